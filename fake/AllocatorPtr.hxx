@@ -34,44 +34,62 @@
 
 #include "util/ConstBuffer.hxx"
 #include "util/StringView.hxx"
+#include "memory/Arena.hxx"
 
-#include <forward_list>
-#include <functional>
-#include <new>
+#include <utility>
 
-#include <stdlib.h>
 #include <string.h>
 
+/**
+ * An #Arena with string helpers.  Everything is freed at once when
+ * this object is destroyed.
+ */
 class Allocator {
-	std::forward_list<std::function<void()>> cleanup;
+	Arena arena;
+
+public:
+	/**
+	 * Allocation counters, e.g. for benchmarks.
+	 */
+	struct Stats {
+		size_t n_allocations, n_bytes;
+	};
+
+private:
+	Stats stats{0, 0};
 
 public:
 	Allocator() = default;
+
+	/**
+	 * @see Arena::Arena()
+	 */
+	explicit Allocator(size_t chunk_size, bool huge=false) noexcept
+		:arena(chunk_size, huge) {}
+
 	Allocator(Allocator &&src) = default;
 
-	~Allocator() {
-		for (auto &i : cleanup)
-			i();
+	Allocator &operator=(Allocator &&src) = delete;
+
+	const Stats &GetStats() const noexcept {
+		return stats;
 	}
 
-	Allocator &operator=(Allocator &&src) = delete;
+	/**
+	 * Free all allocations; see Arena::Clear().  The #Stats are
+	 * not reset.
+	 */
+	void Clear() noexcept {
+		arena.Clear();
+	}
 
 	void *Allocate(size_t size) {
-		void *p = malloc(size);
-		if (p == nullptr)
-			throw std::bad_alloc();
-
-		cleanup.emplace_front([p](){ free(p); });
-		return p;
+		Count(size);
+		return arena.Allocate(size);
 	}
 
 	char *Dup(const char *src) {
-		char *p = strdup(src);
-		if (p == nullptr)
-			throw std::bad_alloc();
-
-		cleanup.emplace_front([p](){ free(p); });
-		return p;
+		return DupZ(src);
 	}
 
 	const char *CheckDup(const char *src) {
@@ -88,28 +106,29 @@ public:
 
 	template<typename T, typename... Args>
 	T *New(Args&&... args) {
-		auto p = new T(std::forward<Args>(args)...);
-		cleanup.emplace_front([p](){ delete p; });
-		return p;
+		Count(sizeof(T));
+		return arena.New<T>(std::forward<Args>(args)...);
 	}
 
 	template<typename T>
 	T *NewArray(size_t n) {
-		auto p = new T[n];
-		cleanup.emplace_front([p](){ delete[] p; });
-		return p;
+		Count(sizeof(T) * n);
+		return arena.NewArray<T>(n);
 	}
 
-	const char *DupZ(StringView src) {
-		char *p = strndup(src.data, src.size);
-		if (p == nullptr)
-			throw std::bad_alloc();
-
-		cleanup.emplace_front([p](){ free(p); });
+	char *DupZ(StringView src) {
+		Count(src.size + 1);
+		char *p = (char *)arena.Allocate(src.size + 1, 1);
+		*(char *)mempcpy(p, src.data, src.size) = 0;
 		return p;
 	}
 
 private:
+	void Count(size_t size) noexcept {
+		++stats.n_allocations;
+		stats.n_bytes += size;
+	}
+
 	template<typename... Args>
 	static size_t ConcatLength(const char *s, Args... args) {
 		return strlen(s) + ConcatLength(args...);
@@ -175,7 +194,12 @@ public:
 		return p;
 	}
 
-	ConstBuffer<void> Dup(ConstBuffer<void> src);
+	ConstBuffer<void> Dup(ConstBuffer<void> src) {
+		if (src.IsNull())
+			return nullptr;
+
+		return {Dup(src.data, src.size), src.size};
+	}
 
 	template<typename T>
 	ConstBuffer<T> Dup(ConstBuffer<T> src) {
@@ -32,18 +32,37 @@
 
 #pragma once
 
+#include "memory/SlicePool.hxx"
 #include "util/ForeignFifoBuffer.hxx"
 
+#include <assert.h>
 #include <stdint.h>
 
 /**
  * A frontend for #SliceFifoBuffer which allows to replace it with a
- * simple heap-allocated buffer when some client code gets copied to
- * another project.
+ * simple buffer when some client code gets copied to another
+ * project.  Buffers are allocated from a per-thread #SlicePool.
+ *
+ * Since #SlicePool is not thread-safe, a buffer must be freed by
+ * the thread which has allocated it, before that thread exits.
  */
 class DefaultFifoBuffer : public ForeignFifoBuffer<uint8_t> {
 	static constexpr size_t SIZE = 8192;
 
+	/**
+	 * The pool which has allocated the buffer; only valid while
+	 * IsDefined().
+	 */
+	SlicePool *pool = nullptr;
+
+	/**
+	 * 256 slices of 8 kB make 2 MB areas.
+	 */
+	static SlicePool &GetPool() noexcept {
+		static thread_local SlicePool pool(SIZE, 256);
+		return pool;
+	}
+
 public:
 	DefaultFifoBuffer():ForeignFifoBuffer(nullptr) {}
 
@@ -52,11 +71,19 @@ public:
 	}
 
 	void Allocate() {
-		SetBuffer(new uint8_t[SIZE], SIZE);
+		pool = &GetPool();
+		SetBuffer((uint8_t *)pool->Alloc(), SIZE);
 	}
 
 	void Free() {
-		delete[] GetBuffer();
+		if (IsDefined()) {
+			/* freeing on another thread would race with
+			   the owner's pool */
+			assert(pool == &GetPool());
+
+			pool->Free(GetBuffer());
+		}
+
 		SetNull();
 	}
 
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ExpandTemplate.hxx"
+#include "AllocatorPtr.hxx"
+#include "util/RuntimeError.hxx"
+
+#include <algorithm>
+
+#include <assert.h>
+#include <string.h>
+
+ExpandTemplate
+ExpandTemplate::Compile(AllocatorPtr alloc, const char *src)
+{
+    ExpandTemplate t;
+    t.source = src;
+
+    /* worst case: one segment per backslash plus the tail */
+    size_t max_segments = 1;
+    for (const char *p = src; (p = strchr(p, '\\')) != nullptr; ++p)
+        ++max_segments;
+
+    Segment *segments = alloc.NewArray<Segment>(max_segments);
+    size_t n = 0;
+
+    /* the start of the pending literal segment */
+    const char *literal = src;
+
+    while (true) {
+        const char *backslash = strchr(src, '\\');
+        if (backslash == nullptr)
+            break;
+
+        const char ch = backslash[1];
+        if (ch == '\\') {
+            /* keep the first backslash in the literal, skip the
+               second one */
+            segments[n++] = {StringView(literal, backslash + 1), NO_CAPTURE};
+            literal = src = backslash + 2;
+        } else if (ch >= '0' && ch <= '9') {
+            const unsigned capture = ch - '0';
+            segments[n++] = {StringView(literal, backslash), capture};
+            t.n_captures = std::max(t.n_captures, capture + 1);
+            literal = src = backslash + 2;
+        } else
+            throw FormatRuntimeError("Invalid backslash escape (0x%02x)",
+                                     (unsigned char)ch);
+    }
+
+    const size_t tail_length = strlen(literal);
+    if (tail_length > 0 || n == 0)
+        segments[n++] = {StringView(literal, tail_length), NO_CAPTURE};
+
+    assert(n <= max_segments);
+
+    for (size_t i = 0; i < n; ++i)
+        t.literal_length += segments[i].literal.size;
+
+    t.segments = {segments, n};
+    return t;
+}
+
+size_t
+ExpandTemplate::GetExpandedLength(ConstBuffer<StringView> captures) const
+{
+    size_t length = literal_length;
+
+    for (const auto &i : segments)
+        if (i.capture != NO_CAPTURE && i.capture < captures.size)
+            length += captures[i.capture].size;
+
+    return length;
+}
+
+char *
+ExpandTemplate::ExpandTo(char *dest, ConstBuffer<StringView> captures) const
+{
+    for (const auto &i : segments) {
+        dest = std::copy_n(i.literal.data, i.literal.size, dest);
+
+        if (i.capture != NO_CAPTURE && i.capture < captures.size) {
+            const StringView c = captures[i.capture];
+            dest = std::copy_n(c.data, c.size, dest);
+        }
+    }
+
+    return dest;
+}
+
+const char *
+ExpandTemplate::Expand(AllocatorPtr alloc,
+                       ConstBuffer<StringView> captures) const
+{
+    assert(!IsNull());
+
+    if (n_captures > captures.size)
+        throw std::runtime_error("Invalid regex capture");
+
+    if (segments.size == 1 && segments.front().capture == NO_CAPTURE &&
+        segments.front().literal.end() == source + strlen(source))
+        /* nothing to expand, and no escaped backslash */
+        return source;
+
+    const size_t length = GetExpandedLength(captures);
+    char *result = alloc.NewArray<char>(length + 1);
+    char *end = ExpandTo(result, captures);
+    assert(end == result + length);
+    *end = 0;
+    return result;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/ConstBuffer.hxx"
+#include "util/StringView.hxx"
+
+#include "util/Compiler.h"
+
+#include <stddef.h>
+
+class AllocatorPtr;
+
+/**
+ * A precompiled EXPAND_* string: the source is scanned for
+ * backslash references ("\1") only once by Compile(), and Expand()
+ * then only needs to concatenate literal segments and regex
+ * captures into a buffer of the exact size.
+ *
+ * The segments point into the source string, which must remain valid
+ * as long as this object is used.
+ */
+class ExpandTemplate {
+    static constexpr unsigned NO_CAPTURE = ~0u;
+
+    struct Segment {
+        /**
+         * Literal text to be copied before the capture.
+         */
+        StringView literal;
+
+        /**
+         * The capture index, or #NO_CAPTURE.
+         */
+        unsigned capture;
+    };
+
+    const char *source = nullptr;
+
+    ConstBuffer<Segment> segments = nullptr;
+
+    /**
+     * The sum of all literal segment lengths.
+     */
+    size_t literal_length = 0;
+
+    /**
+     * The number of captures referenced by this template, i.e. the
+     * highest capture index plus one.
+     */
+    unsigned n_captures = 0;
+
+public:
+    ExpandTemplate() = default;
+
+    /**
+     * Parse the given string.  The allocator is only used for the
+     * segment array, the string is not copied.
+     *
+     * Throws std::runtime_error on error.
+     */
+    static ExpandTemplate Compile(AllocatorPtr alloc, const char *src);
+
+    bool IsNull() const {
+        return source == nullptr;
+    }
+
+    const char *GetSource() const {
+        return source;
+    }
+
+    /**
+     * Does this template contain any capture reference?
+     */
+    bool HasCaptures() const {
+        return n_captures > 0;
+    }
+
+    unsigned GetCaptureCount() const {
+        return n_captures;
+    }
+
+    /**
+     * Calculate the length of the expanded string (without the null
+     * terminator).
+     *
+     * @param captures the regex captures; unmatched captures shall
+     * be empty or null
+     */
+    gcc_pure
+    size_t GetExpandedLength(ConstBuffer<StringView> captures) const;
+
+    /**
+     * Write the expanded string to the given buffer, which must be
+     * at least GetExpandedLength() bytes large.  No null terminator
+     * is written.
+     *
+     * @return the end of the written string
+     */
+    char *ExpandTo(char *dest, ConstBuffer<StringView> captures) const;
+
+    /**
+     * Expand into a newly allocated null-terminated string.  If there
+     * are no captures, the source string is returned.
+     *
+     * Throws std::runtime_error if a capture is referenced which is
+     * not present in the given array.
+     */
+    const char *Expand(AllocatorPtr alloc,
+                       ConstBuffer<StringView> captures) const;
+};
@@ -33,6 +33,7 @@
 #include "ExpandableStringList.hxx"
 #include "AllocatorPtr.hxx"
 #include "util/ConstBuffer.hxx"
+#include "util/StringView.hxx"
 
 #if TRANSLATION_ENABLE_EXPAND
 #include "pexpand.hxx"
@@ -42,23 +43,71 @@
 
 #include <assert.h>
 
-ExpandableStringList::ExpandableStringList(AllocatorPtr alloc,
-                                           const ExpandableStringList &src)
+ExpandableStringList::Item *
+ExpandableStringList::CopyItems(AllocatorPtr alloc, const Item *src, bool dup)
 {
-    Builder builder(*this);
+    size_t n = 0;
+    for (const auto *i = src; i != nullptr; i = i->next)
+        ++n;
+
+    if (n == 0)
+        return nullptr;
+
+    Item *const items = alloc.NewArray<Item>(n);
+    Item *dest = items;
+
+    for (const auto *i = src; i != nullptr; i = i->next, ++dest) {
+        dest->value = dup ? alloc.Dup(i->value) : i->value;
+        dest->next = i->next != nullptr ? dest + 1 : nullptr;
 
-    for (const auto *i = src.head; i != nullptr; i = i->next)
-        builder.Add(alloc, alloc.Dup(i->value),
 #if TRANSLATION_ENABLE_EXPAND
-                    i->expandable
-#else
-                    false
+        dest->expandable = i->expandable;
+
+        if (!i->expand_template.IsNull())
+            /* the template points into the source string; if
+               that was duplicated, compile the copy */
+            dest->expand_template = dup
+                ? ExpandTemplate::Compile(alloc, dest->value)
+                : i->expand_template;
 #endif
-                    );
+    }
+
+    return items;
+}
+
+ExpandableStringList::ExpandableStringList(AllocatorPtr alloc,
+                                           const ExpandableStringList &src)
+    :head(CopyItems(alloc, src.head, true))
+{
+}
+
+void
+ExpandableStringList::Unshare(AllocatorPtr alloc)
+{
+    if (!shared)
+        return;
+
+    head = CopyItems(alloc, head, false);
+    shared = false;
 }
 
 #if TRANSLATION_ENABLE_EXPAND
 
+bool
+ExpandableStringList::PrepareExpand(AllocatorPtr alloc)
+{
+    if (shared) {
+        /* don't bother copying the items if none of them will
+           be modified */
+        if (!IsExpandable())
+            return false;
+
+        Unshare(alloc);
+    }
+
+    return true;
+}
+
 bool
 ExpandableStringList::IsExpandable() const
 {
@@ -72,6 +121,9 @@ ExpandableStringList::IsExpandable() const
 void
 ExpandableStringList::Expand(AllocatorPtr alloc, const MatchInfo &match_info)
 {
+    if (!PrepareExpand(alloc))
+        return;
+
     for (auto *i = head; i != nullptr; i = i->next) {
         if (!i->expandable)
             continue;
@@ -80,6 +132,24 @@ ExpandableStringList::Expand(AllocatorPtr alloc, const MatchInfo &match_info)
     }
 }
 
+void
+ExpandableStringList::Expand(AllocatorPtr alloc,
+                             ConstBuffer<StringView> captures)
+{
+    if (!PrepareExpand(alloc))
+        return;
+
+    for (auto *i = head; i != nullptr; i = i->next) {
+        if (!i->expandable)
+            continue;
+
+        if (i->expand_template.IsNull())
+            i->expand_template = ExpandTemplate::Compile(alloc, i->value);
+
+        i->value = i->expand_template.Expand(alloc, captures);
+    }
+}
+
 #endif
 
 void
@@ -91,6 +161,18 @@ ExpandableStringList::Builder::Add(AllocatorPtr alloc,
     tail_r = &item->next;
 }
 
+#if TRANSLATION_ENABLE_EXPAND
+
+void
+ExpandableStringList::Builder::SetExpand(AllocatorPtr alloc,
+                                         const char *value) const
+{
+    last->expand_template = ExpandTemplate::Compile(alloc, value);
+    SetExpand(value);
+}
+
+#endif
+
 ConstBuffer<const char *>
 ExpandableStringList::ToArray(AllocatorPtr alloc) const
 {
@@ -36,26 +36,41 @@
 #include "translation/Features.hxx"
 #include "util/ShallowCopy.hxx"
 
+#if TRANSLATION_ENABLE_EXPAND
+#include "ExpandTemplate.hxx"
+#endif
+
 #include "util/Compiler.h"
 
 #include <iterator>
 
 class AllocatorPtr;
 class MatchInfo;
+struct StringView;
 template<typename T> struct ConstBuffer;
 
 class ExpandableStringList final {
     struct Item {
         Item *next = nullptr;
 
-        const char *value;
+        const char *value = nullptr;
 
 #if TRANSLATION_ENABLE_EXPAND
-        bool expandable;
+        bool expandable = false;
+
+        /**
+         * The precompiled #value if this item was added with
+         * Builder::SetExpand(AllocatorPtr, const char *).
+         */
+        ExpandTemplate expand_template;
+
+        Item() = default;
 
         Item(const char *_value, bool _expandable)
             :value(_value), expandable(_expandable) {}
 #else
+        Item() = default;
+
         Item(const char *_value, bool)
             :value(_value) {}
 #endif
@@ -63,15 +78,30 @@ class ExpandableStringList final {
 
     Item *head = nullptr;
 
+    /**
+     * Are the items owned by another list?  This is set by the
+     * #ShallowCopy constructor; Expand() copies the items before
+     * modifying them.
+     */
+    bool shared = false;
+
 public:
     ExpandableStringList() = default;
     ExpandableStringList(ExpandableStringList &&) = default;
     ExpandableStringList &operator=(ExpandableStringList &&src) = default;
 
+    /**
+     * Share the items of another list until Expand() modifies
+     * them.  The source list must outlive this object.
+     */
     constexpr ExpandableStringList(ShallowCopy,
                                    const ExpandableStringList &src)
-        :head(src.head) {}
+        :head(src.head), shared(src.head != nullptr) {}
 
+    /**
+     * Make a deep copy; all items are allocated in one contiguous
+     * array.
+     */
     ExpandableStringList(AllocatorPtr alloc, const ExpandableStringList &src);
 
     gcc_pure
@@ -79,6 +109,16 @@ public:
         return head == nullptr;
     }
 
+    bool IsShared() const {
+        return shared;
+    }
+
+    /**
+     * Ensure that the items are owned by this list, copying them
+     * (but not the strings) if they are shared with another list.
+     */
+    void Unshare(AllocatorPtr alloc);
+
     class const_iterator final
         : public std::iterator<std::forward_iterator_tag, const char *> {
 
@@ -114,9 +154,22 @@ public:
     bool IsExpandable() const;
 
     /**
+     * Shared items are copied before they are modified; the
+     * source list remains unchanged.
+     *
      * Throws std::runtime_error on error.
      */
     void Expand(AllocatorPtr alloc, const MatchInfo &match_info);
+
+    /**
+     * Like Expand(AllocatorPtr, const MatchInfo &), but use the
+     * templates precompiled by Builder::SetExpand() and the given
+     * (already unescaped) regex captures.  Items without a template
+     * are compiled on the fly.
+     *
+     * Throws std::runtime_error on error.
+     */
+    void Expand(AllocatorPtr alloc, ConstBuffer<StringView> captures);
 #endif
 
     class Builder final {
@@ -146,10 +199,35 @@ public:
             last->value = value;
             last->expandable = true;
         }
+
+        /**
+         * Like SetExpand(const char *), but precompile the value for
+         * Expand(AllocatorPtr, ConstBuffer<StringView>).
+         *
+         * Throws std::runtime_error if the value is malformed.
+         */
+        void SetExpand(AllocatorPtr alloc, const char *value) const;
 #endif
     };
 
     ConstBuffer<const char *> ToArray(AllocatorPtr alloc) const;
+
+private:
+    /**
+     * Copy a chain of items into one contiguous array.
+     *
+     * @param dup duplicate the strings?
+     */
+    static Item *CopyItems(AllocatorPtr alloc, const Item *src, bool dup);
+
+#if TRANSLATION_ENABLE_EXPAND
+    /**
+     * Prepare for modifying the items in place.
+     *
+     * @return false if there is nothing to be expanded
+     */
+    bool PrepareExpand(AllocatorPtr alloc);
+#endif
 };
 
 #endif
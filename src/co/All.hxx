@@ -0,0 +1,114 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "InvokeTask.hxx"
+
+#include <array>
+
+namespace Co {
+
+/**
+ * Awaitable which runs several tasks concurrently and resumes when
+ * all of them have finished.  Their return values are discarded;
+ * if one throws, the first exception is rethrown after all have
+ * finished.  Do not construct directly; use All().
+ */
+template<size_t N>
+class AllAwaitable {
+	std::array<InvokeTask, N> children;
+
+	std::coroutine_handle<> continuation;
+
+	std::exception_ptr error;
+
+	size_t pending = N;
+
+	/**
+	 * Are the children being started by await_suspend()?
+	 */
+	bool starting = false;
+
+public:
+	template<typename... T>
+	explicit AllAwaitable(Task<T> &... tasks)
+		:children{Wrap(tasks)...} {}
+
+	AllAwaitable(const AllAwaitable &) = delete;
+	AllAwaitable &operator=(const AllAwaitable &) = delete;
+
+	bool await_ready() const noexcept {
+		return N == 0;
+	}
+
+	bool await_suspend(std::coroutine_handle<> _continuation) noexcept {
+		continuation = _continuation;
+
+		starting = true;
+		for (auto &i : children)
+			i.Start(BIND_THIS_METHOD(OnChildComplete));
+		starting = false;
+
+		/* don't suspend if all children have finished
+		   synchronously */
+		return pending > 0;
+	}
+
+	void await_resume() const {
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+private:
+	template<typename T>
+	static InvokeTask Wrap(Task<T> &task) {
+		co_await task;
+	}
+
+	void OnChildComplete(std::exception_ptr _error) noexcept {
+		if (_error && !error)
+			error = std::move(_error);
+
+		if (--pending == 0 && !starting)
+			continuation.resume();
+	}
+};
+
+template<typename... T>
+AllAwaitable<sizeof...(T)>
+All(Task<T> &... tasks)
+{
+	return AllAwaitable<sizeof...(T)>(tasks...);
+}
+
+} // namespace Co
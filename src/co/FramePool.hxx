@@ -0,0 +1,180 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <array>
+#include <new>
+
+#include <stddef.h>
+
+namespace Co {
+
+/**
+ * Allocator for coroutine frames which recycles freed frames, like
+ * #Recycler does for objects.  Frames are grouped in size classes;
+ * larger frames are passed through to the global allocator.
+ *
+ * This class is not thread-safe.  Each thread (i.e. each
+ * #EventLoop) has its own instance, see GetFramePool().
+ */
+class FramePool {
+	static constexpr size_t GRANULARITY = 64;
+	static constexpr size_t N_CLASSES = 16;
+
+	/**
+	 * The maximum number of free frames kept in each class.
+	 */
+	static constexpr size_t MAX_FREE = 64;
+
+	struct FreeFrame {
+		FreeFrame *next;
+	};
+
+	struct Class {
+		FreeFrame *head = nullptr;
+		size_t n_free = 0;
+	};
+
+	std::array<Class, N_CLASSES> classes;
+
+public:
+	static constexpr size_t MAX_SIZE = GRANULARITY * N_CLASSES;
+
+	struct Stats {
+		/**
+		 * The number of frames allocated from the global
+		 * allocator.
+		 */
+		size_t allocated = 0;
+
+		/**
+		 * The number of frames served from the free lists.
+		 */
+		size_t recycled = 0;
+	};
+
+private:
+	Stats stats;
+
+public:
+	FramePool() = default;
+
+	~FramePool() noexcept {
+		Clear();
+	}
+
+	FramePool(const FramePool &) = delete;
+	FramePool &operator=(const FramePool &) = delete;
+
+	const Stats &GetStats() const noexcept {
+		return stats;
+	}
+
+	/**
+	 * Throws std::bad_alloc on error.
+	 */
+	void *Allocate(size_t size) {
+		if (size > MAX_SIZE) {
+			++stats.allocated;
+			return ::operator new(size);
+		}
+
+		auto &c = classes[ClassIndex(size)];
+		if (c.head != nullptr) {
+			FreeFrame *f = c.head;
+			c.head = f->next;
+			--c.n_free;
+			++stats.recycled;
+			return f;
+		}
+
+		++stats.allocated;
+		return ::operator new(ClassSize(size));
+	}
+
+	/**
+	 * @param size the size which was passed to Allocate()
+	 */
+	void Free(void *p, size_t size) noexcept {
+		if (size > MAX_SIZE) {
+			::operator delete(p);
+			return;
+		}
+
+		auto &c = classes[ClassIndex(size)];
+		if (c.n_free >= MAX_FREE) {
+			::operator delete(p);
+			return;
+		}
+
+		auto *f = new(p) FreeFrame{c.head};
+		c.head = f;
+		++c.n_free;
+	}
+
+	/**
+	 * Release all free frames to the global allocator.
+	 */
+	void Clear() noexcept {
+		for (auto &c : classes) {
+			while (c.head != nullptr) {
+				FreeFrame *f = c.head;
+				c.head = f->next;
+				::operator delete(f);
+			}
+
+			c.n_free = 0;
+		}
+	}
+
+private:
+	static constexpr size_t ClassIndex(size_t size) noexcept {
+		return size > 0 ? (size - 1) / GRANULARITY : 0;
+	}
+
+	static constexpr size_t ClassSize(size_t size) noexcept {
+		return (ClassIndex(size) + 1) * GRANULARITY;
+	}
+};
+
+/**
+ * Returns the calling thread's #FramePool.
+ */
+inline FramePool &
+GetFramePool() noexcept
+{
+	static thread_local FramePool pool;
+	return pool;
+}
+
+} // namespace Co
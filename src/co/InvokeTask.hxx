@@ -0,0 +1,135 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Task.hxx"
+#include "util/BindMethod.hxx"
+
+#include <cassert>
+
+namespace Co {
+
+/**
+ * A coroutine which can be launched from callback-based code: it
+ * starts when Start() is called, and the given callback is invoked
+ * when it finishes.  Destroying the #InvokeTask cancels the
+ * coroutine.
+ *
+ * Example:
+ *
+ *     Co::InvokeTask Run() { co_await Co::Sleep(loop, 1s); }
+ *
+ *     task = Run();
+ *     task.Start(BIND_THIS_METHOD(OnTaskComplete));
+ */
+class [[nodiscard]] InvokeTask {
+public:
+	/**
+	 * @param error the exception thrown by the coroutine, or
+	 * nullptr on success
+	 */
+	using Callback = BoundMethod<void(std::exception_ptr error) noexcept>;
+
+	struct promise_type : detail::PromiseBase {
+		Callback callback = nullptr;
+
+		InvokeTask get_return_object() noexcept {
+			return InvokeTask(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		void return_void() noexcept {}
+
+		struct FinalAwaiter {
+			bool await_ready() const noexcept {
+				return false;
+			}
+
+			void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+				auto &p = h.promise();
+				const auto callback = p.callback;
+				auto error = std::move(p.error);
+
+				/* the callback may destroy the
+				   #InvokeTask (and this frame) */
+				callback(std::move(error));
+			}
+
+			void await_resume() const noexcept {}
+		};
+
+		FinalAwaiter final_suspend() noexcept {
+			return {};
+		}
+	};
+
+private:
+	std::coroutine_handle<promise_type> coroutine;
+
+	explicit InvokeTask(std::coroutine_handle<promise_type> _coroutine) noexcept
+		:coroutine(_coroutine) {}
+
+public:
+	InvokeTask() = default;
+
+	InvokeTask(InvokeTask &&src) noexcept
+		:coroutine(std::exchange(src.coroutine, nullptr)) {}
+
+	~InvokeTask() noexcept {
+		if (coroutine)
+			coroutine.destroy();
+	}
+
+	InvokeTask &operator=(InvokeTask &&src) noexcept {
+		using std::swap;
+		swap(coroutine, src.coroutine);
+		return *this;
+	}
+
+	bool IsDefined() const noexcept {
+		return (bool)coroutine;
+	}
+
+	/**
+	 * Start the coroutine.  If it finishes synchronously, the
+	 * callback is invoked before this method returns.
+	 */
+	void Start(Callback callback) noexcept {
+		assert(coroutine);
+		assert(!coroutine.promise().callback);
+
+		coroutine.promise().callback = callback;
+		coroutine.resume();
+	}
+};
+
+} // namespace Co
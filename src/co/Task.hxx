@@ -0,0 +1,203 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "FramePool.hxx"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Coroutine support (requires C++20).  Coroutine frames are
+ * allocated from the thread's #FramePool, so once it is warm,
+ * starting a coroutine does not allocate heap memory.
+ *
+ * Awaitables for libcommon operations live next to the classes they
+ * wrap, e.g. event/co/Sleep.hxx and event/net/co/ConnectSocket.hxx.
+ * They start their operation eagerly on construction, so several
+ * operations can be pipelined by constructing them first and
+ * awaiting them later; destroying an awaitable cancels its
+ * operation.
+ */
+
+namespace Co {
+
+namespace detail {
+
+/**
+ * Common code for all promise types in this library.
+ */
+struct PromiseBase {
+	std::coroutine_handle<> continuation;
+
+	std::exception_ptr error;
+
+	static void *operator new(size_t size) {
+		return GetFramePool().Allocate(size);
+	}
+
+	static void operator delete(void *p, size_t size) noexcept {
+		GetFramePool().Free(p, size);
+	}
+
+	std::suspend_always initial_suspend() noexcept {
+		return {};
+	}
+
+	/**
+	 * Resume the awaiting coroutine (symmetric transfer).
+	 */
+	struct FinalAwaiter {
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		template<typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+			auto c = h.promise().continuation;
+			return c ? c : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	FinalAwaiter final_suspend() noexcept {
+		return {};
+	}
+
+	void unhandled_exception() noexcept {
+		error = std::current_exception();
+	}
+
+	void RethrowError() const {
+		if (error)
+			std::rethrow_exception(error);
+	}
+};
+
+template<typename T>
+struct ValuePromise : PromiseBase {
+	std::optional<T> value;
+
+	template<typename U>
+	void return_value(U &&_value) {
+		value.emplace(std::forward<U>(_value));
+	}
+
+	T TakeValue() {
+		RethrowError();
+		return std::move(*value);
+	}
+};
+
+struct VoidPromise : PromiseBase {
+	void return_void() noexcept {}
+
+	void TakeValue() const {
+		RethrowError();
+	}
+};
+
+} // namespace detail
+
+/**
+ * A lazily started coroutine which returns a value of type T (or
+ * throws).  It starts when it gets awaited, and it resumes the
+ * awaiting coroutine when it finishes.  Destroying the #Task
+ * destroys the coroutine frame, cancelling whatever it awaits.
+ */
+template<typename T=void>
+class [[nodiscard]] Task {
+public:
+	struct promise_type
+		: std::conditional_t<std::is_void_v<T>,
+				     detail::VoidPromise,
+				     detail::ValuePromise<T>> {
+		Task get_return_object() noexcept {
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+	};
+
+private:
+	std::coroutine_handle<promise_type> coroutine;
+
+	explicit Task(std::coroutine_handle<promise_type> _coroutine) noexcept
+		:coroutine(_coroutine) {}
+
+public:
+	Task() = default;
+
+	Task(Task &&src) noexcept
+		:coroutine(std::exchange(src.coroutine, nullptr)) {}
+
+	~Task() noexcept {
+		if (coroutine)
+			coroutine.destroy();
+	}
+
+	Task &operator=(Task &&src) noexcept {
+		using std::swap;
+		swap(coroutine, src.coroutine);
+		return *this;
+	}
+
+	bool IsDefined() const noexcept {
+		return (bool)coroutine;
+	}
+
+	struct Awaiter {
+		std::coroutine_handle<promise_type> coroutine;
+
+		bool await_ready() const noexcept {
+			return coroutine.done();
+		}
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+			coroutine.promise().continuation = continuation;
+			return coroutine;
+		}
+
+		decltype(auto) await_resume() {
+			return coroutine.promise().TakeValue();
+		}
+	};
+
+	Awaiter operator co_await() const noexcept {
+		return {coroutine};
+	}
+};
+
+} // namespace Co
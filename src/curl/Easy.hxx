@@ -87,6 +87,14 @@ public:
 		return handle;
 	}
 
+	/**
+	 * Reset all options to their defaults.  Live connections,
+	 * the DNS cache and the TLS session cache are kept.
+	 */
+	void Reset() {
+		curl_easy_reset(handle);
+	}
+
 	template<typename T>
 	void SetOption(CURLoption option, T value) {
 		CURLcode code = curl_easy_setopt(handle, option, value);
@@ -118,6 +126,24 @@ public:
 		SetOption(CURLOPT_USERPWD, userpwd);
 	}
 
+	void SetShare(CURLSH *share) {
+		SetOption(CURLOPT_SHARE, share);
+	}
+
+	void SetHttpVersion(long version) {
+		SetOption(CURLOPT_HTTP_VERSION, version);
+	}
+
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/**
+	 * Wait for an existing connection to confirm whether it can
+	 * multiplex, instead of opening a new connection.
+	 */
+	void SetPipeWait(bool value=true) {
+		SetOption(CURLOPT_PIPEWAIT, (long)value);
+	}
+#endif
+
 	void SetNoProgress(bool value=true) {
 		SetOption(CURLOPT_NOPROGRESS, (long)value);
 	}
@@ -149,6 +175,13 @@ public:
 		SetOption(CURLOPT_WRITEDATA, userdata);
 	}
 
+	void SetReadFunction(size_t (*function)(char *buffer, size_t size,
+						size_t nitems, void *userdata),
+			     void *userdata) {
+		SetOption(CURLOPT_READFUNCTION, function);
+		SetOption(CURLOPT_READDATA, userdata);
+	}
+
 	void SetNoBody(bool value=true) {
 		SetOption(CURLOPT_NOBODY, (long)value);
 	}
@@ -162,6 +195,15 @@ public:
 		SetOption(CURLOPT_POSTFIELDSIZE, (long)size);
 	}
 
+	/**
+	 * Set the size of a request body which is provided by the
+	 * CURLOPT_READFUNCTION; -1 means unknown (i.e. chunked
+	 * transfer encoding).
+	 */
+	void SetRequestBodySize(curl_off_t size) {
+		SetOption(CURLOPT_POSTFIELDSIZE_LARGE, size);
+	}
+
 	void SetHttpPost(const struct curl_httppost *post) {
 		SetOption(CURLOPT_HTTPPOST, post);
 	}
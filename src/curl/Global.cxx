@@ -29,6 +29,7 @@
 
 #include "Global.hxx"
 #include "Request.hxx"
+#include "Stats.hxx"
 #include "event/SocketEvent.hxx"
 #include "util/RuntimeError.hxx"
 
@@ -118,6 +119,61 @@ CurlGlobal::CurlGlobal(EventLoop &_loop)
 
 	multi.SetOption(CURLMOPT_TIMERFUNCTION, TimerFunction);
 	multi.SetOption(CURLMOPT_TIMERDATA, this);
+
+	share.Share(CURL_LOCK_DATA_DNS);
+	share.Share(CURL_LOCK_DATA_SSL_SESSION);
+}
+
+void
+CurlGlobal::EnableMultiplex()
+{
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	multi.SetOption(CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	multiplex = true;
+#else
+	throw std::runtime_error("HTTP/2 multiplexing requires libcurl 7.43");
+#endif
+}
+
+CurlEasy
+CurlGlobal::ObtainEasy()
+{
+	if (idle_easy.empty())
+		return CurlEasy();
+
+	CurlEasy easy = std::move(idle_easy.back());
+	idle_easy.pop_back();
+	return easy;
+}
+
+void
+CurlGlobal::ReleaseEasy(CurlEasy &&_easy) noexcept
+{
+	CurlEasy easy(std::move(_easy));
+	if (!easy || idle_easy.size() >= MAX_IDLE_EASY)
+		return;
+
+	/* reset now, so the handle does not keep pointers to the
+	   old request */
+	easy.Reset();
+	idle_easy.emplace_back(std::move(easy));
+}
+
+void
+CurlGlobal::Configure(CurlEasy &easy)
+{
+	easy.SetShare(share.Get());
+
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	if (multiplex) {
+#if LIBCURL_VERSION_NUM >= 0x072f00
+		easy.SetHttpVersion(CURL_HTTP_VERSION_2TLS);
+#else
+		easy.SetHttpVersion(CURL_HTTP_VERSION_2_0);
+#endif
+		easy.SetPipeWait();
+	}
+#endif
 }
 
 int
@@ -199,8 +255,13 @@ CurlGlobal::ReadInfo()
 
 	while ((msg = curl_multi_info_read(multi.Get(),
 					   &msgs_in_queue)) != nullptr) {
-		if (msg->msg == CURLMSG_DONE)
+		if (msg->msg == CURLMSG_DONE) {
+			if (instrumentation != nullptr)
+				instrumentation->Record(msg->easy_handle,
+							msg->data.result);
+
 			Done(msg->easy_handle, msg->data.result);
+		}
 	}
 }
 
@@ -31,11 +31,16 @@
 #define CURL_GLOBAL_HXX
 
 #include "Multi.hxx"
+#include "Share.hxx"
+#include "Easy.hxx"
 #include "event/TimerEvent.hxx"
 #include "event/DeferEvent.hxx"
 
+#include <vector>
+
 class CurlSocket;
 class CurlRequest;
+class CurlInstrumentation;
 
 /**
  * Manager for the global CURLM object.
@@ -43,8 +48,27 @@ class CurlRequest;
 class CurlGlobal final {
 	EventLoop &event_loop;
 
+	/**
+	 * Shares the DNS cache and the TLS session cache among all
+	 * easy handles.  Declared before #multi and #idle_easy
+	 * because it must outlive all easy handles.
+	 */
+	CurlShare share;
+
 	CurlMulti multi;
 
+	/**
+	 * Easy handles released by finished requests, to be reused
+	 * by ObtainEasy().
+	 */
+	std::vector<CurlEasy> idle_easy;
+
+	static constexpr std::size_t MAX_IDLE_EASY = 64;
+
+	bool multiplex = false;
+
+	CurlInstrumentation *instrumentation = nullptr;
+
 	DeferEvent read_info_event;
 	TimerEvent timeout_event;
 
@@ -55,6 +79,61 @@ public:
 		return event_loop;
 	}
 
+	/**
+	 * Enable HTTP/2 multiplexing: requests to the same host share
+	 * one connection, and new requests prefer waiting for an
+	 * existing connection over opening a new one.
+	 *
+	 * Throws std::runtime_error if libcurl does not support
+	 * this.
+	 */
+	void EnableMultiplex();
+
+	/**
+	 * Limit the number of connections to a single host
+	 * (CURLMOPT_MAX_HOST_CONNECTIONS); 0 means unlimited.
+	 */
+	void SetMaxHostConnections(long n) {
+		multi.SetOption(CURLMOPT_MAX_HOST_CONNECTIONS, n);
+	}
+
+	/**
+	 * Limit the total number of connections
+	 * (CURLMOPT_MAX_TOTAL_CONNECTIONS); 0 means unlimited.
+	 */
+	void SetMaxTotalConnections(long n) {
+		multi.SetOption(CURLMOPT_MAX_TOTAL_CONNECTIONS, n);
+	}
+
+	/**
+	 * Obtain an easy handle with default options, preferably a
+	 * recycled one.  Pass it back with ReleaseEasy() when done.
+	 *
+	 * Throws std::runtime_error on error.
+	 */
+	CurlEasy ObtainEasy();
+
+	/**
+	 * Return an easy handle which is not used anymore; it may be
+	 * recycled by ObtainEasy().  It must not be registered with
+	 * the multi handle.
+	 */
+	void ReleaseEasy(CurlEasy &&easy) noexcept;
+
+	/**
+	 * Apply global settings (sharing, multiplexing) to an easy
+	 * handle.  Called by #CurlRequest.
+	 */
+	void Configure(CurlEasy &easy);
+
+	/**
+	 * Account all finished transfers in the given object.  Pass
+	 * nullptr to disable.
+	 */
+	void SetInstrumentation(CurlInstrumentation *_instrumentation) noexcept {
+		instrumentation = _instrumentation;
+	}
+
 	void Add(CurlRequest &r);
 	void Remove(CurlRequest &r);
 
@@ -36,8 +36,22 @@
 #include <string>
 #include <map>
 
+class CurlHeaderList;
+
 class CurlResponseHandler {
 public:
+	/**
+	 * The response headers have been received.  The default
+	 * implementation copies them to a std::multimap (with
+	 * lower-case names) and calls the other overload; override
+	 * this one to avoid those allocations (or derive from
+	 * #CurlHeaderListHandler).
+	 *
+	 * @param headers the headers; only valid during this call
+	 */
+	virtual void OnHeaders(unsigned status,
+			       const CurlHeaderList &headers);
+
 	virtual void OnHeaders(unsigned status,
 			       std::multimap<std::string, std::string> &&headers) = 0;
 	virtual void OnData(ConstBuffer<void> data) = 0;
@@ -45,4 +59,31 @@ public:
 	virtual void OnError(std::exception_ptr e) = 0;
 };
 
+/**
+ * Handler for a request body streamed with
+ * CurlRequest::StreamUpload().
+ */
+class CurlUploadHandler {
+public:
+	/**
+	 * The upload buffer has room again after
+	 * CurlRequest::WriteUpload() has accepted less than it was
+	 * given.
+	 */
+	virtual void OnUploadReady() = 0;
+};
+
+/**
+ * A #CurlResponseHandler which receives only the #CurlHeaderList.
+ */
+class CurlHeaderListHandler : public CurlResponseHandler {
+public:
+	void OnHeaders(unsigned status,
+		       const CurlHeaderList &headers) override = 0;
+
+private:
+	void OnHeaders(unsigned,
+		       std::multimap<std::string, std::string> &&) final {}
+};
+
 #endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2016 Max Kellermann <max@duempel.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CURL_HEADER_LIST_HXX
+#define CURL_HEADER_LIST_HXX
+
+#include "http/HeaderName.hxx"
+#include "util/StringView.hxx"
+#include "util/Compiler.h"
+
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+struct CurlHeader {
+	StringView name, value;
+};
+
+/**
+ * A list of HTTP response headers.  All names and values are
+ * copied into one buffer owned by this object, so adding a header
+ * does not allocate (except for growing the buffer).  Names are
+ * stored as received; use Get() for case-insensitive lookups.
+ */
+class CurlHeaderList {
+	/**
+	 * All names and values, concatenated.
+	 */
+	std::string buffer;
+
+	struct Item {
+		uint32_t name_offset, name_size;
+		uint32_t value_offset, value_size;
+	};
+
+	std::vector<Item> items;
+
+	CurlHeader ToHeader(const Item &item) const noexcept {
+		return {
+			{buffer.data() + item.name_offset, item.name_size},
+			{buffer.data() + item.value_offset, item.value_size},
+		};
+	}
+
+public:
+	class const_iterator {
+		const CurlHeaderList &list;
+		std::vector<Item>::const_iterator i;
+
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef CurlHeader value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const CurlHeader *pointer;
+		typedef CurlHeader reference;
+
+		const_iterator(const CurlHeaderList &_list,
+			       std::vector<Item>::const_iterator _i) noexcept
+			:list(_list), i(_i) {}
+
+		const_iterator &operator++() noexcept {
+			++i;
+			return *this;
+		}
+
+		CurlHeader operator*() const noexcept {
+			return list.ToHeader(*i);
+		}
+
+		bool operator==(const const_iterator &other) const noexcept {
+			return i == other.i;
+		}
+
+		bool operator!=(const const_iterator &other) const noexcept {
+			return i != other.i;
+		}
+	};
+
+	bool empty() const noexcept {
+		return items.empty();
+	}
+
+	std::size_t size() const noexcept {
+		return items.size();
+	}
+
+	const_iterator begin() const noexcept {
+		return {*this, items.begin()};
+	}
+
+	const_iterator end() const noexcept {
+		return {*this, items.end()};
+	}
+
+	CurlHeader operator[](std::size_t i) const noexcept {
+		return ToHeader(items[i]);
+	}
+
+	/**
+	 * Remove all headers, but keep the allocated memory.
+	 */
+	void clear() noexcept {
+		buffer.clear();
+		items.clear();
+	}
+
+	void Add(StringView name, StringView value);
+
+	/**
+	 * Look up the first header with the given name
+	 * (case-insensitive).
+	 *
+	 * @return the value or a nullptr #StringView if there is no
+	 * such header
+	 */
+	gcc_pure
+	StringView Get(StringView name) const noexcept;
+
+	/**
+	 * Invoke a function for the value of each header with the
+	 * given name (case-insensitive).
+	 */
+	template<typename F>
+	void ForEach(StringView name, F &&f) const {
+		for (const auto &i : *this)
+			if (http_header_name_equals(i.name, name))
+				f(i.value);
+	}
+};
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2008-2018 Max Kellermann <max@duempel.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "OcspFetcher.hxx"
+#include "Global.hxx"
+#include "Request.hxx"
+#include "Handler.hxx"
+#include "Slist.hxx"
+#include "ssl/OcspStapler.hxx"
+#include "event/Duration.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/RuntimeError.hxx"
+
+#include <algorithm>
+
+constexpr size_t CurlOcspFetcher::MAX_PARALLEL;
+constexpr size_t CurlOcspFetcher::MAX_RESPONSE_SIZE;
+
+class CurlOcspFetcher::Fetch final
+	: public FetchHook, CurlResponseHandler {
+
+	CurlOcspFetcher &fetcher;
+
+	const SslOcspStapler::Key key;
+
+	/**
+	 * The DER-encoded OCSP request.  It must stay alive until
+	 * the transfer is finished because libcurl doesn't copy it.
+	 */
+	const std::string body;
+
+	CurlSlist headers;
+
+	std::string response;
+
+	CurlRequest request;
+
+public:
+	Fetch(CurlOcspFetcher &_fetcher, SslOcspStapler::Request &&r)
+		:fetcher(_fetcher), key(r.key), body(std::move(r.body)),
+		 headers(MakeHeaders()),
+		 request(fetcher.global,
+			 MakeEasy(fetcher.global, r.url.c_str(), body, headers),
+			 *this) {}
+
+	const SslOcspStapler::Key &GetKey() const noexcept {
+		return key;
+	}
+
+	void Start() {
+		request.Start();
+	}
+
+private:
+	static CurlSlist MakeHeaders() {
+		CurlSlist result;
+		result.Append("Content-Type: application/ocsp-request");
+		return result;
+	}
+
+	static CurlEasy MakeEasy(CurlGlobal &global, const char *url,
+				 const std::string &body,
+				 CurlSlist &headers) {
+		CurlEasy easy = global.ObtainEasy();
+		easy.SetURL(url);
+		easy.SetPost();
+		easy.SetRequestBody(body.data(), body.size());
+		easy.SetRequestHeaders(headers.Get());
+		easy.SetOption(CURLOPT_TIMEOUT, 30L);
+		return easy;
+	}
+
+	/* virtual methods from CurlResponseHandler */
+	void OnHeaders(unsigned status,
+		       std::multimap<std::string, std::string> &&) override {
+		if (status != 200)
+			throw FormatRuntimeError("OCSP responder status %u",
+						 status);
+	}
+
+	void OnData(ConstBuffer<void> data) override {
+		if (response.size() + data.size > MAX_RESPONSE_SIZE)
+			throw std::runtime_error("OCSP response too large");
+
+		response.append((const char *)data.data, data.size);
+	}
+
+	void OnEnd() override {
+		try {
+			fetcher.stapler.OnResponse(key, {response.data(), response.size()});
+		} catch (...) {
+			/* the stapler has already scheduled a
+			   retry */
+		}
+
+		fetcher.OnFetchDone(*this);
+	}
+
+	void OnError(std::exception_ptr) override {
+		fetcher.stapler.OnError(key);
+		fetcher.OnFetchDone(*this);
+	}
+};
+
+CurlOcspFetcher::CurlOcspFetcher(CurlGlobal &_global,
+				 SslOcspStapler &_stapler) noexcept
+	:global(_global), stapler(_stapler),
+	 timer(global.GetEventLoop(), BIND_THIS_METHOD(OnTimer)) {}
+
+CurlOcspFetcher::~CurlOcspFetcher() noexcept
+{
+	Stop();
+}
+
+void
+CurlOcspFetcher::Start() noexcept
+{
+	timer.Add(EventDuration<0>::value);
+}
+
+void
+CurlOcspFetcher::Stop() noexcept
+{
+	timer.Cancel();
+
+	fetches.clear_and_dispose([this](Fetch *fetch){
+		stapler.OnError(fetch->GetKey());
+		delete fetch;
+	});
+}
+
+void
+CurlOcspFetcher::Schedule() noexcept
+{
+	if (fetches.size() >= MAX_PARALLEL)
+		/* OnFetchDone() will reschedule */
+		return;
+
+	/* wake up at least hourly, to pick up certificates which
+	   were added in the meantime */
+	constexpr SslOcspStapler::Clock::duration max_delay = std::chrono::hours(1);
+
+	const auto now = SslOcspStapler::Clock::now();
+	const auto next = stapler.GetNextRefresh();
+
+	SslOcspStapler::Clock::duration delay = max_delay;
+	if (next <= now)
+		delay = SslOcspStapler::Clock::duration::zero();
+	else if (next - now < max_delay)
+		delay = next - now;
+
+	timer.Add(ToEventDuration(std::chrono::duration_cast<std::chrono::microseconds>(delay)));
+}
+
+void
+CurlOcspFetcher::OnFetchDone(Fetch &fetch) noexcept
+{
+	fetches.erase(fetches.iterator_to(fetch));
+	delete &fetch;
+
+	Schedule();
+}
+
+void
+CurlOcspFetcher::OnTimer() noexcept
+{
+	const auto now = SslOcspStapler::Clock::now();
+
+	std::vector<SslOcspStapler::Request> requests;
+	try {
+		requests = stapler.CollectDue(now,
+					      MAX_PARALLEL - fetches.size());
+	} catch (...) {
+		/* out of memory or an OpenSSL failure; try again
+		   later */
+		timer.Add(EventDuration<60>::value);
+		return;
+	}
+
+	for (auto &r : requests) {
+		const auto key = r.key;
+
+		try {
+			auto *fetch = new Fetch(*this, std::move(r));
+			fetches.push_back(*fetch);
+
+			try {
+				fetch->Start();
+			} catch (...) {
+				fetches.erase(fetches.iterator_to(*fetch));
+				delete fetch;
+				throw;
+			}
+		} catch (...) {
+			stapler.OnError(key);
+		}
+	}
+
+	Schedule();
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2008-2018 Max Kellermann <max@duempel.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CURL_OCSP_FETCHER_HXX
+#define CURL_OCSP_FETCHER_HXX
+
+#include "event/TimerEvent.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+class CurlGlobal;
+class SslOcspStapler;
+
+/**
+ * Fetches OCSP responses for all certificates registered in a
+ * #SslOcspStapler from their responders, and refreshes them ahead
+ * of expiry.  Each due certificate is one POST request; up to
+ * #MAX_PARALLEL of them run concurrently on the #CurlGlobal, so a
+ * large number of certificates shares the connections to a few
+ * responders instead of stalling the TLS handshakes.
+ *
+ * This class is not thread-safe; it must be used in the event loop
+ * thread of the #CurlGlobal.
+ */
+class CurlOcspFetcher final {
+	CurlGlobal &global;
+	SslOcspStapler &stapler;
+
+	TimerEvent timer;
+
+	typedef boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> FetchHook;
+
+	class Fetch;
+
+	boost::intrusive::list<Fetch,
+			       boost::intrusive::base_hook<FetchHook>,
+			       boost::intrusive::constant_time_size<true>> fetches;
+
+	/**
+	 * The maximum number of concurrent requests.
+	 */
+	static constexpr size_t MAX_PARALLEL = 16;
+
+	/**
+	 * Responses larger than this are rejected.
+	 */
+	static constexpr size_t MAX_RESPONSE_SIZE = 65536;
+
+public:
+	CurlOcspFetcher(CurlGlobal &_global,
+			SslOcspStapler &_stapler) noexcept;
+	~CurlOcspFetcher() noexcept;
+
+	CurlOcspFetcher(const CurlOcspFetcher &) = delete;
+	CurlOcspFetcher &operator=(const CurlOcspFetcher &) = delete;
+
+	/**
+	 * Start fetching all due responses now.  Call this after
+	 * certificates have been added to the #SslOcspStapler.
+	 */
+	void Start() noexcept;
+
+	/**
+	 * Cancel all pending requests and the refresh timer.
+	 */
+	void Stop() noexcept;
+
+private:
+	/**
+	 * Arm the timer for the next refresh.
+	 */
+	void Schedule() noexcept;
+
+	void OnFetchDone(Fetch &fetch) noexcept;
+
+	void OnTimer() noexcept;
+};
+
+#endif
@@ -31,6 +31,7 @@
 #include "Global.hxx"
 #include "Version.hxx"
 #include "Handler.hxx"
+#include "memory/SlicePool.hxx"
 #include "util/RuntimeError.hxx"
 #include "util/StringUtil.hxx"
 #include "util/StringView.hxx"
@@ -45,8 +46,9 @@
 
 CurlRequest::CurlRequest(CurlGlobal &_global, const char *url,
 			 CurlResponseHandler &_handler)
-	:CurlRequest(_global, CurlEasy(url), _handler)
+	:CurlRequest(_global, _global.ObtainEasy(), _handler)
 {
+	easy.SetURL(url);
 }
 
 CurlRequest::CurlRequest(CurlGlobal &_global, CurlEasy &&_easy,
@@ -54,10 +56,13 @@ CurlRequest::CurlRequest(CurlGlobal &_global, CurlEasy &&_easy,
 	:global(_global), handler(_handler),
 	 easy(std::move(_easy)),
 	 defer_error_event(global.GetEventLoop(),
-			   BIND_THIS_METHOD(OnDeferredError))
+			   BIND_THIS_METHOD(OnDeferredError)),
+	 defer_upload_event(global.GetEventLoop(),
+			    BIND_THIS_METHOD(OnDeferredUploadReady))
 {
 	error_buffer[0] = 0;
 
+	global.Configure(easy);
 	easy.SetPrivate((void *)this);
 	easy.SetUserAgent(PACKAGE " " VERSION);
 	easy.SetHeaderFunction(_HeaderFunction, this);
@@ -71,6 +76,7 @@ CurlRequest::CurlRequest(CurlGlobal &_global, CurlEasy &&_easy,
 CurlRequest::~CurlRequest()
 {
 	FreeEasy();
+	FreeUploadBuffer();
 }
 
 void
@@ -99,7 +105,7 @@ CurlRequest::FreeEasy()
 		return;
 
 	Stop();
-	easy = nullptr;
+	global.ReleaseEasy(std::move(easy));
 }
 
 void
@@ -107,7 +113,9 @@ CurlRequest::Resume()
 {
 	assert(registered);
 
-	curl_easy_pause(easy.Get(), CURLPAUSE_CONT);
+	receive_paused = false;
+	curl_easy_pause(easy.Get(),
+			upload_paused ? CURLPAUSE_SEND : CURLPAUSE_CONT);
 
 	if (IsCurlOlderThan(0x072000))
 		/* libcurl older than 7.32.0 does not update
@@ -118,6 +126,139 @@ CurlRequest::Resume()
 	global.InvalidateSockets();
 }
 
+void
+CurlRequest::StreamUpload(CurlUploadHandler &_handler, int64_t size,
+			  SlicePool *pool, size_t buffer_size)
+{
+	assert(!registered);
+	assert(upload_buffer.IsNull());
+
+	if (pool != nullptr) {
+		upload_buffer.SetBuffer((uint8_t *)pool->Alloc(),
+					pool->GetSliceSize());
+		upload_pool = pool;
+	} else
+		upload_buffer.SetBuffer(new uint8_t[buffer_size],
+					buffer_size);
+
+	upload_handler = &_handler;
+
+	easy.SetPost();
+	easy.SetReadFunction(ReadFunction, this);
+	easy.SetRequestBodySize(size);
+}
+
+void
+CurlRequest::FreeUploadBuffer() noexcept
+{
+	if (upload_buffer.IsNull())
+		return;
+
+	defer_upload_event.Cancel();
+
+	if (upload_pool != nullptr)
+		upload_pool->Free(upload_buffer.GetBuffer());
+	else
+		delete[] upload_buffer.GetBuffer();
+
+	upload_buffer.SetNull();
+}
+
+size_t
+CurlRequest::WriteUpload(ConstBuffer<void> _src)
+{
+	assert(!upload_buffer.IsNull());
+	assert(!upload_eof);
+
+	const auto src = ConstBuffer<uint8_t>::FromVoid(_src);
+
+	/* make room at the tail if necessary */
+	upload_buffer.WantWrite(std::min(src.size,
+					 upload_buffer.GetCapacity() -
+					 upload_buffer.GetAvailable()));
+
+	auto w = upload_buffer.Write();
+	const size_t n = std::min(w.size, src.size);
+	std::copy_n(src.data, n, w.data);
+	upload_buffer.Append(n);
+
+	if (n < src.size)
+		upload_full = true;
+
+	if (n > 0 && upload_paused)
+		ResumeUpload();
+
+	return n;
+}
+
+void
+CurlRequest::EndUpload()
+{
+	assert(!upload_buffer.IsNull());
+	assert(!upload_eof);
+
+	upload_eof = true;
+
+	if (upload_paused)
+		ResumeUpload();
+}
+
+void
+CurlRequest::ResumeUpload()
+{
+	assert(upload_paused);
+
+	upload_paused = false;
+
+	if (!registered)
+		return;
+
+	curl_easy_pause(easy.Get(),
+			receive_paused ? CURLPAUSE_RECV : CURLPAUSE_CONT);
+	global.InvalidateSockets();
+}
+
+inline size_t
+CurlRequest::UploadRead(void *ptr, size_t max_size)
+{
+	auto r = upload_buffer.Read();
+	if (r.empty()) {
+		if (upload_eof)
+			return 0;
+
+		upload_paused = true;
+		return CURL_READFUNC_PAUSE;
+	}
+
+	const size_t n = std::min(r.size, max_size);
+	memcpy(ptr, r.data, n);
+	upload_buffer.Consume(n);
+
+	if (upload_full) {
+		/* notify the producer in a "safe" stack frame */
+		upload_full = false;
+		defer_upload_event.Schedule();
+	}
+
+	return n;
+}
+
+size_t
+CurlRequest::ReadFunction(char *ptr, size_t size, size_t nmemb, void *stream)
+{
+	CurlRequest &c = *(CurlRequest *)stream;
+
+	return c.UploadRead(ptr, size * nmemb);
+}
+
+void
+CurlRequest::OnDeferredUploadReady()
+{
+	assert(upload_handler != nullptr);
+
+	upload_handler->OnUploadReady();
+}
+
 void
 CurlRequest::FinishHeaders()
 {
@@ -129,7 +270,7 @@ CurlRequest::FinishHeaders()
 	long status = 0;
 	easy.GetInfo(CURLINFO_RESPONSE_CODE, &status);
 
-	handler.OnHeaders(status, std::move(headers));
+	handler.OnHeaders(status, headers);
 }
 
 void
@@ -191,8 +332,7 @@ CurlRequest::HeaderFunction(StringView s)
 	if (value == nullptr)
 		return;
 
-	std::string name(header, value);
-	std::transform(name.begin(), name.end(), name.begin(), ToLowerASCII);
+	const StringView name(header, value);
 
 	/* skip the colon */
 
@@ -203,7 +343,24 @@ CurlRequest::HeaderFunction(StringView s)
 	value = StripLeft(value, end);
 	end = StripRight(value, end);
 
-	headers.emplace(std::move(name), std::string(value, end));
+	headers.Add(name, {value, end});
+}
+
+void
+CurlResponseHandler::OnHeaders(unsigned status,
+			       const CurlHeaderList &headers)
+{
+	std::multimap<std::string, std::string> map;
+
+	for (const auto &i : headers) {
+		std::string name(i.name.data, i.name.size);
+		std::transform(name.begin(), name.end(), name.begin(),
+			       ToLowerASCII);
+		map.emplace(std::move(name),
+			    std::string(i.value.data, i.value.size));
+	}
+
+	OnHeaders(status, std::move(map));
 }
 
 size_t
@@ -227,6 +384,7 @@ CurlRequest::DataReceived(const void *ptr, size_t received_size)
 		handler.OnData({ptr, received_size});
 		return received_size;
 	} catch (Pause) {
+		receive_paused = true;
 		return CURL_WRITEFUNC_PAUSE;
 	} catch (...) {
 		state = State::CLOSED;
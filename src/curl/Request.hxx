@@ -31,15 +31,20 @@
 #define CURL_REQUEST_HXX
 
 #include "Easy.hxx"
+#include "HeaderList.hxx"
 #include "event/DeferEvent.hxx"
+#include "util/ForeignFifoBuffer.hxx"
+#include "util/ConstBuffer.hxx"
 
-#include <map>
-#include <string>
 #include <exception>
 
+#include <stdint.h>
+
 struct StringView;
 class CurlGlobal;
 class CurlResponseHandler;
+class CurlUploadHandler;
+class SlicePool;
 
 class CurlRequest {
 	CurlGlobal &global;
@@ -55,7 +60,7 @@ class CurlRequest {
 		CLOSED,
 	} state = State::HEADERS;
 
-	std::multimap<std::string, std::string> headers;
+	CurlHeaderList headers;
 
 	DeferEvent defer_error_event;
 
@@ -72,11 +77,56 @@ class CurlRequest {
 	/** error message provided by libcurl */
 	char error_buffer[CURL_ERROR_SIZE];
 
+	/**
+	 * The request body buffer for StreamUpload().
+	 */
+	ForeignFifoBuffer<uint8_t> upload_buffer{nullptr};
+
+	/**
+	 * The pool #upload_buffer was allocated from, or nullptr if
+	 * it was allocated with new[].
+	 */
+	SlicePool *upload_pool = nullptr;
+
+	CurlUploadHandler *upload_handler = nullptr;
+
+	/**
+	 * Invokes CurlUploadHandler::OnUploadReady() outside of the
+	 * libcurl callback.
+	 */
+	DeferEvent defer_upload_event;
+
 	bool registered = false;
 
+	/**
+	 * Has EndUpload() been called?
+	 */
+	bool upload_eof = false;
+
+	/**
+	 * Has the READFUNCTION paused the upload because the buffer
+	 * was empty?
+	 */
+	bool upload_paused = false;
+
+	/**
+	 * Has WriteUpload() rejected data because the buffer was
+	 * full?
+	 */
+	bool upload_full = false;
+
+	/**
+	 * Has the response body been paused (see #Pause)?
+	 */
+	bool receive_paused = false;
+
 public:
 	/**
 	 * To start sending the request, call Start().
+	 *
+	 * The easy handle is obtained from CurlGlobal::ObtainEasy()
+	 * (or passed by the caller), and it is released to
+	 * CurlGlobal::ReleaseEasy() when this object is destroyed.
 	 */
 	CurlRequest(CurlGlobal &_global, const char *url,
 		    CurlResponseHandler &_handler);
@@ -114,6 +164,37 @@ public:
 
 	void Resume();
 
+	/**
+	 * Stream the request body (as POST) from a buffer which is
+	 * filled with WriteUpload(), instead of keeping the whole
+	 * body in memory.  The transfer is paused while the buffer is
+	 * empty.  Must be called before Start().
+	 *
+	 * Throws on error.
+	 *
+	 * @param size the body size, or -1 for chunked transfer
+	 * encoding
+	 * @param pool if not nullptr, then the buffer is a slice from
+	 * this pool (which must outlive this object); otherwise, it
+	 * is allocated with #buffer_size bytes
+	 */
+	void StreamUpload(CurlUploadHandler &_handler, int64_t size,
+			  SlicePool *pool=nullptr,
+			  size_t buffer_size=65536);
+
+	/**
+	 * Append data to the request body.
+	 *
+	 * @return the number of bytes accepted; if this is less than
+	 * the given size, wait for CurlUploadHandler::OnUploadReady()
+	 */
+	size_t WriteUpload(ConstBuffer<void> src);
+
+	/**
+	 * The request body is complete.
+	 */
+	void EndUpload();
+
 	/**
 	 * A HTTP request is finished.  Called by #CurlGlobal.
 	 */
@@ -126,6 +207,16 @@ private:
 	 */
 	void FreeEasy();
 
+	void FreeUploadBuffer() noexcept;
+
+	void ResumeUpload();
+
+	size_t UploadRead(void *ptr, size_t max_size);
+
+	/** called by curl when it wants more request body data */
+	static size_t ReadFunction(char *ptr, size_t size, size_t nmemb,
+				   void *stream);
+
 	void FinishHeaders();
 	void FinishBody();
 
@@ -142,6 +233,7 @@ private:
 				    void *stream);
 
 	void OnDeferredError();
+	void OnDeferredUploadReady();
 };
 
 #endif
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2016 Max Kellermann <max@duempel.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Stats.hxx"
+#include "util/StringView.hxx"
+#include "util/StatsWriter.hxx"
+
+#include <tuple>
+#include <vector>
+
+#include <string.h>
+
+/**
+ * Extract the host (and port) from a URL.
+ */
+gcc_pure
+static StringView
+ExtractHost(const char *url) noexcept
+{
+	if (url == nullptr)
+		return nullptr;
+
+	const char *p = strstr(url, "://");
+	p = p != nullptr ? p + 3 : url;
+
+	const char *end = p + strcspn(p, "/?#");
+
+	/* strip the user info */
+	const char *at = (const char *)memchr(p, '@', end - p);
+	if (at != nullptr)
+		p = at + 1;
+
+	return {p, end};
+}
+
+inline CurlHostStats &
+CurlInstrumentation::Lookup(CURL *easy) noexcept
+{
+	const char *url = nullptr;
+	curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &url);
+
+	const auto host = ExtractHost(url);
+	std::string key(host.data, host.size);
+
+	auto i = hosts.find(key);
+	if (i == hosts.end()) {
+		std::string host_copy(key);
+		i = hosts.emplace(std::piecewise_construct,
+				  std::forward_as_tuple(std::move(key)),
+				  std::forward_as_tuple(std::move(host_copy))).first;
+	}
+
+	return i->second;
+}
+
+#if LIBCURL_VERSION_NUM >= 0x073d00
+/* libcurl 7.61 provides times as integer microseconds */
+#define TIME_INFO(name) CURLINFO_ ## name ## _TIME_T
+#else
+#define TIME_INFO(name) CURLINFO_ ## name ## _TIME
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x073700
+#define SIZE_INFO(name) CURLINFO_SIZE_ ## name ## _T
+#else
+#define SIZE_INFO(name) CURLINFO_SIZE_ ## name
+#endif
+
+/**
+ * Obtain a time value in microseconds.
+ */
+static uint64_t
+GetTimeUs(CURL *easy, CURLINFO info) noexcept
+{
+#if LIBCURL_VERSION_NUM >= 0x073d00
+	curl_off_t value = 0;
+#else
+	double value = 0;
+#endif
+	if (curl_easy_getinfo(easy, info, &value) != CURLE_OK || value < 0)
+		return 0;
+
+#if LIBCURL_VERSION_NUM >= 0x073d00
+	return value;
+#else
+	return value * 1000000;
+#endif
+}
+
+static uint64_t
+GetSize(CURL *easy, CURLINFO info) noexcept
+{
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t value = 0;
+#else
+	double value = 0;
+#endif
+	if (curl_easy_getinfo(easy, info, &value) != CURLE_OK || value < 0)
+		return 0;
+
+	return value;
+}
+
+void
+CurlInstrumentation::Record(CURL *easy, CURLcode result) noexcept
+{
+	auto &stats = Lookup(easy);
+
+	++stats.n_transfers;
+	if (result != CURLE_OK)
+		++stats.n_errors;
+
+	stats.bytes_sent += GetSize(easy, SIZE_INFO(UPLOAD));
+	stats.bytes_received += GetSize(easy, SIZE_INFO(DOWNLOAD));
+
+	long num_connects = 0;
+	curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &num_connects);
+
+	if (num_connects == 0) {
+		++stats.n_reused;
+	} else {
+		stats.namelookup_time.Add(GetTimeUs(easy, TIME_INFO(NAMELOOKUP)));
+		stats.connect_time.Add(GetTimeUs(easy, TIME_INFO(CONNECT)));
+		const auto appconnect = GetTimeUs(easy, TIME_INFO(APPCONNECT));
+		if (appconnect > 0)
+			/* zero means no TLS */
+			stats.appconnect_time.Add(appconnect);
+	}
+
+	if (result == CURLE_OK)
+		stats.starttransfer_time.Add(GetTimeUs(easy, TIME_INFO(STARTTRANSFER)));
+
+	stats.total_time.Add(GetTimeUs(easy, TIME_INFO(TOTAL)));
+}
+
+const CurlHostStats *
+CurlInstrumentation::Find(const char *host) const noexcept
+{
+	auto i = hosts.find(host);
+	return i != hosts.end()
+		? &i->second
+		: nullptr;
+}
+
+void
+CurlInstrumentation::WriteStats(StatsWriter &writer) const
+{
+	/* all samples of one metric must be consecutive, so iterate
+	   the hosts once per metric */
+
+	std::vector<std::pair<std::string, const CurlHostStats *>> items;
+	items.reserve(hosts.size());
+	for (const auto &i : hosts) {
+		std::string labels;
+		AppendStatsLabel(labels, "host", i.first.c_str());
+		items.emplace_back(std::move(labels), &i.second);
+	}
+
+	static constexpr struct {
+		const char *name;
+		uint64_t CurlHostStats::*value;
+	} counters[] = {
+		{ "curl_transfers_total", &CurlHostStats::n_transfers },
+		{ "curl_errors_total", &CurlHostStats::n_errors },
+		{ "curl_reused_connections_total", &CurlHostStats::n_reused },
+		{ "curl_sent_bytes_total", &CurlHostStats::bytes_sent },
+		{ "curl_received_bytes_total", &CurlHostStats::bytes_received },
+	};
+
+	for (const auto &c : counters)
+		for (const auto &i : items)
+			writer.WriteCounter(c.name, i.first.c_str(),
+					    i.second->*c.value);
+
+	static constexpr struct {
+		const char *name;
+		LogLinearHistogram<> CurlHostStats::*value;
+	} histograms[] = {
+		{ "curl_namelookup_seconds", &CurlHostStats::namelookup_time },
+		{ "curl_connect_seconds", &CurlHostStats::connect_time },
+		{ "curl_appconnect_seconds", &CurlHostStats::appconnect_time },
+		{ "curl_starttransfer_seconds", &CurlHostStats::starttransfer_time },
+		{ "curl_total_seconds", &CurlHostStats::total_time },
+	};
+
+	for (const auto &h : histograms)
+		for (const auto &i : items)
+			writer.WriteHistogram(h.name, i.first.c_str(),
+					      i.second->*h.value, 1e-6);
+}
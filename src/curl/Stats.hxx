@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016 Max Kellermann <max@duempel.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CURL_STATS_HXX
+#define CURL_STATS_HXX
+
+#include "util/LogLinearHistogram.hxx"
+#include "util/Compiler.h"
+
+#include <curl/curl.h>
+
+#include <string>
+#include <unordered_map>
+
+#include <stdint.h>
+
+class StatsWriter;
+
+/**
+ * Statistics about transfers to one host; see
+ * #CurlInstrumentation.  Times are recorded in microseconds since
+ * the start of the transfer (i.e. they are cumulative, as reported
+ * by libcurl).
+ */
+struct CurlHostStats {
+	const std::string host;
+
+	uint64_t n_transfers = 0, n_errors = 0;
+
+	/**
+	 * The number of transfers which reused an existing
+	 * connection.
+	 */
+	uint64_t n_reused = 0;
+
+	uint64_t bytes_sent = 0, bytes_received = 0;
+
+	/**
+	 * Name resolution, TCP connect and TLS handshake; only
+	 * recorded for transfers which opened a new connection.
+	 */
+	LogLinearHistogram<> namelookup_time, connect_time, appconnect_time;
+
+	/**
+	 * Until the first response byte has been received.
+	 */
+	LogLinearHistogram<> starttransfer_time;
+
+	LogLinearHistogram<> total_time;
+
+	explicit CurlHostStats(std::string &&_host) noexcept
+		:host(std::move(_host)) {}
+};
+
+/**
+ * Collects per-host statistics about finished transfers; see
+ * CurlGlobal::SetInstrumentation().
+ */
+class CurlInstrumentation {
+	std::unordered_map<std::string, CurlHostStats> hosts;
+
+public:
+	CurlInstrumentation() = default;
+	CurlInstrumentation(const CurlInstrumentation &) = delete;
+	CurlInstrumentation &operator=(const CurlInstrumentation &) = delete;
+
+	/**
+	 * Account a finished transfer.  Called by #CurlGlobal.
+	 */
+	void Record(CURL *easy, CURLcode result) noexcept;
+
+	gcc_pure
+	const CurlHostStats *Find(const char *host) const noexcept;
+
+	/**
+	 * Invoke the given function for each #CurlHostStats.
+	 */
+	template<typename F>
+	void ForEach(F &&f) const {
+		for (const auto &i : hosts)
+			f(i.second);
+	}
+
+	/**
+	 * Write all per-host statistics (with a "host" label) into a
+	 * #StatsWriter.  It must be called from the #EventLoop
+	 * thread.
+	 */
+	void WriteStats(StatsWriter &writer) const;
+
+private:
+	CurlHostStats &Lookup(CURL *easy) noexcept;
+};
+
+#endif
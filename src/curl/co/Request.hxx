@@ -0,0 +1,134 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "curl/Request.hxx"
+#include "curl/Handler.hxx"
+#include "curl/Global.hxx"
+#include "event/co/DeferredResume.hxx"
+
+#include <exception>
+#include <map>
+#include <string>
+
+namespace Co {
+
+struct CurlResponse {
+	unsigned status = 0;
+
+	std::multimap<std::string, std::string> headers;
+
+	std::string body;
+};
+
+/**
+ * Awaitable which performs a HTTP request with CURL and collects the
+ * whole response (wrapping #::CurlRequest).  The request starts on
+ * construction; destroying this object cancels it.  co_await
+ * returns the response or throws.
+ */
+class CurlRequest final : CurlResponseHandler {
+	DeferredResume resume;
+
+	::CurlRequest request;
+
+	CurlResponse response;
+
+	std::exception_ptr error;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	CurlRequest(CurlGlobal &global, const char *url)
+		:resume(global.GetEventLoop()), request(global, url, *this)
+	{
+		request.Start();
+	}
+
+	/**
+	 * Start a request with an easy handle configured by the
+	 * caller (method, headers, body, ...).
+	 *
+	 * Throws on error.
+	 */
+	CurlRequest(CurlGlobal &global, CurlEasy &&easy)
+		:resume(global.GetEventLoop()),
+		 request(global, std::move(easy), *this)
+	{
+		request.Start();
+	}
+
+	~CurlRequest() noexcept {
+		if (!resume.IsDone())
+			request.Stop();
+	}
+
+	bool await_ready() const noexcept {
+		return resume.IsDone();
+	}
+
+	void await_suspend(std::coroutine_handle<> continuation) noexcept {
+		resume.SetContinuation(continuation);
+	}
+
+	CurlResponse await_resume() {
+		if (error)
+			std::rethrow_exception(error);
+
+		return std::move(response);
+	}
+
+private:
+	/* virtual methods from class CurlResponseHandler */
+	void OnHeaders(unsigned status,
+		       std::multimap<std::string, std::string> &&headers) override {
+		response.status = status;
+		response.headers = std::move(headers);
+	}
+
+	void OnData(ConstBuffer<void> data) override {
+		response.body.append((const char *)data.data, data.size);
+	}
+
+	void OnEnd() override {
+		resume.Complete();
+	}
+
+	void OnError(std::exception_ptr e) override {
+		error = std::move(e);
+		resume.Complete();
+	}
+};
+
+} // namespace Co
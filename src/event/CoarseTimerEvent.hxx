@@ -0,0 +1,105 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COARSE_TIMER_EVENT_HXX
+#define COARSE_TIMER_EVENT_HXX
+
+#include "util/BindMethod.hxx"
+
+#include <boost/intrusive/list_hook.hpp>
+
+#include <chrono>
+
+#include <stdint.h>
+
+class EventLoop;
+
+/**
+ * A timer with millisecond resolution which is managed by the
+ * #EventLoop's #TimerWheel instead of libevent's min-heap.
+ * Rescheduling is O(1) and usually does not touch libevent at all,
+ * which makes this class suitable for timeouts which are refreshed
+ * very often (e.g. socket read timeouts), but which rarely expire.
+ *
+ * This class is not thread-safe; it may only be used in the
+ * #EventLoop thread.
+ */
+class CoarseTimerEvent final {
+	friend class TimerWheel;
+	friend class EventLoop;
+
+	typedef boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> SiblingsHook;
+	SiblingsHook siblings;
+
+	EventLoop &loop;
+
+	typedef BoundMethod<void()> Callback;
+	const Callback callback;
+
+	/**
+	 * The time (in milliseconds on the steady clock) when this
+	 * timer expires.  Only valid while IsPending().
+	 */
+	uint64_t due;
+
+public:
+	typedef std::chrono::steady_clock::duration Duration;
+
+	CoarseTimerEvent(EventLoop &_loop, Callback _callback) noexcept
+		:loop(_loop), callback(_callback) {}
+
+	CoarseTimerEvent(const CoarseTimerEvent &) = delete;
+	CoarseTimerEvent &operator=(const CoarseTimerEvent &) = delete;
+
+	EventLoop &GetEventLoop() noexcept {
+		return loop;
+	}
+
+	bool IsPending() const noexcept {
+		return siblings.is_linked();
+	}
+
+	/**
+	 * Schedule the timer; if it is already pending, the old
+	 * expiry is replaced.
+	 */
+	void Schedule(Duration d) noexcept;
+
+	void Cancel() noexcept {
+		siblings.unlink();
+	}
+
+private:
+	void Run() noexcept;
+};
+
+#endif
@@ -36,8 +36,10 @@
 void
 DeferEvent::Schedule() noexcept
 {
-	if (!IsPending())
+	if (!IsPending()) {
+		trace = Trace::GetCurrent();
 		loop.Defer(*this);
+	}
 
 	assert(IsPending());
 }
@@ -34,9 +34,12 @@
 #define DEFER_EVENT_HXX
 
 #include "util/BindMethod.hxx"
+#include "util/Trace.hxx"
 
 #include <boost/intrusive/list_hook.hpp>
 
+#include <stdint.h>
+
 class EventLoop;
 
 /**
@@ -56,8 +59,34 @@ class DeferEvent final {
 	const Callback callback;
 
 public:
-	DeferEvent(EventLoop &_loop, Callback _callback) noexcept
-		:loop(_loop), callback(_callback) {}
+	enum class Priority : uint8_t {
+		/**
+		 * Run in the next iteration (subject to the budget
+		 * configured with EventLoop::SetDeferBudget()).
+		 */
+		NORMAL,
+
+		/**
+		 * Run only after all #NORMAL events, if there is budget
+		 * left.  Use this for background work which must not
+		 * delay I/O.
+		 */
+		IDLE,
+	};
+
+private:
+	const Priority priority;
+
+	/**
+	 * The tracing context of the Schedule() caller, restored while
+	 * the callback runs.
+	 */
+	TraceContext trace;
+
+public:
+	DeferEvent(EventLoop &_loop, Callback _callback,
+		   Priority _priority=Priority::NORMAL) noexcept
+		:loop(_loop), callback(_callback), priority(_priority) {}
 
 	DeferEvent(const DeferEvent &) = delete;
 	DeferEvent &operator=(const DeferEvent &) = delete;
@@ -75,7 +104,11 @@ public:
 
 protected:
 	void OnDeferred() noexcept {
-		callback();
+		if (gcc_unlikely(trace.IsSampled())) {
+			const TraceScope scope(trace);
+			callback();
+		} else
+			callback();
 	}
 };
 
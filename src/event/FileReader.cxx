@@ -0,0 +1,115 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "FileReader.hxx"
+#include "system/Error.hxx"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#ifndef RWF_NOWAIT
+#define RWF_NOWAIT 0x00000008
+#endif
+
+std::atomic<bool> FileReader::nowait_supported{true};
+
+ssize_t
+FileReader::Read(FileDescriptor _fd, void *_buffer, size_t _size,
+		 off_t _offset)
+{
+	assert(!pending);
+
+	if (nowait_supported.load(std::memory_order_relaxed)) {
+		struct iovec v;
+		v.iov_base = _buffer;
+		v.iov_len = _size;
+
+		ssize_t nbytes = preadv2(_fd.Get(), &v, 1, _offset,
+					 RWF_NOWAIT);
+		if (nbytes >= 0)
+			/* page cache hit */
+			return nbytes;
+
+		switch (errno) {
+		case EAGAIN:
+			break;
+
+		case EOPNOTSUPP:
+		case ENOSYS:
+			/* this is a property of the kernel (or of the
+			   filesystem, but most files served by one
+			   process live on the same one) */
+			nowait_supported.store(false, std::memory_order_relaxed);
+			break;
+
+		default:
+			throw MakeErrno("Failed to read file");
+		}
+	}
+
+	if (worker_pool == nullptr) {
+		ssize_t nbytes = pread(_fd.Get(), _buffer, _size, _offset);
+		if (nbytes < 0)
+			throw MakeErrno("Failed to read file");
+		return nbytes;
+	}
+
+	fd = _fd;
+	buffer = _buffer;
+	size = _size;
+	offset = _offset;
+
+	pending = true;
+	worker_pool->Submit(*this);
+	return -1;
+}
+
+void
+FileReader::Run() noexcept
+{
+	result = pread(fd.Get(), buffer, size, offset);
+	error = result < 0 ? errno : 0;
+}
+
+void
+FileReader::OnDone() noexcept
+{
+	assert(pending);
+	pending = false;
+
+	if (result < 0)
+		handler.OnFileReadError(std::make_exception_ptr(MakeErrno(error, "Failed to read file")));
+	else
+		handler.OnFileRead(result);
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "WorkerPool.hxx"
+#include "io/FileDescriptor.hxx"
+
+#include <atomic>
+#include <exception>
+
+#include <sys/types.h>
+#include <stddef.h>
+
+class FileReaderHandler {
+public:
+	/**
+	 * An asynchronous read has finished.
+	 *
+	 * @param nbytes the number of bytes read; 0 means end of file
+	 */
+	virtual void OnFileRead(size_t nbytes) noexcept = 0;
+
+	virtual void OnFileReadError(std::exception_ptr error) noexcept = 0;
+};
+
+/**
+ * Reads from a regular file without blocking the #EventLoop.
+ *
+ * Each read is first attempted inline with preadv2(RWF_NOWAIT),
+ * which succeeds if the data is in the page cache.  Only if the
+ * kernel would have to wait for the disk (EAGAIN), the read is
+ * repeated in a #WorkerPool thread, and its completion is reported
+ * to the #FileReaderHandler.  Kernels/filesystems which don't
+ * support RWF_NOWAIT for buffered reads are detected and always use
+ * the #WorkerPool.
+ *
+ * Without a #WorkerPool, a cache miss falls back to a blocking
+ * pread().
+ */
+class FileReader final : WorkerJob {
+	WorkerPool *const worker_pool;
+
+	FileReaderHandler &handler;
+
+	FileDescriptor fd = FileDescriptor::Undefined();
+	void *buffer;
+	size_t size;
+	off_t offset;
+
+	/**
+	 * The result of pread() in the worker thread and its errno.
+	 */
+	ssize_t result;
+	int error;
+
+	bool pending = false;
+
+	/**
+	 * Cleared after preadv2(RWF_NOWAIT) has failed with
+	 * EOPNOTSUPP (or ENOSYS).
+	 */
+	static std::atomic<bool> nowait_supported;
+
+public:
+	/**
+	 * Throws std::system_error on error.
+	 *
+	 * @param _worker_pool the pool which performs reads which would
+	 * block; may be nullptr
+	 */
+	FileReader(EventLoop &event_loop, WorkerPool *_worker_pool,
+		   FileReaderHandler &_handler)
+		:WorkerJob(event_loop), worker_pool(_worker_pool),
+		 handler(_handler) {}
+
+	~FileReader() noexcept {
+		Cancel();
+	}
+
+	using WorkerJob::GetEventLoop;
+
+	bool IsPending() const noexcept {
+		return pending;
+	}
+
+	/**
+	 * Start reading.  The buffer must remain valid until the
+	 * handler has been invoked or Cancel() has been called.
+	 *
+	 * Throws std::system_error if the inline read fails.
+	 *
+	 * @return the number of bytes read inline (0 means end of
+	 * file, and a short read is possible), or -1 if the read
+	 * continues asynchronously and the handler will be invoked
+	 */
+	ssize_t Read(FileDescriptor _fd, void *_buffer, size_t _size,
+		     off_t _offset);
+
+	/**
+	 * Cancel a pending asynchronous read.  If it is already
+	 * running in a worker thread, this blocks until it has
+	 * finished.
+	 */
+	void Cancel() noexcept {
+		if (pending) {
+			pending = false;
+			worker_pool->Cancel(*this);
+		}
+	}
+
+private:
+	/* virtual methods from WorkerJob */
+	void Run() noexcept override;
+	void OnDone() noexcept override;
+};
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "InjectEvent.hxx"
+#include "Loop.hxx"
+
+InjectEvent::InjectEvent(EventLoop &_loop, Callback _callback)
+	:state(State::IDLE), loop(_loop), callback(_callback)
+{
+	loop.AddInjectEvent();
+}
+
+InjectEvent::~InjectEvent() noexcept
+{
+	if (state.load(std::memory_order_acquire) != State::IDLE)
+		loop.RemoveInjectEvent(*this);
+
+	loop.ReleaseInjectEvent();
+}
+
+void
+InjectEvent::Schedule() noexcept
+{
+	State s = state.load(std::memory_order_acquire);
+
+	while (true) {
+		switch (s) {
+		case State::IDLE:
+			if (state.compare_exchange_weak(s, State::QUEUED,
+							std::memory_order_acq_rel)) {
+				loop.Inject(*this);
+				return;
+			}
+
+			break;
+
+		case State::QUEUED:
+			/* already pending */
+			return;
+
+		case State::CANCELLED:
+			/* still linked in one of the lists; just revive
+			   it */
+			if (state.compare_exchange_weak(s, State::QUEUED,
+							std::memory_order_acq_rel))
+				return;
+
+			break;
+		}
+	}
+}
+
+void
+InjectEvent::Cancel() noexcept
+{
+	State expected = State::QUEUED;
+	state.compare_exchange_strong(expected, State::CANCELLED,
+				      std::memory_order_acq_rel);
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INJECT_EVENT_HXX
+#define INJECT_EVENT_HXX
+
+#include "util/BindMethod.hxx"
+
+#include <boost/intrusive/list_hook.hpp>
+
+#include <atomic>
+
+class EventLoop;
+
+/**
+ * Invoke a method call in the context of an #EventLoop, scheduled
+ * from any thread.  This is the thread-safe counterpart of
+ * #DeferEvent.
+ *
+ * Schedule() and Cancel() may be called from any thread; they are
+ * lock-free and issue at most one eventfd write per batch of
+ * injections.  The object must be constructed and destructed in the
+ * #EventLoop thread (or while the loop is not running), and
+ * Schedule() must not race with destruction.
+ */
+class InjectEvent final {
+	friend class EventLoop;
+
+	typedef boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::safe_link>> SiblingsHook;
+
+	/**
+	 * Hook for EventLoop's loop-thread-only list of collected
+	 * events.
+	 */
+	SiblingsHook siblings;
+
+	/**
+	 * Link in EventLoop's lock-free MPSC stack.
+	 */
+	InjectEvent *next;
+
+	enum class State : unsigned {
+		/**
+		 * Not in any list.
+		 */
+		IDLE,
+
+		/**
+		 * Scheduled and in one of the #EventLoop lists.
+		 */
+		QUEUED,
+
+		/**
+		 * Still in one of the #EventLoop lists, but the callback
+		 * shall not be invoked.
+		 */
+		CANCELLED,
+	};
+
+	std::atomic<State> state;
+
+	EventLoop &loop;
+
+	typedef BoundMethod<void()> Callback;
+	const Callback callback;
+
+public:
+	/**
+	 * Throws std::system_error if the #EventLoop's eventfd could
+	 * not be created.
+	 */
+	InjectEvent(EventLoop &_loop, Callback _callback);
+
+	~InjectEvent() noexcept;
+
+	InjectEvent(const InjectEvent &) = delete;
+	InjectEvent &operator=(const InjectEvent &) = delete;
+
+	EventLoop &GetEventLoop() noexcept {
+		return loop;
+	}
+
+	bool IsPending() const noexcept {
+		return state.load(std::memory_order_relaxed) == State::QUEUED;
+	}
+
+	/**
+	 * Schedule a callback invocation in the #EventLoop thread.  If
+	 * this event is already pending, this is a no-op.  This method
+	 * is thread-safe.
+	 */
+	void Schedule() noexcept;
+
+	/**
+	 * Cancel a pending callback invocation.  This method is
+	 * thread-safe, but if it is called from another thread, the
+	 * callback may already be running (or about to run).
+	 */
+	void Cancel() noexcept;
+
+private:
+	void OnInjected() noexcept {
+		callback();
+	}
+};
+
+#endif
@@ -31,26 +31,397 @@
  */
 
 #include "Loop.hxx"
+#include "io/uring/Queue.hxx"
+#include "system/Error.hxx"
+
+#include <stdint.h>
+
+void
+EventLoop::Init() noexcept
+{
+	::evtimer_assign(&coarse_timer_event, event_base,
+			 CoarseTimerCallback, this);
+}
+
+EventLoop::EventLoop() noexcept
+	:event_base(Create()),
+	 coarse_timers(TimerWheel::ToTick(std::chrono::steady_clock::now()))
+{
+	Init();
+}
+
+EventLoop::EventLoop(Independent) noexcept
+	:event_base(::event_base_new()),
+	 coarse_timers(TimerWheel::ToTick(std::chrono::steady_clock::now()))
+{
+	Init();
+}
+
+EventLoop::~EventLoop() noexcept
+{
+	assert(defer.empty());
+	assert(idle.empty());
+	assert(n_inject_events == 0);
+	assert(injected.empty());
+	assert(inject_head.load() == nullptr);
+
+	if (uring_event_added)
+		::event_del(&uring_event);
+
+	::event_del(&coarse_timer_event);
+	::event_base_free(event_base);
+}
+
+bool
+EventLoop::EnableUring(unsigned entries, unsigned flags) noexcept
+{
+	assert(!uring);
+
+	try {
+		uring.reset(new Uring::Queue(entries, flags));
+	} catch (...) {
+		return false;
+	}
+
+	::event_assign(&uring_event, event_base,
+		       uring->GetEventFileDescriptor().Get(),
+		       EV_READ|EV_PERSIST, UringCallback, this);
+	return true;
+}
+
+void
+EventLoop::SubmitUring() noexcept
+{
+	try {
+		uring->Submit();
+	} catch (...) {
+		/* the entries stay pending and will be retried in the
+		   next iteration */
+	}
+
+	UpdateUringEvent();
+}
+
+void
+EventLoop::UpdateUringEvent() noexcept
+{
+	const bool needed = uring->HasOperations();
+	if (needed == uring_event_added)
+		return;
+
+	if (needed)
+		::event_add(&uring_event, nullptr);
+	else
+		::event_del(&uring_event);
+	uring_event_added = needed;
+}
+
+void
+EventLoop::UringCallback(evutil_socket_t, short, void *ctx) noexcept
+{
+	auto &loop = *(EventLoop *)ctx;
+
+	ProfileScope scope(loop, (const void *)UringCallback);
+	loop.uring->DispatchCompletions();
+	loop.UpdateUringEvent();
+}
 
 void
 EventLoop::Defer(DeferEvent &e) noexcept
 {
-	defer.push_front(e);
+	auto &list = e.priority == DeferEvent::Priority::IDLE
+		? idle
+		: defer;
+
+	/* append, so events scheduled by deferred callbacks don't
+	   overtake older ones */
+	list.push_back(e);
 }
 
 void
 EventLoop::CancelDefer(DeferEvent &e) noexcept
 {
-	defer.erase(defer.iterator_to(e));
+	auto &list = e.priority == DeferEvent::Priority::IDLE
+		? idle
+		: defer;
+
+	list.erase(list.iterator_to(e));
+}
+
+void
+EventLoop::EnableStats(std::chrono::steady_clock::duration slow_threshold,
+		       SlowCallbackHandler slow_handler) noexcept
+{
+	if (stats)
+		stats->Reset();
+	else
+		stats.reset(new EventLoopStats());
+
+	slow_callback_threshold = slow_threshold;
+	slow_callback_handler = slow_handler;
+}
+
+void
+EventLoop::RecordCallback(const void *function,
+			  std::chrono::steady_clock::duration duration) noexcept
+{
+	assert(stats);
+
+	++stats->n_callbacks;
+	stats->callback_durations.Add(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+	iteration_dispatch_time += duration;
+
+	if (duration >= slow_callback_threshold) {
+		++stats->n_slow_callbacks;
+
+		if (slow_callback_handler)
+			slow_callback_handler(function, duration);
+	}
+}
+
+bool
+EventLoop::ProfiledLoop(int flags) noexcept
+{
+	iteration_dispatch_time = std::chrono::steady_clock::duration::zero();
+
+	const auto start = std::chrono::steady_clock::now();
+	const bool result = ::event_base_loop(event_base, flags) == 0;
+	const auto duration = std::chrono::steady_clock::now() - start;
+
+	/* a callback may have disabled the stats */
+	if (stats) {
+		++stats->n_iterations;
+		stats->dispatch_time += iteration_dispatch_time;
+		if (duration > iteration_dispatch_time)
+			stats->wait_time += duration - iteration_dispatch_time;
+	}
+
+	return result;
+}
+
+bool
+EventLoop::BusyPoll(int flags) noexcept
+{
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = start + busy_poll;
+	const unsigned old_n_callbacks = n_callbacks;
+
+	bool hit = false;
+	auto now = start;
+
+	do {
+		FlushClockCaches();
+
+		if (::event_base_loop(event_base, flags|EVLOOP_NONBLOCK) != 0)
+			/* no events registered; let the caller find
+			   out */
+			break;
+
+		if (n_callbacks != old_n_callbacks || HasPendingDeferred()) {
+			hit = true;
+			break;
+		}
+
+		now = std::chrono::steady_clock::now();
+	} while (now < deadline);
+
+	if (!hit)
+		/* back off: block until the loop gets busy again */
+		recently_busy = false;
+
+	if (stats) {
+		++stats->n_busy_polls;
+		if (hit)
+			++stats->n_busy_poll_hits;
+		stats->busy_poll_time += std::chrono::steady_clock::now() - start;
+	}
+
+	return hit;
 }
 
 bool
 EventLoop::RunDeferred() noexcept
 {
-	while (!defer.empty())
-		defer.pop_front_and_dispose([](DeferEvent *e){
+	if (!HasPendingDeferred())
+		return true;
+
+	const bool profile = stats != nullptr;
+	const bool check_time = defer_budget_time > defer_budget_time.zero();
+	const auto start = profile || check_time
+		? std::chrono::steady_clock::now()
+		: std::chrono::steady_clock::time_point();
+
+	unsigned n = 0;
+	while (true) {
+		DeferList *list;
+		if (!defer.empty())
+			list = &defer;
+		else if (!idle.empty())
+			list = &idle;
+		else
+			break;
+
+		list->pop_front_and_dispose([this](DeferEvent *e){
+				ProfileScope scope(*this,
+						   e->callback.GetFunctionAddress());
 				e->OnDeferred();
 			});
 
+		++n;
+		if (n == defer_budget_count)
+			break;
+
+		/* checking the clock is not free; do it only every
+		   16 callbacks */
+		if (check_time && n % 16 == 0 &&
+		    std::chrono::steady_clock::now() - start >= defer_budget_time)
+			break;
+	}
+
+	if (profile && stats)
+		stats->deferred_time += std::chrono::steady_clock::now() - start;
+
 	return true;
 }
+
+void
+EventLoop::Inject(InjectEvent &e) noexcept
+{
+	InjectEvent *old_head = inject_head.load(std::memory_order_relaxed);
+	do {
+		e.next = old_head;
+	} while (!inject_head.compare_exchange_weak(old_head, &e,
+						    std::memory_order_release,
+						    std::memory_order_relaxed));
+
+	if (old_head == nullptr) {
+		/* the stack was empty: wake up the loop; if it was not
+		   empty, a wakeup is already on its way */
+		static constexpr uint64_t value = 1;
+		(void)inject_fd.Write(&value, sizeof(value));
+	}
+}
+
+void
+EventLoop::AddInjectEvent()
+{
+	if (!inject_fd.IsDefined()) {
+		if (!inject_fd.CreateEventFD())
+			throw MakeErrno("eventfd() failed");
+
+		::event_assign(&inject_event, event_base, inject_fd.Get(),
+			       EV_READ|EV_PERSIST, InjectCallback, this);
+	}
+
+	if (n_inject_events++ == 0)
+		::event_add(&inject_event, nullptr);
+}
+
+void
+EventLoop::ReleaseInjectEvent() noexcept
+{
+	assert(n_inject_events > 0);
+
+	if (--n_inject_events == 0)
+		::event_del(&inject_event);
+}
+
+void
+EventLoop::RemoveInjectEvent(InjectEvent &e) noexcept
+{
+	CollectInjected();
+
+	if (e.siblings.is_linked())
+		injected.erase(injected.iterator_to(e));
+
+	e.state.store(InjectEvent::State::IDLE, std::memory_order_release);
+}
+
+void
+EventLoop::CollectInjected() noexcept
+{
+	InjectEvent *head = inject_head.exchange(nullptr,
+						 std::memory_order_acquire);
+
+	/* the stack is in LIFO order; reverse it by inserting each
+	   item before the previously inserted one */
+	auto position = injected.end();
+	for (; head != nullptr; head = head->next)
+		position = injected.insert(position, *head);
+}
+
+void
+EventLoop::RunInjected() noexcept
+{
+	CollectInjected();
+
+	while (!injected.empty()) {
+		auto &e = injected.front();
+		injected.pop_front();
+
+		/* reset the state before invoking the callback, so it may
+		   be scheduled again (from any thread) meanwhile */
+		const auto old_state =
+			e.state.exchange(InjectEvent::State::IDLE,
+					 std::memory_order_acq_rel);
+		if (old_state == InjectEvent::State::QUEUED) {
+			ProfileScope scope(*this, e.callback.GetFunctionAddress());
+			e.OnInjected();
+		}
+	}
+}
+
+void
+EventLoop::InjectCallback(evutil_socket_t, short, void *ctx) noexcept
+{
+	auto &loop = *(EventLoop *)ctx;
+
+	uint64_t value;
+	(void)loop.inject_fd.Read(&value, sizeof(value));
+
+	loop.RunInjected();
+}
+
+void
+EventLoop::AddCoarseTimer(CoarseTimerEvent &t,
+			  CoarseTimerEvent::Duration d) noexcept
+{
+	const auto now_tp = SteadyNow();
+	const uint64_t now = TimerWheel::ToTick(now_tp);
+	coarse_timers.Insert(t, TimerWheel::ToTick(now_tp + d));
+
+	if (t.due < coarse_timer_wakeup)
+		/* only an earlier expiry needs to reschedule the libevent
+		   timer; a later one will be found when it fires */
+		ScheduleCoarseTimerWakeup(t.due, now);
+}
+
+void
+EventLoop::ScheduleCoarseTimerWakeup(uint64_t tick, uint64_t now) noexcept
+{
+	coarse_timer_wakeup = tick;
+
+	const uint64_t delay_ms = tick > now ? tick - now : 0;
+	const struct timeval tv{
+		time_t(delay_ms / 1000),
+		suseconds_t((delay_ms % 1000) * 1000),
+	};
+
+	::evtimer_add(&coarse_timer_event, &tv);
+}
+
+void
+EventLoop::CoarseTimerCallback(evutil_socket_t, short, void *ctx) noexcept
+{
+	auto &loop = *(EventLoop *)ctx;
+
+	const uint64_t now = TimerWheel::ToTick(loop.SteadyNow());
+
+	/* reset before running the timers, because their callbacks may
+	   schedule new timers */
+	loop.coarse_timer_wakeup = TimerWheel::NONE;
+
+	const uint64_t next = loop.coarse_timers.Run(now);
+	if (next < loop.coarse_timer_wakeup)
+		loop.ScheduleCoarseTimerWakeup(next, now);
+}
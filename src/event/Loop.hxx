@@ -34,18 +34,31 @@
 #define EVENT_BASE_HXX
 
 #include "DeferEvent.hxx"
+#include "InjectEvent.hxx"
+#include "TimerWheel.hxx"
+#include "LoopStats.hxx"
+#include "io/UniqueFileDescriptor.hxx"
 #include "util/BindMethod.hxx"
 
 #include <boost/intrusive/list.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+
 #include <event.h>
 
 #include <assert.h>
 
+namespace Uring { class Queue; }
+
 /**
  * Wrapper for a struct event_base.
  */
 class EventLoop {
+	friend class InjectEvent;
+	friend class CoarseTimerEvent;
+
 	struct event_base *const event_base;
 
 	static struct event_base *Create() {
@@ -66,27 +79,181 @@ class EventLoop {
 		return ::event_init();
 	}
 
-	boost::intrusive::list<DeferEvent,
-			       boost::intrusive::member_hook<DeferEvent,
-							     DeferEvent::SiblingsHook,
-							     &DeferEvent::siblings>,
-			       boost::intrusive::constant_time_size<false>> defer;
+	typedef boost::intrusive::list<DeferEvent,
+				       boost::intrusive::member_hook<DeferEvent,
+								     DeferEvent::SiblingsHook,
+								     &DeferEvent::siblings>,
+				       boost::intrusive::constant_time_size<false>> DeferList;
+
+	/**
+	 * Pending #DeferEvent instances with
+	 * DeferEvent::Priority::NORMAL, in the order they were
+	 * scheduled.
+	 */
+	DeferList defer;
+
+	/**
+	 * Pending #DeferEvent instances with
+	 * DeferEvent::Priority::IDLE.
+	 */
+	DeferList idle;
+
+	/**
+	 * The maximum number of #DeferEvent callbacks per
+	 * RunDeferred() call; 0 means unlimited.
+	 */
+	unsigned defer_budget_count = 0;
+
+	/**
+	 * The maximum duration of one RunDeferred() call; zero means
+	 * unlimited.
+	 */
+	std::chrono::steady_clock::duration defer_budget_time =
+		std::chrono::steady_clock::duration::zero();
+
+	/**
+	 * Lock-free MPSC stack of #InjectEvent instances scheduled from
+	 * any thread.  It is collected into #injected by the loop
+	 * thread.
+	 */
+	std::atomic<InjectEvent *> inject_head{nullptr};
+
+	/**
+	 * #InjectEvent instances which have been collected from
+	 * #inject_head, in the order they were scheduled.  Only
+	 * accessed from the loop thread.
+	 */
+	boost::intrusive::list<InjectEvent,
+			       boost::intrusive::member_hook<InjectEvent,
+							     InjectEvent::SiblingsHook,
+							     &InjectEvent::siblings>,
+			       boost::intrusive::constant_time_size<false>> injected;
+
+	/**
+	 * An eventfd which wakes up the loop after #inject_head has
+	 * become non-empty.  It is created on demand by the first
+	 * #InjectEvent.
+	 */
+	UniqueFileDescriptor inject_fd;
+	struct event inject_event;
+
+	/**
+	 * The number of #InjectEvent instances.  #inject_event is
+	 * registered only while this is non-zero, so an idle loop can
+	 * still finish when all other events are gone.
+	 */
+	unsigned n_inject_events = 0;
+
+	/**
+	 * All pending #CoarseTimerEvent instances.
+	 */
+	TimerWheel coarse_timers;
+
+	/**
+	 * A libevent timer which wakes up the loop to run
+	 * #coarse_timers.
+	 */
+	struct event coarse_timer_event;
+
+	/**
+	 * The tick (see TimerWheel::ToTick()) #coarse_timer_event is
+	 * scheduled for, or TimerWheel::NONE if it is not scheduled.
+	 * Rescheduling a #CoarseTimerEvent to a later time does not
+	 * need to touch #coarse_timer_event.
+	 */
+	uint64_t coarse_timer_wakeup = TimerWheel::NONE;
+
+	/**
+	 * An optional io_uring instance (see EnableUring()).  Its
+	 * pending submissions are flushed once per loop iteration,
+	 * right before blocking in libevent; completions are
+	 * dispatched from #uring_event.
+	 */
+	std::unique_ptr<Uring::Queue> uring;
+	struct event uring_event;
+
+	/**
+	 * Is #uring_event registered?  It is only while there are
+	 * operations in flight, so an idle loop can still finish.
+	 */
+	bool uring_event_added = false;
+
+	/**
+	 * The busy-polling budget (see SetBusyPoll()); zero means
+	 * disabled.
+	 */
+	std::chrono::steady_clock::duration busy_poll =
+		std::chrono::steady_clock::duration::zero();
+
+	/**
+	 * Incremented by each #ProfileScope, i.e. for each callback
+	 * invocation; used to find out whether a libevent iteration
+	 * has dispatched anything.
+	 */
+	unsigned n_callbacks = 0;
+
+	/**
+	 * Did the previous iteration dispatch any callbacks?  Only
+	 * then does the next one start with busy-polling.
+	 */
+	bool recently_busy = false;
+
+public:
+	typedef BoundMethod<void(const void *function,
+				 std::chrono::steady_clock::duration duration) noexcept> SlowCallbackHandler;
+
+private:
+	/**
+	 * Statistics; only allocated by EnableStats(), so the
+	 * overhead is a pointer check per callback while disabled.
+	 */
+	std::unique_ptr<EventLoopStats> stats;
+
+	std::chrono::steady_clock::duration slow_callback_threshold;
+	SlowCallbackHandler slow_callback_handler = nullptr;
+
+	/**
+	 * The time spent in callbacks during the current libevent
+	 * iteration; used to split the iteration into
+	 * EventLoopStats::wait_time and EventLoopStats::dispatch_time.
+	 */
+	std::chrono::steady_clock::duration iteration_dispatch_time;
 
 #ifndef NDEBUG
 	typedef BoundMethod<void() noexcept> PostCallback;
 	PostCallback post_callback = nullptr;
 #endif
 
+	/**
+	 * Caches for SteadyNow() and SystemNow().  They are
+	 * invalidated before each libevent iteration and refreshed
+	 * lazily, so all callbacks of one iteration share one
+	 * clock_gettime() call.
+	 */
+	std::chrono::steady_clock::time_point steady_now;
+	std::chrono::system_clock::time_point system_now;
+	bool steady_now_valid = false, system_now_valid = false;
+
 	bool quit;
 
 public:
-	EventLoop() noexcept:event_base(Create()) {}
+	EventLoop() noexcept;
 
-	~EventLoop() noexcept {
-		assert(defer.empty());
+	/**
+	 * Tag type for the constructor which creates an independent
+	 * struct event_base.
+	 */
+	struct Independent {};
 
-		::event_base_free(event_base);
-	}
+	/**
+	 * Create an #EventLoop with its own struct event_base, leaving
+	 * libevent's global "current" base alone.  This is meant for
+	 * loops running in their own thread (see #EventThread), which
+	 * must never share a struct event_base with another thread.
+	 */
+	explicit EventLoop(Independent) noexcept;
+
+	~EventLoop() noexcept;
 
 	EventLoop(const EventLoop &other) = delete;
 	EventLoop &operator=(const EventLoop &other) = delete;
@@ -99,6 +266,81 @@ public:
 		event_reinit(event_base);
 	}
 
+	/**
+	 * Create an io_uring instance for this loop.  libevent remains
+	 * responsible for everything else; io_uring is only used by
+	 * classes which check GetUring().
+	 *
+	 * @return false if io_uring is not available (e.g. old kernel or
+	 * seccomp filter); the caller may continue without it
+	 */
+	bool EnableUring(unsigned entries=1024, unsigned flags=0) noexcept;
+
+	/**
+	 * Returns the io_uring instance or nullptr if EnableUring()
+	 * was not called (or failed).
+	 */
+	Uring::Queue *GetUring() noexcept {
+		return uring.get();
+	}
+
+	/**
+	 * Start collecting #EventLoopStats (and reset them if they
+	 * were already enabled).  This is meant for production use:
+	 * it adds two clock reads per callback.
+	 *
+	 * @param slow_threshold callbacks running at least this long
+	 * are counted as "slow"
+	 * @param slow_handler an optional function which gets invoked
+	 * after each slow callback with the address of the callback's
+	 * function (see BoundMethod::GetFunctionAddress())
+	 */
+	void EnableStats(std::chrono::steady_clock::duration slow_threshold=std::chrono::milliseconds(10),
+			 SlowCallbackHandler slow_handler=nullptr) noexcept;
+
+	void DisableStats() noexcept {
+		stats.reset();
+	}
+
+	/**
+	 * @return the statistics or nullptr if EnableStats() has not
+	 * been called; the caller may reset them
+	 */
+	EventLoopStats *GetStats() noexcept {
+		return stats.get();
+	}
+
+	/**
+	 * Measures the duration of one callback invocation while
+	 * stats are enabled.  Create an instance on the stack right
+	 * before invoking the callback.
+	 */
+	class ProfileScope {
+		EventLoop &loop;
+		const void *const function;
+		std::chrono::steady_clock::time_point start;
+		const bool active;
+
+	public:
+		ProfileScope(EventLoop &_loop, const void *_function) noexcept
+			:loop(_loop), function(_function),
+			 active(loop.stats != nullptr) {
+			++loop.n_callbacks;
+
+			if (active)
+				start = std::chrono::steady_clock::now();
+		}
+
+		~ProfileScope() noexcept {
+			if (active && loop.stats)
+				loop.RecordCallback(function,
+						    std::chrono::steady_clock::now() - start);
+		}
+
+		ProfileScope(const ProfileScope &) = delete;
+		ProfileScope &operator=(const ProfileScope &) = delete;
+	};
+
 #ifndef NDEBUG
 	/**
 	 * Set a callback function which will be invoked each time an even
@@ -112,6 +354,7 @@ public:
 
 	void Dispatch() noexcept {
 		quit = false;
+		FlushClockCaches();
 
 		RunDeferred();
 		while (!quit && Loop(EVLOOP_ONCE) && !quit) {
@@ -150,9 +393,175 @@ public:
 	void Defer(DeferEvent &e) noexcept;
 	void CancelDefer(DeferEvent &e) noexcept;
 
+	/**
+	 * Limit the number of #DeferEvent callbacks invoked per loop
+	 * iteration, so a burst of deferred events cannot starve I/O
+	 * and timers.  Events which exceed the budget are carried over
+	 * to the next iteration, which then polls libevent without
+	 * blocking.
+	 *
+	 * @param max_count the maximum number of callbacks; 0 means
+	 * unlimited
+	 * @param max_time the maximum time; zero means unlimited (the
+	 * clock is only checked every few callbacks, so this is
+	 * approximate)
+	 */
+	void SetDeferBudget(unsigned max_count,
+			    std::chrono::steady_clock::duration max_time=std::chrono::steady_clock::duration::zero()) noexcept {
+		defer_budget_count = max_count;
+		defer_budget_time = max_time;
+	}
+
+	/**
+	 * Enable hybrid waiting: after an iteration which has
+	 * dispatched events, poll libevent without blocking for up to
+	 * the given duration before blocking in epoll_wait().  This
+	 * trades CPU time for wakeup latency (a blocking wait costs
+	 * tens of microseconds until the thread runs again).  As soon
+	 * as one polling phase expires without finding an event, the
+	 * loop blocks again until the next event arrives, so an idle
+	 * loop does not spin.
+	 *
+	 * Combine this with SO_BUSY_POLL (see #SocketTuning) to let
+	 * the kernel poll the NIC queue as well.
+	 *
+	 * @param duration the polling budget; zero disables
+	 * busy-polling
+	 */
+	void SetBusyPoll(std::chrono::steady_clock::duration duration) noexcept {
+		busy_poll = duration;
+		recently_busy = false;
+	}
+
+	/**
+	 * Are there deferred events which have not been run yet?
+	 */
+	bool HasPendingDeferred() const noexcept {
+		return !defer.empty() || !idle.empty();
+	}
+
+	/**
+	 * Returns the std::chrono::steady_clock time, cached for the
+	 * current loop iteration.  This is cheaper than calling
+	 * std::chrono::steady_clock::now() in each callback, but it
+	 * may lag behind if a callback runs for a long time; call
+	 * FlushClockCaches() after a blocking operation.
+	 */
+	std::chrono::steady_clock::time_point SteadyNow() noexcept {
+		if (!steady_now_valid) {
+			steady_now = std::chrono::steady_clock::now();
+			steady_now_valid = true;
+		}
+
+		return steady_now;
+	}
+
+	/**
+	 * Like SteadyNow(), but for std::chrono::system_clock.
+	 */
+	std::chrono::system_clock::time_point SystemNow() noexcept {
+		if (!system_now_valid) {
+			system_now = std::chrono::system_clock::now();
+			system_now_valid = true;
+		}
+
+		return system_now;
+	}
+
+	/**
+	 * Invalidate the caches of SteadyNow() and SystemNow(); the
+	 * next call will read the clock again.
+	 */
+	void FlushClockCaches() noexcept {
+		steady_now_valid = system_now_valid = false;
+	}
+
 private:
+	void Init() noexcept;
+
+	/**
+	 * Called by CoarseTimerEvent::Schedule().
+	 */
+	void AddCoarseTimer(CoarseTimerEvent &t,
+			    CoarseTimerEvent::Duration d) noexcept;
+
+	void ScheduleCoarseTimerWakeup(uint64_t tick, uint64_t now) noexcept;
+
+	static void CoarseTimerCallback(evutil_socket_t fd, short events,
+					void *ctx) noexcept;
+
+	/**
+	 * Called by #InjectEvent::Schedule(); thread-safe.
+	 */
+	void Inject(InjectEvent &e) noexcept;
+
+	/**
+	 * Throws std::system_error on error.
+	 */
+	void AddInjectEvent();
+	void ReleaseInjectEvent() noexcept;
+	void RemoveInjectEvent(InjectEvent &e) noexcept;
+
+	/**
+	 * Move all events from #inject_head to #injected.
+	 */
+	void CollectInjected() noexcept;
+
+	void RunInjected() noexcept;
+
+	static void InjectCallback(evutil_socket_t fd, short events,
+				   void *ctx) noexcept;
+
+	void RecordCallback(const void *function,
+			    std::chrono::steady_clock::duration duration) noexcept;
+
+	bool ProfiledLoop(int flags) noexcept;
+
+	/**
+	 * Poll libevent without blocking until an event has been
+	 * dispatched or the #busy_poll budget has expired.
+	 *
+	 * @return true if an event has been dispatched
+	 */
+	bool BusyPoll(int flags) noexcept;
+
+	void SubmitUring() noexcept;
+	void UpdateUringEvent() noexcept;
+
+	static void UringCallback(evutil_socket_t fd, short events,
+				  void *ctx) noexcept;
+
 	bool Loop(int flags) noexcept {
-		return ::event_base_loop(event_base, flags) == 0;
+		/* the caches were filled before this (possibly blocking)
+		   call; they are stale when the callbacks run */
+		FlushClockCaches();
+
+		if (uring)
+			SubmitUring();
+
+		if (HasPendingDeferred())
+			/* deferred events have been carried over; don't
+			   block, just check for I/O */
+			flags |= EVLOOP_NONBLOCK;
+
+		if (busy_poll > busy_poll.zero() && recently_busy &&
+		    (flags & EVLOOP_NONBLOCK) == 0 && BusyPoll(flags))
+			return true;
+
+		const unsigned old_n_callbacks = n_callbacks;
+
+		/* libevent reports "no events" as failure, but the
+		   loop is not finished while deferred events are
+		   pending */
+
+		const bool result = stats
+			? ProfiledLoop(flags)
+			: ::event_base_loop(event_base, flags) == 0;
+
+		recently_busy = n_callbacks != old_n_callbacks ||
+			HasPendingDeferred();
+
+		return result || HasPendingDeferred();
 	}
 
 	bool RunDeferred() noexcept;
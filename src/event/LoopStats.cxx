@@ -0,0 +1,66 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "LoopStats.hxx"
+#include "util/StatsWriter.hxx"
+
+static double
+ToSeconds(EventLoopStats::Duration d) noexcept
+{
+	return std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+}
+
+void
+WriteStats(StatsWriter &writer, const EventLoopStats &stats,
+	   const char *labels)
+{
+	writer.WriteCounter("event_loop_iterations_total", labels,
+			    stats.n_iterations);
+	writer.WriteCounter("event_loop_callbacks_total", labels,
+			    stats.n_callbacks);
+	writer.WriteCounter("event_loop_slow_callbacks_total", labels,
+			    stats.n_slow_callbacks);
+	writer.WriteCounter("event_loop_deferred_seconds_total", labels,
+			    ToSeconds(stats.deferred_time));
+	writer.WriteCounter("event_loop_wait_seconds_total", labels,
+			    ToSeconds(stats.wait_time));
+	writer.WriteCounter("event_loop_dispatch_seconds_total", labels,
+			    ToSeconds(stats.dispatch_time));
+	writer.WriteCounter("event_loop_busy_polls_total", labels,
+			    stats.n_busy_polls);
+	writer.WriteCounter("event_loop_busy_poll_hits_total", labels,
+			    stats.n_busy_poll_hits);
+	writer.WriteCounter("event_loop_busy_poll_seconds_total", labels,
+			    ToSeconds(stats.busy_poll_time));
+	writer.WriteHistogram("event_loop_callback_duration_seconds", labels,
+			      stats.callback_durations, 1e-6);
+}
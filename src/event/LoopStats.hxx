@@ -0,0 +1,113 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/LogLinearHistogram.hxx"
+
+#include <chrono>
+
+#include <stdint.h>
+
+class StatsWriter;
+
+/**
+ * Counters collected by an #EventLoop after
+ * EventLoop::EnableStats() has been called.
+ */
+struct EventLoopStats {
+	typedef std::chrono::steady_clock::duration Duration;
+
+	/**
+	 * The number of libevent loop iterations.
+	 */
+	uint64_t n_iterations = 0;
+
+	/**
+	 * The number of callbacks which have been measured.
+	 */
+	uint64_t n_callbacks = 0;
+
+	/**
+	 * The number of callbacks which took longer than the
+	 * threshold passed to EventLoop::EnableStats().
+	 */
+	uint64_t n_slow_callbacks = 0;
+
+	/**
+	 * Time spent in EventLoop::RunDeferred().
+	 */
+	Duration deferred_time = Duration::zero();
+
+	/**
+	 * Time spent inside libevent, but outside of callbacks; this
+	 * is mostly waiting in epoll_wait().
+	 */
+	Duration wait_time = Duration::zero();
+
+	/**
+	 * Time spent in callbacks invoked by libevent.
+	 */
+	Duration dispatch_time = Duration::zero();
+
+	/**
+	 * The number of busy-polling phases (see
+	 * EventLoop::SetBusyPoll()) and how many of them found an
+	 * event before the budget expired.
+	 */
+	uint64_t n_busy_polls = 0, n_busy_poll_hits = 0;
+
+	/**
+	 * Time spent busy-polling.
+	 */
+	Duration busy_poll_time = Duration::zero();
+
+	/**
+	 * The durations of all measured callbacks in microseconds.
+	 */
+	LogLinearHistogram<> callback_durations;
+
+	void Reset() noexcept {
+		*this = EventLoopStats();
+	}
+};
+
+/**
+ * Write the counters into a #StatsWriter.  It must be called from
+ * the thread of the #EventLoop which owns this object.
+ *
+ * @param labels preformatted labels (see #StatsWriter) to tell
+ * several loops apart; may be nullptr
+ */
+void
+WriteStats(StatsWriter &writer, const EventLoopStats &stats,
+	   const char *labels=nullptr);
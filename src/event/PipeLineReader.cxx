@@ -31,10 +31,36 @@
  */
 
 #include "PipeLineReader.hxx"
-#include "util/ExtractLine.hxx"
 
 #include <string.h>
 
+constexpr size_t PipeLineReader::INITIAL_BUFFER_SIZE;
+constexpr size_t PipeLineReader::MAX_BUFFER_SIZE;
+constexpr size_t PipeLineReader::MAX_BATCH;
+
+bool
+PipeLineReader::SubmitBatch(WritableBuffer<char> *batch,
+			    size_t &n_batch) noexcept
+{
+	if (n_batch == 0)
+		return true;
+
+	const size_t n = n_batch;
+	n_batch = 0;
+	return batch_callback({batch, n});
+}
+
+inline bool
+PipeLineReader::SubmitLine(WritableBuffer<char> *batch, size_t &n_batch,
+			   WritableBuffer<char> line) noexcept
+{
+	if (!batch_callback)
+		return callback(line);
+
+	batch[n_batch++] = line;
+	return n_batch < MAX_BATCH || SubmitBatch(batch, n_batch);
+}
+
 void
 PipeLineReader::TryRead(bool flush) noexcept
 {
@@ -46,18 +72,66 @@ PipeLineReader::TryRead(bool flush) noexcept
 	auto nbytes = fd.Read(w.data, w.size);
 	if (nbytes <= 0) {
 		event.Delete();
-		callback(nullptr);
+		if (batch_callback)
+			batch_callback(nullptr);
+		else
+			callback(nullptr);
 		return;
 	}
 
 	buffer.Append(nbytes);
 
+	/* the lines are not consumed from the buffer before all of
+	   them have been submitted, so they remain valid during the
+	   whole batch */
+
+	const auto r = buffer.Read();
+	char *p = r.data;
+	char *const end = r.data + r.size;
+
+	WritableBuffer<char> batch[MAX_BATCH];
+	size_t n_batch = 0;
+
 	while (true) {
-		auto r = ExtractLine(buffer, flush);
-		if (r.IsNull())
+		char *newline = (char *)memchr(p, '\n', end - p);
+		if (newline == nullptr)
 			break;
 
-		if (!callback(r))
+		char *line_end = newline;
+		while (line_end > p && line_end[-1] == '\r')
+			--line_end;
+
+		WritableBuffer<char> line(p, line_end - p);
+		p = newline + 1;
+
+		if (!SubmitLine(batch, n_batch, line))
+			return;
+	}
+
+	if (p < end && (flush || (p == r.data && buffer.IsFull() &&
+				   buffer.GetCapacity() >= MAX_BUFFER_SIZE))) {
+		/* submit the incomplete last line (at the end of the
+		   pipe or if it does not fit into the buffer) */
+		WritableBuffer<char> line(p, end - p);
+		p = end;
+
+		if (!SubmitLine(batch, n_batch, line))
 			return;
 	}
+
+	if (!SubmitBatch(batch, n_batch))
+		return;
+
+	buffer.Consume(p - r.data);
+
+	if (end_callback)
+		end_callback();
+
+	/* growing moves the buffer, so this must not be done before
+	   the lines have been handled completely */
+	if ((size_t(nbytes) == w.size || buffer.IsFull()) &&
+	    buffer.GetCapacity() < MAX_BUFFER_SIZE)
+		/* read() has filled the whole buffer; there is
+		   probably more, so read bigger chunks next time */
+		buffer.Grow(buffer.GetCapacity() * 2);
 }
@@ -35,22 +35,43 @@
 #include "SocketEvent.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 #include "util/BindMethod.hxx"
-#include "util/StaticFifoBuffer.hxx"
+#include "util/DynamicFifoBuffer.hxx"
+#include "util/ConstBuffer.hxx"
 #include "util/WritableBuffer.hxx"
 
 /**
  * Read text lines from a (non-blocking) pipe.  Whenever a newline
  * character is found, the line (without trailing NL/CR characters) is
  * passed to the callback.
+ *
+ * The buffer starts small and grows (up to #MAX_BUFFER_SIZE) while
+ * read() keeps filling it completely, i.e. for chatty writers; a
+ * line is split only if it does not fit into the maximum buffer
+ * size.
  */
 class PipeLineReader {
+	static constexpr size_t INITIAL_BUFFER_SIZE = 8192;
+	static constexpr size_t MAX_BUFFER_SIZE = 256 * 1024;
+
+	/**
+	 * The maximum number of lines passed to #batch_callback in
+	 * one call.
+	 */
+	static constexpr size_t MAX_BATCH = 64;
+
 	UniqueFileDescriptor fd;
 	SocketEvent event;
 
-	StaticFifoBuffer<char, 8192> buffer;
+	DynamicFifoBuffer<char> buffer{INITIAL_BUFFER_SIZE};
 
 	typedef BoundMethod<bool(WritableBuffer<char> line)> Callback;
-	const Callback callback;
+	const Callback callback = nullptr;
+
+	typedef BoundMethod<bool(ConstBuffer<WritableBuffer<char>> lines)> BatchCallback;
+	const BatchCallback batch_callback = nullptr;
+
+	typedef BoundMethod<void()> EndCallback;
+	const EndCallback end_callback = nullptr;
 
 public:
 	/**
@@ -58,14 +79,42 @@ public:
 	 * received line, and again with a nullptr parameter at the
 	 * end of the pipe; it returns false if the #PipeLineReader
 	 * has been destroyed inside the callback
+	 * @param _end_callback an optional function which is invoked
+	 * after all complete lines from one read() have been passed
+	 * to #callback; until then, the lines passed to #callback
+	 * remain valid, which allows the caller to process them in
+	 * one batch; it must not destroy the #PipeLineReader
 	 */
 	PipeLineReader(EventLoop &event_loop,
 		       UniqueFileDescriptor _fd,
-		       Callback _callback) noexcept
+		       Callback _callback,
+		       EndCallback _end_callback=nullptr) noexcept
 		:fd(std::move(_fd)),
 		 event(event_loop, fd.Get(), SocketEvent::READ|SocketEvent::PERSIST,
 		       BIND_THIS_METHOD(OnPipeReadable)),
-		 callback(_callback) {
+		 callback(_callback), end_callback(_end_callback) {
+		event.Add();
+	}
+
+	/**
+	 * Construct an instance which passes all complete lines of
+	 * one read() to the callback at once (in chunks of up to
+	 * #MAX_BATCH lines).  This saves a lot of callback overhead
+	 * for chatty writers.
+	 *
+	 * @param _callback this function will be invoked with the
+	 * lines, and again with a nullptr parameter at the end of the
+	 * pipe; the lines remain valid until the callback returns,
+	 * and may be modified in place; it returns false if the
+	 * #PipeLineReader has been destroyed inside the callback
+	 */
+	PipeLineReader(EventLoop &event_loop,
+		       UniqueFileDescriptor _fd,
+		       BatchCallback _callback) noexcept
+		:fd(std::move(_fd)),
+		 event(event_loop, fd.Get(), SocketEvent::READ|SocketEvent::PERSIST,
+		       BIND_THIS_METHOD(OnPipeReadable)),
+		 batch_callback(_callback) {
 		event.Add();
 	}
 
@@ -89,6 +138,21 @@ public:
 	}
 
 private:
+	/**
+	 * Pass one line to #callback or collect it for
+	 * #batch_callback.
+	 *
+	 * @return false if the #PipeLineReader has been destroyed
+	 */
+	bool SubmitLine(WritableBuffer<char> *batch, size_t &n_batch,
+			WritableBuffer<char> line) noexcept;
+
+	/**
+	 * @return false if the #PipeLineReader has been destroyed
+	 */
+	bool SubmitBatch(WritableBuffer<char> *batch,
+			 size_t &n_batch) noexcept;
+
 	void TryRead(bool flush) noexcept;
 
 	void OnPipeReadable(unsigned) noexcept {
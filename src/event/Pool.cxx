@@ -0,0 +1,103 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Pool.hxx"
+
+#include <algorithm>
+
+#include <sched.h>
+
+static size_t
+CountAllowedCpus() noexcept
+{
+	cpu_set_t cpu_set;
+	if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) < 0)
+		return 1;
+
+	int n = CPU_COUNT(&cpu_set);
+	return n > 0 ? n : 1;
+}
+
+/**
+ * Determine the CPU each thread shall be pinned to: the CPUs of the
+ * process's affinity mask in ascending order, wrapping around if
+ * there are more threads than CPUs.
+ */
+static std::unique_ptr<int[]>
+MakeCpuTable(size_t n)
+{
+	std::unique_ptr<int[]> cpus(new int[n]);
+
+	cpu_set_t cpu_set;
+	if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) < 0 ||
+	    CPU_COUNT(&cpu_set) == 0) {
+		std::fill_n(cpus.get(), n, -1);
+		return cpus;
+	}
+
+	int cpu = -1;
+	for (size_t i = 0; i < n; ++i) {
+		do {
+			cpu = (cpu + 1) % CPU_SETSIZE;
+		} while (!CPU_ISSET(cpu, &cpu_set));
+
+		cpus[i] = cpu;
+	}
+
+	return cpus;
+}
+
+EventLoopPool::EventLoopPool(size_t _n)
+	:n(_n > 0 ? _n : CountAllowedCpus()),
+	 threads(new EventThread[n]),
+	 cpus(MakeCpuTable(n))
+{
+}
+
+void
+EventLoopPool::Start(bool pin)
+{
+	try {
+		for (size_t i = 0; i < n; ++i)
+			threads[i].Start(pin ? cpus[i] : -1);
+	} catch (...) {
+		Stop();
+		throw;
+	}
+}
+
+void
+EventLoopPool::Stop() noexcept
+{
+	for (size_t i = 0; i < n; ++i)
+		threads[i].Stop();
+}
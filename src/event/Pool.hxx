@@ -0,0 +1,116 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef EVENT_POOL_HXX
+#define EVENT_POOL_HXX
+
+#include "Thread.hxx"
+
+#include <memory>
+
+#include <stddef.h>
+
+/**
+ * A fixed number of #EventThread instances, usually one per CPU.
+ * This allows spreading the load of a server over all CPU cores,
+ * e.g. with one SO_REUSEPORT listener per loop (see
+ * #PoolServerSocket).
+ *
+ * All events must be registered with the loops before Start() is
+ * called; after that, each loop may only be accessed from inside its
+ * own thread.
+ */
+class EventLoopPool {
+	const size_t n;
+
+	const std::unique_ptr<EventThread[]> threads;
+
+	/**
+	 * The CPU each thread is pinned to by Start(), in the order
+	 * of the process's CPU affinity mask; -1 if the mask is
+	 * unknown.
+	 */
+	const std::unique_ptr<int[]> cpus;
+
+public:
+	/**
+	 * Throws std::system_error on error.
+	 *
+	 * @param _n the number of threads; 0 means one per CPU the
+	 * process is allowed to run on
+	 */
+	explicit EventLoopPool(size_t _n=0);
+
+	~EventLoopPool() noexcept {
+		Stop();
+	}
+
+	EventLoopPool(const EventLoopPool &) = delete;
+	EventLoopPool &operator=(const EventLoopPool &) = delete;
+
+	size_t size() const noexcept {
+		return n;
+	}
+
+	EventLoop &operator[](size_t i) noexcept {
+		assert(i < n);
+
+		return threads[i].GetEventLoop();
+	}
+
+	/**
+	 * Returns the CPU of each thread (see Start()), i.e. an
+	 * array of size() elements; -1 means the thread does not get
+	 * pinned.  This is already known before Start(), e.g. for
+	 * PoolServerSocket::Listen().
+	 */
+	const int *GetCpus() const noexcept {
+		return cpus.get();
+	}
+
+	/**
+	 * Launch all threads.
+	 *
+	 * Throws std::system_error on error.
+	 *
+	 * @param pin pin each thread to one CPU (in the order of the
+	 * process's CPU affinity mask, see GetCpus())?
+	 */
+	void Start(bool pin=true);
+
+	/**
+	 * Stop all threads and wait for them to finish.
+	 */
+	void Stop() noexcept;
+};
+
+#endif
@@ -33,11 +33,27 @@
 #include "SignalEvent.hxx"
 #include "system/Error.hxx"
 
+#include <array>
+
 #include <sys/signalfd.h>
 #include <unistd.h>
+#include <errno.h>
+
+/**
+ * The maximum number of signals read with one read() call.
+ */
+static constexpr size_t SIGNAL_BATCH = 32;
 
 SignalEvent::SignalEvent(EventLoop &loop, Callback _callback) noexcept
-	:event(loop, BIND_THIS_METHOD(EventCallback)), callback(_callback)
+	:event(loop, BIND_THIS_METHOD(EventCallback)),
+	 callback(_callback), info_callback(nullptr)
+{
+	sigemptyset(&mask);
+}
+
+SignalEvent::SignalEvent(EventLoop &loop, InfoCallback _callback) noexcept
+	:event(loop, BIND_THIS_METHOD(EventCallback)),
+	 callback(nullptr), info_callback(_callback)
 {
 	sigemptyset(&mask);
 }
@@ -71,16 +87,43 @@ SignalEvent::Disable() noexcept
 	event.Delete();
 }
 
+inline void
+SignalEvent::Dispatch(const struct signalfd_siginfo &info) noexcept
+{
+	if (info_callback)
+		info_callback(info);
+	else
+		callback(info.ssi_signo);
+}
+
 void
 SignalEvent::EventCallback(unsigned) noexcept
 {
-	struct signalfd_siginfo info;
-	ssize_t nbytes = read(fd, &info, sizeof(info));
-	if (nbytes <= 0) {
-		// TODO: log error?
-		Disable();
-		return;
-	}
+	std::array<struct signalfd_siginfo, SIGNAL_BATCH> info;
+
+	while (true) {
+		ssize_t nbytes = read(fd, info.data(), sizeof(info));
+		if (nbytes <= 0) {
+			if (nbytes < 0 && errno == EAGAIN)
+				/* all pending signals have been read */
+				return;
 
-	callback(info.ssi_signo);
+			// TODO: log error?
+			Disable();
+			return;
+		}
+
+		const size_t n = size_t(nbytes) / sizeof(info.front());
+		for (size_t i = 0; i < n; ++i) {
+			Dispatch(info[i]);
+
+			if (!event.IsPending(SocketEvent::READ))
+				/* the callback has called Disable() */
+				return;
+		}
+
+		if (n < info.size())
+			/* short read: the signalfd is empty now */
+			return;
+	}
 }
@@ -39,6 +39,8 @@
 #include <assert.h>
 #include <signal.h>
 
+struct signalfd_siginfo;
+
 /**
  * Listen for signals delivered to this process, and then invoke a
  * callback.
@@ -46,6 +48,12 @@
  * After constructing an instance, call Add() to add signals to listen
  * on.  When done, call Enable().  After that, Add() must not be
  * called again.
+ *
+ * All signals which are pending on the signalfd are read with as
+ * few read() calls as possible, and the callback is invoked once
+ * for each of them.  The #InfoCallback variant receives the full
+ * "signalfd_siginfo" (e.g. the sender's pid, or the child's pid
+ * and exit status for SIGCHLD).
  */
 class SignalEvent {
 	int fd = -1;
@@ -55,16 +63,28 @@ class SignalEvent {
 	sigset_t mask;
 
 	typedef BoundMethod<void(int)> Callback;
+	typedef BoundMethod<void(const struct signalfd_siginfo &)> InfoCallback;
+
+	/**
+	 * Exactly one of these two is set.
+	 */
 	const Callback callback;
+	const InfoCallback info_callback;
 
 public:
 	SignalEvent(EventLoop &loop, Callback _callback) noexcept;
+	SignalEvent(EventLoop &loop, InfoCallback _callback) noexcept;
 
 	SignalEvent(EventLoop &loop, int signo, Callback _callback) noexcept
 		:SignalEvent(loop, _callback) {
 		Add(signo);
 	}
 
+	SignalEvent(EventLoop &loop, int signo, InfoCallback _callback) noexcept
+		:SignalEvent(loop, _callback) {
+		Add(signo);
+	}
+
 	~SignalEvent() noexcept;
 
 	bool IsDefined() const noexcept {
@@ -81,6 +101,8 @@ public:
 	void Disable() noexcept;
 
 private:
+	void Dispatch(const struct signalfd_siginfo &info) noexcept;
+
 	void EventCallback(unsigned events) noexcept;
 };
 
@@ -50,6 +50,13 @@ public:
 	static constexpr unsigned PERSIST = EV_PERSIST;
 	static constexpr unsigned TIMEOUT = EV_TIMEOUT;
 
+	/**
+	 * Edge-triggered: the callback is invoked only when the socket
+	 * becomes ready, and the event can stay registered all the
+	 * time.
+	 */
+	static constexpr unsigned EDGE = EV_ET;
+
 	SocketEvent(EventLoop &_event_loop, Callback _callback) noexcept
 		:event_loop(_event_loop), callback(_callback) {}
 
@@ -103,6 +110,8 @@ private:
 	static void EventCallback(gcc_unused evutil_socket_t fd, short events,
 				  void *ctx) noexcept {
 		auto &event = *(SocketEvent *)ctx;
+		EventLoop::ProfileScope scope(event.event_loop,
+					      event.callback.GetFunctionAddress());
 		event.callback(events);
 	}
 };
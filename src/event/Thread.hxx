@@ -0,0 +1,101 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef EVENT_THREAD_HXX
+#define EVENT_THREAD_HXX
+
+#include "Loop.hxx"
+#include "InjectEvent.hxx"
+
+#include <thread>
+
+/**
+ * A thread which runs its own #EventLoop.  The loop has an
+ * independent struct event_base, therefore all events registered
+ * with it must only be touched from inside this thread (or before
+ * Start() / after Stop()).
+ */
+class EventThread {
+	EventLoop event_loop;
+
+	/**
+	 * Scheduled by Stop() to break the loop from another thread.
+	 */
+	InjectEvent stop_event;
+
+	std::thread thread;
+
+public:
+	/**
+	 * Throws std::system_error on error.
+	 */
+	EventThread()
+		:event_loop(EventLoop::Independent()),
+		 stop_event(event_loop, BIND_THIS_METHOD(OnStop)) {}
+
+	~EventThread() noexcept {
+		Stop();
+	}
+
+	EventThread(const EventThread &) = delete;
+	EventThread &operator=(const EventThread &) = delete;
+
+	EventLoop &GetEventLoop() noexcept {
+		return event_loop;
+	}
+
+	bool IsRunning() const noexcept {
+		return thread.joinable();
+	}
+
+	/**
+	 * Launch the thread.
+	 *
+	 * Throws std::system_error on error.
+	 *
+	 * @param cpu pin the thread to this CPU; -1 means no pinning
+	 */
+	void Start(int cpu=-1);
+
+	/**
+	 * Ask the thread to break its #EventLoop and wait until it has
+	 * finished.  This may be called from any other thread.  Does
+	 * nothing if the thread is not running.
+	 */
+	void Stop() noexcept;
+
+private:
+	void Run() noexcept;
+	void OnStop() noexcept;
+};
+
+#endif
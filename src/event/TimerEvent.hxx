@@ -40,13 +40,16 @@
  * Invoke an event callback after a certain amount of time.
  */
 class TimerEvent {
+	EventLoop &loop;
+
 	Event event;
 
 	const BoundMethod<void()> callback;
 
 public:
-	TimerEvent(EventLoop &loop, BoundMethod<void()> _callback) noexcept
-		:event(loop, -1, 0, Callback, this), callback(_callback) {}
+	TimerEvent(EventLoop &_loop, BoundMethod<void()> _callback) noexcept
+		:loop(_loop), event(_loop, -1, 0, Callback, this),
+		 callback(_callback) {}
 
 	bool IsPending() const noexcept {
 		return event.IsTimerPending();
@@ -65,6 +68,8 @@ private:
 			     gcc_unused short events,
 			     void *ctx) noexcept {
 		auto &event = *(TimerEvent *)ctx;
+		EventLoop::ProfileScope scope(event.loop,
+					      event.callback.GetFunctionAddress());
 		event.callback();
 	}
 };
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TimerWheel.hxx"
+
+#include <algorithm>
+
+constexpr uint64_t TimerWheel::NONE;
+
+bool
+TimerWheel::IsEmpty() const noexcept
+{
+	for (const auto &i : tier0)
+		if (!i.empty())
+			return false;
+
+	for (const auto &i : tier1)
+		if (!i.empty())
+			return false;
+
+	for (const auto &i : tier2)
+		if (!i.empty())
+			return false;
+
+	return overflow.empty();
+}
+
+void
+TimerWheel::Insert(CoarseTimerEvent &t) noexcept
+{
+	assert(!t.IsPending());
+
+	if (t.due < current)
+		/* already expired: fire on the next tick */
+		t.due = current;
+
+	const uint64_t delta = t.due - current;
+
+	if (delta < SIZE0)
+		tier0[t.due & (SIZE0 - 1)].push_back(t);
+	else if (delta < (uint64_t(1) << SHIFT2))
+		tier1[(t.due >> SHIFT1) & (SIZE1 - 1)].push_back(t);
+	else if (delta < (uint64_t(1) << SHIFT3))
+		tier2[(t.due >> SHIFT2) & (SIZE2 - 1)].push_back(t);
+	else
+		overflow.push_back(t);
+}
+
+inline void
+TimerWheel::Cascade(List &list) noexcept
+{
+	List tmp;
+	tmp.swap(list);
+
+	while (!tmp.empty()) {
+		auto &t = tmp.front();
+		tmp.pop_front();
+		Insert(t);
+	}
+}
+
+inline void
+TimerWheel::Fire(List &list) noexcept
+{
+	/* the callback may schedule or cancel other timers, even ones
+	   in this list; therefore unlink one at a time */
+	while (!list.empty()) {
+		auto &t = list.front();
+		list.pop_front();
+		t.Run();
+	}
+}
+
+uint64_t
+TimerWheel::Run(uint64_t now) noexcept
+{
+	while (current <= now) {
+		/* skip idle ticks: jump straight to the next non-empty
+		   slot or cascade boundary */
+		const uint64_t next = GetNextWakeup();
+		if (next > now) {
+			current = now + 1;
+			break;
+		}
+
+		if (next > current)
+			current = next;
+
+		if ((current & ((uint64_t(1) << SHIFT1) - 1)) == 0) {
+			if ((current & ((uint64_t(1) << SHIFT2) - 1)) == 0) {
+				if ((current & ((uint64_t(1) << SHIFT3) - 1)) == 0)
+					Cascade(overflow);
+
+				Cascade(tier2[(current >> SHIFT2) & (SIZE2 - 1)]);
+			}
+
+			Cascade(tier1[(current >> SHIFT1) & (SIZE1 - 1)]);
+		}
+
+		/* advance before firing, so timers scheduled by the
+		   callbacks land in a later slot */
+		List &list = tier0[current & (SIZE0 - 1)];
+		++current;
+		Fire(list);
+	}
+
+	return GetNextWakeup();
+}
+
+uint64_t
+TimerWheel::GetNextWakeup() const noexcept
+{
+	uint64_t result = NONE;
+
+	for (uint64_t tick = current; tick < current + SIZE0; ++tick) {
+		if (!tier0[tick & (SIZE0 - 1)].empty()) {
+			result = tick;
+			break;
+		}
+	}
+
+	/* tier 1 and 2 entries are moved to a finer tier at their slot
+	   boundary, which may come before the first tier 0 entry; wake
+	   up then (the first boundary may be the current tick if it
+	   has not been processed yet) */
+
+	const uint64_t block1 = (current + (uint64_t(1) << SHIFT1) - 1) >> SHIFT1;
+	for (uint64_t i = 0; i < SIZE1; ++i) {
+		if (!tier1[(block1 + i) & (SIZE1 - 1)].empty()) {
+			result = std::min(result, (block1 + i) << SHIFT1);
+			break;
+		}
+	}
+
+	const uint64_t block2 = (current + (uint64_t(1) << SHIFT2) - 1) >> SHIFT2;
+	for (uint64_t i = 0; i < SIZE2; ++i) {
+		if (!tier2[(block2 + i) & (SIZE2 - 1)].empty()) {
+			result = std::min(result, (block2 + i) << SHIFT2);
+			break;
+		}
+	}
+
+	if (!overflow.empty())
+		result = std::min(result,
+				  ((current + (uint64_t(1) << SHIFT3) - 1) >> SHIFT3) << SHIFT3);
+
+	return result;
+}
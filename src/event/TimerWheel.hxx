@@ -0,0 +1,142 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TIMER_WHEEL_HXX
+#define TIMER_WHEEL_HXX
+
+#include "CoarseTimerEvent.hxx"
+#include "util/Compiler.h"
+
+#include <boost/intrusive/list.hpp>
+
+#include <stdint.h>
+
+/**
+ * A hierarchical hashed timer wheel for #CoarseTimerEvent.  Insertion
+ * and removal are O(1); timers far in the future are cascaded into
+ * finer tiers as time advances.
+ *
+ * Tier 0 has millisecond resolution and spans 1024 ms; tier 1 has
+ * 1024 ms resolution and spans about 65 seconds; tier 2 spans about
+ * 70 minutes.  Timers beyond that are kept in an overflow list which
+ * is rescanned once per tier 2 revolution.
+ *
+ * All times are milliseconds on an arbitrary monotonic scale (see
+ * ToTick()).
+ */
+class TimerWheel {
+	static constexpr unsigned BITS0 = 10, BITS1 = 6, BITS2 = 6;
+	static constexpr unsigned SIZE0 = 1u << BITS0;
+	static constexpr unsigned SIZE1 = 1u << BITS1;
+	static constexpr unsigned SIZE2 = 1u << BITS2;
+	static constexpr unsigned SHIFT1 = BITS0;
+	static constexpr unsigned SHIFT2 = BITS0 + BITS1;
+	static constexpr unsigned SHIFT3 = BITS0 + BITS1 + BITS2;
+
+	typedef boost::intrusive::list<CoarseTimerEvent,
+				       boost::intrusive::member_hook<CoarseTimerEvent,
+								     CoarseTimerEvent::SiblingsHook,
+								     &CoarseTimerEvent::siblings>,
+				       boost::intrusive::constant_time_size<false>> List;
+
+	List tier0[SIZE0], tier1[SIZE1], tier2[SIZE2], overflow;
+
+	/**
+	 * The next tick to be processed by Run(); all earlier ticks have
+	 * been handled already.
+	 */
+	uint64_t current;
+
+public:
+	static constexpr uint64_t NONE = ~uint64_t(0);
+
+	/**
+	 * @param now the current tick; the wheel starts there, so
+	 * timers are placed relative to the actual time and Run()
+	 * does not have to catch up from tick 0
+	 */
+	explicit TimerWheel(uint64_t now) noexcept
+		:current(now) {}
+
+	TimerWheel(const TimerWheel &) = delete;
+	TimerWheel &operator=(const TimerWheel &) = delete;
+
+	/**
+	 * Convert a std::chrono::steady_clock time point to a tick
+	 * (milliseconds, rounded down).
+	 */
+	static constexpr uint64_t ToTick(std::chrono::steady_clock::time_point t) noexcept {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+	}
+
+	gcc_pure
+	bool IsEmpty() const noexcept;
+
+	/**
+	 * Insert a timer which is not currently linked.
+	 *
+	 * @param due the tick when the timer expires
+	 */
+	void Insert(CoarseTimerEvent &t, uint64_t due) noexcept {
+		t.due = due;
+		Insert(t);
+	}
+
+	/**
+	 * Invoke all timers which have expired at the given tick.
+	 *
+	 * @return the tick when the next timer may expire (an upper
+	 * bound for waking up again), or #NONE if the wheel is empty
+	 */
+	uint64_t Run(uint64_t now) noexcept;
+
+	/**
+	 * Determine when Run() needs to be called next: the earliest
+	 * non-empty tier 0 slot or cascade boundary.
+	 *
+	 * @return a tick or #NONE if the wheel is empty
+	 */
+	gcc_pure
+	uint64_t GetNextWakeup() const noexcept;
+
+private:
+	/**
+	 * Insert a timer which is not currently linked; its "due" field
+	 * must be set already.
+	 */
+	void Insert(CoarseTimerEvent &t) noexcept;
+
+	void Cascade(List &list) noexcept;
+	static void Fire(List &list) noexcept;
+};
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "WorkerPool.hxx"
+
+#include <algorithm>
+
+#include <assert.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct WorkerPoolWorker {
+	WorkerPool *pool;
+
+	std::mutex mutex;
+
+	boost::intrusive::list<WorkerJob,
+			       boost::intrusive::constant_time_size<false>> queue;
+
+	std::thread thread;
+
+	/**
+	 * The NUMA node this thread runs on (or -1 if unknown).
+	 * Written by the thread itself before it takes its first
+	 * job; Steal() and ChooseWorker() tolerate stale values.
+	 */
+	std::atomic<int> numa_node{-1};
+};
+
+/**
+ * The #WorkerPoolWorker of the calling thread (nullptr if this is
+ * not a worker thread).
+ */
+static thread_local WorkerPoolWorker *current_worker;
+
+/**
+ * Determine the NUMA node of the CPU the calling thread runs on.
+ *
+ * @return the node number or -1 on error
+ */
+static int
+GetCurrentNumaNode() noexcept
+{
+	unsigned cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) < 0)
+		return -1;
+
+	return node;
+}
+
+/**
+ * Returns the CPU numbers in the process's affinity mask.
+ */
+static std::vector<int>
+GetAllowedCpus()
+{
+	std::vector<int> result;
+
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		for (int i = 0; i < CPU_SETSIZE; ++i)
+			if (CPU_ISSET(i, &set))
+				result.push_back(i);
+
+	return result;
+}
+
+void
+WorkerJob::OnDoneEvent() noexcept
+{
+	/* no lock needed: the worker thread has released the job
+	   before scheduling this event, and nobody else touches a
+	   DONE job */
+	state = State::IDLE;
+	OnDone();
+}
+
+void
+WorkerJob::CancelHandle::Cancel() noexcept
+{
+	assert(job.submit_pool != nullptr);
+
+	job.submit_pool->Cancel(job);
+}
+
+WorkerPool::WorkerPool(unsigned n, bool pin)
+{
+	if (n == 0)
+		n = std::max(std::thread::hardware_concurrency(), 1u);
+
+	std::vector<int> cpus;
+	if (pin)
+		cpus = GetAllowedCpus();
+
+	workers.reset(new Worker[n]);
+	for (unsigned i = 0; i < n; ++i)
+		workers[i].pool = this;
+
+	/* set before starting the threads, which read it while
+	   stealing */
+	n_workers = n;
+
+	try {
+		for (unsigned i = 0; i < n; ++i) {
+			const int cpu = cpus.empty()
+				? -1
+				: cpus[i % cpus.size()];
+			workers[i].thread = std::thread(&WorkerPool::Run, this,
+							std::ref(workers[i]), cpu);
+		}
+	} catch (...) {
+		Stop();
+		throw;
+	}
+}
+
+WorkerPool::~WorkerPool() noexcept
+{
+	assert(n_queued == 0);
+
+	Stop();
+}
+
+void
+WorkerPool::Stop() noexcept
+{
+	{
+		const std::lock_guard<std::mutex> lock(sleep_mutex);
+		quit = true;
+		sleep_cond.notify_all();
+	}
+
+	for (unsigned i = 0; i < n_workers; ++i)
+		if (workers[i].thread.joinable())
+			workers[i].thread.join();
+}
+
+WorkerPool::Worker &
+WorkerPool::ChooseWorker() noexcept
+{
+	/* a job submitted by a worker stays with that worker */
+	if (current_worker != nullptr && current_worker->pool == this)
+		return *current_worker;
+
+	const unsigned start = next_worker.fetch_add(1, std::memory_order_relaxed);
+
+	/* prefer a worker on the submitting thread's NUMA node */
+	const int node = GetCurrentNumaNode();
+	if (node >= 0)
+		for (unsigned i = 0; i < n_workers; ++i) {
+			auto &w = workers[(start + i) % n_workers];
+			if (w.numa_node.load(std::memory_order_relaxed) == node)
+				return w;
+		}
+
+	return workers[start % n_workers];
+}
+
+void
+WorkerPool::Submit(WorkerJob &job) noexcept
+{
+	assert(job.state == WorkerJob::State::IDLE);
+	assert(n_workers > 0);
+
+	auto &w = ChooseWorker();
+	job.submit_pool = this;
+	job.submit_worker = &w;
+
+	{
+		const std::lock_guard<std::mutex> lock(w.mutex);
+		job.state = WorkerJob::State::QUEUED;
+		w.queue.push_back(job);
+		++n_queued;
+	}
+
+	/* lock the mutex to avoid a lost wakeup between a worker's
+	   predicate check and its wait() */
+	const std::lock_guard<std::mutex> lock(sleep_mutex);
+	sleep_cond.notify_one();
+}
+
+void
+WorkerPool::Cancel(WorkerJob &job) noexcept
+{
+	if (job.state == WorkerJob::State::IDLE)
+		return;
+
+	assert(job.submit_worker != nullptr);
+
+	{
+		auto &w = *job.submit_worker;
+		const std::lock_guard<std::mutex> lock(w.mutex);
+		if (job.state == WorkerJob::State::QUEUED) {
+			w.queue.erase(w.queue.iterator_to(job));
+			--n_queued;
+			job.state = WorkerJob::State::IDLE;
+			return;
+		}
+	}
+
+	/* RUNNING or DONE */
+	std::unique_lock<std::mutex> lock(done_mutex);
+	done_cond.wait(lock, [&job]{
+		return job.state != WorkerJob::State::RUNNING;
+	});
+
+	job.done_event.Cancel();
+	job.state = WorkerJob::State::IDLE;
+}
+
+WorkerJob *
+WorkerPool::Pop(Worker &w) noexcept
+{
+	const std::lock_guard<std::mutex> lock(w.mutex);
+	if (w.queue.empty())
+		return nullptr;
+
+	auto &job = w.queue.front();
+	w.queue.pop_front();
+	--n_queued;
+	job.state = WorkerJob::State::RUNNING;
+	return &job;
+}
+
+WorkerJob *
+WorkerPool::Steal(Worker &thief) noexcept
+{
+	const unsigned self = &thief - workers.get();
+	const int node = thief.numa_node.load(std::memory_order_relaxed);
+
+	/* first pass: same NUMA node; second pass: all others */
+	for (unsigned pass = 0; pass < 2; ++pass) {
+		for (unsigned i = 1; i < n_workers; ++i) {
+			auto &victim = workers[(self + i) % n_workers];
+			const bool same_node = victim.numa_node.load(std::memory_order_relaxed) == node;
+			if (same_node != (pass == 0))
+				continue;
+
+			auto *job = Pop(victim);
+			if (job != nullptr)
+				return job;
+		}
+	}
+
+	return nullptr;
+}
+
+inline void
+WorkerPool::Execute(WorkerJob &job) noexcept
+{
+	job.Run();
+
+	const std::lock_guard<std::mutex> lock(done_mutex);
+	job.state = WorkerJob::State::DONE;
+	job.done_event.Schedule();
+
+	/* wake up Cancel() */
+	done_cond.notify_all();
+}
+
+void
+WorkerPool::Run(Worker &w, int cpu) noexcept
+{
+	if (cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		/* errors are not fatal; the thread just floats */
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+
+	w.numa_node = GetCurrentNumaNode();
+	current_worker = &w;
+
+	while (true) {
+		WorkerJob *job = Pop(w);
+		if (job == nullptr)
+			job = Steal(w);
+
+		if (job != nullptr) {
+			Execute(*job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		sleep_cond.wait(lock, [this]{
+			return quit || n_queued > 0;
+		});
+
+		if (quit)
+			break;
+	}
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef EVENT_WORKER_POOL_HXX
+#define EVENT_WORKER_POOL_HXX
+
+#include "InjectEvent.hxx"
+#include "util/Cancellable.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool;
+struct WorkerPoolWorker;
+
+/**
+ * A CPU-bound job which is executed by a #WorkerPool thread; its
+ * completion is reported in the thread of the #EventLoop it was
+ * created for.
+ */
+class WorkerJob
+	: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> {
+
+	friend class WorkerPool;
+
+	enum class State {
+		IDLE,
+		QUEUED,
+		RUNNING,
+		DONE,
+	};
+
+	/**
+	 * QUEUED is entered and left only while holding the mutex of
+	 * #submit_worker; RUNNING is left while holding
+	 * WorkerPool::done_mutex.
+	 */
+	std::atomic<State> state{State::IDLE};
+
+	/**
+	 * The pool and the worker whose queue this job was submitted
+	 * to.  Set by WorkerPool::Submit().
+	 */
+	WorkerPool *submit_pool = nullptr;
+	WorkerPoolWorker *submit_worker = nullptr;
+
+	InjectEvent done_event;
+
+	/**
+	 * Adapter for WorkerPool::Submit(WorkerJob &,
+	 * CancellablePointer &).  It is a separate object so
+	 * derived classes may have their own Cancel() method.
+	 */
+	class CancelHandle final : public Cancellable {
+		WorkerJob &job;
+
+	public:
+		explicit CancelHandle(WorkerJob &_job) noexcept:job(_job) {}
+
+		void Cancel() noexcept override;
+	} cancel_handle{*this};
+
+public:
+	/**
+	 * Throws std::system_error on error.
+	 */
+	explicit WorkerJob(EventLoop &loop)
+		:done_event(loop, BIND_THIS_METHOD(OnDoneEvent)) {}
+
+	virtual ~WorkerJob() noexcept = default;
+
+	WorkerJob(const WorkerJob &) = delete;
+	WorkerJob &operator=(const WorkerJob &) = delete;
+
+	EventLoop &GetEventLoop() noexcept {
+		return done_event.GetEventLoop();
+	}
+
+protected:
+	/**
+	 * Do the work.  Runs in a worker thread.  It may submit more
+	 * jobs, which are then preferably executed by the same
+	 * thread.
+	 */
+	virtual void Run() noexcept = 0;
+
+	/**
+	 * Run() has finished.  Runs in the #EventLoop thread.  The
+	 * job may be destroyed or submitted again inside this
+	 * method.
+	 */
+	virtual void OnDone() noexcept = 0;
+
+private:
+	void OnDoneEvent() noexcept;
+};
+
+/**
+ * A fixed number of threads which execute #WorkerJob instances, to
+ * keep CPU-bound operations (e.g. private key operations,
+ * compression, hashing) out of the #EventLoop threads.
+ *
+ * Each thread has its own queue, so submitters and workers contend
+ * only on one queue at a time; an idle thread steals jobs from the
+ * others, preferring those on its own NUMA node.  Jobs submitted by
+ * a worker thread (from within WorkerJob::Run()) go to that
+ * thread's queue; others are distributed round-robin among the
+ * workers on the submitting thread's NUMA node.
+ */
+class WorkerPool {
+	using Worker = WorkerPoolWorker;
+
+	std::unique_ptr<Worker[]> workers;
+	unsigned n_workers = 0;
+
+	/**
+	 * The number of jobs in all queues.  Idle threads sleep until
+	 * it becomes non-zero.
+	 */
+	std::atomic<size_t> n_queued{0};
+
+	/**
+	 * For round-robin distribution in Submit().
+	 */
+	std::atomic<unsigned> next_worker{0};
+
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_cond;
+
+	/**
+	 * Protects the transition from WorkerJob::State::RUNNING and
+	 * wakes up Cancel().
+	 */
+	std::mutex done_mutex;
+	std::condition_variable done_cond;
+
+	bool quit = false;
+
+public:
+	/**
+	 * Throws std::system_error on error.
+	 *
+	 * @param n the number of threads; 0 means one per CPU
+	 * @param pin pin each thread to one CPU (of the process's
+	 * affinity mask), so its NUMA node is stable
+	 */
+	explicit WorkerPool(unsigned n=0, bool pin=false);
+
+	/**
+	 * All jobs must have been finished or cancelled.
+	 */
+	~WorkerPool() noexcept;
+
+	WorkerPool(const WorkerPool &) = delete;
+	WorkerPool &operator=(const WorkerPool &) = delete;
+
+	unsigned GetThreadCount() const noexcept {
+		return n_workers;
+	}
+
+	/**
+	 * Submit a job.  It must not be pending already.  This
+	 * method is thread-safe.
+	 */
+	void Submit(WorkerJob &job) noexcept;
+
+	/**
+	 * Like Submit(), but register the job in a
+	 * #CancellablePointer; CancellablePointer::Cancel() has the
+	 * same effect as Cancel(WorkerJob &).
+	 */
+	void Submit(WorkerJob &job, CancellablePointer &cancel_ptr) noexcept {
+		Submit(job);
+		cancel_ptr = job.cancel_handle;
+	}
+
+	/**
+	 * Cancel a job which has been submitted, and suppress its
+	 * OnDone() call.  If it is already running, this blocks
+	 * until it has finished.  Afterwards, the job may be
+	 * destroyed.  Must be called in the job's #EventLoop
+	 * thread.
+	 */
+	void Cancel(WorkerJob &job) noexcept;
+
+private:
+	void Stop() noexcept;
+
+	Worker &ChooseWorker() noexcept;
+
+	/**
+	 * Take a job from the given worker's queue.
+	 */
+	WorkerJob *Pop(Worker &worker) noexcept;
+
+	/**
+	 * Take a job from another worker's queue, preferring workers
+	 * on the same NUMA node.
+	 */
+	WorkerJob *Steal(Worker &thief) noexcept;
+
+	void Execute(WorkerJob &job) noexcept;
+
+	void Run(Worker &worker, int cpu) noexcept;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/DeferEvent.hxx"
+
+#include <coroutine>
+#include <exception>
+
+namespace Co {
+
+/**
+ * Resumes the coroutine awaiting an operation from a #DeferEvent,
+ * i.e. never from within the library callback which reported the
+ * completion; that way, the coroutine may freely destroy the
+ * awaitable or start new operations.  Helper class for awaitables
+ * wrapping callback-based operations.
+ */
+class DeferredResume final {
+	DeferEvent event;
+
+	std::coroutine_handle<> continuation;
+
+	bool done = false;
+
+public:
+	explicit DeferredResume(EventLoop &event_loop) noexcept
+		:event(event_loop, BIND_THIS_METHOD(OnDeferred)) {}
+
+	~DeferredResume() noexcept {
+		event.Cancel();
+	}
+
+	DeferredResume(const DeferredResume &) = delete;
+	DeferredResume &operator=(const DeferredResume &) = delete;
+
+	bool IsDone() const noexcept {
+		return done;
+	}
+
+	void SetContinuation(std::coroutine_handle<> _continuation) noexcept {
+		continuation = _continuation;
+
+		if (done)
+			event.Schedule();
+	}
+
+	/**
+	 * The operation has completed; schedule resumption of the
+	 * awaiting coroutine.
+	 */
+	void Complete() noexcept {
+		done = true;
+
+		if (continuation)
+			event.Schedule();
+	}
+
+private:
+	void OnDeferred() noexcept {
+		continuation.resume();
+	}
+};
+
+} // namespace Co
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/TimerEvent.hxx"
+#include "event/Duration.hxx"
+
+#include <chrono>
+#include <coroutine>
+
+namespace Co {
+
+/**
+ * Awaitable which suspends the coroutine for the given duration.
+ * The timer starts on construction.
+ */
+class Sleep final {
+	TimerEvent timer;
+
+	std::coroutine_handle<> continuation;
+
+	bool done = false;
+
+public:
+	Sleep(EventLoop &event_loop, std::chrono::microseconds duration) noexcept
+		:timer(event_loop, BIND_THIS_METHOD(OnTimer))
+	{
+		timer.Add(ToEventDuration(duration));
+	}
+
+	~Sleep() noexcept {
+		timer.Cancel();
+	}
+
+	Sleep(const Sleep &) = delete;
+	Sleep &operator=(const Sleep &) = delete;
+
+	bool await_ready() const noexcept {
+		return done;
+	}
+
+	void await_suspend(std::coroutine_handle<> _continuation) noexcept {
+		continuation = _continuation;
+	}
+
+	void await_resume() const noexcept {}
+
+private:
+	void OnTimer() noexcept {
+		done = true;
+
+		if (continuation)
+			continuation.resume();
+	}
+};
+
+} // namespace Co
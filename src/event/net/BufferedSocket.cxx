@@ -34,10 +34,14 @@
 #include "system/Error.hxx"
 #include "net/SocketProtocolError.hxx"
 #include "util/ConstBuffer.hxx"
+#include "util/Macros.hxx"
 
+#include <algorithm>
 #include <utility>
 
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 bool
 BufferedSocketHandler::OnBufferedTimeout() noexcept
@@ -94,6 +98,10 @@ BufferedSocket::ClosedByPeer() noexcept
 int
 BufferedSocket::AsFD() noexcept
 {
+	if (filter)
+		/* the raw socket would bypass the filter */
+		return -1;
+
 	if (!IsEmpty())
 		/* can switch to the raw socket descriptor only if the input
 		   buffer is empty */
@@ -177,6 +185,11 @@ BufferedSocket::SubmitFromBuffer() noexcept
 	const bool old_expect_more = expect_more;
 	expect_more = false;
 
+	if (input.GetAvailable() >= read_low_water)
+		/* the hint is satisfied; the handler may submit a new
+		   one */
+		read_low_water = 0;
+
 	BufferedResult result = InvokeData();
 	assert((result == BufferedResult::CLOSED) || IsValid());
 
@@ -197,11 +210,14 @@ BufferedSocket::SubmitFromBuffer() noexcept
 				   it's become empty (but don't
 				   refresh the pending timeout) */
 				base.ScheduleRead(read_timeout);
+
+			DeferFilterRead();
 		} else {
 			if (!IsConnected())
 				return false;
 		}
 
+		ApplyReadLowWater();
 		return true;
 
 	case BufferedResult::MORE:
@@ -218,6 +234,7 @@ BufferedSocket::SubmitFromBuffer() noexcept
 		}
 
 		input.FreeIfEmpty();
+		ApplyReadLowWater();
 
 		if (!base.IsReadPending())
 			/* reschedule the read event just in case the buffer was
@@ -225,6 +242,7 @@ BufferedSocket::SubmitFromBuffer() noexcept
 			   don't refresh the pending timeout) */
 			base.ScheduleRead(read_timeout);
 
+		DeferFilterRead();
 		return true;
 
 	case BufferedResult::AGAIN_OPTIONAL:
@@ -286,6 +304,9 @@ BufferedSocket::SubmitDirect() noexcept
 		return false;
 
 	case DirectResult::EMPTY:
+		/* the handler has seen EAGAIN */
+		base.ClearReadReady();
+
 		/* schedule read, but don't refresh timeout of old scheduled
 		   read */
 		if (!base.IsReadPending())
@@ -316,7 +337,47 @@ BufferedSocket::FillBuffer() noexcept
 	if (input.IsNull())
 		input.Allocate();
 
-	ssize_t nbytes = base.ReadToBuffer(input);
+	read_filled = false;
+
+	ssize_t nbytes;
+	if (filter) {
+		try {
+			nbytes = filter->Read(base.GetSocket(), input);
+		} catch (...) {
+			handler->OnBufferedError(std::current_exception());
+			return false;
+		}
+
+		/* the filter may have produced output (e.g. during
+		   the TLS handshake) or may now be able to accept
+		   more */
+		const int e = errno;
+		UpdateFilterWrite();
+		errno = e;
+	} else if (!base.IsEdgeTriggered()) {
+		const size_t space = input.Write().size;
+		nbytes = base.ReadToBuffer(input);
+		read_filled = nbytes > 0 && size_t(nbytes) == space;
+	} else {
+		nbytes = base.ReadToBuffer(input);
+
+		if (nbytes > 0) {
+			/* drain the socket until EAGAIN; there will
+			   be no new notification until then */
+			while (!input.IsFull()) {
+				const ssize_t more = base.ReadToBuffer(input);
+				if (more <= 0)
+					/* EAGAIN clears the readiness flag;
+					   other errors and the end of the
+					   stream are reported by the next
+					   call */
+					break;
+
+				nbytes += more;
+			}
+		}
+	}
+
 	if (gcc_likely(nbytes > 0)) {
 		/* success: data was added to the buffer */
 		expect_more = false;
@@ -339,6 +400,13 @@ BufferedSocket::FillBuffer() noexcept
 		if (errno == EAGAIN) {
 			input.FreeIfEmpty();
 
+			if (filter && filter->IsBusy()) {
+				/* OnSocketFilterReady() will resume
+				   reading */
+				base.UnscheduleRead();
+				return true;
+			}
+
 			/* schedule read, but don't refresh timeout of old
 			   scheduled read */
 			if (!base.IsReadPending())
@@ -353,6 +421,35 @@ BufferedSocket::FillBuffer() noexcept
 	return true;
 }
 
+void
+BufferedSocket::ApplyReadLowWater() noexcept
+{
+	if (!IsConnected())
+		return;
+
+	size_t value = 1;
+	if (read_low_water > 0 && !filter && input.IsDefined()) {
+		/* the kernel counts only what is still in the socket,
+		   and it must never wait for more than fits into our
+		   buffer */
+		const size_t available = input.GetAvailable();
+		if (read_low_water > available)
+			value = std::max<size_t>(std::min(read_low_water - available,
+							  input.GetCapacity() - available),
+						 1);
+	}
+
+	if (value == socket_low_water)
+		return;
+
+	socket_low_water = value;
+
+	/* errors are not fatal; without SO_RCVLOWAT, we just get
+	   more wakeups */
+	const int i = value;
+	base.GetSocket().SetOption(SOL_SOCKET, SO_RCVLOWAT, &i, sizeof(i));
+}
+
 inline bool
 BufferedSocket::TryRead2() noexcept
 {
@@ -388,11 +485,39 @@ BufferedSocket::TryRead2() noexcept
 	} else {
 		got_data = false;
 
-		if (!FillBuffer())
-			return false;
+		for (unsigned n = 1;; ++n) {
+			if (!FillBuffer())
+				return false;
 
-		if (!SubmitFromBuffer())
-			return false;
+			const bool filled = read_filled;
+
+			if (!SubmitFromBuffer())
+				return false;
+
+			if (!filled) {
+				/* short read: the socket has been
+				   drained, no need for more attempts
+				   next time */
+				if (read_burst > 1)
+					read_burst /= 2;
+				break;
+			}
+
+			if (n >= read_burst) {
+				/* the socket probably has more data;
+				   allow more refills per event next
+				   time, to save event loop
+				   iterations */
+				if (read_burst < MAX_READ_BURST)
+					read_burst *= 2;
+				break;
+			}
+
+			if (direct || !IsEmpty() || !base.IsReadPending())
+				/* the handler is not (yet) ready for
+				   more data */
+				break;
+		}
 
 		if (got_data)
 			/* refresh the timeout each time data was received */
@@ -437,6 +562,48 @@ BufferedSocket::OnSocketWrite() noexcept
 	assert(!destroyed);
 	assert(!ended);
 
+	if (corked && !output.empty()) {
+		/* the queue is held back until Uncork(), and the
+		   handler must not write before it */
+		base.UnscheduleWrite();
+		return true;
+	}
+
+	if (filter && !CanFilterWrite()) {
+		/* nothing can be written now; FillBuffer() or
+		   OnSocketFilterReady() will register the "write"
+		   event again */
+		base.UnscheduleWrite();
+		ScheduleSocketWrite();
+		return true;
+	}
+
+	if (HasPendingOutput()) {
+		switch (FlushOutput()) {
+		case FlushResult::DRAINED:
+			break;
+
+		case FlushResult::BLOCKING:
+			return true;
+
+		case FlushResult::CLOSED:
+			return false;
+		}
+
+		if (!handler->OnBufferedDrained())
+			return false;
+
+		if (!want_write) {
+			base.UnscheduleWrite();
+			return true;
+		}
+	} else if (!want_write) {
+		/* the event was registered only to flush the filter,
+		   and that has been done already */
+		base.UnscheduleWrite();
+		return true;
+	}
+
 	try {
 		return handler->OnBufferedWrite();
 	} catch (...) {
@@ -463,6 +630,57 @@ BufferedSocket::OnSocketTimeout() noexcept
 	return handler->OnBufferedTimeout();
 }
 
+/*
+ * SocketFilterHandler
+ *
+ */
+
+void
+BufferedSocket::OnSocketFilterReady() noexcept
+{
+	assert(!destroyed);
+
+	if (!IsConnected())
+		return;
+
+	defer_read.Schedule();
+	UpdateFilterWrite();
+}
+
+void
+BufferedSocket::ScheduleSocketWrite() noexcept
+{
+	if (filter) {
+		if (filter->IsBusy())
+			/* OnSocketFilterReady() will register the
+			   "write" event */
+			return;
+
+		if (filter->IsWaitingForInput()) {
+			/* FillBuffer() will register the "write"
+			   event as soon as the filter has received
+			   what it needs */
+			if (!base.IsReadPending())
+				base.ScheduleRead(read_timeout);
+
+			if (filter->GetPendingOutput() == 0)
+				return;
+		}
+	}
+
+	base.ScheduleWrite(write_timeout);
+}
+
+void
+BufferedSocket::UpdateFilterWrite() noexcept
+{
+	assert(filter);
+
+	if ((want_write || HasPendingOutput()) &&
+	    !base.IsWritePending() && CanFilterWrite())
+		base.ScheduleWrite(write_timeout);
+}
+
 /*
  * public API
  *
@@ -480,6 +698,12 @@ BufferedSocket::Init(SocketDescriptor _fd, FdType _fd_type) noexcept
 	direct = false;
 	expect_more = false;
 	destroyed = false;
+	corked = false;
+	want_write = false;
+	read_low_water = 0;
+	socket_low_water = 1;
+	read_burst = 1;
+	read_filled = false;
 
 #ifndef NDEBUG
 	reading = false;
@@ -505,6 +729,12 @@ BufferedSocket::Init(SocketDescriptor _fd, FdType _fd_type,
 	direct = false;
 	expect_more = false;
 	destroyed = false;
+	corked = false;
+	want_write = false;
+	read_low_water = 0;
+	socket_low_water = 1;
+	read_burst = 1;
+	read_filled = false;
 
 #ifndef NDEBUG
 	reading = false;
@@ -528,6 +758,9 @@ BufferedSocket::Reinit(const struct timeval *_read_timeout,
 	handler = &_handler;
 
 	direct = false;
+
+	read_low_water = 0;
+	ApplyReadLowWater();
 }
 
 void
@@ -537,6 +770,8 @@ BufferedSocket::Destroy() noexcept
 	assert(!destroyed);
 
 	input.FreeIfDefined();
+	output.Clear();
+	filter.reset();
 
 	destroyed = true;
 }
@@ -579,6 +814,19 @@ BufferedSocket::Read(bool _expect_more) noexcept
 ssize_t
 BufferedSocket::Write(const void *data, size_t length) noexcept
 {
+	if (filter) {
+		struct iovec v;
+		v.iov_base = const_cast<void *>(data);
+		v.iov_len = length;
+		return WriteV(&v, 1);
+	}
+
+	if (gcc_unlikely(!output.empty())) {
+		/* don't let this data overtake the queue */
+		ScheduleWrite();
+		return WRITE_BLOCKING;
+	}
+
 	ssize_t nbytes = base.Write(data, length);
 
 	if (gcc_unlikely(nbytes < 0)) {
@@ -602,7 +850,26 @@ BufferedSocket::Write(const void *data, size_t length) noexcept
 ssize_t
 BufferedSocket::WriteV(const struct iovec *v, size_t n) noexcept
 {
-	ssize_t nbytes = base.WriteV(v, n);
+	if (gcc_unlikely(HasPendingOutput())) {
+		ScheduleWrite();
+		return WRITE_BLOCKING;
+	}
+
+	ssize_t nbytes;
+	if (filter) {
+		try {
+			nbytes = filter->WriteV(base.GetSocket(), v, n);
+		} catch (...) {
+			handler->OnBufferedError(std::current_exception());
+			return WRITE_DESTROYED;
+		}
+
+		if (nbytes > 0 && filter->GetPendingOutput() > 0)
+			/* the rest of the encoded data is sent by
+			   OnSocketWrite() */
+			base.ScheduleWrite(write_timeout);
+	} else
+		nbytes = base.WriteV(v, n);
 
 	if (gcc_unlikely(nbytes < 0)) {
 		const int e = errno;
@@ -625,6 +892,17 @@ ssize_t
 BufferedSocket::WriteFrom(int other_fd, FdType other_fd_type,
 			  size_t length) noexcept
 {
+	if (filter) {
+		/* the data would bypass the filter */
+		errno = EOPNOTSUPP;
+		return WRITE_ERRNO;
+	}
+
+	if (gcc_unlikely(!output.empty())) {
+		ScheduleWrite();
+		return WRITE_BLOCKING;
+	}
+
 	ssize_t nbytes = base.WriteFrom(other_fd, other_fd_type, length);
 	if (gcc_unlikely(nbytes < 0)) {
 		const int e = errno;
@@ -644,6 +922,159 @@ BufferedSocket::WriteFrom(int other_fd, FdType other_fd_type,
 	return nbytes;
 }
 
+void
+BufferedSocket::Enqueue(const void *data, size_t length)
+{
+	assert(!ended);
+	assert(!destroyed);
+
+	output.Push(data, length);
+	ScheduleFlush();
+}
+
+void
+BufferedSocket::EnqueueV(const struct iovec *v, size_t n)
+{
+	assert(!ended);
+	assert(!destroyed);
+
+	output.PushV(v, n);
+	ScheduleFlush();
+}
+
+void
+BufferedSocket::EnqueueReference(const void *data, size_t length)
+{
+	assert(!ended);
+	assert(!destroyed);
+
+	output.PushReference(data, length);
+	ScheduleFlush();
+}
+
+BufferedSocket::FlushResult
+BufferedSocket::FlushError(int e) noexcept
+{
+	if (gcc_likely(e == EAGAIN)) {
+		ScheduleSocketWrite();
+		return FlushResult::BLOCKING;
+	}
+
+	if (e == EPIPE || e == ECONNRESET) {
+		switch (handler->OnBufferedBroken()) {
+		case WRITE_BROKEN:
+			/* the peer won't read the rest; discard it
+			   and continue reading */
+			output.Clear();
+			return FlushResult::DRAINED;
+
+		case WRITE_DESTROYED:
+			return FlushResult::CLOSED;
+
+		default:
+			break;
+		}
+	}
+
+	handler->OnBufferedError(std::make_exception_ptr(MakeErrno(e, "send() failed")));
+	return FlushResult::CLOSED;
+}
+
+BufferedSocket::FlushResult
+BufferedSocket::FlushOutput() noexcept
+{
+	assert(IsConnected());
+
+	while (HasPendingOutput()) {
+		if (filter) {
+			/* send what the filter has encoded already
+			   before giving it more */
+			int result;
+
+			try {
+				result = filter->Flush(base.GetSocket());
+			} catch (...) {
+				handler->OnBufferedError(std::current_exception());
+				return FlushResult::CLOSED;
+			}
+
+			if (result == 0) {
+				ScheduleSocketWrite();
+				return FlushResult::BLOCKING;
+			}
+
+			if (result < 0)
+				return FlushError(errno);
+
+			if (output.empty())
+				break;
+		}
+
+		struct iovec v[64];
+		const size_t n = output.Prepare(v, ARRAY_SIZE(v));
+
+		ssize_t nbytes;
+		if (filter) {
+			try {
+				nbytes = filter->WriteV(base.GetSocket(), v, n);
+			} catch (...) {
+				handler->OnBufferedError(std::current_exception());
+				return FlushResult::CLOSED;
+			}
+		} else
+			nbytes = base.WriteV(v, n);
+
+		if (gcc_unlikely(nbytes < 0))
+			return FlushError(errno);
+
+		output.Consume(nbytes);
+
+		if (filter)
+			/* the filter accepts at most a few records per
+			   call; the loop continues until it blocks */
+			continue;
+
+		size_t total = 0;
+		for (size_t i = 0; i < n; ++i)
+			total += v[i].iov_len;
+
+		if (size_t(nbytes) < total) {
+			/* short write: the socket buffer is full */
+			base.ScheduleWrite(write_timeout);
+			return FlushResult::BLOCKING;
+		}
+	}
+
+	return FlushResult::DRAINED;
+}
+
+void
+BufferedSocket::DeferFlushCallback() noexcept
+{
+	assert(!destroyed);
+
+	if (!HasPendingOutput() || !IsConnected())
+		return;
+
+	switch (FlushOutput()) {
+	case FlushResult::DRAINED:
+		break;
+
+	case FlushResult::BLOCKING:
+	case FlushResult::CLOSED:
+		return;
+	}
+
+	if (want_write)
+		/* the handler was waiting for the queue (e.g. while
+		   corked) */
+		ScheduleSocketWrite();
+	else
+		base.UnscheduleWrite();
+
+	handler->OnBufferedDrained();
+}
+
 void
 BufferedSocket::DeferRead(bool _expect_more) noexcept
 {
@@ -668,7 +1099,7 @@ BufferedSocket::ScheduleReadTimeout(bool _expect_more,
 
 	read_timeout = timeout;
 
-	if (!input.IsEmpty())
+	if (!input.IsEmpty() || (filter && filter->HasBufferedInput()))
 		/* deferred call to Read() to deliver data from the buffer */
 		defer_read.Schedule();
 	else
@@ -34,11 +34,14 @@
 
 #include "DefaultFifoBuffer.hxx"
 #include "SocketWrapper.hxx"
+#include "SocketFilter.hxx"
 #include "event/DeferEvent.hxx"
+#include "io/WriteQueue.hxx"
 #include "util/DestructObserver.hxx"
 #include "util/LeakDetector.hxx"
 
 #include <exception>
+#include <memory>
 
 #include <assert.h>
 
@@ -302,9 +305,17 @@ public:
  *
  * - destroyed (after Destroy())
  */
-class BufferedSocket final : DebugDestructAnchor, LeakDetector, SocketHandler {
+class BufferedSocket final
+	: DebugDestructAnchor, LeakDetector, SocketHandler, SocketFilterHandler {
+
 	SocketWrapper base;
 
+	/**
+	 * An optional filter (e.g. TLS) which receives from and sends
+	 * to the socket; see SetFilter().
+	 */
+	std::unique_ptr<SocketFilter> filter;
+
 	const struct timeval *read_timeout, *write_timeout;
 
 	/**
@@ -316,6 +327,45 @@ class BufferedSocket final : DebugDestructAnchor, LeakDetector, SocketHandler {
 
 	DefaultFifoBuffer input;
 
+	/**
+	 * The number of bytes the handler wants to see in #input
+	 * before it gets invoked again; see SetReadLowWater().  0
+	 * means no hint.
+	 */
+	size_t read_low_water;
+
+	/**
+	 * The SO_RCVLOWAT value which is currently configured on the
+	 * socket (1 is the kernel default).
+	 */
+	size_t socket_low_water;
+
+	/**
+	 * How many times TryRead2() may refill the input buffer
+	 * within one "read" event.  This grows while reads fill the
+	 * whole buffer (bulk transfer), and shrinks on short reads.
+	 */
+	unsigned read_burst;
+
+	/**
+	 * Did the last FillBuffer() call fill all of the free buffer
+	 * space?  Then the socket probably has more data.
+	 */
+	bool read_filled;
+
+	static constexpr unsigned MAX_READ_BURST = 16;
+
+	/**
+	 * Data submitted with Enqueue(), waiting to be flushed by
+	 * #defer_flush or by the "write" event.
+	 */
+	WriteQueue output;
+
+	/**
+	 * Flushes #output at the end of the current loop iteration.
+	 */
+	DeferEvent defer_flush;
+
 	/**
 	 * Attempt to do "direct" transfers?
 	 */
@@ -334,6 +384,18 @@ class BufferedSocket final : DebugDestructAnchor, LeakDetector, SocketHandler {
 
 	bool destroyed = true;
 
+	/**
+	 * See Cork().
+	 */
+	bool corked;
+
+	/**
+	 * Has the handler requested the "write" event (with
+	 * ScheduleWrite())?  The event may also be scheduled only
+	 * because #output blocks.
+	 */
+	bool want_write;
+
 #ifndef NDEBUG
 	bool reading, ended;
 
@@ -343,7 +405,8 @@ class BufferedSocket final : DebugDestructAnchor, LeakDetector, SocketHandler {
 public:
 	explicit BufferedSocket(EventLoop &_event_loop) noexcept
 		:base(_event_loop, *this),
-		 defer_read(_event_loop, BIND_THIS_METHOD(DeferReadCallback)) {}
+		 defer_read(_event_loop, BIND_THIS_METHOD(DeferReadCallback)),
+		 defer_flush(_event_loop, BIND_THIS_METHOD(DeferFlushCallback)) {}
 
 	EventLoop &GetEventLoop() noexcept {
 		return defer_read.GetEventLoop();
@@ -365,7 +428,48 @@ public:
 		    const struct timeval *_write_timeout,
 		    BufferedSocketHandler &_handler) noexcept;
 
+	/**
+	 * Replace the handler, but leave everything else alone (unlike
+	 * Reinit()).  This is used by #SocketForwarder to take over a
+	 * socket temporarily.
+	 */
+	void SetHandler(BufferedSocketHandler &_handler) noexcept {
+		assert(!destroyed);
+
+		handler = &_handler;
+	}
+
+	/**
+	 * Install a filter which decodes all data received from the
+	 * socket and encodes all data sent to it.  Call this right
+	 * after Init(), before any data is transferred.  The filter
+	 * is deleted by Destroy().
+	 *
+	 * While a filter is installed, "direct" transfers are
+	 * disabled and WriteFrom() is not supported.
+	 */
+	void SetFilter(std::unique_ptr<SocketFilter> &&_filter) noexcept {
+		assert(!destroyed);
+		assert(IsConnected());
+
+		/* the filter does its own socket I/O, which would
+		   bypass the readiness tracking */
+		assert(!base.IsEdgeTriggered());
+		assert(!base.IsUring());
+
+		filter = std::move(_filter);
+		filter->SetHandler(*this);
+		direct = false;
+	}
+
+	SocketFilter *GetFilter() const noexcept {
+		return filter.get();
+	}
+
 	void Shutdown() noexcept {
+		if (filter && base.IsValid())
+			filter->Shutdown(base.GetSocket());
+
 		base.Shutdown();
 	}
 
@@ -378,6 +482,8 @@ public:
 		assert(!destroyed);
 
 		defer_read.Cancel();
+		defer_flush.Cancel();
+		output.Clear();
 		base.Close();
 	}
 
@@ -391,6 +497,14 @@ public:
 		assert(!destroyed);
 
 		defer_read.Cancel();
+		defer_flush.Cancel();
+		output.Clear();
+
+		/* the next owner of the socket does not know about
+		   our hint */
+		read_low_water = 0;
+		ApplyReadLowWater();
+
 		base.Abandon();
 	}
 
@@ -406,6 +520,43 @@ public:
 		write_timeout = _write_timeout;
 	}
 
+	/**
+	 * Manage the read/write timeouts with the #EventLoop's timer
+	 * wheel; see SocketWrapper::SetCoarseTimeouts().  Call this
+	 * right after Init().
+	 */
+	void SetCoarseTimeouts(bool value) noexcept {
+		base.SetCoarseTimeouts(value);
+	}
+
+	/**
+	 * Keep the socket registered edge-triggered and read until
+	 * EAGAIN; see SocketWrapper::SetEdgeTriggered().  Call this
+	 * right after Init().  This is not compatible with
+	 * SetFilter().
+	 */
+	void SetEdgeTriggered(bool value) noexcept {
+		assert(!filter);
+
+		base.SetEdgeTriggered(value);
+	}
+
+	/**
+	 * Submit reads and writes to the #EventLoop's io_uring; see
+	 * SocketWrapper::EnableUring().  Call this right after
+	 * Init().  This is not compatible with SetFilter() and
+	 * disables SetDirect().
+	 *
+	 * @return false if the #EventLoop does not have io_uring or
+	 * if memory allocation failed
+	 */
+	bool EnableUring() noexcept {
+		assert(!filter);
+
+		direct = false;
+		return base.EnableUring();
+	}
+
 	/**
 	 * Is the object (already and) still usable?  That is, Init() was
 	 * called, but Destroy() was NOT called yet?  The socket may be closed
@@ -453,7 +604,9 @@ public:
 	}
 
 	void SetDirect(bool _direct) noexcept {
-		direct = _direct;
+		/* a filter must see all data; in io_uring mode, data
+		   is read ahead into a private buffer */
+		direct = _direct && !filter && !base.IsUring();
 	}
 
 	/**
@@ -496,6 +649,29 @@ public:
 	 */
 	void Consumed(size_t nbytes) noexcept;
 
+	/**
+	 * Announce that the handler cannot make progress before the
+	 * input buffer contains at least the specified number of
+	 * bytes (e.g. because it has parsed a frame header).  The
+	 * remaining amount is configured as SO_RCVLOWAT, so the
+	 * kernel does not wake us up for each small segment (Linux
+	 * honours this for TCP, but not for local sockets).
+	 *
+	 * The hint is clamped to the free buffer space, it is only
+	 * effective while the input buffer holds a partial frame,
+	 * and it is cleared before the handler is invoked with
+	 * enough data.  A peer which closes the connection or a read
+	 * timeout wake up reading as usual.  Pass 0 to clear the
+	 * hint.  It is ignored while a filter is installed.
+	 */
+	void SetReadLowWater(size_t nbytes) noexcept {
+		assert(!ended);
+		assert(!destroyed);
+
+		read_low_water = nbytes;
+		ApplyReadLowWater();
+	}
+
 	/**
 	 * The caller wants to read more data from the socket.  There
 	 * are four possible outcomes: a call to
@@ -523,7 +699,9 @@ public:
 	}
 
 	/**
-	 * Write data to the socket.
+	 * Write data to the socket.  If there is queued data (see
+	 * Enqueue()), this returns #WRITE_BLOCKING and the handler
+	 * gets called when the queue has been flushed.
 	 *
 	 * @return the positive number of bytes written or a #write_result
 	 * code
@@ -541,10 +719,78 @@ public:
 	ssize_t WriteFrom(int other_fd, FdType other_fd_type,
 			  size_t length) noexcept;
 
+	/**
+	 * Append a copy of the given data to the output queue.  Small
+	 * chunks are coalesced, and the whole queue is sent with one
+	 * sendmsg() call at the end of the current loop iteration
+	 * (unless corked), or when the socket becomes writable.
+	 *
+	 * After the queue has been flushed completely,
+	 * BufferedSocketHandler::OnBufferedDrained() is invoked.
+	 * Errors are reported to BufferedSocketHandler::OnBufferedError()
+	 * (or OnBufferedBroken()).
+	 *
+	 * Throws std::bad_alloc on error.
+	 */
+	void Enqueue(const void *data, size_t length);
+
+	/**
+	 * Like Enqueue(), but with a vector of buffers.
+	 *
+	 * Throws std::bad_alloc on error; then nothing has been
+	 * queued.
+	 */
+	void EnqueueV(const struct iovec *v, size_t n);
+
+	/**
+	 * Like Enqueue(), but do not copy the data.  The caller must
+	 * keep it valid until
+	 * BufferedSocketHandler::OnBufferedDrained() has been invoked
+	 * or the socket has been closed.
+	 *
+	 * Throws std::bad_alloc on error.
+	 */
+	void EnqueueReference(const void *data, size_t length);
+
+	/**
+	 * Returns the number of bytes in the output queue (including
+	 * encoded data held by the filter).
+	 */
+	size_t GetQueuedOutput() const noexcept {
+		return output.GetSize() +
+			(filter ? filter->GetPendingOutput() : 0);
+	}
+
+	/**
+	 * Don't flush the output queue until Uncork() is called.  Use
+	 * this to assemble a response from several Enqueue() calls
+	 * which may span more than one loop iteration.  While the
+	 * queue is not empty, Write() returns #WRITE_BLOCKING, and
+	 * BufferedSocketHandler::OnBufferedWrite() is not invoked
+	 * before Uncork().
+	 */
+	void Cork() noexcept {
+		corked = true;
+		defer_flush.Cancel();
+	}
+
+	/**
+	 * Undo Cork() and schedule a flush of the output queue.
+	 */
+	void Uncork() noexcept {
+		corked = false;
+		if (!output.empty())
+			defer_flush.Schedule();
+	}
+
 	gcc_pure
 	bool IsReadyForWriting() const noexcept {
 		assert(!destroyed);
 
+		if (filter && (filter->GetPendingOutput() > 0 ||
+			       filter->IsBusy()))
+			return false;
+
 		return base.IsReadyForWriting();
 	}
 
@@ -576,14 +822,27 @@ public:
 		assert(!ended);
 		assert(!destroyed);
 
-		base.ScheduleWrite(write_timeout);
+		want_write = true;
+
+		if (corked && !output.empty())
+			/* the handler cannot write before the queue
+			   has been flushed, which Cork() postpones;
+			   Uncork() takes care of the "write" event */
+			return;
+
+		ScheduleSocketWrite();
 	}
 
 	void UnscheduleWrite() noexcept {
 		assert(!ended);
 		assert(!destroyed);
 
-		base.UnscheduleWrite();
+		want_write = false;
+
+		if (output.empty())
+			/* keep the event if it is still needed to flush
+			   the output queue */
+			base.UnscheduleWrite();
 	}
 
 private:
@@ -594,9 +853,57 @@ private:
 	bool SubmitFromBuffer() noexcept;
 	bool SubmitDirect() noexcept;
 	bool FillBuffer() noexcept;
+
+	/**
+	 * Configure SO_RCVLOWAT according to #read_low_water and the
+	 * current #input state.
+	 */
+	void ApplyReadLowWater() noexcept;
+
 	bool TryRead2() noexcept;
 	bool TryRead() noexcept;
 
+	/**
+	 * Is there data in #output or in the filter waiting to be
+	 * sent?
+	 */
+	bool HasPendingOutput() const noexcept {
+		return !output.empty() ||
+			(filter && filter->GetPendingOutput() > 0);
+	}
+
+	/**
+	 * Can the filter make progress when the socket becomes
+	 * writable?
+	 */
+	bool CanFilterWrite() const noexcept {
+		return !filter->IsBusy() &&
+			(!filter->IsWaitingForInput() ||
+			 filter->GetPendingOutput() > 0);
+	}
+
+	/**
+	 * Register the socket's "write" event, unless the filter
+	 * cannot make progress before more input was received or an
+	 * asynchronous operation has finished.
+	 */
+	void ScheduleSocketWrite() noexcept;
+
+	/**
+	 * After the filter has been given a chance to make progress:
+	 * register the "write" event if output is waiting.
+	 */
+	void UpdateFilterWrite() noexcept;
+
+	/**
+	 * Schedule a Read() call if the filter holds input which was
+	 * not delivered because the input buffer was full.
+	 */
+	void DeferFilterRead() noexcept {
+		if (filter && filter->HasBufferedInput())
+			defer_read.Schedule();
+	}
+
 	static bool OnWrite(void *ctx) noexcept;
 	static bool OnRead(void *ctx) noexcept;
 	static bool OnTimeout(void *ctx) noexcept;
@@ -605,8 +912,40 @@ private:
 		Read(false);
 	}
 
+	void ScheduleFlush() noexcept {
+		if (!corked)
+			defer_flush.Schedule();
+	}
+
+	enum class FlushResult {
+		/**
+		 * The queue is empty now.
+		 */
+		DRAINED,
+
+		/**
+		 * The socket blocks; the "write" event has been
+		 * scheduled.
+		 */
+		BLOCKING,
+
+		/**
+		 * The socket has been closed or destroyed by the
+		 * handler after an error.
+		 */
+		CLOSED,
+	};
+
+	FlushResult FlushError(int e) noexcept;
+	FlushResult FlushOutput() noexcept;
+
+	void DeferFlushCallback() noexcept;
+
 	/* virtual methods from class SocketHandler */
 	bool OnSocketRead() noexcept override;
 	bool OnSocketWrite() noexcept override;
 	bool OnSocketTimeout() noexcept override;
+
+	/* virtual methods from class SocketFilterHandler */
+	void OnSocketFilterReady() noexcept override;
 };
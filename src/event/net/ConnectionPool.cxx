@@ -0,0 +1,449 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ConnectionPool.hxx"
+#include "ConnectSocket.hxx"
+#include "event/SocketEvent.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "system/Error.hxx"
+#include "util/Cancellable.hxx"
+#include "util/DeleteDisposer.hxx"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static constexpr timeval connect_timeout{10, 0};
+
+struct ConnectionPool::Idle final : IdleHook {
+	Key &key;
+
+	UniqueSocketDescriptor fd;
+
+	/**
+	 * Detects when the peer closes the idle connection (or sends
+	 * unexpected data).
+	 */
+	SocketEvent event;
+
+	CoarseTimerEvent timer;
+
+	Idle(Key &_key, EventLoop &event_loop,
+	     UniqueSocketDescriptor &&_fd,
+	     std::chrono::steady_clock::duration timeout) noexcept
+		:key(_key), fd(std::move(_fd)),
+		 event(event_loop, fd.Get(), SocketEvent::READ,
+		       BIND_THIS_METHOD(OnSocketEvent)),
+		 timer(event_loop, BIND_THIS_METHOD(OnTimeout)) {
+		event.Add();
+		timer.Schedule(timeout);
+	}
+
+	~Idle() noexcept {
+		event.Delete();
+	}
+
+	UniqueSocketDescriptor Steal() noexcept {
+		event.Delete();
+		timer.Cancel();
+		return std::move(fd);
+	}
+
+private:
+	void Remove() noexcept;
+
+	void OnSocketEvent(unsigned) noexcept {
+		Remove();
+	}
+
+	void OnTimeout() noexcept {
+		Remove();
+	}
+};
+
+struct ConnectionPool::Key final : KeyHook {
+	const AllocatedSocketAddress address;
+
+	/**
+	 * Idle connections, most recently used first.
+	 */
+	boost::intrusive::list<Idle, boost::intrusive::base_hook<IdleHook>,
+			       boost::intrusive::constant_time_size<true>> idle;
+
+	/**
+	 * Get() requests waiting for a free slot.
+	 */
+	boost::intrusive::list<Request, boost::intrusive::base_hook<RequestHook>,
+			       boost::intrusive::constant_time_size<false>> waiting;
+
+	/**
+	 * The number of connections which are currently busy
+	 * (handed out or being established).
+	 */
+	unsigned n_busy = 0;
+
+	explicit Key(SocketAddress _address) noexcept
+		:address(_address) {}
+
+	~Key() noexcept {
+		assert(waiting.empty());
+
+		idle.clear_and_dispose(DeleteDisposer());
+	}
+
+	bool IsUnused() const noexcept {
+		return idle.empty() && waiting.empty() && n_busy == 0;
+	}
+};
+
+inline void
+ConnectionPool::Idle::Remove() noexcept
+{
+	auto &list = key.idle;
+	list.erase_and_dispose(list.iterator_to(*this), DeleteDisposer());
+}
+
+class ConnectionPool::Request final
+	: public RequestHook, public Cancellable, ConnectSocketHandler {
+
+	ConnectionPool &pool;
+	Key &key;
+
+	ConnectionPoolHandler &handler;
+
+	ConnectSocket connect;
+
+public:
+	Request(ConnectionPool &_pool, Key &_key,
+		ConnectionPoolHandler &_handler,
+		CancellablePointer &cancel_ptr) noexcept
+		:pool(_pool), key(_key), handler(_handler),
+		 connect(pool.event_loop, *this) {
+		cancel_ptr = *this;
+	}
+
+	bool IsWaiting() const noexcept {
+		return is_linked();
+	}
+
+	/**
+	 * Hand over an idle connection and destroy this object.
+	 */
+	void Deliver(UniqueSocketDescriptor &&fd) noexcept {
+		auto &h = handler;
+		delete this;
+		h.OnConnectionPoolReady(std::move(fd), true);
+	}
+
+	/**
+	 * Start connecting; this may finish (and destroy this
+	 * object) synchronously.
+	 */
+	void Start(const SocketTuning &tuning) noexcept;
+
+	/* virtual methods from Cancellable */
+	void Cancel() noexcept override;
+
+private:
+	/* virtual methods from ConnectSocketHandler */
+	void OnSocketConnectSuccess(UniqueSocketDescriptor &&fd) override {
+		auto &h = handler;
+		delete this;
+		h.OnConnectionPoolReady(std::move(fd), false);
+	}
+
+	void OnSocketConnectError(std::exception_ptr ep) override {
+		auto &h = handler;
+		auto &p = pool;
+		auto &k = key;
+		delete this;
+
+		assert(k.n_busy > 0);
+		--k.n_busy;
+		p.OnRequestFinished(k);
+
+		h.OnConnectionPoolError(ep);
+	}
+};
+
+void
+ConnectionPool::Request::Start(const SocketTuning &tuning) noexcept
+try {
+	const SocketAddress address = key.address;
+
+	UniqueSocketDescriptor fd;
+	if (!fd.CreateNonBlock(address.GetFamily(), SOCK_STREAM, 0))
+		throw MakeErrno("Failed to create socket");
+
+	tuning.ApplyConnect(fd, address.GetFamily() == AF_INET ||
+			    address.GetFamily() == AF_INET6);
+
+	if (!fd.Connect(address) && errno != EINPROGRESS)
+		throw MakeErrno("Failed to connect");
+
+	connect.WaitConnected(std::move(fd), connect_timeout);
+} catch (...) {
+	OnSocketConnectError(std::current_exception());
+}
+
+void
+ConnectionPool::Request::Cancel() noexcept
+{
+	auto &p = pool;
+	auto &k = key;
+
+	if (IsWaiting()) {
+		k.waiting.erase(k.waiting.iterator_to(*this));
+		delete this;
+	} else {
+		/* the ConnectSocket destructor cancels the connect */
+		delete this;
+
+		assert(k.n_busy > 0);
+		--k.n_busy;
+	}
+
+	p.OnRequestFinished(k);
+}
+
+static bool
+LessAddress(SocketAddress a, SocketAddress b) noexcept
+{
+	if (a.GetSize() != b.GetSize())
+		return a.GetSize() < b.GetSize();
+
+	return memcmp(a.GetAddress(), b.GetAddress(), a.GetSize()) < 0;
+}
+
+bool
+ConnectionPool::KeyCompare::operator()(const Key &a,
+				       const Key &b) const noexcept
+{
+	return LessAddress(a.address, b.address);
+}
+
+bool
+ConnectionPool::KeyCompare::operator()(const Key &a,
+				       SocketAddress b) const noexcept
+{
+	return LessAddress(a.address, b);
+}
+
+bool
+ConnectionPool::KeyCompare::operator()(SocketAddress a,
+				       const Key &b) const noexcept
+{
+	return LessAddress(a, b.address);
+}
+
+ConnectionPool::ConnectionPool(EventLoop &_event_loop,
+			       unsigned _max_per_key,
+			       unsigned _max_idle_per_key,
+			       std::chrono::steady_clock::duration _idle_timeout)
+	:event_loop(_event_loop),
+	 max_per_key(_max_per_key), max_idle_per_key(_max_idle_per_key),
+	 idle_timeout(_idle_timeout),
+	 cleanup_event(event_loop, BIND_THIS_METHOD(OnCleanup))
+{
+	assert(max_per_key > 0);
+
+	tuning.tcp_fast_open = 0;
+}
+
+ConnectionPool::~ConnectionPool() noexcept
+{
+	cleanup_event.Cancel();
+	keys.clear_and_dispose(DeleteDisposer());
+}
+
+ConnectionPool::Key &
+ConnectionPool::MakeKey(SocketAddress address) noexcept
+{
+	ConnectionPool::KeyCompare compare;
+	auto i = keys.lower_bound(address, compare);
+	if (i != keys.end() && !compare(address, *i))
+		return *i;
+
+	auto *key = new Key(address);
+	keys.insert_before(i, *key);
+	return *key;
+}
+
+ConnectionPool::Key &
+ConnectionPool::GetKey(SocketAddress address) noexcept
+{
+	auto i = keys.find(address, KeyCompare());
+	assert(i != keys.end());
+	return *i;
+}
+
+/**
+ * Check whether an idle connection can be reused: there must be
+ * neither pending data nor EOF.
+ */
+static bool
+IsAlive(SocketDescriptor fd) noexcept
+{
+	char dummy;
+	ssize_t nbytes = recv(fd.Get(), &dummy, sizeof(dummy),
+			      MSG_PEEK|MSG_DONTWAIT);
+	return nbytes < 0 && errno == EAGAIN;
+}
+
+UniqueSocketDescriptor
+ConnectionPool::PopIdle(Key &key) noexcept
+{
+	while (!key.idle.empty()) {
+		auto &idle = key.idle.front();
+		auto fd = idle.Steal();
+		key.idle.pop_front_and_dispose(DeleteDisposer());
+
+		if (IsAlive(fd))
+			return fd;
+	}
+
+	return UniqueSocketDescriptor();
+}
+
+void
+ConnectionPool::Get(SocketAddress address, ConnectionPoolHandler &handler,
+		    CancellablePointer &cancel_ptr) noexcept
+{
+	auto &key = MakeKey(address);
+
+	if (key.n_busy < max_per_key) {
+		auto fd = PopIdle(key);
+		if (fd.IsDefined()) {
+			++key.n_busy;
+			handler.OnConnectionPoolReady(std::move(fd), true);
+			return;
+		}
+	}
+
+	auto *request = new Request(*this, key, handler, cancel_ptr);
+
+	if (key.n_busy >= max_per_key) {
+		key.waiting.push_back(*request);
+		return;
+	}
+
+	++key.n_busy;
+	StartConnect(*request);
+}
+
+inline void
+ConnectionPool::StartConnect(Request &request) noexcept
+{
+	request.Start(tuning);
+}
+
+void
+ConnectionPool::Put(SocketAddress address, UniqueSocketDescriptor &&fd,
+		    bool reuse) noexcept
+{
+	auto &key = GetKey(address);
+	assert(key.n_busy > 0);
+	--key.n_busy;
+
+	if (reuse && fd.IsDefined() && max_idle_per_key > 0) {
+		if (key.idle.size() >= max_idle_per_key)
+			/* evict the least recently used one */
+			key.idle.pop_back_and_dispose(DeleteDisposer());
+
+		key.idle.push_front(*new Idle(key, event_loop, std::move(fd),
+					      idle_timeout));
+	} else
+		fd.Close();
+
+	ServeWaiting(key);
+	ScheduleCleanup();
+}
+
+void
+ConnectionPool::ServeWaiting(Key &key) noexcept
+{
+	while (!key.waiting.empty() && key.n_busy < max_per_key) {
+		auto &request = key.waiting.front();
+		key.waiting.pop_front();
+
+		++key.n_busy;
+
+		auto fd = PopIdle(key);
+		if (fd.IsDefined())
+			request.Deliver(std::move(fd));
+		else
+			StartConnect(request);
+	}
+}
+
+void
+ConnectionPool::OnRequestFinished(Key &key) noexcept
+{
+	ServeWaiting(key);
+	ScheduleCleanup();
+}
+
+void
+ConnectionPool::FlushIdle() noexcept
+{
+	for (auto &key : keys)
+		key.idle.clear_and_dispose(DeleteDisposer());
+
+	ScheduleCleanup();
+}
+
+size_t
+ConnectionPool::GetIdleCount() const noexcept
+{
+	size_t n = 0;
+	for (const auto &key : keys)
+		n += key.idle.size();
+	return n;
+}
+
+inline void
+ConnectionPool::ScheduleCleanup() noexcept
+{
+	cleanup_event.Schedule();
+}
+
+void
+ConnectionPool::OnCleanup() noexcept
+{
+	for (auto i = keys.begin(); i != keys.end();) {
+		if (i->IsUnused())
+			i = keys.erase_and_dispose(i, DeleteDisposer());
+		else
+			++i;
+	}
+}
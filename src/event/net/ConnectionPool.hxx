@@ -0,0 +1,206 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/DeferEvent.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/SocketTuning.hxx"
+#include "util/Compiler.h"
+
+#include <boost/intrusive/set.hpp>
+#include <boost/intrusive/list.hpp>
+
+#include <chrono>
+#include <exception>
+
+class EventLoop;
+class CancellablePointer;
+
+class ConnectionPoolHandler {
+public:
+	/**
+	 * A connection is ready.  It must be returned with
+	 * ConnectionPool::Put() when it is not used anymore.
+	 *
+	 * @param reused true if this is an idle connection which has
+	 * been used before
+	 */
+	virtual void OnConnectionPoolReady(UniqueSocketDescriptor &&fd,
+					   bool reused) = 0;
+
+	virtual void OnConnectionPoolError(std::exception_ptr ep) = 0;
+};
+
+/**
+ * A pool of outgoing stream connections, keyed by the peer's
+ * #SocketAddress.  Connections which are returned to the pool are
+ * kept idle for a while and handed out again by Get(), which saves
+ * the connection setup.
+ *
+ * - the number of connections per address (busy and connecting) is
+ *   limited; Get() calls which exceed it wait for a connection to
+ *   be returned
+ * - idle connections are monitored: if the peer closes one (or
+ *   sends unexpected data), it is discarded; Get() additionally
+ *   checks it with a non-blocking recv(MSG_PEEK)
+ * - idle connections expire after a timeout, managed by the
+ *   #TimerWheel (#CoarseTimerEvent)
+ * - optionally, new TCP connections use TCP Fast Open
+ *
+ * This class is not thread-safe.  All pending Get() requests must
+ * be finished or canceled before it is destroyed, and connections
+ * which are still handed out must not be returned afterwards.
+ */
+class ConnectionPool final {
+	struct Idle;
+	struct Key;
+	class Request;
+
+	typedef boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> IdleHook;
+	typedef boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::safe_link>> RequestHook;
+	typedef boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> KeyHook;
+
+	struct KeyCompare {
+		bool operator()(const Key &a, const Key &b) const noexcept;
+		bool operator()(const Key &a, SocketAddress b) const noexcept;
+		bool operator()(SocketAddress a, const Key &b) const noexcept;
+	};
+
+	EventLoop &event_loop;
+
+	const unsigned max_per_key, max_idle_per_key;
+
+	const std::chrono::steady_clock::duration idle_timeout;
+
+	/**
+	 * Applied to new sockets before connect().  TCP Fast Open is
+	 * disabled by default.
+	 */
+	SocketTuning tuning;
+
+	boost::intrusive::set<Key, boost::intrusive::base_hook<KeyHook>,
+			      boost::intrusive::compare<KeyCompare>,
+			      boost::intrusive::constant_time_size<false>> keys;
+
+	/**
+	 * Removes unused #Key instances.  This is deferred, because
+	 * removing them synchronously would invalidate references
+	 * held further up in the stack.
+	 */
+	DeferEvent cleanup_event;
+
+public:
+	/**
+	 * @param _max_per_key the maximum number of connections
+	 * (busy and connecting) per address
+	 * @param _max_idle_per_key the maximum number of idle
+	 * connections per address
+	 * @param _idle_timeout idle connections are closed after
+	 * this duration
+	 */
+	ConnectionPool(EventLoop &_event_loop,
+		       unsigned _max_per_key=16, unsigned _max_idle_per_key=4,
+		       std::chrono::steady_clock::duration _idle_timeout=std::chrono::seconds(60));
+
+	~ConnectionPool() noexcept;
+
+	ConnectionPool(const ConnectionPool &) = delete;
+	ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+	EventLoop &GetEventLoop() noexcept {
+		return event_loop;
+	}
+
+	/**
+	 * Use TCP Fast Open (TCP_FASTOPEN_CONNECT) for new TCP
+	 * connections.  Errors (e.g. if the peer doesn't support it)
+	 * are reported on the first write, not by the connect.
+	 */
+	void EnableFastOpen(bool value=true) noexcept {
+		tuning.tcp_fast_open = value;
+	}
+
+	/**
+	 * Set socket options for new connections (see
+	 * SocketTuning::ApplyConnect()).
+	 */
+	void SetTuning(const SocketTuning &_tuning) noexcept {
+		tuning = _tuning;
+	}
+
+	/**
+	 * Obtain a connection to the given address, either an idle
+	 * one or a new one.  The handler may be invoked
+	 * synchronously.
+	 */
+	void Get(SocketAddress address, ConnectionPoolHandler &handler,
+		 CancellablePointer &cancel_ptr) noexcept;
+
+	/**
+	 * Return a connection obtained by Get().
+	 *
+	 * @param reuse true if the connection is in a clean state and
+	 * may be handed out again; false closes it
+	 */
+	void Put(SocketAddress address, UniqueSocketDescriptor &&fd,
+		 bool reuse) noexcept;
+
+	/**
+	 * Close all idle connections.
+	 */
+	void FlushIdle() noexcept;
+
+	gcc_pure
+	size_t GetIdleCount() const noexcept;
+
+private:
+	Key &MakeKey(SocketAddress address) noexcept;
+	Key &GetKey(SocketAddress address) noexcept;
+
+	/**
+	 * Pop an idle connection which is still alive.
+	 */
+	UniqueSocketDescriptor PopIdle(Key &key) noexcept;
+
+	/**
+	 * Serve #Key::waiting as long as the limit allows it.
+	 */
+	void ServeWaiting(Key &key) noexcept;
+
+	void StartConnect(Request &request) noexcept;
+
+	void OnRequestFinished(Key &key) noexcept;
+	void ScheduleCleanup() noexcept;
+	void OnCleanup() noexcept;
+};
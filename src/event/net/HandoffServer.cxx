@@ -0,0 +1,164 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HandoffServer.hxx"
+#include "net/Handoff.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "system/Error.hxx"
+#include "util/RuntimeError.hxx"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * The peer has this much time to receive each packet; the few
+ * packets usually fit into the socket buffer, but a peer which
+ * connects and never reads must not stall this process forever.
+ */
+static constexpr struct timeval HANDOFF_SEND_TIMEOUT{5, 0};
+
+void
+HandoffSender::Add(StringView name, StringView config, FileDescriptor fd)
+{
+	SendHandoffItem(socket, name, config, fd);
+}
+
+HandoffServer::HandoffServer(EventLoop &event_loop,
+			     HandoffHandler &_handler) noexcept
+	:ServerSocket(event_loop), handler(_handler),
+	 allowed_uid(geteuid()),
+	 peer_event(event_loop, BIND_THIS_METHOD(OnPeerReady)) {}
+
+HandoffServer::~HandoffServer() noexcept
+{
+	ClosePeer();
+}
+
+void
+HandoffServer::Listen(const char *path, mode_t mode)
+{
+	AllocatedSocketAddress address;
+	address.SetLocal(path);
+
+	UniqueSocketDescriptor s;
+	if (!s.CreateNonBlock(AF_LOCAL, SOCK_SEQPACKET, 0))
+		throw MakeErrno("Failed to create socket");
+
+	if (!s.Bind(address))
+		throw FormatErrno("Failed to bind to %s", path);
+
+	/* the socket file is created according to the umask;
+	   restrict it before accepting connections (peers which
+	   connect in between are rejected by OnAccept()) */
+	if (*path != '@' && chmod(path, mode) < 0)
+		throw FormatErrno("Failed to chmod %s", path);
+
+	if (!s.Listen(4))
+		throw MakeErrno("Failed to listen");
+
+	ServerSocket::Listen(std::move(s));
+}
+
+void
+HandoffServer::ClosePeer() noexcept
+{
+	if (!peer.IsDefined())
+		return;
+
+	peer_event.Delete();
+	peer = UniqueSocketDescriptor();
+}
+
+void
+HandoffServer::OnPeerReady(unsigned) noexcept
+{
+	bool committed;
+
+	try {
+		committed = ReceiveHandoffCommit(peer);
+	} catch (...) {
+		ClosePeer();
+		handler.OnHandoffError(std::current_exception());
+		return;
+	}
+
+	ClosePeer();
+
+	if (committed)
+		handler.OnHandoffComplete();
+	else
+		handler.OnHandoffError(std::make_exception_ptr(std::runtime_error("Handoff peer exited before committing")));
+}
+
+void
+HandoffServer::OnAccept(UniqueSocketDescriptor &&new_fd, SocketAddress)
+{
+	if (IsBusy())
+		/* a handoff is already in progress; reject this one */
+		return;
+
+	try {
+		const auto cred = new_fd.GetPeerCredentials();
+		if (cred.pid < 0)
+			throw MakeErrno("Failed to get the handoff peer's credentials");
+
+		if (cred.uid != allowed_uid)
+			throw FormatRuntimeError("Handoff peer uid %u rejected",
+						 unsigned(cred.uid));
+
+		/* the few packets usually fit into the socket buffer,
+		   so it's okay to block here, but not forever */
+		new_fd.SetBlocking();
+		if (!new_fd.SetOption(SOL_SOCKET, SO_SNDTIMEO,
+				      &HANDOFF_SEND_TIMEOUT,
+				      sizeof(HANDOFF_SEND_TIMEOUT)))
+			throw MakeErrno("Failed to set the send timeout");
+
+		HandoffSender sender(new_fd);
+		handler.OnHandoffRequest(sender);
+		SendHandoffCommand(new_fd, HandoffCommand::END);
+	} catch (...) {
+		handler.OnHandoffError(std::current_exception());
+		return;
+	}
+
+	peer = std::move(new_fd);
+	peer_event.Set(peer.Get(), SocketEvent::READ|SocketEvent::PERSIST);
+	peer_event.Add();
+}
+
+void
+HandoffServer::OnAcceptError(std::exception_ptr ep)
+{
+	handler.OnHandoffError(ep);
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "ServerSocket.hxx"
+#include "event/SocketEvent.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "util/StringView.hxx"
+
+#include <exception>
+
+#include <sys/types.h>
+
+class HandoffServer;
+
+/**
+ * Collects the items to be passed to the new process; see
+ * HandoffHandler::OnHandoffRequest().
+ */
+class HandoffSender {
+	SocketDescriptor socket;
+
+public:
+	explicit HandoffSender(SocketDescriptor _socket) noexcept
+		:socket(_socket) {}
+
+	/**
+	 * Pass a file descriptor (e.g. ServerSocket::GetSocket(),
+	 * UdpListener::GetSocket() or a cache snapshot memfd) to the
+	 * new process.  It is duplicated, and this process keeps
+	 * using it until the new one commits.
+	 *
+	 * Throws on error.
+	 */
+	void Add(StringView name, StringView config, FileDescriptor fd);
+};
+
+class HandoffHandler {
+public:
+	/**
+	 * A new process has connected and asks for our file
+	 * descriptors.  Call HandoffSender::Add() for each.
+	 *
+	 * Exceptions thrown by this method abort the handoff.
+	 */
+	virtual void OnHandoffRequest(HandoffSender &sender) = 0;
+
+	/**
+	 * The new process has committed: it is now serving on the
+	 * sockets which were passed to it.  Stop accepting new
+	 * connections and drain existing ones, just like on
+	 * SIGTERM (see #ShutdownListener).
+	 */
+	virtual void OnHandoffComplete() noexcept = 0;
+
+	/**
+	 * The handoff has failed, e.g. because the new process has
+	 * exited before committing.  This process shall continue to
+	 * serve.
+	 */
+	virtual void OnHandoffError(std::exception_ptr ep) noexcept = 0;
+};
+
+/**
+ * Listens on a UNIX socket for a new process (see #HandoffClient)
+ * and passes listening sockets and other file descriptors to it, so
+ * it can take over without rebinding.  Only one handoff can be in
+ * progress at a time.
+ *
+ * Only peers running with the same effective user id as this
+ * process (or the one passed to SetAllowedUid()) are served; others
+ * are rejected (see SO_PEERCRED).
+ */
+class HandoffServer final : ServerSocket {
+	HandoffHandler &handler;
+
+	/**
+	 * Only peers with this user id may take our sockets.
+	 */
+	uid_t allowed_uid;
+
+	/**
+	 * The connection to the new process, waiting for
+	 * #HandoffCommand::COMMIT.
+	 */
+	UniqueSocketDescriptor peer;
+
+	SocketEvent peer_event;
+
+public:
+	HandoffServer(EventLoop &event_loop, HandoffHandler &_handler) noexcept;
+	~HandoffServer() noexcept;
+
+	/**
+	 * Allow a different user to take over, e.g. if the new
+	 * process switches to an unprivileged user before connecting.
+	 */
+	void SetAllowedUid(uid_t uid) noexcept {
+		allowed_uid = uid;
+	}
+
+	/**
+	 * Throws on error.
+	 *
+	 * @param path the socket path; if it starts with '@', an
+	 * abstract socket is created
+	 * @param mode the permissions of the socket file (ignored
+	 * for abstract sockets)
+	 */
+	void Listen(const char *path, mode_t mode=0600);
+
+	using ServerSocket::GetLocalAddress;
+
+	/**
+	 * Is a handoff currently in progress?
+	 */
+	bool IsBusy() const noexcept {
+		return peer.IsDefined();
+	}
+
+private:
+	void ClosePeer() noexcept;
+
+	void OnPeerReady(unsigned events) noexcept;
+
+	/* virtual methods from class ServerSocket */
+	void OnAccept(UniqueSocketDescriptor &&fd,
+		      SocketAddress address) override;
+	void OnAcceptError(std::exception_ptr ep) override;
+};
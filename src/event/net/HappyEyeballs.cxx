@@ -0,0 +1,228 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HappyEyeballs.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/DeleteDisposer.hxx"
+
+#include <stdexcept>
+
+#include <assert.h>
+#include <errno.h>
+
+HappyEyeballsConnect::Attempt::Attempt(HappyEyeballsConnect &_parent) noexcept
+	:parent(_parent), socket(parent.event_loop, *this) {}
+
+inline void
+HappyEyeballsConnect::Attempt::Start(UniqueSocketDescriptor fd,
+				     const struct timeval &_timeout) noexcept
+{
+	socket.WaitConnected(std::move(fd), _timeout);
+}
+
+void
+HappyEyeballsConnect::Attempt::OnSocketConnectSuccess(UniqueSocketDescriptor &&fd)
+{
+	parent.OnAttemptSuccess(*this, std::move(fd));
+}
+
+void
+HappyEyeballsConnect::Attempt::OnSocketConnectTimeout()
+{
+	parent.OnAttemptError(*this,
+			      std::make_exception_ptr(std::runtime_error("Connect timeout")),
+			      true);
+}
+
+void
+HappyEyeballsConnect::Attempt::OnSocketConnectError(std::exception_ptr ep)
+{
+	parent.OnAttemptError(*this, ep, false);
+}
+
+constexpr struct timeval HappyEyeballsConnect::DEFAULT_ATTEMPT_DELAY;
+
+HappyEyeballsConnect::HappyEyeballsConnect(EventLoop &_event_loop,
+					   ConnectSocketHandler &_handler,
+					   const struct timeval &_attempt_delay) noexcept
+	:event_loop(_event_loop), handler(_handler),
+	 attempt_delay(_attempt_delay),
+	 delay_timer(event_loop, BIND_THIS_METHOD(OnDelayTimer))
+{
+}
+
+HappyEyeballsConnect::~HappyEyeballsConnect() noexcept
+{
+	if (IsPending())
+		Cancel();
+}
+
+void
+HappyEyeballsConnect::Cancel() noexcept
+{
+	assert(IsPending());
+
+	CancelAttempts();
+}
+
+void
+HappyEyeballsConnect::CancelAttempts() noexcept
+{
+	delay_timer.Cancel();
+	attempts.clear_and_dispose(DeleteDisposer());
+	next = addresses.size();
+}
+
+void
+HappyEyeballsConnect::Interleave() noexcept
+{
+	if (addresses.size() < 3)
+		return;
+
+	const int first_family = addresses.front().GetFamily();
+
+	std::vector<AllocatedSocketAddress> first, second;
+	first.reserve(addresses.size());
+	second.reserve(addresses.size());
+
+	for (auto &i : addresses)
+		(i.GetFamily() == first_family ? first : second)
+			.emplace_back(std::move(i));
+
+	addresses.clear();
+	auto a = first.begin(), b = second.begin();
+	while (a != first.end() || b != second.end()) {
+		if (a != first.end())
+			addresses.emplace_back(std::move(*a++));
+		if (b != second.end())
+			addresses.emplace_back(std::move(*b++));
+	}
+}
+
+void
+HappyEyeballsConnect::Start(const struct timeval &_timeout) noexcept
+{
+	timeout = _timeout;
+	next = 0;
+	error = nullptr;
+	timed_out = false;
+
+	if (addresses.empty()) {
+		handler.OnSocketConnectError(std::make_exception_ptr(std::runtime_error("No address")));
+		return;
+	}
+
+	Interleave();
+	StartNext();
+}
+
+static UniqueSocketDescriptor
+Connect(const SocketAddress address)
+{
+	UniqueSocketDescriptor fd;
+	if (!fd.CreateNonBlock(address.GetFamily(), SOCK_STREAM, 0))
+		throw MakeErrno("Failed to create socket");
+
+	if (!fd.Connect(address) && errno != EINPROGRESS)
+		throw MakeErrno("Failed to connect");
+
+	return fd;
+}
+
+void
+HappyEyeballsConnect::StartNext() noexcept
+{
+	while (next < addresses.size()) {
+		const SocketAddress address = addresses[next++];
+
+		try {
+			auto *attempt = new Attempt(*this);
+			attempts.push_back(*attempt);
+
+			try {
+				attempt->Start(::Connect(address), timeout);
+			} catch (...) {
+				delete attempt;
+				throw;
+			}
+		} catch (...) {
+			/* synchronous failure: try the next address
+			   right away */
+			error = std::current_exception();
+			timed_out = false;
+			continue;
+		}
+
+		if (next < addresses.size())
+			delay_timer.Add(attempt_delay);
+		return;
+	}
+
+	if (attempts.empty()) {
+		/* all attempts have failed */
+		if (timed_out)
+			handler.OnSocketConnectTimeout();
+		else
+			handler.OnSocketConnectError(error);
+	}
+}
+
+void
+HappyEyeballsConnect::OnDelayTimer() noexcept
+{
+	StartNext();
+}
+
+void
+HappyEyeballsConnect::OnAttemptSuccess(Attempt &attempt,
+				       UniqueSocketDescriptor &&fd) noexcept
+{
+	delete &attempt;
+	CancelAttempts();
+
+	handler.OnSocketConnectSuccess(std::move(fd));
+}
+
+void
+HappyEyeballsConnect::OnAttemptError(Attempt &attempt, std::exception_ptr e,
+				     bool _timed_out) noexcept
+{
+	delete &attempt;
+
+	error = e;
+	timed_out = _timed_out;
+
+	/* start the next attempt right away */
+	delay_timer.Cancel();
+	StartNext();
+}
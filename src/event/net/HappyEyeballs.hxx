@@ -0,0 +1,178 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "ConnectSocket.hxx"
+#include "event/TimerEvent.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "util/Cancellable.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+#include <exception>
+#include <vector>
+
+#include <assert.h>
+#include <sys/time.h>
+
+/**
+ * Connect to one of several addresses of a host, racing staggered
+ * attempts according to "Happy Eyeballs" (RFC 8305): the address
+ * families are interleaved, and a new attempt is started each time
+ * the "Connection Attempt Delay" elapses or the previous attempt
+ * fails.  The first successful connection wins; all others are
+ * closed.
+ */
+class HappyEyeballsConnect final : public Cancellable {
+	EventLoop &event_loop;
+	ConnectSocketHandler &handler;
+
+	/**
+	 * The "Connection Attempt Delay".
+	 */
+	const struct timeval attempt_delay;
+
+	/**
+	 * The timeout for each attempt.
+	 */
+	struct timeval timeout;
+
+	std::vector<AllocatedSocketAddress> addresses;
+
+	/**
+	 * The index of the next address in #addresses to be tried.
+	 */
+	std::size_t next = 0;
+
+	class Attempt final
+		: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>,
+		  ConnectSocketHandler {
+
+		HappyEyeballsConnect &parent;
+
+		ConnectSocket socket;
+
+	public:
+		explicit Attempt(HappyEyeballsConnect &_parent) noexcept;
+
+		void Start(UniqueSocketDescriptor fd,
+			   const struct timeval &timeout) noexcept;
+
+	private:
+		/* virtual methods from ConnectSocketHandler */
+		void OnSocketConnectSuccess(UniqueSocketDescriptor &&fd) override;
+		void OnSocketConnectTimeout() override;
+		void OnSocketConnectError(std::exception_ptr ep) override;
+	};
+
+	typedef boost::intrusive::list<Attempt,
+				       boost::intrusive::constant_time_size<false>> AttemptList;
+
+	AttemptList attempts;
+
+	TimerEvent delay_timer;
+
+	/**
+	 * The error of the most recent failed attempt.
+	 */
+	std::exception_ptr error;
+
+	/**
+	 * Did the most recent failed attempt time out?
+	 */
+	bool timed_out;
+
+public:
+	static constexpr struct timeval DEFAULT_ATTEMPT_DELAY{0, 250000};
+
+	HappyEyeballsConnect(EventLoop &_event_loop,
+			     ConnectSocketHandler &_handler,
+			     const struct timeval &_attempt_delay=DEFAULT_ATTEMPT_DELAY) noexcept;
+	~HappyEyeballsConnect() noexcept;
+
+	HappyEyeballsConnect(const HappyEyeballsConnect &) = delete;
+	HappyEyeballsConnect &operator=(const HappyEyeballsConnect &) = delete;
+
+	bool IsPending() const noexcept {
+		return !attempts.empty();
+	}
+
+	/**
+	 * Start connecting to the given addresses (a container whose
+	 * elements are convertible to #SocketAddress, e.g.
+	 * Cares::AddressList).  The #ConnectSocketHandler is invoked
+	 * exactly once, possibly before this method returns.
+	 *
+	 * @param _timeout the timeout for each attempt
+	 */
+	template<typename L>
+	void Connect(const L &list, const struct timeval &_timeout) noexcept {
+		assert(!IsPending());
+
+		addresses.clear();
+		for (SocketAddress i : list)
+			addresses.emplace_back(i);
+
+		Start(_timeout);
+	}
+
+	/* virtual methods from Cancellable */
+	void Cancel() noexcept override;
+
+private:
+	void Start(const struct timeval &_timeout) noexcept;
+
+	/**
+	 * Reorder #addresses so the address families alternate,
+	 * beginning with the family of the first address (RFC 8305
+	 * section 4).  The relative order within each family is
+	 * preserved.
+	 */
+	void Interleave() noexcept;
+
+	/**
+	 * Start an attempt with the next address.  If there is none
+	 * left and all attempts have failed, report the error to the
+	 * #ConnectSocketHandler.
+	 */
+	void StartNext() noexcept;
+
+	void CancelAttempts() noexcept;
+
+	void OnDelayTimer() noexcept;
+
+	void OnAttemptSuccess(Attempt &attempt,
+			      UniqueSocketDescriptor &&fd) noexcept;
+	void OnAttemptError(Attempt &attempt, std::exception_ptr e,
+			    bool _timed_out) noexcept;
+};
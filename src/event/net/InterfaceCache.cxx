@@ -0,0 +1,202 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "InterfaceCache.hxx"
+#include "system/Error.hxx"
+
+#include <algorithm>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+
+/**
+ * Large enough for one datagram of a dump reply (the kernel fills
+ * at most 8 kB or one page per datagram).
+ */
+static constexpr size_t NETLINK_BUFFER_SIZE = 32768;
+
+InterfaceCache::InterfaceCache(EventLoop &event_loop,
+			       InterfaceCacheHandler &_handler)
+	:event(event_loop, BIND_THIS_METHOD(OnSocketReady)),
+	 handler(_handler)
+{
+	if (!fd.Create(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE))
+		throw MakeErrno("Failed to create netlink socket");
+
+	struct sockaddr_nl sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_LINK|RTMGRP_IPV4_IFADDR|RTMGRP_IPV6_IFADDR;
+
+	if (!fd.Bind(SocketAddress((const struct sockaddr *)&sa, sizeof(sa))))
+		throw MakeErrno("Failed to bind netlink socket");
+
+	/* subscribe before the dump, so no change can get lost; the
+	   notifications received during the dump are applied in
+	   order with the dump replies */
+	Reload();
+
+	event.Set(fd.Get(), SocketEvent::READ|SocketEvent::PERSIST);
+	event.Add();
+}
+
+InterfaceCache::~InterfaceCache() noexcept
+{
+	event.Delete();
+}
+
+void
+InterfaceCache::Reload()
+{
+	table.clear();
+	Dump(RTM_GETLINK, AF_UNSPEC);
+	Dump(RTM_GETADDR, AF_UNSPEC);
+}
+
+void
+InterfaceCache::Dump(uint16_t type, uint8_t family)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct rtgenmsg g;
+	} request;
+
+	memset(&request, 0, sizeof(request));
+	request.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(request.g));
+	request.nlh.nlmsg_type = type;
+	request.nlh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+	request.nlh.nlmsg_seq = ++seq;
+	request.g.rtgen_family = family;
+
+	if (send(fd.Get(), &request, request.nlh.nlmsg_len, 0) < 0)
+		throw MakeErrno("Failed to send netlink request");
+
+	char buffer[NETLINK_BUFFER_SIZE];
+	bool modified = false;
+
+	while (true) {
+		ssize_t nbytes = recv(fd.Get(), buffer, sizeof(buffer), 0);
+		if (nbytes < 0)
+			throw MakeErrno("Failed to receive from netlink socket");
+
+		if (HandleDatagram(buffer, nbytes, request.nlh.nlmsg_seq,
+				   modified))
+			break;
+	}
+}
+
+bool
+InterfaceCache::HandleDatagram(const void *data, size_t size,
+			       uint32_t done_seq, bool &modified_r)
+{
+	const char *p = (const char *)data;
+
+	while (size >= sizeof(struct nlmsghdr)) {
+		const auto &nlh = *(const struct nlmsghdr *)(const void *)p;
+		if (nlh.nlmsg_len < sizeof(nlh) || nlh.nlmsg_len > size)
+			throw std::runtime_error("Malformed netlink message");
+
+		const bool ours = done_seq != 0 && nlh.nlmsg_seq == done_seq;
+
+		switch (nlh.nlmsg_type) {
+		case NLMSG_DONE:
+			if (ours)
+				return true;
+			break;
+
+		case NLMSG_ERROR:
+			if (ours) {
+				const auto &e = *(const struct nlmsgerr *)
+					(const void *)(p + NLMSG_HDRLEN);
+				if (nlh.nlmsg_len >= NLMSG_LENGTH(sizeof(e)) &&
+				    e.error != 0)
+					throw MakeErrno(-e.error,
+							"Netlink request failed");
+			}
+			break;
+
+		default:
+			if (table.Handle(nlh))
+				modified_r = true;
+			break;
+		}
+
+		const size_t n = std::min<size_t>(NLMSG_ALIGN(nlh.nlmsg_len),
+						  size);
+		p += n;
+		size -= n;
+	}
+
+	return false;
+}
+
+bool
+InterfaceCache::ReceiveAll()
+{
+	char buffer[NETLINK_BUFFER_SIZE];
+	bool modified = false;
+
+	while (true) {
+		ssize_t nbytes = recv(fd.Get(), buffer, sizeof(buffer),
+				      MSG_DONTWAIT);
+		if (nbytes < 0) {
+			const int e = errno;
+			if (e == EAGAIN)
+				return modified;
+
+			if (e == ENOBUFS) {
+				/* the receive buffer has overflowed
+				   and notifications have been lost:
+				   start over */
+				Reload();
+				return true;
+			}
+
+			throw MakeErrno(e, "Failed to receive from netlink socket");
+		}
+
+		HandleDatagram(buffer, nbytes, 0, modified);
+	}
+}
+
+void
+InterfaceCache::OnSocketReady(unsigned) noexcept
+try {
+	if (ReceiveAll())
+		handler.OnInterfaceCacheChanged();
+} catch (...) {
+	event.Delete();
+	handler.OnInterfaceCacheError(std::current_exception());
+}
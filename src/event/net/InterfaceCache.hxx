@@ -0,0 +1,155 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/SocketEvent.hxx"
+#include "net/InterfaceTable.hxx"
+#include "net/SocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <exception>
+
+class InterfaceCacheHandler {
+public:
+	/**
+	 * An interface or an address has been added, removed or
+	 * modified.
+	 */
+	virtual void OnInterfaceCacheChanged() noexcept = 0;
+
+	/**
+	 * The netlink socket has failed, and the cache will not be
+	 * updated anymore.
+	 */
+	virtual void OnInterfaceCacheError(std::exception_ptr ep) noexcept = 0;
+};
+
+/**
+ * A #NetworkInterfaceTable which is loaded from the kernel with
+ * RTM_GETLINK and RTM_GETADDR and then kept up to date by
+ * rtnetlink multicast notifications.  Lookups never talk to the
+ * kernel, which makes them a cheap replacement for
+ * FindNetworkInterface() and if_nametoindex() in code which polls
+ * interface state.
+ */
+class InterfaceCache {
+	UniqueSocketDescriptor fd;
+	SocketEvent event;
+
+	InterfaceCacheHandler &handler;
+
+	NetworkInterfaceTable table;
+
+	uint32_t seq = 0;
+
+public:
+	/**
+	 * Open the netlink socket and load the current state
+	 * synchronously, so the table is complete when the
+	 * constructor returns.
+	 *
+	 * Throws on error.
+	 */
+	InterfaceCache(EventLoop &event_loop, InterfaceCacheHandler &_handler);
+
+	~InterfaceCache() noexcept;
+
+	InterfaceCache(const InterfaceCache &) = delete;
+	InterfaceCache &operator=(const InterfaceCache &) = delete;
+
+	const NetworkInterfaceTable &GetTable() const noexcept {
+		return table;
+	}
+
+	gcc_pure
+	unsigned FindIndex(const char *name) const noexcept {
+		return table.FindIndex(name);
+	}
+
+	gcc_pure
+	const char *FindName(unsigned index) const noexcept {
+		return table.FindName(index);
+	}
+
+	gcc_pure
+	bool IsRunning(unsigned index) const noexcept {
+		return table.IsRunning(index);
+	}
+
+	gcc_pure
+	unsigned FindAddress(SocketAddress address) const noexcept {
+		return table.FindAddress(address);
+	}
+
+private:
+	/**
+	 * Discard the table and reload it from the kernel.  This is
+	 * also used to recover after the socket's receive buffer has
+	 * overflowed and notifications have been lost.
+	 *
+	 * Throws on error.
+	 */
+	void Reload();
+
+	/**
+	 * Send a dump request and apply all replies (and all
+	 * notifications received meanwhile) until NLMSG_DONE.
+	 *
+	 * Throws on error.
+	 */
+	void Dump(uint16_t type, uint8_t family);
+
+	/**
+	 * Apply all messages in one datagram.
+	 *
+	 * Throws on error.
+	 *
+	 * @param done_seq if non-zero, then this is the sequence
+	 * number of a pending dump request
+	 * @param modified_r set to true if the table was modified
+	 * @return true if the NLMSG_DONE for #done_seq was received
+	 */
+	bool HandleDatagram(const void *data, size_t size,
+			    uint32_t done_seq, bool &modified_r);
+
+	/**
+	 * Receive and apply all pending notifications.
+	 *
+	 * Throws on error.
+	 *
+	 * @return true if the table was modified
+	 */
+	bool ReceiveAll();
+
+	void OnSocketReady(unsigned events) noexcept;
+};
@@ -32,6 +32,7 @@
 
 #include "MultiUdpListener.hxx"
 #include "UdpHandler.hxx"
+#include "net/MultiSendMessage.hxx"
 #include "system/Error.hxx"
 
 #include <assert.h>
@@ -58,6 +59,12 @@ MultiUdpListener::~MultiUdpListener() noexcept
 	event.Delete();
 }
 
+void
+MultiUdpListener::SetReplyBatch(MultiSendMessage &&_multi_send)
+{
+	multi_send.reset(new MultiSendMessage(std::move(_multi_send)));
+}
+
 void
 MultiUdpListener::EventCallback(unsigned) noexcept
 try {
@@ -66,16 +73,32 @@ try {
 		return;
 	}
 
-	for (auto &d : multi)
+	in_batch = true;
+
+	for (auto &d : multi) {
+		current = &d;
 		if (!handler.OnUdpDatagram(d.payload.data, d.payload.size,
 					   d.address,
 					   d.cred != nullptr
 					   ? d.cred->uid
 					   : -1))
 			return;
+	}
+
+	current = nullptr;
+	in_batch = false;
 
 	multi.Clear();
+
+	if (multi_send && !multi_send->empty())
+		n_dropped_replies += multi_send->Flush(socket);
 } catch (...) {
+	current = nullptr;
+	in_batch = false;
+
+	if (multi_send)
+		multi_send->Clear();
+
 	/* unregister the SocketEvent, just in case the handler does
 	   not destroy us */
 	event.Delete();
@@ -89,6 +112,19 @@ MultiUdpListener::Reply(SocketAddress address,
 {
 	assert(socket.IsDefined());
 
+	if (in_batch && multi_send) {
+		if (multi_send->Push(address, {data, data_length}))
+			return;
+
+		if (!multi_send->empty()) {
+			n_dropped_replies += multi_send->Flush(socket);
+			if (multi_send->Push(address, {data, data_length}))
+				return;
+		}
+
+		/* too large for the buffer: send it right away */
+	}
+
 	ssize_t nbytes = sendto(socket.Get(), data, data_length,
 				MSG_DONTWAIT|MSG_NOSIGNAL,
 				address.GetAddress(), address.GetSize());
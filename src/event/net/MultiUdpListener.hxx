@@ -36,10 +36,14 @@
 #include "net/UniqueSocketDescriptor.hxx"
 #include "net/MultiReceiveMessage.hxx"
 
+#include <memory>
+
+#include <assert.h>
 #include <stddef.h>
 
 class SocketAddress;
 class UdpHandler;
+class MultiSendMessage;
 
 /**
  * Listener on a UDP port.  Unlike #UdpListener, it uses recvmmsg()
@@ -51,6 +55,29 @@ class MultiUdpListener {
 
 	MultiReceiveMessage multi;
 
+	/**
+	 * If set, replies sent while handling a batch of received
+	 * datagrams are queued here and flushed with sendmmsg()
+	 * after the batch.  See SetReplyBatch().
+	 */
+	std::unique_ptr<MultiSendMessage> multi_send;
+
+	/**
+	 * The number of queued replies which could not be sent.
+	 */
+	size_t n_dropped_replies = 0;
+
+	/**
+	 * Is EventCallback() currently passing received datagrams to
+	 * the handler?
+	 */
+	bool in_batch = false;
+
+	/**
+	 * The datagram currently being passed to the handler.
+	 */
+	const MultiReceiveMessage::Datagram *current = nullptr;
+
 	UdpHandler &handler;
 
 public:
@@ -74,6 +101,38 @@ public:
 		event.Delete();
 	}
 
+	/**
+	 * Queue replies sent from within UdpHandler::OnUdpDatagram()
+	 * and send them all with one sendmmsg() call after the
+	 * current batch has been handled.
+	 */
+	void SetReplyBatch(MultiSendMessage &&_multi_send);
+
+	/**
+	 * Returns the number of queued replies (see SetReplyBatch())
+	 * which have been discarded, e.g. because their destination
+	 * was unreachable.  Such errors are not reported to the
+	 * #UdpHandler.
+	 */
+	size_t GetDroppedReplies() const noexcept {
+		return n_dropped_replies;
+	}
+
+	/**
+	 * Keep the datagram currently being handled beyond the
+	 * UdpHandler::OnUdpDatagram() call without copying it (see
+	 * MultiReceiveMessage::Retain()).  May only be called from
+	 * within UdpHandler::OnUdpDatagram().
+	 *
+	 * @return the retained datagram, or an empty instance if no
+	 * retain slot is available
+	 */
+	MultiReceiveMessage::RetainedDatagram RetainCurrent() noexcept {
+		assert(current != nullptr);
+
+		return multi.Retain(*current);
+	}
+
 	/**
 	 * Obtains the underlying socket, which can be used to send
 	 * replies.
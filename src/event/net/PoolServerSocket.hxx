@@ -0,0 +1,100 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef POOL_SERVER_SOCKET_HXX
+#define POOL_SERVER_SOCKET_HXX
+
+#include "event/Pool.hxx"
+#include "net/SocketAddress.hxx"
+
+#include <forward_list>
+
+/**
+ * Manages one #ServerSocket instance (of type #T) per #EventLoop of
+ * an #EventLoopPool.  All of them listen on the same address with
+ * SO_REUSEPORT, which lets the kernel distribute incoming
+ * connections over all threads.
+ *
+ * Construct and call Listen() before EventLoopPool::Start(), and
+ * destruct after EventLoopPool::Stop().
+ */
+template<typename T>
+class PoolServerSocket {
+	EventLoopPool &pool;
+
+	std::forward_list<T> sockets;
+
+	unsigned n = 0;
+
+public:
+	/**
+	 * @param args additional arguments passed to each #T constructor
+	 * after the #EventLoop reference
+	 */
+	template<typename... Args>
+	explicit PoolServerSocket(EventLoopPool &_pool, Args&&... args)
+		:pool(_pool) {
+		/* keep the list in pool order, because the index in
+		   the SO_REUSEPORT group is the order of bind() */
+		auto pos = sockets.before_begin();
+		for (size_t i = 0; i < pool.size(); ++i, ++n)
+			pos = sockets.emplace_after(pos, pool[i], args...);
+	}
+
+	/**
+	 * Throws std::runtime_error on error.
+	 *
+	 * @param steer_by_cpu attach a SO_REUSEPORT program which
+	 * delivers each connection to the loop pinned to the CPU
+	 * which handled its packets (see EventLoopPool::GetCpus();
+	 * requires EventLoopPool::Start(true)), instead of hashing
+	 */
+	void Listen(SocketAddress address,
+		    bool free_bind=false,
+		    const char *bind_to_device=nullptr,
+		    bool steer_by_cpu=false) {
+		for (auto &i : sockets)
+			i.Listen(address, true, free_bind, bind_to_device);
+
+		if (steer_by_cpu && !sockets.empty())
+			/* the program applies to the whole group */
+			sockets.front().SetReusePortCpu(pool.GetCpus(), n);
+	}
+
+	template<typename F>
+	void ForEach(F &&f) {
+		for (auto &i : sockets)
+			f(i);
+	}
+};
+
+#endif
@@ -38,6 +38,8 @@
 #include "net/StaticSocketAddress.hxx"
 #include "net/AllocatedSocketAddress.hxx"
 #include "system/Error.hxx"
+#include "io/uring/Queue.hxx"
+#include "io/uring/Operation.hxx"
 
 #include <assert.h>
 #include <stddef.h>
@@ -49,10 +51,137 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+/**
+ * Accepts connections with IORING_OP_ACCEPT.  It is allocated on the
+ * heap, because the kernel may still write to #remote_address after
+ * the #ServerSocket has been destroyed; in that case the object
+ * deletes itself when the (canceled) completion arrives.
+ */
+class ServerSocket::UringAccept final : Uring::Operation {
+	ServerSocket *parent;
+	Uring::Queue &queue;
+
+	StaticSocketAddress remote_address;
+	socklen_t remote_address_size;
+
+	/**
+	 * Has an accept been submitted whose completion has not yet
+	 * arrived?
+	 */
+	bool in_flight = false;
+
+	/**
+	 * Shall a new accept be submitted after each completion?
+	 */
+	bool enabled = false;
+
+	/**
+	 * Is OnUringCompletion() currently invoking the
+	 * #ServerSocket?
+	 */
+	bool in_callback = false;
+
+public:
+	UringAccept(ServerSocket &_parent, Uring::Queue &_queue) noexcept
+		:parent(&_parent), queue(_queue) {}
+
+	void Enable() {
+		enabled = true;
+		if (!in_flight && !in_callback)
+			Submit();
+	}
+
+	void Disable() {
+		enabled = false;
+		if (in_flight)
+			queue.Cancel(*this);
+	}
+
+	/**
+	 * The #ServerSocket is being destroyed.
+	 */
+	void Disown() noexcept {
+		parent = nullptr;
+		enabled = false;
+
+		if (in_flight) {
+			try {
+				queue.Cancel(*this);
+			} catch (...) {
+				/* the completion will arrive eventually when
+				   the listener socket gets closed */
+			}
+		} else if (!in_callback)
+			delete this;
+	}
+
+private:
+	void Submit() {
+		auto &sqe = queue.Require();
+		sqe.opcode = IORING_OP_ACCEPT;
+		sqe.fd = parent->fd.Get();
+		remote_address_size = remote_address.GetCapacity();
+		sqe.addr = (uint64_t)(uintptr_t)(struct sockaddr *)remote_address;
+		sqe.addr2 = (uint64_t)(uintptr_t)&remote_address_size;
+		sqe.accept_flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+		queue.Push(sqe, *this);
+		in_flight = true;
+	}
+
+	void OnUringCompletion(int res) noexcept override;
+};
+
+void
+ServerSocket::UringAccept::OnUringCompletion(int res) noexcept
+{
+	in_flight = false;
+
+	if (parent == nullptr) {
+		if (res >= 0)
+			close(res);
+		delete this;
+		return;
+	}
+
+	in_callback = true;
+
+	if (res >= 0) {
+		remote_address.SetSize(remote_address_size);
+		parent->OnAccepted(UniqueSocketDescriptor(res),
+				   remote_address);
+	} else if (res != -ECANCELED && res != -EAGAIN &&
+		   res != -EINTR)
+		parent->OnAcceptError(std::make_exception_ptr(MakeErrno(-res, "Failed to accept connection")));
+
+	in_callback = false;
+
+	if (parent == nullptr) {
+		/* the #ServerSocket was destroyed by the handler */
+		delete this;
+		return;
+	}
+
+	if (enabled) {
+		try {
+			Submit();
+		} catch (...) {
+			enabled = false;
+			parent->OnAcceptError(std::current_exception());
+		}
+	}
+}
 
 ServerSocket::~ServerSocket()
 {
-	if (fd.IsDefined())
+	if (uring_accept != nullptr)
+		uring_accept->Disown();
+	else if (fd.IsDefined())
 		event.Delete();
 }
 
@@ -63,10 +192,50 @@ ServerSocket::Listen(UniqueSocketDescriptor _fd)
 	assert(_fd.IsDefined());
 
 	fd = std::move(_fd);
-	event.Set(fd.Get(), SocketEvent::READ|SocketEvent::PERSIST);
+
+	auto *queue = event.GetEventLoop().GetUring();
+	if (queue != nullptr)
+		uring_accept = new UringAccept(*this, *queue);
+	else if (exclusive) {
+		/* libevent cannot pass EPOLLEXCLUSIVE, therefore the
+		   listener is registered in a private epoll instance,
+		   which in turn is watched by libevent */
+		exclusive_epoll = UniqueFileDescriptor(FileDescriptor(epoll_create1(EPOLL_CLOEXEC)));
+		if (!exclusive_epoll.IsDefined())
+			throw MakeErrno("epoll_create1() failed");
+
+		struct epoll_event ee{};
+		ee.events = EPOLLIN|EPOLLEXCLUSIVE;
+		if (epoll_ctl(exclusive_epoll.Get(), EPOLL_CTL_ADD,
+			      fd.Get(), &ee) < 0)
+			throw MakeErrno("Failed to register listener with EPOLLEXCLUSIVE");
+
+		event.Set(exclusive_epoll.Get(),
+			  SocketEvent::READ|SocketEvent::PERSIST);
+	} else
+		event.Set(fd.Get(), SocketEvent::READ|SocketEvent::PERSIST);
+
 	AddEvent();
 }
 
+void
+ServerSocket::AddEvent()
+{
+	if (uring_accept != nullptr)
+		uring_accept->Enable();
+	else
+		event.Add();
+}
+
+void
+ServerSocket::RemoveEvent()
+{
+	if (uring_accept != nullptr)
+		uring_accept->Disable();
+	else
+		event.Delete();
+}
+
 static UniqueSocketDescriptor
 MakeListener(const SocketAddress address,
 	     bool reuse_port,
@@ -182,8 +351,93 @@ ServerSocket::GetLocalAddress() const
 	return fd.GetLocalAddress();
 }
 
+void
+ServerSocket::SetReusePortCpu(unsigned n)
+{
+	if (!fd.SetReusePortCpu(n))
+		throw MakeErrno("Failed to attach SO_REUSEPORT program");
+}
+
+void
+ServerSocket::SetReusePortCpu(const int *cpus, unsigned n)
+{
+	if (!fd.SetReusePortCpu(cpus, n))
+		throw MakeErrno("Failed to attach SO_REUSEPORT program");
+}
+
+void
+ServerSocket::SetAcceptBatch(unsigned n)
+{
+	assert(n > 0);
+
+	batch.reset(n > 1 ? new AcceptedSocket[n] : nullptr);
+	accept_batch = n;
+}
+
+void
+ServerSocket::OnAcceptBatch(AcceptedSocket *sockets, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		OnAccept(std::move(sockets[i].fd), sockets[i].address);
+}
+
 void
 ServerSocket::EventCallback(unsigned)
+{
+	if (exclusive_epoll.IsDefined()) {
+		/* consume the readiness of the private epoll
+		   instance */
+		struct epoll_event ee;
+		epoll_wait(exclusive_epoll.Get(), &ee, 1, 0);
+	}
+
+	if (batch)
+		AcceptBatch();
+	else
+		AcceptOne();
+}
+
+void
+ServerSocket::AcceptBatch()
+{
+	std::exception_ptr error;
+	size_t n = 0;
+
+	while (n < accept_batch) {
+		auto &s = batch[n];
+		s.fd = fd.AcceptNonBlock(s.address);
+		if (!s.fd.IsDefined()) {
+			const int e = errno;
+			if (e != EAGAIN && e != EWOULDBLOCK)
+				error = std::make_exception_ptr(MakeErrno(e, "Failed to accept connection"));
+			break;
+		}
+
+		if (IsTCP(s.address) && !s.fd.SetNoDelay()) {
+			error = std::make_exception_ptr(MakeErrno("setsockopt(TCP_NODELAY) failed"));
+			s.fd.Close();
+			continue;
+		}
+
+		++n;
+	}
+
+	if (n > 0) {
+		OnAcceptBatch(batch.get(), n);
+
+		/* close the sockets which were not claimed by
+		   OnAcceptBatch() */
+		for (size_t i = 0; i < n; ++i)
+			if (batch[i].fd.IsDefined())
+				batch[i].fd.Close();
+	}
+
+	if (error)
+		OnAcceptError(error);
+}
+
+void
+ServerSocket::AcceptOne()
 {
 	StaticSocketAddress remote_address;
 	auto remote_fd = fd.AcceptNonBlock(remote_address);
@@ -195,6 +449,13 @@ ServerSocket::EventCallback(unsigned)
 		return;
 	}
 
+	OnAccepted(std::move(remote_fd), remote_address);
+}
+
+void
+ServerSocket::OnAccepted(UniqueSocketDescriptor &&remote_fd,
+			 SocketAddress remote_address)
+{
 	if (IsTCP(remote_address) && !remote_fd.SetNoDelay()) {
 		OnAcceptError(std::make_exception_ptr(MakeErrno("setsockopt(TCP_NODELAY) failed")));
 		return;
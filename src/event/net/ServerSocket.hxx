@@ -33,9 +33,15 @@
 #pragma once
 
 #include "net/UniqueSocketDescriptor.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "io/UniqueFileDescriptor.hxx"
 #include "event/SocketEvent.hxx"
 
 #include <exception>
+#include <memory>
+
+#include <assert.h>
+#include <stddef.h>
 
 class SocketAddress;
 
@@ -46,6 +52,36 @@ class ServerSocket {
 	UniqueSocketDescriptor fd;
 	SocketEvent event;
 
+	/**
+	 * If the #EventLoop has io_uring enabled, connections are
+	 * accepted by this operation instead of #event.
+	 */
+	class UringAccept;
+	UringAccept *uring_accept = nullptr;
+
+	/**
+	 * An epoll instance which watches #fd with EPOLLEXCLUSIVE;
+	 * #event is registered on this one instead of #fd.  See
+	 * SetExclusive().
+	 */
+	UniqueFileDescriptor exclusive_epoll;
+
+	bool exclusive = false;
+
+public:
+	struct AcceptedSocket {
+		UniqueSocketDescriptor fd;
+		StaticSocketAddress address;
+	};
+
+private:
+	/**
+	 * The maximum number of connections accepted per wakeup.
+	 */
+	unsigned accept_batch = 1;
+
+	std::unique_ptr<AcceptedSocket[]> batch;
+
 public:
 	explicit ServerSocket(EventLoop &event_loop)
 		:event(event_loop, BIND_THIS_METHOD(EventCallback)) {}
@@ -75,18 +111,58 @@ public:
 
 	StaticSocketAddress GetLocalAddress() const;
 
+	/**
+	 * Returns the listener socket, e.g. to pass it to a new
+	 * process (see #HandoffServer).
+	 */
+	SocketDescriptor GetSocket() const noexcept {
+		return fd;
+	}
+
 	bool SetTcpDeferAccept(const int &seconds) {
 		return fd.SetTcpDeferAccept(seconds);
 	}
 
-	void AddEvent() {
-		event.Add();
-	}
+	/**
+	 * Steer new connections within this socket's SO_REUSEPORT
+	 * group by CPU; see SocketDescriptor::SetReusePortCpu().
+	 *
+	 * Throws std::system_error on error.
+	 */
+	void SetReusePortCpu(unsigned n);
+
+	/**
+	 * Like SetReusePortCpu(unsigned), but with an explicit
+	 * CPU table; see SocketDescriptor::SetReusePortCpu(const int
+	 * *, unsigned).
+	 *
+	 * Throws std::system_error on error.
+	 */
+	void SetReusePortCpu(const int *cpus, unsigned n);
+
+	/**
+	 * Drain up to the given number of pending connections from the
+	 * backlog per wakeup (instead of just one), and deliver them to
+	 * OnAcceptBatch().
+	 */
+	void SetAcceptBatch(unsigned n);
 
-	void RemoveEvent() {
-		event.Delete();
+	/**
+	 * Register the listener with EPOLLEXCLUSIVE, so only one of
+	 * several #EventLoops sharing the same listener (each with
+	 * its own dup() of the descriptor) gets woken up for a new
+	 * connection.  Must be called before Listen().  This is
+	 * ignored if the #EventLoop uses io_uring.
+	 */
+	void SetExclusive(bool _exclusive=true) noexcept {
+		assert(!fd.IsDefined());
+
+		exclusive = _exclusive;
 	}
 
+	void AddEvent();
+	void RemoveEvent();
+
 protected:
 	/**
 	 * A new incoming connection has been established.
@@ -97,6 +173,24 @@ protected:
 			      SocketAddress address) = 0;
 	virtual void OnAcceptError(std::exception_ptr ep) = 0;
 
+	/**
+	 * A batch of new incoming connections has been accepted (see
+	 * SetAcceptBatch()).  The default implementation invokes
+	 * OnAccept() for each of them.  This object must not be
+	 * destroyed before the method returns.
+	 *
+	 * @param sockets the sockets; the callee may move the
+	 * descriptors out; all remaining ones are closed by the
+	 * caller
+	 */
+	virtual void OnAcceptBatch(AcceptedSocket *sockets, size_t n);
+
 private:
+	void OnAccepted(UniqueSocketDescriptor &&remote_fd,
+			SocketAddress remote_address);
+
+	void AcceptOne();
+	void AcceptBatch();
+
 	void EventCallback(unsigned events);
 };
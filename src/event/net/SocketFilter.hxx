@@ -0,0 +1,131 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "net/SocketDescriptor.hxx"
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct iovec;
+template<typename T> class ForeignFifoBuffer;
+
+class SocketFilterHandler {
+public:
+	/**
+	 * An asynchronous operation of the filter (see
+	 * SocketFilter::IsBusy()) has finished; reading and writing
+	 * may be resumed.
+	 */
+	virtual void OnSocketFilterReady() noexcept = 0;
+};
+
+/**
+ * A transformation (e.g. TLS) between the socket and the
+ * #BufferedSocket buffers.  It receives from and sends to the
+ * socket by itself; #BufferedSocket sees only the decoded data.
+ */
+class SocketFilter {
+public:
+	virtual ~SocketFilter() noexcept = default;
+
+	virtual void SetHandler(SocketFilterHandler &handler) noexcept = 0;
+
+	/**
+	 * Receive from the socket and append decoded data to the
+	 * buffer.
+	 *
+	 * Throws on protocol errors.
+	 *
+	 * @return the number of bytes appended, 0 at the end of the
+	 * stream, -1 with errno set (EAGAIN if more data from the
+	 * socket is needed), -2 if the buffer is full
+	 */
+	virtual ssize_t Read(SocketDescriptor s,
+			     ForeignFifoBuffer<uint8_t> &buffer) = 0;
+
+	/**
+	 * Encode data and send it to the socket.  Encoded data which
+	 * the socket did not accept remains in the filter (see
+	 * GetPendingOutput()).
+	 *
+	 * Throws on protocol errors.
+	 *
+	 * @return the number of bytes consumed or -1 with errno set
+	 * (EAGAIN if the filter cannot accept more data now)
+	 */
+	virtual ssize_t WriteV(SocketDescriptor s,
+			       const struct iovec *v, size_t n) = 0;
+
+	/**
+	 * Send pending encoded output.
+	 *
+	 * Throws on protocol errors.
+	 *
+	 * @return 1 if there is no more pending output, 0 if the
+	 * socket blocks, -1 with errno set
+	 */
+	virtual int Flush(SocketDescriptor s) = 0;
+
+	/**
+	 * Announce the end of the stream to the peer (e.g. TLS
+	 * "close_notify"), as far as the socket accepts it without
+	 * blocking.
+	 */
+	virtual void Shutdown(SocketDescriptor s) noexcept = 0;
+
+	/**
+	 * Does the filter hold input which can be decoded without
+	 * receiving more data from the socket?
+	 */
+	virtual bool HasBufferedInput() const noexcept = 0;
+
+	/**
+	 * The number of encoded bytes waiting to be sent.
+	 */
+	virtual size_t GetPendingOutput() const noexcept = 0;
+
+	/**
+	 * Is an asynchronous operation pending?  Until
+	 * SocketFilterHandler::OnSocketFilterReady() is called,
+	 * neither Read() nor WriteV() make any progress.
+	 */
+	virtual bool IsBusy() const noexcept = 0;
+
+	/**
+	 * Can writing make progress only after more input has been
+	 * received (e.g. during the TLS handshake)?
+	 */
+	virtual bool IsWaitingForInput() const noexcept = 0;
+};
@@ -0,0 +1,294 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SocketForwarder.hxx"
+#include "net/SocketProtocolError.hxx"
+#include "system/Error.hxx"
+#include "io/Splice.hxx"
+
+#include <assert.h>
+#include <errno.h>
+
+/**
+ * The maximum number of bytes moved into the pipe by one splice()
+ * call; this is the default pipe capacity on Linux.
+ */
+static constexpr size_t MAX_SPLICE = 64 * 1024;
+
+SocketForwarder::~SocketForwarder() noexcept
+{
+	if (pipe.IsDefined() && piped == 0)
+		pipe_pool.Put(std::move(pipe));
+}
+
+void
+SocketForwarder::Start()
+{
+	assert(!pipe.IsDefined());
+
+	pipe = pipe_pool.Get();
+
+	src.SetHandler(*this);
+	dest.SetHandler(dest_handler);
+
+	/* we only read from the source and only write to the
+	   destination */
+	src.UnscheduleWrite();
+	dest.UnscheduleRead();
+
+	src.SetDirect(true);
+	src.Read(false);
+}
+
+SocketForwarder::DrainResult
+SocketForwarder::Drain() noexcept
+{
+	while (piped > 0) {
+		ssize_t nbytes = dest.WriteFrom(pipe.r.Get(), FdType::FD_PIPE,
+						piped);
+		if (nbytes > 0) {
+			assert(size_t(nbytes) <= piped);
+			piped -= nbytes;
+			forwarded += nbytes;
+			continue;
+		}
+
+		switch (nbytes) {
+		case WRITE_BLOCKING:
+			return DrainResult::BLOCKING;
+
+		case WRITE_DESTROYED:
+			return DrainResult::ERROR;
+
+		case WRITE_SOURCE_EOF:
+			/* cannot happen, because the pipe is not empty */
+			Fail(std::make_exception_ptr(std::runtime_error("Pipe ended unexpectedly")));
+			return DrainResult::ERROR;
+
+		default:
+			Fail(std::make_exception_ptr(MakeErrno("Failed to splice to socket")));
+			return DrainResult::ERROR;
+		}
+	}
+
+	return DrainResult::EMPTY;
+}
+
+void
+SocketForwarder::Finish() noexcept
+{
+	assert(src_ended);
+	assert(piped == 0);
+
+	pipe_pool.Put(std::move(pipe));
+	handler.OnForwardEnd();
+}
+
+void
+SocketForwarder::Fail(std::exception_ptr e) noexcept
+{
+	/* the pipe may contain data; don't return it to the pool */
+	pipe = PipePair();
+	piped = 0;
+
+	handler.OnForwardError(e);
+}
+
+/*
+ * source
+ *
+ */
+
+BufferedResult
+SocketForwarder::OnBufferedData()
+{
+	/* data which was already in the input buffer is written
+	   without splice() */
+
+	auto r = src.ReadBuffer();
+	assert(!r.empty());
+
+	ssize_t nbytes = dest.Write(r.data, r.size);
+	if (nbytes > 0) {
+		src.Consumed(nbytes);
+		forwarded += nbytes;
+
+		if (size_t(nbytes) == r.size)
+			return BufferedResult::OK;
+
+		/* the destination didn't take everything: wait until
+		   it becomes writable */
+		dest.ScheduleWrite();
+		return BufferedResult::BLOCKING;
+	}
+
+	switch (nbytes) {
+	case WRITE_BLOCKING:
+		return BufferedResult::BLOCKING;
+
+	case WRITE_DESTROYED:
+		return BufferedResult::CLOSED;
+
+	default:
+		throw MakeErrno("Send failed");
+	}
+}
+
+DirectResult
+SocketForwarder::OnBufferedDirect(SocketDescriptor fd, FdType)
+{
+	switch (Drain()) {
+	case DrainResult::EMPTY:
+		break;
+
+	case DrainResult::BLOCKING:
+		/* stop reading from the source until the destination
+		   has taken the pipe's contents */
+		return DirectResult::BLOCKING;
+
+	case DrainResult::ERROR:
+		return DirectResult::CLOSED;
+	}
+
+	ssize_t nbytes = SpliceToPipe(fd.Get(), pipe.w.Get(), MAX_SPLICE);
+	if (nbytes < 0)
+		return errno == EAGAIN
+			? DirectResult::EMPTY
+			: DirectResult::ERRNO;
+
+	if (nbytes == 0) {
+		/* end of file; this invokes OnBufferedClosed() and
+		   OnBufferedEnd() */
+		src.ClosedByPeer();
+		return DirectResult::CLOSED;
+	}
+
+	piped += nbytes;
+
+	switch (Drain()) {
+	case DrainResult::EMPTY:
+		return DirectResult::OK;
+
+	case DrainResult::BLOCKING:
+		return DirectResult::BLOCKING;
+
+	case DrainResult::ERROR:
+		break;
+	}
+
+	return DirectResult::CLOSED;
+}
+
+bool
+SocketForwarder::OnBufferedClosed() noexcept
+{
+	src.Close();
+	return true;
+}
+
+bool
+SocketForwarder::OnBufferedEnd() noexcept
+{
+	src_ended = true;
+
+	if (piped == 0)
+		Finish();
+
+	return true;
+}
+
+bool
+SocketForwarder::OnBufferedWrite()
+{
+	/* not interested in writing to the source */
+	src.UnscheduleWrite();
+	return true;
+}
+
+void
+SocketForwarder::OnBufferedError(std::exception_ptr e) noexcept
+{
+	Fail(e);
+}
+
+/*
+ * destination
+ *
+ */
+
+BufferedResult
+SocketForwarder::DestinationHandler::OnBufferedData()
+{
+	/* leave incoming data in the input buffer for the real
+	   handler */
+	return BufferedResult::BLOCKING;
+}
+
+bool
+SocketForwarder::DestinationHandler::OnBufferedClosed() noexcept
+{
+	parent.Fail(std::make_exception_ptr(SocketClosedPrematurelyError()));
+	return false;
+}
+
+bool
+SocketForwarder::DestinationHandler::OnBufferedWrite()
+{
+	switch (parent.Drain()) {
+	case DrainResult::EMPTY:
+		break;
+
+	case DrainResult::BLOCKING:
+		return true;
+
+	case DrainResult::ERROR:
+		return false;
+	}
+
+	parent.dest.UnscheduleWrite();
+
+	if (parent.src_ended) {
+		parent.Finish();
+		return false;
+	}
+
+	/* resume reading from the source; deferred, because reading
+	   here could destroy this object */
+	parent.src.DeferRead(false);
+	return true;
+}
+
+void
+SocketForwarder::DestinationHandler::OnBufferedError(std::exception_ptr e) noexcept
+{
+	parent.Fail(e);
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "BufferedSocket.hxx"
+#include "io/PipePool.hxx"
+
+#include <exception>
+
+#include <stdint.h>
+
+class SocketForwarderHandler {
+public:
+	/**
+	 * The source socket has ended, and all data has been written
+	 * to the destination.  The source socket has been closed; the
+	 * destination socket is still connected, and its handler
+	 * should be restored with BufferedSocket::Reinit().
+	 */
+	virtual void OnForwardEnd() noexcept = 0;
+
+	/**
+	 * An error on one of the two sockets has occurred.  No further
+	 * methods will be called.
+	 */
+	virtual void OnForwardError(std::exception_ptr e) noexcept = 0;
+};
+
+/**
+ * Moves all data from one #BufferedSocket to another with splice(),
+ * through a pipe borrowed from a #PipePool, without copying it
+ * through user space.  Data which is already in the source's input
+ * buffer is written first.
+ *
+ * While forwarding, this object replaces the handlers of both
+ * sockets.  Reading from the source is suspended while the pipe
+ * cannot be drained into the destination, and resumed when the
+ * destination becomes writable again.
+ */
+class SocketForwarder final : BufferedSocketHandler {
+	BufferedSocket &src, &dest;
+
+	PipePool &pipe_pool;
+	PipePair pipe;
+
+	SocketForwarderHandler &handler;
+
+	/**
+	 * Handles the events of the destination socket.
+	 */
+	class DestinationHandler final : public BufferedSocketHandler {
+		SocketForwarder &parent;
+
+	public:
+		explicit DestinationHandler(SocketForwarder &_parent) noexcept
+			:parent(_parent) {}
+
+		/* virtual methods from class BufferedSocketHandler */
+		BufferedResult OnBufferedData() override;
+		bool OnBufferedClosed() noexcept override;
+		bool OnBufferedWrite() override;
+		void OnBufferedError(std::exception_ptr e) noexcept override;
+	};
+
+	DestinationHandler dest_handler;
+
+	/**
+	 * The number of bytes in the pipe which have not yet been
+	 * written to the destination.
+	 */
+	size_t piped = 0;
+
+	/**
+	 * The total number of bytes written to the destination.
+	 */
+	uint64_t forwarded = 0;
+
+	/**
+	 * Has the source reached end-of-file?
+	 */
+	bool src_ended = false;
+
+public:
+	SocketForwarder(BufferedSocket &_src, BufferedSocket &_dest,
+			PipePool &_pipe_pool,
+			SocketForwarderHandler &_handler) noexcept
+		:src(_src), dest(_dest), pipe_pool(_pipe_pool),
+		 handler(_handler), dest_handler(*this) {}
+
+	~SocketForwarder() noexcept;
+
+	SocketForwarder(const SocketForwarder &) = delete;
+	SocketForwarder &operator=(const SocketForwarder &) = delete;
+
+	uint64_t GetForwarded() const noexcept {
+		return forwarded;
+	}
+
+	/**
+	 * Take over both sockets and start forwarding.  The handler
+	 * may be invoked before this method returns.
+	 *
+	 * Throws std::system_error if no pipe could be created.
+	 */
+	void Start();
+
+private:
+	enum class DrainResult {
+		/**
+		 * The pipe is empty.
+		 */
+		EMPTY,
+
+		/**
+		 * The destination blocks; it has scheduled its "write"
+		 * event.
+		 */
+		BLOCKING,
+
+		/**
+		 * An error has been reported to the handler.
+		 */
+		ERROR,
+	};
+
+	/**
+	 * Move data from the pipe to the destination.
+	 */
+	DrainResult Drain() noexcept;
+
+	void Finish() noexcept;
+	void Fail(std::exception_ptr e) noexcept;
+
+	/* virtual methods from class BufferedSocketHandler */
+	BufferedResult OnBufferedData() override;
+	DirectResult OnBufferedDirect(SocketDescriptor fd,
+				      FdType fd_type) override;
+	bool OnBufferedClosed() noexcept override;
+	bool OnBufferedEnd() noexcept override;
+	bool OnBufferedWrite() override;
+	void OnBufferedError(std::exception_ptr e) noexcept override;
+};
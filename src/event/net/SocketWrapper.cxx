@@ -32,16 +32,508 @@
 
 #include "SocketWrapper.hxx"
 #include "io/Splice.hxx"
+#include "io/uring/Queue.hxx"
+#include "io/uring/Operation.hxx"
 #include "net/Buffered.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "util/ForeignFifoBuffer.hxx"
+
+#include <algorithm>
+#include <memory>
+#include <new>
 
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <sys/socket.h>
 
+/**
+ * The io_uring operations of a #SocketWrapper: one IORING_OP_RECV
+ * which reads ahead into #recv_buffer and one IORING_OP_SEND which
+ * sends #send_buffer in the background.
+ *
+ * It is allocated on the heap, because the kernel may still access
+ * the buffers after the socket has been closed; in that case the
+ * object deletes itself when the last completion arrives (see
+ * Disown()).
+ */
+class SocketWrapper::UringIO final {
+	static constexpr size_t RECV_SIZE = 16384;
+	static constexpr size_t SEND_SIZE = 65536;
+
+	class RecvOperation final : public Uring::Operation {
+		UringIO &io;
+
+	public:
+		explicit RecvOperation(UringIO &_io) noexcept:io(_io) {}
+
+		void OnUringCompletion(int res) noexcept override {
+			io.OnRecv(res);
+		}
+	};
+
+	class SendOperation final : public Uring::Operation {
+		UringIO &io;
+
+	public:
+		explicit SendOperation(UringIO &_io) noexcept:io(_io) {}
+
+		void OnUringCompletion(int res) noexcept override {
+			io.OnSend(res);
+		}
+	};
+
+	SocketWrapper *parent;
+	Uring::Queue &queue;
+
+	SocketDescriptor fd;
+
+	/**
+	 * A duplicate of #fd which keeps the socket open after
+	 * Disown() until all staged data has been sent.
+	 */
+	UniqueSocketDescriptor own_fd;
+
+	RecvOperation recv_operation{*this};
+	SendOperation send_operation{*this};
+
+	const std::unique_ptr<uint8_t[]> recv_buffer, send_buffer;
+
+	/**
+	 * Received data which has not yet been consumed by
+	 * ReadToBuffer().
+	 */
+	size_t recv_start = 0, recv_end = 0;
+
+	/**
+	 * Staged data which has not yet been sent.  While a send is
+	 * in flight, it covers the first #send_in_flight bytes of
+	 * this range.
+	 */
+	size_t send_start = 0, send_end = 0;
+
+	size_t send_in_flight = 0;
+
+	/**
+	 * An errno value which will be reported by the next
+	 * ReadToBuffer() / Write() call.
+	 */
+	int recv_error = 0, send_error = 0;
+
+	bool recv_in_flight = false, recv_eof = false;
+
+	/**
+	 * Is a completion handler currently invoking the
+	 * #SocketWrapper?
+	 */
+	bool in_callback = false;
+
+public:
+	UringIO(SocketWrapper &_parent, Uring::Queue &_queue,
+		SocketDescriptor _fd)
+		:parent(&_parent), queue(_queue), fd(_fd),
+		 recv_buffer(new uint8_t[RECV_SIZE]),
+		 send_buffer(new uint8_t[SEND_SIZE]) {}
+
+	UringIO(const UringIO &) = delete;
+	UringIO &operator=(const UringIO &) = delete;
+
+	/**
+	 * The #SocketWrapper has closed or abandoned the socket.
+	 * Data which has been staged already is still sent.
+	 *
+	 * Entries which have been queued but not yet submitted carry
+	 * the raw descriptor number, which the kernel resolves only
+	 * during submission; therefore the descriptor must not be
+	 * closed (and reused) before that.  If @a close is true,
+	 * this object takes over the socket and closes it after the
+	 * last completion.  Otherwise, the caller keeps the socket
+	 * (see SocketWrapper::Abandon()): pending entries and further
+	 * operations are moved to a duplicate.
+	 *
+	 * @return true if the socket has been taken over, i.e. the
+	 * caller must not close it
+	 */
+	bool Disown(bool close) noexcept {
+		parent = nullptr;
+
+		bool taken = false;
+		if (recv_in_flight || send_in_flight > 0 ||
+		    (send_start < send_end && send_error == 0)) {
+			if (close) {
+				own_fd = UniqueSocketDescriptor(fd);
+				taken = true;
+			} else {
+				own_fd = UniqueSocketDescriptor(fcntl(fd.Get(), F_DUPFD_CLOEXEC, 0));
+				if (own_fd.IsDefined()) {
+					fd = own_fd;
+					UpdatePending([this](struct io_uring_sqe &sqe){
+						sqe.fd = fd.Get();
+					});
+				} else
+					Detach(errno);
+			}
+		}
+
+		if (recv_in_flight) {
+			try {
+				queue.Cancel(recv_operation);
+			} catch (...) {
+				/* the completion will arrive eventually
+				   when the socket gets closed */
+			}
+		}
+
+		CheckDelete();
+		return taken;
+	}
+
+	bool IsReadable() const noexcept {
+		return recv_start < recv_end || recv_eof || recv_error != 0;
+	}
+
+	bool IsWritable() const noexcept {
+		return send_error != 0 || GetSendSpace() > 0;
+	}
+
+	/**
+	 * Is there no staged data?
+	 */
+	bool IsSendIdle() const noexcept {
+		return send_start == send_end && send_error == 0;
+	}
+
+	void StartRecv() noexcept {
+		if (recv_in_flight || IsReadable() || !fd.IsDefined())
+			return;
+
+		try {
+			auto &sqe = queue.Require();
+			sqe.opcode = IORING_OP_RECV;
+			sqe.fd = fd.Get();
+			sqe.addr = (uint64_t)(uintptr_t)recv_buffer.get();
+			sqe.len = RECV_SIZE;
+			queue.Push(sqe, recv_operation);
+			recv_in_flight = true;
+		} catch (...) {
+			recv_error = ENOBUFS;
+		}
+	}
+
+	ssize_t ReadToBuffer(ForeignFifoBuffer<uint8_t> &buffer) noexcept {
+		auto w = buffer.Write();
+		if (w.empty())
+			return -2;
+
+		if (recv_start < recv_end) {
+			const size_t n = std::min(w.size, recv_end - recv_start);
+			memcpy(w.data, recv_buffer.get() + recv_start, n);
+			buffer.Append(n);
+
+			recv_start += n;
+			if (recv_start == recv_end) {
+				/* read ahead */
+				recv_start = recv_end = 0;
+				StartRecv();
+			}
+
+			return n;
+		}
+
+		if (recv_error != 0) {
+			errno = recv_error;
+			return -1;
+		}
+
+		if (recv_eof)
+			return 0;
+
+		StartRecv();
+		errno = EAGAIN;
+		return -1;
+	}
+
+	ssize_t Write(const void *data, size_t length) noexcept {
+		const struct iovec v{const_cast<void *>(data), length};
+		return WriteV(&v, 1);
+	}
+
+	ssize_t WriteV(const struct iovec *v, size_t n) noexcept {
+		if (send_error != 0) {
+			errno = send_error;
+			return -1;
+		}
+
+		Compress();
+
+		size_t nbytes = 0;
+		for (size_t i = 0; i < n && send_end < SEND_SIZE; ++i) {
+			const size_t chunk = std::min(v[i].iov_len, SEND_SIZE - send_end);
+			memcpy(send_buffer.get() + send_end, v[i].iov_base, chunk);
+			send_end += chunk;
+			nbytes += chunk;
+		}
+
+		if (nbytes == 0) {
+			errno = EAGAIN;
+			return -1;
+		}
+
+		StartSend();
+		return nbytes;
+	}
+
+private:
+	size_t GetSendSpace() const noexcept {
+		/* the staged data is moved to the front by Compress()
+		   only while no send is in flight */
+		return send_in_flight == 0
+			? SEND_SIZE - (send_end - send_start)
+			: SEND_SIZE - send_end;
+	}
+
+	/**
+	 * Move the staged data to the beginning of #send_buffer.
+	 */
+	void Compress() noexcept {
+		if (send_in_flight > 0 || send_start == 0)
+			return;
+
+		memmove(send_buffer.get(), send_buffer.get() + send_start,
+			send_end - send_start);
+		send_end -= send_start;
+		send_start = 0;
+	}
+
+	void StartSend() noexcept {
+		if (send_in_flight > 0 || send_start == send_end ||
+		    !fd.IsDefined())
+			return;
+
+		try {
+			auto &sqe = queue.Require();
+			sqe.opcode = IORING_OP_SEND;
+			sqe.fd = fd.Get();
+			sqe.addr = (uint64_t)(uintptr_t)(send_buffer.get() + send_start);
+			sqe.len = send_end - send_start;
+			sqe.msg_flags = MSG_NOSIGNAL;
+			queue.Push(sqe, send_operation);
+			send_in_flight = send_end - send_start;
+		} catch (...) {
+			send_error = ENOBUFS;
+		}
+	}
+
+	template<typename F>
+	void UpdatePending(F &&f) noexcept {
+		queue.UpdatePending(recv_operation, f);
+		queue.UpdatePending(send_operation, f);
+	}
+
+	/**
+	 * Stop using the socket after Disown() has failed to
+	 * duplicate it: the caller keeps the descriptor and may
+	 * close or reuse it at any time.  Entries which have not yet
+	 * been submitted become no-ops (their completions are still
+	 * needed to free this object), a send which has already been
+	 * submitted is canceled, and staged data is discarded.
+	 */
+	void Detach(int error) noexcept {
+		UpdatePending([](struct io_uring_sqe &sqe){
+			const auto user_data = sqe.user_data;
+			memset(&sqe, 0, sizeof(sqe));
+			sqe.opcode = IORING_OP_NOP;
+			sqe.fd = -1;
+			sqe.user_data = user_data;
+		});
+
+		if (send_in_flight > 0) {
+			try {
+				queue.Cancel(send_operation);
+			} catch (...) {
+				/* the send will complete eventually */
+			}
+		}
+
+		fd.SetUndefined();
+
+		/* keep only the range which is in flight, because
+		   OnSend() will consume it */
+		send_error = error;
+		send_end = send_start + send_in_flight;
+	}
+
+	void CheckDelete() noexcept {
+		if (parent == nullptr && !in_callback && !recv_in_flight &&
+		    send_in_flight == 0)
+			/* own_fd is closed by the destructor */
+			delete this;
+	}
+
+	void OnRecv(int res) noexcept {
+		recv_in_flight = false;
+
+		if (parent == nullptr) {
+			CheckDelete();
+			return;
+		}
+
+		if (res > 0) {
+			recv_start = 0;
+			recv_end = res;
+		} else if (res == 0)
+			recv_eof = true;
+		else if (res == -EAGAIN || res == -EINTR) {
+			StartRecv();
+			return;
+		} else
+			recv_error = -res;
+
+		in_callback = true;
+		parent->OnUringReadable();
+		in_callback = false;
+
+		CheckDelete();
+	}
+
+	void OnSend(int res) noexcept {
+		assert(send_in_flight > 0);
+		send_in_flight = 0;
+
+		if (res >= 0) {
+			/* a short send is continued below */
+			send_start += res;
+			if (send_start == send_end)
+				send_start = send_end = 0;
+		} else if (res != -EAGAIN && res != -EINTR) {
+			send_error = -res;
+			send_start = send_end = 0;
+		}
+
+		StartSend();
+
+		if (parent == nullptr) {
+			CheckDelete();
+			return;
+		}
+
+		in_callback = true;
+		parent->OnUringWritable();
+		in_callback = false;
+
+		CheckDelete();
+	}
+};
+
+SocketWrapper::~SocketWrapper() noexcept
+{
+	DisownUring(false);
+}
+
+bool
+SocketWrapper::EnableUring() noexcept
+{
+	assert(!edge_triggered);
+	assert(!IsReadPending());
+	assert(!IsWritePending());
+
+	auto *queue = GetEventLoop().GetUring();
+	if (queue == nullptr)
+		return false;
+
+	if (use_uring)
+		return true;
+
+	if (IsValid()) {
+		try {
+			uring = new UringIO(*this, *queue, fd);
+		} catch (const std::bad_alloc &) {
+			return false;
+		}
+	}
+
+	use_uring = true;
+	coarse_timeouts = true;
+	return true;
+}
+
+bool
+SocketWrapper::DisownUring(bool close) noexcept
+{
+	return uring != nullptr &&
+		std::exchange(uring, nullptr)->Disown(close);
+}
+
+void
+SocketWrapper::StartUringRead() noexcept
+{
+	assert(uring != nullptr);
+
+	uring->StartRecv();
+	if (uring->IsReadable())
+		ready_event.Schedule();
+}
+
+bool
+SocketWrapper::IsReadReady() const noexcept
+{
+	return uring != nullptr
+		? uring->IsReadable()
+		: read_ready;
+}
+
+bool
+SocketWrapper::IsWriteReady() const noexcept
+{
+	return uring != nullptr
+		? !uring_write_blocked && uring->IsWritable()
+		: write_ready;
+}
+
+void
+SocketWrapper::OnUringReadable() noexcept
+{
+	assert(IsValid());
+
+	if (want_read && handler.OnSocketRead() &&
+	    want_read && IsReadReady())
+		/* not consumed completely: emulate level-triggered
+		   behaviour */
+		ready_event.Schedule();
+}
+
+void
+SocketWrapper::OnUringWritable() noexcept
+{
+	assert(IsValid());
+
+	if (uring_write_blocked && uring->IsSendIdle() &&
+	    !write_event.IsPending(SocketEvent::WRITE))
+		/* the staged data which blocked WriteFrom() has been
+		   sent */
+		uring_write_blocked = false;
+
+	if (want_write && IsWriteReady() && handler.OnSocketWrite() &&
+	    want_write && IsWriteReady())
+		ready_event.Schedule();
+}
+
 void
 SocketWrapper::ReadEventCallback(unsigned events) noexcept
 {
 	assert(IsValid());
 
+	if (edge_triggered) {
+		read_ready = true;
+		if (want_read && handler.OnSocketRead() &&
+		    want_read && read_ready)
+			/* not drained yet: emulate level-triggered
+			   behaviour */
+			ready_event.Schedule();
+		return;
+	}
+
 	if (events & SocketEvent::TIMEOUT)
 		handler.OnSocketTimeout();
 	else
@@ -53,12 +545,80 @@ SocketWrapper::WriteEventCallback(unsigned events) noexcept
 {
 	assert(IsValid());
 
+	if (uring != nullptr) {
+		/* registered by WriteFrom() after the socket buffer
+		   was full */
+		write_event.Delete();
+		uring_write_blocked = false;
+		OnUringWritable();
+		return;
+	}
+
+	if (edge_triggered) {
+		write_ready = true;
+		if (want_write && handler.OnSocketWrite() &&
+		    want_write && write_ready)
+			ready_event.Schedule();
+		return;
+	}
+
 	if (events & SocketEvent::TIMEOUT)
 		handler.OnSocketTimeout();
 	else
 		handler.OnSocketWrite();
 }
 
+void
+SocketWrapper::TimeoutCallback() noexcept
+{
+	assert(IsValid());
+
+	handler.OnSocketTimeout();
+}
+
+void
+SocketWrapper::OnDeferredReady() noexcept
+{
+	assert(IsValid());
+	assert(edge_triggered || uring != nullptr);
+
+	if (want_read && IsReadReady() && !handler.OnSocketRead())
+		return;
+
+	if (want_write && IsWriteReady() && !handler.OnSocketWrite())
+		return;
+
+	if ((want_read && IsReadReady()) || (want_write && IsWriteReady()))
+		ready_event.Schedule();
+}
+
+void
+SocketWrapper::SetEvents() noexcept
+{
+	unsigned flags = SocketEvent::PERSIST;
+	if (edge_triggered)
+		flags |= SocketEvent::EDGE;
+
+	read_event.Set(fd.Get(), SocketEvent::READ|flags);
+	write_event.Set(fd.Get(), SocketEvent::WRITE|flags);
+
+	if (edge_triggered) {
+		/* epoll reports the current state right after
+		   registration, so the flags start out false */
+		read_event.Add();
+		write_event.Add();
+	}
+}
+
+void
+SocketWrapper::ResetEdgeState() noexcept
+{
+	want_read = want_write = false;
+	read_ready = write_ready = false;
+	uring_write_blocked = false;
+	ready_event.Cancel();
+}
+
 void
 SocketWrapper::Init(SocketDescriptor _fd, FdType _fd_type) noexcept
 {
@@ -67,8 +627,46 @@ SocketWrapper::Init(SocketDescriptor _fd, FdType _fd_type) noexcept
 	fd = _fd;
 	fd_type = _fd_type;
 
-	read_event.Set(fd.Get(), SocketEvent::READ|SocketEvent::PERSIST);
-	write_event.Set(fd.Get(), SocketEvent::WRITE|SocketEvent::PERSIST);
+	ResetEdgeState();
+	SetEvents();
+
+	if (use_uring) {
+		/* the #EventLoop's io_uring cannot go away, it was
+		   checked by EnableUring() */
+		try {
+			uring = new UringIO(*this, *GetEventLoop().GetUring(), fd);
+		} catch (const std::bad_alloc &) {
+			/* fall back to readiness mode for this
+			   socket; all code paths check "uring",
+			   and the events have been registered by
+			   SetEvents() already */
+		}
+	}
+}
+
+void
+SocketWrapper::SetEdgeTriggered(bool value) noexcept
+{
+	assert(!use_uring);
+	assert(!IsReadPending());
+	assert(!IsWritePending());
+
+	if (value == edge_triggered)
+		return;
+
+	if (IsValid()) {
+		read_event.Delete();
+		write_event.Delete();
+	}
+
+	edge_triggered = value;
+	if (value)
+		coarse_timeouts = true;
+
+	ResetEdgeState();
+
+	if (IsValid())
+		SetEvents();
 }
 
 void
@@ -88,8 +686,16 @@ SocketWrapper::Close() noexcept
 
 	read_event.Delete();
 	write_event.Delete();
+	read_timeout_event.Cancel();
+	write_timeout_event.Cancel();
+	ResetEdgeState();
 
-	fd.Close();
+	if (DisownUring(true))
+		/* the #UringIO closes the socket after its pending
+		   operations have completed */
+		fd = SocketDescriptor::Undefined();
+	else
+		fd.Close();
 }
 
 void
@@ -99,6 +705,10 @@ SocketWrapper::Abandon() noexcept
 
 	read_event.Delete();
 	write_event.Delete();
+	read_timeout_event.Cancel();
+	write_timeout_event.Cancel();
+	ResetEdgeState();
+	DisownUring(false);
 
 	fd = SocketDescriptor::Undefined();
 }
@@ -118,7 +728,13 @@ SocketWrapper::ReadToBuffer(ForeignFifoBuffer<uint8_t> &buffer) noexcept
 {
 	assert(IsValid());
 
-	return ReceiveToBuffer(fd.Get(), buffer);
+	if (uring != nullptr)
+		return uring->ReadToBuffer(buffer);
+
+	ssize_t nbytes = ReceiveToBuffer(fd.Get(), buffer);
+	if (nbytes < 0 && errno == EAGAIN)
+		read_ready = false;
+	return nbytes;
 }
 
 bool
@@ -126,15 +742,34 @@ SocketWrapper::IsReadyForWriting() const noexcept
 {
 	assert(IsValid());
 
+	if (uring != nullptr)
+		return uring->IsWritable();
+
 	return fd.IsReadyForWriting();
 }
 
+inline void
+SocketWrapper::UpdateWriteReady(ssize_t nbytes, size_t length) noexcept
+{
+	/* a short write means the socket buffer is full; the kernel
+	   will report the next edge when there is room again */
+	if ((nbytes < 0 && errno == EAGAIN) ||
+	    (nbytes >= 0 && size_t(nbytes) < length))
+		write_ready = false;
+}
+
 ssize_t
 SocketWrapper::Write(const void *data, size_t length) noexcept
 {
 	assert(IsValid());
 
-	return send(fd.Get(), data, length, MSG_DONTWAIT|MSG_NOSIGNAL);
+	if (uring != nullptr)
+		return uring->Write(data, length);
+
+	ssize_t nbytes = send(fd.Get(), data, length, MSG_DONTWAIT|MSG_NOSIGNAL);
+	if (edge_triggered)
+		UpdateWriteReady(nbytes, length);
+	return nbytes;
 }
 
 ssize_t
@@ -142,6 +777,9 @@ SocketWrapper::WriteV(const struct iovec *v, size_t n) noexcept
 {
 	assert(IsValid());
 
+	if (uring != nullptr)
+		return uring->WriteV(v, n);
+
 	struct msghdr m = {
 		.msg_name = nullptr,
 		.msg_namelen = 0,
@@ -152,12 +790,46 @@ SocketWrapper::WriteV(const struct iovec *v, size_t n) noexcept
 		.msg_flags = 0,
 	};
 
-	return sendmsg(fd.Get(), &m, MSG_DONTWAIT|MSG_NOSIGNAL);
+	ssize_t nbytes = sendmsg(fd.Get(), &m, MSG_DONTWAIT|MSG_NOSIGNAL);
+	if (edge_triggered) {
+		size_t length = 0;
+		for (size_t i = 0; i < n; ++i)
+			length += v[i].iov_len;
+		UpdateWriteReady(nbytes, length);
+	}
+
+	return nbytes;
 }
 
 ssize_t
 SocketWrapper::WriteFrom(int other_fd, FdType other_fd_type,
 			 size_t length) noexcept
 {
-	return SpliceToSocket(other_fd_type, other_fd, fd.Get(), length);
+	if (uring != nullptr && !uring->IsSendIdle()) {
+		/* the staged data must be sent first;
+		   OnUringWritable() will be invoked after that */
+		uring_write_blocked = true;
+		errno = EAGAIN;
+		return -1;
+	}
+
+	ssize_t nbytes = SpliceToSocket(other_fd_type, other_fd, fd.Get(), length);
+	if (nbytes < 0 && errno == EAGAIN &&
+	    (edge_triggered || uring != nullptr) &&
+	    !fd.IsReadyForWriting()) {
+		/* EAGAIN may also come from an empty source pipe;
+		   only the socket's state matters here */
+		if (uring != nullptr) {
+			/* io_uring does not report when the socket
+			   becomes writable again; wait for it with
+			   #write_event */
+			uring_write_blocked = true;
+			write_event.Add();
+		} else
+			write_ready = false;
+
+		errno = EAGAIN;
+	}
+
+	return nbytes;
 }
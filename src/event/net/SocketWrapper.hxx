@@ -34,6 +34,9 @@
 
 #include "io/FdType.hxx"
 #include "event/SocketEvent.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "event/DeferEvent.hxx"
+#include "event/Duration.hxx"
 #include "net/SocketDescriptor.hxx"
 #include "util/Compiler.h"
 
@@ -72,16 +75,80 @@ class SocketWrapper {
 
 	SocketEvent read_event, write_event;
 
+	/**
+	 * Timers for the read/write timeouts; only used if
+	 * #coarse_timeouts is enabled.
+	 */
+	CoarseTimerEvent read_timeout_event, write_timeout_event;
+
+	/**
+	 * Invokes the handler for a socket which is known to be
+	 * ready; only used in edge-triggered mode.
+	 */
+	DeferEvent ready_event;
+
 	SocketHandler &handler;
 
+	/**
+	 * Manage timeouts with #CoarseTimerEvent instead of libevent
+	 * timers?
+	 */
+	bool coarse_timeouts = false;
+
+	/**
+	 * Keep both events registered with #SocketEvent::EDGE and
+	 * track readiness in the following flags?
+	 */
+	bool edge_triggered = false;
+
+	/**
+	 * Submit reads and writes to the #EventLoop's io_uring?  See
+	 * EnableUring().
+	 */
+	bool use_uring = false;
+
+	/**
+	 * Edge-triggered and io_uring mode: does the handler want to
+	 * be notified?
+	 */
+	bool want_read = false, want_write = false;
+
+	/**
+	 * Edge-triggered mode: has the socket become ready, and no
+	 * EAGAIN has been observed since?
+	 */
+	bool read_ready = false, write_ready = false;
+
+	/**
+	 * The io_uring operations of the current socket; only set in
+	 * io_uring mode (see EnableUring()) while the socket is
+	 * valid.
+	 */
+	class UringIO;
+	UringIO *uring = nullptr;
+
+	/**
+	 * io_uring mode: WriteFrom() has failed with EAGAIN, either
+	 * because staged data must be sent first, or because the
+	 * socket buffer is full (#write_event is then registered).
+	 * IsWriteReady() returns false until that is resolved, or
+	 * else the handler would be invoked again right away.
+	 */
+	bool uring_write_blocked = false;
+
 public:
 	SocketWrapper(EventLoop &event_loop, SocketHandler &_handler) noexcept
 		:read_event(event_loop, BIND_THIS_METHOD(ReadEventCallback)),
 		 write_event(event_loop, BIND_THIS_METHOD(WriteEventCallback)),
+		 read_timeout_event(event_loop, BIND_THIS_METHOD(TimeoutCallback)),
+		 write_timeout_event(event_loop, BIND_THIS_METHOD(TimeoutCallback)),
+		 ready_event(event_loop, BIND_THIS_METHOD(OnDeferredReady)),
 		 handler(_handler) {}
 
 	SocketWrapper(const SocketWrapper &) = delete;
 
+	~SocketWrapper() noexcept;
+
 	EventLoop &GetEventLoop() noexcept {
 		return read_event.GetEventLoop();
 	}
@@ -122,9 +189,124 @@ public:
 		return fd_type;
 	}
 
+	/**
+	 * Use the #EventLoop's timer wheel (#CoarseTimerEvent) for
+	 * read/write timeouts instead of libevent timers.  This makes
+	 * refreshing a timeout O(1) without any libevent call, which is
+	 * useful for connections which refresh their timeout on every
+	 * read.  The socket events are then registered without
+	 * timeout and stay registered while a timeout is refreshed.
+	 *
+	 * This must not be called while events are scheduled.
+	 */
+	void SetCoarseTimeouts(bool value) noexcept {
+		assert(!edge_triggered);
+		assert(!use_uring);
+		assert(!read_event.IsPending(SocketEvent::READ));
+		assert(!write_event.IsPending(SocketEvent::WRITE));
+
+		coarse_timeouts = value;
+	}
+
+	/**
+	 * Register the socket edge-triggered for its whole lifetime
+	 * and track readiness in user space, instead of adding and
+	 * deleting the events (one epoll_ctl() each) on every
+	 * ScheduleRead()/UnscheduleRead() call.  This implies
+	 * SetCoarseTimeouts(true).
+	 *
+	 * The handler must then consume until EAGAIN (or call
+	 * ClearReadReady()/ClearWriteReady() if it does I/O on the
+	 * socket by itself), because no new notification arrives
+	 * while the socket stays ready.
+	 *
+	 * The setting survives Close() and applies to the next
+	 * Init().  It must not be changed while events are
+	 * scheduled.
+	 */
+	void SetEdgeTriggered(bool value) noexcept;
+
+	bool IsEdgeTriggered() const noexcept {
+		return edge_triggered;
+	}
+
+	/**
+	 * Submit reads and writes as io_uring operations
+	 * (IORING_OP_RECV, IORING_OP_SEND) instead of waiting for
+	 * readiness and doing one system call each; the #EventLoop
+	 * submits the entries of all sockets in one batch per
+	 * iteration.  ReadToBuffer() copies from a buffer which was
+	 * filled by the kernel in advance, and Write()/WriteV() copy
+	 * to a buffer which is sent in the background; the handler
+	 * interface remains the same.  This implies
+	 * SetCoarseTimeouts(true) and is not compatible with
+	 * SetEdgeTriggered().
+	 *
+	 * Since data is read ahead, the caller must not read from
+	 * the socket by itself (e.g. with splice()).  Data which has
+	 * not been sent yet by Close() or Abandon() is still
+	 * delivered in the background.
+	 *
+	 * The setting survives Close() and applies to the next
+	 * Init().  It must not be changed while events are
+	 * scheduled.
+	 *
+	 * If memory for the io_uring buffers cannot be allocated by
+	 * a later Init(), that socket falls back to readiness mode.
+	 *
+	 * @return false if the #EventLoop does not have io_uring
+	 * (see EventLoop::EnableUring()) or if memory allocation
+	 * failed; the socket then remains in readiness mode
+	 */
+	bool EnableUring() noexcept;
+
+	bool IsUring() const noexcept {
+		return use_uring;
+	}
+
+	/**
+	 * Edge-triggered mode: the caller has received EAGAIN on the
+	 * socket by itself (e.g. with splice()).
+	 */
+	void ClearReadReady() noexcept {
+		read_ready = false;
+	}
+
+	/**
+	 * Edge-triggered mode: the caller has received EAGAIN (or a
+	 * short write) on the socket by itself.
+	 */
+	void ClearWriteReady() noexcept {
+		write_ready = false;
+	}
+
 	void ScheduleRead(const struct timeval *timeout) noexcept {
 		assert(IsValid());
 
+		if (uring != nullptr) {
+			want_read = true;
+			StartUringRead();
+		} else if (edge_triggered) {
+			want_read = true;
+			if (read_ready)
+				ready_event.Schedule();
+		}
+
+		if (coarse_timeouts) {
+			/* in edge-triggered mode, the event is
+			   registered permanently; in io_uring mode,
+			   it is not used at all */
+			if (!edge_triggered && uring == nullptr &&
+			    !read_event.IsPending(SocketEvent::READ))
+				read_event.Add();
+
+			if (timeout != nullptr)
+				read_timeout_event.Schedule(ToChrono(*timeout));
+			else
+				read_timeout_event.Cancel();
+			return;
+		}
+
 		if (timeout == nullptr && read_event.IsTimerPending())
 			/* work around libevent bug: event_add() should disable the
 			   timeout if tv==nullptr, but in fact it does not; workaround:
@@ -135,12 +317,41 @@ public:
 	}
 
 	void UnscheduleRead() noexcept {
-		read_event.Delete();
+		if (edge_triggered || uring != nullptr)
+			want_read = false;
+		else
+			read_event.Delete();
+		read_timeout_event.Cancel();
 	}
 
 	void ScheduleWrite(const struct timeval *timeout) noexcept {
 		assert(IsValid());
 
+		if (uring != nullptr) {
+			want_write = true;
+			if (IsWriteReady())
+				ready_event.Schedule();
+		} else if (edge_triggered) {
+			want_write = true;
+			if (write_ready)
+				ready_event.Schedule();
+		}
+
+		if (coarse_timeouts) {
+			/* in edge-triggered mode, the event is
+			   registered permanently; in io_uring mode,
+			   it is not used at all */
+			if (!edge_triggered && uring == nullptr &&
+			    !write_event.IsPending(SocketEvent::WRITE))
+				write_event.Add();
+
+			if (timeout != nullptr)
+				write_timeout_event.Schedule(ToChrono(*timeout));
+			else
+				write_timeout_event.Cancel();
+			return;
+		}
+
 		if (timeout == nullptr && write_event.IsTimerPending())
 			/* work around libevent bug: event_add() should disable the
 			   timeout if tv==nullptr, but in fact it does not; workaround:
@@ -151,17 +362,25 @@ public:
 	}
 
 	void UnscheduleWrite() noexcept {
-		write_event.Delete();
+		if (edge_triggered || uring != nullptr)
+			want_write = false;
+		else
+			write_event.Delete();
+		write_timeout_event.Cancel();
 	}
 
 	gcc_pure
 	bool IsReadPending() const noexcept {
-		return read_event.IsPending(SocketEvent::READ);
+		return edge_triggered || uring != nullptr
+			? want_read
+			: read_event.IsPending(SocketEvent::READ);
 	}
 
 	gcc_pure
 	bool IsWritePending() const noexcept {
-		return write_event.IsPending(SocketEvent::WRITE);
+		return edge_triggered || uring != nullptr
+			? want_write
+			: write_event.IsPending(SocketEvent::WRITE);
 	}
 
 	ssize_t ReadToBuffer(ForeignFifoBuffer<uint8_t> &buffer) noexcept;
@@ -173,10 +392,47 @@ public:
 
 	ssize_t WriteV(const struct iovec *v, size_t n) noexcept;
 
+	/**
+	 * Transfer data from a file (sendfile()) or a pipe (splice())
+	 * to the socket.  This works on kernel TLS sockets as well
+	 * (see ssl/Ktls.hxx); the kernel encrypts the data.
+	 */
 	ssize_t WriteFrom(int other_fd, FdType other_fd_type,
 			  size_t length) noexcept;
 
 private:
+	void SetEvents() noexcept;
+	void ResetEdgeState() noexcept;
+	void UpdateWriteReady(ssize_t nbytes, size_t length) noexcept;
+
+	/**
+	 * Release the #UringIO (if any); it lives on until its
+	 * pending operations have completed.
+	 *
+	 * @param close true if the socket is about to be closed; the
+	 * #UringIO may then take it over
+	 * @return true if the #UringIO has taken over the socket
+	 */
+	bool DisownUring(bool close) noexcept;
+
+	void StartUringRead() noexcept;
+
+	/**
+	 * Edge-triggered and io_uring mode: can the handler read
+	 * without blocking?
+	 */
+	gcc_pure
+	bool IsReadReady() const noexcept;
+
+	gcc_pure
+	bool IsWriteReady() const noexcept;
+
+	/* called by #UringIO after a completion */
+	void OnUringReadable() noexcept;
+	void OnUringWritable() noexcept;
+
 	void ReadEventCallback(unsigned events) noexcept;
 	void WriteEventCallback(unsigned events) noexcept;
+	void TimeoutCallback() noexcept;
+	void OnDeferredReady() noexcept;
 };
@@ -34,6 +34,7 @@
 #include "UdpHandler.hxx"
 #include "net/SocketAddress.hxx"
 #include "net/ReceiveMessage.hxx"
+#include "net/MultiReceiveMessage.hxx"
 #include "system/Error.hxx"
 
 #include <assert.h>
@@ -59,9 +60,27 @@ UdpListener::~UdpListener() noexcept
 	event.Delete();
 }
 
+void
+UdpListener::SetBatch(MultiReceiveMessage &&_multi)
+{
+	multi.reset(new MultiReceiveMessage(std::move(_multi)));
+}
+
 bool
 UdpListener::ReceiveAll()
 try {
+	if (multi) {
+		while (true) {
+			bool empty;
+			if (!ReceiveBatch(empty))
+				return false;
+
+			if (empty)
+				/* no more pending datagrams */
+				return true;
+		}
+	}
+
 	while (true) {
 		try {
 			if (!ReceiveOne())
@@ -95,10 +114,36 @@ UdpListener::ReceiveOne()
 				     uid);
 }
 
+bool
+UdpListener::ReceiveBatch(bool &empty_r)
+{
+	if (!multi->Receive(fd)) {
+		empty_r = true;
+		return handler.OnUdpDatagram(nullptr, 0, nullptr, -1);
+	}
+
+	empty_r = multi->empty();
+
+	for (auto &d : *multi)
+		if (!handler.OnUdpDatagram(d.payload.data, d.payload.size,
+					   d.address,
+					   d.cred != nullptr
+					   ? d.cred->uid
+					   : -1))
+			return false;
+
+	multi->Clear();
+	return true;
+}
+
 void
 UdpListener::EventCallback(unsigned) noexcept
 try {
-	ReceiveOne();
+	if (multi) {
+		bool empty;
+		ReceiveBatch(empty);
+	} else
+		ReceiveOne();
 } catch (...) {
 	/* unregister the SocketEvent, just in case the handler does
 	   not destroy us */
@@ -35,10 +35,13 @@
 #include "event/SocketEvent.hxx"
 #include "net/UniqueSocketDescriptor.hxx"
 
+#include <memory>
+
 #include <stddef.h>
 
 class SocketAddress;
 class UdpHandler;
+class MultiReceiveMessage;
 
 /**
  * Listener on a UDP port.
@@ -47,6 +50,12 @@ class UdpListener {
 	UniqueSocketDescriptor fd;
 	SocketEvent event;
 
+	/**
+	 * If set, datagrams are received in batches with recvmmsg();
+	 * see SetBatch().
+	 */
+	std::unique_ptr<MultiReceiveMessage> multi;
+
 	UdpHandler &handler;
 
 public:
@@ -69,6 +78,12 @@ public:
 		event.Delete();
 	}
 
+	/**
+	 * Switch to batched mode: receive many datagrams with one
+	 * recvmmsg() call (like #MultiUdpListener).
+	 */
+	void SetBatch(MultiReceiveMessage &&_multi);
+
 	/**
 	 * Obtains the underlying socket, which can be used to send
 	 * replies.
@@ -104,5 +119,16 @@ private:
 	 */
 	bool ReceiveOne();
 
+	/**
+	 * Receive one batch of datagrams with recvmmsg() and pass
+	 * them to the handler.  Throws exception on error.
+	 *
+	 * @param empty_r set to true if there were no pending
+	 * datagrams
+	 * @return false if one UdpHandler::OnUdpDatagram() invocation
+	 * has returned false
+	 */
+	bool ReceiveBatch(bool &empty_r);
+
 	void EventCallback(unsigned events) noexcept;
 };
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "AddressList.hxx"
+
+#include <ares.h>
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace Cares {
+
+bool
+AddressList::HasFamily(int family) const noexcept
+{
+	return std::any_of(slots.begin(), slots.end(), [family](const Slot &s){
+			return s.sa.sa_family == family;
+		});
+}
+
+bool
+AddressList::Add(SocketAddress address) noexcept
+{
+	Slot slot;
+
+	switch (address.GetFamily()) {
+	case AF_INET:
+		if (address.GetSize() < sizeof(slot.in))
+			return false;
+
+		memcpy(&slot.in, address.GetAddress(), sizeof(slot.in));
+		break;
+
+	case AF_INET6:
+		if (address.GetSize() < sizeof(slot.in6))
+			return false;
+
+		memcpy(&slot.in6, address.GetAddress(), sizeof(slot.in6));
+		break;
+
+	default:
+		return false;
+	}
+
+	slots.push_back(slot);
+	return true;
+}
+
+AddressList
+ToAddressList(const struct ares_addrinfo &ai) noexcept
+{
+	AddressList list;
+
+	bool have_ttl = false;
+	std::chrono::seconds ttl = std::chrono::seconds::zero();
+
+	for (const auto *i = ai.nodes; i != nullptr; i = i->ai_next) {
+		if (i->ai_addr == nullptr ||
+		    !list.Add(SocketAddress(i->ai_addr, i->ai_addrlen)))
+			continue;
+
+		const std::chrono::seconds node_ttl(std::max(i->ai_ttl, 0));
+		if (!have_ttl || node_ttl < ttl)
+			ttl = node_ttl;
+		have_ttl = true;
+	}
+
+	list.SetTtl(ttl);
+	return list;
+}
+
+} // namespace Cares
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "net/SocketAddress.hxx"
+#include "util/Compiler.h"
+
+#include <chrono>
+#include <exception>
+#include <iterator>
+#include <vector>
+
+#include <netinet/in.h>
+
+struct ares_addrinfo;
+
+namespace Cares {
+
+/**
+ * A compact list of IPv4 and IPv6 addresses returned by the
+ * resolver.  Each address occupies a fixed-size slot (no per-address
+ * allocation), and the list carries the smallest TTL of all its
+ * addresses.
+ */
+class AddressList {
+	union Slot {
+		struct sockaddr sa;
+		struct sockaddr_in in;
+		struct sockaddr_in6 in6;
+
+		gcc_pure
+		SocketAddress ToSocketAddress() const noexcept {
+			return SocketAddress(&sa, sa.sa_family == AF_INET6
+					     ? sizeof(in6)
+					     : sizeof(in));
+		}
+	};
+
+	std::vector<Slot> slots;
+
+	std::chrono::seconds ttl = std::chrono::seconds::zero();
+
+public:
+	class const_iterator {
+		std::vector<Slot>::const_iterator i;
+
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef SocketAddress value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const SocketAddress *pointer;
+		typedef SocketAddress reference;
+
+		explicit const_iterator(std::vector<Slot>::const_iterator _i) noexcept
+			:i(_i) {}
+
+		const_iterator &operator++() noexcept {
+			++i;
+			return *this;
+		}
+
+		SocketAddress operator*() const noexcept {
+			return i->ToSocketAddress();
+		}
+
+		bool operator==(const const_iterator &other) const noexcept {
+			return i == other.i;
+		}
+
+		bool operator!=(const const_iterator &other) const noexcept {
+			return i != other.i;
+		}
+	};
+
+	bool empty() const noexcept {
+		return slots.empty();
+	}
+
+	std::size_t size() const noexcept {
+		return slots.size();
+	}
+
+	const_iterator begin() const noexcept {
+		return const_iterator(slots.begin());
+	}
+
+	const_iterator end() const noexcept {
+		return const_iterator(slots.end());
+	}
+
+	SocketAddress operator[](std::size_t i) const noexcept {
+		return slots[i].ToSocketAddress();
+	}
+
+	SocketAddress front() const noexcept {
+		return slots.front().ToSocketAddress();
+	}
+
+	std::chrono::seconds GetTtl() const noexcept {
+		return ttl;
+	}
+
+	void SetTtl(std::chrono::seconds _ttl) noexcept {
+		ttl = _ttl;
+	}
+
+	gcc_pure
+	bool HasFamily(int family) const noexcept;
+
+	void reserve(std::size_t n) {
+		slots.reserve(n);
+	}
+
+	void clear() noexcept {
+		slots.clear();
+		ttl = std::chrono::seconds::zero();
+	}
+
+	/**
+	 * Append an address.  Addresses of families other than
+	 * AF_INET and AF_INET6 are ignored.
+	 *
+	 * @return true if the address was added
+	 */
+	bool Add(SocketAddress address) noexcept;
+};
+
+/**
+ * The result of one name in Channel::LookupBatch(): either a
+ * non-empty #AddressList or an error.
+ */
+struct BatchResult {
+	AddressList addresses;
+	std::exception_ptr error;
+};
+
+/**
+ * Convert an ares_getaddrinfo() result to an #AddressList; its TTL
+ * is the smallest TTL of all nodes.
+ */
+AddressList
+ToAddressList(const struct ares_addrinfo &ai) noexcept;
+
+} // namespace Cares
@@ -0,0 +1,440 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Cache.hxx"
+#include "Channel.hxx"
+#include "Handler.hxx"
+#include "AddressList.hxx"
+#include "Error.hxx"
+#include "event/Loop.hxx"
+#include "util/Cancellable.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+#include <algorithm>
+
+#include <ares.h>
+
+#include <assert.h>
+
+namespace Cares {
+
+/**
+ * A lookup waiting for an #Entry's query to complete.
+ */
+class Cache::Request final
+	: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>,
+	  Cancellable {
+
+	/**
+	 * Exactly one of these is set.
+	 */
+	Handler *const handler;
+	AddressListHandler *const list_handler;
+
+public:
+	Request(Handler &_handler, CancellablePointer &cancel_ptr) noexcept
+		:handler(&_handler), list_handler(nullptr) {
+		cancel_ptr = *this;
+	}
+
+	Request(AddressListHandler &_handler,
+		CancellablePointer &cancel_ptr) noexcept
+		:handler(nullptr), list_handler(&_handler) {
+		cancel_ptr = *this;
+	}
+
+	void Success(const AddressList &addresses) noexcept {
+		auto *_handler = handler;
+		auto *_list_handler = list_handler;
+		delete this;
+
+		if (_handler != nullptr)
+			_handler->OnCaresSuccess(addresses.front());
+		else
+			_list_handler->OnCaresAddressList(addresses);
+	}
+
+	void Error(std::exception_ptr e) noexcept {
+		auto *_handler = handler;
+		auto *_list_handler = list_handler;
+		delete this;
+
+		if (_handler != nullptr)
+			_handler->OnCaresError(e);
+		else
+			_list_handler->OnCaresError(e);
+	}
+
+private:
+	/* virtual methods from Cancellable */
+	void Cancel() noexcept override {
+		delete this;
+	}
+};
+
+class Cache::Entry final : AddrInfoHandler {
+	Cache &cache;
+
+	/**
+	 * The host name; points to the key of #Cache::entries.
+	 */
+	const char *const name;
+
+	/**
+	 * All addresses of the last successful lookup.  Empty if
+	 * the last lookup failed (see #error) or if there was none
+	 * yet.
+	 */
+	AddressList addresses;
+
+	/**
+	 * The cached "not found" error.
+	 */
+	std::exception_ptr error;
+
+	/**
+	 * Until when may this entry be used without a refresh?
+	 */
+	std::chrono::steady_clock::time_point expires;
+
+	/**
+	 * Until when may this entry be used while a refresh is in
+	 * progress?
+	 */
+	std::chrono::steady_clock::time_point stale_until;
+
+	typedef boost::intrusive::list<Request,
+				       boost::intrusive::constant_time_size<false>> RequestList;
+
+	/**
+	 * Lookups waiting for the completion of #query.
+	 */
+	RequestList waiters;
+
+	/**
+	 * The pending query; undefined if there is none.
+	 */
+	CancellablePointer query;
+
+public:
+	Entry(Cache &_cache, const char *_name) noexcept
+		:cache(_cache), name(_name) {}
+
+	~Entry() noexcept {
+		assert(waiters.empty());
+
+		if (query)
+			query.Cancel();
+	}
+
+	bool IsQuerying() const noexcept {
+		return query;
+	}
+
+	bool IsIdle() const noexcept {
+		return !query && waiters.empty();
+	}
+
+	bool IsFresh(std::chrono::steady_clock::time_point now) const noexcept {
+		return now < expires;
+	}
+
+	/**
+	 * May this entry be served while it is being refreshed?
+	 * Only positive entries can be stale.
+	 */
+	bool IsUsable(std::chrono::steady_clock::time_point now) const noexcept {
+		return !addresses.empty() && now < stale_until;
+	}
+
+	bool IsObsolete(std::chrono::steady_clock::time_point now) const noexcept {
+		return now >= stale_until && IsIdle();
+	}
+
+	/**
+	 * Deliver the cached result.
+	 */
+	template<typename H>
+	void Deliver(H &handler) const noexcept {
+		if (!addresses.empty())
+			Deliver(handler, addresses);
+		else
+			handler.OnCaresError(error);
+	}
+
+	bool IsNegative() const noexcept {
+		return addresses.empty();
+	}
+
+	template<typename H>
+	void AddWaiter(H &handler, CancellablePointer &cancel_ptr) noexcept {
+		waiters.push_back(*new Request(handler, cancel_ptr));
+	}
+
+	void StartQuery() noexcept {
+		assert(!query);
+
+		++cache.stats.queries;
+		cache.channel.LookupAddrInfo(name, AF_UNSPEC,
+					     *this, query);
+	}
+
+private:
+	static void Deliver(Handler &handler,
+			    const AddressList &list) noexcept {
+		handler.OnCaresSuccess(list.front());
+	}
+
+	static void Deliver(AddressListHandler &handler,
+			    const AddressList &list) noexcept {
+		handler.OnCaresAddressList(list);
+	}
+
+	/* virtual methods from AddrInfoHandler */
+	void OnCaresAddrInfo(const struct ares_addrinfo &result) noexcept override;
+	void OnCaresError(std::exception_ptr e) noexcept override;
+};
+
+static bool
+IsNegativeCacheable(std::exception_ptr e) noexcept
+{
+	try {
+		std::rethrow_exception(e);
+	} catch (const Error &error) {
+		switch (error.GetCode()) {
+		case ARES_ENODATA:
+		case ARES_ENOTFOUND:
+		case ARES_ENONAME:
+			return true;
+
+		default:
+			return false;
+		}
+	} catch (...) {
+		return false;
+	}
+}
+
+void
+Cache::Entry::OnCaresAddrInfo(const struct ares_addrinfo &result) noexcept
+{
+	query = nullptr;
+
+	const auto &config = cache.config;
+
+	auto new_addresses = ToAddressList(result);
+	if (new_addresses.empty()) {
+		OnCaresError(std::make_exception_ptr(Error(ARES_ENODATA,
+							   "ares_getaddrinfo() failed")));
+		return;
+	}
+
+	addresses = std::move(new_addresses);
+
+	const auto ttl = std::max(std::min(addresses.GetTtl(),
+					   config.max_ttl),
+				  config.min_ttl);
+
+	error = nullptr;
+	expires = cache.channel.GetEventLoop().SteadyNow() + ttl;
+	stale_until = expires + config.stale_ttl;
+
+	while (!waiters.empty()) {
+		auto &request = waiters.front();
+		waiters.pop_front();
+		request.Success(addresses);
+	}
+}
+
+void
+Cache::Entry::OnCaresError(std::exception_ptr e) noexcept
+{
+	query = nullptr;
+
+	const auto now = cache.channel.GetEventLoop().SteadyNow();
+
+	if (IsNegativeCacheable(e)) {
+		addresses.clear();
+		error = e;
+		expires = stale_until = now + cache.config.negative_ttl;
+	} else if (!IsUsable(now)) {
+		/* a transient error and nothing to fall back to:
+		   don't cache it, and unlink this entry before
+		   invoking the handlers, which may start a new
+		   lookup of the same name */
+		const auto self = cache.Detach(name);
+
+		while (!waiters.empty()) {
+			auto &request = waiters.front();
+			waiters.pop_front();
+			request.Error(e);
+		}
+
+		return;
+	} else {
+		/* a transient error while refreshing: keep serving
+		   the stale addresses until #stale_until; there can't
+		   be any waiters */
+		assert(waiters.empty());
+		return;
+	}
+
+	while (!waiters.empty()) {
+		auto &request = waiters.front();
+		waiters.pop_front();
+		request.Error(e);
+	}
+}
+
+Cache::Cache(Channel &_channel, const Config &_config) noexcept
+	:channel(_channel), config(_config),
+	 cleanup_timer(channel.GetEventLoop(), 60,
+		       BIND_THIS_METHOD(OnCleanupTimer)) {}
+
+Cache::~Cache() noexcept = default;
+
+template<typename H>
+inline void
+Cache::DoLookup(const char *name, H &handler,
+		CancellablePointer &cancel_ptr) noexcept
+{
+	const auto now = channel.GetEventLoop().SteadyNow();
+
+	auto i = entries.find(name);
+	if (i == entries.end()) {
+		++stats.misses;
+
+		i = entries.emplace(name, nullptr).first;
+		i->second.reset(new Entry(*this, i->first.c_str()));
+		cleanup_timer.Enable();
+
+		auto &entry = *i->second;
+		entry.AddWaiter(handler, cancel_ptr);
+		entry.StartQuery();
+		return;
+	}
+
+	auto &entry = *i->second;
+
+	if (entry.IsFresh(now)) {
+		if (entry.IsNegative())
+			++stats.negative_hits;
+		else
+			++stats.hits;
+
+		entry.Deliver(handler);
+		return;
+	}
+
+	if (entry.IsUsable(now)) {
+		/* stale-while-revalidate */
+		++stats.stale_hits;
+
+		if (!entry.IsQuerying())
+			entry.StartQuery();
+
+		entry.Deliver(handler);
+		return;
+	}
+
+	if (entry.IsQuerying())
+		++stats.coalesced;
+	else
+		++stats.misses;
+
+	entry.AddWaiter(handler, cancel_ptr);
+
+	if (!entry.IsQuerying())
+		entry.StartQuery();
+}
+
+void
+Cache::Lookup(const char *name, Handler &handler,
+	      CancellablePointer &cancel_ptr) noexcept
+{
+	DoLookup(name, handler, cancel_ptr);
+}
+
+void
+Cache::LookupAll(const char *name, AddressListHandler &handler,
+		 CancellablePointer &cancel_ptr) noexcept
+{
+	DoLookup(name, handler, cancel_ptr);
+}
+
+void
+Cache::Remove(EntryMap::iterator i) noexcept
+{
+	assert(i->second->IsIdle());
+
+	entries.erase(i);
+}
+
+std::unique_ptr<Cache::Entry>
+Cache::Detach(const char *name) noexcept
+{
+	auto i = entries.find(name);
+	assert(i != entries.end());
+
+	auto entry = std::move(i->second);
+	entries.erase(i);
+	return entry;
+}
+
+void
+Cache::Flush() noexcept
+{
+	for (auto i = entries.begin(); i != entries.end();) {
+		auto next = std::next(i);
+		if (i->second->IsIdle())
+			Remove(i);
+		i = next;
+	}
+}
+
+bool
+Cache::OnCleanupTimer() noexcept
+{
+	const auto now = channel.GetEventLoop().SteadyNow();
+
+	for (auto i = entries.begin(); i != entries.end();) {
+		auto next = std::next(i);
+		if (i->second->IsObsolete(now))
+			Remove(i);
+		i = next;
+	}
+
+	return !entries.empty();
+}
+
+} // namespace Cares
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/CleanupTimer.hxx"
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <stdint.h>
+
+class CancellablePointer;
+
+namespace Cares {
+
+class Channel;
+class Handler;
+class AddressListHandler;
+
+/**
+ * A caching resolver in front of a #Channel.  All addresses of a
+ * successful lookup are stored for the smallest of their TTLs
+ * (clamped to Config::min_ttl and Config::max_ttl), and "not found"
+ * results are cached for Config::negative_ttl.  Concurrent lookups
+ * of the same name share one query.  An expired entry is still
+ * served for up to Config::stale_ttl while a refresh runs in the
+ * background.
+ */
+class Cache final {
+public:
+	struct Config {
+		std::chrono::seconds min_ttl{1};
+		std::chrono::seconds max_ttl = std::chrono::hours(1);
+		std::chrono::seconds negative_ttl{5};
+		std::chrono::seconds stale_ttl{30};
+	};
+
+	struct Stats {
+		uint64_t hits = 0, stale_hits = 0, negative_hits = 0;
+		uint64_t misses = 0, coalesced = 0, queries = 0;
+	};
+
+private:
+	Channel &channel;
+
+	const Config config;
+
+	class Request;
+	class Entry;
+
+	typedef std::map<std::string, std::unique_ptr<Entry>,
+			 std::less<>> EntryMap;
+
+	EntryMap entries;
+
+	CleanupTimer cleanup_timer;
+
+	Stats stats;
+
+public:
+	explicit Cache(Channel &_channel) noexcept
+		:Cache(_channel, Config()) {}
+
+	Cache(Channel &_channel, const Config &_config) noexcept;
+	~Cache() noexcept;
+
+	Cache(const Cache &) = delete;
+	Cache &operator=(const Cache &) = delete;
+
+	const Stats &GetStats() const noexcept {
+		return stats;
+	}
+
+	std::size_t GetSize() const noexcept {
+		return entries.size();
+	}
+
+	/**
+	 * Look up a host name and call a #Handler method upon
+	 * completion.  On a cache hit, the #Handler is invoked
+	 * synchronously before this method returns (and #cancel_ptr
+	 * is left untouched).
+	 */
+	void Lookup(const char *name, Handler &handler,
+		    CancellablePointer &cancel_ptr) noexcept;
+
+	/**
+	 * Like Lookup(), but deliver all cached addresses.
+	 */
+	void LookupAll(const char *name, AddressListHandler &handler,
+		       CancellablePointer &cancel_ptr) noexcept;
+
+	/**
+	 * Remove all entries which are not being refreshed.
+	 */
+	void Flush() noexcept;
+
+private:
+	template<typename H>
+	void DoLookup(const char *name, H &handler,
+		      CancellablePointer &cancel_ptr) noexcept;
+
+	void Remove(EntryMap::iterator i) noexcept;
+
+	/**
+	 * Remove an entry whose query has failed.
+	 */
+	std::unique_ptr<Entry> Detach(const char *name) noexcept;
+
+	bool OnCleanupTimer() noexcept;
+};
+
+} // namespace Cares
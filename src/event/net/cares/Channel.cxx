@@ -32,14 +32,20 @@
 
 #include "Channel.hxx"
 #include "Handler.hxx"
+#include "AddressList.hxx"
 #include "Error.hxx"
 #include "event/SocketEvent.hxx"
 #include "net/AllocatedSocketAddress.hxx"
 #include "util/Cancellable.hxx"
 
+#include <algorithm>
+#include <forward_list>
+#include <vector>
+
 #include <assert.h>
 #include <string.h>
 #include <netinet/in.h>
+#include <arpa/nameser.h>
 
 namespace Cares {
 
@@ -84,6 +90,14 @@ Channel::~Channel() noexcept
 	ares_destroy(channel);
 }
 
+void
+Channel::SetServers(const char *servers)
+{
+	int code = ares_set_servers_ports_csv(channel, servers);
+	if (code != ARES_SUCCESS)
+		throw Error(code, "ares_set_servers_ports_csv() failed");
+}
+
 void
 Channel::UpdateSockets() noexcept
 {
@@ -239,4 +253,394 @@ Channel::Lookup(const char *name, Handler &handler,
 	UpdateSockets();
 }
 
+class Channel::AddrInfoRequest final : Cancellable {
+	AddrInfoHandler *handler;
+
+public:
+	AddrInfoRequest(AddrInfoHandler &_handler,
+			CancellablePointer &cancel_ptr)
+		:handler(&_handler) {
+		cancel_ptr = *this;
+	}
+
+	void Start(ares_channel _channel,
+		   const char *name, int family) noexcept {
+		assert(handler != nullptr);
+
+		struct ares_addrinfo_hints hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = family;
+
+		ares_getaddrinfo(_channel, name, nullptr, &hints,
+				 AddrInfoCallback, this);
+	}
+
+private:
+	void Cancel() noexcept override {
+		assert(handler != nullptr);
+
+		handler = nullptr;
+	}
+
+	void AddrInfoCallback(int status,
+			      struct ares_addrinfo *result) noexcept;
+
+	static void AddrInfoCallback(void *arg, int status, int,
+				     struct ares_addrinfo *result) noexcept {
+		auto &request = *(AddrInfoRequest *)arg;
+		request.AddrInfoCallback(status, result);
+	}
+};
+
+inline void
+Channel::AddrInfoRequest::AddrInfoCallback(int status,
+					   struct ares_addrinfo *result) noexcept
+{
+	if (handler != nullptr) {
+		try {
+			if (status != ARES_SUCCESS)
+				throw Error(status, "ares_getaddrinfo() failed");
+			else if (result == nullptr || result->nodes == nullptr)
+				throw Error(ARES_ENODATA, "ares_getaddrinfo() failed");
+
+			handler->OnCaresAddrInfo(*result);
+		} catch (...) {
+			handler->OnCaresError(std::current_exception());
+		}
+	}
+
+	if (result != nullptr)
+		ares_freeaddrinfo(result);
+
+	delete this;
+}
+
+void
+Channel::LookupAddrInfo(const char *name, int family,
+			AddrInfoHandler &handler,
+			CancellablePointer &cancel_ptr) noexcept
+{
+	auto *request = new AddrInfoRequest(handler, cancel_ptr);
+	request->Start(channel, name, family);
+	UpdateSockets();
+}
+
+class Channel::AddressListRequest final : AddrInfoHandler, Cancellable {
+	AddressListHandler &handler;
+
+	CancellablePointer cancel_query;
+
+public:
+	AddressListRequest(AddressListHandler &_handler,
+			   CancellablePointer &cancel_ptr) noexcept
+		:handler(_handler) {
+		cancel_ptr = *this;
+	}
+
+	void Start(Channel &channel, const char *name) noexcept {
+		channel.LookupAddrInfo(name, AF_UNSPEC, *this, cancel_query);
+	}
+
+private:
+	/* virtual methods from Cancellable */
+	void Cancel() noexcept override {
+		cancel_query.Cancel();
+		delete this;
+	}
+
+	/* virtual methods from AddrInfoHandler */
+	void OnCaresAddrInfo(const struct ares_addrinfo &result) noexcept override {
+		const auto list = ToAddressList(result);
+		auto &_handler = handler;
+		delete this;
+
+		if (list.empty())
+			_handler.OnCaresError(std::make_exception_ptr(Error(ARES_ENODATA,
+									    "ares_getaddrinfo() failed")));
+		else
+			_handler.OnCaresAddressList(list);
+	}
+
+	void OnCaresError(std::exception_ptr e) noexcept override {
+		auto &_handler = handler;
+		delete this;
+		_handler.OnCaresError(e);
+	}
+};
+
+void
+Channel::LookupAll(const char *name, AddressListHandler &handler,
+		   CancellablePointer &cancel_ptr) noexcept
+{
+	auto *request = new AddressListRequest(handler, cancel_ptr);
+	request->Start(*this, name);
+}
+
+class Channel::ParallelRequest final : Cancellable {
+	AddressListHandler *handler;
+
+	AddressList ipv6, ipv4;
+
+	std::exception_ptr error;
+
+	/**
+	 * The number of queries which have not yet completed, plus
+	 * one while Start() is running.
+	 */
+	unsigned pending = 3;
+
+public:
+	ParallelRequest(AddressListHandler &_handler,
+			CancellablePointer &cancel_ptr) noexcept
+		:handler(&_handler) {
+		cancel_ptr = *this;
+	}
+
+	void Start(ares_channel _channel, const char *name) noexcept {
+		ares_search(_channel, name, ns_c_in, ns_t_aaaa,
+			    AAAACallback, this);
+		ares_search(_channel, name, ns_c_in, ns_t_a,
+			    ACallback, this);
+		Unref();
+	}
+
+private:
+	void Cancel() noexcept override {
+		assert(handler != nullptr);
+
+		handler = nullptr;
+	}
+
+	void Unref() noexcept;
+
+	void SetError(int status) noexcept {
+		/* prefer a "real" error over "no such record" */
+		if (!error || (status != ARES_ENODATA &&
+			       status != ARES_ENOTFOUND))
+			error = std::make_exception_ptr(Error(status,
+							      "ares_search() failed"));
+	}
+
+	void AAAACallback(int status, const unsigned char *abuf,
+			  int alen) noexcept;
+	void ACallback(int status, const unsigned char *abuf,
+		       int alen) noexcept;
+
+	static void AAAACallback(void *arg, int status, int,
+				 unsigned char *abuf, int alen) noexcept {
+		auto &request = *(ParallelRequest *)arg;
+		request.AAAACallback(status, abuf, alen);
+	}
+
+	static void ACallback(void *arg, int status, int,
+			      unsigned char *abuf, int alen) noexcept {
+		auto &request = *(ParallelRequest *)arg;
+		request.ACallback(status, abuf, alen);
+	}
+};
+
+static constexpr int MAX_ADDRTTLS = 32;
+
+inline void
+Channel::ParallelRequest::AAAACallback(int status, const unsigned char *abuf,
+				       int alen) noexcept
+{
+	if (status == ARES_SUCCESS && handler != nullptr) {
+		struct ares_addr6ttl addrttls[MAX_ADDRTTLS];
+		int n = MAX_ADDRTTLS;
+		status = ares_parse_aaaa_reply(abuf, alen, nullptr,
+					       addrttls, &n);
+		if (status == ARES_SUCCESS) {
+			std::chrono::seconds ttl = std::chrono::seconds::max();
+
+			for (int i = 0; i < n; ++i) {
+				struct sockaddr_in6 sin6;
+				memset(&sin6, 0, sizeof(sin6));
+				sin6.sin6_family = AF_INET6;
+				memcpy(&sin6.sin6_addr, &addrttls[i].ip6addr,
+				       sizeof(sin6.sin6_addr));
+				ipv6.Add(SocketAddress((const struct sockaddr *)&sin6,
+						       sizeof(sin6)));
+				ttl = std::min(ttl, std::chrono::seconds(std::max(addrttls[i].ttl, 0)));
+			}
+
+			ipv6.SetTtl(ttl);
+		}
+	}
+
+	if (status != ARES_SUCCESS)
+		SetError(status);
+
+	Unref();
+}
+
+inline void
+Channel::ParallelRequest::ACallback(int status, const unsigned char *abuf,
+				    int alen) noexcept
+{
+	if (status == ARES_SUCCESS && handler != nullptr) {
+		struct ares_addrttl addrttls[MAX_ADDRTTLS];
+		int n = MAX_ADDRTTLS;
+		status = ares_parse_a_reply(abuf, alen, nullptr,
+					    addrttls, &n);
+		if (status == ARES_SUCCESS) {
+			std::chrono::seconds ttl = std::chrono::seconds::max();
+
+			for (int i = 0; i < n; ++i) {
+				struct sockaddr_in sin;
+				memset(&sin, 0, sizeof(sin));
+				sin.sin_family = AF_INET;
+				sin.sin_addr = addrttls[i].ipaddr;
+				ipv4.Add(SocketAddress((const struct sockaddr *)&sin,
+						       sizeof(sin)));
+				ttl = std::min(ttl, std::chrono::seconds(std::max(addrttls[i].ttl, 0)));
+			}
+
+			ipv4.SetTtl(ttl);
+		}
+	}
+
+	if (status != ARES_SUCCESS)
+		SetError(status);
+
+	Unref();
+}
+
+void
+Channel::ParallelRequest::Unref() noexcept
+{
+	assert(pending > 0);
+
+	if (--pending > 0)
+		return;
+
+	if (handler != nullptr) {
+		AddressList &result = ipv6;
+		if (result.empty())
+			result = std::move(ipv4);
+		else if (!ipv4.empty()) {
+			result.reserve(result.size() + ipv4.size());
+			for (SocketAddress i : ipv4)
+				result.Add(i);
+			result.SetTtl(std::min(result.GetTtl(),
+					       ipv4.GetTtl()));
+		}
+
+		if (!result.empty())
+			handler->OnCaresAddressList(result);
+		else if (error)
+			handler->OnCaresError(error);
+		else
+			handler->OnCaresError(std::make_exception_ptr(Error(ARES_ENODATA,
+									    "ares_search() failed")));
+	}
+
+	delete this;
+}
+
+inline void
+Channel::StartParallel(const char *name, AddressListHandler &handler,
+		       CancellablePointer &cancel_ptr) noexcept
+{
+	auto *request = new ParallelRequest(handler, cancel_ptr);
+	request->Start(channel, name);
+}
+
+void
+Channel::LookupParallel(const char *name, AddressListHandler &handler,
+			CancellablePointer &cancel_ptr) noexcept
+{
+	StartParallel(name, handler, cancel_ptr);
+	UpdateSockets();
+}
+
+class Channel::BatchRequest final : Cancellable {
+	BatchHandler &handler;
+
+	class Item final : public AddressListHandler {
+		BatchRequest &batch;
+		BatchResult &result;
+
+	public:
+		CancellablePointer cancel_ptr;
+
+		Item(BatchRequest &_batch, BatchResult &_result) noexcept
+			:batch(_batch), result(_result) {}
+
+	private:
+		/* virtual methods from AddressListHandler */
+		void OnCaresAddressList(const AddressList &addresses) noexcept override {
+			cancel_ptr = nullptr;
+			result.addresses = addresses;
+			batch.Unref();
+		}
+
+		void OnCaresError(std::exception_ptr e) noexcept override {
+			cancel_ptr = nullptr;
+			result.error = e;
+			batch.Unref();
+		}
+	};
+
+	std::vector<BatchResult> results;
+	std::forward_list<Item> items;
+
+	/**
+	 * The number of lookups which have not yet completed, plus
+	 * one while Start() is running.
+	 */
+	std::size_t pending;
+
+public:
+	BatchRequest(BatchHandler &_handler, std::size_t n,
+		     CancellablePointer &cancel_ptr) noexcept
+		:handler(_handler), results(n), pending(n + 1) {
+		cancel_ptr = *this;
+	}
+
+	void Start(Channel &channel, ConstBuffer<const char *> names) noexcept {
+		assert(names.size == results.size());
+
+		for (std::size_t i = 0; i < names.size; ++i) {
+			items.emplace_front(*this, results[i]);
+			auto &item = items.front();
+			channel.StartParallel(names[i], item, item.cancel_ptr);
+		}
+
+		Unref();
+	}
+
+private:
+	void Unref() noexcept {
+		assert(pending > 0);
+
+		if (--pending > 0)
+			return;
+
+		auto &_handler = handler;
+		const auto _results = std::move(results);
+		delete this;
+
+		_handler.OnCaresBatch({_results.data(), _results.size()});
+	}
+
+	/* virtual methods from Cancellable */
+	void Cancel() noexcept override {
+		for (auto &i : items)
+			if (i.cancel_ptr)
+				i.cancel_ptr.Cancel();
+
+		delete this;
+	}
+};
+
+void
+Channel::LookupBatch(ConstBuffer<const char *> names, BatchHandler &handler,
+		     CancellablePointer &cancel_ptr) noexcept
+{
+	auto *request = new BatchRequest(handler, names.size, cancel_ptr);
+	request->Start(*this, names);
+	UpdateSockets();
+}
+
 } // namespace Cares
@@ -35,6 +35,7 @@
 #include "Init.hxx"
 #include "event/DeferEvent.hxx"
 #include "event/TimerEvent.hxx"
+#include "util/ConstBuffer.hxx"
 
 #include <ares.h>
 
@@ -45,6 +46,9 @@ class CancellablePointer;
 namespace Cares {
 
 class Handler;
+class AddrInfoHandler;
+class AddressListHandler;
+class BatchHandler;
 
 /**
  * C++ wrapper for #ares_channel with #EventLoop integration.
@@ -63,6 +67,10 @@ class Channel {
 	fd_set read_ready, write_ready;
 
 	class Request;
+	class AddrInfoRequest;
+	class AddressListRequest;
+	class ParallelRequest;
+	class BatchRequest;
 
 public:
 	explicit Channel(EventLoop &event_loop);
@@ -72,6 +80,16 @@ public:
 		return defer_process.GetEventLoop();
 	}
 
+	/**
+	 * Replace the name servers from /etc/resolv.conf.
+	 *
+	 * Throws #Cares::Error on error.
+	 *
+	 * @param servers a comma-separated list of addresses, each
+	 * with an optional port (e.g. "127.0.0.1:5353,[::1]:53")
+	 */
+	void SetServers(const char *servers);
+
 	/**
 	 * Look up a host name and call a #Handler method upon
 	 * completion.
@@ -79,7 +97,51 @@ public:
 	void Lookup(const char *name, Handler &handler,
 		    CancellablePointer &cancel_ptr) noexcept;
 
+	/**
+	 * Look up all IPv4 and IPv6 addresses of a host name and
+	 * call a #AddressListHandler method upon completion.
+	 */
+	void LookupAll(const char *name, AddressListHandler &handler,
+		       CancellablePointer &cancel_ptr) noexcept;
+
+	/**
+	 * Like LookupAll(), but send the AAAA and the A query
+	 * concurrently with ares_search() and merge the results
+	 * (IPv6 addresses first).  Unlike LookupAll(), this does not
+	 * consult the "hosts" file.  The lookup fails only if both
+	 * queries fail.
+	 */
+	void LookupParallel(const char *name, AddressListHandler &handler,
+			    CancellablePointer &cancel_ptr) noexcept;
+
+	/**
+	 * Look up a batch of host names (each with
+	 * LookupParallel()) and call the #BatchHandler once all of
+	 * them have completed.  The name strings need to remain valid
+	 * only until this method returns.
+	 */
+	void LookupBatch(ConstBuffer<const char *> names,
+			 BatchHandler &handler,
+			 CancellablePointer &cancel_ptr) noexcept;
+
+	/**
+	 * Look up all addresses of a host name (including their
+	 * TTLs) with ares_getaddrinfo() and call a #AddrInfoHandler
+	 * method upon completion.
+	 *
+	 * @param family AF_INET, AF_INET6 or AF_UNSPEC
+	 */
+	void LookupAddrInfo(const char *name, int family,
+			    AddrInfoHandler &handler,
+			    CancellablePointer &cancel_ptr) noexcept;
+
 private:
+	/**
+	 * Start a LookupParallel() without calling UpdateSockets().
+	 */
+	void StartParallel(const char *name, AddressListHandler &handler,
+			   CancellablePointer &cancel_ptr) noexcept;
+
 	void UpdateSockets() noexcept;
 	void DeferredProcess() noexcept;
 
@@ -32,12 +32,18 @@
 
 #pragma once
 
+#include "util/ConstBuffer.hxx"
+
 #include <exception>
 
+struct ares_addrinfo;
 class SocketAddress;
 
 namespace Cares {
 
+class AddressList;
+struct BatchResult;
+
 /**
  * Handler interface for Channel::Lookup().
  */
@@ -47,4 +53,43 @@ public:
 	virtual void OnCaresError(std::exception_ptr e) noexcept = 0;
 };
 
+/**
+ * Handler interface for Channel::LookupAll().
+ */
+class AddressListHandler {
+public:
+	/**
+	 * @param addresses a non-empty list of addresses; it is
+	 * only valid during this call
+	 */
+	virtual void OnCaresAddressList(const AddressList &addresses) noexcept = 0;
+	virtual void OnCaresError(std::exception_ptr e) noexcept = 0;
+};
+
+/**
+ * Handler interface for Channel::LookupBatch().
+ */
+class BatchHandler {
+public:
+	/**
+	 * @param results one result for each name, in the order the
+	 * names were passed to Channel::LookupBatch(); the array is
+	 * only valid during this call
+	 */
+	virtual void OnCaresBatch(ConstBuffer<BatchResult> results) noexcept = 0;
+};
+
+/**
+ * Handler interface for Channel::LookupAddrInfo().
+ */
+class AddrInfoHandler {
+public:
+	/**
+	 * @param result the result with at least one node; it is
+	 * owned by the caller and freed after this method returns
+	 */
+	virtual void OnCaresAddrInfo(const struct ares_addrinfo &result) noexcept = 0;
+	virtual void OnCaresError(std::exception_ptr e) noexcept = 0;
+};
+
 } // namespace Cares
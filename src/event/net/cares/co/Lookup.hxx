@@ -0,0 +1,104 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/net/cares/Channel.hxx"
+#include "event/net/cares/Handler.hxx"
+#include "event/co/DeferredResume.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "util/Cancellable.hxx"
+
+#include <exception>
+
+namespace Co {
+
+/**
+ * Awaitable which resolves a host name (wrapping
+ * Cares::Channel::Lookup()).  The lookup starts on construction;
+ * destroying this object cancels it.  co_await returns the
+ * address or throws.
+ */
+class CaresLookup final : Cares::Handler {
+	DeferredResume resume;
+
+	CancellablePointer cancel_ptr;
+
+	StaticSocketAddress value;
+
+	std::exception_ptr error;
+
+public:
+	/**
+	 * @param name the host name; it needs to remain valid only
+	 * until the constructor returns
+	 */
+	CaresLookup(Cares::Channel &channel, const char *name) noexcept
+		:resume(channel.GetEventLoop())
+	{
+		channel.Lookup(name, *this, cancel_ptr);
+	}
+
+	~CaresLookup() noexcept {
+		if (!resume.IsDone())
+			cancel_ptr.Cancel();
+	}
+
+	bool await_ready() const noexcept {
+		return resume.IsDone();
+	}
+
+	void await_suspend(std::coroutine_handle<> continuation) noexcept {
+		resume.SetContinuation(continuation);
+	}
+
+	const StaticSocketAddress &await_resume() const {
+		if (error)
+			std::rethrow_exception(error);
+
+		return value;
+	}
+
+private:
+	/* virtual methods from class Cares::Handler */
+	void OnCaresSuccess(SocketAddress address) noexcept override {
+		value = address;
+		resume.Complete();
+	}
+
+	void OnCaresError(std::exception_ptr e) noexcept override {
+		error = std::move(e);
+		resume.Complete();
+	}
+};
+
+} // namespace Co
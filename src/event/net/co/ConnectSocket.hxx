@@ -0,0 +1,101 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/net/ConnectSocket.hxx"
+#include "event/co/DeferredResume.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/SocketAddress.hxx"
+
+#include <exception>
+
+namespace Co {
+
+/**
+ * Awaitable which connects a stream socket (wrapping
+ * #::ConnectSocket).  The connection attempt starts on
+ * construction; destroying this object cancels it.  co_await
+ * returns the connected socket or throws.
+ */
+class ConnectSocket final : ConnectSocketHandler {
+	DeferredResume resume;
+
+	::ConnectSocket connect;
+
+	UniqueSocketDescriptor value;
+
+	std::exception_ptr error;
+
+public:
+	ConnectSocket(EventLoop &event_loop, SocketAddress address,
+		      const struct timeval &timeout) noexcept
+		:resume(event_loop), connect(event_loop, *this)
+	{
+		connect.Connect(address, timeout);
+	}
+
+	ConnectSocket(EventLoop &event_loop, SocketAddress address) noexcept
+		:resume(event_loop), connect(event_loop, *this)
+	{
+		connect.Connect(address);
+	}
+
+	bool await_ready() const noexcept {
+		return resume.IsDone();
+	}
+
+	void await_suspend(std::coroutine_handle<> continuation) noexcept {
+		resume.SetContinuation(continuation);
+	}
+
+	UniqueSocketDescriptor await_resume() {
+		if (error)
+			std::rethrow_exception(error);
+
+		return std::move(value);
+	}
+
+private:
+	/* virtual methods from class ConnectSocketHandler */
+	void OnSocketConnectSuccess(UniqueSocketDescriptor &&fd) override {
+		value = std::move(fd);
+		resume.Complete();
+	}
+
+	void OnSocketConnectError(std::exception_ptr ep) override {
+		error = std::move(ep);
+		resume.Complete();
+	}
+};
+
+} // namespace Co
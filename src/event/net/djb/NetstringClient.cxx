@@ -32,6 +32,11 @@
 
 #include "NetstringClient.hxx"
 #include "util/ConstBuffer.hxx"
+#include "util/StringView.hxx"
+#include "system/Error.hxx"
+
+#include <sys/sendfile.h>
+#include <errno.h>
 
 static constexpr timeval send_timeout{10, 0};
 static constexpr timeval recv_timeout{60, 0};
@@ -74,23 +79,101 @@ NetstringClient::Request(int _out_fd, int _in_fd,
 	event.Add(send_timeout);
 }
 
+template<typename L>
+static inline size_t
+GetTotalSize(const L &list)
+{
+	size_t result = 0;
+	for (const auto &i : list)
+		result += i.size;
+	return result;
+}
+
 void
-NetstringClient::OnEvent(unsigned events)
-	try {
-		if (events & SocketEvent::TIMEOUT) {
-			throw std::runtime_error("Connect timeout");
-		} else if (events & SocketEvent::WRITE) {
+NetstringClient::Request(int _out_fd, int _in_fd,
+			 std::list<ConstBuffer<void>> &&head,
+			 int _body_fd, off_t _body_offset, size_t body_size,
+			 std::list<ConstBuffer<void>> &&_tail)
+{
+	assert(in_fd < 0);
+	assert(out_fd < 0);
+	assert(_in_fd >= 0);
+	assert(_out_fd >= 0);
+	assert(_body_fd >= 0);
+
+	out_fd = _out_fd;
+	in_fd = _in_fd;
+
+	body_fd = _body_fd;
+	body_offset = _body_offset;
+	body_remaining = body_size;
+
+	tail = std::move(_tail);
+
+	head.emplace_front(header(GetTotalSize(head) + body_size +
+				  GetTotalSize(tail)).ToVoid());
+	tail.emplace_back(",", 1);
+	for (const auto &i : head)
+		write.Push(i.data, i.size);
+
+	event.Set(out_fd, SocketEvent::WRITE|SocketEvent::PERSIST);
+	event.Add(send_timeout);
+}
+
+void
+NetstringClient::OnWrite()
+{
+	while (true) {
+		if (!write.IsEmpty()) {
 			switch (write.Write(out_fd)) {
 			case MultiWriteBuffer::Result::MORE:
 				event.Add(&send_timeout);
-				break;
+				return;
 
 			case MultiWriteBuffer::Result::FINISHED:
-				event.Delete();
-				event.Set(in_fd, SocketEvent::READ|SocketEvent::PERSIST);
-				event.Add(recv_timeout);
 				break;
 			}
+		}
+
+		if (body_remaining == 0) {
+			if (tail.empty())
+				break;
+
+			/* the body is complete; now send the tail */
+			write = MultiWriteBuffer();
+			for (const auto &i : tail)
+				write.Push(i.data, i.size);
+			tail.clear();
+			continue;
+		}
+
+		ssize_t nbytes = sendfile(out_fd, body_fd, &body_offset,
+					  body_remaining);
+		if (nbytes < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				event.Add(&send_timeout);
+				return;
+			}
+
+			throw MakeErrno("Failed to send body");
+		} else if (nbytes == 0)
+			throw std::runtime_error("Premature end of body file");
+
+		body_remaining -= nbytes;
+	}
+
+	event.Delete();
+	event.Set(in_fd, SocketEvent::READ|SocketEvent::PERSIST);
+	event.Add(recv_timeout);
+}
+
+void
+NetstringClient::OnEvent(unsigned events)
+	try {
+		if (events & SocketEvent::TIMEOUT) {
+			throw std::runtime_error("Connect timeout");
+		} else if (events & SocketEvent::WRITE) {
+			OnWrite();
 		} else if (events & SocketEvent::READ) {
 			switch (input.Receive(in_fd)) {
 			case NetstringInput::Result::MORE:
@@ -34,6 +34,7 @@
 
 #include "io/MultiWriteBuffer.hxx"
 #include "net/djb/NetstringGenerator.hxx"
+#include "net/djb/NetstringHeader.hxx"
 #include "net/djb/NetstringInput.hxx"
 #include "event/SocketEvent.hxx"
 #include "util/ConstBuffer.hxx"
@@ -41,6 +42,8 @@
 #include <list>
 #include <exception>
 
+#include <sys/types.h>
+
 template<typename T> struct ConstBuffer;
 
 class NetstringClientHandler {
@@ -66,8 +69,22 @@ class NetstringClient final {
 	SocketEvent event;
 
 	NetstringGenerator generator;
+	NetstringHeader header;
 	MultiWriteBuffer write;
 
+	/**
+	 * The file which is streamed with sendfile() after #write
+	 * has been flushed; see Request() with a body file.
+	 */
+	int body_fd = -1;
+	off_t body_offset;
+	size_t body_remaining = 0;
+
+	/**
+	 * Data to be sent after the body file.
+	 */
+	std::list<ConstBuffer<void>> tail;
+
 	NetstringInput input;
 
 	NetstringClientHandler &handler;
@@ -94,6 +111,33 @@ public:
 	void Request(int _out_fd, int _in_fd,
 		     std::list<ConstBuffer<void>> &&data);
 
+	/**
+	 * Like the other Request() overload, but the request data
+	 * consists of the memory chunks #head, followed by a portion
+	 * of a file (which is sent with sendfile() without copying
+	 * it to userspace), followed by the memory chunks #_tail.
+	 * This allows sending large payloads without loading them
+	 * into memory.
+	 *
+	 * @param _body_fd a file descriptor which supports
+	 * sendfile() (e.g. a regular file); it is not closed by this
+	 * object and must remain valid until the
+	 * #NetstringClientHandler has been invoked
+	 * @param _body_offset the file offset where the body starts
+	 * (the file position is not modified)
+	 * @param body_size the number of bytes to be sent from the
+	 * file
+	 */
+	void Request(int _out_fd, int _in_fd,
+		     std::list<ConstBuffer<void>> &&head,
+		     int _body_fd, off_t _body_offset, size_t body_size,
+		     std::list<ConstBuffer<void>> &&_tail);
+
 private:
+	/**
+	 * Throws on error.
+	 */
+	void OnWrite();
+
 	void OnEvent(unsigned events);
 };
@@ -31,31 +31,64 @@
  */
 
 #include "NetstringServer.hxx"
+#include "net/djb/NetstringHeader.hxx"
 #include "util/ConstBuffer.hxx"
+#include "util/StringView.hxx"
 
 #include <stdexcept>
 
+#include <assert.h>
 #include <string.h>
 
 static constexpr timeval busy_timeout{5, 0};
 
+/**
+ * The maximum number of responses per writev() call; this is
+ * MultiWriteBuffer's capacity.
+ */
+static constexpr size_t MAX_WRITEV = 32;
+
+constexpr size_t NetstringServer::MAX_PIPELINED;
+
 NetstringServer::NetstringServer(EventLoop &event_loop,
-				 UniqueSocketDescriptor _fd)
+				 UniqueSocketDescriptor _fd,
+				 bool _persistent)
 	:fd(std::move(_fd)),
 	 event(event_loop, fd.Get(), SocketEvent::READ|SocketEvent::PERSIST,
 	       BIND_THIS_METHOD(OnEvent)),
-	 input(16 * 1024 * 1024) {
+	 input(16 * 1024 * 1024, 8192),
+	 defer_read(event_loop, BIND_THIS_METHOD(OnDeferredRead)),
+	 write_event(event_loop, fd.Get(), SocketEvent::WRITE,
+		     BIND_THIS_METHOD(OnWriteReady)),
+	 persistent(_persistent) {
 	event.Add(busy_timeout);
 }
 
 NetstringServer::~NetstringServer()
 {
 	event.Delete();
+	write_event.Delete();
+	defer_read.Cancel();
+}
+
+void
+NetstringServer::OnPipelinedRequest(RequestId,
+				    AllocatedArray<uint8_t> &&payload)
+{
+	OnRequest(std::move(payload));
 }
 
 bool
 NetstringServer::SendResponse(const void *data, size_t size)
 	try {
+		if (persistent) {
+			for (const auto &i : responses)
+				if (!i.ready)
+					return SendResponse(i.id, data, size);
+
+			throw std::runtime_error("No pending request");
+		}
+
 		std::list<ConstBuffer<void>> list{{data, size}};
 		generator(list);
 		for (const auto &i : list)
@@ -82,6 +115,94 @@ NetstringServer::SendResponse(const char *data)
 	return SendResponse((const void *)data, strlen(data));
 }
 
+bool
+NetstringServer::SendResponse(RequestId id, const void *data, size_t size)
+	try {
+		assert(persistent);
+		assert(!responses.empty());
+		assert(id >= responses.front().id);
+
+		auto &response = responses[id - responses.front().id];
+		assert(response.id == id);
+		assert(!response.ready);
+
+		NetstringHeader header;
+		const StringView h = header(size);
+
+		response.data.reserve(h.size + size + 1);
+		response.data.assign(h.data, h.size);
+		response.data.append((const char *)data, size);
+		response.data.push_back(',');
+		response.ready = true;
+
+		Flush();
+		return true;
+	} catch (...) {
+		OnError(std::current_exception());
+		return false;
+	}
+
+void
+NetstringServer::Flush()
+{
+	assert(persistent);
+
+	while (true) {
+		if (n_writing == 0) {
+			/* collect all consecutive ready responses for
+			   one writev() */
+			write = MultiWriteBuffer();
+
+			for (const auto &i : responses) {
+				if (!i.ready || n_writing >= MAX_WRITEV)
+					break;
+
+				write.Push(i.data.data(), i.data.size());
+				++n_writing;
+			}
+
+			if (n_writing == 0)
+				break;
+		}
+
+		switch (write.Write(fd.Get())) {
+		case MultiWriteBuffer::Result::MORE:
+			write_event.Add();
+			return;
+
+		case MultiWriteBuffer::Result::FINISHED:
+			for (; n_writing > 0; --n_writing)
+				responses.pop_front();
+			break;
+		}
+	}
+
+	/* resume reading if it was throttled by MAX_PIPELINED */
+	ScheduleRead();
+}
+
+void
+NetstringServer::ScheduleRead()
+{
+	assert(persistent);
+
+	if (responses.size() >= MAX_PIPELINED) {
+		/* too many pending responses: stop reading until
+		   Flush() has made progress */
+		event.Delete();
+		return;
+	}
+
+	if (input.HasBufferedData())
+		/* there may be another request in the input buffer;
+		   parse it outside of the current stack frame */
+		defer_read.Schedule();
+
+	/* the idle timeout applies only while no response is
+	   pending */
+	event.Add(responses.empty() ? &busy_timeout : nullptr);
+}
+
 void
 NetstringServer::OnEvent(unsigned events)
 	try {
@@ -92,7 +213,10 @@ NetstringServer::OnEvent(unsigned events)
 
 		switch (input.Receive(fd.Get())) {
 		case NetstringInput::Result::MORE:
-			event.Add(&busy_timeout);
+			if (persistent)
+				ScheduleRead();
+			else
+				event.Add(&busy_timeout);
 			break;
 
 		case NetstringInput::Result::CLOSED:
@@ -100,6 +224,18 @@ NetstringServer::OnEvent(unsigned events)
 			break;
 
 		case NetstringInput::Result::FINISHED:
+			if (persistent) {
+				auto payload = std::move(input.GetValue());
+				input.Reset();
+
+				const RequestId id = next_id++;
+				responses.emplace_back(id);
+				ScheduleRead();
+
+				OnPipelinedRequest(id, std::move(payload));
+				break;
+			}
+
 			event.Delete();
 			OnRequest(std::move(input.GetValue()));
 			break;
@@ -107,3 +243,17 @@ NetstringServer::OnEvent(unsigned events)
 	} catch (...) {
 		OnError(std::current_exception());
 	}
+
+void
+NetstringServer::OnDeferredRead()
+{
+	OnEvent(SocketEvent::READ);
+}
+
+void
+NetstringServer::OnWriteReady(unsigned)
+	try {
+		Flush();
+	} catch (...) {
+		OnError(std::current_exception());
+	}
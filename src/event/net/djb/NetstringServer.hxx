@@ -37,16 +37,33 @@
 #include "net/djb/NetstringGenerator.hxx"
 #include "net/UniqueSocketDescriptor.hxx"
 #include "event/SocketEvent.hxx"
+#include "event/DeferEvent.hxx"
 
+#include <deque>
 #include <exception>
+#include <string>
 #include <cstddef>
+#include <cstdint>
 
 /**
  * A server that receives netstrings
  * (http://cr.yp.to/proto/netstrings.txt) from its clients and
  * responds with another netstring.
+ *
+ * By default, the connection handles exactly one request.  In
+ * persistent mode, it keeps reading requests while earlier
+ * responses are still pending; responses may be submitted in any
+ * order, but they are sent in the order of the requests, with as
+ * few writev() calls as possible.
  */
 class NetstringServer {
+public:
+	/**
+	 * Identifies a request in persistent mode.
+	 */
+	typedef uint64_t RequestId;
+
+private:
 	UniqueSocketDescriptor fd;
 
 	SocketEvent event;
@@ -55,8 +72,56 @@ class NetstringServer {
 	NetstringGenerator generator;
 	MultiWriteBuffer write;
 
+	/**
+	 * Persistent mode only: resumes parsing buffered requests
+	 * outside of the OnPipelinedRequest() stack frame, and
+	 * waits for the socket to become writable.
+	 */
+	DeferEvent defer_read;
+	SocketEvent write_event;
+
+	struct PendingResponse {
+		const RequestId id;
+
+		bool ready = false;
+
+		/**
+		 * The complete netstring (header, value and comma).
+		 */
+		std::string data;
+
+		explicit PendingResponse(RequestId _id) noexcept
+			:id(_id) {}
+	};
+
+	/**
+	 * Persistent mode only: one entry for each request which has
+	 * not been sent yet, in request order.
+	 */
+	std::deque<PendingResponse> responses;
+
+	/**
+	 * The number of #responses (from the front) which are
+	 * currently in #write.
+	 */
+	size_t n_writing = 0;
+
+	RequestId next_id = 0;
+
+	/**
+	 * Stop reading requests while this many responses are
+	 * pending.
+	 */
+	static constexpr size_t MAX_PIPELINED = 64;
+
+	const bool persistent;
+
 public:
-	NetstringServer(EventLoop &event_loop, UniqueSocketDescriptor _fd);
+	/**
+	 * @param _persistent enable persistent mode
+	 */
+	NetstringServer(EventLoop &event_loop, UniqueSocketDescriptor _fd,
+			bool _persistent=false);
 	~NetstringServer();
 
 protected:
@@ -64,9 +129,34 @@ protected:
 		return fd;
 	}
 
+	/**
+	 * Send the response.  In persistent mode, this responds to
+	 * the oldest request which has no response yet.
+	 *
+	 * @return false if an error has occurred and
+	 * OnError() has been called
+	 */
 	bool SendResponse(const void *data, size_t size);
 	bool SendResponse(const char *data);
 
+	/**
+	 * Submit the response for the given request (persistent mode
+	 * only).  It is sent as soon as all previous responses have
+	 * been submitted.
+	 *
+	 * @return false if an error has occurred and
+	 * OnError() has been called
+	 */
+	bool SendResponse(RequestId id, const void *data, size_t size);
+
+	/**
+	 * A netstring has been received in persistent mode.  The
+	 * default implementation calls OnRequest(); override it to
+	 * handle requests concurrently.
+	 */
+	virtual void OnPipelinedRequest(RequestId id,
+					AllocatedArray<uint8_t> &&payload);
+
 	/**
 	 * A netstring has been received.
 	 *
@@ -78,5 +168,16 @@ protected:
 	virtual void OnDisconnect() = 0;
 
 private:
+	/**
+	 * Write all ready responses (persistent mode only).
+	 *
+	 * Throws on error.
+	 */
+	void Flush();
+
+	void ScheduleRead();
+
 	void OnEvent(unsigned events);
+	void OnDeferredRead();
+	void OnWriteReady(unsigned events);
 };
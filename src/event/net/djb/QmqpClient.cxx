@@ -42,13 +42,38 @@ QmqpClient::AppendNetstring(StringView value)
 	request.emplace_back(",", 1);
 }
 
+void
+QmqpClient::Begin(int message_fd, off_t offset, size_t size,
+		  StringView sender)
+{
+	assert(netstring_headers.empty());
+	assert(request.empty());
+	assert(message_fd >= 0);
+
+	netstring_headers.emplace_front();
+	auto &g = netstring_headers.front();
+	head.emplace_back(g(size).ToVoid());
+
+	body_fd = message_fd;
+	body_offset = offset;
+	body_size = size;
+
+	request.emplace_back(",", 1);
+	AppendNetstring(sender);
+}
+
 void
 QmqpClient::Commit(int out_fd, int in_fd)
 {
 	assert(!netstring_headers.empty());
 	assert(!request.empty());
 
-	client.Request(out_fd, in_fd, std::move(request));
+	if (body_fd >= 0)
+		client.Request(out_fd, in_fd, std::move(head),
+			       body_fd, body_offset, body_size,
+			       std::move(request));
+	else
+		client.Request(out_fd, in_fd, std::move(request));
 }
 
 void
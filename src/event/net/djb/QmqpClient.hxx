@@ -77,8 +77,19 @@ class QmqpClient final : NetstringClientHandler {
 	NetstringClient client;
 
 	std::forward_list<NetstringHeader> netstring_headers;
+
+	/**
+	 * The request data before the message body file (only used
+	 * if #body_fd is set).
+	 */
+	std::list<ConstBuffer<void>> head;
+
 	std::list<ConstBuffer<void>> request;
 
+	int body_fd = -1;
+	off_t body_offset;
+	size_t body_size;
+
 	QmqpClientHandler &handler;
 
 public:
@@ -94,6 +105,19 @@ public:
 		AppendNetstring(sender);
 	}
 
+	/**
+	 * Like Begin(), but the message is streamed from a file with
+	 * sendfile() instead of being copied from memory.
+	 *
+	 * @param message_fd a file descriptor which supports
+	 * sendfile(); it is not closed, and it must remain valid
+	 * until the #QmqpClientHandler has been invoked
+	 * @param offset the file offset where the message starts
+	 * @param size the size of the message in bytes
+	 */
+	void Begin(int message_fd, off_t offset, size_t size,
+		   StringView sender);
+
 	void AddRecipient(StringView recipient) {
 		assert(!netstring_headers.empty());
 		assert(!request.empty());
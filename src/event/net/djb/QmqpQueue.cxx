@@ -0,0 +1,189 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "QmqpQueue.hxx"
+#include "QmqpClient.hxx"
+#include "event/net/ConnectSocket.hxx"
+#include "util/DeleteDisposer.hxx"
+
+#include <assert.h>
+
+class QmqpQueue::Transfer final
+	: public TransferHook,
+	  ConnectSocketHandler, QmqpClientHandler {
+
+	QmqpQueue &queue;
+
+	/**
+	 * Contains exactly one item; a std::list allows moving it
+	 * here from QmqpQueue::queue with splice().
+	 */
+	std::list<Mail> mail;
+
+	ConnectSocket connect;
+
+	QmqpClient client;
+
+public:
+	Transfer(QmqpQueue &_queue, std::list<Mail> &&_mail)
+		:queue(_queue), mail(std::move(_mail)),
+		 connect(queue.event_loop, *this),
+		 client(queue.event_loop, *this) {
+		assert(mail.size() == 1);
+	}
+
+	/**
+	 * Start connecting.  This may finish (and destroy this
+	 * object) synchronously.
+	 */
+	void Start() {
+		connect.Connect(queue.address);
+	}
+
+private:
+	Mail &GetMail() {
+		return mail.front();
+	}
+
+	void Finish() {
+		queue.OnTransferFinished(*this);
+	}
+
+	/* virtual methods from ConnectSocketHandler */
+	void OnSocketConnectSuccess(UniqueSocketDescriptor &&fd) override {
+		auto &m = GetMail();
+
+		if (m.message_fd.IsDefined())
+			client.Begin(m.message_fd.Get(), m.message_offset,
+				     m.message_size,
+				     {m.sender.data(), m.sender.size()});
+		else
+			client.Begin({m.message.data(), m.message.size()},
+				     {m.sender.data(), m.sender.size()});
+
+		for (const auto &i : m.recipients)
+			client.AddRecipient({i.data(), i.size()});
+
+		/* QmqpClient takes over ownership */
+		const int s = fd.Steal();
+		client.Commit(s, s);
+	}
+
+	void OnSocketConnectError(std::exception_ptr ep) override {
+		GetMail().handler.OnQmqpClientError(ep);
+		Finish();
+	}
+
+	/* virtual methods from QmqpClientHandler */
+	void OnQmqpClientSuccess(StringView description) override {
+		GetMail().handler.OnQmqpClientSuccess(description);
+		Finish();
+	}
+
+	void OnQmqpClientError(std::exception_ptr error) override {
+		GetMail().handler.OnQmqpClientError(error);
+		Finish();
+	}
+};
+
+QmqpQueue::QmqpQueue(EventLoop &_event_loop, SocketAddress _address,
+		     unsigned _max_connections)
+	:event_loop(_event_loop), address(_address),
+	 max_connections(_max_connections),
+	 defer_start(event_loop, BIND_THIS_METHOD(StartTransfers))
+{
+	assert(max_connections > 0);
+}
+
+QmqpQueue::~QmqpQueue()
+{
+	defer_start.Cancel();
+	transfers.clear_and_dispose(DeleteDisposer());
+}
+
+void
+QmqpQueue::Submit(std::string message, std::string sender,
+		  std::vector<std::string> recipients,
+		  QmqpClientHandler &handler)
+{
+	queue.emplace_back(std::move(sender), std::move(recipients),
+			   handler);
+	queue.back().message = std::move(message);
+
+	defer_start.Schedule();
+}
+
+void
+QmqpQueue::Submit(UniqueFileDescriptor message_fd,
+		  off_t offset, size_t size,
+		  std::string sender,
+		  std::vector<std::string> recipients,
+		  QmqpClientHandler &handler)
+{
+	assert(message_fd.IsDefined());
+
+	queue.emplace_back(std::move(sender), std::move(recipients),
+			   handler);
+	auto &mail = queue.back();
+	mail.message_fd = std::move(message_fd);
+	mail.message_offset = offset;
+	mail.message_size = size;
+
+	defer_start.Schedule();
+}
+
+void
+QmqpQueue::StartTransfers() noexcept
+{
+	while (!queue.empty() && transfers.size() < max_connections) {
+		std::list<Mail> mail;
+		mail.splice(mail.begin(), queue, queue.begin());
+
+		auto *transfer = new Transfer(*this, std::move(mail));
+		transfers.push_back(*transfer);
+
+		/* this may destroy the Transfer synchronously; each
+		   completion schedules #defer_start instead of
+		   recursing into this method */
+		transfer->Start();
+	}
+}
+
+void
+QmqpQueue::OnTransferFinished(Transfer &transfer) noexcept
+{
+	transfers.erase_and_dispose(transfers.iterator_to(transfer),
+				    DeleteDisposer());
+
+	if (!queue.empty())
+		defer_start.Schedule();
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/DeferEvent.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+class QmqpClientHandler;
+
+/**
+ * A front-end for #QmqpClient which queues outgoing emails and
+ * submits them to one QMQP server over a bounded number of
+ * concurrent connections.
+ *
+ * QMQP allows only one message per connection (the server closes it
+ * after sending the response), so connections cannot be reused;
+ * instead, this class keeps up to #max_connections transfers busy,
+ * and as soon as one finishes, the next queued email gets a new
+ * connection.
+ */
+class QmqpQueue final {
+	struct Mail {
+		/**
+		 * The message (if #message_fd is not set).
+		 */
+		std::string message;
+
+		/**
+		 * If set, then the message is streamed from this file
+		 * with sendfile().
+		 */
+		UniqueFileDescriptor message_fd;
+		off_t message_offset = 0;
+		size_t message_size = 0;
+
+		std::string sender;
+		std::vector<std::string> recipients;
+
+		QmqpClientHandler &handler;
+
+		Mail(std::string &&_sender,
+		     std::vector<std::string> &&_recipients,
+		     QmqpClientHandler &_handler) noexcept
+			:sender(std::move(_sender)),
+			 recipients(std::move(_recipients)),
+			 handler(_handler) {}
+	};
+
+	class Transfer;
+	typedef boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> TransferHook;
+
+	EventLoop &event_loop;
+
+	const AllocatedSocketAddress address;
+
+	const unsigned max_connections;
+
+	/**
+	 * Emails waiting for a connection.
+	 */
+	std::list<Mail> queue;
+
+	boost::intrusive::list<Transfer,
+			       boost::intrusive::base_hook<TransferHook>,
+			       boost::intrusive::constant_time_size<true>> transfers;
+
+	/**
+	 * Starts new transfers outside of the caller's stack frame.
+	 */
+	DeferEvent defer_start;
+
+public:
+	QmqpQueue(EventLoop &_event_loop, SocketAddress _address,
+		  unsigned _max_connections=8);
+
+	/**
+	 * Aborts all pending transfers without invoking their
+	 * handlers.
+	 */
+	~QmqpQueue();
+
+	QmqpQueue(const QmqpQueue &) = delete;
+	QmqpQueue &operator=(const QmqpQueue &) = delete;
+
+	size_t GetQueueLength() const noexcept {
+		return queue.size();
+	}
+
+	size_t GetActiveCount() const noexcept {
+		return transfers.size();
+	}
+
+	bool IsIdle() const noexcept {
+		return queue.empty() && transfers.empty();
+	}
+
+	/**
+	 * Queue an email.  Exactly one #QmqpClientHandler method
+	 * will be invoked when it has been delivered (or when
+	 * delivery has failed).
+	 */
+	void Submit(std::string message, std::string sender,
+		    std::vector<std::string> recipients,
+		    QmqpClientHandler &handler);
+
+	/**
+	 * Like Submit(), but the message is streamed from a file
+	 * with sendfile() instead of being held in memory.
+	 *
+	 * @param message_fd a file descriptor which supports
+	 * sendfile() (e.g. a regular file); it is closed by this
+	 * object after the transfer
+	 * @param offset the file offset where the message starts
+	 * @param size the size of the message in bytes
+	 */
+	void Submit(UniqueFileDescriptor message_fd,
+		    off_t offset, size_t size,
+		    std::string sender,
+		    std::vector<std::string> recipients,
+		    QmqpClientHandler &handler);
+
+private:
+	void StartTransfers() noexcept;
+
+	/**
+	 * Called by the #Transfer when it is done; it gets destroyed
+	 * by this method.
+	 */
+	void OnTransferFinished(Transfer &transfer) noexcept;
+};
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BatchSender.hxx"
+#include "net/log/Serializer.hxx"
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+
+namespace Net {
+namespace Log {
+
+BatchSender::BatchSender(EventLoop &event_loop, SocketDescriptor _socket,
+			 size_t _max_datagrams, size_t _buffer_size)
+	:socket(_socket),
+	 defer_flush(event_loop, BIND_THIS_METHOD(Flush),
+		     DeferEvent::Priority::IDLE),
+	 max_datagrams(_max_datagrams), buffer_size(_buffer_size),
+	 buffer(new uint8_t[buffer_size]),
+	 messages(new struct mmsghdr[max_datagrams]),
+	 vecs(new struct iovec[max_datagrams])
+{
+	memset(messages.get(), 0, sizeof(messages[0]) * max_datagrams);
+
+	for (size_t i = 0; i < max_datagrams; ++i) {
+		messages[i].msg_hdr.msg_iov = &vecs[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+BatchSender::~BatchSender() noexcept
+{
+	Flush();
+}
+
+inline bool
+BatchSender::TryQueue(const Datagram &d) noexcept
+{
+	if (n_datagrams >= max_datagrams)
+		return false;
+
+	uint8_t *p = buffer.get() + fill;
+	const size_t size = Serialize(p, buffer_size - fill, d);
+	if (size == 0)
+		return false;
+
+	vecs[n_datagrams] = { p, size };
+	++n_datagrams;
+	fill += size;
+	return true;
+}
+
+void
+BatchSender::Send(const Datagram &d) noexcept
+{
+	if (!TryQueue(d)) {
+		/* the buffer is full: flush it and try again */
+		Flush();
+
+		if (!TryQueue(d)) {
+			/* too large for the buffer */
+			++stats.dropped;
+			return;
+		}
+	}
+
+	++stats.queued;
+	defer_flush.Schedule();
+}
+
+void
+BatchSender::Flush() noexcept
+{
+	defer_flush.Cancel();
+
+	size_t i = 0;
+	while (i < n_datagrams) {
+		int n = sendmmsg(socket.Get(), &messages[i], n_datagrams - i,
+				 MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/* the socket is not writable or some other
+			   error: drop the rest */
+			stats.dropped += n_datagrams - i;
+			break;
+		}
+
+		stats.sent += n;
+		i += n;
+	}
+
+	n_datagrams = 0;
+	fill = 0;
+}
+
+}}
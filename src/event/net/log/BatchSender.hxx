@@ -0,0 +1,133 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/DeferEvent.hxx"
+#include "net/SocketDescriptor.hxx"
+
+#include <memory>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct mmsghdr;
+struct iovec;
+
+namespace Net {
+namespace Log {
+
+struct Datagram;
+
+/**
+ * Serializes log datagrams into a contiguous buffer and sends all of
+ * them with one sendmmsg() call at the end of the current event loop
+ * iteration.  Datagrams which cannot be sent (because the buffer
+ * overflows or the socket is not writable) are dropped and counted.
+ */
+class BatchSender {
+	SocketDescriptor socket;
+
+	DeferEvent defer_flush;
+
+	const size_t max_datagrams, buffer_size;
+
+	const std::unique_ptr<uint8_t[]> buffer;
+	const std::unique_ptr<struct mmsghdr[]> messages;
+	const std::unique_ptr<struct iovec[]> vecs;
+
+	size_t n_datagrams = 0, fill = 0;
+
+public:
+	struct Stats {
+		/**
+		 * The number of datagrams passed to Send() which were
+		 * serialized into the buffer.
+		 */
+		uint64_t queued = 0;
+
+		/**
+		 * The number of datagrams which were passed to the
+		 * kernel.
+		 */
+		uint64_t sent = 0;
+
+		/**
+		 * The number of datagrams which were dropped, either
+		 * because they did not fit into the buffer or because
+		 * sendmmsg() failed.
+		 */
+		uint64_t dropped = 0;
+	};
+
+private:
+	Stats stats;
+
+public:
+	/**
+	 * @param _socket a connected datagram socket (owned by
+	 * caller)
+	 * @param _max_datagrams the maximum number of datagrams per
+	 * sendmmsg() call
+	 * @param _buffer_size the size of the serialization buffer
+	 */
+	BatchSender(EventLoop &event_loop, SocketDescriptor _socket,
+		    size_t _max_datagrams=64, size_t _buffer_size=65536);
+
+	/**
+	 * Flushes pending datagrams.
+	 */
+	~BatchSender() noexcept;
+
+	BatchSender(const BatchSender &) = delete;
+	BatchSender &operator=(const BatchSender &) = delete;
+
+	const Stats &GetStats() const noexcept {
+		return stats;
+	}
+
+	/**
+	 * Queue a datagram.  It is serialized immediately, so the
+	 * #Datagram and its strings need not remain valid.
+	 */
+	void Send(const Datagram &d) noexcept;
+
+	/**
+	 * Send all queued datagrams now.
+	 */
+	void Flush() noexcept;
+
+private:
+	bool TryQueue(const Datagram &d) noexcept;
+};
+
+}}
@@ -32,29 +32,126 @@
 
 #include "PipeAdapter.hxx"
 #include "net/log/Send.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Crc.hxx"
+#include "event/Loop.hxx"
+#include "util/ByteOrder.hxx"
+#include "util/Macros.hxx"
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
 
 namespace Net {
 namespace Log {
 
+void
+PipeAdapter::SendBatch() noexcept
+{
+	if (batch.empty())
+		return;
+
+	datagram.SetTimestamp(GetEventLoop().SystemNow());
+	datagram.message = nullptr;
+
+	/* the attributes surrounding the message are the same for
+	   all lines, so they are serialized only once */
+
+	uint8_t prefix[4096], suffix[256];
+	const size_t prefix_size = SerializeMessagePrefix(prefix, sizeof(prefix),
+							  datagram);
+	const size_t suffix_size = SerializeMessageSuffix(suffix, sizeof(suffix),
+							  datagram);
+	if (prefix_size == 0 || suffix_size == 0) {
+		batch.clear();
+		return;
+	}
+
+	Crc prefix_crc;
+	prefix_crc.reset();
+	prefix_crc.process_bytes(prefix + sizeof(uint32_t),
+				 prefix_size - sizeof(uint32_t));
+
+	struct mmsghdr messages[MAX_BATCH];
+	struct iovec vecs[MAX_BATCH][4];
+	uint32_t crcs[MAX_BATCH];
+
+	memset(messages, 0, sizeof(messages[0]) * batch.size());
+
+	for (size_t i = 0; i < batch.size(); ++i) {
+		const StringView line = batch[i];
+
+		Crc crc = prefix_crc;
+		crc.process_bytes(line.data, line.size);
+		crc.process_bytes(suffix, suffix_size);
+		crcs[i] = ToBE32(crc.checksum());
+
+		auto &v = vecs[i];
+		v[0] = { prefix, prefix_size };
+		v[1] = { const_cast<char *>(line.data), line.size };
+		v[2] = { suffix, suffix_size };
+		v[3] = { &crcs[i], sizeof(crcs[i]) };
+
+		messages[i].msg_hdr.msg_iov = v;
+		messages[i].msg_hdr.msg_iovlen = ARRAY_SIZE(v);
+	}
+
+	size_t i = 0;
+	while (i < batch.size()) {
+		int n = sendmmsg(socket.Get(), &messages[i], batch.size() - i,
+				 MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/* this datagram has failed (e.g. because it is
+			   too large); skip it, but send the others */
+			++n_dropped;
+			++i;
+			continue;
+		}
+
+		i += n;
+	}
+
+	batch.clear();
+}
+
 bool
 PipeAdapter::OnLine(WritableBuffer<char> line) noexcept
 {
-	if (line.IsNull())
+	if (line.IsNull()) {
+		SendBatch();
 		return true;
+	}
 
 	// TODO: erase/quote "dangerous" characters?
 
-	datagram.SetTimestamp(std::chrono::system_clock::now());
+	if (batch_mode) {
+		if (batch.full())
+			SendBatch();
+
+		batch.push_back({line.data, line.size});
+		return true;
+	}
+
+	datagram.SetTimestamp(GetEventLoop().SystemNow());
 
 	datagram.message = {line.data, line.size};
 
 	try {
 		Send(socket, datagram);
 	} catch (...) {
-		// TODO: log this error?
+		++n_dropped;
 	}
 
 	return true;
 }
 
+void
+PipeAdapter::OnLinesEnd() noexcept
+{
+	SendBatch();
+}
+
 }}
@@ -35,6 +35,8 @@
 #include "net/SocketDescriptor.hxx"
 #include "net/log/Datagram.hxx"
 #include "event/PipeLineReader.hxx"
+#include "util/StaticArray.hxx"
+#include "util/StringView.hxx"
 
 namespace Net {
 namespace Log {
@@ -45,6 +47,11 @@ namespace Log {
  *
  * If the pipe ends or fails, there is no callback/notification.  This
  * class just unregisters the event and stops operating.
+ *
+ * In batch mode (see EnableBatch()), all lines obtained by one read()
+ * are sent with one sendmmsg() call, and the datagrams are assembled
+ * with scatter/gather I/O, referring to the lines in the
+ * #PipeLineReader buffer instead of copying them.
  */
 class PipeAdapter {
 	PipeLineReader line_reader;
@@ -53,6 +60,21 @@ class PipeAdapter {
 
 	Datagram datagram;
 
+	static constexpr size_t MAX_BATCH = 64;
+
+	/**
+	 * Lines collected in batch mode, pointing into the
+	 * #PipeLineReader buffer.
+	 */
+	StaticArray<StringView, MAX_BATCH> batch;
+
+	/**
+	 * The number of lines which could not be sent.
+	 */
+	size_t n_dropped = 0;
+
+	bool batch_mode = false;
+
 public:
 	/**
 	 * @param _pipe the pipe this class will read lines from
@@ -62,7 +84,8 @@ public:
 	PipeAdapter(EventLoop &event_loop, UniqueFileDescriptor _pipe,
 		    SocketDescriptor _socket) noexcept
 		:line_reader(event_loop, std::move(_pipe),
-			     BIND_THIS_METHOD(OnLine)),
+			     BIND_THIS_METHOD(OnLine),
+			     BIND_THIS_METHOD(OnLinesEnd)),
 		 socket(_socket) {
 		datagram.valid_timestamp = true;
 	}
@@ -81,12 +104,32 @@ public:
 		return datagram;
 	}
 
+	/**
+	 * Enable batch mode.  This requires that #Datagram::message
+	 * is the only string which varies from line to line; all
+	 * other attributes are serialized once per batch.
+	 */
+	void EnableBatch() noexcept {
+		batch_mode = true;
+	}
+
+	/**
+	 * Returns the number of lines which have been discarded
+	 * because sending them failed.
+	 */
+	size_t GetDroppedLines() const noexcept {
+		return n_dropped;
+	}
+
 	void Flush() noexcept {
 		line_reader.Flush();
 	}
 
 private:
+	void SendBatch() noexcept;
+
 	bool OnLine(WritableBuffer<char> line) noexcept;
+	void OnLinesEnd() noexcept;
 };
 
 }}
@@ -0,0 +1,337 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ReceiverPipeline.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/log/Parser.hxx"
+#include "net/SocketAddress.hxx"
+#include "system/Error.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/Macros.hxx"
+
+#include <chrono>
+#include <new>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+namespace Net {
+namespace Log {
+
+/**
+ * A parsed datagram, shared by all stages.  The raw datagram is
+ * stored after the object in the same allocation, and the #Datagram
+ * points into it.
+ */
+class ReceiverPipeline::Record {
+	std::atomic_uint refs;
+
+public:
+	const size_t size;
+
+	Datagram datagram;
+
+private:
+	Record(unsigned _refs, size_t _size) noexcept
+		:refs(_refs), size(_size) {}
+
+	~Record() noexcept = default;
+
+public:
+	/**
+	 * Throws #ProtocolError if the datagram is malformed.
+	 */
+	static Record *Create(unsigned refs, const void *data, size_t size) {
+		void *p = malloc(sizeof(Record) + size);
+		if (p == nullptr)
+			throw std::bad_alloc();
+
+		auto *record = new(p) Record(refs, size);
+		memcpy(record->GetRaw(), data, size);
+
+		try {
+			record->datagram = ParseDatagram(record->GetRaw(),
+							 (const uint8_t *)record->GetRaw() + size);
+		} catch (...) {
+			record->~Record();
+			free(p);
+			throw;
+		}
+
+		return record;
+	}
+
+	void *GetRaw() noexcept {
+		return this + 1;
+	}
+
+	void Unref() noexcept {
+		if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			this->~Record();
+			free(this);
+		}
+	}
+};
+
+void
+ReceiverPipeline::Stage::Start()
+{
+	running.store(true);
+	thread = std::thread(&Stage::Run, this);
+}
+
+void
+ReceiverPipeline::Stage::Stop() noexcept
+{
+	if (!thread.joinable())
+		return;
+
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+		running.store(false);
+		cond.notify_one();
+	}
+
+	thread.join();
+}
+
+bool
+ReceiverPipeline::Stage::Push(Record *record) noexcept
+{
+	if (!queue.Push(record)) {
+		++dropped;
+		return false;
+	}
+
+	/* pairs with the fence in Run(): either we see "waiting", or
+	   the consumer sees the new record */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (waiting.load(std::memory_order_relaxed)) {
+		const std::lock_guard<std::mutex> lock(mutex);
+		cond.notify_one();
+	}
+
+	return true;
+}
+
+inline void
+ReceiverPipeline::Stage::Handle(Record *record) noexcept
+{
+	consumer.OnLogRecord(record->datagram,
+			     {record->GetRaw(), record->size});
+	record->Unref();
+}
+
+void
+ReceiverPipeline::Stage::Run() noexcept
+{
+	Record *batch[64];
+
+	while (true) {
+		const size_t n = queue.PopBatch(batch, ARRAY_SIZE(batch));
+		if (n > 0) {
+			for (size_t i = 0; i < n; ++i)
+				Handle(batch[i]);
+			continue;
+		}
+
+		consumer.OnLogIdle();
+
+		std::unique_lock<std::mutex> lock(mutex);
+		waiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		Record *record;
+		if (queue.Pop(record)) {
+			waiting.store(false, std::memory_order_relaxed);
+			lock.unlock();
+			Handle(record);
+			continue;
+		}
+
+		if (!running.load())
+			break;
+
+		/* the timeout is just a safety net */
+		cond.wait_for(lock, std::chrono::seconds(1));
+		waiting.store(false, std::memory_order_relaxed);
+	}
+
+	waiting.store(false, std::memory_order_relaxed);
+}
+
+ReceiverPipeline::Receiver::Receiver(ReceiverPipeline &_pipeline,
+				     UniqueSocketDescriptor &&socket)
+	:pipeline(_pipeline),
+	 listener(thread.GetEventLoop(), std::move(socket),
+		  MultiReceiveMessage(64, 65536),
+		  *this) {}
+
+bool
+ReceiverPipeline::Receiver::OnUdpDatagram(const void *data, size_t length,
+					  SocketAddress, int)
+{
+	if (data != nullptr)
+		pipeline.Dispatch(data, length);
+	return true;
+}
+
+void
+ReceiverPipeline::Receiver::OnUdpError(std::exception_ptr) noexcept
+{
+	++pipeline.n_errors;
+	listener.Disable();
+}
+
+ReceiverPipeline::~ReceiverPipeline() noexcept
+{
+	Stop();
+}
+
+void
+ReceiverPipeline::AddConsumer(PipelineConsumer &consumer) noexcept
+{
+	stages.emplace_front(consumer);
+	++n_stages;
+}
+
+StaticSocketAddress
+ReceiverPipeline::Listen(SocketAddress address, unsigned n_threads,
+			 bool steer_by_cpu)
+{
+	assert(n_threads > 0);
+
+	StaticSocketAddress bound;
+	bound = address;
+
+	/* the first socket in the SO_REUSEPORT group */
+	SocketDescriptor first;
+
+	auto last = receivers.before_begin();
+	for (auto i = std::next(last); i != receivers.end(); ++i)
+		last = i;
+
+	for (unsigned i = 0; i < n_threads; ++i) {
+		UniqueSocketDescriptor s;
+		if (!s.CreateNonBlock(bound.GetFamily(), SOCK_DGRAM, 0))
+			throw MakeErrno("Failed to create socket");
+
+		if (!s.SetReuseAddress() || !s.SetReusePort())
+			throw MakeErrno("Failed to set SO_REUSEPORT");
+
+		if (!s.Bind(bound))
+			throw MakeErrno("Failed to bind");
+
+		if (i == 0) {
+			/* use the kernel-assigned port for the other
+			   sockets */
+			bound = s.GetLocalAddress();
+			first = s;
+		}
+
+		last = receivers.emplace_after(last, *this, std::move(s));
+	}
+
+	if (steer_by_cpu) {
+		if (!first.SetReusePortCpu(n_threads))
+			throw MakeErrno("Failed to attach SO_REUSEPORT program");
+
+		pin_cpu = true;
+	}
+
+	return bound;
+}
+
+void
+ReceiverPipeline::Start()
+{
+	/* start the consumers first, so the queues get drained as
+	   soon as the first datagram arrives */
+	for (auto &i : stages)
+		i.Start();
+
+	int cpu = 0;
+	for (auto &i : receivers)
+		i.Start(pin_cpu ? cpu++ : -1);
+}
+
+void
+ReceiverPipeline::Stop() noexcept
+{
+	for (auto &i : receivers)
+		i.Stop();
+
+	for (auto &i : stages)
+		i.Stop();
+}
+
+ReceiverPipeline::Stats
+ReceiverPipeline::GetStats() const noexcept
+{
+	Stats stats;
+	stats.received = n_received.load(std::memory_order_relaxed);
+	stats.malformed = n_malformed.load(std::memory_order_relaxed);
+	stats.errors = n_errors.load(std::memory_order_relaxed);
+	stats.dropped = 0;
+	for (const auto &i : stages)
+		stats.dropped += i.dropped.load(std::memory_order_relaxed);
+	return stats;
+}
+
+inline void
+ReceiverPipeline::Dispatch(const void *data, size_t length) noexcept
+{
+	n_received.fetch_add(1, std::memory_order_relaxed);
+
+	if (n_stages == 0)
+		return;
+
+	Record *record;
+	try {
+		record = Record::Create(n_stages, data, length);
+	} catch (const ProtocolError &) {
+		n_malformed.fetch_add(1, std::memory_order_relaxed);
+		return;
+	} catch (const std::bad_alloc &) {
+		n_errors.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	for (auto &i : stages)
+		if (!i.Push(record))
+			record->Unref();
+}
+
+}}
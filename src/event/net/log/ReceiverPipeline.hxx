@@ -0,0 +1,239 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/Thread.hxx"
+#include "event/net/MultiUdpListener.hxx"
+#include "event/net/UdpHandler.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "util/MPSCQueue.hxx"
+#include "util/Compiler.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <forward_list>
+#include <mutex>
+#include <thread>
+
+#include <stdint.h>
+
+class SocketAddress;
+template<typename T> struct ConstBuffer;
+
+namespace Net {
+namespace Log {
+
+struct Datagram;
+
+/**
+ * A consumer stage of a #ReceiverPipeline, e.g. a one-line writer,
+ * an archive writer or an aggregator.  Each consumer runs in its
+ * own thread and sees all records.
+ */
+class PipelineConsumer {
+public:
+	/**
+	 * A record has been received.  The #Datagram and the raw
+	 * buffer are only valid during this call.
+	 */
+	virtual void OnLogRecord(const Datagram &d,
+				 ConstBuffer<void> raw) noexcept = 0;
+
+	/**
+	 * The queue has been drained, and the thread is about to
+	 * sleep.  This is a good time to flush buffers.
+	 */
+	virtual void OnLogIdle() noexcept {}
+};
+
+/**
+ * A multi-threaded log server: several threads receive #Net::Log
+ * datagrams with #MultiUdpListener on SO_REUSEPORT sockets, parse
+ * them and pass them through lock-free queues to the consumer
+ * threads.  Records are dropped (and counted) if a consumer's queue
+ * is full.
+ */
+class ReceiverPipeline {
+	class Record;
+
+	static constexpr size_t QUEUE_SIZE = 4096;
+
+	class Stage {
+		PipelineConsumer &consumer;
+
+		MPSCQueue<Record *, QUEUE_SIZE> queue;
+
+		std::mutex mutex;
+		std::condition_variable cond;
+
+		/**
+		 * Is the consumer thread going to sleep (or sleeping)?
+		 * Producers notify #cond only if this is set.
+		 */
+		std::atomic_bool waiting{false};
+
+		std::atomic_bool running{false};
+
+		std::thread thread;
+
+	public:
+		std::atomic<uint64_t> dropped{0};
+
+		explicit Stage(PipelineConsumer &_consumer) noexcept
+			:consumer(_consumer) {}
+
+		~Stage() noexcept {
+			Stop();
+		}
+
+		void Start();
+		void Stop() noexcept;
+
+		/**
+		 * Called by a receiver thread.
+		 */
+		bool Push(Record *record) noexcept;
+
+	private:
+		void Run() noexcept;
+		void Handle(Record *record) noexcept;
+	};
+
+	class Receiver final : UdpHandler {
+		ReceiverPipeline &pipeline;
+
+		EventThread thread;
+		MultiUdpListener listener;
+
+	public:
+		Receiver(ReceiverPipeline &_pipeline,
+			 UniqueSocketDescriptor &&socket);
+
+		void Start(int cpu) {
+			thread.Start(cpu);
+		}
+
+		void Stop() noexcept {
+			thread.Stop();
+		}
+
+	private:
+		/* virtual methods from class UdpHandler */
+		bool OnUdpDatagram(const void *data, size_t length,
+				   SocketAddress address, int uid) override;
+		void OnUdpError(std::exception_ptr ep) noexcept override;
+	};
+
+	std::forward_list<Stage> stages;
+	unsigned n_stages = 0;
+
+	std::forward_list<Receiver> receivers;
+
+	bool pin_cpu = false;
+
+	std::atomic<uint64_t> n_received{0}, n_malformed{0}, n_errors{0};
+
+public:
+	struct Stats {
+		/**
+		 * The number of datagrams received.
+		 */
+		uint64_t received;
+
+		/**
+		 * The number of datagrams which failed to parse.
+		 */
+		uint64_t malformed;
+
+		/**
+		 * The sum of all records dropped by all stages
+		 * because their queues were full.
+		 */
+		uint64_t dropped;
+
+		/**
+		 * The number of receive errors (the affected receiver
+		 * is disabled) and allocation failures.
+		 */
+		uint64_t errors;
+	};
+
+	ReceiverPipeline() = default;
+	~ReceiverPipeline() noexcept;
+
+	ReceiverPipeline(const ReceiverPipeline &) = delete;
+	ReceiverPipeline &operator=(const ReceiverPipeline &) = delete;
+
+	/**
+	 * Add a consumer stage.  Must be called before Start().
+	 */
+	void AddConsumer(PipelineConsumer &consumer) noexcept;
+
+	/**
+	 * Create #n_threads SO_REUSEPORT sockets bound to the given
+	 * address, each with its own receiver thread.  Must be called
+	 * before Start().
+	 *
+	 * Throws on error.
+	 *
+	 * @param address the address to bind to; if its port is 0,
+	 * the first socket's port is used for all of them
+	 * @param steer_by_cpu distribute datagrams by the receiving
+	 * CPU (see SocketDescriptor::SetReusePortCpu()) and pin the
+	 * receiver threads to the respective CPUs
+	 * @return the bound address of the first socket
+	 */
+	StaticSocketAddress Listen(SocketAddress address, unsigned n_threads,
+				   bool steer_by_cpu=false);
+
+	/**
+	 * Start all threads.
+	 *
+	 * Throws on error.
+	 */
+	void Start();
+
+	/**
+	 * Stop all threads.  Records which are still queued are
+	 * passed to the consumers before their threads exit.
+	 */
+	void Stop() noexcept;
+
+	gcc_pure
+	Stats GetStats() const noexcept;
+
+private:
+	void Dispatch(const void *data, size_t length) noexcept;
+};
+
+}}
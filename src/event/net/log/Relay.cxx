@@ -0,0 +1,130 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Relay.hxx"
+#include "net/log/SharedRing.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/SocketAddress.hxx"
+#include "util/ConstBuffer.hxx"
+
+namespace Net {
+namespace Log {
+
+Relay::Relay(EventLoop &event_loop, UniqueSocketDescriptor socket,
+	     SharedRingWriter &_ring)
+	:ring(_ring),
+	 listener(event_loop, std::move(socket),
+		  MultiReceiveMessage(64, 65536),
+		  *this),
+	 wake_event(event_loop, BIND_THIS_METHOD(OnWake)),
+	 buffer(new uint8_t[BUFFER_SIZE]) {}
+
+void
+Relay::OnWake() noexcept
+{
+	ring.Wake();
+}
+
+CompactDecoder *
+Relay::GetDecoder(SocketAddress address) noexcept
+{
+	try {
+		std::string key((const char *)address.GetAddress(),
+				address.GetSize());
+
+		auto i = decoders.find(key);
+		if (i != decoders.end())
+			return &i->second;
+
+		if (decoders.size() >= MAX_DECODERS)
+			return nullptr;
+
+		return &decoders[std::move(key)];
+	} catch (const std::bad_alloc &) {
+		return nullptr;
+	}
+}
+
+bool
+Relay::OnUdpDatagram(const void *data, size_t length,
+		     SocketAddress address, int)
+{
+	if (data == nullptr)
+		return true;
+
+	++n_received;
+
+	ConstBuffer<void> record(data, length);
+
+	try {
+		bool compact;
+		const auto payload = GetDatagramPayload(record, true, compact);
+
+		if (compact) {
+			auto *decoder = !address.IsNull()
+				? GetDecoder(address)
+				: nullptr;
+			const auto d = CompactDecoder::ParseCompact(payload,
+								    decoder);
+
+			const size_t size = Serialize(buffer.get(),
+						      BUFFER_SIZE, d);
+			if (size == 0) {
+				++n_dropped;
+				return true;
+			}
+
+			record = {buffer.get(), size};
+		}
+	} catch (const ProtocolError &) {
+		++n_malformed;
+		return true;
+	}
+
+	if (!ring.Append(record)) {
+		++n_dropped;
+		return true;
+	}
+
+	wake_event.Schedule();
+	return true;
+}
+
+void
+Relay::OnUdpError(std::exception_ptr) noexcept
+{
+	++n_errors;
+	listener.Disable();
+}
+
+}}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/DeferEvent.hxx"
+#include "event/net/MultiUdpListener.hxx"
+#include "event/net/UdpHandler.hxx"
+#include "net/log/Parser.hxx"
+#include "util/Compiler.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <stdint.h>
+
+namespace Net {
+namespace Log {
+
+class SharedRingWriter;
+
+/**
+ * Receives #Net::Log datagrams once (with #MultiUdpListener) and
+ * publishes them into a #SharedRingWriter, so several local
+ * consumers (e.g. one-line writer, archiver, aggregator), each with
+ * its own #SharedRingReader, see the full stream without receiving
+ * it again.
+ *
+ * Malformed datagrams are dropped.  #MAGIC_V3 datagrams are decoded
+ * with a #CompactDecoder per sender address and republished as
+ * self-contained V2 datagrams, so consumers need no sender state and
+ * can use VisitDatagram().
+ */
+class Relay final : UdpHandler {
+	static constexpr size_t MAX_DECODERS = 1024;
+
+	SharedRingWriter &ring;
+
+	MultiUdpListener listener;
+
+	/**
+	 * Wakes up the consumers once after a batch of datagrams.
+	 */
+	DeferEvent wake_event;
+
+	/**
+	 * Per-sender state for compact datagrams, keyed by the raw
+	 * sender address.  If there are too many senders, the others
+	 * are parsed without state.
+	 */
+	std::map<std::string, CompactDecoder> decoders;
+
+	static constexpr size_t BUFFER_SIZE = 65536;
+
+	/**
+	 * A buffer for re-serializing compact datagrams.
+	 */
+	const std::unique_ptr<uint8_t[]> buffer;
+
+	uint64_t n_received = 0, n_malformed = 0, n_dropped = 0;
+	uint64_t n_errors = 0;
+
+public:
+	struct Stats {
+		/**
+		 * The number of datagrams received.
+		 */
+		uint64_t received;
+
+		/**
+		 * The number of datagrams which failed to parse.
+		 */
+		uint64_t malformed;
+
+		/**
+		 * The number of records which were too large for the
+		 * ring.
+		 */
+		uint64_t dropped;
+
+		/**
+		 * The number of receive errors (the listener is
+		 * disabled).
+		 */
+		uint64_t errors;
+	};
+
+	Relay(EventLoop &event_loop, UniqueSocketDescriptor socket,
+	      SharedRingWriter &_ring);
+
+	gcc_pure
+	Stats GetStats() const noexcept {
+		return {n_received, n_malformed, n_dropped, n_errors};
+	}
+
+private:
+	void OnWake() noexcept;
+
+	/**
+	 * @return the decoder or nullptr if there are too many
+	 * senders
+	 */
+	CompactDecoder *GetDecoder(SocketAddress address) noexcept;
+
+	/* virtual methods from class UdpHandler */
+	bool OnUdpDatagram(const void *data, size_t length,
+			   SocketAddress address, int uid) override;
+	void OnUdpError(std::exception_ptr ep) noexcept override;
+};
+
+}}
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "StreamSender.hxx"
+#include "net/log/StreamFrame.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <new>
+#include <stdexcept>
+
+#include <sys/uio.h>
+
+namespace Net {
+namespace Log {
+
+static constexpr size_t INITIAL_BUFFER_SIZE = 16384;
+
+StreamSender::StreamSender(EventLoop &event_loop,
+			   UniqueSocketDescriptor &&fd,
+			   StreamSenderHandler &_handler,
+			   size_t _max_queued)
+	:socket(event_loop), handler(_handler),
+	 max_queued(_max_queued),
+	 buffer(new uint8_t[INITIAL_BUFFER_SIZE]),
+	 buffer_size(INITIAL_BUFFER_SIZE)
+{
+	socket.Init(fd.Release(), FD_SOCKET, nullptr, nullptr, *this);
+
+	/* the peer is not supposed to send anything, but we want to
+	   notice when it closes the connection */
+	socket.ScheduleReadNoTimeout(false);
+}
+
+StreamSender::~StreamSender() noexcept
+{
+	if (socket.IsConnected())
+		socket.Close();
+	socket.Destroy();
+}
+
+inline size_t
+StreamSender::Serialize(const Datagram &d) noexcept
+{
+	while (true) {
+		size_t size = Net::Log::Serialize(buffer.get(), buffer_size, d);
+		if (size > 0)
+			return size;
+
+		if (buffer_size >= MAX_STREAM_FRAME_SIZE)
+			return 0;
+
+		/* out of memory is not fatal: the datagram is
+		   refused, and the old buffer remains usable */
+		const size_t new_size = buffer_size * 2;
+		uint8_t *new_buffer = new(std::nothrow) uint8_t[new_size];
+		if (new_buffer == nullptr)
+			return 0;
+
+		buffer.reset(new_buffer);
+		buffer_size = new_size;
+	}
+}
+
+bool
+StreamSender::Send(const Datagram &d) noexcept
+{
+	if (!IsReady()) {
+		blocked = true;
+		++stats.refused;
+		return false;
+	}
+
+	const size_t size = Serialize(d);
+	if (size == 0) {
+		++stats.refused;
+		return false;
+	}
+
+	const uint32_t header = MakeStreamFrameHeader(size);
+
+	struct iovec v[2];
+	v[0].iov_base = const_cast<uint32_t *>(&header);
+	v[0].iov_len = sizeof(header);
+	v[1].iov_base = buffer.get();
+	v[1].iov_len = size;
+
+	/* header and payload are queued all or nothing, so a failed
+	   allocation cannot leave an orphan length prefix which would
+	   break the framing of all following records */
+	try {
+		socket.EnqueueV(v, 2);
+	} catch (const std::bad_alloc &) {
+		++stats.refused;
+		return false;
+	}
+
+	++stats.queued;
+	return true;
+}
+
+BufferedResult
+StreamSender::OnBufferedData()
+{
+	/* ignore whatever the peer sends */
+	socket.Consumed(socket.GetAvailable());
+	return BufferedResult::OK;
+}
+
+bool
+StreamSender::OnBufferedClosed() noexcept
+{
+	socket.Close();
+	handler.OnLogStreamError(std::make_exception_ptr(std::runtime_error("Log server closed the connection")));
+	return false;
+}
+
+bool
+StreamSender::OnBufferedWrite()
+{
+	/* only the output queue needs the "write" event; see
+	   OnBufferedDrained() */
+	socket.UnscheduleWrite();
+	return true;
+}
+
+bool
+StreamSender::OnBufferedDrained() noexcept
+{
+	if (blocked) {
+		blocked = false;
+		handler.OnLogStreamReady();
+	}
+
+	return true;
+}
+
+void
+StreamSender::OnBufferedError(std::exception_ptr e) noexcept
+{
+	if (socket.IsConnected())
+		socket.Close();
+	handler.OnLogStreamError(e);
+}
+
+}}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/net/BufferedSocket.hxx"
+
+#include <exception>
+#include <memory>
+
+#include <stddef.h>
+#include <stdint.h>
+
+class UniqueSocketDescriptor;
+
+namespace Net {
+namespace Log {
+
+struct Datagram;
+
+class StreamSenderHandler {
+public:
+	/**
+	 * The output queue has been drained after Send() had refused
+	 * a datagram.  The producer may resume sending.
+	 */
+	virtual void OnLogStreamReady() noexcept = 0;
+
+	/**
+	 * The connection has failed or was closed by the peer.  No
+	 * more datagrams can be sent; the #StreamSender may be
+	 * destroyed.
+	 */
+	virtual void OnLogStreamError(std::exception_ptr e) noexcept = 0;
+};
+
+/**
+ * Sends log datagrams over a persistent SOCK_STREAM connection
+ * using the framing described in net/log/StreamFrame.hxx.  Unlike UDP, there is no size limit for
+ * #Datagram::message and nothing gets lost silently.
+ *
+ * Datagrams are serialized into the #BufferedSocket output queue and
+ * flushed in one batch at the end of the current event loop
+ * iteration.  If the peer cannot keep up and the queue grows beyond
+ * a limit, Send() refuses new datagrams until the queue has been
+ * drained, which is announced by
+ * StreamSenderHandler::OnLogStreamReady().
+ */
+class StreamSender final : BufferedSocketHandler {
+	BufferedSocket socket;
+
+	StreamSenderHandler &handler;
+
+	/**
+	 * Send() refuses datagrams while the output queue is at
+	 * least this large.
+	 */
+	const size_t max_queued;
+
+	/**
+	 * The serialization buffer; grows on demand (up to
+	 * #MAX_STREAM_FRAME_SIZE) for large datagrams.
+	 */
+	std::unique_ptr<uint8_t[]> buffer;
+	size_t buffer_size;
+
+	/**
+	 * Has Send() refused a datagram since the queue was drained
+	 * the last time?
+	 */
+	bool blocked = false;
+
+public:
+	struct Stats {
+		/**
+		 * The number of datagrams queued for sending.
+		 */
+		uint64_t queued = 0;
+
+		/**
+		 * The number of datagrams refused by Send().
+		 */
+		uint64_t refused = 0;
+	};
+
+private:
+	Stats stats;
+
+public:
+	/**
+	 * Throws std::bad_alloc on error.
+	 *
+	 * @param fd a connected SOCK_STREAM socket in non-blocking mode
+	 * @param _max_queued the maximum number of bytes in the
+	 * output queue (backpressure threshold)
+	 */
+	StreamSender(EventLoop &event_loop, UniqueSocketDescriptor &&fd,
+		     StreamSenderHandler &_handler,
+		     size_t _max_queued=1024 * 1024);
+
+	/**
+	 * Closes the connection; unsent data is discarded.
+	 */
+	~StreamSender() noexcept;
+
+	StreamSender(const StreamSender &) = delete;
+	StreamSender &operator=(const StreamSender &) = delete;
+
+	const Stats &GetStats() const noexcept {
+		return stats;
+	}
+
+	/**
+	 * Is the connection still alive, and will the next Send()
+	 * call accept a datagram?
+	 */
+	bool IsReady() const noexcept {
+		return socket.IsConnected() &&
+			socket.GetQueuedOutput() < max_queued;
+	}
+
+	/**
+	 * Queue a datagram.  It is serialized immediately, so the
+	 * #Datagram and its strings need not remain valid.
+	 *
+	 * @return false if the datagram was refused because the
+	 * output queue is full (StreamSenderHandler::OnLogStreamReady()
+	 * will be invoked later), because the connection has been
+	 * lost or because the datagram is too large (or there is not
+	 * enough memory to serialize it)
+	 */
+	bool Send(const Datagram &d) noexcept;
+
+private:
+	/**
+	 * Serialize the datagram into #buffer, growing it if
+	 * necessary.
+	 *
+	 * @return the serialized size, or 0 if the datagram is too
+	 * large or if the buffer could not be grown
+	 */
+	size_t Serialize(const Datagram &d) noexcept;
+
+	/* virtual methods from class BufferedSocketHandler */
+	BufferedResult OnBufferedData() override;
+	bool OnBufferedClosed() noexcept override;
+	bool OnBufferedWrite() override;
+	bool OnBufferedDrained() noexcept override;
+	void OnBufferedError(std::exception_ptr e) noexcept override;
+};
+
+}}
@@ -0,0 +1,534 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SocketFilter.hxx"
+#include "ssl/Error.hxx"
+#include "event/WorkerPool.hxx"
+#include "util/ForeignFifoBuffer.hxx"
+#include "util/Compiler.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/**
+ * The largest plain text which fits into one TLS record.
+ */
+static constexpr size_t MAX_RECORD = SSL3_RT_MAX_PLAIN_LENGTH;
+
+/**
+ * Worst-case size of one encrypted record including its header.
+ */
+static constexpr size_t MAX_ENCRYPTED_RECORD =
+	MAX_RECORD + SSL3_RT_HEADER_LENGTH + SSL3_RT_MAX_ENCRYPTED_OVERHEAD;
+
+/**
+ * Smaller #iovec chunks are gathered in the staging buffer; larger
+ * ones are passed to SSL_write() directly.
+ */
+static constexpr size_t GATHER_THRESHOLD = 4096;
+
+SslSocketFilter::SslSocketFilter(EventLoop &event_loop, UniqueSSL &&_ssl,
+				 WorkerPool *_worker_pool)
+	:ssl(std::move(_ssl)), worker_pool(_worker_pool),
+	 handshake_job(event_loop, *this)
+{
+	BIO *internal, *_network;
+	if (!BIO_new_bio_pair(&internal, BIO_BUFFER_SIZE,
+			      &_network, BIO_BUFFER_SIZE))
+		throw SslError("BIO_new_bio_pair() failed");
+
+	network.reset(_network);
+	SSL_set_bio(ssl.get(), internal, internal);
+
+	/* a record which SSL_write() did not accept is retried from
+	   the staging buffer, not from the caller's buffer */
+	SSL_set_mode(ssl.get(),
+		     SSL_MODE_ENABLE_PARTIAL_WRITE |
+		     SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+		     SSL_MODE_RELEASE_BUFFERS);
+
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	/* treat a missing "close_notify" like the end of the stream,
+	   just like OpenSSL 1.1 did */
+	SSL_set_options(ssl.get(), SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+}
+
+SslSocketFilter::~SslSocketFilter() noexcept
+{
+	if (job_pending)
+		worker_pool->Cancel(handshake_job);
+}
+
+inline void
+SslSocketFilter::CheckError()
+{
+	if (error)
+		std::rethrow_exception(std::exchange(error, nullptr));
+}
+
+ssize_t
+SslSocketFilter::Receive(SocketDescriptor s) noexcept
+{
+	size_t total = 0;
+
+	while (!peer_eof) {
+		char *p;
+		int n = BIO_nwrite0(network.get(), &p);
+		if (n <= 0)
+			/* the BIO pair is full */
+			break;
+
+		ssize_t nbytes = recv(s.Get(), p, n, MSG_DONTWAIT);
+		if (nbytes < 0) {
+			if (errno == EAGAIN)
+				break;
+
+			return -1;
+		}
+
+		if (nbytes == 0) {
+			peer_eof = true;
+			BIO_shutdown_wr(network.get());
+			break;
+		}
+
+		BIO_nwrite(network.get(), &p, nbytes);
+		total += nbytes;
+
+		if (nbytes < n)
+			break;
+	}
+
+	return total;
+}
+
+int
+SslSocketFilter::Push(SocketDescriptor s) noexcept
+{
+	while (true) {
+		char *p;
+		int n = BIO_nread0(network.get(), &p);
+		if (n <= 0)
+			return 1;
+
+		ssize_t nbytes = send(s.Get(), p, n,
+				      MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (nbytes < 0)
+			return errno == EAGAIN ? 0 : -1;
+
+		BIO_nread(network.get(), &p, nbytes);
+
+		if (nbytes < n)
+			return 0;
+	}
+}
+
+void
+SslSocketFilter::HandleHandshakeStep(int ret, int error_code)
+{
+	handshake_want_read = false;
+
+	if (ret == 1) {
+		handshake_done = true;
+		return;
+	}
+
+	switch (error_code) {
+	case SSL_ERROR_WANT_READ:
+		handshake_want_read = true;
+		break;
+
+	case SSL_ERROR_WANT_WRITE:
+		/* the BIO pair is full; Push() will make room */
+		break;
+
+	default:
+		throw SslError("SSL handshake failed");
+	}
+}
+
+bool
+SslSocketFilter::StepHandshake()
+{
+	assert(!handshake_done);
+	assert(!job_pending);
+
+	if (worker_pool != nullptr) {
+		job_pending = true;
+		handshake_job.Start(*worker_pool, *ssl);
+		return false;
+	}
+
+	ERR_clear_error();
+	int ret = SSL_do_handshake(ssl.get());
+	HandleHandshakeStep(ret, SSL_get_error(ssl.get(), ret));
+	return handshake_done;
+}
+
+ssize_t
+SslSocketFilter::Read(SocketDescriptor s, ForeignFifoBuffer<uint8_t> &buffer)
+{
+	CheckError();
+
+	if (job_pending) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	more_input = false;
+
+	if (!handshake_done) {
+		const ssize_t received = Receive(s);
+		if (received < 0)
+			return -1;
+
+		/* don't repeat a step which is still waiting for
+		   input */
+		const bool step = !handshake_want_read || received > 0 ||
+			peer_eof;
+		if (!step || !StepHandshake()) {
+			Push(s);
+
+			if (peer_eof && !job_pending)
+				/* the peer has given up */
+				return 0;
+
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+
+	size_t total = 0;
+	bool end = false;
+
+	while (true) {
+		auto w = buffer.Write();
+		if (w.empty()) {
+			more_input = true;
+			break;
+		}
+
+		ERR_clear_error();
+		int nbytes = SSL_read(ssl.get(), w.data,
+				      std::min<size_t>(w.size, INT_MAX));
+		if (nbytes > 0) {
+			buffer.Append(nbytes);
+			total += nbytes;
+			continue;
+		}
+
+		const int error_code = SSL_get_error(ssl.get(), nbytes);
+		if (error_code == SSL_ERROR_WANT_READ) {
+			if (peer_eof) {
+				end = true;
+				break;
+			}
+
+			const ssize_t received = Receive(s);
+			if (received > 0 || peer_eof)
+				continue;
+
+			if (received < 0 && total == 0)
+				return -1;
+
+			break;
+		} else if (error_code == SSL_ERROR_ZERO_RETURN) {
+			end = true;
+			break;
+		} else if (error_code == SSL_ERROR_WANT_WRITE) {
+			/* a post-handshake message is waiting to be
+			   sent */
+			break;
+		} else
+			throw SslError("SSL_read() failed");
+	}
+
+	/* send alerts, session tickets and key updates generated
+	   while reading; errors will be reported by the next
+	   WriteV() or Flush() call */
+	Push(s);
+
+	if (total > 0)
+		return total;
+
+	if (more_input)
+		return -2;
+
+	if (end)
+		return 0;
+
+	errno = EAGAIN;
+	return -1;
+}
+
+void
+SslSocketFilter::WriteRecord(const void *data, size_t length)
+{
+	assert(retry_length == 0);
+	assert(length > 0);
+	assert(length <= MAX_RECORD);
+
+	ERR_clear_error();
+	int nbytes = SSL_write(ssl.get(), data, length);
+	if (nbytes > 0) {
+		if (gcc_unlikely(size_t(nbytes) < length)) {
+			/* partial write (negotiated maximum fragment
+			   length): keep the rest for RetryWrite() */
+			retry_length = length - nbytes;
+			memmove(staging.get(),
+				(const uint8_t *)data + nbytes, retry_length);
+		}
+
+		return;
+	}
+
+	switch (SSL_get_error(ssl.get(), nbytes)) {
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		/* keep a copy of the record for RetryWrite(); the
+		   caller may consider it consumed */
+		if (data != staging.get())
+			memcpy(staging.get(), data, length);
+		retry_length = length;
+		break;
+
+	default:
+		throw SslError("SSL_write() failed");
+	}
+}
+
+bool
+SslSocketFilter::RetryWrite()
+{
+	assert(retry_length > 0);
+
+	ERR_clear_error();
+	int nbytes = SSL_write(ssl.get(), staging.get(), retry_length);
+	if (nbytes > 0) {
+		retry_length -= nbytes;
+		if (retry_length > 0)
+			memmove(staging.get(), staging.get() + nbytes,
+				retry_length);
+		return retry_length == 0;
+	}
+
+	switch (SSL_get_error(ssl.get(), nbytes)) {
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		return false;
+
+	default:
+		throw SslError("SSL_write() failed");
+	}
+}
+
+ssize_t
+SslSocketFilter::WriteV(SocketDescriptor s, const struct iovec *v, size_t n)
+{
+	CheckError();
+
+	if (job_pending) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	int result = Flush(s);
+	if (result <= 0) {
+		if (result == 0)
+			errno = EAGAIN;
+		return -1;
+	}
+
+	if (!handshake_done) {
+		if (handshake_want_read || !StepHandshake()) {
+			if (Push(s) < 0)
+				return -1;
+
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+
+	if (!staging)
+		staging.reset(new uint8_t[MAX_RECORD]);
+
+	BIO *const internal = SSL_get_wbio(ssl.get());
+
+	size_t consumed = 0;
+	size_t i = 0, offset = 0;
+
+	while (i < n) {
+		if (BIO_ctrl_get_write_guarantee(internal) < MAX_ENCRYPTED_RECORD)
+			break;
+
+		const uint8_t *base = (const uint8_t *)v[i].iov_base;
+		const size_t remaining = v[i].iov_len - offset;
+		if (remaining == 0) {
+			++i;
+			offset = 0;
+			continue;
+		}
+
+		size_t length;
+		if (remaining >= GATHER_THRESHOLD) {
+			/* large chunk: encrypt it directly from the
+			   caller's buffer */
+			length = std::min(remaining, MAX_RECORD);
+			WriteRecord(base + offset, length);
+
+			offset += length;
+			if (offset == v[i].iov_len) {
+				++i;
+				offset = 0;
+			}
+		} else {
+			/* gather small chunks into one record */
+			length = 0;
+			while (i < n && length < MAX_RECORD) {
+				const size_t chunk =
+					std::min(v[i].iov_len - offset,
+						 MAX_RECORD - length);
+				memcpy(staging.get() + length,
+				       (const uint8_t *)v[i].iov_base + offset,
+				       chunk);
+				length += chunk;
+				offset += chunk;
+
+				if (offset == v[i].iov_len) {
+					++i;
+					offset = 0;
+				}
+			}
+
+			WriteRecord(staging.get(), length);
+		}
+
+		consumed += length;
+
+		if (retry_length > 0)
+			break;
+
+		result = Push(s);
+		if (result < 0) {
+			if (consumed > 0)
+				/* report the error on the next call */
+				break;
+
+			return -1;
+		}
+
+		if (result == 0)
+			/* the socket is full */
+			break;
+	}
+
+	if (consumed == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return consumed;
+}
+
+int
+SslSocketFilter::Flush(SocketDescriptor s)
+{
+	CheckError();
+
+	if (job_pending)
+		return 0;
+
+	int result = Push(s);
+	if (result <= 0 || retry_length == 0)
+		return result;
+
+	if (!RetryWrite())
+		return 0;
+
+	return Push(s);
+}
+
+void
+SslSocketFilter::Shutdown(SocketDescriptor s) noexcept
+{
+	if (!handshake_done || job_pending)
+		return;
+
+	ERR_clear_error();
+	SSL_shutdown(ssl.get());
+	ERR_clear_error();
+
+	Push(s);
+}
+
+bool
+SslSocketFilter::HasBufferedInput() const noexcept
+{
+	/* the SSL object belongs to the worker thread while the job
+	   is pending */
+	return !job_pending &&
+		(more_input || SSL_pending(ssl.get()) > 0);
+}
+
+size_t
+SslSocketFilter::GetPendingOutput() const noexcept
+{
+	size_t result = retry_length;
+	if (!job_pending)
+		result += BIO_ctrl_pending(network.get());
+	return result;
+}
+
+void
+SslSocketFilter::OnSslHandshakeStep(int ret, int error_code) noexcept
+{
+	assert(job_pending);
+
+	job_pending = false;
+
+	try {
+		HandleHandshakeStep(ret, error_code);
+	} catch (...) {
+		error = std::current_exception();
+	}
+
+	if (handler != nullptr)
+		handler->OnSocketFilterReady();
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/net/SocketFilter.hxx"
+#include "ssl/Unique.hxx"
+#include "ssl/HandshakeJob.hxx"
+
+#include <exception>
+#include <memory>
+
+class EventLoop;
+class WorkerPool;
+
+/**
+ * A #SocketFilter which implements TLS with OpenSSL.  The SSL object
+ * is connected to a BIO pair; ciphertext is received directly into
+ * and sent directly from the BIO pair's ring buffer, and SSL_read()
+ * decrypts directly into the #BufferedSocket input buffer, so there
+ * is no additional copy in either direction.
+ *
+ * Small writes are gathered into full TLS records.
+ *
+ * If a #WorkerPool is given, the handshake (which is dominated by
+ * public key operations) runs in a worker thread; encryption and
+ * decryption of records always happen in the #EventLoop thread.
+ */
+class SslSocketFilter final : public SocketFilter, SslHandshakeHandler {
+	/**
+	 * The size of each direction of the BIO pair.
+	 */
+	static constexpr size_t BIO_BUFFER_SIZE = 32768;
+
+	UniqueSSL ssl;
+
+	/**
+	 * Our half of the BIO pair; the other one is owned by #ssl.
+	 */
+	UniqueBIO network;
+
+	WorkerPool *const worker_pool;
+
+	SslHandshakeJob handshake_job;
+
+	SocketFilterHandler *handler = nullptr;
+
+	/**
+	 * An error which occurred in the worker thread; it is
+	 * rethrown by the next Read(), WriteV() or Flush() call.
+	 */
+	std::exception_ptr error;
+
+	/**
+	 * Plain text which is gathered into one record.  If
+	 * #retry_length is non-zero, it contains a record which
+	 * SSL_write() could not accept yet.
+	 */
+	std::unique_ptr<uint8_t[]> staging;
+
+	size_t retry_length = 0;
+
+	bool handshake_done = false;
+
+	/**
+	 * Did the last handshake step need more input?
+	 */
+	bool handshake_want_read = false;
+
+	bool job_pending = false;
+
+	/**
+	 * Has the peer closed its side of the socket?
+	 */
+	bool peer_eof = false;
+
+	/**
+	 * Was Read() stopped because the destination buffer was
+	 * full?
+	 */
+	bool more_input = false;
+
+public:
+	/**
+	 * Throws SslError on error.
+	 *
+	 * @param _ssl an SSL object which has been put into client or
+	 * server mode already
+	 * @param _worker_pool if not nullptr, then the handshake is
+	 * performed in this pool
+	 */
+	SslSocketFilter(EventLoop &event_loop, UniqueSSL &&_ssl,
+			WorkerPool *_worker_pool=nullptr);
+
+	~SslSocketFilter() noexcept;
+
+	SSL &GetSSL() noexcept {
+		return *ssl;
+	}
+
+	bool IsHandshakeDone() const noexcept {
+		return handshake_done;
+	}
+
+	/* virtual methods from SocketFilter */
+	void SetHandler(SocketFilterHandler &_handler) noexcept override {
+		handler = &_handler;
+	}
+
+	ssize_t Read(SocketDescriptor s,
+		     ForeignFifoBuffer<uint8_t> &buffer) override;
+	ssize_t WriteV(SocketDescriptor s,
+		       const struct iovec *v, size_t n) override;
+	int Flush(SocketDescriptor s) override;
+	void Shutdown(SocketDescriptor s) noexcept override;
+	bool HasBufferedInput() const noexcept override;
+	size_t GetPendingOutput() const noexcept override;
+
+	bool IsBusy() const noexcept override {
+		return job_pending;
+	}
+
+	bool IsWaitingForInput() const noexcept override {
+		return !handshake_done && handshake_want_read && !job_pending;
+	}
+
+private:
+	void CheckError();
+
+	/**
+	 * Receive ciphertext from the socket into the BIO pair.
+	 *
+	 * @return the number of bytes received (0 if the socket or
+	 * the BIO pair has no more data/room, or at the end of the
+	 * stream), -1 with errno set on error
+	 */
+	ssize_t Receive(SocketDescriptor s) noexcept;
+
+	/**
+	 * Send ciphertext from the BIO pair to the socket.
+	 *
+	 * @return 1 if everything was sent, 0 if the socket blocks,
+	 * -1 with errno set on error
+	 */
+	int Push(SocketDescriptor s) noexcept;
+
+	/**
+	 * Run one handshake step (or submit it to the #WorkerPool).
+	 *
+	 * @return true if the handshake is complete
+	 */
+	bool StepHandshake();
+
+	void HandleHandshakeStep(int ret, int error_code);
+
+	/**
+	 * Pass one record to SSL_write().  If it does not accept the
+	 * record now, it is copied to #staging for RetryWrite().
+	 */
+	void WriteRecord(const void *data, size_t length);
+
+	/**
+	 * Submit the record in #staging again.
+	 *
+	 * @return true on success, false if SSL_write() still
+	 * blocks
+	 */
+	bool RetryWrite();
+
+	/* virtual methods from SslHandshakeHandler */
+	void OnSslHandshakeStep(int ret, int error_code) noexcept override;
+};
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ChunkEncoder.hxx"
+
+#include <stdio.h>
+
+static constexpr char crlf[] = "\r\n";
+static constexpr char last_chunk[] = "0\r\n\r\n";
+
+static constexpr struct iovec
+MakeIovec(const char *s, size_t length) noexcept
+{
+	return {const_cast<char *>(s), length};
+}
+
+void
+HttpChunkEncoder::Seal() noexcept
+{
+	assert(!sealed);
+
+	sealed = true;
+
+	if (payload_size > 0) {
+		const int length = snprintf(header, sizeof(header), "%zx\r\n",
+					    payload_size);
+		v[0] = MakeIovec(header, length);
+		v[n++] = MakeIovec(crlf, sizeof(crlf) - 1);
+		i = 0;
+	} else
+		/* no payload: skip the reserved header element */
+		i = 1;
+
+	if (end)
+		v[n++] = MakeIovec(last_chunk, sizeof(last_chunk) - 1);
+}
+
+bool
+HttpChunkEncoder::Consume(size_t nbytes) noexcept
+{
+	assert(sealed);
+
+	while (nbytes > 0) {
+		assert(i < n);
+
+		auto &e = v[i];
+		if (nbytes < e.iov_len) {
+			e.iov_base = (char *)e.iov_base + nbytes;
+			e.iov_len -= nbytes;
+			return false;
+		}
+
+		nbytes -= e.iov_len;
+		++i;
+	}
+
+	if (i < n)
+		return false;
+
+	/* everything has been written: start over */
+	i = 0;
+	n = 1;
+	payload_size = 0;
+	sealed = end = false;
+	return true;
+}
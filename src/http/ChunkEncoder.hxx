@@ -0,0 +1,151 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/ConstBuffer.hxx"
+
+#include <array>
+
+#include <assert.h>
+#include <sys/uio.h>
+
+/**
+ * Frames caller buffers as one chunk of the "chunked" transfer
+ * coding (RFC 7230 4.1) without copying them: the chunk header and
+ * the CRLF after the data are separate elements of an iovec array
+ * which can be submitted with BufferedSocket::WriteV().
+ *
+ * Usage: Append() payload buffers (and/or AppendEnd()), then submit
+ * Get() and Consume() the number of bytes which were written, until
+ * IsEmpty().  After that, the next chunk may be appended.
+ */
+class HttpChunkEncoder {
+public:
+	static constexpr size_t MAX_BUFFERS = 16;
+
+private:
+	/**
+	 * The chunk size in hex plus CRLF (and the null terminator
+	 * written by snprintf()).
+	 */
+	char header[sizeof(size_t) * 2 + 3];
+
+	/**
+	 * Element 0 is reserved for the chunk header.
+	 */
+	std::array<struct iovec, 1 + MAX_BUFFERS + 2> v;
+
+	/**
+	 * The range of elements of #v which have not been written
+	 * yet.
+	 */
+	unsigned i = 0, n = 1;
+
+	size_t payload_size = 0;
+
+	/**
+	 * Has the chunk header been generated?  After that, no more
+	 * buffers may be appended until everything has been
+	 * written.
+	 */
+	bool sealed = false;
+
+	/**
+	 * Has AppendEnd() been called?
+	 */
+	bool end = false;
+
+public:
+	/**
+	 * Is there no pending data?  (Data which has been appended
+	 * but not yet passed to Get() counts as pending.)
+	 */
+	bool IsEmpty() const noexcept {
+		return sealed ? i == n : payload_size == 0 && !end;
+	}
+
+	/**
+	 * Can another buffer be appended to the current chunk?
+	 */
+	bool CanAppend() const noexcept {
+		return !sealed && !end && n < 1 + MAX_BUFFERS;
+	}
+
+	/**
+	 * Append a payload buffer to the current chunk.  It is not
+	 * copied; it must remain valid until it has been written.
+	 * Empty buffers are ignored.
+	 */
+	void Append(ConstBuffer<void> payload) noexcept {
+		assert(CanAppend());
+
+		if (payload.empty())
+			return;
+
+		v[n++] = {const_cast<void *>(payload.data), payload.size};
+		payload_size += payload.size;
+	}
+
+	/**
+	 * Append the last chunk (and an empty trailer) after the
+	 * current chunk, ending the body.
+	 */
+	void AppendEnd() noexcept {
+		assert(!sealed);
+		assert(!end);
+
+		end = true;
+	}
+
+	/**
+	 * Returns the pending iovec array.  After the first call,
+	 * nothing can be appended until everything has been
+	 * consumed.
+	 */
+	ConstBuffer<struct iovec> Get() noexcept {
+		if (!sealed)
+			Seal();
+
+		return {&v[i], n - i};
+	}
+
+	/**
+	 * The given number of bytes of Get() have been written.
+	 *
+	 * @return true if everything has been written
+	 */
+	bool Consume(size_t nbytes) noexcept;
+
+private:
+	void Seal() noexcept;
+};
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ChunkParser.hxx"
+
+#include <algorithm>
+#include <stdexcept>
+
+static int
+ParseHexDigit(char ch) noexcept
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	else if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 0xa;
+	else if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 0xa;
+	else
+		return -1;
+}
+
+ConstBuffer<void>
+HttpChunkParser::Parse(ConstBuffer<void> _input)
+{
+	auto input = ConstBuffer<char>::FromVoid(_input);
+	const char *p = input.begin(), *const end = input.end();
+
+	while (p != end) {
+		const char ch = *p;
+		int digit;
+
+		switch (state) {
+		case State::NONE:
+			digit = ParseHexDigit(ch);
+			if (digit < 0)
+				throw std::runtime_error("Chunk size expected");
+
+			remaining = digit;
+			state = State::SIZE;
+			++p;
+			break;
+
+		case State::SIZE:
+			digit = ParseHexDigit(ch);
+			if (digit < 0) {
+				state = State::AFTER_SIZE;
+				break;
+			}
+
+			if (remaining >= uint64_t(1) << 60)
+				throw std::runtime_error("Chunk is too large");
+
+			remaining = remaining * 0x10 + digit;
+			++p;
+			break;
+
+		case State::AFTER_SIZE:
+			++p;
+			if (ch == '\n')
+				state = remaining > 0
+					? State::DATA
+					: State::TRAILER;
+			break;
+
+		case State::DATA:
+			return {p, size_t(std::min<uint64_t>(remaining, end - p))};
+
+		case State::AFTER_DATA:
+			++p;
+			if (ch == '\r')
+				state = State::AFTER_DATA_CR;
+			else if (ch == '\n')
+				state = State::NONE;
+			else
+				throw std::runtime_error("Newline expected after chunk");
+			break;
+
+		case State::AFTER_DATA_CR:
+			++p;
+			if (ch != '\n')
+				throw std::runtime_error("Newline expected after chunk");
+
+			state = State::NONE;
+			break;
+
+		case State::TRAILER:
+			++p;
+			if (ch == '\r')
+				state = State::TRAILER_CR;
+			else if (ch == '\n')
+				state = State::END;
+			else
+				state = State::TRAILER_LINE;
+			break;
+
+		case State::TRAILER_CR:
+			++p;
+			if (ch != '\n')
+				throw std::runtime_error("Malformed chunk trailer");
+
+			state = State::END;
+			break;
+
+		case State::TRAILER_LINE:
+			++p;
+			if (ch == '\n')
+				state = State::TRAILER;
+			break;
+
+		case State::END:
+			return {p, 0};
+		}
+	}
+
+	return {p, 0};
+}
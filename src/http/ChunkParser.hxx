@@ -0,0 +1,127 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/ConstBuffer.hxx"
+
+#include <assert.h>
+#include <stdint.h>
+
+/**
+ * An incremental parser for the "chunked" transfer coding (RFC 7230
+ * 4.1).  It works directly on the caller's input buffer (e.g. the
+ * one returned by BufferedSocket::ReadBuffer()) and points to the
+ * payload in place; nothing is copied.
+ *
+ * Usage: call Parse() with the input; it parses the chunk framing
+ * at the beginning and returns the payload span which follows.
+ * Submit the payload, call Consume() with the number of payload
+ * bytes which have been handled, and remove
+ * (payload.data - input.data) + consumed bytes from the input
+ * buffer.  Repeat until HasEnded().
+ *
+ * Chunk extensions and trailer fields are ignored.
+ */
+class HttpChunkParser {
+	enum class State : uint8_t {
+		/**
+		 * Expecting the first hex digit of the chunk size.
+		 */
+		NONE,
+
+		SIZE,
+
+		/**
+		 * Skipping chunk extensions until the line feed.
+		 */
+		AFTER_SIZE,
+
+		DATA,
+
+		/**
+		 * Expecting the CRLF after the chunk data.
+		 */
+		AFTER_DATA,
+		AFTER_DATA_CR,
+
+		/**
+		 * At the beginning of a trailer line.
+		 */
+		TRAILER,
+		TRAILER_CR,
+		TRAILER_LINE,
+
+		END,
+	};
+
+	State state = State::NONE;
+
+	/**
+	 * The number of payload bytes remaining in the current chunk
+	 * (or its size while parsing it).
+	 */
+	uint64_t remaining;
+
+public:
+	bool HasEnded() const noexcept {
+		return state == State::END;
+	}
+
+	/**
+	 * Parse chunk framing at the beginning of the input and
+	 * return the payload which follows it (a pointer into the
+	 * input).  Framing bytes before the payload are consumed
+	 * implicitly.
+	 *
+	 * Throws std::runtime_error if the input is malformed.
+	 *
+	 * @return the payload; if it is empty, then all of the input
+	 * up to its data pointer has been consumed, and either more
+	 * input is needed or the end has been reached (HasEnded();
+	 * the remaining input belongs to the next message)
+	 */
+	ConstBuffer<void> Parse(ConstBuffer<void> input);
+
+	/**
+	 * The caller has handled the given number of bytes of the
+	 * payload returned by Parse().
+	 */
+	void Consume(size_t nbytes) noexcept {
+		assert(state == State::DATA);
+		assert(nbytes <= remaining);
+
+		remaining -= nbytes;
+		if (remaining == 0)
+			state = State::AFTER_DATA;
+	}
+};
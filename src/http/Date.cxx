@@ -36,6 +36,7 @@
 #include "util/DecimalFormat.h"
 
 #include <stdint.h>
+#include <string.h>
 
 static constexpr char wdays[8][5] = {
 	"Sun,",
@@ -81,7 +82,7 @@ month_name(int month)
 void
 http_date_format_r(char *buffer, std::chrono::system_clock::time_point t)
 {
-	static struct tm tm_buffer;
+	struct tm tm_buffer;
 	const struct tm *tm = sysx_time_gmtime(std::chrono::system_clock::to_time_t(t), &tm_buffer);
 
 	*(uint32_t *)(void *)buffer = *(const uint32_t *)(const void *)wday_name(tm->tm_wday);
@@ -100,13 +101,11 @@ http_date_format_r(char *buffer, std::chrono::system_clock::time_point t)
 	*(uint32_t *)(void *)(buffer + 26) = *(const uint32_t *)(const void *)"GMT";
 }
 
-static char buffer[30];
-
 const char *
 http_date_format(std::chrono::system_clock::time_point t)
 {
-	http_date_format_r(buffer, t);
-	return buffer;
+	static thread_local HttpDateCache cache;
+	return cache.Get(t);
 }
 
 static int
@@ -150,27 +149,67 @@ parse_month_name(const char *p)
 #pragma GCC diagnostic pop
 #endif
 
+/**
+ * Calculate the number of days since 1970-01-01 in the proleptic
+ * Gregorian calendar; this replaces timegm(), which is slow and
+ * normalizes the whole "struct tm".
+ *
+ * @param month the month (0-11)
+ */
+static constexpr long
+DaysFromCivil(int year, unsigned month, unsigned mday) noexcept
+{
+	/* shift the year start to March 1st, so the leap day is the
+	   last day of the year */
+	const int y = year - (month < 2);
+	const int era = (y >= 0 ? y : y - 399) / 400;
+	const unsigned yoe = unsigned(y - era * 400);
+	const unsigned doy = (153 * (month >= 2 ? month - 2 : month + 10) + 2) / 5
+		+ mday - 1;
+	const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return long(era) * 146097 + long(doe) - 719468;
+}
+
+static_assert(DaysFromCivil(1970, 0, 1) == 0, "Wrong epoch");
+static_assert(DaysFromCivil(2000, 2, 1) == 11017, "Wrong leap year");
+
 std::chrono::system_clock::time_point
 http_date_parse(const char *p)
 {
-	struct tm tm;
-
 	if (strlen(p) < 25)
 		return std::chrono::system_clock::from_time_t(-1);
 
-	tm.tm_sec = parse_2digit(p + 23);
-	tm.tm_min = parse_2digit(p + 20);
-	tm.tm_hour = parse_2digit(p + 17);
-	tm.tm_mday = parse_2digit(p + 5);
-	tm.tm_mon = parse_month_name(p + 8);
-	tm.tm_year = parse_4digit(p + 12);
+	const int sec = parse_2digit(p + 23);
+	const int min = parse_2digit(p + 20);
+	const int hour = parse_2digit(p + 17);
+	const int mday = parse_2digit(p + 5);
+	const int mon = parse_month_name(p + 8);
+	const int year = parse_4digit(p + 12);
 
-	if (tm.tm_sec == -1 || tm.tm_min == -1 || tm.tm_hour == -1 ||
-	    tm.tm_mday == -1 || tm.tm_mon == -1 || tm.tm_year < 1900)
+	if (sec < 0 || sec > 60 || min < 0 || min > 59 ||
+	    hour < 0 || hour > 23 || mday < 1 || mday > 31 ||
+	    mon < 0 || year < 1900)
 		return std::chrono::system_clock::from_time_t(-1);
 
-	tm.tm_year -= 1900;
-	tm.tm_isdst = -1;
+	const long days = DaysFromCivil(year, mon, mday);
+	const time_t t = time_t(days) * 86400 +
+		hour * 3600 + min * 60 + sec;
+	return std::chrono::system_clock::from_time_t(t);
+}
+
+std::chrono::system_clock::time_point
+HttpDateParserCache::Parse(const char *p) noexcept
+{
+	if (strcmp(p, last) == 0)
+		return last_value;
+
+	const auto value = http_date_parse(p);
+
+	const size_t length = strlen(p);
+	if (length < sizeof(last)) {
+		memcpy(last, p, length + 1);
+		last_value = value;
+	}
 
-	return std::chrono::system_clock::from_time_t(timegm(&tm));
+	return value;
 }
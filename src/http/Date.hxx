@@ -41,15 +41,73 @@
 
 #include <chrono>
 
+#include <time.h>
+
+/**
+ * Format the time stamp in RFC 1123 format.  The buffer must have
+ * room for 30 characters (including the null terminator).
+ */
 void
 http_date_format_r(char *buffer, std::chrono::system_clock::time_point t);
 
-gcc_const
+/**
+ * Like http_date_format_r(), but return a pointer to a thread-local
+ * buffer which is overwritten by the next call in this thread.
+ */
 const char *
 http_date_format(std::chrono::system_clock::time_point t);
 
+/**
+ * Parse a RFC 1123 time stamp.  Returns from_time_t(-1) on error.
+ */
 gcc_pure
 std::chrono::system_clock::time_point
 http_date_parse(const char *p);
 
+/**
+ * Cache for the value of the "Date" response header.  The string is
+ * regenerated only when the second changes, so feeding it with
+ * EventLoop::SystemNow() formats at most once per second.
+ *
+ * This class is not thread-safe; each thread (usually each
+ * #EventLoop) needs its own instance.
+ */
+class HttpDateCache {
+	time_t last = -1;
+
+	char buffer[30];
+
+public:
+	const char *Get(std::chrono::system_clock::time_point now) noexcept {
+		const time_t t = std::chrono::system_clock::to_time_t(now);
+		if (gcc_unlikely(t != last)) {
+			http_date_format_r(buffer, now);
+			last = t;
+		}
+
+		return buffer;
+	}
+};
+
+/**
+ * Wrapper for http_date_parse() which remembers the most recently
+ * parsed string.  Clients usually send the same "If-Modified-Since"
+ * value over and over (the "Last-Modified" value we sent them), so
+ * most lookups end up being a string comparison.
+ *
+ * This class is not thread-safe.
+ */
+class HttpDateParserCache {
+	char last[32];
+
+	std::chrono::system_clock::time_point last_value;
+
+public:
+	HttpDateParserCache() noexcept {
+		last[0] = 0;
+	}
+
+	std::chrono::system_clock::time_point Parse(const char *p) noexcept;
+};
+
 #endif
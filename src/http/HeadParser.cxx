@@ -0,0 +1,301 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HeadParser.hxx"
+#include "util/CharUtil.hxx"
+
+#include <algorithm>
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+constexpr size_t HttpHeadParser::MAX_HEAD_SIZE;
+
+/**
+ * Find the first occurrence of the given character.
+ *
+ * @return the position or nullptr if there is none
+ */
+gcc_pure
+static const char *
+FindChar(const char *p, const char *end, char ch) noexcept
+{
+#ifdef __SSE2__
+	const __m128i needle = _mm_set1_epi8(ch);
+
+	while (end - p >= 16) {
+		const __m128i chunk =
+			_mm_loadu_si128((const __m128i *)(const void *)p);
+		const int mask =
+			_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+
+		p += 16;
+	}
+#endif
+
+	return (const char *)memchr(p, ch, end - p);
+}
+
+static constexpr bool
+IsTokenChar(char ch) noexcept
+{
+	/* RFC 7230 3.2.6 */
+	return IsAlphaNumericASCII(ch) ||
+		ch == '!' || ch == '#' || ch == '$' || ch == '%' ||
+		ch == '&' || ch == '\'' || ch == '*' || ch == '+' ||
+		ch == '-' || ch == '.' || ch == '^' || ch == '_' ||
+		ch == '`' || ch == '|' || ch == '~';
+}
+
+gcc_pure
+static bool
+IsToken(StringView s) noexcept
+{
+	if (s.empty())
+		return false;
+
+	for (char ch : s)
+		if (!IsTokenChar(ch))
+			return false;
+
+	return true;
+}
+
+gcc_pure
+static http_method_t
+ParseMethod(StringView s) noexcept
+{
+	for (unsigned i = HTTP_METHOD_NULL + 1; i < HTTP_METHOD_INVALID; ++i)
+		if (s.Equals(http_method_to_string_data[i]))
+			return http_method_t(i);
+
+	return HTTP_METHOD_INVALID;
+}
+
+/**
+ * Parse "HTTP/1.x".
+ *
+ * @return the minor version or -1 on error
+ */
+gcc_pure
+static int
+ParseVersion(StringView s) noexcept
+{
+	if (s.size != 8 || memcmp(s.data, "HTTP/1.", 7) != 0 ||
+	    !IsDigitASCII(s.data[7]))
+		return -1;
+
+	return s.data[7] - '0';
+}
+
+bool
+HttpHeadParser::ParseRequestLine(StringView line) noexcept
+{
+	/* request-line = method SP request-target SP HTTP-version */
+
+	const char *sp1 = line.Find(' ');
+	if (sp1 == nullptr)
+		return false;
+
+	const StringView method_string(line.data, sp1);
+	if (!IsToken(method_string))
+		return false;
+
+	const StringView rest(sp1 + 1, line.end());
+	const char *sp2 = rest.Find(' ');
+	if (sp2 == nullptr || sp2 == rest.data)
+		return false;
+
+	const int version = ParseVersion({sp2 + 1, line.end()});
+	if (version < 0)
+		return false;
+
+	method = ParseMethod(method_string);
+	uri_or_reason = ToSpan({rest.data, sp2});
+	minor_version = uint8_t(version);
+	return true;
+}
+
+bool
+HttpHeadParser::ParseStatusLine(StringView line) noexcept
+{
+	/* status-line = HTTP-version SP status-code SP reason-phrase */
+
+	if (line.size < 12 || line[8] != ' ' ||
+	    !IsDigitASCII(line[9]) || !IsDigitASCII(line[10]) ||
+	    !IsDigitASCII(line[11]) ||
+	    (line.size > 12 && line[12] != ' '))
+		return false;
+
+	const int version = ParseVersion({line.data, 8});
+	if (version < 0)
+		return false;
+
+	const int code = (line[9] - '0') * 100 + (line[10] - '0') * 10 +
+		(line[11] - '0');
+	if (code < 100)
+		return false;
+
+	status = http_status_t(code);
+	minor_version = uint8_t(version);
+
+	if (line.size > 13)
+		uri_or_reason = ToSpan({line.data + 13, line.end()});
+	else
+		uri_or_reason = {uint32_t(line.end() - data), 0};
+
+	return true;
+}
+
+bool
+HttpHeadParser::ParseHeaderLine(StringView line) noexcept
+{
+	const char *colon = FindChar(line.begin(), line.end(), ':');
+	if (colon == nullptr)
+		return false;
+
+	/* no whitespace allowed between name and colon (RFC 7230
+	   3.2.4); this also rejects obsolete line folding */
+	const StringView name(line.data, colon);
+	if (!IsToken(name))
+		return false;
+
+	if (fields.full())
+		return false;
+
+	StringView value(colon + 1, line.end());
+	value.Strip();
+
+	Field &field = fields.append();
+	field.name = ToSpan(name);
+	field.value = ToSpan(value);
+	field.header = http_header_lookup(name);
+	return true;
+}
+
+inline bool
+HttpHeadParser::ParseLine(StringView line) noexcept
+{
+	if (have_start_line)
+		return ParseHeaderLine(line);
+
+	have_start_line = true;
+	return mode == Mode::REQUEST
+		? ParseRequestLine(line)
+		: ParseStatusLine(line);
+}
+
+HttpHeadParser::Result
+HttpHeadParser::Feed(const char *_data, size_t size) noexcept
+{
+	assert(result == Result::MORE);
+	assert(size >= position + scanned);
+
+	data = _data;
+
+	const char *const end = data + std::min(size, MAX_HEAD_SIZE);
+
+	while (true) {
+		const char *line_start = data + position;
+		const char *lf = FindChar(line_start + scanned, end, '\n');
+		if (lf == nullptr) {
+			scanned = end - line_start;
+
+			if (size >= MAX_HEAD_SIZE)
+				/* too large */
+				result = Result::ERROR;
+
+			return result;
+		}
+
+		scanned = 0;
+
+		const char *line_end = lf;
+		if (line_end > line_start && line_end[-1] == '\r')
+			--line_end;
+
+		const StringView line(line_start, line_end);
+		const uint32_t next_position = lf + 1 - data;
+
+		if (line.empty()) {
+			if (!have_start_line) {
+				if (mode == Mode::RESPONSE) {
+					result = Result::ERROR;
+					return result;
+				}
+
+				/* ignore empty lines before the
+				   request-line (RFC 7230 3.5) */
+				position = next_position;
+				continue;
+			}
+
+			position = next_position;
+			result = Result::DONE;
+			return result;
+		}
+
+		if (!ParseLine(line)) {
+			result = Result::ERROR;
+			return result;
+		}
+
+		position = next_position;
+	}
+}
+
+StringView
+HttpHeadParser::Get(HttpHeader header) const noexcept
+{
+	assert(header != HttpHeader::UNKNOWN);
+
+	for (const auto &i : fields)
+		if (i.header == header)
+			return ToStringView(i.value);
+
+	return nullptr;
+}
+
+StringView
+HttpHeadParser::Get(StringView name) const noexcept
+{
+	for (const auto &i : fields)
+		if (http_header_name_equals(ToStringView(i.name), name))
+			return ToStringView(i.value);
+
+	return nullptr;
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Method.h"
+#include "Status.h"
+#include "HeaderName.hxx"
+#include "util/StaticArray.hxx"
+#include "util/StringView.hxx"
+#include "util/Compiler.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+/**
+ * A resumable parser for the head (start line and header fields) of
+ * a HTTP/1.x request or response.
+ *
+ * It works directly on the caller's input buffer (e.g. the one
+ * returned by BufferedSocket::ReadBuffer()) and stores only offsets,
+ * so the buffer may be relocated between Feed() calls as long as the
+ * head's beginning stays at the start of the data passed to Feed().
+ * Lines which have been parsed already are not scanned again.
+ *
+ * The StringViews returned by the getters point into the buffer
+ * passed to the most recent Feed() call.  After Feed() has returned
+ * Result::DONE, the caller consumes GetHeadSize() bytes.
+ */
+class HttpHeadParser {
+public:
+	enum class Mode : uint8_t {
+		REQUEST,
+		RESPONSE,
+	};
+
+	enum class Result : uint8_t {
+		/**
+		 * The head is incomplete; call Feed() again when more
+		 * data has been received.
+		 */
+		MORE,
+
+		/**
+		 * The head is complete.
+		 */
+		DONE,
+
+		/**
+		 * The head is malformed or too large.
+		 */
+		ERROR,
+	};
+
+	static constexpr size_t MAX_HEAD_SIZE = 64 * 1024;
+
+	static constexpr size_t MAX_HEADERS = 128;
+
+private:
+	struct Span {
+		uint32_t offset, length;
+	};
+
+	struct Field {
+		Span name, value;
+
+		HttpHeader header;
+	};
+
+	const Mode mode;
+
+	Result result = Result::MORE;
+
+	bool have_start_line = false;
+
+	/**
+	 * The HTTP minor version (0 or 1).
+	 */
+	uint8_t minor_version;
+
+	/**
+	 * The offset of the next line to be parsed.
+	 */
+	uint32_t position = 0;
+
+	/**
+	 * The number of bytes after #position which are known to not
+	 * contain a line feed.
+	 */
+	uint32_t scanned = 0;
+
+	http_method_t method = HTTP_METHOD_NULL;
+
+	http_status_t status = http_status_t(0);
+
+	/**
+	 * The request URI or the reason phrase.
+	 */
+	Span uri_or_reason;
+
+	StaticArray<Field, MAX_HEADERS> fields;
+
+	const char *data = nullptr;
+
+public:
+	explicit HttpHeadParser(Mode _mode) noexcept
+		:mode(_mode) {}
+
+	/**
+	 * Parse more data.
+	 *
+	 * @param _data the beginning of the head; this must contain
+	 * all bytes which were passed to previous calls, plus new
+	 * ones
+	 */
+	Result Feed(const char *_data, size_t size) noexcept;
+
+	Result GetResult() const noexcept {
+		return result;
+	}
+
+	/**
+	 * The number of bytes of the head, including the empty line
+	 * terminating it.  Only valid after Result::DONE.
+	 */
+	size_t GetHeadSize() const noexcept {
+		assert(result == Result::DONE);
+
+		return position;
+	}
+
+	unsigned GetMinorVersion() const noexcept {
+		assert(result == Result::DONE);
+
+		return minor_version;
+	}
+
+	/**
+	 * Returns the request method; HTTP_METHOD_INVALID if the method
+	 * is not known.
+	 */
+	http_method_t GetMethod() const noexcept {
+		assert(result == Result::DONE);
+		assert(mode == Mode::REQUEST);
+
+		return method;
+	}
+
+	StringView GetUri() const noexcept {
+		assert(result == Result::DONE);
+		assert(mode == Mode::REQUEST);
+
+		return ToStringView(uri_or_reason);
+	}
+
+	http_status_t GetStatus() const noexcept {
+		assert(result == Result::DONE);
+		assert(mode == Mode::RESPONSE);
+
+		return status;
+	}
+
+	StringView GetReason() const noexcept {
+		assert(result == Result::DONE);
+		assert(mode == Mode::RESPONSE);
+
+		return ToStringView(uri_or_reason);
+	}
+
+	size_t GetHeaderCount() const noexcept {
+		return fields.size();
+	}
+
+	StringView GetHeaderName(size_t i) const noexcept {
+		return ToStringView(fields[i].name);
+	}
+
+	StringView GetHeaderValue(size_t i) const noexcept {
+		return ToStringView(fields[i].value);
+	}
+
+	/**
+	 * Returns the classification of the i-th header name.
+	 */
+	HttpHeader GetHeader(size_t i) const noexcept {
+		return fields[i].header;
+	}
+
+	/**
+	 * Find the first header with the given well-known name.
+	 *
+	 * @return the value or nullptr if there is no such header
+	 */
+	gcc_pure
+	StringView Get(HttpHeader header) const noexcept;
+
+	/**
+	 * Find the first header with the given name
+	 * (case-insensitive).
+	 *
+	 * @return the value or nullptr if there is no such header
+	 */
+	gcc_pure
+	StringView Get(StringView name) const noexcept;
+
+	/**
+	 * Invoke the callback for each header field with the
+	 * parameters (StringView name, StringView value).
+	 */
+	template<typename F>
+	void ForEach(F &&f) const {
+		for (const auto &i : fields)
+			f(ToStringView(i.name), ToStringView(i.value));
+	}
+
+private:
+	StringView ToStringView(Span span) const noexcept {
+		return {data + span.offset, span.length};
+	}
+
+	Span ToSpan(StringView s) const noexcept {
+		return {uint32_t(s.data - data), uint32_t(s.size)};
+	}
+
+	bool ParseRequestLine(StringView line) noexcept;
+	bool ParseStatusLine(StringView line) noexcept;
+	bool ParseHeaderLine(StringView line) noexcept;
+	bool ParseLine(StringView line) noexcept;
+};
@@ -35,6 +35,10 @@
 #include <assert.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static constexpr inline bool
 http_header_name_char_valid(char ch) noexcept
 {
@@ -86,3 +90,264 @@ http_header_is_hop_by_hop(const char *name) noexcept
 		return false;
 	}
 }
+
+/**
+ * Indexed by #HttpHeader (minus one); all lower case.
+ */
+static constexpr const char *header_names[] = {
+	"accept",
+	"accept-charset",
+	"accept-encoding",
+	"accept-language",
+	"accept-ranges",
+	"access-control-allow-credentials",
+	"access-control-allow-headers",
+	"access-control-allow-methods",
+	"access-control-allow-origin",
+	"access-control-expose-headers",
+	"access-control-max-age",
+	"access-control-request-headers",
+	"access-control-request-method",
+	"age",
+	"allow",
+	"alt-svc",
+	"authorization",
+	"cache-control",
+	"clear-site-data",
+	"connection",
+	"content-disposition",
+	"content-encoding",
+	"content-language",
+	"content-length",
+	"content-location",
+	"content-md5",
+	"content-range",
+	"content-security-policy",
+	"content-security-policy-report-only",
+	"content-type",
+	"cookie",
+	"cookie2",
+	"date",
+	"digest",
+	"dnt",
+	"early-data",
+	"etag",
+	"expect",
+	"expect-ct",
+	"expires",
+	"feature-policy",
+	"forwarded",
+	"from",
+	"host",
+	"if-match",
+	"if-modified-since",
+	"if-none-match",
+	"if-range",
+	"if-unmodified-since",
+	"keep-alive",
+	"last-event-id",
+	"last-modified",
+	"link",
+	"location",
+	"max-forwards",
+	"mime-version",
+	"nel",
+	"origin",
+	"pragma",
+	"prefer",
+	"preference-applied",
+	"proxy-authenticate",
+	"proxy-authorization",
+	"public-key-pins",
+	"range",
+	"referer",
+	"referrer-policy",
+	"refresh",
+	"report-to",
+	"retry-after",
+	"sec-fetch-dest",
+	"sec-fetch-mode",
+	"sec-fetch-site",
+	"sec-fetch-user",
+	"sec-websocket-accept",
+	"sec-websocket-extensions",
+	"sec-websocket-key",
+	"sec-websocket-protocol",
+	"sec-websocket-version",
+	"server",
+	"server-timing",
+	"set-cookie",
+	"set-cookie2",
+	"sourcemap",
+	"strict-transport-security",
+	"te",
+	"timing-allow-origin",
+	"tk",
+	"trailer",
+	"trailers",
+	"transfer-encoding",
+	"upgrade",
+	"upgrade-insecure-requests",
+	"user-agent",
+	"vary",
+	"via",
+	"warning",
+	"www-authenticate",
+	"x-content-type-options",
+	"x-dns-prefetch-control",
+	"x-forwarded-for",
+	"x-forwarded-host",
+	"x-forwarded-proto",
+	"x-frame-options",
+	"x-powered-by",
+	"x-real-ip",
+	"x-request-id",
+	"x-requested-with",
+	"x-ua-compatible",
+	"x-xss-protection",
+};
+
+static_assert(sizeof(header_names) / sizeof(header_names[0]) ==
+	      HTTP_HEADER_COUNT - 1,
+	      "Header name table does not match enum HttpHeader");
+
+/**
+ * The length of the longest well-known header name.
+ */
+static constexpr size_t MAX_HEADER_NAME_LENGTH = 35;
+
+/**
+ * The size of the lowercase buffer used by http_header_lookup(); a
+ * multiple of 16 to allow SSE2 processing.
+ */
+static constexpr size_t LOWER_BUFFER_SIZE = 48;
+
+static_assert(LOWER_BUFFER_SIZE >= MAX_HEADER_NAME_LENGTH, "");
+
+/**
+ * The FNV-1a offset basis was replaced with this seed, which was
+ * chosen (by brute force) so that the hash is collision-free for
+ * all #header_names modulo #HASH_TABLE_SIZE.  It needs to be
+ * searched again when the list is modified; the static_assert below
+ * will fail if it is not perfect anymore.
+ */
+static constexpr uint32_t HASH_SEED = 313;
+
+static constexpr size_t HASH_TABLE_SIZE = 1024;
+
+static constexpr uint32_t
+HashHeaderName(const char *p, size_t length) noexcept
+{
+	uint32_t hash = HASH_SEED;
+	for (size_t i = 0; i < length; ++i)
+		hash = (hash ^ uint8_t(p[i])) * 0x01000193;
+	return hash;
+}
+
+static constexpr size_t
+ConstexprStrlen(const char *p) noexcept
+{
+	size_t length = 0;
+	while (p[length] != 0)
+		++length;
+	return length;
+}
+
+struct HeaderHashTable {
+	/**
+	 * Values of #HttpHeader; HttpHeader::UNKNOWN (0) for unused
+	 * slots.
+	 */
+	uint8_t slots[HASH_TABLE_SIZE];
+
+	/**
+	 * Set if two names are mapped to the same slot.
+	 */
+	bool collision;
+};
+
+static constexpr HeaderHashTable
+BuildHeaderHashTable() noexcept
+{
+	HeaderHashTable table{{}, false};
+
+	for (size_t i = 0; i < HTTP_HEADER_COUNT - 1; ++i) {
+		const char *name = header_names[i];
+		const size_t slot = HashHeaderName(name, ConstexprStrlen(name))
+			% HASH_TABLE_SIZE;
+		if (table.slots[slot] != 0)
+			table.collision = true;
+		table.slots[slot] = uint8_t(i + 1);
+	}
+
+	return table;
+}
+
+static constexpr HeaderHashTable header_hash_table = BuildHeaderHashTable();
+
+static_assert(!header_hash_table.collision,
+	      "HASH_SEED does not yield a perfect hash");
+
+/**
+ * Copy the name to the (zero-padded) buffer and convert it to lower
+ * case.
+ */
+static void
+CopyLower(char *dest, StringView src) noexcept
+{
+	memset(dest, 0, LOWER_BUFFER_SIZE);
+	memcpy(dest, src.data, src.size);
+
+#ifdef __SSE2__
+	const __m128i before_a = _mm_set1_epi8('A' - 1);
+	const __m128i after_z = _mm_set1_epi8('Z' + 1);
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+
+	for (size_t i = 0; i < src.size; i += 16) {
+		auto *p = (__m128i *)(void *)(dest + i);
+		const __m128i chunk = _mm_load_si128(p);
+		const __m128i upper =
+			_mm_and_si128(_mm_cmpgt_epi8(chunk, before_a),
+				      _mm_cmplt_epi8(chunk, after_z));
+		_mm_store_si128(p, _mm_or_si128(chunk,
+						_mm_and_si128(upper, case_bit)));
+	}
+#else
+	for (size_t i = 0; i < src.size; ++i)
+		if (dest[i] >= 'A' && dest[i] <= 'Z')
+			dest[i] += 'a' - 'A';
+#endif
+}
+
+HttpHeader
+http_header_lookup(StringView name) noexcept
+{
+	if (name.size == 0 || name.size > MAX_HEADER_NAME_LENGTH)
+		return HttpHeader::UNKNOWN;
+
+	alignas(16) char lower[LOWER_BUFFER_SIZE];
+	CopyLower(lower, name);
+
+	const size_t slot = HashHeaderName(lower, name.size)
+		% HASH_TABLE_SIZE;
+	const unsigned i = header_hash_table.slots[slot];
+	if (i == 0)
+		return HttpHeader::UNKNOWN;
+
+	const char *candidate = header_names[i - 1];
+	if (memcmp(candidate, lower, name.size) != 0 ||
+	    candidate[name.size] != 0)
+		return HttpHeader::UNKNOWN;
+
+	return HttpHeader(i);
+}
+
+const char *
+http_header_name(HttpHeader header) noexcept
+{
+	const size_t i = size_t(header);
+	if (i == 0 || i >= HTTP_HEADER_COUNT)
+		return nullptr;
+
+	return header_names[i - 1];
+}
@@ -32,8 +32,12 @@
 
 #pragma once
 
+#include "util/StringView.hxx"
 #include "util/Compiler.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
 /**
  * Determines if the specified name consists only of valid characters
  * (RFC 822 3.2).
@@ -50,3 +54,157 @@ http_header_name_valid(const char *name) noexcept;
 gcc_pure
 bool
 http_header_is_hop_by_hop(const char *name) noexcept;
+
+/**
+ * Compare two header names case-insensitively (RFC 7230 3.2).
+ */
+gcc_pure
+static inline bool
+http_header_name_equals(StringView a, StringView b) noexcept
+{
+	return a.EqualsIgnoreCase(b);
+}
+
+/**
+ * Well-known HTTP header names.  Use http_header_lookup() to
+ * classify an incoming header name once, and then compare enum
+ * values instead of strings.
+ */
+enum class HttpHeader : uint8_t {
+	/**
+	 * Not a well-known header name.
+	 */
+	UNKNOWN,
+
+	ACCEPT,
+	ACCEPT_CHARSET,
+	ACCEPT_ENCODING,
+	ACCEPT_LANGUAGE,
+	ACCEPT_RANGES,
+	ACCESS_CONTROL_ALLOW_CREDENTIALS,
+	ACCESS_CONTROL_ALLOW_HEADERS,
+	ACCESS_CONTROL_ALLOW_METHODS,
+	ACCESS_CONTROL_ALLOW_ORIGIN,
+	ACCESS_CONTROL_EXPOSE_HEADERS,
+	ACCESS_CONTROL_MAX_AGE,
+	ACCESS_CONTROL_REQUEST_HEADERS,
+	ACCESS_CONTROL_REQUEST_METHOD,
+	AGE,
+	ALLOW,
+	ALT_SVC,
+	AUTHORIZATION,
+	CACHE_CONTROL,
+	CLEAR_SITE_DATA,
+	CONNECTION,
+	CONTENT_DISPOSITION,
+	CONTENT_ENCODING,
+	CONTENT_LANGUAGE,
+	CONTENT_LENGTH,
+	CONTENT_LOCATION,
+	CONTENT_MD5,
+	CONTENT_RANGE,
+	CONTENT_SECURITY_POLICY,
+	CONTENT_SECURITY_POLICY_REPORT_ONLY,
+	CONTENT_TYPE,
+	COOKIE,
+	COOKIE2,
+	DATE,
+	DIGEST,
+	DNT,
+	EARLY_DATA,
+	ETAG,
+	EXPECT,
+	EXPECT_CT,
+	EXPIRES,
+	FEATURE_POLICY,
+	FORWARDED,
+	FROM,
+	HOST,
+	IF_MATCH,
+	IF_MODIFIED_SINCE,
+	IF_NONE_MATCH,
+	IF_RANGE,
+	IF_UNMODIFIED_SINCE,
+	KEEP_ALIVE,
+	LAST_EVENT_ID,
+	LAST_MODIFIED,
+	LINK,
+	LOCATION,
+	MAX_FORWARDS,
+	MIME_VERSION,
+	NEL,
+	ORIGIN,
+	PRAGMA,
+	PREFER,
+	PREFERENCE_APPLIED,
+	PROXY_AUTHENTICATE,
+	PROXY_AUTHORIZATION,
+	PUBLIC_KEY_PINS,
+	RANGE,
+	REFERER,
+	REFERRER_POLICY,
+	REFRESH,
+	REPORT_TO,
+	RETRY_AFTER,
+	SEC_FETCH_DEST,
+	SEC_FETCH_MODE,
+	SEC_FETCH_SITE,
+	SEC_FETCH_USER,
+	SEC_WEBSOCKET_ACCEPT,
+	SEC_WEBSOCKET_EXTENSIONS,
+	SEC_WEBSOCKET_KEY,
+	SEC_WEBSOCKET_PROTOCOL,
+	SEC_WEBSOCKET_VERSION,
+	SERVER,
+	SERVER_TIMING,
+	SET_COOKIE,
+	SET_COOKIE2,
+	SOURCEMAP,
+	STRICT_TRANSPORT_SECURITY,
+	TE,
+	TIMING_ALLOW_ORIGIN,
+	TK,
+	TRAILER,
+	TRAILERS,
+	TRANSFER_ENCODING,
+	UPGRADE,
+	UPGRADE_INSECURE_REQUESTS,
+	USER_AGENT,
+	VARY,
+	VIA,
+	WARNING,
+	WWW_AUTHENTICATE,
+	X_CONTENT_TYPE_OPTIONS,
+	X_DNS_PREFETCH_CONTROL,
+	X_FORWARDED_FOR,
+	X_FORWARDED_HOST,
+	X_FORWARDED_PROTO,
+	X_FRAME_OPTIONS,
+	X_POWERED_BY,
+	X_REAL_IP,
+	X_REQUEST_ID,
+	X_REQUESTED_WITH,
+	X_UA_COMPATIBLE,
+	X_XSS_PROTECTION,
+};
+
+static constexpr size_t HTTP_HEADER_COUNT =
+	size_t(HttpHeader::X_XSS_PROTECTION) + 1;
+
+/**
+ * Look up a header name (case-insensitively) using a perfect hash
+ * table.
+ *
+ * @return the #HttpHeader or HttpHeader::UNKNOWN
+ */
+gcc_pure
+HttpHeader
+http_header_lookup(StringView name) noexcept;
+
+/**
+ * Returns the (lower case) name of the given well-known header, or
+ * nullptr for HttpHeader::UNKNOWN.
+ */
+gcc_const
+const char *
+http_header_name(HttpHeader header) noexcept;
@@ -33,6 +33,140 @@
 #include "List.hxx"
 #include "util/StringView.hxx"
 
+#include <algorithm>
+#include <stdexcept>
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Find the next comma or double quote.
+ *
+ * @return the position or #end if there is none
+ */
+gcc_pure
+static const char *
+FindDelimiter(const char *p, const char *end) noexcept
+{
+#ifdef __SSE2__
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i quote = _mm_set1_epi8('"');
+
+	while (end - p >= 16) {
+		const __m128i chunk =
+			_mm_loadu_si128((const __m128i *)(const void *)p);
+		const int mask =
+			_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, comma),
+							 _mm_cmpeq_epi8(chunk, quote)));
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+
+		p += 16;
+	}
+#endif
+
+	for (; p != end; ++p)
+		if (*p == ',' || *p == '"')
+			return p;
+
+	return end;
+}
+
+bool
+HttpListTokenizer::Next(StringView &element) noexcept
+{
+	if (p == end)
+		return false;
+
+	const char *const start = p;
+	const char *element_end = end;
+
+	while (p != end) {
+		p = FindDelimiter(p, end);
+		if (p == end)
+			break;
+
+		if (*p == ',') {
+			element_end = p++;
+			break;
+		}
+
+		/* skip the quoted-string */
+		const char *q = (const char *)memchr(p + 1, '"', end - p - 1);
+		if (q == nullptr) {
+			/* unterminated; treat the rest as one
+			   element */
+			p = end;
+			break;
+		}
+
+		p = q + 1;
+	}
+
+	element = {start, element_end};
+	element.Strip();
+
+	if (element.size >= 2 && element.front() == '"' &&
+	    element.back() == '"') {
+		element.pop_front();
+		element.pop_back();
+	}
+
+	return true;
+}
+
+HttpListMatcher::HttpListMatcher(std::initializer_list<const char *> tokens)
+{
+	if (tokens.size() > MAX_TOKENS)
+		throw std::invalid_argument("Too many tokens");
+
+	entries.reserve(tokens.size());
+
+	Mask bit = 1;
+	for (const char *token : tokens) {
+		entries.push_back({token, bit});
+		bit <<= 1;
+	}
+
+	std::stable_sort(entries.begin(), entries.end(),
+			 [](const Entry &a, const Entry &b){
+				 return a.token.size < b.token.size;
+			 });
+}
+
+HttpListMatcher::Mask
+HttpListMatcher::MatchElement(StringView element) const noexcept
+{
+	auto i = std::lower_bound(entries.begin(), entries.end(),
+				  element.size,
+				  [](const Entry &e, size_t size){
+					  return e.token.size < size;
+				  });
+
+	Mask result = 0;
+	for (; i != entries.end() && i->token.size == element.size; ++i)
+		if (i->token.EqualsIgnoreCase(element))
+			result |= i->bit;
+
+	return result;
+}
+
+HttpListMatcher::Mask
+HttpListMatcher::Match(StringView list) const noexcept
+{
+	Mask result = 0;
+
+	HttpListTokenizer t(list);
+	StringView element;
+	while (t.Next(element))
+		result |= MatchElement(element);
+
+	return result;
+}
+
 static StringView
 http_trim(StringView s)
 {
@@ -52,54 +186,30 @@ http_trim(StringView s)
 	return s;
 }
 
-static bool
-http_equals(StringView a, StringView b)
-{
-	return http_trim(a).Equals(http_trim(b));
-}
-
 bool
 http_list_contains(const char *list, const char *_item)
 {
-	const StringView item(_item);
+	const StringView item = http_trim(_item);
 
-	while (*list != 0) {
-		/* XXX what if the comma is within an quoted-string? */
-		const char *comma = strchr(list, ',');
-		if (comma == nullptr)
-			return http_equals(list, item);
-
-		if (http_equals({list, comma}, item))
+	HttpListTokenizer t(list);
+	StringView element;
+	while (t.Next(element))
+		if (element.Equals(item))
 			return true;
 
-		list = comma + 1;
-	}
-
 	return false;
 }
 
-static bool
-http_equals_i(StringView a, StringView b)
-{
-	return http_trim(a).EqualsIgnoreCase(b);
-}
-
 bool
 http_list_contains_i(const char *list, const char *_item)
 {
 	const StringView item(_item);
 
-	while (*list != 0) {
-		/* XXX what if the comma is within an quoted-string? */
-		const char *comma = strchr(list, ',');
-		if (comma == nullptr)
-			return http_equals_i(list, item);
-
-		if (http_equals_i({list, comma}, item))
+	HttpListTokenizer t(list);
+	StringView element;
+	while (t.Next(element))
+		if (element.EqualsIgnoreCase(item))
 			return true;
 
-		list = comma + 1;
-	}
-
 	return false;
 }
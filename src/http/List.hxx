@@ -33,8 +33,81 @@
 #ifndef HTTP_LIST_HXX
 #define HTTP_LIST_HXX
 
+#include "util/StringView.hxx"
 #include "util/Compiler.h"
 
+#include <initializer_list>
+#include <vector>
+
+#include <stdint.h>
+
+/**
+ * Splits a comma-separated HTTP header value (RFC 7230 7) into its
+ * elements in one pass.  Whitespace around each element and the
+ * quotes around a quoted-string are removed; commas inside a
+ * quoted-string do not split.
+ */
+class HttpListTokenizer {
+	const char *p;
+	const char *const end;
+
+public:
+	explicit HttpListTokenizer(StringView list) noexcept
+		:p(list.begin()), end(list.end()) {}
+
+	/**
+	 * Obtain the next element (which may be empty).
+	 *
+	 * @return false if the end of the list has been reached
+	 */
+	bool Next(StringView &element) noexcept;
+};
+
+/**
+ * Matches the elements of a HTTP list against a fixed set of tokens
+ * (case-insensitive), so all interesting tokens of a header can be
+ * evaluated in one pass instead of one http_list_contains_i() call
+ * per token.
+ */
+class HttpListMatcher {
+public:
+	typedef uint64_t Mask;
+
+	static constexpr size_t MAX_TOKENS = 64;
+
+private:
+	struct Entry {
+		StringView token;
+		Mask bit;
+	};
+
+	/**
+	 * Sorted by token length.
+	 */
+	std::vector<Entry> entries;
+
+public:
+	/**
+	 * @param tokens the tokens; bit #i of the resulting mask
+	 * refers to the i-th token; the strings are not copied and
+	 * must remain valid (usually they are literals)
+	 */
+	explicit HttpListMatcher(std::initializer_list<const char *> tokens);
+
+	/**
+	 * Check which tokens are equal to the given (already
+	 * trimmed) element.
+	 */
+	gcc_pure
+	Mask MatchElement(StringView element) const noexcept;
+
+	/**
+	 * Check which tokens are contained in the given list.
+	 */
+	gcc_pure
+	Mask Match(StringView list) const noexcept;
+};
+
 gcc_pure
 bool
 http_list_contains(const char *list, const char *item);
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Negotiate.hxx"
+#include "List.hxx"
+
+#include <stdexcept>
+
+int
+http_parse_qvalue(StringView s) noexcept
+{
+	s.Strip();
+
+	if (s.empty() || (s.front() != '0' && s.front() != '1'))
+		return -1;
+
+	const bool one = s.front() == '1';
+	int value = one ? 1000 : 0;
+	s.pop_front();
+
+	if (s.empty())
+		return value;
+
+	if (s.front() != '.' || s.size > 4)
+		return -1;
+
+	s.pop_front();
+
+	int factor = 100;
+	for (char ch : s) {
+		if (ch < '0' || ch > '9' || (one && ch != '0'))
+			return -1;
+
+		value += (ch - '0') * factor;
+		factor /= 10;
+	}
+
+	return value;
+}
+
+HttpNegotiator::HttpNegotiator(std::initializer_list<const char *> _tokens,
+			       bool _language_ranges)
+	:language_ranges(_language_ranges)
+{
+	if (_tokens.size() > MAX_TOKENS)
+		throw std::invalid_argument("Too many tokens");
+
+	tokens.reserve(_tokens.size());
+	for (const char *token : _tokens)
+		tokens.emplace_back(token);
+}
+
+inline size_t
+HttpNegotiator::MatchToken(StringView element, StringView token) const noexcept
+{
+	if (token.EqualsIgnoreCase(element))
+		/* an exact match is more specific than any prefix */
+		return element.size + 1;
+
+	if (language_ranges && element.size < token.size &&
+	    token[element.size] == '-' &&
+	    token.StartsWithIgnoreCase(element))
+		return element.size;
+
+	return 0;
+}
+
+HttpNegotiator::Qualities
+HttpNegotiator::Parse(StringView header) const noexcept
+{
+	Qualities q{};
+
+	/* 0 means no element has matched the token yet */
+	std::array<size_t, MAX_TOKENS> specificity{};
+
+	int wildcard = -1;
+
+	HttpListTokenizer t(header);
+	StringView element;
+	while (t.Next(element)) {
+		/* split the element into the token and its
+		   parameters; only "q" is interesting */
+		int quality = 1000;
+
+		const char *semicolon = element.Find(';');
+		if (semicolon != nullptr) {
+			StringView params(semicolon + 1, element.end());
+			element.size = semicolon - element.data;
+			element.StripRight();
+
+			while (!params.empty()) {
+				StringView param = params;
+				const char *next = params.Find(';');
+				if (next != nullptr) {
+					param = {params.data, next};
+					params = {next + 1, params.end()};
+				} else
+					params = nullptr;
+
+				param.Strip();
+				if (param.size >= 2 &&
+				    (param.front() == 'q' || param.front() == 'Q') &&
+				    param[1] == '=') {
+					param.skip_front(2);
+					quality = http_parse_qvalue(param);
+				}
+			}
+
+			if (quality < 0)
+				/* ignore malformed elements */
+				continue;
+		}
+
+		if (element.empty())
+			continue;
+
+		if (element.size == 1 && element.front() == '*') {
+			wildcard = quality;
+			continue;
+		}
+
+		for (size_t i = 0; i < tokens.size(); ++i) {
+			const size_t s = MatchToken(element, tokens[i]);
+			if (s > specificity[i]) {
+				specificity[i] = s;
+				q[i] = quality;
+			}
+		}
+	}
+
+	if (wildcard >= 0)
+		for (size_t i = 0; i < tokens.size(); ++i)
+			if (specificity[i] == 0)
+				q[i] = wildcard;
+
+	return q;
+}
+
+HttpNegotiator::Qualities
+HttpNegotiator::Get(StringView header) noexcept
+{
+	if (header.size > MAX_CACHED_LENGTH)
+		return Parse(header);
+
+	try {
+		key_buffer.assign(header.data, header.size);
+	} catch (const std::bad_alloc &) {
+		return Parse(header);
+	}
+
+	const auto *cached = cache.Get(key_buffer);
+	if (cached != nullptr)
+		return *cached;
+
+	const auto q = Parse(header);
+
+	try {
+		cache.Put(key_buffer, q);
+	} catch (const std::bad_alloc &) {
+		/* not cached; doesn't matter */
+	}
+
+	return q;
+}
+
+int
+HttpNegotiator::Select(StringView header, Mask available) noexcept
+{
+	const auto q = Get(header);
+
+	int result = -1;
+	unsigned best = 0;
+
+	for (size_t i = 0; i < tokens.size(); ++i)
+		if ((available & (Mask(1) << i)) && q[i] > best) {
+			best = q[i];
+			result = i;
+		}
+
+	return result;
+}
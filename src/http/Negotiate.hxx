@@ -0,0 +1,159 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/Cache.hxx"
+#include "util/StringView.hxx"
+#include "util/Compiler.h"
+
+#include <array>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+/**
+ * Parse a q-value (RFC 7231 5.3.1).
+ *
+ * @return the quality in thousandths (0..1000) or -1 if the value
+ * is malformed
+ */
+gcc_pure
+int
+http_parse_qvalue(StringView s) noexcept;
+
+/**
+ * Performs proactive content negotiation (RFC 7231 5.3) for a fixed
+ * set of offered tokens, e.g. the codings of precompressed files
+ * for "Accept-Encoding" or the available languages for
+ * "Accept-Language".
+ *
+ * Each header value is parsed only once into the quality of each
+ * offered token; the result is cached per distinct header value,
+ * because clients send only a handful of distinct strings.
+ *
+ * This class is not thread-safe.
+ */
+class HttpNegotiator {
+public:
+	static constexpr size_t MAX_TOKENS = 16;
+
+	typedef uint32_t Mask;
+
+	/**
+	 * The quality of each offered token in thousandths; 0 means
+	 * not acceptable.
+	 */
+	typedef std::array<uint16_t, MAX_TOKENS> Qualities;
+
+private:
+	/**
+	 * Longer header values are not cached.
+	 */
+	static constexpr size_t MAX_CACHED_LENGTH = 256;
+
+	/**
+	 * The offered tokens in order of preference.
+	 */
+	std::vector<StringView> tokens;
+
+	/**
+	 * Match language ranges (RFC 4647 3.3.1) instead of plain
+	 * tokens.
+	 */
+	const bool language_ranges;
+
+	Cache<std::string, Qualities, 32, 31> cache;
+
+	/**
+	 * A buffer for the cache key, reused to avoid an allocation
+	 * for each lookup.
+	 */
+	std::string key_buffer;
+
+public:
+	/**
+	 * Throws std::invalid_argument if there are too many
+	 * tokens.
+	 *
+	 * @param tokens the offered tokens in order of preference;
+	 * bit #i of a #Mask and element #i of #Qualities refer to the
+	 * i-th token; the strings are not copied and must remain
+	 * valid (usually they are literals)
+	 * @param _language_ranges if true, then a header element
+	 * also matches all tokens it is a prefix of (followed by a
+	 * hyphen), e.g. "en" matches "en-US" ("Accept-Language")
+	 */
+	explicit HttpNegotiator(std::initializer_list<const char *> _tokens,
+				bool _language_ranges=false);
+
+	HttpNegotiator(const HttpNegotiator &) = delete;
+	HttpNegotiator &operator=(const HttpNegotiator &) = delete;
+
+	/**
+	 * Parse a header value without consulting the cache.  The
+	 * most specific matching element determines a token's
+	 * quality; "*" applies to all tokens not matched otherwise.
+	 */
+	gcc_pure
+	Qualities Parse(StringView header) const noexcept;
+
+	/**
+	 * Like Parse(), but use the cache.
+	 */
+	Qualities Get(StringView header) noexcept;
+
+	/**
+	 * Choose the acceptable token with the highest quality;
+	 * ties are resolved by the order of preference.
+	 *
+	 * @param available a mask of the tokens which are available
+	 * for this resource (e.g. precompressed files which exist)
+	 * @return the index of the chosen token or -1 if none is
+	 * acceptable (e.g. use "identity" then)
+	 */
+	int Select(StringView header, Mask available=~Mask(0)) noexcept;
+
+	void Clear() noexcept {
+		cache.Clear();
+	}
+
+private:
+	/**
+	 * Determine how specifically the given element (without
+	 * parameters) matches the token, or 0 if it does not match.
+	 */
+	gcc_pure
+	size_t MatchToken(StringView element, StringView token) const noexcept;
+};
@@ -31,9 +31,14 @@
  */
 
 #include "Range.hxx"
+#include "util/CharUtil.hxx"
+
+#include <algorithm>
 
 #include <assert.h>
+#include <inttypes.h>
 #include <string.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 void
@@ -88,3 +93,232 @@ HttpRangeRequest::ParseRangeHeader(const char *p) noexcept
 
 	type = Type::VALID;
 }
+
+/**
+ * Parse a decimal number without sign and whitespace (which
+ * strtoull() would accept).
+ *
+ * @return false on syntax error or overflow
+ */
+static bool
+ParseDecimal(const char *&p, uint64_t &value_r) noexcept
+{
+	if (!IsDigitASCII(*p))
+		return false;
+
+	uint64_t value = 0;
+	do {
+		const unsigned digit = *p++ - '0';
+		if (value > (UINT64_MAX - digit) / 10)
+			return false;
+
+		value = value * 10 + digit;
+	} while (IsDigitASCII(*p));
+
+	value_r = value;
+	return true;
+}
+
+static const char *
+SkipSpace(const char *p) noexcept
+{
+	while (*p == ' ' || *p == '\t')
+		++p;
+	return p;
+}
+
+enum class RangeSpecResult {
+	VALID,
+	UNSATISFIABLE,
+	MALFORMED,
+};
+
+/**
+ * Parse one byte-range-spec or suffix-byte-range-spec.
+ */
+static RangeSpecResult
+ParseRangeSpec(const char *&p, uint64_t size, HttpByteRange &range) noexcept
+{
+	uint64_t first, last;
+
+	if (*p == '-') {
+		/* suffix-byte-range-spec */
+		++p;
+		if (!ParseDecimal(p, last))
+			return RangeSpecResult::MALFORMED;
+
+		if (last == 0 || size == 0)
+			return RangeSpecResult::UNSATISFIABLE;
+
+		range.start = last < size ? size - last : 0;
+		range.end = size;
+		return RangeSpecResult::VALID;
+	}
+
+	if (!ParseDecimal(p, first) || *p != '-')
+		return RangeSpecResult::MALFORMED;
+
+	++p;
+
+	if (IsDigitASCII(*p)) {
+		if (!ParseDecimal(p, last) || last < first)
+			return RangeSpecResult::MALFORMED;
+
+		if (last >= size)
+			last = size - 1;
+	} else
+		last = size - 1;
+
+	if (first >= size)
+		return RangeSpecResult::UNSATISFIABLE;
+
+	range.start = first;
+	range.end = last + 1;
+	return RangeSpecResult::VALID;
+}
+
+void
+HttpMultiRangeRequest::ParseRangeHeader(const char *p) noexcept
+{
+	assert(p != nullptr);
+	assert(type == Type::NONE);
+	assert(ranges.empty());
+
+	if (strncmp(p, "bytes=", 6) != 0) {
+		type = Type::INVALID;
+		return;
+	}
+
+	p += 6;
+
+	bool empty = true;
+
+	while (true) {
+		p = SkipSpace(p);
+
+		if (*p == ',') {
+			/* empty list elements are allowed (RFC 7230
+			   7) */
+			++p;
+			continue;
+		}
+
+		if (*p == 0)
+			break;
+
+		HttpByteRange range;
+		switch (ParseRangeSpec(p, size, range)) {
+		case RangeSpecResult::VALID:
+			if (ranges.full()) {
+				/* too many ranges: ignore the header */
+				ranges.clear();
+				return;
+			}
+
+			ranges.append(range);
+			break;
+
+		case RangeSpecResult::UNSATISFIABLE:
+			break;
+
+		case RangeSpecResult::MALFORMED:
+			ranges.clear();
+			type = Type::INVALID;
+			return;
+		}
+
+		empty = false;
+
+		p = SkipSpace(p);
+		if (*p == ',')
+			++p;
+		else if (*p != 0) {
+			ranges.clear();
+			type = Type::INVALID;
+			return;
+		}
+	}
+
+	if (empty || ranges.empty()) {
+		type = Type::INVALID;
+		return;
+	}
+
+	/* sort and coalesce */
+
+	std::sort(ranges.begin(), ranges.end(),
+		  [](const HttpByteRange &a, const HttpByteRange &b){
+			  return a.start < b.start;
+		  });
+
+	auto dest = ranges.begin();
+	for (auto i = std::next(ranges.begin()); i != ranges.end(); ++i) {
+		if (i->start <= dest->end)
+			dest->end = std::max(dest->end, i->end);
+		else
+			*++dest = *i;
+	}
+
+	ranges.shrink(std::distance(ranges.begin(), dest) + 1);
+
+	type = Type::VALID;
+}
+
+HttpByteRangesPlan::HttpByteRangesPlan(const HttpMultiRangeRequest &request,
+				       const char *content_type,
+				       const char *boundary)
+{
+	assert(request.type == HttpRangeRequest::Type::VALID);
+	assert(boundary != nullptr);
+
+	segments.reserve(request.ranges.size() * 2 + 1);
+
+	std::string header;
+
+	bool first = true;
+	for (const auto &range : request.ranges) {
+		header.clear();
+		if (!first)
+			header += "\r\n";
+		first = false;
+
+		header += "--";
+		header += boundary;
+		header += "\r\n";
+
+		if (content_type != nullptr) {
+			header += "Content-Type: ";
+			header += content_type;
+			header += "\r\n";
+		}
+
+		char content_range[96];
+		snprintf(content_range, sizeof(content_range),
+			 "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64 "\r\n\r\n",
+			 range.start, range.end - 1, request.size);
+		header += content_range;
+
+		AppendMemory(header);
+		AppendFile(range.start, range.GetSize());
+	}
+
+	header = "\r\n--";
+	header += boundary;
+	header += "--\r\n";
+	AppendMemory(header);
+}
+
+void
+HttpByteRangesPlan::AppendMemory(const std::string &s)
+{
+	segments.push_back({false, buffer.size(), s.size()});
+	buffer += s;
+	content_length += s.size();
+}
+
+void
+HttpByteRangesPlan::AppendFile(uint64_t offset, uint64_t length)
+{
+	segments.push_back({true, offset, length});
+	content_length += length;
+}
@@ -33,6 +33,13 @@
 #ifndef HTTP_RANGE_HXX
 #define HTTP_RANGE_HXX
 
+#include "util/StaticArray.hxx"
+#include "util/StringView.hxx"
+#include "util/Compiler.h"
+
+#include <string>
+#include <vector>
+
 #include <stdint.h>
 
 struct HttpRangeRequest {
@@ -53,4 +60,125 @@ struct HttpRangeRequest {
 	void ParseRangeHeader(const char *p) noexcept;
 };
 
+/**
+ * One byte range of a resource.
+ */
+struct HttpByteRange {
+	uint64_t start;
+
+	/**
+	 * The end offset (exclusive).
+	 */
+	uint64_t end;
+
+	constexpr uint64_t GetSize() const noexcept {
+		return end - start;
+	}
+};
+
+/**
+ * Like #HttpRangeRequest, but supports a list of byte ranges (RFC
+ * 7233 2.1), e.g. "bytes=0-99,500-599,-100".
+ */
+struct HttpMultiRangeRequest {
+	typedef HttpRangeRequest::Type Type;
+
+	/**
+	 * Requests with more ranges are ignored, i.e. the whole
+	 * resource is sent (allowed by RFC 7233 6.1).
+	 */
+	static constexpr size_t MAX_RANGES = 16;
+
+	Type type = Type::NONE;
+
+	const uint64_t size;
+
+	/**
+	 * The satisfiable ranges, sorted and with overlapping and
+	 * adjacent ranges coalesced.  Only valid if #type is
+	 * Type::VALID.
+	 */
+	StaticArray<HttpByteRange, MAX_RANGES> ranges;
+
+	explicit HttpMultiRangeRequest(uint64_t _size) noexcept
+		:size(_size) {}
+
+	/**
+	 * Parse a "Range" request header.  Type::INVALID means the
+	 * header is malformed or none of the ranges is satisfiable
+	 * (i.e. "416 Range Not Satisfiable").
+	 */
+	void ParseRangeHeader(const char *p) noexcept;
+
+	/**
+	 * Does the response need to be "multipart/byteranges"?
+	 */
+	bool IsMultipart() const noexcept {
+		return type == Type::VALID && ranges.size() > 1;
+	}
+};
+
+/**
+ * Describes a "multipart/byteranges" response body (RFC 7233 4.1) as
+ * a sequence of memory segments (the part headers) and file segments
+ * (the range data), so it can be sent with writev() and
+ * sendfile()/splice() without copying file contents to userspace.
+ */
+class HttpByteRangesPlan {
+public:
+	struct Segment {
+		/**
+		 * If true, then #offset refers to the file; if false,
+		 * this is a memory segment and #offset refers to the
+		 * plan's buffer (see GetData()).
+		 */
+		bool file;
+
+		uint64_t offset, length;
+	};
+
+private:
+	std::string buffer;
+
+	std::vector<Segment> segments;
+
+	uint64_t content_length = 0;
+
+public:
+	/**
+	 * @param request a parsed request with Type::VALID
+	 * @param content_type the "Content-Type" of the resource
+	 * (may be nullptr)
+	 * @param boundary the multipart boundary (without the
+	 * leading dashes); the same value must be used for the
+	 * response's "Content-Type" header
+	 */
+	HttpByteRangesPlan(const HttpMultiRangeRequest &request,
+			   const char *content_type,
+			   const char *boundary);
+
+	/**
+	 * The size of the whole response body.
+	 */
+	uint64_t GetContentLength() const noexcept {
+		return content_length;
+	}
+
+	const std::vector<Segment> &GetSegments() const noexcept {
+		return segments;
+	}
+
+	/**
+	 * Returns the contents of a memory segment.
+	 */
+	gcc_pure
+	StringView GetData(const Segment &segment) const noexcept {
+		return {buffer.data() + segment.offset, size_t(segment.length)};
+	}
+
+private:
+	void AppendMemory(const std::string &s);
+	void AppendFile(uint64_t offset, uint64_t length);
+};
+
 #endif
@@ -0,0 +1,565 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "AsyncLogger.hxx"
+#include "util/CacheLine.hxx"
+#include "util/Macros.hxx"
+
+#include <algorithm>
+
+#include <sys/uio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Longer records are truncated.
+ */
+static constexpr size_t MAX_RECORD = 4096;
+
+static constexpr size_t MAX_BATCH = 64;
+
+static constexpr size_t
+AlignRecord(size_t size) noexcept
+{
+	return (size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+}
+
+/**
+ * A ring buffer of log records for one producer thread and the
+ * writer thread.  Each record consists of a 32 bit length followed
+ * by the text, padded to a multiple of 4 bytes.  Records never wrap:
+ * if there is not enough room at the end of the buffer, a #WRAP
+ * marker tells the consumer to continue at the beginning.
+ */
+struct AsyncLogger::ThreadBuffer {
+	static constexpr size_t SIZE = 64 * 1024;
+	static constexpr uint32_t WRAP = UINT32_MAX;
+
+	/**
+	 * This bit in the length field marks a #DeferredHeader
+	 * record which needs to be formatted by the writer thread.
+	 */
+	static constexpr uint32_t DEFERRED = 0x80000000;
+
+	/**
+	 * The AsyncLogger::id this buffer belongs to.
+	 */
+	const uint64_t owner;
+
+	/**
+	 * The position of the next record to be consumed; written
+	 * only by the writer thread.
+	 */
+	std::atomic_size_t head{0};
+
+	char pad1[CACHE_LINE_SIZE];
+
+	/**
+	 * The position of the next record to be produced; written
+	 * only by the owning thread.
+	 */
+	std::atomic_size_t tail{0};
+
+	/**
+	 * The producer's copy of #head.
+	 */
+	size_t cached_head = 0;
+
+	/**
+	 * The new #tail after the record started by Begin().
+	 */
+	size_t pending_tail;
+
+	/**
+	 * Has the owning thread exited?  Then this buffer gets freed
+	 * as soon as it is empty.
+	 */
+	std::atomic_bool orphaned{false};
+
+	char pad2[CACHE_LINE_SIZE];
+
+	char data[SIZE];
+
+	static_assert(SIZE >= 2 * AlignRecord(sizeof(uint32_t) + MAX_RECORD),
+		      "Ring buffer too small");
+
+	explicit ThreadBuffer(uint64_t _owner) noexcept
+		:owner(_owner) {}
+
+	bool empty() const noexcept {
+		return head.load(std::memory_order_acquire) ==
+			tail.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Can #n more bytes be written at position #t (producer
+	 * only)?
+	 */
+	bool HasRoom(size_t t, size_t n) noexcept {
+		if (SIZE - (t - cached_head) >= n)
+			return true;
+
+		cached_head = head.load(std::memory_order_acquire);
+		return SIZE - (t - cached_head) >= n;
+	}
+
+	/**
+	 * Start a new record (producer only); it becomes visible
+	 * to the writer thread with Commit().
+	 *
+	 * @param length the length of the record; must not be
+	 * larger than #MAX_RECORD
+	 * @return a pointer to the record payload or nullptr if the
+	 * buffer is full
+	 */
+	char *Begin(size_t length, uint32_t flags=0) noexcept {
+		const size_t total = AlignRecord(sizeof(uint32_t) + length);
+
+		const size_t t = tail.load(std::memory_order_relaxed);
+		const size_t offset = t % SIZE;
+		const size_t contiguous = SIZE - offset;
+		const size_t padding = contiguous < total ? contiguous : 0;
+
+		if (!HasRoom(t, padding + total))
+			return nullptr;
+
+		char *p = data + offset;
+		if (padding > 0) {
+			const uint32_t wrap = WRAP;
+			memcpy(p, &wrap, sizeof(wrap));
+			p = data;
+		}
+
+		const uint32_t header = length | flags;
+		memcpy(p, &header, sizeof(header));
+
+		pending_tail = t + padding + total;
+		return p + sizeof(header);
+	}
+
+	void Commit() noexcept {
+		tail.store(pending_tail, std::memory_order_release);
+	}
+};
+
+/**
+ * The payload of a deferred record; it is followed by the domain and
+ * the argument block.
+ */
+struct DeferredHeader {
+	LoggerDetail::DeferredFormatFunction function;
+	const char *fmt;
+	uint32_t domain_size;
+};
+
+/**
+ * The thread_local owner of the calling thread's #ThreadBuffer.
+ */
+class AsyncLogger::ThreadHolder {
+public:
+	std::shared_ptr<ThreadBuffer> buffer;
+
+	~ThreadHolder() noexcept {
+		if (buffer)
+			buffer->orphaned.store(true, std::memory_order_release);
+	}
+};
+
+std::atomic<AsyncLogger *> AsyncLogger::installed{nullptr};
+
+static std::atomic<uint64_t> next_async_logger_id{0};
+
+void
+FdAsyncLoggerOutput::WriteRecords(const struct iovec *records,
+				  size_t n) noexcept
+{
+	while (n > 0) {
+		struct iovec v[64];
+		size_t n_v = std::min(n, ARRAY_SIZE(v));
+		std::copy_n(records, n_v, v);
+		records += n_v;
+		n -= n_v;
+
+		struct iovec *p = v;
+		while (n_v > 0) {
+			ssize_t nbytes = writev(fd.Get(), p, n_v);
+			if (nbytes < 0) {
+				if (errno == EINTR)
+					continue;
+				return;
+			}
+
+			/* skip the records which were written
+			   completely, and continue after a partial
+			   write */
+			size_t rest = nbytes;
+			while (n_v > 0 && rest >= p->iov_len) {
+				rest -= p->iov_len;
+				++p;
+				--n_v;
+			}
+
+			if (n_v > 0) {
+				p->iov_base = (char *)p->iov_base + rest;
+				p->iov_len -= rest;
+			}
+		}
+	}
+}
+
+AsyncLogger::AsyncLogger(AsyncLoggerOutput &_output) noexcept
+	:output(_output), id(++next_async_logger_id) {}
+
+AsyncLogger::~AsyncLogger() noexcept
+{
+	Uninstall();
+	Stop();
+}
+
+void
+AsyncLogger::Start()
+{
+	if (!format_buffer)
+		format_buffer.reset(new char[MAX_BATCH * MAX_RECORD]);
+
+	running.store(true);
+	thread = std::thread(&AsyncLogger::Run, this);
+}
+
+void
+AsyncLogger::Stop() noexcept
+{
+	if (!thread.joinable())
+		return;
+
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+		running.store(false);
+		cond.notify_one();
+	}
+
+	thread.join();
+}
+
+AsyncLogger::ThreadBuffer *
+AsyncLogger::GetThreadBuffer() noexcept
+{
+	static thread_local ThreadHolder holder;
+
+	if (holder.buffer && holder.buffer->owner == id)
+		return holder.buffer.get();
+
+	std::shared_ptr<ThreadBuffer> buffer;
+
+	try {
+		buffer = std::make_shared<ThreadBuffer>(id);
+
+		const std::lock_guard<std::mutex> lock(mutex);
+		buffers.push_back(buffer);
+	} catch (...) {
+		return nullptr;
+	}
+
+	/* the old buffer belongs to a previous AsyncLogger
+	   instance */
+	if (holder.buffer)
+		holder.buffer->orphaned.store(true, std::memory_order_release);
+
+	holder.buffer = std::move(buffer);
+	return holder.buffer.get();
+}
+
+/**
+ * Copies strings into a record, truncating at the end.
+ */
+class RecordWriter {
+	char *p, *const end;
+
+public:
+	RecordWriter(char *_p, size_t size) noexcept
+		:p(_p), end(_p + size) {}
+
+	void Append(StringView s) noexcept {
+		const size_t n = std::min(s.size, size_t(end - p));
+		if (n > 0)
+			p = (char *)mempcpy(p, s.data, n);
+	}
+};
+
+bool
+AsyncLogger::Push(StringView domain, ConstBuffer<StringView> src) noexcept
+{
+	auto *const b = GetThreadBuffer();
+	if (b == nullptr) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	size_t length = 1;
+	if (!domain.empty())
+		length += domain.size + 3;
+	for (const auto &i : src)
+		length += i.size;
+	length = std::min(length, MAX_RECORD);
+
+	char *p = b->Begin(length);
+	if (p == nullptr) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	/* the last byte is reserved for the newline */
+	RecordWriter w(p, length - 1);
+	if (!domain.empty()) {
+		w.Append("[");
+		w.Append(domain);
+		w.Append("] ");
+	}
+
+	for (const auto &i : src)
+		w.Append(i);
+
+	p[length - 1] = '\n';
+
+	b->Commit();
+	Notify();
+	return true;
+}
+
+bool
+AsyncLogger::PushDeferred(StringView domain,
+			  LoggerDetail::DeferredFormatFunction function,
+			  const char *fmt, ConstBuffer<char> block) noexcept
+{
+	const size_t length = sizeof(DeferredHeader) + domain.size + block.size;
+	if (length > MAX_RECORD) {
+		/* too large for a deferred record: format it right
+		   now */
+		char buffer[MAX_RECORD];
+		StringView s(buffer,
+			     function(buffer, sizeof(buffer), fmt, block.data));
+		return Push(domain, {&s, 1});
+	}
+
+	auto *const b = GetThreadBuffer();
+	char *p = b != nullptr
+		? b->Begin(length, ThreadBuffer::DEFERRED)
+		: nullptr;
+	if (p == nullptr) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	const DeferredHeader header{function, fmt, uint32_t(domain.size)};
+	memcpy(p, &header, sizeof(header));
+	p += sizeof(header);
+	if (!domain.empty())
+		p = (char *)mempcpy(p, domain.data, domain.size);
+	memcpy(p, block.data, block.size);
+
+	b->Commit();
+	Notify();
+	return true;
+}
+
+void
+AsyncLogger::Notify() noexcept
+{
+	/* pairs with the fence in Run(): either we see "waiting", or
+	   the writer sees the new record */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (waiting.load(std::memory_order_relaxed)) {
+		const std::lock_guard<std::mutex> lock(mutex);
+		cond.notify_one();
+	}
+}
+
+/**
+ * Format a deferred record into a #MAX_RECORD buffer.
+ *
+ * @return the length of the formatted line
+ */
+static size_t
+FormatDeferredRecord(char *dest, const char *payload) noexcept
+{
+	DeferredHeader header;
+	memcpy(&header, payload, sizeof(header));
+
+	const char *domain = payload + sizeof(header);
+	const char *block = domain + header.domain_size;
+
+	/* the last byte is reserved for the newline */
+	char *p = dest, *const end = dest + MAX_RECORD - 1;
+
+	if (header.domain_size > 0) {
+		*p++ = '[';
+		p = (char *)mempcpy(p, domain, header.domain_size);
+		*p++ = ']';
+		*p++ = ' ';
+	}
+
+	p += header.function(p, end - p + 1, header.fmt, block);
+	*p++ = '\n';
+	return p - dest;
+}
+
+size_t
+AsyncLogger::Flush() noexcept
+{
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+
+		buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+					     [](const std::shared_ptr<ThreadBuffer> &b){
+						     return b->orphaned.load(std::memory_order_acquire) &&
+							     b->empty();
+					     }),
+			      buffers.end());
+
+		snapshot = buffers;
+	}
+
+	heads.resize(snapshot.size());
+
+	size_t result = 0;
+
+	while (true) {
+		/* collect records from all buffers into one batch */
+		struct iovec v[MAX_BATCH];
+		size_t n = 0;
+
+		for (size_t i = 0; i < snapshot.size(); ++i) {
+			auto &b = *snapshot[i];
+			size_t h = b.head.load(std::memory_order_relaxed);
+			const size_t t = b.tail.load(std::memory_order_acquire);
+
+			while (h != t && n < MAX_BATCH) {
+				const size_t offset = h % ThreadBuffer::SIZE;
+				char *p = b.data + offset;
+
+				uint32_t header;
+				memcpy(&header, p, sizeof(header));
+				if (header == ThreadBuffer::WRAP) {
+					h += ThreadBuffer::SIZE - offset;
+					continue;
+				}
+
+				const size_t length = header & ~ThreadBuffer::DEFERRED;
+				char *const payload = p + sizeof(header);
+
+				if (header & ThreadBuffer::DEFERRED) {
+					char *dest = format_buffer.get() + n * MAX_RECORD;
+					v[n++] = {dest, FormatDeferredRecord(dest, payload)};
+				} else
+					v[n++] = {payload, length};
+
+				h += AlignRecord(sizeof(header) + length);
+			}
+
+			heads[i] = h;
+		}
+
+		if (n == 0)
+			break;
+
+		output.WriteRecords(v, n);
+		written.fetch_add(n, std::memory_order_relaxed);
+		result += n;
+
+		/* now the producers may overwrite the records */
+		for (size_t i = 0; i < snapshot.size(); ++i)
+			snapshot[i]->head.store(heads[i],
+						std::memory_order_release);
+	}
+
+	/* release orphaned buffers outside of the lock */
+	snapshot.clear();
+
+	return result;
+}
+
+bool
+AsyncLogger::HasPending() const noexcept
+{
+	return std::any_of(buffers.begin(), buffers.end(),
+			   [](const std::shared_ptr<ThreadBuffer> &b){
+				   return !b->empty();
+			   });
+}
+
+void
+AsyncLogger::ReportDropped() noexcept
+{
+	const uint64_t d = dropped.load(std::memory_order_relaxed);
+	if (d == reported_dropped)
+		return;
+
+	char buffer[64];
+	int length = snprintf(buffer, sizeof(buffer),
+			      "[AsyncLogger] %llu log records dropped\n",
+			      (unsigned long long)(d - reported_dropped));
+	reported_dropped = d;
+
+	const struct iovec v{buffer, size_t(length)};
+	output.WriteRecords(&v, 1);
+}
+
+void
+AsyncLogger::Run() noexcept
+{
+	while (true) {
+		if (Flush() > 0)
+			continue;
+
+		ReportDropped();
+
+		std::unique_lock<std::mutex> lock(mutex);
+		waiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (HasPending()) {
+			waiting.store(false, std::memory_order_relaxed);
+			continue;
+		}
+
+		if (!running.load())
+			break;
+
+		/* the timeout is just a safety net */
+		cond.wait_for(lock, std::chrono::seconds(1));
+		waiting.store(false, std::memory_order_relaxed);
+	}
+
+	waiting.store(false, std::memory_order_relaxed);
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "FileDescriptor.hxx"
+#include "Logger.hxx"
+#include "util/StringView.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/Compiler.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+struct iovec;
+
+/**
+ * The destination of an #AsyncLogger.  Its methods are called from
+ * the writer thread.
+ */
+class AsyncLoggerOutput {
+public:
+	/**
+	 * Write a batch of log records.  Each record is one complete
+	 * line including the trailing newline.
+	 *
+	 * A journald implementation (not part of this library,
+	 * because it would need libsystemd) would call
+	 * sd_journal_sendv() for each record here.
+	 */
+	virtual void WriteRecords(const struct iovec *records,
+				  size_t n) noexcept = 0;
+};
+
+/**
+ * An #AsyncLoggerOutput which writes to a file descriptor with
+ * writev(), e.g. to stderr.
+ */
+class FdAsyncLoggerOutput final : public AsyncLoggerOutput {
+	FileDescriptor fd;
+
+public:
+	explicit constexpr FdAsyncLoggerOutput(FileDescriptor _fd) noexcept
+		:fd(_fd) {}
+
+	void WriteRecords(const struct iovec *records,
+			  size_t n) noexcept override;
+};
+
+/**
+ * An asynchronous backend for #Logger: once installed, log records
+ * are copied into a lock-free ring buffer owned by the calling
+ * thread, and a dedicated writer thread passes them in batches to an
+ * #AsyncLoggerOutput.  Logging never blocks on a slow output; if a
+ * thread's ring buffer is full, the record is dropped and counted.
+ */
+class AsyncLogger {
+	struct ThreadBuffer;
+	class ThreadHolder;
+
+	AsyncLoggerOutput &output;
+
+	/**
+	 * A unique number for this object; a #ThreadBuffer belongs to
+	 * the #AsyncLogger with the same id.
+	 */
+	const uint64_t id;
+
+	/**
+	 * Protects #buffers and is used with #cond.
+	 */
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	/**
+	 * All registered per-thread buffers; protected by #mutex.
+	 */
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+	/**
+	 * Is the writer thread going to sleep (or sleeping)?
+	 * Producers notify #cond only if this is set.
+	 */
+	std::atomic_bool waiting{false};
+
+	std::atomic_bool running{false};
+
+	std::atomic<uint64_t> written{0}, dropped{0};
+
+	/**
+	 * The value of #dropped which was last reported in the log.
+	 */
+	uint64_t reported_dropped = 0;
+
+	/**
+	 * Copies of #buffers and their new head positions; used only
+	 * by the writer thread.
+	 */
+	std::vector<std::shared_ptr<ThreadBuffer>> snapshot;
+	std::vector<size_t> heads;
+
+	/**
+	 * Deferred records of one batch are formatted into this
+	 * buffer; allocated by Start() and used only by the writer
+	 * thread.
+	 */
+	std::unique_ptr<char[]> format_buffer;
+
+	std::thread thread;
+
+	static std::atomic<AsyncLogger *> installed;
+
+public:
+	explicit AsyncLogger(AsyncLoggerOutput &_output) noexcept;
+	~AsyncLogger() noexcept;
+
+	AsyncLogger(const AsyncLogger &) = delete;
+	AsyncLogger &operator=(const AsyncLogger &) = delete;
+
+	/**
+	 * Start the writer thread.
+	 *
+	 * Throws std::system_error on error.
+	 */
+	void Start();
+
+	/**
+	 * Write all pending records and stop the writer thread.
+	 */
+	void Stop() noexcept;
+
+	/**
+	 * Make this object the backend of LoggerDetail::WriteV(),
+	 * i.e. of all #Logger instances.  Before it is destructed,
+	 * Uninstall() must be called, and there must be no other
+	 * thread which is currently logging.
+	 */
+	void Install() noexcept {
+		installed.store(this, std::memory_order_release);
+	}
+
+	void Uninstall() noexcept {
+		AsyncLogger *expected = this;
+		installed.compare_exchange_strong(expected, nullptr);
+	}
+
+	static AsyncLogger *GetInstalled() noexcept {
+		return installed.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Submit a log record; may be called by any thread.
+	 *
+	 * @return false if the record was dropped
+	 */
+	bool Push(StringView domain,
+		  ConstBuffer<StringView> buffers) noexcept;
+
+	/**
+	 * Submit a deferred format call (see
+	 * BasicLogger::FormatDeferred()); the writer thread will call
+	 * the function to format it.
+	 *
+	 * @return false if the record was dropped
+	 */
+	bool PushDeferred(StringView domain,
+			  LoggerDetail::DeferredFormatFunction function,
+			  const char *fmt, ConstBuffer<char> block) noexcept;
+
+	struct Stats {
+		uint64_t written, dropped;
+	};
+
+	Stats GetStats() const noexcept {
+		return {
+			written.load(std::memory_order_relaxed),
+			dropped.load(std::memory_order_relaxed),
+		};
+	}
+
+private:
+	ThreadBuffer *GetThreadBuffer() noexcept;
+
+	/**
+	 * Wake up the writer thread after a record has been
+	 * committed.
+	 */
+	void Notify() noexcept;
+
+	/**
+	 * Write all records which are currently in a ring buffer.
+	 *
+	 * @return the number of records
+	 */
+	size_t Flush() noexcept;
+
+	/**
+	 * Is there a record in any ring buffer?  Caller must hold
+	 * #mutex.
+	 */
+	gcc_pure
+	bool HasPending() const noexcept;
+
+	void ReportDropped() noexcept;
+
+	void Run() noexcept;
+};
@@ -0,0 +1,262 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BulkFileWriter.hxx"
+#include "system/Error.hxx"
+
+#include <algorithm>
+#include <new>
+
+#include <fcntl.h>
+#include <string.h>
+
+constexpr size_t BulkFileWriter::DEFAULT_BUFFER_SIZE;
+constexpr unsigned BulkFileWriter::DIRECT;
+constexpr unsigned BulkFileWriter::PACE;
+
+static constexpr size_t
+RoundUp(size_t size, size_t alignment) noexcept
+{
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+BulkFileWriter::BulkFileWriter(const char *path, size_t _buffer_size,
+			       unsigned _flags)
+	:file(path),
+	 buffer_size(RoundUp(std::max(_buffer_size, ALIGNMENT), ALIGNMENT)),
+	 flags(_flags),
+	 current(&buffers[0])
+{
+	for (auto &i : buffers) {
+		void *p;
+		if (posix_memalign(&p, ALIGNMENT, buffer_size) != 0)
+			throw std::bad_alloc();
+		i.data.reset((uint8_t *)p);
+	}
+
+	if (flags & DIRECT) {
+		const FileDescriptor fd = file.GetFileDescriptor();
+		const int fl = fcntl(fd.Get(), F_GETFL);
+		direct = fl >= 0 && fcntl(fd.Get(), F_SETFL, fl|O_DIRECT) == 0;
+	}
+
+	thread = std::thread(&BulkFileWriter::Run, this);
+}
+
+BulkFileWriter::~BulkFileWriter() noexcept
+{
+	StopThread();
+
+	/* the FileWriter destructor discards the file unless
+	   Commit() has succeeded */
+}
+
+void
+BulkFileWriter::StopThread() noexcept
+{
+	if (!thread.joinable())
+		return;
+
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+		cond.notify_all();
+	}
+
+	thread.join();
+}
+
+void
+BulkFileWriter::WaitIdle(std::unique_lock<std::mutex> &lock)
+{
+	cond.wait(lock, [this]{ return pending == nullptr; });
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void
+BulkFileWriter::Submit()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	WaitIdle(lock);
+
+	pending = current;
+	cond.notify_all();
+	lock.unlock();
+
+	current = current == &buffers[0] ? &buffers[1] : &buffers[0];
+	current->fill = 0;
+}
+
+void
+BulkFileWriter::Write(const void *_data, size_t size)
+{
+	const uint8_t *data = (const uint8_t *)_data;
+
+	while (size > 0) {
+		const size_t n = std::min(size, buffer_size - current->fill);
+		memcpy(current->data.get() + current->fill, data, n);
+		current->fill += n;
+		data += n;
+		size -= n;
+
+		if (current->fill == buffer_size)
+			Submit();
+	}
+}
+
+void
+BulkFileWriter::Commit()
+{
+	if (current->fill > 0)
+		Submit();
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		WaitIdle(lock);
+	}
+
+	StopThread();
+
+	if (flags & PACE)
+		/* wait for the last writeback, so Commit() returns
+		   with clean pages */
+		Pace(offset, 0);
+
+	file.Commit();
+}
+
+void
+BulkFileWriter::Pace(uint64_t start, uint64_t size) noexcept
+{
+	const int fd = file.GetFileDescriptor().Get();
+
+	/* start writeback of the new range */
+	if (size > 0)
+		sync_file_range(fd, start, size, SYNC_FILE_RANGE_WRITE);
+
+	/* wait for the previous range, which was submitted to the
+	   disk one round ago, and drop it from the page cache */
+	if (previous_size > 0) {
+		sync_file_range(fd, previous_offset, previous_size,
+				SYNC_FILE_RANGE_WAIT_BEFORE|
+				SYNC_FILE_RANGE_WRITE|
+				SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(fd, previous_offset, previous_size,
+			      POSIX_FADV_DONTNEED);
+	}
+
+	previous_offset = start;
+	previous_size = size;
+}
+
+void
+BulkFileWriter::WriteBuffer(const Buffer &buffer)
+{
+	const FileDescriptor fd = file.GetFileDescriptor();
+
+	if (direct && buffer.fill % ALIGNMENT != 0) {
+		/* the last (partial) buffer cannot be written with
+		   O_DIRECT */
+		const int fl = fcntl(fd.Get(), F_GETFL);
+		if (fl >= 0)
+			fcntl(fd.Get(), F_SETFL, fl & ~O_DIRECT);
+		direct = false;
+	}
+
+	const uint64_t start = offset;
+	const uint8_t *p = buffer.data.get();
+	size_t size = buffer.fill;
+
+	while (size > 0) {
+		ssize_t nbytes = pwrite(fd.Get(), p, size, offset);
+		if (nbytes < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EINVAL && direct) {
+				/* the file system refuses O_DIRECT
+				   after all */
+				const int fl = fcntl(fd.Get(), F_GETFL);
+				if (fl >= 0 &&
+				    fcntl(fd.Get(), F_SETFL, fl & ~O_DIRECT) == 0) {
+					direct = false;
+					continue;
+				}
+			}
+
+			throw MakeErrno("Failed to write file");
+		}
+
+		if (nbytes == 0)
+			throw std::runtime_error("Short write");
+
+		p += nbytes;
+		size -= nbytes;
+		offset += nbytes;
+	}
+
+	if ((flags & PACE) && !direct)
+		Pace(start, offset - start);
+}
+
+void
+BulkFileWriter::Run() noexcept
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		cond.wait(lock, [this]{ return pending != nullptr || quit; });
+		if (pending == nullptr)
+			break;
+
+		const Buffer &buffer = *pending;
+
+		lock.unlock();
+
+		std::exception_ptr e;
+		try {
+			WriteBuffer(buffer);
+		} catch (...) {
+			e = std::current_exception();
+		}
+
+		lock.lock();
+
+		if (e && !error)
+			error = std::move(e);
+
+		pending = nullptr;
+		cond.notify_all();
+	}
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "FileWriter.hxx"
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * A variant of #FileWriter for large files: data is collected in two
+ * aligned buffers, and a writer thread writes one of them while the
+ * caller fills the other one.  Write() blocks only if the writer
+ * thread is still busy when the second buffer is full.
+ *
+ * Like #FileWriter, the file appears at its final path only after
+ * Commit().
+ */
+class BulkFileWriter {
+public:
+	static constexpr size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+	/**
+	 * Open the file with O_DIRECT, bypassing the page cache.
+	 * This is silently ignored if the file system does not
+	 * support it.
+	 */
+	static constexpr unsigned DIRECT = 0x1;
+
+	/**
+	 * Start writeback of each buffer immediately (with
+	 * sync_file_range()), wait for the previous one, and drop the
+	 * written pages from the page cache.  This avoids bursts of
+	 * dirty pages and keeps the page cache for more useful data.
+	 */
+	static constexpr unsigned PACE = 0x2;
+
+private:
+	/**
+	 * The alignment of buffers, file offsets and sizes required
+	 * by O_DIRECT.
+	 */
+	static constexpr size_t ALIGNMENT = 4096;
+
+	struct Buffer {
+		struct FreeDeleter {
+			void operator()(void *p) const noexcept {
+				free(p);
+			}
+		};
+
+		std::unique_ptr<uint8_t[], FreeDeleter> data;
+
+		size_t fill = 0;
+	};
+
+	FileWriter file;
+
+	const size_t buffer_size;
+
+	const unsigned flags;
+
+	/**
+	 * Is O_DIRECT currently enabled on the file descriptor?
+	 * Only used by the writer thread.
+	 */
+	bool direct = false;
+
+	Buffer buffers[2];
+
+	/**
+	 * The buffer which is being filled by the caller.
+	 */
+	Buffer *current;
+
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	/**
+	 * The buffer which was submitted to the writer thread;
+	 * nullptr if the writer thread is idle.  Protected by
+	 * #mutex.
+	 */
+	Buffer *pending = nullptr;
+
+	/**
+	 * Protected by #mutex.
+	 */
+	bool quit = false;
+
+	/**
+	 * An error which occurred in the writer thread.  Protected by
+	 * #mutex.
+	 */
+	std::exception_ptr error;
+
+	/**
+	 * The file offset of the next write; only used by the writer
+	 * thread.
+	 */
+	uint64_t offset = 0;
+
+	/**
+	 * The range written by the previous write, to be waited for
+	 * with #PACE.  Only used by the writer thread.
+	 */
+	uint64_t previous_offset = 0, previous_size = 0;
+
+	std::thread thread;
+
+public:
+	/**
+	 * Throws std::system_error on error.
+	 *
+	 * @param _buffer_size the size of each of the two buffers;
+	 * rounded up to a multiple of 4 kB
+	 * @param _flags a combination of #DIRECT and #PACE
+	 */
+	explicit BulkFileWriter(const char *path,
+				size_t _buffer_size=DEFAULT_BUFFER_SIZE,
+				unsigned _flags=0);
+
+	/**
+	 * Discards the file if Commit() has not been called.
+	 */
+	~BulkFileWriter() noexcept;
+
+	BulkFileWriter(const BulkFileWriter &) = delete;
+	BulkFileWriter &operator=(const BulkFileWriter &) = delete;
+
+	/**
+	 * Preallocate space on the file system; see
+	 * FileWriter::Allocate().
+	 */
+	void Allocate(off_t size) {
+		file.Allocate(size);
+	}
+
+	/**
+	 * Throws on error (including errors from previous writes in
+	 * the writer thread).
+	 */
+	void Write(const void *data, size_t size);
+
+	/**
+	 * Write all pending data, wait for the writer thread and
+	 * commit the file.
+	 *
+	 * Throws on error.
+	 */
+	void Commit();
+
+private:
+	/**
+	 * Submit the #current buffer to the writer thread and switch
+	 * to the other one.
+	 */
+	void Submit();
+
+	/**
+	 * Wait until the writer thread is idle and rethrow its error.
+	 * Caller must hold the lock.
+	 */
+	void WaitIdle(std::unique_lock<std::mutex> &lock);
+
+	void StopThread() noexcept;
+
+	void WriteBuffer(const Buffer &buffer);
+	void Pace(uint64_t start, uint64_t size) noexcept;
+
+	void Run() noexcept;
+};
@@ -32,14 +32,16 @@
 
 #include "ConfigParser.hxx"
 #include "FileLineParser.hxx"
+#include "UniqueFileDescriptor.hxx"
 #include "system/Error.hxx"
-#include "util/ScopeExit.hxx"
 
 #include "util/Compiler.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <fnmatch.h>
+#include <string.h>
+#include <sys/stat.h>
 
 namespace fs = boost::filesystem;
 
@@ -296,19 +298,22 @@ IncludeConfigParser::Finish()
 		child.Finish();
 }
 
-inline void
-IncludeConfigParser::IncludePath(boost::filesystem::path &&p)
+static void
+ParseConfigFile(const boost::filesystem::path &path,
+		ConfigParser &parser, ConfigFileCache *cache);
+
+std::vector<fs::path>
+ExpandConfigPath(fs::path &&p)
 {
-	auto directory = p.parent_path();
-	if (directory.empty())
-		directory = ".";
+	std::vector<fs::path> files;
 
 	const auto pattern = p.filename();
 
 	if (pattern.native().find('*') != std::string::npos ||
 	    pattern.native().find('?') != std::string::npos) {
-
-		std::vector<fs::path> files;
+		auto directory = p.parent_path();
+		if (directory.empty())
+			directory = ".";
 
 		/* range-based for requires Boost 1.56 */
 		for (auto i = fs::directory_iterator(directory);
@@ -317,24 +322,129 @@ IncludeConfigParser::IncludePath(boost::filesystem::path &&p)
 				files.emplace_back(i->path());
 
 		std::sort(files.begin(), files.end());
+	} else
+		files.emplace_back(std::move(p));
 
-		for (auto &i : files) {
-			IncludeConfigParser sub(std::move(i), child, false);
-			ParseConfigFile(sub.path.c_str(), sub);
-		}
-	} else {
-		IncludeConfigParser sub(std::move(p), child, false);
-		ParseConfigFile(sub.path.c_str(), sub);
+	return files;
+}
+
+inline void
+IncludeConfigParser::IncludePath(boost::filesystem::path &&p)
+{
+	for (auto &i : ExpandConfigPath(std::move(p))) {
+		IncludeConfigParser sub(std::move(i), child, false, cache);
+		ParseConfigFile(sub.path, sub, cache);
+	}
+}
+
+static UniqueFileDescriptor
+OpenConfigFile(const boost::filesystem::path &path)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.OpenReadOnly(path.c_str()))
+		throw FormatErrno("Failed to open %s", path.c_str());
+
+	return fd;
+}
+
+/**
+ * Read the rest of the file into a null-terminated buffer.
+ *
+ * @param size_hint the expected size (from fstat())
+ */
+static AllocatedArray<char>
+ReadConfigFile(const boost::filesystem::path &path, FileDescriptor fd,
+	       size_t size_hint)
+{
+	/* for regular files, one read() usually reads all of it;
+	   the extra byte detects whether the file has grown */
+	AllocatedArray<char> buffer(size_hint + 2);
+	size_t fill = 0;
+
+	while (true) {
+		if (fill + 1 >= buffer.size())
+			buffer.GrowPreserve(buffer.size() * 2, fill);
+
+		ssize_t nbytes = fd.Read(&buffer[fill],
+					 buffer.size() - 1 - fill);
+		if (nbytes < 0)
+			throw FormatErrno("Failed to read %s", path.c_str());
+
+		if (nbytes == 0)
+			break;
+
+		fill += nbytes;
 	}
+
+	buffer[fill] = '\0';
+	buffer.SetSize(fill + 1);
+	return buffer;
+}
+
+AllocatedArray<char>
+LoadConfigFile(const boost::filesystem::path &path)
+{
+	auto fd = OpenConfigFile(path);
+	const off_t size = fd.GetSize();
+	return ReadConfigFile(path, fd.ToFileDescriptor(),
+			      size > 0 ? size : 4096);
 }
 
+AllocatedArray<char>
+ConfigFileCache::Load(const boost::filesystem::path &path)
+{
+	auto fd = OpenConfigFile(path);
+
+	struct stat st;
+	if (fstat(fd.Get(), &st) < 0)
+		throw FormatErrno("Failed to stat %s", path.c_str());
+
+	if (!S_ISREG(st.st_mode))
+		/* don't cache pipes and devices */
+		return ReadConfigFile(path, fd.ToFileDescriptor(), 4096);
+
+	auto i = items.find(path.native());
+	if (i != items.end() &&
+	    i->second.device == st.st_dev && i->second.inode == st.st_ino &&
+	    i->second.size == st.st_size &&
+	    i->second.mtime.tv_sec == st.st_mtim.tv_sec &&
+	    i->second.mtime.tv_nsec == st.st_mtim.tv_nsec)
+		/* unmodified: return a copy of the cached buffer,
+		   because the caller will modify it */
+		return AllocatedArray<char>(i->second.data);
+
+	auto data = ReadConfigFile(path, fd.ToFileDescriptor(), st.st_size);
+
+	Item &item = items[path.native()];
+	item.device = st.st_dev;
+	item.inode = st.st_ino;
+	item.size = st.st_size;
+	item.mtime = st.st_mtim;
+	item.data = AllocatedArray<char>(data);
+
+	return data;
+}
+
+/**
+ * Split the buffer into lines in place and pass them to the parser.
+ */
 static void
-ParseConfigFile(const boost::filesystem::path &path, FILE *file,
-		ConfigParser &parser)
+ParseConfigBuffer(const boost::filesystem::path &path,
+		  char *p, char *const end,
+		  ConfigParser &parser)
 {
-	char buffer[4096], *line;
 	unsigned i = 1;
-	while ((line = fgets(buffer, sizeof(buffer), file)) != nullptr) {
+	while (p < end) {
+		char *line = p;
+
+		/* memchr() is vectorized by the C library */
+		char *newline = (char *)memchr(p, '\n', end - p);
+		if (newline != nullptr) {
+			*newline = '\0';
+			p = newline + 1;
+		} else
+			p = end;
+
 		FileLineParser line_parser(path, line);
 
 		try {
@@ -348,40 +458,62 @@ ParseConfigFile(const boost::filesystem::path &path, FILE *file,
 	}
 }
 
+static void
+ParseConfigFile(const boost::filesystem::path &path,
+		AllocatedArray<char> &&buffer,
+		ConfigParser &parser)
+{
+	/* the last byte is the null terminator */
+	ParseConfigBuffer(path, &buffer.front(),
+			  &buffer.front() + buffer.size() - 1,
+			  parser);
+}
+
 inline void
 IncludeConfigParser::IncludeOptionalPath(boost::filesystem::path &&p)
 {
-	IncludeConfigParser sub(std::move(p), child, false);
-
-	FILE *file = fopen(sub.path.c_str(), "r");
-	if (file == nullptr) {
-		int e = errno;
-		switch (e) {
-		case ENOENT:
-		case ENOTDIR:
+	IncludeConfigParser sub(std::move(p), child, false, cache);
+
+	AllocatedArray<char> buffer;
+
+	try {
+		buffer = cache != nullptr
+			? cache->Load(sub.path)
+			: LoadConfigFile(sub.path);
+	} catch (const std::system_error &e) {
+		if (IsFileNotFound(e) || IsPathNotFound(e))
 			/* silently ignore this error */
 			return;
 
-		default:
-			throw FormatErrno(e, "Failed to open %s", sub.path.c_str());
-		}
+		throw;
 	}
 
-	AtScopeExit(file) { fclose(file); };
-
-	ParseConfigFile(sub.path.c_str(), file, sub);
+	ParseConfigFile(sub.path, std::move(buffer), sub);
 	sub.Finish();
 }
 
+static void
+ParseConfigFile(const boost::filesystem::path &path,
+		ConfigParser &parser, ConfigFileCache *cache)
+{
+	ParseConfigFile(path,
+			cache != nullptr
+			? cache->Load(path)
+			: LoadConfigFile(path),
+			parser);
+}
+
 void
 ParseConfigFile(const boost::filesystem::path &path, ConfigParser &parser)
 {
-	FILE *file = fopen(path.c_str(), "r");
-	if (file == nullptr)
-		throw FormatErrno("Failed to open %s", path.c_str());
-
-	AtScopeExit(file) { fclose(file); };
+	ParseConfigFile(path, parser, nullptr);
+	parser.Finish();
+}
 
-	ParseConfigFile(path, file, parser);
+void
+ParseConfigFile(const boost::filesystem::path &path, ConfigParser &parser,
+		ConfigFileCache &cache)
+{
+	ParseConfigFile(path, parser, &cache);
 	parser.Finish();
 }
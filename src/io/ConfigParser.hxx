@@ -33,13 +33,81 @@
 #ifndef CONFIG_PARSER_HXX
 #define CONFIG_PARSER_HXX
 
+#include "util/AllocatedArray.hxx"
+
 #include <boost/filesystem.hpp>
 
 #include <memory>
 #include <map>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <time.h>
 
 class FileLineParser;
 
+/**
+ * Keeps the contents of configuration files in memory, so files which
+ * are included several times or which did not change since the last
+ * reload do not need to be read again.  Files are identified by their
+ * path, and an entry is only used if the inode, size and modification
+ * time are still the same.
+ */
+class ConfigFileCache {
+	struct Item {
+		dev_t device;
+		ino_t inode;
+		off_t size;
+		struct timespec mtime;
+
+		AllocatedArray<char> data;
+	};
+
+	std::map<std::string, Item> items;
+
+public:
+	/**
+	 * Load the file into a new null-terminated buffer, from the
+	 * cache if possible.  The caller may modify the buffer.
+	 *
+	 * Throws std::system_error on error.
+	 */
+	AllocatedArray<char> Load(const boost::filesystem::path &path);
+
+	/**
+	 * Invoke the given function for each cached file (sorted by
+	 * path) with the path and the file contents (without the null
+	 * terminator).
+	 */
+	template<typename F>
+	void ForEach(F &&f) const {
+		for (const auto &i : items)
+			f(i.first, i.second.data.size() - 1,
+			  &i.second.data.front());
+	}
+
+	/**
+	 * Forget all cached files.
+	 */
+	void Clear() noexcept {
+		items.clear();
+	}
+
+	size_t size() const noexcept {
+		return items.size();
+	}
+};
+
+/**
+ * Read the whole file into a new null-terminated buffer.  The
+ * buffer size is the file size plus one.
+ *
+ * Throws std::system_error on error.
+ */
+AllocatedArray<char>
+LoadConfigFile(const boost::filesystem::path &path);
+
 class ConfigParser {
 public:
 	virtual ~ConfigParser() {}
@@ -135,12 +203,18 @@ class IncludeConfigParser final : public ConfigParser {
 	 */
 	const bool finish_child;
 
+	ConfigFileCache *const cache;
+
 public:
+	/**
+	 * @param _cache an optional cache for included files
+	 */
 	IncludeConfigParser(boost::filesystem::path &&_path,
 			    ConfigParser &_child,
-			    bool _finish_child=true)
+			    bool _finish_child=true,
+			    ConfigFileCache *_cache=nullptr)
 		:path(std::move(_path)), child(_child),
-		 finish_child(_finish_child) {}
+		 finish_child(_finish_child), cache(_cache) {}
 
 	/* virtual methods from class ConfigParser */
 	bool PreParseLine(FileLineParser &line) override;
@@ -152,7 +226,25 @@ private:
 	void IncludeOptionalPath(boost::filesystem::path &&p);
 };
 
+/**
+ * Expand a path which may contain wildcards ('*' and '?') in its last
+ * segment, like "@include" does.
+ *
+ * @return a sorted list of matching paths (or just the given path if
+ * there are no wildcards)
+ */
+std::vector<boost::filesystem::path>
+ExpandConfigPath(boost::filesystem::path &&p);
+
+/**
+ * Parse a configuration file.  The whole file is read at once, and
+ * lines are passed to the #ConfigParser without copying them.
+ */
 void
 ParseConfigFile(const boost::filesystem::path &path, ConfigParser &parser);
 
+void
+ParseConfigFile(const boost::filesystem::path &path, ConfigParser &parser,
+		ConfigFileCache &cache);
+
 #endif
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "IncrementalConfigLoader.hxx"
+#include "ConfigParser.hxx"
+#include "util/FastHash.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <set>
+#include <system_error>
+#include <thread>
+
+namespace fs = boost::filesystem;
+
+struct IncrementalConfigLoader::Job {
+	fs::path path;
+
+	/**
+	 * The previous state of this file or nullptr if it is new.
+	 */
+	const File *old;
+
+	/**
+	 * Was the file (re)parsed?  If not, it is unmodified.
+	 */
+	bool modified = true;
+
+	std::unique_ptr<ConfigParser> parser;
+
+	File file;
+
+	std::exception_ptr error;
+
+	Job(fs::path &&_path, const File *_old) noexcept
+		:path(std::move(_path)), old(_old) {}
+};
+
+static uint64_t
+HashFile(uint64_t hash, const std::string &path,
+	 size_t size, const char *data) noexcept
+{
+	hash = FastHash64(path.data(), path.size(), hash);
+	return FastHash64(data, size, hash);
+}
+
+bool
+IncrementalConfigLoader::IsModified(const File &file) noexcept
+{
+	uint64_t hash = 0;
+
+	try {
+		for (const auto &path : file.dependencies) {
+			const auto data = LoadConfigFile(path);
+			hash = HashFile(hash, path.native(),
+					data.size() - 1, &data.front());
+		}
+	} catch (...) {
+		/* a file has been deleted or cannot be read anymore:
+		   let the parser report the error */
+		return true;
+	}
+
+	return hash != file.hash;
+}
+
+void
+IncrementalConfigLoader::Run(Job &job) noexcept
+{
+	if (job.old != nullptr && !IsModified(*job.old)) {
+		job.modified = false;
+		return;
+	}
+
+	try {
+		job.parser = handler.CreateConfigParser(job.path);
+
+		/* this cache records all files which are read */
+		ConfigFileCache cache;
+		IncludeConfigParser include(fs::path(job.path), *job.parser,
+					    true, &cache);
+		ParseConfigFile(job.path, include, cache);
+
+		uint64_t hash = 0;
+		cache.ForEach([&job, &hash](const std::string &path,
+					    size_t size, const char *data){
+			hash = HashFile(hash, path, size, data);
+			job.file.dependencies.emplace_back(path);
+		});
+
+		job.file.hash = hash;
+	} catch (...) {
+		job.error = std::current_exception();
+	}
+}
+
+size_t
+IncrementalConfigLoader::Reload()
+{
+	std::vector<Job> jobs;
+	std::set<std::string> seen;
+
+	for (const auto &pattern : patterns) {
+		for (auto &path : ExpandConfigPath(fs::path(pattern))) {
+			if (!seen.emplace(path.native()).second)
+				/* duplicate */
+				continue;
+
+			auto i = files.find(path.native());
+			jobs.emplace_back(std::move(path),
+					  i != files.end() ? &i->second : nullptr);
+		}
+	}
+
+	/* check and parse in parallel */
+
+	std::atomic_size_t next{0};
+	auto worker = [this, &jobs, &next](){
+		size_t i;
+		while ((i = next.fetch_add(1)) < jobs.size())
+			Run(jobs[i]);
+	};
+
+	const size_t n_workers = std::min<size_t>(n_threads, jobs.size());
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < n_workers; ++i) {
+		try {
+			threads.emplace_back(worker);
+		} catch (const std::system_error &) {
+			/* continue with fewer threads */
+			break;
+		}
+	}
+
+	worker();
+
+	for (auto &t : threads)
+		t.join();
+
+	for (const auto &job : jobs)
+		if (job.error)
+			std::rethrow_exception(job.error);
+
+	/* apply the changes */
+
+	std::map<std::string, File> new_files;
+	size_t n_changes = 0;
+
+	for (auto &job : jobs) {
+		if (job.modified) {
+			handler.OnConfigFileChanged(job.path,
+						    std::move(job.parser));
+			new_files.emplace(job.path.native(),
+					  std::move(job.file));
+			++n_changes;
+		} else
+			new_files.emplace(job.path.native(),
+					  std::move(files[job.path.native()]));
+	}
+
+	for (const auto &i : files) {
+		if (new_files.find(i.first) == new_files.end()) {
+			handler.OnConfigFileRemoved(i.first);
+			++n_changes;
+		}
+	}
+
+	files = std::move(new_files);
+	return n_changes;
+}
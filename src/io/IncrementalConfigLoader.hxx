@@ -0,0 +1,151 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+class ConfigParser;
+
+/**
+ * Receives the results of IncrementalConfigLoader::Reload().
+ */
+class IncrementalConfigHandler {
+public:
+	/**
+	 * Create a new parser for the given configuration file.  This
+	 * is called from worker threads, possibly concurrently, so it
+	 * must be thread-safe.
+	 *
+	 * Throws on error.
+	 */
+	virtual std::unique_ptr<ConfigParser> CreateConfigParser(const boost::filesystem::path &path) = 0;
+
+	/**
+	 * A file is new or has been modified; the given parser has
+	 * parsed it successfully.  Called in the thread which called
+	 * Reload().
+	 */
+	virtual void OnConfigFileChanged(const boost::filesystem::path &path,
+					 std::unique_ptr<ConfigParser> &&parser) = 0;
+
+	/**
+	 * A file has been removed (or does not match the patterns
+	 * anymore).
+	 */
+	virtual void OnConfigFileRemoved(const boost::filesystem::path &path) = 0;
+};
+
+/**
+ * Loads a set of independent configuration files (e.g. one file per
+ * virtual host) and reloads only those which have changed.
+ *
+ * Each file gets its own #ConfigParser, which may use "@include".  A
+ * file counts as changed if its contents or the contents of one of
+ * its included files have changed; this is checked with a hash.
+ * Changed files are parsed in parallel.
+ *
+ * Limitation: a wildcard "@include" inside a file is expanded only
+ * when that file is parsed, so a new file matching that wildcard is
+ * noticed only after the including file has changed.
+ */
+class IncrementalConfigLoader {
+	struct File {
+		/**
+		 * A hash of the paths and contents of this file and
+		 * all files included by it.
+		 */
+		uint64_t hash;
+
+		/**
+		 * All files which were read while parsing this file
+		 * (including itself).
+		 */
+		std::vector<boost::filesystem::path> dependencies;
+	};
+
+	const std::vector<boost::filesystem::path> patterns;
+
+	IncrementalConfigHandler &handler;
+
+	const unsigned n_threads;
+
+	std::map<std::string, File> files;
+
+public:
+	/**
+	 * @param _patterns the paths of the configuration files; the
+	 * last segment may contain wildcards (see ExpandConfigPath())
+	 * @param _n_threads the maximum number of worker threads
+	 */
+	IncrementalConfigLoader(std::vector<boost::filesystem::path> &&_patterns,
+				IncrementalConfigHandler &_handler,
+				unsigned _n_threads) noexcept
+		:patterns(std::move(_patterns)), handler(_handler),
+		 n_threads(_n_threads) {}
+
+	/**
+	 * Check all files, parse those which have changed and invoke
+	 * the #IncrementalConfigHandler for each difference to the
+	 * previous call.  If a file fails to parse, the exception is
+	 * rethrown and no handler method is invoked (i.e. all or
+	 * nothing gets applied).
+	 *
+	 * @return the number of files which were changed or removed
+	 */
+	size_t Reload();
+
+	/**
+	 * The number of files which are currently loaded.
+	 */
+	size_t size() const noexcept {
+		return files.size();
+	}
+
+private:
+	struct Job;
+
+	/**
+	 * Has the file (or one of its dependencies) changed since it
+	 * was loaded?
+	 */
+	static bool IsModified(const File &file) noexcept;
+
+	void Run(Job &job) noexcept;
+};
@@ -31,6 +31,7 @@
  */
 
 #include "Logger.hxx"
+#include "AsyncLogger.hxx"
 #include "util/StaticArray.hxx"
 #include "util/Exception.hxx"
 
@@ -60,6 +61,14 @@ void
 LoggerDetail::WriteV(StringView domain,
 		     ConstBuffer<StringView> buffers) noexcept
 {
+	AsyncLogger *async = AsyncLogger::GetInstalled();
+	if (async != nullptr) {
+		/* never block; if the ring buffer is full, the record
+		   is dropped */
+		async->Push(domain, buffers);
+		return;
+	}
+
 	StaticArray<struct iovec, 64> v;
 
 	if (!domain.empty()) {
@@ -99,6 +108,21 @@ LoggerDetail::Format(unsigned level, StringView domain,
 	WriteV(domain, {&s, 1});
 }
 
+void
+LoggerDetail::WriteDeferred(StringView domain, DeferredFormatFunction function,
+			    const char *fmt, ConstBuffer<char> block) noexcept
+{
+	AsyncLogger *async = AsyncLogger::GetInstalled();
+	if (async != nullptr) {
+		async->PushDeferred(domain, function, fmt, block);
+		return;
+	}
+
+	char buffer[2048];
+	StringView s(buffer, function(buffer, sizeof(buffer), fmt, block.data));
+	WriteV(domain, {&s, 1});
+}
+
 std::string
 ChildLoggerDomain::Make(StringView parent, const char *name)
 {
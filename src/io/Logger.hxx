@@ -37,13 +37,27 @@
 #include "util/ConstBuffer.hxx"
 #include "util/Compiler.h"
 
+#include <algorithm>
 #include <string>
 #include <array>
 #include <exception>
+#include <initializer_list>
+#include <tuple>
+#include <type_traits>
 
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 
+/**
+ * Log messages with a level above this value are compiled out
+ * completely.  Define this macro (e.g. -DLOGGER_MAX_LEVEL=3) to strip
+ * verbose trace messages from release builds.
+ */
+#ifndef LOGGER_MAX_LEVEL
+#define LOGGER_MAX_LEVEL (~0u)
+#endif
+
 namespace LoggerDetail {
 
 template<typename T>
@@ -210,7 +224,7 @@ extern unsigned max_level;
 inline bool
 CheckLevel(unsigned level)
 {
-	return level <= max_level;
+	return level <= LOGGER_MAX_LEVEL && level <= max_level;
 }
 
 void
@@ -232,6 +246,232 @@ gcc_printf(3, 4)
 void
 Format(unsigned level, StringView domain, const char *fmt, ...) noexcept;
 
+/**
+ * The maximum size of all string arguments of one deferred format
+ * call; longer strings are truncated.
+ */
+static constexpr size_t MAX_DEFERRED_STRINGS = 1024;
+
+/**
+ * Formats a deferred record: #block contains the packed arguments
+ * followed by copies of their strings.
+ *
+ * @return the length of the formatted string (truncated to size-1)
+ */
+typedef size_t (*DeferredFormatFunction)(char *dest, size_t size,
+					 const char *fmt,
+					 const char *block);
+
+/**
+ * Copies string arguments of a deferred format call.
+ */
+class DeferredStringWriter {
+	char *const base;
+
+	/**
+	 * An empty string which is used when the string area is
+	 * full.
+	 */
+	char *const empty;
+
+	char *p;
+	char *const end;
+
+public:
+	/**
+	 * @param _base the start of the block (offsets are relative
+	 * to it)
+	 * @param _p the start of the string area
+	 * @param size the size of the string area
+	 */
+	DeferredStringWriter(char *_base, char *_p, size_t size) noexcept
+		:base(_base), empty(_p), p(_p + 1), end(_p + size) {
+		*empty = '\0';
+	}
+
+	/**
+	 * @return the offset of the copy within the block
+	 */
+	uint32_t Append(const char *s) noexcept {
+		if (s == nullptr)
+			s = "(null)";
+
+		if (p == end)
+			return empty - base;
+
+		const size_t length = std::min(strlen(s), size_t(end - p - 1));
+		char *const result = p;
+		memcpy(p, s, length);
+		p += length;
+		*p++ = '\0';
+		return result - base;
+	}
+
+	size_t GetBlockSize() const noexcept {
+		return p - base;
+	}
+};
+
+/**
+ * Describes how an argument of a deferred format call is stored.
+ * Only arithmetic types, enums and pointers are allowed, because
+ * they can be copied; the objects they point to are not copied and
+ * must stay valid (except for strings).
+ */
+template<typename T, typename Enable=void>
+struct DeferredArg {
+	static_assert(std::is_arithmetic<T>::value ||
+		      std::is_enum<T>::value ||
+		      std::is_pointer<T>::value,
+		      "Unsupported deferred format argument");
+
+	typedef T Stored;
+
+	static Stored Store(T value, DeferredStringWriter &) noexcept {
+		return value;
+	}
+
+	static T Load(Stored value, const char *) noexcept {
+		return value;
+	}
+};
+
+/**
+ * C strings are copied into the record, because they are usually
+ * not valid anymore when the record gets formatted.
+ */
+template<>
+struct DeferredArg<const char *> {
+	typedef uint32_t Stored;
+
+	static Stored Store(const char *value,
+			    DeferredStringWriter &strings) noexcept {
+		return strings.Append(value);
+	}
+
+	static const char *Load(Stored offset, const char *block) noexcept {
+		return block + offset;
+	}
+};
+
+template<>
+struct DeferredArg<char *> : DeferredArg<const char *> {};
+
+template<>
+struct DeferredArg<std::string> {
+	typedef uint32_t Stored;
+
+	static Stored Store(const std::string &value,
+			    DeferredStringWriter &strings) noexcept {
+		return strings.Append(value.c_str());
+	}
+
+	static const char *Load(Stored offset, const char *block) noexcept {
+		return block + offset;
+	}
+};
+
+template<typename T>
+inline void
+WritePacked(char *&p, const T &value) noexcept
+{
+	memcpy(p, &value, sizeof(value));
+	p += sizeof(value);
+}
+
+template<typename T>
+inline T
+ReadPacked(const char *&p) noexcept
+{
+	T value;
+	memcpy(&value, p, sizeof(value));
+	p += sizeof(value);
+	return value;
+}
+
+template<typename... T>
+struct PackedSize : std::integral_constant<size_t, 0> {};
+
+template<typename T, typename... Rest>
+struct PackedSize<T, Rest...>
+	: std::integral_constant<size_t, sizeof(T) + PackedSize<Rest...>::value> {};
+
+/**
+ * Look up the #DeferredArg for a parameter type, e.g. string
+ * literals are passed as "const char *".
+ */
+template<typename T>
+using DeferredArgFor = DeferredArg<typename std::decay<T>::type>;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+
+template<typename... Args>
+struct DeferredFormatter {
+	template<size_t... I>
+	static size_t Format(char *dest, size_t size, const char *fmt,
+			     const char *block,
+			     std::index_sequence<I...>) noexcept {
+		const char *p = block;
+
+		/* list-initialization evaluates from left to right */
+		const std::tuple<typename DeferredArg<Args>::Stored...> args{
+			ReadPacked<typename DeferredArg<Args>::Stored>(p)...
+		};
+		(void)args;
+
+		/* unused if the parameter pack is empty */
+		(void)p;
+
+		const int length = snprintf(dest, size, fmt,
+					    DeferredArg<Args>::Load(std::get<I>(args), block)...);
+		if (length < 0)
+			return 0;
+
+		return std::min(size_t(length), size - 1);
+	}
+
+	static size_t Format(char *dest, size_t size, const char *fmt,
+			     const char *block) noexcept {
+		return Format(dest, size, fmt, block,
+			      std::index_sequence_for<Args...>());
+	}
+};
+
+#pragma GCC diagnostic pop
+
+void
+WriteDeferred(StringView domain, DeferredFormatFunction function,
+	      const char *fmt, ConstBuffer<char> block) noexcept;
+
+template<typename... Args>
+void
+FormatDeferred(StringView domain, const char *fmt,
+	       const Args &... args) noexcept
+{
+	static constexpr size_t packed_size =
+		PackedSize<typename DeferredArgFor<Args>::Stored...>::value;
+
+	char block[packed_size + MAX_DEFERRED_STRINGS];
+	char *p = block;
+	DeferredStringWriter strings(block, block + packed_size,
+				     MAX_DEFERRED_STRINGS);
+
+	/* list-initialization evaluates from left to right */
+	(void)std::initializer_list<int>{
+		(WritePacked(p, DeferredArgFor<Args>::Store(args, strings)), 0)...
+	};
+
+	/* unused if the parameter pack is empty */
+	(void)p;
+
+	WriteDeferred(domain,
+		      &DeferredFormatter<typename std::decay<Args>::type...>::Format,
+		      fmt,
+		      {block, strings.GetBlockSize()});
+}
+
 } /* namespace LoggerDetail */
 
 inline void
@@ -263,7 +503,12 @@ LogFormat(unsigned level, D &&domain,
 			     fmt, std::forward<Params>(params)...);
 }
 
-template<typename Domain>
+/**
+ * @param MAX_LEVEL messages with a level above this value are
+ * compiled out; this only works if the level is a compile-time
+ * constant (or if Log() is used)
+ */
+template<typename Domain, unsigned MAX_LEVEL=LOGGER_MAX_LEVEL>
 class BasicLogger : public Domain {
 public:
 	BasicLogger() = default;
@@ -273,11 +518,28 @@ public:
 		:Domain(std::forward<D>(_domain)) {}
 
 	static bool CheckLevel(unsigned level) {
-		return LoggerDetail::CheckLevel(level);
+		return level <= MAX_LEVEL && LoggerDetail::CheckLevel(level);
 	}
 
 	template<typename... Params>
 	void operator()(unsigned level, Params... params) const noexcept {
+		if (level > MAX_LEVEL)
+			return;
+
+		LoggerDetail::LogConcat(level, GetDomain(),
+					std::forward<Params>(params)...);
+	}
+
+	/**
+	 * Like operator(), but the level is a template argument, which
+	 * guarantees that no code is generated for levels above
+	 * #MAX_LEVEL.
+	 */
+	template<unsigned level, typename... Params>
+	void Log(Params... params) const noexcept {
+		if (level > MAX_LEVEL)
+			return;
+
 		LoggerDetail::LogConcat(level, GetDomain(),
 					std::forward<Params>(params)...);
 	}
@@ -285,10 +547,29 @@ public:
 	template<typename... Params>
 	void Format(unsigned level,
 		    const char *fmt, Params... params) const noexcept {
+		if (level > MAX_LEVEL)
+			return;
+
 		LoggerDetail::Format(level, GetDomain(),
 				     fmt, std::forward<Params>(params)...);
 	}
 
+	/**
+	 * Like Format(), but with an #AsyncLogger, the arguments are
+	 * only copied, and the expensive formatting happens in the
+	 * writer thread.  The format string must be a literal (or
+	 * otherwise stay valid forever).  String arguments are
+	 * copied; other pointers are not dereferenced by the
+	 * caller's thread.
+	 */
+	template<typename... Params>
+	void FormatDeferred(unsigned level, const char *fmt,
+			    const Params &... params) const noexcept {
+		if (CheckLevel(level))
+			LoggerDetail::FormatDeferred(GetDomain(), fmt,
+						     params...);
+	}
+
 	StringView GetDomain() const {
 		return Domain::GetDomain();
 	}
@@ -31,24 +31,48 @@
  */
 
 #include "MultiWriteBuffer.hxx"
+#include "net/ZeroCopy.hxx"
 #include "system/Error.hxx"
 
+#include <sys/socket.h>
 #include <sys/uio.h>
 #include <errno.h>
 
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+constexpr size_t MultiWriteBuffer::ZEROCOPY_THRESHOLD;
+
+size_t
+MultiWriteBuffer::GetSize() const
+{
+    size_t size = 0;
+    for (unsigned k = i; k != n; ++k)
+        size += buffers[k].GetSize();
+    return size;
+}
+
+size_t
+MultiWriteBuffer::PrepareIovec(iovec *v) const
+{
+    for (unsigned k = i; k != n; ++k) {
+        v[k - i].iov_base = const_cast<void *>(buffers[k].GetData());
+        v[k - i].iov_len = buffers[k].GetSize();
+    }
+
+    return n - i;
+}
+
 MultiWriteBuffer::Result
 MultiWriteBuffer::Write(int fd)
 {
     assert(i < n);
 
     std::array<iovec, MAX_BUFFERS> iov;
+    const size_t n_iov = PrepareIovec(iov.data());
 
-    for (unsigned k = i; k != n; ++k) {
-        iov[k].iov_base = const_cast<void *>(buffers[k].GetData());
-        iov[k].iov_len = buffers[k].GetSize();
-    };
-
-    ssize_t nbytes = writev(fd, &iov[i], n - i);
+    ssize_t nbytes = writev(fd, iov.data(), n_iov);
     if (nbytes < 0) {
         switch (errno) {
         case EAGAIN:
@@ -60,9 +84,56 @@ MultiWriteBuffer::Write(int fd)
         }
     }
 
+    return Consume(nbytes);
+}
+
+MultiWriteBuffer::Result
+MultiWriteBuffer::Send(int fd, ZeroCopyTracker *zerocopy)
+{
+    assert(i < n);
+
+    std::array<iovec, MAX_BUFFERS> iov;
+
+    struct msghdr msg{};
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = PrepareIovec(iov.data());
+
+    int flags = MSG_NOSIGNAL|MSG_DONTWAIT;
+    if (zerocopy != nullptr && GetSize() >= ZEROCOPY_THRESHOLD)
+        flags |= MSG_ZEROCOPY;
+
+    ssize_t nbytes = sendmsg(fd, &msg, flags);
+    if (nbytes < 0) {
+        switch (errno) {
+        case EAGAIN:
+        case EINTR:
+            return Result::MORE;
+
+        case ENOBUFS:
+            if (flags & MSG_ZEROCOPY)
+                /* the socket's optmem limit for pinned pages
+                   is exhausted; try again after completions
+                   have been received */
+                return Result::MORE;
+
+            break;
+        }
+
+        throw MakeErrno("Failed to send");
+    }
+
+    if (flags & MSG_ZEROCOPY)
+        zerocopy->OnSent();
+
+    return Consume(nbytes);
+}
+
+MultiWriteBuffer::Result
+MultiWriteBuffer::Consume(size_t nbytes)
+{
     while (i != n) {
         WriteBuffer &b = buffers[i];
-        if (size_t(nbytes) < b.GetSize()) {
+        if (nbytes < b.GetSize()) {
             b.buffer += nbytes;
             return Result::MORE;
         }
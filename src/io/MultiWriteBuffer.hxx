@@ -39,6 +39,9 @@
 #include <cstddef>
 #include <cassert>
 
+struct iovec;
+class ZeroCopyTracker;
+
 class MultiWriteBuffer {
     static constexpr size_t MAX_BUFFERS = 32;
 
@@ -49,6 +52,22 @@ class MultiWriteBuffer {
 public:
     typedef WriteBuffer::Result Result;
 
+    /**
+     * Send() uses MSG_ZEROCOPY only if at least this many bytes
+     * are pending; below that, the page pinning and the
+     * completion notification cost more than the copy.
+     */
+    static constexpr size_t ZEROCOPY_THRESHOLD = 16384;
+
+    bool IsEmpty() const {
+        return i == n;
+    }
+
+    /**
+     * Returns the number of bytes which have not yet been written.
+     */
+    size_t GetSize() const;
+
     void Push(const void *buffer, size_t size) {
         assert(n < buffers.size());
 
@@ -59,6 +78,26 @@ public:
      * Throws std::system_error on error.
      */
     Result Write(int fd);
+
+    /**
+     * Like Write(), but submit all pending buffers to a
+     * (non-blocking) socket with one sendmsg() call
+     * (MSG_NOSIGNAL).
+     *
+     * Throws std::system_error on error.
+     *
+     * @param zerocopy if not nullptr, then MSG_ZEROCOPY is used
+     * for large amounts of data (SO_ZEROCOPY must have been
+     * enabled, see ZeroCopyTracker::Enable()), and each such send
+     * is registered with this object; the buffers must remain
+     * valid until it reports their completion
+     */
+    Result Send(int fd, ZeroCopyTracker *zerocopy=nullptr);
+
+private:
+    size_t PrepareIovec(iovec *v) const;
+
+    Result Consume(size_t nbytes);
 };
 
 #endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "UniqueFileDescriptor.hxx"
+
+#include <vector>
+
+/**
+ * A pair of non-blocking pipe file descriptors, e.g. for moving data
+ * between two sockets with splice().
+ */
+struct PipePair {
+	UniqueFileDescriptor r, w;
+
+	bool IsDefined() const noexcept {
+		return r.IsDefined();
+	}
+};
+
+/**
+ * Keeps idle pipes around for reuse, to avoid two pipe2() and two
+ * close() system calls per splice() transfer.  This class is not
+ * thread-safe.
+ */
+class PipePool {
+	const size_t max_idle;
+
+	std::vector<PipePair> idle;
+
+public:
+	explicit PipePool(size_t _max_idle=16) noexcept
+		:max_idle(_max_idle) {}
+
+	PipePool(const PipePool &) = delete;
+	PipePool &operator=(const PipePool &) = delete;
+
+	/**
+	 * Obtain an empty pipe, either from the pool or a new one.
+	 *
+	 * Throws std::system_error on error.
+	 */
+	PipePair Get();
+
+	/**
+	 * Return a pipe to the pool.  The caller must make sure it is
+	 * empty; a pipe which still contains data must be closed
+	 * instead.
+	 */
+	void Put(PipePair &&pipe) noexcept;
+
+	/**
+	 * Close all idle pipes.
+	 */
+	void Clear() noexcept {
+		idle.clear();
+	}
+};
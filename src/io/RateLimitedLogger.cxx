@@ -0,0 +1,135 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "RateLimitedLogger.hxx"
+#include "util/FastHash.hxx"
+#include "util/DecimalFormat.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+constexpr int LogRateLimiter::SUPPRESS;
+
+int
+LogRateLimiter::Check(uint64_t hash, Clock::time_point now) noexcept
+{
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	auto &e = entries[hash % entries.size()];
+	if (e.hash != hash || e.count == 0) {
+		/* a new message (or a collision, which forgets the
+		   old one) */
+		e.hash = hash;
+		e.start = now;
+		e.count = 1;
+		e.suppressed = 0;
+		return 0;
+	}
+
+	if (now - e.start >= interval) {
+		/* a new interval: log it and report how many were
+		   suppressed in the previous one */
+		const int result = e.suppressed;
+		e.start = now;
+		e.count = 1;
+		e.suppressed = 0;
+		return result;
+	}
+
+	if (e.count < burst) {
+		++e.count;
+		return 0;
+	}
+
+	++e.suppressed;
+	return SUPPRESS;
+}
+
+uint64_t
+LogRateLimiter::Hash(unsigned level, ConstBuffer<StringView> values) noexcept
+{
+	uint64_t hash = level;
+	for (const auto &i : values)
+		hash = FastHash64(i, hash);
+
+	/* 0 marks an unused entry */
+	return hash != 0 ? hash : 1;
+}
+
+void
+LogRateLimiter::Write(StringView domain, uint64_t hash,
+		      ConstBuffer<StringView> values) noexcept
+{
+	const int suppressed = Check(hash, Clock::now());
+	if (suppressed == SUPPRESS)
+		return;
+
+	if (suppressed == 0 || values.size > 60) {
+		LoggerDetail::WriteV(domain, values);
+		return;
+	}
+
+	/* append a note about the suppressed messages */
+
+	char number[20];
+	char *const number_end = number + sizeof(number);
+	const char *number_begin = format_uint64_backwards(number_end,
+							   suppressed);
+
+	StringView v[64];
+	std::copy(values.begin(), values.end(), v);
+	size_t n = values.size;
+	v[n++] = " (";
+	v[n++] = {number_begin, size_t(number_end - number_begin)};
+	v[n++] = " similar messages suppressed)";
+
+	LoggerDetail::WriteV(domain, {v, n});
+}
+
+void
+LogRateLimiter::Format(StringView domain, unsigned level,
+		       const char *fmt, ...) noexcept
+{
+	char buffer[2048];
+
+	va_list ap;
+	va_start(ap, fmt);
+	int length = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+	va_end(ap);
+
+	if (length < 0)
+		return;
+
+	const StringView s(buffer,
+			   std::min(size_t(length), sizeof(buffer) - 1));
+	Write(domain, Hash(level, {&s, 1}), {&s, 1});
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Logger.hxx"
+
+#include <array>
+#include <chrono>
+#include <mutex>
+
+#include <stdint.h>
+
+/**
+ * Keeps track of how often identical log messages were emitted
+ * recently.  This class is thread-safe.
+ */
+class LogRateLimiter {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+private:
+	struct Entry {
+		uint64_t hash = 0;
+		Clock::time_point start;
+		unsigned count = 0;
+		unsigned suppressed = 0;
+	};
+
+	/**
+	 * A small direct-mapped table; if two messages collide, the
+	 * older one is forgotten.
+	 */
+	std::array<Entry, 64> entries;
+
+	std::mutex mutex;
+
+	const Clock::duration interval;
+
+	const unsigned burst;
+
+public:
+	/**
+	 * @param _burst the number of identical messages which are
+	 * logged per interval
+	 * @param _interval the duration of an interval
+	 */
+	LogRateLimiter(unsigned _burst, Clock::duration _interval) noexcept
+		:interval(_interval), burst(_burst) {}
+
+	static constexpr int SUPPRESS = -1;
+
+	/**
+	 * Check whether a message with the given hash may be logged.
+	 *
+	 * @return #SUPPRESS if the message shall be suppressed, or
+	 * the number of identical messages which were suppressed
+	 * since the last one was logged
+	 */
+	int Check(uint64_t hash, Clock::time_point now) noexcept;
+
+	gcc_pure
+	static uint64_t Hash(unsigned level,
+			     ConstBuffer<StringView> values) noexcept;
+
+	/**
+	 * Write the message unless it is suppressed.
+	 */
+	void Write(StringView domain, uint64_t hash,
+		   ConstBuffer<StringView> values) noexcept;
+
+	/**
+	 * Format and write the message unless it is suppressed.
+	 */
+	gcc_printf(4, 5)
+	void Format(StringView domain, unsigned level,
+		    const char *fmt, ...) noexcept;
+};
+
+/**
+ * A #BasicLogger which suppresses identical messages: of those, only
+ * the first "burst" per interval are logged.  When the next message
+ * is logged after an interval, it carries a note saying how many
+ * were suppressed.
+ *
+ * By default, messages are identical if their level and text are
+ * equal.  With Keyed(), the caller specifies the key instead, so
+ * messages which differ only in details (e.g. an address) can be
+ * grouped.
+ */
+template<typename Domain>
+class BasicRateLimitedLogger : public BasicLogger<Domain> {
+	typedef BasicLogger<Domain> Base;
+
+	mutable LogRateLimiter limiter;
+
+public:
+	template<typename D>
+	BasicRateLimitedLogger(D &&_domain, unsigned burst,
+			       LogRateLimiter::Clock::duration interval)
+		:Base(std::forward<D>(_domain)),
+		 limiter(burst, interval) {}
+
+	template<typename... Params>
+	void operator()(unsigned level, Params... params) const noexcept {
+		if (!Base::CheckLevel(level))
+			return;
+
+		const LoggerDetail::ParamArray<Params...> a(params...);
+		const ConstBuffer<StringView> values(&a.values.front(),
+						      a.values.size());
+		limiter.Write(Base::GetDomain(),
+			      LogRateLimiter::Hash(level, values), values);
+	}
+
+	/**
+	 * Log a message, suppressing it if too many messages with the
+	 * same level and key have been logged.
+	 */
+	template<typename... Params>
+	void Keyed(unsigned level, StringView key,
+		   Params... params) const noexcept {
+		if (!Base::CheckLevel(level))
+			return;
+
+		const LoggerDetail::ParamArray<Params...> a(params...);
+		limiter.Write(Base::GetDomain(),
+			      LogRateLimiter::Hash(level, {&key, 1}),
+			      {&a.values.front(), a.values.size()});
+	}
+
+	template<typename... Params>
+	void Format(unsigned level,
+		    const char *fmt, Params... params) const noexcept {
+		if (Base::CheckLevel(level))
+			limiter.Format(Base::GetDomain(), level, fmt,
+				       params...);
+	}
+};
+
+/**
+ * A #LazyDomainLogger which suppresses repeated messages.
+ */
+class RateLimitedLogger : public BasicRateLimitedLogger<LazyLoggerDomain> {
+public:
+	RateLimitedLogger(LoggerDomainFactory &_factory, unsigned burst,
+			  LogRateLimiter::Clock::duration interval)
+		:BasicRateLimitedLogger(_factory, burst, interval) {}
+};
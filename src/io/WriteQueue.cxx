@@ -0,0 +1,149 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "WriteQueue.hxx"
+
+#include <algorithm>
+
+#include <assert.h>
+#include <string.h>
+#include <sys/uio.h>
+
+void
+WriteQueue::Push(const void *data, size_t size)
+{
+	if (size == 0)
+		return;
+
+	if (!segments.empty()) {
+		auto &back = segments.back();
+		if (back.owned &&
+		    size_t(back.owned_end - (back.data + back.size)) >= size) {
+			/* coalesce with the previous chunk */
+			memcpy(const_cast<uint8_t *>(back.data + back.size),
+			       data, size);
+			back.size += size;
+			total += size;
+			return;
+		}
+	}
+
+	const size_t capacity = std::max(size, MIN_CAPACITY);
+	std::unique_ptr<uint8_t[]> owned(new uint8_t[capacity]);
+	memcpy(owned.get(), data, size);
+
+	const uint8_t *p = owned.get();
+	segments.push_back({std::move(owned), p + capacity, p, size});
+	total += size;
+}
+
+void
+WriteQueue::PushV(const struct iovec *v, size_t n)
+{
+	size_t size = 0;
+	for (size_t i = 0; i < n; ++i)
+		size += v[i].iov_len;
+
+	if (size == 0)
+		return;
+
+	uint8_t *dest;
+	if (!segments.empty() && segments.back().owned &&
+	    size_t(segments.back().owned_end -
+		   (segments.back().data + segments.back().size)) >= size) {
+		/* coalesce with the previous chunk */
+		auto &back = segments.back();
+		dest = const_cast<uint8_t *>(back.data + back.size);
+		back.size += size;
+	} else {
+		/* allocate everything before modifying the queue */
+		const size_t capacity = std::max(size, MIN_CAPACITY);
+		std::unique_ptr<uint8_t[]> owned(new uint8_t[capacity]);
+		dest = owned.get();
+		segments.push_back({std::move(owned), dest + capacity, dest, size});
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		memcpy(dest, v[i].iov_base, v[i].iov_len);
+		dest += v[i].iov_len;
+	}
+
+	total += size;
+}
+
+void
+WriteQueue::PushReference(const void *data, size_t size)
+{
+	if (size == 0)
+		return;
+
+	segments.push_back({nullptr, nullptr, (const uint8_t *)data, size});
+	total += size;
+}
+
+size_t
+WriteQueue::Prepare(struct iovec *v, size_t max) const noexcept
+{
+	size_t n = 0;
+	for (const auto &i : segments) {
+		if (n == max)
+			break;
+
+		v[n].iov_base = const_cast<uint8_t *>(i.data);
+		v[n].iov_len = i.size;
+		++n;
+	}
+
+	return n;
+}
+
+void
+WriteQueue::Consume(size_t nbytes) noexcept
+{
+	assert(nbytes <= total);
+
+	total -= nbytes;
+
+	while (nbytes > 0) {
+		assert(!segments.empty());
+
+		auto &front = segments.front();
+		if (nbytes < front.size) {
+			front.data += nbytes;
+			front.size -= nbytes;
+			return;
+		}
+
+		nbytes -= front.size;
+		segments.pop_front();
+	}
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <deque>
+#include <memory>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct iovec;
+
+/**
+ * A queue of outgoing data which is meant to be flushed with one
+ * writev()/sendmsg() call.  Small chunks are copied and coalesced
+ * into larger owned buffers; large chunks may be referenced without
+ * copying.
+ */
+class WriteQueue {
+	struct Segment {
+		/**
+		 * The buffer owned by this segment, or nullptr if it
+		 * references caller-owned memory.
+		 */
+		std::unique_ptr<uint8_t[]> owned;
+
+		/**
+		 * The end of #owned.
+		 */
+		const uint8_t *owned_end;
+
+		const uint8_t *data;
+		size_t size;
+	};
+
+	std::deque<Segment> segments;
+
+	size_t total = 0;
+
+public:
+	/**
+	 * The minimum size of a new owned buffer; subsequent small
+	 * Push() calls are appended to it.
+	 */
+	static constexpr size_t MIN_CAPACITY = 4096;
+
+	bool empty() const noexcept {
+		return total == 0;
+	}
+
+	/**
+	 * Returns the number of bytes in the queue.
+	 */
+	size_t GetSize() const noexcept {
+		return total;
+	}
+
+	void Clear() noexcept {
+		segments.clear();
+		total = 0;
+	}
+
+	/**
+	 * Append a copy of the given data.
+	 */
+	void Push(const void *data, size_t size);
+
+	/**
+	 * Append a copy of all the given buffers.  This is all or
+	 * nothing: if it throws std::bad_alloc, the queue is
+	 * unchanged, so a record assembled from several buffers is
+	 * never queued partially.
+	 */
+	void PushV(const struct iovec *v, size_t n);
+
+	/**
+	 * Append the given data without copying it.  The caller must
+	 * keep it valid until it has been consumed.
+	 */
+	void PushReference(const void *data, size_t size);
+
+	/**
+	 * Fill an iovec array with the beginning of the queue.
+	 *
+	 * @return the number of iovec elements filled
+	 */
+	size_t Prepare(struct iovec *v, size_t max) const noexcept;
+
+	/**
+	 * Remove the given number of bytes from the front of the
+	 * queue, i.e. after they have been written.
+	 */
+	void Consume(size_t nbytes) noexcept;
+};
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Queue.hxx"
+#include "Operation.hxx"
+#include "system/Error.hxx"
+
+#include <assert.h>
+#include <stdint.h>
+
+namespace Uring {
+
+Queue::Queue(unsigned entries, unsigned flags)
+	:ring(entries, flags)
+{
+	if (!event_fd.CreateEventFD())
+		throw MakeErrno("eventfd() failed");
+
+	ring.RegisterEventFD(event_fd.ToFileDescriptor());
+}
+
+struct io_uring_sqe &
+Queue::Require()
+{
+	auto *sqe = ring.GetSubmitEntry();
+	if (sqe == nullptr) {
+		/* the submission queue is full: flush it and retry */
+		ring.Submit();
+
+		sqe = ring.GetSubmitEntry();
+		if (sqe == nullptr)
+			throw std::runtime_error("io_uring submission queue is full");
+	}
+
+	return *sqe;
+}
+
+void
+Queue::Push(struct io_uring_sqe &sqe, Operation &operation) noexcept
+{
+	sqe.user_data = (uint64_t)(uintptr_t)&operation;
+	++n_operations;
+}
+
+void
+Queue::Cancel(Operation &operation)
+{
+	auto &sqe = Require();
+	sqe.opcode = IORING_OP_ASYNC_CANCEL;
+	sqe.fd = -1;
+	sqe.addr = (uint64_t)(uintptr_t)&operation;
+
+	/* no user_data: the completion of the cancel request itself
+	   is ignored */
+}
+
+void
+Queue::DispatchCompletions() noexcept
+{
+	uint64_t value;
+	(void)event_fd.Read(&value, sizeof(value));
+
+	struct io_uring_cqe *cqe;
+	while ((cqe = ring.PeekCompletion()) != nullptr) {
+		auto *operation = (Operation *)(uintptr_t)cqe->user_data;
+		const int res = cqe->res;
+		const bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+		/* release the entry before invoking the handler, which
+		   may submit new operations */
+		ring.SeenCompletion();
+
+		if (operation != nullptr) {
+			if (!more) {
+				assert(n_operations > 0);
+				--n_operations;
+			}
+
+			operation->OnUringCompletion(res);
+		}
+	}
+}
+
+} // namespace Uring
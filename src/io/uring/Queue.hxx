@@ -0,0 +1,142 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Ring.hxx"
+
+#include <stdint.h>
+
+namespace Uring {
+
+class Operation;
+
+/**
+ * A #Ring which dispatches completions to #Operation instances.
+ * Entries are collected and submitted in batches; the caller decides
+ * when to call Submit(), e.g. once per event loop iteration.
+ */
+class Queue {
+	Ring ring;
+
+	/**
+	 * Signalled by the kernel on each completion; see
+	 * GetEventFileDescriptor().
+	 */
+	UniqueFileDescriptor event_fd;
+
+	/**
+	 * The number of operations which have been pushed but whose
+	 * (final) completion has not yet been dispatched.
+	 */
+	unsigned n_operations = 0;
+
+public:
+	/**
+	 * Throws std::system_error on error.
+	 */
+	explicit Queue(unsigned entries, unsigned flags=0);
+
+	/**
+	 * Returns an eventfd which becomes readable when there are
+	 * completions.  The caller should watch it with its event loop
+	 * and call DispatchCompletions().
+	 */
+	FileDescriptor GetEventFileDescriptor() const noexcept {
+		return event_fd.ToFileDescriptor();
+	}
+
+	/**
+	 * Obtain a submission queue entry.  If the submission queue
+	 * is full, pending entries are submitted first.
+	 *
+	 * Throws std::system_error on error.
+	 */
+	struct io_uring_sqe &Require();
+
+	/**
+	 * Attach the given #Operation to an entry obtained from
+	 * Require().
+	 */
+	void Push(struct io_uring_sqe &sqe, Operation &operation) noexcept;
+
+	/**
+	 * Invoke the given function for each entry of the given
+	 * #Operation which has not yet been submitted, e.g. to modify
+	 * its file descriptor.  The user_data field must not be
+	 * modified.
+	 */
+	template<typename F>
+	void UpdatePending(const Operation &operation, F &&f) noexcept {
+		const uint64_t user_data = (uint64_t)(uintptr_t)&operation;
+		ring.ForEachPending([user_data, &f](struct io_uring_sqe &sqe){
+			if (sqe.user_data == user_data)
+				f(sqe);
+		});
+	}
+
+	/**
+	 * Ask the kernel to cancel the given pending #Operation.  It
+	 * will still receive a completion (usually with -ECANCELED),
+	 * which means the object must not be freed before that.
+	 *
+	 * Throws std::system_error on error.
+	 */
+	void Cancel(Operation &operation);
+
+	/**
+	 * Are there operations which are still waiting for their
+	 * completion?
+	 */
+	bool HasOperations() const noexcept {
+		return n_operations > 0;
+	}
+
+	bool HasPending() const noexcept {
+		return ring.HasPending();
+	}
+
+	/**
+	 * Throws std::system_error on error.
+	 */
+	void Submit() {
+		ring.Submit();
+	}
+
+	/**
+	 * Clear the eventfd and invoke the handlers of all completions
+	 * which have been posted so far.
+	 */
+	void DispatchCompletions() noexcept;
+};
+
+} // namespace Uring
@@ -0,0 +1,221 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Ring.hxx"
+#include "system/Error.hxx"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+namespace Uring {
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p) noexcept
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+	       unsigned flags) noexcept
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, nullptr, 0);
+}
+
+static int
+io_uring_register(int fd, unsigned opcode, const void *arg,
+		  unsigned nr_args) noexcept
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+template<typename T>
+static T *
+At(void *base, size_t offset) noexcept
+{
+	return (T *)((char *)base + offset);
+}
+
+static void *
+MapRing(FileDescriptor fd, size_t size, off_t offset)
+{
+	void *p = mmap(nullptr, size, PROT_READ|PROT_WRITE,
+		       MAP_SHARED|MAP_POPULATE, fd.Get(), offset);
+	if (p == MAP_FAILED)
+		throw MakeErrno("mmap(io_uring) failed");
+
+	return p;
+}
+
+Ring::Ring(unsigned entries, unsigned flags)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = flags;
+
+	int _fd = io_uring_setup(entries, &p);
+	if (_fd < 0)
+		throw MakeErrno("io_uring_setup() failed");
+
+	fd = UniqueFileDescriptor(FileDescriptor(_fd));
+
+	sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		/* both rings share one mapping */
+		if (cq_ring_size > sq_ring_size)
+			sq_ring_size = cq_ring_size;
+		cq_ring_size = 0;
+	}
+
+	sq_ring = MapRing(GetFileDescriptor(), sq_ring_size,
+			  IORING_OFF_SQ_RING);
+
+	try {
+		cq_ring = cq_ring_size > 0
+			? MapRing(GetFileDescriptor(), cq_ring_size,
+				  IORING_OFF_CQ_RING)
+			: sq_ring;
+
+		sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+		sqes = (struct io_uring_sqe *)
+			MapRing(GetFileDescriptor(), sqes_size,
+				IORING_OFF_SQES);
+	} catch (...) {
+		if (cq_ring != nullptr && cq_ring != sq_ring)
+			munmap(cq_ring, cq_ring_size);
+		munmap(sq_ring, sq_ring_size);
+		throw;
+	}
+
+	sq_head = At<unsigned>(sq_ring, p.sq_off.head);
+	sq_tail = At<unsigned>(sq_ring, p.sq_off.tail);
+	sq_array = At<unsigned>(sq_ring, p.sq_off.array);
+	sq_mask = *At<unsigned>(sq_ring, p.sq_off.ring_mask);
+	sq_entries = *At<unsigned>(sq_ring, p.sq_off.ring_entries);
+
+	cq_head = At<unsigned>(cq_ring, p.cq_off.head);
+	cq_tail = At<unsigned>(cq_ring, p.cq_off.tail);
+	cq_mask = *At<unsigned>(cq_ring, p.cq_off.ring_mask);
+	cqes = At<struct io_uring_cqe>(cq_ring, p.cq_off.cqes);
+
+	sqe_tail = submitted_tail = *sq_tail;
+}
+
+Ring::~Ring() noexcept
+{
+	munmap(sqes, sqes_size);
+	if (cq_ring != sq_ring)
+		munmap(cq_ring, cq_ring_size);
+	munmap(sq_ring, sq_ring_size);
+}
+
+struct io_uring_sqe *
+Ring::GetSubmitEntry() noexcept
+{
+	const unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	if (sqe_tail - head >= sq_entries)
+		return nullptr;
+
+	const unsigned index = sqe_tail & sq_mask;
+	++sqe_tail;
+
+	/* the index array is an identity mapping */
+	sq_array[index] = index;
+
+	auto *sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+void
+Ring::Submit()
+{
+	if (!HasPending())
+		return;
+
+	/* publish the new entries to the kernel */
+	__atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+
+	unsigned to_submit = sqe_tail - submitted_tail;
+	while (to_submit > 0) {
+		int result = io_uring_enter(fd.Get(), to_submit, 0, 0);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+
+			throw MakeErrno("io_uring_enter() failed");
+		}
+
+		submitted_tail += result;
+		to_submit -= result;
+
+		if (result == 0)
+			/* the kernel refuses more entries for now (e.g.
+			   completion queue overflow); try again in the
+			   next call */
+			break;
+	}
+}
+
+void
+Ring::RegisterEventFD(FileDescriptor event_fd)
+{
+	const int value = event_fd.Get();
+	if (io_uring_register(fd.Get(), IORING_REGISTER_EVENTFD,
+			      &value, 1) < 0)
+		throw MakeErrno("IORING_REGISTER_EVENTFD failed");
+}
+
+struct io_uring_cqe *
+Ring::PeekCompletion() noexcept
+{
+	const unsigned head = *cq_head;
+	if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+		return nullptr;
+
+	return &cqes[head & cq_mask];
+}
+
+void
+Ring::SeenCompletion() noexcept
+{
+	__atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+} // namespace Uring
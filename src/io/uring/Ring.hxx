@@ -0,0 +1,145 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <linux/io_uring.h>
+
+#include <stddef.h>
+
+namespace Uring {
+
+/**
+ * A minimal io_uring wrapper which talks to the kernel directly
+ * (without liburing): it owns the ring file descriptor and the
+ * shared memory mappings of the submission and completion queues.
+ *
+ * This class is not thread-safe.
+ */
+class Ring {
+	UniqueFileDescriptor fd;
+
+	void *sq_ring = nullptr, *cq_ring = nullptr;
+	size_t sq_ring_size, cq_ring_size;
+
+	struct io_uring_sqe *sqes = nullptr;
+	size_t sqes_size;
+
+	unsigned *sq_head, *sq_tail, *sq_array;
+	unsigned sq_mask, sq_entries;
+
+	unsigned *cq_head, *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/**
+	 * The local tail of the submission queue, i.e. the index of
+	 * the next SQE returned by GetSubmitEntry().  It is published
+	 * to the kernel by Submit().
+	 */
+	unsigned sqe_tail = 0;
+
+	/**
+	 * The number of SQEs which have been published to the kernel
+	 * but not yet consumed by io_uring_enter().
+	 */
+	unsigned submitted_tail = 0;
+
+public:
+	/**
+	 * Throws std::system_error on error (e.g. if the kernel does
+	 * not support io_uring).
+	 */
+	explicit Ring(unsigned entries, unsigned flags=0);
+
+	~Ring() noexcept;
+
+	Ring(const Ring &) = delete;
+	Ring &operator=(const Ring &) = delete;
+
+	FileDescriptor GetFileDescriptor() const noexcept {
+		return fd.ToFileDescriptor();
+	}
+
+	/**
+	 * Obtain a zeroed submission queue entry.  It will be passed
+	 * to the kernel by the next Submit() call.
+	 *
+	 * @return nullptr if the submission queue is full
+	 */
+	struct io_uring_sqe *GetSubmitEntry() noexcept;
+
+	/**
+	 * Are there entries which have not yet been submitted?
+	 */
+	bool HasPending() const noexcept {
+		return sqe_tail != submitted_tail;
+	}
+
+	/**
+	 * Invoke the given function for each entry which has not yet
+	 * been consumed by the kernel; it may still be modified.
+	 */
+	template<typename F>
+	void ForEachPending(F &&f) noexcept {
+		for (unsigned i = submitted_tail; i != sqe_tail; ++i)
+			f(sqes[i & sq_mask]);
+	}
+
+	/**
+	 * Submit all pending entries to the kernel with a single
+	 * io_uring_enter() call.
+	 *
+	 * Throws std::system_error on error.
+	 */
+	void Submit();
+
+	/**
+	 * Register an eventfd which gets signalled on each
+	 * completion.
+	 *
+	 * Throws std::system_error on error.
+	 */
+	void RegisterEventFD(FileDescriptor event_fd);
+
+	/**
+	 * @return the oldest completion queue entry or nullptr if
+	 * there is none; it must be released with SeenCompletion()
+	 */
+	struct io_uring_cqe *PeekCompletion() noexcept;
+
+	void SeenCompletion() noexcept;
+};
+
+} // namespace Uring
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2016-2017 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Budget.hxx"
+#include "Util.hxx"
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+constexpr int Lua::Budget::SAMPLE_INTERVAL;
+
+void
+Lua::Profile::AddSample(std::string &&function) noexcept
+{
+	try {
+		++samples[std::move(function)];
+	} catch (...) {
+		/* out of memory: drop the sample */
+	}
+}
+
+uint64_t
+Lua::Profile::GetSamples(const std::string &function) const noexcept
+{
+	auto i = samples.find(function);
+	return i != samples.end()
+		? i->second
+		: 0;
+}
+
+void
+Lua::Profile::Clear() noexcept
+{
+	samples.clear();
+	n_calls = n_errors = n_exceeded = 0;
+	duration.Clear();
+}
+
+namespace {
+
+/**
+ * The state of one PCall() invocation; a pointer to it is stored in
+ * the Lua registry while the hook is installed.
+ */
+struct BudgetScope {
+	static constexpr const char *REGISTRY_KEY = "Lua::BudgetScope";
+
+	lua_State *const L;
+
+	const Lua::Budget &budget;
+
+	const std::chrono::steady_clock::time_point start;
+
+	uint64_t instructions = 0;
+
+	/**
+	 * The error message if the budget has been exceeded, or
+	 * nullptr.
+	 */
+	const char *exceeded = nullptr;
+
+	/* the previous hook, restored by the destructor */
+	void *const old_scope;
+	const lua_Hook old_hook;
+	const int old_mask, old_count;
+
+	BudgetScope(lua_State *_L, const Lua::Budget &_budget) noexcept
+		:L(_L), budget(_budget),
+		 start(std::chrono::steady_clock::now()),
+		 old_scope(Lua::GetRegistryLightUserData(L, REGISTRY_KEY)),
+		 old_hook(lua_gethook(L)),
+		 old_mask(lua_gethookmask(L)),
+		 old_count(lua_gethookcount(L)) {
+		Lua::SetRegistry(L, REGISTRY_KEY, Lua::LightUserData(this));
+		lua_sethook(L, Hook, LUA_MASKCOUNT,
+			    Lua::Budget::SAMPLE_INTERVAL);
+	}
+
+	~BudgetScope() noexcept {
+		lua_sethook(L, old_hook, old_mask, old_count);
+		Lua::SetRegistry(L, REGISTRY_KEY,
+				 Lua::LightUserData(old_scope));
+	}
+
+	BudgetScope(const BudgetScope &) = delete;
+	BudgetScope &operator=(const BudgetScope &) = delete;
+
+	std::chrono::steady_clock::duration GetElapsed() const noexcept {
+		return std::chrono::steady_clock::now() - start;
+	}
+
+	void Sample(lua_State *_L) noexcept;
+
+	/**
+	 * @return an error message or nullptr if the budget is not
+	 * exhausted yet
+	 */
+	const char *Check() noexcept;
+
+	static void Hook(lua_State *L, lua_Debug *ar);
+};
+
+}
+
+constexpr const char *BudgetScope::REGISTRY_KEY;
+
+inline void
+BudgetScope::Sample(lua_State *_L) noexcept
+{
+	lua_Debug ar;
+	if (lua_getstack(_L, 0, &ar) == 0 || lua_getinfo(_L, "S", &ar) == 0)
+		return;
+
+	try {
+		budget.profile->AddSample(std::string(ar.short_src) + ":" +
+					  std::to_string(ar.linedefined));
+	} catch (...) {
+		/* out of memory: drop the sample */
+	}
+}
+
+inline const char *
+BudgetScope::Check() noexcept
+{
+	instructions += Lua::Budget::SAMPLE_INTERVAL;
+	if (budget.max_instructions > 0 &&
+	    instructions > budget.max_instructions)
+		return "Lua instruction budget exceeded";
+
+	if (budget.timeout > std::chrono::steady_clock::duration::zero() &&
+	    GetElapsed() > budget.timeout)
+		return "Lua time budget exceeded";
+
+	return nullptr;
+}
+
+void
+BudgetScope::Hook(lua_State *L, lua_Debug *)
+{
+	auto &scope = *(BudgetScope *)
+		Lua::GetRegistryLightUserData(L, REGISTRY_KEY);
+
+	if (scope.budget.profile != nullptr)
+		scope.Sample(L);
+
+	if (scope.exceeded == nullptr)
+		scope.exceeded = scope.Check();
+
+	/* raise the error again on each hook invocation, in case
+	   the script catches it with pcall() */
+	if (scope.exceeded != nullptr)
+		luaL_error(L, "%s", scope.exceeded);
+}
+
+void
+Lua::PCall(lua_State *L, int nargs, int nresults, const Budget &budget)
+{
+	const char *exceeded;
+	bool failed;
+	std::chrono::steady_clock::duration elapsed;
+
+	{
+		BudgetScope scope(L, budget);
+		failed = lua_pcall(L, nargs, nresults, 0) != 0;
+		exceeded = scope.exceeded;
+		elapsed = scope.GetElapsed();
+	}
+
+	auto *profile = budget.profile;
+	if (profile != nullptr) {
+		++profile->n_calls;
+		profile->duration.Add(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+	}
+
+	if (exceeded != nullptr) {
+		if (failed)
+			lua_pop(L, 1);
+		else
+			/* the script has returned after all (e.g. the
+			   error was raised in a pcall() which has
+			   ignored it); discard the results */
+			lua_pop(L, nresults == LUA_MULTRET ? 0 : nresults);
+
+		if (profile != nullptr)
+			++profile->n_exceeded;
+		throw BudgetExceeded(exceeded);
+	}
+
+	if (failed) {
+		if (profile != nullptr)
+			++profile->n_errors;
+		throw PopError(L);
+	}
+}
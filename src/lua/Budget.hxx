@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2016-2017 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LUA_BUDGET_HXX
+#define LUA_BUDGET_HXX
+
+#include "Error.hxx"
+#include "util/LogLinearHistogram.hxx"
+#include "util/Compiler.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+
+#include <stdint.h>
+
+struct lua_State;
+
+namespace Lua {
+
+/**
+ * Thrown by PCall() when a script has exceeded its #Budget.
+ */
+class BudgetExceeded : public Error {
+public:
+	explicit BudgetExceeded(const char *_msg):Error(_msg) {}
+};
+
+/**
+ * Statistics about the invocations of one hook, collected by
+ * PCall().  Functions are sampled every #Budget::SAMPLE_INTERVAL
+ * virtual machine instructions.
+ *
+ * This class is not thread-safe.
+ */
+class Profile {
+	/**
+	 * Sample counts by function ("source:line" of its
+	 * definition).
+	 */
+	std::map<std::string, uint64_t> samples;
+
+public:
+	uint64_t n_calls = 0, n_errors = 0, n_exceeded = 0;
+
+	/**
+	 * Wall-clock duration of each call in microseconds.
+	 */
+	LogLinearHistogram<> duration;
+
+	Profile() = default;
+	Profile(const Profile &) = delete;
+	Profile &operator=(const Profile &) = delete;
+
+	void AddSample(std::string &&function) noexcept;
+
+	gcc_pure
+	uint64_t GetSamples(const std::string &function) const noexcept;
+
+	/**
+	 * Invoke the given function for each sampled function with
+	 * its name and sample count.
+	 */
+	template<typename F>
+	void ForEachSample(F &&f) const {
+		for (const auto &i : samples)
+			f(i.first, i.second);
+	}
+
+	void Clear() noexcept;
+};
+
+/**
+ * Limits for a script invocation by PCall().  Zero means
+ * unlimited.
+ */
+struct Budget {
+	/**
+	 * The budget is checked (and a profile sample is taken) every
+	 * this many virtual machine instructions.
+	 */
+	static constexpr int SAMPLE_INTERVAL = 1000;
+
+	std::chrono::steady_clock::duration timeout =
+		std::chrono::steady_clock::duration::zero();
+
+	uint64_t max_instructions = 0;
+
+	/**
+	 * If not nullptr, then statistics are recorded here.
+	 */
+	Profile *profile = nullptr;
+};
+
+/**
+ * Like lua_pcall(), but abort the script with a Lua error if it
+ * exceeds the given #Budget.  A count hook is installed during the
+ * call (and the previous hook is restored afterwards, so calls may
+ * be nested).
+ *
+ * Note that LuaJIT does not invoke hooks from JIT-compiled traces,
+ * i.e. a tight loop which has been compiled is only stopped when it
+ * calls back into the interpreter.
+ *
+ * On success, the results are left on the stack.  Throws
+ * #BudgetExceeded if the budget was exceeded, or #Error if the
+ * script has failed.
+ */
+void
+PCall(lua_State *L, int nargs, int nresults, const Budget &budget);
+
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2016-2017 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BufferView.hxx"
+#include "Class.hxx"
+#include "util/ConstBuffer.hxx"
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+#include <string.h>
+
+static constexpr char lua_buffer_view_class[] = "Lua.BufferView";
+typedef Lua::Class<Lua::BufferView, lua_buffer_view_class> LuaBufferView;
+
+/**
+ * Obtain the #BufferView at the given stack index, and raise a Lua
+ * error if it is not one or if it has been invalidated.
+ */
+static StringView
+CheckBufferView(lua_State *L, int idx)
+{
+	const auto &view = LuaBufferView::Cast(L, idx);
+	if (!view.IsValid())
+		luaL_error(L, "Buffer is no longer valid");
+
+	return view.Get();
+}
+
+/**
+ * Convert a string.sub()-style (1-based, negative values relative to
+ * the end) position to a 0-based offset.
+ */
+static lua_Integer
+RelativePosition(lua_Integer pos, size_t size)
+{
+	if (pos < 0)
+		pos += lua_Integer(size) + 1;
+	return pos;
+}
+
+static int
+l_buffer_view_len(lua_State *L)
+{
+	Lua::Push(L, int(CheckBufferView(L, 1).size));
+	return 1;
+}
+
+static int
+l_buffer_view_tostring(lua_State *L)
+{
+	Lua::Push(L, CheckBufferView(L, 1));
+	return 1;
+}
+
+static int
+l_buffer_view_sub(lua_State *L)
+{
+	const StringView value = CheckBufferView(L, 1);
+
+	lua_Integer start = RelativePosition(luaL_checkinteger(L, 2),
+					     value.size);
+	lua_Integer end = RelativePosition(luaL_optinteger(L, 3, -1),
+					   value.size);
+
+	if (start < 1)
+		start = 1;
+	if (end > lua_Integer(value.size))
+		end = value.size;
+
+	if (start > end)
+		lua_pushliteral(L, "");
+	else
+		lua_pushlstring(L, value.data + start - 1, end - start + 1);
+	return 1;
+}
+
+static int
+l_buffer_view_find(lua_State *L)
+{
+	const StringView value = CheckBufferView(L, 1);
+
+	size_t needle_length;
+	const char *needle = luaL_checklstring(L, 2, &needle_length);
+
+	lua_Integer init = RelativePosition(luaL_optinteger(L, 3, 1),
+					    value.size);
+	if (init < 1)
+		init = 1;
+
+	if (size_t(init) > value.size + 1) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	const void *found = memmem(value.data + init - 1,
+				   value.size - (init - 1),
+				   needle, needle_length);
+	if (found == nullptr) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	const size_t offset = (const char *)found - value.data;
+	lua_pushinteger(L, offset + 1);
+	lua_pushinteger(L, offset + needle_length);
+	return 2;
+}
+
+void
+Lua::RegisterBufferView(lua_State *L)
+{
+	const ScopeCheckStack check_stack(L);
+
+	LuaBufferView::Register(L);
+
+	/* the metatable is its own method table */
+	SetField(L, -2, "__index", StackIndex(-1));
+	SetField(L, -2, "__len", l_buffer_view_len);
+	SetField(L, -2, "__tostring", l_buffer_view_tostring);
+	SetField(L, -2, "len", l_buffer_view_len);
+	SetField(L, -2, "sub", l_buffer_view_sub);
+	SetField(L, -2, "find", l_buffer_view_find);
+
+	lua_pop(L, 1);
+}
+
+Lua::BufferView *
+Lua::NewBufferView(lua_State *L, StringView value)
+{
+	return LuaBufferView::New(L, value);
+}
+
+void
+Lua::PushBufferViews(lua_State *L, ConstBuffer<StringView> values,
+		     BufferView **dest)
+{
+	luaL_checkstack(L, values.size, "Too many buffers");
+
+	for (const auto &i : values) {
+		auto *view = NewBufferView(L, i);
+		if (dest != nullptr)
+			*dest++ = view;
+	}
+}
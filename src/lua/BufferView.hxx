@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016-2017 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LUA_BUFFER_VIEW_HXX
+#define LUA_BUFFER_VIEW_HXX
+
+#include "util/StringView.hxx"
+
+struct lua_State;
+
+namespace Lua {
+
+/**
+ * A Lua object referring to a buffer owned by C++ code (e.g. a
+ * request body or a header value in a socket buffer) without copying
+ * it.  Lua scripts access it with the methods "len", "sub", "find"
+ * and tostring(); only "sub" and tostring() copy data, and only the
+ * requested range.
+ *
+ * The buffer must remain valid until the owner calls Invalidate()
+ * (or until the object is garbage-collected); after that, all
+ * accesses from Lua raise an error.
+ */
+class BufferView {
+	StringView value;
+
+public:
+	explicit constexpr BufferView(StringView _value) noexcept
+		:value(_value) {}
+
+	constexpr bool IsValid() const noexcept {
+		return !value.IsNull();
+	}
+
+	constexpr StringView Get() const noexcept {
+		return value;
+	}
+
+	/**
+	 * The buffer is going to be freed; the Lua object remains, but
+	 * cannot be used anymore.
+	 */
+	void Invalidate() noexcept {
+		value = nullptr;
+	}
+};
+
+/**
+ * Register the #BufferView metatable.  This must be called once per
+ * lua_State before NewBufferView().
+ */
+void
+RegisterBufferView(lua_State *L);
+
+/**
+ * Create a new #BufferView object and push it on the stack.
+ *
+ * @return a pointer which the caller can use to Invalidate() the
+ * object later
+ */
+BufferView *
+NewBufferView(lua_State *L, StringView value);
+
+/**
+ * Call NewBufferView() for each item and push them all on the stack
+ * (in order), e.g. to pass several header values to a Lua function
+ * at once.
+ *
+ * @param dest an array with one element per item, receiving the
+ * pointers returned by NewBufferView(); may be nullptr
+ */
+void
+PushBufferViews(lua_State *L, ConstBuffer<StringView> values,
+		BufferView **dest);
+
+}
+
+#endif
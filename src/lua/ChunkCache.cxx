@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016-2017 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ChunkCache.hxx"
+#include "Error.hxx"
+#include "system/Error.hxx"
+
+extern "C" {
+#include <lauxlib.h>
+}
+
+#include <sys/stat.h>
+
+static constexpr bool
+IsSameTime(const struct timespec &a, const struct timespec &b)
+{
+	return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static int
+DumpWriter(lua_State *, const void *p, size_t size, void *ud)
+{
+	auto &dest = *(std::string *)ud;
+	dest.append((const char *)p, size);
+	return 0;
+}
+
+void
+Lua::ChunkCache::Load(lua_State *L, const char *path)
+{
+	struct stat st;
+	if (stat(path, &st) < 0)
+		throw FormatErrno("Failed to access %s", path);
+
+	/* the chunk name used by luaL_loadfile() */
+	const std::string chunk_name = std::string("@") + path;
+
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+
+		auto i = items.find(path);
+		if (i != items.end()) {
+			const auto &item = i->second;
+			if (item.device == st.st_dev &&
+			    item.inode == st.st_ino &&
+			    item.size == st.st_size &&
+			    IsSameTime(item.mtime, st.st_mtim)) {
+				if (luaL_loadbuffer(L, item.bytecode.data(),
+						    item.bytecode.size(),
+						    chunk_name.c_str()))
+					throw PopError(L);
+				return;
+			}
+
+			items.erase(i);
+		}
+	}
+
+	/* compile outside of the lock; concurrent misses for the
+	   same file just compile it twice */
+
+	if (luaL_loadfile(L, path))
+		throw PopError(L);
+
+	Item item;
+	item.device = st.st_dev;
+	item.inode = st.st_ino;
+	item.size = st.st_size;
+	item.mtime = st.st_mtim;
+
+	if (lua_dump(L, DumpWriter, &item.bytecode) != 0)
+		/* not cacheable, but the chunk on the stack is
+		   usable */
+		return;
+
+	const std::lock_guard<std::mutex> lock(mutex);
+	items[path] = std::move(item);
+}
+
+void
+Lua::ChunkCache::RunFile(lua_State *L, const char *path)
+{
+	Load(L, path);
+
+	if (lua_pcall(L, 0, 0, 0))
+		throw PopError(L);
+}
+
+void
+Lua::ChunkCache::Clear()
+{
+	const std::lock_guard<std::mutex> lock(mutex);
+	items.clear();
+}
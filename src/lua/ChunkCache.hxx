@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016-2017 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LUA_CHUNK_CACHE_HXX
+#define LUA_CHUNK_CACHE_HXX
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <sys/types.h>
+
+struct lua_State;
+
+namespace Lua {
+
+/**
+ * A cache of compiled Lua chunks (LuaJIT bytecode), keyed by file
+ * path.  An entry is invalidated when the file's inode, size or
+ * modification time changes.  This allows initializing many
+ * lua_State instances with the same scripts without parsing them
+ * again.
+ *
+ * This class is thread-safe.
+ */
+class ChunkCache {
+	struct Item {
+		dev_t device;
+		ino_t inode;
+		off_t size;
+		struct timespec mtime;
+
+		std::string bytecode;
+	};
+
+	std::mutex mutex;
+
+	std::map<std::string, Item> items;
+
+public:
+	/**
+	 * Load the specified file and push the compiled chunk on
+	 * the stack, like luaL_loadfile().  If a cached compilation
+	 * for the current version of the file exists, it is used;
+	 * otherwise the file is compiled and the result is added to
+	 * the cache.
+	 *
+	 * Throws std::runtime_error on error.
+	 */
+	void Load(lua_State *L, const char *path);
+
+	/**
+	 * Like Lua::RunFile(), but load the chunk with Load().
+	 *
+	 * Throws std::runtime_error on error.
+	 */
+	void RunFile(lua_State *L, const char *path);
+
+	/**
+	 * Remove all cached chunks.
+	 */
+	void Clear();
+};
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2016-2017 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "StatePool.hxx"
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <algorithm>
+
+void
+Lua::StatePool::Prefill(std::size_t n)
+{
+	n = std::min(n, max_idle);
+
+	while (true) {
+		{
+			const std::lock_guard<std::mutex> lock(mutex);
+			if (idle.size() >= n)
+				break;
+		}
+
+		/* create outside of the lock, because the factory
+		   may be slow */
+		auto state = factory();
+
+		const std::lock_guard<std::mutex> lock(mutex);
+		idle.emplace_back(std::move(state));
+	}
+}
+
+Lua::StatePool::Lease
+Lua::StatePool::Get()
+{
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+		if (!idle.empty()) {
+			auto state = std::move(idle.back());
+			idle.pop_back();
+			return Lease(*this, std::move(state));
+		}
+	}
+
+	return Lease(*this, factory());
+}
+
+void
+Lua::StatePool::Clear() noexcept
+{
+	std::vector<State> old;
+
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+		old.swap(idle);
+	}
+
+	/* the states are closed here, outside of the lock */
+}
+
+void
+Lua::StatePool::Put(State &&state) noexcept
+{
+	lua_State *L = state.get();
+
+	/* remove leftovers from the stack; the globals are kept,
+	   this is up to the scripts */
+	lua_settop(L, 0);
+
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	if (idle.size() < max_idle) {
+		try {
+			idle.emplace_back(std::move(state));
+		} catch (...) {
+			/* out of memory: close the state */
+		}
+	}
+}
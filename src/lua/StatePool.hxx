@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2016-2017 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LUA_STATE_POOL_HXX
+#define LUA_STATE_POOL_HXX
+
+#include "State.hxx"
+
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Lua {
+
+/**
+ * A pool of pre-initialized lua_State instances, all created by
+ * the same factory (i.e. with the same set of scripts loaded).
+ * Callers borrow a warm state with Get() instead of creating and
+ * initializing a new one for each invocation.
+ *
+ * This class is thread-safe, but each lua_State must be used by
+ * only one thread at a time.
+ */
+class StatePool {
+public:
+	/**
+	 * Creates and initializes a new state (e.g. with
+	 * luaL_openlibs() and ChunkCache::RunFile()).  Throws on
+	 * error.
+	 */
+	typedef std::function<State()> Factory;
+
+private:
+	const Factory factory;
+
+	/**
+	 * The maximum number of idle states kept in the pool.
+	 */
+	const std::size_t max_idle;
+
+	std::mutex mutex;
+
+	std::vector<State> idle;
+
+public:
+	/**
+	 * A state borrowed from the pool.  It is returned to the pool
+	 * when this object is destructed, unless Discard() has been
+	 * called.
+	 */
+	class Lease {
+		StatePool *pool;
+		State state;
+
+	public:
+		Lease(StatePool &_pool, State &&_state) noexcept
+			:pool(&_pool), state(std::move(_state)) {}
+
+		Lease(Lease &&src) noexcept
+			:pool(src.pool), state(std::move(src.state)) {}
+
+		~Lease() noexcept {
+			if (state)
+				pool->Put(std::move(state));
+		}
+
+		Lease &operator=(Lease &&src) noexcept {
+			std::swap(pool, src.pool);
+			std::swap(state, src.state);
+			return *this;
+		}
+
+		lua_State *Get() const noexcept {
+			return state.get();
+		}
+
+		operator lua_State *() const noexcept {
+			return state.get();
+		}
+
+		/**
+		 * Do not return this state to the pool, e.g. because
+		 * a script has failed and may have left it in an
+		 * inconsistent state.
+		 */
+		void Discard() noexcept {
+			state.reset();
+		}
+	};
+
+	/**
+	 * @param max_idle the maximum number of idle states kept in
+	 * the pool
+	 */
+	StatePool(Factory &&_factory, std::size_t _max_idle) noexcept
+		:factory(std::move(_factory)), max_idle(_max_idle) {}
+
+	StatePool(const StatePool &) = delete;
+	StatePool &operator=(const StatePool &) = delete;
+
+	/**
+	 * Create new states until the pool contains the given
+	 * number of idle states (at most #max_idle).
+	 *
+	 * Throws on error.
+	 */
+	void Prefill(std::size_t n);
+
+	/**
+	 * Borrow a state from the pool, or create a new one if the
+	 * pool is empty.
+	 *
+	 * Throws on error.
+	 */
+	Lease Get();
+
+	/**
+	 * Discard all idle states, e.g. after the scripts have been
+	 * modified.
+	 */
+	void Clear() noexcept;
+
+private:
+	void Put(State &&state) noexcept;
+};
+
+}
+
+#endif
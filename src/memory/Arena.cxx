@@ -0,0 +1,114 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Arena.hxx"
+
+#include <stdlib.h>
+
+auto
+Arena::NewChunk(size_t capacity, bool use_mmap) -> Chunk *
+{
+	if (use_mmap) {
+		LargeAllocation allocation(sizeof(Chunk) + capacity,
+					   LargeAllocation::TRANSPARENT_HUGE);
+		void *p = allocation.get();
+		capacity = allocation.size() - sizeof(Chunk);
+		return ::new(p) Chunk{nullptr, std::move(allocation), capacity};
+	}
+
+	void *p = malloc(sizeof(Chunk) + capacity);
+	if (p == nullptr)
+		throw std::bad_alloc();
+
+	return ::new(p) Chunk{nullptr, LargeAllocation(), capacity};
+}
+
+void
+Arena::FreeChunks(Chunk *chunk) noexcept
+{
+	while (chunk != nullptr) {
+		Chunk *next = chunk->next;
+
+		if (chunk->allocation.get() != nullptr) {
+			/* move the allocation out of the chunk, because
+			   unmapping it frees the chunk itself */
+			LargeAllocation allocation(std::move(chunk->allocation));
+			chunk->~Chunk();
+		} else {
+			chunk->~Chunk();
+			free(chunk);
+		}
+
+		chunk = next;
+	}
+}
+
+void *
+Arena::AllocateSlow(size_t size, size_t alignment)
+{
+	const size_t data_size = chunk_size - sizeof(Chunk);
+
+	if (size + alignment > data_size / 4) {
+		/* too large: allocate a dedicated chunk and leave the
+		   current chunk alone */
+		Chunk *chunk = NewChunk(size + alignment, false);
+		chunk->next = large_chunks;
+		large_chunks = chunk;
+		return Align(chunk->GetData(), alignment);
+	}
+
+	Chunk *chunk = NewChunk(data_size, huge);
+	chunk->next = chunks;
+	chunks = chunk;
+
+	position = chunk->GetData();
+	end = position + chunk->capacity;
+
+	uint8_t *p = Align(position, alignment);
+	position = p + size;
+	return p;
+}
+
+void
+Arena::Clear() noexcept
+{
+	for (Cleanup *c = cleanups; c != nullptr; c = c->next)
+		c->function(c->p, c->n);
+	cleanups = nullptr;
+
+	FreeChunks(std::exchange(large_chunks, nullptr));
+
+	if (chunks != nullptr) {
+		FreeChunks(std::exchange(chunks->next, nullptr));
+		position = chunks->GetData();
+	}
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "system/LargeAllocation.hxx"
+#include "util/Compiler.h"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A bump-pointer allocator: memory is carved from large chunks, and
+ * everything is freed at once by Clear() or the destructor; there is
+ * no way to free individual allocations.  Destructors of objects
+ * created with New() are invoked at that time, too.
+ *
+ * Chunks are allocated with malloc() or (with the "huge" option)
+ * with mmap() and transparent huge pages.  Allocations which are
+ * too large for a regular chunk get a dedicated one.
+ *
+ * This class is not thread-safe.
+ */
+class Arena {
+	struct Chunk {
+		Chunk *next;
+
+		/**
+		 * Owns the memory of this chunk if it was allocated
+		 * with mmap(); empty if malloc() was used.
+		 */
+		LargeAllocation allocation;
+
+		/**
+		 * The number of usable bytes after this header.
+		 */
+		size_t capacity;
+
+		uint8_t *GetData() noexcept {
+			return (uint8_t *)(this + 1);
+		}
+	};
+
+	struct Cleanup {
+		Cleanup *next;
+		void (*function)(void *p, size_t n) noexcept;
+		void *p;
+		size_t n;
+	};
+
+	/**
+	 * The regular chunks; the first one is the current one.
+	 */
+	Chunk *chunks = nullptr;
+
+	/**
+	 * Dedicated chunks for large allocations.
+	 */
+	Chunk *large_chunks = nullptr;
+
+	/**
+	 * Destructors to be invoked by Clear(), most recent first.
+	 */
+	Cleanup *cleanups = nullptr;
+
+	/**
+	 * The free range of the current chunk.
+	 */
+	uint8_t *position = nullptr, *end = nullptr;
+
+	size_t chunk_size;
+
+	bool huge;
+
+public:
+	static constexpr size_t DEFAULT_CHUNK_SIZE = 8192;
+
+	/**
+	 * @param _chunk_size the size of each regular chunk
+	 * @param _huge allocate chunks with mmap() and request
+	 * transparent huge pages; this is only useful with a large
+	 * #_chunk_size
+	 */
+	explicit Arena(size_t _chunk_size=DEFAULT_CHUNK_SIZE,
+		       bool _huge=false) noexcept
+		:chunk_size(_chunk_size), huge(_huge) {
+		assert(chunk_size >= 4 * sizeof(Chunk));
+	}
+
+	Arena(Arena &&src) noexcept
+		:chunks(std::exchange(src.chunks, nullptr)),
+		 large_chunks(std::exchange(src.large_chunks, nullptr)),
+		 cleanups(std::exchange(src.cleanups, nullptr)),
+		 position(std::exchange(src.position, nullptr)),
+		 end(std::exchange(src.end, nullptr)),
+		 chunk_size(src.chunk_size), huge(src.huge) {}
+
+	~Arena() noexcept {
+		Clear();
+		FreeChunks(chunks);
+	}
+
+	Arena &operator=(const Arena &) = delete;
+
+	/**
+	 * Free all allocations and invoke all registered destructors.
+	 * The current chunk is kept for reuse; all others are freed.
+	 */
+	void Clear() noexcept;
+
+	/**
+	 * Throws std::bad_alloc on error.
+	 */
+	void *Allocate(size_t size,
+		       size_t alignment=alignof(std::max_align_t)) {
+		uint8_t *p = Align(position, alignment);
+		/* Align() may have moved the pointer past the end
+		   of the chunk; check that before subtracting */
+		if (gcc_likely(p != nullptr && p <= end &&
+			       size <= size_t(end - p))) {
+			position = p + size;
+			return p;
+		}
+
+		return AllocateSlow(size, alignment);
+	}
+
+	template<typename T, typename... Args>
+	T *New(Args&&... args) {
+		if (std::is_trivially_destructible<T>::value)
+			return ::new(Allocate(sizeof(T), alignof(T)))
+				T(std::forward<Args>(args)...);
+
+		/* allocate the #Cleanup first, because nothing may
+		   throw after the object has been constructed */
+		Cleanup *c = AllocateCleanup();
+		T *p = ::new(Allocate(sizeof(T), alignof(T)))
+			T(std::forward<Args>(args)...);
+		AddCleanup<T>(*c, p, 1);
+		return p;
+	}
+
+	template<typename T>
+	T *NewArray(size_t n) {
+		Cleanup *c = std::is_trivially_destructible<T>::value
+			? nullptr
+			: AllocateCleanup();
+
+		T *p = (T *)Allocate(sizeof(T) * n, alignof(T));
+
+		size_t i = 0;
+		try {
+			for (; i < n; ++i)
+				::new(p + i) T();
+		} catch (...) {
+			Destruct<T>(p, i);
+			throw;
+		}
+
+		if (c != nullptr)
+			AddCleanup<T>(*c, p, n);
+		return p;
+	}
+
+private:
+	static uint8_t *Align(uint8_t *p, size_t alignment) noexcept {
+		return (uint8_t *)(((uintptr_t)p + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	}
+
+	void *AllocateSlow(size_t size, size_t alignment);
+
+	/**
+	 * Throws std::bad_alloc on error.
+	 *
+	 * @param use_mmap allocate with mmap() and request huge
+	 * pages; the capacity is rounded up to the huge page size
+	 */
+	static Chunk *NewChunk(size_t capacity, bool use_mmap);
+
+	static void FreeChunks(Chunk *chunk) noexcept;
+
+	template<typename T>
+	static void Destruct(void *p, size_t n) noexcept {
+		for (size_t i = 0; i < n; ++i)
+			((T *)p)[i].~T();
+	}
+
+	/**
+	 * Throws std::bad_alloc on error.
+	 */
+	Cleanup *AllocateCleanup() {
+		return (Cleanup *)Allocate(sizeof(Cleanup), alignof(Cleanup));
+	}
+
+	template<typename T>
+	void AddCleanup(Cleanup &c, T *p, size_t n) noexcept {
+		cleanups = ::new(&c) Cleanup{cleanups, Destruct<T>, p, n};
+	}
+};
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Budget.hxx"
+#include "system/LargeAllocation.hxx"
+
+void
+MemoryBudget::Add(MemoryReclaimer &r, unsigned priority) noexcept
+{
+	r.unlink();
+	r.priority = priority;
+
+	/* insert after all reclaimers with the same priority, so
+	   those which were registered first are asked first */
+	auto i = reclaimers.begin();
+	while (i != reclaimers.end() && i->priority <= priority)
+		++i;
+
+	reclaimers.insert(i, r);
+}
+
+size_t
+MemoryBudget::GetUsage() const noexcept
+{
+	size_t usage = LargeAllocation::GetTotalSize();
+	for (const auto &r : reclaimers)
+		usage += r.GetMemoryUsage();
+	return usage;
+}
+
+size_t
+MemoryBudget::Check() noexcept
+{
+	if (limit == 0)
+		return 0;
+
+	const size_t usage = GetUsage();
+	if (usage <= limit)
+		return 0;
+
+	++stats.exceeded;
+	return Reclaim(usage - (limit - limit / 8));
+}
+
+size_t
+MemoryBudget::OnPressure() noexcept
+{
+	++stats.pressure;
+	return Reclaim(GetUsage() / 8);
+}
+
+size_t
+MemoryBudget::Reclaim(size_t bytes) noexcept
+{
+	size_t released = 0;
+
+	/* a reclaimer may unregister itself, so the iterator is
+	   advanced before invoking it */
+	for (auto i = reclaimers.begin();
+	     released < bytes && i != reclaimers.end();) {
+		MemoryReclaimer &r = *i++;
+		released += r.ReclaimMemory(bytes - released);
+	}
+
+	stats.reclaimed += released;
+	return released;
+}
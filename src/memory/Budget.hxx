@@ -0,0 +1,194 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <boost/intrusive/list.hpp>
+
+#include <stddef.h>
+#include <stdint.h>
+
+class MemoryBudget;
+
+/**
+ * Something which holds memory that can be released on demand,
+ * e.g. a cache or a pool with spare capacity.  Register it with
+ * MemoryBudget::Add().
+ */
+class MemoryReclaimer
+	: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> {
+
+	friend class MemoryBudget;
+
+	/**
+	 * Reclaimers with a lower value are asked first.
+	 */
+	unsigned priority = 0;
+
+public:
+	virtual ~MemoryReclaimer() noexcept = default;
+
+	/**
+	 * Returns the number of bytes currently held which are not
+	 * allocated with #LargeAllocation (those are accounted for
+	 * automatically), e.g. heap-allocated cache items.
+	 */
+	virtual size_t GetMemoryUsage() const noexcept = 0;
+
+	/**
+	 * Release at least the given number of bytes, if possible.
+	 *
+	 * @return the number of bytes which were actually released
+	 * (may be more or less than requested)
+	 */
+	virtual size_t ReclaimMemory(size_t bytes) noexcept = 0;
+};
+
+/**
+ * Enforces a process-wide memory budget for caches and pools.  The
+ * usage is the sum of all #LargeAllocation instances and of the
+ * GetMemoryUsage() of all registered #MemoryReclaimer instances.
+ * When the usage exceeds the limit, or when the kernel reports
+ * memory pressure (see OnPressure()), reclaimers are asked to
+ * release memory in priority order.
+ *
+ * Nothing is done automatically: the caller invokes Check() after
+ * growing a cache or from a periodic timer, and OnPressure() from a
+ * #CgroupPressureHandler watching "memory.pressure" (e.g. of a group
+ * with "memory.high").
+ *
+ * This class is not thread-safe; all reclaimers must be owned by
+ * the thread which calls Check() and OnPressure().
+ */
+class MemoryBudget {
+	boost::intrusive::list<MemoryReclaimer,
+			       boost::intrusive::constant_time_size<false>> reclaimers;
+
+	/**
+	 * The maximum usage; 0 means unlimited.
+	 */
+	size_t limit;
+
+public:
+	struct Stats {
+		/**
+		 * The number of times Check() found the budget
+		 * exceeded.
+		 */
+		uint64_t exceeded = 0;
+
+		/**
+		 * The number of OnPressure() calls.
+		 */
+		uint64_t pressure = 0;
+
+		/**
+		 * The total number of bytes released by reclaimers.
+		 */
+		uint64_t reclaimed = 0;
+	};
+
+private:
+	Stats stats;
+
+public:
+	/**
+	 * @param _limit the maximum usage in bytes; 0 means
+	 * unlimited (only OnPressure() reclaims memory)
+	 */
+	explicit MemoryBudget(size_t _limit=0) noexcept
+		:limit(_limit) {}
+
+	~MemoryBudget() noexcept {
+		reclaimers.clear();
+	}
+
+	MemoryBudget(const MemoryBudget &) = delete;
+	MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+	size_t GetLimit() const noexcept {
+		return limit;
+	}
+
+	void SetLimit(size_t _limit) noexcept {
+		limit = _limit;
+	}
+
+	const Stats &GetStats() const noexcept {
+		return stats;
+	}
+
+	/**
+	 * Register a reclaimer.  It is unregistered automatically
+	 * when it is destroyed.
+	 *
+	 * @param priority reclaimers with a lower value are asked
+	 * first; use low values for caches which are cheap to
+	 * refill
+	 */
+	void Add(MemoryReclaimer &r, unsigned priority) noexcept;
+
+	void Remove(MemoryReclaimer &r) noexcept {
+		r.unlink();
+	}
+
+	/**
+	 * Determine the current usage in bytes.
+	 */
+	size_t GetUsage() const noexcept;
+
+	/**
+	 * Reclaim memory if the usage exceeds the limit, down to
+	 * 7/8 of the limit, so reclaiming does not occur on every
+	 * call while the usage hovers around the limit.
+	 *
+	 * @return the number of bytes which were released
+	 */
+	size_t Check() noexcept;
+
+	/**
+	 * The kernel reports memory pressure: release 1/8 of the
+	 * current usage, regardless of the limit.
+	 *
+	 * @return the number of bytes which were released
+	 */
+	size_t OnPressure() noexcept;
+
+	/**
+	 * Ask reclaimers in priority order to release the given
+	 * number of bytes, stopping as soon as enough memory has
+	 * been released.
+	 *
+	 * @return the number of bytes which were released
+	 */
+	size_t Reclaim(size_t bytes) noexcept;
+};
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SegmentFifoBuffer.hxx"
+#include "SlicePool.hxx"
+
+#include <algorithm>
+
+#include <assert.h>
+#include <string.h>
+#include <sys/uio.h>
+
+SegmentFifoBuffer::SegmentFifoBuffer(SlicePool &_pool) noexcept
+	:pool(_pool),
+	 segment_capacity(pool.GetSliceSize() - sizeof(Segment))
+{
+	assert(pool.GetSliceSize() > sizeof(Segment));
+}
+
+void
+SegmentFifoBuffer::Clear() noexcept
+{
+	while (head != nullptr)
+		PopSegment();
+
+	available = 0;
+}
+
+void
+SegmentFifoBuffer::AppendSegment()
+{
+	auto *segment = (Segment *)pool.Alloc();
+	segment->next = nullptr;
+
+	if (tail == nullptr) {
+		assert(head == nullptr);
+
+		head = segment;
+		head_position = 0;
+	} else
+		tail->next = segment;
+
+	tail = segment;
+	tail_position = 0;
+}
+
+void
+SegmentFifoBuffer::PopSegment() noexcept
+{
+	assert(head != nullptr);
+
+	Segment *segment = head;
+	head = segment->next;
+	head_position = 0;
+
+	if (head == nullptr) {
+		tail = nullptr;
+		tail_position = 0;
+	}
+
+	pool.Free(segment);
+}
+
+WritableBuffer<uint8_t>
+SegmentFifoBuffer::Write()
+{
+	if (tail == nullptr || tail_position == segment_capacity)
+		AppendSegment();
+
+	return {tail->GetData() + tail_position,
+		segment_capacity - tail_position};
+}
+
+void
+SegmentFifoBuffer::Append(size_t n) noexcept
+{
+	assert(tail != nullptr);
+	assert(tail_position + n <= segment_capacity);
+
+	tail_position += n;
+	available += n;
+}
+
+void
+SegmentFifoBuffer::Append(const void *_p, size_t n)
+{
+	const uint8_t *p = (const uint8_t *)_p;
+
+	while (n > 0) {
+		auto w = Write();
+		const size_t nbytes = std::min(w.size, n);
+		memcpy(w.data, p, nbytes);
+		Append(nbytes);
+		p += nbytes;
+		n -= nbytes;
+	}
+}
+
+ConstBuffer<uint8_t>
+SegmentFifoBuffer::Read() const noexcept
+{
+	if (head == nullptr)
+		return nullptr;
+
+	const size_t end = head == tail ? tail_position : segment_capacity;
+	return {head->GetData() + head_position, end - head_position};
+}
+
+void
+SegmentFifoBuffer::Consume(size_t n) noexcept
+{
+	assert(n <= available);
+
+	available -= n;
+
+	while (n > 0) {
+		assert(head != nullptr);
+
+		const size_t end = head == tail ? tail_position : segment_capacity;
+		const size_t in_head = end - head_position;
+		if (n < in_head) {
+			head_position += n;
+			return;
+		}
+
+		n -= in_head;
+		PopSegment();
+	}
+
+	if (head != nullptr && head == tail && head_position == tail_position)
+		/* the last segment has been drained completely */
+		PopSegment();
+}
+
+size_t
+SegmentFifoBuffer::PrepareIovec(struct iovec *v, size_t max) const noexcept
+{
+	size_t n = 0;
+	size_t position = head_position;
+
+	for (const Segment *i = head; i != nullptr && n < max; i = i->next) {
+		const size_t end = i == tail ? tail_position : segment_capacity;
+		if (end > position) {
+			v[n].iov_base = const_cast<uint8_t *>(i->GetData() + position);
+			v[n].iov_len = end - position;
+			++n;
+		}
+
+		position = 0;
+	}
+
+	return n;
+}
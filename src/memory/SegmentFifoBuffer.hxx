@@ -0,0 +1,171 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/ConstBuffer.hxx"
+#include "util/WritableBuffer.hxx"
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct iovec;
+class SlicePool;
+
+/**
+ * A first-in-first-out byte buffer which consists of a chain of
+ * fixed-size slices from a #SlicePool.  Unlike #DynamicFifoBuffer,
+ * growing it never copies the buffered data, and slices are returned
+ * to the pool as soon as they have been consumed.
+ *
+ * Read() returns only the contiguous part at the head; use
+ * PrepareIovec() to pass all buffered data to writev().
+ *
+ * This class is not thread-safe.
+ */
+class SegmentFifoBuffer {
+	/**
+	 * The header at the beginning of each slice; the data
+	 * follows it.
+	 */
+	struct Segment {
+		Segment *next;
+
+		uint8_t *GetData() noexcept {
+			return (uint8_t *)(this + 1);
+		}
+
+		const uint8_t *GetData() const noexcept {
+			return (const uint8_t *)(this + 1);
+		}
+	};
+
+	SlicePool &pool;
+
+	/**
+	 * The number of data bytes per segment.
+	 */
+	const size_t segment_capacity;
+
+	Segment *head = nullptr, *tail = nullptr;
+
+	/**
+	 * The read position in #head.
+	 */
+	size_t head_position = 0;
+
+	/**
+	 * The write position in #tail.
+	 */
+	size_t tail_position = 0;
+
+	/**
+	 * The total number of buffered bytes.
+	 */
+	size_t available = 0;
+
+public:
+	explicit SegmentFifoBuffer(SlicePool &_pool) noexcept;
+
+	~SegmentFifoBuffer() noexcept {
+		Clear();
+	}
+
+	SegmentFifoBuffer(const SegmentFifoBuffer &) = delete;
+	SegmentFifoBuffer &operator=(const SegmentFifoBuffer &) = delete;
+
+	bool IsEmpty() const noexcept {
+		return available == 0;
+	}
+
+	/**
+	 * Returns the total number of buffered bytes.
+	 */
+	size_t GetAvailable() const noexcept {
+		return available;
+	}
+
+	/**
+	 * Free all segments.
+	 */
+	void Clear() noexcept;
+
+	/**
+	 * Return a writable buffer at the end; a new segment is
+	 * allocated if the last one is full.  Call Append() to
+	 * commit data written to it.
+	 *
+	 * Throws std::bad_alloc on error.
+	 */
+	WritableBuffer<uint8_t> Write();
+
+	/**
+	 * Commit data written into the buffer returned by Write().
+	 */
+	void Append(size_t n) noexcept;
+
+	/**
+	 * Copy data to the end of the buffer, allocating new
+	 * segments as needed.
+	 *
+	 * Throws std::bad_alloc on error.
+	 */
+	void Append(const void *p, size_t n);
+
+	/**
+	 * Return the contiguous data at the head (the first
+	 * segment).  It is empty only if the whole buffer is empty.
+	 */
+	ConstBuffer<uint8_t> Read() const noexcept;
+
+	/**
+	 * Remove data from the head; this may span multiple
+	 * segments.  Drained segments are returned to the pool.
+	 */
+	void Consume(size_t n) noexcept;
+
+	/**
+	 * Fill an iovec array with the buffered data, e.g. for
+	 * writev(); pass the number of bytes written to Consume().
+	 *
+	 * @return the number of iovec items used (at most #max)
+	 */
+	size_t PrepareIovec(struct iovec *v, size_t max) const noexcept;
+
+private:
+	/**
+	 * Throws std::bad_alloc on error.
+	 */
+	void AppendSegment();
+
+	void PopSegment() noexcept;
+};
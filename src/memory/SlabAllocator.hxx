@@ -0,0 +1,223 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "SlabPool.hxx"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+#include <stddef.h>
+
+/**
+ * A per-thread cache in front of a #SlabPool.  Allocate() and Free()
+ * usually don't need any atomic operation; objects are exchanged
+ * with the (shared) #SlabPool only when the cache runs empty or
+ * full.
+ *
+ * This class is not thread-safe; each thread needs its own
+ * instance (see #SlabAllocator).
+ */
+class SlabCache {
+	static constexpr size_t CAPACITY = 64;
+
+	SlabPool &pool;
+
+	size_t n = 0;
+
+	void *objects[CAPACITY];
+
+public:
+	explicit SlabCache(SlabPool &_pool) noexcept:pool(_pool) {}
+
+	~SlabCache() noexcept {
+		Flush(n);
+	}
+
+	SlabCache(const SlabCache &) = delete;
+	SlabCache &operator=(const SlabCache &) = delete;
+
+	/**
+	 * Throws std::bad_alloc on error.
+	 */
+	void *Allocate() {
+		if (n > 0)
+			return objects[--n];
+
+		return pool.Allocate();
+	}
+
+	void Free(void *p) noexcept {
+		if (n == CAPACITY)
+			/* return the older half to the pool, keep the
+			   recently used (cache-hot) objects */
+			FlushOldest(CAPACITY / 2);
+
+		objects[n++] = p;
+	}
+
+private:
+	/**
+	 * Return the @a count most recently freed objects to the
+	 * pool.
+	 */
+	void Flush(size_t count) noexcept {
+		if (count == 0)
+			return;
+
+		for (size_t i = n - count; i + 1 < n; ++i)
+			pool.Link(objects[i], objects[i + 1]);
+
+		pool.FreeList(objects[n - count], objects[n - 1]);
+		n -= count;
+	}
+
+	/**
+	 * Return the @a count least recently freed objects to the
+	 * pool.
+	 */
+	void FlushOldest(size_t count) noexcept {
+		for (size_t i = 0; i + 1 < count; ++i)
+			pool.Link(objects[i], objects[i + 1]);
+
+		pool.FreeList(objects[0], objects[count - 1]);
+
+		std::move(objects + count, objects + n, objects);
+		n -= count;
+	}
+};
+
+/**
+ * A thread-safe allocator for objects of type @a T: a global
+ * #SlabPool per type, with a per-thread #SlabCache.  Objects may be
+ * freed by a different thread than the one which allocated them.
+ *
+ * The pool is never destroyed, so objects may be freed during
+ * process shutdown, even from static destructors.
+ */
+template<typename T>
+class SlabAllocator {
+	static SlabPool &GetPool() noexcept {
+		/* intentionally leaked; see class documentation */
+		static SlabPool &pool = *new SlabPool(sizeof(T), alignof(T));
+		return pool;
+	}
+
+	struct ThreadCache : SlabCache {
+		ThreadCache() noexcept:SlabCache(GetPool()) {}
+
+		~ThreadCache() noexcept {
+			destroyed = true;
+		}
+	};
+
+	/**
+	 * Set by the #ThreadCache destructor; afterwards (e.g. in
+	 * other thread_local destructors), objects go straight to
+	 * the pool.  This is a trivial type, so it remains
+	 * accessible until the thread ends.
+	 */
+	static thread_local bool destroyed;
+
+	static ThreadCache &GetCache() noexcept {
+		static thread_local ThreadCache cache;
+		return cache;
+	}
+
+public:
+	/**
+	 * Allocate uninitialized memory for one object.
+	 *
+	 * Throws std::bad_alloc on error.
+	 */
+	static void *Allocate() {
+		if (destroyed)
+			return GetPool().Allocate();
+
+		return GetCache().Allocate();
+	}
+
+	/**
+	 * Free memory obtained from Allocate().
+	 */
+	static void Free(void *p) noexcept {
+		if (destroyed)
+			GetPool().Free(p);
+		else
+			GetCache().Free(p);
+	}
+
+	template<typename... Args>
+	static T *New(Args&&... args) {
+		void *p = Allocate();
+		try {
+			return ::new(p) T(std::forward<Args>(args)...);
+		} catch (...) {
+			Free(p);
+			throw;
+		}
+	}
+
+	static void Delete(T *t) noexcept {
+		t->~T();
+		Free(t);
+	}
+};
+
+template<typename T>
+thread_local bool SlabAllocator<T>::destroyed = false;
+
+/**
+ * Derive from this class to allocate instances of @a T with plain
+ * "new" and "delete" from a #SlabAllocator.  Derived classes of
+ * @a T with a different size fall back to the global allocator.
+ */
+template<typename T>
+struct SlabAllocated {
+	static void *operator new(size_t size) {
+		if (size != sizeof(T))
+			return ::operator new(size);
+
+		return SlabAllocator<T>::Allocate();
+	}
+
+	static void operator delete(void *p, size_t size) noexcept {
+		if (size != sizeof(T)) {
+			::operator delete(p);
+			return;
+		}
+
+		SlabAllocator<T>::Free(p);
+	}
+};
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SlabPool.hxx"
+
+#include <algorithm>
+#include <new>
+
+#include <assert.h>
+
+constexpr size_t SlabPool::DEFAULT_MAX_SIZE;
+
+static constexpr size_t
+AlignUp(size_t size, size_t alignment) noexcept
+{
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "");
+
+SlabPool::SlabPool(size_t _size, size_t alignment, size_t max_size)
+	:object_size(AlignUp(std::max(_size, sizeof(uint32_t)),
+			     std::max(alignment, alignof(uint32_t)))),
+	 capacity(std::min<size_t>(max_size / object_size, UINT32_MAX - 1)),
+	 allocation(size_t(capacity) * object_size,
+		    LargeAllocation::TRANSPARENT_HUGE|LargeAllocation::RESERVE)
+{
+	assert(alignment <= 4096);
+	assert((alignment & (alignment - 1)) == 0);
+	assert(capacity > 0);
+}
+
+void *
+SlabPool::PopFree() noexcept
+{
+	uint64_t head = free_head.load(std::memory_order_acquire);
+	while (true) {
+		const uint32_t index = uint32_t(head);
+		if (index == 0)
+			return nullptr;
+
+		void *p = FromIndex(index - 1);
+
+		/* this object may be allocated (and overwritten) by
+		   another thread right now; then the tag has changed
+		   and the compare-and-swap fails */
+		const uint32_t next = GetLink(p).load(std::memory_order_relaxed);
+
+		const uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+		if (free_head.compare_exchange_weak(head, new_head,
+						    std::memory_order_acquire,
+						    std::memory_order_acquire))
+			return p;
+	}
+}
+
+void *
+SlabPool::Allocate()
+{
+	void *p = PopFree();
+	if (p != nullptr)
+		return p;
+
+	const uint64_t i = fresh.fetch_add(1, std::memory_order_relaxed);
+	if (i >= capacity)
+		throw std::bad_alloc();
+
+	return FromIndex(i);
+}
+
+void
+SlabPool::FreeList(void *first, void *last) noexcept
+{
+	const uint32_t first_index = ToIndex(first) + 1;
+
+	uint64_t head = free_head.load(std::memory_order_relaxed);
+	while (true) {
+		GetLink(last).store(uint32_t(head), std::memory_order_relaxed);
+		const uint64_t new_head = (((head >> 32) + 1) << 32) | first_index;
+		if (free_head.compare_exchange_weak(head, new_head,
+						    std::memory_order_release,
+						    std::memory_order_relaxed))
+			return;
+	}
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "system/LargeAllocation.hxx"
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A thread-safe pool of fixed-size objects which are carved from
+ * one #LargeAllocation.  The allocation reserves address space for
+ * the maximum number of objects up front (MAP_NORESERVE), and pages
+ * are faulted in only when objects are handed out for the first
+ * time.  Freed objects are kept on a lock-free free list; memory is
+ * never returned to the kernel.
+ *
+ * Objects are identified by a 32 bit index, which allows the free
+ * list head to carry an ABA tag in the same 64 bit word.  Since the
+ * memory is never unmapped, reading the link of an object which has
+ * just been allocated by another thread is harmless; the tag makes
+ * the compare-and-swap fail.
+ *
+ * Most users should use #SlabAllocator instead, which adds a
+ * per-thread cache.
+ */
+class SlabPool {
+	const size_t object_size;
+
+	/**
+	 * The maximum number of objects.
+	 */
+	const uint32_t capacity;
+
+	const LargeAllocation allocation;
+
+	/**
+	 * The index of the next object which has never been handed
+	 * out.
+	 */
+	std::atomic<uint64_t> fresh{0};
+
+	/**
+	 * The head of the free list: the upper 32 bits are an ABA
+	 * tag, the lower 32 bits are the object index plus one (0
+	 * means empty).
+	 */
+	std::atomic<uint64_t> free_head{0};
+
+public:
+	static constexpr size_t DEFAULT_MAX_SIZE = size_t(1) << 30;
+
+	/**
+	 * Throws std::bad_alloc on error.
+	 *
+	 * @param _size the size of each object
+	 * @param alignment the alignment of each object (must be a
+	 * power of two not larger than 4096)
+	 * @param max_size the address space to reserve; this limits
+	 * the number of objects
+	 */
+	SlabPool(size_t _size, size_t alignment,
+		 size_t max_size=DEFAULT_MAX_SIZE);
+
+	SlabPool(const SlabPool &) = delete;
+	SlabPool &operator=(const SlabPool &) = delete;
+
+	size_t GetObjectSize() const noexcept {
+		return object_size;
+	}
+
+	/**
+	 * Allocate one object (uninitialized memory).
+	 *
+	 * Throws std::bad_alloc if the pool is exhausted.
+	 */
+	void *Allocate();
+
+	/**
+	 * Return an object obtained from Allocate().
+	 */
+	void Free(void *p) noexcept {
+		FreeList(p, p);
+	}
+
+	/**
+	 * Return a list of objects which have been linked with
+	 * Link(); @a first is the head and @a last the tail of the
+	 * list.  This needs only one atomic operation for the whole
+	 * list.
+	 */
+	void FreeList(void *first, void *last) noexcept;
+
+	/**
+	 * Link two objects for FreeList().
+	 */
+	void Link(void *p, void *next) const noexcept {
+		GetLink(p).store(ToIndex(next) + 1, std::memory_order_relaxed);
+	}
+
+private:
+	char *GetBase() const noexcept {
+		return (char *)allocation.get();
+	}
+
+	static std::atomic<uint32_t> &GetLink(void *p) noexcept {
+		return *(std::atomic<uint32_t> *)p;
+	}
+
+	void *FromIndex(uint32_t i) const noexcept {
+		return GetBase() + size_t(i) * object_size;
+	}
+
+	uint32_t ToIndex(void *p) const noexcept {
+		return ((char *)p - GetBase()) / object_size;
+	}
+
+	void *PopFree() noexcept;
+};
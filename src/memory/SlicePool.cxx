@@ -0,0 +1,165 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SlicePool.hxx"
+
+#include <assert.h>
+#include <sys/mman.h>
+
+SlicePool::Area::Area(size_t size, bool huge_pages)
+	:allocation(size)
+{
+#ifdef MADV_HUGEPAGE
+	if (huge_pages)
+		madvise(allocation.get(), allocation.size(), MADV_HUGEPAGE);
+#else
+	(void)huge_pages;
+#endif
+}
+
+SlicePool::SlicePool(size_t _slice_size, unsigned _slices_per_area,
+		     bool _huge_pages) noexcept
+	:slice_size(_slice_size), slices_per_area(_slices_per_area),
+	 huge_pages(_huge_pages)
+{
+	/* each free slice stores a pointer */
+	assert(slice_size >= sizeof(void *));
+	assert(slice_size % sizeof(void *) == 0);
+	assert(slices_per_area > 0);
+}
+
+SlicePool::~SlicePool() noexcept
+{
+	/* slices which are still allocated become invalid; this is
+	   tolerated for process-wide pools which are destroyed at
+	   exit */
+
+	available.clear();
+	areas.clear_and_dispose([](Area *area){
+			delete area;
+		});
+}
+
+void *
+SlicePool::Alloc()
+{
+	if (available.empty()) {
+		auto *area = new Area(slice_size * slices_per_area, huge_pages);
+		areas.insert(*area);
+		available.push_front(*area);
+		++n_empty_areas;
+	}
+
+	Area &area = available.front();
+	assert(area.n_allocated < slices_per_area);
+
+	if (area.n_allocated++ == 0)
+		--n_empty_areas;
+
+	void *p;
+	if (area.free_head != nullptr) {
+		p = area.free_head;
+		area.free_head = *(void **)p;
+	} else {
+		assert(area.n_initialized < slices_per_area);
+		p = (char *)area.allocation.get() +
+			area.n_initialized++ * slice_size;
+	}
+
+	if (area.n_allocated == slices_per_area)
+		available.pop_front();
+
+	++n_allocated;
+	return p;
+}
+
+void
+SlicePool::Free(void *p) noexcept
+{
+	assert(p != nullptr);
+	assert(n_allocated > 0);
+
+	auto i = areas.upper_bound(p, Area::Compare());
+	assert(i != areas.begin());
+	--i;
+
+	Area &area = *i;
+	assert((const char *)p >= area.GetBegin());
+	assert((const char *)p < area.GetEnd());
+	assert(((const char *)p - area.GetBegin()) % slice_size == 0);
+	assert(area.n_allocated > 0);
+
+	if (area.n_allocated == slices_per_area)
+		/* it was full; now it has a free slice again */
+		available.push_back(area);
+
+	*(void **)p = area.free_head;
+	area.free_head = p;
+	--n_allocated;
+
+	if (--area.n_allocated == 0) {
+		if (n_empty_areas > 0)
+			/* there is already a spare area; give this one
+			   back to the kernel */
+			DeleteArea(area);
+		else
+			++n_empty_areas;
+	}
+}
+
+size_t
+SlicePool::ReleaseSpare() noexcept
+{
+	if (n_empty_areas == 0)
+		return 0;
+
+	for (auto &area : available) {
+		if (area.n_allocated == 0) {
+			const size_t size = area.allocation.size();
+			DeleteArea(area);
+			--n_empty_areas;
+			return size;
+		}
+	}
+
+	return 0;
+}
+
+void
+SlicePool::DeleteArea(Area &area) noexcept
+{
+	assert(area.n_allocated == 0);
+
+	available.erase(available.iterator_to(area));
+	areas.erase(areas.iterator_to(area));
+	delete &area;
+}
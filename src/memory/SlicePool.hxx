@@ -0,0 +1,188 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "system/LargeAllocation.hxx"
+
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/set.hpp>
+
+#include <stddef.h>
+
+/**
+ * Allocates fixed-size slices from large mmap() areas.  Slices which
+ * have never been used are never touched, so they cost no physical
+ * memory; and because freed slices are reused in LIFO order, the
+ * working set of active users stays small and cache-friendly.
+ *
+ * An area is returned to the kernel when all of its slices are free
+ * (except for one spare area, to avoid mmap()/munmap() ping-pong).
+ *
+ * This class is not thread-safe.
+ */
+class SlicePool {
+	struct Area {
+		typedef boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> AvailableHook;
+		AvailableHook available_hook;
+
+		typedef boost::intrusive::set_member_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> AreasHook;
+		AreasHook areas_hook;
+
+		LargeAllocation allocation;
+
+		/**
+		 * A singly linked list of freed slices; the first word
+		 * of each free slice points to the next one.
+		 */
+		void *free_head = nullptr;
+
+		/**
+		 * The number of slices which have been handed out at
+		 * least once.  Slices beyond this have never been
+		 * touched.
+		 */
+		unsigned n_initialized = 0;
+
+		unsigned n_allocated = 0;
+
+		/**
+		 * Throws std::bad_alloc on error.
+		 */
+		Area(size_t size, bool huge_pages);
+
+		const char *GetBegin() const noexcept {
+			return (const char *)allocation.get();
+		}
+
+		const char *GetEnd() const noexcept {
+			return GetBegin() + allocation.size();
+		}
+
+		struct Compare {
+			bool operator()(const Area &a, const Area &b) const noexcept {
+				return a.GetBegin() < b.GetBegin();
+			}
+
+			/**
+			 * Used by upper_bound() to find the area which
+			 * contains a pointer.
+			 */
+			bool operator()(const void *p, const Area &b) const noexcept {
+				return (const char *)p < b.GetBegin();
+			}
+
+			bool operator()(const Area &a, const void *p) const noexcept {
+				return a.GetBegin() < (const char *)p;
+			}
+		};
+	};
+
+	const size_t slice_size;
+	const unsigned slices_per_area;
+	const bool huge_pages;
+
+	/**
+	 * All areas, sorted by address, to find the area of a slice
+	 * in Free().
+	 */
+	boost::intrusive::set<Area,
+			      boost::intrusive::member_hook<Area, Area::AreasHook,
+							    &Area::areas_hook>,
+			      boost::intrusive::compare<Area::Compare>,
+			      boost::intrusive::constant_time_size<true>> areas;
+
+	/**
+	 * Areas which have at least one free slice.
+	 */
+	boost::intrusive::list<Area,
+			       boost::intrusive::member_hook<Area, Area::AvailableHook,
+							     &Area::available_hook>,
+			       boost::intrusive::constant_time_size<false>> available;
+
+	/**
+	 * The number of areas without any allocated slice.
+	 */
+	unsigned n_empty_areas = 0;
+
+	size_t n_allocated = 0;
+
+public:
+	/**
+	 * @param huge_pages advise the kernel to back areas with
+	 * transparent huge pages (useful for large areas which are
+	 * mostly in use)
+	 */
+	SlicePool(size_t _slice_size, unsigned _slices_per_area,
+		  bool _huge_pages=false) noexcept;
+
+	~SlicePool() noexcept;
+
+	SlicePool(const SlicePool &) = delete;
+	SlicePool &operator=(const SlicePool &) = delete;
+
+	size_t GetSliceSize() const noexcept {
+		return slice_size;
+	}
+
+	/**
+	 * Returns the number of slices currently allocated.
+	 */
+	size_t GetAllocatedCount() const noexcept {
+		return n_allocated;
+	}
+
+	/**
+	 * Returns the number of areas currently mapped.
+	 */
+	size_t GetAreaCount() const noexcept {
+		return areas.size();
+	}
+
+	/**
+	 * Throws std::bad_alloc on error.
+	 */
+	void *Alloc();
+
+	void Free(void *p) noexcept;
+
+	/**
+	 * Return the spare area (if any) to the kernel, e.g. when
+	 * asked by a #MemoryReclaimer.
+	 *
+	 * @return the number of bytes which were released
+	 */
+	size_t ReleaseSpare() noexcept;
+
+private:
+	void DeleteArea(Area &area) noexcept;
+};
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "AddressPrefixSet.hxx"
+#include "MaskedSocketAddress.hxx"
+#include "IPv4Address.hxx"
+#include "IPv6Address.hxx"
+#include "system/Error.hxx"
+#include "util/StringUtil.hxx"
+#include "util/RuntimeError.hxx"
+#include "util/ScopeExit.hxx"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+constexpr size_t AddressPrefixSet::npos;
+
+static constexpr bool
+GetBit(const std::array<uint8_t, 16> &key, unsigned i) noexcept
+{
+	return (key[i / 8] >> (7 - i % 8)) & 1;
+}
+
+/**
+ * Clear all bits beyond the given length.
+ */
+static void
+Truncate(std::array<uint8_t, 16> &key, unsigned length) noexcept
+{
+	unsigned i = length / 8;
+	if (i >= key.size())
+		return;
+
+	if (length % 8 != 0)
+		key[i++] &= 0xff << (8 - length % 8);
+
+	std::fill(key.begin() + i, key.end(), 0);
+}
+
+/**
+ * Determine the number of leading bits which are equal in both
+ * keys, up to the given maximum.
+ */
+gcc_pure
+static unsigned
+CommonPrefixLength(const std::array<uint8_t, 16> &a,
+		   const std::array<uint8_t, 16> &b,
+		   unsigned max_length) noexcept
+{
+	unsigned i = 0;
+	while (i < max_length && i % 8 == 0 && a[i / 8] == b[i / 8])
+		i += 8;
+
+	while (i < max_length && GetBit(a, i) == GetBit(b, i))
+		++i;
+
+	return std::min(i, max_length);
+}
+
+bool
+AddressPrefixSet::Tree::Insert(const Key &_key, unsigned length,
+			       size_t value)
+{
+	assert(value != npos);
+
+	Key key = _key;
+	Truncate(key, length);
+
+	uint32_t i = 0;
+
+	while (true) {
+		assert(nodes[i].length <= length);
+
+		if (nodes[i].length == length) {
+			if (nodes[i].value != npos)
+				return false;
+
+			nodes[i].value = value;
+			return true;
+		}
+
+		const bool bit = GetBit(key, nodes[i].length);
+		const uint32_t child = nodes[i].children[bit];
+		if (child == 0) {
+			/* new leaf */
+			const uint32_t leaf = nodes.size();
+			nodes.emplace_back(key, length);
+			nodes.back().value = value;
+			nodes[i].children[bit] = leaf;
+			return true;
+		}
+
+		const unsigned child_length = nodes[child].length;
+		const unsigned common =
+			CommonPrefixLength(key, nodes[child].key,
+					   std::min(length, child_length));
+		if (common == child_length) {
+			/* the child is a prefix of the new key */
+			i = child;
+			continue;
+		}
+
+		/* split the edge to the child at the first
+		   differing bit (or at the end of the new key) */
+		Key split_key = key;
+		Truncate(split_key, common);
+
+		const uint32_t split = nodes.size();
+		nodes.emplace_back(split_key, common);
+		nodes[split].children[GetBit(nodes[child].key, common)] = child;
+
+		if (common == length) {
+			nodes[split].value = value;
+		} else {
+			const uint32_t leaf = nodes.size();
+			nodes.emplace_back(key, length);
+			nodes.back().value = value;
+			nodes[split].children[GetBit(key, common)] = leaf;
+		}
+
+		nodes[i].children[bit] = split;
+		return true;
+	}
+}
+
+inline const AddressPrefixSet::Node *
+AddressPrefixSet::Tree::FindLongest(const Key &key,
+				    unsigned max_length) const noexcept
+{
+	const Node *best = nullptr;
+	const Node *node = &nodes.front();
+
+	while (true) {
+		if (node->value != npos)
+			best = node;
+
+		if (node->length >= max_length)
+			break;
+
+		const uint32_t child = node->children[GetBit(key, node->length)];
+		if (child == 0)
+			break;
+
+		node = &nodes[child];
+		if (CommonPrefixLength(key, node->key,
+				       node->length) < node->length)
+			break;
+	}
+
+	return best;
+}
+
+static std::array<uint8_t, 16>
+ToKey(const IPv4Address &address) noexcept
+{
+	std::array<uint8_t, 16> key{};
+	memcpy(key.data(), &address.GetAddress(), 4);
+	return key;
+}
+
+static std::array<uint8_t, 16>
+ToKey(const IPv6Address &address) noexcept
+{
+	std::array<uint8_t, 16> key;
+	memcpy(key.data(), &address.GetAddress(), 16);
+	return key;
+}
+
+void
+AddressPrefixSet::Add(const MaskedSocketAddress &prefix, size_t value)
+{
+	const auto address = prefix.GetAddress();
+	const unsigned length = prefix.GetPrefixLength();
+
+	bool added;
+
+	switch (address.GetFamily()) {
+	case AF_INET:
+		if (length > 32)
+			throw std::invalid_argument("Prefix length is too big");
+
+		added = ipv4.Insert(ToKey(IPv4Address::Cast(address)),
+				    length, value);
+		break;
+
+	case AF_INET6:
+		if (length > 128)
+			throw std::invalid_argument("Prefix length is too big");
+
+		added = ipv6.Insert(ToKey(IPv6Address::Cast(address)),
+				    length, value);
+		break;
+
+	default:
+		throw std::invalid_argument("Address family not supported");
+	}
+
+	if (added)
+		++n_prefixes;
+}
+
+void
+AddressPrefixSet::Add(const char *s, size_t value)
+{
+	Add(MaskedSocketAddress(s), value);
+}
+
+void
+AddressPrefixSet::LoadFile(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (file == nullptr)
+		throw FormatErrno("Failed to open %s", path);
+
+	AtScopeExit(file) { fclose(file); };
+
+	char line[256];
+	size_t line_number = 0;
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		++line_number;
+
+		char *p = Strip(line);
+		if (*p == 0 || *p == '#')
+			continue;
+
+		try {
+			Add(p, line_number);
+		} catch (...) {
+			std::throw_with_nested(FormatRuntimeError("%s line %zu",
+								  path,
+								  line_number));
+		}
+	}
+}
+
+size_t
+AddressPrefixSet::Find(SocketAddress address) const noexcept
+{
+	if (address.IsNull())
+		return npos;
+
+	const Node *node;
+
+	switch (address.GetFamily()) {
+	case AF_INET:
+		if (address.GetSize() < sizeof(struct sockaddr_in))
+			return npos;
+
+		node = ipv4.FindLongest(ToKey(IPv4Address::Cast(address)), 32);
+		break;
+
+	case AF_INET6:
+		if (address.GetSize() < sizeof(struct sockaddr_in6))
+			return npos;
+
+		node = ipv6.FindLongest(ToKey(IPv6Address::Cast(address)), 128);
+		break;
+
+	default:
+		return npos;
+	}
+
+	return node != nullptr ? node->value : npos;
+}
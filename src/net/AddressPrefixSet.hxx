@@ -0,0 +1,161 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "SocketAddress.hxx"
+#include "util/Compiler.h"
+
+#include <array>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+class MaskedSocketAddress;
+
+/**
+ * A set of IPv4 and IPv6 network prefixes (e.g. an access control
+ * list) with longest-prefix-match lookups.  Each address family has
+ * its own path-compressed binary radix tree, so a lookup visits at
+ * most one node per distinct prefix length on the path (at most 33
+ * for IPv4, 129 for IPv6), independent of the number of prefixes.
+ *
+ * Other address families (e.g. local sockets) are not supported.
+ */
+class AddressPrefixSet {
+public:
+	static constexpr size_t npos = size_t(-1);
+
+private:
+	typedef std::array<uint8_t, 16> Key;
+
+	struct Node {
+		/**
+		 * The prefix bits; bits beyond #length are zero.
+		 */
+		Key key;
+
+		/**
+		 * The child node indices for the next bit being 0 or
+		 * 1; 0 means none (the root is never a child).
+		 */
+		uint32_t children[2] = {0, 0};
+
+		/**
+		 * The value passed to Add() if this node is a member
+		 * prefix, or #npos if it is only an inner node.
+		 */
+		size_t value = npos;
+
+		uint8_t length;
+
+		Node(const Key &_key, unsigned _length) noexcept
+			:key(_key), length(_length) {}
+	};
+
+	struct Tree {
+		/**
+		 * All nodes; the first one is the root (prefix
+		 * length 0).
+		 */
+		std::vector<Node> nodes;
+
+		Tree() {
+			nodes.emplace_back(Key(), 0);
+		}
+
+		/**
+		 * @return false if the prefix already existed
+		 */
+		bool Insert(const Key &key, unsigned length, size_t value);
+
+		gcc_pure
+		const Node *FindLongest(const Key &key,
+					unsigned max_length) const noexcept;
+	};
+
+	Tree ipv4, ipv6;
+
+	size_t n_prefixes = 0;
+
+public:
+	size_t size() const noexcept {
+		return n_prefixes;
+	}
+
+	bool empty() const noexcept {
+		return n_prefixes == 0;
+	}
+
+	/**
+	 * Add a prefix.  If the same prefix is added again, the old
+	 * value is kept (and size() is not incremented).
+	 *
+	 * Throws std::invalid_argument if the address family is not
+	 * supported.
+	 *
+	 * @param value an arbitrary value to be returned by Find(),
+	 * e.g. an index into the caller's table; must not be #npos
+	 */
+	void Add(const MaskedSocketAddress &prefix, size_t value=0);
+
+	/**
+	 * Parse a prefix (see MaskedSocketAddress) and add it.
+	 *
+	 * Throws on error.
+	 */
+	void Add(const char *s, size_t value=0);
+
+	/**
+	 * Load prefixes from a text file with one prefix per line.
+	 * Empty lines and lines starting with '#' are ignored.  The
+	 * value of each prefix is its line number.
+	 *
+	 * Throws on error.
+	 */
+	void LoadFile(const char *path);
+
+	/**
+	 * Find the longest prefix containing the given address.
+	 *
+	 * @return the value of the prefix or #npos if there is no
+	 * match
+	 */
+	gcc_pure
+	size_t Find(SocketAddress address) const noexcept;
+
+	gcc_pure
+	bool Contains(SocketAddress address) const noexcept {
+		return Find(address) != npos;
+	}
+};
@@ -0,0 +1,223 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Handoff.hxx"
+#include "SendMessage.hxx"
+#include "ReceiveMessage.hxx"
+#include "ScmRightsBuilder.hxx"
+#include "AllocatedSocketAddress.hxx"
+#include "SocketProtocolError.hxx"
+#include "system/Error.hxx"
+
+#include <string.h>
+
+static void
+SendHandoffPacket(SocketDescriptor s, HandoffCommand command,
+		  StringView name, StringView config, FileDescriptor fd)
+{
+	if (sizeof(HandoffHeader) + name.size + config.size > HANDOFF_MAX_PACKET_SIZE)
+		throw std::runtime_error("Handoff item too large");
+
+	HandoffHeader header{};
+	header.magic = HANDOFF_MAGIC;
+	header.command = command;
+	header.name_length = name.size;
+	header.config_length = config.size;
+
+	struct iovec v[] = {
+		{&header, sizeof(header)},
+		{const_cast<char *>(name.data), name.size},
+		{const_cast<char *>(config.data), config.size},
+	};
+
+	MessageHeader msg(ConstBuffer<struct iovec>(v, 3));
+
+	ScmRightsBuilder<1> b(msg);
+	if (fd.IsDefined()) {
+		b.push_back(fd.Get());
+		b.Finish(msg);
+	} else {
+		msg.msg_control = nullptr;
+		msg.msg_controllen = 0;
+	}
+
+	SendMessage(s, msg, MSG_NOSIGNAL);
+}
+
+void
+SendHandoffItem(SocketDescriptor s, StringView name, StringView config,
+		FileDescriptor fd)
+{
+	SendHandoffPacket(s, HandoffCommand::ITEM, name, config, fd);
+}
+
+void
+SendHandoffCommand(SocketDescriptor s, HandoffCommand command)
+{
+	SendHandoffPacket(s, command, nullptr, nullptr,
+			  FileDescriptor::Undefined());
+}
+
+using HandoffReceiveBuffer = ReceiveMessageBuffer<HANDOFF_MAX_PACKET_SIZE, sizeof(int)>;
+
+/**
+ * Receive one packet and verify its header.
+ *
+ * @return the header (with command==0 if the peer has closed the
+ * connection)
+ */
+static HandoffHeader
+ReceiveHandoffPacket(SocketDescriptor s, HandoffReceiveBuffer &buffer,
+		     ReceiveMessageResult &result)
+{
+	result = ReceiveMessage(s, buffer, 0);
+
+	HandoffHeader header{};
+	if (result.payload.IsNull())
+		return header;
+
+	if (result.payload.size < sizeof(header))
+		throw SocketProtocolError("Malformed handoff packet");
+
+	memcpy(&header, result.payload.data, sizeof(header));
+	if (header.magic != HANDOFF_MAGIC ||
+	    result.payload.size != sizeof(header) + header.name_length + header.config_length)
+		throw SocketProtocolError("Malformed handoff packet");
+
+	return header;
+}
+
+std::forward_list<HandoffItem>
+ReceiveHandoffItems(SocketDescriptor s)
+{
+	std::forward_list<HandoffItem> items;
+	auto tail = items.before_begin();
+
+	HandoffReceiveBuffer buffer;
+
+	while (true) {
+		ReceiveMessageResult result;
+		const auto header = ReceiveHandoffPacket(s, buffer, result);
+		switch (header.command) {
+		case HandoffCommand::ITEM:
+			if (result.fds.empty())
+				throw SocketProtocolError("Handoff item without file descriptor");
+
+			{
+				const char *p = (const char *)result.payload.data + sizeof(header);
+				StringView name(p, header.name_length);
+				StringView config(p + header.name_length,
+						  header.config_length);
+				tail = items.emplace_after(tail, name, config,
+							   std::move(result.fds.front()));
+			}
+
+			break;
+
+		case HandoffCommand::END:
+			return items;
+
+		case HandoffCommand::COMMIT:
+			throw SocketProtocolError("Unexpected handoff packet");
+
+		default:
+			if (result.payload.IsNull())
+				throw SocketClosedPrematurelyError();
+
+			throw SocketProtocolError("Unexpected handoff packet");
+		}
+	}
+}
+
+bool
+ReceiveHandoffCommit(SocketDescriptor s)
+{
+	HandoffReceiveBuffer buffer;
+	ReceiveMessageResult result;
+	const auto header = ReceiveHandoffPacket(s, buffer, result);
+	if (result.payload.IsNull())
+		return false;
+
+	if (header.command != HandoffCommand::COMMIT)
+		throw SocketProtocolError("Unexpected handoff packet");
+
+	return true;
+}
+
+static UniqueSocketDescriptor
+ConnectHandoffSocket(const char *path)
+{
+	AllocatedSocketAddress address;
+	address.SetLocal(path);
+
+	UniqueSocketDescriptor s;
+	if (!s.Create(AF_LOCAL, SOCK_SEQPACKET, 0))
+		throw MakeErrno("Failed to create socket");
+
+	if (!s.Connect(address))
+		throw FormatErrno("Failed to connect to %s", path);
+
+	return s;
+}
+
+HandoffClient::HandoffClient(const char *path)
+	:HandoffClient(ConnectHandoffSocket(path)) {}
+
+HandoffClient::HandoffClient(UniqueSocketDescriptor &&_socket)
+	:socket(std::move(_socket)),
+	 items(ReceiveHandoffItems(socket)) {}
+
+UniqueFileDescriptor
+HandoffClient::Take(StringView name, StringView config) noexcept
+{
+	for (auto prev = items.before_begin(), i = std::next(prev);
+	     i != items.end(); prev = i++) {
+		if (!name.Equals(StringView(i->name.data(), i->name.size())))
+			continue;
+
+		UniqueFileDescriptor result;
+		if (config.Equals(StringView(i->config.data(), i->config.size())))
+			result = std::move(i->fd);
+
+		items.erase_after(prev);
+		return result;
+	}
+
+	return UniqueFileDescriptor();
+}
+
+void
+HandoffClient::Commit()
+{
+	items.clear();
+	SendHandoffCommand(socket, HandoffCommand::COMMIT);
+}
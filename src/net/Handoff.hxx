@@ -0,0 +1,199 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "UniqueSocketDescriptor.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/StringView.hxx"
+
+#include <forward_list>
+#include <string>
+
+#include <stdint.h>
+
+/*
+ * The "hot restart" handoff protocol: a new process connects to the
+ * old one over a SOCK_SEQPACKET UNIX socket, and the old one sends
+ * all of its listening sockets (and other file descriptors such as
+ * cache snapshot memfds), each with a name and an opaque
+ * configuration blob.  The new process starts serving on those
+ * sockets right away, without rebinding, and then sends COMMIT; only
+ * then does the old process stop accepting and begin draining.
+ * Since both processes share the very same sockets during the
+ * transition, no connection attempt is refused.
+ *
+ * Each packet consists of a #HandoffHeader, the name and the
+ * configuration; ITEM packets carry exactly one file descriptor
+ * (SCM_RIGHTS).
+ */
+
+enum class HandoffCommand : uint16_t {
+	/**
+	 * Old to new: a file descriptor.
+	 */
+	ITEM = 1,
+
+	/**
+	 * Old to new: there are no more items.
+	 */
+	END = 2,
+
+	/**
+	 * New to old: the new process has taken over; the old
+	 * process shall now stop accepting and drain.
+	 */
+	COMMIT = 3,
+};
+
+struct HandoffHeader {
+	uint32_t magic;
+	HandoffCommand command;
+	uint16_t name_length;
+	uint32_t config_length;
+};
+
+static_assert(sizeof(HandoffHeader) == 12, "Wrong header size");
+
+static constexpr uint32_t HANDOFF_MAGIC = 0x48444f46; /* "FODH" */
+
+/**
+ * The maximum size of one packet (header, name and configuration).
+ */
+static constexpr size_t HANDOFF_MAX_PACKET_SIZE = 16384;
+
+struct HandoffItem {
+	std::string name;
+
+	/**
+	 * An opaque blob describing the object, e.g. the listener
+	 * configuration, to be compared with the new process's
+	 * configuration.
+	 */
+	std::string config;
+
+	UniqueFileDescriptor fd;
+
+	HandoffItem(StringView _name, StringView _config,
+		    UniqueFileDescriptor &&_fd) noexcept
+		:name(_name.data, _name.size),
+		 config(_config.data, _config.size),
+		 fd(std::move(_fd)) {}
+};
+
+/**
+ * Send one file descriptor.  The descriptor is duplicated by the
+ * kernel; the caller keeps using (and owning) it.
+ *
+ * Throws on error.
+ */
+void
+SendHandoffItem(SocketDescriptor s, StringView name, StringView config,
+		FileDescriptor fd);
+
+/**
+ * Send a packet without a file descriptor (#HandoffCommand::END or
+ * #HandoffCommand::COMMIT).
+ *
+ * Throws on error.
+ */
+void
+SendHandoffCommand(SocketDescriptor s, HandoffCommand command);
+
+/**
+ * Receive items until #HandoffCommand::END.
+ *
+ * Throws on error (including premature end of the connection).
+ */
+std::forward_list<HandoffItem>
+ReceiveHandoffItems(SocketDescriptor s);
+
+/**
+ * Receive #HandoffCommand::COMMIT.
+ *
+ * Throws on error.
+ *
+ * @return false if the peer has closed the connection without
+ * committing
+ */
+bool
+ReceiveHandoffCommit(SocketDescriptor s);
+
+/**
+ * The new process's side of the handoff protocol.
+ */
+class HandoffClient {
+	UniqueSocketDescriptor socket;
+
+	std::forward_list<HandoffItem> items;
+
+public:
+	/**
+	 * Connect to the old process's handoff socket and receive
+	 * all items.
+	 *
+	 * Throws on error.
+	 */
+	explicit HandoffClient(const char *path);
+
+	/**
+	 * Use an already connected socket.
+	 *
+	 * Throws on error.
+	 */
+	explicit HandoffClient(UniqueSocketDescriptor &&_socket);
+
+	/**
+	 * Take the item with the given name.  Compare its
+	 * configuration with @a config and return an undefined
+	 * descriptor if it differs (or if there is no such item),
+	 * so the caller falls back to creating a new one.
+	 */
+	UniqueFileDescriptor Take(StringView name, StringView config) noexcept;
+
+	/**
+	 * Like Take(), but return a socket.
+	 */
+	UniqueSocketDescriptor TakeSocket(StringView name,
+					  StringView config) noexcept {
+		return UniqueSocketDescriptor(Take(name, config).Steal());
+	}
+
+	/**
+	 * Tell the old process that we have taken over.  Items which
+	 * were not taken are closed.
+	 *
+	 * Throws on error.
+	 */
+	void Commit();
+};
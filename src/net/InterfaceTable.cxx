@@ -0,0 +1,323 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "InterfaceTable.hxx"
+#include "SocketAddress.hxx"
+#include "IPv4Address.hxx"
+#include "IPv6Address.hxx"
+#include "util/FastHash.hxx"
+
+#include <algorithm>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+
+size_t
+NetworkInterfaceTable::AddressKey::Hash::operator()(const AddressKey &key) const noexcept
+{
+	return FastHash64(key.data, key.size, key.family);
+}
+
+/**
+ * Obtain the payload of a netlink message, or nullptr if it is too
+ * short for the given header type.  This replaces NLMSG_DATA(),
+ * which casts away the "const".
+ */
+template<typename T>
+gcc_pure
+static const T *
+GetPayload(const struct nlmsghdr &nlh) noexcept
+{
+	if (nlh.nlmsg_len < NLMSG_LENGTH(sizeof(T)))
+		return nullptr;
+
+	return (const T *)(const void *)((const char *)&nlh + NLMSG_HDRLEN);
+}
+
+/**
+ * Invoke the given function for each rtattr following the fixed
+ * header #T.  This replaces RTA_OK() and RTA_NEXT(), which cast
+ * away the "const".
+ */
+template<typename T, typename F>
+static void
+ForEachAttribute(const struct nlmsghdr &nlh, F &&f)
+{
+	const size_t offset = NLMSG_LENGTH(sizeof(T));
+	const char *p = (const char *)&nlh + NLMSG_ALIGN(offset);
+	size_t remaining = nlh.nlmsg_len - std::min<size_t>(NLMSG_ALIGN(offset),
+							    nlh.nlmsg_len);
+
+	while (remaining >= sizeof(struct rtattr)) {
+		const auto &rta = *(const struct rtattr *)(const void *)p;
+		if (rta.rta_len < sizeof(rta) || rta.rta_len > remaining)
+			break;
+
+		f(rta.rta_type, p + RTA_LENGTH(0), rta.rta_len - RTA_LENGTH(0));
+
+		const size_t n = std::min<size_t>(RTA_ALIGN(rta.rta_len),
+						  remaining);
+		p += n;
+		remaining -= n;
+	}
+}
+
+bool
+NetworkInterfaceTable::Handle(const struct nlmsghdr &nlh) noexcept
+{
+	switch (nlh.nlmsg_type) {
+	case RTM_NEWLINK:
+		return HandleNewLink(nlh);
+
+	case RTM_DELLINK:
+		return HandleDelLink(nlh);
+
+	case RTM_NEWADDR:
+		return HandleAddress(nlh, true);
+
+	case RTM_DELADDR:
+		return HandleAddress(nlh, false);
+
+	default:
+		return false;
+	}
+}
+
+inline bool
+NetworkInterfaceTable::HandleNewLink(const struct nlmsghdr &nlh) noexcept
+{
+	const auto *ifi = GetPayload<struct ifinfomsg>(nlh);
+	if (ifi == nullptr || ifi->ifi_index <= 0)
+		return false;
+
+	const unsigned index = ifi->ifi_index;
+
+	std::string name;
+	ForEachAttribute<struct ifinfomsg>(nlh, [&name](unsigned type,
+							 const char *data,
+							 size_t size){
+		if (type == IFLA_IFNAME)
+			name.assign(data, strnlen(data, size));
+	});
+
+	auto &i = by_index[index];
+	bool modified = i.flags != ifi->ifi_flags;
+	i.flags = ifi->ifi_flags;
+
+	if (!name.empty() && name != i.name) {
+		/* new interface or renamed */
+		auto old = by_name.find(i.name);
+		if (old != by_name.end() && old->second == index)
+			by_name.erase(old);
+
+		i.name = std::move(name);
+		by_name[i.name] = index;
+		modified = true;
+	}
+
+	return modified;
+}
+
+inline bool
+NetworkInterfaceTable::HandleDelLink(const struct nlmsghdr &nlh) noexcept
+{
+	const auto *ifi = GetPayload<struct ifinfomsg>(nlh);
+	if (ifi == nullptr || ifi->ifi_index <= 0)
+		return false;
+
+	const unsigned index = ifi->ifi_index;
+	auto i = by_index.find(index);
+	if (i == by_index.end())
+		return false;
+
+	RemoveAddresses(index, i->second);
+
+	auto n = by_name.find(i->second.name);
+	if (n != by_name.end() && n->second == index)
+		by_name.erase(n);
+
+	by_index.erase(i);
+	return true;
+}
+
+inline bool
+NetworkInterfaceTable::HandleAddress(const struct nlmsghdr &nlh,
+				     bool add) noexcept
+{
+	const auto *ifa = GetPayload<struct ifaddrmsg>(nlh);
+	if (ifa == nullptr || ifa->ifa_index == 0)
+		return false;
+
+	size_t expected_size;
+	switch (ifa->ifa_family) {
+	case AF_INET:
+		expected_size = 4;
+		break;
+
+	case AF_INET6:
+		expected_size = 16;
+		break;
+
+	default:
+		/* other address families are unsupported */
+		return false;
+	}
+
+	/* IFA_LOCAL is the local address of point-to-point
+	   interfaces (where IFA_ADDRESS is the peer); it is only
+	   present for IPv4 */
+	const char *address = nullptr, *local = nullptr;
+	ForEachAttribute<struct ifaddrmsg>(nlh, [&](unsigned type,
+						    const char *data,
+						    size_t size){
+		if (size != expected_size)
+			return;
+
+		if (type == IFA_ADDRESS)
+			address = data;
+		else if (type == IFA_LOCAL)
+			local = data;
+	});
+
+	if (local != nullptr)
+		address = local;
+
+	if (address == nullptr)
+		return false;
+
+	const unsigned index = ifa->ifa_index;
+	const AddressKey key(ifa->ifa_family, address, expected_size);
+
+	if (add) {
+		auto &i = by_index[index];
+		if (std::find(i.addresses.begin(), i.addresses.end(),
+			      key) != i.addresses.end())
+			return false;
+
+		i.addresses.push_back(key);
+		by_address[key] = index;
+		return true;
+	} else {
+		auto i = by_index.find(index);
+		if (i == by_index.end())
+			return false;
+
+		auto &addresses = i->second.addresses;
+		auto a = std::find(addresses.begin(), addresses.end(), key);
+		if (a == addresses.end())
+			return false;
+
+		addresses.erase(a);
+
+		auto b = by_address.find(key);
+		if (b != by_address.end() && b->second == index)
+			by_address.erase(b);
+
+		return true;
+	}
+}
+
+void
+NetworkInterfaceTable::RemoveAddresses(unsigned index,
+				       Interface &i) noexcept
+{
+	for (const auto &key : i.addresses) {
+		auto b = by_address.find(key);
+		if (b != by_address.end() && b->second == index)
+			by_address.erase(b);
+	}
+
+	i.addresses.clear();
+}
+
+unsigned
+NetworkInterfaceTable::FindIndex(const char *name) const noexcept
+{
+	/* interface names are shorter than IFNAMSIZ, so this
+	   std::string fits into the small string buffer and does
+	   not allocate */
+	auto i = by_name.find(name);
+	return i != by_name.end() ? i->second : 0;
+}
+
+const char *
+NetworkInterfaceTable::FindName(unsigned index) const noexcept
+{
+	auto i = by_index.find(index);
+	return i != by_index.end() && !i->second.name.empty()
+		? i->second.name.c_str()
+		: nullptr;
+}
+
+unsigned
+NetworkInterfaceTable::GetFlags(unsigned index) const noexcept
+{
+	auto i = by_index.find(index);
+	return i != by_index.end() ? i->second.flags : 0;
+}
+
+bool
+NetworkInterfaceTable::IsRunning(unsigned index) const noexcept
+{
+	const unsigned mask = IFF_UP|IFF_RUNNING;
+	return (GetFlags(index) & mask) == mask;
+}
+
+unsigned
+NetworkInterfaceTable::FindAddress(SocketAddress address) const noexcept
+{
+	AddressKey key;
+
+	switch (address.GetFamily()) {
+	case AF_INET:
+		{
+			const auto &in = IPv4Address::Cast(address).GetAddress();
+			key = AddressKey(AF_INET, &in, sizeof(in));
+		}
+		break;
+
+	case AF_INET6:
+		{
+			const auto &in6 = IPv6Address::Cast(address).GetAddress();
+			key = AddressKey(AF_INET6, &in6, sizeof(in6));
+		}
+		break;
+
+	default:
+		/* other address families are unsupported */
+		return 0;
+	}
+
+	auto i = by_address.find(key);
+	return i != by_address.end() ? i->second : 0;
+}
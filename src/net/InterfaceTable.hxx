@@ -0,0 +1,168 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/Compiler.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+struct nlmsghdr;
+class SocketAddress;
+
+/**
+ * A table of network interfaces and their addresses, indexed by
+ * name, index and address.  It is filled from rtnetlink messages
+ * (RTM_NEWLINK, RTM_DELLINK, RTM_NEWADDR, RTM_DELADDR), either
+ * dump replies or multicast notifications.  See #InterfaceCache for
+ * a class which keeps one up to date.
+ */
+class NetworkInterfaceTable {
+	/**
+	 * An IPv4 or IPv6 address (without port and scope) which can
+	 * be used as a hash table key.
+	 */
+	struct AddressKey {
+		uint8_t family = 0, size = 0;
+		uint8_t data[16];
+
+		AddressKey() = default;
+
+		AddressKey(uint8_t _family, const void *_data,
+			   size_t _size) noexcept
+			:family(_family), size(_size) {
+			memcpy(data, _data, _size);
+		}
+
+		gcc_pure
+		bool operator==(const AddressKey &other) const noexcept {
+			return family == other.family &&
+				size == other.size &&
+				memcmp(data, other.data, size) == 0;
+		}
+
+		struct Hash {
+			gcc_pure
+			size_t operator()(const AddressKey &key) const noexcept;
+		};
+	};
+
+	struct Interface {
+		std::string name;
+
+		/**
+		 * The IFF_* flags.
+		 */
+		unsigned flags = 0;
+
+		std::vector<AddressKey> addresses;
+	};
+
+	std::unordered_map<unsigned, Interface> by_index;
+	std::unordered_map<std::string, unsigned> by_name;
+	std::unordered_map<AddressKey, unsigned, AddressKey::Hash> by_address;
+
+public:
+	gcc_pure
+	bool empty() const noexcept {
+		return by_index.empty();
+	}
+
+	gcc_pure
+	size_t size() const noexcept {
+		return by_index.size();
+	}
+
+	void clear() noexcept {
+		by_index.clear();
+		by_name.clear();
+		by_address.clear();
+	}
+
+	/**
+	 * Apply one rtnetlink message.  Messages of other types are
+	 * ignored.
+	 *
+	 * @return true if the table was modified
+	 */
+	bool Handle(const struct nlmsghdr &nlh) noexcept;
+
+	/**
+	 * @return the interface index or 0 if there is no such
+	 * interface
+	 */
+	gcc_pure
+	unsigned FindIndex(const char *name) const noexcept;
+
+	/**
+	 * @return the interface name or nullptr if there is no such
+	 * interface
+	 */
+	gcc_pure
+	const char *FindName(unsigned index) const noexcept;
+
+	/**
+	 * @return the IFF_* flags of the given interface or 0 if there
+	 * is no such interface
+	 */
+	gcc_pure
+	unsigned GetFlags(unsigned index) const noexcept;
+
+	/**
+	 * Is the given interface administratively up and does it
+	 * have a carrier (IFF_UP and IFF_RUNNING)?
+	 */
+	gcc_pure
+	bool IsRunning(unsigned index) const noexcept;
+
+	/**
+	 * Find the network interface with the given address, like
+	 * FindNetworkInterface().
+	 *
+	 * @return the interface index or 0 if no matching network
+	 * interface was found
+	 */
+	gcc_pure
+	unsigned FindAddress(SocketAddress address) const noexcept;
+
+private:
+	bool HandleNewLink(const struct nlmsghdr &nlh) noexcept;
+	bool HandleDelLink(const struct nlmsghdr &nlh) noexcept;
+	bool HandleAddress(const struct nlmsghdr &nlh, bool add) noexcept;
+
+	void RemoveAddresses(unsigned index, Interface &i) noexcept;
+};
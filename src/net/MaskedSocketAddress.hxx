@@ -52,6 +52,14 @@ public:
 	 */
 	explicit MaskedSocketAddress(const char *s);
 
+	SocketAddress GetAddress() const noexcept {
+		return address;
+	}
+
+	unsigned GetPrefixLength() const noexcept {
+		return prefix_length;
+	}
+
 	gcc_pure
 	bool Matches(SocketAddress other) const noexcept;
 };
@@ -33,43 +33,124 @@
 #include "MultiReceiveMessage.hxx"
 #include "SocketDescriptor.hxx"
 #include "system/Error.hxx"
+#include "system/HugePage.hxx"
+
+#include <algorithm>
+
+#include <assert.h>
+#include <stdint.h>
 
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+/**
+ * The maximum number of segments the kernel coalesces with UDP_GRO
+ * (UDP_MAX_SEGMENTS).  This was 64 until Linux 6.9 raised it to
+ * 128; the larger value is safe with older kernels, too, it just
+ * allocates more #Datagram entries than they will ever fill.
+ */
+static constexpr size_t MAX_GRO_SEGMENTS = 128;
+
+/**
+ * Use huge pages for buffers which are big enough to fill at least
+ * one; the whole buffer is touched by recvmmsg() sooner or later,
+ * so rounding up wastes little.
+ */
+static constexpr unsigned
+LargeBufferFlags(size_t size) noexcept
+{
+	return size >= HUGE_PAGE_SIZE
+		? LargeAllocation::TRANSPARENT_HUGE|LargeAllocation::LOCAL_NODE
+		: LargeAllocation::LOCAL_NODE;
+}
 
 MultiReceiveMessage::MultiReceiveMessage(size_t _allocated_datagrams,
 					 size_t _max_payload_size,
 					 size_t _max_cmsg_size,
-					 size_t _max_fds)
+					 size_t _max_fds,
+					 size_t _retain_slots)
 	:allocated_datagrams(_allocated_datagrams),
 	 max_payload_size(_max_payload_size), max_cmsg_size(_max_cmsg_size),
 	 max_fds(_max_fds),
-	 buffer(allocated_datagrams * (max_payload_size + max_cmsg_size
-				       + sizeof(struct mmsghdr)
-				       + sizeof(struct sockaddr_storage)
-				       + sizeof(struct iovec))),
+	 n_slots(allocated_datagrams + _retain_slots),
+	 max_datagrams(_allocated_datagrams),
+	 buffer(n_slots * (max_payload_size + max_cmsg_size
+			   + sizeof(struct sockaddr_storage))
+		+ allocated_datagrams * (sizeof(struct mmsghdr)
+					 + sizeof(struct iovec)),
+		LargeBufferFlags(n_slots * max_payload_size)),
 	 fds(max_fds > 0
-	     ? new UniqueFileDescriptor[allocated_datagrams * max_fds]
+	     ? new UniqueFileDescriptor[n_slots * max_fds]
 	     : nullptr),
+	 retain(new RetainState(n_slots)),
+	 message_slots(new size_t[allocated_datagrams]),
 	 datagrams(new Datagram[allocated_datagrams])
+{
+}
+
+struct sockaddr_storage *
+MultiReceiveMessage::GetSlotAddress(size_t slot) noexcept
 {
 	auto *m = GetMmsg();
 	auto *v = (struct iovec *)(m + allocated_datagrams);
 	auto *a = (struct sockaddr_storage *)(v + allocated_datagrams);
+	return a + slot;
+}
 
-	/* initialize attributes which will not be modified by
-	   recvmmsg() */
-	for (size_t i = 0; i < allocated_datagrams; ++i) {
-		v[i] = {GetPayload(i), max_payload_size};
+void
+MultiReceiveMessage::CloseSlotFds(size_t slot) noexcept
+{
+	if (max_fds == 0)
+		return;
 
-		m[i].msg_hdr = {
-			.msg_name = (struct sockaddr *)&a[i],
-			.msg_namelen = sizeof(struct sockaddr_storage),
-			.msg_iov = &v[i],
-			.msg_iovlen = 1,
-			.msg_control = max_cmsg_size > 0 ? GetCmsg(i) : nullptr,
-			.msg_controllen = max_cmsg_size,
-			.msg_flags = 0,
-		};
+	auto *f = GetSlotFds(slot);
+	for (size_t i = 0; i < max_fds; ++i)
+		if (f[i].IsDefined())
+			f[i].Close();
+}
+
+size_t
+MultiReceiveMessage::FindFreeSlot() noexcept
+{
+	if (n_slots == allocated_datagrams) {
+		/* no retain slots: fixed mapping */
+		assert(next_slot < n_slots);
+		return next_slot++;
+	}
+
+	while (true) {
+		const size_t slot = next_slot;
+		next_slot = (next_slot + 1) % n_slots;
+
+		/* there are at least #allocated_datagrams free
+		   slots, because Retain() refuses to retain more
+		   than the spare ones */
+		if (retain->refs[slot].load(std::memory_order_acquire) == 0) {
+			/* close leftover file descriptors of a
+			   previously retained datagram */
+			CloseSlotFds(slot);
+			return slot;
+		}
+	}
+}
+
+void
+MultiReceiveMessage::EnableGro(SocketDescriptor s)
+{
+	assert(max_cmsg_size >= CMSG_SPACE(sizeof(int)));
+
+	if (!s.SetBoolOption(SOL_UDP, UDP_GRO, true))
+		throw MakeErrno("Failed to set UDP_GRO");
+
+	if (!gro) {
+		datagrams.reset(new Datagram[allocated_datagrams * MAX_GRO_SEGMENTS]);
+		max_datagrams = allocated_datagrams * MAX_GRO_SEGMENTS;
+		gro = true;
 	}
 }
 
@@ -79,6 +160,26 @@ MultiReceiveMessage::Receive(SocketDescriptor s)
 	Clear();
 
 	auto *m = GetMmsg();
+	auto *v = (struct iovec *)(m + allocated_datagrams);
+
+	if (n_slots == allocated_datagrams)
+		next_slot = 0;
+
+	for (size_t i = 0; i < allocated_datagrams; ++i) {
+		const size_t slot = message_slots[i] = FindFreeSlot();
+
+		v[i] = {GetPayload(slot), max_payload_size};
+
+		m[i].msg_hdr = {
+			.msg_name = GetSlotAddress(slot),
+			.msg_namelen = sizeof(struct sockaddr_storage),
+			.msg_iov = &v[i],
+			.msg_iovlen = 1,
+			.msg_control = max_cmsg_size > 0 ? GetCmsg(slot) : nullptr,
+			.msg_controllen = max_cmsg_size,
+			.msg_flags = 0,
+		};
+	}
 
 	int flags = MSG_WAITFORONE;
 #ifdef MSG_CMSG_CLOEXEC
@@ -98,17 +199,20 @@ MultiReceiveMessage::Receive(SocketDescriptor s)
 		throw MakeErrno("recvmmsg() failed");
 	}
 
-	n_datagrams = result;
+	n_messages = result;
 
-	for (size_t i = 0; i < n_datagrams; ++i) {
+	for (size_t i = 0; i < n_messages; ++i) {
 		auto &mh = m[i].msg_hdr;
-		auto &d = datagrams[i];
+		const size_t slot = message_slots[i];
+		auto &d = datagrams[n_datagrams++];
+		size_t gso_size = 0;
 		d.address = SocketAddress((const struct sockaddr *)mh.msg_name,
 					  mh.msg_namelen);
-		d.payload = {GetPayload(i), m[i].msg_len};
+		d.payload = {GetPayload(slot), m[i].msg_len};
 		d.cred = nullptr;
-		d.fds.data = &fds[n_fds];
+		d.fds.data = max_fds > 0 ? GetSlotFds(slot) : nullptr;
 		d.fds.size = 0;
+		d.slot = slot;
 
 #ifdef __clang__
 #pragma GCC diagnostic push
@@ -120,6 +224,9 @@ MultiReceiveMessage::Receive(SocketDescriptor s)
 			if (cmsg->cmsg_level == SOL_SOCKET &&
 			    cmsg->cmsg_type == SCM_CREDENTIALS) {
 				d.cred = (const struct ucred *)CMSG_DATA(cmsg);
+			} else if (cmsg->cmsg_level == SOL_UDP &&
+				   cmsg->cmsg_type == UDP_GRO) {
+				gso_size = *(const int *)CMSG_DATA(cmsg);
 			} else if (cmsg->cmsg_level == SOL_SOCKET &&
 				   cmsg->cmsg_type == SCM_RIGHTS) {
 				const int *f = (const int *)CMSG_DATA(cmsg);
@@ -127,10 +234,9 @@ MultiReceiveMessage::Receive(SocketDescriptor s)
 
 				for (unsigned ii = 0; ii < nn; ++ii) {
 					FileDescriptor fd(f[ii]);
-					if (d.fds.size < max_fds) {
-						fds[n_fds++] = UniqueFileDescriptor(fd);
-						++d.fds.size;
-					} else
+					if (d.fds.size < max_fds)
+						d.fds.data[d.fds.size++] = UniqueFileDescriptor(fd);
+					else
 						fd.Close();
 				}
 			}
@@ -139,6 +245,33 @@ MultiReceiveMessage::Receive(SocketDescriptor s)
 #ifdef __clang__
 #pragma GCC diagnostic pop
 #endif
+
+		if (gso_size > 0 && d.payload.size > gso_size) {
+			/* split the coalesced buffer into its
+			   segments */
+			const Datagram first = d;
+			auto *p = (uint8_t *)first.payload.data;
+			size_t remaining = first.payload.size;
+
+			d.payload.size = gso_size;
+			p += gso_size;
+			remaining -= gso_size;
+
+			while (remaining > 0 && n_datagrams < max_datagrams) {
+				const size_t size = std::min(remaining,
+							     gso_size);
+
+				auto &segment = datagrams[n_datagrams++];
+				segment.address = first.address;
+				segment.payload = {p, size};
+				segment.cred = first.cred;
+				segment.fds = nullptr;
+				segment.slot = slot;
+
+				p += size;
+				remaining -= size;
+			}
+		}
 	}
 
 	return true;
@@ -147,15 +280,51 @@ MultiReceiveMessage::Receive(SocketDescriptor s)
 void
 MultiReceiveMessage::Clear()
 {
-	/* reinitialize attributes which are modified by recvmmsg */
-	auto *m = GetMmsg();
-	for (size_t i = 0; i < n_datagrams; ++i) {
-		m[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
-		m[i].msg_hdr.msg_controllen = max_cmsg_size;
+	/* close the file descriptors of all slots which have not
+	   been retained */
+	for (size_t i = 0; i < n_messages; ++i) {
+		const size_t slot = message_slots[i];
+		if (retain->refs[slot].load(std::memory_order_acquire) == 0)
+			CloseSlotFds(slot);
+	}
+
+	n_messages = n_datagrams = 0;
+}
+
+MultiReceiveMessage::RetainedDatagram
+MultiReceiveMessage::Retain(const Datagram &d) noexcept
+{
+	auto &state = *retain;
+	auto &refs = state.refs[d.slot];
+
+	if (refs.fetch_add(1, std::memory_order_acq_rel) == 0) {
+		/* this slot is now being retained; only this thread
+		   increments #n_retained, therefore this check is not
+		   racy */
+		if (state.n_retained.load(std::memory_order_relaxed) >=
+		    n_slots - allocated_datagrams) {
+			/* all spare slots are occupied */
+			refs.fetch_sub(1, std::memory_order_release);
+			return {};
+		}
+
+		state.n_retained.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	n_datagrams = 0;
+	return {state, d};
+}
+
+void
+MultiReceiveMessage::RetainedDatagram::reset() noexcept
+{
+	if (state == nullptr)
+		return;
+
+	if (state->refs[slot].fetch_sub(1, std::memory_order_acq_rel) == 1)
+		/* decrement this after the slot has become free, so
+		   Retain() never sees fewer than
+		   #allocated_datagrams free slots */
+		state->n_retained.fetch_sub(1, std::memory_order_release);
 
-	while (n_fds > 0)
-		fds[--n_fds].Close();
+	state = nullptr;
 }
@@ -38,7 +38,9 @@
 #include "util/OffsetPointer.hxx"
 #include "util/WritableBuffer.hxx"
 
+#include <atomic>
 #include <memory>
+#include <utility>
 
 class SocketDescriptor;
 
@@ -46,16 +48,82 @@ class SocketDescriptor;
  * This class helps to receive many network datagrams from a socket
  * efficiently.  To do that, it allocates and manages buffers to be
  * used by recvmmsg().
+ *
+ * The buffer is split into slots, one per datagram.  If "retain"
+ * slots were allocated, the handler may keep a datagram beyond the
+ * next Receive() call with Retain(), without copying it.
  */
 class MultiReceiveMessage {
 	const size_t allocated_datagrams;
 	const size_t max_payload_size, max_cmsg_size, max_fds;
+
+	/**
+	 * The total number of slots; this is #allocated_datagrams
+	 * plus the number of slots which may be retained.
+	 */
+	const size_t n_slots;
+
+	/**
+	 * The number of messages filled by the last recvmmsg() call.
+	 */
+	size_t n_messages = 0;
+
+	/**
+	 * The number of #Datagram instances; this is larger than
+	 * #n_messages if UDP_GRO has coalesced datagrams.
+	 */
 	size_t n_datagrams = 0;
 
+	/**
+	 * The capacity of #datagrams.
+	 */
+	size_t max_datagrams;
+
+	/**
+	 * The slot where the search for free slots begins in the next
+	 * Receive() call.
+	 */
+	size_t next_slot = 0;
+
+	/**
+	 * Has EnableGro() been called?
+	 */
+	bool gro = false;
+
 	LargeAllocation buffer;
 
+	/**
+	 * File descriptors received with SCM_RIGHTS; #max_fds per
+	 * slot.
+	 */
 	std::unique_ptr<UniqueFileDescriptor[]> fds;
-	size_t n_fds = 0;
+
+	struct RetainState {
+		/**
+		 * The number of RetainedDatagram references per
+		 * slot.
+		 */
+		const std::unique_ptr<std::atomic_uint[]> refs;
+
+		/**
+		 * The number of slots with a non-zero reference
+		 * counter.
+		 */
+		std::atomic_size_t n_retained{0};
+
+		explicit RetainState(size_t _n_slots)
+			:refs(new std::atomic_uint[_n_slots]) {
+			for (size_t i = 0; i < _n_slots; ++i)
+				refs[i].store(0, std::memory_order_relaxed);
+		}
+	};
+
+	std::unique_ptr<RetainState> retain;
+
+	/**
+	 * The slot of each message passed to recvmmsg().
+	 */
+	std::unique_ptr<size_t[]> message_slots;
 
 public:
 	struct Datagram {
@@ -64,32 +132,108 @@ public:
 		const struct ucred *cred;
 		WritableBuffer<UniqueFileDescriptor> fds;
 
-		/*
-		constexpr Datagram(SocketAddress _address,
-				   WritableBuffer<void> _payload,
-				   const struct ucred *_cred,
-				   WritableBuffer<UniqueFileDescriptor> _fds)
-			:address(_address), payload(_payload),
-			 cred(_cred), fds(_fds) {}
-		*/
+		/**
+		 * The buffer slot containing this datagram (for
+		 * internal use).
+		 */
+		size_t slot;
 	};
 
 	typedef Datagram *iterator;
 
+	/**
+	 * A datagram which has been retained with Retain().  It keeps
+	 * its buffer slot out of circulation until this object is
+	 * destructed or reset().  This may happen in any thread, but
+	 * the #MultiReceiveMessage must outlive it.
+	 *
+	 * File descriptors which have not been moved out of #fds are
+	 * closed by the #MultiReceiveMessage before the slot is
+	 * reused.
+	 */
+	class RetainedDatagram {
+		RetainState *state = nullptr;
+		size_t slot;
+
+	public:
+		SocketAddress address;
+		WritableBuffer<void> payload = nullptr;
+		const struct ucred *cred = nullptr;
+		WritableBuffer<UniqueFileDescriptor> fds = nullptr;
+
+		RetainedDatagram() = default;
+
+		RetainedDatagram(RetainState &_state,
+				 const Datagram &d) noexcept
+			:state(&_state), slot(d.slot),
+			 address(d.address), payload(d.payload),
+			 cred(d.cred), fds(d.fds) {}
+
+		RetainedDatagram(RetainedDatagram &&src) noexcept
+			:state(std::exchange(src.state, nullptr)),
+			 slot(src.slot),
+			 address(src.address), payload(src.payload),
+			 cred(src.cred), fds(src.fds) {}
+
+		~RetainedDatagram() noexcept {
+			reset();
+		}
+
+		RetainedDatagram &operator=(RetainedDatagram &&src) noexcept {
+			using std::swap;
+			swap(state, src.state);
+			swap(slot, src.slot);
+			swap(address, src.address);
+			swap(payload, src.payload);
+			swap(cred, src.cred);
+			swap(fds, src.fds);
+			return *this;
+		}
+
+		operator bool() const noexcept {
+			return state != nullptr;
+		}
+
+		/**
+		 * Release the buffer slot.
+		 */
+		void reset() noexcept;
+	};
+
 private:
 	std::unique_ptr<Datagram[]> datagrams;
 
 public:
+	/**
+	 * @param _retain_slots the number of additional buffer slots
+	 * which may be occupied by retained datagrams (see Retain())
+	 */
 	MultiReceiveMessage(size_t _allocated_datagrams,
 			    size_t _max_payload_size,
 			    size_t _max_cmsg_size=0,
-			    size_t _max_fds=0);
+			    size_t _max_fds=0,
+			    size_t _retain_slots=0);
 
 	MultiReceiveMessage(MultiReceiveMessage &&) noexcept = default;
 	MultiReceiveMessage &operator=(MultiReceiveMessage &&) noexcept = default;
 
 	/**
-	 * Receive new datagrams.  Any previous ones will be discarded.
+	 * Enable UDP_GRO on the given socket, allowing the kernel to
+	 * coalesce many datagrams from the same peer into one large
+	 * buffer; Receive() splits them again.  This requires a
+	 * large (up to 64 kB) "max_payload_size" and enough
+	 * "max_cmsg_size" for the UDP_GRO control message.  All
+	 * segments of a coalesced buffer refer to the same peer
+	 * address and credentials; file descriptors are attached to
+	 * the first segment only.
+	 *
+	 * Throws on error.
+	 */
+	void EnableGro(SocketDescriptor s);
+
+	/**
+	 * Receive new datagrams.  Any previous ones will be discarded
+	 * (unless retained).
 	 *
 	 * Throws on error.
 	 *
@@ -100,10 +244,27 @@ public:
 	/**
 	 * Discard all datagrams.  This should be called after
 	 * processing with begin() and end() has finished to free
-	 * resources such as file descriptors.
+	 * resources such as file descriptors.  Retained datagrams
+	 * are not affected.
 	 */
 	void Clear();
 
+	/**
+	 * Keep the given datagram (obtained from begin() and end())
+	 * beyond the next Clear() call without copying it.  Its
+	 * buffer slot is returned when the #RetainedDatagram is
+	 * released.
+	 *
+	 * @return the retained datagram, or an empty instance if all
+	 * retain slots are occupied (the caller must copy the
+	 * datagram then)
+	 */
+	RetainedDatagram Retain(const Datagram &d) noexcept;
+
+	bool empty() const noexcept {
+		return n_datagrams == 0;
+	}
+
 	iterator begin() {
 		return datagrams.get();
 	}
@@ -117,16 +278,29 @@ private:
 		return OffsetPointer(buffer.get(), offset);
 	}
 
-	void *GetPayload(size_t i) noexcept {
-		return At(i * max_payload_size);
+	void *GetPayload(size_t slot) noexcept {
+		return At(slot * max_payload_size);
 	}
 
-	void *GetCmsg(size_t i) noexcept {
-		return OffsetPointer(GetPayload(allocated_datagrams),
-				     i * max_cmsg_size);
+	void *GetCmsg(size_t slot) noexcept {
+		return OffsetPointer(GetPayload(n_slots),
+				     slot * max_cmsg_size);
 	}
 
+	struct sockaddr_storage *GetSlotAddress(size_t slot) noexcept;
+
 	struct mmsghdr *GetMmsg() noexcept {
-		return (struct mmsghdr *)GetCmsg(allocated_datagrams);
+		return (struct mmsghdr *)GetCmsg(n_slots);
+	}
+
+	UniqueFileDescriptor *GetSlotFds(size_t slot) noexcept {
+		return &fds[slot * max_fds];
 	}
+
+	void CloseSlotFds(size_t slot) noexcept;
+
+	/**
+	 * Find the next slot which is not retained.
+	 */
+	size_t FindFreeSlot() noexcept;
 };
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MultiSendMessage.hxx"
+#include "SocketDescriptor.hxx"
+#include "SocketAddress.hxx"
+#include "util/Compiler.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+/**
+ * The maximum number of segments the kernel accepts in one
+ * UDP_SEGMENT message (UDP_MAX_SEGMENTS).  Linux 6.9 raised the
+ * limit to 128, but older kernels reject more than 64 segments
+ * with EINVAL.
+ */
+static constexpr unsigned MAX_SEGMENTS = 64;
+
+/**
+ * The maximum size of one UDP_SEGMENT message.
+ */
+static constexpr size_t MAX_GSO_SIZE = 65000;
+
+static constexpr size_t CMSG_SIZE = CMSG_SPACE(sizeof(uint16_t));
+
+static constexpr size_t
+AlignUp(size_t size) noexcept
+{
+	return (size + 15) & ~size_t(15);
+}
+
+MultiSendMessage::MultiSendMessage(size_t _max_datagrams,
+				   size_t _max_payload_size)
+	:max_datagrams(_max_datagrams), max_payload_size(_max_payload_size),
+	 buffer(AlignUp(max_datagrams * max_payload_size) +
+		max_datagrams * (CMSG_SIZE
+				 + sizeof(struct mmsghdr)
+				 + sizeof(struct iovec)
+				 + sizeof(struct sockaddr_storage)))
+{
+}
+
+void *
+MultiSendMessage::GetCmsg(size_t i) const noexcept
+{
+	return GetPayload(AlignUp(max_datagrams * max_payload_size) +
+			  i * CMSG_SIZE);
+}
+
+struct mmsghdr *
+MultiSendMessage::GetMmsg() const noexcept
+{
+	return (struct mmsghdr *)GetCmsg(max_datagrams);
+}
+
+bool
+MultiSendMessage::Push(SocketAddress address,
+		       ConstBuffer<void> payload) noexcept
+{
+	assert(address.GetSize() <= sizeof(struct sockaddr_storage));
+
+	if (full() || payload.size > max_payload_size)
+		return false;
+
+	auto *m = GetMmsg();
+	auto *v = (struct iovec *)(m + max_datagrams);
+	auto *a = (struct sockaddr_storage *)(v + max_datagrams);
+
+	void *p = GetPayload(fill);
+	memcpy(p, payload.data, payload.size);
+	fill += payload.size;
+	++n_datagrams;
+
+	if (gso && n_messages > 0 && !segments_closed &&
+	    payload.size > 0 && payload.size <= segment_size &&
+	    n_segments < MAX_SEGMENTS &&
+	    v[n_messages - 1].iov_len + payload.size <= MAX_GSO_SIZE &&
+	    address == SocketAddress((const struct sockaddr *)&a[n_messages - 1],
+				     m[n_messages - 1].msg_hdr.msg_namelen)) {
+		/* append to the previous message; the payload is
+		   already contiguous */
+		auto &mh = m[n_messages - 1].msg_hdr;
+		v[n_messages - 1].iov_len += payload.size;
+
+		if (++n_segments == 2) {
+			const uint16_t value = segment_size;
+
+			mh.msg_control = GetCmsg(n_messages - 1);
+			mh.msg_controllen = CMSG_SIZE;
+
+			auto *cmsg = CMSG_FIRSTHDR(&mh);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(value));
+			memcpy(CMSG_DATA(cmsg), &value, sizeof(value));
+		}
+
+		if (payload.size < segment_size)
+			segments_closed = true;
+
+		return true;
+	}
+
+	const size_t i = n_messages++;
+	memcpy(&a[i], address.GetAddress(), address.GetSize());
+	v[i] = {p, payload.size};
+	m[i].msg_hdr = {
+		.msg_name = &a[i],
+		.msg_namelen = address.GetSize(),
+		.msg_iov = &v[i],
+		.msg_iovlen = 1,
+		.msg_control = nullptr,
+		.msg_controllen = 0,
+		.msg_flags = 0,
+	};
+	m[i].msg_len = 0;
+
+	segment_size = payload.size;
+	n_segments = 1;
+	segments_closed = false;
+
+	return true;
+}
+
+/**
+ * How many datagrams does this message contain?  It may have been
+ * merged with UDP_SEGMENT.
+ */
+gcc_pure
+static size_t
+CountDatagrams(const struct msghdr &mh) noexcept
+{
+	const size_t size = mh.msg_iov[0].iov_len;
+	if (mh.msg_controllen == 0 || size == 0)
+		return 1;
+
+	uint16_t segment_size;
+	memcpy(&segment_size, CMSG_DATA(CMSG_FIRSTHDR(&mh)),
+	       sizeof(segment_size));
+	return (size + segment_size - 1) / segment_size;
+}
+
+size_t
+MultiSendMessage::Flush(SocketDescriptor s) noexcept
+{
+	auto *m = GetMmsg();
+	size_t i = 0, n_dropped = 0;
+
+	while (i < n_messages) {
+		int result = sendmmsg(s.Get(), m + i, n_messages - i,
+				      MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (result < 0) {
+			const int e = errno;
+			if (e == EINTR)
+				continue;
+
+			if (e == EAGAIN || e == ENOBUFS)
+				/* the socket buffer is full; give up */
+				break;
+
+			/* this message has failed (e.g. because its
+			   destination is unreachable); skip it, but
+			   send the others */
+			n_dropped += CountDatagrams(m[i].msg_hdr);
+			++i;
+			continue;
+		}
+
+		if (result == 0)
+			break;
+
+		i += result;
+	}
+
+	for (; i < n_messages; ++i)
+		n_dropped += CountDatagrams(m[i].msg_hdr);
+
+	Clear();
+	return n_dropped;
+}
+
+void
+MultiSendMessage::Clear() noexcept
+{
+	fill = 0;
+	n_messages = n_datagrams = 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "system/LargeAllocation.hxx"
+#include "util/OffsetPointer.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <stddef.h>
+
+class SocketAddress;
+class SocketDescriptor;
+
+/**
+ * This class helps to send many network datagrams to a socket
+ * efficiently: datagrams are copied into a buffer by Push(), and
+ * Flush() sends all of them with one sendmmsg() call.  It is the
+ * counterpart of #MultiReceiveMessage.
+ */
+class MultiSendMessage {
+	const size_t max_datagrams, max_payload_size;
+
+	LargeAllocation buffer;
+
+	/**
+	 * The number of bytes used in the payload area.
+	 */
+	size_t fill = 0;
+
+	/**
+	 * The number of messages (struct mmsghdr).  With UDP_SEGMENT,
+	 * one message may contain several datagrams.
+	 */
+	size_t n_messages = 0;
+
+	/**
+	 * The number of datagrams queued by Push().
+	 */
+	size_t n_datagrams = 0;
+
+	/**
+	 * The segment size of the last message (i.e. the size of
+	 * its first datagram).
+	 */
+	size_t segment_size;
+
+	/**
+	 * The number of segments in the last message.
+	 */
+	unsigned n_segments;
+
+	/**
+	 * Can no more segments be appended to the last message?
+	 * This is set after a segment smaller than #segment_size
+	 * has been appended.
+	 */
+	bool segments_closed;
+
+	/**
+	 * Merge consecutive datagrams to the same destination into
+	 * one message with UDP_SEGMENT?
+	 */
+	bool gso = false;
+
+public:
+	MultiSendMessage(size_t _max_datagrams, size_t _max_payload_size);
+
+	MultiSendMessage(MultiSendMessage &&) noexcept = default;
+
+	/**
+	 * Merge consecutive datagrams of the same size addressed to
+	 * the same destination into one message, letting the kernel
+	 * split it (UDP_SEGMENT, Linux 4.18).  This is only
+	 * applicable to UDP sockets.
+	 */
+	void EnableGso() noexcept {
+		gso = true;
+	}
+
+	bool empty() const noexcept {
+		return n_datagrams == 0;
+	}
+
+	bool full() const noexcept {
+		return n_datagrams >= max_datagrams;
+	}
+
+	size_t size() const noexcept {
+		return n_datagrams;
+	}
+
+	/**
+	 * Queue a copy of the given datagram.
+	 *
+	 * @return false if the buffer is full (call Flush() and try
+	 * again) or if the payload is too large
+	 */
+	bool Push(SocketAddress address, ConstBuffer<void> payload) noexcept;
+
+	/**
+	 * Send all queued datagrams and clear the buffer.  Datagrams
+	 * which could not be sent are discarded: a message which
+	 * fails (e.g. because its destination is unreachable) is
+	 * skipped, and the remaining ones are still sent; if the
+	 * socket buffer is full, all remaining ones are discarded.
+	 *
+	 * @return the number of discarded datagrams
+	 */
+	size_t Flush(SocketDescriptor s) noexcept;
+
+	/**
+	 * Discard all queued datagrams.
+	 */
+	void Clear() noexcept;
+
+private:
+	void *GetPayload(size_t offset) const noexcept {
+		return OffsetPointer(buffer.get(), offset);
+	}
+
+	void *GetCmsg(size_t i) const noexcept;
+
+	struct mmsghdr *GetMmsg() const noexcept;
+};
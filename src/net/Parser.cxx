@@ -34,10 +34,202 @@
 #include "AddressInfo.hxx"
 #include "Resolver.hxx"
 #include "AllocatedSocketAddress.hxx"
+#include "StaticSocketAddress.hxx"
+#include "IPv4Address.hxx"
+#include "IPv6Address.hxx"
+#include "util/HexParse.hxx"
 
+#include <algorithm>
 #include <stdexcept>
 
 #include <netdb.h>
+#include <string.h>
+
+/**
+ * Parse four decimal octets separated by dots.  Leading zeroes are
+ * rejected because inet_aton() would interpret them as octal.
+ *
+ * @return a pointer to the first character after the address or
+ * nullptr on error
+ */
+static const char *
+ParseIPv4Octets(const char *p, uint8_t *dest) noexcept
+{
+	for (unsigned i = 0; i < 4; ++i) {
+		if (i > 0) {
+			if (*p != '.')
+				return nullptr;
+			++p;
+		}
+
+		if (!IsDigitASCII(*p) || (*p == '0' && IsDigitASCII(p[1])))
+			return nullptr;
+
+		unsigned value = 0;
+		do {
+			value = value * 10 + unsigned(*p++ - '0');
+			if (value > 255)
+				return nullptr;
+		} while (IsDigitASCII(*p));
+
+		dest[i] = uint8_t(value);
+	}
+
+	return p;
+}
+
+static const char *
+ParseIPv6(const char *p, struct in6_addr &dest) noexcept
+{
+	unsigned words[8];
+	unsigned n = 0;
+
+	/* the position of "::" within #words; -1 if there is none */
+	int gap = -1;
+
+	if (*p == ':') {
+		if (p[1] != ':')
+			return nullptr;
+
+		gap = 0;
+		p += 2;
+	}
+
+	while (ParseHexDigit(*p) >= 0) {
+		const char *const start = p;
+
+		unsigned value = 0, n_digits = 0;
+		do {
+			if (++n_digits > 4)
+				return nullptr;
+			value = (value << 4) | unsigned(ParseHexDigit(*p++));
+		} while (ParseHexDigit(*p) >= 0);
+
+		if (*p == '.') {
+			/* trailing IPv4 address */
+			if (n > 6)
+				return nullptr;
+
+			uint8_t octets[4];
+			p = ParseIPv4Octets(start, octets);
+			if (p == nullptr)
+				return nullptr;
+
+			words[n++] = (octets[0] << 8) | octets[1];
+			words[n++] = (octets[2] << 8) | octets[3];
+			break;
+		}
+
+		if (n >= 8)
+			return nullptr;
+
+		words[n++] = value;
+
+		if (*p != ':')
+			break;
+
+		if (p[1] == ':') {
+			if (gap >= 0)
+				/* only one "::" allowed */
+				return nullptr;
+
+			gap = n;
+			p += 2;
+		} else {
+			++p;
+			if (ParseHexDigit(*p) < 0)
+				return nullptr;
+		}
+	}
+
+	if (gap < 0) {
+		if (n != 8)
+			return nullptr;
+	} else {
+		if (n >= 8)
+			return nullptr;
+
+		/* move the words after "::" to the end and fill the
+		   gap with zeroes */
+		const unsigned tail = n - gap;
+		std::copy_backward(words + gap, words + n, words + 8);
+		std::fill_n(words + gap, 8 - tail - gap, 0u);
+	}
+
+	auto *b = (uint8_t *)&dest;
+	for (unsigned i = 0; i < 8; ++i) {
+		b[i * 2] = uint8_t(words[i] >> 8);
+		b[i * 2 + 1] = uint8_t(words[i]);
+	}
+
+	return p;
+}
+
+/**
+ * Parse a decimal port number which must be followed by the null
+ * terminator.
+ */
+static bool
+ParsePort(const char *p, unsigned &port) noexcept
+{
+	if (!IsDigitASCII(*p))
+		return false;
+
+	unsigned value = 0;
+	do {
+		value = value * 10 + unsigned(*p++ - '0');
+		if (value > 0xffff)
+			return false;
+	} while (IsDigitASCII(*p));
+
+	if (*p != 0)
+		return false;
+
+	port = value;
+	return true;
+}
+
+bool
+ParseNumericAddress(StaticSocketAddress &dest, const char *p,
+		    unsigned port) noexcept
+{
+	struct in6_addr a6;
+
+	if (*p == '[') {
+		p = ParseIPv6(p + 1, a6);
+		if (p == nullptr || *p != ']')
+			return false;
+
+		++p;
+		if (*p == ':') {
+			if (!ParsePort(p + 1, port))
+				return false;
+		} else if (*p != 0)
+			return false;
+
+		dest = IPv6Address(a6, port);
+		return true;
+	}
+
+	uint8_t octets[4];
+	const char *end = ParseIPv4Octets(p, octets);
+	if (end != nullptr && (*end == 0 || *end == ':')) {
+		if (*end == ':' && !ParsePort(end + 1, port))
+			return false;
+
+		struct in_addr a4;
+		memcpy(&a4, octets, sizeof(a4));
+		dest = IPv4Address(a4, port);
+		return true;
+	}
+
+	end = ParseIPv6(p, a6);
+	if (end == nullptr || *end != 0)
+		return false;
+
+	dest = IPv6Address(a6, port);
+	return true;
+}
 
 AllocatedSocketAddress
 ParseSocketAddress(const char *p, int default_port, bool passive)
@@ -61,6 +253,12 @@ ParseSocketAddress(const char *p, int default_port, bool passive)
 #endif
 	}
 
+	if (default_port >= 0) {
+		StaticSocketAddress address;
+		if (ParseNumericAddress(address, p, default_port))
+			return AllocatedSocketAddress(address);
+	}
+
 	static constexpr struct addrinfo hints = {
 		.ai_flags = AI_NUMERICHOST|AI_ADDRCONFIG,
 		.ai_family = AF_UNSPEC,
@@ -34,6 +34,20 @@
 #define NET_PARSER_HXX
 
 class AllocatedSocketAddress;
+class StaticSocketAddress;
+
+/**
+ * Parse a numeric IPv4 or IPv6 address with an optional port number
+ * ("1.2.3.4", "1.2.3.4:80", "::1", "[::1]:80") without involving the
+ * libc resolver.  Interface names ("fe80::1%eth0"), service names
+ * and the legacy inet_aton() notations are not supported; callers
+ * may fall back to getaddrinfo() for those.
+ *
+ * @return true on success, false if the string was not recognized
+ */
+bool
+ParseNumericAddress(StaticSocketAddress &dest, const char *p,
+		    unsigned default_port) noexcept;
 
 /**
  * Parse a numeric socket address or a local socket address (absolute
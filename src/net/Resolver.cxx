@@ -36,6 +36,11 @@
 #include "util/RuntimeError.hxx"
 #include "util/CharUtil.hxx"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+
 #include <sys/socket.h>
 #include <netdb.h>
 #include <net/if.h>
@@ -130,3 +135,55 @@ Resolve(const char *host_and_port, int default_port,
 
 	return AddressInfoList(ai);
 }
+
+std::vector<AddressInfoList>
+ResolveBatch(ConstBuffer<const char *> hosts, int default_port,
+	     const struct addrinfo *hints, unsigned max_threads)
+{
+	std::vector<AddressInfoList> results(hosts.size);
+	std::vector<std::exception_ptr> errors(hosts.size);
+
+	std::atomic_size_t next(0);
+
+	auto worker = [&](){
+		size_t i;
+		while ((i = next.fetch_add(1, std::memory_order_relaxed)) < hosts.size) {
+			try {
+				results[i] = Resolve(hosts[i], default_port,
+						     hints);
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
+		}
+	};
+
+	const size_t n_threads = std::min<size_t>(std::max(max_threads, 1u),
+						  hosts.size);
+
+	if (n_threads <= 1) {
+		worker();
+	} else {
+		/* the calling thread is one of the workers */
+		std::vector<std::thread> threads;
+		threads.reserve(n_threads - 1);
+
+		try {
+			for (size_t i = 1; i < n_threads; ++i)
+				threads.emplace_back(worker);
+		} catch (...) {
+			/* failed to create a thread; continue with
+			   the ones we have */
+		}
+
+		worker();
+
+		for (auto &t : threads)
+			t.join();
+	}
+
+	for (const auto &e : errors)
+		if (e)
+			std::rethrow_exception(e);
+
+	return results;
+}
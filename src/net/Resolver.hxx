@@ -33,6 +33,10 @@
 #ifndef NET_RESOLVER_HXX
 #define NET_RESOLVER_HXX
 
+#include "util/ConstBuffer.hxx"
+
+#include <vector>
+
 struct addrinfo;
 class AddressInfoList;
 
@@ -49,4 +53,19 @@ AddressInfoList
 Resolve(const char *host_and_port, int default_port,
 	const struct addrinfo *hints);
 
+/**
+ * Resolve many host names concurrently (each with Resolve()) on a
+ * small pool of threads.  Code running in an #EventLoop should use
+ * Cares::Channel::LookupBatch() instead.
+ *
+ * Throws on error (the error of the first failed host in the
+ * given order), after all lookups have finished.
+ *
+ * @param max_threads the maximum number of threads
+ * @return one #AddressInfoList for each host, in the given order
+ */
+std::vector<AddressInfoList>
+ResolveBatch(ConstBuffer<const char *> hosts, int default_port,
+	     const struct addrinfo *hints, unsigned max_threads=16);
+
 #endif
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ReusePortCpu.hxx"
+
+#include <linux/filter.h>
+
+#include <assert.h>
+#include <stdint.h>
+
+size_t
+MakeReusePortCpuProgram(struct sock_filter *code,
+			const int *cpus, unsigned n) noexcept
+{
+	assert(n > 0);
+
+	size_t length = 0;
+
+	/* A = raw_smp_processor_id() */
+	code[length++] = BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+				  (uint32_t)(SKF_AD_OFF + SKF_AD_CPU));
+
+	if (cpus != nullptr) {
+		for (unsigned i = 0; i < n; ++i) {
+			if (cpus[i] < 0)
+				continue;
+
+			/* if (A == cpus[i]) return i */
+			code[length++] = BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,
+						  (uint32_t)cpus[i], 0, 1);
+			code[length++] = BPF_STMT(BPF_RET|BPF_K, i);
+		}
+	}
+
+	/* A = A % n */
+	code[length++] = BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, n);
+	/* return A */
+	code[length++] = BPF_STMT(BPF_RET|BPF_A, 0);
+
+	assert(length <= ReusePortCpuProgramMaxLength(n));
+	return length;
+}
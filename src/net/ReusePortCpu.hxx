@@ -0,0 +1,68 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+
+struct sock_filter;
+
+/**
+ * The maximum number of instructions generated by
+ * MakeReusePortCpuProgram() for a group of @a n sockets.
+ */
+static constexpr size_t
+ReusePortCpuProgramMaxLength(unsigned n) noexcept
+{
+	/* one comparison and one return per table entry, plus the
+	   load and the "cpu % n" fallback */
+	return 2 * size_t(n) + 3;
+}
+
+/**
+ * Generate the classic BPF program for
+ * SocketDescriptor::SetReusePortCpu().  It returns the index of the
+ * socket in the SO_REUSEPORT group which shall get a connection
+ * handled by the current CPU.
+ *
+ * @param code the destination buffer; it must have room for
+ * ReusePortCpuProgramMaxLength(n) instructions
+ * @param cpus the CPU of each socket (in the order they were bound),
+ * or -1 if it is not pinned to a CPU; nullptr means socket i runs on
+ * CPU i
+ * @param n the number of sockets in the group
+ * @return the number of instructions
+ */
+size_t
+MakeReusePortCpuProgram(struct sock_filter *code,
+			const int *cpus, unsigned n) noexcept;
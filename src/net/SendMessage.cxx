@@ -48,3 +48,14 @@ SendMessage(SocketDescriptor s, const MessageHeader &mh, int flags)
 
 	return (size_t)nbytes;
 }
+
+size_t
+SendMultiMessage(SocketDescriptor s, struct mmsghdr *v, size_t n,
+		 int flags)
+{
+	int result = sendmmsg(s.Get(), v, n, flags);
+	if (result < 0)
+		throw MakeErrno("sendmmsg() failed");
+
+	return (size_t)result;
+}
@@ -67,3 +67,19 @@ public:
  */
 size_t
 SendMessage(SocketDescriptor s, const MessageHeader &mh, int flags);
+
+/**
+ * Wrapper for sendmmsg(): send several messages with one system
+ * call.  The kernel stores the number of bytes sent in each
+ * mmsghdr::msg_len.
+ *
+ * Throws on error, i.e. if not even the first message could be
+ * sent.
+ *
+ * @return the number of messages which were sent; this may be less
+ * than @a n, e.g. if the socket buffer is full (with MSG_DONTWAIT)
+ * or if a later message has failed
+ */
+size_t
+SendMultiMessage(SocketDescriptor s, struct mmsghdr *v, size_t n,
+		 int flags);
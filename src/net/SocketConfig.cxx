@@ -88,7 +88,7 @@ SocketConfig::Create(int type) const
 	    !fd.SetReuseAddress(true))
 		throw MakeErrno("Failed to set SO_REUSEADDR");
 
-	if (reuse_port && !fd.SetReusePort())
+	if ((reuse_port || reuse_port_cpu > 0) && !fd.SetReusePort())
 		throw MakeErrno("Failed to set SO_REUSEPORT");
 
 	if (free_bind && !fd.SetFreeBind())
@@ -106,6 +106,9 @@ SocketConfig::Create(int type) const
 		throw FormatErrno(e, "Failed to bind to %s", address_string);
 	}
 
+	if (reuse_port_cpu > 0 && !fd.SetReusePortCpu(reuse_port_cpu))
+		throw MakeErrno("Failed to attach SO_REUSEPORT program");
+
 	if (!multicast_group.IsNull() &&
 	    !fd.AddMembership(multicast_group)) {
 		const int e = errno;
@@ -120,12 +123,10 @@ SocketConfig::Create(int type) const
 				  address_string);
 	}
 
-	if (is_tcp) {
-		fd.SetTcpFastOpen();
+	tuning.ApplyListener(fd, is_tcp);
 
-		if (tcp_defer_accept > 0)
-			fd.SetTcpDeferAccept(tcp_defer_accept);
-	}
+	if (is_tcp && tcp_defer_accept > 0)
+		fd.SetTcpDeferAccept(tcp_defer_accept);
 
 	if (listen > 0 && !fd.Listen(listen))
 		throw MakeErrno("Failed to listen");
@@ -33,6 +33,7 @@
 #pragma once
 
 #include "AllocatedSocketAddress.hxx"
+#include "SocketTuning.hxx"
 
 #include <string>
 
@@ -61,10 +62,25 @@ struct SocketConfig {
 
 	bool reuse_port = false;
 
+	/**
+	 * If non-zero, attach a SO_REUSEPORT program which steers
+	 * packets/connections to the socket with the index "cpu %
+	 * reuse_port_cpu" in the SO_REUSEPORT group (see
+	 * SocketDescriptor::SetReusePortCpu()).  Implies
+	 * #reuse_port.
+	 */
+	unsigned reuse_port_cpu = 0;
+
 	bool free_bind = false;
 
 	bool pass_cred = false;
 
+	/**
+	 * Performance tuning options; see SocketTuning::FindProfile()
+	 * for named profiles.
+	 */
+	SocketTuning tuning;
+
 	SocketConfig() = default;
 
 	explicit SocketConfig(SocketAddress _bind_address)
@@ -40,6 +40,14 @@
 #include <sys/socket.h>
 #endif
 
+#ifdef __linux__
+#include "ReusePortCpu.hxx"
+
+#include <linux/filter.h>
+#endif
+
+#include <memory>
+
 #include <errno.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -286,6 +294,46 @@ SocketDescriptor::SetTcpFastOpen(int qlen)
 	return SetOption(SOL_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen));
 }
 
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+
+bool
+SocketDescriptor::SetTcpFastOpenConnect(bool value)
+{
+	return SetBoolOption(SOL_TCP, TCP_FASTOPEN_CONNECT, value);
+}
+
+bool
+SocketDescriptor::SetReusePortCpu(unsigned n)
+{
+	return SetReusePortCpu(nullptr, n);
+}
+
+bool
+SocketDescriptor::SetReusePortCpu(const int *cpus, unsigned n)
+{
+	assert(n > 0);
+
+	/* without a table, the program has no per-socket
+	   instructions */
+	const size_t max_length =
+		ReusePortCpuProgramMaxLength(cpus != nullptr ? n : 0);
+	if (max_length > BPF_MAXINSNS) {
+		errno = EINVAL;
+		return false;
+	}
+
+	std::unique_ptr<struct sock_filter[]> code(new struct sock_filter[max_length]);
+
+	struct sock_fprog prog;
+	prog.len = MakeReusePortCpuProgram(code.get(), cpus, n);
+	prog.filter = code.get();
+
+	return SetOption(SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+			 &prog, sizeof(prog));
+}
+
 bool
 SocketDescriptor::AddMembership(const IPv4Address &address)
 {
@@ -182,6 +182,38 @@ public:
 
 	bool SetTcpFastOpen(int qlen=16);
 
+	/**
+	 * Enable TCP Fast Open on an outgoing connection
+	 * (TCP_FASTOPEN_CONNECT, Linux 4.11): connect() returns
+	 * immediately, and the SYN is sent together with the first
+	 * data.  Must be called before connect().
+	 */
+	bool SetTcpFastOpenConnect(bool value=true);
+
+	/**
+	 * Attach a SO_ATTACH_REUSEPORT_CBPF program to the
+	 * SO_REUSEPORT group of this socket which selects the
+	 * socket with the index "cpu % n" (in the order they were
+	 * bound), i.e. the one whose thread runs on the CPU that
+	 * handled the packet.  Must be called after bind().
+	 */
+	bool SetReusePortCpu(unsigned n);
+
+	/**
+	 * Like SetReusePortCpu(unsigned), but look up the socket in a
+	 * table instead of assuming that socket i runs on CPU i.
+	 * Packets handled by CPUs which are not in the table are
+	 * distributed by "cpu % n".
+	 *
+	 * @param cpus the CPU of each socket (in the order they were
+	 * bound), or -1 if it is not pinned to a CPU; if several
+	 * sockets share a CPU, the first one gets all of its
+	 * connections; nullptr is the same as
+	 * SetReusePortCpu(unsigned)
+	 * @param n the number of sockets in the group
+	 */
+	bool SetReusePortCpu(const int *cpus, unsigned n);
+
 	bool AddMembership(const IPv4Address &address);
 	bool AddMembership(const IPv6Address &address);
 	bool AddMembership(SocketAddress address);
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SocketTuning.hxx"
+#include "SocketDescriptor.hxx"
+#include "ZeroCopy.hxx"
+
+#include <stdexcept>
+
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT 25
+#endif
+
+SocketTuning
+SocketTuning::FindProfile(const char *name)
+{
+	if (strcmp(name, "default") == 0)
+		return Default();
+	else if (strcmp(name, "latency") == 0)
+		return LowLatency();
+	else if (strcmp(name, "throughput") == 0)
+		return Throughput();
+	else
+		throw std::runtime_error(std::string("Unknown socket profile: ") + name);
+}
+
+static void
+SetIntOption(SocketDescriptor fd, int level, int name, int value) noexcept
+{
+	fd.SetOption(level, name, &value, sizeof(value));
+}
+
+void
+SocketTuning::ApplyCommon(SocketDescriptor fd, bool is_tcp) const noexcept
+{
+	/* buffer sizes must be set before listen()/connect(),
+	   because they determine the TCP window scale */
+	if (send_buffer > 0)
+		SetIntOption(fd, SOL_SOCKET, SO_SNDBUF, send_buffer);
+
+	if (receive_buffer > 0)
+		SetIntOption(fd, SOL_SOCKET, SO_RCVBUF, receive_buffer);
+
+	if (busy_poll > 0)
+		SetIntOption(fd, SOL_SOCKET, SO_BUSY_POLL, busy_poll);
+
+	if (prefer_busy_poll)
+		fd.SetBoolOption(SOL_SOCKET, SO_PREFER_BUSY_POLL, true);
+
+	if (incoming_cpu >= 0)
+		SetIntOption(fd, SOL_SOCKET, SO_INCOMING_CPU, incoming_cpu);
+
+	if (zerocopy)
+		ZeroCopyTracker::Enable(fd);
+
+	if (is_tcp) {
+		if (tcp_no_delay)
+			fd.SetNoDelay();
+
+		if (tcp_quick_ack)
+			fd.SetBoolOption(IPPROTO_TCP, TCP_QUICKACK, true);
+
+		if (tcp_notsent_lowat > 0)
+			SetIntOption(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+				     tcp_notsent_lowat);
+	}
+}
+
+void
+SocketTuning::ApplyListener(SocketDescriptor fd, bool is_tcp) const noexcept
+{
+	ApplyCommon(fd, is_tcp);
+
+	if (is_tcp && tcp_fast_open > 0)
+		fd.SetTcpFastOpen(tcp_fast_open);
+}
+
+void
+SocketTuning::ApplyConnect(SocketDescriptor fd, bool is_tcp) const noexcept
+{
+	ApplyCommon(fd, is_tcp);
+
+	if (is_tcp && tcp_fast_open > 0)
+		fd.SetTcpFastOpenConnect();
+}
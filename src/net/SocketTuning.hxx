@@ -0,0 +1,155 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+class SocketDescriptor;
+
+/**
+ * A set of socket options for performance tuning, applied to
+ * listeners by SocketConfig::Create() and to outgoing sockets
+ * before connect() (e.g. by #ConnectionPool).
+ *
+ * All options are best-effort: errors (e.g. unsupported by the
+ * kernel, or lacking privileges) are ignored, because none of them
+ * affects correctness.  Accepted sockets inherit most of these
+ * options from the listener.
+ *
+ * Named profiles can be obtained with FindProfile().
+ */
+struct SocketTuning {
+	/**
+	 * TCP Fast Open: on listeners, the queue length for
+	 * TCP_FASTOPEN; on outgoing sockets, any non-zero value
+	 * enables TCP_FASTOPEN_CONNECT.  0 disables it.
+	 */
+	unsigned tcp_fast_open = 16;
+
+	/**
+	 * Set TCP_NODELAY?
+	 */
+	bool tcp_no_delay = false;
+
+	/**
+	 * Set TCP_QUICKACK?  Note that the kernel may clear this
+	 * flag later; it mostly affects the connection setup.
+	 */
+	bool tcp_quick_ack = false;
+
+	/**
+	 * If non-zero, sets TCP_NOTSENT_LOWAT, which limits the
+	 * amount of unsent data in the kernel and lets EPOLLOUT
+	 * fire only after it has been drained below this value.
+	 */
+	unsigned tcp_notsent_lowat = 0;
+
+	/**
+	 * If non-zero, sets SO_BUSY_POLL (in microseconds).
+	 */
+	unsigned busy_poll = 0;
+
+	/**
+	 * Set SO_PREFER_BUSY_POLL (Linux 5.11)?
+	 */
+	bool prefer_busy_poll = false;
+
+	/**
+	 * If non-negative, sets SO_INCOMING_CPU.
+	 */
+	int incoming_cpu = -1;
+
+	/**
+	 * If non-zero, sets SO_SNDBUF / SO_RCVBUF (in bytes).
+	 */
+	unsigned send_buffer = 0, receive_buffer = 0;
+
+	/**
+	 * Enable SO_ZEROCOPY (see #ZeroCopyTracker)?
+	 */
+	bool zerocopy = false;
+
+	/**
+	 * The default profile: only TCP Fast Open.
+	 */
+	static constexpr SocketTuning Default() noexcept {
+		return {};
+	}
+
+	/**
+	 * For request/response traffic with small messages.
+	 */
+	static constexpr SocketTuning LowLatency() noexcept {
+		SocketTuning t;
+		t.tcp_no_delay = true;
+		t.tcp_quick_ack = true;
+		t.tcp_notsent_lowat = 16384;
+		t.busy_poll = 50;
+		t.prefer_busy_poll = true;
+		return t;
+	}
+
+	/**
+	 * For bulk transfers.
+	 */
+	static constexpr SocketTuning Throughput() noexcept {
+		SocketTuning t;
+		t.tcp_notsent_lowat = 131072;
+		t.send_buffer = 4 * 1024 * 1024;
+		t.receive_buffer = 4 * 1024 * 1024;
+		t.zerocopy = true;
+		return t;
+	}
+
+	/**
+	 * Look up a named profile ("default", "latency",
+	 * "throughput").
+	 *
+	 * Throws std::runtime_error if the name is unknown.
+	 */
+	static SocketTuning FindProfile(const char *name);
+
+	/**
+	 * Apply all options which must be set before listen().
+	 *
+	 * @param is_tcp is this a TCP socket?
+	 */
+	void ApplyListener(SocketDescriptor fd, bool is_tcp) const noexcept;
+
+	/**
+	 * Apply all options to a new outgoing socket; call this
+	 * before connect().
+	 */
+	void ApplyConnect(SocketDescriptor fd, bool is_tcp) const noexcept;
+
+private:
+	void ApplyCommon(SocketDescriptor fd, bool is_tcp) const noexcept;
+};
@@ -44,7 +44,7 @@
 #include <stdint.h>
 
 static SocketAddress
-ipv64_normalize_mapped(SocketAddress address)
+ipv64_normalize_mapped(SocketAddress address, IPv4Address &a4) noexcept
 {
 	const auto &a6 = *(const struct sockaddr_in6 *)(const void *)address.GetAddress();
 
@@ -55,12 +55,197 @@ ipv64_normalize_mapped(SocketAddress address)
 	memcpy(&inaddr, ((const char *)&a6.sin6_addr) + 12, sizeof(inaddr));
 	const uint16_t port = FromBE16(a6.sin6_port);
 
-	static IPv4Address a4;
 	a4 = {inaddr, port};
 
 	return a4;
 }
 
+static char *
+FormatDecimal(char *dest, unsigned value) noexcept
+{
+	char buffer[16];
+	char *p = buffer + sizeof(buffer);
+
+	do {
+		*--p = char('0' + value % 10);
+		value /= 10;
+	} while (value > 0);
+
+	return std::copy(p, buffer + sizeof(buffer), dest);
+}
+
+static char *
+FormatHex16(char *dest, unsigned value) noexcept
+{
+	static constexpr char hex_digits[] = "0123456789abcdef";
+
+	bool started = false;
+	for (int shift = 12; shift >= 0; shift -= 4) {
+		const unsigned digit = (value >> shift) & 0xf;
+		if (digit != 0 || started || shift == 0) {
+			*dest++ = hex_digits[digit];
+			started = true;
+		}
+	}
+
+	return dest;
+}
+
+static char *
+FormatIPv4Octets(char *dest, const uint8_t *octets) noexcept
+{
+	for (unsigned i = 0; i < 4; ++i) {
+		if (i > 0)
+			*dest++ = '.';
+		dest = FormatDecimal(dest, octets[i]);
+	}
+
+	*dest = 0;
+	return dest;
+}
+
+char *
+FormatIPv4(char *dest, const struct in_addr &address) noexcept
+{
+	return FormatIPv4Octets(dest, (const uint8_t *)&address);
+}
+
+char *
+FormatIPv6(char *dest, const struct in6_addr &address) noexcept
+{
+	const auto *b = (const uint8_t *)&address;
+
+	unsigned words[8];
+	for (unsigned i = 0; i < 8; ++i)
+		words[i] = (b[i * 2] << 8) | b[i * 2 + 1];
+
+	/* find the longest run of zero groups; the first one wins
+	   if there are several of the same length (RFC 5952 4.2.3) */
+	unsigned best_base = 8, best_length = 0;
+	for (unsigned i = 0; i < 8;) {
+		if (words[i] != 0) {
+			++i;
+			continue;
+		}
+
+		unsigned j = i + 1;
+		while (j < 8 && words[j] == 0)
+			++j;
+
+		if (j - i > best_length) {
+			best_base = i;
+			best_length = j - i;
+		}
+
+		i = j;
+	}
+
+	if (best_length < 2) {
+		/* a single zero group is not compressed (RFC 5952
+		   4.2.2) */
+		best_base = 8;
+		best_length = 0;
+	}
+
+	for (unsigned i = 0; i < 8; ++i) {
+		if (i >= best_base && i < best_base + best_length) {
+			if (i == best_base)
+				*dest++ = ':';
+			continue;
+		}
+
+		if (i > 0)
+			*dest++ = ':';
+
+		if (i == 6 && best_base == 0 &&
+		    (best_length == 6 ||
+		     (best_length == 5 && words[5] == 0xffff)))
+			/* IPv4-compatible or IPv4-mapped address: use
+			   dotted-quad notation for the last 32 bits
+			   like inet_ntop() does */
+			return FormatIPv4Octets(dest, b + 12);
+
+		dest = FormatHex16(dest, words[i]);
+	}
+
+	if (best_length > 0 && best_base + best_length == 8)
+		*dest++ = ':';
+
+	*dest = 0;
+	return dest;
+}
+
+/**
+ * Format an IPv4 or IPv6 address without getnameinfo().
+ *
+ * @param dest a buffer with room for at least 64 characters
+ * @return a pointer to the null terminator or nullptr if this
+ * address must be formatted by getnameinfo()
+ */
+static char *
+FormatInet(char *dest, SocketAddress address, bool with_port) noexcept
+{
+	switch (address.GetFamily()) {
+	case AF_INET:
+		if (address.GetSize() < sizeof(struct sockaddr_in))
+			return nullptr;
+
+		{
+			const auto &a4 = IPv4Address::Cast(address);
+			dest = FormatIPv4(dest, a4.GetAddress());
+			if (with_port) {
+				*dest++ = ':';
+				dest = FormatDecimal(dest, a4.GetPort());
+				*dest = 0;
+			}
+		}
+
+		return dest;
+
+	case AF_INET6:
+		if (address.GetSize() < sizeof(struct sockaddr_in6))
+			return nullptr;
+
+		{
+			const auto &a6 = IPv6Address::Cast(address);
+			if (a6.GetScopeId() != 0)
+				/* let getnameinfo() translate the scope id
+				   to an interface name */
+				return nullptr;
+
+			if (with_port)
+				*dest++ = '[';
+
+			dest = FormatIPv6(dest, a6.GetAddress());
+
+			if (with_port) {
+				*dest++ = ']';
+				*dest++ = ':';
+				dest = FormatDecimal(dest, a6.GetPort());
+				*dest = 0;
+			}
+		}
+
+		return dest;
+
+	default:
+		return nullptr;
+	}
+}
+
+static bool
+CopyString(char *buffer, size_t buffer_size,
+	   const char *src, const char *end) noexcept
+{
+	const size_t length = end - src;
+	if (length >= buffer_size)
+		/* no more room */
+		return false;
+
+	memcpy(buffer, src, length + 1);
+	return true;
+}
+
 static bool
 LocalToString(char *buffer, size_t buffer_size,
 	      const struct sockaddr_un *sun, size_t length)
@@ -99,7 +284,13 @@ ToString(char *buffer, size_t buffer_size,
 				     (const struct sockaddr_un *)address.GetAddress(),
 				     address.GetSize());
 
-	address = ipv64_normalize_mapped(address);
+	IPv4Address ipv4_buffer;
+	address = ipv64_normalize_mapped(address, ipv4_buffer);
+
+	char tmp[64];
+	const char *end = FormatInet(tmp, address, true);
+	if (end != nullptr)
+		return CopyString(buffer, buffer_size, tmp, end);
 
 	char serv[16];
 	int ret = getnameinfo(address.GetAddress(), address.GetSize(),
@@ -147,7 +338,13 @@ HostToString(char *buffer, size_t buffer_size,
 				     (const struct sockaddr_un *)address.GetAddress(),
 				     address.GetSize());
 
-	address = ipv64_normalize_mapped(address);
+	IPv4Address ipv4_buffer;
+	address = ipv64_normalize_mapped(address, ipv4_buffer);
+
+	char tmp[64];
+	const char *end = FormatInet(tmp, address, false);
+	if (end != nullptr)
+		return CopyString(buffer, buffer_size, tmp, end);
 
 	return getnameinfo(address.GetAddress(), address.GetSize(),
 			   buffer, buffer_size,
@@ -35,8 +35,29 @@
 
 #include <stddef.h>
 
+struct in_addr;
+struct in6_addr;
 class SocketAddress;
 
+/**
+ * Format an IPv4 address in dotted-quad notation.  The buffer must
+ * have room for at least 16 characters.
+ *
+ * @return a pointer to the null terminator
+ */
+char *
+FormatIPv4(char *dest, const struct in_addr &address) noexcept;
+
+/**
+ * Format an IPv6 address according to RFC 5952 (lower case, longest
+ * run of zero groups compressed to "::").  The buffer must have room
+ * for at least 46 characters.
+ *
+ * @return a pointer to the null terminator
+ */
+char *
+FormatIPv6(char *dest, const struct in6_addr &address) noexcept;
+
 /**
  * Generates the string representation of a #SocketAddress into the
  * specified buffer.
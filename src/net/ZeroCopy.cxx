@@ -0,0 +1,108 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ZeroCopy.hxx"
+#include "SocketDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <errno.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+bool
+ZeroCopyTracker::Enable(SocketDescriptor s) noexcept
+{
+	return s.SetBoolOption(SOL_SOCKET, SO_ZEROCOPY, true);
+}
+
+bool
+ZeroCopyTracker::ReadCompletions(SocketDescriptor s)
+{
+	bool result = false;
+
+	while (true) {
+		char control[128];
+		struct msghdr msg{};
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(s.Get(), &msg, MSG_ERRQUEUE|MSG_DONTWAIT) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return result;
+
+			if (errno == EINTR)
+				continue;
+
+			throw MakeErrno("Failed to read socket error queue");
+		}
+
+		for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!((cmsg->cmsg_level == SOL_IP &&
+			       cmsg->cmsg_type == IP_RECVERR) ||
+			      (cmsg->cmsg_level == SOL_IPV6 &&
+			       cmsg->cmsg_type == IPV6_RECVERR)))
+				continue;
+
+			const auto &serr = *(const struct sock_extended_err *)
+				CMSG_DATA(cmsg);
+			if (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+			    serr.ee_errno != 0)
+				continue;
+
+			/* ee_info..ee_data is the (inclusive) range
+			   of completed sends; TCP reports them in
+			   order */
+			const uint32_t hi = serr.ee_data;
+			if (int32_t(hi + 1 - completed) > 0) {
+				completed = hi + 1;
+				result = true;
+			}
+
+			if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				copied = true;
+		}
+	}
+}
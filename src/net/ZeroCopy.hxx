@@ -0,0 +1,125 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+class SocketDescriptor;
+
+/**
+ * Tracks the completion of sendmsg(MSG_ZEROCOPY) calls on one
+ * socket.  The kernel numbers all successful zerocopy sends on a
+ * socket sequentially and reports completed ranges on the socket's
+ * error queue; until then, the memory passed to sendmsg() must not
+ * be modified or freed.
+ *
+ * Completions are reported with POLLERR (SocketEvent::ERROR); call
+ * ReadCompletions() then.
+ */
+class ZeroCopyTracker {
+	/**
+	 * The sequence number of the next zerocopy send.
+	 */
+	uint32_t next = 0;
+
+	/**
+	 * All sends before this sequence number are complete.
+	 */
+	uint32_t completed = 0;
+
+	/**
+	 * Has the kernel reported that it had to copy the data
+	 * anyway (e.g. on the loopback device)?
+	 */
+	bool copied = false;
+
+public:
+	/**
+	 * Enable SO_ZEROCOPY on the given socket.
+	 *
+	 * @return false if the kernel or the socket type does not
+	 * support zerocopy
+	 */
+	static bool Enable(SocketDescriptor s) noexcept;
+
+	/**
+	 * Register a successful sendmsg(MSG_ZEROCOPY) call.
+	 */
+	void OnSent() noexcept {
+		++next;
+	}
+
+	/**
+	 * Returns a sequence number to be passed to IsComplete()
+	 * later; it covers all sends registered so far.
+	 */
+	uint32_t GetSequence() const noexcept {
+		return next;
+	}
+
+	/**
+	 * Have all sends registered before GetSequence() returned
+	 * the given value been completed?  Only then may the memory
+	 * be released.
+	 */
+	bool IsComplete(uint32_t sequence) const noexcept {
+		return int32_t(sequence - completed) <= 0;
+	}
+
+	/**
+	 * Are there sends which have not been completed yet?
+	 */
+	bool HasPending() const noexcept {
+		return next != completed;
+	}
+
+	/**
+	 * Did the kernel copy the data after all?  If so, zerocopy
+	 * doesn't pay off for this socket, and the caller should
+	 * stop using it.
+	 */
+	bool WasCopied() const noexcept {
+		return copied;
+	}
+
+	/**
+	 * Read all pending completion notifications from the error
+	 * queue of the given socket.
+	 *
+	 * Throws std::system_error on error (other than an empty
+	 * error queue).
+	 *
+	 * @return true if at least one send has been completed
+	 */
+	bool ReadCompletions(SocketDescriptor s);
+};
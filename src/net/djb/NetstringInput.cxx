@@ -35,6 +35,8 @@
 #include "util/RuntimeError.hxx"
 #include "util/CharUtil.hxx"
 
+#include <algorithm>
+
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -147,6 +149,124 @@ NetstringInput::ReceiveValue(int fd)
 	return ValueData(nbytes);
 }
 
+/**
+ * Parse the value size from a netstring header (without the colon).
+ */
+static size_t
+ParseSize(const uint8_t *p, size_t length, size_t max_size)
+{
+	size_t size = 0;
+
+	for (size_t i = 0; i != length; ++i) {
+		if (!IsDigitASCII(p[i]))
+			throw std::runtime_error("Malformed netstring");
+
+		size = size * 10 + (p[i] - '0');
+		if (size >= max_size)
+			throw FormatRuntimeError("Netstring is too large: %zu",
+						 size);
+	}
+
+	return size;
+}
+
+NetstringInput::Result
+NetstringInput::ParseBuffered()
+{
+	assert(state == State::HEADER);
+
+	auto r = buffer.Read();
+	if (r.empty())
+		return Result::MORE;
+
+	const auto *colon = (const uint8_t *)
+		memchr(r.data, ':', std::min(r.size, sizeof(header_buffer)));
+	if (colon == nullptr) {
+		if (r.size >= sizeof(header_buffer) ||
+		    !OnlyDigits((const char *)r.data, r.size))
+			throw std::runtime_error("Malformed netstring");
+
+		return Result::MORE;
+	}
+
+	if (colon == r.data)
+		throw std::runtime_error("Malformed netstring");
+
+	const size_t header_size = colon + 1 - r.data;
+	const size_t size = ParseSize(r.data, header_size - 1, max_size);
+
+	/* including the trailing comma */
+	const size_t total_size = header_size + size + 1;
+
+	if (total_size <= r.size) {
+		/* the whole netstring is in the buffer */
+		if (r.data[total_size - 1] != ',')
+			throw std::runtime_error("Malformed netstring");
+
+		in_place = {r.data + header_size, size};
+		in_place_size = total_size;
+		state = State::FINISHED;
+		return Result::FINISHED;
+	}
+
+	if (total_size <= buffer.GetCapacity()) {
+		/* small enough for the buffer: make room (by moving
+		   the netstring to the beginning of the buffer) and
+		   wait for more data */
+		buffer.WantWrite(total_size - r.size);
+		return Result::MORE;
+	}
+
+	/* too large: allocate a dedicated buffer and copy the part
+	   which has already been received */
+	value.ResizeDiscard(size + 1);
+	state = State::VALUE;
+	value_position = 0;
+
+	const size_t vbytes = r.size - header_size;
+	memcpy(&value.front(), r.data + header_size, vbytes);
+	buffer.Consume(r.size);
+	return ValueData(vbytes);
+}
+
+inline NetstringInput::Result
+NetstringInput::ReceiveBuffered(int fd)
+{
+	/* there may be a complete netstring in the buffer already
+	   (after Reset()) */
+	Result result = ParseBuffered();
+	if (result != Result::MORE)
+		return result;
+
+	if (state == State::VALUE)
+		return ReceiveValue(fd);
+
+	auto w = buffer.Write();
+	assert(!w.empty());
+
+	ssize_t nbytes = read(fd, w.data, w.size);
+	if (nbytes < 0) {
+		switch (errno) {
+		case EAGAIN:
+		case EINTR:
+			return Result::MORE;
+
+		case ECONNRESET:
+			return Result::CLOSED;
+
+		default:
+			throw MakeErrno("read() failed");
+		}
+	}
+
+	if (nbytes == 0)
+		return Result::CLOSED;
+
+	buffer.Append(nbytes);
+
+	return ParseBuffered();
+}
+
 NetstringInput::Result
 NetstringInput::Receive(int fd)
 {
@@ -156,6 +276,9 @@ NetstringInput::Receive(int fd)
 		gcc_unreachable();
 
 	case State::HEADER:
+		if (buffer.IsDefined())
+			return ReceiveBuffered(fd);
+
 		return ReceiveHeader(fd);
 
 	case State::VALUE:
@@ -164,3 +287,29 @@ NetstringInput::Receive(int fd)
 
 	gcc_unreachable();
 }
+
+AllocatedArray<uint8_t> &
+NetstringInput::GetValue()
+{
+	assert(state == State::FINISHED);
+
+	if (!in_place.IsNull()) {
+		value.ResizeDiscard(in_place.size);
+		std::copy_n(in_place.data, in_place.size, value.begin());
+		in_place = nullptr;
+	}
+
+	return value;
+}
+
+void
+NetstringInput::Reset()
+{
+	assert(state == State::FINISHED);
+
+	buffer.Consume(in_place_size);
+	in_place = nullptr;
+	in_place_size = 0;
+	header_position = 0;
+	state = State::HEADER;
+}
@@ -34,13 +34,22 @@
 #define NETSTRING_INPUT_HXX
 
 #include "util/AllocatedArray.hxx"
+#include "util/ForeignFifoBuffer.hxx"
+#include "util/ConstBuffer.hxx"
 
 #include <cstddef>
 #include <cassert>
 #include <cstdint>
+#include <memory>
 
 /**
  * A netstring input buffer.
+ *
+ * In buffered mode, it reads large chunks into a reusable buffer
+ * and parses the header from there; a value which fits into the
+ * buffer is handed out in place (see GetValueView()), and only
+ * larger values get a dedicated allocation.  Data following the
+ * netstring remains in the buffer for the next one (see Reset()).
  */
 class NetstringInput {
 	enum class State {
@@ -59,9 +68,36 @@ class NetstringInput {
 
 	const size_t max_size;
 
+	/**
+	 * The read buffer (buffered mode only).
+	 */
+	std::unique_ptr<uint8_t[]> buffer_storage;
+	ForeignFifoBuffer<uint8_t> buffer{nullptr};
+
+	/**
+	 * In buffered mode: the value inside #buffer (only in state
+	 * FINISHED, if the value was not copied to #value) and the
+	 * number of buffered bytes occupied by the whole netstring.
+	 */
+	ConstBuffer<uint8_t> in_place = nullptr;
+	size_t in_place_size = 0;
+
 public:
-	explicit NetstringInput(size_t _max_size)
-		:max_size(_max_size) {}
+	/**
+	 * @param buffer_size the size of the read buffer; 0 disables
+	 * buffered mode, and each read() stops at the end of the
+	 * netstring
+	 */
+	explicit NetstringInput(size_t _max_size, size_t buffer_size=0)
+		:max_size(_max_size) {
+		if (buffer_size > 0) {
+			buffer_storage.reset(new uint8_t[buffer_size]);
+			buffer.SetBuffer(buffer_storage.get(), buffer_size);
+		}
+	}
+
+	NetstringInput(const NetstringInput &) = delete;
+	NetstringInput &operator=(const NetstringInput &) = delete;
 
 	enum class Result {
 		MORE,
@@ -74,13 +110,44 @@ public:
 	 */
 	Result Receive(int fd);
 
-	AllocatedArray<uint8_t> &GetValue() {
+	/**
+	 * Returns the value (without the trailing comma).  In
+	 * buffered mode, a value which was received in place is
+	 * copied.
+	 */
+	AllocatedArray<uint8_t> &GetValue();
+
+	/**
+	 * Returns the value without copying it.  It is valid until
+	 * the next Reset() call.
+	 */
+	ConstBuffer<uint8_t> GetValueView() const {
 		assert(state == State::FINISHED);
 
-		return value;
+		return in_place.IsNull()
+			? ConstBuffer<uint8_t>(value.begin(), value.size())
+			: in_place;
+	}
+
+	/**
+	 * Prepare for receiving the next netstring after
+	 * Result::FINISHED.
+	 */
+	void Reset();
+
+	/**
+	 * Are there buffered data which have not yet been parsed
+	 * (after Reset())?  If yes, call Receive() again without
+	 * waiting for the socket to become readable; it may have
+	 * another complete netstring already.
+	 */
+	bool HasBufferedData() const {
+		return buffer.GetAvailable() > in_place_size;
 	}
 
 private:
+	Result ParseBuffered();
+	Result ReceiveBuffered(int fd);
 	Result ReceiveHeader(int fd);
 	Result ValueData(size_t nbytes);
 	Result ReceiveValue(int fd);
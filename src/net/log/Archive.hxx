@@ -0,0 +1,116 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/*
+ * Definitions for the binary log archive format.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Net {
+namespace Log {
+
+/*
+
+  A log archive file starts with an #ArchiveFileHeader, followed by
+  any number of blocks.  All integers are little-endian.
+
+  Each block starts with an #ArchiveBlockHeader, followed by a sorted
+  array of "n_sites" 32 bit FNV-1a hashes of all sites in the block,
+  padded to a multiple of 8 bytes.  Then there are "stored_size"
+  bytes of (maybe compressed) payload, again padded to a multiple of
+  8 bytes.
+
+  The uncompressed payload is a sequence of records, each consisting
+  of a 32 bit length followed by the raw datagram (including magic
+  and CRC, see Protocol.hxx).
+
+  The block headers and the site hash arrays can be inspected through
+  a read-only mapping of the file without decompressing anything.
+
+ */
+
+static constexpr uint32_t ARCHIVE_MAGIC = 0x414c4d43; // "CMLA"
+static constexpr uint32_t ARCHIVE_VERSION = 1;
+static constexpr uint32_t ARCHIVE_BLOCK_MAGIC = 0x4b4c4243; // "CBLK"
+
+enum class ArchiveCompression : uint8_t {
+	NONE = 0,
+	LZ4 = 1,
+	ZSTD = 2,
+};
+
+struct ArchiveFileHeader {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct ArchiveBlockHeader {
+	uint32_t magic;
+
+	ArchiveCompression compression;
+	uint8_t reserved[3];
+
+	uint32_t n_records;
+	uint32_t n_sites;
+
+	/**
+	 * The number of payload bytes in the file (excluding
+	 * padding).
+	 */
+	uint32_t stored_size;
+
+	/**
+	 * The number of payload bytes after decompression.
+	 */
+	uint32_t uncompressed_size;
+
+	/**
+	 * The time stamp range of all records in this block.  If at
+	 * least one record has no time stamp, the range is 0 to
+	 * UINT64_MAX.
+	 */
+	uint64_t min_timestamp, max_timestamp;
+};
+
+static_assert(sizeof(ArchiveBlockHeader) == 40, "Wrong struct size");
+
+static constexpr size_t
+ArchivePadding(size_t size) noexcept
+{
+	return (8 - size % 8) % 8;
+}
+
+}}
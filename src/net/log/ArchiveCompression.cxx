@@ -0,0 +1,171 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ArchiveCompression.hxx"
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <stdexcept>
+
+#include <string.h>
+
+namespace Net {
+namespace Log {
+
+bool
+IsArchiveCompressionSupported(ArchiveCompression c) noexcept
+{
+	switch (c) {
+	case ArchiveCompression::NONE:
+		return true;
+
+	case ArchiveCompression::LZ4:
+#ifdef HAVE_LZ4
+		return true;
+#else
+		return false;
+#endif
+
+	case ArchiveCompression::ZSTD:
+#ifdef HAVE_ZSTD
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	return false;
+}
+
+void
+CompressArchiveBlock(ArchiveCompression c, const void *src, size_t src_size,
+		     std::vector<uint8_t> &dest)
+{
+	switch (c) {
+	case ArchiveCompression::NONE:
+		dest.insert(dest.end(), (const uint8_t *)src,
+			    (const uint8_t *)src + src_size);
+		return;
+
+	case ArchiveCompression::LZ4:
+#ifdef HAVE_LZ4
+		{
+			const size_t position = dest.size();
+			dest.resize(position + LZ4_compressBound(src_size));
+			int n = LZ4_compress_default((const char *)src,
+						     (char *)&dest[position],
+						     src_size,
+						     dest.size() - position);
+			if (n <= 0)
+				throw std::runtime_error("LZ4 compression failed");
+
+			dest.resize(position + n);
+			return;
+		}
+#else
+		break;
+#endif
+
+	case ArchiveCompression::ZSTD:
+#ifdef HAVE_ZSTD
+		{
+			const size_t position = dest.size();
+			dest.resize(position + ZSTD_compressBound(src_size));
+			size_t n = ZSTD_compress(&dest[position],
+						 dest.size() - position,
+						 src, src_size, 3);
+			if (ZSTD_isError(n))
+				throw std::runtime_error(ZSTD_getErrorName(n));
+
+			dest.resize(position + n);
+			return;
+		}
+#else
+		break;
+#endif
+	}
+
+	throw std::runtime_error("Compression algorithm not supported");
+}
+
+void
+DecompressArchiveBlock(ArchiveCompression c, const void *src, size_t src_size,
+		       void *dest, size_t dest_size)
+{
+	switch (c) {
+	case ArchiveCompression::NONE:
+		if (src_size != dest_size)
+			throw std::runtime_error("Wrong block size");
+
+		memcpy(dest, src, src_size);
+		return;
+
+	case ArchiveCompression::LZ4:
+#ifdef HAVE_LZ4
+		{
+			int n = LZ4_decompress_safe((const char *)src,
+						    (char *)dest,
+						    src_size, dest_size);
+			if (n < 0 || size_t(n) != dest_size)
+				throw std::runtime_error("LZ4 decompression failed");
+			return;
+		}
+#else
+		break;
+#endif
+
+	case ArchiveCompression::ZSTD:
+#ifdef HAVE_ZSTD
+		{
+			size_t n = ZSTD_decompress(dest, dest_size,
+						   src, src_size);
+			if (ZSTD_isError(n))
+				throw std::runtime_error(ZSTD_getErrorName(n));
+			if (n != dest_size)
+				throw std::runtime_error("Wrong block size");
+			return;
+		}
+#else
+		break;
+#endif
+	}
+
+	throw std::runtime_error("Compression algorithm not supported");
+}
+
+}}
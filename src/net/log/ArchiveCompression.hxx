@@ -0,0 +1,73 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Archive.hxx"
+#include "util/Compiler.h"
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Net {
+namespace Log {
+
+/**
+ * Was support for this compression algorithm compiled in?
+ */
+gcc_const
+bool
+IsArchiveCompressionSupported(ArchiveCompression c) noexcept;
+
+/**
+ * Compress the source buffer and append the result to the given
+ * vector.
+ *
+ * Throws on error.
+ */
+void
+CompressArchiveBlock(ArchiveCompression c, const void *src, size_t src_size,
+		     std::vector<uint8_t> &dest);
+
+/**
+ * Decompress into the given buffer, which must be exactly as large
+ * as the uncompressed data.
+ *
+ * Throws on error.
+ */
+void
+DecompressArchiveBlock(ArchiveCompression c, const void *src, size_t src_size,
+		       void *dest, size_t dest_size);
+
+}}
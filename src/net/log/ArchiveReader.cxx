@@ -0,0 +1,186 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ArchiveReader.hxx"
+#include "ArchiveCompression.hxx"
+#include "io/FileDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/ByteOrder.hxx"
+#include "util/FNVHash.hxx"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <string.h>
+
+namespace Net {
+namespace Log {
+
+size_t
+ArchiveReader::Block::GetRecordCount() const noexcept
+{
+	return FromLE32(header->n_records);
+}
+
+uint64_t
+ArchiveReader::Block::GetMinTimestamp() const noexcept
+{
+	return FromLE64(header->min_timestamp);
+}
+
+uint64_t
+ArchiveReader::Block::GetMaxTimestamp() const noexcept
+{
+	return FromLE64(header->max_timestamp);
+}
+
+bool
+ArchiveReader::Block::MayContainSite(uint32_t hash) const noexcept
+{
+	const uint32_t *end = sites + FromLE32(header->n_sites);
+
+	return std::binary_search(sites, end, ToLE32(hash),
+				  [](uint32_t a, uint32_t b){
+					  return FromLE32(a) < FromLE32(b);
+				  });
+}
+
+ArchiveReader::ArchiveReader(FileDescriptor fd)
+{
+	const off_t file_size = fd.GetSize();
+	if (file_size < off_t(sizeof(ArchiveFileHeader)))
+		throw std::runtime_error("Archive file is too small");
+
+	size = file_size;
+
+	void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.Get(), 0);
+	if (p == MAP_FAILED)
+		throw MakeErrno("Failed to map archive");
+
+	data = (const uint8_t *)p;
+
+	const auto &header = *(const ArchiveFileHeader *)p;
+	if (FromLE32(header.magic) != ARCHIVE_MAGIC ||
+	    FromLE32(header.version) != ARCHIVE_VERSION) {
+		munmap(p, size);
+		throw std::runtime_error("Not a log archive");
+	}
+}
+
+ArchiveReader::~ArchiveReader() noexcept
+{
+	munmap(const_cast<uint8_t *>(data), size);
+}
+
+bool
+ArchiveReader::NextBlock(size_t &offset, Block &block) const noexcept
+{
+	if (offset < sizeof(ArchiveFileHeader))
+		offset = sizeof(ArchiveFileHeader);
+
+	if (size - offset < sizeof(ArchiveBlockHeader))
+		return false;
+
+	const auto &header = *(const ArchiveBlockHeader *)(const void *)(data + offset);
+	if (FromLE32(header.magic) != ARCHIVE_BLOCK_MAGIC)
+		return false;
+
+	size_t position = offset + sizeof(header);
+
+	const size_t sites_size = FromLE32(header.n_sites) * sizeof(uint32_t);
+	const size_t stored_size = FromLE32(header.stored_size);
+	const size_t total_size = sites_size + ArchivePadding(sites_size) +
+		stored_size + ArchivePadding(stored_size);
+	if (size - position < total_size)
+		/* truncated (maybe still being written) */
+		return false;
+
+	block.header = &header;
+	block.sites = (const uint32_t *)(const void *)(data + position);
+	position += sites_size + ArchivePadding(sites_size);
+	block.stored = {data + position, stored_size};
+
+	offset = position + stored_size + ArchivePadding(stored_size);
+	return true;
+}
+
+ConstBuffer<void>
+ArchiveReader::LoadBlock(const Block &block)
+{
+	const auto compression = block.header->compression;
+	if (compression == ArchiveCompression::NONE)
+		/* no copy needed */
+		return block.stored;
+
+	const size_t uncompressed_size =
+		FromLE32(block.header->uncompressed_size);
+	if (uncompressed_size > buffer_size) {
+		buffer.reset(new uint8_t[uncompressed_size]);
+		buffer_size = uncompressed_size;
+	}
+
+	DecompressArchiveBlock(compression,
+			       block.stored.data, block.stored.size,
+			       buffer.get(), uncompressed_size);
+	return {buffer.get(), uncompressed_size};
+}
+
+uint32_t
+ArchiveReader::SiteHash(const char *site) noexcept
+{
+	return FNV1aHash32(site);
+}
+
+ConstBuffer<void>
+ArchiveReader::SplitRecord(ConstBuffer<void> _payload,
+			   ConstBuffer<void> &record)
+{
+	auto payload = ConstBuffer<uint8_t>::FromVoid(_payload);
+
+	uint32_t length;
+	if (payload.size < sizeof(length))
+		throw std::runtime_error("Malformed archive block");
+
+	memcpy(&length, payload.data, sizeof(length));
+	length = FromLE32(length);
+	payload.skip_front(sizeof(length));
+
+	if (payload.size < length)
+		throw std::runtime_error("Malformed archive block");
+
+	record = {payload.data, length};
+	payload.skip_front(length);
+	return payload.ToVoid();
+}
+
+}}
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Archive.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/Compiler.h"
+
+#include <memory>
+
+#include <stddef.h>
+#include <stdint.h>
+
+class FileDescriptor;
+
+namespace Net {
+namespace Log {
+
+/**
+ * Reads a binary log archive file (see Archive.hxx) through a
+ * read-only mapping.  Block headers and site hashes are inspected
+ * in place, and only the blocks which may match a query are
+ * decompressed.
+ */
+class ArchiveReader {
+	const uint8_t *data;
+	size_t size;
+
+	std::unique_ptr<uint8_t[]> buffer;
+	size_t buffer_size = 0;
+
+public:
+	/**
+	 * A block inside the mapping.
+	 */
+	class Block {
+		friend class ArchiveReader;
+
+		const ArchiveBlockHeader *header;
+		const uint32_t *sites;
+		ConstBuffer<void> stored;
+
+	public:
+		size_t GetRecordCount() const noexcept;
+		uint64_t GetMinTimestamp() const noexcept;
+		uint64_t GetMaxTimestamp() const noexcept;
+
+		/**
+		 * Does this block overlap the given time stamp range
+		 * (inclusive)?
+		 */
+		gcc_pure
+		bool Overlaps(uint64_t since, uint64_t until) const noexcept {
+			return GetMaxTimestamp() >= since &&
+				GetMinTimestamp() <= until;
+		}
+
+		/**
+		 * May this block contain records of the site with the
+		 * given FNV1aHash32()?  False positives are possible
+		 * due to hash collisions.
+		 */
+		gcc_pure
+		bool MayContainSite(uint32_t hash) const noexcept;
+	};
+
+	/**
+	 * Selects records by time stamp range and site.  Matching is
+	 * done per block; the caller must check each datagram
+	 * passed to its callback.
+	 */
+	struct Filter {
+		uint64_t since = 0, until = UINT64_MAX;
+
+		/**
+		 * If not nullptr, then only blocks containing this
+		 * site are visited.
+		 */
+		const char *site = nullptr;
+	};
+
+	/**
+	 * Throws on error.
+	 *
+	 * @param fd the archive file (owned by caller; may be closed
+	 * after the constructor returns)
+	 */
+	explicit ArchiveReader(FileDescriptor fd);
+
+	~ArchiveReader() noexcept;
+
+	ArchiveReader(const ArchiveReader &) = delete;
+	ArchiveReader &operator=(const ArchiveReader &) = delete;
+
+	/**
+	 * Obtain the block at the given file offset and advance the
+	 * offset to the next block.
+	 *
+	 * @param offset the file offset; pass 0 to get the first
+	 * block
+	 * @return false if there are no more blocks (or the rest of
+	 * the file is truncated or corrupt)
+	 */
+	bool NextBlock(size_t &offset, Block &block) const noexcept;
+
+	/**
+	 * Obtain the (uncompressed) payload of a block.  The returned
+	 * buffer is valid until the next call.
+	 *
+	 * Throws on error.
+	 */
+	ConstBuffer<void> LoadBlock(const Block &block);
+
+	/**
+	 * Invoke the function with each datagram (ConstBuffer<void>)
+	 * in the payload returned by LoadBlock().
+	 *
+	 * Throws on error.
+	 */
+	template<typename F>
+	static void ForEachRecord(ConstBuffer<void> payload, F &&f) {
+		while (!payload.empty()) {
+			ConstBuffer<void> record;
+			payload = SplitRecord(payload, record);
+			f(record);
+		}
+	}
+
+	/**
+	 * Invoke the function with each datagram (ConstBuffer<void>)
+	 * of all blocks matching the filter.
+	 *
+	 * Throws on error.
+	 */
+	template<typename F>
+	void Query(const Filter &filter, F &&f) {
+		const uint32_t site_hash = filter.site != nullptr
+			? SiteHash(filter.site)
+			: 0;
+
+		size_t offset = 0;
+		Block block;
+		while (NextBlock(offset, block)) {
+			if (!block.Overlaps(filter.since, filter.until))
+				continue;
+
+			if (filter.site != nullptr &&
+			    !block.MayContainSite(site_hash))
+				continue;
+
+			ForEachRecord(LoadBlock(block), f);
+		}
+	}
+
+private:
+	gcc_pure
+	static uint32_t SiteHash(const char *site) noexcept;
+
+	/**
+	 * Split the first record off the payload.
+	 *
+	 * Throws on error.
+	 *
+	 * @return the rest of the payload
+	 */
+	static ConstBuffer<void> SplitRecord(ConstBuffer<void> payload,
+					     ConstBuffer<void> &record);
+};
+
+}}
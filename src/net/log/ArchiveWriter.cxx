@@ -0,0 +1,200 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ArchiveWriter.hxx"
+#include "ArchiveCompression.hxx"
+#include "Visit.hxx"
+#include "system/Error.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/ByteOrder.hxx"
+#include "util/FNVHash.hxx"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <string.h>
+
+namespace Net {
+namespace Log {
+
+template<typename T>
+static void
+AppendT(std::vector<uint8_t> &v, const T &value) noexcept
+{
+	const auto *p = (const uint8_t *)&value;
+	v.insert(v.end(), p, p + sizeof(value));
+}
+
+static void
+AppendPadding(std::vector<uint8_t> &v) noexcept
+{
+	v.resize(v.size() + ArchivePadding(v.size()));
+}
+
+static void
+WriteFull(FileDescriptor fd, const void *_p, size_t size)
+{
+	auto p = (const uint8_t *)_p;
+	while (size > 0) {
+		ssize_t nbytes = fd.Write(p, size);
+		if (nbytes < 0)
+			throw MakeErrno("Failed to write archive");
+
+		p += nbytes;
+		size -= nbytes;
+	}
+}
+
+ArchiveWriter::ArchiveWriter(FileDescriptor _fd,
+			     ArchiveCompression _compression,
+			     size_t _block_size)
+	:fd(_fd), compression(_compression), block_size(_block_size)
+{
+	if (!IsArchiveCompressionSupported(compression))
+		throw std::runtime_error("Compression algorithm not supported");
+
+	Reset();
+
+	if (fd.GetSize() == 0) {
+		const ArchiveFileHeader header{
+			ToLE32(ARCHIVE_MAGIC),
+			ToLE32(ARCHIVE_VERSION),
+		};
+
+		WriteFull(fd, &header, sizeof(header));
+	}
+}
+
+void
+ArchiveWriter::Reset() noexcept
+{
+	payload.clear();
+	sites.clear();
+	n_records = 0;
+	min_timestamp = UINT64_MAX;
+	max_timestamp = 0;
+}
+
+void
+ArchiveWriter::Append(ConstBuffer<void> datagram)
+{
+	struct Visitor : NullDatagramVisitor {
+		uint64_t timestamp = 0;
+		uint32_t site_hash = 0;
+		bool valid_timestamp = false, valid_site = false;
+
+		void OnString(Attribute, StringView value) noexcept {
+			/* the string is null-terminated in the datagram */
+			site_hash = FNV1aHash32(value.data);
+			valid_site = true;
+		}
+
+		void OnUint64(Attribute, uint64_t value) noexcept {
+			timestamp = value;
+			valid_timestamp = true;
+		}
+	} v;
+
+	VisitDatagram(datagram, ToMask(Attribute::TIMESTAMP, Attribute::SITE),
+		      v);
+
+	if (v.valid_timestamp) {
+		min_timestamp = std::min(min_timestamp, v.timestamp);
+		max_timestamp = std::max(max_timestamp, v.timestamp);
+	} else {
+		min_timestamp = 0;
+		max_timestamp = UINT64_MAX;
+	}
+
+	if (v.valid_site)
+		sites.push_back(v.site_hash);
+
+	AppendT(payload, ToLE32(datagram.size));
+	const auto *p = (const uint8_t *)datagram.data;
+	payload.insert(payload.end(), p, p + datagram.size);
+	++n_records;
+
+	if (payload.size() >= block_size)
+		Flush();
+}
+
+void
+ArchiveWriter::Flush()
+{
+	if (n_records == 0)
+		return;
+
+	std::sort(sites.begin(), sites.end());
+	sites.erase(std::unique(sites.begin(), sites.end()), sites.end());
+
+	output.clear();
+	output.resize(sizeof(ArchiveBlockHeader));
+
+	for (uint32_t i : sites)
+		AppendT(output, ToLE32(i));
+	AppendPadding(output);
+
+	const size_t payload_position = output.size();
+	auto c = compression;
+	CompressArchiveBlock(c, payload.data(), payload.size(), output);
+
+	if (output.size() - payload_position >= payload.size() &&
+	    c != ArchiveCompression::NONE) {
+		/* incompressible: store it */
+		c = ArchiveCompression::NONE;
+		output.resize(payload_position);
+		CompressArchiveBlock(c, payload.data(), payload.size(),
+				     output);
+	}
+
+	ArchiveBlockHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = ToLE32(ARCHIVE_BLOCK_MAGIC);
+	header.compression = c;
+	header.n_records = ToLE32(n_records);
+	header.n_sites = ToLE32(sites.size());
+	header.stored_size = ToLE32(output.size() - payload_position);
+	header.uncompressed_size = ToLE32(payload.size());
+	header.min_timestamp = ToLE64(min_timestamp);
+	header.max_timestamp = ToLE64(max_timestamp);
+	memcpy(output.data(), &header, sizeof(header));
+
+	AppendPadding(output);
+
+	/* one write() per block, so concurrent readers see either
+	   nothing or the whole block (usually) */
+	WriteFull(fd, output.data(), output.size());
+
+	Reset();
+}
+
+}}
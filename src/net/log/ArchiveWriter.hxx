@@ -0,0 +1,105 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Archive.hxx"
+#include "io/FileDescriptor.hxx"
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+template<typename T> struct ConstBuffer;
+
+namespace Net {
+namespace Log {
+
+/**
+ * Appends log datagrams to a binary archive file (see Archive.hxx).
+ * Datagrams are collected in memory and written as one block when
+ * the block is full or when Flush() is called.
+ */
+class ArchiveWriter {
+	FileDescriptor fd;
+
+	const ArchiveCompression compression;
+
+	const size_t block_size;
+
+	std::vector<uint8_t> payload, output;
+	std::vector<uint32_t> sites;
+
+	uint32_t n_records = 0;
+	uint64_t min_timestamp, max_timestamp;
+
+public:
+	/**
+	 * Throws on error.
+	 *
+	 * @param _fd the archive file, opened for writing with
+	 * O_APPEND (owned by caller); if it is empty, the file header
+	 * is written
+	 * @param _block_size flush the block after this many
+	 * (uncompressed) bytes
+	 */
+	explicit ArchiveWriter(FileDescriptor _fd,
+			       ArchiveCompression _compression=ArchiveCompression::NONE,
+			       size_t _block_size=1024 * 1024);
+
+	ArchiveWriter(const ArchiveWriter &) = delete;
+	ArchiveWriter &operator=(const ArchiveWriter &) = delete;
+
+	/**
+	 * Append a datagram.  It may be written to the file right
+	 * away, or later.
+	 *
+	 * Throws #ProtocolError if the datagram is malformed, and
+	 * other exceptions on I/O error.
+	 */
+	void Append(ConstBuffer<void> datagram);
+
+	/**
+	 * Write the pending block to the file.  This must be called
+	 * before the object is destroyed, or else the pending
+	 * datagrams are lost.
+	 *
+	 * Throws on error.
+	 */
+	void Flush();
+
+private:
+	void Reset() noexcept;
+};
+
+}}
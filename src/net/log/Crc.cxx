@@ -0,0 +1,273 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Crc.hxx"
+#include "util/ByteOrder.hxx"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_CRC_PCLMUL
+#elif defined(__aarch64__) && defined(__GNUC__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define HAVE_CRC_ARM
+#endif
+
+namespace Net {
+namespace Log {
+
+/**
+ * The lookup tables for the slice-by-8 algorithm.  table[0] is
+ * the classic bytewise table; table[k][i] is the CRC of byte i
+ * followed by k zero bytes.
+ */
+struct Crc32Table {
+	uint32_t table[8][256];
+
+	constexpr Crc32Table() noexcept:table() {
+		for (unsigned i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (unsigned j = 0; j < 8; ++j)
+				c = (c >> 1) ^ (0xedb88320 & (0 - (c & 1)));
+			table[0][i] = c;
+		}
+
+		for (unsigned i = 0; i < 256; ++i)
+			for (unsigned k = 1; k < 8; ++k)
+				table[k][i] = (table[k - 1][i] >> 8)
+					^ table[0][table[k - 1][i] & 0xff];
+	}
+};
+
+static constexpr Crc32Table crc32_table;
+
+static uint32_t
+LoadLE32(const uint8_t *p) noexcept
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return FromLE32(value);
+}
+
+static uint32_t
+UpdateCrc32Slice8(uint32_t crc, const uint8_t *p, size_t size) noexcept
+{
+	const auto &t = crc32_table.table;
+
+	for (; size >= 8; p += 8, size -= 8) {
+		const uint32_t a = LoadLE32(p) ^ crc;
+		const uint32_t b = LoadLE32(p + 4);
+
+		crc = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^
+			t[5][(a >> 16) & 0xff] ^ t[4][a >> 24] ^
+			t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^
+			t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+	}
+
+	for (; size > 0; ++p, --size)
+		crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+
+	return crc;
+}
+
+#ifdef HAVE_CRC_PCLMUL
+
+/**
+ * Fold the data with carry-less multiplication, as described in
+ * Intel's paper "Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction".
+ *
+ * @param size the number of bytes; must be a multiple of 16 and at
+ * least 64
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t
+UpdateCrc32Pclmul(uint32_t crc, const uint8_t *p, size_t size) noexcept
+{
+	/* the constants for the bit-reflected polynomial: x^(4*128+64)
+	   and x^(4*128) mod P, x^(128+64) and x^128 mod P, x^64 mod P,
+	   and the Barrett reduction constants P and mu */
+	alignas(16) static constexpr uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+	alignas(16) static constexpr uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+	alignas(16) static constexpr uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+	alignas(16) static constexpr uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+	__m128i x1 = _mm_loadu_si128((const __m128i *)(const void *)(p + 0x00));
+	__m128i x2 = _mm_loadu_si128((const __m128i *)(const void *)(p + 0x10));
+	__m128i x3 = _mm_loadu_si128((const __m128i *)(const void *)(p + 0x20));
+	__m128i x4 = _mm_loadu_si128((const __m128i *)(const void *)(p + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+
+	__m128i k = _mm_load_si128((const __m128i *)(const void *)k1k2);
+
+	p += 64;
+	size -= 64;
+
+	/* fold four 128 bit lanes in parallel */
+	for (; size >= 64; p += 64, size -= 64) {
+		const __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+		const __m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+		const __m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+		const __m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				   _mm_loadu_si128((const __m128i *)(const void *)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+				   _mm_loadu_si128((const __m128i *)(const void *)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+				   _mm_loadu_si128((const __m128i *)(const void *)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+				   _mm_loadu_si128((const __m128i *)(const void *)(p + 0x30)));
+	}
+
+	/* fold the four lanes into one */
+	k = _mm_load_si128((const __m128i *)(const void *)k3k4);
+
+	const __m128i lanes[] = {x2, x3, x4};
+	for (const __m128i &next : lanes) {
+		const __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+	}
+
+	/* fold the remaining 128 bit blocks */
+	for (; size >= 16; p += 16, size -= 16) {
+		const __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				   _mm_loadu_si128((const __m128i *)(const void *)p));
+	}
+
+	/* fold 128 bits to 64 bits */
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	k = _mm_loadl_epi64((const __m128i *)(const void *)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	k = _mm_load_si128((const __m128i *)(const void *)poly);
+
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, k, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, k, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t
+UpdateCrc32Hardware(uint32_t crc, const uint8_t *p, size_t size) noexcept
+{
+	if (size >= 64) {
+		const size_t n = size & ~size_t(15);
+		crc = UpdateCrc32Pclmul(crc, p, n);
+		p += n;
+		size -= n;
+	}
+
+	return UpdateCrc32Slice8(crc, p, size);
+}
+
+gcc_const
+static bool
+HaveHardwareCrc32() noexcept
+{
+	return __builtin_cpu_supports("pclmul") &&
+		__builtin_cpu_supports("sse4.1");
+}
+
+#elif defined(HAVE_CRC_ARM)
+
+__attribute__((target("+crc")))
+static uint32_t
+UpdateCrc32Hardware(uint32_t crc, const uint8_t *p, size_t size) noexcept
+{
+	for (; size >= 8; p += 8, size -= 8) {
+		uint64_t value;
+		memcpy(&value, p, sizeof(value));
+		crc = __crc32d(crc, FromLE64(value));
+	}
+
+	for (; size > 0; ++p, --size)
+		crc = __crc32b(crc, *p);
+
+	return crc;
+}
+
+gcc_const
+static bool
+HaveHardwareCrc32() noexcept
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#endif
+
+typedef uint32_t (*UpdateCrc32Function)(uint32_t crc,
+					const uint8_t *p, size_t size);
+
+static UpdateCrc32Function
+SelectUpdateCrc32() noexcept
+{
+#if defined(HAVE_CRC_PCLMUL) || defined(HAVE_CRC_ARM)
+	if (HaveHardwareCrc32())
+		return UpdateCrc32Hardware;
+#endif
+
+	return UpdateCrc32Slice8;
+}
+
+uint32_t
+UpdateCrc32(uint32_t crc, const void *p, size_t size) noexcept
+{
+	static const UpdateCrc32Function f = SelectUpdateCrc32();
+	return f(crc, (const uint8_t *)p, size);
+}
+
+}}
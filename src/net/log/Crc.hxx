@@ -32,14 +32,48 @@
 
 #pragma once
 
-#include <boost/crc.hpp>
+#include "util/Compiler.h"
+
+#include <stddef.h>
+#include <stdint.h>
 
 namespace Net {
 namespace Log {
 
 /**
- * The CRC algorithm.
+ * Update a CRC-32 (IEEE 802.3, reflected polynomial 0xedb88320)
+ * register with the specified data.  The register is neither
+ * pre-inverted nor post-inverted by this function.
+ *
+ * This uses carry-less multiplication (PCLMULQDQ) or the ARMv8 CRC32
+ * instructions if the CPU supports them, and falls back to a
+ * slice-by-8 table implementation.
+ */
+gcc_pure
+uint32_t
+UpdateCrc32(uint32_t crc, const void *p, size_t size) noexcept;
+
+/**
+ * The CRC algorithm.  It produces the same results as
+ * boost::crc_32_type and implements a subset of its interface.
  */
-using Crc = boost::crc_32_type;
+class Crc {
+	uint32_t state = 0xffffffff;
+
+public:
+	typedef uint32_t value_type;
+
+	void reset() noexcept {
+		state = 0xffffffff;
+	}
+
+	void process_bytes(const void *p, size_t size) noexcept {
+		state = UpdateCrc32(state, p, size);
+	}
+
+	value_type checksum() const noexcept {
+		return ~state;
+	}
+};
 
 }}
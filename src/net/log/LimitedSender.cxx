@@ -0,0 +1,129 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "LimitedSender.hxx"
+#include "Send.hxx"
+#include "Datagram.hxx"
+#include "util/FNVHash.hxx"
+
+#include <algorithm>
+
+#include <stdio.h>
+
+namespace Net {
+namespace Log {
+
+LimitedSender::LimitedSender(SocketDescriptor _socket,
+			     const Config &_config) noexcept
+	:socket(_socket), config(_config)
+{
+	std::fill_n(sample_counters, N_SAMPLE_SLOTS, 0);
+}
+
+gcc_pure
+static uint32_t
+SampleKey(const Datagram &d) noexcept
+{
+	using Traits = FNVTraits<uint32_t>;
+	using Algorithm = FNV1aAlgorithm<Traits>;
+
+	Traits::fast_type hash = d.site != nullptr
+		? FNV1aHash32(d.site)
+		: Traits::OFFSET_BASIS;
+
+	const unsigned status = d.valid_http_status
+		? unsigned(d.http_status)
+		: 0;
+	hash = Algorithm::Update(hash, status);
+	hash = Algorithm::Update(hash, status >> 8);
+
+	return hash;
+}
+
+inline bool
+LimitedSender::Sample(const Datagram &d) noexcept
+{
+	if (config.sample_n <= 1)
+		return true;
+
+	auto &counter = sample_counters[SampleKey(d) % N_SAMPLE_SLOTS];
+	const bool result = counter == 0;
+	if (++counter >= config.sample_n)
+		counter = 0;
+	return result;
+}
+
+bool
+LimitedSender::Send(const Datagram &d, TimePoint now)
+{
+	Flush(now);
+
+	if (!Sample(d) ||
+	    (config.rate > 0 &&
+	     !bucket.Check(now, config.rate, config.burst))) {
+		if (n_suppressed++ == 0)
+			next_summary = now + config.summary_interval;
+		++total_suppressed;
+		return false;
+	}
+
+	Net::Log::Send(socket, d);
+	return true;
+}
+
+void
+LimitedSender::Flush(TimePoint now)
+{
+	if (n_suppressed > 0 && now >= next_summary)
+		SendSummary(now);
+}
+
+void
+LimitedSender::SendSummary(TimePoint now)
+{
+	char buffer[64];
+	int length = snprintf(buffer, sizeof(buffer),
+			      "%llu log records suppressed",
+			      (unsigned long long)n_suppressed);
+
+	Datagram d(StringView(buffer, length));
+	d.SetTimestamp(std::chrono::system_clock::now());
+
+	/* reset before sending, so a send error doesn't cause a
+	   summary flood */
+	n_suppressed = 0;
+	next_summary = now + config.summary_interval;
+
+	Net::Log::Send(socket, d);
+}
+
+}}
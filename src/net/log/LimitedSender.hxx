@@ -0,0 +1,153 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/TokenBucket.hxx"
+#include "net/SocketDescriptor.hxx"
+#include "util/Compiler.h"
+
+#include <chrono>
+
+#include <stdint.h>
+
+namespace Net {
+namespace Log {
+
+struct Datagram;
+
+/**
+ * A wrapper for Send() which protects the log server from floods:
+ * a deterministic per-key sampler (keyed by site and HTTP status)
+ * and a token bucket decide whether a datagram gets sent.
+ * Suppressed datagrams are counted, and a summary message ("N log
+ * records suppressed") is sent periodically.
+ *
+ * This class does not use the event loop; the caller passes the
+ * current time to each method.
+ */
+class LimitedSender {
+public:
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	struct Config {
+		/**
+		 * The number of datagrams per second allowed by the
+		 * token bucket.  Zero disables the rate limiter.
+		 */
+		double rate = 0;
+
+		/**
+		 * The capacity of the token bucket.
+		 */
+		double burst = 0;
+
+		/**
+		 * Send only every Nth datagram per key.  1 disables
+		 * sampling.
+		 */
+		unsigned sample_n = 1;
+
+		/**
+		 * The minimum interval between two summary messages.
+		 */
+		std::chrono::steady_clock::duration summary_interval =
+			std::chrono::seconds(10);
+	};
+
+private:
+	const SocketDescriptor socket;
+
+	const Config config;
+
+	TokenBucket bucket;
+
+	/**
+	 * Per-key counters for the sampler.  Keys are hashed into a
+	 * fixed number of slots; collisions only make the sampling
+	 * slightly coarser.
+	 */
+	static constexpr size_t N_SAMPLE_SLOTS = 256;
+	uint32_t sample_counters[N_SAMPLE_SLOTS];
+
+	/**
+	 * The number of datagrams suppressed since the last summary.
+	 */
+	uint64_t n_suppressed = 0;
+
+	uint64_t total_suppressed = 0;
+
+	TimePoint next_summary;
+
+public:
+	LimitedSender(SocketDescriptor _socket, const Config &_config) noexcept;
+
+	/**
+	 * Send the datagram unless it is suppressed by the sampler
+	 * or the rate limiter.  Also sends a pending summary if it
+	 * is due.
+	 *
+	 * Throws on error.
+	 *
+	 * @return true if the datagram was sent, false if it was
+	 * suppressed
+	 */
+	bool Send(const Datagram &d, TimePoint now);
+
+	/**
+	 * Send a summary message if datagrams were suppressed and
+	 * the summary interval has elapsed.  Call this periodically
+	 * to avoid losing the summary when there is no more traffic.
+	 *
+	 * Throws on error.
+	 */
+	void Flush(TimePoint now);
+
+	/**
+	 * The total number of suppressed datagrams since this object
+	 * was constructed.
+	 */
+	uint64_t GetSuppressed() const noexcept {
+		return total_suppressed;
+	}
+
+private:
+	/**
+	 * Shall this datagram pass the sampling filter?  This updates
+	 * #sample_counters.
+	 */
+	bool Sample(const Datagram &d) noexcept;
+
+	void SendSummary(TimePoint now);
+};
+
+}}
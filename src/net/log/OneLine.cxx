@@ -32,174 +32,365 @@
 
 #include "OneLine.hxx"
 #include "Datagram.hxx"
-#include "io/FileDescriptor.hxx"
-#include "util/StringBuffer.hxx"
+#include "util/DecimalFormat.h"
+#include "util/StringView.hxx"
 
-#include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <string.h>
 #include <time.h>
 
-template<size_t capacity>
-static const char *
-FormatTimestamp(StringBuffer<capacity> &buffer, uint64_t value)
+/**
+ * The maximum length of a formatted time stamp.
+ */
+static constexpr size_t MAX_TIMESTAMP = 32;
+
+/* the maximum lengths of escaped strings */
+static constexpr size_t MAX_URI = 4096 - 4;
+static constexpr size_t MAX_REFERER = 2048 - 4;
+static constexpr size_t MAX_USER_AGENT = 1024 - 4;
+static constexpr size_t MAX_MESSAGE = 4096 - 4;
+
+/**
+ * Formats time stamps, and remembers the last one, because
+ * consecutive log records usually have the same second.
+ */
+class OneLineTimestampCache {
+	uint64_t second = UINT64_MAX;
+	size_t length;
+	char buffer[MAX_TIMESTAMP];
+
+public:
+	StringView Format(uint64_t value) noexcept {
+		const uint64_t new_second = value / 1000000;
+		if (new_second != second) {
+			time_t t = new_second;
+			struct tm tm;
+			length = strftime(buffer, sizeof(buffer),
+					  "%d/%b/%Y:%H:%M:%S %z",
+					  localtime_r(&t, &tm));
+			second = new_second;
+		}
+
+		return {buffer, length};
+	}
+};
+
+static bool
+IsHarmlessChar(signed char ch)
 {
-	time_t t = value / 1000000;
-	struct tm tm;
-	strftime(buffer.data(), buffer.capacity(),
-		 "%d/%b/%Y:%H:%M:%S %z", localtime_r(&t, &tm));
-	return buffer.c_str();
+	return ch >= 0x20 && ch != '"' && ch != '\\';
 }
 
-template<size_t capacity>
-static const char *
-FormatOptionalTimestamp(StringBuffer<capacity> &buffer, bool valid,
-			uint64_t value)
+static char *
+Append(char *p, StringView s) noexcept
 {
-	return valid
-		? FormatTimestamp(buffer, value)
-		: "-";
+	memcpy(p, s.data, s.size);
+	return p + s.size;
 }
 
-static const char *
-OptionalString(const char *p)
+static char *
+Append(char *p, char ch) noexcept
 {
-	if (p == nullptr)
-		return "-";
-
+	*p++ = ch;
 	return p;
 }
 
-static bool
-IsHarmlessChar(signed char ch)
+static char *
+AppendOptional(char *p, const char *s) noexcept
 {
-	return ch >= 0x20 && ch != '"' && ch != '\\';
+	return Append(p, s != nullptr ? StringView(s) : StringView("-"));
 }
 
-static const char *
-EscapeString(const char *value, char *const buffer, size_t buffer_size)
+static char *
+AppendUnsigned(char *p, uint64_t value) noexcept
 {
-	char *p = buffer, *const buffer_limit = buffer + buffer_size - 4;
-	char ch;
-	while (p < buffer_limit && (ch = *value++) != 0) {
-		if (IsHarmlessChar(ch))
-			*p++ = ch;
-		else
-			p += sprintf(p, "\\x%02X", (unsigned char)ch);
-	}
+	char buffer[32];
+	const size_t length = format_uint64(buffer, value);
+	return Append(p, {buffer, length});
+}
 
-	*p = 0;
-	return buffer;
+static char *
+AppendEscapedChar(char *p, unsigned char ch) noexcept
+{
+	static constexpr char hex_digits[] = "0123456789ABCDEF";
+	*p++ = '\\';
+	*p++ = 'x';
+	*p++ = hex_digits[ch >> 4];
+	*p++ = hex_digits[ch & 0xf];
+	return p;
 }
 
-static const char *
-EscapeString(StringView value, char *const buffer, size_t buffer_size)
+#ifdef __SSE2__
+
+/**
+ * Find the first character in the 16 bytes which is not
+ * IsHarmlessChar().
+ *
+ * @return the index or 16 if all characters are harmless
+ */
+static unsigned
+FindHarmful16(const char *p) noexcept
 {
-	char *p = buffer, *const buffer_limit = buffer + buffer_size - 4;
+	const __m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
 
-	for (char ch : value) {
-		if (p >= buffer_limit)
+	/* the signed comparison also catches all bytes >= 0x80, just
+	   like IsHarmlessChar() */
+	const __m128i harmful =
+		_mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x20)),
+			     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+					  _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+
+	const unsigned mask = _mm_movemask_epi8(harmful);
+	return mask != 0
+		? __builtin_ctz(mask)
+		: 16;
+}
+
+#endif
+
+/**
+ * Append the string, escaping all characters which are not
+ * IsHarmlessChar().  Stops (before the next character) when at least
+ * #max_length characters have been written.
+ */
+static char *
+AppendEscaped(char *p, StringView value, size_t max_length) noexcept
+{
+	char *const limit = p + max_length;
+	const char *src = value.begin(), *const end = value.end();
+
+	while (src < end && p < limit) {
+#ifdef __SSE2__
+		/* copy runs of harmless characters 16 bytes at a
+		   time */
+		while (end - src >= 16) {
+			const size_t n = FindHarmful16(src);
+			const size_t room = limit - p;
+			if (n >= room) {
+				memcpy(p, src, room);
+				return p + room;
+			}
+
+			memcpy(p, src, n);
+			p += n;
+			src += n;
+
+			if (n < 16)
+				break;
+		}
+
+		if (src == end)
 			break;
+#endif
 
+		const char ch = *src++;
 		if (IsHarmlessChar(ch))
 			*p++ = ch;
 		else
-			p += sprintf(p, "\\x%02X", (unsigned char)ch);
+			p = AppendEscapedChar(p, ch);
 	}
 
-	*p = 0;
-	return buffer;
+	return p;
 }
 
-static void
-LogOneLineHttp(FileDescriptor fd, const Net::Log::Datagram &d,
-	       bool site)
+static char *
+AppendEscaped(char *p, const char *value, size_t max_length) noexcept
 {
-	const char *method = d.valid_http_method &&
-		http_method_is_valid(d.http_method)
-		? http_method_to_string(d.http_method)
-		: "?";
+	return AppendEscaped(p, StringView(value), max_length);
+}
 
-	StringBuffer<32> stamp_buffer;
-	const char *stamp =
-		FormatOptionalTimestamp(stamp_buffer, d.valid_timestamp,
-					d.timestamp);
-
-	char length_buffer[32];
-	const char *length = "-";
-	if (d.valid_length) {
-		snprintf(length_buffer, sizeof(length_buffer), "%llu",
-			 (unsigned long long)d.length);
-		length = length_buffer;
+static char *
+AppendSite(char *p, const Net::Log::Datagram &d, bool site) noexcept
+{
+	if (site) {
+		p = AppendOptional(p, d.site);
+		p = Append(p, ' ');
 	}
 
-	char duration_buffer[32];
-	const char *duration = "-";
-	if (d.valid_duration) {
-		snprintf(duration_buffer, sizeof(duration_buffer), "%llu",
-			 (unsigned long long)d.duration);
-		duration = duration_buffer;
-	}
+	return p;
+}
+
+static char *
+AppendTimestamp(char *p, const Net::Log::Datagram &d,
+		OneLineTimestampCache &cache) noexcept
+{
+	return d.valid_timestamp
+		? Append(p, cache.Format(d.timestamp))
+		: Append(p, '-');
+}
 
-	char escaped_uri[4096], escaped_referer[2048], escaped_ua[1024];
+static size_t
+OptionalLength(const char *s) noexcept
+{
+	return s != nullptr ? strlen(s) : 1;
+}
 
+/**
+ * Calculate an upper bound for the length of the line (including
+ * the trailing newline) which will be formatted for this datagram.
+ *
+ * @return the length or 0 if nothing will be logged for this datagram
+ */
+gcc_pure
+static size_t
+GetMaxLineLength(const Net::Log::Datagram &d, bool site) noexcept
+{
+	/* space for delimiters, numbers, method and escape
+	   overshoot */
+	constexpr size_t SLACK = 256;
+
+	size_t length = SLACK + MAX_TIMESTAMP;
 	if (site)
-		dprintf(fd.Get(),
-			"%s %s - - [%s] \"%s %s HTTP/1.1\" %u %s \"%s\" \"%s\" %s\n",
-			OptionalString(d.site),
-			OptionalString(d.remote_host),
-			stamp, method,
-			EscapeString(d.http_uri, escaped_uri, sizeof(escaped_uri)),
-			d.http_status, length,
-			EscapeString(OptionalString(d.http_referer),
-				     escaped_referer, sizeof(escaped_referer)),
-			EscapeString(OptionalString(d.user_agent),
-				     escaped_ua, sizeof(escaped_ua)),
-			duration);
+		length += OptionalLength(d.site);
+
+	if (d.http_uri != nullptr && d.valid_http_status)
+		length += OptionalLength(d.remote_host) +
+			MAX_URI + MAX_REFERER + MAX_USER_AGENT;
+	else if (d.message != nullptr)
+		length += MAX_MESSAGE;
 	else
-		dprintf(fd.Get(),
-			"%s - - [%s] \"%s %s HTTP/1.1\" %u %s \"%s\" \"%s\" %s\n",
-			OptionalString(d.remote_host),
-			stamp, method,
-			EscapeString(d.http_uri, escaped_uri, sizeof(escaped_uri)),
-			d.http_status, length,
-			EscapeString(OptionalString(d.http_referer),
-				     escaped_referer, sizeof(escaped_referer)),
-			EscapeString(OptionalString(d.user_agent),
-				     escaped_ua, sizeof(escaped_ua)),
-			duration);
+		return 0;
+
+	return length;
 }
 
-static void
-LogOneLineMessage(FileDescriptor fd, const Net::Log::Datagram &d,
-		  bool site)
+static char *
+FormatOneLineHttp(char *p, const Net::Log::Datagram &d, bool site,
+		  OneLineTimestampCache &cache) noexcept
 {
+	const char *method = d.valid_http_method &&
+		http_method_is_valid(d.http_method)
+		? http_method_to_string(d.http_method)
+		: "?";
 
-	StringBuffer<32> stamp_buffer;
-	const char *stamp =
-		FormatOptionalTimestamp(stamp_buffer, d.valid_timestamp,
-					d.timestamp);
+	p = AppendSite(p, d, site);
+	p = AppendOptional(p, d.remote_host);
+	p = Append(p, " - - [");
+	p = AppendTimestamp(p, d, cache);
+	p = Append(p, "] \"");
+	p = Append(p, method);
+	p = Append(p, ' ');
+	p = AppendEscaped(p, d.http_uri, MAX_URI);
+	p = Append(p, " HTTP/1.1\" ");
+	p = AppendUnsigned(p, unsigned(d.http_status));
+	p = Append(p, ' ');
 
-	char escaped_message[4096];
+	if (d.valid_length)
+		p = AppendUnsigned(p, d.length);
+	else
+		p = Append(p, '-');
 
-	if (site)
-		dprintf(fd.Get(),
-			"%s [%s] %s\n",
-			OptionalString(d.site),
-			stamp,
-			EscapeString(d.message, escaped_message,
-				     sizeof(escaped_message)));
+	p = Append(p, " \"");
+	p = AppendEscaped(p, d.http_referer != nullptr ? d.http_referer : "-",
+			  MAX_REFERER);
+	p = Append(p, "\" \"");
+	p = AppendEscaped(p, d.user_agent != nullptr ? d.user_agent : "-",
+			  MAX_USER_AGENT);
+	p = Append(p, "\" ");
+
+	if (d.valid_duration)
+		p = AppendUnsigned(p, d.duration);
 	else
-		dprintf(fd.Get(),
-			"[%s] %s\n",
-			stamp,
-			EscapeString(d.message, escaped_message,
-				     sizeof(escaped_message)));}
+		p = Append(p, '-');
 
+	return Append(p, '\n');
+}
 
-void
-LogOneLine(FileDescriptor fd, const Net::Log::Datagram &d, bool site)
+static char *
+FormatOneLineMessage(char *p, const Net::Log::Datagram &d, bool site,
+		     OneLineTimestampCache &cache) noexcept
+{
+	p = AppendSite(p, d, site);
+	p = Append(p, '[');
+	p = AppendTimestamp(p, d, cache);
+	p = Append(p, "] ");
+	p = AppendEscaped(p, d.message, MAX_MESSAGE);
+	return Append(p, '\n');
+}
+
+/**
+ * Format the line into the buffer, which must be at least
+ * GetMaxLineLength() bytes large.
+ *
+ * @return the end of the line
+ */
+static char *
+FormatOneLine(char *p, const Net::Log::Datagram &d, bool site,
+	      OneLineTimestampCache &cache) noexcept
 {
 	if (d.http_uri != nullptr && d.valid_http_status)
-		LogOneLineHttp(fd, d, site);
+		return FormatOneLineHttp(p, d, site, cache);
 	else if (d.message != nullptr)
-		LogOneLineMessage(fd, d, site);
+		return FormatOneLineMessage(p, d, site, cache);
+	else
+		return p;
+}
+
+void
+LogOneLine(FileDescriptor fd, const Net::Log::Datagram &d, bool site)
+{
+	const size_t max_length = GetMaxLineLength(d, site);
+	if (max_length == 0)
+		return;
+
+	std::unique_ptr<char[]> buffer(new char[max_length]);
+	OneLineTimestampCache cache;
+	const char *end = FormatOneLine(buffer.get(), d, site, cache);
+	fd.Write(buffer.get(), end - buffer.get());
+}
+
+OneLineWriter::OneLineWriter(FileDescriptor _fd, bool _site,
+			     size_t _capacity)
+	:fd(_fd), site(_site),
+	 capacity(_capacity), buffer(new char[capacity]),
+	 timestamp_cache(new OneLineTimestampCache()) {}
+
+OneLineWriter::~OneLineWriter() noexcept
+{
+	Flush();
+}
+
+void
+OneLineWriter::Append(const Net::Log::Datagram &d)
+{
+	const size_t max_length = GetMaxLineLength(d, site);
+	if (max_length == 0)
+		return;
+
+	if (max_length > capacity - fill) {
+		Flush();
+
+		if (max_length > capacity) {
+			/* doesn't fit into the buffer at all */
+			std::unique_ptr<char[]> tmp(new char[max_length]);
+			const char *end = FormatOneLine(tmp.get(), d, site,
+							*timestamp_cache);
+			fd.Write(tmp.get(), end - tmp.get());
+			return;
+		}
+	}
+
+	char *p = buffer.get() + fill;
+	fill = FormatOneLine(p, d, site, *timestamp_cache) - buffer.get();
+}
+
+void
+OneLineWriter::Flush() noexcept
+{
+	const char *p = buffer.get();
+	while (fill > 0) {
+		ssize_t nbytes = fd.Write(p, fill);
+		if (nbytes <= 0)
+			/* errors are ignored, just like LogOneLine()
+			   does */
+			break;
+
+		p += nbytes;
+		fill -= nbytes;
+	}
+
+	fill = 0;
 }
@@ -32,8 +32,14 @@
 
 #pragma once
 
+#include "io/FileDescriptor.hxx"
+
+#include <memory>
+
+#include <stddef.h>
+
 namespace Net { namespace Log { struct Datagram; }}
-class FileDescriptor;
+class OneLineTimestampCache;
 
 /**
  * Print the #Net::Log::Datagram in one line, similar to Apache's
@@ -44,3 +50,51 @@ class FileDescriptor;
 void
 LogOneLine(FileDescriptor fd, const Net::Log::Datagram &d,
 	   bool site=true);
+
+/**
+ * Like LogOneLine(), but collects the lines in a buffer and writes
+ * them with one write() call when the buffer is full or when
+ * Flush() is called.  Write errors are ignored.
+ */
+class OneLineWriter {
+	FileDescriptor fd;
+
+	const bool site;
+
+	const size_t capacity;
+	const std::unique_ptr<char[]> buffer;
+	size_t fill = 0;
+
+	const std::unique_ptr<OneLineTimestampCache> timestamp_cache;
+
+public:
+	/**
+	 * @param _fd the file descriptor (owned by caller)
+	 * @param _site log the site name?
+	 * @param _capacity the size of the buffer
+	 */
+	explicit OneLineWriter(FileDescriptor _fd, bool _site=true,
+			       size_t _capacity=65536);
+
+	/**
+	 * Flushes the buffer.
+	 */
+	~OneLineWriter() noexcept;
+
+	OneLineWriter(const OneLineWriter &) = delete;
+	OneLineWriter &operator=(const OneLineWriter &) = delete;
+
+	/**
+	 * Format one line into the buffer, flushing it first if the
+	 * line might not fit.  A line which is larger than the
+	 * whole buffer (because of a long site name or remote host)
+	 * is formatted into a temporary allocation and written
+	 * directly.
+	 *
+	 * Throws std::bad_alloc if that allocation fails; the buffer
+	 * has been flushed then, and the line is lost.
+	 */
+	void Append(const Net::Log::Datagram &d);
+
+	void Flush() noexcept;
+};
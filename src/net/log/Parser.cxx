@@ -79,6 +79,31 @@ read_uint64(uint64_t *value_r, const void *p, const uint8_t *end)
 	return src + 1;
 }
 
+/**
+ * Read an unsigned LEB128 integer.
+ */
+static const void *
+read_varint(uint64_t *value_r, const void *p, const uint8_t *end)
+{
+	auto src = (const uint8_t *)p;
+	uint64_t value = 0;
+
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		if (src >= end)
+			return nullptr;
+
+		const uint8_t byte = *src++;
+		value |= uint64_t(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			*value_r = value;
+			return src;
+		}
+	}
+
+	/* too long */
+	return nullptr;
+}
+
 static const void *
 read_string(const char **value_r, const void *p, const uint8_t *end)
 {
@@ -217,6 +242,10 @@ log_server_apply_attributes(const void *p, const uint8_t *end)
 		case Attribute::TYPE:
 			p = read_uint8(&(uint8_t &)datagram.type, p, end);
 			break;
+
+		case Attribute::TIMESTAMP_BASE:
+			/* not allowed in V1/V2 */
+			throw ProtocolError();
 		}
 
 		if (p == nullptr)
@@ -224,8 +253,283 @@ log_server_apply_attributes(const void *p, const uint8_t *end)
 	}
 }
 
+/**
+ * Like read_string(), but never reads past the end.
+ */
+static const void *
+ReadCompactString(const char **value_r, const void *p, const uint8_t *end)
+{
+	auto src = (const uint8_t *)p;
+	if (src >= end)
+		return nullptr;
+
+	auto nul = (const uint8_t *)memchr(src, 0, end - src);
+	if (nul == nullptr)
+		return nullptr;
+
+	*value_r = (const char *)src;
+	return nul + 1;
+}
+
+/**
+ * @return false if the attribute is not a string
+ */
+static bool
+SetStringAttribute(Datagram &d, Attribute attr, const char *value) noexcept
+{
+	switch (attr) {
+	case Attribute::REMOTE_HOST:
+		d.remote_host = value;
+		return true;
+
+	case Attribute::FORWARDED_TO:
+		d.forwarded_to = value;
+		return true;
+
+	case Attribute::HOST:
+		d.host = value;
+		return true;
+
+	case Attribute::SITE:
+		d.site = value;
+		return true;
+
+	case Attribute::HTTP_URI:
+		d.http_uri = value;
+		return true;
+
+	case Attribute::HTTP_REFERER:
+		d.http_referer = value;
+		return true;
+
+	case Attribute::USER_AGENT:
+		d.user_agent = value;
+		return true;
+
+	case Attribute::MESSAGE:
+		d.message = value;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+const char *
+CompactDecoder::Lookup(uint32_t id) const noexcept
+{
+	auto i = dictionary.find(id);
+	return i != dictionary.end()
+		? i->second.c_str()
+		: nullptr;
+}
+
+void
+CompactDecoder::Define(uint32_t id, const char *value)
+{
+	if (dictionary.size() < MAX_ENTRIES)
+		dictionary.emplace(id, value);
+}
+
+bool
+CompactDecoder::UpdateEpoch(uint32_t _epoch) noexcept
+{
+	if (have_epoch && _epoch == epoch)
+		return true;
+
+	if (have_previous_epoch && _epoch == previous_epoch)
+		/* a late datagram */
+		return false;
+
+	previous_epoch = epoch;
+	have_previous_epoch = have_epoch;
+	epoch = _epoch;
+	have_epoch = true;
+	Reset();
+	return true;
+}
+
 Datagram
-Net::Log::ParseDatagram(ConstBuffer<void> _d)
+CompactDecoder::ParseCompact(ConstBuffer<void> _payload, CompactDecoder *state)
+{
+	const auto payload = ConstBuffer<uint8_t>::FromVoid(_payload);
+	const void *p = payload.begin();
+	const uint8_t *const end = payload.end();
+
+	uint64_t u64;
+	p = read_varint(&u64, p, end);
+	if (p == nullptr || u64 > UINT32_MAX)
+		throw ProtocolError();
+
+	if (state != nullptr && !state->UpdateEpoch(uint32_t(u64)))
+		state = nullptr;
+
+	Datagram datagram;
+
+	uint64_t timestamp_delta, timestamp_base;
+	bool have_timestamp_delta = false, have_timestamp_base = false;
+
+	while (p < (const void *)end) {
+		auto attr_p = (const uint8_t *)p;
+		const uint8_t code = *attr_p++;
+		p = attr_p;
+
+		const uint8_t flags = code & (ATTRIBUTE_DEFINE|ATTRIBUTE_REFERENCE);
+		const auto attr = Attribute(code & ~flags);
+
+		const char *value;
+
+		if (flags != 0) {
+			p = read_varint(&u64, p, end);
+			if (p == nullptr || u64 > UINT32_MAX)
+				throw ProtocolError();
+
+			const uint32_t id = u64;
+
+			if (flags == ATTRIBUTE_DEFINE) {
+				p = ReadCompactString(&value, p, end);
+				if (p == nullptr)
+					throw ProtocolError();
+
+				if (state != nullptr)
+					state->Define(id, value);
+			} else if (flags == ATTRIBUTE_REFERENCE) {
+				value = state != nullptr
+					? state->Lookup(id)
+					: nullptr;
+			} else
+				throw ProtocolError();
+
+			if (!SetStringAttribute(datagram, attr, value))
+				throw ProtocolError();
+
+			continue;
+		}
+
+		switch (attr) {
+			uint8_t u8;
+
+		case Attribute::NOP:
+			break;
+
+		case Attribute::TIMESTAMP:
+			p = read_varint(&timestamp_delta, p, end);
+			have_timestamp_delta = true;
+			break;
+
+		case Attribute::TIMESTAMP_BASE:
+			p = read_varint(&timestamp_base, p, end);
+			have_timestamp_base = true;
+			if (p != nullptr && state != nullptr)
+				state->SetTimestampBase(timestamp_base);
+			break;
+
+		case Attribute::REMOTE_HOST:
+		case Attribute::FORWARDED_TO:
+		case Attribute::HOST:
+		case Attribute::SITE:
+		case Attribute::HTTP_URI:
+		case Attribute::HTTP_REFERER:
+		case Attribute::USER_AGENT:
+		case Attribute::MESSAGE:
+			p = ReadCompactString(&value, p, end);
+			if (p != nullptr)
+				SetStringAttribute(datagram, attr, value);
+			break;
+
+		case Attribute::HTTP_METHOD:
+			p = read_uint8(&u8, p, end);
+			if (p == nullptr)
+				throw ProtocolError();
+
+			datagram.http_method = http_method_t(u8);
+			if (!http_method_is_valid(datagram.http_method))
+				throw ProtocolError();
+
+			datagram.valid_http_method = true;
+			break;
+
+		case Attribute::HTTP_STATUS:
+			p = read_varint(&u64, p, end);
+			if (p == nullptr || u64 > UINT16_MAX)
+				throw ProtocolError();
+
+			datagram.http_status = http_status_t(u64);
+			if (!http_status_is_valid(datagram.http_status))
+				throw ProtocolError();
+
+			datagram.valid_http_status = true;
+			break;
+
+		case Attribute::LENGTH:
+			p = read_varint(&datagram.length, p, end);
+			datagram.valid_length = true;
+			break;
+
+		case Attribute::TRAFFIC:
+			p = read_varint(&datagram.traffic_received, p, end);
+			if (p != nullptr)
+				p = read_varint(&datagram.traffic_sent, p, end);
+			datagram.valid_traffic = true;
+			break;
+
+		case Attribute::DURATION:
+			p = read_varint(&datagram.duration, p, end);
+			datagram.valid_duration = true;
+			break;
+
+		case Attribute::TYPE:
+			p = read_uint8(&(uint8_t &)datagram.type, p, end);
+			break;
+
+		default:
+			/* a newer attribute whose size we don't know;
+			   ignore the rest */
+			p = end;
+			break;
+		}
+
+		if (p == nullptr)
+			throw ProtocolError();
+	}
+
+	if (have_timestamp_delta) {
+		if (!have_timestamp_base && state != nullptr)
+			have_timestamp_base =
+				state->GetTimestampBase(timestamp_base);
+
+		if (have_timestamp_base) {
+			datagram.timestamp = timestamp_base + timestamp_delta;
+			datagram.valid_timestamp = true;
+		}
+	}
+
+	FixUp(datagram);
+	return datagram;
+}
+
+Datagram
+CompactDecoder::Parse(ConstBuffer<void> d)
+{
+	bool compact;
+	const auto payload = GetDatagramPayload(d, true, compact);
+	if (compact)
+		return ParseCompact(payload, this);
+
+	const auto v = ConstBuffer<uint8_t>::FromVoid(payload);
+	return log_server_apply_attributes(v.data, v.data + v.size);
+}
+
+ConstBuffer<void>
+Net::Log::GetDatagramPayload(ConstBuffer<void> _d, bool verify_crc)
+{
+	bool compact;
+	return GetDatagramPayload(_d, verify_crc, compact);
+}
+
+ConstBuffer<void>
+Net::Log::GetDatagramPayload(ConstBuffer<void> _d, bool verify_crc,
+			     bool &compact_r)
 {
 	auto d = ConstBuffer<uint8_t>::FromVoid(_d);
 
@@ -235,7 +539,9 @@ Net::Log::ParseDatagram(ConstBuffer<void> _d)
 
 	d.MoveFront((const uint8_t *)(magic + 1));
 
-	if (*magic == ToBE32(MAGIC_V2)) {
+	compact_r = *magic == ToBE32(MAGIC_V3);
+
+	if (*magic == ToBE32(MAGIC_V2) || compact_r) {
 		if (d.size < sizeof(Crc::value_type))
 			throw ProtocolError();
 
@@ -244,13 +550,15 @@ Net::Log::ParseDatagram(ConstBuffer<void> _d)
 			(d.data + d.size - sizeof(Crc::value_type));
 		d.SetEnd((const uint8_t *)&expected_crc);
 
-		Crc crc;
-		crc.reset();
-		crc.process_bytes(d.data, d.size);
-		if (crc.checksum() != FromBE32(expected_crc))
-			throw ProtocolError();
+		if (verify_crc) {
+			Crc crc;
+			crc.reset();
+			crc.process_bytes(d.data, d.size);
+			if (crc.checksum() != FromBE32(expected_crc))
+				throw ProtocolError();
+		}
 
-		return log_server_apply_attributes(d.data, d.data + d.size);
+		return d.ToVoid();
 	}
 
 	/* allow both little-endian and big-endian magic in the V1
@@ -259,6 +567,29 @@ Net::Log::ParseDatagram(ConstBuffer<void> _d)
 	if (*magic != ToLE32(MAGIC_V1) && *magic != ToBE32(MAGIC_V1))
 		throw ProtocolError();
 
+	return d.ToVoid();
+}
+
+bool
+Net::Log::VerifyDatagramCrc(ConstBuffer<void> d) noexcept
+{
+	try {
+		GetDatagramPayload(d, true);
+		return true;
+	} catch (const ProtocolError &) {
+		return false;
+	}
+}
+
+Datagram
+Net::Log::ParseDatagram(ConstBuffer<void> _d)
+{
+	bool compact;
+	const auto payload = GetDatagramPayload(_d, true, compact);
+	if (compact)
+		return CompactDecoder::ParseCompact(payload, nullptr);
+
+	const auto d = ConstBuffer<uint8_t>::FromVoid(payload);
 	return log_server_apply_attributes(d.data, d.data + d.size);
 }
 
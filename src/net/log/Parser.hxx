@@ -32,6 +32,13 @@
 
 #pragma once
 
+#include "util/Compiler.h"
+
+#include <string>
+#include <unordered_map>
+
+#include <stdint.h>
+
 template<typename T> struct ConstBuffer;
 
 namespace Net {
@@ -42,6 +49,12 @@ struct Datagram;
 class ProtocolError {};
 
 /**
+ * Parse a datagram of any protocol version.  Since this function has
+ * no state, dictionary references and relative time stamps in
+ * #MAGIC_V3 datagrams can only be resolved if their definition is in
+ * the same datagram; the others are omitted.  Use #CompactDecoder to
+ * resolve them.
+ *
  * Throws #ProtocolError on error.
  */
 Datagram
@@ -50,4 +63,120 @@ ParseDatagram(ConstBuffer<void> d);
 Datagram
 ParseDatagram(const void *p, const void *end);
 
+/**
+ * Check the magic and (optionally) the CRC of a datagram, and return
+ * the attribute payload between them.
+ *
+ * Throws #ProtocolError on error.
+ *
+ * @param verify_crc false skips the CRC check; the caller may check it
+ * later with VerifyDatagramCrc()
+ */
+ConstBuffer<void>
+GetDatagramPayload(ConstBuffer<void> d, bool verify_crc=true);
+
+/**
+ * Like GetDatagramPayload(), but also reports whether the payload
+ * uses the compact #MAGIC_V3 encoding.
+ */
+ConstBuffer<void>
+GetDatagramPayload(ConstBuffer<void> d, bool verify_crc, bool &compact_r);
+
+/**
+ * Check the CRC of a datagram (which has been parsed already).
+ * Datagrams of protocol version 1 have no CRC and always pass.
+ */
+gcc_pure
+bool
+VerifyDatagramCrc(ConstBuffer<void> d) noexcept;
+
+/**
+ * Parses datagrams from one sender, remembering its #MAGIC_V3
+ * dictionary and timestamp base (see #CompactSerializer).  Use one
+ * instance per sender (e.g. per source address).
+ */
+class CompactDecoder {
+	/**
+	 * Limit the memory a (misbehaving) sender can occupy; further
+	 * definitions are used only for the datagram which contains
+	 * them.
+	 */
+	static constexpr size_t MAX_ENTRIES = 4096;
+
+	uint32_t epoch, previous_epoch;
+
+	uint64_t timestamp_base;
+
+	bool have_epoch = false, have_previous_epoch = false;
+	bool have_timestamp_base = false;
+
+	std::unordered_map<uint32_t, std::string> dictionary;
+
+public:
+	/**
+	 * Parse a datagram of any protocol version.  The strings of
+	 * the returned #Datagram point into the given buffer or into
+	 * this object; they are valid until the next Parse() call.
+	 *
+	 * Late datagrams of the previous epoch are parsed without
+	 * the dictionary, just like ParseDatagram() does; any other
+	 * epoch number starts a new epoch (the sender may have been
+	 * restarted).
+	 *
+	 * Throws #ProtocolError on error.
+	 */
+	Datagram Parse(ConstBuffer<void> d);
+
+	/**
+	 * Parse the payload of a #MAGIC_V3 datagram (as returned by
+	 * GetDatagramPayload()).
+	 *
+	 * Throws #ProtocolError on error.
+	 *
+	 * @param state the sender's state or nullptr to parse without
+	 * it
+	 */
+	static Datagram ParseCompact(ConstBuffer<void> payload,
+				     CompactDecoder *state);
+
+private:
+	/**
+	 * Resolve a dictionary reference.
+	 *
+	 * @return the string or nullptr if the id is unknown
+	 */
+	gcc_pure
+	const char *Lookup(uint32_t id) const noexcept;
+
+	/**
+	 * Learn a dictionary definition.  An id keeps its string for
+	 * the whole epoch, so redefinitions are ignored (which also
+	 * keeps pointers returned by Lookup() valid).
+	 */
+	void Define(uint32_t id, const char *value);
+
+	/**
+	 * Switch to the given epoch unless it is the current or the
+	 * previous one.
+	 *
+	 * @return true if the datagram's epoch is the current one
+	 */
+	bool UpdateEpoch(uint32_t _epoch) noexcept;
+
+	void SetTimestampBase(uint64_t value) noexcept {
+		timestamp_base = value;
+		have_timestamp_base = true;
+	}
+
+	bool GetTimestampBase(uint64_t &value_r) const noexcept {
+		value_r = timestamp_base;
+		return have_timestamp_base;
+	}
+
+	void Reset() noexcept {
+		have_timestamp_base = false;
+		dictionary.clear();
+	}
+};
+
 }}
@@ -62,6 +62,28 @@ namespace Log {
   payload, excluding the magic (and of course excluding the CRC
   itself).
 
+  Protocol version 3 (#MAGIC_V3) is a compact encoding of the same
+  attributes for senders which keep state (see #CompactSerializer):
+
+  - the magic is followed by the sender's "epoch" number (LEB128);
+    all dictionary entries and the timestamp base belong to this
+    epoch, and a receiver discards them when a newer epoch begins
+
+  - integers (except the 8 bit ones) are unsigned LEB128 varints
+
+  - #Attribute::TIMESTAMP is the number of microseconds since
+    #Attribute::TIMESTAMP_BASE, which is repeated periodically
+
+  - a string attribute code may be combined with
+    #ATTRIBUTE_DEFINE (payload: varint id and the null-terminated
+    string, which is remembered under this id) or with
+    #ATTRIBUTE_REFERENCE (payload: only the varint id of a string
+    defined earlier); an id keeps its string for the whole epoch;
+    senders repeat definitions periodically, so a receiver which has
+    missed one recovers quickly
+
+  The CRC is the same as in version 2.
+
  */
 
 /**
@@ -76,6 +98,20 @@ static constexpr uint32_t MAGIC_V1 = 0x63046102;
  */
 static constexpr uint32_t MAGIC_V2 = 0x63046103;
 
+/**
+ * Protocol version 3 magic number.  Changes:
+ *
+ * - compact encoding with varints, timestamp deltas and
+ *   dictionary-coded strings (see above)
+ */
+static constexpr uint32_t MAGIC_V3 = 0x63046104;
+
+/**
+ * V3 only: flags combined with a string attribute code.
+ */
+static constexpr uint8_t ATTRIBUTE_DEFINE = 0x40;
+static constexpr uint8_t ATTRIBUTE_REFERENCE = 0x80;
+
 enum class Attribute : uint8_t {
 	NOP = 0,
 
@@ -163,6 +199,13 @@ enum class Attribute : uint8_t {
 	 * are present.
 	 */
 	TYPE = 15,
+
+	/**
+	 * V3 only: the 64 bit time stamp (microseconds since epoch)
+	 * which #TIMESTAMP values are relative to.  It remains the
+	 * same for the whole sender epoch.
+	 */
+	TIMESTAMP_BASE = 16,
 };
 
 /**
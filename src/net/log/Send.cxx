@@ -31,168 +31,124 @@
  */
 
 #include "Send.hxx"
+#include "Serializer.hxx"
 #include "Datagram.hxx"
-#include "Protocol.hxx"
 #include "Crc.hxx"
 #include "net/SocketDescriptor.hxx"
 #include "net/SendMessage.hxx"
-#include "system/Error.hxx"
 #include "util/ByteOrder.hxx"
-#include "util/StaticArray.hxx"
 
-#include <sys/socket.h>
+#include <memory>
+#include <stdexcept>
 
-class SocketDescriptor;
+#include <stdint.h>
+#include <sys/socket.h>
 
 namespace Net {
 namespace Log {
 
-static struct iovec
-MakeIovec(ConstBuffer<void> b) noexcept
-{
-	return { const_cast<void *>(b.data), b.size };
-}
+/**
+ * The size of the stack buffer for the serialized attributes; only
+ * datagrams with very long strings need a larger (heap) buffer.
+ */
+static constexpr size_t STACK_BUFFER_SIZE = 4096;
 
-static struct iovec
-MakeIovec(const char *s) noexcept
-{
-	return { const_cast<char *>(s), strlen(s) + 1 };
-}
+/**
+ * The attributes following #Attribute::MESSAGE are all fixed-size,
+ * so this is always enough.
+ */
+static constexpr size_t MAX_SUFFIX_SIZE = 64;
 
-template<typename T>
-static constexpr struct iovec
-MakeIovecT(const T &t) noexcept
+/**
+ * Invoke the serializer function with a buffer which is large
+ * enough, and then pass the result to the consumer.  The stack
+ * buffer is tried first, then heap buffers of increasing size.
+ */
+template<typename S, typename C>
+static void
+WithSerialized(S &&serialize, C &&consumer)
 {
-	return { const_cast<T *>(&t), sizeof(t) };
+	uint8_t stack_buffer[STACK_BUFFER_SIZE];
+	size_t size = serialize(stack_buffer, sizeof(stack_buffer));
+	if (size > 0) {
+		consumer(stack_buffer, size);
+		return;
+	}
+
+	for (size_t buffer_size = sizeof(stack_buffer) * 4;
+	     buffer_size <= 1024 * 1024; buffer_size *= 4) {
+		std::unique_ptr<uint8_t[]> buffer(new uint8_t[buffer_size]);
+		size = serialize(buffer.get(), buffer_size);
+		if (size > 0) {
+			consumer(buffer.get(), size);
+			return;
+		}
+	}
+
+	throw std::runtime_error("Log datagram too large");
 }
 
-template<typename T, T _value>
-static auto
-MakeIovecStatic() noexcept
+static void
+SendSerialized(SocketDescriptor s, const void *data, size_t size)
 {
-	static constexpr T value = _value;
-	return MakeIovecT<T>(value);
+	const struct iovec v{const_cast<void *>(data), size};
+	SendMessage(s, ConstBuffer<struct iovec>(&v, 1), MSG_DONTWAIT);
 }
 
-template<Attribute value>
-static auto
-MakeIovecAttribute()
+/**
+ * Send a datagram with a message: the message is not copied, only
+ * the attributes around it are serialized (see
+ * SerializeMessagePrefix()).
+ */
+static void
+SendWithMessage(SocketDescriptor s, const Datagram &d)
 {
-	return MakeIovecStatic<Attribute, value>();
+	uint8_t suffix[MAX_SUFFIX_SIZE];
+	const size_t suffix_size =
+		SerializeMessageSuffix(suffix, sizeof(suffix), d);
+	if (suffix_size == 0)
+		throw std::runtime_error("Log datagram too large");
+
+	WithSerialized([&d](void *buffer, size_t size){
+			return SerializeMessagePrefix(buffer, size, d);
+		},
+		[s, &d, suffix, suffix_size](const void *prefix, size_t prefix_size){
+			/* the CRC covers everything after the
+			   magic */
+			Crc crc;
+			crc.reset();
+			crc.process_bytes((const uint8_t *)prefix + sizeof(uint32_t),
+					  prefix_size - sizeof(uint32_t));
+			crc.process_bytes(d.message.data, d.message.size);
+			crc.process_bytes(suffix, suffix_size);
+			const uint32_t crc_value = ToBE32(crc.checksum());
+
+			const struct iovec v[] = {
+				{const_cast<void *>(prefix), prefix_size},
+				{const_cast<char *>(d.message.data), d.message.size},
+				{const_cast<uint8_t *>(suffix), suffix_size},
+				{const_cast<uint32_t *>(&crc_value), sizeof(crc_value)},
+			};
+
+			SendMessage(s, ConstBuffer<struct iovec>(v, 4),
+				    MSG_DONTWAIT);
+		});
 }
 
 void
 Send(SocketDescriptor s, const Datagram &d)
 {
-	StaticArray<struct iovec, 64> v;
-
-	v.push_back(MakeIovecStatic<uint32_t, ToBE32(MAGIC_V2)>());
-
-	uint64_t timestamp;
-
-	if (d.valid_timestamp) {
-		v.push_back(MakeIovecAttribute<Attribute::TIMESTAMP>());
-		timestamp = ToBE64(d.timestamp);
-		v.push_back(MakeIovecT(timestamp));
-	}
-
-	if (d.remote_host != nullptr) {
-		v.push_back(MakeIovecAttribute<Attribute::REMOTE_HOST>());
-		v.push_back(MakeIovec(d.remote_host));
-	}
-
-	if (d.host != nullptr) {
-		v.push_back(MakeIovecAttribute<Attribute::HOST>());
-		v.push_back(MakeIovec(d.host));
-	}
-
-	if (d.site != nullptr) {
-		v.push_back(MakeIovecAttribute<Attribute::SITE>());
-		v.push_back(MakeIovec(d.site));
-	}
-
-	if (d.forwarded_to != nullptr) {
-		v.push_back(MakeIovecAttribute<Attribute::FORWARDED_TO>());
-		v.push_back(MakeIovec(d.forwarded_to));
-	}
-
-	uint8_t http_method;
-	if (d.valid_http_method) {
-		v.push_back(MakeIovecAttribute<Attribute::HTTP_METHOD>());
-		http_method = uint8_t(d.http_method);
-		v.push_back(MakeIovecT(http_method));
-	}
-
-	if (d.http_uri != nullptr) {
-		v.push_back(MakeIovecAttribute<Attribute::HTTP_URI>());
-		v.push_back(MakeIovec(d.http_uri));
-	}
-
-	if (d.http_referer != nullptr) {
-		v.push_back(MakeIovecAttribute<Attribute::HTTP_REFERER>());
-		v.push_back(MakeIovec(d.http_referer));
-	}
-
-	if (d.user_agent != nullptr) {
-		v.push_back(MakeIovecAttribute<Attribute::USER_AGENT>());
-		v.push_back(MakeIovec(d.user_agent));
-	}
-
 	if (d.message != nullptr) {
-		v.push_back(MakeIovecAttribute<Attribute::MESSAGE>());
-		v.push_back(MakeIovec(d.message.ToVoid()));
-		v.push_back(MakeIovecStatic<uint8_t, 0>());
-	}
-
-	uint16_t http_status;
-	if (d.valid_http_status) {
-		v.push_back(MakeIovecAttribute<Attribute::HTTP_STATUS>());
-		http_status = ToBE16(int(d.http_status));
-		v.push_back(MakeIovecT(http_status));
+		SendWithMessage(s, d);
+		return;
 	}
 
-	uint64_t length;
-	if (d.valid_length) {
-		v.push_back(MakeIovecAttribute<Attribute::LENGTH>());
-		length = ToBE64(d.length);
-		v.push_back(MakeIovecT(length));
-	}
-
-	struct {
-		uint64_t received, sent;
-	} traffic;
-
-	if (d.valid_traffic) {
-		v.push_back(MakeIovecAttribute<Attribute::TRAFFIC>());
-		traffic.received = ToBE64(d.traffic_received);
-		traffic.sent = ToBE64(d.traffic_sent);
-		v.push_back(MakeIovecT(traffic));
-	}
-
-	uint64_t duration;
-	if (d.valid_duration) {
-		v.push_back(MakeIovecAttribute<Attribute::DURATION>());
-		duration = ToBE64(d.duration);
-		v.push_back(MakeIovecT(duration));
-	}
-
-	if (d.type != Net::Log::Type::UNSPECIFIED) {
-		v.push_back(MakeIovecAttribute<Attribute::TYPE>());
-		v.push_back(MakeIovecT(d.type));
-	}
-
-	Crc crc;
-	crc.reset();
-
-	const auto begin = std::next(v.begin()), end = v.end();
-	for (auto i = begin; i != end; ++i)
-		crc.process_bytes(i->iov_base, i->iov_len);
-
-	const uint32_t crc_value = ToBE32(crc.checksum());
-	v.push_back(MakeIovecT(crc_value));
-
-	SendMessage(s, ConstBuffer<struct iovec>(&v.front(), v.size()),
-		    MSG_DONTWAIT);
+	WithSerialized([&d](void *buffer, size_t size){
+			return Serialize(buffer, size, d);
+		},
+		[s](const void *data, size_t size){
+			SendSerialized(s, data, size);
+		});
 }
 
 }}
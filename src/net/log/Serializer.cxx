@@ -0,0 +1,374 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Serializer.hxx"
+#include "Datagram.hxx"
+#include "Protocol.hxx"
+#include "Crc.hxx"
+#include "util/ByteOrder.hxx"
+
+#include <string.h>
+
+namespace Net {
+namespace Log {
+
+namespace {
+
+/**
+ * Appends data to a fixed buffer, and remembers whether it ran out of
+ * space.
+ */
+class SerializeBuffer {
+	uint8_t *p;
+	uint8_t *const end;
+	bool overflow = false;
+
+public:
+	SerializeBuffer(void *buffer, size_t size) noexcept
+		:p((uint8_t *)buffer), end(p + size) {}
+
+	bool IsOverflow() const noexcept {
+		return overflow;
+	}
+
+	uint8_t *GetPosition() const noexcept {
+		return p;
+	}
+
+	void Write(const void *src, size_t size) noexcept {
+		if (overflow || size_t(end - p) < size) {
+			overflow = true;
+			return;
+		}
+
+		memcpy(p, src, size);
+		p += size;
+	}
+
+	template<typename T>
+	void WriteT(const T &value) noexcept {
+		Write(&value, sizeof(value));
+	}
+
+	void WriteString(const char *s) noexcept {
+		Write(s, strlen(s) + 1);
+	}
+
+	/**
+	 * Write an unsigned LEB128 integer.
+	 */
+	void WriteVarint(uint64_t value) noexcept {
+		uint8_t tmp[10];
+		size_t n = 0;
+
+		do {
+			uint8_t byte = value & 0x7f;
+			value >>= 7;
+			if (value != 0)
+				byte |= 0x80;
+			tmp[n++] = byte;
+		} while (value != 0);
+
+		Write(tmp, n);
+	}
+
+	void WriteAttribute(Attribute a) noexcept {
+		WriteT(a);
+	}
+
+	void WriteString(Attribute a, const char *s) noexcept {
+		if (s != nullptr) {
+			WriteAttribute(a);
+			WriteString(s);
+		}
+	}
+};
+
+}
+
+/**
+ * Write the magic and all attributes preceding
+ * #Attribute::MESSAGE.
+ */
+static void
+WriteHead(SerializeBuffer &b, const Datagram &d) noexcept
+{
+	b.WriteT(ToBE32(MAGIC_V2));
+
+	if (d.valid_timestamp) {
+		b.WriteAttribute(Attribute::TIMESTAMP);
+		b.WriteT(ToBE64(d.timestamp));
+	}
+
+	b.WriteString(Attribute::REMOTE_HOST, d.remote_host);
+	b.WriteString(Attribute::HOST, d.host);
+	b.WriteString(Attribute::SITE, d.site);
+	b.WriteString(Attribute::FORWARDED_TO, d.forwarded_to);
+
+	if (d.valid_http_method) {
+		b.WriteAttribute(Attribute::HTTP_METHOD);
+		b.WriteT(uint8_t(d.http_method));
+	}
+
+	b.WriteString(Attribute::HTTP_URI, d.http_uri);
+	b.WriteString(Attribute::HTTP_REFERER, d.http_referer);
+	b.WriteString(Attribute::USER_AGENT, d.user_agent);
+}
+
+/**
+ * Write all attributes following #Attribute::MESSAGE (without the
+ * CRC).
+ */
+static void
+WriteTail(SerializeBuffer &b, const Datagram &d) noexcept
+{
+	if (d.valid_http_status) {
+		b.WriteAttribute(Attribute::HTTP_STATUS);
+		b.WriteT(ToBE16(int(d.http_status)));
+	}
+
+	if (d.valid_length) {
+		b.WriteAttribute(Attribute::LENGTH);
+		b.WriteT(ToBE64(d.length));
+	}
+
+	if (d.valid_traffic) {
+		b.WriteAttribute(Attribute::TRAFFIC);
+		b.WriteT(ToBE64(d.traffic_received));
+		b.WriteT(ToBE64(d.traffic_sent));
+	}
+
+	if (d.valid_duration) {
+		b.WriteAttribute(Attribute::DURATION);
+		b.WriteT(ToBE64(d.duration));
+	}
+
+	if (d.type != Type::UNSPECIFIED) {
+		b.WriteAttribute(Attribute::TYPE);
+		b.WriteT(d.type);
+	}
+}
+
+size_t
+Serialize(void *buffer, size_t size, const Datagram &d) noexcept
+{
+	SerializeBuffer b(buffer, size);
+
+	WriteHead(b, d);
+
+	if (d.message != nullptr) {
+		b.WriteAttribute(Attribute::MESSAGE);
+		b.Write(d.message.data, d.message.size);
+		b.WriteT(uint8_t(0));
+	}
+
+	WriteTail(b, d);
+
+	if (b.IsOverflow())
+		return 0;
+
+	const uint8_t *const crc_begin = (const uint8_t *)buffer + sizeof(uint32_t);
+
+	Crc crc;
+	crc.reset();
+	crc.process_bytes(crc_begin, b.GetPosition() - crc_begin);
+	b.WriteT(ToBE32(crc.checksum()));
+
+	if (b.IsOverflow())
+		return 0;
+
+	return b.GetPosition() - (uint8_t *)buffer;
+}
+
+void
+CompactSerializer::Reset() noexcept
+{
+	++epoch;
+	sequence = 0;
+	base_sequence = 0;
+	have_timestamp_base = false;
+	dictionary.clear();
+}
+
+inline bool
+CompactSerializer::NeedsReset(const Datagram &d) const noexcept
+{
+	if (d.valid_timestamp && have_timestamp_base &&
+	    (d.timestamp < timestamp_base ||
+	     d.timestamp - timestamp_base >= MAX_TIMESTAMP_DELTA))
+		return true;
+
+	/* assume the worst case: all four dictionary strings are
+	   new */
+	return dictionary.size() + 4 > MAX_ENTRIES;
+}
+
+size_t
+CompactSerializer::Serialize(void *buffer, size_t size, const Datagram &d)
+{
+	if (NeedsReset(d))
+		Reset();
+
+	SerializeBuffer b(buffer, size);
+
+	b.WriteT(ToBE32(MAGIC_V3));
+	b.WriteVarint(epoch);
+
+	if (d.valid_timestamp) {
+		bool send_base = sequence - base_sequence >= REFRESH_INTERVAL;
+		if (!have_timestamp_base) {
+			timestamp_base = d.timestamp;
+			have_timestamp_base = true;
+			send_base = true;
+		}
+
+		if (send_base) {
+			base_sequence = sequence;
+			b.WriteAttribute(Attribute::TIMESTAMP_BASE);
+			b.WriteVarint(timestamp_base);
+		}
+
+		b.WriteAttribute(Attribute::TIMESTAMP);
+		b.WriteVarint(d.timestamp - timestamp_base);
+	}
+
+	auto write_dictionary_string = [this, &b](Attribute a, const char *s){
+		if (s == nullptr)
+			return;
+
+		auto i = dictionary.emplace(s, Entry{uint32_t(dictionary.size()),
+						     sequence});
+		auto &e = i.first->second;
+		if (!i.second && sequence - e.sequence < REFRESH_INTERVAL) {
+			b.WriteT(uint8_t(uint8_t(a) | ATTRIBUTE_REFERENCE));
+			b.WriteVarint(e.id);
+		} else {
+			e.sequence = sequence;
+			b.WriteT(uint8_t(uint8_t(a) | ATTRIBUTE_DEFINE));
+			b.WriteVarint(e.id);
+			b.WriteString(s);
+		}
+	};
+
+	b.WriteString(Attribute::REMOTE_HOST, d.remote_host);
+	write_dictionary_string(Attribute::HOST, d.host);
+	write_dictionary_string(Attribute::SITE, d.site);
+	write_dictionary_string(Attribute::FORWARDED_TO, d.forwarded_to);
+
+	if (d.valid_http_method) {
+		b.WriteAttribute(Attribute::HTTP_METHOD);
+		b.WriteT(uint8_t(d.http_method));
+	}
+
+	b.WriteString(Attribute::HTTP_URI, d.http_uri);
+	b.WriteString(Attribute::HTTP_REFERER, d.http_referer);
+	write_dictionary_string(Attribute::USER_AGENT, d.user_agent);
+
+	if (d.message != nullptr) {
+		b.WriteAttribute(Attribute::MESSAGE);
+		b.Write(d.message.data, d.message.size);
+		b.WriteT(uint8_t(0));
+	}
+
+	if (d.valid_http_status) {
+		b.WriteAttribute(Attribute::HTTP_STATUS);
+		b.WriteVarint(unsigned(d.http_status));
+	}
+
+	if (d.valid_length) {
+		b.WriteAttribute(Attribute::LENGTH);
+		b.WriteVarint(d.length);
+	}
+
+	if (d.valid_traffic) {
+		b.WriteAttribute(Attribute::TRAFFIC);
+		b.WriteVarint(d.traffic_received);
+		b.WriteVarint(d.traffic_sent);
+	}
+
+	if (d.valid_duration) {
+		b.WriteAttribute(Attribute::DURATION);
+		b.WriteVarint(d.duration);
+	}
+
+	if (d.type != Type::UNSPECIFIED) {
+		b.WriteAttribute(Attribute::TYPE);
+		b.WriteT(d.type);
+	}
+
+	const uint8_t *const crc_begin = (const uint8_t *)buffer + sizeof(uint32_t);
+
+	if (!b.IsOverflow()) {
+		Crc crc;
+		crc.reset();
+		crc.process_bytes(crc_begin, b.GetPosition() - crc_begin);
+		b.WriteT(ToBE32(crc.checksum()));
+	}
+
+	if (b.IsOverflow()) {
+		/* the dictionary may contain entries whose definition
+		   was not sent; start over */
+		Reset();
+		return 0;
+	}
+
+	++sequence;
+	return b.GetPosition() - (uint8_t *)buffer;
+}
+
+size_t
+SerializeMessagePrefix(void *buffer, size_t size, const Datagram &d) noexcept
+{
+	SerializeBuffer b(buffer, size);
+	WriteHead(b, d);
+	b.WriteAttribute(Attribute::MESSAGE);
+
+	if (b.IsOverflow())
+		return 0;
+
+	return b.GetPosition() - (uint8_t *)buffer;
+}
+
+size_t
+SerializeMessageSuffix(void *buffer, size_t size, const Datagram &d) noexcept
+{
+	SerializeBuffer b(buffer, size);
+	b.WriteT(uint8_t(0));
+	WriteTail(b, d);
+
+	if (b.IsOverflow())
+		return 0;
+
+	return b.GetPosition() - (uint8_t *)buffer;
+}
+
+}}
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Net {
+namespace Log {
+
+struct Datagram;
+
+/**
+ * Serialize a log datagram into the given buffer, including the magic
+ * and the CRC.  The result is the same payload which Send() would
+ * transmit.
+ *
+ * @return the number of bytes written to the buffer or 0 if the
+ * buffer is too small
+ */
+size_t
+Serialize(void *buffer, size_t size, const Datagram &d) noexcept;
+
+/**
+ * Serialize the parts of a datagram surrounding #Datagram::message,
+ * which allows sending the message without copying it (with
+ * scatter/gather I/O).  The datagram consists of the prefix (starting
+ * with the magic and ending with the #Attribute::MESSAGE code), the
+ * message bytes, the suffix (starting with the message's null
+ * terminator) and the big-endian CRC over everything after the magic.
+ *
+ * #Datagram::message is ignored by these functions.
+ *
+ * @return the number of bytes written to the buffer or 0 if the
+ * buffer is too small
+ */
+size_t
+SerializeMessagePrefix(void *buffer, size_t size, const Datagram &d) noexcept;
+
+size_t
+SerializeMessageSuffix(void *buffer, size_t size, const Datagram &d) noexcept;
+
+/**
+ * Serializes datagrams in the compact #MAGIC_V3 encoding.  It
+ * remembers which strings (#Attribute::SITE, #Attribute::HOST,
+ * #Attribute::USER_AGENT, #Attribute::FORWARDED_TO) it has sent
+ * already and replaces them with dictionary references, and it sends
+ * time stamps relative to a base.  Use one instance per destination.
+ */
+class CompactSerializer {
+	/**
+	 * Start a new epoch when the dictionary has grown to this
+	 * number of entries.
+	 */
+	static constexpr size_t MAX_ENTRIES = 1024;
+
+	/**
+	 * Repeat a dictionary definition (and the timestamp base)
+	 * after this number of datagrams, allowing receivers which
+	 * have missed it to recover.
+	 */
+	static constexpr uint64_t REFRESH_INTERVAL = 64;
+
+	/**
+	 * Start a new epoch when a time stamp is this far from the
+	 * base (in microseconds); this keeps each delta within 4
+	 * varint bytes.
+	 */
+	static constexpr uint64_t MAX_TIMESTAMP_DELTA = uint64_t(1) << 28;
+
+	uint32_t epoch;
+
+	/**
+	 * The number of datagrams serialized in this epoch.
+	 */
+	uint64_t sequence;
+
+	uint64_t timestamp_base;
+
+	/**
+	 * The #sequence when #timestamp_base was last sent.
+	 */
+	uint64_t base_sequence;
+
+	bool have_timestamp_base;
+
+	struct Entry {
+		uint32_t id;
+
+		/**
+		 * The #sequence when this entry was last defined.
+		 */
+		uint64_t sequence;
+	};
+
+	std::unordered_map<std::string, Entry> dictionary;
+
+public:
+	/**
+	 * @param _epoch the first epoch number; to avoid confusing
+	 * receivers after a restart, this should be different from
+	 * the last epoch of the previous instance (e.g. random)
+	 */
+	explicit CompactSerializer(uint32_t _epoch) noexcept
+		:epoch(_epoch - 1) {
+		Reset();
+	}
+
+	/**
+	 * Start a new epoch, discarding the dictionary.
+	 */
+	void Reset() noexcept;
+
+	/**
+	 * Serialize a log datagram into the given buffer, including
+	 * the magic and the CRC.
+	 *
+	 * Throws std::bad_alloc if the dictionary runs out of memory.
+	 *
+	 * @return the number of bytes written to the buffer or 0 if
+	 * the buffer is too small
+	 */
+	size_t Serialize(void *buffer, size_t size, const Datagram &d);
+
+private:
+	/**
+	 * Must a new epoch begin before this datagram can be
+	 * serialized?
+	 */
+	bool NeedsReset(const Datagram &d) const noexcept;
+};
+
+}}
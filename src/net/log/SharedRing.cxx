@@ -0,0 +1,287 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SharedRing.hxx"
+#include "system/Error.hxx"
+
+#include <stdexcept>
+#include <new>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+namespace Net {
+namespace Log {
+
+/**
+ * The size reserved for the #SharedRingHeader; the record area
+ * begins after it.
+ */
+static constexpr size_t HEADER_SIZE = 4096;
+
+static constexpr uint64_t
+AlignRecord(uint64_t size) noexcept
+{
+	return (size + 7) & ~uint64_t(7);
+}
+
+SharedRingWriter::SharedRingWriter(size_t _capacity)
+	:mapping_size(HEADER_SIZE + _capacity), capacity(_capacity)
+{
+	assert(capacity >= HEADER_SIZE);
+	assert((capacity & (capacity - 1)) == 0);
+
+	int _fd = memfd_create("Net::Log::SharedRing",
+			       MFD_CLOEXEC|MFD_ALLOW_SEALING);
+	if (_fd < 0)
+		throw MakeErrno("memfd_create() failed");
+
+	fd = UniqueFileDescriptor(FileDescriptor(_fd));
+
+	if (ftruncate(fd.Get(), mapping_size) < 0)
+		throw MakeErrno("ftruncate() failed");
+
+	void *p = mmap(nullptr, mapping_size, PROT_READ|PROT_WRITE,
+		       MAP_SHARED, fd.Get(), 0);
+	if (p == MAP_FAILED)
+		throw MakeErrno("mmap() failed");
+
+	header = new(p) SharedRingHeader();
+	header->magic = SharedRingHeader::MAGIC;
+	header->header_size = HEADER_SIZE;
+	header->capacity = capacity;
+	header->write_begin.store(0, std::memory_order_relaxed);
+	header->write_position.store(0, std::memory_order_relaxed);
+	header->wake_sequence.store(0, std::memory_order_relaxed);
+
+	data = (uint8_t *)p + HEADER_SIZE;
+
+	/* our own mapping remains writable, but consumers can only
+	   map it read-only (Linux 5.1 or later; ignore failures on
+	   older kernels) */
+	(void)fcntl(fd.Get(), F_ADD_SEALS, F_SEAL_FUTURE_WRITE);
+
+	if (fcntl(fd.Get(), F_ADD_SEALS,
+		  F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) < 0) {
+		munmap(p, mapping_size);
+		throw MakeErrno("Failed to seal memfd");
+	}
+}
+
+SharedRingWriter::~SharedRingWriter() noexcept
+{
+	munmap(header, mapping_size);
+}
+
+bool
+SharedRingWriter::Append(ConstBuffer<void> record) noexcept
+{
+	if (record.size > GetMaxRecordSize())
+		return false;
+
+	const uint64_t need = sizeof(SharedRingRecord) + AlignRecord(record.size);
+
+	uint64_t offset = position & (capacity - 1);
+	const uint64_t padding = capacity - offset < need
+		? capacity - offset
+		: 0;
+	const uint64_t end = position + padding + need;
+
+	/* announce which area is about to be overwritten before
+	   touching it (like a seqlock) */
+	header->write_begin.store(end, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	if (padding > 0) {
+		const SharedRingRecord pad{0, SharedRingRecord::FLAG_PADDING};
+		memcpy(data + offset, &pad, sizeof(pad));
+		offset = 0;
+	}
+
+	const SharedRingRecord rh{uint32_t(record.size), 0};
+	memcpy(data + offset, &rh, sizeof(rh));
+	memcpy(data + offset + sizeof(rh), record.data, record.size);
+
+	position = end;
+	header->write_position.store(position, std::memory_order_release);
+	return true;
+}
+
+void
+SharedRingWriter::Wake() noexcept
+{
+	header->wake_sequence.fetch_add(1, std::memory_order_release);
+	syscall(SYS_futex, &header->wake_sequence, FUTEX_WAKE, INT_MAX,
+		nullptr, nullptr, 0);
+}
+
+SharedRingReader::SharedRingReader(FileDescriptor fd)
+{
+	struct stat st;
+	if (fstat(fd.Get(), &st) < 0)
+		throw MakeErrno("fstat() failed");
+
+	if (size_t(st.st_size) <= HEADER_SIZE)
+		throw std::runtime_error("Shared ring too small");
+
+	mapping_size = st.st_size;
+
+	void *p = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED,
+		       fd.Get(), 0);
+	if (p == MAP_FAILED)
+		throw MakeErrno("mmap() failed");
+
+	header = (const SharedRingHeader *)p;
+	data = (const uint8_t *)p + HEADER_SIZE;
+	capacity = header->capacity;
+
+	if (header->magic != SharedRingHeader::MAGIC ||
+	    header->header_size != HEADER_SIZE ||
+	    capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+	    HEADER_SIZE + capacity != mapping_size) {
+		munmap(p, mapping_size);
+		throw std::runtime_error("Malformed shared ring");
+	}
+
+	position = next_position =
+		header->write_position.load(std::memory_order_acquire);
+}
+
+SharedRingReader::~SharedRingReader() noexcept
+{
+	munmap(const_cast<SharedRingHeader *>(header), mapping_size);
+}
+
+inline bool
+SharedRingReader::IsOverwritten(uint64_t p) const noexcept
+{
+	return header->write_begin.load(std::memory_order_relaxed) - p > capacity;
+}
+
+void
+SharedRingReader::Overrun() noexcept
+{
+	++n_overruns;
+	position = next_position =
+		header->write_position.load(std::memory_order_acquire);
+}
+
+ConstBuffer<void>
+SharedRingReader::Next() noexcept
+{
+	while (true) {
+		const uint64_t w =
+			header->write_position.load(std::memory_order_acquire);
+		if (position == w)
+			return nullptr;
+
+		if (w - position > capacity) {
+			Overrun();
+			continue;
+		}
+
+		const uint64_t offset = position & (capacity - 1);
+
+		SharedRingRecord rh;
+		memcpy(&rh, data + offset, sizeof(rh));
+
+		if (rh.flags & SharedRingRecord::FLAG_PADDING) {
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (IsOverwritten(position)) {
+				Overrun();
+				continue;
+			}
+
+			position += capacity - offset;
+			continue;
+		}
+
+		const uint64_t need = sizeof(rh) + AlignRecord(rh.size);
+		if (need > capacity - offset || need > w - position) {
+			/* the header was overwritten while we were
+			   reading it */
+			Overrun();
+			continue;
+		}
+
+		next_position = position + need;
+		return {data + offset + sizeof(rh), rh.size};
+	}
+}
+
+bool
+SharedRingReader::Consume() noexcept
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (IsOverwritten(position)) {
+		Overrun();
+		return false;
+	}
+
+	position = next_position;
+	return true;
+}
+
+bool
+SharedRingReader::Wait(int timeout_ms) noexcept
+{
+	auto &word = const_cast<std::atomic<uint32_t> &>(header->wake_sequence);
+	const uint32_t sequence = word.load(std::memory_order_acquire);
+
+	if (header->write_position.load(std::memory_order_acquire) != position)
+		return true;
+
+	struct timespec timeout;
+	if (timeout_ms >= 0) {
+		timeout.tv_sec = timeout_ms / 1000;
+		timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+	}
+
+	syscall(SYS_futex, &word, FUTEX_WAIT, sequence,
+		timeout_ms >= 0 ? &timeout : nullptr, nullptr, 0);
+
+	return header->write_position.load(std::memory_order_acquire) != position;
+}
+
+}}
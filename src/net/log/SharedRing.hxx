@@ -0,0 +1,234 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/Compiler.h"
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Net {
+namespace Log {
+
+/**
+ * The header of a shared-memory ring buffer, which occupies the
+ * first page of the memfd.  The record area follows.
+ *
+ * Records are aligned to 8 bytes; each starts with a
+ * #SharedRingRecord header.  Records never wrap around the end of
+ * the area; if the next one doesn't fit, the writer fills up the
+ * rest with a padding record.
+ */
+struct SharedRingHeader {
+	static constexpr uint32_t MAGIC = 0x4c6f6752; /* "LogR" */
+
+	uint32_t magic;
+
+	uint32_t header_size;
+
+	/**
+	 * The size of the record area; a power of two.
+	 */
+	uint64_t capacity;
+
+	/**
+	 * The end of the last record which is being written
+	 * (monotonic, not wrapped).  Updated before the record is
+	 * written, so readers can detect that their record has been
+	 * overwritten.
+	 */
+	std::atomic<uint64_t> write_begin;
+
+	/**
+	 * The end of the last complete record (monotonic, not
+	 * wrapped).
+	 */
+	std::atomic<uint64_t> write_position;
+
+	/**
+	 * Incremented by SharedRingWriter::Wake(); a futex word for
+	 * SharedRingReader::Wait().
+	 */
+	std::atomic<uint32_t> wake_sequence;
+};
+
+struct SharedRingRecord {
+	static constexpr uint32_t FLAG_PADDING = 0x1;
+
+	uint32_t size;
+	uint32_t flags;
+};
+
+/**
+ * The producer side of a single-producer multi-consumer ring buffer
+ * in a sealed memfd.  Consumers map the memfd read-only (see
+ * #SharedRingReader), each with its own cursor; the writer never
+ * waits for them, and slow consumers lose records.
+ *
+ * This class is not thread-safe.
+ */
+class SharedRingWriter {
+	UniqueFileDescriptor fd;
+
+	SharedRingHeader *header;
+	uint8_t *data;
+
+	size_t mapping_size;
+
+	const uint64_t capacity;
+
+	uint64_t position = 0;
+
+public:
+	/**
+	 * Throws on error.
+	 *
+	 * @param _capacity the size of the record area; must be a
+	 * power of two and a multiple of the page size
+	 */
+	explicit SharedRingWriter(size_t _capacity);
+	~SharedRingWriter() noexcept;
+
+	SharedRingWriter(const SharedRingWriter &) = delete;
+	SharedRingWriter &operator=(const SharedRingWriter &) = delete;
+
+	/**
+	 * Returns the memfd, which may be passed to consumers (e.g.
+	 * via SCM_RIGHTS).  It is sealed against resizing and, if the
+	 * kernel supports it, against new writable mappings.
+	 */
+	FileDescriptor GetFileDescriptor() const noexcept {
+		return fd.ToFileDescriptor();
+	}
+
+	/**
+	 * The maximum size of one record.
+	 */
+	size_t GetMaxRecordSize() const noexcept {
+		return capacity / 4;
+	}
+
+	/**
+	 * Append a record.  Consumers see it immediately, but
+	 * sleeping consumers are woken only by Wake().
+	 *
+	 * @return false if the record is too large
+	 */
+	bool Append(ConstBuffer<void> record) noexcept;
+
+	/**
+	 * Wake up consumers waiting in SharedRingReader::Wait().
+	 */
+	void Wake() noexcept;
+};
+
+/**
+ * The consumer side of a #SharedRingWriter.  It maps the memfd
+ * read-only.  A new reader starts at the current end of the ring,
+ * i.e. it sees only records appended afterwards.
+ */
+class SharedRingReader {
+	const SharedRingHeader *header;
+	const uint8_t *data;
+
+	size_t mapping_size;
+
+	uint64_t capacity;
+
+	uint64_t position;
+
+	/**
+	 * The end of the record returned by Next().
+	 */
+	uint64_t next_position;
+
+	/**
+	 * The number of times records were lost because the writer
+	 * has overtaken this reader.
+	 */
+	uint64_t n_overruns = 0;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	explicit SharedRingReader(FileDescriptor fd);
+	~SharedRingReader() noexcept;
+
+	SharedRingReader(const SharedRingReader &) = delete;
+	SharedRingReader &operator=(const SharedRingReader &) = delete;
+
+	uint64_t GetOverruns() const noexcept {
+		return n_overruns;
+	}
+
+	/**
+	 * Obtain the next record.  The returned buffer points into the
+	 * shared mapping, and the writer may overwrite it at any time;
+	 * after processing it, call Consume() to find out whether the
+	 * contents were still valid.
+	 *
+	 * @return the record or nullptr if there is none
+	 */
+	ConstBuffer<void> Next() noexcept;
+
+	/**
+	 * Advance to the record after the one returned by Next().
+	 *
+	 * @return true if the record was valid until now; false if the
+	 * writer has overwritten it (the caller must discard whatever
+	 * it has read from it), and this reader skips ahead
+	 */
+	bool Consume() noexcept;
+
+	/**
+	 * Wait until the writer calls SharedRingWriter::Wake(), unless
+	 * there are already new records.
+	 *
+	 * @param timeout_ms the timeout in milliseconds; negative
+	 * means no timeout
+	 * @return true if there are new records
+	 */
+	bool Wait(int timeout_ms) noexcept;
+
+private:
+	bool IsOverwritten(uint64_t p) const noexcept;
+
+	void Overrun() noexcept;
+};
+
+}}
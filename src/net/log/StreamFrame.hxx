@@ -0,0 +1,92 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Parser.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/ByteOrder.hxx"
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Framing for log records on a SOCK_STREAM connection.  Each
+ * record is prefixed by its size (32 bit big-endian) and contains a
+ * datagram exactly as produced by Serialize(), including the magic
+ * and the CRC.
+ */
+
+namespace Net {
+namespace Log {
+
+static constexpr size_t STREAM_FRAME_HEADER_SIZE = sizeof(uint32_t);
+
+/**
+ * Records larger than this are rejected by both sides.
+ */
+static constexpr size_t MAX_STREAM_FRAME_SIZE = 16 * 1024 * 1024;
+
+static inline uint32_t
+MakeStreamFrameHeader(size_t size) noexcept
+{
+	return ToBE32(size);
+}
+
+/**
+ * Check whether the buffer begins with a complete frame.
+ *
+ * Throws #ProtocolError if the frame is too large.
+ *
+ * @return the payload of the frame (the caller shall consume
+ * #STREAM_FRAME_HEADER_SIZE plus its size) or nullptr if the frame is
+ * not yet complete
+ */
+static inline ConstBuffer<void>
+ParseStreamFrame(ConstBuffer<void> src)
+{
+	if (src.size < STREAM_FRAME_HEADER_SIZE)
+		return nullptr;
+
+	uint32_t header;
+	memcpy(&header, src.data, sizeof(header));
+	const size_t size = FromBE32(header);
+	if (size > MAX_STREAM_FRAME_SIZE)
+		throw ProtocolError();
+
+	if (src.size < STREAM_FRAME_HEADER_SIZE + size)
+		return nullptr;
+
+	return {(const uint8_t *)src.data + STREAM_FRAME_HEADER_SIZE, size};
+}
+
+}}
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TrafficAggregator.hxx"
+#include "Datagram.hxx"
+#include "util/FNVHash.hxx"
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace Net {
+namespace Log {
+
+TrafficAggregator::Site::Site(StringView _name)
+	:storage(new char[_name.size + 1])
+{
+	memcpy(storage.get(), _name.data, _name.size);
+	storage[_name.size] = 0;
+	name = {storage.get(), _name.size};
+}
+
+size_t
+TrafficAggregator::StringViewHash::operator()(StringView s) const noexcept
+{
+	using Algorithm = FNV1aAlgorithm<FNVTraits<uint32_t>>;
+
+	Algorithm::fast_type hash = FNVTraits<uint32_t>::OFFSET_BASIS;
+	for (char ch : s)
+		hash = Algorithm::Update(hash, ch);
+	return hash;
+}
+
+inline TrafficAggregator::Traffic &
+TrafficAggregator::LookupSite(StringView name)
+{
+	const size_t *i = index.Find(name);
+	if (i != nullptr)
+		return sites[*i].traffic;
+
+	sites.emplace_back(name);
+	auto &site = sites.back();
+	index.Insert(site.name, sites.size() - 1);
+	return site.traffic;
+}
+
+void
+TrafficAggregator::Add(const Datagram &d)
+{
+	if (d.site == nullptr)
+		return;
+
+	Add(d.site, d.valid_timestamp ? d.timestamp : 0,
+	    d.valid_traffic ? d.traffic_received : 0,
+	    d.valid_traffic ? d.traffic_sent : 0,
+	    d.valid_length ? d.length : 0);
+}
+
+void
+TrafficAggregator::Add(StringView site, uint64_t timestamp,
+		       uint64_t received, uint64_t sent, uint64_t length)
+{
+	if (timestamp > 0) {
+		if (window_start == UINT64_MAX)
+			window_start = timestamp - timestamp % window_size;
+		else
+			Advance(timestamp);
+	}
+
+	auto &t = LookupSite(site);
+	++t.n_records;
+	t.received += received;
+	t.sent += sent;
+	t.length += length;
+}
+
+void
+TrafficAggregator::Advance(uint64_t now)
+{
+	if (window_start == UINT64_MAX || now < window_start + window_size)
+		return;
+
+	FinishWindow();
+
+	/* skip empty windows */
+	window_start = now - now % window_size;
+}
+
+void
+TrafficAggregator::Flush()
+{
+	if (window_start == UINT64_MAX)
+		return;
+
+	FinishWindow();
+	window_start += window_size;
+}
+
+void
+TrafficAggregator::FinishWindow()
+{
+	/* move the sites with traffic to the front */
+	const auto active_end =
+		std::partition(sites.begin(), sites.end(), [](const Site &s){
+			return s.traffic.n_records > 0;
+		});
+
+	const size_t n_active = std::distance(sites.begin(), active_end);
+	if (n_active > 0)
+		callback(window_start, {sites.data(), n_active});
+
+	for (auto &i : sites) {
+		if (i.traffic.n_records > 0) {
+			i.idle_windows = 0;
+			i.traffic = {};
+		} else
+			++i.idle_windows;
+	}
+
+	/* forget sites which have been idle for too long (they are
+	   all behind the active ones) */
+	const auto expired_begin =
+		std::partition(active_end, sites.end(), [this](const Site &s){
+			return s.idle_windows <= max_idle_windows;
+		});
+	sites.erase(expired_begin, sites.end());
+
+	/* the vector has been reordered: rebuild the index */
+	index.Clear();
+	for (size_t i = 0; i < sites.size(); ++i)
+		index.Insert(sites[i].name, i);
+}
+
+}}
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/FlatHashMap.hxx"
+#include "util/StringView.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/BindMethod.hxx"
+
+#include <memory>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Net {
+namespace Log {
+
+struct Datagram;
+
+/**
+ * Sums up the traffic of each site over fixed time windows.  Each
+ * site name is copied once (interned) when it is first seen; after
+ * that, adding a record only costs one hash table lookup and doesn't
+ * allocate memory.
+ *
+ * When a record belongs to a newer window, the current window is
+ * finished and passed to the snapshot callback.  Records belonging
+ * to an older window (late arrivals) are accounted to the current
+ * window.
+ */
+class TrafficAggregator {
+public:
+	struct Traffic {
+		uint64_t n_records = 0;
+		uint64_t received = 0, sent = 0;
+		uint64_t length = 0;
+	};
+
+	class Site {
+		friend class TrafficAggregator;
+
+		std::unique_ptr<char[]> storage;
+
+		/**
+		 * The number of consecutive windows without traffic.
+		 */
+		unsigned idle_windows = 0;
+
+	public:
+		/**
+		 * The site name; it points into #storage and is
+		 * null-terminated.
+		 */
+		StringView name;
+
+		Traffic traffic;
+
+		explicit Site(StringView _name);
+	};
+
+	/**
+	 * @param window_start the start of the window in microseconds
+	 * since the epoch (like Datagram::timestamp)
+	 * @param sites all sites which had traffic during the window;
+	 * the buffer is only valid during the call
+	 */
+	typedef BoundMethod<void(uint64_t window_start,
+				 ConstBuffer<Site> sites)> SnapshotCallback;
+
+private:
+	struct StringViewHash {
+		gcc_pure
+		size_t operator()(StringView s) const noexcept;
+	};
+
+	struct StringViewEqual {
+		gcc_pure
+		bool operator()(StringView a, StringView b) const noexcept {
+			return a.Equals(b);
+		}
+	};
+
+	/**
+	 * All known sites.  A vector (and not a map of objects)
+	 * allows passing the snapshot as one contiguous buffer.
+	 */
+	std::vector<Site> sites;
+
+	/**
+	 * Maps site names to indexes in #sites.
+	 */
+	FlatHashMap<StringView, size_t, StringViewHash, StringViewEqual> index;
+
+	const uint64_t window_size;
+
+	/**
+	 * Sites without traffic are forgotten after this number of
+	 * windows.
+	 */
+	const unsigned max_idle_windows;
+
+	/**
+	 * The start of the current window; UINT64_MAX if no record
+	 * has been seen yet.
+	 */
+	uint64_t window_start = UINT64_MAX;
+
+	const SnapshotCallback callback;
+
+public:
+	/**
+	 * @param _window_size the window size in microseconds
+	 */
+	TrafficAggregator(uint64_t _window_size, SnapshotCallback _callback,
+			  unsigned _max_idle_windows=60) noexcept
+		:window_size(_window_size),
+		 max_idle_windows(_max_idle_windows),
+		 callback(_callback) {}
+
+	TrafficAggregator(const TrafficAggregator &) = delete;
+	TrafficAggregator &operator=(const TrafficAggregator &) = delete;
+
+	size_t GetSiteCount() const noexcept {
+		return sites.size();
+	}
+
+	/**
+	 * Add a record.  Records without a site are ignored; records
+	 * without a time stamp are accounted to the current window.
+	 */
+	void Add(const Datagram &d);
+
+	/**
+	 * Add traffic of one record.
+	 *
+	 * @param timestamp microseconds since the epoch, or 0 to use
+	 * the current window
+	 */
+	void Add(StringView site, uint64_t timestamp,
+		 uint64_t received, uint64_t sent, uint64_t length);
+
+	/**
+	 * Finish all windows which end before the given time stamp
+	 * (e.g. from a periodic timer, when there is no traffic).
+	 */
+	void Advance(uint64_t now);
+
+	/**
+	 * Finish the current window right now.
+	 */
+	void Flush();
+
+private:
+	Traffic &LookupSite(StringView name);
+
+	void FinishWindow();
+};
+
+}}
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Parser.hxx"
+#include "Protocol.hxx"
+#include "http/Method.h"
+#include "http/Status.h"
+#include "util/ConstBuffer.hxx"
+#include "util/StringView.hxx"
+#include "util/ByteOrder.hxx"
+
+#include <string.h>
+
+namespace Net {
+namespace Log {
+
+/**
+ * A bit mask of #Attribute values.
+ */
+typedef uint32_t AttributeMask;
+
+constexpr AttributeMask
+ToMask(Attribute a) noexcept
+{
+	return unsigned(a) < 32
+		? AttributeMask(1) << unsigned(a)
+		: 0;
+}
+
+template<typename... Args>
+constexpr AttributeMask
+ToMask(Attribute a, Attribute b, Args... args) noexcept
+{
+	return ToMask(a) | ToMask(b, args...);
+}
+
+/**
+ * An empty implementation of the visitor interface for
+ * VisitDatagram().  Derive from this class and hide the methods
+ * you're interested in.
+ */
+struct NullDatagramVisitor {
+	/**
+	 * A string attribute (e.g. #Attribute::SITE or
+	 * #Attribute::MESSAGE).
+	 */
+	void OnString(Attribute, StringView) noexcept {}
+
+	/**
+	 * A 64 bit integer attribute: #Attribute::TIMESTAMP,
+	 * #Attribute::LENGTH or #Attribute::DURATION.
+	 */
+	void OnUint64(Attribute, uint64_t) noexcept {}
+
+	void OnTraffic(uint64_t, uint64_t) noexcept {}
+	void OnHttpMethod(http_method_t) noexcept {}
+	void OnHttpStatus(http_status_t) noexcept {}
+	void OnType(Type) noexcept {}
+};
+
+namespace VisitDetail {
+
+inline uint64_t
+LoadBE64(const uint8_t *p) noexcept
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return FromBE64(value);
+}
+
+inline uint16_t
+LoadBE16(const uint8_t *p) noexcept
+{
+	uint16_t value;
+	memcpy(&value, p, sizeof(value));
+	return FromBE16(value);
+}
+
+inline void
+CheckSize(const uint8_t *p, const uint8_t *end, size_t size)
+{
+	if (size_t(end - p) < size)
+		throw ProtocolError();
+}
+
+/**
+ * @return a pointer to the null terminator
+ */
+inline const uint8_t *
+FindStringEnd(const uint8_t *p, const uint8_t *end)
+{
+	auto nul = (const uint8_t *)memchr(p, 0, end - p);
+	if (nul == nullptr)
+		throw ProtocolError();
+	return nul;
+}
+
+}
+
+/**
+ * Parse the attributes of a datagram and invoke the visitor for each
+ * attribute in the #wanted mask.  This does not allocate memory and
+ * does not copy anything; the #StringView values point into the
+ * datagram.  Unwanted attributes are skipped without decoding or
+ * validating them, and parsing stops as soon as all wanted attributes
+ * have been seen (which means that a malformed tail may go
+ * unnoticed).  Unknown (newer) attributes end parsing, because their
+ * size is not known.
+ *
+ * Unlike ParseDatagram(), this does not guess the #Type of records
+ * from old clients, and it does not support the compact #MAGIC_V3
+ * encoding, which needs a #CompactDecoder.
+ *
+ * Throws #ProtocolError on error.
+ *
+ * @param visitor an object implementing the interface of
+ * #NullDatagramVisitor
+ * @param verify_crc false skips the CRC check; the caller may check it
+ * later with VerifyDatagramCrc()
+ */
+template<typename V>
+void
+VisitDatagram(ConstBuffer<void> d, AttributeMask wanted, V &&visitor,
+	      bool verify_crc=true)
+{
+	using namespace VisitDetail;
+
+	bool compact;
+	const auto payload =
+		ConstBuffer<uint8_t>::FromVoid(GetDatagramPayload(d, verify_crc,
+								  compact));
+	if (compact)
+		throw ProtocolError();
+
+	const uint8_t *p = payload.begin(), *const end = payload.end();
+	AttributeMask missing = wanted;
+
+	while (p < end && missing != 0) {
+		const auto attr = Attribute(*p++);
+		const auto mask = ToMask(attr);
+		const bool want = (missing & mask) != 0;
+		missing &= ~mask;
+
+		switch (attr) {
+			const uint8_t *nul;
+
+		case Attribute::NOP:
+			break;
+
+		case Attribute::TIMESTAMP:
+		case Attribute::LENGTH:
+		case Attribute::DURATION:
+			CheckSize(p, end, sizeof(uint64_t));
+			if (want)
+				visitor.OnUint64(attr, LoadBE64(p));
+			p += sizeof(uint64_t);
+			break;
+
+		case Attribute::TRAFFIC:
+			CheckSize(p, end, 2 * sizeof(uint64_t));
+			if (want)
+				visitor.OnTraffic(LoadBE64(p),
+						  LoadBE64(p + sizeof(uint64_t)));
+			p += 2 * sizeof(uint64_t);
+			break;
+
+		case Attribute::HTTP_METHOD:
+			CheckSize(p, end, sizeof(uint8_t));
+			if (want) {
+				const auto method = http_method_t(*p);
+				if (!http_method_is_valid(method))
+					throw ProtocolError();
+				visitor.OnHttpMethod(method);
+			}
+			p += sizeof(uint8_t);
+			break;
+
+		case Attribute::HTTP_STATUS:
+			CheckSize(p, end, sizeof(uint16_t));
+			if (want) {
+				const auto status = http_status_t(LoadBE16(p));
+				if (!http_status_is_valid(status))
+					throw ProtocolError();
+				visitor.OnHttpStatus(status);
+			}
+			p += sizeof(uint16_t);
+			break;
+
+		case Attribute::TYPE:
+			CheckSize(p, end, sizeof(uint8_t));
+			if (want)
+				visitor.OnType(Type(*p));
+			p += sizeof(uint8_t);
+			break;
+
+		case Attribute::REMOTE_HOST:
+		case Attribute::SITE:
+		case Attribute::HTTP_URI:
+		case Attribute::HTTP_REFERER:
+		case Attribute::USER_AGENT:
+		case Attribute::HOST:
+		case Attribute::MESSAGE:
+		case Attribute::FORWARDED_TO:
+			nul = FindStringEnd(p, end);
+			if (want)
+				visitor.OnString(attr,
+						 StringView((const char *)p,
+							    (const char *)nul));
+			p = nul + 1;
+			break;
+
+		default:
+			return;
+		}
+	}
+}
+
+}}
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Batch.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <stdexcept>
+
+#include <assert.h>
+
+std::vector<ODBus::Message>
+ODBus::SendWithReplyAndBlockAll(DBusConnection &connection,
+				ConstBuffer<DBusMessage *> calls,
+				int timeout_milliseconds)
+{
+	std::vector<PendingCall> pending;
+	pending.reserve(calls.size);
+
+	for (auto *msg : calls)
+		pending.emplace_back(PendingCall::SendWithReply(&connection, msg,
+								timeout_milliseconds));
+
+	dbus_connection_flush(&connection);
+
+	std::vector<Message> replies;
+	replies.reserve(pending.size());
+
+	for (auto &i : pending) {
+		i.Block();
+		replies.emplace_back(Message::StealReply(*i.Get()));
+	}
+
+	return replies;
+}
+
+void
+ODBus::BatchCall::Add(DBusMessage &msg, int timeout_milliseconds)
+{
+	replies.emplace_back();
+
+	try {
+		items.emplace_back(*this, replies.size() - 1,
+				   PendingCall::SendWithReply(&connection, &msg,
+							      timeout_milliseconds));
+	} catch (...) {
+		replies.pop_back();
+		throw;
+	}
+
+	auto &item = items.back();
+	if (!item.pending.SetNotify(NotifyFunction, &item)) {
+		item.pending.Cancel();
+		items.pop_back();
+		replies.pop_back();
+		throw std::runtime_error("dbus_pending_call_set_notify() failed");
+	}
+
+	++n_remaining;
+}
+
+void
+ODBus::BatchCall::Send() noexcept
+{
+	if (n_remaining == 0) {
+		items.clear();
+
+		auto r = std::move(replies);
+		replies.clear();
+		handler.OnBatchReplies(std::move(r));
+		return;
+	}
+
+	dbus_connection_flush(&connection);
+}
+
+void
+ODBus::BatchCall::Cancel() noexcept
+{
+	for (auto &i : items)
+		if (i.pending)
+			i.pending.Cancel();
+
+	items.clear();
+	replies.clear();
+	n_remaining = 0;
+}
+
+inline void
+ODBus::BatchCall::OnReply(Item &item) noexcept
+{
+	assert(n_remaining > 0);
+
+	try {
+		replies[item.index] = Message::StealReply(*item.pending.Get());
+	} catch (...) {
+		/* no reply: leave the Message undefined */
+	}
+
+	item.pending = PendingCall();
+
+	if (--n_remaining > 0)
+		return;
+
+	items.clear();
+
+	/* move to the stack, because the handler may destroy this
+	   object or start a new batch */
+	auto r = std::move(replies);
+	replies.clear();
+	handler.OnBatchReplies(std::move(r));
+}
+
+void
+ODBus::BatchCall::NotifyFunction(DBusPendingCall *, void *user_data) noexcept
+{
+	auto &item = *(Item *)user_data;
+	item.parent.OnReply(item);
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ODBUS_BATCH_HXX
+#define ODBUS_BATCH_HXX
+
+#include "Message.hxx"
+#include "PendingCall.hxx"
+
+#include <dbus/dbus.h>
+
+#include <list>
+#include <vector>
+
+template<typename T> struct ConstBuffer;
+
+namespace ODBus {
+
+/**
+ * Send all method calls, flush the connection once, and then wait
+ * for all replies.  This costs one round trip instead of one per
+ * call.
+ *
+ * Throws on error (but error replies are returned in the vector).
+ *
+ * @return the replies in the same order as #calls
+ */
+std::vector<Message>
+SendWithReplyAndBlockAll(DBusConnection &connection,
+			 ConstBuffer<DBusMessage *> calls,
+			 int timeout_milliseconds=-1);
+
+class BatchCallHandler {
+public:
+	/**
+	 * All replies of the batch have been received.  They are in
+	 * the order of BatchCall::Add() calls; failed calls (e.g.
+	 * timeouts) have an error reply, and a reply which could not
+	 * be obtained is an undefined #Message.
+	 */
+	virtual void OnBatchReplies(std::vector<Message> &&replies) noexcept = 0;
+};
+
+/**
+ * Send a number of method calls asynchronously and invoke the
+ * #BatchCallHandler when all replies have been received.  The
+ * replies are dispatched by a #WatchManager in the #EventLoop.
+ *
+ * Usage: call Add() for each message, then Send().
+ */
+class BatchCall {
+	DBusConnection &connection;
+
+	BatchCallHandler &handler;
+
+	struct Item {
+		BatchCall &parent;
+
+		const size_t index;
+
+		PendingCall pending;
+
+		Item(BatchCall &_parent, size_t _index,
+		     PendingCall &&_pending) noexcept
+			:parent(_parent), index(_index),
+			 pending(std::move(_pending)) {}
+	};
+
+	/**
+	 * A std::list because the notify callbacks hold pointers to
+	 * the items.
+	 */
+	std::list<Item> items;
+
+	std::vector<Message> replies;
+
+	size_t n_remaining = 0;
+
+public:
+	BatchCall(DBusConnection &_connection,
+		  BatchCallHandler &_handler) noexcept
+		:connection(_connection), handler(_handler) {}
+
+	~BatchCall() noexcept {
+		Cancel();
+	}
+
+	BatchCall(const BatchCall &) = delete;
+	BatchCall &operator=(const BatchCall &) = delete;
+
+	bool IsPending() const noexcept {
+		return n_remaining > 0;
+	}
+
+	/**
+	 * Send a method call (without flushing the connection).
+	 *
+	 * Throws on error.
+	 */
+	void Add(DBusMessage &msg, int timeout_milliseconds=-1);
+
+	/**
+	 * Flush all calls added with Add().  The handler will be
+	 * invoked later from within the #EventLoop; if no call has
+	 * been added, it is invoked right away.
+	 */
+	void Send() noexcept;
+
+	/**
+	 * Cancel all pending calls; the handler will not be invoked.
+	 */
+	void Cancel() noexcept;
+
+private:
+	void OnReply(Item &item) noexcept;
+
+	static void NotifyFunction(DBusPendingCall *pending,
+				   void *user_data) noexcept;
+};
+
+} /* namespace ODBus */
+
+#endif
@@ -32,6 +32,11 @@
 
 #include "ScopeMatch.hxx"
 #include "Error.hxx"
+#include "Batch.hxx"
+#include "Message.hxx"
+#include "AppendIter.hxx"
+
+#include <exception>
 
 ODBus::ScopeMatch::ScopeMatch(DBusConnection *_connection, const char *_rule)
 	:connection(_connection), rule(_rule)
@@ -40,3 +45,49 @@ ODBus::ScopeMatch::ScopeMatch(DBusConnection *_connection, const char *_rule)
 	dbus_bus_add_match(connection, rule, error);
 	error.CheckThrow("DBus AddMatch error");
 }
+
+ODBus::MultiScopeMatch::MultiScopeMatch(DBusConnection *_connection,
+					ConstBuffer<const char *> _rules)
+	:connection(_connection), rules(_rules)
+{
+	std::vector<Message> calls;
+	calls.reserve(rules.size);
+
+	std::vector<DBusMessage *> call_pointers;
+	call_pointers.reserve(rules.size);
+
+	for (const char *rule : rules) {
+		calls.emplace_back(Message::NewMethodCall(DBUS_SERVICE_DBUS,
+							  DBUS_PATH_DBUS,
+							  DBUS_INTERFACE_DBUS,
+							  "AddMatch"));
+		AppendMessageIter(*calls.back().Get()).Append(rule);
+		call_pointers.push_back(calls.back().Get());
+	}
+
+	auto replies = SendWithReplyAndBlockAll(*connection,
+						{call_pointers.data(), call_pointers.size()});
+
+	std::exception_ptr error;
+	for (size_t i = 0; i < replies.size(); ++i) {
+		try {
+			replies[i].CheckThrowError();
+			continue;
+		} catch (...) {
+			if (!error)
+				error = std::current_exception();
+		}
+
+		/* mark this rule as "not added" */
+		call_pointers[i] = nullptr;
+	}
+
+	if (error) {
+		for (size_t i = 0; i < rules.size; ++i)
+			if (call_pointers[i] != nullptr)
+				dbus_bus_remove_match(connection, rules[i],
+						      nullptr);
+
+		std::rethrow_exception(error);
+	}
+}
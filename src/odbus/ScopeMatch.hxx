@@ -33,6 +33,8 @@
 #ifndef ODBUS_SCOPE_MATCH_HXX
 #define ODBUS_SCOPE_MATCH_HXX
 
+#include "util/ConstBuffer.hxx"
+
 #include <dbus/dbus.h>
 
 namespace ODBus {
@@ -56,6 +58,34 @@ public:
 	ScopeMatch &operator=(const ScopeMatch &) = delete;
 };
 
+/**
+ * Like #ScopeMatch, but for several rules at once: all AddMatch
+ * calls are sent together, which costs only one round trip.
+ */
+class MultiScopeMatch {
+	DBusConnection *const connection;
+	const ConstBuffer<const char *> rules;
+
+public:
+	/**
+	 * Throws on error (after removing the rules which were added
+	 * successfully).
+	 *
+	 * @param _rules an array of rules which must remain valid
+	 * for the lifetime of this object
+	 */
+	MultiScopeMatch(DBusConnection *_connection,
+			ConstBuffer<const char *> _rules);
+
+	~MultiScopeMatch() noexcept {
+		for (const char *rule : rules)
+			dbus_bus_remove_match(connection, rule, nullptr);
+	}
+
+	MultiScopeMatch(const MultiScopeMatch &) = delete;
+	MultiScopeMatch &operator=(const MultiScopeMatch &) = delete;
+};
+
 } /* namespace ODBus */
 
 #endif
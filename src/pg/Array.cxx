@@ -39,74 +39,112 @@
 
 namespace Pg {
 
-std::list<std::string>
-DecodeArray(const char *p)
+ArrayDecoder::ArrayDecoder(const char *s, std::string &_buffer)
+	:p(s), buffer(_buffer)
 {
-	std::list<std::string> dest;
-
-	if (p == nullptr || *p == 0)
-		return dest;
+	if (p == nullptr || *p == 0) {
+		p = nullptr;
+		return;
+	}
 
 	if (*p != '{')
 		throw std::invalid_argument("'{' expected");
 
 	if (p[1] == '}' && p[2] == 0)
-		return dest; /* special case: empty array */
-
-	do {
-		++p;
+		p = nullptr; /* special case: empty array */
+}
 
-		if (*p == '\"') {
+/**
+ * Unescape the rest of a quoted element into the buffer.
+ *
+ * @param p the first backslash
+ * @return the closing double quote
+ */
+static const char *
+UnescapeArrayElement(const char *p, std::string &buffer)
+{
+	while (*p != '"') {
+		if (*p == '\\') {
 			++p;
 
-			std::string value;
+			if (*p == 0)
+				throw std::invalid_argument("backslash at end of string");
 
-			while (*p != '\"') {
-				if (*p == '\\') {
-					++p;
+			buffer.push_back(*p++);
+		} else if (*p == 0) {
+			throw std::invalid_argument("missing closing double quote");
+		} else {
+			/* copy the unescaped run in one chunk */
+			const char *end = p + strcspn(p, "\"\\");
+			buffer.append(p, end);
+			p = end;
+		}
+	}
 
-					if (*p == 0)
-						throw std::invalid_argument("backslash at end of string");
+	return p;
+}
 
-					value.push_back(*p++);
-				} else if (*p == 0) {
-					throw std::invalid_argument("missing closing double quote");
-				} else {
-					value.push_back(*p++);
-				}
-			}
+bool
+ArrayDecoder::Next(StringView &value)
+{
+	if (p == nullptr)
+		return false;
 
-			++p;
+	/* skip the '{' or ',' */
+	++p;
 
-			if (*p != '}' && *p != ',')
-				throw std::invalid_argument("'}' or ',' expected");
+	if (*p == '"') {
+		++p;
 
-			dest.push_back(std::move(value));
-		} else if (*p == 0) {
-			throw std::invalid_argument("missing '}'");
-		} else if (*p == '{') {
-			throw std::invalid_argument("unexpected '{'");
+		const char *end = p + strcspn(p, "\"\\");
+		if (*end == '"') {
+			/* no escapes: refer to the input string */
+			value = {p, end};
+		} else if (*end == 0) {
+			throw std::invalid_argument("missing closing double quote");
 		} else {
-			const char *end = strchr(p, ',');
-			if (end == nullptr) {
-				end = strchr(p, '}');
-				if (end == nullptr)
-					throw std::invalid_argument("missing '}'");
-			}
+			buffer.assign(p, end);
+			end = UnescapeArrayElement(end, buffer);
+			value = {buffer.data(), buffer.size()};
+		}
 
-			dest.push_back(std::string(p, end));
+		p = end + 1;
+
+		if (*p != '}' && *p != ',')
+			throw std::invalid_argument("'}' or ',' expected");
+	} else if (*p == 0) {
+		throw std::invalid_argument("missing '}'");
+	} else if (*p == '{') {
+		throw std::invalid_argument("unexpected '{'");
+	} else {
+		const char *end = p + strcspn(p, ",}");
+		if (*end == 0)
+			throw std::invalid_argument("missing '}'");
 
-			p = end;
-		}
-	} while (*p == ',');
+		value = {p, end};
+		p = end;
+	}
 
-	if (*p != '}')
-		throw std::invalid_argument("'}' expected");
+	if (*p == '}') {
+		if (p[1] != 0)
+			throw std::invalid_argument("garbage after '}'");
 
-	++p;
+		/* end of array */
+		p = nullptr;
+	}
+
+	return true;
+}
+
+std::list<std::string>
+DecodeArray(const char *p)
+{
+	std::list<std::string> dest;
 
-	if (*p != 0)
-		throw std::invalid_argument("garbage after '}'");
+	std::string buffer;
+	VisitArray(p, buffer, [&dest](StringView value){
+			dest.emplace_back(value.data, value.size);
+		});
 
 	return dest;
 }
@@ -37,45 +37,140 @@
 #ifndef PG_ARRAY_HXX
 #define PG_ARRAY_HXX
 
+#include "util/StringView.hxx"
+
 #include <list>
 #include <string>
 
+#include <stddef.h>
+
 namespace Pg {
 
+/**
+ * An incremental parser for a one-dimensional PostgreSQL array in
+ * text format.  Elements are returned as #StringView pointing into
+ * the input string; only elements with backslash escapes are
+ * unescaped into a caller-provided buffer, which is reused for the
+ * next element.
+ */
+class ArrayDecoder {
+	const char *p;
+
+	std::string &buffer;
+
+public:
+	/**
+	 * Throws std::invalid_argument on syntax error.
+	 *
+	 * @param s the array string; it must remain valid until
+	 * this object is destructed, just like the returned
+	 * elements
+	 * @param _buffer a buffer for unescaping elements; its
+	 * contents are undefined afterwards
+	 */
+	ArrayDecoder(const char *s, std::string &_buffer);
+
+	/**
+	 * Obtain the next element.  It remains valid until this
+	 * method is called again.
+	 *
+	 * Throws std::invalid_argument on syntax error.
+	 *
+	 * @return false if there are no more elements
+	 */
+	bool Next(StringView &value);
+};
+
+/**
+ * Decode the array and invoke the given function for each element
+ * (as #StringView).
+ *
+ * Throws std::invalid_argument on syntax error.
+ */
+template<typename F>
+void
+VisitArray(const char *p, std::string &buffer, F &&f)
+{
+	ArrayDecoder decoder(p, buffer);
+
+	StringView value;
+	while (decoder.Next(value))
+		f(value);
+}
+
 /**
  * Throws std::invalid_argument on syntax error.
  */
 std::list<std::string>
 DecodeArray(const char *p);
 
+/**
+ * Calculate the length of the string generated by EncodeArray()
+ * (without a null terminator).
+ */
 template<typename L>
-std::string
-EncodeArray(const L &src)
+size_t
+GetEncodedArrayLength(const L &src) noexcept
 {
 	if (src.empty())
-		return "{}";
+		return 2;
 
-	std::string dest("{");
+	/* the opening brace */
+	size_t length = 1;
+
+	for (const auto &i : src) {
+		/* two double quotes and a comma (or the closing
+		   brace) */
+		length += 3;
+
+		for (const auto ch : i)
+			length += ch == '\\' || ch == '"' ? 2 : 1;
+	}
+
+	return length;
+}
+
+/**
+ * Encode the array into the given buffer, which must be large
+ * enough (see GetEncodedArrayLength()).  No null terminator is
+ * written.
+ *
+ * @return the end of the string
+ */
+template<typename L>
+char *
+EncodeArray(char *dest, const L &src) noexcept
+{
+	*dest++ = '{';
 
 	bool first = true;
 	for (const auto &i : src) {
 		if (first)
 			first = false;
 		else
-			dest.push_back(',');
+			*dest++ = ',';
 
-		dest.push_back('"');
+		*dest++ = '"';
 
 		for (const auto ch : i) {
 			if (ch == '\\' || ch == '"')
-				dest.push_back('\\');
-			dest.push_back(ch);
+				*dest++ = '\\';
+			*dest++ = ch;
 		}
 
-		dest.push_back('"');
+		*dest++ = '"';
 	}
 
-	dest.push_back('}');
+	*dest++ = '}';
+	return dest;
+}
+
+template<typename L>
+std::string
+EncodeArray(const L &src)
+{
+	std::string dest(GetEncodedArrayLength(src), '\0');
+	EncodeArray(&dest.front(), src);
 	return dest;
 }
 
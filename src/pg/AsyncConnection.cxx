@@ -41,7 +41,8 @@ AsyncConnection::AsyncConnection(EventLoop &event_loop,
 	:conninfo(_conninfo), schema(_schema),
 	 handler(_handler),
 	 socket_event(event_loop, -1, 0, BIND_THIS_METHOD(OnSocketEvent)),
-	 reconnect_timer(event_loop, BIND_THIS_METHOD(OnReconnectTimer))
+	 reconnect_timer(event_loop, BIND_THIS_METHOD(OnReconnectTimer)),
+	 resume_stream_event(event_loop, BIND_THIS_METHOD(OnResumeStream))
 {
 }
 
@@ -57,12 +58,40 @@ AsyncConnection::Error() noexcept
 	const bool was_connected = state == State::READY;
 	state = State::DISCONNECTED;
 
+	if (copy_nonblocking) {
+		try {
+			SetNonBlocking(false);
+		} catch (...) {
+			/* the connection is broken anyway;
+			   PQsetnonblocking() has updated the flag
+			   nonetheless */
+		}
+	}
+
+	ResetCopy();
+	ResetStream();
+
 	if (result_handler != nullptr) {
 		auto rh = result_handler;
 		result_handler = nullptr;
+		query_timer.Abort();
 		rh->OnResultError();
 	}
 
+	if (!pipeline_handlers.empty()) {
+		const auto handlers = std::move(pipeline_handlers);
+		pipeline_handlers.clear();
+		pipeline_aborted = false;
+
+		for (auto &timer : pipeline_timers)
+			timer.Abort();
+		pipeline_timers.clear();
+
+		for (auto *rh : handlers)
+			if (rh != nullptr)
+				rh->OnResultError();
+	}
+
 	if (was_connected)
 		handler.OnDisconnect();
 
@@ -101,6 +130,23 @@ AsyncConnection::Poll(PostgresPollingStatusType status) noexcept
 			}
 		}
 
+#ifdef LIBPQ_HAS_PIPELINING
+		if (pipeline_mode &&
+		    (state == State::CONNECTING || state == State::RECONNECTING)) {
+			/* non-blocking mode is necessary to avoid a
+			   deadlock while both sides are sending */
+			try {
+				SetNonBlocking(true);
+				EnterPipelineMode();
+			} catch (...) {
+				handler.OnError(NestCurrentException(std::runtime_error("Failed to enter pipeline mode")));
+
+				Error();
+				break;
+			}
+		}
+#endif
+
 		state = State::READY;
 		socket_event.Set(GetSocket(), SocketEvent::READ|SocketEvent::PERSIST);
 		socket_event.Add();
@@ -145,17 +191,270 @@ AsyncConnection::PollReconnect() noexcept
 	Poll(Connection::PollReconnect());
 }
 
+void
+AsyncConnection::ResetCopy() noexcept
+{
+	copy_state = CopyState::NONE;
+	copy_handler = nullptr;
+	copy_pending.clear();
+	copy_end_error.clear();
+	copy_end_pending = false;
+	copy_blocked = false;
+	copy_nonblocking = false;
+}
+
+inline void
+AsyncConnection::StartCopyIn()
+{
+	copy_state = CopyState::IN;
+
+	if (copy_handler == nullptr) {
+		/* COPY FROM STDIN via SendQuery() */
+		Connection::PutCopyEnd("COPY FROM STDIN not supported");
+		copy_state = CopyState::NONE;
+		return;
+	}
+
+	SetNonBlocking(true);
+	copy_nonblocking = true;
+
+	copy_handler->OnCopyReady();
+}
+
+inline bool
+AsyncConnection::PollCopyOut()
+{
+	assert(copy_state == CopyState::OUT);
+
+	if (!ReceiveCopyData(true, [this](const char *data, size_t size){
+				if (copy_handler != nullptr)
+					copy_handler->OnCopyData(data, size);
+			}))
+		return false;
+
+	copy_state = CopyState::NONE;
+	return true;
+}
+
+bool
+AsyncConnection::PutCopyData(const void *data, size_t size)
+{
+	assert(state == State::READY);
+	assert(copy_state == CopyState::IN);
+	assert(!copy_end_pending);
+
+	if (!copy_pending.empty()) {
+		copy_pending.append((const char *)data, size);
+		copy_blocked = true;
+		return false;
+	}
+
+	if (!Connection::PutCopyData(data, size)) {
+		copy_pending.assign((const char *)data, size);
+		FlushOutput();
+		copy_blocked = true;
+		return false;
+	}
+
+	if (!FlushOutput()) {
+		copy_blocked = true;
+		return false;
+	}
+
+	return true;
+}
+
+void
+AsyncConnection::EndCopyIn(const char *error)
+{
+	assert(state == State::READY);
+	assert(copy_state == CopyState::IN);
+	assert(!copy_end_pending);
+
+	if (!copy_pending.empty() || !Connection::PutCopyEnd(error)) {
+		copy_end_pending = true;
+		if (error != nullptr)
+			copy_end_error = error;
+		FlushOutput();
+		return;
+	}
+
+	copy_state = CopyState::NONE;
+	copy_blocked = false;
+	FlushOutput();
+}
+
+inline void
+AsyncConnection::ContinueCopyIn()
+{
+	assert(copy_state == CopyState::IN);
+
+	if (!copy_pending.empty()) {
+		if (!Connection::PutCopyData(copy_pending.data(),
+					     copy_pending.size())) {
+			FlushOutput();
+			return;
+		}
+
+		copy_pending.clear();
+
+		if (!FlushOutput())
+			return;
+	}
+
+	if (copy_end_pending) {
+		if (!Connection::PutCopyEnd(copy_end_error.empty()
+					    ? nullptr
+					    : copy_end_error.c_str())) {
+			FlushOutput();
+			return;
+		}
+
+		copy_end_pending = false;
+		copy_end_error.clear();
+		copy_state = CopyState::NONE;
+		copy_blocked = false;
+		FlushOutput();
+		return;
+	}
+
+	if (copy_blocked) {
+		copy_blocked = false;
+		copy_handler->OnCopyReady();
+	}
+}
+
+void
+AsyncConnection::ResetStream() noexcept
+{
+	resume_stream_event.Cancel();
+	stream_handler = nullptr;
+	stream_batch.clear();
+	stream_paused = false;
+}
+
+void
+AsyncConnection::FlushStreamBatch(bool may_pause)
+{
+	assert(stream_handler != nullptr);
+	assert(!stream_batch.empty());
+
+	RowBatch batch(std::move(stream_batch));
+	stream_batch.clear();
+	stream_batch.reserve(stream_batch_size);
+
+	if (!stream_handler->OnRowBatch(std::move(batch)) && may_pause) {
+		/* pause: stop watching the socket, so the kernel
+		   applies backpressure to the server */
+		stream_paused = true;
+		socket_event.Delete();
+	}
+}
+
+inline bool
+AsyncConnection::HandleStreamResult(Result &result)
+{
+	assert(stream_handler != nullptr);
+
+	if (result.IsDefined() &&
+	    result.GetStatus() == PGRES_SINGLE_TUPLE) {
+		stream_batch.push_back(std::move(result));
+		if (stream_batch.size() >= stream_batch_size)
+			FlushStreamBatch(true);
+		return true;
+	}
+
+	/* the end of the rows (or an error): deliver the rest
+	   before the final result; there is nothing left to pause */
+	if (!stream_batch.empty())
+		FlushStreamBatch(false);
+
+	if (!result.IsDefined())
+		ResetStream();
+
+	return false;
+}
+
+void
+AsyncConnection::ResumeStream() noexcept
+{
+	if (!stream_paused)
+		return;
+
+	stream_paused = false;
+
+	if (state != State::READY)
+		return;
+
+	socket_event.Set(GetSocket(), SocketEvent::READ|SocketEvent::PERSIST);
+	socket_event.Add();
+
+	/* libpq may have buffered more rows already, which would
+	   not trigger a socket event */
+	resume_stream_event.Schedule();
+}
+
+inline void
+AsyncConnection::OnResumeStream() noexcept
+{
+	if (state == State::READY && !stream_paused)
+		PollNotify();
+}
+
 inline void
 AsyncConnection::PollResult()
 {
-	while (!IsBusy()) {
+	while (true) {
+		if (copy_state == CopyState::IN)
+			/* waiting for the copy_handler to submit
+			   data */
+			break;
+
+		if (stream_paused)
+			/* waiting for ResumeStream() */
+			break;
+
+		if (copy_state == CopyState::OUT && !PollCopyOut())
+			break;
+
+		if (IsBusy())
+			break;
+
 		auto result = ReceiveResult();
+		if (result.IsDefined()) {
+			query_timer.OnResult(result);
+
+			switch (result.GetStatus()) {
+			case PGRES_COPY_IN:
+				StartCopyIn();
+				continue;
+
+			case PGRES_COPY_OUT:
+				copy_state = CopyState::OUT;
+				continue;
+
+			default:
+				break;
+			}
+		} else if (copy_handler != nullptr) {
+			/* the COPY command has finished */
+			if (copy_nonblocking)
+				SetNonBlocking(false);
+
+			ResetCopy();
+		}
+
+		if (stream_handler != nullptr &&
+		    HandleStreamResult(result))
+			continue;
+
 		if (result_handler != nullptr) {
 			if (result.IsDefined())
 				result_handler->OnResult(std::move(result));
 			else {
 				auto rh = result_handler;
 				result_handler = nullptr;
+				query_timer.Finish();
 				rh->OnResultEnd();
 			}
 		}
@@ -165,6 +464,119 @@ AsyncConnection::PollResult()
 	}
 }
 
+inline void
+AsyncConnection::PollPipelineResult()
+{
+	while (!IsBusy()) {
+		auto result = ReceiveResult();
+		if (!result.IsDefined()) {
+			/* end of the current query's results */
+			if (pipeline_handlers.empty())
+				break;
+
+			auto rh = pipeline_handlers.front();
+			pipeline_handlers.pop_front();
+
+			auto timer = pipeline_timers.front();
+			pipeline_timers.pop_front();
+
+			if (pipeline_aborted)
+				timer.Abort();
+			else
+				timer.Finish();
+
+			if (rh == nullptr)
+				/* internal request */
+				pipeline_aborted = false;
+			else if (pipeline_aborted) {
+				pipeline_aborted = false;
+				rh->OnResultError();
+			} else
+				rh->OnResultEnd();
+
+			continue;
+		}
+
+#ifdef LIBPQ_HAS_PIPELINING
+		switch (result.GetStatus()) {
+		case PGRES_PIPELINE_SYNC:
+			/* the synchronization point after each query
+			   has no handler */
+			continue;
+
+		case PGRES_PIPELINE_ABORTED:
+			pipeline_aborted = true;
+			continue;
+
+		default:
+			break;
+		}
+#endif
+
+		if (pipeline_handlers.empty())
+			continue;
+
+		pipeline_timers.front().OnResult(result);
+
+		auto rh = pipeline_handlers.front();
+		if (rh != nullptr)
+			rh->OnResult(std::move(result));
+		else if (result.IsError())
+			/* preparing a statement has failed; we don't
+			   know which one, so prepare them all again */
+			ForgetPreparedStatements();
+	}
+}
+
+void
+AsyncConnection::PrepareLazily(const Statement &s)
+{
+	if (IsPrepared(s))
+		return;
+
+	if (pipeline_mode) {
+		SendPrepare(s);
+		pipeline_handlers.push_back(nullptr);
+		pipeline_timers.emplace_back();
+	} else
+		Prepare(s);
+}
+
+void
+AsyncConnection::CommitPipelineQuery(AsyncResultHandler &_handler,
+				     const QueryTimer &timer) noexcept
+{
+	assert(pipeline_mode);
+
+	pipeline_handlers.push_back(&_handler);
+	pipeline_timers.push_back(timer);
+
+	try {
+#ifdef LIBPQ_HAS_PIPELINING
+		PipelineSync();
+#endif
+		FlushOutput();
+	} catch (...) {
+		handler.OnError(std::current_exception());
+		Error();
+	}
+}
+
+bool
+AsyncConnection::FlushOutput()
+{
+	assert(state == State::READY);
+
+	const bool flushed = Flush();
+	if (flushed)
+		socket_event.Set(GetSocket(), SocketEvent::READ|SocketEvent::PERSIST);
+	else
+		socket_event.Set(GetSocket(),
+				 SocketEvent::READ|SocketEvent::WRITE|SocketEvent::PERSIST);
+	socket_event.Add();
+	return flushed;
+}
+
 void
 AsyncConnection::PollNotify() noexcept
 {
@@ -179,10 +591,14 @@ AsyncConnection::PollNotify() noexcept
 	switch (GetStatus()) {
 	case CONNECTION_OK:
 		try {
-			PollResult();
+			if (pipeline_mode)
+				PollPipelineResult();
+			else
+				PollResult();
 
 			while ((notify = GetNextNotify()))
-				handler.OnNotify(notify->relname);
+				handler.OnNotifyPayload(notify->relname,
+							notify->extra);
 
 			if (!was_idle && IsIdle())
 				handler.OnIdle();
@@ -241,8 +657,16 @@ AsyncConnection::Disconnect() noexcept
 
 	socket_event.Delete();
 	reconnect_timer.Cancel();
+	resume_stream_event.Cancel();
 	Connection::Disconnect();
 	state = State::DISCONNECTED;
+
+	pipeline_handlers.clear();
+	pipeline_timers.clear();
+	pipeline_aborted = false;
+
+	ResetCopy();
+	ResetStream();
 }
 
 void
@@ -257,7 +681,7 @@ AsyncConnection::ScheduleReconnect() noexcept
 }
 
 inline void
-AsyncConnection::OnSocketEvent(unsigned) noexcept
+AsyncConnection::OnSocketEvent(unsigned events) noexcept
 {
 	switch (state) {
 	case State::DISCONNECTED:
@@ -273,6 +697,18 @@ AsyncConnection::OnSocketEvent(unsigned) noexcept
 		break;
 
 	case State::READY:
+		if (events & SocketEvent::WRITE) {
+			try {
+				if (FlushOutput() &&
+				    copy_state == CopyState::IN)
+					ContinueCopyIn();
+			} catch (...) {
+				handler.OnError(std::current_exception());
+				Error();
+				break;
+			}
+		}
+
 		PollNotify();
 		break;
 	}
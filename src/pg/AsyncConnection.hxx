@@ -36,8 +36,13 @@
 #include "Connection.hxx"
 #include "event/SocketEvent.hxx"
 #include "event/TimerEvent.hxx"
+#include "event/DeferEvent.hxx"
 
 #include <cassert>
+#include <deque>
+#include <string>
+
+#include <stdint.h>
 
 namespace Pg {
 
@@ -68,6 +73,17 @@ public:
 	 */
 	virtual void OnNotify(const char *name) = 0;
 
+	/**
+	 * Like OnNotify(), but with the payload ("" if there is
+	 * none).  The default implementation calls OnNotify().
+	 *
+	 * Exceptions thrown by this method will be reported to
+	 * OnError(), and the connection will be closed.
+	 */
+	virtual void OnNotifyPayload(const char *name, const char *) {
+		OnNotify(name);
+	}
+
 	virtual void OnError(std::exception_ptr e) noexcept = 0;
 };
 
@@ -92,6 +108,56 @@ public:
 	}
 };
 
+/**
+ * Handler for AsyncConnection::SendCopy().  The result of the COPY
+ * command is delivered to the #AsyncResultHandler methods after all
+ * data has been transferred.
+ */
+class AsyncCopyHandler : public AsyncResultHandler {
+public:
+	/**
+	 * "COPY ... FROM STDIN": the server is ready to receive
+	 * data.  Submit it with AsyncConnection::PutCopyData() and
+	 * finish with AsyncConnection::EndCopyIn().  This is called
+	 * again after PutCopyData() has returned false and the
+	 * output buffer has been flushed.
+	 *
+	 * Exceptions thrown by this method will be reported to
+	 * AsyncConnectionHandler::OnError(), and the connection will
+	 * be closed.
+	 */
+	virtual void OnCopyReady() {}
+
+	/**
+	 * "COPY ... TO STDOUT": one row has been received.
+	 *
+	 * Exceptions thrown by this method will be reported to
+	 * AsyncConnectionHandler::OnError(), and the connection will
+	 * be closed.
+	 */
+	virtual void OnCopyData(const char *, size_t) {}
+};
+
+/**
+ * Handler for AsyncConnection::SendStreamQuery().  After the last
+ * batch, OnResult() receives the final result (an empty
+ * PGRES_TUPLES_OK result or an error), followed by OnResultEnd().
+ */
+class AsyncRowStreamHandler : public AsyncResultHandler {
+public:
+	/**
+	 * A batch of rows has been received.
+	 *
+	 * Exceptions thrown by this method will be reported to
+	 * AsyncConnectionHandler::OnError(), and the connection will
+	 * be closed.
+	 *
+	 * @return false to stop reading from the server until
+	 * AsyncConnection::ResumeStream() is called
+	 */
+	virtual bool OnRowBatch(RowBatch &&batch) = 0;
+};
+
 /**
  * A PostgreSQL database connection that connects asynchronously,
  * reconnects automatically and provides an asynchronous notify
@@ -154,8 +220,121 @@ class AsyncConnection : public Connection {
 	 */
 	TimerEvent reconnect_timer;
 
+	/**
+	 * Resumes a paused stream; see ResumeStream().
+	 */
+	DeferEvent resume_stream_event;
+
 	AsyncResultHandler *result_handler = nullptr;
 
+	/**
+	 * The handlers of the queries in progress in pipeline mode,
+	 * oldest first.  (#result_handler is not used in pipeline
+	 * mode.)  nullptr is an internal request (see
+	 * SendPrepared()) whose results are discarded.
+	 */
+	std::deque<AsyncResultHandler *> pipeline_handlers;
+
+	/**
+	 * Measures the query of #result_handler (if instrumentation
+	 * is enabled).
+	 */
+	QueryTimer query_timer;
+
+	/**
+	 * Measures the queries in #pipeline_handlers (one item for
+	 * each of them).
+	 */
+	std::deque<QueryTimer> pipeline_timers;
+
+	/**
+	 * Use pipeline mode?  See EnablePipelineMode().
+	 */
+	bool pipeline_mode = false;
+
+	/**
+	 * Has the current query in #pipeline_handlers been aborted
+	 * because an earlier one has failed?
+	 */
+	bool pipeline_aborted = false;
+
+	enum class CopyState : uint8_t {
+		/**
+		 * No COPY data is being transferred.
+		 */
+		NONE,
+
+		/**
+		 * "COPY ... FROM STDIN": waiting for the
+		 * #copy_handler to submit data.
+		 */
+		IN,
+
+		/**
+		 * "COPY ... TO STDOUT": receiving data.
+		 */
+		OUT,
+	};
+
+	CopyState copy_state = CopyState::NONE;
+
+	/**
+	 * The handler passed to SendCopy(); it is also the
+	 * #result_handler.
+	 */
+	AsyncCopyHandler *copy_handler = nullptr;
+
+	/**
+	 * COPY data which libpq has refused to queue because its
+	 * output buffer was full; it will be submitted as soon as
+	 * the socket becomes writable.
+	 */
+	std::string copy_pending;
+
+	/**
+	 * The error message for a postponed EndCopyIn() call (empty
+	 * if the COPY shall succeed).
+	 */
+	std::string copy_end_error;
+
+	/**
+	 * Was EndCopyIn() postponed because #copy_pending was not
+	 * empty or libpq's output buffer was full?
+	 */
+	bool copy_end_pending = false;
+
+	/**
+	 * Has PutCopyData() returned false?  Then the
+	 * #copy_handler will be notified as soon as the output
+	 * buffer has been flushed.
+	 */
+	bool copy_blocked = false;
+
+	/**
+	 * Has the connection been switched to non-blocking mode
+	 * for "COPY ... FROM STDIN"?
+	 */
+	bool copy_nonblocking = false;
+
+	/**
+	 * The handler passed to SendStreamQuery(); it is also the
+	 * #result_handler.
+	 */
+	AsyncRowStreamHandler *stream_handler = nullptr;
+
+	/**
+	 * The rows received in single-row mode which have not yet
+	 * been passed to the #stream_handler.
+	 */
+	RowBatch stream_batch;
+
+	size_t stream_batch_size = 0;
+
+	/**
+	 * Has the #stream_handler asked to stop reading?
+	 */
+	bool stream_paused = false;
+
 public:
 	/**
 	 * Construct the object, but do not initiate the connect yet.
@@ -177,6 +356,21 @@ public:
 		return state == State::READY;
 	}
 
+#ifdef LIBPQ_HAS_PIPELINING
+	/**
+	 * Use the pipeline mode of PostgreSQL 14: SendQuery() may be
+	 * called while other queries are in progress, and the results
+	 * are dispatched to their handlers in order.  Each query is
+	 * followed by a synchronization point, so a failed query
+	 * aborts only itself.  This must be called before Connect().
+	 */
+	void EnablePipelineMode() noexcept {
+		assert(state == State::DISCONNECTED);
+
+		pipeline_mode = true;
+	}
+#endif
+
 	/**
 	 * Initiate the initial connect.  This may be called only once.
 	 */
@@ -194,17 +388,155 @@ public:
 	bool IsIdle() const {
 		assert(IsDefined());
 
-		return state == State::READY && result_handler == nullptr;
+		return state == State::READY && result_handler == nullptr &&
+			pipeline_handlers.empty();
+	}
+
+	/**
+	 * May SendQuery() be called now?  Unlike IsIdle(), this is
+	 * true in pipeline mode while other queries are in progress.
+	 */
+	gcc_pure
+	bool CanSendQuery() const {
+		return pipeline_mode
+			? state == State::READY
+			: IsIdle();
 	}
 
 	template<typename... Params>
 	void SendQuery(AsyncResultHandler &_handler, Params... params) {
+		assert(CanSendQuery());
+
+		auto timer = StartQueryTimer(GetQueryString(params...));
+
+		Connection::SendQuery(params...);
+
+		if (pipeline_mode) {
+			CommitPipelineQuery(_handler, timer);
+			return;
+		}
+
+		/* set this only after the query has been sent
+		   successfully, or else the connection would remain
+		   busy after an exception */
+		result_handler = &_handler;
+		query_timer = timer;
+	}
+
+	/**
+	 * Like SendQuery(), but execute a #Statement.  If the
+	 * statement has not been prepared on this connection yet,
+	 * this is done first: in pipeline mode, the request is
+	 * queued before the query; otherwise, it is prepared
+	 * synchronously (one round trip per statement and
+	 * connection).
+	 *
+	 * Throws on error.
+	 */
+	template<typename... Params>
+	void SendPrepared(AsyncResultHandler &_handler,
+			  const Statement &s, Params... params) {
+		assert(CanSendQuery());
+
+		PrepareLazily(s);
+
+		auto timer = StartQueryTimer(s);
+
+		Connection::SendPrepared(false, s, params...);
+
+		if (pipeline_mode) {
+			CommitPipelineQuery(_handler, timer);
+			return;
+		}
+
+		result_handler = &_handler;
+		query_timer = timer;
+	}
+
+	/**
+	 * Send a COPY command.  Data is exchanged through the
+	 * #AsyncCopyHandler methods; "COPY ... FROM STDIN" switches
+	 * the connection to non-blocking mode until the command has
+	 * finished.  COPY is not available in pipeline mode.
+	 *
+	 * Throws on error.
+	 */
+	void SendCopy(AsyncCopyHandler &_handler, const char *query) {
 		assert(IsIdle());
+		assert(!pipeline_mode);
+
+		auto timer = StartQueryTimer(query);
+
+		Connection::SendQuery(query);
 
 		result_handler = &_handler;
+		copy_handler = &_handler;
+		query_timer = timer;
+	}
+
+	/**
+	 * Submit data for "COPY ... FROM STDIN"; may only be called
+	 * after AsyncCopyHandler::OnCopyReady().  The data is always
+	 * accepted.
+	 *
+	 * Throws on error.
+	 *
+	 * @return true if more data may be submitted right away,
+	 * false if the caller shall wait for the next
+	 * AsyncCopyHandler::OnCopyReady() call
+	 */
+	bool PutCopyData(const void *data, size_t size);
+
+	bool PutCopyData(const CopyEncoder &encoder) {
+		return PutCopyData(encoder.GetData(), encoder.GetSize());
+	}
+
+	/**
+	 * Finish "COPY ... FROM STDIN".  The result will be
+	 * delivered to the #AsyncCopyHandler.
+	 *
+	 * Throws on error.
+	 *
+	 * @param error if not nullptr, then the command fails with
+	 * this error message
+	 */
+	void EndCopyIn(const char *error=nullptr);
+
+#if PG_VERSION_NUM >= 90200
+	/**
+	 * Like SendQuery(), but receive the rows in single-row mode
+	 * and pass them to the handler in batches of up to
+	 * #batch_size rows, instead of holding the whole result in
+	 * memory.  Not available in pipeline mode.
+	 *
+	 * Throws on error.
+	 */
+	template<typename... Params>
+	void SendStreamQuery(AsyncRowStreamHandler &_handler,
+			     size_t batch_size, Params... params) {
+		assert(IsIdle());
+		assert(!pipeline_mode);
+		assert(batch_size > 0);
+
+		auto timer = StartQueryTimer(GetQueryString(params...));
 
 		Connection::SendQuery(params...);
+		SetSingleRowMode();
+
+		result_handler = &_handler;
+		query_timer = timer;
+		stream_handler = &_handler;
+		stream_batch_size = batch_size;
+		stream_batch.reserve(batch_size);
 	}
+#endif
+
+	/**
+	 * Continue reading rows after AsyncRowStreamHandler::OnRowBatch()
+	 * has returned false.  Already received rows are delivered
+	 * from inside the event loop, not from this method.
+	 */
+	void ResumeStream() noexcept;
 
 	void CheckNotify() noexcept {
 		if (IsReady())
@@ -224,13 +556,92 @@ protected:
 	void PollConnect() noexcept;
 	void PollReconnect() noexcept;
 	void PollResult();
+	void PollPipelineResult();
+
+	/**
+	 * The server has accepted "COPY ... FROM STDIN".
+	 */
+	void StartCopyIn();
+
+	/**
+	 * Submit postponed COPY data after the output buffer has
+	 * been flushed, and notify the #copy_handler.
+	 */
+	void ContinueCopyIn();
+
+	/**
+	 * Receive "COPY ... TO STDOUT" data.
+	 *
+	 * @return true if all data has been received
+	 */
+	bool PollCopyOut();
+
+	void ResetCopy() noexcept;
+
+	/**
+	 * Handle a result of a SendStreamQuery() call.
+	 *
+	 * @return true if the result has been consumed
+	 */
+	bool HandleStreamResult(Result &result);
+
+	/**
+	 * Pass #stream_batch to the #stream_handler.
+	 *
+	 * @param may_pause honor a pause request from the handler?
+	 */
+	void FlushStreamBatch(bool may_pause);
+
+	void ResetStream() noexcept;
 	void PollNotify() noexcept;
 
+	/**
+	 * Called by SendQuery() in pipeline mode: add the handler to
+	 * #pipeline_handlers and send a synchronization point.
+	 * Errors are reported to the handlers.
+	 */
+	void CommitPipelineQuery(AsyncResultHandler &_handler,
+				 const QueryTimer &timer) noexcept;
+
+	/**
+	 * Prepare the statement (or queue its preparation in pipeline
+	 * mode) unless that has been done already.
+	 *
+	 * Throws on error.
+	 */
+	void PrepareLazily(const Statement &s);
+
+	/**
+	 * Flush the output buffer and watch the socket for
+	 * writability if that was not possible.
+	 *
+	 * Throws on error.
+	 *
+	 * @return true if the output buffer is empty
+	 */
+	bool FlushOutput();
+
 	void ScheduleReconnect() noexcept;
 
 private:
+	/**
+	 * Extract the SQL text from SendQuery() parameters.
+	 */
+	template<typename... Params>
+	static const char *GetQueryString(const char *query,
+					  Params...) noexcept {
+		return query;
+	}
+
+	template<typename... Params>
+	static const char *GetQueryString(bool, const char *query,
+					  Params...) noexcept {
+		return query;
+	}
+
 	void OnSocketEvent(unsigned events) noexcept;
 	void OnReconnectTimer() noexcept;
+	void OnResumeStream() noexcept;
 };
 
 } /* namespace Pg */
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "AsyncConnectionPool.hxx"
+
+#include <algorithm>
+
+namespace Pg {
+
+AsyncConnectionPool::PooledConnection::PooledConnection(AsyncConnectionPool &_pool,
+							Schema &_schema) noexcept
+	:pool(_pool), schema(_schema),
+	 connection(pool.event_loop, pool.conninfo.c_str(),
+		    schema.name.c_str(), *this)
+{
+}
+
+void
+AsyncConnectionPool::PooledConnection::Dispatch() noexcept
+{
+	while (IsIdle() && !schema.queue.empty()) {
+		auto &query = schema.queue.front();
+		schema.queue.pop_front();
+
+		try {
+			query.SendQuery(connection);
+		} catch (...) {
+			pool.handler.OnError(std::current_exception());
+			query.OnResultError();
+		}
+	}
+}
+
+void
+AsyncConnectionPool::PooledConnection::OnConnect()
+{
+	Dispatch();
+}
+
+void
+AsyncConnectionPool::PooledConnection::OnIdle()
+{
+	Dispatch();
+}
+
+void
+AsyncConnectionPool::PooledConnection::OnDisconnect() noexcept
+{
+	/* the query in progress (if any) has been reported to its
+	   handler; queued queries wait for another connection or for
+	   the reconnect */
+}
+
+void
+AsyncConnectionPool::PooledConnection::OnNotify(const char *)
+{
+}
+
+void
+AsyncConnectionPool::PooledConnection::OnError(std::exception_ptr e) noexcept
+{
+	pool.handler.OnError(e);
+}
+
+AsyncConnectionPool::AsyncConnectionPool(EventLoop &_event_loop,
+					 const char *_conninfo,
+					 const char *_schema,
+					 unsigned _min_connections,
+					 unsigned _max_connections,
+					 AsyncConnectionPoolHandler &_handler) noexcept
+	:event_loop(_event_loop), conninfo(_conninfo),
+	 default_schema(_schema != nullptr ? _schema : ""),
+	 min_connections(_min_connections),
+	 max_connections(std::max(_max_connections, 1u)),
+	 handler(_handler)
+{
+	assert(min_connections <= max_connections);
+}
+
+AsyncConnectionPool::~AsyncConnectionPool() noexcept
+{
+	for (auto &i : schemas)
+		i.second.queue.clear();
+}
+
+AsyncConnectionPool::Schema &
+AsyncConnectionPool::MakeSchema(const std::string &name) noexcept
+{
+	auto i = schemas.emplace(std::piecewise_construct,
+				 std::forward_as_tuple(name),
+				 std::forward_as_tuple(name));
+	auto &schema = i.first->second;
+
+	if (i.second)
+		for (unsigned n = 0; n < min_connections; ++n)
+			AddConnection(schema);
+
+	return schema;
+}
+
+void
+AsyncConnectionPool::AddConnection(Schema &schema) noexcept
+{
+	schema.connections.emplace_back(*this, schema);
+	schema.connections.back().Connect();
+}
+
+void
+AsyncConnectionPool::Submit(AsyncPoolQuery &query, const char *_schema) noexcept
+{
+	assert(!query.is_linked());
+
+	auto &schema = MakeSchema(_schema != nullptr
+				  ? std::string(_schema)
+				  : default_schema);
+
+	/* the queue is only non-empty if there is no idle connection,
+	   so new queries cannot overtake queued ones */
+	schema.queue.push_back(query);
+
+	for (auto &c : schema.connections) {
+		if (c.IsIdle()) {
+			c.Dispatch();
+			return;
+		}
+	}
+
+	if (schema.connections.size() < max_connections)
+		/* the new connection will pick up the query as soon
+		   as it is ready */
+		AddConnection(schema);
+}
+
+const AsyncConnectionPool::Schema *
+AsyncConnectionPool::FindSchema(const char *name) const noexcept
+{
+	auto i = schemas.find(name != nullptr
+			      ? std::string(name)
+			      : default_schema);
+	return i != schemas.end()
+		? &i->second
+		: nullptr;
+}
+
+size_t
+AsyncConnectionPool::GetQueueLength(const char *_schema) const noexcept
+{
+	const auto *schema = FindSchema(_schema);
+	return schema != nullptr
+		? schema->queue.size()
+		: 0;
+}
+
+unsigned
+AsyncConnectionPool::GetReadyCount(const char *_schema) const noexcept
+{
+	const auto *schema = FindSchema(_schema);
+	if (schema == nullptr)
+		return 0;
+
+	return std::count_if(schema->connections.begin(),
+			     schema->connections.end(),
+			     [](const PooledConnection &c){
+				     return c.IsReady();
+			     });
+}
+
+unsigned
+AsyncConnectionPool::GetBusyCount(const char *_schema) const noexcept
+{
+	const auto *schema = FindSchema(_schema);
+	if (schema == nullptr)
+		return 0;
+
+	return std::count_if(schema->connections.begin(),
+			     schema->connections.end(),
+			     [](const PooledConnection &c){
+				     return c.IsReady() && !c.IsIdle();
+			     });
+}
+
+} /* namespace Pg */
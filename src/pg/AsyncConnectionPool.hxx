@@ -0,0 +1,240 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "AsyncConnection.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+#include <list>
+#include <map>
+#include <string>
+
+namespace Pg {
+
+class AsyncConnectionPool;
+
+/**
+ * A query submitted to an #AsyncConnectionPool.  While it waits for
+ * a connection, it is linked in the pool's wait queue; destroying
+ * it removes it from there.
+ */
+class AsyncPoolQuery
+	: public AsyncResultHandler,
+	  public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> {
+public:
+	/**
+	 * A connection is available for this query.  The
+	 * implementation calls AsyncConnection::SendQuery() with
+	 * this object as #AsyncResultHandler.
+	 *
+	 * Exceptions thrown by this method will be reported to
+	 * OnResultError() and AsyncConnectionPoolHandler::OnError().
+	 */
+	virtual void SendQuery(AsyncConnection &connection) = 0;
+
+	/**
+	 * Does this query only read?  Then a #ReplicaRouter may
+	 * send it to a replica.
+	 */
+	virtual bool IsReadOnly() const noexcept {
+		return false;
+	}
+};
+
+class AsyncConnectionPoolHandler {
+public:
+	/**
+	 * An error has occurred on one of the connections; the
+	 * connection will be reestablished automatically.
+	 */
+	virtual void OnError(std::exception_ptr e) noexcept = 0;
+};
+
+/**
+ * A pool of #AsyncConnection instances to one database.  Queries
+ * are dispatched to an idle connection of their schema (see
+ * AsyncConnection::GetSchemaName()), and if there is none, they wait
+ * in a FIFO queue until one becomes idle; new connections are
+ * established on demand, up to the configured maximum per schema.
+ * Broken connections are reestablished by the reconnect logic of
+ * #AsyncConnection.
+ */
+class AsyncConnectionPool final {
+	struct Schema;
+
+	class PooledConnection final : AsyncConnectionHandler {
+		AsyncConnectionPool &pool;
+
+		Schema &schema;
+
+		AsyncConnection connection;
+
+	public:
+		PooledConnection(AsyncConnectionPool &_pool,
+				 Schema &_schema) noexcept;
+
+		void Connect() noexcept {
+			connection.Connect();
+		}
+
+		/**
+		 * Can a query be sent on this connection now?  In
+		 * pipeline mode, this is true while other queries are
+		 * in progress.
+		 */
+		bool IsIdle() const noexcept {
+			return connection.IsReady() && connection.CanSendQuery();
+		}
+
+		bool IsReady() const noexcept {
+			return connection.IsReady();
+		}
+
+		/**
+		 * Send queued queries while this connection is idle.
+		 */
+		void Dispatch() noexcept;
+
+	private:
+		/* virtual methods from AsyncConnectionHandler */
+		void OnConnect() override;
+		void OnIdle() override;
+		void OnDisconnect() noexcept override;
+		void OnNotify(const char *name) override;
+		void OnError(std::exception_ptr e) noexcept override;
+	};
+
+	typedef boost::intrusive::list<AsyncPoolQuery,
+				       boost::intrusive::constant_time_size<false>> QueryList;
+
+	struct Schema {
+		const std::string name;
+
+		std::list<PooledConnection> connections;
+
+		/**
+		 * Queries waiting for an idle connection, oldest
+		 * first.
+		 */
+		QueryList queue;
+
+		explicit Schema(const std::string &_name):name(_name) {}
+	};
+
+	EventLoop &event_loop;
+
+	const std::string conninfo;
+
+	const std::string default_schema;
+
+	const unsigned min_connections, max_connections;
+
+	AsyncConnectionPoolHandler &handler;
+
+	std::map<std::string, Schema> schemas;
+
+public:
+	/**
+	 * @param schema the schema used by Submit() if none was
+	 * specified
+	 * @param min_connections the number of connections per schema
+	 * which are established by Start() or by the first query
+	 * @param max_connections the maximum number of connections
+	 * per schema
+	 */
+	AsyncConnectionPool(EventLoop &event_loop,
+			    const char *conninfo, const char *schema,
+			    unsigned min_connections,
+			    unsigned max_connections,
+			    AsyncConnectionPoolHandler &handler) noexcept;
+
+	~AsyncConnectionPool() noexcept;
+
+	AsyncConnectionPool(const AsyncConnectionPool &) = delete;
+	AsyncConnectionPool &operator=(const AsyncConnectionPool &) = delete;
+
+	/**
+	 * Establish the minimum number of connections for the default
+	 * schema now instead of waiting for the first query.
+	 */
+	void Start() noexcept {
+		MakeSchema(default_schema);
+	}
+
+	/**
+	 * Send a query on an idle connection or queue it until one
+	 * becomes idle.  The query object must remain valid until
+	 * its #AsyncResultHandler methods have finished, or until
+	 * it is destroyed while still waiting in the queue.
+	 *
+	 * @param schema the schema to route the query to; nullptr
+	 * selects the default schema
+	 */
+	void Submit(AsyncPoolQuery &query, const char *schema=nullptr) noexcept;
+
+	/**
+	 * Returns the number of queries waiting for a connection of
+	 * the given schema (nullptr selects the default schema).
+	 */
+	gcc_pure
+	size_t GetQueueLength(const char *schema=nullptr) const noexcept;
+
+	/**
+	 * Returns the number of established connections of the given
+	 * schema (nullptr selects the default schema).
+	 */
+	gcc_pure
+	unsigned GetReadyCount(const char *schema=nullptr) const noexcept;
+
+	/**
+	 * Returns the number of established connections of the given
+	 * schema which are busy with a query.
+	 */
+	gcc_pure
+	unsigned GetBusyCount(const char *schema=nullptr) const noexcept;
+
+private:
+	gcc_pure
+	const Schema *FindSchema(const char *name) const noexcept;
+
+	/**
+	 * Look up a #Schema, and create it (with #min_connections
+	 * connections) if it does not exist yet.
+	 */
+	Schema &MakeSchema(const std::string &name) noexcept;
+
+	void AddConnection(Schema &schema) noexcept;
+};
+
+} /* namespace Pg */
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BinaryDecoder.hxx"
+
+#include <limits>
+
+namespace Pg {
+
+/**
+ * The PostgreSQL epoch (2000-01-01 00:00:00 UTC) as a Unix time
+ * stamp.
+ */
+static constexpr std::chrono::seconds pg_epoch(946684800);
+
+static constexpr std::chrono::hours pg_day(24);
+static constexpr auto pg_month = 30 * pg_day;
+static constexpr auto pg_year = 365 * pg_day + pg_day / 4;
+
+std::chrono::system_clock::time_point
+DecodeTimestamp(BinaryValue value)
+{
+	using std::chrono::system_clock;
+
+	const int64_t us = DecodeInt64(value);
+	if (us == std::numeric_limits<int64_t>::max())
+		return system_clock::time_point::max();
+	else if (us == std::numeric_limits<int64_t>::min())
+		return system_clock::time_point::min();
+
+	const auto d = pg_epoch + std::chrono::microseconds(us);
+	return system_clock::time_point(std::chrono::duration_cast<system_clock::duration>(d));
+}
+
+static inline uint32_t
+ReadBE32(const uint8_t *p) noexcept
+{
+	uint32_t raw;
+	memcpy(&raw, p, sizeof(raw));
+	return FromBE32(raw);
+}
+
+static inline uint64_t
+ReadBE64(const uint8_t *p) noexcept
+{
+	uint64_t raw;
+	memcpy(&raw, p, sizeof(raw));
+	return FromBE64(raw);
+}
+
+std::chrono::microseconds
+DecodeInterval(BinaryValue value)
+{
+	/* int64 microseconds, int32 days, int32 months */
+	if (value.size != 16)
+		throw std::invalid_argument("Wrong interval size");
+
+	const auto *p = (const uint8_t *)value.data;
+	const int64_t us = ReadBE64(p);
+	const int32_t days = ReadBE32(p + 8);
+	const int32_t months = ReadBE32(p + 12);
+
+	/* split the months into years and months like the text
+	   representation does */
+	const int32_t years = months / 12;
+
+	const auto calendar = days * pg_day + (months % 12) * pg_month
+		+ years * pg_year;
+
+	return std::chrono::microseconds(us)
+		+ std::chrono::duration_cast<std::chrono::microseconds>(calendar);
+}
+
+unsigned
+DecodeBinaryArrayHeader(BinaryValue &value, Oid element_type)
+{
+	/* int32 ndim, int32 flags, Oid element_type; then int32
+	   length and int32 lower bound per dimension */
+	if (value.size < 12)
+		throw std::invalid_argument("Malformed binary array");
+
+	const auto *p = (const uint8_t *)value.data;
+	const uint32_t ndim = ReadBE32(p);
+	const Oid type = ReadBE32(p + 8);
+
+	if (ndim == 0) {
+		/* empty array */
+		value = {p + 12, value.size - 12};
+		return 0;
+	}
+
+	if (ndim != 1)
+		throw std::invalid_argument("Multi-dimensional arrays not supported");
+
+	if (type != element_type)
+		throw std::invalid_argument("Wrong array element type");
+
+	if (value.size < 20)
+		throw std::invalid_argument("Malformed binary array");
+
+	const uint32_t n = ReadBE32(p + 12);
+
+	value = {p + 20, value.size - 20};
+	return n;
+}
+
+BinaryValue
+DecodeBinaryArrayElement(BinaryValue &value)
+{
+	if (value.size < 4)
+		throw std::invalid_argument("Malformed binary array");
+
+	const auto *p = (const uint8_t *)value.data;
+	const int32_t length = ReadBE32(p);
+	p += 4;
+
+	if (length < 0) {
+		/* NULL */
+		value = {p, value.size - 4};
+		return {nullptr, 0};
+	}
+
+	if (value.size - 4 < size_t(length))
+		throw std::invalid_argument("Malformed binary array");
+
+	value = {p + length, value.size - 4 - length};
+	return {p, size_t(length)};
+}
+
+} /* namespace Pg */
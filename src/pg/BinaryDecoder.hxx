@@ -0,0 +1,342 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "BinaryValue.hxx"
+#include "util/ByteOrder.hxx"
+
+#include "util/Compiler.h"
+
+#include <postgresql/libpq-fe.h>
+
+#include <array>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Decoders for values in the binary format of the PostgreSQL wire
+ * protocol, i.e. results of queries with "result_binary=true" (see
+ * Connection::ExecuteParams()).  All of them throw
+ * std::invalid_argument if the value is malformed.
+ */
+
+namespace Pg {
+
+/**
+ * The binary representation of a PostgreSQL "uuid" value.
+ */
+typedef std::array<uint8_t, 16> Uuid;
+
+template<typename T>
+static inline T
+DecodeBinaryRaw(BinaryValue value)
+{
+	if (value.size != sizeof(T))
+		throw std::invalid_argument("Wrong binary value size");
+
+	T raw;
+	memcpy(&raw, value.data, sizeof(raw));
+	return raw;
+}
+
+static inline int16_t
+DecodeInt16(BinaryValue value)
+{
+	return FromBE16(DecodeBinaryRaw<uint16_t>(value));
+}
+
+static inline int32_t
+DecodeInt32(BinaryValue value)
+{
+	return FromBE32(DecodeBinaryRaw<uint32_t>(value));
+}
+
+static inline int64_t
+DecodeInt64(BinaryValue value)
+{
+	return FromBE64(DecodeBinaryRaw<uint64_t>(value));
+}
+
+static inline double
+DecodeFloat8(BinaryValue value)
+{
+	static_assert(sizeof(double) == sizeof(uint64_t), "");
+
+	const uint64_t raw = DecodeInt64(value);
+	double result;
+	memcpy(&result, &raw, sizeof(result));
+	return result;
+}
+
+static inline bool
+DecodeBool(BinaryValue value)
+{
+	return DecodeBinaryRaw<uint8_t>(value) != 0;
+}
+
+static inline Uuid
+DecodeUuid(BinaryValue value)
+{
+	return DecodeBinaryRaw<Uuid>(value);
+}
+
+/**
+ * Decode a "timestamp" or "timestamptz" value (with
+ * "integer_datetimes", the default since PostgreSQL 8.4).  The
+ * special values "infinity" and "-infinity" are mapped to
+ * time_point::max() and time_point::min().
+ */
+gcc_pure
+std::chrono::system_clock::time_point
+DecodeTimestamp(BinaryValue value);
+
+/**
+ * Decode an "interval" value with the same conventions as
+ * ParseIntervalS(): a month has 30 days and a year has 365.25
+ * days.
+ */
+gcc_pure
+std::chrono::microseconds
+DecodeInterval(BinaryValue value);
+
+/**
+ * Parse the header of a one-dimensional binary array.
+ *
+ * @param value the array; on return, this points to the first
+ * element
+ * @param element_type the expected type of the elements
+ * @return the number of elements
+ */
+unsigned
+DecodeBinaryArrayHeader(BinaryValue &value, Oid element_type);
+
+/**
+ * Obtain the next element of a binary array whose header has been
+ * parsed by DecodeBinaryArrayHeader().
+ *
+ * @param value the remaining array elements; on return, this
+ * points to the following element
+ * @return the element; its "data" is nullptr if the element is
+ * NULL
+ */
+BinaryValue
+DecodeBinaryArrayElement(BinaryValue &value);
+
+/**
+ * Describes how to decode a C++ type from a binary value.  The
+ * specializations provide:
+ *
+ * - Decode(BinaryValue)
+ * - IsType(Oid), which checks whether a column type is compatible
+ * - element_type, the OID which is expected for array elements
+ */
+template<typename T>
+struct BinaryTraits;
+
+template<>
+struct BinaryTraits<int16_t> {
+	static constexpr Oid element_type = 21;
+
+	static constexpr bool IsType(Oid type) noexcept {
+		return type == element_type;
+	}
+
+	static int16_t Decode(BinaryValue value) {
+		return DecodeInt16(value);
+	}
+};
+
+template<>
+struct BinaryTraits<int32_t> {
+	static constexpr Oid element_type = 23;
+
+	static constexpr bool IsType(Oid type) noexcept {
+		return type == element_type;
+	}
+
+	static int32_t Decode(BinaryValue value) {
+		return DecodeInt32(value);
+	}
+};
+
+template<>
+struct BinaryTraits<int64_t> {
+	static constexpr Oid element_type = 20;
+
+	static constexpr bool IsType(Oid type) noexcept {
+		return type == element_type;
+	}
+
+	static int64_t Decode(BinaryValue value) {
+		return DecodeInt64(value);
+	}
+};
+
+template<>
+struct BinaryTraits<double> {
+	static constexpr Oid element_type = 701;
+
+	static constexpr bool IsType(Oid type) noexcept {
+		return type == element_type;
+	}
+
+	static double Decode(BinaryValue value) {
+		return DecodeFloat8(value);
+	}
+};
+
+template<>
+struct BinaryTraits<bool> {
+	static constexpr Oid element_type = 16;
+
+	static constexpr bool IsType(Oid type) noexcept {
+		return type == element_type;
+	}
+
+	static bool Decode(BinaryValue value) {
+		return DecodeBool(value);
+	}
+};
+
+/**
+ * "bytea"; the returned value points into the #Result.
+ */
+template<>
+struct BinaryTraits<BinaryValue> {
+	static constexpr Oid element_type = 17;
+
+	static constexpr bool IsType(Oid type) noexcept {
+		return type == element_type;
+	}
+
+	static BinaryValue Decode(BinaryValue value) noexcept {
+		return value;
+	}
+};
+
+/**
+ * "text" and "varchar".
+ */
+template<>
+struct BinaryTraits<std::string> {
+	static constexpr Oid element_type = 25;
+
+	static constexpr bool IsType(Oid type) noexcept {
+		/* 1043 = varchar */
+		return type == element_type || type == 1043;
+	}
+
+	static std::string Decode(BinaryValue value) {
+		return std::string((const char *)value.data, value.size);
+	}
+};
+
+template<>
+struct BinaryTraits<Uuid> {
+	static constexpr Oid element_type = 2950;
+
+	static constexpr bool IsType(Oid type) noexcept {
+		return type == element_type;
+	}
+
+	static Uuid Decode(BinaryValue value) {
+		return DecodeUuid(value);
+	}
+};
+
+/**
+ * "timestamp" and "timestamptz".
+ */
+template<>
+struct BinaryTraits<std::chrono::system_clock::time_point> {
+	static constexpr Oid element_type = 1184;
+
+	static constexpr bool IsType(Oid type) noexcept {
+		/* 1114 = timestamp */
+		return type == element_type || type == 1114;
+	}
+
+	static std::chrono::system_clock::time_point Decode(BinaryValue value) {
+		return DecodeTimestamp(value);
+	}
+};
+
+template<>
+struct BinaryTraits<std::chrono::microseconds> {
+	static constexpr Oid element_type = 1186;
+
+	static constexpr bool IsType(Oid type) noexcept {
+		return type == element_type;
+	}
+
+	static std::chrono::microseconds Decode(BinaryValue value) {
+		return DecodeInterval(value);
+	}
+};
+
+/**
+ * One-dimensional arrays (without NULL elements).  The column type
+ * is not checked, only the element type embedded in the value.
+ */
+template<typename T>
+struct BinaryTraits<std::vector<T>> {
+	static constexpr bool IsType(Oid) noexcept {
+		return true;
+	}
+
+	static std::vector<T> Decode(BinaryValue value) {
+		const unsigned n =
+			DecodeBinaryArrayHeader(value,
+						BinaryTraits<T>::element_type);
+
+		std::vector<T> result;
+		result.reserve(n);
+
+		for (unsigned i = 0; i < n; ++i) {
+			const auto element = DecodeBinaryArrayElement(value);
+			if (element.data == nullptr)
+				throw std::invalid_argument("NULL array element");
+
+			result.emplace_back(BinaryTraits<T>::Decode(element));
+		}
+
+		return result;
+	}
+};
+
+} /* namespace Pg */
@@ -42,6 +42,7 @@ Connection::Connect(const char *conninfo)
 {
 	assert(!IsDefined());
 
+	prepared_statements.clear();
 	conn = ::PQconnectdb(conninfo);
 	if (conn == nullptr)
 		throw std::bad_alloc();
@@ -55,6 +56,7 @@ Connection::StartConnect(const char *conninfo)
 {
 	assert(!IsDefined());
 
+	prepared_statements.clear();
 	conn = ::PQconnectStart(conninfo);
 	if (conn == nullptr)
 		throw std::bad_alloc();
@@ -63,6 +65,36 @@ Connection::StartConnect(const char *conninfo)
 		throw std::runtime_error(GetErrorMessage());
 }
 
+void
+Connection::Prepare(const Statement &s)
+{
+	assert(IsDefined());
+
+	if (IsPrepared(s))
+		return;
+
+	auto result = CheckResult(::PQprepare(conn, s.GetName(), s.GetSql(),
+					      s.GetParamTypeCount(),
+					      s.GetParamTypes()));
+	if (!result.IsCommandSuccessful())
+		throw Error(std::move(result));
+
+	prepared_statements.emplace(&s);
+}
+
+void
+Connection::SendPrepare(const Statement &s)
+{
+	assert(IsDefined());
+	assert(!IsPrepared(s));
+
+	if (::PQsendPrepare(conn, s.GetName(), s.GetSql(),
+			    s.GetParamTypeCount(), s.GetParamTypes()) == 0)
+		throw std::runtime_error(GetErrorMessage());
+
+	prepared_statements.emplace(&s);
+}
+
 void
 Connection::ExecuteOrThrow(const char *query)
 {
@@ -71,6 +103,60 @@ Connection::ExecuteOrThrow(const char *query)
 		throw Error(std::move(result));
 }
 
+void
+Connection::BeginCopy(const char *query, ExecStatusType expected_status)
+{
+	auto result = Execute(query);
+	if (result.GetStatus() != expected_status) {
+		if (result.IsError())
+			throw Error(std::move(result));
+
+		throw std::runtime_error("Unexpected COPY direction");
+	}
+}
+
+bool
+Connection::PutCopyData(const void *data, size_t size)
+{
+	assert(IsDefined());
+
+	const int result = ::PQputCopyData(conn, (const char *)data, size);
+	if (result < 0)
+		throw std::runtime_error(GetErrorMessage());
+
+	return result > 0;
+}
+
+bool
+Connection::PutCopyEnd(const char *error)
+{
+	assert(IsDefined());
+
+	const int result = ::PQputCopyEnd(conn, error);
+	if (result < 0)
+		throw std::runtime_error(GetErrorMessage());
+
+	return result > 0;
+}
+
+unsigned
+Connection::FinishCopy()
+{
+	assert(IsDefined());
+
+	auto result = ReceiveResult();
+	if (!result.IsDefined())
+		throw std::runtime_error("No COPY result");
+
+	/* consume the end of the command */
+	while (ReceiveResult().IsDefined()) {}
+
+	if (!result.IsCommandSuccessful())
+		throw Error(std::move(result));
+
+	return result.GetAffectedRows();
+}
+
 void
 Connection::SetRole(const char *role_name)
 {
@@ -129,4 +215,18 @@ Connection::Escape(const char *p) const noexcept
 	return Escape(p, strlen(p));
 }
 
+std::string
+Connection::EscapeIdentifier(const char *p) const
+{
+	assert(IsDefined());
+	assert(p != nullptr);
+
+	char *buffer = ::PQescapeIdentifier(conn, p, strlen(p));
+	if (buffer == nullptr)
+		throw std::runtime_error(GetErrorMessage());
+
+	AtScopeExit(buffer) { ::PQfreemem(buffer); };
+	return buffer;
+}
+
 } /* namespace Pg */
@@ -36,15 +36,21 @@
 #include "ParamWrapper.hxx"
 #include "DynamicParamWrapper.hxx"
 #include "Result.hxx"
+#include "RowBatch.hxx"
 #include "Notify.hxx"
+#include "CopyEncoder.hxx"
+#include "Statement.hxx"
+#include "QueryStats.hxx"
 
 #include "util/Compiler.h"
+#include "util/ScopeExit.hxx"
 
 #include <postgresql/libpq-fe.h>
 #include <postgresql/pg_config.h>
 
 #include <new>
 #include <memory>
+#include <set>
 #include <string>
 #include <cassert>
 #include <algorithm>
@@ -58,6 +64,20 @@ namespace Pg {
 class Connection {
 	PGconn *conn = nullptr;
 
+	/**
+	 * The statements which have been prepared on this connection
+	 * (or were sent to be prepared, see SendPrepare()).  This is
+	 * cleared on (re)connect, because prepared statements belong
+	 * to the server session.
+	 */
+	std::set<const Statement *> prepared_statements;
+
+	/**
+	 * If not nullptr, then queries are measured and accounted
+	 * here.
+	 */
+	QueryInstrumentation *instrumentation = nullptr;
+
 public:
 	Connection() = default;
 
@@ -73,12 +93,16 @@ public:
 	Connection(const Connection &other) = delete;
 
 	Connection(Connection &&other) noexcept
-		:conn(std::exchange(other.conn, nullptr)) {}
+		:conn(std::exchange(other.conn, nullptr)),
+		 prepared_statements(std::move(other.prepared_statements)),
+		 instrumentation(other.instrumentation) {}
 
 	Connection &operator=(const Connection &other) = delete;
 
 	Connection &operator=(Connection &&other) noexcept {
 		std::swap(conn, other.conn);
+		std::swap(prepared_statements, other.prepared_statements);
+		std::swap(instrumentation, other.instrumentation);
 		return *this;
 	}
 
@@ -137,11 +161,25 @@ public:
 			::PQfinish(conn);
 			conn = nullptr;
 		}
+
+		prepared_statements.clear();
 	}
 
 	void Connect(const char *conninfo);
 	void StartConnect(const char *conninfo);
 
+	/**
+	 * Enable (or disable with nullptr) query instrumentation.
+	 * The object may be shared by several connections.
+	 */
+	void SetInstrumentation(QueryInstrumentation *_instrumentation) noexcept {
+		instrumentation = _instrumentation;
+	}
+
+	QueryInstrumentation *GetInstrumentation() const noexcept {
+		return instrumentation;
+	}
+
 	PostgresPollingStatusType PollConnect() {
 		assert(IsDefined());
 
@@ -151,12 +189,14 @@ public:
 	void Reconnect() noexcept {
 		assert(IsDefined());
 
+		prepared_statements.clear();
 		::PQreset(conn);
 	}
 
 	void StartReconnect() noexcept {
 		assert(IsDefined());
 
+		prepared_statements.clear();
 		::PQresetStart(conn);
 	}
 
@@ -179,6 +219,35 @@ public:
 	}
 
 protected:
+	/**
+	 * Start measuring a query (if instrumentation is enabled).
+	 */
+	template<typename K>
+	QueryTimer StartQueryTimer(const K &key) noexcept {
+		return instrumentation != nullptr
+			? QueryTimer(*instrumentation,
+				     instrumentation->Lookup(key))
+			: QueryTimer();
+	}
+
+	/**
+	 * Invoke a function which executes a query synchronously
+	 * and returns the #Result, and measure it.
+	 */
+	template<typename K, typename F>
+	Result Measure(const K &key, F &&f) {
+		if (instrumentation == nullptr)
+			return f();
+
+		auto timer = StartQueryTimer(key);
+		auto result = f();
+		timer.OnResult(result);
+		timer.Finish();
+		return result;
+	}
+
+	void BeginCopy(const char *query, ExecStatusType expected_status);
+
 	Result CheckResult(PGresult *result) {
 		if (result == nullptr)
 			throw std::bad_alloc();
@@ -229,7 +298,9 @@ public:
 		assert(IsDefined());
 		assert(query != nullptr);
 
-		return CheckResult(::PQexec(conn, query));
+		return Measure(query, [this, query](){
+				return CheckResult(::PQexec(conn, query));
+			});
 	}
 
 	template<typename... Params>
@@ -240,10 +311,14 @@ public:
 
 		const TextParamArray<Params...> params(_params...);
 
-		return CheckResult(::PQexecParams(conn, query, params.count,
-						  nullptr, params.values,
-						  nullptr, nullptr,
-						  result_binary));
+		return Measure(query, [&](){
+				return CheckResult(::PQexecParams(conn, query,
+								  params.count,
+								  nullptr,
+								  params.values,
+								  nullptr, nullptr,
+								  result_binary));
+			});
 	}
 
 	template<typename... Params>
@@ -258,10 +333,15 @@ public:
 
 		const BinaryParamArray<Params...> params(_params...);
 
-		return CheckResult(::PQexecParams(conn, query, params.count,
-						  nullptr, params.values,
-						  params.lengths, params.formats,
-						  false));
+		return Measure(query, [&](){
+				return CheckResult(::PQexecParams(conn, query,
+								  params.count,
+								  nullptr,
+								  params.values,
+								  params.lengths,
+								  params.formats,
+								  false));
+			});
 	}
 
 	/**
@@ -279,9 +359,73 @@ public:
 		std::unique_ptr<int[]> lengths(new int[n]);
 		std::unique_ptr<int[]> formats(new int[n]);
 
-		return ExecuteDynamic2<Params...>(query, values.get(),
-						  lengths.get(), formats.get(), 0,
-						  params...);
+		return Measure(query, [&](){
+				return ExecuteDynamic2<Params...>(query, values.get(),
+								  lengths.get(),
+								  formats.get(), 0,
+								  params...);
+			});
+	}
+
+	gcc_pure
+	bool IsPrepared(const Statement &s) const noexcept {
+		return prepared_statements.find(&s) != prepared_statements.end();
+	}
+
+	/**
+	 * Prepare the statement on this connection, unless that has
+	 * been done already.
+	 *
+	 * Throws #Error on error.
+	 */
+	void Prepare(const Statement &s);
+
+	/**
+	 * Send a request to prepare the statement without waiting
+	 * for the result, and assume that it will succeed; on
+	 * failure, the caller shall call ForgetPreparedStatements().
+	 * This is only useful in pipeline mode, where the following
+	 * queries can be sent before the result arrives.
+	 *
+	 * Throws std::runtime_error on error.
+	 */
+	void SendPrepare(const Statement &s);
+
+	/**
+	 * Assume that no statement is prepared on this connection,
+	 * so they will all be prepared again when used next time.
+	 */
+	void ForgetPreparedStatements() noexcept {
+		prepared_statements.clear();
+	}
+
+	/**
+	 * Execute a #Statement, preparing it first if this has not
+	 * been done on this connection yet.
+	 *
+	 * Throws #Error if preparing fails.
+	 */
+	template<typename... Params>
+	Result ExecutePrepared(bool result_binary,
+			       const Statement &s, Params... _params) {
+		assert(IsDefined());
+
+		Prepare(s);
+
+		const TextParamArray<Params...> params(_params...);
+
+		return Measure(s, [&](){
+				return CheckResult(::PQexecPrepared(conn, s.GetName(),
+								    params.count,
+								    params.values,
+								    nullptr, nullptr,
+								    result_binary));
+			});
+	}
+
+	template<typename... Params>
+	Result ExecutePrepared(const Statement &s, Params... params) {
+		return ExecutePrepared(false, s, params...);
 	}
 
 	/**
@@ -291,6 +435,111 @@ public:
 	 */
 	void ExecuteOrThrow(const char *query);
 
+	/**
+	 * Start a "COPY ... FROM STDIN" command.  Submit the data
+	 * with PutCopyData() (see #CopyEncoder) and finish with
+	 * EndCopyIn().
+	 *
+	 * Throws #Error on error.
+	 */
+	void BeginCopyIn(const char *query) {
+		BeginCopy(query, PGRES_COPY_IN);
+	}
+
+	/**
+	 * Start a "COPY ... TO STDOUT" command.  Receive the data
+	 * with ReceiveCopyData() and finish with FinishCopy().
+	 *
+	 * Throws #Error on error.
+	 */
+	void BeginCopyOut(const char *query) {
+		BeginCopy(query, PGRES_COPY_OUT);
+	}
+
+	/**
+	 * Submit data for "COPY ... FROM STDIN".  The data does not
+	 * need to be aligned to rows.
+	 *
+	 * Throws std::runtime_error on error.
+	 *
+	 * @return false if the data was not queued because the
+	 * connection is non-blocking and the output buffer is full;
+	 * the caller shall wait for the socket to become writable and
+	 * then try again
+	 */
+	bool PutCopyData(const void *data, size_t size);
+
+	bool PutCopyData(const CopyEncoder &encoder) {
+		return PutCopyData(encoder.GetData(), encoder.GetSize());
+	}
+
+	/**
+	 * Submit the end of "COPY ... FROM STDIN".
+	 *
+	 * Throws std::runtime_error on error.
+	 *
+	 * @param error if not nullptr, then the command fails with
+	 * this error message
+	 * @return false if the connection is non-blocking and the
+	 * output buffer is full (see PutCopyData())
+	 */
+	bool PutCopyEnd(const char *error=nullptr);
+
+	/**
+	 * Obtain the result of a COPY command after all data has
+	 * been transferred.
+	 *
+	 * Throws #Error on error.
+	 *
+	 * @return the number of rows which were copied
+	 */
+	unsigned FinishCopy();
+
+	/**
+	 * Finish "COPY ... FROM STDIN" (see BeginCopyIn()).
+	 *
+	 * Throws #Error on error.
+	 *
+	 * @return the number of rows which were copied
+	 */
+	unsigned EndCopyIn() {
+		PutCopyEnd();
+		return FinishCopy();
+	}
+
+	/**
+	 * Receive data from "COPY ... TO STDOUT", passing each row
+	 * to the given function (with a "const char *, size_t"
+	 * signature).
+	 *
+	 * Throws std::runtime_error on error.
+	 *
+	 * @param async if true, then return as soon as no more data
+	 * has been received; the caller shall call ConsumeInput()
+	 * when the socket becomes readable and then try again
+	 * @return true if all data has been received (and
+	 * FinishCopy() shall be called), false if more data is
+	 * expected (in async mode)
+	 */
+	template<typename F>
+	bool ReceiveCopyData(bool async, F &&f) {
+		assert(IsDefined());
+
+		while (true) {
+			char *buffer;
+			const int n = ::PQgetCopyData(conn, &buffer, async);
+			if (n > 0) {
+				AtScopeExit(buffer) { ::PQfreemem(buffer); };
+				f((const char *)buffer, size_t(n));
+			} else if (n == 0)
+				return false;
+			else if (n == -1)
+				return true;
+			else
+				throw std::runtime_error(GetErrorMessage());
+		}
+	}
+
 	/**
 	 * Wrapper for "SET ROLE ...".
 	 *
@@ -318,9 +567,14 @@ public:
 	 * Begin a transaction with isolation level "REPEATABLE READ".
 	 *
 	 * Throws #Error on error.
+	 *
+	 * @param read_only begin a "READ ONLY" transaction, which
+	 * may be executed on a replica
 	 */
-	void BeginRepeatableRead() {
-		ExecuteOrThrow("BEGIN ISOLATION LEVEL REPEATABLE READ");
+	void BeginRepeatableRead(bool read_only=false) {
+		ExecuteOrThrow(read_only
+			       ? "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY"
+			       : "BEGIN ISOLATION LEVEL REPEATABLE READ");
 	}
 
 	/**
@@ -413,10 +667,135 @@ public:
 		SendQuery(false, query, params...);
 	}
 
+	/**
+	 * Send a query for a #Statement which must have been
+	 * prepared on this connection already (see Prepare() and
+	 * SendPrepare()).
+	 *
+	 * Throws std::runtime_error on error.
+	 */
+	template<typename... Params>
+	void SendPrepared(bool result_binary,
+			  const Statement &s, Params... _params) {
+		assert(IsDefined());
+		assert(IsPrepared(s));
+
+		const TextParamArray<Params...> params(_params...);
+
+		if (::PQsendQueryPrepared(conn, s.GetName(), params.count,
+					  params.values, nullptr, nullptr,
+					  result_binary) == 0)
+			throw std::runtime_error(GetErrorMessage());
+	}
+
+	/**
+	 * Throws on error.
+	 */
+	void SetNonBlocking(bool nonblocking) {
+		assert(IsDefined());
+
+		if (::PQsetnonblocking(conn, nonblocking) < 0)
+			throw std::runtime_error(GetErrorMessage());
+	}
+
+	/**
+	 * Attempt to flush the output buffer (in non-blocking mode).
+	 *
+	 * Throws on error.
+	 *
+	 * @return true if all data has been sent, false if the
+	 * caller shall wait for the socket to become writable and
+	 * then try again
+	 */
+	bool Flush() {
+		assert(IsDefined());
+
+		const int result = ::PQflush(conn);
+		if (result < 0)
+			throw std::runtime_error(GetErrorMessage());
+
+		return result == 0;
+	}
+
+#ifdef LIBPQ_HAS_PIPELINING
+	/**
+	 * Throws on error.
+	 */
+	void EnterPipelineMode() {
+		assert(IsDefined());
+
+		if (::PQenterPipelineMode(conn) == 0)
+			throw std::runtime_error(GetErrorMessage());
+	}
+
+	/**
+	 * Throws on error.
+	 */
+	void PipelineSync() {
+		assert(IsDefined());
+
+		if (::PQpipelineSync(conn) == 0)
+			throw std::runtime_error(GetErrorMessage());
+	}
+#endif
+
 #if PG_VERSION_NUM >= 90200
 	void SetSingleRowMode() noexcept {
 		PQsetSingleRowMode(conn);
 	}
+
+	/**
+	 * Execute a query in single-row mode and pass the rows to
+	 * the given function in batches of up to #batch_size rows
+	 * (as a #RowBatch rvalue reference), instead of holding the
+	 * whole result in memory.  The server is not read from while
+	 * the function runs.
+	 *
+	 * Throws std::runtime_error if sending the query fails.
+	 *
+	 * @return the final result, which is either an empty
+	 * PGRES_TUPLES_OK result if all rows have been received,
+	 * or an error result; the caller is responsible for checking
+	 * its status
+	 */
+	template<typename F, typename... Params>
+	Result ExecuteStreaming(size_t batch_size, F &&f,
+				const char *query, Params... params) {
+		assert(batch_size > 0);
+
+		SendQuery(query, params...);
+		SetSingleRowMode();
+
+		RowBatch batch;
+		batch.reserve(batch_size);
+
+		Result final_result;
+
+		while (true) {
+			auto result = ReceiveResult();
+			if (!result.IsDefined())
+				break;
+
+			if (result.GetStatus() == PGRES_SINGLE_TUPLE) {
+				batch.push_back(std::move(result));
+				if (batch.size() >= batch_size) {
+					f(std::move(batch));
+					batch.clear();
+				}
+
+				continue;
+			}
+
+			if (!batch.empty()) {
+				f(std::move(batch));
+				batch.clear();
+			}
+
+			final_result = std::move(result);
+		}
+
+		return final_result;
+	}
 #endif
 
 	Result ReceiveResult() noexcept {
@@ -435,6 +814,14 @@ public:
 	std::string Escape(const std::string &p) const noexcept {
 		return Escape(p.data(), p.length());
 	}
+
+	/**
+	 * Quote an identifier (e.g. a table or channel name) for
+	 * use in a SQL command.
+	 *
+	 * Throws std::runtime_error on error.
+	 */
+	std::string EscapeIdentifier(const char *p) const;
 };
 
 } /* namespace Pg */
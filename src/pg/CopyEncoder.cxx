@@ -0,0 +1,270 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CopyEncoder.hxx"
+#include "util/ByteOrder.hxx"
+
+#include <string.h>
+#include <stdio.h>
+
+namespace Pg {
+
+/**
+ * The signature, flags field and header extension length of the
+ * binary COPY format.
+ */
+static constexpr char binary_header[] = "PGCOPY\n\377\r\n\0"
+	"\0\0\0\0"
+	"\0\0\0";
+
+CopyEncoder::CopyEncoder(bool _binary) noexcept
+	:binary(_binary)
+{
+	if (binary)
+		/* the terminating null byte of the string literal is
+		   the last byte of the header extension length */
+		buffer.append(binary_header, sizeof(binary_header));
+}
+
+inline void
+CopyEncoder::AppendRaw16(uint16_t value) noexcept
+{
+	value = ToBE16(value);
+	buffer.append((const char *)&value, sizeof(value));
+}
+
+inline void
+CopyEncoder::AppendRaw32(uint32_t value) noexcept
+{
+	value = ToBE32(value);
+	buffer.append((const char *)&value, sizeof(value));
+}
+
+inline void
+CopyEncoder::AppendRaw64(uint64_t value) noexcept
+{
+	value = ToBE64(value);
+	buffer.append((const char *)&value, sizeof(value));
+}
+
+void
+CopyEncoder::BeginRow(unsigned n_columns) noexcept
+{
+	if (binary)
+		AppendRaw16(n_columns);
+	else
+		first_column = true;
+}
+
+inline void
+CopyEncoder::BeginColumn() noexcept
+{
+	if (binary)
+		return;
+
+	if (first_column)
+		first_column = false;
+	else
+		buffer.push_back('\t');
+}
+
+void
+CopyEncoder::AppendNull() noexcept
+{
+	BeginColumn();
+
+	if (binary)
+		AppendRaw32(uint32_t(-1));
+	else
+		buffer.append("\\N", 2);
+}
+
+inline void
+CopyEncoder::AppendBinaryField(const void *value, size_t size) noexcept
+{
+	AppendRaw32(size);
+	buffer.append((const char *)value, size);
+}
+
+void
+CopyEncoder::AppendEscaped(const char *value, size_t length) noexcept
+{
+	const char *const end = value + length;
+	while (true) {
+		/* copy unescaped runs in one chunk */
+		const char *p = value;
+		while (p != end && *p != '\\' && *p != '\t' &&
+		       *p != '\n' && *p != '\r')
+			++p;
+
+		buffer.append(value, p);
+		if (p == end)
+			break;
+
+		buffer.push_back('\\');
+		switch (*p) {
+		case '\t':
+			buffer.push_back('t');
+			break;
+
+		case '\n':
+			buffer.push_back('n');
+			break;
+
+		case '\r':
+			buffer.push_back('r');
+			break;
+
+		default:
+			buffer.push_back(*p);
+			break;
+		}
+
+		value = p + 1;
+	}
+}
+
+void
+CopyEncoder::Append(const char *value, size_t length) noexcept
+{
+	BeginColumn();
+
+	if (binary)
+		AppendBinaryField(value, length);
+	else
+		AppendEscaped(value, length);
+}
+
+void
+CopyEncoder::Append(const char *value) noexcept
+{
+	Append(value, strlen(value));
+}
+
+void
+CopyEncoder::AppendBinary(const void *value, size_t size) noexcept
+{
+	BeginColumn();
+
+	if (binary) {
+		AppendBinaryField(value, size);
+		return;
+	}
+
+	/* the "hex" format of bytea; the backslash needs to be
+	   escaped for COPY */
+	static constexpr char hex_digits[] = "0123456789abcdef";
+
+	buffer.append("\\\\x", 3);
+
+	const auto *p = (const uint8_t *)value;
+	for (size_t i = 0; i < size; ++i) {
+		buffer.push_back(hex_digits[p[i] >> 4]);
+		buffer.push_back(hex_digits[p[i] & 0xf]);
+	}
+}
+
+void
+CopyEncoder::AppendBool(bool value) noexcept
+{
+	BeginColumn();
+
+	if (binary) {
+		AppendRaw32(1);
+		buffer.push_back(value);
+	} else
+		buffer.push_back(value ? 't' : 'f');
+}
+
+void
+CopyEncoder::AppendInt16(int16_t value) noexcept
+{
+	if (binary) {
+		AppendRaw32(sizeof(value));
+		AppendRaw16(value);
+	} else
+		AppendInt64(value);
+}
+
+void
+CopyEncoder::AppendInt32(int32_t value) noexcept
+{
+	if (binary) {
+		AppendRaw32(sizeof(value));
+		AppendRaw32(value);
+	} else
+		AppendInt64(value);
+}
+
+void
+CopyEncoder::AppendInt64(int64_t value) noexcept
+{
+	BeginColumn();
+
+	if (binary) {
+		AppendRaw32(sizeof(value));
+		AppendRaw64(value);
+	} else {
+		char tmp[32];
+		buffer.append(tmp, snprintf(tmp, sizeof(tmp), "%lld",
+					    (long long)value));
+	}
+}
+
+void
+CopyEncoder::AppendDouble(double value) noexcept
+{
+	BeginColumn();
+
+	if (binary) {
+		static_assert(sizeof(value) == sizeof(uint64_t), "");
+
+		uint64_t raw;
+		memcpy(&raw, &value, sizeof(raw));
+
+		AppendRaw32(sizeof(value));
+		AppendRaw64(raw);
+	} else {
+		char tmp[32];
+		buffer.append(tmp, snprintf(tmp, sizeof(tmp), "%.17g",
+					    value));
+	}
+}
+
+void
+CopyEncoder::Finish() noexcept
+{
+	if (binary)
+		AppendRaw16(uint16_t(-1));
+}
+
+} /* namespace Pg */
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/Compiler.h"
+
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Pg {
+
+/**
+ * Encodes rows for "COPY ... FROM STDIN" into a buffer which can be
+ * submitted with Connection::PutCopyData().  Supports both the text
+ * format and the binary format ("WITH (FORMAT binary)").
+ *
+ * In binary format, the caller must append values in exactly the
+ * column types of the table; in text format, the server parses each
+ * value.
+ */
+class CopyEncoder {
+	std::string buffer;
+
+	const bool binary;
+
+	/**
+	 * Text format only: has the first column of the current row
+	 * been appended already?
+	 */
+	bool first_column;
+
+public:
+	/**
+	 * @param binary use the binary format (the COPY command must
+	 * specify "FORMAT binary")
+	 */
+	explicit CopyEncoder(bool _binary=false) noexcept;
+
+	CopyEncoder(const CopyEncoder &) = delete;
+	CopyEncoder &operator=(const CopyEncoder &) = delete;
+
+	bool IsBinary() const noexcept {
+		return binary;
+	}
+
+	bool IsEmpty() const noexcept {
+		return buffer.empty();
+	}
+
+	const char *GetData() const noexcept {
+		return buffer.data();
+	}
+
+	size_t GetSize() const noexcept {
+		return buffer.size();
+	}
+
+	/**
+	 * Discard the buffer contents after they have been
+	 * submitted.
+	 */
+	void Clear() noexcept {
+		buffer.clear();
+	}
+
+	void BeginRow(unsigned n_columns) noexcept;
+
+	void EndRow() noexcept {
+		if (!binary)
+			buffer.push_back('\n');
+	}
+
+	void AppendNull() noexcept;
+
+	/**
+	 * Append a value of type "text" or "varchar" (or, in text
+	 * format, any value in its text representation).
+	 */
+	void Append(const char *value, size_t length) noexcept;
+
+	void Append(const char *value) noexcept;
+
+	void Append(const std::string &value) noexcept {
+		Append(value.data(), value.length());
+	}
+
+	/**
+	 * Append a value of type "bytea".
+	 */
+	void AppendBinary(const void *value, size_t size) noexcept;
+
+	void AppendBool(bool value) noexcept;
+
+	/**
+	 * Append a value of type "int2".
+	 */
+	void AppendInt16(int16_t value) noexcept;
+
+	/**
+	 * Append a value of type "int4".
+	 */
+	void AppendInt32(int32_t value) noexcept;
+
+	/**
+	 * Append a value of type "int8".
+	 */
+	void AppendInt64(int64_t value) noexcept;
+
+	/**
+	 * Append a value of type "float8".
+	 */
+	void AppendDouble(double value) noexcept;
+
+	/**
+	 * Finish the COPY data.  This is only necessary in binary
+	 * format (to append the trailer); no more rows may be
+	 * appended afterwards.
+	 */
+	void Finish() noexcept;
+
+private:
+	void BeginColumn() noexcept;
+	void AppendEscaped(const char *value, size_t length) noexcept;
+	void AppendBinaryField(const void *value, size_t size) noexcept;
+	void AppendRaw16(uint16_t value) noexcept;
+	void AppendRaw32(uint32_t value) noexcept;
+	void AppendRaw64(uint64_t value) noexcept;
+};
+
+} /* namespace Pg */
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "NotifyDispatcher.hxx"
+#include "AsyncConnection.hxx"
+
+namespace Pg {
+
+NotifyDispatcher::NotifyDispatcher(EventLoop &event_loop,
+				   AsyncConnection &_connection) noexcept
+	:connection(_connection),
+	 defer_event(event_loop, BIND_THIS_METHOD(OnDeferred))
+{
+}
+
+NotifyDispatcher::~NotifyDispatcher() noexcept
+{
+	defer_event.Cancel();
+
+	for (auto &i : channels)
+		i.second.subscribers.clear();
+}
+
+void
+NotifyDispatcher::Subscribe(const char *channel,
+			    NotifySubscriber &subscriber)
+{
+	assert(!subscriber.is_linked());
+
+	auto &c = channels[channel];
+	c.subscribers.push_back(subscriber);
+
+	if (!c.listening)
+		Apply();
+}
+
+void
+NotifyDispatcher::Unsubscribe(const char *channel,
+			      NotifySubscriber &subscriber)
+{
+	if (subscriber.is_linked())
+		subscriber.unlink();
+
+	auto i = channels.find(channel);
+	if (i != channels.end() && i->second.subscribers.empty())
+		Apply();
+}
+
+void
+NotifyDispatcher::Apply()
+{
+	if (dispatching)
+		/* will be called again by OnDeferred() */
+		return;
+
+	if (!connection.IsReady() || !connection.IsIdle())
+		/* will be called again by OnConnect() or OnIdle() */
+		return;
+
+	for (auto i = channels.begin(); i != channels.end();) {
+		auto &c = i->second;
+
+		if (c.subscribers.empty()) {
+			/* subscribers may have been destroyed
+			   without Unsubscribe() */
+			if (c.listening) {
+				const auto sql = "UNLISTEN " +
+					connection.EscapeIdentifier(i->first.c_str());
+				connection.ExecuteOrThrow(sql.c_str());
+			}
+
+			i = channels.erase(i);
+			continue;
+		}
+
+		if (!c.listening) {
+			const auto sql = "LISTEN " +
+				connection.EscapeIdentifier(i->first.c_str());
+			connection.ExecuteOrThrow(sql.c_str());
+			c.listening = true;
+		}
+
+		++i;
+	}
+}
+
+void
+NotifyDispatcher::OnDisconnect() noexcept
+{
+	/* subscriptions belong to the server session */
+	for (auto &i : channels)
+		i.second.listening = false;
+}
+
+void
+NotifyDispatcher::OnNotify(const char *channel, const char *payload) noexcept
+{
+	std::string key(channel);
+	key.push_back('\0');
+	key.append(payload);
+
+	if (!pending_keys.emplace(std::move(key)).second)
+		/* coalesce with an identical pending notification */
+		return;
+
+	pending.emplace_back(channel, payload);
+	defer_event.Schedule();
+}
+
+void
+NotifyDispatcher::OnDeferred() noexcept
+{
+	const auto notifications = std::move(pending);
+	pending.clear();
+	pending_keys.clear();
+
+	dispatching = true;
+
+	for (const auto &n : notifications) {
+		auto i = channels.find(n.first);
+		if (i == channels.end())
+			continue;
+
+		auto &subscribers = i->second.subscribers;
+		for (auto j = subscribers.begin(); j != subscribers.end();) {
+			/* advance before invoking, because the
+			   subscriber may unsubscribe itself */
+			auto &subscriber = *j++;
+			subscriber.OnNotify(n.first.c_str(), n.second.c_str());
+		}
+	}
+
+	dispatching = false;
+
+	try {
+		Apply();
+	} catch (...) {
+		/* the connection is probably broken; the
+		   AsyncConnection will notice and reconnect, and
+		   OnConnect() will try again */
+	}
+}
+
+} /* namespace Pg */
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/DeferEvent.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Pg {
+
+class AsyncConnection;
+
+/**
+ * A subscriber of a #NotifyDispatcher channel.  Destroying it
+ * unsubscribes it.
+ */
+class NotifySubscriber
+	: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> {
+public:
+	/**
+	 * A notification has been received on the channel.  This
+	 * method may unsubscribe (or destroy) this object, but no
+	 * other subscriber.
+	 */
+	virtual void OnNotify(const char *channel,
+			      const char *payload) noexcept = 0;
+};
+
+/**
+ * Multiplexes many subscribers of PostgreSQL notifications
+ * ("LISTEN") over one #AsyncConnection.  It keeps track of the
+ * subscribed channels and issues "LISTEN" again after a reconnect.
+ *
+ * Notifications are delivered from the event loop.  Identical
+ * notifications (same channel and payload) received within one
+ * event loop iteration are delivered only once, so a burst of
+ * cache invalidations causes only one refresh.
+ *
+ * The #AsyncConnectionHandler of the connection must forward
+ * OnConnect(), OnIdle(), OnDisconnect() and OnNotifyPayload() to
+ * this object.  "LISTEN" and "UNLISTEN" are executed synchronously
+ * while the connection is idle, so it must not use pipeline mode.
+ */
+class NotifyDispatcher final {
+	AsyncConnection &connection;
+
+	typedef boost::intrusive::list<NotifySubscriber,
+				       boost::intrusive::constant_time_size<false>> SubscriberList;
+
+	struct Channel {
+		SubscriberList subscribers;
+
+		/**
+		 * Has "LISTEN" been executed on the current
+		 * connection?
+		 */
+		bool listening = false;
+	};
+
+	std::map<std::string, Channel> channels;
+
+	/**
+	 * Notifications waiting to be delivered by #defer_event, in
+	 * the order they were received.
+	 */
+	std::vector<std::pair<std::string, std::string>> pending;
+
+	/**
+	 * Channel and payload (separated by a null byte) of all
+	 * #pending notifications, for coalescing.
+	 */
+	std::set<std::string> pending_keys;
+
+	DeferEvent defer_event;
+
+	/**
+	 * Is OnDeferred() currently invoking subscribers?  Then
+	 * Apply() is postponed, because it may erase channels.
+	 */
+	bool dispatching = false;
+
+public:
+	NotifyDispatcher(EventLoop &event_loop,
+			 AsyncConnection &_connection) noexcept;
+
+	~NotifyDispatcher() noexcept;
+
+	NotifyDispatcher(const NotifyDispatcher &) = delete;
+	NotifyDispatcher &operator=(const NotifyDispatcher &) = delete;
+
+	/**
+	 * Subscribe to the given channel.  If the connection is
+	 * busy, "LISTEN" is postponed until it becomes idle.
+	 *
+	 * Throws on error.
+	 */
+	void Subscribe(const char *channel, NotifySubscriber &subscriber);
+
+	/**
+	 * Unsubscribe from the given channel; "UNLISTEN" is executed
+	 * when the last subscriber is gone.
+	 *
+	 * Throws on error.
+	 */
+	void Unsubscribe(const char *channel, NotifySubscriber &subscriber);
+
+	/**
+	 * Forwarded from AsyncConnectionHandler::OnConnect().
+	 *
+	 * Throws on error.
+	 */
+	void OnConnect() {
+		Apply();
+	}
+
+	/**
+	 * Forwarded from AsyncConnectionHandler::OnIdle().
+	 *
+	 * Throws on error.
+	 */
+	void OnIdle() {
+		Apply();
+	}
+
+	/**
+	 * Forwarded from AsyncConnectionHandler::OnDisconnect().
+	 */
+	void OnDisconnect() noexcept;
+
+	/**
+	 * Forwarded from AsyncConnectionHandler::OnNotifyPayload().
+	 */
+	void OnNotify(const char *channel, const char *payload) noexcept;
+
+private:
+	/**
+	 * Execute the "LISTEN" and "UNLISTEN" commands which are
+	 * necessary to match the subscriptions, if the connection is
+	 * idle.
+	 *
+	 * Throws on error.
+	 */
+	void Apply();
+
+	void OnDeferred() noexcept;
+};
+
+} /* namespace Pg */
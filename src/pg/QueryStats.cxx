@@ -0,0 +1,143 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "QueryStats.hxx"
+#include "Result.hxx"
+#include "Statement.hxx"
+#include "util/FNVHash.hxx"
+
+#include <postgresql/pg_config.h>
+
+#include <stdio.h>
+
+namespace Pg {
+
+QueryStats &
+QueryInstrumentation::Lookup(const char *sql) noexcept
+{
+	char key[20];
+	snprintf(key, sizeof(key), "#%016llx",
+		 (unsigned long long)FNV1aHash64(sql));
+
+	auto i = statements.find(key);
+	if (i == statements.end())
+		i = statements.emplace(std::piecewise_construct,
+				       std::forward_as_tuple(key),
+				       std::forward_as_tuple(key, sql)).first;
+
+	return i->second;
+}
+
+QueryStats &
+QueryInstrumentation::Lookup(const Statement &s) noexcept
+{
+	auto i = statements.find(s.GetName());
+	if (i == statements.end())
+		i = statements.emplace(std::piecewise_construct,
+				       std::forward_as_tuple(s.GetName()),
+				       std::forward_as_tuple(s.GetName(),
+							     s.GetSql())).first;
+
+	return i->second;
+}
+
+static constexpr uint64_t
+ToMicroseconds(std::chrono::steady_clock::duration d) noexcept
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+void
+QueryInstrumentation::Record(QueryStats &stats,
+			     std::chrono::steady_clock::duration first_result,
+			     std::chrono::steady_clock::duration completion,
+			     uint64_t n_rows, bool failed) noexcept
+{
+	++stats.n_queries;
+	if (failed)
+		++stats.n_errors;
+	stats.n_rows += n_rows;
+
+	stats.first_result_latency.Add(ToMicroseconds(first_result));
+	stats.completion_latency.Add(ToMicroseconds(completion));
+
+	if (slow_query_handler != nullptr &&
+	    completion >= slow_query_threshold)
+		slow_query_handler->OnSlowQuery(stats, completion, n_rows);
+}
+
+void
+QueryTimer::OnResult(const Result &result) noexcept
+{
+	if (instrumentation == nullptr)
+		return;
+
+	if (!got_result) {
+		got_result = true;
+		first_result = std::chrono::steady_clock::now() - start;
+	}
+
+	switch (result.GetStatus()) {
+	case PGRES_TUPLES_OK:
+#if PG_VERSION_NUM >= 90200
+	case PGRES_SINGLE_TUPLE:
+#endif
+		n_rows += result.GetRowCount();
+		break;
+
+	case PGRES_COMMAND_OK:
+		n_rows += result.GetAffectedRows();
+		break;
+
+	default:
+		if (result.IsError())
+			failed = true;
+		break;
+	}
+}
+
+void
+QueryTimer::Finish() noexcept
+{
+	if (instrumentation == nullptr)
+		return;
+
+	const auto completion = std::chrono::steady_clock::now() - start;
+	if (!got_result)
+		first_result = completion;
+
+	instrumentation->Record(*stats, first_result, completion,
+				n_rows, failed);
+	instrumentation = nullptr;
+}
+
+} /* namespace Pg */
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/LogLinearHistogram.hxx"
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#include <stdint.h>
+
+namespace Pg {
+
+class Result;
+class Statement;
+
+/**
+ * Statistics about one statement; see #QueryInstrumentation.
+ * Latencies are recorded in microseconds.
+ */
+struct QueryStats {
+	/**
+	 * The name of the prepared statement, or a hash of the SQL
+	 * text.
+	 */
+	const std::string key;
+
+	/**
+	 * The SQL text.
+	 */
+	const std::string sql;
+
+	uint64_t n_queries = 0, n_errors = 0;
+
+	/**
+	 * The total number of rows returned (or affected).
+	 */
+	uint64_t n_rows = 0;
+
+	/**
+	 * The time from sending the query until the first result
+	 * has been received.
+	 */
+	LogLinearHistogram<> first_result_latency;
+
+	/**
+	 * The time from sending the query until its last result
+	 * has been received.
+	 */
+	LogLinearHistogram<> completion_latency;
+
+	QueryStats(std::string &&_key, const char *_sql) noexcept
+		:key(std::move(_key)), sql(_sql) {}
+};
+
+class SlowQueryHandler {
+public:
+	/**
+	 * A query has taken longer than the configured threshold
+	 * (see QueryInstrumentation::SetSlowQueryHandler()).
+	 */
+	virtual void OnSlowQuery(const QueryStats &stats,
+				 std::chrono::steady_clock::duration duration,
+				 uint64_t n_rows) noexcept = 0;
+};
+
+/**
+ * Collects per-statement statistics of queries on one or more
+ * connections (of the same thread); see
+ * Connection::SetInstrumentation().
+ */
+class QueryInstrumentation {
+	std::unordered_map<std::string, QueryStats> statements;
+
+	SlowQueryHandler *slow_query_handler = nullptr;
+
+	std::chrono::steady_clock::duration slow_query_threshold;
+
+public:
+	QueryInstrumentation() = default;
+	QueryInstrumentation(const QueryInstrumentation &) = delete;
+	QueryInstrumentation &operator=(const QueryInstrumentation &) = delete;
+
+	void SetSlowQueryHandler(std::chrono::steady_clock::duration threshold,
+				 SlowQueryHandler &handler) noexcept {
+		slow_query_threshold = threshold;
+		slow_query_handler = &handler;
+	}
+
+	/**
+	 * Obtain the entry for an unprepared query, identified by
+	 * the hash of its SQL text.
+	 */
+	QueryStats &Lookup(const char *sql) noexcept;
+
+	QueryStats &Lookup(const Statement &s) noexcept;
+
+	void Record(QueryStats &stats,
+		    std::chrono::steady_clock::duration first_result,
+		    std::chrono::steady_clock::duration completion,
+		    uint64_t n_rows, bool failed) noexcept;
+
+	/**
+	 * Invoke the given function for each #QueryStats.
+	 */
+	template<typename F>
+	void ForEach(F &&f) const {
+		for (const auto &i : statements)
+			f(i.second);
+	}
+};
+
+/**
+ * Measures one query in progress.  A default-constructed instance
+ * does nothing.
+ */
+class QueryTimer {
+	QueryInstrumentation *instrumentation = nullptr;
+	QueryStats *stats;
+
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::duration first_result;
+
+	uint64_t n_rows;
+
+	bool got_result, failed;
+
+public:
+	QueryTimer() = default;
+
+	QueryTimer(QueryInstrumentation &_instrumentation,
+		   QueryStats &_stats) noexcept
+		:instrumentation(&_instrumentation), stats(&_stats),
+		 start(std::chrono::steady_clock::now()),
+		 n_rows(0), got_result(false), failed(false) {}
+
+	/**
+	 * Account a result of this query.
+	 */
+	void OnResult(const Result &result) noexcept;
+
+	/**
+	 * The query has finished; submit the measurements to the
+	 * #QueryInstrumentation.
+	 */
+	void Finish() noexcept;
+
+	/**
+	 * The query has failed without a result (e.g. because the
+	 * connection was lost).
+	 */
+	void Abort() noexcept {
+		failed = true;
+		Finish();
+	}
+};
+
+} /* namespace Pg */
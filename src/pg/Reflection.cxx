@@ -108,4 +108,66 @@ RuleExists(Pg::Connection &c, const char *schema,
 
 }
 
+const char *const SchemaSnapshot::QUERY =
+	"SELECT 't', table_name::text, NULL::text, NULL::text "
+	"FROM INFORMATION_SCHEMA.TABLES "
+	"WHERE table_schema=$1 AND table_type='BASE TABLE' "
+	"UNION ALL "
+	"SELECT 'c', table_name::text, column_name::text, data_type::text "
+	"FROM INFORMATION_SCHEMA.COLUMNS "
+	"WHERE table_schema=$1 "
+	"UNION ALL "
+	"SELECT 'i', tablename::text, indexname::text, NULL "
+	"FROM pg_indexes "
+	"WHERE schemaname=$1 "
+	"UNION ALL "
+	"SELECT 'r', tablename::text, rulename::text, NULL "
+	"FROM pg_rules "
+	"WHERE schemaname=$1";
+
+SchemaSnapshot::SchemaSnapshot(Connection &c, const char *schema)
+	:SchemaSnapshot(CheckError(c.ExecuteParams(QUERY, schema)))
+{
+}
+
+SchemaSnapshot::SchemaSnapshot(const Result &result)
+{
+	for (const auto &row : result) {
+		auto &table = tables[row.GetValue(1)];
+		const char *name = row.GetValue(2);
+
+		switch (*row.GetValue(0)) {
+		case 't':
+			table.is_base_table = true;
+			break;
+
+		case 'c':
+			table.columns.emplace(name, row.GetValue(3));
+			break;
+
+		case 'i':
+			table.indexes.emplace(name);
+			break;
+
+		case 'r':
+			table.rules.emplace(name);
+			break;
+		}
+	}
+}
+
+const std::string &
+SchemaSnapshot::GetColumnType(const char *table_name,
+			      const char *column_name) const
+{
+	const auto *t = FindTable(table_name);
+	if (t != nullptr) {
+		auto i = t->columns.find(column_name);
+		if (i != t->columns.end())
+			return i->second;
+	}
+
+	throw FormatRuntimeError("No such column: %s", column_name);
+}
+
 }
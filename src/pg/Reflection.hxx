@@ -33,11 +33,14 @@
 #ifndef PG_REFLECTION_HXX
 #define PG_REFLECTION_HXX
 
+#include <map>
+#include <set>
 #include <string>
 
 namespace Pg {
 
 class Connection;
+class Result;
 
 /**
  * Does the specified table exist?
@@ -83,6 +86,95 @@ bool
 RuleExists(Pg::Connection &c, const char *schema,
 	   const char *table_name, const char *rule_name);
 
+/**
+ * An in-memory copy of a schema's tables, columns, indexes and
+ * rules, loaded with one query.  It answers the same questions as
+ * the functions above without a round trip each, e.g. for
+ * migration code which checks dozens of them at startup.  It is
+ * not updated by DDL statements; construct a new one afterwards if
+ * needed.
+ */
+class SchemaSnapshot {
+	struct Table {
+		/**
+		 * Is this a base table?  (Columns of views are
+		 * listed, too.)
+		 */
+		bool is_base_table = false;
+
+		/**
+		 * Column name to data type.
+		 */
+		std::map<std::string, std::string, std::less<>> columns;
+
+		std::set<std::string, std::less<>> indexes, rules;
+	};
+
+	std::map<std::string, Table, std::less<>> tables;
+
+public:
+	/**
+	 * The query which loads a snapshot; its only parameter is
+	 * the schema name.  This can be used to send it
+	 * asynchronously and pass the result to the #Result
+	 * constructor.
+	 */
+	static const char *const QUERY;
+
+	/**
+	 * Load the snapshot.
+	 *
+	 * Throws on error.
+	 *
+	 * @param schema the schema name (must not be nullptr or empty, as
+	 * there is no fallback to "public")
+	 */
+	SchemaSnapshot(Connection &c, const char *schema);
+
+	/**
+	 * Construct from the result of #QUERY.
+	 */
+	explicit SchemaSnapshot(const Result &result);
+
+	bool TableExists(const char *table_name) const noexcept {
+		auto i = tables.find(table_name);
+		return i != tables.end() && i->second.is_base_table;
+	}
+
+	bool ColumnExists(const char *table_name,
+			  const char *column_name) const noexcept {
+		const auto *t = FindTable(table_name);
+		return t != nullptr &&
+			t->columns.find(column_name) != t->columns.end();
+	}
+
+	/**
+	 * Throws std::runtime_error if there is no such column.
+	 */
+	const std::string &GetColumnType(const char *table_name,
+					 const char *column_name) const;
+
+	bool IndexExists(const char *table_name,
+			 const char *index_name) const noexcept {
+		const auto *t = FindTable(table_name);
+		return t != nullptr &&
+			t->indexes.find(index_name) != t->indexes.end();
+	}
+
+	bool RuleExists(const char *table_name,
+			const char *rule_name) const noexcept {
+		const auto *t = FindTable(table_name);
+		return t != nullptr &&
+			t->rules.find(rule_name) != t->rules.end();
+	}
+
+private:
+	const Table *FindTable(const char *table_name) const noexcept {
+		auto i = tables.find(table_name);
+		return i != tables.end() ? &i->second : nullptr;
+	}
+};
+
 }
 
 #endif
@@ -0,0 +1,183 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ReplicaRouter.hxx"
+#include "event/Duration.hxx"
+
+#include <stdlib.h>
+
+namespace Pg {
+
+/**
+ * The time since the last replayed transaction, or zero if the
+ * replica has replayed everything it has received (i.e. the primary
+ * is idle).
+ */
+static constexpr char lag_query[] =
+	"SELECT CASE WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() "
+	"THEN 0 "
+	"ELSE COALESCE(EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()), 0) "
+	"END";
+
+ReplicaRouter::Replica::Replica(ReplicaRouter &_router, EventLoop &_event_loop,
+				const char *conninfo, const char *schema,
+				unsigned min_connections,
+				unsigned max_connections,
+				AsyncConnectionPoolHandler &handler) noexcept
+	:router(_router),
+	 pool(_event_loop, conninfo, schema,
+	      /* one connection is needed for the lag check */
+	      std::max(min_connections, 1u), max_connections, handler)
+{
+}
+
+void
+ReplicaRouter::Replica::StartCheck() noexcept
+{
+	if (checking) {
+		/* the previous check has not finished during one
+		   interval; the replica is probably unreachable */
+		lag_ok = false;
+		return;
+	}
+
+	checking = true;
+	pool.Submit(*this);
+}
+
+void
+ReplicaRouter::Replica::SendQuery(AsyncConnection &connection)
+{
+	connection.SendQuery(*this, lag_query);
+}
+
+void
+ReplicaRouter::Replica::OnResult(Result &&result)
+{
+	if (!result.IsQuerySuccessful() || result.IsEmpty()) {
+		lag_ok = false;
+		return;
+	}
+
+	lag = std::chrono::duration<double>(strtod(result.GetValue(0, 0),
+						   nullptr));
+	lag_ok = lag <= router.max_lag;
+}
+
+void
+ReplicaRouter::Replica::OnResultEnd()
+{
+	checking = false;
+}
+
+void
+ReplicaRouter::Replica::OnResultError() noexcept
+{
+	checking = false;
+	lag_ok = false;
+}
+
+ReplicaRouter::ReplicaRouter(EventLoop &_event_loop,
+			     AsyncConnectionPool &_primary,
+			     std::chrono::steady_clock::duration _max_lag,
+			     std::chrono::steady_clock::duration _check_interval) noexcept
+	:primary(_primary),
+	 max_lag(_max_lag), check_interval(_check_interval),
+	 check_timer(_event_loop, BIND_THIS_METHOD(OnCheckTimer)),
+	 event_loop(_event_loop)
+{
+}
+
+void
+ReplicaRouter::AddReplica(const char *conninfo, const char *schema,
+			  unsigned min_connections, unsigned max_connections,
+			  AsyncConnectionPoolHandler &handler) noexcept
+{
+	replicas.emplace_back(*this, event_loop, conninfo, schema,
+			      min_connections, max_connections, handler);
+	replicas.back().StartCheck();
+
+	ScheduleCheck();
+}
+
+void
+ReplicaRouter::ScheduleCheck() noexcept
+{
+	if (!check_timer.IsPending())
+		check_timer.Add(ToEventDuration(std::chrono::duration_cast<std::chrono::microseconds>(check_interval)));
+}
+
+void
+ReplicaRouter::OnCheckTimer() noexcept
+{
+	for (auto &replica : replicas)
+		replica.StartCheck();
+
+	ScheduleCheck();
+}
+
+AsyncConnectionPool *
+ReplicaRouter::FindReplica(const char *schema) noexcept
+{
+	Replica *best = nullptr;
+	size_t best_load = 0;
+
+	for (auto &replica : replicas) {
+		if (!replica.IsHealthy(schema))
+			continue;
+
+		const size_t load = replica.GetLoad(schema);
+		if (best == nullptr || load < best_load) {
+			best = &replica;
+			best_load = load;
+		}
+	}
+
+	return best != nullptr
+		? &best->pool
+		: nullptr;
+}
+
+void
+ReplicaRouter::Submit(AsyncPoolQuery &query, bool read_only,
+		      const char *schema) noexcept
+{
+	AsyncConnectionPool *pool = read_only
+		? FindReplica(schema)
+		: nullptr;
+	if (pool == nullptr)
+		pool = &primary;
+
+	pool->Submit(query, schema);
+}
+
+} /* namespace Pg */
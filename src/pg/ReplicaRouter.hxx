@@ -0,0 +1,198 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "AsyncConnectionPool.hxx"
+#include "event/TimerEvent.hxx"
+
+#include <chrono>
+#include <list>
+
+namespace Pg {
+
+/**
+ * Routes queries to a primary database and its streaming replicas:
+ * read-only queries (see AsyncPoolQuery::IsReadOnly()) go to the
+ * least loaded healthy replica, everything else (and read-only
+ * queries if no replica is healthy) goes to the primary.
+ *
+ * A replica is healthy if it has an established connection and if
+ * its replication lag, which is checked periodically, does not
+ * exceed the configured maximum.
+ */
+class ReplicaRouter final {
+	AsyncConnectionPool &primary;
+
+	/**
+	 * A replica pool and its lag check query.
+	 */
+	class Replica final : public AsyncPoolQuery {
+		ReplicaRouter &router;
+
+	public:
+		AsyncConnectionPool pool;
+
+		/**
+		 * The replication lag measured by the most recent
+		 * check.
+		 */
+		std::chrono::duration<double> lag{0};
+
+		/**
+		 * Was the most recent check successful and was the
+		 * lag acceptable?
+		 */
+		bool lag_ok = false;
+
+		/**
+		 * Is a check in progress (or waiting for a
+		 * connection)?
+		 */
+		bool checking = false;
+
+		Replica(ReplicaRouter &_router, EventLoop &event_loop,
+			const char *conninfo, const char *schema,
+			unsigned min_connections, unsigned max_connections,
+			AsyncConnectionPoolHandler &handler) noexcept;
+
+		~Replica() noexcept {
+			/* remove the check query from the pool's
+			   queue before the pool is destroyed */
+			if (is_linked())
+				unlink();
+		}
+
+		/**
+		 * Is this replica eligible for read-only queries of
+		 * the given schema?  Connections for a schema other
+		 * than the default one are established on demand, so
+		 * an established connection of the default schema
+		 * suffices.
+		 */
+		gcc_pure
+		bool IsHealthy(const char *schema) const noexcept {
+			return lag_ok &&
+				(pool.GetReadyCount(schema) > 0 ||
+				 pool.GetReadyCount() > 0);
+		}
+
+		gcc_pure
+		size_t GetLoad(const char *schema) const noexcept {
+			return pool.GetQueueLength(schema) +
+				pool.GetBusyCount(schema);
+		}
+
+		void StartCheck() noexcept;
+
+	private:
+		/* virtual methods from AsyncPoolQuery */
+		void SendQuery(AsyncConnection &connection) override;
+
+		/* virtual methods from AsyncResultHandler */
+		void OnResult(Result &&result) override;
+		void OnResultEnd() override;
+		void OnResultError() noexcept override;
+	};
+
+	std::list<Replica> replicas;
+
+	/**
+	 * Replicas lagging behind more than this are not used.
+	 */
+	const std::chrono::duration<double> max_lag;
+
+	const std::chrono::steady_clock::duration check_interval;
+
+	TimerEvent check_timer;
+
+	EventLoop &event_loop;
+
+public:
+	/**
+	 * @param primary the pool of the primary server; it must
+	 * remain valid until this object is destroyed
+	 * @param max_lag the maximum replication lag of a replica
+	 * which receives queries
+	 * @param check_interval how often to check the replication
+	 * lag
+	 */
+	ReplicaRouter(EventLoop &event_loop, AsyncConnectionPool &primary,
+		      std::chrono::steady_clock::duration max_lag,
+		      std::chrono::steady_clock::duration check_interval) noexcept;
+
+	~ReplicaRouter() noexcept {
+		check_timer.Cancel();
+	}
+
+	ReplicaRouter(const ReplicaRouter &) = delete;
+	ReplicaRouter &operator=(const ReplicaRouter &) = delete;
+
+	/**
+	 * Add a replica server, and check its replication lag right
+	 * away.  It receives queries only after the first successful
+	 * check.  The parameters are the same as for the
+	 * #AsyncConnectionPool constructor.
+	 */
+	void AddReplica(const char *conninfo, const char *schema,
+			unsigned min_connections, unsigned max_connections,
+			AsyncConnectionPoolHandler &handler) noexcept;
+
+	/**
+	 * Send the query to the primary or a replica, depending on
+	 * AsyncPoolQuery::IsReadOnly().  See
+	 * AsyncConnectionPool::Submit().
+	 */
+	void Submit(AsyncPoolQuery &query, const char *schema=nullptr) noexcept {
+		Submit(query, query.IsReadOnly(), schema);
+	}
+
+	/**
+	 * Like Submit(), but with an explicit read-only flag.
+	 */
+	void Submit(AsyncPoolQuery &query, bool read_only,
+		    const char *schema=nullptr) noexcept;
+
+private:
+	/**
+	 * Find the least loaded healthy replica.
+	 *
+	 * @return the replica's pool or nullptr if there is none
+	 */
+	gcc_pure
+	AsyncConnectionPool *FindReplica(const char *schema) noexcept;
+
+	void ScheduleCheck() noexcept;
+	void OnCheckTimer() noexcept;
+};
+
+} /* namespace Pg */
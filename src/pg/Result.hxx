@@ -34,6 +34,7 @@
 #define PG_RESULT_HXX
 
 #include "BinaryValue.hxx"
+#include "BinaryDecoder.hxx"
 
 #include "util/Compiler.h"
 
@@ -43,6 +44,9 @@
 #include <cstdlib>
 #include <string>
 #include <algorithm>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
 
 namespace Pg {
 
@@ -240,6 +244,46 @@ public:
 	gcc_pure
 	std::string GetOnlyStringChecked() const noexcept;
 
+	/**
+	 * Verify that the given column is in binary format and its
+	 * type can be decoded into "T" (see #BinaryTraits).
+	 *
+	 * Throws std::runtime_error on mismatch.
+	 */
+	template<typename T>
+	void CheckBinaryColumn(unsigned column) const {
+		if (!IsColumnBinary(column))
+			throw std::runtime_error(std::string("Column is not binary: ") +
+						 GetColumnName(column));
+
+		if (!BinaryTraits<T>::IsType(GetColumnType(column)))
+			throw std::runtime_error(std::string("Wrong column type: ") +
+						 GetColumnName(column));
+	}
+
+	/**
+	 * Verify that the result has exactly the given column types,
+	 * all in binary format.
+	 *
+	 * Throws std::runtime_error on mismatch.
+	 */
+	template<typename... T>
+	void CheckBinaryColumns() const {
+		if (GetColumnCount() != sizeof...(T))
+			throw std::runtime_error("Wrong number of columns");
+
+		CheckBinaryColumns<T...>(std::index_sequence_for<T...>());
+	}
+
+private:
+	template<typename... T, size_t... I>
+	void CheckBinaryColumns(std::index_sequence<I...>) const {
+		const int dummy[] = {0, (CheckBinaryColumn<T>(I), 0)...};
+		(void)dummy;
+	}
+
+public:
+
 	class RowIterator {
 		PGresult *result;
 		unsigned row;
@@ -311,6 +355,50 @@ public:
 
 			return BinaryValue(GetValue(column), GetValueLength(column));
 		}
+
+		/**
+		 * Decode a non-NULL value in binary format (see
+		 * #BinaryTraits and Result::CheckBinaryColumn()).
+		 *
+		 * Throws std::invalid_argument if the value is NULL
+		 * or malformed.
+		 */
+		template<typename T>
+		T Decode(unsigned column) const {
+			if (IsValueNull(column))
+				throw std::invalid_argument("Unexpected NULL value");
+
+			return BinaryTraits<T>::Decode(GetBinaryValue(column));
+		}
+
+		/**
+		 * Decode the columns of this row (in this order) into
+		 * a std::tuple.
+		 */
+		template<typename... T>
+		std::tuple<T...> DecodeTuple() const {
+			return DecodeTuple<T...>(std::index_sequence_for<T...>());
+		}
+
+		/**
+		 * Decode the columns of this row (in this order) and
+		 * pass them to the (aggregate) initializer of "S".
+		 */
+		template<typename S, typename... T>
+		S DecodeStruct() const {
+			return DecodeStruct<S, T...>(std::index_sequence_for<T...>());
+		}
+
+	private:
+		template<typename... T, size_t... I>
+		std::tuple<T...> DecodeTuple(std::index_sequence<I...>) const {
+			return std::tuple<T...>(Decode<T>(I)...);
+		}
+
+		template<typename S, typename... T, size_t... I>
+		S DecodeStruct(std::index_sequence<I...>) const {
+			return S{Decode<T>(I)...};
+		}
 	};
 
 	typedef RowIterator iterator;
@@ -322,6 +410,56 @@ public:
 	iterator end() const noexcept {
 		return iterator{result, GetRowCount()};
 	}
+
+	template<typename... T>
+	class TupleIterator {
+		RowIterator i;
+
+	public:
+		constexpr TupleIterator(RowIterator _i):i(_i) {}
+
+		constexpr bool operator!=(const TupleIterator &other) const noexcept {
+			return i != other.i;
+		}
+
+		TupleIterator &operator++() noexcept {
+			++i;
+			return *this;
+		}
+
+		std::tuple<T...> operator*() const {
+			return i.template DecodeTuple<T...>();
+		}
+	};
+
+	template<typename... T>
+	struct TupleRange {
+		TupleIterator<T...> first, last;
+
+		TupleIterator<T...> begin() const noexcept {
+			return first;
+		}
+
+		TupleIterator<T...> end() const noexcept {
+			return last;
+		}
+	};
+
+	/**
+	 * Check the column types (see CheckBinaryColumns()) and
+	 * return a range which decodes each row into a std::tuple:
+	 *
+	 *   for (const auto &row : result.DecodeRows<int64_t, std::string>())
+	 *     ...
+	 *
+	 * Throws std::runtime_error on column type mismatch;
+	 * iterating throws std::invalid_argument on malformed values.
+	 */
+	template<typename... T>
+	TupleRange<T...> DecodeRows() const {
+		CheckBinaryColumns<T...>();
+		return {begin(), end()};
+	}
 };
 
 } /* namespace Pg */
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Result.hxx"
+
+#include <vector>
+
+namespace Pg {
+
+/**
+ * A batch of rows received in single-row mode (see
+ * Connection::ExecuteStreaming() and
+ * AsyncConnection::SendStreamQuery()).  Each #Result contains
+ * exactly one row.
+ */
+class RowBatch {
+	std::vector<Result> rows;
+
+public:
+	class const_iterator {
+		std::vector<Result>::const_iterator i;
+
+	public:
+		explicit const_iterator(std::vector<Result>::const_iterator _i)
+			:i(_i) {}
+
+		bool operator==(const const_iterator &other) const noexcept {
+			return i == other.i;
+		}
+
+		bool operator!=(const const_iterator &other) const noexcept {
+			return i != other.i;
+		}
+
+		const_iterator &operator++() noexcept {
+			++i;
+			return *this;
+		}
+
+		Result::RowIterator operator*() const noexcept {
+			return i->begin();
+		}
+	};
+
+	void reserve(size_t n) {
+		rows.reserve(n);
+	}
+
+	bool empty() const noexcept {
+		return rows.empty();
+	}
+
+	size_t size() const noexcept {
+		return rows.size();
+	}
+
+	void clear() noexcept {
+		rows.clear();
+	}
+
+	void push_back(Result &&row) {
+		assert(row.GetRowCount() == 1);
+
+		rows.push_back(std::move(row));
+	}
+
+	Result::RowIterator operator[](size_t i) const noexcept {
+		assert(i < rows.size());
+
+		return rows[i].begin();
+	}
+
+	const_iterator begin() const noexcept {
+		return const_iterator(rows.begin());
+	}
+
+	const_iterator end() const noexcept {
+		return const_iterator(rows.end());
+	}
+};
+
+} /* namespace Pg */
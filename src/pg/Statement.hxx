@@ -0,0 +1,88 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <postgresql/libpq-fe.h>
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+namespace Pg {
+
+/**
+ * A SQL statement which is declared once (usually as a global
+ * constant) and prepared lazily by each #Connection on its first
+ * use; see Connection::ExecutePrepared() and
+ * AsyncConnection::SendPrepared().  After a reconnect, it is
+ * prepared again.
+ *
+ * The name must be unique among all statements used on one
+ * connection.
+ */
+class Statement {
+	const std::string name;
+	const std::string sql;
+
+	/**
+	 * The parameter types; parameters beyond the end of this
+	 * list (or with type 0) are inferred by the server.
+	 */
+	const std::vector<Oid> param_types;
+
+public:
+	Statement(const char *_name, const char *_sql,
+		  std::initializer_list<Oid> _param_types={})
+		:name(_name), sql(_sql), param_types(_param_types) {}
+
+	Statement(const Statement &) = delete;
+	Statement &operator=(const Statement &) = delete;
+
+	const char *GetName() const noexcept {
+		return name.c_str();
+	}
+
+	const char *GetSql() const noexcept {
+		return sql.c_str();
+	}
+
+	int GetParamTypeCount() const noexcept {
+		return param_types.size();
+	}
+
+	const Oid *GetParamTypes() const noexcept {
+		return param_types.empty() ? nullptr : param_types.data();
+	}
+};
+
+} /* namespace Pg */
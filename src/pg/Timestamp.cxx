@@ -32,6 +32,7 @@
 
 #include "Timestamp.hxx"
 #include "time/Convert.hxx"
+#include "time/UtcFormatter.hxx"
 #include "util/StringBuffer.hxx"
 
 #include <stdexcept>
@@ -109,18 +110,14 @@ ParseTimestamp(const char *s)
 	return t;
 }
 
-static StringBuffer<64>
-FormatTimestamp(const struct tm &tm) noexcept
-{
-	StringBuffer<64> buffer;
-	strftime(buffer.data(), buffer.capacity(), "%F %T", &tm);
-	return buffer;
-}
-
 StringBuffer<64>
 FormatTimestamp(std::chrono::system_clock::time_point tp)
 {
-	return FormatTimestamp(GmTime(tp));
+	static thread_local UtcFormatter formatter;
+
+	StringBuffer<64> buffer;
+	*formatter.FormatDateTime(buffer.data(), tp, ' ') = 0;
+	return buffer;
 }
 
 }
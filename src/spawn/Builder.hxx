@@ -41,35 +41,80 @@
 #include "util/ConstBuffer.hxx"
 #include "util/StaticArray.hxx"
 
+#include <vector>
+
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <string.h>
 
 class SpawnPayloadTooLargeError {};
 
+/**
+ * Serializes a datagram of the spawn protocol.  The payload is
+ * limited only by #SPAWN_MAX_REQUEST_SIZE (see SetMaxSize()), and the
+ * buffer grows as needed; callers which serialize many requests
+ * should pass a reusable buffer to the constructor, so it needs to
+ * be allocated only once.
+ */
 class SpawnSerializer {
-	static constexpr size_t capacity = 65536;
-
-	size_t size = 0;
+	/**
+	 * The buffer used if none was passed to the constructor.
+	 */
+	std::vector<uint8_t> own_buffer;
 
-	uint8_t buffer[capacity];
+	std::vector<uint8_t> &buffer;
 
 	StaticArray<int, 8> fds;
 
+	size_t max_size = SPAWN_MAX_REQUEST_SIZE;
+
 public:
-	explicit SpawnSerializer(SpawnRequestCommand cmd) {
-		buffer[size++] = (uint8_t)cmd;
+	explicit SpawnSerializer(SpawnRequestCommand cmd)
+		:buffer(own_buffer) {
+		buffer.push_back((uint8_t)cmd);
+	}
+
+	explicit SpawnSerializer(SpawnResponseCommand cmd)
+		:buffer(own_buffer) {
+		buffer.push_back((uint8_t)cmd);
+	}
+
+	/**
+	 * Serialize into the given buffer; its old contents are
+	 * discarded, but its capacity is kept.
+	 */
+	SpawnSerializer(std::vector<uint8_t> &_buffer,
+			SpawnRequestCommand cmd)
+		:buffer(_buffer) {
+		buffer.clear();
+		buffer.push_back((uint8_t)cmd);
+	}
+
+	SpawnSerializer(std::vector<uint8_t> &_buffer,
+			SpawnResponseCommand cmd)
+		:buffer(_buffer) {
+		buffer.clear();
+		buffer.push_back((uint8_t)cmd);
 	}
 
-	explicit SpawnSerializer(SpawnResponseCommand cmd) {
-		buffer[size++] = (uint8_t)cmd;
+	SpawnSerializer(const SpawnSerializer &) = delete;
+	SpawnSerializer &operator=(const SpawnSerializer &) = delete;
+
+	/**
+	 * Raise the size limit, e.g. to
+	 * #SPAWN_MAX_MEMFD_REQUEST_SIZE for a request which may be
+	 * sent with #SpawnRequestCommand::MEMFD.
+	 */
+	void SetMaxSize(size_t _max_size) noexcept {
+		max_size = _max_size;
 	}
 
 	void WriteByte(uint8_t value) {
-		if (size >= capacity)
+		if (buffer.size() >= max_size)
 			throw SpawnPayloadTooLargeError();
 
-		buffer[size++] = value;
+		buffer.push_back(value);
 	}
 
 	void Write(SpawnExecCommand cmd) {
@@ -82,11 +127,11 @@ public:
 	}
 
 	void Write(ConstBuffer<void> value) {
-		if (size + value.size > capacity)
+		if (buffer.size() + value.size > max_size)
 			throw SpawnPayloadTooLargeError();
 
-		memcpy(buffer + size, value.data, value.size);
-		size += value.size;
+		const auto *p = (const uint8_t *)value.data;
+		buffer.insert(buffer.end(), p, p + value.size);
 	}
 
 	template<typename T>
@@ -130,7 +175,7 @@ public:
 	}
 
 	ConstBuffer<void> GetPayload() const {
-		return {buffer, size};
+		return {buffer.data(), buffer.size()};
 	}
 
 	ConstBuffer<int> GetFds() const {
@@ -166,4 +211,39 @@ Send(SocketDescriptor socket, const SpawnSerializer &s)
 	return Send<MAX_FDS>(socket, s.GetPayload(), s.GetFds());
 }
 
+/**
+ * Like Send(), but never blocks.
+ *
+ * Throws on error.
+ *
+ * @return false if the socket buffer is full
+ */
+template<size_t MAX_FDS>
+static bool
+TrySend(SocketDescriptor s, ConstBuffer<void> payload, ConstBuffer<int> fds)
+{
+	assert(s.IsDefined());
+
+	struct iovec vec = {
+		.iov_base = const_cast<void *>(payload.data),
+		.iov_len = payload.size,
+	};
+
+	MessageHeader msg(ConstBuffer<struct iovec>(&vec, 1));
+
+	ScmRightsBuilder<MAX_FDS> b(msg);
+	for (int i : fds)
+		b.push_back(i);
+	b.Finish(msg);
+
+	if (sendmsg(s.Get(), &msg, MSG_NOSIGNAL|MSG_DONTWAIT) < 0) {
+		if (errno == EAGAIN)
+			return false;
+
+		throw MakeErrno("sendmsg() failed");
+	}
+
+	return true;
+}
+
 #endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/Hash128.hxx"
+
+#include <map>
+#include <string>
+
+struct CgroupOptions;
+struct CgroupState;
+
+/**
+ * Keeps the cgroups of child processes prepared: each group is
+ * created and its settings are written only once (and again only
+ * if they change), instead of doing it in each new child process.
+ * The cgroup2 directory is kept open, so new children can be
+ * created inside the group with CLONE_INTO_CGROUP (see
+ * #PreparedChildProcess::cgroup_fd).
+ */
+class CgroupCache {
+	const CgroupState &state;
+
+	struct Group {
+		/**
+		 * A directory file descriptor of the cgroup2 group;
+		 * undefined if there is no unified hierarchy.
+		 */
+		UniqueFileDescriptor fd;
+
+		/**
+		 * The hash of the settings which were written last,
+		 * see CgroupOptions::MakeSettingsHash().
+		 */
+		Hash128 settings;
+	};
+
+	std::map<std::string, Group> groups;
+
+public:
+	explicit CgroupCache(const CgroupState &_state) noexcept
+		:state(_state) {}
+
+	CgroupCache(const CgroupCache &) = delete;
+	CgroupCache &operator=(const CgroupCache &) = delete;
+
+	/**
+	 * Prepare the given cgroup: create it if necessary and apply
+	 * changed settings.  The returned file descriptor remains
+	 * owned by this object.
+	 *
+	 * Throws on error.
+	 *
+	 * @return the cgroup2 directory or
+	 * FileDescriptor::Undefined() if there is no unified
+	 * hierarchy
+	 */
+	FileDescriptor Get(const CgroupOptions &options);
+
+	void Clear() noexcept {
+		groups.clear();
+	}
+};
@@ -36,8 +36,11 @@
 #include "AllocatorPtr.hxx"
 #include "system/Error.hxx"
 #include "io/WriteFile.hxx"
+#include "io/UniqueFileDescriptor.hxx"
 #include "util/StringView.hxx"
 #include "util/RuntimeError.hxx"
+#include "util/StringCompare.hxx"
+#include "util/Hash128.hxx"
 
 #include <assert.h>
 #include <sched.h>
@@ -45,6 +48,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
@@ -82,18 +86,21 @@ WriteFile(const char *path, const char *data)
 		throw FormatErrno("write('%s') failed", path);
 }
 
+static constexpr char mount_base_path[] = "/sys/fs/cgroup";
+
 static void
-MoveToNewCgroup(const char *mount_base_path, const char *controller,
-		const char *delegated_group, const char *sub_group)
+MakeGroupPath(char *path, size_t max_path, const char *controller,
+	      const char *delegated_group, const char *sub_group)
 {
-	char path[PATH_MAX];
-
-	constexpr int max_path = sizeof(path) - 16;
 	if (snprintf(path, max_path, "%s/%s%s/%s",
 		     mount_base_path, controller,
-		     delegated_group, sub_group) >= max_path)
+		     delegated_group, sub_group) >= (int)max_path)
 		throw std::runtime_error("Path is too long");
+}
 
+static void
+CreateGroup(const char *path)
+{
 	if (mkdir(path, 0777) < 0) {
 		switch (errno) {
 		case EEXIST:
@@ -103,25 +110,80 @@ MoveToNewCgroup(const char *mount_base_path, const char *controller,
 			throw FormatErrno("mkdir('%s') failed", path);
 		}
 	}
+}
+
+static void
+MoveToNewCgroup(const char *controller,
+		const char *delegated_group, const char *sub_group)
+{
+	char path[PATH_MAX];
+
+	constexpr size_t max_path = sizeof(path) - 16;
+	MakeGroupPath(path, max_path, controller, delegated_group, sub_group);
+	CreateGroup(path);
 
 	strcat(path, "/cgroup.procs");
 	WriteFile(path, "0");
 }
 
+static void
+CheckEnabled(const CgroupState &state)
+{
+	if (!state.IsEnabled())
+		throw std::runtime_error("Control groups are disabled");
+}
+
 void
-CgroupOptions::Apply(const CgroupState &state) const
+CgroupOptions::Apply(const CgroupState &state, bool prepared) const
 {
 	if (name == nullptr)
 		return;
 
-	if (!state.IsEnabled())
-		throw std::runtime_error("Control groups are disabled");
-
-	const auto mount_base_path = "/sys/fs/cgroup";
+	CheckEnabled(state);
 
 	for (const auto &mount_point : state.mounts)
-		MoveToNewCgroup(mount_base_path, mount_point.c_str(),
-				state.group_path.c_str(), name);
+		/* with CLONE_INTO_CGROUP, we are already a member of
+		   the cgroup2 group */
+		if (!prepared || mount_point != "unified")
+			MoveToNewCgroup(mount_point.c_str(),
+					state.group_path.c_str(), name);
+
+	if (!prepared)
+		ApplySettings(state);
+}
+
+UniqueFileDescriptor
+CgroupOptions::Prepare(const CgroupState &state) const
+{
+	assert(name != nullptr);
+
+	CheckEnabled(state);
+
+	UniqueFileDescriptor unified;
+
+	for (const auto &mount_point : state.mounts) {
+		char path[PATH_MAX];
+		MakeGroupPath(path, sizeof(path), mount_point.c_str(),
+			      state.group_path.c_str(), name);
+		CreateGroup(path);
+
+		/* report the components, not the PATH_MAX buffer,
+		   which would not fit into the error message buffer
+		   (-Wformat-truncation) */
+		if (mount_point == "unified" &&
+		    !unified.Open(path, O_RDONLY|O_DIRECTORY))
+			throw FormatErrno("Failed to open cgroup %s%s/%s",
+					  mount_point.c_str(),
+					  state.group_path.c_str(), name);
+	}
+
+	return unified;
+}
+
+void
+CgroupOptions::ApplySettings(const CgroupState &state) const
+{
+	assert(name != nullptr);
 
 	for (const auto *set = set_head; set != nullptr; set = set->next) {
 		const char *dot = strchr(set->name, '.');
@@ -157,3 +219,24 @@ CgroupOptions::MakeId(char *p) const
 
 	return p;
 }
+
+void
+CgroupOptions::MakeHash(Hash128Builder &h) const noexcept
+{
+	h.UpdateString(name);
+}
+
+void
+CgroupOptions::MakeSettingsHash(Hash128Builder &h) const noexcept
+{
+	for (const auto *set = set_head; set != nullptr; set = set->next) {
+		h.UpdateString(set->name);
+		h.UpdateString(set->value);
+	}
+}
+
+bool
+CgroupOptions::IsSameId(const CgroupOptions &other) const noexcept
+{
+	return StringIsEqualOptional(name, other.name);
+}
@@ -35,6 +35,8 @@
 #include "util/Compiler.h"
 
 class AllocatorPtr;
+class UniqueFileDescriptor;
+class Hash128Builder;
 struct StringView;
 struct CgroupState;
 
@@ -62,9 +64,54 @@ struct CgroupOptions {
 	void Set(AllocatorPtr alloc, StringView name, StringView value);
 
 	/**
+	 * Move the current process into the configured cgroup and
+	 * apply all #SetItem settings.
+	 *
 	 * Throws std::runtime_error on error.
+	 *
+	 * @param prepared true if the process has been created in the
+	 * cgroup2 group with CLONE_INTO_CGROUP and the settings have
+	 * been applied already (see #CgroupCache); then only the
+	 * legacy hierarchies remain to be joined
 	 */
-	void Apply(const CgroupState &state) const;
+	void Apply(const CgroupState &state, bool prepared=false) const;
+
+	/**
+	 * Create the cgroup (in all hierarchies) without moving a
+	 * process into it.
+	 *
+	 * Throws std::runtime_error on error.
+	 *
+	 * @return a directory file descriptor of the cgroup2 group
+	 * (for CLONE_INTO_CGROUP) or an undefined one if there is no
+	 * unified hierarchy
+	 */
+	UniqueFileDescriptor Prepare(const CgroupState &state) const;
+
+	/**
+	 * Write all #SetItem settings into the cgroup, which must
+	 * exist already.
+	 *
+	 * Throws std::runtime_error on error.
+	 */
+	void ApplySettings(const CgroupState &state) const;
 
 	char *MakeId(char *p) const;
+
+	/**
+	 * Hash the same attributes as MakeId().
+	 */
+	void MakeHash(Hash128Builder &h) const noexcept;
+
+	/**
+	 * Hash the #SetItem list (which is not covered by
+	 * MakeHash()).
+	 */
+	void MakeSettingsHash(Hash128Builder &h) const noexcept;
+
+	/**
+	 * Compare the attributes covered by MakeId().
+	 */
+	gcc_pure
+	bool IsSameId(const CgroupOptions &other) const noexcept;
 };
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CgroupPressure.hxx"
+#include "CgroupState.hxx"
+#include "system/Error.hxx"
+#include "util/Macros.hxx"
+
+#include <algorithm>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+static constexpr const char *pressure_files[] = {
+	"cpu.pressure",
+	"memory.pressure",
+	"io.pressure",
+};
+
+CgroupPressureMonitor::CgroupPressureMonitor(EventLoop &event_loop,
+					     CgroupPressureHandler &_handler)
+	:handler(_handler),
+	 epoll_fd(FileDescriptor(epoll_create1(EPOLL_CLOEXEC))),
+	 event(event_loop, BIND_THIS_METHOD(OnReady))
+{
+	if (!epoll_fd.IsDefined())
+		throw MakeErrno("epoll_create1() failed");
+
+	event.Set(epoll_fd.Get(), SocketEvent::READ|SocketEvent::PERSIST);
+	event.Add();
+}
+
+CgroupPressureMonitor::~CgroupPressureMonitor()
+{
+	event.Delete();
+}
+
+void
+CgroupPressureMonitor::Add(const char *path, PressureResource resource,
+			   bool full,
+			   std::chrono::microseconds threshold,
+			   std::chrono::microseconds window)
+{
+	const size_t i = size_t(resource);
+	assert(i < ARRAY_SIZE(pressure_files));
+
+	Remove(resource);
+
+	char buffer[4096];
+	if (snprintf(buffer, sizeof(buffer), "%s/%s",
+		     path, pressure_files[i]) >= (int)sizeof(buffer))
+		throw std::runtime_error("Path is too long");
+
+	/* format the error message from the components, because
+	   the whole buffer would not fit into it
+	   (-Wformat-truncation) */
+	UniqueFileDescriptor fd;
+	if (!fd.Open(buffer, O_RDWR|O_NONBLOCK))
+		throw FormatErrno("Failed to open %s/%s",
+				  path, pressure_files[i]);
+
+	/* the trigger is registered by writing its specification
+	   (including the null terminator) to the pressure file; it
+	   remains active as long as the file is open */
+	const int length = snprintf(buffer, sizeof(buffer), "%s %lu %lu",
+				    full ? "full" : "some",
+				    (unsigned long)threshold.count(),
+				    (unsigned long)window.count());
+	if (fd.Write(buffer, length + 1) < 0)
+		throw FormatErrno("Failed to install %s trigger",
+				  pressure_files[i]);
+
+	struct epoll_event e;
+	e.events = EPOLLPRI;
+	e.data.u32 = i;
+	if (epoll_ctl(epoll_fd.Get(), EPOLL_CTL_ADD, fd.Get(), &e) < 0)
+		throw MakeErrno("epoll_ctl() failed");
+
+	triggers[i] = std::move(fd);
+}
+
+void
+CgroupPressureMonitor::Remove(PressureResource resource) noexcept
+{
+	auto &fd = triggers[size_t(resource)];
+	if (!fd.IsDefined())
+		return;
+
+	epoll_ctl(epoll_fd.Get(), EPOLL_CTL_DEL, fd.Get(), nullptr);
+	fd.Close();
+}
+
+std::string
+CgroupPressureMonitor::GetCgroupPath(const CgroupState &state,
+				     const char *name)
+{
+	if (!state.IsEnabled() ||
+	    std::find(state.mounts.begin(), state.mounts.end(),
+		      "unified") == state.mounts.end())
+		return std::string();
+
+	std::string path = "/sys/fs/cgroup/unified" + state.group_path;
+	if (name != nullptr) {
+		path.push_back('/');
+		path.append(name);
+	}
+
+	return path;
+}
+
+inline void
+CgroupPressureMonitor::OnReady(unsigned) noexcept
+{
+	struct epoll_event events[std::tuple_size<decltype(triggers)>::value];
+	const int n = epoll_wait(epoll_fd.Get(), events, ARRAY_SIZE(events), 0);
+
+	unsigned fired = 0;
+	for (int i = 0; i < n; ++i) {
+		const auto resource = PressureResource(events[i].data.u32);
+
+		if (events[i].events & EPOLLERR)
+			/* the cgroup has been deleted */
+			Remove(resource);
+		else if (events[i].events & EPOLLPRI)
+			fired |= 1u << unsigned(resource);
+	}
+
+	/* invoke the handler last and only through a local
+	   reference, because it may destroy this object */
+	auto &h = handler;
+	for (unsigned i = 0; fired != 0; ++i, fired >>= 1)
+		if (fired & 1)
+			h.OnCgroupPressure(PressureResource(i));
+}
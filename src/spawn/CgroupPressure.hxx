@@ -0,0 +1,128 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/SocketEvent.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <array>
+#include <chrono>
+#include <string>
+
+#include <stdint.h>
+
+struct CgroupState;
+
+/**
+ * A resource monitored by "pressure stall information" (PSI).
+ */
+enum class PressureResource : uint8_t {
+	CPU,
+	MEMORY,
+	IO,
+};
+
+class CgroupPressureHandler {
+public:
+	/**
+	 * A trigger installed with CgroupPressureMonitor::Add() has
+	 * fired: tasks in the cgroup have stalled on the given
+	 * resource for longer than the threshold within the window.
+	 */
+	virtual void OnCgroupPressure(PressureResource resource) noexcept = 0;
+};
+
+/**
+ * Installs PSI triggers on the pressure files ("cpu.pressure",
+ * "memory.pressure", "io.pressure") of a cgroup2 group and reports
+ * them to a #CgroupPressureHandler in the #EventLoop, so callers can
+ * shed load before the group gets throttled.
+ *
+ * The kernel signals triggers with POLLPRI, which libevent cannot
+ * wait for; therefore, the trigger file descriptors are registered
+ * in a private epoll instance, which becomes readable when one of
+ * them fires.
+ */
+class CgroupPressureMonitor {
+	CgroupPressureHandler &handler;
+
+	UniqueFileDescriptor epoll_fd;
+
+	SocketEvent event;
+
+	std::array<UniqueFileDescriptor, 3> triggers;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	CgroupPressureMonitor(EventLoop &event_loop,
+			      CgroupPressureHandler &_handler);
+	~CgroupPressureMonitor();
+
+	CgroupPressureMonitor(const CgroupPressureMonitor &) = delete;
+	CgroupPressureMonitor &operator=(const CgroupPressureMonitor &) = delete;
+
+	/**
+	 * Install a trigger, replacing an existing one for the same
+	 * resource.
+	 *
+	 * Throws on error (e.g. if the kernel does not support PSI).
+	 *
+	 * @param path the cgroup2 directory, see GetCgroupPath()
+	 * @param full trigger on "full" stalls (all tasks stalled at
+	 * the same time) instead of "some"
+	 * @param threshold the stall duration which fires the trigger
+	 * @param window the window in which stalls are accumulated;
+	 * the kernel allows 500ms to 10s
+	 */
+	void Add(const char *path, PressureResource resource, bool full,
+		 std::chrono::microseconds threshold,
+		 std::chrono::microseconds window);
+
+	void Remove(PressureResource resource) noexcept;
+
+	/**
+	 * Determine the cgroup2 directory of the given cgroup (see
+	 * CgroupOptions::name) below our own group, or of our own
+	 * group if #name is nullptr.
+	 *
+	 * @return the path or an empty string if there is no unified
+	 * hierarchy
+	 */
+	static std::string GetCgroupPath(const CgroupState &state,
+					 const char *name);
+
+private:
+	void OnReady(unsigned events) noexcept;
+};
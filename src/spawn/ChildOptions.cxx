@@ -37,6 +37,7 @@
 #include "system/Error.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 #include "util/djbhash.h"
+#include "util/StringCompare.hxx"
 
 #if TRANSLATION_ENABLE_JAILCGI
 #include "JailParams.hxx"
@@ -71,13 +72,15 @@ ChildOptions::ChildOptions(AllocatorPtr alloc,
 	      : nullptr),
 #endif
 	 uid_gid(src.uid_gid),
+	 placement(src.placement),
 	 umask(src.umask),
 	 stderr_null(src.stderr_null),
 	 stderr_jailed(src.stderr_jailed),
 	 forbid_user_ns(src.forbid_user_ns),
 	 forbid_multicast(src.forbid_multicast),
 	 forbid_bind(src.forbid_bind),
-	 no_new_privs(src.no_new_privs)
+	 no_new_privs(src.no_new_privs),
+	 sched_batch(src.sched_batch)
 {
 }
 
@@ -104,6 +107,8 @@ ChildOptions::IsExpandable() const
 void
 ChildOptions::Expand(AllocatorPtr alloc, const MatchInfo &match_info)
 {
+	hash_valid = false;
+
 	if (expand_stderr_path != nullptr)
 		stderr_path = expand_string_unescaped(alloc, expand_stderr_path,
 						      match_info);
@@ -144,6 +149,7 @@ ChildOptions::MakeId(char *p) const
 		p = jail->MakeId(p);
 #endif
 	p = uid_gid.MakeId(p);
+	p = placement.MakeId(p);
 
 	if (stderr_null) {
 		*p++ = ';';
@@ -174,9 +180,113 @@ ChildOptions::MakeId(char *p) const
 		*p++ = 'n';
 	}
 
+	if (sched_batch) {
+		*p++ = ';';
+		*p++ = 's';
+		*p++ = 'b';
+	}
+
 	return p;
 }
 
+gcc_pure
+static bool
+HasResourceLimits(const ResourceLimits *rlimits) noexcept
+{
+	return rlimits != nullptr && !rlimits->IsEmpty();
+}
+
+void
+ChildOptions::MakeHash(Hash128Builder &h) const noexcept
+{
+	const unsigned flags = stderr_jailed |
+		(stderr_null << 1) |
+		(forbid_user_ns << 2) |
+		(forbid_multicast << 3) |
+		(forbid_bind << 4) |
+		(no_new_privs << 5) |
+		(HasResourceLimits(rlimits) << 6) |
+#if TRANSLATION_ENABLE_JAILCGI
+		((jail != nullptr) << 7) |
+#endif
+		(unsigned(umask < 0 ? 0xfff : umask) << 8) |
+		(sched_batch << 20);
+	h.UpdateT(flags);
+
+	h.UpdateString(stderr_path);
+
+	size_t n_env = 0;
+	for (const char *i : env) {
+		h.UpdateString(i);
+		++n_env;
+	}
+	h.UpdateT(n_env);
+
+	cgroup.MakeHash(h);
+	if (HasResourceLimits(rlimits))
+		rlimits->MakeHash(h);
+	refence.MakeHash(h);
+	ns.MakeHash(h);
+#if TRANSLATION_ENABLE_JAILCGI
+	if (jail != nullptr)
+		jail->MakeHash(h);
+#endif
+	uid_gid.MakeHash(h);
+	placement.MakeHash(h);
+}
+
+gcc_pure
+static bool
+IsSameResourceLimits(const ResourceLimits *a, const ResourceLimits *b) noexcept
+{
+	if (!HasResourceLimits(a) || !HasResourceLimits(b))
+		return HasResourceLimits(a) == HasResourceLimits(b);
+
+	return a->IsSameId(*b);
+}
+
+gcc_pure
+static bool
+IsSameStringList(const ExpandableStringList &a,
+		 const ExpandableStringList &b) noexcept
+{
+	auto i = a.begin(), j = b.begin();
+	for (; i != a.end() && j != b.end(); ++i, ++j)
+		if (!StringIsEqual(*i, *j))
+			return false;
+
+	return !(i != a.end()) && !(j != b.end());
+}
+
+bool
+ChildOptions::operator==(const ChildOptions &other) const noexcept
+{
+	if (hash_valid && other.hash_valid && hash != other.hash)
+		return false;
+
+	return (umask < 0 ? -1 : umask) == (other.umask < 0 ? -1 : other.umask) &&
+		stderr_jailed == other.stderr_jailed &&
+		stderr_null == other.stderr_null &&
+		forbid_user_ns == other.forbid_user_ns &&
+		forbid_multicast == other.forbid_multicast &&
+		forbid_bind == other.forbid_bind &&
+		no_new_privs == other.no_new_privs &&
+		sched_batch == other.sched_batch &&
+		StringIsEqualOptional(stderr_path, other.stderr_path) &&
+		IsSameStringList(env, other.env) &&
+		cgroup.IsSameId(other.cgroup) &&
+		IsSameResourceLimits(rlimits, other.rlimits) &&
+		refence.IsSameId(other.refence) &&
+		ns.IsSameId(other.ns) &&
+#if TRANSLATION_ENABLE_JAILCGI
+		(jail == nullptr || other.jail == nullptr
+		 ? jail == other.jail
+		 : jail->IsSameId(*other.jail)) &&
+#endif
+		uid_gid.IsSameId(other.uid_gid) &&
+		placement.IsSameId(other.placement);
+}
+
 UniqueFileDescriptor
 ChildOptions::OpenStderrPath() const
 {
@@ -226,6 +336,8 @@ ChildOptions::CopyTo(PreparedChildProcess &dest
 	if (rlimits != nullptr)
 		dest.rlimits = *rlimits;
 	dest.uid_gid = uid_gid;
+	dest.placement = placement;
+	dest.sched_batch = sched_batch;
 	dest.forbid_user_ns = forbid_user_ns;
 	dest.forbid_multicast = forbid_multicast;
 	dest.forbid_bind = forbid_bind;
@@ -39,7 +39,9 @@
 #include "RefenceOptions.hxx"
 #include "NamespaceOptions.hxx"
 #include "UidGid.hxx"
+#include "PlacementOptions.hxx"
 #include "util/ShallowCopy.hxx"
+#include "util/Hash128.hxx"
 
 struct ResourceLimits;
 struct JailParams;
@@ -82,6 +84,8 @@ struct ChildOptions {
 
 	UidGid uid_gid;
 
+	PlacementOptions placement;
+
 	/**
 	 * The umask for the new child process.  -1 means do not change
 	 * it.
@@ -108,6 +112,21 @@ struct ChildOptions {
 
 	bool no_new_privs = false;
 
+	/**
+	 * @see PreparedChildProcess::sched_batch
+	 */
+	bool sched_batch = false;
+
+private:
+	/**
+	 * The value returned by GetHash(); only valid if
+	 * #hash_valid is set.
+	 */
+	mutable Hash128 hash{0, 0};
+
+	mutable bool hash_valid = false;
+
+public:
 	ChildOptions() = default;
 
 	constexpr ChildOptions(ShallowCopy shallow_copy, const ChildOptions &src)
@@ -123,13 +142,15 @@ struct ChildOptions {
 		jail(src.jail),
 #endif
 		uid_gid(src.uid_gid),
+		placement(src.placement),
 		umask(src.umask),
 		stderr_null(src.stderr_null),
 		stderr_jailed(src.stderr_jailed),
 		forbid_user_ns(src.forbid_user_ns),
 		forbid_multicast(src.forbid_multicast),
 		forbid_bind(src.forbid_bind),
-		no_new_privs(src.no_new_privs) {}
+		no_new_privs(src.no_new_privs),
+		sched_batch(src.sched_batch) {}
 
 	ChildOptions(AllocatorPtr alloc, const ChildOptions &src);
 
@@ -148,6 +169,41 @@ struct ChildOptions {
 
 	char *MakeId(char *p) const;
 
+	/**
+	 * Hash the attributes included in MakeId().  This can be used
+	 * as a pool key instead of the string built by MakeId(); use
+	 * operator==() to rule out collisions.
+	 */
+	void MakeHash(Hash128Builder &h) const noexcept;
+
+	/**
+	 * Like MakeHash(), but cache the result in this object.  The
+	 * attributes must not be modified after calling this method,
+	 * except by Expand().
+	 */
+	gcc_pure
+	Hash128 GetHash() const noexcept {
+		if (!hash_valid) {
+			Hash128Builder h;
+			MakeHash(h);
+			hash = h.Finish();
+			hash_valid = true;
+		}
+
+		return hash;
+	}
+
+	/**
+	 * Compare the attributes included in MakeId(); two objects
+	 * are equal if their child processes are interchangeable.
+	 */
+	gcc_pure
+	bool operator==(const ChildOptions &other) const noexcept;
+
+	bool operator!=(const ChildOptions &other) const noexcept {
+		return !(*this == other);
+	}
+
 	/**
 	 * Throws on error.
 	 */
@@ -0,0 +1,487 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ChildStock.hxx"
+#include "ChildOptions.hxx"
+#include "Prepared.hxx"
+#include "Interface.hxx"
+#include "event/Loop.hxx"
+#include "system/Error.hxx"
+#include "util/Cancellable.hxx"
+#include "util/DeleteDisposer.hxx"
+
+#include <string>
+
+#include <assert.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+class ChildStock::Request final
+	: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+	  public Cancellable {
+
+	ChildStock &stock;
+	ChildStockKey &key;
+
+	const ChildOptions &options;
+	void *const info;
+
+	ChildStockHandler &handler;
+
+public:
+	Request(ChildStock &_stock, ChildStockKey &_key,
+		const ChildOptions &_options, void *_info,
+		ChildStockHandler &_handler,
+		CancellablePointer &cancel_ptr) noexcept
+		:stock(_stock), key(_key),
+		 options(_options), info(_info),
+		 handler(_handler) {
+		cancel_ptr = *this;
+	}
+
+	const ChildOptions &GetOptions() const noexcept {
+		return options;
+	}
+
+	void *GetInfo() const noexcept {
+		return info;
+	}
+
+	/**
+	 * Hand over a child process and destroy this object.
+	 */
+	void Deliver(ChildStockItem &item) noexcept {
+		auto &h = handler;
+		delete this;
+		h.OnChildStockReady(item);
+	}
+
+	/**
+	 * Report an error and destroy this object.
+	 */
+	void Fail(std::exception_ptr ep) noexcept {
+		auto &h = handler;
+		delete this;
+		h.OnChildStockError(ep);
+	}
+
+	/* virtual methods from Cancellable */
+	void Cancel() noexcept override;
+};
+
+struct ChildStockKey final : ChildStock::KeyHook {
+	const Hash128 hash;
+
+	const std::string name;
+
+	/**
+	 * Idle children, most recently used first.
+	 */
+	boost::intrusive::list<ChildStockItem,
+			       boost::intrusive::member_hook<ChildStockItem,
+							     ChildStockItem::SiblingsHook,
+							     &ChildStockItem::key_siblings>,
+			       boost::intrusive::constant_time_size<true>> idle;
+
+	/**
+	 * Get() requests waiting for a free slot.
+	 */
+	boost::intrusive::list<ChildStock::Request,
+			       boost::intrusive::constant_time_size<false>> waiting;
+
+	/**
+	 * The number of children which are currently handed out.
+	 */
+	unsigned n_busy = 0;
+
+	ChildStockKey(Hash128 _hash, const char *_name) noexcept
+		:hash(_hash), name(_name) {}
+
+	~ChildStockKey() noexcept {
+		assert(waiting.empty());
+		assert(idle.empty());
+		assert(n_busy == 0);
+	}
+
+	bool IsUnused() const noexcept {
+		return idle.empty() && waiting.empty() && n_busy == 0;
+	}
+};
+
+void
+ChildStock::Request::Cancel() noexcept
+{
+	auto &s = stock;
+	auto &k = key;
+
+	k.waiting.erase(k.waiting.iterator_to(*this));
+	delete this;
+
+	s.OnRequestFinished(k);
+}
+
+ChildStockItem::ChildStockItem(ChildStock &_stock, ChildStockKey &_key,
+			       UniqueSocketDescriptor &&_control) noexcept
+	:stock(_stock), key(_key), control(std::move(_control)),
+	 event(stock.event_loop, control.Get(), SocketEvent::READ,
+	       BIND_THIS_METHOD(OnSocketEvent))
+{
+}
+
+ChildStockItem::~ChildStockItem() noexcept
+{
+	assert(!key_siblings.is_linked());
+	assert(!stock_siblings.is_linked());
+
+	event.Delete();
+
+	if (pid > 0)
+		/* this also unregisters our ExitListener */
+		stock.spawn_service.KillChildProcess(pid);
+}
+
+void
+ChildStockItem::Put(bool reuse) noexcept
+{
+	stock.Put(*this, reuse);
+}
+
+void
+ChildStockItem::OnSocketEvent(unsigned) noexcept
+{
+	assert(!busy);
+
+	/* an idle child must not send anything; this is probably
+	   EOF because it has exited */
+	stock.OnIdleGone(*this);
+}
+
+void
+ChildStockItem::OnChildProcessExit(int)
+{
+	pid = -1;
+
+	if (!busy)
+		stock.OnIdleGone(*this);
+
+	/* a busy item will be destroyed by Put() */
+}
+
+bool
+ChildStock::KeyCompare::operator()(const ChildStockKey &a,
+				   const ChildStockKey &b) const noexcept
+{
+	return a.hash < b.hash;
+}
+
+bool
+ChildStock::KeyCompare::operator()(const ChildStockKey &a,
+				   Hash128 b) const noexcept
+{
+	return a.hash < b;
+}
+
+bool
+ChildStock::KeyCompare::operator()(Hash128 a,
+				   const ChildStockKey &b) const noexcept
+{
+	return a < b.hash;
+}
+
+static unsigned
+CleanupInterval(std::chrono::steady_clock::duration idle_timeout) noexcept
+{
+	const auto s = std::chrono::duration_cast<std::chrono::seconds>(idle_timeout).count() / 2;
+	return s > 0 ? unsigned(s) : 1;
+}
+
+ChildStock::ChildStock(EventLoop &_event_loop, SpawnService &_spawn_service,
+		       ChildStockClass &_cls,
+		       unsigned _max_per_key, unsigned _max_idle_per_key,
+		       unsigned _max_idle,
+		       std::chrono::steady_clock::duration _idle_timeout) noexcept
+	:event_loop(_event_loop), spawn_service(_spawn_service), cls(_cls),
+	 max_per_key(_max_per_key), max_idle_per_key(_max_idle_per_key),
+	 max_idle(_max_idle),
+	 idle_timeout(_idle_timeout),
+	 cleanup_timer(event_loop, CleanupInterval(idle_timeout),
+		       BIND_THIS_METHOD(OnCleanupTimer)),
+	 cleanup_event(event_loop, BIND_THIS_METHOD(OnCleanup))
+{
+	assert(max_per_key > 0);
+}
+
+ChildStock::~ChildStock() noexcept
+{
+	FlushIdle();
+
+	/* cancel after FlushIdle(), which schedules it */
+	cleanup_event.Cancel();
+	keys.clear_and_dispose(DeleteDisposer());
+}
+
+ChildStockKey &
+ChildStock::MakeKey(const char *name, const ChildOptions &options) noexcept
+{
+	Hash128Builder h;
+	h.UpdateString(name);
+	h.UpdateT(options.GetHash());
+	const auto hash = h.Finish();
+
+	KeyCompare compare;
+	auto i = keys.lower_bound(hash, compare);
+	if (i != keys.end() && !compare(hash, *i))
+		return *i;
+
+	auto *key = new ChildStockKey(hash, name);
+	keys.insert_before(i, *key);
+	return *key;
+}
+
+ChildStockItem &
+ChildStock::Spawn(ChildStockKey &key, const ChildOptions &options, void *info)
+{
+	UniqueSocketDescriptor control, child_control;
+	if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_SEQPACKET, 0,
+						      control, child_control))
+		throw MakeErrno("socketpair() failed");
+
+	PreparedChildProcess p;
+	p.SetControl(std::move(child_control));
+	cls.PrepareChild(options, info, p);
+
+	auto *item = new ChildStockItem(*this, key, std::move(control));
+
+	try {
+		item->pid = spawn_service.SpawnChildProcess(key.name.c_str(),
+							    std::move(p),
+							    item);
+	} catch (...) {
+		delete item;
+		throw;
+	}
+
+	return *item;
+}
+
+/**
+ * Check whether an idle child can be reused: there must be neither
+ * pending data nor EOF on its control socket.
+ */
+static bool
+IsAlive(SocketDescriptor fd) noexcept
+{
+	char dummy;
+	ssize_t nbytes = recv(fd.Get(), &dummy, sizeof(dummy),
+			      MSG_PEEK|MSG_DONTWAIT);
+	return nbytes < 0 && errno == EAGAIN;
+}
+
+void
+ChildStock::DeleteIdle(ChildStockItem &item) noexcept
+{
+	assert(!item.busy);
+
+	item.key.idle.erase(item.key.idle.iterator_to(item));
+	idle.erase(idle.iterator_to(item));
+	delete &item;
+}
+
+ChildStockItem *
+ChildStock::PopIdle(ChildStockKey &key) noexcept
+{
+	while (!key.idle.empty()) {
+		auto &item = key.idle.front();
+
+		if (item.pid > 0 && IsAlive(item.control)) {
+			key.idle.pop_front();
+			idle.erase(idle.iterator_to(item));
+			item.event.Delete();
+			item.busy = true;
+			return &item;
+		}
+
+		DeleteIdle(item);
+	}
+
+	return nullptr;
+}
+
+void
+ChildStock::Get(const char *name, const ChildOptions &options, void *info,
+		ChildStockHandler &handler,
+		CancellablePointer &cancel_ptr) noexcept
+{
+	auto &key = MakeKey(name, options);
+
+	if (key.n_busy >= max_per_key) {
+		key.waiting.push_back(*new Request(*this, key, options, info,
+						   handler, cancel_ptr));
+		return;
+	}
+
+	ChildStockItem *item = PopIdle(key);
+	if (item == nullptr) {
+		try {
+			item = &Spawn(key, options, info);
+		} catch (...) {
+			ScheduleCleanup();
+			handler.OnChildStockError(std::current_exception());
+			return;
+		}
+	}
+
+	++key.n_busy;
+	handler.OnChildStockReady(*item);
+}
+
+void
+ChildStock::Put(ChildStockItem &item, bool reuse) noexcept
+{
+	assert(item.busy);
+
+	auto &key = item.key;
+	assert(key.n_busy > 0);
+	--key.n_busy;
+
+	if (reuse && item.pid > 0 && max_idle_per_key > 0 && max_idle > 0) {
+		if (key.idle.size() >= max_idle_per_key)
+			/* evict the least recently used one of this
+			   key */
+			DeleteIdle(key.idle.back());
+
+		if (idle.size() >= max_idle)
+			/* evict the least recently used one of the
+			   whole stock */
+			DeleteIdle(idle.front());
+
+		item.busy = false;
+		item.idle_since = event_loop.SteadyNow();
+		item.event.Add();
+		key.idle.push_front(item);
+		idle.push_back(item);
+
+		cleanup_timer.Enable();
+	} else
+		delete &item;
+
+	ServeWaiting(key);
+	ScheduleCleanup();
+}
+
+void
+ChildStock::OnIdleGone(ChildStockItem &item) noexcept
+{
+	auto &key = item.key;
+	DeleteIdle(item);
+
+	ServeWaiting(key);
+	ScheduleCleanup();
+}
+
+void
+ChildStock::ServeWaiting(ChildStockKey &key) noexcept
+{
+	while (!key.waiting.empty() && key.n_busy < max_per_key) {
+		auto &request = key.waiting.front();
+		key.waiting.pop_front();
+
+		ChildStockItem *item = PopIdle(key);
+		if (item == nullptr) {
+			try {
+				item = &Spawn(key, request.GetOptions(),
+					      request.GetInfo());
+			} catch (...) {
+				request.Fail(std::current_exception());
+				continue;
+			}
+		}
+
+		++key.n_busy;
+		request.Deliver(*item);
+	}
+}
+
+void
+ChildStock::OnRequestFinished(ChildStockKey &key) noexcept
+{
+	ServeWaiting(key);
+	ScheduleCleanup();
+}
+
+void
+ChildStock::FlushIdle() noexcept
+{
+	while (!idle.empty())
+		DeleteIdle(idle.front());
+
+	ScheduleCleanup();
+}
+
+size_t
+ChildStock::GetBusyCount() const noexcept
+{
+	size_t n = 0;
+	for (const auto &key : keys)
+		n += key.n_busy;
+	return n;
+}
+
+inline void
+ChildStock::ScheduleCleanup() noexcept
+{
+	cleanup_event.Schedule();
+}
+
+void
+ChildStock::OnCleanup() noexcept
+{
+	for (auto i = keys.begin(); i != keys.end();) {
+		if (i->IsUnused())
+			i = keys.erase_and_dispose(i, DeleteDisposer());
+		else
+			++i;
+	}
+}
+
+bool
+ChildStock::OnCleanupTimer() noexcept
+{
+	const auto expiry = event_loop.SteadyNow() - idle_timeout;
+
+	/* the list is ordered by idle_since */
+	while (!idle.empty() && idle.front().idle_since <= expiry)
+		DeleteIdle(idle.front());
+
+	ScheduleCleanup();
+	return !idle.empty();
+}
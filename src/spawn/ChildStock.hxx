@@ -0,0 +1,330 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "ExitListener.hxx"
+#include "event/CleanupTimer.hxx"
+#include "event/DeferEvent.hxx"
+#include "event/SocketEvent.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "util/Hash128.hxx"
+#include "util/Compiler.h"
+
+#include <boost/intrusive/set.hpp>
+#include <boost/intrusive/list.hpp>
+
+#include <chrono>
+#include <exception>
+
+struct ChildOptions;
+struct PreparedChildProcess;
+struct ChildStockKey;
+class SpawnService;
+class CancellablePointer;
+class ChildStock;
+
+/**
+ * Describes how to launch child processes for a #ChildStock.
+ */
+class ChildStockClass {
+public:
+	/**
+	 * Fill in the parameters of a new child process, e.g. the
+	 * executable, its arguments and ChildOptions::CopyTo().  The
+	 * control socket has already been set up.
+	 *
+	 * Throws on error.
+	 *
+	 * @param info the opaque pointer passed to ChildStock::Get()
+	 */
+	virtual void PrepareChild(const ChildOptions &options, void *info,
+				  PreparedChildProcess &p) = 0;
+};
+
+/**
+ * A child process managed by #ChildStock.
+ */
+class ChildStockItem final : ExitListener {
+	friend class ChildStock;
+	friend struct ChildStockKey;
+
+	typedef boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::safe_link>> SiblingsHook;
+
+	/**
+	 * For #ChildStockKey's list of idle items.
+	 */
+	SiblingsHook key_siblings;
+
+	/**
+	 * For #ChildStock's global list of idle items.
+	 */
+	SiblingsHook stock_siblings;
+
+	ChildStock &stock;
+	ChildStockKey &key;
+
+	/**
+	 * Our end of the control socket.
+	 */
+	UniqueSocketDescriptor control;
+
+	/**
+	 * Detects when the idle child process closes the control
+	 * socket or sends unexpected data.
+	 */
+	SocketEvent event;
+
+	/**
+	 * The process id; -1 after the process has exited.
+	 */
+	int pid = -1;
+
+	bool busy = true;
+
+	/**
+	 * When was this item returned to the stock?  Only valid if
+	 * it is idle.
+	 */
+	std::chrono::steady_clock::time_point idle_since;
+
+	ChildStockItem(ChildStock &_stock, ChildStockKey &_key,
+		       UniqueSocketDescriptor &&_control) noexcept;
+
+	~ChildStockItem() noexcept;
+
+public:
+	ChildStockItem(const ChildStockItem &) = delete;
+	ChildStockItem &operator=(const ChildStockItem &) = delete;
+
+	int GetPid() const noexcept {
+		return pid;
+	}
+
+	/**
+	 * Returns the control socket.  It was connected to the
+	 * child's #PreparedChildProcess::control_fd.
+	 */
+	SocketDescriptor GetControl() const noexcept {
+		return control;
+	}
+
+	/**
+	 * Return this item to the stock.  After this call, it must
+	 * not be used anymore.
+	 *
+	 * @param reuse false if the child process is in an undefined
+	 * state and must be killed
+	 */
+	void Put(bool reuse) noexcept;
+
+private:
+	void OnSocketEvent(unsigned events) noexcept;
+
+	/* virtual methods from ExitListener */
+	void OnChildProcessExit(int status) override;
+};
+
+class ChildStockHandler {
+public:
+	/**
+	 * A child process is ready.  It must be returned with
+	 * ChildStockItem::Put() when it is not used anymore.
+	 */
+	virtual void OnChildStockReady(ChildStockItem &item) noexcept = 0;
+
+	virtual void OnChildStockError(std::exception_ptr ep) noexcept = 0;
+};
+
+/**
+ * A pool of long-running child processes (e.g. FastCGI or WAS
+ * workers), keyed by a name and the #ChildOptions hash.  Each child
+ * gets a control socket (#PreparedChildProcess::control_fd); while a
+ * child is handed out, its user talks to it over this socket.
+ *
+ * - the number of busy children per key is limited; Get() calls
+ *   which exceed it wait until a child is returned
+ * - the number of idle children is limited per key and globally;
+ *   the least recently used idle child is killed first
+ * - idle children which close their control socket (or exit) are
+ *   discarded
+ * - idle children are killed after a timeout by a #CleanupTimer
+ *
+ * Keys are compared by their 128 bit hash only (see
+ * ChildOptions::GetHash()).
+ *
+ * This class is not thread-safe.  All pending Get() requests must be
+ * finished or canceled and all items must be returned before it is
+ * destroyed.
+ */
+class ChildStock final {
+	friend class ChildStockItem;
+	friend struct ChildStockKey;
+	class Request;
+
+	typedef boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> KeyHook;
+
+	struct KeyCompare {
+		bool operator()(const ChildStockKey &a, const ChildStockKey &b) const noexcept;
+		bool operator()(const ChildStockKey &a, Hash128 b) const noexcept;
+		bool operator()(Hash128 a, const ChildStockKey &b) const noexcept;
+	};
+
+	EventLoop &event_loop;
+	SpawnService &spawn_service;
+	ChildStockClass &cls;
+
+	const unsigned max_per_key, max_idle_per_key, max_idle;
+
+	const std::chrono::steady_clock::duration idle_timeout;
+
+	boost::intrusive::set<ChildStockKey, boost::intrusive::base_hook<KeyHook>,
+			      boost::intrusive::compare<KeyCompare>,
+			      boost::intrusive::constant_time_size<false>> keys;
+
+	/**
+	 * All idle items, least recently used first.
+	 */
+	boost::intrusive::list<ChildStockItem,
+			       boost::intrusive::member_hook<ChildStockItem,
+							     ChildStockItem::SiblingsHook,
+							     &ChildStockItem::stock_siblings>,
+			       boost::intrusive::constant_time_size<true>> idle;
+
+	/**
+	 * Kills expired idle children.
+	 */
+	CleanupTimer cleanup_timer;
+
+	/**
+	 * Removes unused #ChildStockKey instances.  This is deferred,
+	 * because removing them synchronously would invalidate
+	 * references held further up in the stack.
+	 */
+	DeferEvent cleanup_event;
+
+public:
+	/**
+	 * @param _max_per_key the maximum number of busy children per
+	 * key
+	 * @param _max_idle_per_key the maximum number of idle
+	 * children per key
+	 * @param _max_idle the maximum number of idle children in
+	 * this stock
+	 * @param _idle_timeout idle children are killed after this
+	 * duration
+	 */
+	ChildStock(EventLoop &_event_loop, SpawnService &_spawn_service,
+		   ChildStockClass &_cls,
+		   unsigned _max_per_key=16, unsigned _max_idle_per_key=4,
+		   unsigned _max_idle=64,
+		   std::chrono::steady_clock::duration _idle_timeout=std::chrono::minutes(5)) noexcept;
+
+	~ChildStock() noexcept;
+
+	ChildStock(const ChildStock &) = delete;
+	ChildStock &operator=(const ChildStock &) = delete;
+
+	EventLoop &GetEventLoop() noexcept {
+		return event_loop;
+	}
+
+	/**
+	 * Obtain a child process, either an idle one or a new one.
+	 * The handler may be invoked synchronously.
+	 *
+	 * @param name the name of the child process (passed to
+	 * SpawnService::SpawnChildProcess()); it is part of the key
+	 * @param options the options of the child process; they must
+	 * remain valid (and unmodified) until the handler is invoked
+	 * or the operation is canceled
+	 * @param info an opaque pointer passed to
+	 * ChildStockClass::PrepareChild(); it must remain valid as
+	 * long as #options
+	 */
+	void Get(const char *name, const ChildOptions &options, void *info,
+		 ChildStockHandler &handler,
+		 CancellablePointer &cancel_ptr) noexcept;
+
+	/**
+	 * Kill all idle children.
+	 */
+	void FlushIdle() noexcept;
+
+	size_t GetIdleCount() const noexcept {
+		return idle.size();
+	}
+
+	gcc_pure
+	size_t GetBusyCount() const noexcept;
+
+private:
+	ChildStockKey &MakeKey(const char *name,
+			       const ChildOptions &options) noexcept;
+
+	/**
+	 * Launch a new child process.
+	 *
+	 * Throws on error.
+	 */
+	ChildStockItem &Spawn(ChildStockKey &key, const ChildOptions &options,
+			      void *info);
+
+	/**
+	 * Pop an idle child process which is still alive.
+	 */
+	ChildStockItem *PopIdle(ChildStockKey &key) noexcept;
+
+	/**
+	 * Remove an idle item from all lists and destroy it.
+	 */
+	void DeleteIdle(ChildStockItem &item) noexcept;
+
+	void Put(ChildStockItem &item, bool reuse) noexcept;
+
+	/**
+	 * Called by #ChildStockItem when an idle child process is
+	 * gone.
+	 */
+	void OnIdleGone(ChildStockItem &item) noexcept;
+
+	/**
+	 * Serve #ChildStockKey::waiting as long as the limit allows
+	 * it.
+	 */
+	void ServeWaiting(ChildStockKey &key) noexcept;
+
+	void OnRequestFinished(ChildStockKey &key) noexcept;
+	void ScheduleCleanup() noexcept;
+	void OnCleanup() noexcept;
+	bool OnCleanupTimer() noexcept;
+};
@@ -37,9 +37,11 @@
 #include "Prepared.hxx"
 #include "MountList.hxx"
 #include "ExitListener.hxx"
+#include "MemfdPayload.hxx"
 #include "system/Error.hxx"
 #include "util/RuntimeError.hxx"
 #include "util/ScopeExit.hxx"
+#include "util/Exception.hxx"
 
 #include <array>
 
@@ -49,8 +51,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
-
-static constexpr size_t MAX_FDS = 8;
+#include <sys/wait.h>
 
 SpawnServerClient::SpawnServerClient(EventLoop &event_loop,
 				     const SpawnConfig &_config,
@@ -60,6 +61,11 @@ SpawnServerClient::SpawnServerClient(EventLoop &event_loop,
 	 read_event(event_loop, socket.Get(),
 		    SocketEvent::READ|SocketEvent::PERSIST,
 		    BIND_THIS_METHOD(OnSocketEvent)),
+	 write_event(event_loop, socket.Get(),
+		     SocketEvent::WRITE|SocketEvent::PERSIST,
+		     BIND_THIS_METHOD(OnWritable)),
+	 failed_event(event_loop, BIND_THIS_METHOD(OnFailed)),
+	 flush_event(event_loop, BIND_THIS_METHOD(FlushBatch)),
 	 verify(_verify)
 {
 	read_event.Add();
@@ -86,6 +92,8 @@ SpawnServerClient::ReplaceSocket(UniqueSocketDescriptor new_socket)
 
 	read_event.Set(socket.Get(), SocketEvent::READ|SocketEvent::PERSIST);
 	read_event.Add();
+
+	write_event.Set(socket.Get(), SocketEvent::WRITE|SocketEvent::PERSIST);
 }
 
 void
@@ -93,6 +101,25 @@ SpawnServerClient::Close()
 {
 	assert(socket.IsDefined());
 
+	/* discard unsent EXEC requests */
+	flush_event.Cancel();
+	exec_batch.clear();
+	exec_batch_fd_numbers.clear();
+	exec_batch_fds.clear();
+	exec_batch_pids.clear();
+
+	write_event.Delete();
+	send_queue.clear();
+
+	failed_event.Cancel();
+	failed_pids.clear();
+
+	/* the responses to these will never arrive */
+	stats_handlers.clear();
+
+	/* profiles are registered per connection */
+	profiles.clear();
+
 	read_event.Delete();
 	socket.Close();
 }
@@ -115,16 +142,101 @@ SpawnServerClient::CheckOrAbort()
 	}
 }
 
-inline void
+SpawnServerClient::QueuedDatagram::QueuedDatagram(ConstBuffer<void> _payload,
+						  ConstBuffer<int> _fds)
+	:payload((const uint8_t *)_payload.data,
+		 (const uint8_t *)_payload.data + _payload.size),
+	 fd_numbers(_fds.begin(), _fds.end())
+{
+}
+
+SpawnServerClient::QueuedDatagram *
 SpawnServerClient::Send(ConstBuffer<void> payload, ConstBuffer<int> fds)
 {
-	::Send<MAX_FDS>(socket, payload, fds);
+	assert(fds.size <= SPAWN_MAX_REQUEST_FDS);
+
+	if (send_queue.empty()) {
+		if (TrySend<SPAWN_MAX_REQUEST_FDS>(socket, payload, fds))
+			return nullptr;
+
+		write_event.Add();
+	}
+
+	send_queue.emplace_back(payload, fds);
+	return &send_queue.back();
 }
 
-inline void
+inline SpawnServerClient::QueuedDatagram *
 SpawnServerClient::Send(const SpawnSerializer &s)
 {
-	::Send<MAX_FDS>(socket, s);
+	return Send(s.GetPayload(), s.GetFds());
+}
+
+SpawnServerClient::QueuedDatagram *
+SpawnServerClient::SendMemfd(const SpawnSerializer &s)
+{
+	auto memfd = CreateSpawnPayloadMemfd(s.GetPayload());
+
+	const auto fds = s.GetFds();
+	assert(1 + fds.size <= SPAWN_MAX_REQUEST_FDS);
+
+	std::array<int, SPAWN_MAX_REQUEST_FDS> fd_numbers;
+	fd_numbers[0] = memfd.Get();
+	std::copy(fds.begin(), fds.end(), fd_numbers.begin() + 1);
+
+	static constexpr uint8_t cmd = uint8_t(SpawnRequestCommand::MEMFD);
+	auto *d = Send({&cmd, sizeof(cmd)}, {fd_numbers.data(), 1 + fds.size});
+	if (d != nullptr)
+		/* keep the memfd open until the datagram has been
+		   sent */
+		d->fds.push_back(std::move(memfd));
+
+	return d;
+}
+
+void
+SpawnServerClient::FlushQueue() noexcept
+{
+	while (!send_queue.empty()) {
+		auto &d = send_queue.front();
+
+		try {
+			if (!TrySend<SPAWN_MAX_REQUEST_FDS>(socket,
+							    {d.payload.data(), d.payload.size()},
+							    {d.fd_numbers.data(), d.fd_numbers.size()}))
+				/* still full; wait for the next
+				   write_event */
+				return;
+		} catch (...) {
+			fprintf(stderr, "failed to send to spawner: %s\n",
+				GetFullMessage(std::current_exception()).c_str());
+
+			failed_pids.insert(failed_pids.end(),
+					   d.pids.begin(), d.pids.end());
+			failed_event.Schedule();
+		}
+
+		send_queue.pop_front();
+	}
+
+	write_event.Delete();
+}
+
+void
+SpawnServerClient::OnWritable(unsigned) noexcept
+{
+	FlushQueue();
+}
+
+void
+SpawnServerClient::OnFailed() noexcept
+{
+	/* the listeners may call us back, which may add new pids */
+	const auto pids = std::move(failed_pids);
+	failed_pids.clear();
+
+	for (int pid : pids)
+		HandleExit(pid, W_EXITCODE(0xff, 0));
 }
 
 UniqueSocketDescriptor
@@ -142,15 +254,142 @@ SpawnServerClient::Connect()
 
 	const int remote_fd = remote_socket.Get();
 
+	QueuedDatagram *d;
+
 	try {
-		Send(ConstBuffer<void>(&cmd, sizeof(cmd)), {&remote_fd, 1});
+		d = Send(ConstBuffer<void>(&cmd, sizeof(cmd)), {&remote_fd, 1});
 	} catch (...) {
 		std::throw_with_nested(std::runtime_error("Spawn server failed"));
 	}
 
+	if (d != nullptr)
+		d->fds.emplace_back(FileDescriptor(remote_socket.Release().Get()));
+
 	return local_socket;
 }
 
+void
+SpawnServerClient::EnableBatching()
+{
+	if (batching)
+		return;
+
+	CheckOrAbort();
+
+	static constexpr uint8_t payload[] = {
+		uint8_t(SpawnRequestCommand::CONNECT),
+		uint8_t(SpawnConnectFlags::BATCH),
+	};
+
+	try {
+		Send(ConstBuffer<void>(payload, sizeof(payload)), nullptr);
+	} catch (...) {
+		std::throw_with_nested(std::runtime_error("Spawn server failed"));
+	}
+
+	batching = true;
+}
+
+/**
+ * Move all file descriptors out of the #PreparedChildProcess, so they
+ * stay open until the batch has been sent.
+ */
+static void
+StealFds(PreparedChildProcess &p, std::vector<UniqueFileDescriptor> &dest)
+{
+	int *const fds[] = {
+		&p.stdin_fd, &p.stdout_fd, &p.stderr_fd, &p.control_fd,
+	};
+
+	for (int *i : fds) {
+		const int fd = *i;
+		if (fd < 0)
+			continue;
+
+		dest.emplace_back(FileDescriptor(fd));
+
+		/* the same file descriptor may be used more than once */
+		for (int *j : fds)
+			if (*j == fd)
+				*j = -1;
+	}
+}
+
+bool
+SpawnServerClient::AddToBatch(int pid, const SpawnSerializer &s,
+			      PreparedChildProcess &p)
+{
+	const auto payload = ConstBuffer<uint8_t>::FromVoid(s.GetPayload());
+	const auto fds = s.GetFds();
+
+	const uint32_t length = payload.size;
+	const size_t record_size = sizeof(length) + payload.size;
+
+	if (1 + record_size > SPAWN_MAX_REQUEST_SIZE)
+		return false;
+
+	if (exec_batch.size() + record_size > SPAWN_MAX_REQUEST_SIZE ||
+	    exec_batch_fd_numbers.size() + fds.size > SPAWN_MAX_REQUEST_FDS)
+		FlushBatch();
+
+	if (exec_batch.empty())
+		exec_batch.push_back(uint8_t(SpawnRequestCommand::EXEC_BATCH));
+
+	const auto *l = (const uint8_t *)&length;
+	exec_batch.insert(exec_batch.end(), l, l + sizeof(length));
+	exec_batch.insert(exec_batch.end(), payload.begin(), payload.end());
+
+	exec_batch_fd_numbers.insert(exec_batch_fd_numbers.end(),
+				     fds.begin(), fds.end());
+	StealFds(p, exec_batch_fds);
+	exec_batch_pids.push_back(pid);
+
+	flush_event.Schedule();
+	return true;
+}
+
+void
+SpawnServerClient::FlushBatch() noexcept
+{
+	flush_event.Cancel();
+
+	if (exec_batch.empty())
+		return;
+
+	assert(socket.IsDefined());
+
+	std::exception_ptr error;
+
+	try {
+		auto *d = Send({exec_batch.data(), exec_batch.size()},
+			       {exec_batch_fd_numbers.data(),
+				exec_batch_fd_numbers.size()});
+		if (d != nullptr) {
+			d->fds = std::move(exec_batch_fds);
+			d->pids = std::move(exec_batch_pids);
+		}
+	} catch (...) {
+		error = std::current_exception();
+	}
+
+	exec_batch.clear();
+	exec_batch_fd_numbers.clear();
+	exec_batch_fds.clear();
+
+	const auto pids = std::move(exec_batch_pids);
+	exec_batch_pids.clear();
+
+	if (error) {
+		fprintf(stderr, "failed to send EXEC to spawner: %s\n",
+			GetFullMessage(error).c_str());
+
+		/* the listeners may call us back, which is safe now that
+		   the batch has been cleared */
+		for (int pid : pids)
+			HandleExit(pid, W_EXITCODE(0xff, 0));
+	}
+}
+
 static void
 Serialize(SpawnSerializer &s, const CgroupOptions &c)
 {
@@ -248,8 +487,39 @@ Serialize(SpawnSerializer &s, const UidGid &uid_gid)
 		s.WriteT(uid_gid.groups[i]);
 }
 
+/**
+ * Serialize CPU/NUMA placement and utilization clamp settings.
+ */
 static void
-Serialize(SpawnSerializer &s, const PreparedChildProcess &p)
+Serialize(SpawnSerializer &s, const PlacementOptions &placement)
+{
+	if (placement.HasCpus()) {
+		s.Write(SpawnExecCommand::CPU_AFFINITY);
+		s.WriteT(placement.cpus);
+	}
+
+	if (placement.memory_policy != PlacementOptions::MemoryPolicy::DEFAULT) {
+		s.Write(SpawnExecCommand::MEMORY_POLICY);
+		s.WriteT(placement.memory_policy);
+		s.WriteT(placement.memory_nodes);
+	}
+
+	if (placement.util_min != PlacementOptions::UTIL_UNDEFINED ||
+	    placement.util_max != PlacementOptions::UTIL_UNDEFINED) {
+		s.Write(SpawnExecCommand::UTIL_CLAMP);
+		s.WriteT(placement.util_min);
+		s.WriteT(placement.util_max);
+	}
+
+	s.WriteOptional(SpawnExecCommand::NUMA_AUTO, placement.auto_node);
+}
+
+/**
+ * Serialize the settings which are specific to this child process
+ * (not part of a profile).
+ */
+static void
+SerializeRequest(SpawnSerializer &s, const PreparedChildProcess &p)
 {
 	assert(p.exec_function == nullptr); // not supported
 
@@ -261,18 +531,26 @@ Serialize(SpawnSerializer &s, const PreparedChildProcess &p)
 	for (const char *i : p.env)
 		s.WriteString(SpawnExecCommand::SETENV, i);
 
-	if (p.umask >= 0) {
-		uint16_t umask = p.umask;
-		s.Write(SpawnExecCommand::UMASK);
-		s.WriteT(umask);
-	}
-
 	s.CheckWriteFd(SpawnExecCommand::STDIN, p.stdin_fd);
 	s.CheckWriteFd(SpawnExecCommand::STDOUT, p.stdout_fd);
 	s.CheckWriteFd(SpawnExecCommand::STDERR, p.stderr_fd);
 	s.CheckWriteFd(SpawnExecCommand::CONTROL, p.control_fd);
 
 	s.WriteOptionalString(SpawnExecCommand::STDERR_PATH, p.stderr_path);
+}
+
+/**
+ * Serialize the settings which are usually shared by many child
+ * processes (see #SpawnRequestCommand::PROFILE).
+ */
+static void
+SerializeProfile(SpawnSerializer &s, const PreparedChildProcess &p)
+{
+	if (p.umask >= 0) {
+		uint16_t umask = p.umask;
+		s.Write(SpawnExecCommand::UMASK);
+		s.WriteT(umask);
+	}
 
 	if (p.priority != 0) {
 		s.Write(SpawnExecCommand::PRIORITY);
@@ -284,6 +562,7 @@ Serialize(SpawnSerializer &s, const PreparedChildProcess &p)
 	Serialize(s, p.ns);
 	Serialize(s, p.rlimits);
 	Serialize(s, p.uid_gid);
+	Serialize(s, p.placement);
 
 	s.WriteOptionalString(SpawnExecCommand::CHROOT, p.chroot);
 	s.WriteOptionalString(SpawnExecCommand::CHDIR, p.chdir);
@@ -291,6 +570,9 @@ Serialize(SpawnSerializer &s, const PreparedChildProcess &p)
 	if (p.sched_idle)
 		s.Write(SpawnExecCommand::SCHED_IDLE_);
 
+	if (p.sched_batch)
+		s.Write(SpawnExecCommand::SCHED_BATCH_);
+
 	if (p.ioprio_idle)
 		s.Write(SpawnExecCommand::IOPRIO_IDLE);
 
@@ -310,13 +592,70 @@ Serialize(SpawnSerializer &s, const PreparedChildProcess &p)
 		s.Write(SpawnExecCommand::TTY);
 }
 
+static void
+Serialize(SpawnSerializer &s, const PreparedChildProcess &p)
+{
+	SerializeRequest(s, p);
+	SerializeProfile(s, p);
+}
+
 int
-SpawnServerClient::SpawnChildProcess(const char *name,
-				     PreparedChildProcess &&p,
-				     ExitListener *listener)
+SpawnServerClient::LookupProfile(const PreparedChildProcess &p)
 {
-	assert(!shutting_down);
+	/* borrow the buffer, see SpawnChildProcess() */
+	auto buffer = std::move(profile_buffer);
+	AtScopeExit(this, &buffer) { profile_buffer = std::move(buffer); };
+
+	SpawnSerializer s(buffer, SpawnRequestCommand::PROFILE);
+
+	/* placeholder for the profile id */
+	const uint16_t zero = 0;
+	s.WriteT(zero);
+
+	try {
+		SerializeProfile(s, p);
+	} catch (SpawnPayloadTooLargeError) {
+		return -1;
+	}
+
+	constexpr size_t header_size = 1 + sizeof(zero);
+	std::string key((const char *)buffer.data() + header_size,
+			buffer.size() - header_size);
 
+	auto i = profiles.find(key);
+	if (i != profiles.end())
+		return i->second;
+
+	if (profiles.size() >= SPAWN_MAX_PROFILES) {
+		/* start over; requests referring to the old ids must be
+		   sent before the ids get reused */
+		FlushBatch();
+		if (!socket.IsDefined())
+			return -1;
+
+		profiles.clear();
+	}
+
+	const uint16_t id = profiles.size();
+	memcpy(buffer.data() + 1, &id, sizeof(id));
+
+	try {
+		Send(s);
+	} catch (...) {
+		fprintf(stderr, "failed to send PROFILE to spawner: %s\n",
+			GetFullMessage(std::current_exception()).c_str());
+		return -1;
+	}
+
+	profiles.emplace(std::move(key), id);
+	return id;
+}
+
+void
+SpawnServerClient::DoSpawnChildProcess(int pid, const char *name,
+				       PreparedChildProcess &&p,
+				       ExitListener *listener)
+{
 	/* this check is performed again on the server (which is obviously
 	   necessary, and the only way to have it secure); this one is
 	   only here for the developer to see the error earlier in the
@@ -324,30 +663,95 @@ SpawnServerClient::SpawnChildProcess(const char *name,
 	if (verify && !p.uid_gid.IsEmpty())
 		config.Verify(p.uid_gid);
 
-	CheckOrAbort();
+	/* borrow the buffer, because FlushBatch() may invoke
+	   listeners which call this method recursively */
+	auto buffer = std::move(serialize_buffer);
+	AtScopeExit(this, &buffer) { serialize_buffer = std::move(buffer); };
 
-	const int pid = MakePid();
+	SpawnSerializer s(buffer, SpawnRequestCommand::EXEC);
 
-	SpawnSerializer s(SpawnRequestCommand::EXEC);
+	/* requests which are too large for a datagram are sent in a
+	   memfd, see SendMemfd() */
+	s.SetMaxSize(SPAWN_MAX_MEMFD_REQUEST_SIZE);
 
 	try {
 		s.WriteInt(pid);
 		s.WriteString(name);
 
-		Serialize(s, p);
+		const int profile = LookupProfile(p);
+		if (profile >= 0) {
+			s.Write(SpawnExecCommand::PROFILE);
+			s.WriteT(uint16_t(profile));
+			SerializeRequest(s, p);
+		} else
+			Serialize(s, p);
 	} catch (SpawnPayloadTooLargeError) {
 		throw std::runtime_error("Spawn payload is too large");
 	}
 
-	try {
-		Send(s.GetPayload(), s.GetFds());
-	} catch (const std::runtime_error &e) {
-		std::throw_with_nested(std::runtime_error("Spawn server failed"));
+	if (!batching || !AddToBatch(pid, s, p)) {
+		/* the previous requests must arrive first */
+		FlushBatch();
+
+		QueuedDatagram *d;
+
+		try {
+			d = NeedsSpawnPayloadMemfd(s.GetPayload().size)
+				? SendMemfd(s)
+				: Send(s);
+		} catch (const std::runtime_error &e) {
+			std::throw_with_nested(std::runtime_error("Spawn server failed"));
+		}
+
+		if (d != nullptr) {
+			StealFds(p, d->fds);
+			d->pids.push_back(pid);
+		}
 	}
 
 	processes.emplace(std::piecewise_construct,
 			  std::forward_as_tuple(pid),
 			  std::forward_as_tuple(listener));
+}
+
+int
+SpawnServerClient::SpawnChildProcess(const char *name,
+				     PreparedChildProcess &&p,
+				     ExitListener *listener)
+{
+	assert(!shutting_down);
+
+	CheckOrAbort();
+
+	const int pid = MakePid();
+	DoSpawnChildProcess(pid, name, std::move(p), listener);
+	return pid;
+}
+
+int
+SpawnServerClient::EnqueueChildProcess(const char *name,
+				       PreparedChildProcess &&p,
+				       ExitListener *listener) noexcept
+{
+	assert(!shutting_down);
+
+	CheckOrAbort();
+
+	const int pid = MakePid();
+
+	try {
+		DoSpawnChildProcess(pid, name, std::move(p), listener);
+	} catch (...) {
+		fprintf(stderr, "failed to spawn '%s': %s\n",
+			name, GetFullMessage(std::current_exception()).c_str());
+
+		processes.emplace(std::piecewise_construct,
+				  std::forward_as_tuple(pid),
+				  std::forward_as_tuple(listener));
+		failed_pids.push_back(pid);
+		failed_event.Schedule();
+	}
+
 	return pid;
 }
 
@@ -371,7 +775,12 @@ SpawnServerClient::KillChildProcess(int pid, int signo)
 	assert(i->second.listener != nullptr);
 	processes.erase(i);
 
-	SpawnSerializer s(SpawnRequestCommand::KILL);
+	/* the EXEC request must arrive before the KILL request */
+	FlushBatch();
+	if (!socket.IsDefined())
+		return;
+
+	SpawnSerializer s(serialize_buffer, SpawnRequestCommand::KILL);
 	s.WriteInt(pid);
 	s.WriteInt(signo);
 
@@ -386,15 +795,9 @@ SpawnServerClient::KillChildProcess(int pid, int signo)
 		Close();
 }
 
-inline void
-SpawnServerClient::HandleExitMessage(SpawnPayload payload)
+void
+SpawnServerClient::HandleExit(int pid, int status)
 {
-	int pid, status;
-	payload.ReadInt(pid);
-	payload.ReadInt(status);
-	if (!payload.IsEmpty())
-		throw MalformedSpawnPayloadError();
-
 	auto i = processes.find(pid);
 	if (i == processes.end())
 		return;
@@ -409,6 +812,98 @@ SpawnServerClient::HandleExitMessage(SpawnPayload payload)
 		Close();
 }
 
+inline void
+SpawnServerClient::HandleExitMessage(SpawnPayload payload)
+{
+	int pid, status;
+	payload.ReadInt(pid);
+	payload.ReadInt(status);
+	if (!payload.IsEmpty())
+		throw MalformedSpawnPayloadError();
+
+	HandleExit(pid, status);
+}
+
+inline void
+SpawnServerClient::HandleExitBatchMessage(SpawnPayload payload)
+{
+	while (!payload.IsEmpty()) {
+		int pid, status;
+		payload.ReadInt(pid);
+		payload.ReadInt(status);
+		HandleExit(pid, status);
+	}
+}
+
+void
+SpawnServerClient::QueryStats(SpawnStatsHandler &handler)
+{
+	CheckOrAbort();
+
+	SpawnSerializer s(serialize_buffer, SpawnRequestCommand::STATS);
+	Send(s);
+
+	stats_handlers.push_back(&handler);
+}
+
+inline void
+SpawnServerClient::HandleStatsMessage(SpawnPayload payload)
+{
+	stats_response = SpawnStats();
+
+	auto &stats = stats_response;
+	payload.ReadT(stats.requests);
+	payload.ReadT(stats.spawned);
+	payload.ReadT(stats.rejected);
+	payload.ReadT(stats.failed);
+	payload.ReadT(stats.exited);
+
+	for (auto &h : stats.latency)
+		for (auto &n : h.buckets)
+			payload.ReadT(n);
+
+	if (!payload.IsEmpty())
+		throw MalformedSpawnPayloadError();
+}
+
+static void
+Read(SpawnPayload &payload, SpawnResourceUsage &u)
+{
+	payload.ReadT(u.n_exits);
+	payload.ReadT(u.user_time);
+	payload.ReadT(u.system_time);
+	payload.ReadT(u.max_rss);
+	payload.ReadT(u.minor_faults);
+	payload.ReadT(u.major_faults);
+	payload.ReadT(u.voluntary_switches);
+	payload.ReadT(u.involuntary_switches);
+}
+
+inline void
+SpawnServerClient::HandleStatsUsageMessage(SpawnPayload payload)
+{
+	while (!payload.IsEmpty()) {
+		const char *key = payload.ReadString();
+		Read(payload, stats_response.usage[key]);
+	}
+}
+
+inline void
+SpawnServerClient::HandleStatsEndMessage(SpawnPayload payload)
+{
+	if (!payload.IsEmpty())
+		throw MalformedSpawnPayloadError();
+
+	if (stats_handlers.empty())
+		return;
+
+	auto &handler = *stats_handlers.front();
+	stats_handlers.pop_front();
+
+	handler.OnSpawnStats(std::move(stats_response));
+	stats_response = SpawnStats();
+}
+
 inline void
 SpawnServerClient::HandleMessage(ConstBuffer<uint8_t> payload)
 {
@@ -422,6 +917,22 @@ SpawnServerClient::HandleMessage(ConstBuffer<uint8_t> payload)
 	case SpawnResponseCommand::EXIT:
 		HandleExitMessage(SpawnPayload(payload));
 		break;
+
+	case SpawnResponseCommand::EXIT_BATCH:
+		HandleExitBatchMessage(SpawnPayload(payload));
+		break;
+
+	case SpawnResponseCommand::STATS:
+		HandleStatsMessage(SpawnPayload(payload));
+		break;
+
+	case SpawnResponseCommand::STATS_USAGE:
+		HandleStatsUsageMessage(SpawnPayload(payload));
+		break;
+
+	case SpawnResponseCommand::STATS_END:
+		HandleStatsEndMessage(SpawnPayload(payload));
+		break;
 	}
 }
 
@@ -429,7 +940,7 @@ inline void
 SpawnServerClient::OnSocketEvent(unsigned)
 {
 	constexpr size_t N = 64;
-	std::array<uint8_t[16], N> payloads;
+	std::array<uint8_t[SPAWN_MAX_RESPONSE_SIZE], N> payloads;
 	std::array<struct iovec, N> iovs;
 	std::array<struct mmsghdr, N> msgs;
 
@@ -35,16 +35,30 @@
 
 #include "Interface.hxx"
 #include "Config.hxx"
+#include "Stats.hxx"
 #include "event/SocketEvent.hxx"
+#include "event/DeferEvent.hxx"
 #include "net/UniqueSocketDescriptor.hxx"
+#include "io/UniqueFileDescriptor.hxx"
 
+#include <deque>
 #include <map>
+#include <string>
+#include <vector>
 
 template<typename T> struct ConstBuffer;
 struct PreparedChildProcess;
 class SpawnPayload;
 class SpawnSerializer;
 
+/**
+ * Receives the response to SpawnServerClient::QueryStats().
+ */
+class SpawnStatsHandler {
+public:
+	virtual void OnSpawnStats(SpawnStats &&stats) noexcept = 0;
+};
+
 class SpawnServerClient final : public SpawnService {
 	struct ChildProcess {
 		ExitListener *listener;
@@ -61,8 +75,114 @@ class SpawnServerClient final : public SpawnService {
 
 	std::map<int, ChildProcess> processes;
 
+	/**
+	 * A datagram which could not be sent yet because the socket
+	 * buffer was full.
+	 */
+	struct QueuedDatagram {
+		std::vector<uint8_t> payload;
+
+		std::vector<int> fd_numbers;
+
+		/**
+		 * Owns the file descriptors in #fd_numbers until they
+		 * have been sent.
+		 */
+		std::vector<UniqueFileDescriptor> fds;
+
+		/**
+		 * The pids of the EXEC requests in this datagram;
+		 * they are reported as failed if it cannot be sent.
+		 */
+		std::vector<int> pids;
+
+		QueuedDatagram(ConstBuffer<void> _payload,
+			       ConstBuffer<int> _fds);
+	};
+
+	/**
+	 * Datagrams waiting for the socket to become writable, in the
+	 * order they must be sent.  While this is not empty, all new
+	 * datagrams are appended here.
+	 */
+	std::deque<QueuedDatagram> send_queue;
+
 	SocketEvent read_event;
 
+	/**
+	 * Sends #send_queue; only enabled while it is not empty.
+	 */
+	SocketEvent write_event;
+
+	/**
+	 * Reports #failed_pids to their #ExitListener.
+	 */
+	DeferEvent failed_event;
+
+	/**
+	 * Child processes whose EnqueueChildProcess() call has failed;
+	 * the failure is reported from #failed_event, because the
+	 * caller does not know the pid before the call returns.
+	 */
+	std::vector<int> failed_pids;
+
+	/**
+	 * Sends #exec_batch.
+	 */
+	DeferEvent flush_event;
+
+	/**
+	 * Serialized EXEC requests which have not yet been sent (see
+	 * EnableBatching()).
+	 */
+	std::vector<uint8_t> exec_batch;
+
+	/**
+	 * The file descriptor numbers to be attached to #exec_batch,
+	 * in the order they are referenced.
+	 */
+	std::vector<int> exec_batch_fd_numbers;
+
+	/**
+	 * Owns the file descriptors in #exec_batch_fd_numbers until
+	 * they have been sent.
+	 */
+	std::vector<UniqueFileDescriptor> exec_batch_fds;
+
+	/**
+	 * The pids of the child processes in #exec_batch.
+	 */
+	std::vector<int> exec_batch_pids;
+
+	/**
+	 * A reusable buffer for SpawnSerializer, to avoid allocating
+	 * a new one for each request.
+	 */
+	std::vector<uint8_t> serialize_buffer;
+
+	/**
+	 * The profiles registered on this connection (see
+	 * #SpawnRequestCommand::PROFILE), indexed by their serialized
+	 * commands.
+	 */
+	std::map<std::string, uint16_t> profiles;
+
+	/**
+	 * A reusable buffer for serializing profiles.
+	 */
+	std::vector<uint8_t> profile_buffer;
+
+	/**
+	 * Handlers waiting for a #SpawnResponseCommand::STATS_END, in
+	 * the order the requests were sent.
+	 */
+	std::deque<SpawnStatsHandler *> stats_handlers;
+
+	/**
+	 * The #SpawnStats response currently being received.
+	 */
+	SpawnStats stats_response;
+
 	/**
 	 * Call UidGid::Verify() before sending the spawn request to the
 	 * server?
@@ -73,6 +193,11 @@ class SpawnServerClient final : public SpawnService {
 
 	bool shutting_down = false;
 
+	/**
+	 * Has EnableBatching() been called?
+	 */
+	bool batching = false;
+
 public:
 	explicit SpawnServerClient(EventLoop &event_loop,
 				   const SpawnConfig &_config,
@@ -98,6 +223,44 @@ public:
 
 	UniqueSocketDescriptor Connect();
 
+	/**
+	 * Negotiate batching on this connection: EXEC requests issued
+	 * in one event loop iteration are combined in one datagram,
+	 * and the server combines EXIT messages.
+	 */
+	void EnableBatching();
+
+	/**
+	 * Query statistics from the spawner.  The handler is invoked
+	 * as soon as the response has been received; it must remain
+	 * valid until then.  If the connection to the spawner is
+	 * lost, the handler is never invoked.
+	 *
+	 * Throws on error.
+	 */
+	void QueryStats(SpawnStatsHandler &handler);
+
+	/**
+	 * Like SpawnChildProcess(), but never blocks on the spawner and
+	 * never throws: if the socket buffer is full, the request is
+	 * queued (see GetQueueDepth()), and errors are reported to the
+	 * #ExitListener as exit status 0xff (after this method has
+	 * returned).
+	 *
+	 * @return a process id
+	 */
+	int EnqueueChildProcess(const char *name, PreparedChildProcess &&params,
+				ExitListener *listener) noexcept;
+
+	/**
+	 * Returns the number of datagrams waiting for the socket to
+	 * become writable.  The caller may use this to throttle new
+	 * requests.
+	 */
+	size_t GetQueueDepth() const noexcept {
+		return send_queue.size();
+	}
+
 private:
 	int MakePid() {
 		++last_pid;
@@ -117,12 +280,77 @@ private:
 	 */
 	void CheckOrAbort();
 
-	void Send(ConstBuffer<void> payload, ConstBuffer<int> fds);
-	void Send(const SpawnSerializer &s);
+	/**
+	 * Send a datagram, or append it to #send_queue if the socket
+	 * would block.  The caller must move ownership of the file
+	 * descriptors to the returned #QueuedDatagram.
+	 *
+	 * Throws on error.
+	 *
+	 * @return the #QueuedDatagram or nullptr if the datagram has
+	 * been sent
+	 */
+	QueuedDatagram *Send(ConstBuffer<void> payload, ConstBuffer<int> fds);
+	QueuedDatagram *Send(const SpawnSerializer &s);
+
+	/**
+	 * Like Send(), but transfer the payload in a sealed memfd
+	 * (#SpawnRequestCommand::MEMFD), because it is too large for
+	 * a datagram.
+	 */
+	QueuedDatagram *SendMemfd(const SpawnSerializer &s);
+
+	/**
+	 * Send as many datagrams from #send_queue as possible.  On
+	 * error, the child processes in the failed datagram are
+	 * reported to their #ExitListener.
+	 */
+	void FlushQueue() noexcept;
+
+	/**
+	 * Send an EXEC request and register the child process.
+	 *
+	 * Throws on error.
+	 */
+	void DoSpawnChildProcess(int pid, const char *name,
+				 PreparedChildProcess &&p,
+				 ExitListener *listener);
+
+	/**
+	 * Look up the profile matching the given
+	 * #PreparedChildProcess, and register a new one if there is
+	 * none.
+	 *
+	 * @return the profile id or -1 if no profile can be used
+	 */
+	int LookupProfile(const PreparedChildProcess &p);
+
+	/**
+	 * Add an EXEC request to #exec_batch and move the file
+	 * descriptors out of the #PreparedChildProcess.
+	 *
+	 * @return false if the request does not fit into a batch; it
+	 * needs to be sent directly then
+	 */
+	bool AddToBatch(int pid, const SpawnSerializer &s,
+			PreparedChildProcess &p);
+
+	/**
+	 * Send #exec_batch now.  On error, all child processes in the
+	 * batch are reported as failed to their #ExitListener.
+	 */
+	void FlushBatch() noexcept;
 
+	void HandleExit(int pid, int status);
 	void HandleExitMessage(SpawnPayload payload);
+	void HandleExitBatchMessage(SpawnPayload payload);
+	void HandleStatsMessage(SpawnPayload payload);
+	void HandleStatsUsageMessage(SpawnPayload payload);
+	void HandleStatsEndMessage(SpawnPayload payload);
 	void HandleMessage(ConstBuffer<uint8_t> payload);
 	void OnSocketEvent(unsigned events);
+	void OnWritable(unsigned events) noexcept;
+	void OnFailed() noexcept;
 
 public:
 	/* virtual methods from class SpawnService */
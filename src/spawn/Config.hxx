@@ -64,6 +64,42 @@ struct SpawnConfig {
      */
     bool allow_any_uid_gid = false;
 
+    /**
+     * The maximum number of zygote processes (pre-initialized
+     * templates for identical child process profiles).  0 disables
+     * zygotes.
+     */
+    unsigned max_zygotes = 0;
+
+    /**
+     * The maximum number of prepared mount namespaces kept by the
+     * spawner for identical mount configurations.  0 disables the
+     * cache.
+     */
+    unsigned max_mount_namespaces = 0;
+
+    /**
+     * The maximum number of detached mount trees kept by the
+     * spawner for bind mount sources; child processes attach them
+     * instead of bind-mounting each source path.  0 disables the
+     * cache.
+     */
+    unsigned max_mount_trees = 0;
+
+    /**
+     * The maximum number of O_PATH file descriptors of executables
+     * kept by the spawner; child processes execveat() them instead
+     * of resolving the path again.  0 disables the cache.
+     */
+    unsigned max_executables = 0;
+
+    /**
+     * The number of worker processes which set up new child
+     * processes in parallel to the spawner's event loop.  0 means
+     * all child processes are set up by the spawner itself.
+     */
+    unsigned spawn_workers = 0;
+
     void VerifyUid(uid_t uid) const {
         if (allowed_uids.find(uid) == allowed_uids.end())
             throw FormatRuntimeError("uid %d is not allowed", int(uid));
@@ -32,6 +32,7 @@
 
 #include "ConfigParser.hxx"
 #include "Config.hxx"
+#include "UserDatabase.hxx"
 #include "io/FileLineParser.hxx"
 #include "util/RuntimeError.hxx"
 
@@ -39,13 +40,16 @@
 #include <grp.h>
 
 static uid_t
-ParseUser(const char *name)
+ParseUser(const char *name, UserDatabase *users)
 {
     char *endptr;
     unsigned long i = strtoul(name, &endptr, 10);
     if (endptr > name && *endptr == 0)
         return i;
 
+    if (users != nullptr)
+        return users->Lookup(name).uid;
+
     const auto *pw = getpwnam(name);
     if (pw == nullptr)
         throw FormatRuntimeError("No such user: %s", name);
@@ -54,13 +58,16 @@ ParseUser(const char *name)
 }
 
 static gid_t
-ParseGroup(const char *name)
+ParseGroup(const char *name, UserDatabase *users)
 {
     char *endptr;
     unsigned long i = strtoul(name, &endptr, 10);
     if (endptr > name && *endptr == 0)
         return i;
 
+    if (users != nullptr)
+        return users->LookupGroup(name);
+
     const auto *gr = getgrnam(name);
     if (gr == nullptr)
         throw FormatRuntimeError("No such group: %s", name);
@@ -74,9 +81,24 @@ SpawnConfigParser::ParseLine(FileLineParser &line)
     const char *word = line.ExpectWord();
 
     if (strcmp(word, "allow_user") == 0) {
-        config.allowed_uids.insert(ParseUser(line.ExpectValueAndEnd()));
+        config.allowed_uids.insert(ParseUser(line.ExpectValueAndEnd(), users));
     } else if (strcmp(word, "allow_group") == 0) {
-        config.allowed_gids.insert(ParseGroup(line.ExpectValueAndEnd()));
+        config.allowed_gids.insert(ParseGroup(line.ExpectValueAndEnd(), users));
+    } else if (strcmp(word, "zygotes") == 0) {
+        config.max_zygotes = line.NextPositiveInteger();
+        line.ExpectEnd();
+    } else if (strcmp(word, "mount_namespaces") == 0) {
+        config.max_mount_namespaces = line.NextPositiveInteger();
+        line.ExpectEnd();
+    } else if (strcmp(word, "mount_trees") == 0) {
+        config.max_mount_trees = line.NextPositiveInteger();
+        line.ExpectEnd();
+    } else if (strcmp(word, "executables") == 0) {
+        config.max_executables = line.NextPositiveInteger();
+        line.ExpectEnd();
+    } else if (strcmp(word, "workers") == 0) {
+        config.spawn_workers = line.NextPositiveInteger();
+        line.ExpectEnd();
     } else
         throw LineParser::Error("Unknown option");
 }
@@ -36,12 +36,21 @@
 #include "io/ConfigParser.hxx"
 
 struct SpawnConfig;
+class UserDatabase;
 
 class SpawnConfigParser final : public ConfigParser {
     SpawnConfig &config;
 
+    /**
+     * If set, then user and group names are resolved with this
+     * object instead of NSS.
+     */
+    UserDatabase *const users;
+
 public:
-    explicit SpawnConfigParser(SpawnConfig &_config):config(_config) {}
+    explicit SpawnConfigParser(SpawnConfig &_config,
+                               UserDatabase *_users=nullptr)
+        :config(_config), users(_users) {}
 
 protected:
     /* virtual methods from class ConfigParser */
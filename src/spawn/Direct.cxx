@@ -35,21 +35,30 @@
 #include "SeccompFilter.hxx"
 #include "SyscallFilter.hxx"
 #include "Init.hxx"
+#include "Zygote.hxx"
+#include "PidNamespace.hxx"
 #include "daemon/Client.hxx"
 #include "net/UniqueSocketDescriptor.hxx"
+#include "net/ReceiveMessage.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 #include "io/WriteFile.hxx"
 #include "system/IOPrio.hxx"
 #include "util/PrintException.hxx"
 #include "util/ScopeExit.hxx"
+#include "util/Macros.hxx"
 
 #include "util/Compiler.h"
 
 #include <systemd/sd-journal.h>
 
+#include <algorithm>
 #include <exception>
+#include <initializer_list>
+#include <memory>
+#include <vector>
 
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -57,13 +66,21 @@
 #include <sys/prctl.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <dirent.h>
+#include <stdlib.h>
 
 #ifndef PR_SET_NO_NEW_PRIVS
 #define PR_SET_NO_NEW_PRIVS 38
 #endif
 
+#ifndef __NR_execveat
+#define __NR_execveat 322
+#endif
+
 static void
 CheckedDup2(FileDescriptor oldfd, FileDescriptor newfd)
 {
@@ -114,13 +131,22 @@ UnblockSignals()
 	sigprocmask(SIG_UNBLOCK, &mask, nullptr);
 }
 
-gcc_noreturn
+/**
+ * The first part of Exec(): set up the process environment
+ * (namespaces, mounts, cgroup, resource limits).  A zygote process
+ * does this only once and then forks its children from here.
+ *
+ * @param stdout_fd_r returns the file descriptor to be used for
+ * STDOUT (may be the systemd journal)
+ * @param stderr_fd_r returns the file descriptor to be used for
+ * STDERR (may be the systemd journal)
+ */
 static void
-Exec(const char *path, PreparedChildProcess &&p,
-     UniqueFileDescriptor &&userns_create_pipe_w,
-     UniqueFileDescriptor &&userns_setup_pipe_r,
-     const CgroupState &cgroup_state)
-try {
+PrepareExec(PreparedChildProcess &p, int &stdout_fd_r, int &stderr_fd_r,
+	    UniqueFileDescriptor &&userns_create_pipe_w,
+	    UniqueFileDescriptor &&userns_setup_pipe_r,
+	    const CgroupState &cgroup_state)
+{
 	UnignoreSignals();
 	UnblockSignals();
 
@@ -129,7 +155,9 @@ try {
 
 	TryWriteExistingFile("/proc/self/oom_score_adj", "800");
 
-	int stdout_fd = p.stdout_fd, stderr_fd = p.stderr_fd;
+	int &stdout_fd = stdout_fd_r, &stderr_fd = stderr_fd_r;
+	stdout_fd = p.stdout_fd;
+	stderr_fd = p.stderr_fd;
 	if (stdout_fd < 0 || (stderr_fd < 0 && p.stderr_path == nullptr)) {
 		/* if no log destination was specified, log to the systemd
 		   journal */
@@ -143,7 +171,7 @@ try {
 			stderr_fd = journal_fd;
 	}
 
-	p.cgroup.Apply(cgroup_state);
+	p.cgroup.Apply(cgroup_state, p.cgroup_fd >= 0);
 
 	if (p.ns.enable_cgroup && p.cgroup.IsDefined()) {
 		/* if the process was just moved to another cgroup, we need to
@@ -160,7 +188,8 @@ try {
 
 	p.refence.Apply();
 
-	p.ns.Setup(p.uid_gid);
+	p.ns.Setup(p.uid_gid, FileDescriptor(p.mount_namespace_fd),
+		   FileDescriptor(p.network_namespace_fd));
 	p.rlimits.Apply(0);
 
 	if (p.chroot != nullptr && chroot(p.chroot) < 0) {
@@ -198,7 +227,39 @@ try {
 		    userns_setup_pipe_r.Read(&buffer, sizeof(buffer)) != 0)
 			_exit(EXIT_FAILURE);
 	}
+}
+
+/**
+ * Execute the program, preferably by PreparedChildProcess::exec_fd.
+ * Returns only on error (with errno set).
+ */
+static void
+ExecveOrFd(const char *path, const PreparedChildProcess &p) noexcept
+{
+	char *const*argv = const_cast<char *const*>(&p.args.front());
+	char *const*envp = const_cast<char *const*>(&p.env.front());
+
+	if (p.exec_fd >= 0)
+		syscall(__NR_execveat, p.exec_fd, "", argv, envp,
+			AT_EMPTY_PATH);
+
+	/* fall back to the path if execveat() has failed, e.g. if the
+	   kernel does not support it or if the program is a script
+	   (its interpreter cannot open the close-on-exec file
+	   descriptor); this also yields the proper error */
+	execve(path, argv, envp);
+}
 
+/**
+ * The second part of Exec(): apply the per-process settings and
+ * execute the program.
+ */
+gcc_noreturn
+static void
+ExecPrepared(const char *path, PreparedChildProcess &&p,
+	     int stdout_fd, int stderr_fd,
+	     const Seccomp::Program *syscall_filter)
+{
 	if (p.chdir != nullptr && chdir(p.chdir) < 0) {
 		fprintf(stderr, "chdir('%s') failed: %s\n",
 			p.chdir, strerror(errno));
@@ -208,6 +269,9 @@ try {
 	if (p.sched_idle) {
 		static struct sched_param sched_param;
 		sched_setscheduler(0, SCHED_IDLE, &sched_param);
+	} else if (p.sched_batch) {
+		static struct sched_param sched_param;
+		sched_setscheduler(0, SCHED_BATCH, &sched_param);
 	}
 
 	if (p.priority != 0 &&
@@ -216,6 +280,10 @@ try {
 		_exit(EXIT_FAILURE);
 	}
 
+	/* before switching the uid, because raising the utilization
+	   clamp requires CAP_SYS_NICE */
+	p.placement.Apply();
+
 	if (p.ioprio_idle)
 		ioprio_set_idle();
 
@@ -267,40 +335,162 @@ try {
 		}
 	}
 
-	try {
-		Seccomp::Filter sf(SCMP_ACT_ALLOW);
-		sf.AddSecondaryArchs();
+	if (syscall_filter != nullptr) {
+		try {
+			syscall_filter->Install();
+		} catch (const std::runtime_error &e) {
+			if (p.HasSyscallFilter())
+				/* filter options have been explicitly
+				   enabled, and thus failure to set up the
+				   filter are fatal */
+				throw;
+
+			fprintf(stderr, "Failed to setup seccomp filter for '%s': %s\n",
+				path, e.what());
+		}
+	}
+
+	if (p.exec_function != nullptr) {
+		_exit(p.exec_function(std::move(p)));
+	} else {
+		ExecveOrFd(path, p);
+
+		fprintf(stderr, "failed to execute %s: %s\n", path, strerror(errno));
+		_exit(EXIT_FAILURE);
+	}
+}
 
-		BuildSyscallFilter(sf);
+gcc_noreturn
+static void
+Exec(const char *path, PreparedChildProcess &&p,
+     UniqueFileDescriptor &&userns_create_pipe_w,
+     UniqueFileDescriptor &&userns_setup_pipe_r,
+     const CgroupState &cgroup_state,
+     const Seccomp::Program *syscall_filter)
+try {
+	int stdout_fd, stderr_fd;
+	PrepareExec(p, stdout_fd, stderr_fd,
+		    std::move(userns_create_pipe_w),
+		    std::move(userns_setup_pipe_r),
+		    cgroup_state);
+	ExecPrepared(path, std::move(p), stdout_fd, stderr_fd,
+		     syscall_filter);
+} catch (const std::exception &e) {
+	PrintException(e);
+	_exit(EXIT_FAILURE);
+}
 
-		if (p.forbid_user_ns)
-			ForbidUserNamespace(sf);
+void
+CloseInheritedFds(std::initializer_list<int> keep) noexcept
+{
+	DIR *dir = opendir("/proc/self/fd");
+	if (dir == nullptr)
+		return;
 
-		if (p.forbid_multicast)
-			ForbidMulticast(sf);
+	const int dir_fd = dirfd(dir);
 
-		if (p.forbid_bind)
-			ForbidBind(sf);
+	std::vector<int> fds;
 
-		sf.Load();
-	} catch (const std::runtime_error &e) {
-		if (p.HasSyscallFilter())
-			/* filter options have been explicitly enabled, and thus
-			   failure to set up the filter are fatal */
-			throw;
+	const struct dirent *e;
+	while ((e = readdir(dir)) != nullptr) {
+		char *endptr;
+		const long fd = strtol(e->d_name, &endptr, 10);
+		if (endptr == e->d_name || *endptr != 0)
+			continue;
 
-		fprintf(stderr, "Failed to setup seccomp filter for '%s': %s\n",
-			path, e.what());
+		if (fd > STDERR_FILENO && fd != dir_fd &&
+		    std::find(keep.begin(), keep.end(), fd) == keep.end())
+			fds.push_back(fd);
 	}
 
-	if (p.exec_function != nullptr) {
-		_exit(p.exec_function(std::move(p)));
-	} else {
-		execve(path, const_cast<char *const*>(&p.args.front()),
-		       const_cast<char *const*>(&p.env.front()));
+	closedir(dir);
 
-		fprintf(stderr, "failed to execute %s: %s\n", path, strerror(errno));
-		_exit(EXIT_FAILURE);
+	for (int fd : fds)
+		close(fd);
+}
+
+/**
+ * Close the file descriptors of the given #PreparedChildProcess
+ * (which may be shared) and clear them.
+ */
+static void
+CloseFds(PreparedChildProcess &p) noexcept
+{
+	int *const fds[] = {
+		&p.stdin_fd, &p.stdout_fd, &p.stderr_fd, &p.control_fd,
+	};
+
+	for (int *i : fds) {
+		const int fd = *i;
+		if (fd < 0)
+			continue;
+
+		close(fd);
+
+		for (int *j : fds)
+			if (*j == fd)
+				*j = -1;
+	}
+}
+
+/**
+ * The main loop of a zygote process: wait for requests from the
+ * spawn server and fork a new child process for each one.  The
+ * children are created with CLONE_PARENT, i.e. they are children of
+ * the spawn server, which reaps them.
+ */
+gcc_noreturn
+static void
+RunZygote(UniqueSocketDescriptor &&socket, PreparedChildProcess &&p,
+	  UniqueFileDescriptor &&userns_create_pipe_w,
+	  UniqueFileDescriptor &&userns_setup_pipe_r,
+	  const CgroupState &cgroup_state,
+	  const Seccomp::Program *syscall_filter)
+try {
+	/* the file descriptors belong to the request which caused
+	   this zygote to be created; it will be sent again with
+	   SpawnZygoteRequest */
+	CloseFds(p);
+
+	/* note: all children share the journal stream opened here */
+	int stdout_fd, stderr_fd;
+	PrepareExec(p, stdout_fd, stderr_fd,
+		    std::move(userns_create_pipe_w),
+		    std::move(userns_setup_pipe_r),
+		    cgroup_state);
+
+	std::unique_ptr<SpawnZygoteRequest::Buffer> buffer(new SpawnZygoteRequest::Buffer());
+
+	while (true) {
+		auto result = ReceiveMessage(socket, *buffer, 0);
+		if (result.payload.IsNull())
+			/* the spawn server has closed the socket */
+			_exit(EXIT_SUCCESS);
+
+		SpawnZygoteRequest::Parse(result, p);
+
+		long pid = syscall(__NR_clone, CLONE_PARENT|SIGCHLD,
+				   nullptr, nullptr, nullptr, nullptr);
+		if (pid == 0) {
+			try {
+				socket.Close();
+
+				const char *path = p.Finish();
+				ExecPrepared(path, std::move(p),
+					     p.stdout_fd >= 0 ? p.stdout_fd : stdout_fd,
+					     p.stderr_fd >= 0 ? p.stderr_fd : stderr_fd,
+					     syscall_filter);
+			} catch (const std::exception &e) {
+				PrintException(e);
+				_exit(EXIT_FAILURE);
+			}
+		}
+
+		const int reply = pid < 0 ? -errno : int(pid);
+		CloseFds(p);
+
+		if (socket.Write(&reply, sizeof(reply)) != sizeof(reply))
+			_exit(EXIT_FAILURE);
 	}
 } catch (const std::exception &e) {
 	PrintException(e);
@@ -325,11 +515,33 @@ struct SpawnChildProcessContext {
 	 */
 	UniqueFileDescriptor wait_pipe_r, wait_pipe_w;
 
+	/**
+	 * If defined, then this is a zygote process which receives
+	 * requests on this socket.
+	 */
+	UniqueSocketDescriptor zygote_socket;
+
+	/**
+	 * The compiled system call filter; it is obtained from the
+	 * cache by the parent process, so the child only needs to
+	 * install it.  nullptr if the filter could not be built (and
+	 * failure is not fatal).
+	 */
+	const Seccomp::Program *syscall_filter = nullptr;
+
 	SpawnChildProcessContext(PreparedChildProcess &&_params,
 				 const CgroupState &_cgroup_state)
 		:params(std::move(_params)),
 		 cgroup_state(_cgroup_state),
 		 path(_params.Finish()) {}
+
+	SpawnChildProcessContext(PreparedChildProcess &_params,
+				 const CgroupState &_cgroup_state,
+				 UniqueSocketDescriptor &&_zygote_socket)
+		:params(std::move(_params)),
+		 cgroup_state(_cgroup_state),
+		 path(nullptr),
+		 zygote_socket(std::move(_zygote_socket)) {}
 };
 
 static int
@@ -343,19 +555,253 @@ spawn_fn(void *_ctx)
 	Exec(ctx.path, std::move(ctx.params),
 	     std::move(ctx.userns_create_pipe_w),
 	     std::move(ctx.wait_pipe_r),
-	     ctx.cgroup_state);
+	     ctx.cgroup_state, ctx.syscall_filter);
 }
 
-pid_t
-SpawnChildProcess(PreparedChildProcess &&params,
-		  const CgroupState &cgroup_state)
+static int
+zygote_fn(void *_ctx)
+{
+	auto &ctx = *(SpawnChildProcessContext *)_ctx;
+
+	ctx.userns_create_pipe_r.Close();
+	ctx.wait_pipe_w.Close();
+
+	CloseInheritedFds({
+			ctx.zygote_socket.Get(),
+			ctx.userns_create_pipe_w.Get(),
+			ctx.wait_pipe_r.Get(),
+		});
+
+	RunZygote(std::move(ctx.zygote_socket), std::move(ctx.params),
+		  std::move(ctx.userns_create_pipe_w),
+		  std::move(ctx.wait_pipe_r),
+		  ctx.cgroup_state, ctx.syscall_filter);
+}
+
+/**
+ * Print an error message (with strerror(errno)) to stderr and exit.
+ * This does not use stdio, because a CLONE_VM child must not touch
+ * the parent's stdio buffers and locks.
+ */
+gcc_noreturn
+static void
+VforkFail(const char *msg, const char *arg) noexcept
+{
+	const char *const error = strerror(errno);
+	const char *const colon = ": ", *const lf = "\n";
+	struct iovec v[] = {
+		{const_cast<char *>(msg), strlen(msg)},
+		{const_cast<char *>(colon), 2},
+		{const_cast<char *>(arg), strlen(arg)},
+		{const_cast<char *>(colon), 2},
+		{const_cast<char *>(error), strlen(error)},
+		{const_cast<char *>(lf), 1},
+	};
+
+	(void)writev(STDERR_FILENO, v, ARRAY_SIZE(v));
+	_exit(EXIT_FAILURE);
+}
+
+/**
+ * The child function for VforkChildProcess().  This is a reduced
+ * version of Exec() which uses only plain system calls; see
+ * PreparedChildProcess::IsVforkCompatible().
+ */
+static int
+vfork_fn(void *_ctx)
+{
+	auto &ctx = *(SpawnChildProcessContext *)_ctx;
+	const auto &p = ctx.params;
+
+	UnignoreSignals();
+	UnblockSignals();
+
+	if (p.umask >= 0)
+		umask(p.umask);
+
+	TryWriteExistingFile("/proc/self/oom_score_adj", "800");
+
+	if (p.chdir != nullptr && chdir(p.chdir) < 0)
+		VforkFail("chdir() failed", p.chdir);
+
+	if (p.sched_idle) {
+		static struct sched_param sched_param;
+		sched_setscheduler(0, SCHED_IDLE, &sched_param);
+	} else if (p.sched_batch) {
+		static struct sched_param sched_param;
+		sched_setscheduler(0, SCHED_BATCH, &sched_param);
+	}
+
+	if (p.priority != 0 &&
+	    setpriority(PRIO_PROCESS, getpid(), p.priority) < 0)
+		VforkFail("setpriority() failed", ctx.path);
+
+	if (p.ioprio_idle)
+		ioprio_set_idle();
+
+	if (p.no_new_privs)
+		prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+
+	int stderr_fd = p.stderr_fd;
+	if (stderr_fd < 0) {
+		stderr_fd = open(p.stderr_path,
+				 O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC|O_NOCTTY,
+				 0600);
+		if (stderr_fd < 0)
+			VforkFail("Failed to open STDERR_PATH", p.stderr_path);
+	}
+
+	constexpr int CONTROL_FILENO = 3;
+	CheckedDup2(p.stdin_fd, STDIN_FILENO);
+	CheckedDup2(p.stdout_fd, STDOUT_FILENO);
+	CheckedDup2(stderr_fd, STDERR_FILENO);
+	CheckedDup2(p.control_fd, CONTROL_FILENO);
+
+	if (p.tty)
+		DisconnectTty();
+
+	if (p.session)
+		setsid();
+
+	if (p.tty && ioctl(p.stdin_fd, TIOCSCTTY, nullptr) < 0)
+		VforkFail("Failed to set the controlling terminal", ctx.path);
+
+	if (ctx.syscall_filter != nullptr &&
+	    !ctx.syscall_filter->TryInstall() &&
+	    p.HasSyscallFilter())
+		/* filter options have been explicitly enabled, and
+		   thus failure to set up the filter are fatal */
+		VforkFail("Failed to setup seccomp filter", ctx.path);
+
+	ExecveOrFd(ctx.path, p);
+
+	VforkFail("failed to execute", ctx.path);
+}
+
+/**
+ * Obtain the system call filter for the given process from the
+ * cache.
+ *
+ * Throws on error if the filter is mandatory.
+ */
+static const Seccomp::Program *
+LookupSyscallFilter(const PreparedChildProcess &p)
+{
+	try {
+		return &GetSyscallFilter(p.forbid_user_ns, p.forbid_multicast,
+					 p.forbid_bind);
+	} catch (const std::runtime_error &e) {
+		if (p.HasSyscallFilter())
+			/* filter options have been explicitly enabled, and thus
+			   failure to set up the filter are fatal */
+			throw;
+
+		fprintf(stderr, "Failed to setup seccomp filter: %s\n",
+			e.what());
+		return nullptr;
+	}
+}
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+#ifndef __NR_clone3
+#define __NR_clone3 435
+#endif
+
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+/**
+ * The third version of struct clone_args (Linux 5.7); declared here
+ * because older kernel headers lack it.
+ */
+struct Clone3Args {
+	uint64_t flags;
+	uint64_t pidfd;
+	uint64_t child_tid;
+	uint64_t parent_tid;
+	uint64_t exit_signal;
+	uint64_t stack;
+	uint64_t stack_size;
+	uint64_t tls;
+
+	/* version 2 (Linux 5.5) */
+	uint64_t set_tid;
+	uint64_t set_tid_size;
+
+	/* version 3 (Linux 5.7) */
+	uint64_t cgroup;
+};
+
+/**
+ * The size of the first version of struct clone_args (Linux 5.3).
+ */
+static constexpr size_t CLONE_ARGS_SIZE_VER0 = 64;
+
+/**
+ * Create a new child process with clone3(CLONE_PIDFD) and without an
+ * exit signal.  Without a new stack, clone3() behaves like fork(),
+ * so the child runs the given function on a copy of this stack.
+ *
+ * @param cgroup_fd if defined, then the child is created inside
+ * this cgroup2 directory (CLONE_INTO_CGROUP)
+ * @return the process id or -1 on error (with errno set; ENOSYS if
+ * the kernel does not support clone3())
+ */
+static long
+Clone3(int flags, int (*fn)(void *), void *arg, UniqueFileDescriptor &pidfd_r,
+       FileDescriptor cgroup_fd=FileDescriptor::Undefined())
 {
+	int pidfd = -1;
+
+	Clone3Args args;
+	memset(&args, 0, sizeof(args));
+	args.flags = (flags & ~CSIGNAL) | CLONE_PIDFD;
+	args.pidfd = (uintptr_t)&pidfd;
+
+	/* pass the smallest structure possible, to keep this
+	   compatible with old kernels if no new feature is used */
+	size_t size = CLONE_ARGS_SIZE_VER0;
+	if (cgroup_fd.IsDefined()) {
+		args.flags |= CLONE_INTO_CGROUP;
+		args.cgroup = cgroup_fd.Get();
+		size = sizeof(args);
+	}
+
+	long pid = syscall(__NR_clone3, &args, size);
+	if (pid == 0)
+		_exit(fn(arg));
+
+	if (pid > 0)
+		pidfd_r = UniqueFileDescriptor(FileDescriptor(pidfd));
+
+	return pid;
+}
+
+static pid_t
+CloneChildProcess(SpawnChildProcessContext &ctx, int (*fn)(void *),
+		  UniqueFileDescriptor *pidfd_r=nullptr,
+		  bool clone_parent=false,
+		  SpawnChildTimings *timings_r=nullptr)
+{
+	using Clock = std::chrono::steady_clock;
+	ctx.syscall_filter = LookupSyscallFilter(ctx.params);
+
 	int clone_flags = SIGCHLD;
-	clone_flags = params.ns.GetCloneFlags(clone_flags);
+	clone_flags = ctx.params.ns.GetCloneFlags(clone_flags);
 
-	SpawnChildProcessContext ctx(std::move(params), cgroup_state);
+	if (ctx.params.mount_namespace_fd >= 0)
+		/* the child will reassociate with an existing mount
+		   namespace, no need to copy ours */
+		clone_flags &= ~CLONE_NEWNS;
 
-	UniqueFileDescriptor old_pidns;
+	if (clone_parent)
+		clone_flags |= CLONE_PARENT;
+
+	FileDescriptor old_pidns = FileDescriptor::Undefined();
 
 	AtScopeExit(&old_pidns) {
 		/* restore the old namespaces */
@@ -364,13 +810,14 @@ SpawnChildProcess(PreparedChildProcess &&params,
 	};
 
 	if (ctx.params.ns.pid_namespace != nullptr) {
-		/* first open a handle to our existing (old) namespaces
-		   to be able to restore them later (see above) */
-		if (!old_pidns.OpenReadOnly("/proc/self/ns/pid"))
-			throw MakeErrno("Failed to open current PID namespace");
-
-		auto fd = SpawnDaemon::MakePidNamespace(SpawnDaemon::Connect(),
-							ctx.params.ns.pid_namespace);
+		/* first obtain a handle to our existing (old)
+		   namespaces to be able to restore them later (see
+		   above); it is kept open for the lifetime of this
+		   process */
+		old_pidns = GetCurrentPidNamespace();
+
+		const auto fd = SpawnDaemon::GetClient()
+			.GetPidNamespace(ctx.params.ns.pid_namespace);
 		if (setns(fd.Get(), CLONE_NEWPID) < 0)
 			throw MakeErrno("setns(CLONE_NEWPID) failed");
 	}
@@ -401,11 +848,43 @@ SpawnChildProcess(PreparedChildProcess &&params,
 		ctx.params.ns.enable_user = false;
 	}
 
-	char stack[8192];
-	long pid = clone(spawn_fn, stack + sizeof(stack), clone_flags, &ctx);
+	auto t = Clock::now();
+
+	long pid = -1;
+	errno = ENOSYS;
+
+	if (pidfd_r != nullptr) {
+		pid = Clone3(clone_flags, fn, &ctx, *pidfd_r,
+			     FileDescriptor(ctx.params.cgroup_fd));
+
+		if (pid < 0 && errno != ENOSYS && ctx.params.cgroup_fd >= 0) {
+			/* CLONE_INTO_CGROUP may be unsupported (before
+			   Linux 5.7) or refused for this group; let
+			   the child join its cgroup the traditional
+			   way (the child sees this modified copy of
+			   the context) */
+			ctx.params.cgroup_fd = -1;
+			pid = Clone3(clone_flags, fn, &ctx, *pidfd_r);
+		}
+	}
+
+	if (pid < 0 && errno == ENOSYS) {
+		/* clone() cannot do CLONE_INTO_CGROUP */
+		ctx.params.cgroup_fd = -1;
+
+		char stack[8192];
+		pid = clone(fn, stack + sizeof(stack), clone_flags, &ctx);
+	}
+
 	if (pid < 0)
 		throw MakeErrno("clone() failed");
 
+	if (timings_r != nullptr) {
+		const auto now = Clock::now();
+		timings_r->clone = now - t;
+		t = now;
+	}
+
 	if (ctx.userns_create_pipe_r.IsDefined()) {
 		/* wait for the child to create the user namespace */
 
@@ -417,6 +896,12 @@ SpawnChildProcess(PreparedChildProcess &&params,
 		if (ctx.userns_create_pipe_r.Read(&buffer, sizeof(buffer)) != 1 ||
 		    ctx.userns_create_pipe_r.Read(&buffer, sizeof(buffer)) != 0)
 			throw std::runtime_error("User namespace setup failed");
+
+		if (timings_r != nullptr) {
+			const auto now = Clock::now();
+			timings_r->user_ns = now - t;
+			t = now;
+		}
 	}
 
 	if (ctx.wait_pipe_w.IsDefined()) {
@@ -435,7 +920,91 @@ SpawnChildProcess(PreparedChildProcess &&params,
 		static constexpr char buffer = 0;
 		ctx.wait_pipe_w.Write(&buffer, sizeof(buffer));
 		ctx.wait_pipe_w.Close();
+
+		if (timings_r != nullptr)
+			timings_r->uid_map = Clock::now() - t;
 	}
 
 	return pid;
 }
+
+/**
+ * Spawn a child process with CLONE_VM|CLONE_VFORK, which saves the
+ * cost of copying the page tables; this process is suspended until
+ * the child has called execve() or has exited.  The caller must
+ * check PreparedChildProcess::IsVforkCompatible().
+ *
+ * No pidfd is obtained, because clone() ignores CLONE_PIDFD on old
+ * kernels; the process is reaped via SIGCHLD.
+ */
+static pid_t
+VforkChildProcess(SpawnChildProcessContext &ctx,
+		  SpawnChildTimings *timings_r)
+{
+	using Clock = std::chrono::steady_clock;
+	ctx.syscall_filter = LookupSyscallFilter(ctx.params);
+
+	/* block all signals while the child shares our address space,
+	   or else a signal handler could run in the child; vfork_fn()
+	   unblocks them */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	const auto t = Clock::now();
+
+	char stack[16384];
+	long pid = clone(vfork_fn, stack + sizeof(stack),
+			 CLONE_VM|CLONE_VFORK|SIGCHLD, &ctx);
+	const int e = errno;
+
+	pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+	if (pid < 0)
+		throw MakeErrno(e, "clone() failed");
+
+	if (timings_r != nullptr)
+		timings_r->clone = Clock::now() - t;
+
+	return pid;
+}
+
+pid_t
+SpawnChildProcess(PreparedChildProcess &&params,
+		  const CgroupState &cgroup_state,
+		  UniqueFileDescriptor *pidfd_r, bool clone_parent,
+		  SpawnChildTimings *timings_r)
+{
+	SpawnChildProcessContext ctx(std::move(params), cgroup_state);
+
+	/* with CLONE_PARENT, the new process would inherit the exit
+	   signal of the calling worker process (i.e. none), and thus
+	   could not be reaped without a pidfd */
+	if (!clone_parent && ctx.params.IsVforkCompatible())
+		return VforkChildProcess(ctx, timings_r);
+
+	return CloneChildProcess(ctx, spawn_fn, pidfd_r, clone_parent,
+				 timings_r);
+}
+
+pid_t
+CloneHelperProcess(int (*fn)(void *), void *arg,
+		   UniqueFileDescriptor &pidfd_r)
+{
+	long pid = Clone3(0, fn, arg, pidfd_r);
+	if (pid < 0)
+		throw MakeErrno("clone3() failed");
+
+	return pid;
+}
+
+pid_t
+SpawnZygoteProcess(PreparedChildProcess &params,
+		   const CgroupState &cgroup_state,
+		   UniqueSocketDescriptor &&socket)
+{
+	assert(IsZygoteCompatible(params));
+
+	SpawnChildProcessContext ctx(params, cgroup_state, std::move(socket));
+	return CloneChildProcess(ctx, zygote_fn);
+}
@@ -33,18 +33,84 @@
 #ifndef SPAWN_DIRECT_HXX
 #define SPAWN_DIRECT_HXX
 
+#include <chrono>
+#include <initializer_list>
+
 #include <sys/types.h>
 
 struct PreparedChildProcess;
 struct CgroupState;
+class UniqueFileDescriptor;
+class UniqueSocketDescriptor;
+
+/**
+ * Durations of the phases of SpawnChildProcess() which are performed
+ * by the calling process.  Phases which were skipped are zero.
+ */
+struct SpawnChildTimings {
+	std::chrono::steady_clock::duration clone{}, user_ns{}, uid_map{};
+};
 
 /**
  * Throws exception on error.
  *
+ * @param pidfd_r if not nullptr, then the process is created with
+ * clone3(CLONE_PIDFD) and without an exit signal, and the pidfd is
+ * returned here (to be passed to ChildProcessRegistry::Add()); if
+ * the kernel does not support this, the process is created the old
+ * way and the pidfd remains undefined
+ * @param clone_parent create the process with CLONE_PARENT, i.e. it
+ * becomes a child of the calling process's parent (and inherits its
+ * exit signal); this is used by spawn worker processes
+ * @param timings_r if not nullptr, then the durations of the setup
+ * phases are returned here
  * @return the process id
  */
 pid_t
 SpawnChildProcess(PreparedChildProcess &&params,
-                  const CgroupState &cgroup_state);
+                  const CgroupState &cgroup_state,
+                  UniqueFileDescriptor *pidfd_r=nullptr,
+                  bool clone_parent=false,
+                  SpawnChildTimings *timings_r=nullptr);
+
+/**
+ * Create a new helper process with clone3(CLONE_PIDFD) and without an
+ * exit signal.  It runs the given function (like fork(), on a copy
+ * of the calling process) and exits with its return value.
+ *
+ * Throws exception on error (e.g. if the kernel does not support
+ * clone3()).
+ *
+ * @return the process id
+ */
+pid_t
+CloneHelperProcess(int (*fn)(void *), void *arg,
+                   UniqueFileDescriptor &pidfd_r);
+
+/**
+ * Close all file descriptors of the current process except for
+ * stdin/stdout/stderr and the given ones.  This is useful for
+ * helper processes which never call execve(), where O_CLOEXEC does
+ * not help.
+ */
+void
+CloseInheritedFds(std::initializer_list<int> keep) noexcept;
+
+/**
+ * Spawn a "zygote" process which applies all settings of the given
+ * #PreparedChildProcess (except for arguments, environment and file
+ * descriptors) and then waits for #SpawnZygoteRequest messages on
+ * the given socket, forking a new child process for each one.
+ * Unlike SpawnChildProcess(), this function does not consume the
+ * #PreparedChildProcess.
+ *
+ * Throws exception on error.
+ *
+ * @return the process id of the zygote
+ */
+pid_t
+SpawnZygoteProcess(PreparedChildProcess &params,
+                   const CgroupState &cgroup_state,
+                   UniqueSocketDescriptor &&socket);
 
 #endif
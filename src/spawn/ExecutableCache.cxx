@@ -0,0 +1,130 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ExecutableCache.hxx"
+#include "Prepared.hxx"
+
+#include <tuple>
+
+#include <assert.h>
+#include <fcntl.h>
+
+static constexpr bool
+operator==(const struct timespec &a, const struct timespec &b) noexcept
+{
+	return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+bool
+ExecutableCache::Item::IsSame(const struct stat &st) const noexcept
+{
+	return st.st_dev == dev && st.st_ino == ino &&
+		st.st_mtim == mtime && st.st_ctim == ctime;
+}
+
+/**
+ * May this file be executed by its file descriptor?  Set-user-ID and
+ * set-group-ID programs are excluded, because execveat() on our file
+ * descriptor would ignore the MS_NOSUID flag of the child's mounts.
+ */
+gcc_pure
+static bool
+IsPlainExecutable(const struct stat &st) noexcept
+{
+	return S_ISREG(st.st_mode) && (st.st_mode & 0111) != 0 &&
+		(st.st_mode & (S_ISUID|S_ISGID)) == 0;
+}
+
+FileDescriptor
+ExecutableCache::Get(const std::string &path, size_t base_length) noexcept
+{
+	struct stat st;
+
+	auto i = items.find(path);
+	if (i != items.end()) {
+		if (i->second.base_length == base_length &&
+		    stat(path.c_str(), &st) == 0 && i->second.IsSame(st))
+			return i->second.fd.ToFileDescriptor();
+
+		/* the file has been modified or replaced (or was
+		   verified for a different mount) */
+		items.erase(i);
+	}
+
+	if (items.size() >= max_executables)
+		return FileDescriptor::Undefined();
+
+	UniqueFileDescriptor fd;
+	if (!fd.Open(path.c_str(), O_PATH) ||
+	    fstat(fd.Get(), &st) < 0 || !IsPlainExecutable(st))
+		return FileDescriptor::Undefined();
+
+	if (base_length > 0) {
+		/* the child's bind mount is not recursive; if the file
+		   is on another filesystem than the mount source, the
+		   child would not see it at this path */
+		const std::string base(path, 0, base_length);
+		struct stat base_st;
+		if (stat(base.c_str(), &base_st) < 0 ||
+		    base_st.st_dev != st.st_dev)
+			return FileDescriptor::Undefined();
+	}
+
+	return items.emplace(std::piecewise_construct,
+			     std::forward_as_tuple(path),
+			     std::forward_as_tuple(std::move(fd),
+						   base_length, st))
+		.first->second.fd.ToFileDescriptor();
+}
+
+void
+ExecutableCache::Prepare(PreparedChildProcess &p) noexcept
+{
+	assert(IsEnabled());
+	assert(!p.args.empty());
+
+	if (p.exec_function != nullptr || p.chroot != nullptr)
+		return;
+
+	const char *path = p.exec_path != nullptr
+		? p.exec_path
+		: p.args.front();
+	if (*path != '/')
+		/* relative paths depend on the working directory */
+		return;
+
+	size_t base_length;
+	if (!p.ns.mount.TranslatePath(path, path_buffer, base_length))
+		return;
+
+	p.exec_fd = Get(path_buffer, base_length).Get();
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include "util/Compiler.h"
+
+#include <map>
+#include <string>
+
+#include <sys/stat.h>
+
+struct PreparedChildProcess;
+
+/**
+ * Keeps O_PATH file descriptors of executables, so child processes
+ * can execveat() them instead of resolving the path (again) inside
+ * their jail.  Each lookup revalidates the cached file descriptor by
+ * comparing device, inode and timestamps with the current file at
+ * that path.
+ */
+class ExecutableCache {
+	/**
+	 * The maximum number of executables.  If there are more
+	 * distinct paths, the others are executed by path.  0
+	 * disables this class.
+	 */
+	const unsigned max_executables;
+
+	struct Item {
+		UniqueFileDescriptor fd;
+
+		/**
+		 * The base_length passed to Get(); it was verified
+		 * only for this value.
+		 */
+		size_t base_length;
+
+		dev_t dev;
+		ino_t ino;
+		struct timespec mtime, ctime;
+
+		Item(UniqueFileDescriptor &&_fd, size_t _base_length,
+		     const struct stat &st) noexcept
+			:fd(std::move(_fd)), base_length(_base_length),
+			 dev(st.st_dev), ino(st.st_ino),
+			 mtime(st.st_mtim), ctime(st.st_ctim) {}
+
+		gcc_pure
+		bool IsSame(const struct stat &st) const noexcept;
+	};
+
+	std::map<std::string, Item> items;
+
+	/**
+	 * A buffer for MountNamespaceOptions::TranslatePath().
+	 */
+	std::string path_buffer;
+
+public:
+	explicit ExecutableCache(unsigned _max_executables) noexcept
+		:max_executables(_max_executables) {}
+
+	ExecutableCache(const ExecutableCache &) = delete;
+	ExecutableCache &operator=(const ExecutableCache &) = delete;
+
+	bool IsEnabled() const noexcept {
+		return max_executables > 0;
+	}
+
+	/**
+	 * Look up the program to be executed by the given process and
+	 * store its file descriptor in
+	 * PreparedChildProcess::exec_fd.  The file descriptor remains
+	 * owned by this object.  If there is none (e.g. because the
+	 * path cannot be resolved outside of the jail), the attribute
+	 * is left alone, and the program is executed by path.
+	 */
+	void Prepare(PreparedChildProcess &p) noexcept;
+
+	void Clear() noexcept {
+		items.clear();
+	}
+
+private:
+	/**
+	 * @param base_length see MountNamespaceOptions::TranslatePath()
+	 */
+	FileDescriptor Get(const std::string &path, size_t base_length) noexcept;
+};
@@ -33,6 +33,8 @@
 #ifndef BENG_PROXY_SPAWN_EXIT_LISTENER_HXX
 #define BENG_PROXY_SPAWN_EXIT_LISTENER_HXX
 
+struct rusage;
+
 /**
  * This interface gets notified when the registered child process
  * exits.
@@ -40,6 +42,13 @@
 class ExitListener {
 public:
     virtual void OnChildProcessExit(int status) = 0;
+
+    /**
+     * Called by #ChildProcessRegistry right before
+     * OnChildProcessExit() with the resource usage of the child
+     * process.  The default implementation ignores it.
+     */
+    virtual void OnChildProcessUsage(const struct rusage &) {}
 };
 
 #endif
@@ -32,6 +32,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 /*
@@ -43,11 +44,89 @@
  */
 
 enum class SpawnRequestCommand : uint8_t {
+    /**
+     * Payload: optional #SpawnConnectFlags byte.  With one file
+     * descriptor, it is a new connection; without one, the flags are
+     * applied to the connection this request was received on.
+     */
     CONNECT,
+
     EXEC,
     KILL,
+
+    /**
+     * Several #EXEC requests in one datagram.  Each one is prefixed
+     * with its length (uint32_t, host byte order) and contains the
+     * #EXEC command byte.  The file descriptors of all requests are
+     * concatenated.  Only allowed after #SpawnConnectFlags::BATCH was
+     * negotiated.
+     */
+    EXEC_BATCH,
+
+    /**
+     * Query the #SpawnStats.  No payload.  The server responds
+     * with #SpawnResponseCommand::STATS, any number of
+     * #SpawnResponseCommand::STATS_USAGE and finally
+     * #SpawnResponseCommand::STATS_END.
+     */
+    STATS,
+
+    /**
+     * Register a profile on this connection: a set of
+     * #SpawnExecCommand records (without file descriptors) which
+     * many #EXEC requests have in common.  Payload: the profile id
+     * (uint16_t, less than #SPAWN_MAX_PROFILES) followed by the
+     * commands.  An existing profile with the same id is replaced.
+     */
+    PROFILE,
+
+    /**
+     * An #EXEC request which is larger than #SPAWN_MAX_REQUEST_SIZE.
+     * No payload.  The first file descriptor is a sealed memfd (see
+     * CreateSpawnPayloadMemfd()) containing the request including
+     * its command byte; the remaining file descriptors belong to
+     * that request.
+     */
+    MEMFD,
 };
 
+enum class SpawnConnectFlags : uint8_t {
+    /**
+     * The client wishes to send #SpawnRequestCommand::EXEC_BATCH and
+     * receive #SpawnResponseCommand::EXIT_BATCH.
+     */
+    BATCH = 0x1,
+};
+
+/**
+ * The maximum size of a request datagram.
+ */
+static constexpr size_t SPAWN_MAX_REQUEST_SIZE = 65536;
+
+/**
+ * The maximum size of a request transferred in a memfd (see
+ * #SpawnRequestCommand::MEMFD).
+ */
+static constexpr size_t SPAWN_MAX_MEMFD_REQUEST_SIZE = 16 * 1024 * 1024;
+
+/**
+ * The maximum number of file descriptors attached to a request
+ * datagram.
+ */
+static constexpr size_t SPAWN_MAX_REQUEST_FDS = 32;
+
+/**
+ * The maximum number of records in one
+ * #SpawnResponseCommand::EXIT_BATCH datagram.
+ */
+static constexpr size_t SPAWN_MAX_EXIT_BATCH = 64;
+
+/**
+ * The maximum number of profiles per connection (see
+ * #SpawnRequestCommand::PROFILE).
+ */
+static constexpr size_t SPAWN_MAX_PROFILES = 64;
+
 enum class SpawnExecCommand : uint8_t {
     ARG,
     SETENV,
@@ -87,6 +166,38 @@ enum class SpawnExecCommand : uint8_t {
     CHROOT,
     CHDIR,
     HOOK_INFO,
+
+    /**
+     * Apply a profile registered with
+     * #SpawnRequestCommand::PROFILE (uint16_t id).  Only allowed as
+     * the first command; the following commands override or
+     * extend it.
+     */
+    PROFILE,
+
+    SCHED_BATCH_,
+
+    /**
+     * Payload: cpu_set_t.
+     */
+    CPU_AFFINITY,
+
+    /**
+     * Payload: PlacementOptions::MemoryPolicy (uint8_t), node mask
+     * (uint64_t).
+     */
+    MEMORY_POLICY,
+
+    /**
+     * Payload: minimum and maximum utilization clamp (uint16_t
+     * each, PlacementOptions::UTIL_UNDEFINED to keep).
+     */
+    UTIL_CLAMP,
+
+    /**
+     * Let the spawner choose a NUMA node (see #NumaBalancer).
+     */
+    NUMA_AUTO,
 };
 
 enum class SpawnResponseCommand : uint16_t {
@@ -96,4 +207,43 @@ enum class SpawnResponseCommand : uint16_t {
     CGROUPS_AVAILABLE,
 
     EXIT,
+
+    /**
+     * Several #EXIT records (id and status, both int) in one
+     * datagram, at most #SPAWN_MAX_EXIT_BATCH.
+     */
+    EXIT_BATCH,
+
+    /**
+     * The counters of #SpawnStats (uint64_t each, in declaration
+     * order), followed by all latency histogram buckets (uint32_t
+     * each, grouped by #SpawnPhase).
+     */
+    STATS,
+
+    /**
+     * Up to #SPAWN_MAX_STATS_USAGE records, each a null-terminated
+     * key followed by the #SpawnResourceUsage fields (uint64_t each,
+     * in declaration order).
+     */
+    STATS_USAGE,
+
+    /**
+     * No payload; marks the end of a #SpawnRequestCommand::STATS
+     * response.
+     */
+    STATS_END,
 };
+
+/**
+ * The maximum number of records in one
+ * #SpawnResponseCommand::STATS_USAGE datagram.
+ */
+static constexpr size_t SPAWN_MAX_STATS_USAGE = 4;
+
+/**
+ * The maximum size of a response datagram (the command is
+ * transmitted as one byte).
+ */
+static constexpr size_t SPAWN_MAX_RESPONSE_SIZE =
+    1 + SPAWN_MAX_EXIT_BATCH * 2 * sizeof(int);
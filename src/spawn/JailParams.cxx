@@ -36,6 +36,8 @@
 #include "util/CharUtil.hxx"
 #include "util/ConstBuffer.hxx"
 #include "util/StaticArray.hxx"
+#include "util/StringCompare.hxx"
+#include "util/Hash128.hxx"
 
 #if TRANSLATION_ENABLE_EXPAND
 #include "pexpand.hxx"
@@ -79,6 +81,20 @@ JailParams::MakeId(char *p) const
     return p;
 }
 
+void
+JailParams::MakeHash(Hash128Builder &h) const noexcept
+{
+    h.UpdateString(enabled ? home_directory : nullptr);
+}
+
+bool
+JailParams::IsSameId(const JailParams &other) const noexcept
+{
+    return enabled == other.enabled &&
+        (!enabled ||
+         StringIsEqualOptional(home_directory, other.home_directory));
+}
+
 void
 JailParams::InsertWrapper(PreparedChildProcess &p,
                           const char *document_root) const
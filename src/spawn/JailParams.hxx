@@ -38,6 +38,7 @@
 struct PreparedChildProcess;
 class AllocatorPtr;
 class MatchInfo;
+class Hash128Builder;
 
 struct JailParams {
     bool enabled = false;
@@ -62,6 +63,16 @@ struct JailParams {
 
     char *MakeId(char *p) const;
 
+    /**
+     * Hash the same attributes as MakeId().
+     */
+    void MakeHash(Hash128Builder &h) const noexcept;
+
+    /**
+     * Compare the attributes covered by MakeId().
+     */
+    bool IsSameId(const JailParams &other) const noexcept;
+
     void InsertWrapper(PreparedChildProcess &p,
                        const char *document_root) const;
 
@@ -36,6 +36,7 @@
 #include "Prepared.hxx"
 #include "CgroupState.hxx"
 #include "system/Error.hxx"
+#include "io/UniqueFileDescriptor.hxx"
 
 #include <utility>
 
@@ -47,11 +48,13 @@ LocalSpawnService::SpawnChildProcess(const char *name,
     if (params.uid_gid.IsEmpty())
         params.uid_gid = config.default_uid_gid;
 
-    pid_t pid = ::SpawnChildProcess(std::move(params), CgroupState());
+    UniqueFileDescriptor pidfd;
+    pid_t pid = ::SpawnChildProcess(std::move(params), CgroupState(),
+                                    &pidfd);
     if (pid < 0)
         throw MakeErrno("clone() failed");
 
-    registry.Add(pid, name, listener);
+    registry.Add(pid, std::move(pidfd), name, listener);
     return pid;
 }
 
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MemfdPayload.hxx"
+#include "IProtocol.hxx"
+#include "Parser.hxx"
+#include "system/Error.hxx"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * These seals guarantee that the contents and the size are
+ * immutable.
+ */
+static constexpr int REQUIRED_SEALS =
+	F_SEAL_SEAL|F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE;
+
+UniqueFileDescriptor
+CreateSpawnPayloadMemfd(ConstBuffer<void> payload)
+{
+	int _fd = memfd_create("spawn", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+	if (_fd < 0)
+		throw MakeErrno("memfd_create() failed");
+
+	UniqueFileDescriptor fd{FileDescriptor(_fd)};
+
+	/* write() instead of mmap(), because F_SEAL_WRITE cannot be
+	   applied while there is a writable mapping */
+	auto p = ConstBuffer<uint8_t>::FromVoid(payload);
+	while (!p.empty()) {
+		ssize_t nbytes = fd.Write(p.data, p.size);
+		if (nbytes < 0)
+			throw MakeErrno("Failed to write memfd");
+
+		p.skip_front(nbytes);
+	}
+
+	if (fcntl(fd.Get(), F_ADD_SEALS, REQUIRED_SEALS) < 0)
+		throw MakeErrno("Failed to seal memfd");
+
+	return fd;
+}
+
+SpawnPayloadMapping::SpawnPayloadMapping(FileDescriptor fd)
+{
+	/* this fails with EINVAL if this is not a memfd */
+	const int seals = fcntl(fd.Get(), F_GET_SEALS);
+	if (seals < 0 || (seals & REQUIRED_SEALS) != REQUIRED_SEALS)
+		throw MalformedSpawnPayloadError();
+
+	struct stat st;
+	if (fstat(fd.Get(), &st) < 0)
+		throw MakeErrno("fstat() failed");
+
+	if (!S_ISREG(st.st_mode) || st.st_size <= 0 ||
+	    uint64_t(st.st_size) > SPAWN_MAX_MEMFD_REQUEST_SIZE)
+		throw MalformedSpawnPayloadError();
+
+	size = st.st_size;
+
+	void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.Get(), 0);
+	if (p == MAP_FAILED)
+		throw MakeErrno("mmap() failed");
+
+	data = (const uint8_t *)p;
+}
+
+SpawnPayloadMapping::~SpawnPayloadMapping() noexcept
+{
+	munmap(const_cast<uint8_t *>(data), size);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "IProtocol.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <stdint.h>
+
+/**
+ * Is a serialized spawn request of this size too large for a
+ * datagram, i.e. does it need to be sent with
+ * #SpawnRequestCommand::MEMFD?
+ */
+constexpr bool
+NeedsSpawnPayloadMemfd(size_t size) noexcept
+{
+	return size > SPAWN_MAX_REQUEST_SIZE;
+}
+
+/**
+ * Write a spawn request which is too large for a datagram (see
+ * #SpawnRequestCommand::MEMFD) into a new memfd and seal it, so the
+ * receiver can map it without having to worry about concurrent
+ * modifications.
+ *
+ * Throws on error.
+ */
+UniqueFileDescriptor
+CreateSpawnPayloadMemfd(ConstBuffer<void> payload);
+
+/**
+ * Maps a memfd created by CreateSpawnPayloadMemfd() read-only.
+ */
+class SpawnPayloadMapping {
+	const uint8_t *data;
+	size_t size;
+
+public:
+	/**
+	 * Throws #MalformedSpawnPayloadError if the file is not a
+	 * properly sealed memfd or if it is too large, and
+	 * std::system_error on other errors.
+	 */
+	explicit SpawnPayloadMapping(FileDescriptor fd);
+
+	~SpawnPayloadMapping() noexcept;
+
+	SpawnPayloadMapping(const SpawnPayloadMapping &) = delete;
+	SpawnPayloadMapping &operator=(const SpawnPayloadMapping &) = delete;
+
+	ConstBuffer<uint8_t> Get() const noexcept {
+		return {data, size};
+	}
+};
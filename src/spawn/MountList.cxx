@@ -32,7 +32,10 @@
 
 #include "MountList.hxx"
 #include "system/BindMount.hxx"
+#include "system/MountTree.hxx"
 #include "AllocatorPtr.hxx"
+#include "util/StringAPI.hxx"
+#include "util/Hash128.hxx"
 
 #if TRANSLATION_ENABLE_EXPAND
 #include "pexpand.hxx"
@@ -53,7 +56,8 @@ MountList::MountList(AllocatorPtr alloc, const MountList &src)
      expand_source(src.expand_source),
 #endif
      writable(src.writable),
-     exec(src.exec) {}
+     exec(src.exec),
+     tree_fd(-1) {}
 
 MountList *
 MountList::CloneAll(AllocatorPtr alloc, const MountList *src)
@@ -91,8 +95,8 @@ MountList::ExpandAll(AllocatorPtr alloc, MountList *m,
 
 #endif
 
-inline void
-MountList::Apply() const
+int
+MountList::GetMountFlags() const noexcept
 {
     int flags = MS_NOSUID|MS_NODEV;
     if (!writable)
@@ -100,7 +104,16 @@ MountList::Apply() const
     if (!exec)
         flags |= MS_NOEXEC;
 
-    BindMount(source, target, flags);
+    return flags;
+}
+
+inline void
+MountList::Apply() const
+{
+    if (tree_fd >= 0 && AttachMountTree(FileDescriptor(tree_fd), target))
+        return;
+
+    BindMount(source, target, GetMountFlags());
 }
 
 void
@@ -138,3 +151,40 @@ MountList::MakeIdAll(char *p, const MountList *m)
 
     return p;
 }
+
+void
+MountList::MakeHash(Hash128Builder &h) const noexcept
+{
+    h.UpdateT(uint8_t(writable | (exec << 1)));
+    h.UpdateString(source);
+    h.UpdateString(target);
+}
+
+void
+MountList::MakeHashAll(Hash128Builder &h, const MountList *m) noexcept
+{
+    size_t n = 0;
+    for (; m != nullptr; m = m->next, ++n)
+        m->MakeHash(h);
+
+    /* the number of items terminates the list */
+    h.UpdateT(n);
+}
+
+bool
+MountList::IsSameId(const MountList &other) const noexcept
+{
+    return writable == other.writable && exec == other.exec &&
+        StringIsEqual(source, other.source) &&
+        StringIsEqual(target, other.target);
+}
+
+bool
+MountList::IsSameIdAll(const MountList *a, const MountList *b) noexcept
+{
+    for (; a != nullptr && b != nullptr; a = a->next, b = b->next)
+        if (!a->IsSameId(*b))
+            return false;
+
+    return a == b;
+}
@@ -39,6 +39,7 @@
 
 class AllocatorPtr;
 class MatchInfo;
+class Hash128Builder;
 
 struct MountList {
     MountList *next;
@@ -57,6 +58,13 @@ struct MountList {
      */
     bool exec;
 
+    /**
+     * A detached mount tree prepared by #MountTreeCache (not
+     * owned by this object) which is attached instead of
+     * bind-mounting #source; -1 if there is none.
+     */
+    int tree_fd;
+
     constexpr MountList(const char *_source, const char *_target,
 #if !TRANSLATION_ENABLE_EXPAND
                         gcc_unused
@@ -67,7 +75,7 @@ struct MountList {
 #if TRANSLATION_ENABLE_EXPAND
          expand_source(_expand_source),
 #endif
-         writable(_writable), exec(_exec) {
+         writable(_writable), exec(_exec), tree_fd(-1) {
     }
 
     MountList(AllocatorPtr alloc, const MountList &src);
@@ -91,6 +99,12 @@ struct MountList {
                           const MatchInfo &match_info);
 #endif
 
+    /**
+     * Returns the MS_* flags for mounting this object.
+     */
+    gcc_pure
+    int GetMountFlags() const noexcept;
+
     /**
      * Throws std::system_error on error.
      */
@@ -105,6 +119,21 @@ struct MountList {
 
     char *MakeId(char *p) const;
     static char *MakeIdAll(char *p, const MountList *m);
+
+    /**
+     * Hash the same attributes as MakeId().
+     */
+    void MakeHash(Hash128Builder &h) const noexcept;
+    static void MakeHashAll(Hash128Builder &h, const MountList *m) noexcept;
+
+    /**
+     * Compare the attributes covered by MakeId().
+     */
+    gcc_pure
+    bool IsSameId(const MountList &other) const noexcept;
+
+    gcc_pure
+    static bool IsSameIdAll(const MountList *a, const MountList *b) noexcept;
 };
 
 #endif
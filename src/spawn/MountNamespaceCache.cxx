@@ -0,0 +1,159 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MountNamespaceCache.hxx"
+#include "NamespaceOptions.hxx"
+#include "MountNamespaceOptions.hxx"
+#include "system/Error.hxx"
+#include "util/ScopeExit.hxx"
+#include "util/PrintException.hxx"
+
+#include <stdexcept>
+
+#include <assert.h>
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static constexpr size_t KEY_BUFFER_SIZE = 65536;
+
+MountNamespaceCache::MountNamespaceCache(unsigned _max_namespaces)
+	:max_namespaces(_max_namespaces),
+	 key_buffer(_max_namespaces > 0 ? new char[KEY_BUFFER_SIZE] : nullptr)
+{
+}
+
+bool
+MountNamespaceCache::IsCacheable(const NamespaceOptions &ns) noexcept
+{
+	const auto &m = ns.mount;
+
+	return m.enable_mount &&
+		/* only if the spawner is root, the child process
+		   postpones CLONE_NEWUSER until after the mounts, and
+		   only then setns() is allowed */
+		geteuid() == 0 &&
+		/* private writable filesystems must not be shared */
+		!m.mount_pts &&
+		m.mount_tmp_tmpfs == nullptr && m.mount_tmpfs == nullptr &&
+		/* a /proc mount belongs to the PID namespace of the
+		   process which mounted it */
+		(!m.mount_proc ||
+		 (!ns.enable_pid && ns.pid_namespace == nullptr)) &&
+		/* this is not a mount setting */
+		m.hostname == nullptr;
+}
+
+FileDescriptor
+MountNamespaceCache::Get(const MountNamespaceOptions &options)
+{
+	assert(IsEnabled());
+
+	char *const key_end = options.MakeId(key_buffer.get());
+	std::string key(key_buffer.get(), key_end);
+
+	auto i = namespaces.find(key);
+	if (i != namespaces.end())
+		return i->second.ToFileDescriptor();
+
+	if (namespaces.size() >= max_namespaces)
+		return FileDescriptor::Undefined();
+
+	auto fd = Create(options);
+	return namespaces.emplace(std::move(key), std::move(fd))
+		.first->second.ToFileDescriptor();
+}
+
+UniqueFileDescriptor
+MountNamespaceCache::Create(const MountNamespaceOptions &options)
+{
+	/* the helper process reports success on "ready" and then
+	   waits for "hold" to be closed, keeping the namespace alive
+	   until we have opened it */
+	UniqueFileDescriptor ready_r, ready_w, hold_r, hold_w;
+	if (!UniqueFileDescriptor::CreatePipe(ready_r, ready_w) ||
+	    !UniqueFileDescriptor::CreatePipe(hold_r, hold_w))
+		throw MakeErrno("pipe() failed");
+
+	const pid_t pid = fork();
+	if (pid < 0)
+		throw MakeErrno("fork() failed");
+
+	if (pid == 0) {
+		ready_r.Close();
+		hold_w.Close();
+
+		try {
+			if (unshare(CLONE_NEWNS) < 0)
+				throw MakeErrno("unshare(CLONE_NEWNS) failed");
+
+			options.Setup();
+		} catch (const std::exception &e) {
+			PrintException(e);
+			_exit(EXIT_FAILURE);
+		}
+
+		char ch = 0;
+		if (ready_w.Write(&ch, sizeof(ch)) != sizeof(ch))
+			_exit(EXIT_FAILURE);
+
+		ready_w.Close();
+		hold_r.Read(&ch, sizeof(ch));
+		_exit(EXIT_SUCCESS);
+	}
+
+	ready_w.Close();
+	hold_r.Close();
+
+	AtScopeExit(pid, &hold_w) {
+		hold_w.Close();
+
+		int status;
+		waitpid(pid, &status, 0);
+	};
+
+	char ch;
+	if (ready_r.Read(&ch, sizeof(ch)) != sizeof(ch))
+		throw std::runtime_error("Failed to set up mount namespace");
+
+	char path[64];
+	sprintf(path, "/proc/%d/ns/mnt", int(pid));
+
+	UniqueFileDescriptor fd;
+	if (!fd.OpenReadOnly(path))
+		throw FormatErrno("Failed to open %s", path);
+
+	return fd;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include "util/Compiler.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+struct MountNamespaceOptions;
+struct NamespaceOptions;
+
+/**
+ * Keeps prepared mount namespaces (held open by a file descriptor)
+ * for distinct #MountNamespaceOptions, so child processes with
+ * identical mount setups can just setns() into an existing one
+ * instead of repeating all the mounts.
+ *
+ * Note that all users of one namespace share its mounts, and mounts
+ * which were changed after the namespace was created are not
+ * updated.
+ */
+class MountNamespaceCache {
+	/**
+	 * The maximum number of namespaces.  If there are more
+	 * distinct configurations, the others are set up the regular
+	 * way.  0 disables this class.
+	 */
+	const unsigned max_namespaces;
+
+	std::map<std::string, UniqueFileDescriptor> namespaces;
+
+	/**
+	 * A buffer for MountNamespaceOptions::MakeId().
+	 */
+	std::unique_ptr<char[]> key_buffer;
+
+public:
+	explicit MountNamespaceCache(unsigned _max_namespaces);
+
+	MountNamespaceCache(const MountNamespaceCache &) = delete;
+	MountNamespaceCache &operator=(const MountNamespaceCache &) = delete;
+
+	bool IsEnabled() const noexcept {
+		return max_namespaces > 0;
+	}
+
+	/**
+	 * Can the mount namespace described by these options be
+	 * shared by several processes?  This is not the case if it
+	 * contains private writable filesystems (tmpfs, devpts), if
+	 * it depends on the PID namespace (/proc) or if the child
+	 * process creates its user namespace before setting up the
+	 * mounts.
+	 */
+	static bool IsCacheable(const NamespaceOptions &ns) noexcept;
+
+	/**
+	 * Obtain a mount namespace for the given options, creating a
+	 * new one if necessary.  The returned file descriptor remains
+	 * owned by this object.
+	 *
+	 * Throws on error.
+	 *
+	 * @return the namespace file descriptor or
+	 * FileDescriptor::Undefined() if the cache is full
+	 */
+	FileDescriptor Get(const MountNamespaceOptions &options);
+
+	void Clear() noexcept {
+		namespaces.clear();
+	}
+
+private:
+	/**
+	 * Create a new mount namespace from the given options.
+	 *
+	 * Throws on error.
+	 */
+	static UniqueFileDescriptor Create(const MountNamespaceOptions &options);
+};
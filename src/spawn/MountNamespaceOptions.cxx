@@ -35,8 +35,11 @@
 #include "AllocatorPtr.hxx"
 #include "system/pivot_root.h"
 #include "system/BindMount.hxx"
+#include "system/MountTree.hxx"
 #include "system/Error.hxx"
 #include "util/ScopeExit.hxx"
+#include "util/StringCompare.hxx"
+#include "util/Hash128.hxx"
 
 #if TRANSLATION_ENABLE_EXPAND
 #include "pexpand.hxx"
@@ -94,6 +97,12 @@ MountNamespaceOptions::Expand(AllocatorPtr alloc, const MatchInfo &match_info)
 
 #endif
 
+int
+MountNamespaceOptions::GetHomeMountFlags() noexcept
+{
+	return MS_NOSUID|MS_NODEV;
+}
+
 static void
 ChdirOrThrow(const char *path)
 {
@@ -234,7 +243,11 @@ MountNamespaceOptions::Setup() const
 			assert(home != nullptr);
 			assert(*home == '/');
 
-			BindMount(home + 1, mount_home, MS_NOSUID|MS_NODEV);
+			if (home_tree_fd < 0 ||
+			    !AttachMountTree(FileDescriptor(home_tree_fd),
+					     mount_home))
+				BindMount(home + 1, mount_home,
+					  GetHomeMountFlags());
 		}
 
 		MountList::ApplyAll(mounts);
@@ -283,6 +296,101 @@ MountNamespaceOptions::Setup() const
 		throw MakeErrno("sethostname() failed");
 }
 
+/**
+ * If the given path is inside the given mount point, return the
+ * remaining portion (empty or starting with a slash).
+ */
+gcc_pure
+static const char *
+MatchMountPoint(const char *path, const char *mount_point) noexcept
+{
+	const char *rest = StringAfterPrefix(path, mount_point);
+	return rest != nullptr && (*rest == 0 || *rest == '/')
+		? rest
+		: nullptr;
+}
+
+bool
+MountNamespaceOptions::TranslatePath(const char *path, std::string &outer,
+				     size_t &base_length) const noexcept
+{
+	assert(path != nullptr);
+	assert(*path == '/');
+
+	if (!enable_mount) {
+		outer = path;
+		base_length = 0;
+		return true;
+	}
+
+	/* private filesystems are all mounted MS_NOEXEC, and they
+	   may hide bind mounts below them */
+	if ((mount_proc && MatchMountPoint(path, "/proc") != nullptr) ||
+	    ((mount_pts || bind_mount_pts) &&
+	     MatchMountPoint(path, "/dev/pts") != nullptr) ||
+	    (mount_tmp_tmpfs != nullptr &&
+	     MatchMountPoint(path, "/tmp") != nullptr) ||
+	    (mount_tmpfs != nullptr &&
+	     MatchMountPoint(path, mount_tmpfs) != nullptr))
+		return false;
+
+	/* find the innermost bind mount; on a tie, the one mounted
+	   last wins because it covers the others */
+
+	const char *source = nullptr, *rest = nullptr;
+	size_t best_length = 0;
+	bool exec = true;
+
+	if (mount_home != nullptr) {
+		const char *r = MatchMountPoint(path, mount_home);
+		if (r != nullptr) {
+			source = home;
+			rest = r;
+			best_length = r - path;
+		}
+	}
+
+	for (const auto *i = mounts; i != nullptr; i = i->next) {
+		const char *r = MatchMountPoint(path, i->target);
+		if (r != nullptr && size_t(r - path) >= best_length) {
+			source = i->source;
+			rest = r;
+			best_length = r - path;
+			exec = i->exec;
+		}
+	}
+
+	if (source != nullptr) {
+		if (!exec)
+			return false;
+
+		/* MountList sources are relative to the old root */
+		outer.clear();
+		if (*source != '/')
+			outer.push_back('/');
+		outer.append(source);
+		base_length = outer.length();
+		outer.append(rest);
+		return true;
+	}
+
+	if (mount_root_tmpfs)
+		/* the tmpfs contains only mount points */
+		return false;
+
+	if (pivot_root != nullptr) {
+		outer = pivot_root;
+		base_length = outer.length();
+		outer.append(path);
+	} else {
+		/* still in the old root, with all its mounts */
+		outer = path;
+		base_length = 0;
+	}
+
+	return true;
+}
+
 char *
 MountNamespaceOptions::MakeId(char *p) const noexcept
 {
@@ -333,3 +441,50 @@ MountNamespaceOptions::MakeId(char *p) const noexcept
 
 	return p;
 }
+
+void
+MountNamespaceOptions::MakeHash(Hash128Builder &h) const noexcept
+{
+	if (!enable_mount) {
+		h.UpdateT(uint8_t(0));
+		return;
+	}
+
+	const uint8_t flags = 0x1 |
+		(mount_root_tmpfs << 1) |
+		(mount_proc << 2) |
+		((mount_proc && writable_proc) << 3) |
+		(mount_pts << 4) |
+		(bind_mount_pts << 5);
+	h.UpdateT(flags);
+
+	h.UpdateString(pivot_root);
+	h.UpdateString(mount_home);
+	h.UpdateString(mount_home != nullptr ? home : nullptr);
+	h.UpdateString(mount_tmp_tmpfs);
+	h.UpdateString(mount_tmpfs);
+	MountList::MakeHashAll(h, mounts);
+}
+
+bool
+MountNamespaceOptions::IsSameId(const MountNamespaceOptions &other) const noexcept
+{
+	if (enable_mount != other.enable_mount)
+		return false;
+
+	if (!enable_mount)
+		return true;
+
+	return mount_root_tmpfs == other.mount_root_tmpfs &&
+		mount_proc == other.mount_proc &&
+		(!mount_proc || writable_proc == other.writable_proc) &&
+		mount_pts == other.mount_pts &&
+		bind_mount_pts == other.bind_mount_pts &&
+		StringIsEqualOptional(pivot_root, other.pivot_root) &&
+		StringIsEqualOptional(mount_home, other.mount_home) &&
+		(mount_home == nullptr ||
+		 StringIsEqualOptional(home, other.home)) &&
+		StringIsEqualOptional(mount_tmp_tmpfs, other.mount_tmp_tmpfs) &&
+		StringIsEqualOptional(mount_tmpfs, other.mount_tmpfs) &&
+		MountList::IsSameIdAll(mounts, other.mounts);
+}
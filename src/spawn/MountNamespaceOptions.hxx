@@ -36,9 +36,12 @@
 
 #include "util/Compiler.h"
 
+#include <string>
+
 class AllocatorPtr;
 struct MountList;
 class MatchInfo;
+class Hash128Builder;
 
 struct MountNamespaceOptions {
 	bool enable_mount = false;
@@ -95,6 +98,14 @@ struct MountNamespaceOptions {
 
 	MountList *mounts = nullptr;
 
+	/**
+	 * A detached mount tree of #home prepared by
+	 * #MountTreeCache (not owned by this object) which is
+	 * attached at #mount_home instead of bind-mounting; -1 if
+	 * there is none.
+	 */
+	int home_tree_fd = -1;
+
 	/**
 	 * The hostname of the new UTS namespace.
 	 */
@@ -121,6 +132,40 @@ struct MountNamespaceOptions {
 
 	char *MakeId(char *p) const noexcept;
 
+	/**
+	 * Hash the same attributes as MakeId().
+	 */
+	void MakeHash(Hash128Builder &h) const noexcept;
+
+	/**
+	 * Compare the attributes covered by MakeId().
+	 */
+	gcc_pure
+	bool IsSameId(const MountNamespaceOptions &other) const noexcept;
+
+	/**
+	 * Translate an absolute path as seen by the child process
+	 * (after Setup()) to the path in the spawner's mount namespace
+	 * it refers to.
+	 *
+	 * @param base_length receives the length of the prefix of
+	 * #outer which is the root of the (non-recursive) bind mount
+	 * the path was found in; the caller should verify that it is
+	 * on the same filesystem as the file.  0 if the path is
+	 * outside of all bind mounts.
+	 * @return false if the path cannot be translated, e.g. because
+	 * it is inside a private filesystem or inside a mount where
+	 * the child may not execute programs
+	 */
+	bool TranslatePath(const char *path,
+			   std::string &outer, size_t &base_length) const noexcept;
+
+	/**
+	 * Returns the MS_* flags for mounting #home.
+	 */
+	gcc_const
+	static int GetHomeMountFlags() noexcept;
+
 	const char *GetJailedHome() const noexcept {
 		return mount_home != nullptr
 			? mount_home
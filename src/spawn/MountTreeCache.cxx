@@ -0,0 +1,100 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MountTreeCache.hxx"
+#include "MountNamespaceOptions.hxx"
+#include "MountList.hxx"
+#include "system/MountTree.hxx"
+#include "system/Error.hxx"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+MountTreeCache::MountTreeCache(unsigned _max_trees)
+	:max_trees(_max_trees)
+{
+	if (max_trees > 0 && !root.Open("/", O_PATH|O_DIRECTORY))
+		throw MakeErrno("Failed to open /");
+}
+
+int
+MountTreeCache::Get(const char *source, int flags)
+{
+	assert(IsEnabled());
+
+	char key[16];
+	snprintf(key, sizeof(key), "%x:", flags);
+
+	std::string k(key);
+	k += source;
+
+	auto i = trees.find(k);
+	if (i != trees.end())
+		return i->second.Get();
+
+	if (trees.size() >= max_trees)
+		return -1;
+
+	auto tree = CloneMountTree(root.ToFileDescriptor(), source, flags);
+	if (!tree.IsDefined()) {
+		if (errno == ENOSYS || errno == EPERM) {
+			/* the kernel (or a seccomp filter) does not allow
+			   the new mount API; don't try again */
+			supported = false;
+			return -1;
+		}
+
+		throw FormatErrno("open_tree('%s') failed", source);
+	}
+
+	return trees.emplace(std::move(k), std::move(tree))
+		.first->second.Get();
+}
+
+void
+MountTreeCache::Prepare(MountNamespaceOptions &options)
+{
+	assert(IsEnabled());
+
+	if (options.mount_home != nullptr) {
+		assert(options.home != nullptr);
+		assert(*options.home == '/');
+
+		options.home_tree_fd = Get(options.home + 1,
+					   MountNamespaceOptions::GetHomeMountFlags());
+	}
+
+	for (auto *i = options.mounts; i != nullptr && IsEnabled(); i = i->next)
+		i->tree_fd = Get(i->source, i->GetMountFlags());
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <map>
+#include <string>
+
+struct MountNamespaceOptions;
+
+/**
+ * Keeps detached mount trees (see CloneMountTree()) for distinct
+ * bind mount sources, prepared once by the spawner, so child
+ * processes only need to attach them (AttachMountTree()) instead of
+ * resolving the source path and bind-mounting it again.
+ *
+ * Note that a tree refers to the directory which was mounted when
+ * it was created; if the source path is later replaced by a
+ * different directory, the tree is not updated.
+ */
+class MountTreeCache {
+	/**
+	 * The maximum number of trees.  If there are more distinct
+	 * sources, the others are bind-mounted the regular way.  0
+	 * disables this class.
+	 */
+	const unsigned max_trees;
+
+	/**
+	 * Set to false if the kernel does not support the new mount
+	 * API.
+	 */
+	bool supported = true;
+
+	/**
+	 * An O_PATH file descriptor of the root directory; source
+	 * paths (which are relative) are resolved relative to it,
+	 * just like the child process does.
+	 */
+	UniqueFileDescriptor root;
+
+	std::map<std::string, UniqueFileDescriptor> trees;
+
+public:
+	explicit MountTreeCache(unsigned _max_trees);
+
+	MountTreeCache(const MountTreeCache &) = delete;
+	MountTreeCache &operator=(const MountTreeCache &) = delete;
+
+	bool IsEnabled() const noexcept {
+		return max_trees > 0 && supported;
+	}
+
+	/**
+	 * Look up (or create) trees for the home directory and all
+	 * #MountList items and store their file descriptors in the
+	 * given options.  The file descriptors remain owned by this
+	 * object.  Items for which no tree is available are left
+	 * alone; they will be bind-mounted the regular way.
+	 *
+	 * Throws on error.
+	 */
+	void Prepare(MountNamespaceOptions &options);
+
+	void Clear() noexcept {
+		trees.clear();
+	}
+
+private:
+	/**
+	 * @return the tree file descriptor or -1 if none is
+	 * available
+	 */
+	int Get(const char *source, int flags);
+};
@@ -38,6 +38,8 @@
 #include "AllocatorPtr.hxx"
 #include "system/Error.hxx"
 #include "util/ScopeExit.hxx"
+#include "util/StringCompare.hxx"
+#include "util/Hash128.hxx"
 
 #include <set>
 
@@ -149,7 +151,9 @@ NamespaceOptions::ReassociateNetwork() const
 }
 
 void
-NamespaceOptions::Setup(const UidGid &uid_gid) const
+NamespaceOptions::Setup(const UidGid &uid_gid,
+			FileDescriptor mount_namespace,
+			FileDescriptor network_namespace_fd) const
 {
 	/* set up UID/GID mapping in the old /proc */
 	if (enable_user) {
@@ -162,10 +166,17 @@ NamespaceOptions::Setup(const UidGid &uid_gid) const
 		SetupUidMap(0, uid_gid.uid, false);
 	}
 
-	if (network_namespace != nullptr)
+	if (network_namespace_fd.IsDefined())
+		ReassociateNetworkNamespace(network_namespace_fd,
+					    network_namespace);
+	else if (network_namespace != nullptr)
 		ReassociateNetwork();
 
-	mount.Setup();
+	if (mount_namespace.IsDefined()) {
+		if (setns(mount_namespace.Get(), CLONE_NEWNS) < 0)
+			throw MakeErrno("setns(CLONE_NEWNS) failed");
+	} else
+		mount.Setup();
 
 	if (hostname != nullptr &&
 	    sethostname(hostname, strlen(hostname)) < 0)
@@ -210,3 +221,35 @@ NamespaceOptions::MakeId(char *p) const
 
 	return p;
 }
+
+void
+NamespaceOptions::MakeHash(Hash128Builder &h) const noexcept
+{
+	const uint8_t flags = enable_user |
+		(enable_pid << 1) |
+		(enable_cgroup << 2) |
+		(enable_network << 3) |
+		(enable_ipc << 4);
+	h.UpdateT(flags);
+
+	h.UpdateString(pid_namespace);
+	h.UpdateString(enable_network ? network_namespace : nullptr);
+	mount.MakeHash(h);
+	h.UpdateString(hostname);
+}
+
+bool
+NamespaceOptions::IsSameId(const NamespaceOptions &other) const noexcept
+{
+	return enable_user == other.enable_user &&
+		enable_pid == other.enable_pid &&
+		enable_cgroup == other.enable_cgroup &&
+		enable_network == other.enable_network &&
+		enable_ipc == other.enable_ipc &&
+		StringIsEqualOptional(pid_namespace, other.pid_namespace) &&
+		(!enable_network ||
+		 StringIsEqualOptional(network_namespace,
+				       other.network_namespace)) &&
+		mount.IsSameId(other.mount) &&
+		StringIsEqualOptional(hostname, other.hostname);
+}
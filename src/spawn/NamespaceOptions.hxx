@@ -34,6 +34,7 @@
 
 #include "MountNamespaceOptions.hxx"
 #include "translation/Features.hxx"
+#include "io/FileDescriptor.hxx"
 
 #include "util/Compiler.h"
 
@@ -42,6 +43,7 @@ struct MountList;
 struct SpawnConfig;
 struct UidGid;
 class MatchInfo;
+class Hash128Builder;
 
 struct NamespaceOptions {
 	/**
@@ -121,11 +123,29 @@ struct NamespaceOptions {
 
 	/**
 	 * Throws std::system_error on error.
+	 *
+	 * @param mount_namespace if defined, then reassociate with
+	 * this mount namespace instead of setting up #mount
+	 * @param network_namespace if defined, then this is an open
+	 * handle to #network_namespace (see #NetworkNamespaceCache)
 	 */
-	void Setup(const UidGid &uid_gid) const;
+	void Setup(const UidGid &uid_gid,
+		   FileDescriptor mount_namespace=FileDescriptor::Undefined(),
+		   FileDescriptor network_namespace=FileDescriptor::Undefined()) const;
 
 	char *MakeId(char *p) const;
 
+	/**
+	 * Hash the same attributes as MakeId().
+	 */
+	void MakeHash(Hash128Builder &h) const noexcept;
+
+	/**
+	 * Compare the attributes covered by MakeId().
+	 */
+	gcc_pure
+	bool IsSameId(const NamespaceOptions &other) const noexcept;
+
 	const char *GetJailedHome() const {
 		return mount.GetJailedHome();
 	}
@@ -33,16 +33,23 @@
 #include "NetworkNamespace.hxx"
 #include "system/Error.hxx"
 #include "io/UniqueFileDescriptor.hxx"
+#include "util/RuntimeError.hxx"
 
+#include <limits.h>
 #include <sched.h>
+#include <sys/vfs.h>
 
-/**
- * Open a network namespace in /run/netns.
- */
-static UniqueFileDescriptor
-OpenNetworkNS(const char *name)
+#ifndef NSFS_MAGIC
+#define NSFS_MAGIC 0x6e736673
+#endif
+
+UniqueFileDescriptor
+OpenNetworkNamespace(const char *name)
 {
-	char path[4096];
+	/* a namespace name is one path component; this buffer
+	   (unlike PATH_MAX) also fits into the error messages
+	   below */
+	char path[sizeof("/run/netns/") + NAME_MAX];
 	if (snprintf(path, sizeof(path),
 		     "/run/netns/%s", name) >= (int)sizeof(path))
 		throw std::runtime_error("Network namespace name is too long");
@@ -51,15 +58,32 @@ OpenNetworkNS(const char *name)
 	if (!fd.OpenReadOnly(path))
 		throw FormatErrno("Failed to open %s", path);
 
+	/* "ip netns add" creates the file before bind-mounting the
+	   namespace onto it; don't let anybody (e.g. a cache) keep a
+	   plain file */
+	struct statfs st;
+	if (fstatfs(fd.Get(), &st) < 0)
+		throw FormatErrno("Failed to stat %s", path);
+
+	if ((unsigned long)st.f_type != NSFS_MAGIC)
+		throw FormatRuntimeError("Not a namespace: %s", path);
+
 	return fd;
 }
 
+void
+ReassociateNetworkNamespace(FileDescriptor fd, const char *name)
+{
+	if (setns(fd.Get(), CLONE_NEWNET) < 0)
+		throw FormatErrno("Failed to reassociate with network namespace '%s'",
+				  name);
+}
+
 void
 ReassociateNetworkNamespace(const char *name)
 {
 	assert(name != nullptr);
 
-	if (setns(OpenNetworkNS(name).Get(), CLONE_NEWNET) < 0)
-		throw FormatErrno("Failed to reassociate with network namespace '%s'",
-				  name);
+	ReassociateNetworkNamespace(OpenNetworkNamespace(name).ToFileDescriptor(),
+				    name);
 }
@@ -32,6 +32,28 @@
 
 #pragma once
 
+class UniqueFileDescriptor;
+class FileDescriptor;
+
+/**
+ * Open a network namespace in /run/netns.
+ *
+ * Throws on error.
+ */
+UniqueFileDescriptor
+OpenNetworkNamespace(const char *name);
+
+/**
+ * Reassociate the current process with the given network namespace
+ * file descriptor (e.g. from #NetworkNamespaceCache).
+ *
+ * Throws on error.
+ *
+ * @param name the namespace name for error messages
+ */
+void
+ReassociateNetworkNamespace(FileDescriptor fd, const char *name);
+
 /**
  * Reassociate the current process with the given network namespace
  * (set up with "ip netns" mounted in /run/netns/).
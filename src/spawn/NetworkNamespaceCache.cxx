@@ -0,0 +1,137 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "NetworkNamespaceCache.hxx"
+#include "NetworkNamespace.hxx"
+
+#include <assert.h>
+#include <sys/inotify.h>
+
+static constexpr char NETNS_DIRECTORY[] = "/run/netns";
+
+static constexpr uint32_t INOTIFY_MASK = IN_CREATE|IN_DELETE|
+	IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|
+	IN_ONLYDIR;
+
+NetworkNamespaceCache::NetworkNamespaceCache(EventLoop &event_loop) noexcept
+	:inotify_event(event_loop, BIND_THIS_METHOD(OnInotifyEvent))
+{
+}
+
+NetworkNamespaceCache::~NetworkNamespaceCache() noexcept
+{
+	inotify_event.Delete();
+}
+
+bool
+NetworkNamespaceCache::Watch() noexcept
+{
+	if (inotify_fd.IsDefined())
+		return true;
+
+	UniqueFileDescriptor new_fd;
+	if (!new_fd.CreateInotify() ||
+	    inotify_add_watch(new_fd.Get(), NETNS_DIRECTORY, INOTIFY_MASK) < 0)
+		return false;
+
+	inotify_fd = std::move(new_fd);
+	inotify_event.Set(inotify_fd.Get(),
+			  SocketEvent::READ|SocketEvent::PERSIST);
+	inotify_event.Add();
+	return true;
+}
+
+void
+NetworkNamespaceCache::Clear() noexcept
+{
+	inotify_event.Delete();
+	inotify_fd.Close();
+	namespaces.clear();
+}
+
+FileDescriptor
+NetworkNamespaceCache::Get(const char *name)
+{
+	assert(name != nullptr);
+
+	if (!Watch())
+		return FileDescriptor::Undefined();
+
+	/* consume events which have not yet been seen by the
+	   EventLoop, so a namespace which was just re-created is
+	   never served from a stale file descriptor */
+	ReadEvents();
+	if (!inotify_fd.IsDefined())
+		/* the directory itself has vanished */
+		return FileDescriptor::Undefined();
+
+	auto i = namespaces.find(name);
+	if (i == namespaces.end())
+		i = namespaces.emplace(name, OpenNetworkNamespace(name)).first;
+
+	return i->second.ToFileDescriptor();
+}
+
+void
+NetworkNamespaceCache::ReadEvents() noexcept
+{
+	alignas(struct inotify_event) char buffer[4096];
+
+	while (inotify_fd.IsDefined()) {
+		ssize_t nbytes = inotify_fd.Read(buffer, sizeof(buffer));
+		if (nbytes <= 0)
+			break;
+
+		const char *p = buffer, *const end = buffer + nbytes;
+		while (p < end) {
+			const auto &event = *(const struct inotify_event *)(const void *)p;
+			p += sizeof(event) + event.len;
+
+			if (event.mask & (IN_DELETE_SELF|IN_MOVE_SELF|
+					  IN_IGNORED|IN_Q_OVERFLOW)) {
+				/* the directory is gone or we have
+				   missed events: start over */
+				Clear();
+				return;
+			}
+
+			if (event.len > 0)
+				namespaces.erase(event.name);
+		}
+	}
+}
+
+void
+NetworkNamespaceCache::OnInotifyEvent(unsigned) noexcept
+{
+	ReadEvents();
+}
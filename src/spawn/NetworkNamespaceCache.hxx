@@ -0,0 +1,99 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/SocketEvent.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <map>
+#include <string>
+
+/**
+ * Keeps the network namespaces in /run/netns (set up with "ip
+ * netns") open, so child processes can just setns() with a cached
+ * file descriptor instead of opening the namespace again for each
+ * new process.
+ *
+ * The directory is watched with inotify; if a namespace is deleted
+ * or replaced, its file descriptor is closed (which also allows the
+ * kernel to free a deleted namespace).  If /run/netns cannot be
+ * watched (e.g. because it does not exist yet), nothing is cached.
+ */
+class NetworkNamespaceCache {
+	/**
+	 * The inotify file descriptor watching /run/netns; undefined
+	 * if watching is not possible currently.
+	 */
+	UniqueFileDescriptor inotify_fd;
+
+	SocketEvent inotify_event;
+
+	std::map<std::string, UniqueFileDescriptor> namespaces;
+
+public:
+	explicit NetworkNamespaceCache(EventLoop &event_loop) noexcept;
+	~NetworkNamespaceCache() noexcept;
+
+	NetworkNamespaceCache(const NetworkNamespaceCache &) = delete;
+	NetworkNamespaceCache &operator=(const NetworkNamespaceCache &) = delete;
+
+	/**
+	 * Obtain the network namespace with the given name, opening
+	 * it if necessary.  The returned file descriptor remains
+	 * owned by this object.
+	 *
+	 * Throws on error.
+	 *
+	 * @return the namespace file descriptor or
+	 * FileDescriptor::Undefined() if caching is not possible
+	 */
+	FileDescriptor Get(const char *name);
+
+	void Clear() noexcept;
+
+private:
+	/**
+	 * Start watching /run/netns if not already done.
+	 *
+	 * @return true if the directory is being watched
+	 */
+	bool Watch() noexcept;
+
+	/**
+	 * Read all pending inotify events and invalidate the
+	 * affected namespaces.
+	 */
+	void ReadEvents() noexcept;
+
+	void OnInotifyEvent(unsigned events) noexcept;
+};
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "NumaBalancer.hxx"
+#include "PlacementOptions.hxx"
+#include "util/ScopeExit.hxx"
+
+#include <algorithm>
+
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+constexpr std::chrono::steady_clock::duration NumaBalancer::SAMPLE_INTERVAL;
+
+/**
+ * Read the first line of a (small) text file.
+ */
+static bool
+ReadLine(const char *path, char *buffer, size_t size) noexcept
+{
+	FILE *file = fopen(path, "r");
+	if (file == nullptr)
+		return false;
+
+	AtScopeExit(file) { fclose(file); };
+
+	return fgets(buffer, size, file) != nullptr;
+}
+
+NumaBalancer::NumaBalancer(const char *node_path,
+			   const char *_stat_path) noexcept
+	:stat_path(_stat_path)
+{
+	DIR *dir = opendir(node_path);
+	if (dir == nullptr)
+		return;
+
+	AtScopeExit(dir) { closedir(dir); };
+
+	while (const auto *e = readdir(dir)) {
+		if (strncmp(e->d_name, "node", 4) != 0)
+			continue;
+
+		char *endptr;
+		const unsigned long id = strtoul(e->d_name + 4, &endptr, 10);
+		if (endptr == e->d_name + 4 || *endptr != 0 ||
+		    id >= 64)
+			/* PlacementOptions::memory_nodes is a 64 bit
+			   mask */
+			continue;
+
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/node%lu/cpulist",
+			 node_path, id);
+
+		char line[4096];
+		if (!ReadLine(path, line, sizeof(line)))
+			continue;
+
+		Node node;
+		node.id = id;
+		if (!ParseCpuList(line, node.cpus))
+			continue;
+
+		node.n_cpus = CPU_COUNT(&node.cpus);
+		if (node.n_cpus == 0)
+			/* a node with memory only */
+			continue;
+
+		nodes.push_back(node);
+	}
+
+	std::sort(nodes.begin(), nodes.end(),
+		  [](const Node &a, const Node &b){
+			  return a.id < b.id;
+		  });
+
+	if (IsEnabled())
+		Sample();
+}
+
+void
+NumaBalancer::Sample() noexcept
+{
+	FILE *file = fopen(stat_path, "r");
+	if (file == nullptr)
+		return;
+
+	AtScopeExit(file) { fclose(file); };
+
+	struct Counters {
+		unsigned long long busy = 0, total = 0;
+	};
+
+	std::vector<Counters> counters(nodes.size());
+
+	char line[256];
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		/* skip the "cpu" summary line and everything
+		   else */
+		if (strncmp(line, "cpu", 3) != 0 ||
+		    line[3] < '0' || line[3] > '9')
+			continue;
+
+		unsigned cpu;
+		unsigned long long user, nice, system, idle, iowait,
+			irq, softirq, steal;
+		if (sscanf(line + 3, "%u %llu %llu %llu %llu %llu %llu %llu %llu",
+			   &cpu, &user, &nice, &system, &idle, &iowait,
+			   &irq, &softirq, &steal) != 9 ||
+		    cpu >= CPU_SETSIZE)
+			continue;
+
+		const unsigned long long busy = user + nice + system +
+			irq + softirq + steal;
+		const unsigned long long total = busy + idle + iowait;
+
+		for (size_t i = 0; i < nodes.size(); ++i) {
+			if (CPU_ISSET(cpu, &nodes[i].cpus)) {
+				counters[i].busy += busy;
+				counters[i].total += total;
+				break;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		auto &node = nodes[i];
+		const auto &c = counters[i];
+
+		if (c.total > node.total && c.busy >= node.busy)
+			node.load = double(c.busy - node.busy) /
+				double(c.total - node.total);
+
+		node.busy = c.busy;
+		node.total = c.total;
+		node.recent = 0;
+	}
+}
+
+unsigned
+NumaBalancer::Place(PlacementOptions &placement,
+		    std::chrono::steady_clock::time_point now) noexcept
+{
+	assert(IsEnabled());
+
+	if (now >= next_sample) {
+		Sample();
+		next_sample = now + SAMPLE_INTERVAL;
+	}
+
+	auto &node = *std::min_element(nodes.begin(), nodes.end(),
+				       [](const Node &a, const Node &b){
+					       return a.GetScore() < b.GetScore();
+				       });
+	++node.recent;
+
+	placement.cpus = node.cpus;
+	placement.memory_nodes = uint64_t(1) << node.id;
+	if (placement.memory_policy == PlacementOptions::MemoryPolicy::DEFAULT)
+		placement.memory_policy = PlacementOptions::MemoryPolicy::PREFERRED;
+
+	return node.id;
+}
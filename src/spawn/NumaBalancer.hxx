@@ -0,0 +1,131 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include <sched.h>
+
+struct PlacementOptions;
+
+/**
+ * Spreads child processes across NUMA nodes: each new child process
+ * is bound to the CPUs of the node which is currently least busy,
+ * and prefers allocating memory from that node.  This avoids remote
+ * memory accesses of processes which the scheduler would otherwise
+ * move between sockets.
+ *
+ * The load of each node is sampled from /proc/stat (at most once per
+ * #SAMPLE_INTERVAL); children placed since the last sample are
+ * accounted as one busy CPU each, so a burst of new processes
+ * does not end up on one node.
+ */
+class NumaBalancer {
+	static constexpr std::chrono::steady_clock::duration SAMPLE_INTERVAL =
+		std::chrono::seconds(1);
+
+	struct Node {
+		unsigned id;
+
+		cpu_set_t cpus;
+
+		unsigned n_cpus;
+
+		/**
+		 * The /proc/stat counters of all #cpus at the last
+		 * sample.
+		 */
+		unsigned long long busy = 0, total = 0;
+
+		/**
+		 * The fraction of busy CPU time (0..1) between the
+		 * last two samples.
+		 */
+		double load = 0;
+
+		/**
+		 * The number of child processes placed on this node
+		 * since the last sample.
+		 */
+		unsigned recent = 0;
+
+		double GetScore() const noexcept {
+			return load + double(recent) / n_cpus;
+		}
+	};
+
+	std::vector<Node> nodes;
+
+	/**
+	 * The path of /proc/stat.
+	 */
+	const char *const stat_path;
+
+	std::chrono::steady_clock::time_point next_sample;
+
+public:
+	/**
+	 * Load the NUMA topology from sysfs.  Errors are not fatal;
+	 * the object is just disabled.
+	 *
+	 * @param node_path the sysfs directory containing the
+	 * "nodeN" directories (only to be changed by unit tests)
+	 * @param _stat_path the path of /proc/stat (only to be
+	 * changed by unit tests); must remain valid for the lifetime
+	 * of this object
+	 */
+	explicit NumaBalancer(const char *node_path="/sys/devices/system/node",
+			      const char *_stat_path="/proc/stat") noexcept;
+
+	/**
+	 * Does this machine have more than one NUMA node?
+	 */
+	bool IsEnabled() const noexcept {
+		return nodes.size() > 1;
+	}
+
+	/**
+	 * Choose a node for a new child process and store its CPUs
+	 * and memory node in the given #PlacementOptions.  An
+	 * explicit #PlacementOptions::memory_policy is preserved;
+	 * otherwise, the node is only "preferred".
+	 *
+	 * @return the id of the chosen node
+	 */
+	unsigned Place(PlacementOptions &placement,
+		       std::chrono::steady_clock::time_point now) noexcept;
+
+private:
+	void Sample() noexcept;
+};
@@ -55,7 +55,20 @@ public:
     }
 
     size_t GetSize() const {
-        return begin - end;
+        return end - begin;
+    }
+
+    /**
+     * Returns the portion of the payload which has not been
+     * consumed yet.
+     */
+    ConstBuffer<uint8_t> GetRemaining() const {
+        return {begin, GetSize()};
+    }
+
+    uint8_t PeekByte() const {
+        assert(!IsEmpty());
+        return *begin;
     }
 
     uint8_t ReadByte() {
@@ -33,18 +33,20 @@
 #include "PidNamespace.hxx"
 #include "spawn/daemon/Client.hxx"
 #include "system/Error.hxx"
-#include "net/UniqueSocketDescriptor.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 
 #include <sched.h>
 
-/**
- * Obtain a PID namespace from the Spawn daemon.
- */
-static UniqueFileDescriptor
-GetPidNS(const char *name)
+FileDescriptor
+GetCurrentPidNamespace()
 {
-	return SpawnDaemon::MakePidNamespace(SpawnDaemon::Connect(), name);
+	/* our own PID namespace never changes (setns() affects only
+	   new child processes), so this handle stays valid */
+	static UniqueFileDescriptor fd;
+	if (!fd.IsDefined() && !fd.OpenReadOnly("/proc/self/ns/pid"))
+		throw MakeErrno("Failed to open current PID namespace");
+
+	return fd.ToFileDescriptor();
 }
 
 void
@@ -52,7 +54,8 @@ ReassociatePidNamespace(const char *name)
 {
 	assert(name != nullptr);
 
-	if (setns(GetPidNS(name).Get(), CLONE_NEWPID) < 0)
+	const auto fd = SpawnDaemon::GetClient().GetPidNamespace(name);
+	if (setns(fd.Get(), CLONE_NEWPID) < 0)
 		throw FormatErrno("Failed to reassociate with PID namespace '%s'",
 				  name);
 }
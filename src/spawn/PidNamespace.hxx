@@ -32,6 +32,18 @@
 
 #pragma once
 
+class FileDescriptor;
+
+/**
+ * Returns a handle to the PID namespace of the current process.  It
+ * is opened on the first call and remains open for the lifetime of
+ * the process.
+ *
+ * Throws on error.
+ */
+FileDescriptor
+GetCurrentPidNamespace();
+
 /**
  * Reassociate the next child process with the given PID namespace.
  * The namespace handle is queried from the Spawn daemon (Package
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PlacementOptions.hxx"
+#include "system/Error.hxx"
+#include "util/Hash128.hxx"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * The layout of the kernel's "struct sched_attr" (version 1, which
+ * added the utilization clamp); not all C libraries define it.
+ */
+struct SchedAttr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime, sched_deadline, sched_period;
+	uint32_t sched_util_min, sched_util_max;
+};
+
+static_assert(sizeof(SchedAttr) == 56, "Wrong size");
+
+static constexpr uint64_t _SCHED_FLAG_KEEP_POLICY = 0x08;
+static constexpr uint64_t _SCHED_FLAG_KEEP_PARAMS = 0x10;
+static constexpr uint64_t _SCHED_FLAG_UTIL_CLAMP_MIN = 0x20;
+static constexpr uint64_t _SCHED_FLAG_UTIL_CLAMP_MAX = 0x40;
+
+template<typename F>
+static bool
+ParseIdList(const char *s, unsigned max, F &&f) noexcept
+{
+	while (true) {
+		char *endptr;
+		const unsigned long first = strtoul(s, &endptr, 10);
+		if (endptr == s || first >= max)
+			return false;
+
+		unsigned long last = first;
+		s = endptr;
+		if (*s == '-') {
+			++s;
+			last = strtoul(s, &endptr, 10);
+			if (endptr == s || last >= max || last < first)
+				return false;
+
+			s = endptr;
+		}
+
+		for (unsigned long i = first; i <= last; ++i)
+			f(i);
+
+		if (*s == 0 || *s == '\n')
+			return true;
+
+		if (*s != ',')
+			return false;
+
+		++s;
+	}
+}
+
+bool
+ParseCpuList(const char *s, cpu_set_t &cpus) noexcept
+{
+	CPU_ZERO(&cpus);
+	return ParseIdList(s, CPU_SETSIZE, [&cpus](unsigned i){
+			CPU_SET(i, &cpus);
+		});
+}
+
+bool
+ParseNodeList(const char *s, uint64_t &nodes) noexcept
+{
+	nodes = 0;
+	return ParseIdList(s, 64, [&nodes](unsigned i){
+			nodes |= uint64_t(1) << i;
+		});
+}
+
+char *
+PlacementOptions::MakeId(char *p) const noexcept
+{
+	if (HasCpus()) {
+		p = stpcpy(p, ";c");
+
+		/* hex digits, lowest CPU first, without trailing
+		   zeroes */
+		unsigned n = CPU_SETSIZE / 4;
+		while (n > 0) {
+			const unsigned i = (n - 1) * 4;
+			if (CPU_ISSET(i, &cpus) || CPU_ISSET(i + 1, &cpus) ||
+			    CPU_ISSET(i + 2, &cpus) || CPU_ISSET(i + 3, &cpus))
+				break;
+			--n;
+		}
+
+		for (unsigned i = 0; i < n * 4; i += 4) {
+			const unsigned nibble = CPU_ISSET(i, &cpus) |
+				(CPU_ISSET(i + 1, &cpus) << 1) |
+				(CPU_ISSET(i + 2, &cpus) << 2) |
+				(CPU_ISSET(i + 3, &cpus) << 3);
+			*p++ = "0123456789abcdef"[nibble];
+		}
+	}
+
+	if (memory_policy != MemoryPolicy::DEFAULT)
+		p += sprintf(p, ";m%u:%llx", unsigned(memory_policy),
+			     (unsigned long long)memory_nodes);
+
+	if (util_min != UTIL_UNDEFINED || util_max != UTIL_UNDEFINED)
+		p += sprintf(p, ";uc%u-%u", util_min, util_max);
+
+	if (auto_node)
+		p = stpcpy(p, ";na");
+
+	return p;
+}
+
+void
+PlacementOptions::MakeHash(Hash128Builder &h) const noexcept
+{
+	h.UpdateT(cpus);
+	h.UpdateT(memory_nodes);
+	h.UpdateT(memory_policy);
+	h.UpdateT(util_min);
+	h.UpdateT(util_max);
+	h.UpdateT(auto_node);
+}
+
+bool
+PlacementOptions::IsSameId(const PlacementOptions &other) const noexcept
+{
+	return CPU_EQUAL(&cpus, &other.cpus) &&
+		memory_nodes == other.memory_nodes &&
+		memory_policy == other.memory_policy &&
+		util_min == other.util_min &&
+		util_max == other.util_max &&
+		auto_node == other.auto_node;
+}
+
+void
+PlacementOptions::Apply() const
+{
+	if (HasCpus() && sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+		throw MakeErrno("sched_setaffinity() failed");
+
+	if (memory_policy != MemoryPolicy::DEFAULT &&
+	    /* the kernel ignores the last bit of "maxnode" */
+	    syscall(__NR_set_mempolicy, int(memory_policy),
+		    &memory_nodes, sizeof(memory_nodes) * 8 + 1) < 0)
+		throw MakeErrno("set_mempolicy() failed");
+
+	if (util_min != UTIL_UNDEFINED || util_max != UTIL_UNDEFINED) {
+		SchedAttr attr{};
+		attr.size = sizeof(attr);
+		attr.sched_flags = _SCHED_FLAG_KEEP_POLICY|_SCHED_FLAG_KEEP_PARAMS;
+
+		if (util_min != UTIL_UNDEFINED) {
+			attr.sched_flags |= _SCHED_FLAG_UTIL_CLAMP_MIN;
+			attr.sched_util_min = util_min;
+		}
+
+		if (util_max != UTIL_UNDEFINED) {
+			attr.sched_flags |= _SCHED_FLAG_UTIL_CLAMP_MAX;
+			attr.sched_util_max = util_max;
+		}
+
+		if (syscall(__NR_sched_setattr, 0, &attr, 0) < 0)
+			throw MakeErrno("sched_setattr() failed");
+	}
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/Compiler.h"
+
+#include <sched.h>
+#include <stdint.h>
+
+class Hash128Builder;
+
+/**
+ * Where (on which CPUs and NUMA memory nodes) a child process runs,
+ * and how much CPU capacity the scheduler assumes it needs.
+ */
+struct PlacementOptions {
+	/**
+	 * The NUMA memory policy; the values are the same as the
+	 * kernel's MPOL_* constants.
+	 *
+	 * @see set_mempolicy(2)
+	 */
+	enum class MemoryPolicy : uint8_t {
+		/**
+		 * Inherit the policy of the spawner.
+		 */
+		DEFAULT = 0,
+
+		PREFERRED = 1,
+		BIND = 2,
+		INTERLEAVE = 3,
+	};
+
+	/**
+	 * A #util_min / #util_max value which means "don't change".
+	 */
+	static constexpr uint16_t UTIL_UNDEFINED = 0xffff;
+
+	/**
+	 * The maximum utilization clamp value
+	 * (SCHED_CAPACITY_SCALE).
+	 */
+	static constexpr uint16_t UTIL_MAX = 1024;
+
+	/**
+	 * Restrict the child process to these CPUs.  If empty, the
+	 * affinity is inherited.
+	 *
+	 * @see sched_setaffinity(2)
+	 */
+	cpu_set_t cpus{};
+
+	/**
+	 * A bit mask of NUMA nodes for #memory_policy.
+	 */
+	uint64_t memory_nodes = 0;
+
+	MemoryPolicy memory_policy = MemoryPolicy::DEFAULT;
+
+	/**
+	 * Utilization clamp (0..#UTIL_MAX): a hint to the scheduler
+	 * and to cpufreq how much CPU capacity this process needs at
+	 * least / at most.  Requires Linux 5.3.
+	 *
+	 * @see sched_setattr(2)
+	 */
+	uint16_t util_min = UTIL_UNDEFINED, util_max = UTIL_UNDEFINED;
+
+	/**
+	 * Let the spawn server choose a NUMA node (see
+	 * #NumaBalancer).  This overrides #cpus and #memory_nodes.
+	 */
+	bool auto_node = false;
+
+	gcc_pure
+	bool HasCpus() const noexcept {
+		return CPU_COUNT(&cpus) > 0;
+	}
+
+	gcc_pure
+	bool IsEmpty() const noexcept {
+		return !HasCpus() &&
+			memory_policy == MemoryPolicy::DEFAULT &&
+			util_min == UTIL_UNDEFINED &&
+			util_max == UTIL_UNDEFINED &&
+			!auto_node;
+	}
+
+	char *MakeId(char *p) const noexcept;
+
+	/**
+	 * Hash the same attributes as MakeId().
+	 */
+	void MakeHash(Hash128Builder &h) const noexcept;
+
+	gcc_pure
+	bool IsSameId(const PlacementOptions &other) const noexcept;
+
+	/**
+	 * Apply these settings to the current process.
+	 *
+	 * Throws std::system_error on error.
+	 */
+	void Apply() const;
+};
+
+/**
+ * Parse a list of CPU numbers and ranges in the format used by
+ * sysfs and cpuset(7), e.g. "0-3,8,10-11".
+ *
+ * @return false on syntax error or if a CPU number is out of range
+ */
+bool
+ParseCpuList(const char *s, cpu_set_t &cpus) noexcept;
+
+/**
+ * Like ParseCpuList(), but for a list of (up to 64) NUMA nodes.
+ */
+bool
+ParseNodeList(const char *s, uint64_t &nodes) noexcept;
@@ -55,6 +55,25 @@ PreparedChildProcess::~PreparedChildProcess()
 		close(control_fd);
 }
 
+bool
+PreparedChildProcess::IsVforkCompatible() const noexcept
+{
+	return exec_function == nullptr &&
+		ns.GetCloneFlags(0) == 0 &&
+		ns.pid_namespace == nullptr &&
+		ns.network_namespace == nullptr &&
+		mount_namespace_fd < 0 &&
+		chroot == nullptr &&
+		!cgroup.IsDefined() &&
+		refence.IsEmpty() &&
+		uid_gid.IsEmpty() &&
+		rlimits.IsEmpty() &&
+		/* PlacementOptions::Apply() throws */
+		placement.IsEmpty() &&
+		stdout_fd >= 0 &&
+		(stderr_fd >= 0 || stderr_path != nullptr);
+}
+
 void
 PreparedChildProcess::InsertWrapper(ConstBuffer<const char *> w)
 {
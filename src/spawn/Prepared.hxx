@@ -38,6 +38,8 @@
 #include "RefenceOptions.hxx"
 #include "NamespaceOptions.hxx"
 #include "UidGid.hxx"
+#include "PlacementOptions.hxx"
+#include "util/Compiler.h"
 
 #include <string>
 #include <vector>
@@ -81,6 +83,37 @@ struct PreparedChildProcess {
 	std::vector<const char *> env;
 	int stdin_fd = -1, stdout_fd = -1, stderr_fd = -1, control_fd = -1;
 
+	/**
+	 * If non-negative, then this is a prepared mount namespace
+	 * (see #MountNamespaceCache) which the child process
+	 * reassociates with instead of applying
+	 * NamespaceOptions::mount; it is not owned by this object.
+	 */
+	int mount_namespace_fd = -1;
+
+	/**
+	 * If non-negative, then this is an open handle to
+	 * NamespaceOptions::network_namespace (see
+	 * #NetworkNamespaceCache); it is not owned by this object.
+	 */
+	int network_namespace_fd = -1;
+
+	/**
+	 * If non-negative, then this is the cgroup2 directory of
+	 * #cgroup (see #CgroupCache) whose settings have already been
+	 * applied; the child process is created inside it with
+	 * CLONE_INTO_CGROUP.  It is not owned by this object.
+	 */
+	int cgroup_fd = -1;
+
+	/**
+	 * If non-negative, then this is an O_PATH file descriptor of
+	 * the program to be executed (see #ExecutableCache), which is
+	 * passed to execveat() instead of resolving the path again in
+	 * the child process.  It is not owned by this object.
+	 */
+	int exec_fd = -1;
+
 	/**
 	 * The umask for the new child process.  -1 means do not change
 	 * it.
@@ -103,6 +136,8 @@ struct PreparedChildProcess {
 
 	UidGid uid_gid;
 
+	PlacementOptions placement;
+
 	/**
 	 * Change to this new root directory.  This feature should not be
 	 * used; use NamespaceOptions::pivot_root instead.  It is only
@@ -123,6 +158,16 @@ struct PreparedChildProcess {
 	 */
 	bool sched_idle = false;
 
+	/**
+	 * Select the "batch" CPU scheduling policy for CPU-intensive
+	 * non-interactive processes.  Unlike #sched_idle, the
+	 * "priority" value is still effective.  Ignored if
+	 * #sched_idle is set.
+	 *
+	 * @see sched(7)
+	 */
+	bool sched_batch = false;
+
 	/**
 	 * Select the "idle" I/O scheduling class.
 	 *
@@ -168,6 +213,18 @@ struct PreparedChildProcess {
 		return forbid_user_ns || forbid_multicast || forbid_bind;
 	}
 
+	/**
+	 * Can this process be spawned with CLONE_VM|CLONE_VFORK,
+	 * i.e. without copying the page tables of this (possibly
+	 * huge) process?  That is only possible if the child does not
+	 * need to do anything which may allocate memory or throw
+	 * exceptions, because it shares the address space (and the
+	 * heap) with the suspended parent: no namespaces, cgroup,
+	 * resource limits, uid/gid switch and no systemd journal.
+	 */
+	gcc_pure
+	bool IsVforkCompatible() const noexcept;
+
 	void InsertWrapper(ConstBuffer<const char *> w);
 
 	void Append(const char *arg) {
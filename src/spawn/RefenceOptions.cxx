@@ -35,6 +35,7 @@
 #include "system/Error.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 #include "util/djbhash.h"
+#include "util/Hash128.hxx"
 
 #include <algorithm>
 
@@ -66,6 +67,12 @@ RefenceOptions::MakeId(char *p) const
     return p;
 }
 
+void
+RefenceOptions::MakeHash(Hash128Builder &h) const noexcept
+{
+    h.Update(data);
+}
+
 inline void
 RefenceOptions::Apply(FileDescriptor fd) const
 {
@@ -37,6 +37,7 @@
 
 class AllocatorPtr;
 class FileDescriptor;
+class Hash128Builder;
 
 /**
  * Options for Refence.
@@ -62,6 +63,15 @@ public:
 
     char *MakeId(char *p) const;
 
+    /**
+     * Hash the same attributes as MakeId().
+     */
+    void MakeHash(Hash128Builder &h) const noexcept;
+
+    bool IsSameId(const RefenceOptions &other) const noexcept {
+        return data.Equals(other.data);
+    }
+
     /**
      * Throws std::system_error on error.
      */
@@ -32,19 +32,33 @@
 
 #include "Registry.hxx"
 #include "ExitListener.hxx"
+#include "event/Loop.hxx"
+#include "event/Duration.hxx"
 #include "util/DeleteDisposer.hxx"
 #include "util/StringFormat.hxx"
 
+#include <algorithm>
+
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <sys/signalfd.h>
 #include <sys/wait.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef __NR_pidfd_send_signal
+#define __NR_pidfd_send_signal 424
+#endif
 
-static constexpr struct timeval child_kill_timeout = {
-    .tv_sec = 60,
-    .tv_usec = 0,
-};
+/**
+ * The waitid() id type for pidfds (Linux 5.4); not an enum value in
+ * older glibc versions.
+ */
+static constexpr int WAITID_P_PIDFD = 3;
+
+static constexpr std::chrono::seconds child_kill_timeout(60);
 
 static std::string
 MakeChildProcessLogDomain(unsigned pid, const char *name)
@@ -52,18 +66,43 @@ MakeChildProcessLogDomain(unsigned pid, const char *name)
     return StringFormat<64>("spawn:%u:%s", pid, name).c_str();
 }
 
-ChildProcessRegistry::ChildProcess::ChildProcess(EventLoop &_event_loop,
-                                                 pid_t _pid, const char *_name,
+ChildProcessRegistry::ChildProcess::ChildProcess(ChildProcessRegistry &_registry,
+                                                 pid_t _pid,
+                                                 UniqueFileDescriptor &&_pidfd,
+                                                 const char *_name,
                                                  ExitListener *_listener)
-    :logger(MakeChildProcessLogDomain(_pid, _name)),
+    :registry(_registry),
+     logger(MakeChildProcessLogDomain(_pid, _name)),
      pid(_pid), name(_name),
-     start_time(std::chrono::steady_clock::now()),
+     start_time(_registry.event_loop.SteadyNow()),
      listener(_listener),
-     kill_timeout_event(_event_loop, BIND_THIS_METHOD(KillTimeoutCallback))
+     pidfd(std::move(_pidfd)),
+     pidfd_event(_registry.event_loop, BIND_THIS_METHOD(OnPidfdReady))
 {
+    if (pidfd.IsDefined()) {
+        pidfd_event.Set(pidfd.Get(), SocketEvent::READ|SocketEvent::PERSIST);
+        pidfd_event.Add();
+    }
+
     logger(5, "added child process");
 }
 
+bool
+ChildProcessRegistry::ChildProcess::SendSignal(int signo)
+{
+    if (pidfd.IsDefined()) {
+        /* the pidfd cannot refer to a recycled pid */
+        if (syscall(__NR_pidfd_send_signal, pidfd.Get(), signo,
+                    nullptr, 0) == 0)
+            return true;
+
+        if (errno != ENOSYS)
+            return false;
+    }
+
+    return kill(pid, signo) == 0;
+}
+
 static constexpr double
 timeval_to_double(const struct timeval &tv)
 {
@@ -98,21 +137,75 @@ ChildProcessRegistry::ChildProcess::OnExit(int status,
                   rusage.ru_minflt, rusage.ru_majflt,
                   rusage.ru_nvcsw, rusage.ru_nivcsw);
 
-    if (listener != nullptr)
+    if (listener != nullptr) {
+        listener->OnChildProcessUsage(rusage);
         listener->OnChildProcessExit(status);
+    }
 }
 
 inline void
-ChildProcessRegistry::ChildProcess::KillTimeoutCallback()
+ChildProcessRegistry::ChildProcess::OnKillTimeout()
 {
     logger(3, "sending SIGKILL to due to timeout");
 
-    if (kill(pid, SIGKILL) < 0)
+    if (!SendSignal(SIGKILL))
         logger(1, "failed to kill child process: ", strerror(errno));
 }
 
+/**
+ * Convert a waitid() result to a wait4() status.
+ */
+static int
+ToWaitStatus(const siginfo_t &info)
+{
+    switch (info.si_code) {
+    case CLD_EXITED:
+        return W_EXITCODE(info.si_status, 0);
+
+    case CLD_DUMPED:
+        return info.si_status | WCOREFLAG;
+
+    default:
+        return info.si_status;
+    }
+}
+
+void
+ChildProcessRegistry::ChildProcess::OnPidfdReady(unsigned)
+{
+    siginfo_t info;
+    info.si_pid = 0;
+
+    struct rusage rusage;
+
+    /* the raw system call, because the glibc wrapper does not
+       return the rusage */
+    if (syscall(__NR_waitid, WAITID_P_PIDFD, pidfd.Get(), &info,
+                WEXITED|WNOHANG|__WALL, &rusage) < 0) {
+        if (errno != EINVAL) {
+            logger(1, "waitid() failed: ", strerror(errno));
+            return;
+        }
+
+        /* the kernel doesn't know P_PIDFD; the pidfd is readable,
+           so the process has exited and its pid cannot have been
+           recycled */
+        int status;
+        if (wait4(pid, &status, WNOHANG|__WALL, &rusage) > 0)
+            registry.OnExit(*this, status, rusage);
+        return;
+    }
+
+    if (info.si_pid == 0)
+        /* not yet */
+        return;
+
+    registry.OnExit(*this, ToWaitStatus(info), rusage);
+}
+
 ChildProcessRegistry::ChildProcessRegistry(EventLoop &_event_loop)
     :logger("spawn"), event_loop(_event_loop),
+     kill_timer(event_loop, BIND_THIS_METHOD(OnKillTimer)),
      sigchld_event(event_loop, SIGCHLD, BIND_THIS_METHOD(OnSigChld))
 {
     sigchld_event.Enable();
@@ -121,6 +214,9 @@ ChildProcessRegistry::ChildProcessRegistry(EventLoop &_event_loop)
 void
 ChildProcessRegistry::Clear()
 {
+    kill_queue.clear();
+    kill_timer.Cancel();
+
     children.clear_and_dispose(DeleteDisposer());
 
     CheckVolatileEvent();
@@ -128,13 +224,21 @@ ChildProcessRegistry::Clear()
 
 void
 ChildProcessRegistry::Add(pid_t pid, const char *name, ExitListener *listener)
+{
+    Add(pid, UniqueFileDescriptor(), name, listener);
+}
+
+void
+ChildProcessRegistry::Add(pid_t pid, UniqueFileDescriptor &&pidfd,
+                          const char *name, ExitListener *listener)
 {
     assert(name != nullptr);
 
     if (volatile_event && IsEmpty())
         sigchld_event.Enable();
 
-    auto child = new ChildProcess(event_loop, pid, name, listener);
+    auto child = new ChildProcess(*this, pid, std::move(pidfd),
+                                  name, listener);
 
     children.insert(*child);
 }
@@ -165,7 +269,7 @@ ChildProcessRegistry::Kill(pid_t pid, int signo)
     assert(child->listener != nullptr);
     child->listener = nullptr;
 
-    if (kill(pid, signo) < 0) {
+    if (!child->SendSignal(signo)) {
         logger(1, "failed to kill child process: ", strerror(errno));
 
         /* if we can't kill the process, we can't do much, so let's
@@ -177,7 +281,7 @@ ChildProcessRegistry::Kill(pid_t pid, int signo)
         return;
     }
 
-    child->kill_timeout_event.Add(child_kill_timeout);
+    ScheduleKill(*child, child_kill_timeout);
 }
 
 void
@@ -186,6 +290,78 @@ ChildProcessRegistry::Kill(pid_t pid)
     Kill(pid, SIGTERM);
 }
 
+void
+ChildProcessRegistry::KillAll(int signo,
+                              std::chrono::steady_clock::duration timeout)
+{
+    logger(4, "sending ", strsignal(signo), " to ", children.size(),
+           " child processes");
+
+    for (auto &child : children) {
+        if (!child.SendSignal(signo)) {
+            child.logger(1, "failed to kill child process: ",
+                         strerror(errno));
+            continue;
+        }
+
+        ScheduleKill(child, timeout);
+    }
+}
+
+void
+ChildProcessRegistry::ScheduleKill(ChildProcess &child,
+                                   std::chrono::steady_clock::duration timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    if (child.kill_hook.is_linked()) {
+        if (child.kill_deadline <= deadline)
+            return;
+
+        kill_queue.erase(kill_queue.iterator_to(child));
+    }
+
+    const bool earliest = kill_queue.empty() ||
+        deadline < kill_queue.begin()->kill_deadline;
+
+    child.kill_deadline = deadline;
+    kill_queue.insert(child);
+
+    if (earliest)
+        ScheduleKillTimer();
+}
+
+void
+ChildProcessRegistry::ScheduleKillTimer()
+{
+    if (kill_queue.empty()) {
+        kill_timer.Cancel();
+        return;
+    }
+
+    const auto remaining = kill_queue.begin()->kill_deadline -
+        std::chrono::steady_clock::now();
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(remaining);
+    kill_timer.Add(ToEventDuration(std::max(us, std::chrono::microseconds::zero())));
+}
+
+void
+ChildProcessRegistry::OnKillTimer()
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    while (!kill_queue.empty()) {
+        auto &child = *kill_queue.begin();
+        if (child.kill_deadline > now)
+            break;
+
+        kill_queue.erase(kill_queue.iterator_to(child));
+        child.OnKillTimeout();
+    }
+
+    ScheduleKillTimer();
+}
+
 void
 ChildProcessRegistry::OnExit(pid_t pid, int status,
                              const struct rusage &rusage)
@@ -200,14 +376,37 @@ ChildProcessRegistry::OnExit(pid_t pid, int status,
     delete child;
 }
 
+void
+ChildProcessRegistry::OnExit(ChildProcess &child, int status,
+                             const struct rusage &rusage)
+{
+    Remove(children.iterator_to(child));
+    child.OnExit(status, rusage);
+    delete &child;
+
+    CheckVolatileEvent();
+}
+
 
 void
-ChildProcessRegistry::OnSigChld(int)
+ChildProcessRegistry::OnSigChld(const struct signalfd_siginfo &info)
 {
     pid_t pid;
     int status;
 
     struct rusage rusage;
+
+    if (info.ssi_code == CLD_EXITED || info.ssi_code == CLD_KILLED ||
+        info.ssi_code == CLD_DUMPED) {
+        /* reap the reported child directly */
+        pid = wait4(info.ssi_pid, &status, WNOHANG, &rusage);
+        if (pid > 0)
+            OnExit(pid, status, rusage);
+    }
+
+    /* SIGCHLD is not a real-time signal, so exits which happen
+       while one SIGCHLD is pending are coalesced into one
+       signalfd record; collect those, too */
     while ((pid = wait4(-1, &status, WNOHANG, &rusage)) > 0) {
         OnExit(pid, status, rusage);
     }
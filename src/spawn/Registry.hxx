@@ -36,6 +36,9 @@
 #include "io/Logger.hxx"
 #include "event/TimerEvent.hxx"
 #include "event/SignalEvent.hxx"
+#include "event/SocketEvent.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "memory/SlabAllocator.hxx"
 
 #include "util/Compiler.h"
 
@@ -51,12 +54,17 @@
 class ExitListener;
 
 /**
- * Multiplexer for SIGCHLD.
+ * Multiplexer for SIGCHLD.  Child processes which were registered
+ * with a pidfd are instead monitored with that pidfd and reaped with
+ * waitid(P_PIDFD).
  */
 class ChildProcessRegistry {
 
     struct ChildProcess
-        : boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> {
+        : boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+          SlabAllocated<ChildProcess> {
+
+        ChildProcessRegistry &registry;
 
         const Logger logger;
 
@@ -73,23 +81,56 @@ class ChildProcessRegistry {
         ExitListener *listener;
 
         /**
-         * This timer is set up by child_kill_signal().  If the child
-         * process hasn't exited after a certain amount of time, we send
-         * SIGKILL.
+         * If #kill_hook is linked, then SIGKILL is sent at this time
+         * unless the child process exits before.
+         */
+        std::chrono::steady_clock::time_point kill_deadline;
+
+        typedef boost::intrusive::set_member_hook<boost::intrusive::link_mode<boost::intrusive::safe_link>> KillHook;
+
+        /**
+         * Linked into ChildProcessRegistry::kill_queue by
+         * ChildProcessRegistry::ScheduleKill().
          */
-        TimerEvent kill_timeout_event;
+        KillHook kill_hook;
 
-        ChildProcess(EventLoop &event_loop,
-                     pid_t _pid, const char *_name,
+        /**
+         * A pidfd referring to this child process (may be
+         * undefined).  If defined, then the process was created
+         * without an exit signal, and it is reaped by
+         * OnPidfdReady().
+         */
+        UniqueFileDescriptor pidfd;
+
+        SocketEvent pidfd_event;
+
+        ChildProcess(ChildProcessRegistry &_registry,
+                     pid_t _pid, UniqueFileDescriptor &&_pidfd,
+                     const char *_name,
                      ExitListener *_listener);
 
         void Disable() {
-            kill_timeout_event.Cancel();
+            pidfd_event.Delete();
         }
 
+        /**
+         * Send a signal, using the pidfd if available.
+         *
+         * @return false on error (errno set)
+         */
+        bool SendSignal(int signo);
+
         void OnExit(int status, const struct rusage &rusage);
 
-        void KillTimeoutCallback();
+        void OnKillTimeout();
+
+        void OnPidfdReady(unsigned events);
+
+        struct KillDeadlineCompare {
+            bool operator()(const ChildProcess &a, const ChildProcess &b) const {
+                return a.kill_deadline < b.kill_deadline;
+            }
+        };
 
         struct Compare {
             bool operator()(const ChildProcess &a, const ChildProcess &b) const {
@@ -116,6 +157,23 @@ class ChildProcessRegistry {
 
     ChildProcessSet children;
 
+    typedef boost::intrusive::multiset<ChildProcess,
+                                       boost::intrusive::member_hook<ChildProcess,
+                                                                     ChildProcess::KillHook,
+                                                                     &ChildProcess::kill_hook>,
+                                       boost::intrusive::compare<ChildProcess::KillDeadlineCompare>,
+                                       boost::intrusive::constant_time_size<false>> KillQueue;
+
+    /**
+     * Child processes which have been sent a signal, ordered by
+     * their #ChildProcess::kill_deadline; all of them are serviced
+     * by one #kill_timer, so killing thousands of processes at once
+     * does not arm thousands of timers.
+     */
+    KillQueue kill_queue;
+
+    TimerEvent kill_timer;
+
     SignalEvent sigchld_event;
 
     /**
@@ -152,6 +210,15 @@ public:
      */
     void Add(pid_t pid, const char *name, ExitListener *listener);
 
+    /**
+     * Register a child process which was created with a pidfd
+     * (and without an exit signal), e.g. by SpawnChildProcess().
+     * If the pidfd is undefined, this is equivalent to the other
+     * overload.
+     */
+    void Add(pid_t pid, UniqueFileDescriptor &&pidfd,
+             const char *name, ExitListener *listener);
+
     void SetExitListener(pid_t pid, ExitListener *listener);
 
     /**
@@ -164,6 +231,14 @@ public:
      */
     void Kill(pid_t pid);
 
+    /**
+     * Send a signal to all child processes, and SIGKILL to those
+     * which have not exited after the given duration.  Unlike
+     * Kill(), this does not unregister the processes; their
+     * #ExitListener will be notified as usual.
+     */
+    void KillAll(int signo, std::chrono::steady_clock::duration timeout);
+
     /**
      * Begin shutdown of this subsystem: wait for all children to exit,
      * and then remove the event.
@@ -190,6 +265,12 @@ private:
     void Remove(ChildProcessSet::iterator i) {
         assert(!children.empty());
 
+        if (i->kill_hook.is_linked()) {
+            kill_queue.erase(kill_queue.iterator_to(*i));
+            if (kill_queue.empty())
+                kill_timer.Cancel();
+        }
+
         i->Disable();
 
         children.erase(i);
@@ -200,8 +281,25 @@ private:
             sigchld_event.Disable();
     }
 
+    /**
+     * Send SIGKILL to the given child process if it hasn't exited
+     * after the given duration.  An earlier deadline which was
+     * already scheduled is kept.
+     */
+    void ScheduleKill(ChildProcess &child,
+                      std::chrono::steady_clock::duration timeout);
+
+    /**
+     * Arm #kill_timer for the first item of #kill_queue.
+     */
+    void ScheduleKillTimer();
+
+    void OnKillTimer();
+
     void OnExit(pid_t pid, int status, const struct rusage &rusage);
-    void OnSigChld(int signo);
+    void OnExit(ChildProcess &child, int status,
+                const struct rusage &rusage);
+    void OnSigChld(const struct signalfd_siginfo &info);
 };
 
 #endif
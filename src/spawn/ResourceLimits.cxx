@@ -34,10 +34,12 @@
 #include "system/Error.hxx"
 #include "util/djbhash.h"
 #include "util/CharUtil.hxx"
+#include "util/Hash128.hxx"
 #include "util/Compiler.h"
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 /**
  * glibc has a "__rlimit_resource_t" typedef which maps to "int" in
@@ -83,7 +85,7 @@ ResourceLimit::CompleteFrom(int pid, int resource, const ResourceLimit &src)
 }
 
 gcc_pure
-inline bool
+bool
 ResourceLimits::IsEmpty() const
 {
 	for (const auto &i : values)
@@ -112,6 +114,18 @@ ResourceLimits::MakeId(char *p) const
 	return p;
 }
 
+void
+ResourceLimits::MakeHash(Hash128Builder &h) const noexcept
+{
+	h.Update(values, sizeof(values));
+}
+
+bool
+ResourceLimits::IsSameId(const ResourceLimits &other) const noexcept
+{
+	return memcmp(values, other.values, sizeof(values)) == 0;
+}
+
 /**
  * Replace ResourceLimit::UNDEFINED with current values.
  */
@@ -33,8 +33,12 @@
 #ifndef BENG_PROXY_RESOURCE_LIMITS_HXX
 #define BENG_PROXY_RESOURCE_LIMITS_HXX
 
+#include "util/Compiler.h"
+
 #include <sys/resource.h>
 
+class Hash128Builder;
+
 struct ResourceLimit : rlimit {
 	static constexpr rlim_t UNDEFINED = rlim_t(-2);
 
@@ -79,6 +83,14 @@ struct ResourceLimits {
 
 	char *MakeId(char *p) const;
 
+	/**
+	 * Hash the same attributes as MakeId().
+	 */
+	void MakeHash(Hash128Builder &h) const noexcept;
+
+	gcc_pure
+	bool IsSameId(const ResourceLimits &other) const noexcept;
+
 	/**
 	 * Throws std::system_error on error.
 	 */
@@ -31,9 +31,47 @@
  */
 
 #include "SeccompFilter.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+
+#ifndef PR_SET_NO_NEW_PRIVS
+#define PR_SET_NO_NEW_PRIVS 38
+#endif
 
 namespace Seccomp {
 
+void
+Program::Install() const
+{
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
+        throw MakeErrno("prctl(PR_SET_NO_NEW_PRIVS) failed");
+
+    struct sock_fprog prog;
+    prog.len = (unsigned short)instructions.size();
+    prog.filter = const_cast<struct sock_filter *>(instructions.data());
+
+    if (syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER, 0, &prog) < 0)
+        throw MakeErrno("seccomp(SECCOMP_SET_MODE_FILTER) failed");
+}
+
+bool
+Program::TryInstall() const noexcept
+{
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
+        return false;
+
+    struct sock_fprog prog;
+    prog.len = (unsigned short)instructions.size();
+    prog.filter = const_cast<struct sock_filter *>(instructions.data());
+
+    return syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER, 0, &prog) == 0;
+}
+
 Filter::Filter(uint32_t def_action)
     :ctx(seccomp_init(def_action))
 {
@@ -57,6 +95,53 @@ Filter::Load() const
         throw MakeErrno(-error, "seccomp_load() failed");
 }
 
+Program
+Filter::Export() const
+{
+    /* the kernel limits BPF programs to BPF_MAXINSNS instructions,
+       which fits into the pipe buffer, so we can write it completely
+       before reading it; the pipe is non-blocking so a larger
+       program fails instead of blocking forever */
+    UniqueFileDescriptor r, w;
+    if (!UniqueFileDescriptor::CreatePipeNonBlock(r, w))
+        throw MakeErrno("pipe() failed");
+
+    int error = seccomp_export_bpf(ctx, w.Get());
+    if (error < 0)
+        throw MakeErrno(-error, "seccomp_export_bpf() failed");
+
+    w.Close();
+
+    std::vector<struct sock_filter> instructions;
+    struct sock_filter buffer[256];
+    size_t fill = 0;
+
+    while (true) {
+        ssize_t nbytes = r.Read((char *)buffer + fill,
+                                sizeof(buffer) - fill);
+        if (nbytes < 0)
+            throw MakeErrno("Failed to read BPF program");
+
+        fill += nbytes;
+
+        const size_t n = fill / sizeof(buffer[0]);
+        instructions.insert(instructions.end(), buffer, buffer + n);
+
+        const size_t rest = fill % sizeof(buffer[0]);
+        memmove(buffer, (const char *)buffer + n * sizeof(buffer[0]), rest);
+        fill = rest;
+
+        if (nbytes == 0)
+            break;
+    }
+
+    if (fill > 0 || instructions.empty() ||
+        instructions.size() > BPF_MAXINSNS)
+        throw std::runtime_error("Malformed BPF program");
+
+    return Program(std::move(instructions));
+}
+
 void
 Filter::AddArch(uint32_t arch_token)
 {
@@ -38,9 +38,41 @@
 #include "seccomp.h"
 
 #include <stdexcept>
+#include <vector>
+
+#include <linux/filter.h>
 
 namespace Seccomp {
 
+/**
+ * A compiled BPF program exported from a #Filter.  Unlike #Filter,
+ * it can be installed without libseccomp and without allocating
+ * memory, and it can be reused for many processes.
+ */
+class Program {
+    std::vector<struct sock_filter> instructions;
+
+public:
+    explicit Program(std::vector<struct sock_filter> &&_instructions)
+        :instructions(std::move(_instructions)) {}
+
+    /**
+     * Install this program in the current process (after setting
+     * PR_SET_NO_NEW_PRIVS, just like seccomp_load() does).
+     *
+     * Throws std::system_error on error.
+     */
+    void Install() const;
+
+    /**
+     * Like Install(), but without exceptions (for use in a
+     * CLONE_VM child process).
+     *
+     * @return false on error (with errno set)
+     */
+    bool TryInstall() const noexcept;
+};
+
 class Filter {
     const scmp_filter_ctx ctx;
 
@@ -64,6 +96,13 @@ public:
 
     void Load() const;
 
+    /**
+     * Compile this filter to a BPF program.
+     *
+     * Throws std::runtime_error on error.
+     */
+    Program Export() const;
+
     void AddArch(uint32_t arch_token);
     void AddSecondaryArchs() noexcept;
 
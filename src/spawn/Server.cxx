@@ -40,17 +40,37 @@
 #include "MountList.hxx"
 #include "CgroupState.hxx"
 #include "Direct.hxx"
+#include "Zygote.hxx"
+#include "MountNamespaceCache.hxx"
+#include "MountTreeCache.hxx"
+#include "ExecutableCache.hxx"
+#include "NetworkNamespaceCache.hxx"
+#include "CgroupCache.hxx"
+#include "NumaBalancer.hxx"
+#include "Stats.hxx"
 #include "Registry.hxx"
 #include "ExitListener.hxx"
+#include "MemfdPayload.hxx"
+#include "memory/Arena.hxx"
+#include "memory/SlabAllocator.hxx"
 #include "event/SocketEvent.hxx"
+#include "event/DeferEvent.hxx"
 #include "net/UniqueSocketDescriptor.hxx"
+#include "net/MultiReceiveMessage.hxx"
 #include "net/ReceiveMessage.hxx"
+#include "net/SendMessage.hxx"
+#include "net/ScmRightsBuilder.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 #include "util/DeleteDisposer.hxx"
+#include "util/DestructObserver.hxx"
+#include "util/ScopeExit.hxx"
 #include "util/ConstBuffer.hxx"
 #include "util/StaticArray.hxx"
 #include "util/PrintException.hxx"
 #include "util/Exception.hxx"
+#include "util/Macros.hxx"
+#include "util/Compiler.h"
+#include "system/Error.hxx"
 
 #include <boost/intrusive/list.hpp>
 
@@ -58,6 +78,8 @@
 #include <algorithm>
 #include <memory>
 #include <map>
+#include <deque>
+#include <vector>
 
 #include <unistd.h>
 #include <sys/socket.h>
@@ -104,20 +126,30 @@ public:
 
 class SpawnServerConnection;
 
-class SpawnServerChild final : public ExitListener {
+class SpawnServerChild final
+	: public ExitListener, public SlabAllocated<SpawnServerChild> {
 	SpawnServerConnection &connection;
 
+	SpawnStats &stats;
+
 	const int id;
 
 	const pid_t pid;
 
 	const std::string name;
 
+	/**
+	 * The key for SpawnStats::usage.
+	 */
+	const std::string stats_key;
+
 public:
 	explicit SpawnServerChild(SpawnServerConnection &_connection,
+				  SpawnStats &_stats,
 				  int _id, pid_t _pid,
-				  const char *_name)
-		:connection(_connection), id(_id), pid(_pid), name(_name) {}
+				  const char *_name, const char *_stats_key)
+		:connection(_connection), stats(_stats),
+		 id(_id), pid(_pid), name(_name), stats_key(_stats_key) {}
 
 	SpawnServerChild(const SpawnServerChild &) = delete;
 	SpawnServerChild &operator=(const SpawnServerChild &) = delete;
@@ -133,6 +165,10 @@ public:
 	/* virtual methods from ExitListener */
 	void OnChildProcessExit(int status) override;
 
+	void OnChildProcessUsage(const struct rusage &ru) override {
+		stats.AddUsage(stats_key.c_str(), ru);
+	}
+
 	/* boost::instrusive::set hooks */
 	typedef boost::intrusive::set_member_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> IdHook;
 	IdHook id_hook;
@@ -152,8 +188,81 @@ public:
 	};
 };
 
+/**
+ * Kill a child process which nobody is interested in anymore, and
+ * let the #ChildProcessRegistry reap it.
+ */
+static void
+DiscardChildProcess(ChildProcessRegistry &registry, pid_t pid,
+		    UniqueFileDescriptor &&pidfd, const char *name)
+{
+	kill(pid, SIGTERM);
+	registry.Add(pid, std::move(pidfd), name, nullptr);
+}
+
+/**
+ * An EXEC request which has been submitted to a #SpawnServerWorker
+ * (or which has completed after such a request), but which has not
+ * yet been committed to its #SpawnServerConnection.  Results are
+ * committed in the order the requests were received, so the client
+ * sees EXIT messages for failed requests in the same order as
+ * without workers.
+ */
+struct SpawnServerPendingChild
+	: boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> {
+
+	/**
+	 * The connection which has submitted this request; nullptr
+	 * if the connection has been closed meanwhile.
+	 */
+	SpawnServerConnection *connection;
+
+	const int id;
+
+	const std::string name, stats_key;
+
+	/**
+	 * When was the request received?
+	 */
+	const std::chrono::steady_clock::time_point start_time;
+
+	/**
+	 * The signal received with a KILL request before the child
+	 * process was registered; 0 if none.
+	 */
+	int kill_signo = 0;
+
+	/**
+	 * Has the result arrived?
+	 */
+	bool done = false;
+
+	/**
+	 * The new process id or -1 if spawning has failed.
+	 */
+	pid_t pid = -1;
+
+	UniqueFileDescriptor pidfd;
+
+	SpawnServerPendingChild(SpawnServerConnection *_connection,
+				int _id, const char *_name,
+				const char *_stats_key,
+				std::chrono::steady_clock::time_point _start_time)
+		:connection(_connection), id(_id),
+		 name(_name), stats_key(_stats_key),
+		 start_time(_start_time) {}
+
+	/**
+	 * The result has arrived.  This may destroy this object and
+	 * the connection.
+	 */
+	void Complete(ChildProcessRegistry &registry,
+		      pid_t _pid, UniqueFileDescriptor &&_pidfd);
+};
+
 class SpawnServerConnection
-	: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> {
+	: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+	  DestructAnchor {
 	SpawnServerProcess &process;
 	UniqueSocketDescriptor socket;
 
@@ -161,6 +270,37 @@ class SpawnServerConnection
 
 	SocketEvent event;
 
+	/**
+	 * Waits for the socket to become writable while #exit_batch
+	 * could not be sent.
+	 */
+	SocketEvent write_event;
+
+	/**
+	 * Sends #exit_batch.
+	 */
+	DeferEvent flush_exit_event;
+
+	struct ExitRecord {
+		int id, status;
+	};
+
+	/**
+	 * EXIT records which have not yet been sent (only if
+	 * #batching is enabled).
+	 */
+	std::vector<ExitRecord> exit_batch;
+
+	/**
+	 * A reusable buffer for SpawnSerializer.
+	 */
+	std::vector<uint8_t> send_buffer;
+
+	/**
+	 * Has the client negotiated #SpawnConnectFlags::BATCH?
+	 */
+	bool batching = false;
+
 	typedef boost::intrusive::set<SpawnServerChild,
 				      boost::intrusive::member_hook<SpawnServerChild,
 								    SpawnServerChild::IdHook,
@@ -168,6 +308,26 @@ class SpawnServerConnection
 				      boost::intrusive::compare<SpawnServerChild::CompareId>> ChildIdMap;
 	ChildIdMap children;
 
+	/**
+	 * EXEC requests which have not yet been committed, in the
+	 * order they were received.
+	 */
+	typedef boost::intrusive::list<SpawnServerPendingChild,
+				       boost::intrusive::constant_time_size<false>> PendingList;
+	PendingList pending;
+
+	/**
+	 * Profiles registered with #SpawnRequestCommand::PROFILE.
+	 */
+	std::map<uint16_t, std::vector<uint8_t>> profiles;
+
+	/**
+	 * Allocates the objects referenced by the
+	 * #PreparedChildProcess of one EXEC request (see
+	 * #SpawnExecStorage).
+	 */
+	Arena exec_arena;
+
 public:
 	SpawnServerConnection(SpawnServerProcess &_process,
 			      UniqueSocketDescriptor &&_socket);
@@ -175,18 +335,66 @@ public:
 
 	void OnChildProcessExit(int id, int status, SpawnServerChild *child);
 
+	/**
+	 * Commit all completed requests at the front of #pending.
+	 * This may destroy this object.
+	 */
+	void CommitPending();
+
+	void ApplyConnectFlags(uint8_t flags) {
+		batching = flags & uint8_t(SpawnConnectFlags::BATCH);
+	}
+
 private:
 	void RemoveConnection();
 
 	void SendExit(int id, int status);
-	void SpawnChild(int id, const char *name, PreparedChildProcess &&p);
 
-	void HandleExecMessage(SpawnPayload payload, SpawnFdList &&fds);
+	/**
+	 * Send as much of #exit_batch as possible with sendmmsg().  If
+	 * the socket buffer is full, wait for #write_event instead of
+	 * blocking.
+	 */
+	void FlushExitBatch() noexcept;
+
+	/**
+	 * Register the new child process (or report the failure to
+	 * the client if #pid is negative).
+	 */
+	void Commit(int id, const char *name, const char *stats_key,
+		    pid_t pid, UniqueFileDescriptor &&pidfd, int kill_signo);
+
+	/**
+	 * Like Commit(), but wait for earlier requests which are still
+	 * pending.
+	 */
+	void CommitOrQueue(int id, const char *name, const char *stats_key,
+			   pid_t pid, UniqueFileDescriptor &&pidfd);
+
+	void SpawnChild(int id, const char *name, PreparedChildProcess &&p,
+			ConstBuffer<uint8_t> request,
+			std::chrono::steady_clock::time_point start_time);
+
+	void HandleExecMessage(SpawnPayload payload, SpawnFdList &fds);
+	void HandleExecBatchMessage(ConstBuffer<uint8_t> payload,
+				    SpawnFdList &&fds);
 	void HandleKillMessage(SpawnPayload payload, SpawnFdList &&fds);
+	void HandleStatsMessage(ConstBuffer<uint8_t> payload,
+				SpawnFdList &&fds);
+	void HandleProfileMessage(ConstBuffer<uint8_t> payload,
+				  SpawnFdList &&fds);
+	void HandleMemfdMessage(ConstBuffer<uint8_t> payload,
+				SpawnFdList &&fds);
+	void HandleConnectMessage(ConstBuffer<uint8_t> payload,
+				  SpawnFdList &&fds);
 	void HandleMessage(ConstBuffer<uint8_t> payload, SpawnFdList &&fds);
-	void HandleMessage(ReceiveMessageResult &&result);
+	void HandleMessage(MultiReceiveMessage::Datagram &d);
 
 	void ReadEventCallback(unsigned events);
+
+	void OnWritable(unsigned) noexcept {
+		FlushExitBatch();
+	}
 };
 
 void
@@ -205,6 +413,68 @@ SpawnServerConnection::OnChildProcessExit(int id, int status,
 	SendExit(id, status);
 }
 
+/**
+ * A helper process which sets up new child processes, so the
+ * expensive parts (namespaces, mounts, seccomp) do not block the
+ * spawner's event loop.  It receives the raw EXEC request plus the
+ * file descriptors, and replies with the process id and a pidfd.
+ * The child processes are created with CLONE_PARENT, i.e. they are
+ * children of the spawner.
+ */
+class SpawnServerWorker final
+	: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+	  public ExitListener {
+
+	SpawnServerProcess &process;
+
+	UniqueSocketDescriptor socket;
+
+	const pid_t pid;
+
+	SocketEvent event;
+
+	/**
+	 * Requests which have been submitted, but not yet answered,
+	 * in the order they were submitted.
+	 */
+	std::deque<SpawnServerPendingChild *> queue;
+
+public:
+	SpawnServerWorker(SpawnServerProcess &_process,
+			  UniqueSocketDescriptor &&_socket, pid_t _pid);
+	~SpawnServerWorker();
+
+	SpawnServerWorker(const SpawnServerWorker &) = delete;
+	SpawnServerWorker &operator=(const SpawnServerWorker &) = delete;
+
+	size_t GetQueueSize() const {
+		return queue.size();
+	}
+
+	/**
+	 * Forward an EXEC request to the worker process.  Throws on
+	 * error (e.g. if the socket buffer is full).
+	 *
+	 * @param request the EXEC payload after the command byte
+	 */
+	void Submit(SpawnServerPendingChild &child,
+		    ConstBuffer<uint8_t> request,
+		    const PreparedChildProcess &p);
+
+	void Kill();
+
+	/**
+	 * Fail all requests which have not been answered yet.
+	 */
+	void FailAll();
+
+private:
+	void OnSocketReady(unsigned events) noexcept;
+
+	/* virtual methods from ExitListener */
+	void OnChildProcessExit(int status) override;
+};
+
 class SpawnServerProcess {
 	const SpawnConfig config;
 	const CgroupState &cgroup_state;
@@ -216,17 +486,65 @@ class SpawnServerProcess {
 
 	ChildProcessRegistry child_process_registry;
 
+	SpawnZygoteStock zygotes;
+
+	MountNamespaceCache mount_namespaces;
+
+	MountTreeCache mount_trees;
+
+	ExecutableCache executables;
+
+	NetworkNamespaceCache network_namespaces;
+
+	CgroupCache cgroups;
+
+	NumaBalancer numa;
+
+	SpawnStats stats;
+
+	typedef boost::intrusive::list<SpawnServerWorker,
+				       boost::intrusive::constant_time_size<false>> WorkerList;
+	WorkerList workers;
+
 	typedef boost::intrusive::list<SpawnServerConnection,
 				       boost::intrusive::constant_time_size<false>> ConnectionList;
 	ConnectionList connections;
 
+	/**
+	 * Receives requests for all connections; there is only one
+	 * thread, and the datagrams are handled before the next
+	 * Receive() call.
+	 */
+	MultiReceiveMessage receive{
+		16, SPAWN_MAX_REQUEST_SIZE,
+		CMSG_SPACE(sizeof(int) * SPAWN_MAX_REQUEST_FDS),
+		SPAWN_MAX_REQUEST_FDS,
+	};
+
 public:
 	SpawnServerProcess(const SpawnConfig &_config,
 			   const CgroupState &_cgroup_state,
 			   SpawnHook *_hook)
 		:config(_config), cgroup_state(_cgroup_state), hook(_hook),
 		 logger("spawn"),
-		 child_process_registry(loop) {}
+		 child_process_registry(loop),
+		 zygotes(child_process_registry, cgroup_state,
+			 config.max_zygotes),
+		 mount_namespaces(config.max_mount_namespaces),
+		 mount_trees(config.max_mount_trees),
+		 executables(config.max_executables),
+		 network_namespaces(loop),
+		 cgroups(cgroup_state) {
+		for (unsigned i = 0; i < config.spawn_workers; ++i) {
+			try {
+				StartWorker();
+			} catch (...) {
+				logger(1, "Failed to start spawn worker: ",
+				       GetFullMessage(std::current_exception()).c_str());
+				break;
+			}
+		}
+	}
 
 	const SpawnConfig &GetConfig() const {
 		return config;
@@ -244,13 +562,100 @@ public:
 		return child_process_registry;
 	}
 
+	SpawnZygoteStock &GetZygotes() {
+		return zygotes;
+	}
+
+	MountNamespaceCache &GetMountNamespaces() {
+		return mount_namespaces;
+	}
+
+	MountTreeCache &GetMountTrees() {
+		return mount_trees;
+	}
+
+	ExecutableCache &GetExecutables() {
+		return executables;
+	}
+
+	NetworkNamespaceCache &GetNetworkNamespaces() {
+		return network_namespaces;
+	}
+
+	CgroupCache &GetCgroups() {
+		return cgroups;
+	}
+
+	NumaBalancer &GetNumaBalancer() {
+		return numa;
+	}
+
+	SpawnStats &GetStats() {
+		return stats;
+	}
+
+	/**
+	 * Account for the result of an EXEC request.
+	 */
+	void AddSpawnResult(bool success,
+			    std::chrono::steady_clock::time_point start_time,
+			    const SpawnChildTimings &timings) {
+		if (!success) {
+			++stats.failed;
+			return;
+		}
+
+		++stats.spawned;
+		stats.AddLatency(SpawnPhase::TOTAL,
+				 std::chrono::steady_clock::now() - start_time);
+
+		if (timings.clone.count() > 0)
+			stats.AddLatency(SpawnPhase::CLONE, timings.clone);
+		if (timings.user_ns.count() > 0)
+			stats.AddLatency(SpawnPhase::USER_NS, timings.user_ns);
+		if (timings.uid_map.count() > 0)
+			stats.AddLatency(SpawnPhase::UID_MAP, timings.uid_map);
+	}
+
+	MultiReceiveMessage &GetReceiveMessage() {
+		return receive;
+	}
+
+	bool HasWorkers() const {
+		return !workers.empty();
+	}
+
+	/**
+	 * Returns the worker with the fewest pending requests or
+	 * nullptr if there are no workers.
+	 */
+	SpawnServerWorker *FindWorker() {
+		SpawnServerWorker *best = nullptr;
+		for (auto &i : workers)
+			if (best == nullptr ||
+			    i.GetQueueSize() < best->GetQueueSize())
+				best = &i;
+		return best;
+	}
+
+	void LogWorkerError(std::exception_ptr ep) {
+		logger(1, "Spawn worker failed: ", GetFullMessage(ep).c_str());
+	}
+
+	void RemoveWorker(SpawnServerWorker &worker) {
+		workers.erase(workers.iterator_to(worker));
+		worker.FailAll();
+		delete &worker;
+	}
+
 	bool Verify(const PreparedChildProcess &p) const {
 		return hook != nullptr && hook->Verify(p);
 	}
 
-	void AddConnection(UniqueSocketDescriptor &&_socket) {
+	SpawnServerConnection &AddConnection(UniqueSocketDescriptor &&_socket) {
 		auto connection = new SpawnServerConnection(*this, std::move(_socket));
 		connections.push_back(*connection);
+		return *connection;
 	}
 
 	void RemoveConnection(SpawnServerConnection &connection) {
@@ -265,9 +670,23 @@ public:
 	void Run();
 
 private:
+	void StartWorker();
+
 	void Quit() {
 		assert(connections.empty());
 
+		workers.clear_and_dispose([](SpawnServerWorker *worker){
+				worker->Kill();
+				worker->FailAll();
+				delete worker;
+			});
+
+		zygotes.Clear();
+		mount_namespaces.Clear();
+		mount_trees.Clear();
+		executables.Clear();
+		network_namespaces.Clear();
+		cgroups.Clear();
 		child_process_registry.SetVolatile();
 	}
 };
@@ -278,19 +697,39 @@ SpawnServerConnection::SpawnServerConnection(SpawnServerProcess &_process,
 	 logger("spawn"),
 	 event(process.GetEventLoop(), socket.Get(),
 	       SocketEvent::READ|SocketEvent::PERSIST,
-	       BIND_THIS_METHOD(ReadEventCallback)) {
+	       BIND_THIS_METHOD(ReadEventCallback)),
+	 write_event(process.GetEventLoop(), socket.Get(),
+		     SocketEvent::WRITE,
+		     BIND_THIS_METHOD(OnWritable)),
+	 flush_exit_event(process.GetEventLoop(),
+			  BIND_THIS_METHOD(FlushExitBatch)) {
 	event.Add();
 }
 
 SpawnServerConnection::~SpawnServerConnection()
 {
 	event.Delete();
+	write_event.Delete();
+	flush_exit_event.Cancel();
 
 	auto &registry = process.GetChildProcessRegistry();
 	children.clear_and_dispose([&registry](SpawnServerChild *child){
 			child->Kill(registry, SIGTERM);
 			delete child;
 		});
+
+	pending.clear_and_dispose([&registry](SpawnServerPendingChild *c){
+			if (c->done) {
+				if (c->pid >= 0)
+					DiscardChildProcess(registry, c->pid,
+							    std::move(c->pidfd),
+							    c->name.c_str());
+				delete c;
+			} else
+				/* still owned by the worker, which will
+				   dispose it when the result arrives */
+				c->connection = nullptr;
+		});
 }
 
 inline void
@@ -302,7 +741,17 @@ SpawnServerConnection::RemoveConnection()
 void
 SpawnServerConnection::SendExit(int id, int status)
 {
-	SpawnSerializer s(SpawnResponseCommand::EXIT);
+	if (batching) {
+		exit_batch.push_back({id, status});
+
+		/* if we're waiting for the socket to become writable,
+		   the record will be sent by OnWritable() */
+		if (!write_event.IsPending(SocketEvent::WRITE))
+			flush_exit_event.Schedule();
+		return;
+	}
+
+	SpawnSerializer s(send_buffer, SpawnResponseCommand::EXIT);
 	s.WriteInt(id);
 	s.WriteInt(status);
 
@@ -343,11 +792,216 @@ SpawnServerConnection::SendExit(int id, int status)
 	}
 }
 
+void
+SpawnServerConnection::FlushExitBatch() noexcept
+{
+	constexpr size_t MAX_DATAGRAMS = 16;
+
+	flush_exit_event.Cancel();
+
+	while (!exit_batch.empty()) {
+		uint8_t buffers[MAX_DATAGRAMS][SPAWN_MAX_RESPONSE_SIZE];
+		struct iovec iovs[MAX_DATAGRAMS];
+		struct mmsghdr msgs[MAX_DATAGRAMS];
+
+		size_t n = 0, position = 0;
+		while (n < MAX_DATAGRAMS && position < exit_batch.size()) {
+			const size_t count = std::min(exit_batch.size() - position,
+						      SPAWN_MAX_EXIT_BATCH);
+
+			uint8_t *p = buffers[n];
+			*p++ = uint8_t(SpawnResponseCommand::EXIT_BATCH);
+
+			for (size_t i = position; i < position + count; ++i) {
+				const auto &r = exit_batch[i];
+				memcpy(p, &r.id, sizeof(r.id));
+				p += sizeof(r.id);
+				memcpy(p, &r.status, sizeof(r.status));
+				p += sizeof(r.status);
+			}
+
+			iovs[n].iov_base = buffers[n];
+			iovs[n].iov_len = p - buffers[n];
+
+			auto &msg = msgs[n].msg_hdr;
+			msg.msg_name = nullptr;
+			msg.msg_namelen = 0;
+			msg.msg_iov = &iovs[n];
+			msg.msg_iovlen = 1;
+			msg.msg_control = nullptr;
+			msg.msg_controllen = 0;
+			msg.msg_flags = 0;
+
+			position += count;
+			++n;
+		}
+
+		int result = sendmmsg(socket.Get(), msgs, n,
+				      MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (result < 0) {
+			if (errno == EAGAIN) {
+				/* the client may be busy, while the datagram
+				   queue has filled (see
+				   /proc/sys/net/unix/max_dgram_qlen); keep
+				   collecting records until it catches up */
+				write_event.Add();
+				return;
+			}
+
+			logger(1, "Failed to send EXIT to worker: ",
+			       strerror(errno));
+			RemoveConnection();
+			return;
+		}
+
+		/* all datagrams but the last one are full */
+		const size_t sent = size_t(result) == n
+			? position
+			: size_t(result) * SPAWN_MAX_EXIT_BATCH;
+		exit_batch.erase(exit_batch.begin(), exit_batch.begin() + sent);
+
+		if (size_t(result) < n) {
+			write_event.Add();
+			return;
+		}
+	}
+}
+
+void
+SpawnServerConnection::Commit(int id, const char *name,
+			      const char *stats_key,
+			      pid_t pid, UniqueFileDescriptor &&pidfd,
+			      int kill_signo)
+{
+	if (pid < 0) {
+		SendExit(id, W_EXITCODE(0xff, 0));
+		return;
+	}
+
+	auto &registry = process.GetChildProcessRegistry();
+
+	if (kill_signo != 0) {
+		/* the client has already sent KILL */
+		kill(pid, kill_signo);
+		registry.Add(pid, std::move(pidfd), name, nullptr);
+		return;
+	}
+
+	auto *child = new SpawnServerChild(*this, process.GetStats(),
+					   id, pid, name, stats_key);
+	children.insert(*child);
+
+	registry.Add(pid, std::move(pidfd), name, child);
+}
+
+void
+SpawnServerConnection::CommitOrQueue(int id, const char *name,
+				     const char *stats_key,
+				     pid_t pid, UniqueFileDescriptor &&pidfd)
+{
+	if (pending.empty()) {
+		Commit(id, name, stats_key, pid, std::move(pidfd), 0);
+		return;
+	}
+
+	/* earlier requests are still being handled by a worker */
+	auto *c = new SpawnServerPendingChild(this, id, name, stats_key,
+					      std::chrono::steady_clock::time_point());
+	c->done = true;
+	c->pid = pid;
+	c->pidfd = std::move(pidfd);
+	pending.push_back(*c);
+}
+
+void
+SpawnServerConnection::CommitPending()
+{
+	const DestructObserver destructed(*this);
+
+	while (!pending.empty() && pending.front().done) {
+		std::unique_ptr<SpawnServerPendingChild> c(&pending.front());
+		pending.pop_front();
+
+		Commit(c->id, c->name.c_str(), c->stats_key.c_str(),
+		       c->pid, std::move(c->pidfd), c->kill_signo);
+
+		if (destructed)
+			return;
+	}
+}
+
+void
+SpawnServerPendingChild::Complete(ChildProcessRegistry &registry,
+				  pid_t _pid, UniqueFileDescriptor &&_pidfd)
+{
+	if (connection == nullptr) {
+		/* the connection has been closed meanwhile */
+		if (_pid >= 0)
+			DiscardChildProcess(registry, _pid, std::move(_pidfd),
+					    name.c_str());
+		delete this;
+		return;
+	}
+
+	done = true;
+	pid = _pid;
+	pidfd = std::move(_pidfd);
+	connection->CommitPending();
+}
+
+/**
+ * Copy the request to the given buffer and append the commands
+ * which transfer the NUMA placement chosen by the spawner.  They
+ * are parsed after the original commands, and thus override them.
+ *
+ * @return the new request or nullptr if it is too large for a
+ * worker
+ */
+static ConstBuffer<uint8_t>
+AppendPlacement(std::vector<uint8_t> &dest, ConstBuffer<uint8_t> request,
+		const PlacementOptions &placement)
+{
+	const auto cpu_affinity = SpawnExecCommand::CPU_AFFINITY;
+	const auto memory_policy = SpawnExecCommand::MEMORY_POLICY;
+
+	dest.reserve(request.size + 2 + sizeof(placement.cpus) +
+		     sizeof(placement.memory_policy) +
+		     sizeof(placement.memory_nodes));
+	dest.insert(dest.end(), request.begin(), request.end());
+
+	auto append = [&dest](const void *p, size_t size){
+		dest.insert(dest.end(), (const uint8_t *)p,
+			    (const uint8_t *)p + size);
+	};
+
+	append(&cpu_affinity, sizeof(cpu_affinity));
+	append(&placement.cpus, sizeof(placement.cpus));
+	append(&memory_policy, sizeof(memory_policy));
+	append(&placement.memory_policy, sizeof(placement.memory_policy));
+	append(&placement.memory_nodes, sizeof(placement.memory_nodes));
+
+	if (dest.size() > SPAWN_MAX_REQUEST_SIZE)
+		return nullptr;
+
+	return {dest.data(), dest.size()};
+}
+
 inline void
 SpawnServerConnection::SpawnChild(int id, const char *name,
-				  PreparedChildProcess &&p)
+				  PreparedChildProcess &&p,
+				  ConstBuffer<uint8_t> request,
+				  std::chrono::steady_clock::time_point start_time)
 {
 	const auto &config = process.GetConfig();
+	auto &stats = process.GetStats();
+
+	++stats.requests;
+
+	/* copy the cgroup name, because it points into the
+	   PreparedChildProcess, which will be consumed */
+	const std::string stats_key = p.cgroup.name != nullptr
+		? p.cgroup.name
+		: name;
 
 	if (!p.uid_gid.IsEmpty()) {
 		try {
@@ -355,7 +1009,9 @@ SpawnServerConnection::SpawnChild(int id, const char *name,
 				config.Verify(p.uid_gid);
 		} catch (const std::exception &e) {
 			PrintException(e);
-			SendExit(id, W_EXITCODE(0xff, 0));
+			++stats.rejected;
+			CommitOrQueue(id, name, stats_key.c_str(),
+				      -1, UniqueFileDescriptor());
 			return;
 		}
 	}
@@ -363,29 +1019,104 @@ SpawnServerConnection::SpawnChild(int id, const char *name,
 	if (p.uid_gid.IsEmpty()) {
 		if (config.default_uid_gid.IsEmpty()) {
 			logger(1, "No uid/gid specified");
-			SendExit(id, W_EXITCODE(0xff, 0));
+			++stats.rejected;
+			CommitOrQueue(id, name, stats_key.c_str(),
+				      -1, UniqueFileDescriptor());
 			return;
 		}
 
 		p.uid_gid = config.default_uid_gid;
 	}
 
+	/* the request with the placement chosen by the
+	   #NumaBalancer appended, for workers */
+	std::vector<uint8_t> placed;
+
+	if (p.placement.auto_node) {
+		auto &numa = process.GetNumaBalancer();
+		if (numa.IsEnabled()) {
+			numa.Place(p.placement, start_time);
+
+			if (!request.IsNull())
+				request = AppendPlacement(placed, request,
+							  p.placement);
+		}
+	}
+
+	auto &zygotes = process.GetZygotes();
+	/* the zygote key is bounded only for requests which fit into
+	   a datagram (see ZYGOTE_MAX_ID_SIZE); larger ones were
+	   received in a memfd and are spawned directly */
+	const bool use_zygote = zygotes.IsEnabled() && !request.IsNull() &&
+		IsZygoteCompatible(p);
+
+	if (!use_zygote && !request.IsNull()) {
+		auto *worker = process.FindWorker();
+		if (worker != nullptr) {
+			auto *c = new SpawnServerPendingChild(this, id, name,
+							      stats_key.c_str(),
+							      start_time);
+
+			try {
+				worker->Submit(*c, request, p);
+				pending.push_back(*c);
+				return;
+			} catch (...) {
+				/* fall back to spawning the child
+				   process right here */
+				logger(2, "Failed to submit to spawn worker: ",
+				       GetFullMessage(std::current_exception()).c_str());
+				delete c;
+			}
+		}
+	}
+
 	pid_t pid;
+	UniqueFileDescriptor pidfd;
+	SpawnChildTimings timings;
 
 	try {
-		pid = SpawnChildProcess(std::move(p),
-					process.GetCgroupState());
+		auto &mount_namespaces = process.GetMountNamespaces();
+
+		if (use_zygote) {
+			pid = zygotes.Spawn(p);
+		} else {
+			if (mount_namespaces.IsEnabled() &&
+			    MountNamespaceCache::IsCacheable(p.ns))
+				p.mount_namespace_fd =
+					mount_namespaces.Get(p.ns.mount).Get();
+
+			auto &mount_trees = process.GetMountTrees();
+			if (p.mount_namespace_fd < 0 && p.ns.mount.enable_mount &&
+			    mount_trees.IsEnabled())
+				mount_trees.Prepare(p.ns.mount);
+
+			auto &executables = process.GetExecutables();
+			if (executables.IsEnabled())
+				executables.Prepare(p);
+
+			if (p.ns.network_namespace != nullptr)
+				p.network_namespace_fd = process.GetNetworkNamespaces()
+					.Get(p.ns.network_namespace).Get();
+
+			if (p.cgroup.IsDefined() &&
+			    process.GetCgroupState().IsEnabled())
+				p.cgroup_fd = process.GetCgroups()
+					.Get(p.cgroup).Get();
+
+			pid = SpawnChildProcess(std::move(p),
+						process.GetCgroupState(),
+						&pidfd, false, &timings);
+		}
 	} catch (...) {
 		logger(1, "Failed to spawn child process: ",
 		       GetFullMessage(std::current_exception()).c_str());
-		SendExit(id, W_EXITCODE(0xff, 0));
-		return;
+		pid = -1;
 	}
 
-	auto *child = new SpawnServerChild(*this, id, pid, name);
-	children.insert(*child);
+	process.AddSpawnResult(pid >= 0, start_time, timings);
 
-	process.GetChildProcessRegistry().Add(pid, name, child);
+	CommitOrQueue(id, name, stats_key.c_str(), pid, std::move(pidfd));
 }
 
 static void
@@ -413,22 +1144,61 @@ Read(SpawnPayload &payload, UidGid &uid_gid)
 		uid_gid.groups[n_groups] = 0;
 }
 
-inline void
-SpawnServerConnection::HandleExecMessage(SpawnPayload payload,
-					 SpawnFdList &&fds)
-{
-	int id;
-	payload.ReadInt(id);
-	const char *name = payload.ReadString();
+/**
+ * Memory owned by a #PreparedChildProcess parsed by
+ * ParseExecCommands().
+ */
+/**
+ * Allocates the objects referenced by a #PreparedChildProcess parsed
+ * by ParseExecCommands().  Strings are usually referenced directly
+ * in the payload; everything else comes from an #Arena, which the
+ * owner clears in one step when the next request arrives.
+ */
+struct SpawnExecStorage {
+	Arena &arena;
 
-	PreparedChildProcess p;
+	explicit SpawnExecStorage(Arena &_arena) noexcept
+		:arena(_arena) {}
 
-	MountList **mount_tail = &p.ns.mount.mounts;
-	assert(*mount_tail == nullptr);
+	const char *Dup(const char *src) {
+		const size_t size = strlen(src) + 1;
+		return (const char *)memcpy(arena.Allocate(size, 1), src, size);
+	}
+};
 
-	std::forward_list<MountList> mounts;
-	std::forward_list<std::string> strings;
-	std::forward_list<CgroupOptions::SetItem> cgroup_sets;
+/**
+ * Check a UTIL_CLAMP pair: each value is either
+ * #PlacementOptions::UTIL_UNDEFINED or at most
+ * #PlacementOptions::UTIL_MAX, and the minimum must not exceed the
+ * maximum.
+ */
+static constexpr bool
+IsValidUtilClamp(uint16_t min, uint16_t max) noexcept
+{
+	return (min == PlacementOptions::UTIL_UNDEFINED ||
+		min <= PlacementOptions::UTIL_MAX) &&
+		(max == PlacementOptions::UTIL_UNDEFINED ||
+		 (max <= PlacementOptions::UTIL_MAX &&
+		  (min == PlacementOptions::UTIL_UNDEFINED || min <= max)));
+}
+
+/**
+ * Parse the commands of an EXEC request (after the id and the name)
+ * into a #PreparedChildProcess.
+ *
+ * @param get_fd a function which returns the file descriptor for the
+ * given STDIN/STDOUT/STDERR/CONTROL command
+ */
+template<typename GetFd>
+static void
+ParseExecCommands(SpawnPayload &payload, GetFd &&get_fd,
+		  PreparedChildProcess &p, SpawnExecStorage &storage)
+{
+	/* append to the mounts of a profile which may have been
+	   parsed before */
+	MountList **mount_tail = &p.ns.mount.mounts;
+	while (*mount_tail != nullptr)
+		mount_tail = &(*mount_tail)->next;
 
 	while (!payload.IsEmpty()) {
 		const SpawnExecCommand cmd = (SpawnExecCommand)payload.ReadByte();
@@ -457,15 +1227,15 @@ SpawnServerConnection::HandleExecMessage(SpawnPayload payload,
 			break;
 
 		case SpawnExecCommand::STDIN:
-			p.SetStdin(fds.Get().Steal());
+			p.SetStdin(get_fd(cmd).Steal());
 			break;
 
 		case SpawnExecCommand::STDOUT:
-			p.SetStdout(fds.Get().Steal());
+			p.SetStdout(get_fd(cmd).Steal());
 			break;
 
 		case SpawnExecCommand::STDERR:
-			p.SetStderr(fds.Get().Steal());
+			p.SetStderr(get_fd(cmd).Steal());
 			break;
 
 		case SpawnExecCommand::STDERR_PATH:
@@ -473,7 +1243,7 @@ SpawnServerConnection::HandleExecMessage(SpawnPayload payload,
 			break;
 
 		case SpawnExecCommand::CONTROL:
-			p.SetControl(fds.Get().Steal());
+			p.SetControl(get_fd(cmd).Steal());
 			break;
 
 		case SpawnExecCommand::TTY:
@@ -539,12 +1309,13 @@ SpawnServerConnection::HandleExecMessage(SpawnPayload payload,
 				const char *target = payload.ReadString();
 				bool writable = payload.ReadByte();
 				bool exec = payload.ReadByte();
-				mounts.emplace_front(source, target, false,
-						     writable, exec);
+				auto *m = storage.arena.New<MountList>(source, target,
+								       false,
+								       writable, exec);
+				*mount_tail = m;
+				mount_tail = &m->next;
 			}
 
-			*mount_tail = &mounts.front();
-			mount_tail = &mounts.front().next;
 			break;
 
 		case SpawnExecCommand::HOSTNAME:
@@ -567,6 +1338,33 @@ SpawnServerConnection::HandleExecMessage(SpawnPayload payload,
 			p.ioprio_idle = true;
 			break;
 
+		case SpawnExecCommand::SCHED_BATCH_:
+			p.sched_batch = true;
+			break;
+
+		case SpawnExecCommand::CPU_AFFINITY:
+			payload.ReadT(p.placement.cpus);
+			break;
+
+		case SpawnExecCommand::MEMORY_POLICY:
+			payload.ReadT(p.placement.memory_policy);
+			payload.ReadT(p.placement.memory_nodes);
+			if (p.placement.memory_policy > PlacementOptions::MemoryPolicy::INTERLEAVE)
+				throw MalformedSpawnPayloadError();
+			break;
+
+		case SpawnExecCommand::UTIL_CLAMP:
+			payload.ReadT(p.placement.util_min);
+			payload.ReadT(p.placement.util_max);
+			if (!IsValidUtilClamp(p.placement.util_min,
+					      p.placement.util_max))
+				throw MalformedSpawnPayloadError();
+			break;
+
+		case SpawnExecCommand::NUMA_AUTO:
+			p.placement.auto_node = true;
+			break;
+
 		case SpawnExecCommand::FORBID_USER_NS:
 			p.forbid_user_ns = true;
 			break;
@@ -589,17 +1387,13 @@ SpawnServerConnection::HandleExecMessage(SpawnPayload payload,
 
 		case SpawnExecCommand::CGROUP_SET:
 			{
-				const char *set_name = payload.ReadString();
-				const char *set_value = payload.ReadString();
-				strings.emplace_front(set_name);
-				set_name = strings.front().c_str();
-				strings.emplace_front(set_value);
-				set_value = strings.front().c_str();
-
-				cgroup_sets.emplace_front(set_name, set_value);
-				auto &set = cgroup_sets.front();
-				set.next = p.cgroup.set_head;
-				p.cgroup.set_head = &set;
+				const char *set_name = storage.Dup(payload.ReadString());
+				const char *set_value = storage.Dup(payload.ReadString());
+
+				auto *set = storage.arena.New<CgroupOptions::SetItem>(set_name,
+										      set_value);
+				set->next = p.cgroup.set_head;
+				p.cgroup.set_head = set;
 			}
 
 			break;
@@ -619,10 +1413,424 @@ SpawnServerConnection::HandleExecMessage(SpawnPayload payload,
 		case SpawnExecCommand::HOOK_INFO:
 			p.hook_info = payload.ReadString();
 			break;
+
+		case SpawnExecCommand::PROFILE:
+			/* only allowed as the first command, see
+			   HandleExecMessage() */
+			throw MalformedSpawnPayloadError();
+		}
+	}
+}
+
+/**
+ * A "get_fd" function for ParseExecCommands() parsing a profile,
+ * which must not contain file descriptors.
+ */
+gcc_noreturn
+static UniqueFileDescriptor
+NoProfileFd(SpawnExecCommand)
+{
+	throw MalformedSpawnPayloadError();
+}
+
+/**
+ * The reply of a worker process to one request.
+ */
+struct SpawnWorkerResponse {
+	/**
+	 * The new process id or -1 on error.
+	 */
+	pid_t pid;
+
+	SpawnChildTimings timings;
+};
+
+/**
+ * Parameters for RunSpawnWorker(), valid in the worker process.
+ */
+struct SpawnWorkerContext {
+	SocketDescriptor socket;
+	const SpawnConfig &config;
+	const CgroupState &cgroup_state;
+};
+
+/**
+ * Handle one request received by a worker process.
+ *
+ * @return the new process id
+ */
+static pid_t
+HandleWorkerRequest(const SpawnWorkerContext &ctx, Arena &arena,
+		    ConstBuffer<uint8_t> request,
+		    std::forward_list<UniqueFileDescriptor> &fds,
+		    UniqueFileDescriptor &pidfd_r,
+		    SpawnChildTimings &timings_r)
+{
+	if (request.empty())
+		throw MalformedSpawnPayloadError();
+
+	/* the first byte is a bit mask specifying which of
+	   STDIN/STDOUT/STDERR/CONTROL are in the fd list */
+	const uint8_t mask = request.shift();
+
+	UniqueFileDescriptor slots[4];
+	for (unsigned i = 0; i < ARRAY_SIZE(slots); ++i) {
+		if (mask & (1u << i)) {
+			if (fds.empty())
+				throw MalformedSpawnPayloadError();
+
+			slots[i] = std::move(fds.front());
+			fds.pop_front();
 		}
 	}
 
-	SpawnChild(id, name, std::move(p));
+	SpawnPayload payload(request);
+
+	int id;
+	payload.ReadInt(id);
+	payload.ReadString();
+
+	PreparedChildProcess p;
+	SpawnExecStorage storage(arena);
+	ParseExecCommands(payload, [&slots](SpawnExecCommand cmd){
+			unsigned i;
+			switch (cmd) {
+			case SpawnExecCommand::STDIN:
+				i = 0;
+				break;
+
+			case SpawnExecCommand::STDOUT:
+				i = 1;
+				break;
+
+			case SpawnExecCommand::STDERR:
+				i = 2;
+				break;
+
+			default:
+				i = 3;
+				break;
+			}
+
+			if (!slots[i].IsDefined())
+				throw MalformedSpawnPayloadError();
+
+			return std::move(slots[i]);
+		}, p, storage);
+
+	/* the request has already been verified by the spawner */
+	if (p.uid_gid.IsEmpty())
+		p.uid_gid = ctx.config.default_uid_gid;
+
+	return SpawnChildProcess(std::move(p), ctx.cgroup_state,
+				 &pidfd_r, true, &timings_r);
+}
+
+/**
+ * The main function of a worker process: handle requests until the
+ * spawner closes the socket.
+ */
+static int
+RunSpawnWorker(void *_ctx)
+{
+	const auto &ctx = *(const SpawnWorkerContext *)_ctx;
+
+	CloseInheritedFds({ctx.socket.Get()});
+
+	typedef ReceiveMessageBuffer<SPAWN_MAX_REQUEST_SIZE + 1,
+				     CMSG_SPACE(sizeof(int) * 4)> Buffer;
+	std::unique_ptr<Buffer> buffer(new Buffer());
+
+	Arena arena;
+
+	while (true) {
+		ReceiveMessageResult result;
+
+		try {
+			result = ReceiveMessage(ctx.socket, *buffer, 0);
+		} catch (...) {
+			PrintException(std::current_exception());
+			return EXIT_FAILURE;
+		}
+
+		if (result.payload.IsNull())
+			/* the spawner has closed the socket */
+			return EXIT_SUCCESS;
+
+		SpawnWorkerResponse response;
+		response.pid = -1;
+		UniqueFileDescriptor pidfd;
+
+		arena.Clear();
+
+		try {
+			response.pid = HandleWorkerRequest(ctx, arena,
+							   ConstBuffer<uint8_t>::FromVoid(result.payload),
+							   result.fds, pidfd,
+							   response.timings);
+		} catch (...) {
+			fprintf(stderr, "Failed to spawn child process: %s\n",
+				GetFullMessage(std::current_exception()).c_str());
+		}
+
+		const int pidfd_value = pidfd.Get();
+
+		try {
+			::Send<1>(ctx.socket,
+				  ConstBuffer<void>(&response, sizeof(response)),
+				  pidfd.IsDefined()
+				  ? ConstBuffer<int>(&pidfd_value, 1)
+				  : ConstBuffer<int>(nullptr));
+		} catch (...) {
+			PrintException(std::current_exception());
+			return EXIT_FAILURE;
+		}
+	}
+}
+
+SpawnServerWorker::SpawnServerWorker(SpawnServerProcess &_process,
+				     UniqueSocketDescriptor &&_socket,
+				     pid_t _pid)
+	:process(_process), socket(std::move(_socket)), pid(_pid),
+	 event(process.GetEventLoop(), socket.Get(),
+	       SocketEvent::READ|SocketEvent::PERSIST,
+	       BIND_THIS_METHOD(OnSocketReady))
+{
+	event.Add();
+}
+
+SpawnServerWorker::~SpawnServerWorker()
+{
+	assert(queue.empty());
+
+	event.Delete();
+}
+
+void
+SpawnServerWorker::Submit(SpawnServerPendingChild &child,
+			  ConstBuffer<uint8_t> request,
+			  const PreparedChildProcess &p)
+{
+	const int fds[] = {p.stdin_fd, p.stdout_fd, p.stderr_fd, p.control_fd};
+
+	uint8_t mask = 0;
+	for (unsigned i = 0; i < ARRAY_SIZE(fds); ++i)
+		if (fds[i] >= 0)
+			mask |= 1u << i;
+
+	struct iovec vec[] = {
+		{
+			.iov_base = &mask,
+			.iov_len = sizeof(mask),
+		},
+		{
+			.iov_base = const_cast<uint8_t *>(request.data),
+			.iov_len = request.size,
+		},
+	};
+
+	MessageHeader msg(ConstBuffer<struct iovec>(vec, ARRAY_SIZE(vec)));
+
+	ScmRightsBuilder<ARRAY_SIZE(fds)> b(msg);
+	for (int fd : fds)
+		if (fd >= 0)
+			b.push_back(fd);
+	b.Finish(msg);
+
+	SendMessage(socket, msg, MSG_DONTWAIT|MSG_NOSIGNAL);
+
+	queue.push_back(&child);
+}
+
+void
+SpawnServerWorker::Kill()
+{
+	process.GetChildProcessRegistry().Kill(pid, SIGTERM);
+}
+
+void
+SpawnServerWorker::FailAll()
+{
+	auto &registry = process.GetChildProcessRegistry();
+
+	while (!queue.empty()) {
+		auto *c = queue.front();
+		queue.pop_front();
+
+		++process.GetStats().failed;
+
+		c->Complete(registry, -1, UniqueFileDescriptor());
+	}
+}
+
+void
+SpawnServerWorker::OnSocketReady(unsigned) noexcept
+{
+	ReceiveMessageBuffer<sizeof(SpawnWorkerResponse),
+			     CMSG_SPACE(sizeof(int))> buffer;
+
+	SpawnServerPendingChild *c;
+	SpawnWorkerResponse response;
+	UniqueFileDescriptor pidfd;
+
+	try {
+		auto result = ReceiveMessage(socket, buffer, MSG_DONTWAIT);
+		if (result.payload.IsNull())
+			throw std::runtime_error("Spawn worker has closed the socket");
+
+		if (result.payload.size != sizeof(response) || queue.empty())
+			throw std::runtime_error("Malformed spawn worker response");
+
+		memcpy(&response, result.payload.data, sizeof(response));
+
+		if (response.pid >= 0 && !result.fds.empty())
+			pidfd = std::move(result.fds.front());
+	} catch (...) {
+		process.LogWorkerError(std::current_exception());
+		Kill();
+		process.RemoveWorker(*this);
+		return;
+	}
+
+	c = queue.front();
+	queue.pop_front();
+
+	process.AddSpawnResult(response.pid >= 0, c->start_time,
+			       response.timings);
+
+	/* this may destroy this object (via
+	   SpawnServerProcess::Quit()) */
+	c->Complete(process.GetChildProcessRegistry(), response.pid,
+		    std::move(pidfd));
+}
+
+void
+SpawnServerWorker::OnChildProcessExit(int)
+{
+	process.RemoveWorker(*this);
+}
+
+void
+SpawnServerProcess::StartWorker()
+{
+	UniqueSocketDescriptor a, b;
+	if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_SEQPACKET,
+						      0, a, b))
+		throw MakeErrno("socketpair() failed");
+
+	SpawnWorkerContext ctx{b, config, cgroup_state};
+
+	UniqueFileDescriptor pidfd;
+	const pid_t pid = CloneHelperProcess(RunSpawnWorker, &ctx, pidfd);
+
+	a.SetNonBlocking();
+
+	auto *worker = new SpawnServerWorker(*this, std::move(a), pid);
+	workers.push_back(*worker);
+
+	child_process_registry.Add(pid, std::move(pidfd), "spawn worker",
+				   worker);
+}
+
+inline void
+SpawnServerConnection::HandleExecMessage(SpawnPayload payload,
+					 SpawnFdList &fds)
+{
+	const auto start_time = std::chrono::steady_clock::now();
+	auto request = payload.GetRemaining();
+
+	int id;
+	payload.ReadInt(id);
+	const char *name = payload.ReadString();
+
+	/* free the objects of the previous request; this is not done
+	   after SpawnChild(), because that may destroy this object */
+	exec_arena.Clear();
+
+	PreparedChildProcess p;
+	SpawnExecStorage storage(exec_arena);
+
+	/* the request with the profile expanded, for workers, which
+	   don't know this connection's profiles */
+	std::vector<uint8_t> expanded;
+
+	if (!payload.IsEmpty() &&
+	    SpawnExecCommand(payload.PeekByte()) == SpawnExecCommand::PROFILE) {
+		const uint8_t *const header_end = payload.GetRemaining().data;
+
+		payload.ReadByte();
+		uint16_t profile_id;
+		payload.ReadT(profile_id);
+
+		auto i = profiles.find(profile_id);
+		if (i == profiles.end())
+			throw MalformedSpawnPayloadError();
+
+		const auto &profile = i->second;
+		SpawnPayload profile_payload({profile.data(), profile.size()});
+		ParseExecCommands(profile_payload, NoProfileFd, p, storage);
+
+		if (process.HasWorkers()) {
+			const auto rest = payload.GetRemaining();
+			expanded.reserve((header_end - request.data) +
+					 profile.size() + rest.size);
+			expanded.insert(expanded.end(), request.begin(), header_end);
+			expanded.insert(expanded.end(),
+					profile.begin(), profile.end());
+			expanded.insert(expanded.end(), rest.begin(), rest.end());
+
+			request = expanded.size() <= SPAWN_MAX_REQUEST_SIZE
+				? ConstBuffer<uint8_t>(expanded.data(),
+						       expanded.size())
+				: nullptr;
+		}
+	}
+
+	ParseExecCommands(payload, [&fds](SpawnExecCommand){
+			return fds.Get();
+		}, p, storage);
+
+	if (request.size > SPAWN_MAX_REQUEST_SIZE)
+		/* too large for a worker datagram (received in a
+		   memfd, see HandleMemfdMessage()); spawn it here */
+		request = nullptr;
+
+	SpawnChild(id, name, std::move(p), request, start_time);
+}
+
+inline void
+SpawnServerConnection::HandleExecBatchMessage(ConstBuffer<uint8_t> payload,
+					      SpawnFdList &&fds)
+{
+	if (!batching)
+		throw MalformedSpawnPayloadError();
+
+	const DestructObserver destructed(*this);
+
+	while (!payload.empty()) {
+		uint32_t length;
+		if (payload.size < sizeof(length))
+			throw MalformedSpawnPayloadError();
+
+		memcpy(&length, payload.data, sizeof(length));
+		payload.skip_front(sizeof(length));
+
+		if (length == 0 || length > payload.size)
+			throw MalformedSpawnPayloadError();
+
+		ConstBuffer<uint8_t> record(payload.data, length);
+		payload.skip_front(length);
+
+		if (SpawnRequestCommand(record.shift()) != SpawnRequestCommand::EXEC)
+			throw MalformedSpawnPayloadError();
+
+		/* all requests share one file descriptor list, and each
+		   one takes its own from the front */
+		HandleExecMessage(SpawnPayload(record), fds);
+
+		if (destructed)
+			return;
+	}
 }
 
 inline void
@@ -639,8 +1847,18 @@ SpawnServerConnection::HandleKillMessage(SpawnPayload payload,
 		throw MalformedSpawnPayloadError();
 
 	auto i = children.find(id, SpawnServerChild::CompareId());
-	if (i == children.end())
+	if (i == children.end()) {
+		/* maybe the request is still being handled by a
+		   worker; apply the signal when it completes */
+		for (auto &c : pending) {
+			if (c.id == id) {
+				c.kill_signo = signo;
+				break;
+			}
+		}
+
 		return;
+	}
 
 	SpawnServerChild *child = &*i;
 	children.erase(i);
@@ -649,6 +1867,139 @@ SpawnServerConnection::HandleKillMessage(SpawnPayload payload,
 	delete child;
 }
 
+static void
+Serialize(SpawnSerializer &s, const SpawnResourceUsage &u)
+{
+	s.WriteT(u.n_exits);
+	s.WriteT(u.user_time);
+	s.WriteT(u.system_time);
+	s.WriteT(u.max_rss);
+	s.WriteT(u.minor_faults);
+	s.WriteT(u.major_faults);
+	s.WriteT(u.voluntary_switches);
+	s.WriteT(u.involuntary_switches);
+}
+
+inline void
+SpawnServerConnection::HandleStatsMessage(ConstBuffer<uint8_t> payload,
+					  SpawnFdList &&fds)
+{
+	if (!payload.empty() || !fds.IsEmpty())
+		throw MalformedSpawnPayloadError();
+
+	const auto &stats = process.GetStats();
+
+	static_assert(1 + 5 * sizeof(uint64_t) +
+		      N_SPAWN_PHASES * SpawnLatencyHistogram::N_BUCKETS * sizeof(uint32_t)
+		      <= SPAWN_MAX_RESPONSE_SIZE,
+		      "STATS response too large");
+
+	{
+		SpawnSerializer s(send_buffer, SpawnResponseCommand::STATS);
+		s.WriteT(stats.requests);
+		s.WriteT(stats.spawned);
+		s.WriteT(stats.rejected);
+		s.WriteT(stats.failed);
+		s.WriteT(stats.exited);
+
+		for (const auto &h : stats.latency)
+			for (uint32_t n : h.buckets)
+				s.WriteT(n);
+
+		::Send<1>(socket, s);
+	}
+
+	static_assert(1 + SPAWN_MAX_STATS_USAGE *
+		      (SpawnStats::MAX_USAGE_KEY_LENGTH + 1 + 8 * sizeof(uint64_t))
+		      <= SPAWN_MAX_RESPONSE_SIZE,
+		      "STATS_USAGE response too large");
+
+	auto i = stats.usage.begin();
+	const auto end = stats.usage.end();
+	while (i != end) {
+		SpawnSerializer u(send_buffer,
+				  SpawnResponseCommand::STATS_USAGE);
+
+		for (size_t n = 0; n < SPAWN_MAX_STATS_USAGE && i != end;
+		     ++n, ++i) {
+			u.WriteString(i->first.c_str());
+			Serialize(u, i->second);
+		}
+
+		::Send<1>(socket, u);
+	}
+
+	SpawnSerializer s(send_buffer, SpawnResponseCommand::STATS_END);
+	::Send<1>(socket, s);
+}
+
+inline void
+SpawnServerConnection::HandleProfileMessage(ConstBuffer<uint8_t> payload,
+					    SpawnFdList &&fds)
+{
+	if (!fds.IsEmpty())
+		throw MalformedSpawnPayloadError();
+
+	SpawnPayload p(payload);
+	uint16_t id;
+	p.ReadT(id);
+	if (id >= SPAWN_MAX_PROFILES)
+		throw MalformedSpawnPayloadError();
+
+	const auto commands = p.GetRemaining();
+
+	/* check the profile now, so an EXEC request referring to it
+	   cannot fail because of it */
+	{
+		exec_arena.Clear();
+
+		PreparedChildProcess dummy;
+		SpawnExecStorage storage(exec_arena);
+		SpawnPayload check(commands);
+		ParseExecCommands(check, NoProfileFd, dummy, storage);
+	}
+
+	profiles[id].assign(commands.begin(), commands.end());
+}
+
+inline void
+SpawnServerConnection::HandleConnectMessage(ConstBuffer<uint8_t> payload,
+					    SpawnFdList &&fds)
+{
+	uint8_t flags = 0;
+	if (payload.size == 1)
+		flags = payload.front();
+	else if (!payload.empty())
+		throw MalformedSpawnPayloadError();
+
+	if (fds.IsEmpty())
+		/* renegotiate this connection */
+		ApplyConnectFlags(flags);
+	else if (fds.size() == 1)
+		process.AddConnection(fds.GetSocket()).ApplyConnectFlags(flags);
+	else
+		throw MalformedSpawnPayloadError();
+}
+
+inline void
+SpawnServerConnection::HandleMemfdMessage(ConstBuffer<uint8_t> payload,
+					  SpawnFdList &&fds)
+{
+	if (!payload.empty())
+		throw MalformedSpawnPayloadError();
+
+	/* the mapping must outlive the PreparedChildProcess which
+	   points into it; it is consumed by HandleExecMessage() */
+	const auto memfd = fds.Get();
+	const SpawnPayloadMapping mapping(memfd.ToFileDescriptor());
+	auto request = mapping.Get();
+
+	if (SpawnRequestCommand(request.shift()) != SpawnRequestCommand::EXEC)
+		throw MalformedSpawnPayloadError();
+
+	HandleExecMessage(SpawnPayload(request), fds);
+}
+
 inline void
 SpawnServerConnection::HandleMessage(ConstBuffer<uint8_t> payload,
 				     SpawnFdList &&fds)
@@ -657,44 +2008,74 @@ SpawnServerConnection::HandleMessage(ConstBuffer<uint8_t> payload,
 
 	switch (cmd) {
 	case SpawnRequestCommand::CONNECT:
-		if (!payload.empty() || fds.size() != 1)
-			throw MalformedSpawnPayloadError();
-
-		process.AddConnection(fds.GetSocket());
+		HandleConnectMessage(payload, std::move(fds));
 		break;
 
 	case SpawnRequestCommand::EXEC:
-		HandleExecMessage(SpawnPayload(payload), std::move(fds));
+		HandleExecMessage(SpawnPayload(payload), fds);
 		break;
 
 	case SpawnRequestCommand::KILL:
 		HandleKillMessage(SpawnPayload(payload), std::move(fds));
 		break;
+
+	case SpawnRequestCommand::EXEC_BATCH:
+		HandleExecBatchMessage(payload, std::move(fds));
+		break;
+
+	case SpawnRequestCommand::STATS:
+		HandleStatsMessage(payload, std::move(fds));
+		break;
+
+	case SpawnRequestCommand::PROFILE:
+		HandleProfileMessage(payload, std::move(fds));
+		break;
+
+	case SpawnRequestCommand::MEMFD:
+		HandleMemfdMessage(payload, std::move(fds));
+		break;
 	}
 }
 
 inline void
-SpawnServerConnection::HandleMessage(ReceiveMessageResult &&result)
+SpawnServerConnection::HandleMessage(MultiReceiveMessage::Datagram &d)
 {
-	HandleMessage(ConstBuffer<uint8_t>::FromVoid(result.payload),
-		      std::move(result.fds));
+	std::forward_list<UniqueFileDescriptor> fds;
+	auto tail = fds.before_begin();
+	for (auto &fd : d.fds)
+		tail = fds.insert_after(tail, std::move(fd));
+
+	HandleMessage(ConstBuffer<uint8_t>::FromVoid(d.payload),
+		      std::move(fds));
 }
 
 inline void
 SpawnServerConnection::ReadEventCallback(unsigned)
 try {
-	ReceiveMessageBuffer<8192, CMSG_SPACE(sizeof(int) * 32)> rmb;
+	auto &receive = process.GetReceiveMessage();
+	AtScopeExit(&receive) { receive.Clear(); };
 
-	auto result = ReceiveMessage(socket, rmb, MSG_DONTWAIT);
-	if (result.payload.empty()) {
+	if (!receive.Receive(socket)) {
 		RemoveConnection();
 		return;
 	}
 
-	try {
-		HandleMessage(std::move(result));
-	} catch (MalformedSpawnPayloadError) {
-		logger(3, "Malformed spawn payload");
+	const DestructObserver destructed(*this);
+
+	for (auto &d : receive) {
+		if (d.payload.empty()) {
+			RemoveConnection();
+			return;
+		}
+
+		try {
+			HandleMessage(d);
+		} catch (MalformedSpawnPayloadError) {
+			logger(3, "Malformed spawn payload");
+		}
+
+		if (destructed)
+			return;
 	}
 } catch (...) {
 	logger(2, std::current_exception());
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Stats.hxx"
+#include "util/StatsWriter.hxx"
+
+#include <vector>
+
+#include <sys/resource.h>
+#include <string.h>
+
+void
+SpawnLatencyHistogram::Add(std::chrono::steady_clock::duration d) noexcept
+{
+	size_t i = 0;
+	while (i < N_BUCKETS - 1 && d >= GetUpperBound(i))
+		++i;
+
+	++buckets[i];
+}
+
+static constexpr uint64_t
+ToMicroseconds(const struct timeval &tv)
+{
+	return uint64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+void
+SpawnResourceUsage::Add(const struct rusage &ru) noexcept
+{
+	++n_exits;
+	user_time += ToMicroseconds(ru.ru_utime);
+	system_time += ToMicroseconds(ru.ru_stime);
+	if (uint64_t(ru.ru_maxrss) > max_rss)
+		max_rss = ru.ru_maxrss;
+	minor_faults += ru.ru_minflt;
+	major_faults += ru.ru_majflt;
+	voluntary_switches += ru.ru_nvcsw;
+	involuntary_switches += ru.ru_nivcsw;
+}
+
+void
+SpawnStats::AddUsage(const char *key, const struct rusage &ru)
+{
+	++exited;
+
+	std::string k(key, strnlen(key, MAX_USAGE_KEY_LENGTH));
+
+	auto i = usage.find(k);
+	if (i == usage.end()) {
+		if (usage.size() >= MAX_USAGE_KEYS)
+			k = "*";
+
+		i = usage.emplace(std::move(k), SpawnResourceUsage()).first;
+	}
+
+	i->second.Add(ru);
+}
+
+void
+WriteStats(StatsWriter &writer, const SpawnStats &stats)
+{
+	writer.WriteCounter("spawn_requests_total", nullptr, stats.requests);
+	writer.WriteCounter("spawn_spawned_total", nullptr, stats.spawned);
+	writer.WriteCounter("spawn_rejected_total", nullptr, stats.rejected);
+	writer.WriteCounter("spawn_failed_total", nullptr, stats.failed);
+	writer.WriteCounter("spawn_exited_total", nullptr, stats.exited);
+
+	std::vector<std::pair<std::string, const SpawnResourceUsage *>> items;
+	items.reserve(stats.usage.size());
+	for (const auto &i : stats.usage) {
+		std::string labels;
+		AppendStatsLabel(labels, "key", i.first.c_str());
+		items.emplace_back(std::move(labels), &i.second);
+	}
+
+	for (const auto &i : items)
+		writer.WriteCounter("spawn_child_exits_total", i.first.c_str(),
+				    i.second->n_exits);
+
+	for (const auto &i : items)
+		writer.WriteCounter("spawn_child_user_seconds_total",
+				    i.first.c_str(),
+				    i.second->user_time * 1e-6);
+
+	for (const auto &i : items)
+		writer.WriteCounter("spawn_child_system_seconds_total",
+				    i.first.c_str(),
+				    i.second->system_time * 1e-6);
+
+	for (const auto &i : items)
+		writer.WriteGauge("spawn_child_max_rss_bytes",
+				  i.first.c_str(),
+				  i.second->max_rss * 1024.);
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct rusage;
+class StatsWriter;
+
+/**
+ * The phases of spawning a child process which are measured by
+ * #SpawnStats.  Only the phases performed by the spawner itself can
+ * be measured; everything after the child process has been woken up
+ * (cgroup, execve()) runs asynchronously.
+ */
+enum class SpawnPhase : uint8_t {
+	/**
+	 * From receiving the EXEC request until the child process has
+	 * been created.
+	 */
+	TOTAL,
+
+	/**
+	 * The clone() system call, including the creation of new
+	 * namespaces.
+	 */
+	CLONE,
+
+	/**
+	 * Waiting for the child process to create its user namespace.
+	 */
+	USER_NS,
+
+	/**
+	 * Setting up the uid/gid map and the resource limits of a new
+	 * user namespace.
+	 */
+	UID_MAP,
+};
+
+static constexpr size_t N_SPAWN_PHASES = size_t(SpawnPhase::UID_MAP) + 1;
+
+/**
+ * A histogram of durations with exponentially growing buckets.
+ */
+struct SpawnLatencyHistogram {
+	static constexpr size_t N_BUCKETS = 16;
+
+	/**
+	 * Bucket i counts durations below GetUpperBound(i); the last
+	 * bucket also counts all longer durations.
+	 */
+	std::array<uint32_t, N_BUCKETS> buckets{};
+
+	static constexpr std::chrono::microseconds GetUpperBound(size_t i) {
+		return std::chrono::microseconds(uint64_t(16) << i);
+	}
+
+	void Add(std::chrono::steady_clock::duration d) noexcept;
+};
+
+/**
+ * Accumulated resource usage of exited child processes.
+ */
+struct SpawnResourceUsage {
+	uint64_t n_exits = 0;
+
+	/**
+	 * Microseconds.
+	 */
+	uint64_t user_time = 0, system_time = 0;
+
+	/**
+	 * The largest maximum resident set size of all processes
+	 * [kB].
+	 */
+	uint64_t max_rss = 0;
+
+	uint64_t minor_faults = 0, major_faults = 0;
+
+	uint64_t voluntary_switches = 0, involuntary_switches = 0;
+
+	void Add(const struct rusage &ru) noexcept;
+};
+
+/**
+ * Statistics collected by the spawn server, which can be queried by
+ * the client with #SpawnRequestCommand::STATS.
+ */
+struct SpawnStats {
+	/**
+	 * The number of EXEC requests.
+	 */
+	uint64_t requests = 0;
+
+	/**
+	 * The number of child processes created successfully.
+	 */
+	uint64_t spawned = 0;
+
+	/**
+	 * The number of requests rejected by SpawnHook::Verify() or
+	 * SpawnConfig::Verify(), or which did not specify a uid/gid.
+	 */
+	uint64_t rejected = 0;
+
+	/**
+	 * The number of requests where creating the child process
+	 * has failed.
+	 */
+	uint64_t failed = 0;
+
+	/**
+	 * The number of child processes which have exited.
+	 */
+	uint64_t exited = 0;
+
+	std::array<SpawnLatencyHistogram, N_SPAWN_PHASES> latency;
+
+	/**
+	 * Resource usage of exited child processes by cgroup name (or
+	 * by process name if no cgroup was configured).
+	 */
+	std::map<std::string, SpawnResourceUsage> usage;
+
+	/**
+	 * The maximum number of keys in #usage.  Records for new keys
+	 * beyond that are accumulated in the key "*".
+	 */
+	static constexpr size_t MAX_USAGE_KEYS = 256;
+
+	/**
+	 * Longer keys are truncated.
+	 */
+	static constexpr size_t MAX_USAGE_KEY_LENGTH = 63;
+
+	void AddLatency(SpawnPhase phase,
+			std::chrono::steady_clock::duration d) noexcept {
+		latency[size_t(phase)].Add(d);
+	}
+
+	void AddUsage(const char *key, const struct rusage &ru);
+};
+
+/**
+ * Write the counters and the resource usage (with a "key" label)
+ * into a #StatsWriter.
+ */
+void
+WriteStats(StatsWriter &writer, const SpawnStats &stats);
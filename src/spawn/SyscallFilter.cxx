@@ -33,6 +33,7 @@
 #include "SyscallFilter.hxx"
 #include "SeccompFilter.hxx"
 
+#include <memory>
 #include <set>
 
 #include <sys/socket.h>
@@ -229,3 +230,36 @@ ForbidBind(Seccomp::Filter &sf)
     sf.AddRule(SCMP_ACT_ERRNO(EACCES), SCMP_SYS(bind));
     sf.AddRule(SCMP_ACT_ERRNO(EACCES), SCMP_SYS(listen));
 }
+
+const Seccomp::Program &
+GetSyscallFilter(bool forbid_user_ns, bool forbid_multicast,
+                 bool forbid_bind)
+{
+    /* the set of architectures is fixed at compile time (see
+       Seccomp::Filter::AddSecondaryArchs()), therefore it is not
+       part of the cache key */
+    static std::unique_ptr<Seccomp::Program> cache[8];
+
+    auto &program = cache[unsigned(forbid_user_ns) |
+                          (unsigned(forbid_multicast) << 1) |
+                          (unsigned(forbid_bind) << 2)];
+    if (!program) {
+        Seccomp::Filter sf(SCMP_ACT_ALLOW);
+        sf.AddSecondaryArchs();
+
+        BuildSyscallFilter(sf);
+
+        if (forbid_user_ns)
+            ForbidUserNamespace(sf);
+
+        if (forbid_multicast)
+            ForbidMulticast(sf);
+
+        if (forbid_bind)
+            ForbidBind(sf);
+
+        program.reset(new Seccomp::Program(sf.Export()));
+    }
+
+    return *program;
+}
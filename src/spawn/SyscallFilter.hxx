@@ -33,7 +33,7 @@
 #ifndef SPAWN_SYSCALL_FILTER_HXX
 #define SPAWN_SYSCALL_FILTER_HXX
 
-namespace Seccomp { class Filter; }
+namespace Seccomp { class Filter; class Program; }
 
 /**
  * Build a standard system call filter.
@@ -63,4 +63,17 @@ ForbidMulticast(Seccomp::Filter &sf);
 void
 ForbidBind(Seccomp::Filter &sf);
 
+/**
+ * Obtain the compiled program of a standard system call filter
+ * (BuildSyscallFilter()) with the given additional rules.  Each
+ * combination is compiled only once and then cached for the lifetime
+ * of this process, which is meant to be called in the spawn server
+ * before forking the child process.
+ *
+ * Throws std::runtime_error on error.
+ */
+const Seccomp::Program &
+GetSyscallFilter(bool forbid_user_ns, bool forbid_multicast,
+                 bool forbid_bind);
+
 #endif
@@ -233,21 +233,25 @@ CreateSystemdScope(const char *name, const char *description,
 
 	auto connection = ODBus::Connection::GetSystem();
 
-	const char *match = "type='signal',"
+	static const char *const matches[] = {
+		/* the match for WaitJobRemoved() */
+		"type='signal',"
 		"sender='org.freedesktop.systemd1',"
 		"interface='org.freedesktop.systemd1.Manager',"
 		"member='JobRemoved',"
-		"path='/org/freedesktop/systemd1'";
-	const ODBus::ScopeMatch scope_match(connection, match);
+		"path='/org/freedesktop/systemd1'",
 
-	/* the match for WaitUnitRemoved() */
-	const char *unit_removed_match = "type='signal',"
+		/* the match for WaitUnitRemoved() */
+		"type='signal',"
 		"sender='org.freedesktop.systemd1',"
 		"interface='org.freedesktop.systemd1.Manager',"
 		"member='UnitRemoved',"
-		"path='/org/freedesktop/systemd1'";
-	const ODBus::ScopeMatch unit_removed_scope_match(connection,
-							 unit_removed_match);
+		"path='/org/freedesktop/systemd1'",
+	};
+
+	/* add both matches with one round trip */
+	const ODBus::MultiScopeMatch scope_match(connection,
+						 {matches, ARRAY_SIZE(matches)});
 
 	using namespace ODBus;
 
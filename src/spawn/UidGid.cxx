@@ -33,6 +33,7 @@
 #include "UidGid.hxx"
 #include "system/Error.hxx"
 #include "util/RuntimeError.hxx"
+#include "util/Hash128.hxx"
 
 #include <unistd.h>
 #include <stdlib.h>
@@ -82,6 +83,13 @@ UidGid::MakeId(char *p) const
 	return p;
 }
 
+void
+UidGid::MakeHash(Hash128Builder &h) const noexcept
+{
+	const uint64_t value = (uint64_t(uid) << 32) | gid;
+	h.UpdateT(value);
+}
+
 static bool
 IsUid(uid_t uid)
 {
@@ -38,6 +38,8 @@
 
 #include <sys/types.h>
 
+class Hash128Builder;
+
 struct UidGid {
 	uid_t uid;
 	gid_t gid;
@@ -75,6 +77,18 @@ struct UidGid {
 
 	char *MakeId(char *p) const;
 
+	/**
+	 * Hash the same attributes as MakeId().
+	 */
+	void MakeHash(Hash128Builder &h) const noexcept;
+
+	/**
+	 * Compare the attributes covered by MakeId().
+	 */
+	constexpr bool IsSameId(const UidGid &other) const noexcept {
+		return uid == other.uid && gid == other.gid;
+	}
+
 	/**
 	 * Throws std::system_error on error.
 	 */
@@ -0,0 +1,359 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "UserDatabase.hxx"
+#include "system/Error.hxx"
+#include "util/IterableSplitString.hxx"
+#include "util/RuntimeError.hxx"
+#include "util/ScopeExit.hxx"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/stat.h>
+
+UserDatabase::FileStamp::FileStamp(const struct stat &st) noexcept
+	:dev(st.st_dev), ino(st.st_ino), size(st.st_size),
+	 mtime(st.st_mtim) {}
+
+bool
+UserDatabase::FileStamp::operator==(const FileStamp &other) const noexcept
+{
+	return dev == other.dev && ino == other.ino && size == other.size &&
+		mtime.tv_sec == other.mtime.tv_sec &&
+		mtime.tv_nsec == other.mtime.tv_nsec;
+}
+
+UserDatabase::UserDatabase(std::chrono::steady_clock::duration _ttl,
+			   const char *_passwd_path,
+			   const char *_group_path) noexcept
+	:passwd_path(_passwd_path), group_path(_group_path),
+	 ttl(_ttl)
+{
+}
+
+static bool
+GetFileStamp(const char *path, struct stat &st)
+{
+	if (stat(path, &st) == 0)
+		return true;
+
+	if (errno == ENOENT)
+		return false;
+
+	throw FormatErrno("Failed to stat %s", path);
+}
+
+/**
+ * Invoke the given function for each line of the file.  A missing
+ * file is treated like an empty one.
+ */
+template<typename F>
+static void
+ForEachLine(const char *path, F &&f)
+{
+	FILE *file = fopen(path, "re");
+	if (file == nullptr) {
+		if (errno == ENOENT)
+			return;
+
+		throw FormatErrno("Failed to open %s", path);
+	}
+
+	char *line = nullptr;
+	size_t capacity = 0;
+
+	AtScopeExit(file, &line) {
+		free(line);
+		fclose(file);
+	};
+
+	ssize_t length;
+	while ((length = getline(&line, &capacity, file)) >= 0) {
+		StringView s(line, length);
+		if (!s.empty() && s.back() == '\n')
+			s.pop_back();
+
+		if (!s.empty() && s.front() != '#')
+			f(s);
+	}
+
+	/* don't mistake a read error (e.g. EISDIR) for the end of
+	   the file */
+	if (ferror(file))
+		throw FormatErrno("Failed to read %s", path);
+}
+
+/**
+ * Parse a decimal uid or gid.
+ *
+ * @return false on syntax error
+ */
+static bool
+ParseId(StringView s, unsigned long &value_r) noexcept
+{
+	if (s.empty())
+		return false;
+
+	unsigned long value = 0;
+	for (char ch : s) {
+		if (ch < '0' || ch > '9')
+			return false;
+
+		value = value * 10 + (ch - '0');
+		if (value > 0xffffffffUL)
+			return false;
+	}
+
+	value_r = value;
+	return true;
+}
+
+void
+UserDatabase::LoadPasswd(const char *path)
+{
+	users.clear();
+
+	ForEachLine(path, [this](StringView line){
+			/* name:password:uid:gid:gecos:home:shell */
+			StringView fields[4];
+			size_t n = 0;
+			for (StringView i : IterableSplitString(line, ':')) {
+				fields[n++] = i;
+				if (n == 4)
+					break;
+			}
+
+			unsigned long uid, gid;
+			if (n < 4 || fields[0].empty() ||
+			    !ParseId(fields[2], uid) || !ParseId(fields[3], gid))
+				/* ignore malformed lines */
+				return;
+
+			/* like NSS, the first entry wins */
+			users.emplace(std::string(fields[0].data, fields[0].size),
+				      User{uid_t(uid), gid_t(gid)});
+		});
+}
+
+void
+UserDatabase::LoadGroup(const char *path)
+{
+	groups.clear();
+	memberships.clear();
+
+	ForEachLine(path, [this](StringView line){
+			/* name:password:gid:member,member,... */
+			StringView fields[4];
+			size_t n = 0;
+			for (StringView i : IterableSplitString(line, ':')) {
+				fields[n++] = i;
+				if (n == 4)
+					break;
+			}
+
+			unsigned long gid;
+			if (n < 3 || fields[0].empty() || !ParseId(fields[2], gid))
+				return;
+
+			if (!groups.emplace(std::string(fields[0].data, fields[0].size),
+					    gid_t(gid)).second)
+				/* duplicate group name */
+				return;
+
+			if (n < 4)
+				return;
+
+			for (StringView member : IterableSplitString(fields[3], ','))
+				if (!member.empty())
+					memberships.emplace(std::string(member.data,
+									member.size),
+							    gid_t(gid));
+		});
+}
+
+void
+UserDatabase::Refresh(std::chrono::steady_clock::time_point now, bool force)
+{
+	if (!force && now < next_check)
+		return;
+
+	struct stat st;
+
+	FileStamp stamp;
+	if (GetFileStamp(passwd_path.c_str(), st))
+		stamp = FileStamp(st);
+
+	if (!(stamp == passwd_stamp)) {
+		passwd_stamp = FileStamp();
+		LoadPasswd(passwd_path.c_str());
+		passwd_stamp = stamp;
+		nss_users.clear();
+	}
+
+	stamp = FileStamp();
+	if (GetFileStamp(group_path.c_str(), st))
+		stamp = FileStamp(st);
+
+	if (!(stamp == group_stamp)) {
+		group_stamp = FileStamp();
+		LoadGroup(group_path.c_str());
+		group_stamp = stamp;
+		nss_users.clear();
+		nss_groups.clear();
+	}
+
+	next_check = now + ttl;
+}
+
+void
+UserDatabase::Clear() noexcept
+{
+	next_check = {};
+	passwd_stamp = group_stamp = FileStamp();
+	users.clear();
+	groups.clear();
+	memberships.clear();
+	nss_users.clear();
+	nss_groups.clear();
+}
+
+void
+UserDatabase::CollectGroups(UidGid &dest, const char *username) const noexcept
+{
+	/* like getgrouplist(), the primary group comes first */
+	auto o = dest.groups.begin();
+	const auto end = dest.groups.end();
+	*o++ = dest.gid;
+
+	const auto range = memberships.equal_range(username);
+	for (auto i = range.first; i != range.second && o != end; ++i)
+		if (std::find(dest.groups.begin(), o, i->second) == o)
+			*o++ = i->second;
+
+	if (o != end)
+		*o = 0;
+}
+
+UidGid
+UserDatabase::Lookup(const char *username)
+{
+	const auto now = std::chrono::steady_clock::now();
+	Refresh(now, false);
+
+	auto i = users.find(username);
+	if (i == users.end())
+		return LookupNss(username, now);
+
+	UidGid result;
+	result.uid = i->second.uid;
+	result.gid = i->second.gid;
+	CollectGroups(result, username);
+	return result;
+}
+
+UidGid
+UserDatabase::LookupNss(const char *username,
+			std::chrono::steady_clock::time_point now)
+{
+	auto i = nss_users.find(username);
+	if (i == nss_users.end() || now >= i->second.expires) {
+		NssUser entry;
+		entry.expires = now + ttl;
+
+		try {
+			entry.uid_gid.Lookup(username);
+			entry.found = true;
+		} catch (const std::system_error &) {
+			/* don't cache NSS failures */
+			throw;
+		} catch (const std::runtime_error &) {
+			entry.found = false;
+		}
+
+		if (i == nss_users.end())
+			i = nss_users.emplace(username, entry).first;
+		else
+			i->second = entry;
+	}
+
+	if (!i->second.found)
+		throw FormatRuntimeError("No such user: %s", username);
+
+	return i->second.uid_gid;
+}
+
+gid_t
+UserDatabase::LookupGroup(const char *name)
+{
+	const auto now = std::chrono::steady_clock::now();
+	Refresh(now, false);
+
+	auto i = groups.find(name);
+	if (i == groups.end())
+		return LookupGroupNss(name, now);
+
+	return i->second;
+}
+
+gid_t
+UserDatabase::LookupGroupNss(const char *name,
+			     std::chrono::steady_clock::time_point now)
+{
+	auto i = nss_groups.find(name);
+	if (i == nss_groups.end() || now >= i->second.expires) {
+		NssGroup entry;
+		entry.expires = now + ttl;
+
+		errno = 0;
+		const auto *gr = getgrnam(name);
+		if (gr == nullptr && errno != 0 && errno != ENOENT)
+			throw FormatErrno("Failed to look up group '%s'", name);
+
+		entry.found = gr != nullptr;
+		entry.gid = entry.found ? gr->gr_gid : 0;
+
+		if (i == nss_groups.end())
+			i = nss_groups.emplace(name, entry).first;
+		else
+			i->second = entry;
+	}
+
+	if (!i->second.found)
+		throw FormatRuntimeError("No such group: %s", name);
+
+	return i->second.gid;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "UidGid.hxx"
+#include "util/Compiler.h"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+
+#include <sys/types.h>
+#include <time.h>
+
+struct stat;
+
+/**
+ * An indexed in-memory copy of /etc/passwd and /etc/group, which
+ * replaces getpwnam(), getgrnam() and getgrouplist() for hot paths
+ * (configuration reloads, per-request user switches).  These NSS
+ * calls may block for a long time if a network directory (LDAP) is
+ * configured.
+ *
+ * The files are loaded lazily and checked for modifications (with
+ * stat()) at most once per TTL; they are parsed again only after
+ * they have changed.  Names which are not found in the files are
+ * resolved via NSS once, and the result (positive or negative) is
+ * remembered for the TTL.
+ *
+ * This class is not thread-safe.
+ */
+class UserDatabase {
+	struct User {
+		uid_t uid;
+		gid_t gid;
+	};
+
+	struct FileStamp {
+		dev_t dev = 0;
+		ino_t ino = 0;
+		off_t size = -1;
+		struct timespec mtime{0, 0};
+
+		FileStamp() = default;
+		explicit FileStamp(const struct stat &st) noexcept;
+
+		bool operator==(const FileStamp &other) const noexcept;
+	};
+
+	struct NssUser {
+		std::chrono::steady_clock::time_point expires;
+
+		/**
+		 * Did the user exist?  If not, #uid_gid is empty.
+		 */
+		bool found;
+
+		UidGid uid_gid;
+	};
+
+	struct NssGroup {
+		std::chrono::steady_clock::time_point expires;
+		bool found;
+		gid_t gid;
+	};
+
+	const std::string passwd_path, group_path;
+
+	const std::chrono::steady_clock::duration ttl;
+
+	/**
+	 * When shall the files be checked for modifications again?
+	 */
+	std::chrono::steady_clock::time_point next_check;
+
+	FileStamp passwd_stamp, group_stamp;
+
+	std::map<std::string, User, std::less<>> users;
+
+	std::map<std::string, gid_t, std::less<>> groups;
+
+	/**
+	 * Maps user names to the supplementary groups (from the member
+	 * lists in /etc/group).
+	 */
+	std::multimap<std::string, gid_t, std::less<>> memberships;
+
+	std::map<std::string, NssUser, std::less<>> nss_users;
+	std::map<std::string, NssGroup, std::less<>> nss_groups;
+
+public:
+	explicit UserDatabase(std::chrono::steady_clock::duration _ttl=std::chrono::minutes(1),
+			      const char *_passwd_path="/etc/passwd",
+			      const char *_group_path="/etc/group") noexcept;
+
+	UserDatabase(const UserDatabase &) = delete;
+	UserDatabase &operator=(const UserDatabase &) = delete;
+
+	/**
+	 * Look up a user name and return its uid, primary gid and
+	 * supplementary groups (like UidGid::Lookup()).
+	 *
+	 * Throws std::runtime_error on error.
+	 */
+	UidGid Lookup(const char *username);
+
+	/**
+	 * Look up a group name.
+	 *
+	 * Throws std::runtime_error on error.
+	 */
+	gid_t LookupGroup(const char *name);
+
+	/**
+	 * Load the files now (if they have been modified), e.g. to
+	 * move the cost out of the first lookup.
+	 *
+	 * Throws std::system_error on error.
+	 */
+	void Preload() {
+		Refresh(std::chrono::steady_clock::now(), true);
+	}
+
+	/**
+	 * Forget everything; the next lookup will load the files
+	 * again.
+	 */
+	void Clear() noexcept;
+
+	size_t GetUserCount() const noexcept {
+		return users.size();
+	}
+
+	size_t GetGroupCount() const noexcept {
+		return groups.size();
+	}
+
+private:
+	/**
+	 * Reload the files if they have been modified.
+	 *
+	 * Throws std::system_error on error.
+	 *
+	 * @param force check now, even if the TTL has not yet
+	 * expired
+	 */
+	void Refresh(std::chrono::steady_clock::time_point now, bool force);
+
+	void LoadPasswd(const char *path);
+	void LoadGroup(const char *path);
+
+	/**
+	 * Fill #UidGid::groups from #memberships.
+	 */
+	void CollectGroups(UidGid &dest, const char *username) const noexcept;
+
+	UidGid LookupNss(const char *username,
+			 std::chrono::steady_clock::time_point now);
+	gid_t LookupGroupNss(const char *name,
+			     std::chrono::steady_clock::time_point now);
+};
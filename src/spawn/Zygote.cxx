@@ -0,0 +1,459 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Zygote.hxx"
+#include "Prepared.hxx"
+#include "Direct.hxx"
+#include "Registry.hxx"
+#include "Builder.hxx"
+#include "system/Error.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/Macros.hxx"
+
+#include <stdexcept>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+bool
+IsZygoteCompatible(const PreparedChildProcess &p) noexcept
+{
+	return p.exec_function == nullptr &&
+		/* each PID namespace needs its own init process */
+		!p.ns.enable_pid && p.ns.pid_namespace == nullptr &&
+		/* the refence is applied to one process, not to its
+		   children */
+		p.refence.IsEmpty() &&
+		!p.args.empty();
+}
+
+static constexpr uint8_t NO_FD = 0xff;
+
+/**
+ * The header of a #SpawnZygoteRequest.  It is followed by
+ * #n_args+#n_env null-terminated strings.
+ */
+struct SpawnZygoteRequestHeader {
+	/**
+	 * Index into the file descriptor list of the message for
+	 * stdin, stdout, stderr, control; #NO_FD if the file
+	 * descriptor is not set.
+	 */
+	uint8_t fds[4];
+
+	uint16_t n_args, n_env;
+};
+
+class SpawnZygoteRequestWriter {
+	static constexpr size_t capacity = SPAWN_MAX_REQUEST_SIZE;
+
+	size_t size = sizeof(SpawnZygoteRequestHeader);
+
+	uint8_t buffer[capacity];
+
+public:
+	SpawnZygoteRequestHeader &GetHeader() noexcept {
+		return *(SpawnZygoteRequestHeader *)(void *)buffer;
+	}
+
+	void WriteString(const char *value) {
+		const size_t length = strlen(value) + 1;
+		if (size + length > capacity)
+			throw SpawnPayloadTooLargeError();
+
+		memcpy(buffer + size, value, length);
+		size += length;
+	}
+
+	ConstBuffer<void> GetPayload() const noexcept {
+		return {buffer, size};
+	}
+};
+
+void
+SpawnZygoteRequest::Send(SocketDescriptor s, const PreparedChildProcess &p)
+{
+	if (p.args.size() > 0xffff || p.env.size() > 0xffff)
+		throw SpawnPayloadTooLargeError();
+
+	std::unique_ptr<SpawnZygoteRequestWriter> w(new SpawnZygoteRequestWriter());
+	auto &header = w->GetHeader();
+
+	const int src_fds[] = {
+		p.stdin_fd, p.stdout_fd, p.stderr_fd, p.control_fd,
+	};
+
+	int fds[ARRAY_SIZE(src_fds)];
+	unsigned n_fds = 0;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(src_fds); ++i) {
+		const int fd = src_fds[i];
+		header.fds[i] = NO_FD;
+		if (fd < 0)
+			continue;
+
+		/* send each file descriptor only once */
+		for (unsigned j = 0; j < n_fds; ++j) {
+			if (fds[j] == fd) {
+				header.fds[i] = j;
+				break;
+			}
+		}
+
+		if (header.fds[i] == NO_FD) {
+			header.fds[i] = n_fds;
+			fds[n_fds++] = fd;
+		}
+	}
+
+	header.n_args = p.args.size();
+	header.n_env = p.env.size();
+
+	for (const char *i : p.args)
+		w->WriteString(i);
+
+	for (const char *i : p.env)
+		w->WriteString(i);
+
+	::Send<ARRAY_SIZE(fds)>(s, w->GetPayload(), {fds, n_fds});
+}
+
+/**
+ * Return the next null-terminated string and advance the buffer.
+ */
+static const char *
+ShiftString(ConstBuffer<char> &payload)
+{
+	const char *end = (const char *)memchr(payload.data, 0, payload.size);
+	if (end == nullptr)
+		throw std::runtime_error("Malformed zygote request");
+
+	const char *value = payload.data;
+	payload.skip_front(end + 1 - value);
+	return value;
+}
+
+void
+SpawnZygoteRequest::Parse(ReceiveMessageResult &result,
+			  PreparedChildProcess &p)
+{
+	if (result.payload.size < sizeof(SpawnZygoteRequestHeader))
+		throw std::runtime_error("Malformed zygote request");
+
+	SpawnZygoteRequestHeader header;
+	memcpy(&header, result.payload.data, sizeof(header));
+
+	std::vector<int> fds;
+	for (auto &i : result.fds)
+		fds.push_back(i.Steal());
+
+	int *const dest_fds[] = {
+		&p.stdin_fd, &p.stdout_fd, &p.stderr_fd, &p.control_fd,
+	};
+
+	static_assert(ARRAY_SIZE(dest_fds) == ARRAY_SIZE(header.fds), "");
+
+	for (unsigned i = 0; i < ARRAY_SIZE(dest_fds); ++i) {
+		const unsigned slot = header.fds[i];
+		if (slot == NO_FD)
+			*dest_fds[i] = -1;
+		else if (slot < fds.size())
+			*dest_fds[i] = fds[slot];
+		else
+			throw std::runtime_error("Malformed zygote request");
+	}
+
+	auto payload = ConstBuffer<char>::FromVoid(result.payload);
+	payload.skip_front(sizeof(header));
+
+	p.args.clear();
+	for (unsigned i = 0; i < header.n_args; ++i)
+		p.args.push_back(ShiftString(payload));
+
+	p.env.clear();
+	for (unsigned i = 0; i < header.n_env; ++i)
+		p.env.push_back(ShiftString(payload));
+
+	if (p.args.empty() || !payload.empty())
+		throw std::runtime_error("Malformed zygote request");
+}
+
+SpawnZygoteStock::Zygote::Zygote(SpawnZygoteStock &_stock,
+				 PreparedChildProcess &p)
+	:stock(_stock)
+{
+	UniqueSocketDescriptor child_socket;
+	if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_SEQPACKET,
+						      0,
+						      socket, child_socket))
+		throw MakeErrno("socketpair() failed");
+
+	/* Spawn() waits synchronously for the reply; don't let a
+	   stuck zygote block the spawner forever */
+	static constexpr struct timeval timeout{ZYGOTE_TIMEOUT_S, 0};
+	if (!socket.SetOption(SOL_SOCKET, SO_RCVTIMEO,
+			      &timeout, sizeof(timeout)) ||
+	    !socket.SetOption(SOL_SOCKET, SO_SNDTIMEO,
+			      &timeout, sizeof(timeout)))
+		throw MakeErrno("Failed to set the zygote socket timeout");
+
+	pid = SpawnZygoteProcess(p, stock.cgroup_state,
+				 std::move(child_socket));
+	stock.registry.Add(pid, "zygote", this);
+}
+
+void
+SpawnZygoteStock::Zygote::Kill() noexcept
+{
+	stock.registry.Kill(pid, SIGTERM);
+}
+
+pid_t
+SpawnZygoteStock::Zygote::Spawn(const PreparedChildProcess &p)
+{
+	SpawnZygoteRequest::Send(socket, p);
+
+	int reply;
+	ssize_t nbytes = recv(socket.Get(), &reply, sizeof(reply), 0);
+	if (nbytes < 0) {
+		if (errno == EAGAIN)
+			throw std::runtime_error("Zygote has timed out");
+
+		throw MakeErrno("Failed to receive from zygote");
+	}
+
+	if (size_t(nbytes) != sizeof(reply))
+		throw std::runtime_error("Zygote has failed");
+
+	if (reply < 0)
+		throw MakeErrno(-reply, "Zygote failed to fork");
+
+	return reply;
+}
+
+void
+SpawnZygoteStock::Zygote::OnChildProcessExit(gcc_unused int status)
+{
+	stock.OnZygoteExit(*this);
+}
+
+SpawnZygoteStock::SpawnZygoteStock(ChildProcessRegistry &_registry,
+				   const CgroupState &_cgroup_state,
+				   unsigned _max_zygotes)
+	:registry(_registry), cgroup_state(_cgroup_state),
+	 max_zygotes(_max_zygotes),
+	 key_buffer(new char[ZYGOTE_KEY_BUFFER_SIZE]) {}
+
+SpawnZygoteStock::~SpawnZygoteStock() noexcept
+{
+	Clear();
+}
+
+/**
+ * Appends to a fixed-size buffer, throwing instead of writing past
+ * its end.
+ */
+class ZygoteKeyWriter {
+	char *p;
+	char *const end;
+
+public:
+	ZygoteKeyWriter(char *_p, size_t size) noexcept
+		:p(_p), end(_p + size) {}
+
+	char *GetEnd() const noexcept {
+		return p;
+	}
+
+	void Check(size_t length) const {
+		if (size_t(end - p) < length)
+			throw std::runtime_error("Zygote key is too long");
+	}
+
+	void Append(char ch) {
+		Check(1);
+		*p++ = ch;
+	}
+
+	void Append(const char *value) {
+		const size_t length = strlen(value);
+		Check(length);
+		p = (char *)mempcpy(p, value, length);
+	}
+
+	void AppendOptionalString(char tag, const char *value) {
+		if (value != nullptr) {
+			Append(';');
+			Append(tag);
+			Append(value);
+		}
+	}
+
+	void AppendInt(char tag, int value) {
+		char buffer[16];
+		snprintf(buffer, sizeof(buffer), ";%c%d", tag, value);
+		Append(buffer);
+	}
+
+	void AppendFlag(const char *tag, bool value) {
+		if (value) {
+			Append(';');
+			Append(tag);
+		}
+	}
+
+	/**
+	 * Append the MakeId() string of the given options.  Those
+	 * methods are not bounded, but their output is at most twice
+	 * the size of the request they were parsed from; see
+	 * #ZYGOTE_MAX_ID_SIZE.
+	 */
+	template<typename T>
+	void AppendId(const T &options) {
+		Check(ZYGOTE_MAX_ID_SIZE);
+		p = options.MakeId(p);
+		assert(p <= end);
+	}
+};
+
+std::string
+MakeZygoteKey(const PreparedChildProcess &p, char *buffer, size_t size)
+{
+	ZygoteKeyWriter w(buffer, size);
+
+	w.AppendOptionalString('x', p.exec_path);
+	w.AppendOptionalString('e', p.stderr_path);
+	w.AppendOptionalString('r', p.chroot);
+	w.AppendOptionalString('d', p.chdir);
+
+	w.AppendInt('u', p.umask);
+	w.AppendInt('p', p.priority);
+
+	w.AppendId(p.cgroup);
+	w.AppendId(p.refence);
+	w.AppendId(p.ns);
+	w.AppendId(p.rlimits);
+	w.AppendId(p.uid_gid);
+	w.AppendId(p.placement);
+
+	w.AppendFlag("si", p.sched_idle);
+	w.AppendFlag("sb", p.sched_batch);
+	w.AppendFlag("ii", p.ioprio_idle);
+	w.AppendFlag("fu", p.forbid_user_ns);
+	w.AppendFlag("fm", p.forbid_multicast);
+	w.AppendFlag("fb", p.forbid_bind);
+	w.AppendFlag("nnp", p.no_new_privs);
+	w.AppendFlag("tty", p.tty);
+	w.AppendFlag("ns", !p.session);
+
+	return std::string(buffer, w.GetEnd());
+}
+
+inline std::string
+SpawnZygoteStock::MakeKey(const PreparedChildProcess &p) const
+{
+	return MakeZygoteKey(p, key_buffer.get(), ZYGOTE_KEY_BUFFER_SIZE);
+}
+
+SpawnZygoteStock::Zygote &
+SpawnZygoteStock::Make(const std::string &key, PreparedChildProcess &p)
+{
+	if (zygotes.size() >= max_zygotes) {
+		assert(!lru.empty());
+		Remove(lru.back(), true);
+	}
+
+	auto i = zygotes.emplace(std::piecewise_construct,
+				 std::forward_as_tuple(key),
+				 std::forward_as_tuple(*this, p));
+	assert(i.second);
+
+	lru.push_front(i.first->second);
+	return i.first->second;
+}
+
+pid_t
+SpawnZygoteStock::Spawn(PreparedChildProcess &p)
+{
+	assert(IsEnabled());
+	assert(IsZygoteCompatible(p));
+
+	const auto key = MakeKey(p);
+
+	auto i = zygotes.find(key);
+	if (i != zygotes.end()) {
+		auto &zygote = i->second;
+
+		/* move to the front of the LRU list */
+		lru.erase(lru.iterator_to(zygote));
+		lru.push_front(zygote);
+
+		try {
+			return zygote.Spawn(p);
+		} catch (...) {
+			/* the zygote is broken; discard it and try
+			   again with a new one */
+			Remove(zygote, true);
+		}
+	}
+
+	return Make(key, p).Spawn(p);
+}
+
+void
+SpawnZygoteStock::Remove(Zygote &zygote, bool kill) noexcept
+{
+	if (kill)
+		zygote.Kill();
+
+	lru.erase(lru.iterator_to(zygote));
+
+	for (auto i = zygotes.begin(); i != zygotes.end(); ++i) {
+		if (&i->second == &zygote) {
+			zygotes.erase(i);
+			break;
+		}
+	}
+}
+
+void
+SpawnZygoteStock::Clear() noexcept
+{
+	while (!lru.empty())
+		Remove(lru.front(), true);
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "IProtocol.hxx"
+#include "ExitListener.hxx"
+#include "net/ReceiveMessage.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include "util/Compiler.h"
+
+#include <boost/intrusive/list.hpp>
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <sys/types.h>
+#include <time.h>
+
+struct PreparedChildProcess;
+struct CgroupState;
+class ChildProcessRegistry;
+
+/**
+ * Can the given process be forked from a zygote?  This is not
+ * possible if it needs a new PID namespace (every process needs its
+ * own init process), or if it uses features which are applied to
+ * one process and not inherited by its children.
+ */
+gcc_pure
+bool
+IsZygoteCompatible(const PreparedChildProcess &p) noexcept;
+
+/**
+ * The maximum size of one MakeId() string in a zygote key.  A
+ * request which fits into a datagram may be expanded with a profile
+ * of the same size, and MakeId() writes at most twice the size of
+ * the request data it was parsed from.
+ */
+static constexpr size_t ZYGOTE_MAX_ID_SIZE = 4 * SPAWN_MAX_REQUEST_SIZE;
+
+static constexpr size_t ZYGOTE_KEY_BUFFER_SIZE = 2 * ZYGOTE_MAX_ID_SIZE;
+
+/**
+ * How long to wait for a zygote to accept a request and to reply
+ * (in seconds)?
+ */
+static constexpr time_t ZYGOTE_TIMEOUT_S = 10;
+
+/**
+ * Build the string which identifies the zygote for the given
+ * process, i.e. all settings except for the arguments, the
+ * environment and the file descriptors.
+ *
+ * Throws std::runtime_error if it does not fit into the buffer.
+ */
+std::string
+MakeZygoteKey(const PreparedChildProcess &p, char *buffer, size_t size);
+
+/**
+ * The messages sent from the spawn server to a zygote process.  The
+ * zygote already has all settings of the #PreparedChildProcess
+ * except for the arguments, the environment and the file
+ * descriptors; those are sent for each new child process.  The
+ * zygote replies with the new pid (int) or a negative errno value.
+ */
+struct SpawnZygoteRequest {
+	typedef ReceiveMessageBuffer<SPAWN_MAX_REQUEST_SIZE,
+				     sizeof(int) * 4> Buffer;
+
+	/**
+	 * Throws on error.
+	 */
+	static void Send(SocketDescriptor s, const PreparedChildProcess &p);
+
+	/**
+	 * Copy the request into the given #PreparedChildProcess.  The
+	 * strings point into the receive buffer.
+	 *
+	 * Throws on error.
+	 */
+	static void Parse(ReceiveMessageResult &result,
+			  PreparedChildProcess &p);
+};
+
+/**
+ * Manages "zygote" processes: each one has set up namespaces, mounts
+ * and other settings for one distinct profile, and then forks new
+ * child processes on demand, saving the (expensive) setup for each
+ * of them.
+ */
+class SpawnZygoteStock {
+	class Zygote final
+		: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+		  public ExitListener {
+
+		SpawnZygoteStock &stock;
+
+		UniqueSocketDescriptor socket;
+
+		pid_t pid;
+
+	public:
+		/**
+		 * Throws on error.
+		 */
+		Zygote(SpawnZygoteStock &_stock, PreparedChildProcess &p);
+
+		Zygote(const Zygote &) = delete;
+		Zygote &operator=(const Zygote &) = delete;
+
+		void Kill() noexcept;
+
+		/**
+		 * Send the request and wait for the reply, at most
+		 * #ZYGOTE_TIMEOUT_S seconds.
+		 *
+		 * Throws on error.
+		 */
+		pid_t Spawn(const PreparedChildProcess &p);
+
+		/* virtual methods from class ExitListener */
+		void OnChildProcessExit(int status) override;
+	};
+
+	ChildProcessRegistry &registry;
+	const CgroupState &cgroup_state;
+
+	/**
+	 * The maximum number of zygotes; if more profiles are used,
+	 * the least recently used zygote is killed.  0 disables this
+	 * class.
+	 */
+	const unsigned max_zygotes;
+
+	std::map<std::string, Zygote> zygotes;
+
+	typedef boost::intrusive::list<Zygote,
+				       boost::intrusive::constant_time_size<false>> ZygoteList;
+
+	/**
+	 * All #zygotes, the most recently used one first.
+	 */
+	ZygoteList lru;
+
+	/**
+	 * A buffer for MakeKey().
+	 */
+	std::unique_ptr<char[]> key_buffer;
+
+public:
+	SpawnZygoteStock(ChildProcessRegistry &_registry,
+			 const CgroupState &_cgroup_state,
+			 unsigned _max_zygotes);
+	~SpawnZygoteStock() noexcept;
+
+	SpawnZygoteStock(const SpawnZygoteStock &) = delete;
+	SpawnZygoteStock &operator=(const SpawnZygoteStock &) = delete;
+
+	bool IsEnabled() const noexcept {
+		return max_zygotes > 0;
+	}
+
+	/**
+	 * Spawn a new child process from a zygote matching the given
+	 * profile (which must be compatible, see
+	 * IsZygoteCompatible()).  A new zygote is created if there is
+	 * none.
+	 *
+	 * Throws on error.
+	 *
+	 * @return the process id; the new process is a child of this
+	 * process
+	 */
+	pid_t Spawn(PreparedChildProcess &p);
+
+	/**
+	 * Kill all zygotes.
+	 */
+	void Clear() noexcept;
+
+private:
+	/**
+	 * Throws std::runtime_error on error.
+	 */
+	std::string MakeKey(const PreparedChildProcess &p) const;
+
+	Zygote &Make(const std::string &key, PreparedChildProcess &p);
+
+	/**
+	 * Kill (if it is still running) and delete the given zygote.
+	 */
+	void Remove(Zygote &zygote, bool kill) noexcept;
+
+	void OnZygoteExit(Zygote &zygote) noexcept {
+		Remove(zygote, false);
+	}
+};
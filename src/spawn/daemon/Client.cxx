@@ -42,6 +42,10 @@
 
 #include <boost/crc.hpp>
 
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
 static UniqueSocketDescriptor
 CreateConnectLocalSocket(const char *path)
 {
@@ -152,4 +156,94 @@ MakePidNamespace(SocketDescriptor s, const char *name)
 	throw std::runtime_error("NAMESPACE_HANDLES expected");
 }
 
+void
+Client::Invalidate() noexcept
+{
+	socket.Close();
+	pid_namespaces.clear();
+}
+
+void
+Client::CheckConnection() noexcept
+{
+	if (!socket.IsDefined())
+		return;
+
+	if (socket_pid != getpid()) {
+		/* we have been forked; don't share the connection
+		   with the parent process */
+		Invalidate();
+		return;
+	}
+
+	char dummy;
+	if (recv(socket.Get(), &dummy, sizeof(dummy),
+		 MSG_PEEK|MSG_DONTWAIT) >= 0 || errno != EAGAIN)
+		/* hangup, error or unsolicited datagram: the daemon
+		   has been restarted or wants us to flush our cache */
+		Invalidate();
+}
+
+SocketDescriptor
+Client::GetSocket()
+{
+	if (!socket.IsDefined()) {
+		/* namespace handles obtained over an old connection
+		   may be stale */
+		pid_namespaces.clear();
+
+		socket = Connect();
+		socket_pid = getpid();
+	}
+
+	return socket;
+}
+
+UniqueFileDescriptor
+Client::RequestPidNamespace(const char *name)
+{
+	try {
+		return MakePidNamespace(GetSocket(), name);
+	} catch (...) {
+		/* the connection is in an undefined state */
+		Invalidate();
+		throw;
+	}
+}
+
+FileDescriptor
+Client::GetPidNamespace(const char *name)
+{
+	CheckConnection();
+
+	auto i = pid_namespaces.find(name);
+	if (i != pid_namespaces.end())
+		return i->second.ToFileDescriptor();
+
+	const bool reused = socket.IsDefined();
+	UniqueFileDescriptor fd;
+
+	try {
+		fd = RequestPidNamespace(name);
+	} catch (const std::system_error &) {
+		if (!reused)
+			throw;
+
+		/* the daemon may have closed the connection since
+		   CheckConnection(); retry once with a new
+		   connection */
+		fd = RequestPidNamespace(name);
+	}
+
+	return pid_namespaces.emplace(name, std::move(fd))
+		.first->second.ToFileDescriptor();
+}
+
+Client &
+GetClient() noexcept
+{
+	static Client client;
+	return client;
+}
+
 }
@@ -32,9 +32,13 @@
 
 #pragma once
 
-class UniqueFileDescriptor;
-class SocketDescriptor;
-class UniqueSocketDescriptor;
+#include "net/UniqueSocketDescriptor.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <map>
+#include <string>
+
+#include <sys/types.h>
 
 namespace SpawnDaemon {
 
@@ -54,4 +58,71 @@ Connect();
 UniqueFileDescriptor
 MakePidNamespace(SocketDescriptor s, const char *name);
 
+/**
+ * A long-lived connection to the Spawn daemon which caches the
+ * namespace handles obtained from it, so repeated requests for the
+ * same name cost no IPC.
+ *
+ * The cache is tied to the connection: it is flushed whenever a new
+ * connection is established, i.e. after the daemon has hung up
+ * (e.g. because it was restarted) or sent an unsolicited datagram.
+ * After fork(), the child process reconnects instead of sharing the
+ * parent's connection.
+ *
+ * This class is not thread-safe.
+ */
+class Client {
+	UniqueSocketDescriptor socket;
+
+	/**
+	 * The process which has created #socket.
+	 */
+	pid_t socket_pid;
+
+	std::map<std::string, UniqueFileDescriptor> pid_namespaces;
+
+public:
+	/**
+	 * Obtain a handle to the PID namespace with the given name.
+	 * The returned descriptor is owned by this object; it is
+	 * valid until the next call.
+	 *
+	 * Throws on error.
+	 */
+	FileDescriptor GetPidNamespace(const char *name);
+
+	/**
+	 * Close the connection and flush the cache.
+	 */
+	void Invalidate() noexcept;
+
+private:
+	/**
+	 * Check whether the connection is still usable; if not,
+	 * invalidate it.  This is a non-blocking peek for pending
+	 * input: the daemon never sends anything unsolicited on a
+	 * healthy connection.
+	 */
+	void CheckConnection() noexcept;
+
+	/**
+	 * Throws on error.
+	 */
+	SocketDescriptor GetSocket();
+
+	/**
+	 * Send a PID_NAMESPACE request and receive the response.
+	 * On error, the connection is invalidated.
+	 *
+	 * Throws on error.
+	 */
+	UniqueFileDescriptor RequestPidNamespace(const char *name);
+};
+
+/**
+ * Returns the process-wide #Client instance.
+ */
+Client &
+GetClient() noexcept;
+
 }
@@ -0,0 +1,372 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CertStore.hxx"
+#include "AltName.hxx"
+#include "Name.hxx"
+#include "LoadFile.hxx"
+#include "Error.hxx"
+#include "Unique.hxx"
+#include "system/Error.hxx"
+#include "util/ScopeExit.hxx"
+#include "util/StringCompare.hxx"
+
+#include <openssl/ssl.h>
+
+#include <algorithm>
+
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr std::chrono::seconds SslCertStore::GRACE_PERIOD;
+
+SSL_CTX *
+SslCertDirectoryLoader::LoadCertificate(const std::string &id)
+{
+	auto chain = LoadCertChainFile((id + ".crt").c_str());
+	auto key = LoadKeyFile((id + ".key").c_str());
+
+	SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+	if (ctx == nullptr)
+		throw SslError("SSL_CTX_new() failed");
+
+	try {
+		if (chain.empty())
+			throw std::runtime_error("No certificate in " + id + ".crt");
+
+		auto i = chain.begin();
+		if (SSL_CTX_use_certificate(ctx, i->get()) != 1)
+			throw SslError("SSL_CTX_use_certificate() failed");
+
+		for (++i; i != chain.end(); ++i) {
+			if (SSL_CTX_add_extra_chain_cert(ctx, i->get()) != 1)
+				throw SslError("SSL_CTX_add_extra_chain_cert() failed");
+
+			/* SSL_CTX_add_extra_chain_cert() has taken
+			   over ownership */
+			i->release();
+		}
+
+		if (SSL_CTX_use_PrivateKey(ctx, key.get()) != 1)
+			throw SslError("SSL_CTX_use_PrivateKey() failed");
+
+		ConfigureContext(*ctx);
+	} catch (...) {
+		SSL_CTX_free(ctx);
+		throw;
+	}
+
+	return ctx;
+}
+
+SslCertStore::Entry::~Entry() noexcept
+{
+	SSL_CTX *p = ctx.load(std::memory_order_acquire);
+	if (p != nullptr)
+		SSL_CTX_free(p);
+}
+
+SslCertStore::Node &
+SslCertStore::Node::MakeChild(const std::string &label)
+{
+	auto &child = children[label];
+	if (!child)
+		child.reset(new Node());
+	return *child;
+}
+
+SslCertStore::Builder::~Builder() noexcept
+{
+	for (auto &i : items)
+		if (i.ctx != nullptr)
+			SSL_CTX_free(i.ctx);
+}
+
+void
+SslCertStore::Builder::Add(const std::string &id, uint64_t stamp,
+			   std::forward_list<std::string> names)
+{
+	items.push_front({id, stamp, nullptr, std::move(names)});
+}
+
+static std::forward_list<std::string>
+GetHostNames(X509 &cert)
+{
+	auto names = GetSubjectAltNames(cert);
+	if (names.empty()) {
+		/* legacy certificate without subjectAltName: fall
+		   back to the common name */
+		auto cn = GetCommonName(cert);
+		if (!cn.IsNull())
+			names.emplace_front(cn.c_str());
+	}
+
+	return names;
+}
+
+void
+SslCertStore::Builder::Add(const std::string &id, SSL_CTX &ctx)
+{
+	X509 *cert = SSL_CTX_get0_certificate(&ctx);
+	if (cert == nullptr)
+		throw std::runtime_error("SSL_CTX without certificate");
+
+	items.push_front({id, 0, nullptr, GetHostNames(*cert)});
+	SSL_CTX_up_ref(&ctx);
+	items.front().ctx = &ctx;
+}
+
+void
+SslCertStore::Builder::ScanDirectory(const char *path)
+{
+	DIR *dir = opendir(path);
+	if (dir == nullptr)
+		throw FormatErrno("Failed to open %s", path);
+
+	AtScopeExit(dir) { closedir(dir); };
+
+	const struct dirent *ent;
+	while ((ent = readdir(dir)) != nullptr) {
+		const size_t length = strlen(ent->d_name);
+		if (length <= 4 || strcmp(ent->d_name + length - 4, ".crt") != 0)
+			continue;
+
+		const std::string id = std::string(path) + "/" +
+			std::string(ent->d_name, length - 4);
+
+		struct stat st;
+		if (stat((id + ".crt").c_str(), &st) < 0 ||
+		    !S_ISREG(st.st_mode) ||
+		    access((id + ".key").c_str(), R_OK) < 0)
+			continue;
+
+		auto cert = LoadCertFile((id + ".crt").c_str());
+
+		Add(id, uint64_t(st.st_mtim.tv_sec) * 1000000000u + st.st_mtim.tv_nsec,
+		    GetHostNames(*cert));
+	}
+}
+
+/**
+ * Convert a host name to lower case (host names are
+ * case-insensitive).
+ */
+static std::string
+NormalizeHostName(const char *s, size_t length)
+{
+	std::string result(s, length);
+	std::transform(result.begin(), result.end(), result.begin(),
+		       [](char ch){
+			       return ch >= 'A' && ch <= 'Z' ? ch + 'a' - 'A' : ch;
+		       });
+	return result;
+}
+
+/**
+ * Split the host name into labels and invoke the callback with each
+ * label, starting with the rightmost (top-level) one.
+ */
+template<typename F>
+static void
+ForEachLabelReverse(const std::string &name, F &&f)
+{
+	size_t end = name.size();
+	while (end > 0) {
+		const size_t dot = name.rfind('.', end - 1);
+		const size_t begin = dot == std::string::npos ? 0 : dot + 1;
+		if (!f(name.substr(begin, end - begin), begin == 0))
+			return;
+
+		if (begin == 0)
+			break;
+
+		end = dot;
+	}
+}
+
+void
+SslCertStore::Commit(Builder &&builder)
+{
+	std::unique_ptr<Index> index(new Index());
+
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	const Index *old = current.load(std::memory_order_acquire);
+
+	for (auto &item : builder.items) {
+		std::shared_ptr<Entry> entry;
+
+		if (item.ctx == nullptr && old != nullptr) {
+			auto i = old->entries.find(item.id);
+			if (i != old->entries.end() &&
+			    i->second->stamp == item.stamp)
+				/* unchanged: keep the SSL_CTX which may
+				   have been loaded already */
+				entry = i->second;
+		}
+
+		if (!entry) {
+			entry = std::make_shared<Entry>(item.id, item.stamp,
+							item.ctx);
+			item.ctx = nullptr;
+		}
+
+		index->entries[item.id] = entry;
+
+		for (const auto &name : item.names) {
+			const bool wildcard = StringStartsWith(name.c_str(), "*.");
+			const std::string normalized =
+				NormalizeHostName(name.data() + (wildcard ? 2 : 0),
+						  name.size() - (wildcard ? 2 : 0));
+
+			Node *node = &index->root;
+			ForEachLabelReverse(normalized,
+					    [&node](std::string &&label, bool){
+						    node = &node->MakeChild(label);
+						    return true;
+					    });
+
+			auto &slot = wildcard ? node->wildcard : node->exact;
+			if (!slot)
+				slot = entry;
+		}
+	}
+
+	/* publish */
+	current.store(index.release(), std::memory_order_release);
+
+	const auto now = std::chrono::steady_clock::now();
+
+	if (old != nullptr) {
+		const_cast<Index *>(old)->retired = now;
+		retired.emplace_back(old);
+	}
+
+	/* free indexes whose grace period has expired */
+	while (!retired.empty() &&
+	       retired.front()->retired + GRACE_PERIOD <= now)
+		retired.pop_front();
+}
+
+SslCertStore::~SslCertStore() noexcept
+{
+	delete current.load();
+}
+
+SSL_CTX *
+SslCertStore::GetContext(Entry &entry)
+{
+	SSL_CTX *ctx = entry.ctx.load(std::memory_order_acquire);
+	if (ctx != nullptr)
+		return ctx;
+
+	SSL_CTX *new_ctx = loader.LoadCertificate(entry.id);
+	if (entry.ctx.compare_exchange_strong(ctx, new_ctx,
+					      std::memory_order_acq_rel))
+		return new_ctx;
+
+	/* another thread was faster */
+	SSL_CTX_free(new_ctx);
+	return ctx;
+}
+
+SSL_CTX *
+SslCertStore::Find(const char *host_name)
+{
+	const Index *index = current.load(std::memory_order_acquire);
+	if (index == nullptr)
+		return nullptr;
+
+	const std::string name = NormalizeHostName(host_name,
+						   strlen(host_name));
+
+	const Node *node = &index->root;
+	Entry *wildcard = nullptr;
+
+	ForEachLabelReverse(name, [&node, &wildcard](std::string &&label,
+						     bool leftmost){
+		if (leftmost && node->wildcard)
+			/* "*.parent" matches exactly one more
+			   label */
+			wildcard = node->wildcard.get();
+
+		auto i = node->children.find(label);
+		if (i == node->children.end()) {
+			node = nullptr;
+			return false;
+		}
+
+		node = i->second.get();
+		return true;
+	});
+
+	Entry *entry = node != nullptr && node->exact
+		? node->exact.get()
+		: wildcard;
+	if (entry == nullptr)
+		return nullptr;
+
+	return GetContext(*entry);
+}
+
+int
+SslCertStore::ServerNameCallback(SSL *ssl, int *, void *_store) noexcept
+{
+	auto &store = *(SslCertStore *)_store;
+
+	const char *host_name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+	if (host_name == nullptr)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	try {
+		SSL_CTX *ctx = store.Find(host_name);
+		if (ctx == nullptr)
+			/* continue with the default certificate */
+			return SSL_TLSEXT_ERR_NOACK;
+
+		SSL_set_SSL_CTX(ssl, ctx);
+		return SSL_TLSEXT_ERR_OK;
+	} catch (...) {
+		/* loading the certificate has failed; fall back
+		   to the default certificate */
+		return SSL_TLSEXT_ERR_NOACK;
+	}
+}
+
+void
+SslCertStore::Enable(SSL_CTX &ctx) noexcept
+{
+	SSL_CTX_set_tlsext_servername_callback(&ctx, ServerNameCallback);
+	SSL_CTX_set_tlsext_servername_arg(&ctx, this);
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SSL_CERT_STORE_HXX
+#define SSL_CERT_STORE_HXX
+
+#include <openssl/ossl_typ.h>
+
+#include <atomic>
+#include <chrono>
+#include <forward_list>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <stdint.h>
+
+/**
+ * Creates SSL_CTX objects for a #SslCertStore on demand.
+ */
+class SslCertLoader {
+public:
+	/**
+	 * Create a SSL_CTX for the certificate with the given id.
+	 * The caller takes over the reference.
+	 *
+	 * Throws on error.
+	 */
+	virtual SSL_CTX *LoadCertificate(const std::string &id) = 0;
+};
+
+/**
+ * Loads certificates from a directory: for each "NAME.crt" (a PEM
+ * certificate chain) there must be a "NAME.key" (the PEM private
+ * key).  The id is the path without the suffix.
+ */
+class SslCertDirectoryLoader : public SslCertLoader {
+public:
+	/* virtual methods from SslCertLoader */
+	SSL_CTX *LoadCertificate(const std::string &id) override;
+
+protected:
+	/**
+	 * Apply application specific settings (protocols, ciphers,
+	 * session cache, ...) to a new SSL_CTX.  The default does
+	 * nothing.
+	 */
+	virtual void ConfigureContext(SSL_CTX &) {}
+};
+
+/**
+ * A store for many server certificates, indexed by their host names
+ * (subjectAltName), for SNI lookups.  The index is a trie of reversed
+ * domain labels, so a lookup takes O(number of labels) regardless of
+ * the number of certificates; wildcard names ("*.example.com") match
+ * exactly one additional label.
+ *
+ * SSL_CTX objects are created lazily by a #SslCertLoader when a name
+ * is looked up for the first time.
+ *
+ * The index is immutable; Commit() publishes a new one atomically,
+ * and lookups (on any thread) never block.  Replaced indexes are
+ * freed after a grace period, which must be longer than any lookup;
+ * pointers returned by Find() must therefore not be kept beyond the
+ * current callback (SSL_set_SSL_CTX() takes a reference).
+ */
+class SslCertStore {
+	struct Entry {
+		const std::string id;
+
+		const uint64_t stamp;
+
+		/**
+		 * The SSL_CTX (owning a reference), created on
+		 * demand.
+		 */
+		std::atomic<SSL_CTX *> ctx;
+
+		Entry(const std::string &_id, uint64_t _stamp,
+		      SSL_CTX *_ctx) noexcept
+			:id(_id), stamp(_stamp), ctx(_ctx) {}
+
+		~Entry() noexcept;
+
+		Entry(const Entry &) = delete;
+		Entry &operator=(const Entry &) = delete;
+	};
+
+	struct Node {
+		std::unordered_map<std::string, std::unique_ptr<Node>> children;
+
+		/**
+		 * The certificate for exactly this name.
+		 */
+		std::shared_ptr<Entry> exact;
+
+		/**
+		 * The certificate for "*." this name.
+		 */
+		std::shared_ptr<Entry> wildcard;
+
+		Node &MakeChild(const std::string &label);
+	};
+
+	struct Index {
+		Node root;
+
+		/**
+		 * All entries by id, to reuse loaded SSL_CTX objects
+		 * in the next index.
+		 */
+		std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+
+		/**
+		 * When was this index replaced?
+		 */
+		std::chrono::steady_clock::time_point retired;
+	};
+
+public:
+	/**
+	 * Collects certificates for a new index; see Commit().
+	 */
+	class Builder {
+		friend class SslCertStore;
+
+		struct Item {
+			std::string id;
+			uint64_t stamp;
+			SSL_CTX *ctx;
+			std::forward_list<std::string> names;
+		};
+
+		std::forward_list<Item> items;
+
+	public:
+		Builder() = default;
+		Builder(Builder &&) = default;
+		~Builder() noexcept;
+
+		/**
+		 * Add a certificate which will be loaded on demand.
+		 *
+		 * @param id passed to SslCertLoader::LoadCertificate()
+		 * @param stamp an arbitrary version number (e.g. the
+		 * modification time); if an entry with the same id
+		 * and stamp exists in the current index, its SSL_CTX
+		 * is reused
+		 * @param names the host names; a leading "*." denotes
+		 * a wildcard
+		 */
+		void Add(const std::string &id, uint64_t stamp,
+			 std::forward_list<std::string> names);
+
+		/**
+		 * Add a prebuilt SSL_CTX (this method adds a
+		 * reference), serving the certificates' subject alt
+		 * names.
+		 */
+		void Add(const std::string &id, SSL_CTX &ctx);
+
+		/**
+		 * Scan a directory for certificates (see
+		 * #SslCertDirectoryLoader), reading only their names.
+		 *
+		 * Throws on error.
+		 */
+		void ScanDirectory(const char *path);
+	};
+
+private:
+	static constexpr std::chrono::seconds GRACE_PERIOD{10};
+
+	SslCertLoader &loader;
+
+	std::atomic<const Index *> current{nullptr};
+
+	/**
+	 * Protects #retired and serializes Commit() calls.
+	 */
+	std::mutex mutex;
+
+	std::list<std::unique_ptr<const Index>> retired;
+
+public:
+	explicit SslCertStore(SslCertLoader &_loader) noexcept
+		:loader(_loader) {}
+
+	~SslCertStore() noexcept;
+
+	SslCertStore(const SslCertStore &) = delete;
+	SslCertStore &operator=(const SslCertStore &) = delete;
+
+	/**
+	 * Build a new index from the given #Builder and make it the
+	 * current one.
+	 */
+	void Commit(Builder &&builder);
+
+	/**
+	 * Look up the SSL_CTX for the given host name.  On the first
+	 * lookup of a certificate, this calls the #SslCertLoader.
+	 *
+	 * Throws if loading the certificate fails.
+	 *
+	 * @return the SSL_CTX (a borrowed reference, see class
+	 * documentation) or nullptr if there is no matching
+	 * certificate
+	 */
+	SSL_CTX *Find(const char *host_name);
+
+	/**
+	 * Install a SNI callback in the given (default) SSL_CTX
+	 * which switches to the matching certificate's SSL_CTX.
+	 * Connections without a matching certificate (or without
+	 * SNI) continue with the default SSL_CTX.  This object must
+	 * outlive the SSL_CTX.
+	 */
+	void Enable(SSL_CTX &ctx) noexcept;
+
+private:
+	SSL_CTX *GetContext(Entry &entry);
+
+	static int ServerNameCallback(SSL *ssl, int *al, void *ctx) noexcept;
+};
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SSL_HANDSHAKE_JOB_HXX
+#define SSL_HANDSHAKE_JOB_HXX
+
+#include "event/WorkerPool.hxx"
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+class SslHandshakeHandler {
+public:
+	/**
+	 * One SSL_do_handshake() step has finished.
+	 *
+	 * @param ret the return value of SSL_do_handshake()
+	 * @param error the return value of SSL_get_error(), which was
+	 * evaluated in the worker thread because OpenSSL's error queue
+	 * is thread-local
+	 */
+	virtual void OnSslHandshakeStep(int ret, int error) noexcept = 0;
+};
+
+/**
+ * Runs SSL_do_handshake() in a #WorkerPool thread, so the expensive
+ * public key operations of a TLS handshake (private key signature,
+ * key exchange) don't block the #EventLoop.
+ *
+ * While the job is pending, the caller must neither access the SSL
+ * object nor watch its socket.  When the handler reports
+ * SSL_ERROR_WANT_READ/WANT_WRITE, wait for the socket and Start()
+ * the next step; after the handshake is complete, continue with
+ * SSL_read()/SSL_write() in the #EventLoop thread as usual.
+ */
+class SslHandshakeJob final : public WorkerJob {
+	SslHandshakeHandler &handler;
+
+	SSL *ssl = nullptr;
+
+	int ret, error;
+
+public:
+	SslHandshakeJob(EventLoop &_loop, SslHandshakeHandler &_handler)
+		:WorkerJob(_loop), handler(_handler) {}
+
+	void Start(WorkerPool &pool, SSL &_ssl) noexcept {
+		ssl = &_ssl;
+		pool.Submit(*this);
+	}
+
+protected:
+	/* virtual methods from WorkerJob */
+	void Run() noexcept override {
+		ERR_clear_error();
+		ret = SSL_do_handshake(ssl);
+		error = SSL_get_error(ssl, ret);
+
+		/* don't leak errors into the next job of this
+		   thread */
+		ERR_clear_error();
+	}
+
+	void OnDone() noexcept override {
+		handler.OnSslHandshakeStep(ret, error);
+	}
+};
+
+#endif
@@ -33,10 +33,140 @@
 #include "Hash.hxx"
 #include "Buffer.hxx"
 #include "Error.hxx"
+#include "io/FileDescriptor.hxx"
+#include "system/Error.hxx"
 #include "util/ConstBuffer.hxx"
 
 #include <openssl/evp.h>
 
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+
+SslHasher::SslHasher(const EVP_MD &_md)
+	:ctx(EVP_MD_CTX_new()), md(_md)
+{
+	if (ctx == nullptr)
+		throw SslError("EVP_MD_CTX_new() failed");
+
+	if (!EVP_DigestInit_ex(ctx, &md, nullptr)) {
+		EVP_MD_CTX_free(ctx);
+		throw SslError("EVP_DigestInit_ex() failed");
+	}
+}
+
+SslHasher::~SslHasher() noexcept
+{
+	EVP_MD_CTX_free(ctx);
+}
+
+void
+SslHasher::Reset()
+{
+	if (!EVP_DigestInit_ex(ctx, &md, nullptr))
+		throw SslError("EVP_DigestInit_ex() failed");
+}
+
+void
+SslHasher::Update(ConstBuffer<void> src)
+{
+	if (!EVP_DigestUpdate(ctx, src.data, src.size))
+		throw SslError("EVP_DigestUpdate() failed");
+}
+
+void
+SslHasher::Update(ConstBuffer<struct iovec> src)
+{
+	for (const auto &i : src)
+		Update({i.iov_base, i.iov_len});
+}
+
+/**
+ * Files smaller than this are read() instead of mapped, because
+ * mmap() and munmap() cost more than copying a few pages.
+ */
+static constexpr size_t HASH_MMAP_THRESHOLD = 256 * 1024;
+
+/**
+ * Map at most this many bytes at a time, to limit the address space
+ * (and page table) usage for huge files.
+ */
+static constexpr size_t HASH_MMAP_WINDOW = 64 * 1024 * 1024;
+
+void
+SslHasher::UpdateFile(FileDescriptor fd)
+{
+	struct stat st;
+	off_t offset = 0;
+	if (fstat(fd.Get(), &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size >= off_t(HASH_MMAP_THRESHOLD) &&
+	    (offset = lseek(fd.Get(), 0, SEEK_CUR)) >= 0) {
+		/* windows must start at a page boundary */
+		const off_t page_size = sysconf(_SC_PAGESIZE);
+
+		while (offset < st.st_size) {
+			const off_t map_offset = offset - offset % page_size;
+			const size_t map_size =
+				std::min<off_t>(st.st_size - map_offset,
+						HASH_MMAP_WINDOW);
+
+			void *p = mmap(nullptr, map_size, PROT_READ,
+				       MAP_PRIVATE, fd.Get(), map_offset);
+			if (p == MAP_FAILED)
+				throw MakeErrno("mmap() failed");
+
+			madvise(p, map_size, MADV_SEQUENTIAL);
+
+			const size_t skip = offset - map_offset;
+
+			try {
+				Update({(const char *)p + skip, map_size - skip});
+			} catch (...) {
+				munmap(p, map_size);
+				throw;
+			}
+
+			munmap(p, map_size);
+			offset = map_offset + map_size;
+		}
+
+		/* leave the file position at the end, like the read()
+		   loop below */
+		lseek(fd.Get(), offset, SEEK_SET);
+		return;
+	}
+
+	char buffer[65536];
+
+	while (true) {
+		ssize_t nbytes = fd.Read(buffer, sizeof(buffer));
+		if (nbytes < 0)
+			throw MakeErrno("Failed to read file");
+
+		if (nbytes == 0)
+			break;
+
+		Update({buffer, size_t(nbytes)});
+	}
+}
+
+void
+SslHasher::Final(void *dest)
+{
+	if (!EVP_DigestFinal_ex(ctx, (unsigned char *)dest, nullptr))
+		throw SslError("EVP_DigestFinal_ex() failed");
+
+	Reset();
+}
+
 SHA1Digest
 CalcSHA1(ConstBuffer<void> src)
 {
@@ -54,3 +184,38 @@ CalcSHA1(X509_NAME &src)
 	const SslBuffer buffer(src);
 	return CalcSHA1(buffer.get());
 }
+
+SHA256Digest
+CalcSHA256(ConstBuffer<void> src)
+{
+	SHA256Digest result;
+	if (!EVP_Digest(src.data, src.size, result.data, nullptr,
+			EVP_sha256(), nullptr))
+		throw SslError("EVP_Digest() failed");
+
+	return result;
+}
+
+template<typename H, typename D>
+static void
+CalcBatch(ConstBuffer<ConstBuffer<void>> src, D *dest)
+{
+	H hasher;
+
+	for (const auto &i : src) {
+		hasher.Update(i);
+		*dest++ = hasher.Final();
+	}
+}
+
+void
+CalcSHA1Batch(ConstBuffer<ConstBuffer<void>> src, SHA1Digest *dest)
+{
+	CalcBatch<SHA1Hasher>(src, dest);
+}
+
+void
+CalcSHA256Batch(ConstBuffer<ConstBuffer<void>> src, SHA256Digest *dest)
+{
+	CalcBatch<SHA256Hasher>(src, dest);
+}
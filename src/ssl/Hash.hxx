@@ -41,13 +41,89 @@
 
 #include <openssl/ossl_typ.h>
 #include <openssl/sha.h>
+#include <openssl/evp.h>
+
+#include <stddef.h>
 
 template<typename T> struct ConstBuffer;
+struct iovec;
+class FileDescriptor;
 
 struct SHA1Digest {
 	unsigned char data[SHA_DIGEST_LENGTH];
 };
 
+struct SHA256Digest {
+	unsigned char data[SHA256_DIGEST_LENGTH];
+};
+
+/**
+ * Incremental message digest calculation.  This is a thin wrapper
+ * for EVP_MD_CTX; OpenSSL selects the fastest implementation
+ * (SHA-NI, AVX2, ...) for the CPU at runtime.
+ *
+ * Methods throw SslError on error.
+ */
+class SslHasher {
+	EVP_MD_CTX *const ctx;
+	const EVP_MD &md;
+
+public:
+	explicit SslHasher(const EVP_MD &_md);
+	~SslHasher() noexcept;
+
+	SslHasher(const SslHasher &) = delete;
+	SslHasher &operator=(const SslHasher &) = delete;
+
+	/**
+	 * Discard all data passed to Update() and start over.
+	 */
+	void Reset();
+
+	void Update(ConstBuffer<void> src);
+
+	/**
+	 * Hash all buffers of the given I/O vector, in order.
+	 */
+	void Update(ConstBuffer<struct iovec> src);
+
+	/**
+	 * Hash the contents of the given file, starting at the
+	 * current file position until end-of-file.  Regular files
+	 * are mapped into memory; other files (e.g. pipes) are read
+	 * in chunks.
+	 *
+	 * Throws std::system_error on I/O error.
+	 */
+	void UpdateFile(FileDescriptor fd);
+
+	/**
+	 * Finish the calculation and write the digest to the given
+	 * buffer, which must be large enough for the digest size of
+	 * the #EVP_MD.  Afterwards, this object is reset and can be
+	 * reused.
+	 */
+	void Final(void *dest);
+};
+
+/**
+ * A #SslHasher with a fixed algorithm and a typed Final() method.
+ */
+template<typename D, const EVP_MD *(*get_md)()>
+class SslTypedHasher : public SslHasher {
+public:
+	SslTypedHasher():SslHasher(*get_md()) {}
+
+	D Final() {
+		D result;
+		SslHasher::Final(result.data);
+		return result;
+	}
+};
+
+using SHA1Hasher = SslTypedHasher<SHA1Digest, EVP_sha1>;
+using SHA256Hasher = SslTypedHasher<SHA256Digest, EVP_sha256>;
+
 gcc_pure
 SHA1Digest
 CalcSHA1(ConstBuffer<void> src);
@@ -56,4 +132,24 @@ gcc_pure
 SHA1Digest
 CalcSHA1(X509_NAME &src);
 
+gcc_pure
+SHA256Digest
+CalcSHA256(ConstBuffer<void> src);
+
+/**
+ * Calculate the SHA1 digests of many (small) inputs.  This reuses
+ * one digest context, which is cheaper than calling CalcSHA1()
+ * for each of them.
+ *
+ * @param dest an array with the same number of elements as #src
+ */
+void
+CalcSHA1Batch(ConstBuffer<ConstBuffer<void>> src, SHA1Digest *dest);
+
+/**
+ * The SHA256 version of CalcSHA1Batch().
+ */
+void
+CalcSHA256Batch(ConstBuffer<ConstBuffer<void>> src, SHA256Digest *dest);
+
 #endif
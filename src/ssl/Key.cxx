@@ -38,13 +38,14 @@
 #include <openssl/bn.h>
 #include <openssl/evp.h>
 #include <openssl/rsa.h>
+#include <openssl/ec.h>
 #include <openssl/x509.h>
 #include <openssl/err.h>
 
 #include <assert.h>
 
 UniqueEVP_PKEY
-GenerateRsaKey()
+GenerateRsaKey(unsigned bits)
 {
 	const UniqueBIGNUM e(BN_new());
 	if (!e)
@@ -57,7 +58,7 @@ GenerateRsaKey()
 	if (!rsa)
 		throw SslError("RSA_new() failed");
 
-	if (!RSA_generate_key_ex(rsa.get(), 4096, e.get(), nullptr))
+	if (!RSA_generate_key_ex(rsa.get(), bits, e.get(), nullptr))
 		throw SslError("RSA_generate_key_ex() failed");
 
 	UniqueEVP_PKEY key(EVP_PKEY_new());
@@ -72,6 +73,32 @@ GenerateRsaKey()
 	return key;
 }
 
+UniqueEVP_PKEY
+GenerateEcKey(int curve_nid)
+{
+	UniqueEC_KEY ec(EC_KEY_new_by_curve_name(curve_nid));
+	if (!ec)
+		throw SslError("EC_KEY_new_by_curve_name() failed");
+
+	/* encode the curve by name, not by parameters, or many
+	   peers will reject it */
+	EC_KEY_set_asn1_flag(ec.get(), OPENSSL_EC_NAMED_CURVE);
+
+	if (!EC_KEY_generate_key(ec.get()))
+		throw SslError("EC_KEY_generate_key() failed");
+
+	UniqueEVP_PKEY key(EVP_PKEY_new());
+	if (!key)
+		throw SslError("EVP_PKEY_new() failed");
+
+	if (!EVP_PKEY_assign_EC_KEY(key.get(), ec.get()))
+		throw SslError("EVP_PKEY_assign_EC_KEY() failed");
+
+	ec.release();
+
+	return key;
+}
+
 UniqueEVP_PKEY
 DecodeDerKey(ConstBuffer<void> der)
 {
@@ -45,8 +45,22 @@
 
 template<typename T> struct ConstBuffer;
 
+/**
+ * Generate a new RSA key.  This is slow (up to several hundred
+ * milliseconds for 4096 bits); consider using #SslKeyPool.
+ *
+ * Throws SslError on error.
+ */
+UniqueEVP_PKEY
+GenerateRsaKey(unsigned bits=4096);
+
+/**
+ * Generate a new EC key on the given named curve.
+ *
+ * Throws SslError on error.
+ */
 UniqueEVP_PKEY
-GenerateRsaKey();
+GenerateEcKey(int curve_nid);
 
 /**
  * Decode a private key encoded with DER.  It is a wrapper for
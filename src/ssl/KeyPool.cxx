@@ -0,0 +1,176 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "KeyPool.hxx"
+#include "Key.hxx"
+
+#include <stdexcept>
+
+#include <sched.h>
+
+UniqueEVP_PKEY
+SslKeyType::Generate() const
+{
+	switch (id) {
+	case EVP_PKEY_RSA:
+		return GenerateRsaKey(parameter);
+
+	case EVP_PKEY_EC:
+		return GenerateEcKey(parameter);
+
+	default:
+		throw std::invalid_argument("Unsupported key type");
+	}
+}
+
+SslKeyPool::SslKeyPool(size_t _capacity,
+		       std::initializer_list<SslKeyType> types)
+	:capacity(_capacity)
+{
+	for (const auto &type : types)
+		slots.emplace_back(type);
+
+	thread = std::thread(&SslKeyPool::Run, this);
+}
+
+SslKeyPool::~SslKeyPool() noexcept
+{
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+		should_stop = true;
+		cond.notify_one();
+	}
+
+	thread.join();
+}
+
+inline SslKeyPool::Slot *
+SslKeyPool::FindSlot(SslKeyType type) noexcept
+{
+	for (auto &slot : slots)
+		if (slot.type == type)
+			return &slot;
+
+	return nullptr;
+}
+
+inline SslKeyPool::Slot *
+SslKeyPool::FindShallowest() noexcept
+{
+	Slot *result = nullptr;
+
+	for (auto &slot : slots)
+		if (slot.keys.size() < capacity &&
+		    (result == nullptr ||
+		     slot.keys.size() < result->keys.size()))
+			result = &slot;
+
+	return result;
+}
+
+UniqueEVP_PKEY
+SslKeyPool::Get(SslKeyType type)
+{
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+
+		auto *slot = FindSlot(type);
+		if (slot != nullptr && !slot->keys.empty()) {
+			auto key = std::move(slot->keys.front());
+			slot->keys.pop_front();
+			cond.notify_one();
+			return key;
+		}
+	}
+
+	/* the pool is empty (or this type is not pooled): don't
+	   wait for the background thread, which may be busy with
+	   another type */
+	return type.Generate();
+}
+
+size_t
+SslKeyPool::GetAvailable(SslKeyType type) const noexcept
+{
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	for (const auto &slot : slots)
+		if (slot.type == type)
+			return slot.keys.size();
+
+	return 0;
+}
+
+void
+SslKeyPool::Run() noexcept
+{
+	/* key generation is background work which must not compete
+	   with request handling */
+	static struct sched_param sched_param;
+	sched_setscheduler(0, SCHED_IDLE, &sched_param);
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (!should_stop) {
+		auto *slot = FindShallowest();
+		if (slot == nullptr) {
+			cond.wait(lock);
+			continue;
+		}
+
+		const auto type = slot->type;
+
+		lock.unlock();
+
+		UniqueEVP_PKEY key;
+		try {
+			key = type.Generate();
+		} catch (...) {
+			/* ignore; Get() will generate (and report the
+			   error) synchronously when the pool is
+			   empty */
+		}
+
+		lock.lock();
+
+		if (!key) {
+			/* don't spin on a persistent failure */
+			cond.wait_for(lock, std::chrono::seconds(10));
+			continue;
+		}
+
+		/* the slot pointer is stable, because #slots is a
+		   std::list which is never modified after
+		   construction */
+		slot->keys.emplace_back(std::move(key));
+	}
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SSL_KEY_POOL_HXX
+#define SSL_KEY_POOL_HXX
+
+#include "Unique.hxx"
+#include "util/Compiler.h"
+
+#include <openssl/evp.h>
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+
+/**
+ * Describes which kind of key shall be generated.
+ */
+struct SslKeyType {
+	/**
+	 * EVP_PKEY_RSA or EVP_PKEY_EC.
+	 */
+	int id;
+
+	/**
+	 * The key size in bits (RSA) or the curve NID (EC).
+	 */
+	int parameter;
+
+	static constexpr SslKeyType Rsa(unsigned bits=4096) noexcept {
+		return {EVP_PKEY_RSA, int(bits)};
+	}
+
+	static constexpr SslKeyType Ec(int curve_nid) noexcept {
+		return {EVP_PKEY_EC, curve_nid};
+	}
+
+	constexpr bool operator==(const SslKeyType &other) const noexcept {
+		return id == other.id &&
+			parameter == other.parameter;
+	}
+
+	/**
+	 * Generate a new key of this type synchronously.
+	 *
+	 * Throws SslError on error.
+	 */
+	UniqueEVP_PKEY Generate() const;
+};
+
+/**
+ * Keeps a number of pregenerated keys per #SslKeyType, so callers
+ * (e.g. certificate issuance or MakeSelfSignedDummyCert()) don't
+ * have to wait for the key generation.  A background thread with
+ * SCHED_IDLE priority refills the pool.
+ *
+ * All public methods are thread-safe.
+ */
+class SslKeyPool {
+	struct Slot {
+		const SslKeyType type;
+
+		std::deque<UniqueEVP_PKEY> keys;
+
+		explicit Slot(SslKeyType _type) noexcept:type(_type) {}
+	};
+
+	/**
+	 * The number of keys kept per type.
+	 */
+	const size_t capacity;
+
+	mutable std::mutex mutex;
+	std::condition_variable cond;
+
+	std::list<Slot> slots;
+
+	bool should_stop = false;
+
+	std::thread thread;
+
+public:
+	/**
+	 * Throws std::system_error if the thread cannot be created.
+	 *
+	 * @param capacity the number of keys to keep per type
+	 * @param types the key types to generate in the background;
+	 * others are generated synchronously by Get()
+	 */
+	SslKeyPool(size_t _capacity, std::initializer_list<SslKeyType> types);
+
+	~SslKeyPool() noexcept;
+
+	SslKeyPool(const SslKeyPool &) = delete;
+	SslKeyPool &operator=(const SslKeyPool &) = delete;
+
+	/**
+	 * Obtain a new key.  If the pool for this type is empty, the
+	 * key is generated synchronously.  Each key is handed out
+	 * only once.
+	 *
+	 * Throws SslError on error.
+	 */
+	UniqueEVP_PKEY Get(SslKeyType type);
+
+	/**
+	 * Returns the number of pregenerated keys currently available
+	 * for the given type.
+	 */
+	gcc_pure
+	size_t GetAvailable(SslKeyType type) const noexcept;
+
+private:
+	gcc_pure
+	Slot *FindSlot(SslKeyType type) noexcept;
+
+	/**
+	 * Returns the slot with the fewest keys below #capacity, or
+	 * nullptr if all are full.
+	 */
+	gcc_pure
+	Slot *FindShallowest() noexcept;
+
+	void Run() noexcept;
+};
+
+#endif
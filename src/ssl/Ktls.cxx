@@ -0,0 +1,128 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Ktls.hxx"
+#include "io/FileDescriptor.hxx"
+
+#include <openssl/err.h>
+
+#include <errno.h>
+
+bool
+EnableKtls(SSL_CTX &ssl_ctx) noexcept
+{
+#ifdef SSL_OP_ENABLE_KTLS
+	SSL_CTX_set_options(&ssl_ctx, SSL_OP_ENABLE_KTLS);
+	return true;
+#else
+	(void)ssl_ctx;
+	return false;
+#endif
+}
+
+bool
+EnableKtls(SSL &ssl) noexcept
+{
+#ifdef SSL_OP_ENABLE_KTLS
+	SSL_set_options(&ssl, SSL_OP_ENABLE_KTLS);
+	return true;
+#else
+	(void)ssl;
+	return false;
+#endif
+}
+
+bool
+IsKtlsSendActive(SSL &ssl) noexcept
+{
+#ifdef BIO_get_ktls_send
+	BIO *bio = SSL_get_wbio(&ssl);
+	return bio != nullptr && BIO_get_ktls_send(bio);
+#else
+	(void)ssl;
+	return false;
+#endif
+}
+
+bool
+IsKtlsReceiveActive(SSL &ssl) noexcept
+{
+#ifdef BIO_get_ktls_recv
+	BIO *bio = SSL_get_rbio(&ssl);
+	return bio != nullptr && BIO_get_ktls_recv(bio);
+#else
+	(void)ssl;
+	return false;
+#endif
+}
+
+ssize_t
+SslSendFile(SSL &ssl, FileDescriptor fd, off_t offset, size_t size) noexcept
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if (!IsKtlsSendActive(ssl)) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	ERR_clear_error();
+	ossl_ssize_t nbytes = SSL_sendfile(&ssl, fd.Get(), offset, size, 0);
+	if (nbytes >= 0)
+		return nbytes;
+
+	const int error = SSL_get_error(&ssl, nbytes);
+	ERR_clear_error();
+
+	switch (error) {
+	case SSL_ERROR_WANT_WRITE:
+		errno = EAGAIN;
+		break;
+
+	case SSL_ERROR_SYSCALL:
+		/* errno was set by sendfile() */
+		break;
+
+	default:
+		errno = EIO;
+		break;
+	}
+
+	return -1;
+#else
+	(void)ssl;
+	(void)fd;
+	(void)offset;
+	(void)size;
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Kernel TLS (kTLS) offload.
+ *
+ * After the handshake, OpenSSL can pass the session keys to the
+ * kernel (TCP_ULP "tls").  From then on, data written to the socket
+ * is encrypted by the kernel, which allows sending files with
+ * sendfile() or splice() instead of reading them into userspace
+ * and encrypting them there.
+ *
+ * This works only if the SSL object is bound to the socket with
+ * SSL_set_fd() (not with a memory BIO), and only with ciphers the
+ * kernel supports (e.g. AES-GCM); otherwise OpenSSL silently keeps
+ * encrypting in userspace.
+ */
+
+#ifndef SSL_KTLS_HXX
+#define SSL_KTLS_HXX
+
+#include "util/Compiler.h"
+
+#include <openssl/ssl.h>
+
+#include <sys/types.h>
+
+class FileDescriptor;
+
+/**
+ * Switch all connections of this context to kernel TLS after the
+ * handshake (SSL_OP_ENABLE_KTLS).  Call before creating SSL objects.
+ *
+ * @return false if this OpenSSL build does not support kTLS
+ */
+bool
+EnableKtls(SSL_CTX &ssl_ctx) noexcept;
+
+/**
+ * Like EnableKtls(SSL_CTX &), but only for one connection.  Call
+ * before the handshake.
+ */
+bool
+EnableKtls(SSL &ssl) noexcept;
+
+/**
+ * Are outgoing records encrypted by the kernel?  Only meaningful
+ * after the handshake has completed.
+ */
+gcc_pure
+bool
+IsKtlsSendActive(SSL &ssl) noexcept;
+
+/**
+ * Are incoming records decrypted by the kernel?
+ */
+gcc_pure
+bool
+IsKtlsReceiveActive(SSL &ssl) noexcept;
+
+/**
+ * Send a portion of a file over the TLS connection with sendfile().
+ * This requires IsKtlsSendActive().  Once kTLS transmission is
+ * active, it is also possible to pass the socket to
+ * SocketWrapper::WriteFrom(), which encrypts file and pipe data in
+ * the kernel just the same.
+ *
+ * @return the number of bytes sent, or -1 with errno set (EAGAIN
+ * if the socket is not writable)
+ */
+ssize_t
+SslSendFile(SSL &ssl, FileDescriptor fd, off_t offset,
+	    size_t size) noexcept;
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "OcspStapler.hxx"
+#include "Error.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/RuntimeError.hxx"
+#include "util/ScopeExit.hxx"
+
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include <algorithm>
+
+constexpr unsigned SslOcspStapler::REFRESH_PERCENT;
+constexpr std::chrono::minutes SslOcspStapler::RETRY_INTERVAL;
+
+SslOcspStapler::Item::Item(X509 &_cert, X509 &_issuer, OCSP_CERTID *_id,
+			   std::string &&_url) noexcept
+	:cert(UpRef(_cert)), issuer(UpRef(_issuer)),
+	 id(_id, OCSP_CERTID_free),
+	 url(std::move(_url)),
+	 expires(Clock::time_point::min()),
+	 refresh(Clock::time_point::min())
+{
+}
+
+static SslOcspStapler::Key
+CalcCertIdKey(OCSP_CERTID &id)
+{
+	const int length = i2d_OCSP_CERTID(&id, nullptr);
+	if (length <= 0)
+		throw SslError("i2d_OCSP_CERTID() failed");
+
+	std::unique_ptr<unsigned char[]> der(new unsigned char[length]);
+	unsigned char *p = der.get();
+	i2d_OCSP_CERTID(&id, &p);
+
+	return CalcSHA1({der.get(), size_t(length)});
+}
+
+/**
+ * Returns the (first) OCSP responder URL of the given certificate,
+ * or an empty string.
+ */
+static std::string
+GetOcspUrl(X509 &cert)
+{
+	std::string result;
+
+	STACK_OF(OPENSSL_STRING) *urls = X509_get1_ocsp(&cert);
+	if (urls != nullptr) {
+		if (sk_OPENSSL_STRING_num(urls) > 0)
+			result = sk_OPENSSL_STRING_value(urls, 0);
+		X509_email_free(urls);
+	}
+
+	return result;
+}
+
+bool
+SslOcspStapler::Add(X509 &cert, X509 &issuer)
+{
+	std::string url = GetOcspUrl(cert);
+	if (url.empty())
+		return false;
+
+	OCSP_CERTID *id = OCSP_cert_to_id(nullptr, &cert, &issuer);
+	if (id == nullptr)
+		throw SslError("OCSP_cert_to_id() failed");
+
+	Key key;
+	try {
+		key = CalcCertIdKey(*id);
+	} catch (...) {
+		OCSP_CERTID_free(id);
+		throw;
+	}
+
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	auto i = items.find(key);
+	if (i == items.end())
+		i = items.emplace(std::piecewise_construct,
+				  std::forward_as_tuple(key),
+				  std::forward_as_tuple(cert, issuer, id,
+							std::move(url))).first;
+	else
+		/* the same certificate in another SSL_CTX (or another
+		   X509 object): share the response */
+		OCSP_CERTID_free(id);
+
+	by_cert[&cert] = &i->second;
+	return true;
+}
+
+bool
+SslOcspStapler::Add(SSL_CTX &ctx)
+{
+	X509 *cert = SSL_CTX_get0_certificate(&ctx);
+	if (cert == nullptr)
+		return false;
+
+	STACK_OF(X509) *chain = nullptr;
+	SSL_CTX_get_extra_chain_certs(&ctx, &chain);
+	if (chain == nullptr)
+		return false;
+
+	for (int i = 0, n = sk_X509_num(chain); i < n; ++i) {
+		X509 *issuer = sk_X509_value(chain, i);
+		if (X509_check_issued(issuer, cert) == X509_V_OK)
+			return Add(*cert, *issuer);
+	}
+
+	return false;
+}
+
+std::vector<SslOcspStapler::Request>
+SslOcspStapler::CollectDue(Clock::time_point now, size_t max)
+{
+	std::vector<Request> result;
+
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	for (auto &i : items) {
+		if (result.size() >= max)
+			break;
+
+		auto &item = i.second;
+		if (item.busy || item.refresh > now)
+			continue;
+
+		OCSP_REQUEST *req = OCSP_REQUEST_new();
+		if (req == nullptr)
+			throw SslError("OCSP_REQUEST_new() failed");
+
+		AtScopeExit(req) { OCSP_REQUEST_free(req); };
+
+		OCSP_CERTID *id = OCSP_CERTID_dup(item.id.get());
+		if (id == nullptr || OCSP_request_add0_id(req, id) == nullptr) {
+			OCSP_CERTID_free(id);
+			throw SslError("OCSP_request_add0_id() failed");
+		}
+
+		const int length = i2d_OCSP_REQUEST(req, nullptr);
+		if (length <= 0)
+			throw SslError("i2d_OCSP_REQUEST() failed");
+
+		Request r;
+		r.key = i.first;
+		r.url = item.url;
+		r.body.resize(length);
+		unsigned char *p = (unsigned char *)&r.body.front();
+		i2d_OCSP_REQUEST(req, &p);
+
+		result.push_back(std::move(r));
+		item.busy = true;
+	}
+
+	return result;
+}
+
+SslOcspStapler::Clock::time_point
+SslOcspStapler::GetNextRefresh() const noexcept
+{
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	auto result = Clock::time_point::max();
+	for (const auto &i : items)
+		if (!i.second.busy)
+			result = std::min(result, i.second.refresh);
+
+	return result;
+}
+
+/**
+ * Returns the number of seconds from now until the given time
+ * (negative if it is in the past).
+ */
+static long
+SecondsUntil(const ASN1_GENERALIZEDTIME &t)
+{
+	int days, seconds;
+	if (!ASN1_TIME_diff(&days, &seconds, nullptr, &t))
+		throw SslError("ASN1_TIME_diff() failed");
+
+	return long(days) * 86400 + seconds;
+}
+
+void
+SslOcspStapler::ParseResponse(Item &item, ConstBuffer<void> der,
+			      Clock::time_point now)
+{
+	const unsigned char *p = (const unsigned char *)der.data;
+	OCSP_RESPONSE *response = d2i_OCSP_RESPONSE(nullptr, &p, der.size);
+	if (response == nullptr)
+		throw SslError("Malformed OCSP response");
+
+	AtScopeExit(response) { OCSP_RESPONSE_free(response); };
+
+	const int response_status = OCSP_response_status(response);
+	if (response_status != OCSP_RESPONSE_STATUS_SUCCESSFUL)
+		throw FormatRuntimeError("OCSP responder error: %s",
+					 OCSP_response_status_str(response_status));
+
+	OCSP_BASICRESP *basic = OCSP_response_get1_basic(response);
+	if (basic == nullptr)
+		throw SslError("OCSP_response_get1_basic() failed");
+
+	AtScopeExit(basic) { OCSP_BASICRESP_free(basic); };
+
+	/* the response must be signed by the issuer or by a
+	   responder certificate issued by it */
+
+	X509_STORE *store = X509_STORE_new();
+	STACK_OF(X509) *certs = sk_X509_new_null();
+	AtScopeExit(store, certs) {
+		sk_X509_free(certs);
+		X509_STORE_free(store);
+	};
+
+	if (store == nullptr || certs == nullptr ||
+	    !X509_STORE_add_cert(store, item.issuer.get()) ||
+	    !sk_X509_push(certs, item.issuer.get()))
+		throw SslError("Failed to set up OCSP verification");
+
+	X509_STORE_set_flags(store, X509_V_FLAG_PARTIAL_CHAIN);
+
+	if (OCSP_basic_verify(basic, certs, store, OCSP_TRUSTOTHER) <= 0)
+		throw SslError("OCSP response verification failed");
+
+	int status, reason;
+	ASN1_GENERALIZEDTIME *revoked, *this_update, *next_update;
+	if (!OCSP_resp_find_status(basic, item.id.get(), &status, &reason,
+				   &revoked, &this_update, &next_update))
+		throw std::runtime_error("OCSP response does not cover the certificate");
+
+	/* allow 5 minutes of clock skew */
+	if (!OCSP_check_validity(this_update, next_update, 300, -1))
+		throw SslError("OCSP response is not valid");
+
+	/* without nextUpdate, newer information is always
+	   available; refresh hourly */
+	const long lifetime = next_update != nullptr
+		? SecondsUntil(*next_update)
+		: 3600;
+
+	/* the certificate status (even "revoked") is stapled
+	   as-is; it's up to the client to evaluate it */
+
+	item.response.assign((const char *)der.data, der.size);
+	item.expires = now + std::chrono::seconds(lifetime);
+	item.refresh = now + std::max(std::chrono::seconds(lifetime * long(REFRESH_PERCENT) / 100),
+				      std::chrono::seconds(60));
+}
+
+void
+SslOcspStapler::OnResponse(const Key &key, ConstBuffer<void> der)
+{
+	const auto now = Clock::now();
+
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	auto i = items.find(key);
+	if (i == items.end())
+		return;
+
+	auto &item = i->second;
+	item.busy = false;
+
+	try {
+		ParseResponse(item, der, now);
+	} catch (...) {
+		item.refresh = now + RETRY_INTERVAL;
+		throw;
+	}
+}
+
+void
+SslOcspStapler::OnError(const Key &key) noexcept
+{
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	auto i = items.find(key);
+	if (i == items.end())
+		return;
+
+	auto &item = i->second;
+	item.busy = false;
+	item.refresh = Clock::now() + RETRY_INTERVAL;
+}
+
+std::string
+SslOcspStapler::Get(const X509 &cert) const
+{
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	auto i = by_cert.find(&cert);
+	if (i == by_cert.end())
+		return std::string();
+
+	const auto &item = *i->second;
+	if (item.response.empty() || item.expires <= Clock::now())
+		return std::string();
+
+	return item.response;
+}
+
+int
+SslOcspStapler::StatusCallback(SSL *ssl, void *ctx) noexcept
+{
+	const auto &stapler = *(const SslOcspStapler *)ctx;
+
+	const X509 *cert = SSL_get_certificate(ssl);
+	if (cert == nullptr)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	try {
+		const auto response = stapler.Get(*cert);
+		if (response.empty())
+			return SSL_TLSEXT_ERR_NOACK;
+
+		/* OpenSSL takes over ownership of this buffer */
+		void *p = OPENSSL_malloc(response.size());
+		if (p == nullptr)
+			return SSL_TLSEXT_ERR_NOACK;
+
+		memcpy(p, response.data(), response.size());
+		SSL_set_tlsext_status_ocsp_resp(ssl, p, response.size());
+		return SSL_TLSEXT_ERR_OK;
+	} catch (...) {
+		return SSL_TLSEXT_ERR_NOACK;
+	}
+}
+
+void
+SslOcspStapler::Enable(SSL_CTX &ctx) noexcept
+{
+	SSL_CTX_set_tlsext_status_cb(&ctx, StatusCallback);
+	SSL_CTX_set_tlsext_status_arg(&ctx, this);
+}
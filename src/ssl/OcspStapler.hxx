@@ -0,0 +1,222 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SSL_OCSP_STAPLER_HXX
+#define SSL_OCSP_STAPLER_HXX
+
+#include "Hash.hxx"
+#include "Unique.hxx"
+
+#include <openssl/ocsp.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <string.h>
+
+template<typename T> struct ConstBuffer;
+
+/**
+ * Caches OCSP responses for server certificates and staples them
+ * into TLS handshakes (status_request extension) from memory.
+ *
+ * This class does not fetch responses; it tells the caller which
+ * responses are due (CollectDue()) and accepts the responder's
+ * answers (OnResponse()).  See #CurlOcspFetcher.
+ *
+ * This class is thread-safe.
+ */
+class SslOcspStapler {
+public:
+	typedef std::chrono::system_clock Clock;
+
+	/**
+	 * Identifies a certificate: the SHA1 of its OCSP CertID,
+	 * which consists of the hashes of the issuer's name and key
+	 * and the certificate's serial number.
+	 */
+	typedef SHA1Digest Key;
+
+	struct Request {
+		Key key;
+
+		/**
+		 * The OCSP responder URL.
+		 */
+		std::string url;
+
+		/**
+		 * The DER-encoded OCSP request, to be POSTed with
+		 * content type "application/ocsp-request".
+		 */
+		std::string body;
+	};
+
+private:
+	struct KeyCompare {
+		bool operator()(const Key &a, const Key &b) const noexcept {
+			return memcmp(a.data, b.data, sizeof(a.data)) < 0;
+		}
+	};
+
+	struct Item {
+		UniqueX509 cert, issuer;
+
+		std::unique_ptr<OCSP_CERTID, void(*)(OCSP_CERTID *)> id;
+
+		std::string url;
+
+		/**
+		 * The DER-encoded OCSP response; empty if none has
+		 * been received yet.
+		 */
+		std::string response;
+
+		/**
+		 * The response must not be stapled after this time.
+		 */
+		Clock::time_point expires;
+
+		/**
+		 * When to fetch the next response.
+		 */
+		Clock::time_point refresh;
+
+		/**
+		 * Is a request currently in flight?
+		 */
+		bool busy = false;
+
+		Item(X509 &_cert, X509 &_issuer, OCSP_CERTID *_id,
+		     std::string &&_url) noexcept;
+	};
+
+	mutable std::mutex mutex;
+
+	std::map<Key, Item, KeyCompare> items;
+
+	/**
+	 * Finds items by the X509 object which is used in the
+	 * SSL_CTX, for the status callback.
+	 */
+	std::unordered_map<const X509 *, Item *> by_cert;
+
+public:
+	/**
+	 * Fetch a new response after this fraction of its validity
+	 * period has elapsed.
+	 */
+	static constexpr unsigned REFRESH_PERCENT = 50;
+
+	/**
+	 * Retry after a failed fetch.
+	 */
+	static constexpr std::chrono::minutes RETRY_INTERVAL{5};
+
+	SslOcspStapler() = default;
+
+	SslOcspStapler(const SslOcspStapler &) = delete;
+	SslOcspStapler &operator=(const SslOcspStapler &) = delete;
+
+	/**
+	 * Register a certificate.  The same X509 object must be used
+	 * in the SSL_CTX.  The first response is due immediately.
+	 *
+	 * Throws SslError on error.
+	 *
+	 * @return false if the certificate does not specify an OCSP
+	 * responder
+	 */
+	bool Add(X509 &cert, X509 &issuer);
+
+	/**
+	 * Register the certificate of the given SSL_CTX; its issuer
+	 * is looked up in the SSL_CTX's extra chain certificates.
+	 *
+	 * Throws SslError on error.
+	 *
+	 * @return false if the SSL_CTX has no certificate, no issuer,
+	 * or the certificate does not specify an OCSP responder
+	 */
+	bool Add(SSL_CTX &ctx);
+
+	/**
+	 * Install the status callback in the given SSL_CTX.  This
+	 * object must outlive the SSL_CTX.
+	 */
+	void Enable(SSL_CTX &ctx) noexcept;
+
+	/**
+	 * Collect requests for all responses which need to be
+	 * (re)fetched now.  The items are marked busy until
+	 * OnResponse() or OnError() is called.
+	 *
+	 * @param max the maximum number of requests
+	 */
+	std::vector<Request> CollectDue(Clock::time_point now, size_t max);
+
+	/**
+	 * Returns the time when the next response is due, or
+	 * Clock::time_point::max() if there are no certificates.
+	 */
+	Clock::time_point GetNextRefresh() const noexcept;
+
+	/**
+	 * A response has been received.  It is verified and stored.
+	 *
+	 * Throws on error (and schedules a retry).
+	 */
+	void OnResponse(const Key &key, ConstBuffer<void> der);
+
+	/**
+	 * Fetching a response has failed; schedule a retry.
+	 */
+	void OnError(const Key &key) noexcept;
+
+	/**
+	 * Returns the stapled response for the given certificate, or
+	 * an empty string if there is no valid one.
+	 */
+	std::string Get(const X509 &cert) const;
+
+private:
+	static void ParseResponse(Item &item, ConstBuffer<void> der,
+				  Clock::time_point now);
+
+	static int StatusCallback(SSL *ssl, void *ctx) noexcept;
+};
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SessionCache.hxx"
+#include "Error.hxx"
+
+#include <algorithm>
+#include <functional>
+
+#include <string.h>
+
+constexpr size_t SslSessionCache::N_SHARDS;
+
+SslSessionCache::SslSessionCache(std::chrono::seconds _lifetime,
+				 size_t max_items) noexcept
+	:lifetime(_lifetime),
+	 max_shard_items(std::max<size_t>(max_items / N_SHARDS, 1))
+{
+}
+
+inline void
+SslSessionCache::Shard::Erase(std::list<Item>::iterator i) noexcept
+{
+	map.erase(i->id);
+	items.erase(i);
+}
+
+void
+SslSessionCache::Shard::Expire(Clock::time_point now) noexcept
+{
+	/* all items have the same lifetime, so the list is sorted by
+	   expiry */
+	while (!items.empty() && items.front().expires <= now)
+		Erase(items.begin());
+}
+
+inline SslSessionCache::Shard &
+SslSessionCache::GetShard(const std::string &id) noexcept
+{
+	return shards[std::hash<std::string>()(id) % N_SHARDS];
+}
+
+bool
+SslSessionCache::Add(SSL_SESSION &session) noexcept
+{
+	unsigned id_length;
+	const unsigned char *id_data = SSL_SESSION_get_id(&session, &id_length);
+
+	const int der_length = i2d_SSL_SESSION(&session, nullptr);
+	if (der_length <= 0)
+		return false;
+
+	Item item;
+	item.id.assign((const char *)id_data, id_length);
+
+	try {
+		item.der.resize(der_length);
+	} catch (const std::bad_alloc &) {
+		return false;
+	}
+
+	unsigned char *p = (unsigned char *)&item.der.front();
+	i2d_SSL_SESSION(&session, &p);
+
+	const auto now = Clock::now();
+	item.expires = now + lifetime;
+
+	auto &shard = GetShard(item.id);
+	const std::lock_guard<std::mutex> lock(shard.mutex);
+
+	shard.Expire(now);
+
+	auto existing = shard.map.find(item.id);
+	if (existing != shard.map.end())
+		shard.Erase(existing->second);
+	else if (shard.items.size() >= max_shard_items)
+		shard.Erase(shard.items.begin());
+
+	try {
+		shard.items.push_back(std::move(item));
+		auto i = std::prev(shard.items.end());
+		try {
+			shard.map.emplace(i->id, i);
+		} catch (...) {
+			shard.items.erase(i);
+			return false;
+		}
+	} catch (const std::bad_alloc &) {
+		return false;
+	}
+
+	return true;
+}
+
+SSL_SESSION *
+SslSessionCache::Get(const void *id, size_t id_length) noexcept
+{
+	std::string key;
+	std::string der;
+
+	try {
+		key.assign((const char *)id, id_length);
+
+		auto &shard = GetShard(key);
+		const std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto i = shard.map.find(key);
+		if (i == shard.map.end())
+			return nullptr;
+
+		if (i->second->expires <= Clock::now()) {
+			shard.Erase(i->second);
+			return nullptr;
+		}
+
+		der = i->second->der;
+	} catch (const std::bad_alloc &) {
+		return nullptr;
+	}
+
+	/* deserialize outside of the lock */
+	const unsigned char *p = (const unsigned char *)der.data();
+	return d2i_SSL_SESSION(nullptr, &p, der.size());
+}
+
+void
+SslSessionCache::Remove(const void *id, size_t id_length) noexcept
+{
+	try {
+		const std::string key((const char *)id, id_length);
+
+		auto &shard = GetShard(key);
+		const std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto i = shard.map.find(key);
+		if (i != shard.map.end())
+			shard.Erase(i->second);
+	} catch (const std::bad_alloc &) {
+	}
+}
+
+void
+SslSessionCache::Expire() noexcept
+{
+	const auto now = Clock::now();
+
+	for (auto &shard : shards) {
+		const std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.Expire(now);
+	}
+}
+
+void
+SslSessionCache::Clear() noexcept
+{
+	for (auto &shard : shards) {
+		const std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.map.clear();
+		shard.items.clear();
+	}
+}
+
+size_t
+SslSessionCache::size() noexcept
+{
+	size_t n = 0;
+	for (auto &shard : shards) {
+		const std::lock_guard<std::mutex> lock(shard.mutex);
+		n += shard.items.size();
+	}
+
+	return n;
+}
+
+static int
+GetSessionCacheIndex()
+{
+	static const int index =
+		SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+	return index;
+}
+
+inline SslSessionCache &
+SslSessionCache::FromCtx(SSL_CTX &ctx) noexcept
+{
+	return *(SslSessionCache *)SSL_CTX_get_ex_data(&ctx,
+						       GetSessionCacheIndex());
+}
+
+int
+SslSessionCache::NewSessionCallback(SSL *ssl, SSL_SESSION *session)
+{
+	FromCtx(*SSL_get_SSL_CTX(ssl)).Add(*session);
+
+	/* we have serialized the session and don't keep a
+	   reference */
+	return 0;
+}
+
+void
+SslSessionCache::RemoveSessionCallback(SSL_CTX *ctx, SSL_SESSION *session)
+{
+	unsigned id_length;
+	const unsigned char *id = SSL_SESSION_get_id(session, &id_length);
+	FromCtx(*ctx).Remove(id, id_length);
+}
+
+SSL_SESSION *
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+SslSessionCache::GetSessionCallback(SSL *ssl, const unsigned char *id,
+				    int length, int *copy)
+#else
+SslSessionCache::GetSessionCallback(SSL *ssl, unsigned char *id,
+				    int length, int *copy)
+#endif
+{
+	/* the returned reference is passed to OpenSSL */
+	*copy = 0;
+
+	return FromCtx(*SSL_get_SSL_CTX(ssl)).Get(id, length);
+}
+
+void
+SslSessionCache::Enable(SSL_CTX &ctx, const char *sid_ctx)
+{
+	const int index = GetSessionCacheIndex();
+	if (index < 0)
+		throw SslError("SSL_CTX_get_ex_new_index() failed");
+
+	if (!SSL_CTX_set_ex_data(&ctx, index, this))
+		throw SslError("SSL_CTX_set_ex_data() failed");
+
+	if (!SSL_CTX_set_session_id_context(&ctx,
+					    (const unsigned char *)sid_ctx,
+					    strlen(sid_ctx)))
+		throw SslError("SSL_CTX_set_session_id_context() failed");
+
+	SSL_CTX_set_session_cache_mode(&ctx,
+				       SSL_SESS_CACHE_SERVER|
+				       SSL_SESS_CACHE_NO_INTERNAL|
+				       SSL_SESS_CACHE_NO_AUTO_CLEAR);
+	SSL_CTX_set_timeout(&ctx, lifetime.count());
+
+	SSL_CTX_sess_set_new_cb(&ctx, NewSessionCallback);
+	SSL_CTX_sess_set_remove_cb(&ctx, RemoveSessionCallback);
+	SSL_CTX_sess_set_get_cb(&ctx, GetSessionCallback);
+}
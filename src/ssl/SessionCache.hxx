@@ -0,0 +1,160 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SSL_SESSION_CACHE_HXX
+#define SSL_SESSION_CACHE_HXX
+
+#include <openssl/ssl.h>
+
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * A server-side TLS session cache which can be shared by many
+ * SSL_CTX instances and threads.  Sessions are stored in serialized
+ * form, keyed by their session id, in a number of independently
+ * locked shards to reduce lock contention.  Each shard expires
+ * entries after a fixed lifetime and evicts the oldest entries when
+ * it is full.
+ */
+class SslSessionCache {
+	static constexpr size_t N_SHARDS = 16;
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Item {
+		std::string id;
+
+		/**
+		 * The session, serialized with i2d_SSL_SESSION().
+		 */
+		std::string der;
+
+		Clock::time_point expires;
+	};
+
+	struct Shard {
+		std::mutex mutex;
+
+		/**
+		 * All items, oldest first.
+		 */
+		std::list<Item> items;
+
+		std::unordered_map<std::string, std::list<Item>::iterator> map;
+
+		void Expire(Clock::time_point now) noexcept;
+		void Erase(std::list<Item>::iterator i) noexcept;
+	};
+
+	const std::chrono::seconds lifetime;
+
+	const size_t max_shard_items;
+
+	Shard shards[N_SHARDS];
+
+public:
+	/**
+	 * @param _lifetime expire sessions after this duration
+	 * @param max_items the maximum number of sessions in the whole
+	 * cache
+	 */
+	explicit SslSessionCache(std::chrono::seconds _lifetime=std::chrono::minutes(5),
+				 size_t max_items=65536) noexcept;
+
+	SslSessionCache(const SslSessionCache &) = delete;
+	SslSessionCache &operator=(const SslSessionCache &) = delete;
+
+	/**
+	 * Install this cache in the given SSL_CTX, replacing
+	 * OpenSSL's internal cache.  This object must outlive the
+	 * SSL_CTX.
+	 *
+	 * @param sid_ctx a context identifier stored in each session;
+	 * sessions are only resumed in a SSL_CTX with the same one
+	 *
+	 * Throws SslError on error.
+	 */
+	void Enable(SSL_CTX &ctx, const char *sid_ctx);
+
+	/**
+	 * Store a session.  Returns false if the session could not
+	 * be serialized.
+	 */
+	bool Add(SSL_SESSION &session) noexcept;
+
+	/**
+	 * Look up a session.  The caller owns the returned reference.
+	 *
+	 * @return the session or nullptr if none was found (or it has
+	 * expired)
+	 */
+	SSL_SESSION *Get(const void *id, size_t id_length) noexcept;
+
+	void Remove(const void *id, size_t id_length) noexcept;
+
+	/**
+	 * Remove all expired sessions.  The cache expires sessions
+	 * lazily, so calling this is only necessary to free memory.
+	 */
+	void Expire() noexcept;
+
+	void Clear() noexcept;
+
+	/**
+	 * Count the sessions in the cache (expensive, only for
+	 * statistics).
+	 */
+	size_t size() noexcept;
+
+private:
+	Shard &GetShard(const std::string &id) noexcept;
+
+	static SslSessionCache &FromCtx(SSL_CTX &ctx) noexcept;
+
+	static int NewSessionCallback(SSL *ssl, SSL_SESSION *session);
+	static void RemoveSessionCallback(SSL_CTX *ctx, SSL_SESSION *session);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	static SSL_SESSION *GetSessionCallback(SSL *ssl,
+					       const unsigned char *id,
+					       int length, int *copy);
+#else
+	static SSL_SESSION *GetSessionCallback(SSL *ssl,
+					       unsigned char *id,
+					       int length, int *copy);
+#endif
+};
+
+#endif
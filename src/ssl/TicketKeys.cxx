@@ -0,0 +1,221 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TicketKeys.hxx"
+#include "Error.hxx"
+#include "system/Error.hxx"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include <algorithm>
+
+#include <string.h>
+#include <unistd.h>
+
+constexpr size_t SslTicketKeys::MAX_KEYS;
+
+SslTicketKey
+SslTicketKey::Generate()
+{
+	SslTicketKey key;
+	if (RAND_bytes((unsigned char *)&key, sizeof(key)) != 1)
+		throw SslError("RAND_bytes() failed");
+	return key;
+}
+
+void
+SslTicketKeys::Rotate()
+{
+	const auto key = SslTicketKey::Generate();
+
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	std::move_backward(keys.begin(),
+			   keys.begin() + std::min(n_keys, MAX_KEYS - 1),
+			   keys.begin() + std::min(n_keys + 1, MAX_KEYS));
+	keys.front() = key;
+	if (n_keys < MAX_KEYS)
+		++n_keys;
+
+	last_rotation = std::chrono::steady_clock::now();
+}
+
+bool
+SslTicketKeys::RotateIfDue(std::chrono::steady_clock::duration interval)
+{
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+		if (n_keys > 0 &&
+		    std::chrono::steady_clock::now() < last_rotation + interval)
+			return false;
+	}
+
+	Rotate();
+	return true;
+}
+
+void
+SslTicketKeys::Load(FileDescriptor fd)
+{
+	std::array<SslTicketKey, MAX_KEYS> new_keys;
+	ssize_t nbytes = pread(fd.Get(), &new_keys, sizeof(new_keys), 0);
+	if (nbytes < 0)
+		throw MakeErrno("Failed to read ticket keys");
+
+	if (nbytes == 0 || nbytes % sizeof(SslTicketKey) != 0)
+		throw std::runtime_error("Malformed ticket key file");
+
+	const std::lock_guard<std::mutex> lock(mutex);
+	keys = new_keys;
+	n_keys = nbytes / sizeof(SslTicketKey);
+	last_rotation = std::chrono::steady_clock::now();
+}
+
+void
+SslTicketKeys::Save(FileDescriptor fd) const
+{
+	std::array<SslTicketKey, MAX_KEYS> copy;
+	size_t n;
+
+	{
+		const std::lock_guard<std::mutex> lock(mutex);
+		copy = keys;
+		n = n_keys;
+	}
+
+	const size_t size = n * sizeof(SslTicketKey);
+	ssize_t nbytes = pwrite(fd.Get(), &copy, size, 0);
+	if (nbytes < 0)
+		throw MakeErrno("Failed to write ticket keys");
+
+	if (size_t(nbytes) != size)
+		throw std::runtime_error("Short write");
+
+	/* file descriptors which cannot be truncated (e.g. a sealed
+	   memfd of the same size) are not an error */
+	(void)ftruncate(fd.Get(), size);
+}
+
+bool
+SslTicketKeys::GetCurrent(SslTicketKey &key) const noexcept
+{
+	const std::lock_guard<std::mutex> lock(mutex);
+	if (n_keys == 0)
+		return false;
+
+	key = keys.front();
+	return true;
+}
+
+int
+SslTicketKeys::Find(const uint8_t *name, SslTicketKey &key) const noexcept
+{
+	const std::lock_guard<std::mutex> lock(mutex);
+	for (size_t i = 0; i < n_keys; ++i) {
+		if (memcmp(keys[i].name, name, sizeof(keys[i].name)) == 0) {
+			key = keys[i];
+			return i == 0 ? 1 : 2;
+		}
+	}
+
+	return 0;
+}
+
+static int
+GetTicketKeysIndex()
+{
+	static const int index =
+		SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+	return index;
+}
+
+int
+SslTicketKeys::TicketKeyCallback(SSL *ssl, unsigned char *key_name,
+				 unsigned char *iv,
+				 EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx,
+				 int enc)
+{
+	const auto &keys = *(const SslTicketKeys *)
+		SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), GetTicketKeysIndex());
+
+	SslTicketKey key;
+
+	if (enc) {
+		if (!keys.GetCurrent(key))
+			/* no keys yet: don't issue a ticket */
+			return 0;
+
+		if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+			return -1;
+
+		memcpy(key_name, key.name, sizeof(key.name));
+
+		if (!EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), nullptr,
+					key.aes_key, iv) ||
+		    !HMAC_Init_ex(hctx, key.hmac_key, sizeof(key.hmac_key),
+				  EVP_sha256(), nullptr))
+			return -1;
+
+		return 1;
+	} else {
+		const int result = keys.Find(key_name, key);
+		if (result == 0)
+			/* unknown (rotated out) key: full handshake */
+			return 0;
+
+		if (!HMAC_Init_ex(hctx, key.hmac_key, sizeof(key.hmac_key),
+				  EVP_sha256(), nullptr) ||
+		    !EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), nullptr,
+					key.aes_key, iv))
+			return -1;
+
+		/* 2 means: the ticket is valid, but issue a new one
+		   with the current key */
+		return result;
+	}
+}
+
+void
+SslTicketKeys::Enable(SSL_CTX &ctx)
+{
+	const int index = GetTicketKeysIndex();
+	if (index < 0)
+		throw SslError("SSL_CTX_get_ex_new_index() failed");
+
+	if (!SSL_CTX_set_ex_data(&ctx, index, this))
+		throw SslError("SSL_CTX_set_ex_data() failed");
+
+	if (!SSL_CTX_set_tlsext_ticket_key_cb(&ctx, TicketKeyCallback))
+		throw SslError("SSL_CTX_set_tlsext_ticket_key_cb() failed");
+}
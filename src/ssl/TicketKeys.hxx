@@ -0,0 +1,162 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SSL_TICKET_KEYS_HXX
+#define SSL_TICKET_KEYS_HXX
+
+#include "io/FileDescriptor.hxx"
+
+#include <openssl/ssl.h>
+
+#include <array>
+#include <chrono>
+#include <mutex>
+
+#include <stdint.h>
+
+/**
+ * One session ticket encryption key (STEK).  The layout is the same
+ * as the 80 byte key files used by nginx and others.
+ */
+struct SslTicketKey {
+	uint8_t name[16];
+	uint8_t hmac_key[32];
+	uint8_t aes_key[32];
+
+	/**
+	 * Throws SslError on error.
+	 */
+	static SslTicketKey Generate();
+};
+
+static_assert(sizeof(SslTicketKey) == 80, "Wrong SslTicketKey size");
+
+/**
+ * A ring of session ticket encryption keys: new tickets are
+ * encrypted with the newest key, and tickets encrypted with older
+ * keys are still accepted (and renewed) until their key is rotated
+ * out.
+ *
+ * To share keys among processes (so a client can resume the session
+ * on any of them), one process generates and rotates the keys and
+ * writes them to a file or memfd with Save(); the others Load() it
+ * periodically.
+ *
+ * This class is thread-safe.
+ */
+class SslTicketKeys {
+public:
+	static constexpr size_t MAX_KEYS = 4;
+
+private:
+	mutable std::mutex mutex;
+
+	/**
+	 * The keys, newest first.
+	 */
+	std::array<SslTicketKey, MAX_KEYS> keys;
+
+	size_t n_keys = 0;
+
+	std::chrono::steady_clock::time_point last_rotation;
+
+public:
+	SslTicketKeys() = default;
+
+	SslTicketKeys(const SslTicketKeys &) = delete;
+	SslTicketKeys &operator=(const SslTicketKeys &) = delete;
+
+	bool IsEmpty() const noexcept {
+		const std::lock_guard<std::mutex> lock(mutex);
+		return n_keys == 0;
+	}
+
+	/**
+	 * Generate a new key which will be used for new tickets; the
+	 * oldest key is discarded if the ring is full.
+	 *
+	 * Throws SslError on error.
+	 */
+	void Rotate();
+
+	/**
+	 * Call Rotate() if the last rotation was more than
+	 * @a interval ago (or if there are no keys).  Call this
+	 * from a periodic timer.
+	 *
+	 * Throws SslError on error.
+	 *
+	 * @return true if the keys were rotated
+	 */
+	bool RotateIfDue(std::chrono::steady_clock::duration interval);
+
+	/**
+	 * Replace all keys with the contents of the given file (a
+	 * sequence of 80 byte keys, newest first), read from offset
+	 * 0.
+	 *
+	 * Throws on error.
+	 */
+	void Load(FileDescriptor fd);
+
+	/**
+	 * Write all keys to the given file (at offset 0, truncating
+	 * it), in the format understood by Load().
+	 *
+	 * Throws std::system_error on error.
+	 */
+	void Save(FileDescriptor fd) const;
+
+	/**
+	 * Install the ticket key callback in the given SSL_CTX.  This
+	 * object must outlive the SSL_CTX.
+	 *
+	 * Throws SslError on error.
+	 */
+	void Enable(SSL_CTX &ctx);
+
+private:
+	bool GetCurrent(SslTicketKey &key) const noexcept;
+
+	/**
+	 * @return 0 if not found, 1 if this is the current key, 2 if
+	 * it is an older key
+	 */
+	int Find(const uint8_t *name, SslTicketKey &key) const noexcept;
+
+	static int TicketKeyCallback(SSL *ssl, unsigned char *key_name,
+				     unsigned char *iv,
+				     EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx,
+				     int enc);
+};
+
+#endif
@@ -31,12 +31,33 @@
  */
 
 #include "LargeAllocation.hxx"
+#include "HugePage.hxx"
 
+#include <atomic>
 #include <new>
 
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+/* from linux/mempolicy.h; we don't depend on libnuma */
+static constexpr int LA_MPOL_PREFERRED = 1;
+
+constexpr unsigned LargeAllocation::TRANSPARENT_HUGE;
+constexpr unsigned LargeAllocation::HUGETLB;
+constexpr unsigned LargeAllocation::POPULATE;
+constexpr unsigned LargeAllocation::LOCAL_NODE;
+constexpr unsigned LargeAllocation::RESERVE;
+
+/**
+ * The sum of the sizes of all allocations, see GetTotalSize().
+ */
+static std::atomic<size_t> total_size{0};
+
 /**
  * Round up the parameter, make it page-aligned.
  */
@@ -60,10 +81,137 @@ LargeAllocation::LargeAllocation(size_t _size)
 		    -1, 0);
 	if (data == (void *)-1)
 		throw std::bad_alloc();
+
+	total_size.fetch_add(the_size, std::memory_order_relaxed);
+}
+
+/**
+ * Map anonymous memory whose address is aligned to
+ * #HUGE_PAGE_SIZE, by mapping more than needed and unmapping the
+ * excess.
+ *
+ * @param size a multiple of #HUGE_PAGE_SIZE
+ */
+static void *
+MapHugeAligned(size_t size) noexcept
+{
+	constexpr int flags = MAP_ANONYMOUS|MAP_PRIVATE|MAP_NORESERVE;
+	const size_t padded_size = size + HUGE_PAGE_SIZE;
+	void *p = mmap(nullptr, padded_size,
+		       PROT_READ|PROT_WRITE, flags,
+		       -1, 0);
+	if (p == (void *)-1)
+		return p;
+
+	char *const begin = (char *)p;
+	char *const end = begin + padded_size;
+	char *const aligned = (char *)AlignHugePageUp((size_t)begin);
+
+	if (aligned > begin)
+		munmap(begin, aligned - begin);
+	if (end > aligned + size)
+		munmap(aligned + size, end - (aligned + size));
+
+	return aligned;
+}
+
+/**
+ * Determine the NUMA node of the CPU the calling thread runs on.
+ *
+ * @return the node number or -1 on error
+ */
+static int
+GetCurrentNumaNode() noexcept
+{
+	unsigned cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) < 0)
+		return -1;
+
+	return node;
+}
+
+static void
+PreferNumaNode(void *p, size_t size, int node) noexcept
+{
+	constexpr size_t BITS = sizeof(unsigned long) * 8;
+	unsigned long mask[16] = {};
+	if (node < 0 || size_t(node) >= BITS * 16)
+		return;
+
+	mask[node / BITS] = 1UL << (node % BITS);
+
+	/* this is only a preference; errors (e.g. a kernel without
+	   NUMA support) are ignored */
+	syscall(SYS_mbind, p, size, LA_MPOL_PREFERRED,
+		mask, BITS * 16, 0);
+}
+
+LargeAllocation::LargeAllocation(size_t _size, unsigned flags, int numa_node)
+{
+	if (flags & (TRANSPARENT_HUGE|HUGETLB)) {
+		the_size = AlignHugePageUp(_size);
+
+		data = (void *)-1;
+
+#ifdef MAP_HUGETLB
+		if (flags & HUGETLB)
+			/* no MAP_NORESERVE here: reserving the huge
+			   pages now makes mmap() fail if the pool is
+			   exhausted, instead of SIGBUS later */
+			data = mmap(nullptr, the_size,
+				    PROT_READ|PROT_WRITE,
+				    MAP_ANONYMOUS|MAP_PRIVATE|MAP_HUGETLB,
+				    -1, 0);
+#endif
+
+		if (data == (void *)-1) {
+			data = MapHugeAligned(the_size);
+			if (data == (void *)-1)
+				throw std::bad_alloc();
+
+#ifdef MADV_HUGEPAGE
+			madvise(data, the_size, MADV_HUGEPAGE);
+#endif
+		}
+	} else {
+		the_size = AlignToPageSize(_size);
+
+		constexpr int mmap_flags = MAP_ANONYMOUS|MAP_PRIVATE|MAP_NORESERVE;
+		data = mmap(nullptr, the_size,
+			    PROT_READ|PROT_WRITE, mmap_flags,
+			    -1, 0);
+		if (data == (void *)-1)
+			throw std::bad_alloc();
+	}
+
+	if (numa_node < 0 && (flags & LOCAL_NODE))
+		numa_node = GetCurrentNumaNode();
+
+	/* the policy must be set before the pages are faulted in */
+	if (numa_node >= 0)
+		PreferNumaNode(data, the_size, numa_node);
+
+	if (flags & POPULATE)
+		/* failure (EINVAL on old kernels) is not fatal; the
+		   pages will be faulted in on demand */
+		madvise(data, the_size, MADV_POPULATE_WRITE);
+
+	accounted = (flags & RESERVE) == 0;
+	if (accounted)
+		total_size.fetch_add(the_size, std::memory_order_relaxed);
 }
 
 void
-LargeAllocation::Free(void *p, size_t size) noexcept
+LargeAllocation::Free(void *p, size_t size, bool accounted) noexcept
 {
 	munmap(p, size);
+
+	if (accounted)
+		total_size.fetch_sub(size, std::memory_order_relaxed);
+}
+
+size_t
+LargeAllocation::GetTotalSize() noexcept
+{
+	return total_size.load(std::memory_order_relaxed);
 }
@@ -33,6 +33,8 @@
 #ifndef LARGE_ALLOCATION_HXX
 #define LARGE_ALLOCATION_HXX
 
+#include "util/Compiler.h"
+
 #include <utility>
 
 #include <stddef.h>
@@ -44,7 +46,48 @@ class LargeAllocation {
 	void *data = nullptr;
 	size_t the_size;
 
+	/**
+	 * Is this allocation included in GetTotalSize()?
+	 */
+	bool accounted = true;
+
 public:
+	/**
+	 * Round the size up to a multiple of #HUGE_PAGE_SIZE, align
+	 * the address and enable transparent huge pages
+	 * (MADV_HUGEPAGE) for this allocation.
+	 */
+	static constexpr unsigned TRANSPARENT_HUGE = 0x1;
+
+	/**
+	 * Like #TRANSPARENT_HUGE, but attempt to allocate from the
+	 * reserved hugetlbfs pool (MAP_HUGETLB) first.  If the pool
+	 * is exhausted, this falls back to #TRANSPARENT_HUGE.
+	 */
+	static constexpr unsigned HUGETLB = 0x2;
+
+	/**
+	 * Prefault all pages (MADV_POPULATE_WRITE), so the first
+	 * access does not cause page faults.  This is a no-op on
+	 * kernels which lack this feature (before Linux 5.14).
+	 */
+	static constexpr unsigned POPULATE = 0x4;
+
+	/**
+	 * Prefer memory from the NUMA node of the CPU the calling
+	 * thread currently runs on, i.e. the node of its
+	 * #EventLoop if the thread is pinned.  Ignored if an explicit
+	 * node is specified.
+	 */
+	static constexpr unsigned LOCAL_NODE = 0x8;
+
+	/**
+	 * This allocation only reserves address space which will
+	 * mostly remain untouched (e.g. the maximum capacity of a
+	 * pool); it is not included in GetTotalSize().
+	 */
+	static constexpr unsigned RESERVE = 0x10;
+
 	LargeAllocation() = default;
 
 	/**
@@ -52,24 +95,36 @@ public:
 	 */
 	explicit LargeAllocation(size_t _size);
 
+	/**
+	 * Throws std::bad_alloc on error.
+	 *
+	 * @param flags a combination of #TRANSPARENT_HUGE,
+	 * #HUGETLB, #POPULATE, #LOCAL_NODE and #RESERVE
+	 * @param numa_node prefer memory from this NUMA node; -1 means
+	 * no preference (unless #LOCAL_NODE is set)
+	 */
+	LargeAllocation(size_t _size, unsigned flags, int numa_node=-1);
+
 	LargeAllocation(LargeAllocation &&src) noexcept
-		:data(std::exchange(src.data, nullptr)), the_size(src.the_size) {}
+		:data(std::exchange(src.data, nullptr)), the_size(src.the_size),
+		 accounted(src.accounted) {}
 
 	~LargeAllocation() noexcept {
 		if (data != nullptr)
-			Free(data, the_size);
+			Free(data, the_size, accounted);
 	}
 
 	LargeAllocation &operator=(LargeAllocation &&src) noexcept {
 		using std::swap;
 		swap(data, src.data);
 		swap(the_size, src.the_size);
+		swap(accounted, src.accounted);
 		return *this;
 	}
 
 	void reset() noexcept {
 		if (data != nullptr) {
-			Free(data, the_size);
+			Free(data, the_size, accounted);
 			data = nullptr;
 		}
 	}
@@ -82,8 +137,15 @@ public:
 		return the_size;
 	}
 
+	/**
+	 * Returns the sum of the sizes of all allocations in this
+	 * process (e.g. for #MemoryBudget).
+	 */
+	gcc_pure
+	static size_t GetTotalSize() noexcept;
+
 private:
-	static void Free(void *p, size_t size) noexcept;
+	static void Free(void *p, size_t size, bool accounted) noexcept;
 };
 
 #endif
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MountTree.hxx"
+#include "system/Error.hxx"
+
+#include <sys/mount.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#ifndef __NR_open_tree
+#define __NR_open_tree 428
+#endif
+
+#ifndef __NR_move_mount
+#define __NR_move_mount 429
+#endif
+
+#ifndef __NR_mount_setattr
+#define __NR_mount_setattr 442
+#endif
+
+/* these are usually defined by <linux/mount.h>, but that header
+   conflicts with glibc's <sys/mount.h> */
+
+#ifndef OPEN_TREE_CLONE
+#define OPEN_TREE_CLONE 1
+#endif
+
+#ifndef OPEN_TREE_CLOEXEC
+#define OPEN_TREE_CLOEXEC O_CLOEXEC
+#endif
+
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#endif
+
+#ifndef MOUNT_ATTR_RDONLY
+#define MOUNT_ATTR_RDONLY 0x00000001
+#define MOUNT_ATTR_NOSUID 0x00000002
+#define MOUNT_ATTR_NODEV 0x00000004
+#define MOUNT_ATTR_NOEXEC 0x00000008
+#endif
+
+/**
+ * Same layout as the kernel's struct mount_attr.
+ */
+struct MountAttr {
+    uint64_t attr_set, attr_clr, propagation, userns_fd;
+};
+
+static int
+my_open_tree(int dfd, const char *path, unsigned flags) noexcept
+{
+    return syscall(__NR_open_tree, dfd, path, flags);
+}
+
+static int
+my_move_mount(int from_dfd, const char *from_path,
+              int to_dfd, const char *to_path, unsigned flags) noexcept
+{
+    return syscall(__NR_move_mount, from_dfd, from_path,
+                   to_dfd, to_path, flags);
+}
+
+static int
+my_mount_setattr(int dfd, const char *path, unsigned flags,
+                 const MountAttr &attr) noexcept
+{
+    return syscall(__NR_mount_setattr, dfd, path, flags,
+                   &attr, sizeof(attr));
+}
+
+static constexpr uint64_t
+ToMountAttr(int flags) noexcept
+{
+    return ((flags & MS_RDONLY) ? MOUNT_ATTR_RDONLY : 0) |
+        ((flags & MS_NOSUID) ? MOUNT_ATTR_NOSUID : 0) |
+        ((flags & MS_NODEV) ? MOUNT_ATTR_NODEV : 0) |
+        ((flags & MS_NOEXEC) ? MOUNT_ATTR_NOEXEC : 0);
+}
+
+UniqueFileDescriptor
+CloneMountTree(FileDescriptor dir, const char *path, int flags) noexcept
+{
+    const int fd = my_open_tree(dir.Get(), path,
+                                OPEN_TREE_CLONE|OPEN_TREE_CLOEXEC);
+    if (fd < 0)
+        return UniqueFileDescriptor();
+
+    UniqueFileDescriptor tree{FileDescriptor(fd)};
+
+    const MountAttr attr{ToMountAttr(flags), 0, 0, 0};
+    if (attr.attr_set != 0 &&
+        my_mount_setattr(tree.Get(), "", AT_EMPTY_PATH, attr) < 0) {
+        const int e = errno;
+        tree.Close();
+        errno = e;
+    }
+
+    return tree;
+}
+
+bool
+AttachMountTree(FileDescriptor tree, const char *target)
+{
+    /* attach a clone, not the tree itself, because move_mount()
+       would consume it */
+    const int fd = my_open_tree(tree.Get(), "",
+                                OPEN_TREE_CLONE|OPEN_TREE_CLOEXEC|
+                                AT_EMPTY_PATH);
+    if (fd < 0) {
+        if (errno == EINVAL || errno == EPERM || errno == ENOSYS)
+            return false;
+
+        throw FormatErrno("open_tree('%s') failed", target);
+    }
+
+    UniqueFileDescriptor clone{FileDescriptor(fd)};
+
+    if (my_move_mount(clone.Get(), "", AT_FDCWD, target,
+                      MOVE_MOUNT_F_EMPTY_PATH) < 0) {
+        if (errno == EINVAL || errno == EPERM)
+            return false;
+
+        throw FormatErrno("move_mount('%s') failed", target);
+    }
+
+    return true;
+}
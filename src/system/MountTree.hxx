@@ -0,0 +1,69 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/*
+ * Wrappers for the "new" Linux mount API (open_tree(),
+ * mount_setattr(), move_mount()), which operates on detached mount
+ * trees referenced by file descriptors.
+ */
+
+#include "io/UniqueFileDescriptor.hxx"
+
+/**
+ * Clone the mount at the given path (relative to #dir) into a new
+ * detached mount tree and apply the given MS_RDONLY, MS_NOSUID,
+ * MS_NODEV and MS_NOEXEC flags to it.  Like BindMount(), this is not
+ * recursive.
+ *
+ * @return the tree file descriptor or an undefined object on error
+ * (with errno set; ENOSYS if the kernel does not implement the new
+ * mount API)
+ */
+UniqueFileDescriptor
+CloneMountTree(FileDescriptor dir, const char *path, int flags) noexcept;
+
+/**
+ * Attach a clone of a detached mount tree (obtained by
+ * CloneMountTree()) at the given target.  The tree itself remains
+ * detached, so it can be attached again in other mount namespaces.
+ *
+ * Throws std::system_error on error.
+ *
+ * @return false if the kernel refuses to clone the detached tree
+ * (e.g. older kernels which do not support cloning a detached tree
+ * or a mount from a foreign mount namespace); the caller should then
+ * fall back to BindMount()
+ */
+bool
+AttachMountTree(FileDescriptor tree, const char *target);
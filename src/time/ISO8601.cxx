@@ -32,9 +32,12 @@
 
 #include "ISO8601.hxx"
 #include "Convert.hxx"
+#include "UtcFormatter.hxx"
+#include "util/CharUtil.hxx"
 
 #include <stdexcept>
 
+#include <string.h>
 #include <time.h>
 
 std::string
@@ -48,12 +51,94 @@ FormatISO8601(const struct tm &tm)
 std::string
 FormatISO8601(std::chrono::system_clock::time_point tp)
 {
-	return FormatISO8601(GmTime(tp));
+	char buffer[ISO8601_BUFFER_SIZE];
+	const char *end = FormatISO8601(buffer, tp);
+	return std::string(buffer, size_t(end - buffer));
+}
+
+char *
+FormatISO8601(char *buffer, std::chrono::system_clock::time_point tp) noexcept
+{
+	static thread_local UtcFormatter formatter;
+	char *p = formatter.FormatDateTime(buffer, tp, 'T');
+	*p++ = 'Z';
+	*p = 0;
+	return p;
+}
+
+/**
+ * Parse a fixed number of decimal digits.
+ *
+ * @return the value or -1 on error
+ */
+static int
+ParseDigits(const char *p, unsigned n) noexcept
+{
+	int value = 0;
+	for (unsigned i = 0; i < n; ++i) {
+		if (!IsDigitASCII(p[i]))
+			return -1;
+
+		value = value * 10 + (p[i] - '0');
+	}
+
+	return value;
+}
+
+static constexpr bool
+IsLeapYear(int y) noexcept
+{
+	return y % 4 == 0 && (y % 100 != 0 || y % 400 == 0);
+}
+
+static constexpr unsigned
+DaysInMonth(int y, unsigned m) noexcept
+{
+	return m == 2
+		? (IsLeapYear(y) ? 29 : 28)
+		: (m == 4 || m == 6 || m == 9 || m == 11 ? 30 : 31);
+}
+
+/**
+ * Parse "YYYY-MM-DDTHH:MM:SSZ" without calling libc.
+ *
+ * @return false if the string is not in this exact format
+ */
+static bool
+ParseCanonicalISO8601(const char *s,
+		      std::chrono::system_clock::time_point &result) noexcept
+{
+	if (strlen(s) != 20 ||
+	    s[4] != '-' || s[7] != '-' || s[10] != 'T' ||
+	    s[13] != ':' || s[16] != ':' || s[19] != 'Z')
+		return false;
+
+	const int year = ParseDigits(s, 4);
+	const int month = ParseDigits(s + 5, 2);
+	const int day = ParseDigits(s + 8, 2);
+	const int hour = ParseDigits(s + 11, 2);
+	const int minute = ParseDigits(s + 14, 2);
+	const int second = ParseDigits(s + 17, 2);
+
+	if (year < 0 || month < 1 || month > 12 ||
+	    day < 1 || unsigned(day) > DaysInMonth(year, month) ||
+	    hour < 0 || hour > 23 || minute < 0 || minute > 59 ||
+	    second < 0 || second > 60)
+		return false;
+
+	const int64_t t = DaysFromCivil(year, month, day) * 86400
+		+ hour * 3600 + minute * 60 + second;
+	result = std::chrono::system_clock::time_point(std::chrono::seconds(t));
+	return true;
 }
 
 std::chrono::system_clock::time_point
 ParseISO8601(const char *s)
 {
+	std::chrono::system_clock::time_point result;
+	if (ParseCanonicalISO8601(s, result))
+		return result;
+
 	struct tm tm;
 	const char *end = strptime(s, "%FT%TZ", &tm);
 	if (end == nullptr || *end != 0)
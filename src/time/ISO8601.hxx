@@ -36,14 +36,39 @@
 #include <string>
 #include <chrono>
 
+#include <stddef.h>
+
 struct tm;
 
+/**
+ * The buffer size required by FormatISO8601(char *, ...), including
+ * the null terminator.
+ */
+static constexpr size_t ISO8601_BUFFER_SIZE = 21;
+
 std::string
 FormatISO8601(const struct tm &tm);
 
 std::string
 FormatISO8601(std::chrono::system_clock::time_point tp);
 
+/**
+ * Format the time stamp as "YYYY-MM-DDTHH:MM:SSZ" into the given
+ * buffer (#ISO8601_BUFFER_SIZE bytes) without allocating memory.
+ * This uses a per-thread #UtcFormatter.
+ *
+ * @return a pointer to the null terminator
+ */
+char *
+FormatISO8601(char *buffer, std::chrono::system_clock::time_point tp) noexcept;
+
+/**
+ * Parse an ISO8601 time stamp.  The canonical format
+ * "YYYY-MM-DDTHH:MM:SSZ" is parsed with a fast path which does not
+ * involve strptime() and timegm().
+ *
+ * Throws std::runtime_error on error.
+ */
 std::chrono::system_clock::time_point
 ParseISO8601(const char *s);
 
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "UtcFormatter.hxx"
+#include "util/DecimalFormat.h"
+
+#include <assert.h>
+#include <string.h>
+
+constexpr size_t UtcFormatter::DATE_TIME_LENGTH;
+
+void
+UtcFormatter::UpdateDate(int64_t new_day) noexcept
+{
+	const auto c = CivilFromDays(new_day);
+	assert(c.year >= 0 && c.year <= 9999);
+
+	format_4digit(date, c.year);
+	date[4] = '-';
+	format_2digit(date + 5, c.month);
+	date[7] = '-';
+	format_2digit(date + 8, c.day);
+
+	day = new_day;
+}
+
+char *
+UtcFormatter::FormatDateTime(char *p,
+			     std::chrono::system_clock::time_point tp,
+			     char separator) noexcept
+{
+	/* round towards negative infinity, so time stamps before
+	   1970 get the correct date */
+	const auto since_epoch = tp.time_since_epoch();
+	int64_t s = std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count();
+	if (std::chrono::seconds(s) > since_epoch)
+		--s;
+
+	int64_t new_day = s / 86400;
+	int64_t time_of_day = s % 86400;
+	if (time_of_day < 0) {
+		--new_day;
+		time_of_day += 86400;
+	}
+
+	if (new_day != day)
+		UpdateDate(new_day);
+
+	memcpy(p, date, sizeof(date));
+	p += sizeof(date);
+
+	const unsigned t = unsigned(time_of_day);
+	*p++ = separator;
+	format_2digit(p, t / 3600);
+	p[2] = ':';
+	format_2digit(p + 3, t / 60 % 60);
+	p[5] = ':';
+	format_2digit(p + 6, t % 60);
+	return p + 8;
+}
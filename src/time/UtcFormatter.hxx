@@ -0,0 +1,120 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <chrono>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A civil (proleptic Gregorian) date.
+ */
+struct CivilDate {
+	int year;
+	unsigned month, day;
+};
+
+/**
+ * Convert a number of days since 1970-01-01 to a civil date, using
+ * integer arithmetic only (no libc call, no time zone lookup).
+ */
+constexpr CivilDate
+CivilFromDays(int64_t z) noexcept
+{
+	z += 719468;
+	const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	const unsigned doe = unsigned(z - era * 146097);
+	const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const unsigned mp = (5 * doy + 2) / 153;
+	const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+	const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+	return {int(yoe + era * 400) + (m <= 2), m, d};
+}
+
+/**
+ * The inverse of CivilFromDays().
+ */
+constexpr int64_t
+DaysFromCivil(int y, unsigned m, unsigned d) noexcept
+{
+	y -= m <= 2;
+	const int64_t era = (y >= 0 ? y : y - 399) / 400;
+	const unsigned yoe = unsigned(y - era * 400);
+	const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + int64_t(doe) - 719468;
+}
+
+/**
+ * Formats UTC time stamps without calling gmtime() or strftime().
+ * The date part is formatted only once per day and remembered; the
+ * time of day is computed arithmetically.  This is useful for
+ * formatting large numbers of time stamps which are close to each
+ * other (e.g. log records or database rows).
+ *
+ * This class is not thread-safe; use one instance per thread.
+ * Only years 0000..9999 are supported.
+ */
+class UtcFormatter {
+	/**
+	 * The day (since 1970-01-01) described by #date.
+	 */
+	int64_t day = INT64_MIN;
+
+	/**
+	 * "YYYY-MM-DD" (not null-terminated).
+	 */
+	char date[10];
+
+public:
+	/**
+	 * The length of FormatDateTime() output.
+	 */
+	static constexpr size_t DATE_TIME_LENGTH = 19;
+
+	/**
+	 * Write "YYYY-MM-DD<separator>HH:MM:SS" (without null
+	 * terminator, fractional seconds are truncated) to the given
+	 * buffer, which must have room for #DATE_TIME_LENGTH
+	 * characters.
+	 *
+	 * @return the end of the output
+	 */
+	char *FormatDateTime(char *p, std::chrono::system_clock::time_point tp,
+			     char separator) noexcept;
+
+private:
+	void UpdateDate(int64_t new_day) noexcept;
+};
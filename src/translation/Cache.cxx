@@ -0,0 +1,314 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Cache.hxx"
+#include "Response.hxx"
+#include "Protocol.hxx"
+#include "AllocatorPtr.hxx"
+#include "util/FNVHash.hxx"
+
+#include <vector>
+
+#include <string.h>
+
+/**
+ * Marks an attribute which is absent from the request in
+ * TranslationCache::MakeKey().
+ */
+static constexpr uint32_t ABSENT_LENGTH = UINT32_MAX;
+
+struct TranslationCache::Item {
+    /**
+     * Owns all the memory referenced by this item.
+     */
+    Allocator allocator;
+
+    StringView key;
+
+    ConstBuffer<TranslationCacheField> fields;
+
+    TranslateResponse response;
+
+    Item(const TranslationCacheRequest &request, StringView _key,
+         const TranslateResponse &_response)
+        :allocator(4096) {
+        AllocatorPtr alloc(allocator);
+
+        key = {(const char *)alloc.Dup(_key.data, _key.size), _key.size};
+
+        auto *f = alloc.NewArray<TranslationCacheField>(request.fields.size);
+        for (size_t i = 0; i < request.fields.size; ++i) {
+            f[i].command = request.fields[i].command;
+            f[i].value = alloc.Dup(request.fields[i].value);
+        }
+        fields = {f, request.fields.size};
+
+        response.Clear();
+        response.CopyFrom(alloc, _response);
+    }
+
+    /**
+     * The approximate number of bytes occupied by this item.
+     */
+    gcc_pure
+    size_t GetMemoryUsage() const noexcept {
+        return sizeof(*this) + allocator.GetStats().n_bytes;
+    }
+
+    gcc_pure
+    const TranslationCacheField *Find(TranslationCommand command) const noexcept {
+        for (const auto &i : fields)
+            if (i.command == command)
+                return &i;
+        return nullptr;
+    }
+};
+
+struct TranslationCache::VaryItem {
+    std::string key;
+    std::vector<TranslationCommand> vary;
+
+    VaryItem(StringView _key, ConstBuffer<TranslationCommand> _vary)
+        :key(_key.data, _key.size), vary(_vary.begin(), _vary.end()) {}
+};
+
+const TranslationCacheField *
+TranslationCacheRequest::Find(TranslationCommand command) const noexcept
+{
+    for (const auto &i : fields)
+        if (i.command == command)
+            return &i;
+    return nullptr;
+}
+
+size_t
+TranslationCache::KeyHash::operator()(StringView s) const noexcept
+{
+    using Traits = FNVTraits<uint32_t>;
+    using Algorithm = FNV1aAlgorithm<Traits>;
+
+    Traits::fast_type hash = Traits::OFFSET_BASIS;
+    for (char ch : s)
+        hash = Algorithm::Update(hash, ch);
+    return hash;
+}
+
+TranslationCache::TranslationCache(std::chrono::steady_clock::duration _default_max_age) noexcept
+    :default_max_age(_default_max_age) {}
+
+TranslationCache::~TranslationCache() noexcept = default;
+
+/**
+ * Compare two optional attribute values.
+ */
+gcc_pure
+static bool
+FieldEquals(const TranslationCacheField *a,
+            const TranslationCacheField *b) noexcept
+{
+    if (a == nullptr || b == nullptr)
+        return a == b;
+
+    return a->value.size == b->value.size &&
+        (a->value.size == 0 ||
+         memcmp(a->value.data, b->value.data, a->value.size) == 0);
+}
+
+bool
+TranslationCacheRequest::VaryEquals(const TranslationCacheRequest &other,
+                                    ConstBuffer<TranslationCommand> vary) const noexcept
+{
+    if (!key.Equals(other.key))
+        return false;
+
+    for (const auto command : vary)
+        if (!FieldEquals(Find(command), other.Find(command)))
+            return false;
+
+    return true;
+}
+
+StringView
+TranslationCache::MakeKey(const TranslationCacheRequest &request,
+                          ConstBuffer<TranslationCommand> vary)
+{
+    /* the primary key, followed by a binary representation of the
+       VARY attributes: command, length and value */
+
+    key_buffer.assign(request.key.data, request.key.size);
+
+    for (const auto command : vary) {
+        key_buffer.push_back(0);
+        key_buffer.append((const char *)&command, sizeof(command));
+
+        const auto *f = request.Find(command);
+        const uint32_t length = f != nullptr
+            ? f->value.size
+            : ABSENT_LENGTH;
+        key_buffer.append((const char *)&length, sizeof(length));
+        if (f != nullptr)
+            key_buffer.append((const char *)f->value.data, f->value.size);
+    }
+
+    return {key_buffer.data(), key_buffer.size()};
+}
+
+const TranslateResponse *
+TranslationCache::Get(const TranslationCacheRequest &request,
+                      Expiry now) noexcept
+{
+    const auto *vary = vary_sets.Get(request.key, now);
+    if (vary == nullptr) {
+        ++stats.misses;
+        return nullptr;
+    }
+
+    const auto &v = (*vary)->vary;
+
+    StringView key;
+    try {
+        key = MakeKey(request, {v.data(), v.size()});
+    } catch (const std::bad_alloc &) {
+        ++stats.misses;
+        return nullptr;
+    }
+
+    const auto *item = items.Get(key, now);
+    if (item == nullptr) {
+        ++stats.misses;
+        return nullptr;
+    }
+
+    ++stats.hits;
+    return &(*item)->response;
+}
+
+std::string
+TranslationCache::MakeLookupKey(const TranslationCacheRequest &request,
+                                Expiry now)
+{
+    StringView key;
+
+    const auto *vary = vary_sets.Get(request.key, now);
+    if (vary != nullptr) {
+        const auto &v = (*vary)->vary;
+        key = MakeKey(request, {v.data(), v.size()});
+    } else {
+        std::vector<TranslationCommand> all;
+        all.reserve(request.fields.size);
+        for (const auto &i : request.fields)
+            all.push_back(i.command);
+        key = MakeKey(request, {all.data(), all.size()});
+    }
+
+    return std::string(key.data, key.size);
+}
+
+void
+TranslationCache::Put(const TranslationCacheRequest &request,
+                      const TranslateResponse &response,
+                      ConstBuffer<TranslationCommand> vary,
+                      std::chrono::seconds max_age, Expiry now)
+{
+    if (max_age == std::chrono::seconds::zero())
+        return;
+
+    const std::chrono::steady_clock::duration duration =
+        max_age > std::chrono::seconds::zero()
+        ? std::chrono::steady_clock::duration(max_age)
+        : default_max_age;
+    const auto expires = Expiry::Touched(now, duration);
+
+    const StringView key = MakeKey(request, vary);
+    std::unique_ptr<Item> item(new Item(request, key, response));
+    const StringView item_key = item->key;
+    const size_t cost = item->GetMemoryUsage();
+    items.Put(item_key, std::move(item), expires, cost);
+
+    /* remember the VARY list for Get(), and extend its lifetime */
+    std::unique_ptr<VaryItem> v(new VaryItem(request.key, vary));
+    const StringView v_key(v->key.data(), v->key.size());
+    vary_sets.Put(v_key, std::move(v), expires);
+
+    ++stats.stores;
+}
+
+size_t
+TranslationCache::Invalidate(const TranslationCacheRequest &request,
+                             ConstBuffer<TranslationCommand> invalidate) noexcept
+{
+    if (invalidate.empty())
+        return 0;
+
+    const size_t n = items.RemoveIf([&request, invalidate](StringView, const std::unique_ptr<Item> &item){
+            for (const auto command : invalidate)
+                if (!FieldEquals(request.Find(command),
+                                 item->Find(command)))
+                    return false;
+            return true;
+        });
+
+    stats.invalidated += n;
+    return n;
+}
+
+#if TRANSLATION_ENABLE_CACHE
+
+void
+TranslationCache::Feed(const TranslationCacheRequest &request,
+                       const TranslateResponse &response, Expiry now)
+{
+    Invalidate(request, response.invalidate);
+    Put(request, response, response.vary, response.max_age, now);
+}
+
+#endif
+
+size_t
+TranslationCache::Sweep(Expiry now) noexcept
+{
+    vary_sets.Sweep(now);
+    return items.Sweep(now);
+}
+
+size_t
+TranslationCache::ReclaimMemory(size_t bytes) noexcept
+{
+    return items.Reclaim(bytes);
+}
+
+void
+TranslationCache::Clear() noexcept
+{
+    items.Clear();
+    vary_sets.Clear();
+}
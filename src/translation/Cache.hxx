@@ -0,0 +1,246 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "translation/Features.hxx"
+#include "util/ExpiringCache.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/StringView.hxx"
+#include "util/Compiler.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <stdint.h>
+
+enum class TranslationCommand : uint16_t;
+struct TranslateResponse;
+
+/**
+ * A request attribute which may be referenced by
+ * #TranslationCommand::VARY or #TranslationCommand::INVALIDATE.
+ */
+struct TranslationCacheField {
+    TranslationCommand command;
+    ConstBuffer<void> value;
+};
+
+/**
+ * Describes a translation request for #TranslationCache.
+ */
+struct TranslationCacheRequest {
+    /**
+     * The primary key, e.g. the host name and the URI.
+     */
+    StringView key;
+
+    /**
+     * All request attributes which may be referenced by VARY or
+     * INVALIDATE.  Attributes missing here are considered absent
+     * from the request.
+     */
+    ConstBuffer<TranslationCacheField> fields;
+
+    gcc_pure
+    const TranslationCacheField *Find(TranslationCommand command) const noexcept;
+
+    /**
+     * Do both requests have the same primary key and the same
+     * values for all attributes listed in #vary?
+     */
+    gcc_pure
+    bool VaryEquals(const TranslationCacheRequest &other,
+                    ConstBuffer<TranslationCommand> vary) const noexcept;
+};
+
+/**
+ * A cache for translation responses.  Responses are looked up by the
+ * primary key plus the values of the request attributes listed in
+ * the response's VARY packet.  Each response is stored as an
+ * immutable copy in its own arena; the cost of each item is the
+ * size of its copy.
+ *
+ * This class is large; allocate it on the heap.
+ */
+class TranslationCache {
+    struct KeyHash {
+        gcc_pure
+        size_t operator()(StringView s) const noexcept;
+    };
+
+    struct KeyEqual {
+        gcc_pure
+        bool operator()(StringView a, StringView b) const noexcept {
+            return a.Equals(b);
+        }
+    };
+
+    struct Item;
+    struct VaryItem;
+
+    /**
+     * The cached responses, keyed by the primary key plus the
+     * VARY attribute values (see MakeKey()).
+     */
+    ExpiringCache<StringView, std::unique_ptr<Item>,
+                  8192, 8191, KeyHash, KeyEqual> items;
+
+    /**
+     * The most recent VARY list for each primary key.
+     */
+    ExpiringCache<StringView, std::unique_ptr<VaryItem>,
+                  2048, 2039, KeyHash, KeyEqual> vary_sets;
+
+    /**
+     * The lifetime of responses without a MAX_AGE packet.
+     */
+    const std::chrono::steady_clock::duration default_max_age;
+
+    /**
+     * A buffer for MakeKey(), reused to avoid an allocation for
+     * each lookup.
+     */
+    std::string key_buffer;
+
+public:
+    struct Stats {
+        uint64_t hits = 0, misses = 0, stores = 0, invalidated = 0;
+    };
+
+private:
+    Stats stats;
+
+public:
+    explicit TranslationCache(std::chrono::steady_clock::duration _default_max_age=std::chrono::minutes(5)) noexcept;
+    ~TranslationCache() noexcept;
+
+    TranslationCache(const TranslationCache &) = delete;
+    TranslationCache &operator=(const TranslationCache &) = delete;
+
+    const Stats &GetStats() const noexcept {
+        return stats;
+    }
+
+    /**
+     * Look up a cached response.  The returned pointer remains
+     * valid until the cache is modified.
+     *
+     * @return the response or nullptr on cache miss
+     */
+    const TranslateResponse *Get(const TranslationCacheRequest &request,
+                                 Expiry now) noexcept;
+
+    /**
+     * Store a copy of the response.
+     *
+     * Throws std::bad_alloc on error.
+     *
+     * @param vary the request attributes which select this
+     * response (#TranslationCommand::VARY)
+     * @param max_age the lifetime of the response
+     * (#TranslationCommand::MAX_AGE); negative means the default,
+     * zero disables caching this response
+     */
+    void Put(const TranslationCacheRequest &request,
+             const TranslateResponse &response,
+             ConstBuffer<TranslationCommand> vary,
+             std::chrono::seconds max_age, Expiry now);
+
+    /**
+     * Remove all responses whose request had the same values as
+     * the given request for all attributes listed in #invalidate
+     * (#TranslationCommand::INVALIDATE).
+     *
+     * @return the number of responses which were removed
+     */
+    size_t Invalidate(const TranslationCacheRequest &request,
+                      ConstBuffer<TranslationCommand> invalidate) noexcept;
+
+    /**
+     * Build the key under which a response to this request would
+     * be cached: the primary key plus the values of the
+     * attributes in the most recent VARY list for it.  If no VARY
+     * list is known, all attributes of the request are part of
+     * the key, so only identical requests share it.  This does
+     * not count as a lookup in #Stats.
+     *
+     * Throws std::bad_alloc on error.
+     */
+    std::string MakeLookupKey(const TranslationCacheRequest &request,
+                              Expiry now);
+
+#if TRANSLATION_ENABLE_CACHE
+    /**
+     * Handle a response received from the translation server:
+     * apply its INVALIDATE list and store it according to its
+     * VARY and MAX_AGE packets.
+     *
+     * Throws std::bad_alloc on error.
+     */
+    void Feed(const TranslationCacheRequest &request,
+              const TranslateResponse &response, Expiry now);
+#endif
+
+    /**
+     * Remove expired responses.
+     *
+     * @return the number of responses which were removed
+     */
+    size_t Sweep(Expiry now) noexcept;
+
+    void Clear() noexcept;
+
+    /**
+     * Returns the (approximate) number of bytes occupied by
+     * cached responses, e.g. for a #MemoryReclaimer.
+     */
+    size_t GetMemoryUsage() const noexcept {
+        return items.GetTotalCost();
+    }
+
+    /**
+     * Remove least recently used responses until at least the
+     * given number of bytes has been released.
+     *
+     * @return the number of bytes which were released
+     */
+    size_t ReclaimMemory(size_t bytes) noexcept;
+
+private:
+    /**
+     * Build the cache key in #key_buffer.
+     */
+    StringView MakeKey(const TranslationCacheRequest &request,
+                       ConstBuffer<TranslationCommand> vary);
+};
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Coalescer.hxx"
+#include "Cache.hxx"
+#include "Stock.hxx"
+#include "Handler.hxx"
+#include "Response.hxx"
+#include "util/Expiry.hxx"
+
+#include <tuple>
+
+TranslationCoalescer::Flight::~Flight() noexcept
+{
+    if (cancel_ptr)
+        cancel_ptr.Cancel();
+
+    waiters.clear_and_dispose([](Waiter *w){ delete w; });
+}
+
+void
+TranslationCoalescer::Flight::Send() noexcept
+{
+    static constexpr TranslateHandler flight_handler = {
+        OnResponseCallback,
+        OnErrorCallback,
+    };
+
+    auto &w = waiters.front();
+    ++coalescer.stats.sent;
+
+    /* this may invoke the handler (and destroy this object)
+       synchronously */
+    coalescer.stock.SendRequest(w.parser, w.data, flight_handler, this,
+                                cancel_ptr);
+}
+
+void
+TranslationCoalescer::Flight::OnResponse(TranslateResponse &response) noexcept
+{
+    auto &c = coalescer;
+
+    /* detach the waiters and destroy this flight, so handlers
+       may submit new requests with the same key */
+    cancel_ptr = nullptr;
+    WaiterList list;
+    list.swap(waiters);
+    for (auto &w : list)
+        w.flight = nullptr;
+    c.flights.erase(iterator);
+
+    auto &leader = list.front();
+    list.pop_front();
+
+#if TRANSLATION_ENABLE_CACHE
+    const ConstBuffer<TranslationCommand> vary = response.vary;
+#else
+    const ConstBuffer<TranslationCommand> vary = nullptr;
+#endif
+
+    /* the response belongs to the leader's parser, therefore
+       the other waiters are completed first; a handler must not
+       cancel the leader */
+    WaiterList retry;
+    while (!list.empty()) {
+        auto &w = list.front();
+        list.pop_front();
+
+        if (!w.cache_request.VaryEquals(leader.cache_request, vary)) {
+            /* the response depends on an attribute where this
+               request differs */
+            retry.push_back(w);
+            continue;
+        }
+
+        const auto &handler = w.handler;
+        void *ctx = w.handler_ctx;
+        delete &w;
+        handler.response(response, ctx);
+    }
+
+    {
+        const auto &handler = leader.handler;
+        void *ctx = leader.handler_ctx;
+        delete &leader;
+        handler.response(response, ctx);
+    }
+
+    /* submit the mismatching requests again; by now, the
+       leader's handler may have stored the response (and its
+       VARY list) in the cache, which yields a new key */
+    while (!retry.empty()) {
+        auto &w = retry.front();
+        retry.pop_front();
+        c.Submit(w);
+    }
+}
+
+void
+TranslationCoalescer::Flight::OnError(std::exception_ptr ep) noexcept
+{
+    cancel_ptr = nullptr;
+    WaiterList list;
+    list.swap(waiters);
+    for (auto &w : list)
+        w.flight = nullptr;
+    coalescer.flights.erase(iterator);
+
+    while (!list.empty()) {
+        auto &w = list.front();
+        list.pop_front();
+
+        const auto &handler = w.handler;
+        void *ctx = w.handler_ctx;
+        delete &w;
+        handler.error(ep, ctx);
+    }
+}
+
+void
+TranslationCoalescer::Waiter::Cancel() noexcept
+{
+    Flight *const f = flight;
+    const bool leader = f != nullptr && &f->waiters.front() == this;
+
+    if (leader)
+        /* cancel the request before its parser and data are
+           freed by our caller */
+        f->cancel_ptr.CancelAndClear();
+
+    delete this;
+
+    if (leader) {
+        if (f->waiters.empty())
+            f->coalescer.flights.erase(f->iterator);
+        else
+            /* promote the next waiter */
+            f->Send();
+    }
+}
+
+TranslationCoalescer::~TranslationCoalescer() noexcept
+{
+    flights.clear();
+}
+
+void
+TranslationCoalescer::Submit(Waiter &w) noexcept
+{
+    FlightMap::iterator i;
+    bool inserted;
+
+    try {
+        auto key = cache.MakeLookupKey(w.cache_request, Expiry::Now());
+        std::tie(i, inserted) = flights.emplace(std::piecewise_construct,
+                                                std::forward_as_tuple(std::move(key)),
+                                                std::forward_as_tuple(*this));
+    } catch (...) {
+        const auto &handler = w.handler;
+        void *ctx = w.handler_ctx;
+        delete &w;
+        handler.error(std::current_exception(), ctx);
+        return;
+    }
+
+    auto &f = i->second;
+    w.flight = &f;
+    f.waiters.push_back(w);
+
+    if (inserted) {
+        f.iterator = i;
+        f.Send();
+    } else
+        ++stats.coalesced;
+}
+
+void
+TranslationCoalescer::SendRequest(const TranslationCacheRequest &cache_request,
+                                  TranslateParser &parser,
+                                  ConstBuffer<void> request,
+                                  const TranslateHandler &handler, void *ctx,
+                                  CancellablePointer &cancel_ptr) noexcept
+{
+    auto *w = new Waiter(cache_request, parser, request,
+                         handler, ctx, cancel_ptr);
+    Submit(*w);
+}
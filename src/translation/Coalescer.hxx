@@ -0,0 +1,214 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/Cancellable.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+#include <exception>
+#include <string>
+#include <unordered_map>
+
+#include <stdint.h>
+
+struct TranslateHandler;
+struct TranslateResponse;
+struct TranslationCacheRequest;
+class TranslateParser;
+class TranslationCache;
+class TranslationStock;
+
+/**
+ * Coalesces identical translation requests which are in flight at
+ * the same time: only the first one is sent to the translation
+ * server, and all others wait for its response.  Requests are
+ * identical if they have the same #TranslationCache key (see
+ * TranslationCache::MakeLookupKey()).  This avoids a "thundering
+ * herd" on the translation server when a popular URI is missing
+ * from the cache, e.g. after a cache flush.
+ *
+ * All handlers receive the same #TranslateResponse object (the
+ * one parsed for the first request), so they must not modify it;
+ * the first request's handler is invoked last, because its caller
+ * owns the response.  If the response's VARY list contains
+ * attributes which differ between the first request and a waiting
+ * one, the waiting request is sent again.
+ */
+class TranslationCoalescer {
+    struct Flight;
+
+    class Waiter final
+        : public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>,
+          public Cancellable {
+
+    public:
+        Flight *flight = nullptr;
+
+        const TranslationCacheRequest &cache_request;
+
+        TranslateParser &parser;
+        const ConstBuffer<void> data;
+
+        const TranslateHandler &handler;
+        void *const handler_ctx;
+
+        Waiter(const TranslationCacheRequest &_cache_request,
+               TranslateParser &_parser, ConstBuffer<void> _data,
+               const TranslateHandler &_handler, void *_ctx,
+               CancellablePointer &cancel_ptr) noexcept
+            :cache_request(_cache_request),
+             parser(_parser), data(_data),
+             handler(_handler), handler_ctx(_ctx) {
+            cancel_ptr = *this;
+        }
+
+        Waiter(const Waiter &) = delete;
+        Waiter &operator=(const Waiter &) = delete;
+
+        /* virtual methods from class Cancellable */
+        void Cancel() noexcept override;
+    };
+
+    typedef boost::intrusive::list<Waiter,
+                                   boost::intrusive::constant_time_size<false>> WaiterList;
+
+    typedef std::unordered_map<std::string, Flight> FlightMap;
+
+    struct Flight {
+        TranslationCoalescer &coalescer;
+
+        FlightMap::iterator iterator;
+
+        /**
+         * All requests waiting for the response; the first one
+         * has been sent to the translation server.
+         */
+        WaiterList waiters;
+
+        /**
+         * Cancels the request of the first waiter.
+         */
+        CancellablePointer cancel_ptr;
+
+        explicit Flight(TranslationCoalescer &_coalescer) noexcept
+            :coalescer(_coalescer) {}
+
+        ~Flight() noexcept;
+
+        Flight(const Flight &) = delete;
+        Flight &operator=(const Flight &) = delete;
+
+        /**
+         * Send the request of the first waiter.
+         */
+        void Send() noexcept;
+
+        void OnResponse(TranslateResponse &response) noexcept;
+        void OnError(std::exception_ptr ep) noexcept;
+
+        static void OnResponseCallback(TranslateResponse &response,
+                                       void *ctx) noexcept {
+            ((Flight *)ctx)->OnResponse(response);
+        }
+
+        static void OnErrorCallback(std::exception_ptr ep,
+                                    void *ctx) noexcept {
+            ((Flight *)ctx)->OnError(ep);
+        }
+    };
+
+    TranslationStock &stock;
+    TranslationCache &cache;
+
+    FlightMap flights;
+
+public:
+    struct Stats {
+        /**
+         * The number of requests sent to the translation
+         * server.
+         */
+        uint64_t sent = 0;
+
+        /**
+         * The number of requests which have been attached to a
+         * request in flight.
+         */
+        uint64_t coalesced = 0;
+    };
+
+private:
+    Stats stats;
+
+public:
+    TranslationCoalescer(TranslationStock &_stock,
+                         TranslationCache &_cache) noexcept
+        :stock(_stock), cache(_cache) {}
+
+    /**
+     * All pending requests are canceled without invoking their
+     * handlers.
+     */
+    ~TranslationCoalescer() noexcept;
+
+    TranslationCoalescer(const TranslationCoalescer &) = delete;
+    TranslationCoalescer &operator=(const TranslationCoalescer &) = delete;
+
+    const Stats &GetStats() const noexcept {
+        return stats;
+    }
+
+    size_t GetFlightCount() const noexcept {
+        return flights.size();
+    }
+
+    /**
+     * Send a translation request, or attach it to an identical
+     * request in flight.  The parameters are the same as for
+     * TranslationStock::SendRequest().
+     *
+     * @param cache_request describes the request for computing
+     * the #TranslationCache key; it (and the memory it refers to)
+     * must remain valid until the handler is invoked or the
+     * request is canceled
+     */
+    void SendRequest(const TranslationCacheRequest &cache_request,
+                     TranslateParser &parser, ConstBuffer<void> request,
+                     const TranslateHandler &handler, void *ctx,
+                     CancellablePointer &cancel_ptr) noexcept;
+
+private:
+    void Submit(Waiter &waiter) noexcept;
+};
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Marshal.hxx"
+#include "AllocatorPtr.hxx"
+#include "net/SendMessage.hxx"
+#include "net/SocketDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <stdexcept>
+
+#include <errno.h>
+
+void
+TranslationMarshaller::Write(TranslationCommand command,
+                             ConstBuffer<void> payload)
+{
+    const bool use_extended = payload.size > 0xffff;
+    if (use_extended && (!extended || payload.size > 0xffffffff))
+        throw std::runtime_error("translation packet too large");
+
+    if (n_packets >= MAX_PACKETS)
+        throw std::runtime_error("too many translation packets");
+
+    auto &header = headers[n_packets++];
+    if (use_extended) {
+        header.header.length = 0;
+        header.header.command = TranslationCommand(uint16_t(command) |
+                                                   TRANSLATION_COMMAND_EXTENDED);
+        header.length = payload.size;
+    } else {
+        header.header.length = payload.size;
+        header.header.command = command;
+    }
+
+    const size_t header_size = use_extended
+        ? sizeof(header)
+        : sizeof(header.header);
+
+    auto *v = &vec[n_vec++];
+    v->iov_base = &header;
+    v->iov_len = header_size;
+
+    if (payload.size > 0) {
+        v = &vec[n_vec++];
+        v->iov_base = const_cast<void *>(payload.data);
+        v->iov_len = payload.size;
+    }
+
+    size += header_size + payload.size;
+}
+
+size_t
+TranslationMarshaller::CopyTo(void *_dest) const
+{
+    auto *dest = (uint8_t *)_dest;
+
+    for (const auto &i : GetVector()) {
+        memcpy(dest, i.iov_base, i.iov_len);
+        dest += i.iov_len;
+    }
+
+    return size;
+}
+
+ConstBuffer<void>
+TranslationMarshaller::Dup(AllocatorPtr alloc) const
+{
+    if (IsEmpty())
+        return {"", 0};
+
+    void *p = alloc.NewArray<uint8_t>(size);
+    CopyTo(p);
+    return {p, size};
+}
+
+void
+TranslationMarshaller::Consume(size_t nbytes)
+{
+    assert(nbytes <= size);
+
+    size -= nbytes;
+
+    while (nbytes > 0) {
+        assert(position < n_vec);
+
+        auto &v = vec[position];
+        if (nbytes < v.iov_len) {
+            v.iov_base = (uint8_t *)v.iov_base + nbytes;
+            v.iov_len -= nbytes;
+            break;
+        }
+
+        nbytes -= v.iov_len;
+        ++position;
+    }
+}
+
+size_t
+TranslationMarshaller::Send(SocketDescriptor s)
+{
+    if (IsEmpty())
+        return 0;
+
+    const MessageHeader m(GetVector());
+    auto nbytes = sendmsg(s.Get(), &m, MSG_DONTWAIT|MSG_NOSIGNAL);
+    if (nbytes < 0) {
+        if (errno == EAGAIN)
+            return 0;
+
+        throw MakeErrno("Failed to send translation request");
+    }
+
+    Consume(nbytes);
+    return nbytes;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Protocol.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/StringView.hxx"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/uio.h>
+
+class AllocatorPtr;
+class SocketDescriptor;
+
+/**
+ * Serialize translation packets (e.g. a translation request).  This
+ * is the counterpart of #TranslatePacketReader.
+ *
+ * Payloads are not copied: the #TranslationHeader of each packet is
+ * stored inside this object, and the payload is referenced, i.e. it
+ * must remain valid until the packets have been sent.  The total size
+ * is known before anything gets written, which allows copying
+ * everything into one buffer of the exact size or sending it with a
+ * single sendmsg() call.
+ *
+ * This object must not be moved after the first Write() call,
+ * because the iovec array points to its own headers.
+ */
+class TranslationMarshaller {
+    static constexpr size_t MAX_PACKETS = 64;
+
+    TranslationExtendedHeader headers[MAX_PACKETS];
+
+    struct iovec vec[MAX_PACKETS * 2];
+
+    size_t n_packets = 0, n_vec = 0;
+
+    /**
+     * May payloads larger than 64 kB be sent with a
+     * #TranslationExtendedHeader?  See EnableExtended().
+     */
+    bool extended = false;
+
+    /**
+     * The index of the first #vec element which has not yet been
+     * consumed by Consume().
+     */
+    size_t position = 0;
+
+    /**
+     * The number of bytes which have not yet been consumed.
+     */
+    size_t size = 0;
+
+public:
+    TranslationMarshaller() = default;
+    TranslationMarshaller(const TranslationMarshaller &) = delete;
+    TranslationMarshaller &operator=(const TranslationMarshaller &) = delete;
+
+    /**
+     * Send payloads larger than 64 kB in one packet with a
+     * #TranslationExtendedHeader instead of refusing them.  Call this
+     * only if the peer has announced (at least)
+     * #TRANSLATION_PROTOCOL_EXTENDED.  Smaller payloads still get a
+     * regular header.
+     */
+    void EnableExtended() {
+        extended = true;
+    }
+
+    /**
+     * Append a packet.
+     *
+     * Throws std::runtime_error if the payload is too large (see
+     * EnableExtended()) or if there are too many packets.
+     */
+    void Write(TranslationCommand command, ConstBuffer<void> payload);
+
+    void Write(TranslationCommand command) {
+        Write(command, ConstBuffer<void>(nullptr));
+    }
+
+    void Write(TranslationCommand command, StringView payload) {
+        Write(command, payload.ToVoid());
+    }
+
+    void Write(TranslationCommand command, const char *payload) {
+        assert(payload != nullptr);
+
+        Write(command, StringView(payload));
+    }
+
+    /**
+     * Append a packet, but only if the payload is not nullptr.
+     */
+    void WriteOptional(TranslationCommand command, const char *payload) {
+        if (payload != nullptr)
+            Write(command, payload);
+    }
+
+    void WriteOptional(TranslationCommand command,
+                       ConstBuffer<void> payload) {
+        if (!payload.IsNull())
+            Write(command, payload);
+    }
+
+    /**
+     * Append a packet with a fixed-size payload; the referenced
+     * object must remain valid.
+     */
+    template<typename T>
+    void WriteT(TranslationCommand command, const T &payload) {
+        Write(command, ConstBuffer<void>(&payload, sizeof(payload)));
+    }
+
+    bool IsEmpty() const {
+        return size == 0;
+    }
+
+    /**
+     * @return the number of bytes which remain to be sent
+     */
+    size_t GetSize() const {
+        return size;
+    }
+
+    /**
+     * Returns the remaining data as an iovec array, which can be
+     * passed to writev() or sendmsg().
+     */
+    ConstBuffer<struct iovec> GetVector() const {
+        return {vec + position, n_vec - position};
+    }
+
+    /**
+     * Copy the remaining data to the given buffer, which must be at
+     * least GetSize() bytes large.
+     *
+     * @return the number of bytes copied, i.e. GetSize()
+     */
+    size_t CopyTo(void *dest) const;
+
+    /**
+     * Copy the remaining data into a new allocation of the exact
+     * size.
+     */
+    ConstBuffer<void> Dup(AllocatorPtr alloc) const;
+
+    /**
+     * Mark the given number of bytes as "sent" (e.g. after a partial
+     * write).
+     */
+    void Consume(size_t nbytes);
+
+    /**
+     * Send as much as possible of the remaining data to the socket
+     * with a single sendmsg() call, and consume what was sent.
+     *
+     * Throws on error.
+     *
+     * @return the number of bytes sent; 0 if the socket would block
+     */
+    size_t Send(SocketDescriptor s);
+};
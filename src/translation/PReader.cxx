@@ -33,8 +33,45 @@
 #include "PReader.hxx"
 #include "AllocatorPtr.hxx"
 
+#include <stdexcept>
+
 #include <string.h>
 
+inline size_t
+TranslatePacketReader::ParseHeader(const uint8_t *data, size_t length)
+{
+    TranslationHeader header;
+    if (length < sizeof(header))
+        return 0;
+
+    memcpy(&header, data, sizeof(header));
+
+    const uint16_t c = uint16_t(header.command);
+    if (c & TRANSLATION_COMMAND_EXTENDED) {
+        TranslationExtendedHeader eh;
+        if (length < sizeof(eh))
+            return 0;
+
+        memcpy(&eh, data, sizeof(eh));
+
+        if (max_extended_length == 0)
+            throw std::runtime_error("extended translation packet without protocol negotiation");
+
+        if (eh.length > max_extended_length)
+            throw std::runtime_error("extended translation packet is too large");
+
+        command = TranslationCommand(c & ~TRANSLATION_COMMAND_EXTENDED);
+        extended = true;
+        payload_length = eh.length;
+        return sizeof(eh);
+    }
+
+    command = header.command;
+    extended = false;
+    payload_length = header.length;
+    return sizeof(header);
+}
+
 size_t
 TranslatePacketReader::Feed(AllocatorPtr alloc,
                             const uint8_t *data, size_t length)
@@ -51,27 +88,26 @@ TranslatePacketReader::Feed(AllocatorPtr alloc,
     size_t consumed = 0;
 
     if (state == State::HEADER) {
-        if (length < sizeof(header))
+        const size_t header_size = ParseHeader(data, length);
+        if (header_size == 0)
             /* need more data */
             return 0;
 
-        memcpy(&header, data, sizeof(header));
-
-        if (header.length == 0) {
+        if (payload_length == 0) {
             payload = nullptr;
             state = State::COMPLETE;
-            return sizeof(header);
+            return header_size;
         }
 
-        consumed += sizeof(header);
-        data += sizeof(header);
-        length -= sizeof(header);
+        consumed += header_size;
+        data += header_size;
+        length -= header_size;
 
         state = State::PAYLOAD;
 
         payload_position = 0;
-        payload = alloc.NewArray<char>(header.length + 1);
-        payload[header.length] = 0;
+        payload = alloc.NewArray<char>(payload_length + 1);
+        payload[payload_length] = 0;
 
         if (length == 0)
             return consumed;
@@ -79,17 +115,45 @@ TranslatePacketReader::Feed(AllocatorPtr alloc,
 
     assert(state == State::PAYLOAD);
 
-    assert(payload_position < header.length);
+    assert(payload_position < payload_length);
 
-    size_t nbytes = header.length - payload_position;
+    size_t nbytes = payload_length - payload_position;
     if (nbytes > length)
         nbytes = length;
 
     memcpy(payload + payload_position, data, nbytes);
     payload_position += nbytes;
-    if (payload_position == header.length)
+    if (payload_position == payload_length)
         state = State::COMPLETE;
 
     consumed += nbytes;
     return consumed;
 }
+
+size_t
+TranslatePacketReader::FeedPinned(AllocatorPtr alloc,
+                                  uint8_t *data, size_t length)
+{
+    if (state == State::COMPLETE)
+        state = State::HEADER;
+
+    if (state == State::HEADER) {
+        const size_t header_size = ParseHeader(data, length);
+
+        if (header_size > 0 && payload_length > 0 &&
+            length - header_size >= payload_length) {
+            /* the whole packet is in the buffer: move the payload
+               over the last header byte and append the null
+               terminator in place */
+            char *p = (char *)data + header_size - 1;
+            memmove(p, p + 1, payload_length);
+            p[payload_length] = 0;
+
+            payload = p;
+            state = State::COMPLETE;
+            return header_size + payload_length;
+        }
+    }
+
+    return Feed(alloc, data, length);
+}
@@ -53,19 +53,66 @@ class TranslatePacketReader {
 
     State state = State::HEADER;
 
-    TranslationHeader header;
+    TranslationCommand command;
+
+    /**
+     * Was the current packet sent with a
+     * #TranslationExtendedHeader?
+     */
+    bool extended;
+
+    size_t payload_length;
+
+    /**
+     * The maximum payload length of a packet with a
+     * #TranslationExtendedHeader; 0 means they are not allowed.
+     * See AllowExtended().
+     */
+    size_t max_extended_length = 0;
 
     char *payload;
     size_t payload_position;
 
 public:
+    /**
+     * Accept packets with a #TranslationExtendedHeader from now on.
+     * Call this only after both sides have announced (at least)
+     * #TRANSLATION_PROTOCOL_EXTENDED.  Longer payloads are rejected
+     * before anything is allocated.
+     */
+    void AllowExtended(size_t max_length) {
+        assert(max_length > 0);
+
+        max_extended_length = max_length;
+    }
+
     /**
      * Read a packet from the socket.
      *
+     * Throws std::runtime_error on a malformed header, i.e. an
+     * extended header which was not allowed (see AllowExtended())
+     * or whose length exceeds the limit.
+     *
      * @return the number of bytes consumed
      */
     size_t Feed(AllocatorPtr alloc, const uint8_t *data, size_t length);
 
+    /**
+     * Like Feed(), but if the complete packet is already present in
+     * the buffer, the payload is not copied to a new allocation;
+     * GetPayload() points into the buffer instead.  To make room for
+     * the null terminator, the payload is moved over the (already
+     * parsed) header by one byte.  Incomplete packets are copied as
+     * usual.
+     *
+     * The caller must "pin" the buffer: the consumed bytes must not
+     * be modified or freed as long as the payload (or a response
+     * which refers to it) is in use.
+     *
+     * @return the number of bytes consumed
+     */
+    size_t FeedPinned(AllocatorPtr alloc, uint8_t *data, size_t length);
+
     bool IsComplete() const {
         return state == State::COMPLETE;
     }
@@ -73,7 +120,16 @@ public:
     TranslationCommand GetCommand() const {
         assert(IsComplete());
 
-        return header.command;
+        return command;
+    }
+
+    /**
+     * Was the packet sent with a #TranslationExtendedHeader?
+     */
+    bool IsExtended() const {
+        assert(IsComplete());
+
+        return extended;
     }
 
     const void *GetPayload() const {
@@ -87,8 +143,20 @@ public:
     size_t GetLength() const {
         assert(IsComplete());
 
-        return header.length;
+        return payload_length;
     }
+
+private:
+    /**
+     * Parse the (regular or extended) header at the beginning of the
+     * buffer.
+     *
+     * Throws std::runtime_error if an extended header is not
+     * allowed.
+     *
+     * @return the size of the header or 0 if it is incomplete
+     */
+    size_t ParseHeader(const uint8_t *data, size_t length);
 };
 
 #endif
@@ -31,6 +31,7 @@
  */
 
 #include "Parser.hxx"
+#include "StringTable.hxx"
 #if TRANSLATION_ENABLE_TRANSFORMATION
 #include "translation/Transformation.hxx"
 #include "bp/XmlProcessor.hxx"
@@ -59,7 +60,9 @@
 #include "net/Parser.hxx"
 #endif
 #include "util/CharUtil.hxx"
+#include "util/Macros.hxx"
 #include "util/RuntimeError.hxx"
+#include "util/StringCompare.hxx"
 
 #if TRANSLATION_ENABLE_HTTP
 #include "http/HeaderName.hxx"
@@ -152,6 +155,167 @@ is_valid_absolute_uri(const char *p, size_t size)
 
 #endif
 
+/**
+ * How the payload of a #StringPacket is validated.
+ */
+enum class StringPacketCheck : uint8_t {
+    /**
+     * No validation; the payload is used as-is.
+     */
+    NONE,
+
+    /**
+     * The payload must not contain null bytes.
+     */
+    NO_NULL,
+
+    /**
+     * See is_valid_nonempty_string().
+     */
+    NON_EMPTY,
+
+    /**
+     * See is_valid_absolute_path().
+     */
+    ABSOLUTE_PATH,
+
+#if TRANSLATION_ENABLE_HTTP
+    /**
+     * See is_valid_absolute_uri().
+     */
+    ABSOLUTE_URI,
+#endif
+};
+
+/**
+ * Describes a packet whose payload is a string which is validated
+ * and then copied to a #TranslateResponse attribute, without any
+ * other side effect.  These are handled by one generic code path
+ * instead of a bespoke switch case each.
+ */
+struct StringPacket {
+    TranslationCommand command;
+
+    StringPacketCheck check;
+
+    /**
+     * Throw "duplicate" if the attribute has already been set?
+     */
+    bool unique;
+
+    /**
+     * The maximum payload length; 0 means unlimited.
+     */
+    uint16_t max_length;
+
+    const char *TranslateResponse::*attribute;
+
+    const char *name;
+};
+
+#define STRING_PACKET(command, check, unique, max_length, attribute) \
+    { TranslationCommand::command, StringPacketCheck::check, \
+      unique, max_length, &TranslateResponse::attribute, #command }
+
+static constexpr StringPacket string_packets[] = {
+    STRING_PACKET(TOKEN, NO_NULL, false, 0, token),
+    STRING_PACKET(POOL, NON_EMPTY, false, 0, pool),
+    STRING_PACKET(CANONICAL_HOST, NON_EMPTY, false, 0, canonical_host),
+    STRING_PACKET(TEST_PATH, ABSOLUTE_PATH, true, 0, test_path),
+
+#if TRANSLATION_ENABLE_HTTP
+    STRING_PACKET(REDIRECT, NON_EMPTY, false, 0, redirect),
+    STRING_PACKET(BOUNCE, NON_EMPTY, false, 0, bounce),
+    STRING_PACKET(HOST, NONE, false, 0, host),
+    STRING_PACKET(URI, ABSOLUTE_URI, false, 0, uri),
+    STRING_PACKET(MESSAGE, NON_EMPTY, false, 1024, message),
+#endif
+
+#if TRANSLATION_ENABLE_WIDGET
+    STRING_PACKET(WIDGET_GROUP, NON_EMPTY, false, 0, widget_group),
+#endif
+
+#if TRANSLATION_ENABLE_SESSION
+    STRING_PACKET(LANGUAGE, NONE, false, 0, language),
+    STRING_PACKET(WWW_AUTHENTICATE, NON_EMPTY, false, 0, www_authenticate),
+    STRING_PACKET(AUTHENTICATION_INFO, NON_EMPTY, false, 0,
+                  authentication_info),
+    STRING_PACKET(SESSION_SITE, NONE, false, 0, session_site),
+#endif
+
+#if TRANSLATION_ENABLE_EXECUTE
+    STRING_PACKET(SHELL, ABSOLUTE_PATH, true, 0, shell),
+#endif
+};
+
+#undef STRING_PACKET
+
+/**
+ * Maps a #TranslationCommand to its (1-based) index in
+ * #string_packets; 0 means it is not a #StringPacket.
+ */
+struct StringPacketIndex {
+    static constexpr size_t SIZE = 256;
+
+    uint8_t positions[SIZE];
+
+    constexpr StringPacketIndex():positions() {
+        for (size_t i = 0; i < ARRAY_SIZE(string_packets); ++i)
+            positions[size_t(string_packets[i].command)] = i + 1;
+    }
+
+    constexpr const StringPacket *Find(TranslationCommand command) const {
+        return size_t(command) < SIZE && positions[size_t(command)] > 0
+            ? &string_packets[positions[size_t(command)] - 1]
+            : nullptr;
+    }
+};
+
+static_assert(ARRAY_SIZE(string_packets) < 256, "Too many string packets");
+
+static constexpr StringPacketIndex string_packet_index;
+
+gcc_pure
+static bool
+IsValidStringPacket(StringPacketCheck check, const char *p, size_t size)
+{
+    switch (check) {
+    case StringPacketCheck::NONE:
+        return true;
+
+    case StringPacketCheck::NO_NULL:
+        return !has_null_byte(p, size);
+
+    case StringPacketCheck::NON_EMPTY:
+        return is_valid_nonempty_string(p, size);
+
+    case StringPacketCheck::ABSOLUTE_PATH:
+        return is_valid_absolute_path(p, size);
+
+#if TRANSLATION_ENABLE_HTTP
+    case StringPacketCheck::ABSOLUTE_URI:
+        return is_valid_absolute_uri(p, size);
+#endif
+    }
+
+    gcc_unreachable();
+}
+
+static void
+HandleStringPacket(TranslateResponse &response, const StringPacket &packet,
+                   const char *payload, size_t payload_length)
+{
+    if ((packet.max_length > 0 && payload_length > packet.max_length) ||
+        !IsValidStringPacket(packet.check, payload, payload_length))
+        throw FormatRuntimeError("malformed %s packet", packet.name);
+
+    const char *&attribute = response.*packet.attribute;
+    if (packet.unique && attribute != nullptr)
+        throw FormatRuntimeError("duplicate %s packet", packet.name);
+
+    attribute = payload;
+}
+
 #if TRANSLATION_ENABLE_TRANSFORMATION
 
 Transformation *
@@ -450,7 +614,8 @@ translate_client_pair(AllocatorPtr alloc,
 #if TRANSLATION_ENABLE_EXPAND
 
 static void
-translate_client_expand_pair(ExpandableStringList::Builder &builder,
+translate_client_expand_pair(AllocatorPtr alloc,
+                             ExpandableStringList::Builder &builder,
                              const char *name,
                              const char *payload, size_t payload_length)
 {
@@ -459,7 +624,7 @@ translate_client_expand_pair(ExpandableStringList::Builder &builder,
 
     translate_client_check_pair(name, payload, payload_length);
 
-    builder.SetExpand(payload);
+    builder.SetExpand(alloc, payload);
 }
 
 #endif
@@ -1004,6 +1169,66 @@ TranslateParser::HandleCgroupSet(StringView payload)
     child_options->cgroup.Set(alloc, set.first, set.second);
 }
 
+inline void
+TranslateParser::HandleMemoryPolicy(StringView payload)
+{
+    if (child_options == nullptr)
+        throw std::runtime_error("misplaced MEMORY_POLICY packet");
+
+    auto &placement = child_options->placement;
+    if (placement.memory_policy != PlacementOptions::MemoryPolicy::DEFAULT)
+        throw std::runtime_error("duplicate MEMORY_POLICY packet");
+
+    if (has_null_byte(payload.data, payload.size))
+        throw std::runtime_error("malformed MEMORY_POLICY packet");
+
+    static constexpr struct {
+        const char *prefix;
+        PlacementOptions::MemoryPolicy policy;
+    } policies[] = {
+        { "bind:", PlacementOptions::MemoryPolicy::BIND },
+        { "preferred:", PlacementOptions::MemoryPolicy::PREFERRED },
+        { "interleave:", PlacementOptions::MemoryPolicy::INTERLEAVE },
+    };
+
+    for (const auto &i : policies) {
+        const char *nodes = StringAfterPrefix(payload.data, i.prefix);
+        if (nodes == nullptr)
+            continue;
+
+        if (!ParseNodeList(nodes, placement.memory_nodes) ||
+            placement.memory_nodes == 0)
+            break;
+
+        placement.memory_policy = i.policy;
+        return;
+    }
+
+    throw std::runtime_error("malformed MEMORY_POLICY packet");
+}
+
+inline void
+TranslateParser::HandleUtilClamp(ConstBuffer<void> _payload)
+{
+    if (child_options == nullptr)
+        throw std::runtime_error("misplaced UTIL_CLAMP packet");
+
+    auto &placement = child_options->placement;
+    if (placement.util_min != PlacementOptions::UTIL_UNDEFINED)
+        throw std::runtime_error("duplicate UTIL_CLAMP packet");
+
+    if (_payload.size != sizeof(uint16_t) * 2)
+        throw std::runtime_error("malformed UTIL_CLAMP packet");
+
+    const auto payload = ConstBuffer<uint16_t>::FromVoid(_payload);
+    if (payload[0] > payload[1] ||
+        payload[1] > PlacementOptions::UTIL_MAX)
+        throw std::runtime_error("malformed UTIL_CLAMP packet");
+
+    placement.util_min = payload[0];
+    placement.util_max = payload[1];
+}
+
 static bool
 CheckProbeSuffix(const char *payload, size_t length)
 {
@@ -1018,6 +1243,13 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
 {
     const char *const payload = (const char *)_payload;
 
+    const auto *string_packet = string_packet_index.Find(command);
+    if (string_packet != nullptr) {
+        HandleStringPacket(response, *string_packet,
+                           payload, payload_length);
+        return;
+    }
+
     switch (command) {
 #if TRANSLATION_ENABLE_TRANSFORMATION
         Transformation *new_transformation;
@@ -1027,6 +1259,25 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
     case TranslationCommand::END:
         gcc_unreachable();
 
+    case TranslationCommand::TOKEN:
+    case TranslationCommand::POOL:
+    case TranslationCommand::CANONICAL_HOST:
+    case TranslationCommand::TEST_PATH:
+    case TranslationCommand::REDIRECT:
+    case TranslationCommand::BOUNCE:
+    case TranslationCommand::HOST:
+    case TranslationCommand::URI:
+    case TranslationCommand::MESSAGE:
+    case TranslationCommand::WIDGET_GROUP:
+    case TranslationCommand::LANGUAGE:
+    case TranslationCommand::WWW_AUTHENTICATE:
+    case TranslationCommand::AUTHENTICATION_INFO:
+    case TranslationCommand::SESSION_SITE:
+    case TranslationCommand::SHELL:
+        /* handled by string_packets[] above if the feature is
+           enabled */
+        break;
+
     case TranslationCommand::PARAM:
     case TranslationCommand::REMOTE_HOST:
     case TranslationCommand::WIDGET_TYPE:
@@ -1262,17 +1513,6 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
         break;
 #endif
 
-    case TranslationCommand::REDIRECT:
-#if TRANSLATION_ENABLE_HTTP
-        if (!is_valid_nonempty_string(payload, payload_length))
-            throw std::runtime_error("malformed REDIRECT packet");
-
-        response.redirect = payload;
-        return;
-#else
-        break;
-#endif
-
     case TranslationCommand::EXPAND_REDIRECT:
 #if TRANSLATION_ENABLE_HTTP && TRANSLATION_ENABLE_EXPAND
         if (response.regex == nullptr ||
@@ -1289,17 +1529,6 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
         break;
 #endif
 
-    case TranslationCommand::BOUNCE:
-#if TRANSLATION_ENABLE_HTTP
-        if (!is_valid_nonempty_string(payload, payload_length))
-            throw std::runtime_error("malformed BOUNCE packet");
-
-        response.bounce = payload;
-        return;
-#else
-        break;
-#endif
-
     case TranslationCommand::FILTER:
 #if TRANSLATION_ENABLE_TRANSFORMATION
         resource_address = AddFilter();
@@ -1382,17 +1611,6 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
         break;
 #endif
 
-    case TranslationCommand::WIDGET_GROUP:
-#if TRANSLATION_ENABLE_WIDGET
-        if (!is_valid_nonempty_string(payload, payload_length))
-            throw std::runtime_error("malformed WIDGET_GROUP packet");
-
-        response.widget_group = payload;
-        return;
-#else
-        break;
-#endif
-
     case TranslationCommand::UNTRUSTED:
 #if TRANSLATION_ENABLE_WIDGET
         if (!is_valid_nonempty_string(payload, payload_length) || *payload == '.' ||
@@ -1449,25 +1667,6 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
         break;
 #endif
 
-    case TranslationCommand::HOST:
-#if TRANSLATION_ENABLE_HTTP
-        response.host = payload;
-        return;
-#else
-        break;
-#endif
-
-    case TranslationCommand::URI:
-#if TRANSLATION_ENABLE_HTTP
-        if (!is_valid_absolute_uri(payload, payload_length))
-            throw std::runtime_error("malformed URI packet");
-
-        response.uri = payload;
-        return;
-#else
-        break;
-#endif
-
     case TranslationCommand::DIRECT_ADDRESSING:
 #if TRANSLATION_ENABLE_WIDGET
         response.direct_addressing = true;
@@ -1516,14 +1715,6 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
         break;
 #endif
 
-    case TranslationCommand::LANGUAGE:
-#if TRANSLATION_ENABLE_SESSION
-        response.language = payload;
-        return;
-#else
-        break;
-#endif
-
     case TranslationCommand::PIPE:
 #if TRANSLATION_ENABLE_RADDRESS
         if (resource_address == nullptr || resource_address->IsDefined())
@@ -1982,7 +2173,7 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
             !args_builder.CanSetExpand())
             throw std::runtime_error("misplaced EXPAND_APPEND packet");
 
-        args_builder.SetExpand(payload);
+        args_builder.SetExpand(alloc, payload);
         return;
 #else
         break;
@@ -2017,10 +2208,10 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
                 ? env_builder
                 : params_builder;
 
-            translate_client_expand_pair(builder, "EXPAND_PAIR",
+            translate_client_expand_pair(alloc, builder, "EXPAND_PAIR",
                                          payload, payload_length);
         } else if (lhttp_address != nullptr) {
-            translate_client_expand_pair(env_builder,
+            translate_client_expand_pair(alloc, env_builder,
                                          "EXPAND_PAIR",
                                          payload, payload_length);
         } else
@@ -2064,28 +2255,6 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
         break;
 #endif
 
-    case TranslationCommand::WWW_AUTHENTICATE:
-#if TRANSLATION_ENABLE_SESSION
-        if (!is_valid_nonempty_string(payload, payload_length))
-            throw std::runtime_error("malformed WWW_AUTHENTICATE packet");
-
-        response.www_authenticate = payload;
-        return;
-#else
-        break;
-#endif
-
-    case TranslationCommand::AUTHENTICATION_INFO:
-#if TRANSLATION_ENABLE_SESSION
-        if (!is_valid_nonempty_string(payload, payload_length))
-            throw std::runtime_error("malformed AUTHENTICATION_INFO packet");
-
-        response.authentication_info = payload;
-        return;
-#else
-        break;
-#endif
-
     case TranslationCommand::HEADER:
 #if TRANSLATION_ENABLE_HTTP
         parse_header(alloc, response.response_headers,
@@ -2550,16 +2719,6 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
         return;
 
 
-    case TranslationCommand::TEST_PATH:
-        if (!is_valid_absolute_path(payload, payload_length))
-            throw std::runtime_error("malformed TEST_PATH packet");
-
-        if (response.test_path != nullptr)
-            throw std::runtime_error("duplicate TEST_PATH packet");
-
-        response.test_path = payload;
-        return;
-
     case TranslationCommand::EXPAND_TEST_PATH:
 #if TRANSLATION_ENABLE_EXPAND
         if (response.regex == nullptr)
@@ -2633,7 +2792,7 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
             throw std::runtime_error("misplaced EXPAND_SETENV packet");
 
         if (child_options != nullptr) {
-            translate_client_expand_pair(env_builder,
+            translate_client_expand_pair(alloc, env_builder,
                                          "EXPAND_SETENV",
                                          payload, payload_length);
         } else
@@ -2892,14 +3051,6 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
         break;
 #endif
 
-    case TranslationCommand::SESSION_SITE:
-#if TRANSLATION_ENABLE_SESSION
-        response.session_site = payload;
-        return;
-#else
-        break;
-#endif
-
     case TranslationCommand::IPC_NAMESPACE:
         if (payload_length != 0)
             throw std::runtime_error("malformed IPC_NAMESPACE packet");
@@ -3180,52 +3331,6 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
         break;
 #endif
 
-    case TranslationCommand::POOL:
-        if (!is_valid_nonempty_string(payload, payload_length))
-            throw std::runtime_error("malformed POOL packet");
-
-        response.pool = payload;
-        return;
-
-    case TranslationCommand::MESSAGE:
-#if TRANSLATION_ENABLE_HTTP
-        if (payload_length > 1024 ||
-            !is_valid_nonempty_string(payload, payload_length))
-            throw std::runtime_error("malformed MESSAGE packet");
-
-        response.message = payload;
-        return;
-#else
-        break;
-#endif
-
-    case TranslationCommand::CANONICAL_HOST:
-        if (!is_valid_nonempty_string(payload, payload_length))
-            throw std::runtime_error("malformed CANONICAL_HOST packet");
-
-        response.canonical_host = payload;
-        return;
-
-    case TranslationCommand::SHELL:
-#if TRANSLATION_ENABLE_EXECUTE
-        if (!is_valid_absolute_path(payload, payload_length))
-            throw std::runtime_error("malformed SHELL packet");
-
-        if (response.shell != nullptr)
-            throw std::runtime_error("duplicate SHELL packet");
-
-        response.shell = payload;
-        return;
-#else
-        break;
-#endif
-
-    case TranslationCommand::TOKEN:
-        if (has_null_byte(payload, payload_length))
-            throw std::runtime_error("malformed TOKEN packet");
-        response.token = payload;
-        return;
-
     case TranslationCommand::STDERR_PATH_JAILED:
         translate_client_stderr_path(child_options,
                                      { _payload, payload_length },
@@ -3389,11 +3494,136 @@ TranslateParser::HandleRegularPacket(TranslationCommand command,
 
         ns_options->pid_namespace = payload;
         return;
+
+    case TranslationCommand::CPU_AFFINITY:
+        if (child_options == nullptr)
+            throw std::runtime_error("misplaced CPU_AFFINITY packet");
+
+        if (child_options->placement.HasCpus())
+            throw std::runtime_error("duplicate CPU_AFFINITY packet");
+
+        if (has_null_byte(payload, payload_length) ||
+            !ParseCpuList(payload, child_options->placement.cpus) ||
+            !child_options->placement.HasCpus())
+            throw std::runtime_error("malformed CPU_AFFINITY packet");
+
+        return;
+
+    case TranslationCommand::MEMORY_POLICY:
+        HandleMemoryPolicy({payload, payload_length});
+        return;
+
+    case TranslationCommand::SCHED_BATCH_:
+        if (child_options == nullptr || child_options->sched_batch)
+            throw std::runtime_error("misplaced SCHED_BATCH packet");
+
+        if (payload_length != 0)
+            throw std::runtime_error("malformed SCHED_BATCH packet");
+
+        child_options->sched_batch = true;
+        return;
+
+    case TranslationCommand::UTIL_CLAMP:
+        HandleUtilClamp({_payload, payload_length});
+        return;
+
+    case TranslationCommand::NUMA_AUTO:
+        if (child_options == nullptr || child_options->placement.auto_node)
+            throw std::runtime_error("misplaced NUMA_AUTO packet");
+
+        if (payload_length != 0)
+            throw std::runtime_error("malformed NUMA_AUTO packet");
+
+        child_options->placement.auto_node = true;
+        return;
     }
 
     throw FormatRuntimeError("unknown translation packet: %u", command);
 }
 
+/**
+ * Commands whose payloads are likely to be repeated in many
+ * responses; see TranslateParser::SetStringTable().
+ */
+static constexpr TranslationCommand interned_commands[] = {
+    TranslationCommand::PATH,
+    TranslationCommand::EXPAND_PATH,
+    TranslationCommand::EXPAND_PATH_INFO,
+    TranslationCommand::SITE,
+    TranslationCommand::EXPAND_SITE,
+    TranslationCommand::DOCUMENT_ROOT,
+    TranslationCommand::EXPAND_DOCUMENT_ROOT,
+    TranslationCommand::CONTENT_TYPE,
+    TranslationCommand::INTERPRETER,
+    TranslationCommand::ACTION,
+    TranslationCommand::EXPAND_SCRIPT_NAME,
+    TranslationCommand::EXPAND_REDIRECT,
+    TranslationCommand::EXPAND_URI,
+    TranslationCommand::EXPAND_LHTTP_URI,
+    TranslationCommand::EXPAND_TEST_PATH,
+    TranslationCommand::EXPAND_AUTH_FILE,
+    TranslationCommand::EXPAND_APPEND_AUTH,
+    TranslationCommand::EXPAND_COOKIE_HOST,
+    TranslationCommand::EXPAND_READ_FILE,
+    TranslationCommand::EXPAND_HEADER,
+    TranslationCommand::EXPAND_REQUEST_HEADER,
+    TranslationCommand::APPEND,
+    TranslationCommand::EXPAND_APPEND,
+    TranslationCommand::PAIR,
+    TranslationCommand::EXPAND_PAIR,
+    TranslationCommand::SETENV,
+    TranslationCommand::EXPAND_SETENV,
+    TranslationCommand::HOME,
+    TranslationCommand::EXPAND_HOME,
+    TranslationCommand::PIVOT_ROOT,
+    TranslationCommand::MOUNT_HOME,
+    TranslationCommand::MOUNT_TMPFS,
+    TranslationCommand::BIND_MOUNT,
+    TranslationCommand::BIND_MOUNT_RW,
+    TranslationCommand::BIND_MOUNT_EXEC,
+    TranslationCommand::EXPAND_BIND_MOUNT,
+    TranslationCommand::EXPAND_BIND_MOUNT_RW,
+    TranslationCommand::EXPAND_BIND_MOUNT_EXEC,
+    TranslationCommand::STDERR_PATH,
+    TranslationCommand::EXPAND_STDERR_PATH,
+    TranslationCommand::CGROUP,
+    TranslationCommand::CGROUP_SET,
+};
+
+/**
+ * A constexpr bit set of #TranslationCommand values.
+ */
+struct TranslationCommandSet {
+    static constexpr size_t SIZE = 256;
+
+    uint8_t bits[SIZE / 8];
+
+    template<size_t N>
+    constexpr TranslationCommandSet(const TranslationCommand (&commands)[N])
+        :bits() {
+        for (size_t i = 0; i < N; ++i)
+            bits[size_t(commands[i]) / 8] |= 1u << (size_t(commands[i]) % 8);
+    }
+
+    constexpr bool Contains(TranslationCommand command) const {
+        return size_t(command) < SIZE &&
+            (bits[size_t(command) / 8] & (1u << (size_t(command) % 8))) != 0;
+    }
+};
+
+static constexpr TranslationCommandSet interned_command_set(interned_commands);
+
+inline const void *
+TranslateParser::InternPayload(TranslationCommand command,
+                               const void *payload, size_t payload_length)
+{
+    if (string_table == nullptr || payload_length == 0 ||
+        !interned_command_set.Contains(command))
+        return payload;
+
+    return string_table->Intern({(const char *)payload, payload_length});
+}
+
 inline TranslateParser::Result
 TranslateParser::HandlePacket(TranslationCommand command,
                               const void *const payload, size_t payload_length)
@@ -3458,10 +3688,19 @@ TranslateParser::HandlePacket(TranslationCommand command,
         if (payload_length >= sizeof(uint8_t))
             response.protocol_version = *(const uint8_t *)payload;
 
+        /* extended packets need the version announced by the
+           server; the request's version was checked by the caller
+           of EnableExtended() */
+        if (max_extended_length > 0 &&
+            response.protocol_version >= TRANSLATION_PROTOCOL_EXTENDED)
+            reader.AllowExtended(max_extended_length);
+
         return Result::MORE;
 
     default:
-        HandleRegularPacket(command, payload, payload_length);
+        HandleRegularPacket(command,
+                            InternPayload(command, payload, payload_length),
+                            payload_length);
         return Result::MORE;
     }
 }
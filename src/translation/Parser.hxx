@@ -54,6 +54,7 @@ struct MountList;
 struct AddressList;
 struct Transformation;
 struct StringView;
+class TranslationStringTable;
 
 /**
  * Parse translation response packets.
@@ -101,6 +102,18 @@ class TranslateParser {
     TranslatePacketReader reader;
     TranslateResponse response;
 
+    /**
+     * The maximum payload length of extended packets; 0 means they
+     * are not allowed.  See EnableExtended().
+     */
+    size_t max_extended_length = 0;
+
+    /**
+     * If set, then frequently repeated payloads are interned in
+     * this table; see SetStringTable().
+     */
+    TranslationStringTable *string_table = nullptr;
+
     TranslationCommand previous_command;
 
 #if TRANSLATION_ENABLE_RADDRESS
@@ -180,10 +193,49 @@ public:
     {
     }
 
+    /**
+     * Intern payloads which are likely to be repeated in many
+     * responses (EXPAND_* strings, mount paths, cgroup settings,
+     * ...) in the given table, so identical strings share one
+     * allocation and can be compared by pointer.
+     */
+    void SetStringTable(TranslationStringTable *_table) {
+        string_table = _table;
+    }
+
+    /**
+     * Accept packets with a #TranslationExtendedHeader if the
+     * server announces (at least) #TRANSLATION_PROTOCOL_EXTENDED in
+     * its BEGIN packet.  Call this only if the request announced
+     * that version, too.
+     *
+     * @param max_length the maximum payload length of an extended
+     * packet; longer ones are rejected before allocating anything
+     */
+    void EnableExtended(size_t max_length) {
+        assert(max_length > 0);
+
+        max_extended_length = max_length;
+    }
+
+    /**
+     * Throws std::runtime_error on a malformed packet header.
+     */
     size_t Feed(const uint8_t *data, size_t length) {
         return reader.Feed(alloc, data, length);
     }
 
+    /**
+     * Like Feed(), but refer to complete packets in the given buffer
+     * instead of copying them; see
+     * TranslatePacketReader::FeedPinned().  The caller must keep the
+     * buffer valid and unmodified as long as the #TranslateResponse
+     * is in use.
+     */
+    size_t FeedPinned(uint8_t *data, size_t length) {
+        return reader.FeedPinned(alloc, data, length);
+    }
+
     enum class Result {
         MORE,
         DONE,
@@ -260,6 +312,12 @@ private:
 
     void HandleCgroupSet(StringView payload);
 
+    void HandleMemoryPolicy(StringView payload);
+    void HandleUtilClamp(ConstBuffer<void> payload);
+
+    const void *InternPayload(TranslationCommand command,
+                              const void *payload, size_t payload_length);
+
     Result HandlePacket(TranslationCommand command,
                         const void *const _payload, size_t payload_length);
 };
@@ -944,6 +944,36 @@ enum class TranslationCommand : uint16_t {
      * the Spawn daemon).
      */
     PID_NAMESPACE_NAME = 204,
+
+    /**
+     * Restrict the child process to the given CPUs.  Payload is a
+     * list of CPU numbers and ranges, e.g. "0-3,8".
+     */
+    CPU_AFFINITY = 205,
+
+    /**
+     * Set the NUMA memory policy of the child process.  Payload is
+     * "bind:", "preferred:" or "interleave:" followed by a list of
+     * NUMA node numbers and ranges.
+     */
+    MEMORY_POLICY = 206,
+
+    /**
+     * Run the child process with the scheduling policy SCHED_BATCH.
+     */
+    SCHED_BATCH_ = 207,
+
+    /**
+     * Utilization clamp for the child process.  Payload is two
+     * uint16_t values (minimum and maximum, 0..1024).
+     */
+    UTIL_CLAMP = 208,
+
+    /**
+     * Let the spawner choose the least loaded NUMA node for the
+     * child process.
+     */
+    NUMA_AUTO = 209,
 };
 
 struct TranslationHeader {
@@ -953,4 +983,28 @@ struct TranslationHeader {
 
 static_assert(sizeof(TranslationHeader) == 4, "Wrong size");
 
+/**
+ * The first protocol version (see #TranslationCommand::BEGIN) which
+ * allows packets with a #TranslationExtendedHeader.  A peer may send
+ * them only after the other side has announced at least this
+ * version.
+ */
+static constexpr unsigned TRANSLATION_PROTOCOL_EXTENDED = 4;
+
+/**
+ * If this bit is set in TranslationHeader::command, then
+ * TranslationHeader::length is zero, and the real payload length
+ * follows the header as a 32 bit integer; see
+ * #TranslationExtendedHeader.  This avoids splitting payloads which
+ * are larger than 64 kB.
+ */
+static constexpr uint16_t TRANSLATION_COMMAND_EXTENDED = 0x8000;
+
+struct TranslationExtendedHeader {
+    TranslationHeader header;
+    uint32_t length;
+};
+
+static_assert(sizeof(TranslationExtendedHeader) == 8, "Wrong size");
+
 #endif
@@ -0,0 +1,548 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Snapshot.hxx"
+#include "Response.hxx"
+#include "Protocol.hxx"
+#include "AllocatorPtr.hxx"
+#include "util/Macros.hxx"
+
+#include <stdexcept>
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+static constexpr const char *TranslateResponse::*snapshot_strings[] = {
+    &TranslateResponse::token,
+#if TRANSLATION_ENABLE_EXECUTE
+    &TranslateResponse::shell,
+    &TranslateResponse::execute,
+#endif
+    &TranslateResponse::base,
+#if TRANSLATION_ENABLE_CACHE
+    &TranslateResponse::regex,
+    &TranslateResponse::inverse_regex,
+#endif
+    &TranslateResponse::site,
+    &TranslateResponse::expand_site,
+    &TranslateResponse::canonical_host,
+#if TRANSLATION_ENABLE_HTTP
+    &TranslateResponse::document_root,
+    &TranslateResponse::expand_document_root,
+    &TranslateResponse::redirect,
+    &TranslateResponse::expand_redirect,
+    &TranslateResponse::bounce,
+    &TranslateResponse::message,
+    &TranslateResponse::scheme,
+    &TranslateResponse::host,
+    &TranslateResponse::uri,
+    &TranslateResponse::expand_uri,
+    &TranslateResponse::local_uri,
+    &TranslateResponse::untrusted,
+    &TranslateResponse::untrusted_prefix,
+    &TranslateResponse::untrusted_site_suffix,
+    &TranslateResponse::untrusted_raw_site_suffix,
+#endif
+    &TranslateResponse::test_path,
+    &TranslateResponse::expand_test_path,
+    &TranslateResponse::pool,
+#if TRANSLATION_ENABLE_SESSION
+    &TranslateResponse::auth_file,
+    &TranslateResponse::expand_auth_file,
+    &TranslateResponse::expand_append_auth,
+    &TranslateResponse::user,
+    &TranslateResponse::session_site,
+    &TranslateResponse::language,
+    &TranslateResponse::realm,
+    &TranslateResponse::www_authenticate,
+    &TranslateResponse::authentication_info,
+    &TranslateResponse::cookie_domain,
+    &TranslateResponse::cookie_host,
+    &TranslateResponse::expand_cookie_host,
+    &TranslateResponse::cookie_path,
+#endif
+#if TRANSLATION_ENABLE_WIDGET
+    &TranslateResponse::widget_group,
+#endif
+#if TRANSLATION_ENABLE_RADDRESS
+    &TranslateResponse::content_type,
+#endif
+    &TranslateResponse::read_file,
+    &TranslateResponse::expand_read_file,
+};
+
+static constexpr ConstBuffer<void> TranslateResponse::*snapshot_buffers[] = {
+#if TRANSLATION_ENABLE_SESSION
+    &TranslateResponse::session,
+#endif
+#if TRANSLATION_ENABLE_HTTP
+    &TranslateResponse::internal_redirect,
+#endif
+#if TRANSLATION_ENABLE_SESSION
+    &TranslateResponse::check,
+    &TranslateResponse::auth,
+    &TranslateResponse::append_auth,
+#endif
+#if TRANSLATION_ENABLE_HTTP
+    &TranslateResponse::want_full_uri,
+#endif
+#if TRANSLATION_ENABLE_RADDRESS
+    &TranslateResponse::file_not_found,
+    &TranslateResponse::enotdir,
+    &TranslateResponse::directory_index,
+#endif
+    &TranslateResponse::error_document,
+    &TranslateResponse::probe_path_suffixes,
+};
+
+static constexpr bool TranslateResponse::*snapshot_flags[] = {
+    &TranslateResponse::uncached,
+#if TRANSLATION_ENABLE_RADDRESS
+    &TranslateResponse::unsafe_base,
+    &TranslateResponse::easy_base,
+#endif
+#if TRANSLATION_ENABLE_CACHE
+    &TranslateResponse::regex_tail,
+    &TranslateResponse::regex_unescape,
+    &TranslateResponse::inverse_regex_unescape,
+#endif
+#if TRANSLATION_ENABLE_WIDGET
+    &TranslateResponse::direct_addressing,
+#endif
+#if TRANSLATION_ENABLE_SESSION
+    &TranslateResponse::stateful,
+    &TranslateResponse::discard_session,
+    &TranslateResponse::secure_cookie,
+#endif
+#if TRANSLATION_ENABLE_TRANSFORMATION
+    &TranslateResponse::filter_4xx,
+#endif
+    &TranslateResponse::previous,
+    &TranslateResponse::transparent,
+#if TRANSLATION_ENABLE_HTTP
+    &TranslateResponse::redirect_query_string,
+    &TranslateResponse::redirect_full_uri,
+#endif
+#if TRANSLATION_ENABLE_RADDRESS
+    &TranslateResponse::auto_base,
+#endif
+#if TRANSLATION_ENABLE_WIDGET
+    &TranslateResponse::widget_info,
+    &TranslateResponse::anchor_absolute,
+#endif
+#if TRANSLATION_ENABLE_HTTP
+    &TranslateResponse::dump_headers,
+#endif
+#if TRANSLATION_ENABLE_CACHE
+    &TranslateResponse::regex_on_host_uri,
+    &TranslateResponse::regex_on_user_uri,
+#endif
+    &TranslateResponse::auto_deflate,
+    &TranslateResponse::auto_gzip,
+#if TRANSLATION_ENABLE_SESSION
+    &TranslateResponse::realm_from_auth_base,
+#endif
+};
+
+static_assert(ARRAY_SIZE(snapshot_flags) <= 64, "Too many flags");
+
+/**
+ * The capacity of TranslateResponse::probe_suffixes.
+ */
+static constexpr size_t MAX_PROBE_SUFFIXES = 16;
+
+/**
+ * Refers to a range of the snapshot buffer.  An offset of zero means
+ * nullptr.  Strings are null-terminated, but the terminator is not
+ * included in the size.
+ */
+struct SnapshotRef {
+    uint32_t offset, size;
+};
+
+struct SnapshotHeader {
+    static constexpr uint32_t MAGIC = 0x54525331; // "TRS1"
+
+    uint32_t magic;
+
+    /**
+     * Identifies the snapshot layout of the build which has created
+     * it; see MakeLayout().
+     */
+    uint32_t layout;
+
+    uint64_t size;
+
+    int64_t max_age, expires_relative, user_max_age;
+
+    uint64_t validate_mtime;
+
+    uint64_t flags;
+
+    uint32_t protocol_version;
+    int32_t status;
+
+    uint16_t https_only, external_session_keepalive;
+    uint32_t n_probe_suffixes;
+
+    SnapshotRef strings[ARRAY_SIZE(snapshot_strings)];
+    SnapshotRef buffers[ARRAY_SIZE(snapshot_buffers)];
+    SnapshotRef vary, invalidate, want;
+    SnapshotRef probe_suffixes[MAX_PROBE_SUFFIXES];
+    SnapshotRef validate_mtime_path;
+    SnapshotRef request_header_forward, response_header_forward;
+};
+
+static constexpr uint32_t
+MakeLayout()
+{
+    return (uint32_t(sizeof(SnapshotHeader)) << 16) ^
+        (uint32_t(ARRAY_SIZE(snapshot_strings)) << 10) ^
+        (uint32_t(ARRAY_SIZE(snapshot_buffers)) << 5) ^
+        uint32_t(ARRAY_SIZE(snapshot_flags));
+}
+
+static constexpr size_t
+AlignSnapshot(size_t size)
+{
+    return (size + TRANSLATION_SNAPSHOT_ALIGNMENT - 1)
+        & ~(TRANSLATION_SNAPSHOT_ALIGNMENT - 1);
+}
+
+namespace {
+
+/**
+ * Appends data to the snapshot.  Without a buffer, it only
+ * calculates the size.
+ */
+class SnapshotWriter {
+    uint8_t *const base;
+
+    size_t position = AlignSnapshot(sizeof(SnapshotHeader));
+
+public:
+    explicit SnapshotWriter(void *_base) noexcept
+        :base((uint8_t *)_base) {}
+
+    size_t GetSize() const noexcept {
+        return AlignSnapshot(position);
+    }
+
+    SnapshotRef Append(const void *p, size_t size, size_t extra=0) noexcept {
+        if (p == nullptr)
+            return {0, 0};
+
+        position = AlignSnapshot(position);
+        const SnapshotRef ref{uint32_t(position), uint32_t(size)};
+
+        if (base != nullptr)
+            memcpy(base + position, p, size + extra);
+
+        position += size + extra;
+        return ref;
+    }
+
+    SnapshotRef Append(ConstBuffer<void> b) noexcept {
+        return Append(b.data, b.size);
+    }
+
+    template<typename T>
+    SnapshotRef Append(ConstBuffer<T> b) noexcept {
+        return Append(b.ToVoid());
+    }
+
+    SnapshotRef AppendString(const char *s) noexcept {
+        return s != nullptr
+            ? Append(s, strlen(s), 1)
+            : SnapshotRef{0, 0};
+    }
+};
+
+}
+
+template<typename W>
+static void
+WriteSnapshot(W &w, SnapshotHeader &h, const TranslateResponse &response) noexcept
+{
+    for (size_t i = 0; i < ARRAY_SIZE(snapshot_strings); ++i)
+        h.strings[i] = w.AppendString(response.*snapshot_strings[i]);
+
+    for (size_t i = 0; i < ARRAY_SIZE(snapshot_buffers); ++i)
+        h.buffers[i] = w.Append(response.*snapshot_buffers[i]);
+
+#if TRANSLATION_ENABLE_CACHE
+    h.vary = w.Append(response.vary);
+    h.invalidate = w.Append(response.invalidate);
+#endif
+#if TRANSLATION_ENABLE_WANT
+    h.want = w.Append(response.want);
+#endif
+
+    for (size_t i = 0; i < response.probe_suffixes.size(); ++i)
+        h.probe_suffixes[i] = w.AppendString(response.probe_suffixes[i]);
+
+    h.validate_mtime_path = w.AppendString(response.validate_mtime.path);
+
+#if TRANSLATION_ENABLE_HTTP
+    h.request_header_forward =
+        w.Append(&response.request_header_forward,
+                 sizeof(response.request_header_forward));
+    h.response_header_forward =
+        w.Append(&response.response_header_forward,
+                 sizeof(response.response_header_forward));
+#endif
+}
+
+bool
+IsTranslationSnapshotSupported(const TranslateResponse &response) noexcept
+{
+#if TRANSLATION_ENABLE_EXECUTE
+    if (response.execute != nullptr || !response.args.IsEmpty())
+        return false;
+#endif
+
+#if TRANSLATION_ENABLE_RADDRESS
+    if (response.address.IsDefined())
+        return false;
+#endif
+
+#if TRANSLATION_ENABLE_SESSION
+    if (response.external_session_manager != nullptr)
+        return false;
+#endif
+
+#if TRANSLATION_ENABLE_HTTP
+    if (!response.request_headers.IsEmpty() ||
+        !response.expand_request_headers.IsEmpty() ||
+        !response.response_headers.IsEmpty() ||
+        !response.expand_response_headers.IsEmpty())
+        return false;
+#endif
+
+#if TRANSLATION_ENABLE_WIDGET
+    if (response.views != nullptr || !response.container_groups.IsEmpty())
+        return false;
+#endif
+
+    (void)response;
+    return true;
+}
+
+size_t
+GetTranslationSnapshotSize(const TranslateResponse &response) noexcept
+{
+    SnapshotHeader h;
+    SnapshotWriter w(nullptr);
+    WriteSnapshot(w, h, response);
+    return w.GetSize();
+}
+
+size_t
+WriteTranslationSnapshot(void *dest,
+                         const TranslateResponse &response) noexcept
+{
+    assert(IsTranslationSnapshotSupported(response));
+    assert(((uintptr_t)dest & (TRANSLATION_SNAPSHOT_ALIGNMENT - 1)) == 0);
+
+    SnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+
+    SnapshotWriter w(dest);
+    WriteSnapshot(w, h, response);
+
+    h.magic = SnapshotHeader::MAGIC;
+    h.layout = MakeLayout();
+    h.size = w.GetSize();
+
+    h.max_age = response.max_age.count();
+    h.expires_relative = response.expires_relative.count();
+#if TRANSLATION_ENABLE_SESSION
+    h.user_max_age = response.user_max_age.count();
+    h.external_session_keepalive = response.external_session_keepalive.count();
+#endif
+    h.validate_mtime = response.validate_mtime.mtime;
+
+    for (size_t i = 0; i < ARRAY_SIZE(snapshot_flags); ++i)
+        if (response.*snapshot_flags[i])
+            h.flags |= uint64_t(1) << i;
+
+    h.protocol_version = response.protocol_version;
+    h.status = response.status;
+#if TRANSLATION_ENABLE_HTTP
+    h.https_only = response.https_only;
+#endif
+    h.n_probe_suffixes = response.probe_suffixes.size();
+
+    memcpy(dest, &h, sizeof(h));
+    return h.size;
+}
+
+ConstBuffer<void>
+DupTranslationSnapshot(AllocatorPtr alloc, const TranslateResponse &response)
+{
+    if (!IsTranslationSnapshotSupported(response))
+        throw std::runtime_error("Translation response not supported by snapshot");
+
+    const size_t size = GetTranslationSnapshotSize(response);
+    void *p = alloc.NewArray<uint64_t>(size / sizeof(uint64_t));
+    WriteTranslationSnapshot(p, response);
+    return {p, size};
+}
+
+namespace {
+
+class SnapshotReader {
+    const uint8_t *const base;
+    const size_t size;
+
+public:
+    SnapshotReader(const void *_base, size_t _size) noexcept
+        :base((const uint8_t *)_base), size(_size) {}
+
+    const void *Get(SnapshotRef ref, size_t extra=0) const {
+        if (ref.offset == 0)
+            return nullptr;
+
+        if (ref.offset < sizeof(SnapshotHeader) || ref.offset > size ||
+            size - ref.offset < ref.size + extra)
+            throw std::runtime_error("Malformed translation snapshot");
+
+        return base + ref.offset;
+    }
+
+    ConstBuffer<void> GetBuffer(SnapshotRef ref) const {
+        const void *p = Get(ref);
+        if (p == nullptr)
+            return nullptr;
+
+        return {p, ref.size};
+    }
+
+    template<typename T>
+    ConstBuffer<T> GetArray(SnapshotRef ref) const {
+        if (ref.size % sizeof(T) != 0 ||
+            ref.offset % alignof(T) != 0)
+            throw std::runtime_error("Malformed translation snapshot");
+
+        return ConstBuffer<T>::FromVoid(GetBuffer(ref));
+    }
+
+    const char *GetString(SnapshotRef ref) const {
+        const char *p = (const char *)Get(ref, 1);
+        if (p != nullptr && p[ref.size] != 0)
+            throw std::runtime_error("Malformed translation snapshot");
+
+        return p;
+    }
+};
+
+}
+
+void
+LoadTranslationSnapshot(TranslateResponse &dest, ConstBuffer<void> src)
+{
+    SnapshotHeader h;
+    if (src.size < sizeof(h))
+        throw std::runtime_error("Translation snapshot too small");
+
+    memcpy(&h, src.data, sizeof(h));
+
+    if (h.magic != SnapshotHeader::MAGIC || h.layout != MakeLayout())
+        throw std::runtime_error("Incompatible translation snapshot");
+
+    if (h.size > src.size)
+        throw std::runtime_error("Truncated translation snapshot");
+
+    if (h.n_probe_suffixes > MAX_PROBE_SUFFIXES)
+        throw std::runtime_error("Malformed translation snapshot");
+
+    const SnapshotReader r(src.data, h.size);
+
+    dest.Clear();
+
+    for (size_t i = 0; i < ARRAY_SIZE(snapshot_strings); ++i)
+        dest.*snapshot_strings[i] = r.GetString(h.strings[i]);
+
+    for (size_t i = 0; i < ARRAY_SIZE(snapshot_buffers); ++i)
+        dest.*snapshot_buffers[i] = r.GetBuffer(h.buffers[i]);
+
+#if TRANSLATION_ENABLE_CACHE
+    dest.vary = r.GetArray<TranslationCommand>(h.vary);
+    dest.invalidate = r.GetArray<TranslationCommand>(h.invalidate);
+#endif
+#if TRANSLATION_ENABLE_WANT
+    dest.want = r.GetArray<TranslationCommand>(h.want);
+#endif
+
+    dest.probe_suffixes.resize(h.n_probe_suffixes);
+    for (size_t i = 0; i < h.n_probe_suffixes; ++i) {
+        dest.probe_suffixes[i] = r.GetString(h.probe_suffixes[i]);
+        if (dest.probe_suffixes[i] == nullptr)
+            throw std::runtime_error("Malformed translation snapshot");
+    }
+
+    dest.validate_mtime.path = r.GetString(h.validate_mtime_path);
+    dest.validate_mtime.mtime = h.validate_mtime;
+
+#if TRANSLATION_ENABLE_HTTP
+    const auto request_header_forward = r.GetBuffer(h.request_header_forward);
+    const auto response_header_forward = r.GetBuffer(h.response_header_forward);
+    if (request_header_forward.size != sizeof(dest.request_header_forward) ||
+        response_header_forward.size != sizeof(dest.response_header_forward))
+        throw std::runtime_error("Malformed translation snapshot");
+
+    memcpy(&dest.request_header_forward, request_header_forward.data,
+           sizeof(dest.request_header_forward));
+    memcpy(&dest.response_header_forward, response_header_forward.data,
+           sizeof(dest.response_header_forward));
+#endif
+
+    dest.max_age = std::chrono::seconds(h.max_age);
+    dest.expires_relative = std::chrono::seconds(h.expires_relative);
+#if TRANSLATION_ENABLE_SESSION
+    dest.user_max_age = std::chrono::seconds(h.user_max_age);
+    dest.external_session_keepalive =
+        std::chrono::duration<uint16_t>(h.external_session_keepalive);
+#endif
+
+    for (size_t i = 0; i < ARRAY_SIZE(snapshot_flags); ++i)
+        dest.*snapshot_flags[i] = (h.flags & (uint64_t(1) << i)) != 0;
+
+    dest.protocol_version = h.protocol_version;
+#if TRANSLATION_ENABLE_HTTP
+    dest.status = http_status_t(h.status);
+    dest.https_only = h.https_only;
+#else
+    dest.status = h.status;
+#endif
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "util/ConstBuffer.hxx"
+#include "util/Compiler.h"
+
+#include <stddef.h>
+
+struct TranslateResponse;
+class AllocatorPtr;
+
+/*
+ * A position-independent "snapshot" of a #TranslateResponse: all
+ * pointers are replaced by offsets into one flat buffer, which can
+ * therefore be stored in shared memory or in a file and be used by
+ * other processes (running the same build).
+ *
+ * Only the "flat" attributes (strings, buffers, flags and numbers)
+ * can be stored; responses with nested objects (e.g. a resource
+ * address, child process options or header lists) are not
+ * supported, see IsTranslationSnapshotSupported().
+ */
+
+/**
+ * The required alignment of snapshot buffers.
+ */
+static constexpr size_t TRANSLATION_SNAPSHOT_ALIGNMENT = 8;
+
+/**
+ * Can this response be stored in a snapshot?
+ */
+gcc_pure
+bool
+IsTranslationSnapshotSupported(const TranslateResponse &response) noexcept;
+
+/**
+ * Calculate the exact size of the snapshot of the given response.
+ * It is always a multiple of #TRANSLATION_SNAPSHOT_ALIGNMENT.
+ */
+gcc_pure
+size_t
+GetTranslationSnapshotSize(const TranslateResponse &response) noexcept;
+
+/**
+ * Write a snapshot.  The caller must check
+ * IsTranslationSnapshotSupported() first.
+ *
+ * @param dest a buffer of GetTranslationSnapshotSize() bytes aligned
+ * to #TRANSLATION_SNAPSHOT_ALIGNMENT
+ * @return the number of bytes written
+ */
+size_t
+WriteTranslationSnapshot(void *dest,
+                         const TranslateResponse &response) noexcept;
+
+/**
+ * Allocate a buffer and write a snapshot into it.
+ *
+ * Throws std::runtime_error if the response is not supported.
+ */
+ConstBuffer<void>
+DupTranslationSnapshot(AllocatorPtr alloc, const TranslateResponse &response);
+
+/**
+ * Load a snapshot in place: all pointers in the #TranslateResponse
+ * refer to the snapshot buffer, which must therefore remain valid
+ * and unmodified as long as the #TranslateResponse is used.  Nothing
+ * is copied or allocated.
+ *
+ * Throws std::runtime_error if the snapshot is malformed or was
+ * created by an incompatible build.
+ */
+void
+LoadTranslationSnapshot(TranslateResponse &dest, ConstBuffer<void> src);
@@ -0,0 +1,483 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Stock.hxx"
+#include "Handler.hxx"
+#include "Parser.hxx"
+#include "net/SocketProtocolError.hxx"
+#include "system/Error.hxx"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+void
+TranslationStock::Request::Abort(std::exception_ptr ep) noexcept
+{
+    auto &_handler = handler;
+    void *ctx = handler_ctx;
+    delete this;
+
+    _handler.error(ep, ctx);
+}
+
+void
+TranslationStock::Request::Cancel() noexcept
+{
+    if (connection == nullptr) {
+        stock.waiting.erase(stock.waiting.iterator_to(*this));
+        delete this;
+    } else
+        /* the response is already on its way; discard it when it
+           arrives */
+        canceled = true;
+}
+
+size_t
+TranslationStock::ResponseFramer::Feed(const uint8_t *data,
+                                       size_t length) noexcept
+{
+    size_t consumed = 0;
+
+    while (length > 0 && !end) {
+        if (payload_remaining > 0) {
+            size_t nbytes = std::min(payload_remaining, length);
+            payload_remaining -= nbytes;
+            data += nbytes;
+            length -= nbytes;
+            consumed += nbytes;
+        } else {
+            const bool extended = header_fill >= sizeof(header.header) &&
+                (uint16_t(header.header.command) & TRANSLATION_COMMAND_EXTENDED);
+            const size_t header_size = extended
+                ? sizeof(header)
+                : sizeof(header.header);
+
+            size_t nbytes = std::min(header_size - header_fill, length);
+            memcpy((uint8_t *)&header + header_fill, data, nbytes);
+            header_fill += nbytes;
+            data += nbytes;
+            length -= nbytes;
+            consumed += nbytes;
+
+            if (header_fill < header_size)
+                /* need more data (or the rest of an extended
+                   header) */
+                continue;
+
+            if (!extended &&
+                (uint16_t(header.header.command) & TRANSLATION_COMMAND_EXTENDED))
+                /* the 16 bit header says the 32 bit length follows */
+                continue;
+
+            header_fill = 0;
+            payload_remaining = extended
+                ? header.length
+                : header.header.length;
+        }
+
+        if (header_fill == 0 && payload_remaining == 0 &&
+            (uint16_t(header.header.command) & ~TRANSLATION_COMMAND_EXTENDED) ==
+            uint16_t(TranslationCommand::END))
+            end = true;
+    }
+
+    return consumed;
+}
+
+TranslationStock::Connection::Connection(TranslationStock &_stock,
+                                         UniqueSocketDescriptor &&fd) noexcept
+    :stock(_stock),
+     connect(stock.event_loop, *this),
+     socket(stock.event_loop)
+{
+    connect.WaitConnected(std::move(fd), stock.config.timeout);
+}
+
+TranslationStock::Connection::~Connection() noexcept
+{
+    assert(requests.empty());
+
+    if (ready) {
+        if (socket.IsConnected())
+            socket.Close();
+        socket.Destroy();
+    }
+}
+
+inline void
+TranslationStock::Connection::Destroy() noexcept
+{
+    stock.connections.erase(stock.connections.iterator_to(*this));
+    delete this;
+}
+
+void
+TranslationStock::Connection::Send(Request &request)
+{
+    assert(IsAvailable());
+    assert(request.connection == nullptr);
+
+    socket.Enqueue(request.data.data, request.data.size);
+
+    request.connection = this;
+    requests.push_back(request);
+
+    socket.ScheduleReadTimeout(true, &stock.config.timeout);
+}
+
+void
+TranslationStock::Connection::Abort(std::exception_ptr ep, bool retry) noexcept
+{
+    auto &s = stock;
+
+    RequestList failed, retried;
+    failed.swap(requests);
+    Destroy();
+
+    for (auto i = failed.begin(); i != failed.end();) {
+        auto &request = *i;
+        request.connection = nullptr;
+
+        if (request.canceled) {
+            i = failed.erase(i);
+            delete &request;
+        } else if (retry && !request.receiving && !request.retried) {
+            request.retried = true;
+            i = failed.erase(i);
+            retried.push_back(request);
+        } else
+            ++i;
+    }
+
+    /* retry in the original order, before all other waiting
+       requests */
+    s.waiting.splice(s.waiting.begin(), retried);
+
+    while (!failed.empty()) {
+        auto &request = failed.front();
+        failed.pop_front();
+        request.Abort(ep);
+    }
+
+    if (retry)
+        s.Dispatch();
+}
+
+inline void
+TranslationStock::Connection::FinishResponse() noexcept
+{
+    auto &request = requests.front();
+    requests.pop_front();
+    framer.Reset();
+
+    if (requests.empty())
+        socket.ScheduleReadNoTimeout(false);
+
+    const bool canceled = request.canceled;
+    auto &parser = request.parser;
+    auto &handler = request.handler;
+    void *ctx = request.handler_ctx;
+    delete &request;
+
+    if (!canceled)
+        handler.response(parser.GetResponse(), ctx);
+}
+
+BufferedResult
+TranslationStock::Connection::OnBufferedData()
+{
+    if (requests.empty()) {
+        Abort(std::make_exception_ptr(SocketProtocolError("Unexpected data from translation server")),
+              false);
+        return BufferedResult::CLOSED;
+    }
+
+    const auto r = socket.ReadBuffer();
+    const uint8_t *data = (const uint8_t *)r.data;
+    size_t length = r.size;
+    size_t consumed = 0;
+
+    while (length > 0 && !requests.empty()) {
+        auto &request = requests.front();
+
+        size_t nbytes;
+        bool done;
+
+        if (request.canceled) {
+            nbytes = framer.Feed(data, length);
+            done = framer.IsEnd();
+        } else {
+            try {
+                nbytes = request.parser.Feed(data, length);
+            } catch (...) {
+                /* nothing has been consumed; let the framer
+                   discard the response */
+                request.canceled = true;
+                request.handler.error(std::current_exception(),
+                                      request.handler_ctx);
+                continue;
+            }
+
+            if (nbytes == 0)
+                break;
+
+            /* keep track of the packet boundaries, to be able to
+               discard the rest if the request gets canceled */
+            framer.Feed(data, nbytes);
+            request.receiving = true;
+
+            try {
+                done = request.parser.Process() == TranslateParser::Result::DONE;
+            } catch (...) {
+                /* fail only this request; the framer knows where its
+                   response ends, so the rest of it is discarded and
+                   the connection remains usable */
+                request.canceled = true;
+                request.handler.error(std::current_exception(),
+                                      request.handler_ctx);
+                done = framer.IsEnd();
+            }
+        }
+
+        socket.Consumed(nbytes);
+        data += nbytes;
+        length -= nbytes;
+        consumed += nbytes;
+
+        if (done)
+            FinishResponse();
+    }
+
+    if (requests.empty()) {
+        if (!socket.IsConnected()) {
+            /* the server has closed the connection after sending
+               the last response */
+            auto &s = stock;
+            Destroy();
+            s.Dispatch();
+            return BufferedResult::CLOSED;
+        }
+
+        if (length > 0) {
+            Abort(std::make_exception_ptr(SocketProtocolError("Unexpected data from translation server")),
+                  false);
+            return BufferedResult::CLOSED;
+        }
+
+        /* a pipeline slot has become free */
+        stock.Dispatch();
+    } else if (requests.size() < stock.config.max_pipeline &&
+               !stock.waiting.empty())
+        stock.Dispatch();
+
+    return consumed > 0 ? BufferedResult::OK : BufferedResult::MORE;
+}
+
+bool
+TranslationStock::Connection::OnBufferedClosed() noexcept
+{
+    socket.Close();
+
+    if (requests.empty()) {
+        Destroy();
+        return false;
+    }
+
+    /* there may be more responses in the input buffer */
+    return true;
+}
+
+bool
+TranslationStock::Connection::OnBufferedEnd() noexcept
+{
+    /* requests are still waiting for a response: let
+       OnBufferedError() retry them */
+    return false;
+}
+
+bool
+TranslationStock::Connection::OnBufferedWrite()
+{
+    /* only the output queue needs the "write" event */
+    socket.UnscheduleWrite();
+    return true;
+}
+
+void
+TranslationStock::Connection::OnBufferedError(std::exception_ptr e) noexcept
+{
+    Abort(e, true);
+}
+
+void
+TranslationStock::Connection::OnSocketConnectSuccess(UniqueSocketDescriptor &&fd)
+{
+    socket.Init(fd.Release(), FD_SOCKET,
+                nullptr, &stock.config.timeout,
+                *this);
+    ready = true;
+    socket.ScheduleReadNoTimeout(false);
+
+    stock.Dispatch();
+}
+
+void
+TranslationStock::Connection::OnSocketConnectError(std::exception_ptr ep)
+{
+    auto &s = stock;
+    Destroy();
+    s.OnConnectionFailed(ep);
+}
+
+TranslationStock::TranslationStock(EventLoop &_event_loop,
+                                   SocketAddress _address,
+                                   const Config &_config) noexcept
+    :event_loop(_event_loop), address(_address), config(_config)
+{
+}
+
+TranslationStock::~TranslationStock() noexcept
+{
+    const auto ep = std::make_exception_ptr(std::runtime_error("Translation stock destroyed"));
+
+    while (!connections.empty())
+        connections.front().Abort(ep, false);
+
+    while (!waiting.empty()) {
+        auto &request = waiting.front();
+        waiting.pop_front();
+        request.Abort(ep);
+    }
+}
+
+TranslationStock::Connection *
+TranslationStock::FindConnection() noexcept
+{
+    Connection *best = nullptr;
+
+    for (auto &c : connections)
+        if (c.IsAvailable() &&
+            (best == nullptr ||
+             c.GetRequestCount() < best->GetRequestCount()))
+            best = &c;
+
+    return best;
+}
+
+size_t
+TranslationStock::CountConnecting() const noexcept
+{
+    size_t n = 0;
+    for (const auto &c : connections)
+        if (c.IsConnecting())
+            ++n;
+    return n;
+}
+
+bool
+TranslationStock::Connect() noexcept
+{
+    UniqueSocketDescriptor fd;
+
+    try {
+        if (!fd.CreateNonBlock(address.GetFamily(), SOCK_STREAM, 0))
+            throw MakeErrno("Failed to create socket");
+
+        if (!fd.Connect(address) && errno != EINPROGRESS)
+            throw MakeErrno("Failed to connect to translation server");
+    } catch (...) {
+        OnConnectionFailed(std::current_exception());
+        return false;
+    }
+
+    connections.push_back(*new Connection(*this, std::move(fd)));
+    return true;
+}
+
+void
+TranslationStock::Dispatch() noexcept
+{
+    while (!waiting.empty()) {
+        auto *c = FindConnection();
+        if (c == nullptr)
+            break;
+
+        auto &request = waiting.front();
+        waiting.pop_front();
+
+        try {
+            c->Send(request);
+        } catch (...) {
+            request.Abort(std::current_exception());
+        }
+    }
+
+    /* open more connections if the pending ones are not enough to
+       carry all waiting requests */
+    while (!waiting.empty() &&
+           connections.size() < config.max_connections &&
+           CountConnecting() * config.max_pipeline < waiting.size())
+        if (!Connect())
+            break;
+}
+
+void
+TranslationStock::OnConnectionFailed(std::exception_ptr ep) noexcept
+{
+    if (!connections.empty())
+        /* let the other connections handle the waiting requests */
+        return;
+
+    RequestList failed;
+    failed.swap(waiting);
+
+    while (!failed.empty()) {
+        auto &request = failed.front();
+        failed.pop_front();
+        request.Abort(ep);
+    }
+}
+
+void
+TranslationStock::SendRequest(TranslateParser &parser,
+                              ConstBuffer<void> request,
+                              const TranslateHandler &handler, void *ctx,
+                              CancellablePointer &cancel_ptr) noexcept
+{
+    auto *r = new Request(*this, parser, request, handler, ctx, cancel_ptr);
+    waiting.push_back(*r);
+    Dispatch();
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Protocol.hxx"
+#include "event/net/BufferedSocket.hxx"
+#include "event/net/ConnectSocket.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "util/Cancellable.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/Compiler.h"
+
+#include <boost/intrusive/list.hpp>
+
+#include <exception>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+struct TranslateHandler;
+class TranslateParser;
+
+struct TranslationStockConfig {
+    /**
+     * The maximum number of connections to the translation
+     * server.
+     */
+    unsigned max_connections = 4;
+
+    /**
+     * The maximum number of requests in flight on one
+     * connection.
+     */
+    unsigned max_pipeline = 16;
+
+    /**
+     * Timeout for connecting and for receiving a response.
+     */
+    struct timeval timeout{10, 0};
+};
+
+/**
+ * A pool of persistent connections to one translation server.
+ * Requests are pipelined: a connection may carry several requests
+ * whose responses have not yet been received; each response is fed
+ * into the #TranslateParser of the corresponding request, and the
+ * result is passed to its #TranslateHandler.
+ *
+ * If a connection fails before any response data has been received
+ * for a request, the request is retried once on another connection
+ * (e.g. because the server has closed an idle connection).
+ */
+class TranslationStock {
+public:
+    typedef TranslationStockConfig Config;
+
+private:
+    typedef boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> SiblingsHook;
+
+    class Connection;
+
+    class Request final : public SiblingsHook, public Cancellable {
+        TranslationStock &stock;
+
+    public:
+        TranslateParser &parser;
+
+        /**
+         * The serialized request.  It is owned by the caller and
+         * needs to remain valid until the handler is invoked or
+         * the request is canceled.
+         */
+        const ConstBuffer<void> data;
+
+        const TranslateHandler &handler;
+        void *const handler_ctx;
+
+        /**
+         * The connection this request was sent on; nullptr while
+         * it is waiting for a connection.
+         */
+        Connection *connection = nullptr;
+
+        /**
+         * Has some response data been received already?
+         */
+        bool receiving = false;
+
+        /**
+         * Has this request been retried already?
+         */
+        bool retried = false;
+
+        /**
+         * Was this request canceled while it was in flight?  Its
+         * response will be discarded.
+         */
+        bool canceled = false;
+
+        Request(TranslationStock &_stock, TranslateParser &_parser,
+                ConstBuffer<void> _data,
+                const TranslateHandler &_handler, void *_ctx,
+                CancellablePointer &cancel_ptr) noexcept
+            :stock(_stock), parser(_parser), data(_data),
+             handler(_handler), handler_ctx(_ctx) {
+            cancel_ptr = *this;
+        }
+
+        Request(const Request &) = delete;
+        Request &operator=(const Request &) = delete;
+
+        void Abort(std::exception_ptr ep) noexcept;
+
+        /* virtual methods from class Cancellable */
+        void Cancel() noexcept override;
+    };
+
+    typedef boost::intrusive::list<Request,
+                                   boost::intrusive::base_hook<SiblingsHook>,
+                                   boost::intrusive::constant_time_size<true>> RequestList;
+
+    /**
+     * Skips over translation packets, looking for the END packet.
+     * This follows the packet boundaries of a response while it is
+     * being parsed, so a canceled request's response can be
+     * discarded at any point.
+     */
+    class ResponseFramer {
+        TranslationExtendedHeader header;
+        size_t header_fill = 0;
+        size_t payload_remaining = 0;
+        bool end = false;
+
+    public:
+        bool IsEnd() const noexcept {
+            return end;
+        }
+
+        void Reset() noexcept {
+            header_fill = 0;
+            payload_remaining = 0;
+            end = false;
+        }
+
+        /**
+         * @return the number of bytes consumed; stops after the
+         * END packet
+         */
+        size_t Feed(const uint8_t *data, size_t length) noexcept;
+    };
+
+    class Connection final
+        : public SiblingsHook, BufferedSocketHandler, ConnectSocketHandler {
+
+        TranslationStock &stock;
+
+        ConnectSocket connect;
+
+        BufferedSocket socket;
+
+        /**
+         * Requests which have been sent on this connection, in
+         * the order their responses are expected.
+         */
+        RequestList requests;
+
+        ResponseFramer framer;
+
+        /**
+         * Has the connection been established, i.e. has #socket
+         * been initialized?
+         */
+        bool ready = false;
+
+    public:
+        Connection(TranslationStock &_stock,
+                   UniqueSocketDescriptor &&fd) noexcept;
+        ~Connection() noexcept;
+
+        Connection(const Connection &) = delete;
+        Connection &operator=(const Connection &) = delete;
+
+        bool IsConnecting() const noexcept {
+            return !ready;
+        }
+
+        /**
+         * Can this connection accept another request?
+         */
+        bool IsAvailable() const noexcept {
+            return ready && socket.IsConnected() &&
+                requests.size() < stock.config.max_pipeline;
+        }
+
+        size_t GetRequestCount() const noexcept {
+            return requests.size();
+        }
+
+        /**
+         * Throws std::bad_alloc on error.
+         */
+        void Send(Request &request);
+
+        /**
+         * Destroy this connection and fail all requests in flight.
+         *
+         * @param retry retry requests which have not received any
+         * response data yet (once) instead of failing them
+         */
+        void Abort(std::exception_ptr ep, bool retry) noexcept;
+
+    private:
+        void Destroy() noexcept;
+
+        /**
+         * The response of the first request has been received
+         * completely.
+         */
+        void FinishResponse() noexcept;
+
+        /* virtual methods from class BufferedSocketHandler */
+        BufferedResult OnBufferedData() override;
+        bool OnBufferedClosed() noexcept override;
+        bool OnBufferedEnd() noexcept override;
+        bool OnBufferedWrite() override;
+        void OnBufferedError(std::exception_ptr e) noexcept override;
+
+        /* virtual methods from class ConnectSocketHandler */
+        void OnSocketConnectSuccess(UniqueSocketDescriptor &&fd) override;
+        void OnSocketConnectError(std::exception_ptr ep) override;
+    };
+
+    typedef boost::intrusive::list<Connection,
+                                   boost::intrusive::base_hook<SiblingsHook>,
+                                   boost::intrusive::constant_time_size<true>> ConnectionList;
+
+    EventLoop &event_loop;
+
+    const AllocatedSocketAddress address;
+
+    const Config config;
+
+    /**
+     * Requests waiting for a connection.
+     */
+    RequestList waiting;
+
+    ConnectionList connections;
+
+public:
+    TranslationStock(EventLoop &_event_loop, SocketAddress _address,
+                     const Config &_config=Config()) noexcept;
+
+    /**
+     * All pending requests fail.
+     */
+    ~TranslationStock() noexcept;
+
+    TranslationStock(const TranslationStock &) = delete;
+    TranslationStock &operator=(const TranslationStock &) = delete;
+
+    size_t GetConnectionCount() const noexcept {
+        return connections.size();
+    }
+
+    size_t GetWaitingCount() const noexcept {
+        return waiting.size();
+    }
+
+    /**
+     * Send a translation request.  Exactly one of the handler
+     * methods will be invoked, unless the operation is canceled.
+     * The handler must not destroy this object.
+     *
+     * @param parser receives the response; it must remain valid
+     * until the handler is invoked or the request is canceled
+     * @param request the serialized request (BEGIN..END, e.g. built
+     * with #TranslationMarshaller); it is not copied and must
+     * remain valid as well
+     */
+    void SendRequest(TranslateParser &parser, ConstBuffer<void> request,
+                     const TranslateHandler &handler, void *ctx,
+                     CancellablePointer &cancel_ptr) noexcept;
+
+private:
+    gcc_pure
+    Connection *FindConnection() noexcept;
+
+    gcc_pure
+    size_t CountConnecting() const noexcept;
+
+    /**
+     * Open a new connection.
+     *
+     * @return false if that has failed (and OnConnectionFailed() has
+     * been called)
+     */
+    bool Connect() noexcept;
+
+    /**
+     * Assign waiting requests to connections, and open new
+     * connections if necessary.
+     */
+    void Dispatch() noexcept;
+
+    /**
+     * A connection attempt has failed.  If no connection is left,
+     * all waiting requests fail.
+     */
+    void OnConnectionFailed(std::exception_ptr ep) noexcept;
+};
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "StringTable.hxx"
+#include "util/FNVHash.hxx"
+
+#include <algorithm>
+
+#include <string.h>
+
+gcc_pure
+static size_t
+HashBuffer(StringView s) noexcept
+{
+    using Traits = FNVTraits<uint32_t>;
+    using Algorithm = FNV1aAlgorithm<Traits>;
+
+    Traits::fast_type hash = Traits::OFFSET_BASIS;
+    for (char ch : s)
+        hash = Algorithm::Update(hash, ch);
+
+    return hash;
+}
+
+TranslationStringTable::TranslationStringTable(AllocatorPtr _alloc) noexcept
+    :alloc(_alloc)
+{
+    std::fill_n(buckets, N_BUCKETS, nullptr);
+}
+
+const char *
+TranslationStringTable::Intern(StringView s) noexcept
+{
+    const size_t hash = HashBuffer(s);
+    Item *&bucket = buckets[hash % N_BUCKETS];
+
+    for (const Item *i = bucket; i != nullptr; i = i->next) {
+        if (i->hash == hash && i->value.size == s.size &&
+            memcmp(i->value.data, s.data, s.size) == 0) {
+            ++hits;
+            return i->value.data;
+        }
+    }
+
+    char *value = alloc.NewArray<char>(s.size + 1);
+    memcpy(value, s.data, s.size);
+    value[s.size] = 0;
+
+    auto *item = alloc.New<Item>();
+    item->next = bucket;
+    item->hash = hash;
+    item->value = {value, s.size};
+    bucket = item;
+
+    ++size;
+    return value;
+}
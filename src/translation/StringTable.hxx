@@ -0,0 +1,91 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "AllocatorPtr.hxx"
+#include "util/StringView.hxx"
+
+#include <stddef.h>
+
+/**
+ * An interning table for translation payload strings: identical
+ * strings are stored only once, and the returned pointers can be
+ * compared instead of the string contents.
+ *
+ * The strings are allocated from the given allocator, which must
+ * outlive all responses referring to them (e.g. the one of the
+ * translation cache).  Strings may contain null bytes; each is
+ * null-terminated.
+ */
+class TranslationStringTable {
+    struct Item {
+        Item *next;
+        size_t hash;
+        StringView value;
+    };
+
+    static constexpr size_t N_BUCKETS = 1024;
+
+    AllocatorPtr alloc;
+
+    Item *buckets[N_BUCKETS];
+
+    size_t size = 0;
+
+    /**
+     * The number of Intern() calls which found an existing string.
+     */
+    size_t hits = 0;
+
+public:
+    explicit TranslationStringTable(AllocatorPtr _alloc) noexcept;
+
+    TranslationStringTable(const TranslationStringTable &) = delete;
+    TranslationStringTable &operator=(const TranslationStringTable &) = delete;
+
+    size_t GetSize() const noexcept {
+        return size;
+    }
+
+    size_t GetHits() const noexcept {
+        return hits;
+    }
+
+    /**
+     * Look up the given string, and add a copy of it if it is not
+     * yet in the table.
+     *
+     * @return a pointer to the shared copy
+     */
+    const char *Intern(StringView s) noexcept;
+};
@@ -76,8 +76,34 @@ public:
 	R operator()(Args... args) const {
 		return function(instance_, std::forward<Args>(args)...);
 	}
+
+	/**
+	 * Returns the address of the generated wrapper function.  This
+	 * is only useful for diagnostics: a symbolizer (e.g.
+	 * addr2line) resolves it to a name which contains the bound
+	 * method.
+	 */
+	const void *GetFunctionAddress() const noexcept {
+		return reinterpret_cast<const void *>(function);
+	}
+};
+
+#if defined(__cpp_noexcept_function_type) && __cpp_noexcept_function_type >= 201510L
+
+/* since C++17, "noexcept" is part of the function type; these
+   specializations let such signatures share the implementation of
+   the plain ones */
+
+template<typename R, typename... Args>
+class BoundMethod<R(Args...) noexcept> : public BoundMethod<R(Args...)> {
+public:
+	BoundMethod() = default;
+
+	using BoundMethod<R(Args...)>::BoundMethod;
 };
 
+#endif
+
 namespace BindMethodDetail {
 
 /**
@@ -96,6 +122,13 @@ struct MethodWithSignature<T, R(Args...)> {
 	typedef R (T::*method_pointer)(Args...);
 };
 
+#if defined(__cpp_noexcept_function_type) && __cpp_noexcept_function_type >= 201510L
+template<typename T, typename R, typename... Args>
+struct MethodWithSignature<T, R(Args...) noexcept> {
+	typedef R (T::*method_pointer)(Args...) noexcept;
+};
+#endif
+
 /**
  * Helper class which introspects a method pointer type.
  *
@@ -118,6 +151,14 @@ struct MethodSignatureHelper<R (T::*)(Args...)> {
 	typedef R plain_signature(Args...);
 };
 
+#if defined(__cpp_noexcept_function_type) && __cpp_noexcept_function_type >= 201510L
+template<typename R, typename T, typename... Args>
+struct MethodSignatureHelper<R (T::*)(Args...) noexcept> {
+	typedef T class_type;
+	typedef R plain_signature(Args...) noexcept;
+};
+#endif
+
 /**
  * Helper class which converts a plain function signature type to a
  * wrapper function pointer type.
@@ -130,6 +171,12 @@ struct MethodWrapperWithSignature<R(Args...)> {
 	typedef R (*function_pointer)(void *instance, Args...);
 };
 
+#if defined(__cpp_noexcept_function_type) && __cpp_noexcept_function_type >= 201510L
+template<typename R, typename... Args>
+struct MethodWrapperWithSignature<R(Args...) noexcept>
+	: MethodWrapperWithSignature<R(Args...)> {};
+#endif
+
 /**
  * Generate a wrapper function.  Helper class for
  * #BindMethodWrapperGenerator.
@@ -164,6 +211,13 @@ struct BindMethodWrapperGenerator<T, M, method, R(Args...)>
 	: BindMethodWrapperGenerator2<T, M, method, R, Args...> {
 };
 
+#if defined(__cpp_noexcept_function_type) && __cpp_noexcept_function_type >= 201510L
+template<typename T, typename M, M method, typename R, typename... Args>
+struct BindMethodWrapperGenerator<T, M, method, R(Args...) noexcept>
+	: BindMethodWrapperGenerator2<T, M, method, R, Args...> {
+};
+#endif
+
 template<typename T, typename S,
 	 typename MethodWithSignature<T, S>::method_pointer method>
 typename MethodWrapperWithSignature<S>::function_pointer
@@ -195,6 +249,14 @@ struct FunctionTraits<R(Args...)> {
 	typedef R (*pointer_type)(Args...);
 };
 
+#if defined(__cpp_noexcept_function_type) && __cpp_noexcept_function_type >= 201510L
+template<typename R, typename... Args>
+struct FunctionTraits<R(Args...) noexcept> {
+	typedef R function_type(Args...) noexcept;
+	typedef R (*pointer_type)(Args...) noexcept;
+};
+#endif
+
 /**
  * Generate a wrapper function for a plain function which ignores the
  * instance pointer.  Helper class for
@@ -227,6 +289,13 @@ struct BindFunctionWrapperGenerator<R(Args...), P, function>
 	: BindFunctionWrapperGenerator2<P, function, R, Args...> {
 };
 
+#if defined(__cpp_noexcept_function_type) && __cpp_noexcept_function_type >= 201510L
+template<typename P, P function, typename R, typename... Args>
+struct BindFunctionWrapperGenerator<R(Args...) noexcept, P, function>
+	: BindFunctionWrapperGenerator2<P, function, R, Args...> {
+};
+#endif
+
 template<typename T, typename T::pointer_type function>
 typename MethodWrapperWithSignature<typename T::function_type>::function_pointer
 MakeBindFunctionWrapper() noexcept
@@ -30,6 +30,8 @@
 #ifndef CACHE_HXX
 #define CACHE_HXX
 
+#include "CachePolicy.hxx"
+#include "FlatHashMap.hxx"
 #include "Manual.hxx"
 #include "Cast.hxx"
 #include "Compiler.h"
@@ -38,6 +40,7 @@
 #include <boost/intrusive/unordered_set.hpp>
 
 #include <array>
+#include <type_traits>
 
 #include <assert.h>
 
@@ -49,13 +52,21 @@
  * @param max_size the maximum number of items in the cache
  * @param table_size the size of the internal hash table; rule of
  * thumb: should be prime
+ * @param Policy the eviction/admission policy, see CachePolicy.hxx
  */
 template<typename Key, typename Data,
 	 std::size_t max_size,
 	 std::size_t table_size,
 	 typename Hash=std::hash<Key>,
-	 typename Equal=std::equal_to<Key>>
+	 typename Equal=std::equal_to<Key>,
+	 typename Policy=CacheLruPolicy>
 class Cache {
+	/**
+	 * The maximum number of items in the protected segment (of
+	 * segmented LRU); 0 means plain LRU.
+	 */
+	static constexpr std::size_t max_protected =
+		max_size * Policy::protected_percent / 100;
 
 	struct Pair {
 		Key key;
@@ -89,6 +100,11 @@ class Cache {
 		Manual<Pair> pair;
 
 	public:
+		/**
+		 * Is this item in #protected_list?
+		 */
+		bool is_protected = false;
+
 		static constexpr Item &Cast(Data &data) {
 			return ContainerCast(Manual<Pair>::Cast(Pair::Cast(data)),
 					     &Item::pair);
@@ -157,39 +173,201 @@ class Cache {
 	 */
 	ItemList unallocated_list;
 
+	/**
+	 * All items in LRU order (most recently used first); with
+	 * segmented LRU, only the items of the probation segment.
+	 */
 	ItemList chronological_list;
 
-	typedef boost::intrusive::unordered_set<Item,
-						boost::intrusive::hash<ItemHash>,
-						boost::intrusive::equal<ItemEqual>,
-						boost::intrusive::constant_time_size<false>> KeyMap;
+	/**
+	 * The protected segment of segmented LRU in LRU order.
+	 */
+	ItemList protected_list;
+
+	std::size_t protected_size = 0;
+
+	typename Policy::template Admission<max_size> admission;
+
+	/**
+	 * The key index based on an intrusive hash table with
+	 * #table_size buckets.
+	 */
+	class IntrusiveIndex {
+		typedef boost::intrusive::unordered_set<Item,
+							boost::intrusive::hash<ItemHash>,
+							boost::intrusive::equal<ItemEqual>,
+							boost::intrusive::constant_time_size<false>> KeyMap;
+
+		std::array<typename KeyMap::bucket_type, table_size> buckets;
+
+		KeyMap map;
+
+	public:
+		IntrusiveIndex() noexcept
+			:map(typename KeyMap::bucket_traits(&buckets.front(), buckets.size())) {}
+
+		template<typename K>
+		gcc_pure
+		Item *Find(K &&key) noexcept {
+			auto i = map.find(std::forward<K>(key),
+					  map.hash_function(), map.key_eq());
+			return i != map.end() ? &*i : nullptr;
+		}
+
+		void Insert(Item &item) noexcept {
+			auto i = map.insert(item);
+			(void)i;
+			assert(i.second && "Key must not exist already");
+		}
+
+		void Erase(Item &item) noexcept {
+			map.erase(map.iterator_to(item));
+		}
+
+		void Clear() noexcept {
+			map.clear();
+		}
+	};
+
+	/**
+	 * The key index based on a #FlatHashMap; its table is
+	 * allocated once by the constructor (#table_size is
+	 * ignored), as long as moving a #Key cannot throw (see
+	 * FlatHashMap::Reserve()).
+	 */
+	class FlatIndex {
+		FlatHashMap<Key, Item *, Hash, Equal> map;
+
+	public:
+		FlatIndex() {
+			map.Reserve(max_size);
+		}
+
+		template<typename K>
+		gcc_pure
+		Item *Find(K &&key) noexcept {
+			auto *i = map.Find(key);
+			return i != nullptr ? *i : nullptr;
+		}
+
+		void Insert(Item &item) {
+			auto i = map.Insert(item.GetKey(), &item);
+			(void)i;
+			assert(i.second && "Key must not exist already");
+		}
+
+		void Erase(Item &item) noexcept {
+			map.Erase(item.GetKey());
+		}
 
-	std::array<typename KeyMap::bucket_type, table_size> buckets;
+		void Clear() noexcept {
+			map.Clear();
+		}
+	};
 
-	KeyMap map;
+	typename std::conditional<Policy::flat_index,
+				  FlatIndex, IntrusiveIndex>::type map;
 
 	std::array<Item, max_size> buffer;
 
+	/**
+	 * Hash a (possibly heterogeneous) lookup key for the
+	 * admission filter.
+	 */
+	template<typename K>
+	static std::size_t HashKey(const K &key) noexcept {
+		return Hash()(key);
+	}
+
+	using Admission = typename Policy::template Admission<max_size>;
+
+	/**
+	 * Record an access for the admission filter; this is a no-op
+	 * (without hashing the key) if the #Policy does not have one.
+	 */
+	template<typename K>
+	void RecordAccess(const K &key) noexcept {
+		if (Admission::enabled)
+			admission.Record(HashKey(key));
+	}
+
+	/**
+	 * Determine the item to be evicted next: the least recently
+	 * used item of the probation segment, or of the protected
+	 * segment if the former is empty.
+	 */
 	gcc_pure
 	Item &GetOldest() noexcept {
-		assert(!chronological_list.empty());
+		if (!chronological_list.empty())
+			return chronological_list.back();
+
+		assert(!protected_list.empty());
+		return protected_list.back();
+	}
 
-		return chronological_list.back();
+	/**
+	 * Remove the item from its LRU list.
+	 */
+	void Unlink(Item &item) noexcept {
+		if (item.is_protected) {
+			protected_list.erase(protected_list.iterator_to(item));
+			--protected_size;
+			item.is_protected = false;
+		} else
+			chronological_list.erase(chronological_list.iterator_to(item));
+	}
+
+	/**
+	 * An item was hit: move it to the front of its list, or promote
+	 * it to the protected segment.
+	 */
+	void Touch(Item &item) noexcept {
+		if (max_protected == 0) {
+			chronological_list.erase(chronological_list.iterator_to(item));
+			chronological_list.push_front(item);
+			return;
+		}
+
+		Unlink(item);
+
+		protected_list.push_front(item);
+		item.is_protected = true;
+		++protected_size;
+
+		if (protected_size > max_protected) {
+			/* demote the least recently used protected
+			   item back to probation */
+			Item &demoted = protected_list.back();
+			Unlink(demoted);
+			chronological_list.push_front(demoted);
+		}
 	}
 
 	/**
 	 * Remove the oldest item from the cache (both from the #map and
-	 * from #chronological_list), but do not destruct it.
+	 * from its LRU list), but do not destruct it.
 	 */
 	Item &RemoveOldest() noexcept {
 		Item &item = GetOldest();
 
-		map.erase(map.iterator_to(item));
-		chronological_list.erase(chronological_list.iterator_to(item));
+		map.Erase(item);
+		Unlink(item);
 
 		return item;
 	}
 
+	/**
+	 * Remove the item from all containers, destruct it and
+	 * return it to #unallocated_list.
+	 */
+	void Dispose(Item &item) noexcept {
+		map.Erase(item);
+		Unlink(item);
+
+		item.Destruct();
+		unallocated_list.push_front(item);
+	}
+
 	/**
 	 * Allocate an item from #unallocated_list, but do not construct it.
 	 */
@@ -201,12 +379,36 @@ class Cache {
 		return item;
 	}
 
+	/**
+	 * Add a new item (returned by Make()) to the #map and to the
+	 * LRU list.  If the former throws, the item is disposed.
+	 */
+	void Link(Item &item) {
+		try {
+			map.Insert(item);
+		} catch (...) {
+			item.Destruct();
+			unallocated_list.push_front(item);
+			throw;
+		}
+
+		chronological_list.push_front(item);
+	}
+
 	template<typename K, typename U>
 	Item &Make(K &&key, U &&data) {
 		if (unallocated_list.empty()) {
 			/* cache is full: delete oldest */
 			Item &item = RemoveOldest();
-			item.Replace(std::forward<K>(key), std::forward<U>(data));
+			try {
+				item.Replace(std::forward<K>(key),
+					     std::forward<U>(data));
+			} catch (...) {
+				item.Destruct();
+				unallocated_list.push_front(item);
+				throw;
+			}
+
 			return item;
 		} else {
 			/* cache is not full: allocate new item */
@@ -217,8 +419,7 @@ class Cache {
 	}
 
 public:
-	Cache() noexcept
-		:map(typename KeyMap::bucket_traits(&buckets.front(), buckets.size())) {
+	Cache() noexcept(!Policy::flat_index) {
 		for (auto &i : buffer)
 			unallocated_list.push_back(i);
 	}
@@ -231,7 +432,7 @@ public:
 	Cache &operator=(const Cache &) = delete;
 
 	bool IsEmpty() const noexcept {
-		return chronological_list.empty();
+		return chronological_list.empty() && protected_list.empty();
 	}
 
 	bool IsFull() const noexcept {
@@ -239,12 +440,19 @@ public:
 	}
 
 	void Clear() noexcept {
-		map.clear();
+		map.Clear();
 
-		chronological_list.clear_and_dispose([this](Item *item){
-				item->Destruct();
-				unallocated_list.push_front(*item);
-			});
+		const auto dispose = [this](Item *item){
+			item->Destruct();
+			item->is_protected = false;
+			unallocated_list.push_front(*item);
+		};
+
+		chronological_list.clear_and_dispose(dispose);
+		protected_list.clear_and_dispose(dispose);
+		protected_size = 0;
+
+		admission.Clear();
 	}
 
 	/**
@@ -253,18 +461,14 @@ public:
 	 */
 	template<typename K>
 	Data *Get(K &&key) noexcept {
-		auto i = map.find(std::forward<K>(key),
-				  map.hash_function(), map.key_eq());
-		if (i == map.end())
-			return nullptr;
-
-		Item &item = *i;
+		RecordAccess(key);
 
-		/* move to the front of the chronological list */
-		chronological_list.erase(chronological_list.iterator_to(item));
-		chronological_list.push_front(item);
+		Item *item = map.Find(std::forward<K>(key));
+		if (item == nullptr)
+			return nullptr;
 
-		return &item.GetData();
+		Touch(*item);
+		return &item->GetData();
 	}
 
 	/**
@@ -277,31 +481,50 @@ public:
 	template<typename K, typename U>
 	Data &Put(K &&key, U &&data) {
 		Item &item = Make(std::forward<K>(key), std::forward<U>(data));
-		chronological_list.push_front(item);
-		auto i = map.insert(item);
-		(void)i;
-		assert(i.second && "Key must not exist already");
+		Link(item);
 		return item.GetData();
 	}
 
+	/**
+	 * Like PutOrReplace(), but if the key does not exist yet and
+	 * the cache is full, consult the admission filter of the
+	 * #Policy whether the new item is worth evicting the victim.
+	 * This should be used for items which were just missed by
+	 * Get().
+	 *
+	 * @return the item's data or nullptr if it was not admitted
+	 */
+	template<typename K, typename U>
+	Data *TryPut(K &&key, U &&data) {
+		Item *i = map.Find(key);
+		if (i != nullptr) {
+			i->ReplaceData(std::forward<U>(data));
+			return &i->GetData();
+		}
+
+		if (IsFull() &&
+		    !admission.Admit(HashKey(key), HashKey(GetOldest().GetKey())))
+			return nullptr;
+
+		Item &item = Make(std::forward<K>(key), std::forward<U>(data));
+		Link(item);
+		return &item.GetData();
+	}
+
 	/**
 	 * Insert a new item into the cache.  If the key exists
 	 * already, then the item is replaced.
 	 */
 	template<typename K, typename U>
 	Data &PutOrReplace(K &&key, U &&data) {
-		typename KeyMap::insert_commit_data icd;
-		auto i = map.insert_check(key,
-					  map.hash_function(), map.key_eq(),
-					  icd);
-		if (i.second) {
+		Item *i = map.Find(key);
+		if (i == nullptr) {
 			Item &item = Make(std::forward<K>(key), std::forward<U>(data));
-			chronological_list.push_front(item);
-			map.insert_commit(item, icd);
+			Link(item);
 			return item.GetData();
 		} else {
-			i.first->ReplaceData(std::forward<U>(data));
-			return i.first->GetData();
+			i->ReplaceData(std::forward<U>(data));
+			return i->GetData();
 		}
 	}
 
@@ -310,13 +533,7 @@ public:
 	 * value.
 	 */
 	void RemoveItem(Data &data) noexcept {
-		auto &item = Item::Cast(data);
-
-		map.erase(map.iterator_to(item));
-		chronological_list.erase(chronological_list.iterator_to(item));
-
-		item.Destruct();
-		unallocated_list.push_front(item);
+		Dispose(Item::Cast(data));
 	}
 
 	/**
@@ -324,17 +541,10 @@ public:
 	 */
 	template<typename K>
 	void Remove(K &&key) noexcept {
-		auto i = map.find(std::forward<K>(key),
-				  map.hash_function(), map.key_eq());
-		assert(i != map.end());
-
-		Item &item = *i;
-
-		map.erase(i);
-		chronological_list.erase(chronological_list.iterator_to(item));
+		Item *i = map.Find(std::forward<K>(key));
+		assert(i != nullptr);
 
-		item.Destruct();
-		unallocated_list.push_front(item);
+		Dispose(*i);
 	}
 
 	/**
@@ -343,11 +553,22 @@ public:
 	 */
 	template<typename P>
 	void RemoveIf(P &&p) noexcept {
-		chronological_list.remove_and_dispose_if([&p](const Item &item){
-				return p(item.GetKey(), item.GetData());
-			},
+		const auto pred = [&p](const Item &item){
+			return p(item.GetKey(), item.GetData());
+		};
+
+		chronological_list.remove_and_dispose_if(pred,
+			[this](Item *item){
+				map.Erase(*item);
+				item->Destruct();
+				unallocated_list.push_front(*item);
+			});
+
+		protected_list.remove_and_dispose_if(pred,
 			[this](Item *item){
-				map.erase(map.iterator_to(*item));
+				map.Erase(*item);
+				--protected_size;
+				item->is_protected = false;
 				item->Destruct();
 				unallocated_list.push_front(*item);
 			});
@@ -360,9 +581,29 @@ public:
 	 */
 	template<typename F>
 	void ForEach(F &&f) const {
+		for (const auto &i : protected_list)
+			f(i.GetKey(), i.GetData());
+
 		for (const auto &i : chronological_list)
 			f(i.GetKey(), i.GetData());
 	}
+
+	/**
+	 * Like ForEach(), but begin with the item which would be
+	 * evicted first.  Inserting the items in this order into an
+	 * empty cache restores the LRU order (e.g. from a
+	 * #CacheSnapshotWriter).
+	 */
+	template<typename F>
+	void ForEachOldestFirst(F &&f) const {
+		for (auto i = chronological_list.rbegin();
+		     i != chronological_list.rend(); ++i)
+			f(i->GetKey(), i->GetData());
+
+		for (auto i = protected_list.rbegin();
+		     i != protected_list.rend(); ++i)
+			f(i->GetKey(), i->GetData());
+	}
 };
 
 #endif
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "CountMinSketch.hxx"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Eviction/admission policies for #Cache.
+ *
+ * "protected_percent" is the share of the cache reserved for items
+ * which have been hit at least once after insertion (segmented LRU);
+ * 0 means plain LRU.  The "Admission" template decides whether a new
+ * item may displace the eviction victim in Cache::TryPut().
+ * "flat_index" selects a #FlatHashMap instead of an intrusive hash
+ * table as the key index (see #CacheFlatIndexPolicy).
+ */
+
+/**
+ * An admission filter which admits everything.
+ */
+template<size_t max_size>
+struct CacheNullAdmission {
+	/**
+	 * Does this filter need Record() calls?  If not, the #Cache
+	 * does not hash keys for it.
+	 */
+	static constexpr bool enabled = false;
+
+	void Record(size_t) noexcept {}
+
+	constexpr bool Admit(size_t, size_t) const noexcept {
+		return true;
+	}
+
+	void Clear() noexcept {}
+};
+
+constexpr size_t
+CacheSketchWidth(size_t max_size) noexcept
+{
+	size_t width = 16;
+	while (width < max_size)
+		width <<= 1;
+	return width;
+}
+
+/**
+ * TinyLFU: estimate the access frequency of all keys (including
+ * those not in the cache) with a #CountMinSketch, and admit a new
+ * item only if it is more popular than the victim.  This keeps
+ * one-hit wonders (e.g. from scans) from flushing popular items.
+ */
+template<size_t max_size>
+class CacheTinyLfuAdmission {
+	CountMinSketch<CacheSketchWidth(max_size)> sketch{max_size * 10};
+
+public:
+	static constexpr bool enabled = true;
+
+	void Record(size_t hash) noexcept {
+		sketch.Increment(hash);
+	}
+
+	bool Admit(size_t candidate, size_t victim) const noexcept {
+		return sketch.Estimate(candidate) > sketch.Estimate(victim);
+	}
+
+	void Clear() noexcept {
+		sketch.Clear();
+	}
+};
+
+/**
+ * Plain LRU (the default).
+ */
+struct CacheLruPolicy {
+	static constexpr unsigned protected_percent = 0;
+
+	template<size_t max_size>
+	using Admission = CacheNullAdmission<max_size>;
+
+	static constexpr bool flat_index = false;
+};
+
+/**
+ * Segmented LRU: new items enter a "probation" segment and are
+ * promoted to the "protected" segment on their first hit; eviction
+ * happens from the probation segment first.
+ */
+template<unsigned _protected_percent=80>
+struct CacheSegmentedLruPolicy {
+	static_assert(_protected_percent < 100, "Bad protected_percent");
+
+	static constexpr unsigned protected_percent = _protected_percent;
+
+	template<size_t max_size>
+	using Admission = CacheNullAdmission<max_size>;
+
+	static constexpr bool flat_index = false;
+};
+
+/**
+ * Segmented LRU with a TinyLFU admission filter.
+ */
+template<unsigned _protected_percent=80>
+struct CacheTinyLfuPolicy {
+	static_assert(_protected_percent < 100, "Bad protected_percent");
+
+	static constexpr unsigned protected_percent = _protected_percent;
+
+	template<size_t max_size>
+	using Admission = CacheTinyLfuAdmission<max_size>;
+
+	static constexpr bool flat_index = false;
+};
+
+/**
+ * Wraps another policy, but uses a #FlatHashMap as the key index:
+ * lookups probe one flat array instead of chasing bucket list
+ * pointers.  The table is allocated once by the #Cache constructor.
+ */
+template<typename Base=CacheLruPolicy>
+struct CacheFlatIndexPolicy : Base {
+	static constexpr bool flat_index = true;
+};
@@ -0,0 +1,228 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CacheSnapshot.hxx"
+#include "FNVHash.hxx"
+
+#include <stdexcept>
+
+#include <string.h>
+
+static constexpr uint32_t CACHE_SNAPSHOT_MAGIC = 0x534e4343; /* "CCNS" */
+static constexpr uint32_t CACHE_SNAPSHOT_VERSION = 1;
+
+struct CacheSnapshotHeader {
+	uint32_t magic, version;
+
+	/**
+	 * Wall clock time of the dump [nanoseconds since the epoch].
+	 */
+	int64_t time;
+
+	uint32_t n_items, reserved;
+};
+
+static_assert(sizeof(CacheSnapshotHeader) == 24, "Wrong header size");
+
+using SnapshotHashTraits = FNVTraits<uint64_t>;
+using SnapshotHashAlgorithm = FNV1aAlgorithm<SnapshotHashTraits>;
+
+gcc_pure
+static uint64_t
+SnapshotChecksum(const uint8_t *p, const uint8_t *end) noexcept
+{
+	SnapshotHashTraits::fast_type hash = SnapshotHashTraits::OFFSET_BASIS;
+	while (p != end)
+		hash = SnapshotHashAlgorithm::Update(hash, *p++);
+	return hash;
+}
+
+static void
+AppendVarint(std::string &dest, uint64_t value) noexcept
+{
+	while (value >= 0x80) {
+		dest.push_back(char(value | 0x80));
+		value >>= 7;
+	}
+
+	dest.push_back(char(value));
+}
+
+static uint64_t
+ReadVarint(const uint8_t *&p, const uint8_t *end)
+{
+	uint64_t value = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		if (p == end)
+			throw std::runtime_error("Truncated cache snapshot");
+
+		const uint8_t b = *p++;
+		value |= uint64_t(b & 0x7f) << shift;
+		if ((b & 0x80) == 0)
+			return value;
+	}
+
+	throw std::runtime_error("Malformed cache snapshot");
+}
+
+static void
+AppendBuffer(std::string &dest, ConstBuffer<void> src) noexcept
+{
+	AppendVarint(dest, src.size);
+	dest.append((const char *)src.data, src.size);
+}
+
+static ConstBuffer<void>
+ReadBuffer(const uint8_t *&p, const uint8_t *end)
+{
+	const auto size = ReadVarint(p, end);
+	if (size > size_t(end - p))
+		throw std::runtime_error("Truncated cache snapshot");
+
+	ConstBuffer<void> result(p, size);
+	p += size;
+	return result;
+}
+
+static int64_t
+WallClockNow() noexcept
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+CacheSnapshotWriter::CacheSnapshotWriter(Expiry _now)
+	:now(_now)
+{
+	buffer.resize(sizeof(CacheSnapshotHeader));
+}
+
+void
+CacheSnapshotWriter::Add(ConstBuffer<void> key, ConstBuffer<void> value,
+			 Expiry expires, size_t cost) noexcept
+{
+	/* remaining lifetime in milliseconds plus one; zero means
+	   "never expires" */
+	uint64_t ttl = 0;
+	if (!(expires == Expiry::Never())) {
+		const auto remaining = expires.GetRemainingDuration(now);
+		if (remaining <= remaining.zero())
+			return;
+
+		ttl = std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count() + 1;
+	}
+
+	AppendBuffer(buffer, key);
+	AppendBuffer(buffer, value);
+	AppendVarint(buffer, ttl);
+	AppendVarint(buffer, cost);
+	++n_items;
+}
+
+std::string
+CacheSnapshotWriter::Finish() noexcept
+{
+	CacheSnapshotHeader header{};
+	header.magic = CACHE_SNAPSHOT_MAGIC;
+	header.version = CACHE_SNAPSHOT_VERSION;
+	header.time = WallClockNow();
+	header.n_items = n_items;
+	memcpy(&buffer.front(), &header, sizeof(header));
+
+	const uint8_t *begin = (const uint8_t *)buffer.data();
+	const uint64_t checksum = SnapshotChecksum(begin, begin + buffer.size());
+	buffer.append((const char *)&checksum, sizeof(checksum));
+
+	return std::move(buffer);
+}
+
+CacheSnapshotReader::CacheSnapshotReader(ConstBuffer<void> src, Expiry _now)
+	:p((const uint8_t *)src.data),
+	 end((const uint8_t *)src.data + src.size),
+	 now(_now)
+{
+	if (src.size < sizeof(CacheSnapshotHeader) + sizeof(uint64_t))
+		throw std::runtime_error("Truncated cache snapshot");
+
+	CacheSnapshotHeader header;
+	memcpy(&header, p, sizeof(header));
+	if (header.magic != CACHE_SNAPSHOT_MAGIC)
+		throw std::runtime_error("Not a cache snapshot");
+
+	if (header.version != CACHE_SNAPSHOT_VERSION)
+		throw std::runtime_error("Unsupported cache snapshot version");
+
+	uint64_t checksum;
+	memcpy(&checksum, end - sizeof(checksum), sizeof(checksum));
+	if (checksum != SnapshotChecksum(p, end - sizeof(checksum)))
+		throw std::runtime_error("Cache snapshot checksum mismatch");
+
+	p += sizeof(header);
+	end -= sizeof(checksum);
+	remaining = header.n_items;
+
+	/* if the clock went backwards, assume no time has elapsed */
+	const int64_t delta = WallClockNow() - header.time;
+	elapsed = delta > 0
+		? std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(delta))
+		: std::chrono::steady_clock::duration::zero();
+}
+
+bool
+CacheSnapshotReader::Next(Item &item)
+{
+	while (remaining > 0) {
+		--remaining;
+
+		item.key = ReadBuffer(p, end);
+		item.value = ReadBuffer(p, end);
+		const uint64_t ttl = ReadVarint(p, end);
+		item.cost = ReadVarint(p, end);
+
+		if (ttl == 0) {
+			item.expires = Expiry::Never();
+			return true;
+		}
+
+		const auto lifetime = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(ttl - 1));
+		if (lifetime <= elapsed)
+			/* has expired in the meantime */
+			continue;
+
+		item.expires = Expiry::Touched(now, lifetime - elapsed);
+		return true;
+	}
+
+	if (p != end)
+		throw std::runtime_error("Garbage after cache snapshot");
+
+	return false;
+}
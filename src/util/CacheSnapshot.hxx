@@ -0,0 +1,137 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Expiry.hxx"
+#include "ConstBuffer.hxx"
+
+#include <string>
+#include <chrono>
+
+#include <stdint.h>
+
+/*
+ * A compact binary dump of cache contents which survives a process
+ * restart, so a new process can start with a warm cache.
+ *
+ * Entries are written in least-recently-used order (see
+ * Cache::ForEachOldestFirst()); loading them in the same order
+ * restores the LRU order.  Expiry is stored as remaining lifetime
+ * and the dump carries the wall clock time it was taken, so the
+ * reader can subtract the time which elapsed between dump and load
+ * (the monotonic clock does not survive a reboot).
+ *
+ * Keys and values are opaque byte strings; serializing them is up
+ * to the caller.  So is storing the result (e.g. in a file or in a
+ * memfd passed to the new process).
+ */
+
+/**
+ * Builds a cache snapshot in memory.
+ */
+class CacheSnapshotWriter {
+	const Expiry now;
+
+	std::string buffer;
+
+	uint32_t n_items = 0;
+
+public:
+	explicit CacheSnapshotWriter(Expiry _now=Expiry::Now());
+
+	uint32_t GetCount() const noexcept {
+		return n_items;
+	}
+
+	/**
+	 * Append an item.  Items which have already expired are
+	 * ignored.
+	 *
+	 * @param cost an opaque value for the #ExpiringCache
+	 */
+	void Add(ConstBuffer<void> key, ConstBuffer<void> value,
+		 Expiry expires=Expiry::Never(), size_t cost=0) noexcept;
+
+	/**
+	 * Finish the snapshot and return it.  The object is unusable
+	 * afterwards.
+	 */
+	std::string Finish() noexcept;
+};
+
+/**
+ * Parses a snapshot built by #CacheSnapshotWriter.  The header and
+ * the checksum are verified by the constructor, so a truncated or
+ * corrupt dump is rejected before any item is loaded.
+ */
+class CacheSnapshotReader {
+	const uint8_t *p, *end;
+
+	uint32_t remaining;
+
+	/**
+	 * How much time has elapsed (wall clock) since the dump was
+	 * taken?
+	 */
+	std::chrono::steady_clock::duration elapsed;
+
+	const Expiry now;
+
+public:
+	struct Item {
+		ConstBuffer<void> key, value;
+
+		/**
+		 * The expiry translated to this process's clock.
+		 */
+		Expiry expires;
+
+		size_t cost;
+	};
+
+	/**
+	 * Throws std::runtime_error on error.
+	 */
+	explicit CacheSnapshotReader(ConstBuffer<void> src,
+				     Expiry _now=Expiry::Now());
+
+	/**
+	 * Read the next item which has not yet expired.  The buffers
+	 * point into the source buffer.
+	 *
+	 * Throws std::runtime_error on error.
+	 *
+	 * @return false if there are no more items
+	 */
+	bool Next(Item &item);
+};
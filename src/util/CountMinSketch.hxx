@@ -0,0 +1,125 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <array>
+#include <algorithm>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A count-min sketch: estimates how often a hash value has been
+ * seen, in constant space.  The counters saturate at 15 (like
+ * TinyLFU's 4 bit counters), and all counters are halved after
+ * #sample_size increments, so old popularity fades away.
+ *
+ * @param width the number of counters per row; must be a power of
+ * two
+ */
+template<size_t width>
+class CountMinSketch {
+	static_assert(width > 0 && (width & (width - 1)) == 0,
+		      "Width must be a power of two");
+
+	static constexpr unsigned DEPTH = 4;
+	static constexpr uint8_t MAX_COUNT = 15;
+
+	std::array<std::array<uint8_t, width>, DEPTH> rows;
+
+	const size_t sample_size;
+	size_t n_increments = 0;
+
+	static constexpr size_t Index(uint64_t hash, unsigned row) noexcept {
+		return (hash + row * ((hash >> 32) | 1)) & (width - 1);
+	}
+
+	static constexpr uint64_t Mix(uint64_t hash) noexcept {
+		return (hash ^ (hash >> 29)) * 0xbf58476d1ce4e5b9ULL;
+	}
+
+public:
+	/**
+	 * @param _sample_size the number of increments after which
+	 * all counters are halved; TinyLFU suggests ten times the
+	 * number of cached items
+	 */
+	explicit CountMinSketch(size_t _sample_size=width * 8) noexcept
+		:sample_size(_sample_size) {
+		Clear();
+	}
+
+	void Clear() noexcept {
+		for (auto &row : rows)
+			row.fill(0);
+		n_increments = 0;
+	}
+
+	void Increment(uint64_t hash) noexcept {
+		hash = Mix(hash);
+
+		bool incremented = false;
+		for (unsigned i = 0; i < DEPTH; ++i) {
+			auto &counter = rows[i][Index(hash, i)];
+			if (counter < MAX_COUNT) {
+				++counter;
+				incremented = true;
+			}
+		}
+
+		if (incremented && ++n_increments >= sample_size)
+			Reset();
+	}
+
+	unsigned Estimate(uint64_t hash) const noexcept {
+		hash = Mix(hash);
+
+		unsigned result = MAX_COUNT;
+		for (unsigned i = 0; i < DEPTH; ++i)
+			result = std::min<unsigned>(result,
+						    rows[i][Index(hash, i)]);
+		return result;
+	}
+
+private:
+	/**
+	 * Halve all counters ("aging").
+	 */
+	void Reset() noexcept {
+		for (auto &row : rows)
+			for (auto &counter : row)
+				counter >>= 1;
+
+		n_increments /= 2;
+	}
+};
@@ -54,6 +54,50 @@ format_4digit(char *dest, unsigned number)
 	dest[3] = (char)('0' + number % 10);
 }
 
+/**
+ * Format a 64 bit unsigned integer into a decimal string, writing
+ * backwards from the given end pointer (without a null terminator);
+ * up to 20 characters are written.  Two digits are converted per
+ * division using a lookup table.
+ *
+ * @return a pointer to the first digit
+ */
+static gcc_always_inline char *
+format_uint64_backwards(char *end, uint64_t number)
+{
+	static const char digit_pairs[201] =
+		"00010203040506070809"
+		"10111213141516171819"
+		"20212223242526272829"
+		"30313233343536373839"
+		"40414243444546474849"
+		"50515253545556575859"
+		"60616263646566676869"
+		"70717273747576777879"
+		"80818283848586878889"
+		"90919293949596979899";
+
+	char *p = end;
+
+	while (number >= 100) {
+		const unsigned i = (unsigned)(number % 100) * 2;
+		number /= 100;
+		p -= 2;
+		p[0] = digit_pairs[i];
+		p[1] = digit_pairs[i + 1];
+	}
+
+	if (number >= 10) {
+		const unsigned i = (unsigned)number * 2;
+		p -= 2;
+		p[0] = digit_pairs[i];
+		p[1] = digit_pairs[i + 1];
+	} else
+		*--p = (char)('0' + number);
+
+	return p;
+}
+
 /**
  * Format a 64 bit unsigned integer into a decimal string.
  */
@@ -63,11 +107,7 @@ format_uint64(char dest[32], uint64_t number)
 	char *p = dest + 32 - 1;
 
 	*p = 0;
-	do {
-		--p;
-		*p = '0' + (char)(number % 10);
-		number /= 10;
-	} while (number != 0);
+	p = format_uint64_backwards(p, number);
 
 	if (p > dest)
 		memmove(dest, p, dest + 32 - p);
@@ -0,0 +1,444 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Expiry.hxx"
+#include "Manual.hxx"
+#include "Cast.hxx"
+#include "Compiler.h"
+
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/set.hpp>
+#include <boost/intrusive/unordered_set.hpp>
+
+#include <array>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A variant of #Cache whose items carry an #Expiry and a cost
+ * (e.g. a byte size).  Expired items are removed lazily by Get() and
+ * in bounded batches by Sweep() (e.g. from a #CleanupTimer); besides
+ * the LRU limit on the number of items, the total cost may be
+ * limited.  No dynamic allocation; all items are allocated statically
+ * inside this class.
+ *
+ * @param max_size the maximum number of items in the cache
+ * @param table_size the size of the internal hash table; rule of
+ * thumb: should be prime
+ */
+template<typename Key, typename Data,
+	 std::size_t max_size,
+	 std::size_t table_size,
+	 typename Hash=std::hash<Key>,
+	 typename Equal=std::equal_to<Key>>
+class ExpiringCache {
+
+	struct Pair {
+		Key key;
+		Data data;
+
+		template<typename K, typename U>
+		Pair(K &&_key, U &&_data)
+			:key(std::forward<K>(_key)),
+			 data(std::forward<U>(_data)) {}
+
+		static constexpr Pair &Cast(Data &data) {
+			return ContainerCast(data, &Pair::data);
+		}
+	};
+
+	class Item
+		: public boost::intrusive::unordered_set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+		  public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+		  public boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> {
+
+		Manual<Pair> pair;
+
+	public:
+		Expiry expires;
+
+		size_t cost;
+
+		static constexpr Item &Cast(Data &data) {
+			return ContainerCast(Manual<Pair>::Cast(Pair::Cast(data)),
+					     &Item::pair);
+		}
+
+		const Key &GetKey() const noexcept {
+			return pair->key;
+		}
+
+		const Data &GetData() const noexcept {
+			return pair->data;
+		}
+
+		Data &GetData() noexcept {
+			return pair->data;
+		}
+
+		template<typename K, typename U>
+		void Construct(K &&_key, U &&value,
+			       Expiry _expires, size_t _cost) {
+			pair.Construct(std::forward<K>(_key),
+				       std::forward<U>(value));
+			expires = _expires;
+			cost = _cost;
+		}
+
+		void Destruct() noexcept {
+			pair.Destruct();
+		}
+	};
+
+	struct ItemHash : Hash {
+		using Hash::operator();
+
+		gcc_pure
+		std::size_t operator()(const Item &a) const noexcept {
+			return Hash::operator()(a.GetKey());
+		}
+	};
+
+	struct ItemEqual : Equal {
+		gcc_pure
+		bool operator()(const Item &a, const Item &b) const noexcept {
+			return Equal::operator()(a.GetKey(), b.GetKey());
+		}
+
+		gcc_pure
+		bool operator()(const Key &a, const Item &b) const noexcept {
+			return Equal::operator()(a, b.GetKey());
+		}
+	};
+
+	struct ItemExpiryCompare {
+		gcc_pure
+		bool operator()(const Item &a, const Item &b) const noexcept {
+			return !(a.expires >= b.expires);
+		}
+	};
+
+	typedef boost::intrusive::list<Item,
+				       boost::intrusive::constant_time_size<false>> ItemList;
+
+	/**
+	 * The list of unallocated items.
+	 */
+	ItemList unallocated_list;
+
+	ItemList chronological_list;
+
+	typedef boost::intrusive::unordered_set<Item,
+						boost::intrusive::hash<ItemHash>,
+						boost::intrusive::equal<ItemEqual>,
+						boost::intrusive::constant_time_size<false>> KeyMap;
+
+	std::array<typename KeyMap::bucket_type, table_size> buckets;
+
+	KeyMap map;
+
+	/**
+	 * All items ordered by their expiry, soonest first.
+	 */
+	typedef boost::intrusive::multiset<Item,
+					   boost::intrusive::compare<ItemExpiryCompare>,
+					   boost::intrusive::constant_time_size<false>> ExpiryMap;
+
+	ExpiryMap expiry_map;
+
+	/**
+	 * The maximum sum of all item costs; 0 means unlimited.
+	 */
+	const size_t max_cost;
+
+	/**
+	 * The sum of all item costs.
+	 */
+	size_t total_cost = 0;
+
+	std::array<Item, max_size> buffer;
+
+	/**
+	 * Remove an item from all containers, destruct it and
+	 * return it to #unallocated_list.
+	 */
+	void Dispose(Item &item) noexcept {
+		map.erase(map.iterator_to(item));
+		chronological_list.erase(chronological_list.iterator_to(item));
+		expiry_map.erase(expiry_map.iterator_to(item));
+
+		assert(total_cost >= item.cost);
+		total_cost -= item.cost;
+
+		item.Destruct();
+		unallocated_list.push_front(item);
+	}
+
+	void RemoveOldest() noexcept {
+		assert(!chronological_list.empty());
+
+		Dispose(chronological_list.back());
+	}
+
+	/**
+	 * Remove least recently used items until there is room for
+	 * a new item with the given cost.
+	 */
+	void MakeRoom(size_t cost) noexcept {
+		if (unallocated_list.empty())
+			RemoveOldest();
+
+		if (max_cost > 0)
+			while (total_cost + cost > max_cost)
+				RemoveOldest();
+	}
+
+	template<typename K, typename U>
+	Item &Insert(K &&key, U &&data, Expiry expires, size_t cost) {
+		MakeRoom(cost);
+
+		assert(!unallocated_list.empty());
+		Item &item = unallocated_list.front();
+		unallocated_list.pop_front();
+
+		item.Construct(std::forward<K>(key), std::forward<U>(data),
+			       expires, cost);
+		total_cost += cost;
+
+		chronological_list.push_front(item);
+		expiry_map.insert(item);
+		return item;
+	}
+
+public:
+	/**
+	 * @param _max_cost the maximum sum of all item costs; 0
+	 * means unlimited
+	 */
+	explicit ExpiringCache(size_t _max_cost=0) noexcept
+		:map(typename KeyMap::bucket_traits(&buckets.front(), buckets.size())),
+		 max_cost(_max_cost) {
+		for (auto &i : buffer)
+			unallocated_list.push_back(i);
+	}
+
+	~ExpiringCache() noexcept {
+		Clear();
+	}
+
+	ExpiringCache(const ExpiringCache &) = delete;
+	ExpiringCache &operator=(const ExpiringCache &) = delete;
+
+	bool IsEmpty() const noexcept {
+		return chronological_list.empty();
+	}
+
+	bool IsFull() const noexcept {
+		return unallocated_list.empty();
+	}
+
+	size_t GetTotalCost() const noexcept {
+		return total_cost;
+	}
+
+	void Clear() noexcept {
+		map.clear();
+		expiry_map.clear();
+		total_cost = 0;
+
+		chronological_list.clear_and_dispose([this](Item *item){
+				item->Destruct();
+				unallocated_list.push_front(*item);
+			});
+	}
+
+	/**
+	 * Look up an item by its key.  Returns nullptr if no such
+	 * item exists or if it has expired (in which case it is
+	 * removed).
+	 */
+	template<typename K>
+	Data *Get(K &&key, Expiry now) noexcept {
+		auto i = map.find(std::forward<K>(key),
+				  map.hash_function(), map.key_eq());
+		if (i == map.end())
+			return nullptr;
+
+		Item &item = *i;
+
+		if (item.expires.IsExpired(now)) {
+			Dispose(item);
+			return nullptr;
+		}
+
+		/* move to the front of the chronological list */
+		chronological_list.erase(chronological_list.iterator_to(item));
+		chronological_list.push_front(item);
+
+		return &item.GetData();
+	}
+
+	/**
+	 * Insert a new item into the cache.  If the key exists
+	 * already, then the item is replaced.  Least recently used
+	 * items are deleted to make room for this one.
+	 *
+	 * @param cost the cost of this item (e.g. its size in bytes)
+	 * @return the new item's data, or nullptr if its cost
+	 * exceeds the maximum total cost (the old item is removed
+	 * nonetheless, because it is stale)
+	 */
+	template<typename K, typename U>
+	Data *Put(K &&key, U &&data, Expiry expires, size_t cost=0) {
+		auto i = map.find(key, map.hash_function(), map.key_eq());
+		if (i != map.end())
+			Dispose(*i);
+
+		if (max_cost > 0 && cost > max_cost)
+			return nullptr;
+
+		Item &item = Insert(std::forward<K>(key),
+				    std::forward<U>(data),
+				    expires, cost);
+		map.insert(item);
+		return &item.GetData();
+	}
+
+	/**
+	 * Remove an item from the cache using a reference to the
+	 * value.
+	 */
+	void RemoveItem(Data &data) noexcept {
+		Dispose(Item::Cast(data));
+	}
+
+	/**
+	 * Remove an item from the cache if it exists.
+	 */
+	template<typename K>
+	void Remove(K &&key) noexcept {
+		auto i = map.find(std::forward<K>(key),
+				  map.hash_function(), map.key_eq());
+		if (i != map.end())
+			Dispose(*i);
+	}
+
+	/**
+	 * Remove all items for which the given predicate (invoked
+	 * with key and value) returns true.
+	 *
+	 * @return the number of items which were removed
+	 */
+	template<typename P>
+	size_t RemoveIf(P &&p) noexcept {
+		size_t n = 0;
+
+		for (auto i = chronological_list.begin();
+		     i != chronological_list.end();) {
+			Item &item = *i++;
+			if (p(item.GetKey(), item.GetData())) {
+				Dispose(item);
+				++n;
+			}
+		}
+
+		return n;
+	}
+
+	/**
+	 * Remove least recently used items until their costs sum up
+	 * to at least the given value (or until the cache is empty),
+	 * e.g. when asked by a #MemoryReclaimer.
+	 *
+	 * @return the sum of the costs of all removed items
+	 */
+	size_t Reclaim(size_t cost) noexcept {
+		size_t released = 0;
+
+		while (released < cost && !chronological_list.empty()) {
+			released += chronological_list.back().cost;
+			RemoveOldest();
+		}
+
+		return released;
+	}
+
+	/**
+	 * Remove up to #max_items expired items.  The work is
+	 * bounded, which makes this suitable for a periodic
+	 * #CleanupTimer.
+	 *
+	 * @return the number of items which were removed
+	 */
+	size_t Sweep(Expiry now, size_t max_items=SIZE_MAX) noexcept {
+		size_t n = 0;
+
+		while (n < max_items && !expiry_map.empty()) {
+			Item &item = *expiry_map.begin();
+			if (!item.expires.IsExpired(now))
+				break;
+
+			Dispose(item);
+			++n;
+		}
+
+		return n;
+	}
+
+	/**
+	 * Iterates over all items, passing each key/value pair to a
+	 * given function.  The cache must not be modified from within
+	 * that function.
+	 */
+	template<typename F>
+	void ForEach(F &&f) const {
+		for (const auto &i : chronological_list)
+			f(i.GetKey(), i.GetData());
+	}
+
+	/**
+	 * Like ForEach(), but begin with the least recently used
+	 * item, and pass its #Expiry and cost as well.  Inserting the
+	 * items in this order into an empty cache restores the LRU
+	 * order (e.g. from a #CacheSnapshotWriter).
+	 */
+	template<typename F>
+	void ForEachOldestFirst(F &&f) const {
+		for (auto i = chronological_list.rbegin();
+		     i != chronological_list.rend(); ++i)
+			f(i->GetKey(), i->GetData(), i->expires, i->cost);
+	}
+};
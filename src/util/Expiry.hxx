@@ -67,6 +67,15 @@ public:
 		return now.value + duration;
 	}
 
+	/**
+	 * Overload which accepts a cached time stamp, e.g. from
+	 * EventLoop::SteadyNow().
+	 */
+	static constexpr Expiry Touched(value_type now,
+					duration_type duration) noexcept {
+		return now + duration;
+	}
+
 	static Expiry Touched(duration_type duration) noexcept {
 		return Touched(Now(), duration);
 	}
@@ -75,6 +84,10 @@ public:
 		value = now.value + duration;
 	}
 
+	void Touch(value_type now, duration_type duration) noexcept {
+		value = now + duration;
+	}
+
 	void Touch(duration_type duration) noexcept {
 		Touch(Now(), duration);
 	}
@@ -83,10 +96,27 @@ public:
 		return now >= *this;
 	}
 
+	constexpr bool IsExpired(value_type now) const noexcept {
+		return now >= value;
+	}
+
 	bool IsExpired() const noexcept {
 		return IsExpired(Now());
 	}
 
+	/**
+	 * Returns the duration until this time stamp expires: zero
+	 * if it has already expired, duration_type::max() if it
+	 * never expires.
+	 */
+	constexpr duration_type GetRemainingDuration(Expiry now) const noexcept {
+		return value == value_type::max()
+			? duration_type::max()
+			: (IsExpired(now)
+			   ? duration_type::zero()
+			   : value - now.value);
+	}
+
 	constexpr bool operator==(Expiry other) const noexcept {
 		return value == other.value;
 	}
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "FastHash.hxx"
+#include "ByteOrder.hxx"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static constexpr uint64_t P0 = 0xa0761d6478bd642full;
+static constexpr uint64_t P1 = 0xe7037ed1a0b428dbull;
+static constexpr uint64_t P2 = 0x8ebc6af09c88c6e3ull;
+static constexpr uint64_t P3 = 0x589965cc75374cc3ull;
+
+static constexpr uint32_t SCRAMBLE_PRIME = 0x9e3779b1u;
+
+/**
+ * Inputs of at least this size are folded with the accumulators
+ * first.
+ */
+static constexpr size_t LARGE_THRESHOLD = 512;
+
+static constexpr size_t STRIPE_SIZE = 64;
+
+/**
+ * The accumulators are scrambled after this many stripes.
+ */
+static constexpr size_t STRIPES_PER_BLOCK = 16;
+
+static inline uint64_t
+Read64(const uint8_t *p) noexcept
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return FromLE64(value);
+}
+
+static inline uint64_t
+Read32(const uint8_t *p) noexcept
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return FromLE32(value);
+}
+
+/**
+ * Read 1 to 3 bytes.
+ */
+static inline uint64_t
+Read3(const uint8_t *p, size_t size) noexcept
+{
+	return (uint64_t(p[0]) << 16) | (uint64_t(p[size >> 1]) << 8) |
+		p[size - 1];
+}
+
+/**
+ * Multiply two 64 bit integers to a 128 bit result and return both
+ * halves.
+ */
+static inline void
+Multiply128(uint64_t &a, uint64_t &b) noexcept
+{
+#ifdef __SIZEOF_INT128__
+	const __uint128_t r = __uint128_t(a) * b;
+	a = uint64_t(r);
+	b = uint64_t(r >> 64);
+#else
+	const uint64_t ha = a >> 32, hb = b >> 32;
+	const uint64_t la = uint32_t(a), lb = uint32_t(b);
+	const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	const uint64_t t = rl + (rm0 << 32);
+	uint64_t c = t < rl;
+	const uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	a = lo;
+	b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+/**
+ * Multiply and fold the 128 bit result to 64 bits.
+ */
+static inline uint64_t
+Mix(uint64_t a, uint64_t b) noexcept
+{
+	Multiply128(a, b);
+	return a ^ b;
+}
+
+static constexpr uint64_t
+AccumulatorKey(uint64_t seed, unsigned i) noexcept
+{
+	/* derive a different key for each lane */
+	return (P0 * (i + 1)) ^ (seed + P1 * i);
+}
+
+struct Accumulators {
+	alignas(16) uint64_t acc[8];
+	alignas(16) uint64_t key[8];
+
+	explicit Accumulators(uint64_t seed) noexcept {
+		for (unsigned i = 0; i < 8; ++i) {
+			acc[i] = P2 + i;
+			key[i] = AccumulatorKey(seed, i);
+		}
+	}
+
+	void AccumulateStripe(const uint8_t *p) noexcept;
+	void Scramble() noexcept;
+
+	uint64_t Merge(size_t size) const noexcept {
+		uint64_t result = size * P3;
+		for (unsigned i = 0; i < 8; i += 2)
+			result ^= Mix(acc[i] ^ key[i], acc[i + 1] ^ key[i + 1]);
+		return result;
+	}
+};
+
+#ifdef __SSE2__
+
+inline void
+Accumulators::AccumulateStripe(const uint8_t *p) noexcept
+{
+	auto *a = (__m128i *)(void *)acc;
+	const auto *k = (const __m128i *)(const void *)key;
+
+	for (unsigned i = 0; i < 4; ++i) {
+		const __m128i data =
+			_mm_loadu_si128((const __m128i *)(const void *)(p + i * 16));
+		const __m128i data_key = _mm_xor_si128(data, _mm_load_si128(k + i));
+
+		/* (data_key & 0xffffffff) * (data_key >> 32) */
+		const __m128i product =
+			_mm_mul_epu32(data_key, _mm_srli_epi64(data_key, 32));
+
+		/* add the data to the neighbouring lane */
+		const __m128i swapped =
+			_mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+
+		a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+	}
+}
+
+inline void
+Accumulators::Scramble() noexcept
+{
+	auto *a = (__m128i *)(void *)acc;
+	const auto *k = (const __m128i *)(const void *)key;
+	const __m128i prime = _mm_set1_epi32(SCRAMBLE_PRIME);
+
+	for (unsigned i = 0; i < 4; ++i) {
+		__m128i x = _mm_load_si128(a + i);
+		x = _mm_xor_si128(x, _mm_srli_epi64(x, 47));
+		x = _mm_xor_si128(x, _mm_load_si128(k + i));
+
+		/* 64x32 bit multiplication */
+		const __m128i lo = _mm_mul_epu32(x, prime);
+		const __m128i hi = _mm_mul_epu32(_mm_srli_epi64(x, 32), prime);
+		a[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+	}
+}
+
+#else
+
+inline void
+Accumulators::AccumulateStripe(const uint8_t *p) noexcept
+{
+	for (unsigned i = 0; i < 8; ++i) {
+		const uint64_t data = Read64(p + i * 8);
+		const uint64_t data_key = data ^ key[i];
+		acc[i ^ 1] += data;
+		acc[i] += (data_key & 0xffffffff) * (data_key >> 32);
+	}
+}
+
+inline void
+Accumulators::Scramble() noexcept
+{
+	for (unsigned i = 0; i < 8; ++i) {
+		uint64_t x = acc[i];
+		x ^= x >> 47;
+		x ^= key[i];
+		acc[i] = x * SCRAMBLE_PRIME;
+	}
+}
+
+#endif
+
+/**
+ * Fold all complete blocks of the input.
+ *
+ * @return the new seed for the remaining bytes
+ */
+static uint64_t
+HashLarge(const uint8_t *&p, size_t &size, uint64_t seed) noexcept
+{
+	const size_t total = size;
+	Accumulators a(seed);
+
+	const size_t block_size = STRIPE_SIZE * STRIPES_PER_BLOCK;
+	for (; size >= block_size; size -= block_size) {
+		for (size_t i = 0; i < STRIPES_PER_BLOCK; ++i, p += STRIPE_SIZE)
+			a.AccumulateStripe(p);
+		a.Scramble();
+	}
+
+	for (; size >= STRIPE_SIZE; size -= STRIPE_SIZE, p += STRIPE_SIZE)
+		a.AccumulateStripe(p);
+
+	return seed ^ a.Merge(total);
+}
+
+uint64_t
+FastHash64(const void *_p, size_t size, uint64_t seed) noexcept
+{
+	const auto *p = (const uint8_t *)_p;
+	const size_t total = size;
+
+	seed ^= Mix(seed ^ P0, P1);
+
+	if (size >= LARGE_THRESHOLD)
+		seed = HashLarge(p, size, seed);
+
+	uint64_t a, b;
+	if (size <= 16) {
+		if (size >= 4) {
+			const size_t shift = (size >> 3) << 2;
+			a = (Read32(p) << 32) | Read32(p + shift);
+			b = (Read32(p + size - 4) << 32) | Read32(p + size - 4 - shift);
+		} else if (size > 0) {
+			a = Read3(p, size);
+			b = 0;
+		} else
+			a = b = 0;
+	} else {
+		size_t i = size;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = Mix(Read64(p) ^ P1, Read64(p + 8) ^ seed);
+				see1 = Mix(Read64(p + 16) ^ P2, Read64(p + 24) ^ see1);
+				see2 = Mix(Read64(p + 32) ^ P3, Read64(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+
+			seed ^= see1 ^ see2;
+		}
+
+		while (i > 16) {
+			seed = Mix(Read64(p) ^ P1, Read64(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+
+		a = Read64(p + i - 16);
+		b = Read64(p + i - 8);
+	}
+
+	a ^= P1;
+	b ^= seed;
+	Multiply128(a, b);
+	return Mix(a ^ P0 ^ total, b ^ P1);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/*
+ * A fast non-cryptographic 64 bit hash function for hash tables and
+ * consistent hashing.
+ */
+
+#include "StringView.hxx"
+#include "Compiler.h"
+
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Calculate a 64 bit hash of the given buffer.
+ *
+ * Short inputs are processed in the style of wyhash (64x64->128 bit
+ * multiplications of 8 byte words); inputs of 512 bytes and more are
+ * first folded with eight XXH3-style accumulators, which are
+ * vectorized with SSE2.  The result does not depend on the CPU or
+ * the code path; it is stable across hosts (and can therefore be
+ * used for #HashRing), but it is not compatible with the reference
+ * implementations of wyhash or XXH3.
+ *
+ * This is not a cryptographic hash; don't use it for hash tables
+ * with keys controlled by an attacker unless the seed is secret.
+ */
+gcc_pure gcc_hot
+uint64_t
+FastHash64(const void *p, size_t size, uint64_t seed=0) noexcept;
+
+gcc_pure gcc_hot
+inline uint64_t
+FastHash64(StringView s, uint64_t seed=0) noexcept
+{
+	return FastHash64(s.data, s.size, seed);
+}
+
+/**
+ * A hash functor for strings which can be used with util::Cache,
+ * std::unordered_map and #FlatHashMap.
+ */
+struct FastStringHash {
+	gcc_pure
+	size_t operator()(StringView s) const noexcept {
+		return FastHash64(s);
+	}
+
+	gcc_pure
+	size_t operator()(const char *s) const noexcept {
+		return FastHash64(StringView(s));
+	}
+
+	gcc_pure
+	size_t operator()(const std::string &s) const noexcept {
+		return FastHash64(s.data(), s.size());
+	}
+};
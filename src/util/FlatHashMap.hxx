@@ -0,0 +1,542 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Manual.hxx"
+#include "Compiler.h"
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * A hash map with open addressing in the style of Google's "Swiss
+ * table": one control byte per slot stores 7 bits of the hash, and
+ * lookups compare 16 control bytes at once (with SSE2 if available),
+ * so most lookups touch one control cache line and one slot.  Keys
+ * and values are stored inline in one flat array; there are no
+ * per-node allocations and no pointer chasing.
+ *
+ * Memory is allocated only when the table grows (see Reserve()).
+ * Tombstones left behind by Erase() are purged in place when they
+ * fill up the table (unless moving the key or the value may throw;
+ * then the table is rebuilt in a new allocation).  Pointers to
+ * values are invalidated when that happens.
+ */
+template<typename Key, typename T,
+	 typename Hash=std::hash<Key>,
+	 typename Equal=std::equal_to<Key>>
+class FlatHashMap {
+	static constexpr size_t GROUP_SIZE = 16;
+
+	/* control byte values; "full" slots have the 7 bit hash
+	   fragment (0..127) */
+	static constexpr int8_t EMPTY = -128;
+	static constexpr int8_t DELETED = -2;
+
+	/**
+	 * Can slots be moved around without the risk of an exception
+	 * (see PurgeTombstones())?
+	 */
+	static constexpr bool nothrow_move =
+		std::is_nothrow_move_constructible<Key>::value &&
+		std::is_nothrow_move_constructible<T>::value;
+
+	struct Slot {
+		Key key;
+		T value;
+
+		template<typename K, typename U>
+		Slot(K &&_key, U &&_value)
+			:key(std::forward<K>(_key)),
+			 value(std::forward<U>(_value)) {}
+	};
+
+	/**
+	 * #capacity control bytes plus a copy of the first
+	 * #GROUP_SIZE-1 ones, so a group can always be loaded with
+	 * one unaligned load.
+	 */
+	std::unique_ptr<int8_t[]> ctrl;
+
+	std::unique_ptr<Manual<Slot>[]> slots;
+
+	/**
+	 * The number of slots; zero or a power of two which is at
+	 * least #GROUP_SIZE.
+	 */
+	size_t capacity = 0;
+
+	size_t n_items = 0;
+
+	/**
+	 * The number of EMPTY slots which may still be filled before
+	 * a rehash is necessary (7/8 maximum load factor).
+	 */
+	size_t growth_left = 0;
+
+	/**
+	 * A bit mask of matching positions in a group of control
+	 * bytes.
+	 */
+	class BitMask {
+		uint32_t mask;
+
+	public:
+		explicit constexpr BitMask(uint32_t _mask) noexcept
+			:mask(_mask) {}
+
+		constexpr operator bool() const noexcept {
+			return mask != 0;
+		}
+
+		unsigned Lowest() const noexcept {
+			return __builtin_ctz(mask);
+		}
+
+		unsigned Highest() const noexcept {
+			return 31 - __builtin_clz(mask);
+		}
+
+		void ClearLowest() noexcept {
+			mask &= mask - 1;
+		}
+	};
+
+	class Group {
+#ifdef __SSE2__
+		__m128i ctrl;
+#else
+		int8_t ctrl[GROUP_SIZE];
+#endif
+
+	public:
+		explicit Group(const int8_t *p) noexcept {
+#ifdef __SSE2__
+			ctrl = _mm_loadu_si128((const __m128i *)p);
+#else
+			memcpy(ctrl, p, sizeof(ctrl));
+#endif
+		}
+
+		BitMask Match(int8_t value) const noexcept {
+#ifdef __SSE2__
+			return BitMask(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value))));
+#else
+			uint32_t mask = 0;
+			for (unsigned i = 0; i < GROUP_SIZE; ++i)
+				if (ctrl[i] == value)
+					mask |= 1u << i;
+			return BitMask(mask);
+#endif
+		}
+
+		BitMask MatchEmpty() const noexcept {
+			return Match(EMPTY);
+		}
+
+		/**
+		 * Match EMPTY and DELETED slots.
+		 */
+		BitMask MatchFree() const noexcept {
+#ifdef __SSE2__
+			/* "full" values are non-negative */
+			return BitMask(_mm_movemask_epi8(ctrl));
+#else
+			uint32_t mask = 0;
+			for (unsigned i = 0; i < GROUP_SIZE; ++i)
+				if (ctrl[i] < 0)
+					mask |= 1u << i;
+			return BitMask(mask);
+#endif
+		}
+	};
+
+	static size_t H1(size_t hash) noexcept {
+		return hash >> 7;
+	}
+
+	static int8_t H2(size_t hash) noexcept {
+		return hash & 0x7f;
+	}
+
+	static size_t HashKey(const Key &key) noexcept {
+		/* mix the bits, because std::hash is often the
+		   identity */
+		uint64_t h = Hash()(key);
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	void SetCtrl(size_t i, int8_t value) noexcept {
+		ctrl[i] = value;
+		if (i < GROUP_SIZE - 1)
+			ctrl[capacity + i] = value;
+	}
+
+	Slot &GetSlot(size_t i) noexcept {
+		return slots[i].Get();
+	}
+
+	/**
+	 * @return the slot index or SIZE_MAX
+	 */
+	gcc_pure
+	size_t FindIndex(const Key &key, size_t hash) const noexcept {
+		if (capacity == 0)
+			return SIZE_MAX;
+
+		const size_t mask = capacity - 1;
+		const int8_t h2 = H2(hash);
+		size_t pos = H1(hash) & mask;
+
+		for (size_t step = GROUP_SIZE;; step += GROUP_SIZE) {
+			const Group g(&ctrl[pos]);
+
+			for (auto m = g.Match(h2); m; m.ClearLowest()) {
+				const size_t i = (pos + m.Lowest()) & mask;
+				if (Equal()(slots[i].Get().key, key))
+					return i;
+			}
+
+			if (g.MatchEmpty())
+				return SIZE_MAX;
+
+			pos = (pos + step) & mask;
+		}
+	}
+
+	/**
+	 * Find an EMPTY or DELETED slot for the given hash.
+	 */
+	size_t FindFree(size_t hash) const noexcept {
+		const size_t mask = capacity - 1;
+		size_t pos = H1(hash) & mask;
+
+		for (size_t step = GROUP_SIZE;; step += GROUP_SIZE) {
+			const Group g(&ctrl[pos]);
+			const auto m = g.MatchFree();
+			if (m)
+				return (pos + m.Lowest()) & mask;
+
+			pos = (pos + step) & mask;
+		}
+	}
+
+	static constexpr size_t MaxLoad(size_t _capacity) noexcept {
+		return _capacity - _capacity / 8;
+	}
+
+	/**
+	 * Up to this number of items, a table which is full of
+	 * tombstones is purged instead of growing; the margin to
+	 * MaxLoad() ensures that a purge frees enough slots to pay
+	 * off.
+	 */
+	static constexpr size_t PurgeLoad(size_t _capacity) noexcept {
+		return _capacity / 32 * 25;
+	}
+
+	void Rehash(size_t new_capacity) {
+		assert(new_capacity >= GROUP_SIZE);
+		assert((new_capacity & (new_capacity - 1)) == 0);
+
+		std::unique_ptr<int8_t[]> new_ctrl(new int8_t[new_capacity + GROUP_SIZE - 1]);
+		memset(new_ctrl.get(), EMPTY, new_capacity + GROUP_SIZE - 1);
+
+		std::unique_ptr<Manual<Slot>[]> new_slots(new Manual<Slot>[new_capacity]);
+
+		auto old_ctrl = std::move(ctrl);
+		auto old_slots = std::move(slots);
+		const size_t old_capacity = capacity;
+
+		ctrl = std::move(new_ctrl);
+		slots = std::move(new_slots);
+		capacity = new_capacity;
+		growth_left = MaxLoad(capacity) - n_items;
+
+		for (size_t i = 0; i < old_capacity; ++i) {
+			if (old_ctrl[i] < 0)
+				continue;
+
+			Slot &old = old_slots[i].Get();
+			const size_t hash = HashKey(old.key);
+			const size_t j = FindFree(hash);
+			slots[j].Construct(std::move(old.key),
+					   std::move(old.value));
+			SetCtrl(j, H2(hash));
+			old_slots[i].Destruct();
+		}
+	}
+
+	void MoveSlot(size_t to, size_t from) noexcept {
+		Slot &src = GetSlot(from);
+		slots[to].Construct(std::move(src.key), std::move(src.value));
+		slots[from].Destruct();
+	}
+
+	/**
+	 * Convert all tombstones to EMPTY slots without allocating
+	 * memory, moving items closer to the start of their probe
+	 * sequence (like Abseil's DropDeletesWithoutResize()).
+	 */
+	void PurgeTombstones() noexcept {
+		/* from now on, DELETED marks an item which has not
+		   been placed yet */
+		for (size_t i = 0; i < capacity; ++i)
+			SetCtrl(i, ctrl[i] >= 0 ? DELETED : EMPTY);
+
+		const size_t mask = capacity - 1;
+
+		for (size_t i = 0; i < capacity; ++i) {
+			if (ctrl[i] != DELETED)
+				continue;
+
+			const size_t hash = HashKey(GetSlot(i).key);
+			const size_t j = FindFree(hash);
+
+			/* which group of the probe sequence is this
+			   position in? */
+			const size_t probe = H1(hash) & mask;
+			const auto probe_group = [probe, mask](size_t pos){
+				return ((pos - probe) & mask) / GROUP_SIZE;
+			};
+
+			if (probe_group(i) == probe_group(j)) {
+				/* already in the best group */
+				SetCtrl(i, H2(hash));
+			} else if (ctrl[j] == EMPTY) {
+				MoveSlot(j, i);
+				SetCtrl(j, H2(hash));
+				SetCtrl(i, EMPTY);
+			} else {
+				/* swap with the unplaced item in
+				   slot j, and then process slot i
+				   again */
+				assert(ctrl[j] == DELETED);
+
+				Manual<Slot> tmp;
+				tmp.Construct(std::move(GetSlot(j).key),
+					      std::move(GetSlot(j).value));
+				slots[j].Destruct();
+				MoveSlot(j, i);
+				slots[i].Construct(std::move(tmp->key),
+						   std::move(tmp->value));
+				tmp.Destruct();
+
+				SetCtrl(j, H2(hash));
+				--i;
+			}
+		}
+
+		growth_left = MaxLoad(capacity) - n_items;
+	}
+
+	/**
+	 * Make sure there is room for one more item.
+	 */
+	void PrepareInsert() {
+		if (growth_left > 0)
+			return;
+
+		if (capacity == 0)
+			Rehash(GROUP_SIZE);
+		else if (n_items < PurgeLoad(capacity)) {
+			/* mostly tombstones: no need to grow */
+			if (nothrow_move)
+				PurgeTombstones();
+			else
+				Rehash(capacity);
+		} else
+			Rehash(capacity * 2);
+	}
+
+	void EraseIndex(size_t i) noexcept {
+		slots[i].Destruct();
+		--n_items;
+
+		/* if the run of non-EMPTY slots around this one is
+		   shorter than a group, every probe sequence which
+		   reached this slot has stopped in the same group, so
+		   it can become EMPTY instead of a tombstone */
+		const size_t mask = capacity - 1;
+		const auto empty_after = Group(&ctrl[i]).MatchEmpty();
+		const auto empty_before =
+			Group(&ctrl[(i - GROUP_SIZE) & mask]).MatchEmpty();
+		if (empty_after && empty_before &&
+		    empty_after.Lowest() + GROUP_SIZE - empty_before.Highest() <= GROUP_SIZE) {
+			SetCtrl(i, EMPTY);
+			++growth_left;
+		} else
+			SetCtrl(i, DELETED);
+	}
+
+public:
+	FlatHashMap() = default;
+
+	FlatHashMap(FlatHashMap &&src) noexcept
+		:ctrl(std::move(src.ctrl)), slots(std::move(src.slots)),
+		 capacity(std::exchange(src.capacity, 0)),
+		 n_items(std::exchange(src.n_items, 0)),
+		 growth_left(std::exchange(src.growth_left, 0)) {}
+
+	~FlatHashMap() noexcept {
+		Clear();
+	}
+
+	FlatHashMap &operator=(FlatHashMap &&src) noexcept {
+		using std::swap;
+		swap(ctrl, src.ctrl);
+		swap(slots, src.slots);
+		swap(capacity, src.capacity);
+		swap(n_items, src.n_items);
+		swap(growth_left, src.growth_left);
+		return *this;
+	}
+
+	bool IsEmpty() const noexcept {
+		return n_items == 0;
+	}
+
+	size_t GetSize() const noexcept {
+		return n_items;
+	}
+
+	/**
+	 * Allocate enough room for the given number of items, so
+	 * no allocation is needed until then, not even after many
+	 * Erase() calls (as long as moving keys and values cannot
+	 * throw).
+	 */
+	void Reserve(size_t n) {
+		size_t new_capacity = capacity > 0 ? capacity : GROUP_SIZE;
+		while (PurgeLoad(new_capacity) < n)
+			new_capacity *= 2;
+
+		if (new_capacity != capacity)
+			Rehash(new_capacity);
+	}
+
+	void Clear() noexcept {
+		for (size_t i = 0; i < capacity; ++i) {
+			if (ctrl[i] >= 0)
+				slots[i].Destruct();
+			SetCtrl(i, EMPTY);
+		}
+
+		n_items = 0;
+		growth_left = MaxLoad(capacity);
+	}
+
+	/**
+	 * @return a pointer to the value or nullptr if the key was
+	 * not found
+	 */
+	gcc_pure
+	T *Find(const Key &key) noexcept {
+		const size_t i = FindIndex(key, HashKey(key));
+		return i != SIZE_MAX
+			? &GetSlot(i).value
+			: nullptr;
+	}
+
+	gcc_pure
+	const T *Find(const Key &key) const noexcept {
+		return const_cast<FlatHashMap *>(this)->Find(key);
+	}
+
+	/**
+	 * Insert a new item unless the key exists already.
+	 *
+	 * @return a pointer to the value and true if it was
+	 * inserted, false if the key existed already (and the
+	 * existing value was not modified)
+	 */
+	template<typename K, typename U>
+	std::pair<T *, bool> Insert(K &&key, U &&value) {
+		const size_t hash = HashKey(key);
+		size_t i = FindIndex(key, hash);
+		if (i != SIZE_MAX)
+			return {&GetSlot(i).value, false};
+
+		PrepareInsert();
+
+		i = FindFree(hash);
+
+		/* construct first; if that throws, the slot remains
+		   free */
+		slots[i].Construct(std::forward<K>(key),
+				   std::forward<U>(value));
+
+		if (ctrl[i] == EMPTY)
+			--growth_left;
+		SetCtrl(i, H2(hash));
+		++n_items;
+		return {&GetSlot(i).value, true};
+	}
+
+	/**
+	 * @return true if the item was found and removed
+	 */
+	bool Erase(const Key &key) noexcept {
+		const size_t i = FindIndex(key, HashKey(key));
+		if (i == SIZE_MAX)
+			return false;
+
+		EraseIndex(i);
+		return true;
+	}
+
+	/**
+	 * Invoke the function for each key/value pair.  The map must
+	 * not be modified meanwhile.
+	 */
+	template<typename F>
+	void ForEach(F &&f) {
+		for (size_t i = 0; i < capacity; ++i)
+			if (ctrl[i] >= 0)
+				f(GetSlot(i).key, GetSlot(i).value);
+	}
+};
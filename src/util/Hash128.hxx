@@ -0,0 +1,111 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "FastHash.hxx"
+#include "Compiler.h"
+
+#include <type_traits>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A 128 bit hash value, e.g. for identifying objects by their
+ * contents without building a string key.
+ */
+struct Hash128 {
+	uint64_t a, b;
+
+	constexpr bool operator==(Hash128 other) const noexcept {
+		return a == other.a && b == other.b;
+	}
+
+	constexpr bool operator!=(Hash128 other) const noexcept {
+		return !(*this == other);
+	}
+
+	constexpr bool operator<(Hash128 other) const noexcept {
+		return a < other.a || (a == other.a && b < other.b);
+	}
+};
+
+/**
+ * Calculate a #Hash128 over a sequence of fields.  Each Update()
+ * call hashes one field; its size is part of the hash, so splitting
+ * the same bytes differently yields a different hash.
+ *
+ * The two halves are chained with different seeds through
+ * FastHash64(); this is not a cryptographic hash.
+ */
+class Hash128Builder {
+	uint64_t a = 0x243f6a8885a308d3ull, b = 0x13198a2e03707344ull;
+
+public:
+	void Update(const void *p, size_t size) noexcept {
+		const uint64_t new_a = FastHash64(p, size, a ^ size);
+		b = FastHash64(p, size, b + size) ^ new_a;
+		a = new_a;
+	}
+
+	void Update(StringView s) noexcept {
+		Update(s.data, s.size);
+	}
+
+	/**
+	 * Hash a trivially copyable value (e.g. an integer, a bool
+	 * or an enum).
+	 */
+	template<typename T>
+	void UpdateT(const T &value) noexcept {
+		static_assert(std::is_trivially_copyable<T>::value,
+			      "T must be trivially copyable");
+		Update(&value, sizeof(value));
+	}
+
+	/**
+	 * Hash a string which may be nullptr; nullptr and the empty
+	 * string have different hashes.
+	 */
+	void UpdateString(const char *s) noexcept {
+		if (s == nullptr)
+			UpdateT(uint64_t(~0ull));
+		else
+			Update(StringView(s));
+	}
+
+	gcc_pure
+	Hash128 Finish() const noexcept {
+		return {a, b};
+	}
+};
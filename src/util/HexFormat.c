@@ -32,4 +32,112 @@
 
 #include "HexFormat.h"
 
+#include <stdbool.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <tmmintrin.h>
+#define HAVE_SSSE3_DISPATCH
+#endif
+
 const char hex_digits[0x10] = "0123456789abcdef";
+
+#ifdef HAVE_SSSE3_DISPATCH
+
+/**
+ * Convert 16 input bytes at a time; the nibbles are translated to
+ * digits with PSHUFB, which does not access memory and is therefore
+ * also constant-time.
+ *
+ * @param size the number of bytes; must be a multiple of 16
+ */
+__attribute__((target("ssse3")))
+static char *
+format_hex_ssse3(char *dest, const uint8_t *src, size_t size)
+{
+	const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+					  '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+	const __m128i low_mask = _mm_set1_epi8(0x0f);
+
+	for (; size > 0; src += 16, dest += 32, size -= 16) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(const void *)src);
+		const __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), low_mask);
+		const __m128i lo = _mm_and_si128(x, low_mask);
+		const __m128i hi_digits = _mm_shuffle_epi8(lut, hi);
+		const __m128i lo_digits = _mm_shuffle_epi8(lut, lo);
+
+		_mm_storeu_si128((__m128i *)(void *)dest,
+				 _mm_unpacklo_epi8(hi_digits, lo_digits));
+		_mm_storeu_si128((__m128i *)(void *)(dest + 16),
+				 _mm_unpackhi_epi8(hi_digits, lo_digits));
+	}
+
+	return dest;
+}
+
+gcc_const
+static bool
+have_ssse3(void)
+{
+	return __builtin_cpu_supports("ssse3");
+}
+
+/**
+ * Format as many bytes as possible with SSSE3.
+ */
+static char *
+format_hex_vector(char *dest, const uint8_t **src_p, size_t *size_p)
+{
+	const size_t n = *size_p & ~(size_t)15;
+	if (n == 0 || !have_ssse3())
+		return dest;
+
+	dest = format_hex_ssse3(dest, *src_p, n);
+	*src_p += n;
+	*size_p -= n;
+	return dest;
+}
+
+#endif
+
+char *
+format_hex_buffer(char *dest, const void *_src, size_t size)
+{
+	const uint8_t *src = (const uint8_t *)_src;
+
+#ifdef HAVE_SSSE3_DISPATCH
+	dest = format_hex_vector(dest, &src, &size);
+#endif
+
+	for (size_t i = 0; i < size; ++i, dest += 2)
+		format_uint8_hex_fixed(dest, src[i]);
+
+	return dest;
+}
+
+/**
+ * Convert a nibble to a lower-case hex digit without branches or
+ * table lookups.
+ */
+static gcc_always_inline char
+nibble_to_hex_ct(unsigned n)
+{
+	/* (9 - n) >> 8 is all ones if n > 9 */
+	return (char)(n + '0' + (((9u - n) >> 8) & ('a' - '0' - 10)));
+}
+
+char *
+format_hex_buffer_ct(char *dest, const void *_src, size_t size)
+{
+	const uint8_t *src = (const uint8_t *)_src;
+
+#ifdef HAVE_SSSE3_DISPATCH
+	dest = format_hex_vector(dest, &src, &size);
+#endif
+
+	for (size_t i = 0; i < size; ++i) {
+		*dest++ = nibble_to_hex_ct(src[i] >> 4);
+		*dest++ = nibble_to_hex_ct(src[i] & 0xf);
+	}
+
+	return dest;
+}
@@ -38,8 +38,35 @@
 #include <stdint.h>
 #include <string.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 extern const char hex_digits[0x10];
 
+/**
+ * Format a buffer as a lower-case hex string.  Uses SSSE3 if the
+ * CPU supports it.
+ *
+ * @param dest the destination buffer; it must have room for
+ * 2 * size characters (no null terminator is written)
+ * @return a pointer to the end of the hex string
+ */
+char *
+format_hex_buffer(char *dest, const void *src, size_t size);
+
+/**
+ * Like format_hex_buffer(), but without table lookups indexed by the
+ * data, so the timing does not depend on the contents.  Use this for
+ * secrets such as keys and session ids.
+ */
+char *
+format_hex_buffer_ct(char *dest, const void *src, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
 static gcc_always_inline void
 format_uint8_hex_fixed(char dest[2], uint8_t number) {
 	dest[0] = hex_digits[(number >> 4) & 0xf];
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HexParse.hxx"
+
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __SSE2__
+
+/**
+ * Convert 32 hex digits to 16 bytes.  All lanes are processed
+ * without branches; the result is only checked at the end.
+ *
+ * @return a bit mask of the invalid characters (0 on success)
+ */
+static unsigned
+ParseHexChunk(uint8_t *dest, const char *src) noexcept
+{
+	const __m128i minus_one = _mm_set1_epi8(-1);
+	const __m128i ten = _mm_set1_epi8(10);
+	const __m128i six = _mm_set1_epi8(6);
+
+	unsigned invalid = 0;
+	__m128i values[2];
+
+	for (unsigned i = 0; i < 2; ++i) {
+		const __m128i c =
+			_mm_loadu_si128((const __m128i *)(const void *)(src + i * 16));
+
+		/* '0'..'9' */
+		const __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+		const __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(d, minus_one),
+						       _mm_cmplt_epi8(d, ten));
+
+		/* 'a'..'f' and 'A'..'F' */
+		const __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+					       _mm_set1_epi8('a'));
+		const __m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(l, minus_one),
+							_mm_cmplt_epi8(l, six));
+
+		values[i] = _mm_or_si128(_mm_and_si128(is_digit, d),
+					 _mm_and_si128(is_letter,
+						       _mm_add_epi8(l, ten)));
+
+		const unsigned valid =
+			_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter));
+		invalid |= ~valid & 0xffff;
+	}
+
+	/* each 16 bit lane contains the high nibble in the low byte
+	   and the low nibble in the high byte */
+	__m128i bytes[2];
+	for (unsigned i = 0; i < 2; ++i) {
+		const __m128i hi = _mm_slli_epi16(_mm_and_si128(values[i],
+								_mm_set1_epi16(0x00ff)),
+						  4);
+		const __m128i lo = _mm_srli_epi16(values[i], 8);
+		bytes[i] = _mm_or_si128(hi, lo);
+	}
+
+	_mm_storeu_si128((__m128i *)(void *)dest,
+			 _mm_packus_epi16(bytes[0], bytes[1]));
+
+	return invalid;
+}
+
+#endif
+
+/**
+ * Convert a hex digit without branches.
+ *
+ * @return the value or a negative value if the character is
+ * invalid
+ */
+static inline int
+ParseHexDigitConstantTime(char _ch) noexcept
+{
+	const int ch = (unsigned char)_ch;
+
+	/* each mask is -1 if the character is in the range, 0
+	   otherwise */
+	const int d = ch - '0';
+	const int digit_mask = ((d | (9 - d)) >> 8) ^ -1;
+
+	const int l = (ch | 0x20) - 'a';
+	const int letter_mask = ((l | (5 - l)) >> 8) ^ -1;
+
+	return ((d & digit_mask) | ((l + 10) & letter_mask)) |
+		((digit_mask | letter_mask) ^ -1);
+}
+
+bool
+ParseHexBuffer(void *_dest, const char *src, size_t size) noexcept
+{
+	auto *dest = (uint8_t *)_dest;
+
+#ifdef __SSE2__
+	for (; size >= 16; dest += 16, src += 32, size -= 16)
+		if (ParseHexChunk(dest, src) != 0)
+			return false;
+#endif
+
+	for (size_t i = 0; i < size; ++i) {
+		const int hi = ParseHexDigit(src[i * 2]);
+		const int lo = ParseHexDigit(src[i * 2 + 1]);
+		if (hi < 0 || lo < 0)
+			return false;
+
+		dest[i] = uint8_t((hi << 4) | lo);
+	}
+
+	return true;
+}
+
+bool
+ParseHexBufferConstantTime(void *_dest, const char *src,
+			   size_t size) noexcept
+{
+	auto *dest = (uint8_t *)_dest;
+	unsigned invalid = 0;
+
+#ifdef __SSE2__
+	for (; size >= 16; dest += 16, src += 32, size -= 16)
+		invalid |= ParseHexChunk(dest, src);
+#endif
+
+	for (size_t i = 0; i < size; ++i) {
+		const int hi = ParseHexDigitConstantTime(src[i * 2]);
+		const int lo = ParseHexDigitConstantTime(src[i * 2 + 1]);
+		invalid |= unsigned(hi | lo) >> 31;
+
+		dest[i] = uint8_t((unsigned(hi) << 4) | (unsigned(lo) & 0xf));
+	}
+
+	return invalid == 0;
+}
@@ -34,6 +34,8 @@
 
 #include "CharUtil.hxx"
 
+#include <stddef.h>
+
 #if __cpp_constexpr >= 201304
 constexpr /* requires C++14 */
 #endif
@@ -49,3 +51,23 @@ ParseHexDigit(char ch) noexcept
 	else
 		return -1;
 }
+
+/**
+ * Parse a hex string (upper or lower case) into a buffer.  Uses SSE2
+ * if available.
+ *
+ * @param src the hex string; exactly 2 * size characters are read
+ * @param size the number of bytes to be written to #dest
+ * @return true on success, false if there was an invalid character
+ * (the contents of #dest are undefined then)
+ */
+bool
+ParseHexBuffer(void *dest, const char *src, size_t size) noexcept;
+
+/**
+ * Like ParseHexBuffer(), but always examines the whole input without
+ * branching on its contents, so the timing does not depend on the
+ * (secret) data.
+ */
+bool
+ParseHexBufferConstantTime(void *dest, const char *src, size_t size) noexcept;
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <array>
+
+#include <stdint.h>
+
+/**
+ * A histogram with logarithmic buckets, each of which is subdivided
+ * linearly.  It is cheap enough to record values on a hot path:
+ * Add() is a few bit operations and one increment, and there is no
+ * allocation.
+ *
+ * Values below 2^#SUB_BITS get one bucket each; above that, each
+ * power of two is split into 2^#SUB_BITS buckets, so the relative
+ * error is at most 2^-#SUB_BITS.  Values which are too large end up
+ * in the last bucket.
+ *
+ * @param SUB_BITS the number of linear sub-bucket bits
+ * @param MAX_BITS the number of significant bits of the largest
+ * value which gets a precise bucket
+ */
+template<unsigned SUB_BITS=2, unsigned MAX_BITS=32>
+class LogLinearHistogram {
+	static_assert(SUB_BITS < MAX_BITS, "Bad parameters");
+
+	static constexpr unsigned SUB_COUNT = 1u << SUB_BITS;
+
+public:
+	static constexpr unsigned N_BUCKETS =
+		SUB_COUNT + (MAX_BITS - SUB_BITS) * SUB_COUNT;
+
+private:
+	std::array<uint64_t, N_BUCKETS> buckets;
+
+public:
+	constexpr LogLinearHistogram() noexcept:buckets() {}
+
+	static constexpr unsigned size() noexcept {
+		return N_BUCKETS;
+	}
+
+	static unsigned ValueToBucket(uint64_t value) noexcept {
+		if (value < SUB_COUNT)
+			return value;
+
+		/* the position of the most significant bit */
+		const unsigned msb = 63 - __builtin_clzll(value);
+		if (msb >= MAX_BITS)
+			return N_BUCKETS - 1;
+
+		const unsigned sub = (value >> (msb - SUB_BITS)) & (SUB_COUNT - 1);
+		return SUB_COUNT + (msb - SUB_BITS) * SUB_COUNT + sub;
+	}
+
+	/**
+	 * Returns the smallest value which is counted in the given
+	 * bucket.
+	 */
+	static constexpr uint64_t GetLowerBound(unsigned bucket) noexcept {
+		return bucket < SUB_COUNT
+			? bucket
+			: (uint64_t(SUB_COUNT + bucket % SUB_COUNT)
+			   << (bucket / SUB_COUNT - 1));
+	}
+
+	void Add(uint64_t value) noexcept {
+		++buckets[ValueToBucket(value)];
+	}
+
+	/**
+	 * Add a number of values to a bucket directly, e.g. to merge
+	 * histograms.
+	 */
+	void AddToBucket(unsigned bucket, uint64_t n) noexcept {
+		buckets[bucket] += n;
+	}
+
+	void Clear() noexcept {
+		buckets.fill(0);
+	}
+
+	uint64_t operator[](unsigned bucket) const noexcept {
+		return buckets[bucket];
+	}
+
+	uint64_t GetTotal() const noexcept {
+		uint64_t total = 0;
+		for (auto i : buckets)
+			total += i;
+		return total;
+	}
+
+	/**
+	 * Returns the lower bound of the bucket which contains the
+	 * given quantile (0..1).
+	 */
+	uint64_t GetQuantile(double q) const noexcept {
+		const uint64_t total = GetTotal();
+		if (total == 0)
+			return 0;
+
+		uint64_t threshold = uint64_t(q * total);
+		if (threshold >= total)
+			threshold = total - 1;
+
+		uint64_t sum = 0;
+		for (unsigned i = 0; i < N_BUCKETS; ++i) {
+			sum += buckets[i];
+			if (sum > threshold)
+				return GetLowerBound(i);
+		}
+
+		return GetLowerBound(N_BUCKETS - 1);
+	}
+};
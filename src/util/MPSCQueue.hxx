@@ -0,0 +1,209 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "CacheLine.hxx"
+
+#include <atomic>
+#include <utility>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A lock-free bounded first-in-first-out queue for many producer
+ * threads and one consumer thread.  Its capacity is fixed at compile
+ * time and it does not allocate.
+ *
+ * Each cell has a sequence number which tells whether it is free
+ * for the producer of a certain position or ready for the consumer
+ * (D. Vyukov's bounded queue), so producers only contend on the
+ * #tail counter.
+ *
+ * @param size the capacity; must be a power of two
+ */
+template<class T, size_t size>
+class MPSCQueue {
+	static_assert(size > 0 && (size & (size - 1)) == 0,
+		      "Size must be a power of two");
+
+	static constexpr size_t MASK = size - 1;
+
+	struct Cell {
+		/**
+		 * If this equals the position, the cell is free for
+		 * the producer; if it equals position+1, the value is
+		 * ready for the consumer.
+		 */
+		std::atomic_size_t sequence;
+
+		T value;
+	};
+
+	/**
+	 * The position of the next element to be pushed; shared by
+	 * all producers.
+	 */
+	std::atomic_size_t tail{0};
+
+	char pad1[CACHE_LINE_SIZE];
+
+	/**
+	 * The position of the next element to be popped; accessed
+	 * only by the consumer.
+	 */
+	size_t head = 0;
+
+	char pad2[CACHE_LINE_SIZE];
+
+	Cell cells[size];
+
+public:
+	MPSCQueue() noexcept {
+		for (size_t i = 0; i < size; ++i)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	MPSCQueue(const MPSCQueue &) = delete;
+	MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+	static constexpr size_t GetCapacity() noexcept {
+		return size;
+	}
+
+	/**
+	 * Append one element (any thread).
+	 *
+	 * @return false if the queue is full
+	 */
+	template<typename U>
+	bool Push(U &&value) noexcept {
+		size_t pos = tail.load(std::memory_order_relaxed);
+		Cell *cell;
+
+		while (true) {
+			cell = &cells[pos & MASK];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0) {
+				if (tail.compare_exchange_weak(pos, pos + 1,
+							       std::memory_order_relaxed))
+					break;
+			} else if (diff < 0)
+				/* full */
+				return false;
+			else
+				/* another producer was faster */
+				pos = tail.load(std::memory_order_relaxed);
+		}
+
+		cell->value = std::forward<U>(value);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Move up to #n elements into the queue (any thread).  They
+	 * occupy consecutive positions, i.e. they will not be
+	 * interleaved with elements from other producers.
+	 *
+	 * @return the number of elements which were moved
+	 */
+	size_t PushBatch(T *src, size_t n) noexcept {
+		size_t pos = tail.load(std::memory_order_relaxed);
+		size_t k;
+
+		while (true) {
+			/* count the free cells starting at #pos */
+			k = 0;
+			while (k < n &&
+			       cells[(pos + k) & MASK].sequence.load(std::memory_order_acquire) == pos + k)
+				++k;
+
+			if (k == 0) {
+				if (n == 0)
+					return 0;
+
+				const size_t seq = cells[pos & MASK].sequence.load(std::memory_order_acquire);
+				const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff < 0)
+					/* full */
+					return 0;
+
+				pos = tail.load(std::memory_order_relaxed);
+				continue;
+			}
+
+			if (tail.compare_exchange_weak(pos, pos + k,
+						       std::memory_order_relaxed))
+				break;
+		}
+
+		for (size_t i = 0; i < k; ++i) {
+			Cell &cell = cells[(pos + i) & MASK];
+			cell.value = std::move(src[i]);
+			cell.sequence.store(pos + i + 1, std::memory_order_release);
+		}
+
+		return k;
+	}
+
+	/**
+	 * Remove the oldest element (consumer only).
+	 *
+	 * @return false if the queue is empty (or if the producer of
+	 * the oldest element has not yet finished)
+	 */
+	bool Pop(T &dest) noexcept {
+		Cell &cell = cells[head & MASK];
+		if (cell.sequence.load(std::memory_order_acquire) != head + 1)
+			return false;
+
+		dest = std::move(cell.value);
+		cell.sequence.store(head + size, std::memory_order_release);
+		++head;
+		return true;
+	}
+
+	/**
+	 * Move up to #max elements out of the queue (consumer only).
+	 *
+	 * @return the number of elements which were moved
+	 */
+	size_t PopBatch(T *dest, size_t max) noexcept {
+		size_t n = 0;
+		while (n < max && Pop(dest[n]))
+			++n;
+		return n;
+	}
+};
@@ -0,0 +1,307 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MAGLEV_HASH_RING_HXX
+#define MAGLEV_HASH_RING_HXX
+
+#include "util/Compiler.h"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+#include <stddef.h>
+
+/**
+ * Consistent Hashing implementation based on Google's Maglev lookup
+ * table.  Unlike #HashRing, it supports node weights, and the
+ * permutation of each node is calculated only once when it is added,
+ * so membership and weight changes are cheap.  Each change moves only
+ * a small portion of the buckets to other nodes.
+ *
+ * The interface (Pick(), FindNext()) is the same as #HashRing.
+ *
+ * @param Node the node type
+ * @param hash_t the type of a hash value
+ * @param N_BUCKETS the number of buckets in the lookup table; must be
+ * a prime number which is much larger than the number of nodes
+ * (e.g. 65537 for up to a few hundred nodes)
+ *
+ * @see https://research.google/pubs/pub44824/
+ */
+template<typename Node, typename hash_t, size_t N_BUCKETS>
+class MaglevHashRing {
+	static constexpr bool IsPrime(size_t n) noexcept {
+		if (n < 2)
+			return false;
+
+		for (size_t i = 2; i * i <= n; ++i)
+			if (n % i == 0)
+				return false;
+
+		return true;
+	}
+
+	static_assert(IsPrime(N_BUCKETS), "N_BUCKETS must be a prime number");
+
+	struct Member {
+		Node *node;
+
+		/**
+		 * The permutation of this node: it claims the buckets
+		 * offset, offset+skip, offset+2*skip, ...
+		 */
+		size_t offset, skip;
+
+		unsigned weight;
+
+		/* the following are only used by Populate() */
+
+		size_t position;
+		unsigned credit;
+
+		Member(Node &_node, size_t _offset, size_t _skip,
+		       unsigned _weight) noexcept
+			:node(&_node), offset(_offset), skip(_skip),
+			 weight(_weight) {}
+
+		size_t NextFree(const std::array<Node *, N_BUCKETS> &buckets) noexcept {
+			size_t i;
+			do {
+				i = position;
+				position = (position + skip) % N_BUCKETS;
+			} while (buckets[i] != nullptr);
+
+			return i;
+		}
+	};
+
+	std::vector<Member> members;
+
+	std::array<Node *, N_BUCKETS> buckets;
+
+public:
+	MaglevHashRing() noexcept {
+		buckets.fill(nullptr);
+	}
+
+	/**
+	 * Is there no node with a non-zero weight?  Pick() must not be
+	 * called then.
+	 */
+	gcc_pure
+	bool IsEmpty() const noexcept {
+		return buckets.front() == nullptr;
+	}
+
+	/**
+	 * Build the lookup table using nodes from the given container,
+	 * replacing all existing nodes.
+	 *
+	 * @param nodes an iterable container which contains nodes;
+	 * pointers to those nodes will be stored in this object
+	 * (i.e. they must be valid as long as this object is used)
+	 * @param hasher a functor object which generates a secure hash of
+	 * a node and a replica number (only replicas 0 and 1 are used)
+	 * @param weight a functor object which returns the (relative)
+	 * weight of a node; nodes with weight 0 are not used
+	 */
+	template<typename C, typename H, typename W>
+	void Build(C &&nodes, H &&hasher, W &&weight) {
+		members.clear();
+		for (auto &node : nodes)
+			Insert(node, hasher, weight(node));
+
+		Populate();
+	}
+
+	/**
+	 * Build the lookup table using nodes with equal weights.
+	 */
+	template<typename C, typename H>
+	void Build(C &&nodes, H &&hasher) {
+		Build(std::forward<C>(nodes), std::forward<H>(hasher),
+		      [](const Node &) { return 1u; });
+	}
+
+	/**
+	 * Add a new node.  It must not already be present.
+	 */
+	template<typename H>
+	void Add(Node &node, H &&hasher, unsigned weight=1) {
+		Insert(node, hasher, weight);
+		Populate();
+	}
+
+	/**
+	 * Remove a node.
+	 *
+	 * @return false if the node was not found
+	 */
+	bool Remove(const Node &node) noexcept {
+		auto i = Find(node);
+		if (i == members.end())
+			return false;
+
+		members.erase(i);
+		Populate();
+		return true;
+	}
+
+	/**
+	 * Change the weight of a node.  A weight of 0 disables the
+	 * node without forgetting it.
+	 *
+	 * @return false if the node was not found
+	 */
+	bool SetWeight(const Node &node, unsigned weight) noexcept {
+		auto i = Find(node);
+		if (i == members.end())
+			return false;
+
+		if (i->weight != weight) {
+			i->weight = weight;
+			Populate();
+		}
+
+		return true;
+	}
+
+	/**
+	 * Pick a node using the given hash.
+	 *
+	 * Before calling this, there must be at least one node with a
+	 * non-zero weight.
+	 */
+	gcc_pure
+	Node &Pick(hash_t h) const noexcept {
+		return *buckets[h % N_BUCKETS];
+	}
+
+	/**
+	 * Find the next node after the given one.  This is useful for
+	 * skipping known-bad nodes and turning to a failover node.
+	 *
+	 * @return a new hash (for another FindNext() call) and a node
+	 * reference (may be equal to the previous node if there is only
+	 * one node)
+	 */
+	gcc_pure
+	std::pair<hash_t, Node &> FindNext(hash_t h) const noexcept {
+		auto &node = Pick(h++);
+
+		for (size_t i = buckets.size() - 1;; --i, ++h) {
+			auto &n = Pick(h);
+			if (i == 0 || &n != &node)
+				return {h, n};
+		}
+	}
+
+	/**
+	 * Find the first node (starting with the one returned by
+	 * Pick()) which is accepted by the given predicate.  This
+	 * implements "consistent hashing with bounded loads": the
+	 * predicate rejects nodes whose load exceeds their share,
+	 * e.g. ceil((1 + epsilon) * total_load * weight / total_weight).
+	 *
+	 * @return the node or nullptr if the predicate rejects all nodes
+	 */
+	template<typename P>
+	Node *FindIf(hash_t h, P &&accept) const noexcept {
+		const Node *previous = nullptr;
+
+		for (size_t i = 0; i < buckets.size(); ++i, ++h) {
+			auto &n = Pick(h);
+			if (&n == previous)
+				continue;
+
+			if (accept(n))
+				return &n;
+
+			previous = &n;
+		}
+
+		return nullptr;
+	}
+
+private:
+	typename std::vector<Member>::iterator Find(const Node &node) noexcept {
+		return std::find_if(members.begin(), members.end(),
+				    [&node](const Member &m){
+					    return m.node == &node;
+				    });
+	}
+
+	template<typename H>
+	void Insert(Node &node, H &hasher, unsigned weight) {
+		members.emplace_back(node,
+				     size_t(hasher(node, 0) % N_BUCKETS),
+				     size_t(hasher(node, 1) % (N_BUCKETS - 1)) + 1,
+				     weight);
+	}
+
+	/**
+	 * Fill the lookup table: the nodes take turns claiming the
+	 * next free bucket in their permutation.  A node with less
+	 * than the maximum weight skips turns, proportionally.
+	 */
+	void Populate() noexcept {
+		buckets.fill(nullptr);
+
+		unsigned max_weight = 0;
+		for (auto &m : members) {
+			m.position = m.offset;
+			m.credit = 0;
+			max_weight = std::max(max_weight, m.weight);
+		}
+
+		if (max_weight == 0)
+			return;
+
+		size_t n = 0;
+		while (true) {
+			for (auto &m : members) {
+				m.credit += m.weight;
+				if (m.credit < max_weight)
+					continue;
+
+				m.credit -= max_weight;
+				buckets[m.NextFree(buckets)] = m.node;
+				if (++n == N_BUCKETS)
+					return;
+			}
+		}
+	}
+};
+
+#endif
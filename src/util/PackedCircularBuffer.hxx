@@ -0,0 +1,236 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "ConstBuffer.hxx"
+#include "WritableBuffer.hxx"
+
+#include <algorithm>
+#include <type_traits>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A fixed-size circular buffer for trivially copyable values which
+ * are packed into a plain array.  Like #VCircularBuffer, it
+ * overwrites the oldest items when it is full, and the memory chunk
+ * is managed by the caller.  Unlike #VCircularBuffer, all items
+ * have the same size, but there is no per-item overhead (no list
+ * hook), and items can be added and removed in bulk.
+ */
+template<typename T>
+class PackedCircularBuffer {
+	static_assert(std::is_trivially_copyable<T>::value,
+		      "T must be trivially copyable");
+
+public:
+	typedef T value_type;
+	typedef T &reference;
+	typedef const T &const_reference;
+	typedef T *pointer;
+	typedef const T *const_pointer;
+	typedef size_t size_type;
+
+private:
+	T *const data;
+	const size_type capacity_;
+
+	/**
+	 * The array index of the first (oldest) item.
+	 */
+	size_type head = 0;
+
+	/**
+	 * The number of items.
+	 */
+	size_type n = 0;
+
+public:
+	explicit PackedCircularBuffer(WritableBuffer<void> buffer) noexcept
+		:data((T *)((uint8_t *)buffer.data + AlignDelta(buffer.data))),
+		 capacity_((buffer.size - AlignDelta(buffer.data)) / sizeof(T)) {
+		assert(buffer.size >= AlignDelta(buffer.data) + sizeof(T));
+	}
+
+	PackedCircularBuffer(const PackedCircularBuffer &) = delete;
+	PackedCircularBuffer &operator=(const PackedCircularBuffer &) = delete;
+
+	constexpr bool empty() const noexcept {
+		return n == 0;
+	}
+
+	constexpr bool full() const noexcept {
+		return n == capacity_;
+	}
+
+	constexpr size_type size() const noexcept {
+		return n;
+	}
+
+	constexpr size_type capacity() const noexcept {
+		return capacity_;
+	}
+
+	void clear() noexcept {
+		head = n = 0;
+	}
+
+	reference front() noexcept {
+		assert(!empty());
+		return data[head];
+	}
+
+	const_reference front() const noexcept {
+		assert(!empty());
+		return data[head];
+	}
+
+	reference back() noexcept {
+		assert(!empty());
+		return data[Wrap(head + n - 1)];
+	}
+
+	const_reference back() const noexcept {
+		assert(!empty());
+		return data[Wrap(head + n - 1)];
+	}
+
+	/**
+	 * Access an item by its position; 0 is the oldest one.
+	 */
+	reference operator[](size_type i) noexcept {
+		assert(i < n);
+		return data[Wrap(head + i)];
+	}
+
+	const_reference operator[](size_type i) const noexcept {
+		assert(i < n);
+		return data[Wrap(head + i)];
+	}
+
+	/**
+	 * Return the contiguous range of items beginning with the
+	 * oldest one.  This covers all items unless the buffer
+	 * wraps around; after pop_front_n() with its size, call it
+	 * again to obtain the rest.
+	 */
+	WritableBuffer<T> front_span() noexcept {
+		return {data + head, std::min(n, capacity_ - head)};
+	}
+
+	ConstBuffer<T> front_span() const noexcept {
+		return {data + head, std::min(n, capacity_ - head)};
+	}
+
+	/**
+	 * Append an item; if the buffer is full, the oldest one is
+	 * discarded.
+	 */
+	reference push_back(const_reference value) noexcept {
+		if (full())
+			pop_front();
+
+		reference slot = data[Wrap(head + n)];
+		slot = value;
+		++n;
+		return slot;
+	}
+
+	/**
+	 * Append #count items; if there is not enough room, the
+	 * oldest ones are discarded.  If #count exceeds the
+	 * capacity, only the newest items from #src are kept.
+	 */
+	void push_back_n(const T *src, size_type count) noexcept {
+		if (count >= capacity_) {
+			src += count - capacity_;
+			count = capacity_;
+			clear();
+		} else if (count > capacity_ - n)
+			pop_front_n(count - (capacity_ - n));
+
+		const size_type tail = Wrap(head + n);
+		const size_type first = std::min(count, capacity_ - tail);
+		std::copy_n(src, first, data + tail);
+		std::copy_n(src + first, count - first, data);
+		n += count;
+	}
+
+	void pop_front() noexcept {
+		assert(!empty());
+
+		pop_front_n(1);
+	}
+
+	/**
+	 * Discard the #count oldest items.
+	 */
+	void pop_front_n(size_type count) noexcept {
+		assert(count <= n);
+
+		n -= count;
+		/* rewind an empty buffer to maximize the next
+		   front_span() */
+		head = n > 0 ? Wrap(head + count) : 0;
+	}
+
+	/**
+	 * Move up to #count of the oldest items to #dest.
+	 *
+	 * @return the number of items copied
+	 */
+	size_type pop_front_n(T *dest, size_type count) noexcept {
+		count = std::min(count, n);
+
+		const size_type first = std::min(count, capacity_ - head);
+		std::copy_n(data + head, first, dest);
+		std::copy_n(data, count - first, dest + first);
+		pop_front_n(count);
+		return count;
+	}
+
+private:
+	static size_t AlignDelta(const void *p) noexcept {
+		return (alignof(T) - ((size_t)p % alignof(T))) % alignof(T);
+	}
+
+	/**
+	 * Wrap an index which may exceed the capacity by less than
+	 * the capacity.
+	 */
+	constexpr size_type Wrap(size_type i) const noexcept {
+		return i >= capacity_ ? i - capacity_ : i;
+	}
+};
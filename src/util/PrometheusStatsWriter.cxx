@@ -0,0 +1,196 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PrometheusStatsWriter.hxx"
+
+#include <stdio.h>
+
+void
+AppendStatsLabel(std::string &labels, const char *name, const char *value)
+{
+	if (!labels.empty())
+		labels.push_back(',');
+
+	labels.append(name);
+	labels.append("=\"");
+
+	for (const char *p = value; *p != 0; ++p) {
+		switch (*p) {
+		case '\\':
+			labels.append("\\\\");
+			break;
+
+		case '"':
+			labels.append("\\\"");
+			break;
+
+		case '\n':
+			labels.append("\\n");
+			break;
+
+		default:
+			labels.push_back(*p);
+		}
+	}
+
+	labels.push_back('"');
+}
+
+/**
+ * Format a sample value; integers are printed exactly (up to 2^53).
+ */
+static void
+FormatValue(char *buffer, size_t size, double value) noexcept
+{
+	if (value >= 0 && value < 9007199254740992.) {
+		/* truncation never rounds up, so if the integer is
+		   not smaller, it is exact */
+		const auto i = (unsigned long long)value;
+		if (!(double(i) < value)) {
+			snprintf(buffer, size, "%llu", i);
+			return;
+		}
+	}
+
+	snprintf(buffer, size, "%.15g", value);
+}
+
+void
+PrometheusStatsWriter::WriteType(const char *name, const char *type)
+{
+	if (last_name == name)
+		return;
+
+	last_name = name;
+
+	out.append("# TYPE ");
+	out.append(name);
+	out.push_back(' ');
+	out.append(type);
+	out.push_back('\n');
+}
+
+void
+PrometheusStatsWriter::WriteSample(const char *name, const char *suffix,
+				   const char *labels, const char *extra_label,
+				   const char *value)
+{
+	out.append(name);
+	out.append(suffix);
+
+	const bool have_labels = labels != nullptr && *labels != 0;
+	if (have_labels || extra_label != nullptr) {
+		out.push_back('{');
+		if (have_labels)
+			out.append(labels);
+		if (extra_label != nullptr) {
+			if (have_labels)
+				out.push_back(',');
+			out.append(extra_label);
+		}
+		out.push_back('}');
+	}
+
+	out.push_back(' ');
+	out.append(value);
+	out.push_back('\n');
+}
+
+void
+PrometheusStatsWriter::WriteCounter(const char *name, const char *labels,
+				    double value)
+{
+	WriteType(name, "counter");
+
+	char buffer[32];
+	FormatValue(buffer, sizeof(buffer), value);
+	WriteSample(name, "", labels, nullptr, buffer);
+}
+
+void
+PrometheusStatsWriter::WriteGauge(const char *name, const char *labels,
+				  double value)
+{
+	WriteType(name, "gauge");
+
+	char buffer[32];
+	FormatValue(buffer, sizeof(buffer), value);
+	WriteSample(name, "", labels, nullptr, buffer);
+}
+
+void
+PrometheusStatsWriter::WriteHistogram(const char *name, const char *labels,
+				      const LogLinearHistogram<> &histogram,
+				      double scale)
+{
+	typedef LogLinearHistogram<> H;
+
+	WriteType(name, "histogram");
+
+	char le[48], value[32];
+
+	/* the histogram does not know the exact sum; approximate it
+	   with each bucket's lower bound */
+	uint64_t count = 0;
+	double sum = 0;
+
+	for (unsigned i = 0; i < H::N_BUCKETS; ++i) {
+		const uint64_t n = histogram[i];
+		count += n;
+		sum += double(n) * double(H::GetLowerBound(i));
+
+		if (n == 0 && i + 1 < H::N_BUCKETS)
+			/* skip empty buckets; Prometheus only needs
+			   the cumulative count at each boundary */
+			continue;
+
+		if (i + 1 < H::N_BUCKETS) {
+			/* values are integers, so the inclusive upper
+			   bound is the next bucket's lower bound minus
+			   one */
+			char bound[32];
+			FormatValue(bound, sizeof(bound),
+				    double(H::GetLowerBound(i + 1) - 1) * scale);
+			snprintf(le, sizeof(le), "le=\"%s\"", bound);
+		} else
+			snprintf(le, sizeof(le), "le=\"+Inf\"");
+
+		snprintf(value, sizeof(value), "%llu", (unsigned long long)count);
+		WriteSample(name, "_bucket", labels, le, value);
+	}
+
+	FormatValue(value, sizeof(value), sum * scale);
+	WriteSample(name, "_sum", labels, nullptr, value);
+
+	snprintf(value, sizeof(value), "%llu", (unsigned long long)count);
+	WriteSample(name, "_count", labels, nullptr, value);
+}
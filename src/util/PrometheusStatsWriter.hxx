@@ -0,0 +1,70 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "StatsWriter.hxx"
+
+#include <string>
+
+/**
+ * Renders metrics in the Prometheus text exposition format (version
+ * 0.0.4).
+ */
+class PrometheusStatsWriter final : public StatsWriter {
+	std::string &out;
+
+	/**
+	 * The name of the most recent metric, to emit the "# TYPE"
+	 * line only once per metric family.
+	 */
+	std::string last_name;
+
+public:
+	explicit PrometheusStatsWriter(std::string &_out) noexcept
+		:out(_out) {}
+
+	/* virtual methods from class StatsWriter */
+	void WriteCounter(const char *name, const char *labels,
+			  double value) override;
+	void WriteGauge(const char *name, const char *labels,
+			double value) override;
+	void WriteHistogram(const char *name, const char *labels,
+			    const LogLinearHistogram<> &histogram,
+			    double scale) override;
+
+private:
+	void WriteType(const char *name, const char *type);
+	void WriteSample(const char *name, const char *suffix,
+			 const char *labels, const char *extra_label,
+			 const char *value);
+};
@@ -0,0 +1,185 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "CacheLine.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+#include <stddef.h>
+
+/**
+ * A lock-free bounded first-in-first-out queue for exactly one
+ * producer thread and one consumer thread.  Like #StaticFifoBuffer,
+ * its capacity is fixed at compile time and it does not allocate.
+ *
+ * Each side keeps a cached copy of the other side's index, so the
+ * shared cache lines are only touched when the cached value says
+ * the queue is full/empty.
+ *
+ * @param size the capacity; must be a power of two
+ */
+template<class T, size_t size>
+class SPSCQueue {
+	static_assert(size > 0 && (size & (size - 1)) == 0,
+		      "Size must be a power of two");
+
+	static constexpr size_t MASK = size - 1;
+
+	/**
+	 * The position of the next element to be popped; written only
+	 * by the consumer.
+	 */
+	std::atomic_size_t head{0};
+
+	/**
+	 * The consumer's copy of #tail.
+	 */
+	size_t cached_tail = 0;
+
+	char pad1[CACHE_LINE_SIZE];
+
+	/**
+	 * The position of the next element to be pushed; written only
+	 * by the producer.
+	 */
+	std::atomic_size_t tail{0};
+
+	/**
+	 * The producer's copy of #head.
+	 */
+	size_t cached_head = 0;
+
+	char pad2[CACHE_LINE_SIZE];
+
+	T data[size];
+
+public:
+	SPSCQueue() = default;
+	SPSCQueue(const SPSCQueue &) = delete;
+	SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+	static constexpr size_t GetCapacity() noexcept {
+		return size;
+	}
+
+	/**
+	 * Is the queue empty?  The result is only a snapshot unless
+	 * called by the consumer (for "empty") or the producer (for
+	 * "not empty").
+	 */
+	bool empty() const noexcept {
+		return head.load(std::memory_order_acquire) ==
+			tail.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Append one element (producer only).
+	 *
+	 * @return false if the queue is full
+	 */
+	template<typename U>
+	bool Push(U &&value) noexcept {
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (t - cached_head == size) {
+			cached_head = head.load(std::memory_order_acquire);
+			if (t - cached_head == size)
+				return false;
+		}
+
+		data[t & MASK] = std::forward<U>(value);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Move up to #n elements into the queue with only one
+	 * synchronization (producer only).
+	 *
+	 * @return the number of elements which were moved
+	 */
+	size_t PushBatch(T *src, size_t n) noexcept {
+		const size_t t = tail.load(std::memory_order_relaxed);
+		size_t n_free = size - (t - cached_head);
+		if (n_free < n) {
+			cached_head = head.load(std::memory_order_acquire);
+			n_free = size - (t - cached_head);
+		}
+
+		n = std::min(n, n_free);
+		for (size_t i = 0; i < n; ++i)
+			data[(t + i) & MASK] = std::move(src[i]);
+
+		tail.store(t + n, std::memory_order_release);
+		return n;
+	}
+
+	/**
+	 * Remove the oldest element (consumer only).
+	 *
+	 * @return false if the queue is empty
+	 */
+	bool Pop(T &dest) noexcept {
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h == cached_tail) {
+			cached_tail = tail.load(std::memory_order_acquire);
+			if (h == cached_tail)
+				return false;
+		}
+
+		dest = std::move(data[h & MASK]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Move up to #max elements out of the queue with only one
+	 * synchronization (consumer only).
+	 *
+	 * @return the number of elements which were moved
+	 */
+	size_t PopBatch(T *dest, size_t max) noexcept {
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (cached_tail - h < max)
+			cached_tail = tail.load(std::memory_order_acquire);
+
+		const size_t n = std::min(max, cached_tail - h);
+		for (size_t i = 0; i < n; ++i)
+			dest[i] = std::move(data[(h + i) & MASK]);
+
+		head.store(h + n, std::memory_order_release);
+		return n;
+	}
+};
@@ -0,0 +1,246 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Cache.hxx"
+#include "CacheLine.hxx"
+
+#include <array>
+#include <mutex>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A thread-safe variant of #Cache: the key space is split into
+ * #n_shards independent #Cache instances, each protected by its own
+ * mutex, so threads contend only if they access the same shard.
+ * Like #Cache, it does not allocate dynamically.
+ *
+ * Since returned pointers would not be protected by the lock, data
+ * is only accessed by copying it (Get()) or from within a callback
+ * (Lookup()).
+ *
+ * @param n_shards the number of shards
+ * @param shard_size the maximum number of items per shard
+ * @param shard_table_size the size of each shard's hash table
+ */
+template<typename Key, typename Data,
+	 size_t n_shards,
+	 size_t shard_size,
+	 size_t shard_table_size,
+	 typename Hash=std::hash<Key>,
+	 typename Equal=std::equal_to<Key>>
+class ShardedCache {
+	static_assert(n_shards > 0, "Need at least one shard");
+
+public:
+	struct Stats {
+		size_t hits = 0, misses = 0, insertions = 0;
+	};
+
+private:
+	struct Shard {
+		mutable std::mutex mutex;
+
+		Cache<Key, Data, shard_size, shard_table_size,
+		      Hash, Equal> cache;
+
+		/**
+		 * Protected by #mutex.
+		 */
+		Stats stats;
+
+		/* there are only mutex and counters between two
+		   shards' hot data, don't let them share a cache
+		   line */
+		char pad[CACHE_LINE_SIZE];
+	};
+
+	std::array<Shard, n_shards> shards;
+
+public:
+	ShardedCache() = default;
+	ShardedCache(const ShardedCache &) = delete;
+	ShardedCache &operator=(const ShardedCache &) = delete;
+
+	static constexpr size_t GetShardCount() noexcept {
+		return n_shards;
+	}
+
+	/**
+	 * Determine which shard the given key belongs to.  This uses
+	 * different bits of the hash than the shards' hash tables.
+	 * It may also be used for assigning keys to per-thread
+	 * instances.
+	 */
+	template<typename K>
+	gcc_pure
+	static size_t GetShardIndex(const K &key) noexcept {
+		uint64_t h = Hash()(key);
+		h ^= h >> 33;
+		h *= 0x9e3779b97f4a7c15ULL;
+		return (h >> 32) % n_shards;
+	}
+
+	/**
+	 * Look up an item and invoke the given function with a
+	 * reference to its data while the shard is locked.
+	 *
+	 * @return true if the item was found
+	 */
+	template<typename K, typename F>
+	bool Lookup(const K &key, F &&f) {
+		auto &shard = GetShard(key);
+		const std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto *data = shard.cache.Get(key);
+		if (data == nullptr) {
+			++shard.stats.misses;
+			return false;
+		}
+
+		++shard.stats.hits;
+		f(*data);
+		return true;
+	}
+
+	/**
+	 * Look up an item and copy its data.
+	 *
+	 * @return true if the item was found
+	 */
+	template<typename K>
+	bool Get(const K &key, Data &dest) {
+		return Lookup(key, [&dest](const Data &data){
+				dest = data;
+			});
+	}
+
+	/**
+	 * Insert a new item; if the key exists already, the item is
+	 * replaced.  If the shard is full, its least recently used
+	 * item is deleted.
+	 */
+	template<typename K, typename U>
+	void Put(K &&key, U &&data) {
+		auto &shard = GetShard(key);
+		const std::lock_guard<std::mutex> lock(shard.mutex);
+
+		shard.cache.PutOrReplace(std::forward<K>(key),
+					 std::forward<U>(data));
+		++shard.stats.insertions;
+	}
+
+	/**
+	 * Remove an item if it exists.
+	 *
+	 * @return true if the item was removed
+	 */
+	template<typename K>
+	bool Remove(const K &key) noexcept {
+		auto &shard = GetShard(key);
+		const std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto *data = shard.cache.Get(key);
+		if (data == nullptr)
+			return false;
+
+		shard.cache.RemoveItem(*data);
+		return true;
+	}
+
+	/**
+	 * Remove all items matching the given predicate.  The shards
+	 * are locked one after another.
+	 */
+	template<typename P>
+	void RemoveIf(P &&p) noexcept {
+		for (auto &shard : shards) {
+			const std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.cache.RemoveIf(p);
+		}
+	}
+
+	/**
+	 * Invoke Cache::ForEachOldestFirst() on all shards, one after
+	 * another, while each is locked.  The order across shards is
+	 * not preserved, but since each key always maps to the same
+	 * shard, inserting the items in this order restores the LRU
+	 * order of each shard.
+	 */
+	template<typename F>
+	void ForEachOldestFirst(F &&f) const {
+		for (const auto &shard : shards) {
+			const std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.cache.ForEachOldestFirst(f);
+		}
+	}
+
+	void Clear() noexcept {
+		for (auto &shard : shards) {
+			const std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.cache.Clear();
+		}
+	}
+
+	/**
+	 * Obtain a snapshot of the statistics of one shard.
+	 */
+	Stats GetShardStats(size_t i) const noexcept {
+		const auto &shard = shards[i];
+		const std::lock_guard<std::mutex> lock(shard.mutex);
+		return shard.stats;
+	}
+
+	/**
+	 * Obtain the sum of all shards' statistics.
+	 */
+	Stats GetStats() const noexcept {
+		Stats result;
+		for (size_t i = 0; i < n_shards; ++i) {
+			const auto s = GetShardStats(i);
+			result.hits += s.hits;
+			result.misses += s.misses;
+			result.insertions += s.insertions;
+		}
+
+		return result;
+	}
+
+private:
+	template<typename K>
+	Shard &GetShard(const K &key) noexcept {
+		return shards[GetShardIndex(key)];
+	}
+};
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SmallStringBuilder.hxx"
+#include "DecimalFormat.h"
+
+#include <algorithm>
+
+SmallStringBuilderBase::SmallStringBuilderBase(SmallStringBuilderBase &&src,
+					       char *_buffer,
+					       size_t buffer_size) noexcept
+	:data(_buffer), inline_buffer(_buffer),
+	 length(src.length), capacity(buffer_size - 1)
+{
+	if (src.IsInline()) {
+		/* the source is never larger than its inline buffer,
+		   and both have the same size */
+		memcpy(data, src.data, length + 1);
+	} else {
+		data = src.data;
+		capacity = src.capacity;
+		src.data = src.inline_buffer;
+		src.capacity = buffer_size - 1;
+	}
+
+	src.Clear();
+}
+
+void
+SmallStringBuilderBase::Grow(size_t min_capacity)
+{
+	const size_t new_capacity = std::max(min_capacity, capacity * 2);
+	char *new_data = new char[new_capacity + 1];
+	memcpy(new_data, data, length + 1);
+
+	if (!IsInline())
+		delete[] data;
+
+	data = new_data;
+	capacity = new_capacity;
+}
+
+void
+SmallStringBuilderBase::AppendUnsigned(uint64_t value)
+{
+	char buffer[20];
+	char *const end = buffer + sizeof(buffer);
+	const char *p = format_uint64_backwards(end, value);
+	Append(p, end - p);
+}
+
+void
+SmallStringBuilderBase::AppendSigned(int64_t value)
+{
+	if (value < 0) {
+		Append('-');
+		AppendUnsigned(-(uint64_t)value);
+	} else
+		AppendUnsigned(value);
+}
+
+static constexpr bool
+IsHarmlessChar(signed char ch) noexcept
+{
+	return ch >= 0x20 && ch != '"' && ch != '\\';
+}
+
+void
+SmallStringBuilderBase::AppendEscaped(StringView s)
+{
+	static constexpr char hex_digits[] = "0123456789ABCDEF";
+
+	/* most strings need no escaping; reserve space for that case */
+	Reserve(s.size);
+
+	const char *p = s.begin(), *const end = s.end();
+	while (p != end) {
+		const char *harmful = std::find_if_not(p, end, IsHarmlessChar);
+		Append(p, harmful - p);
+		if (harmful == end)
+			break;
+
+		const unsigned char ch = *harmful;
+		char *dest = Write(4);
+		dest[0] = '\\';
+		dest[1] = 'x';
+		dest[2] = hex_digits[ch >> 4];
+		dest[3] = hex_digits[ch & 0xf];
+
+		p = harmful + 1;
+	}
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "StringView.hxx"
+#include "Compiler.h"
+
+#include <utility>
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The non-template part of #SmallStringBuilder.
+ */
+class SmallStringBuilderBase {
+	char *data;
+
+	/**
+	 * The caller-provided inline buffer.  If #data equals this
+	 * pointer, no heap allocation has been made.
+	 */
+	char *const inline_buffer;
+
+	size_t length = 0;
+
+	/**
+	 * The maximum length without reallocation (excluding the null
+	 * terminator).
+	 */
+	size_t capacity;
+
+protected:
+	SmallStringBuilderBase(char *_buffer, size_t buffer_size) noexcept
+		:data(_buffer), inline_buffer(_buffer),
+		 capacity(buffer_size - 1) {
+		*data = '\0';
+	}
+
+	/**
+	 * Move constructor; the derived class passes its own inline
+	 * buffer.
+	 */
+	SmallStringBuilderBase(SmallStringBuilderBase &&src,
+			       char *_buffer, size_t buffer_size) noexcept;
+
+	~SmallStringBuilderBase() noexcept {
+		if (!IsInline())
+			delete[] data;
+	}
+
+	SmallStringBuilderBase(const SmallStringBuilderBase &) = delete;
+	SmallStringBuilderBase &operator=(const SmallStringBuilderBase &) = delete;
+
+public:
+	/**
+	 * Is the string still stored in the inline buffer?
+	 */
+	bool IsInline() const noexcept {
+		return data == inline_buffer;
+	}
+
+	bool empty() const noexcept {
+		return length == 0;
+	}
+
+	size_t size() const noexcept {
+		return length;
+	}
+
+	/**
+	 * Returns the null-terminated string.  The pointer is
+	 * invalidated by the next modification.
+	 */
+	const char *c_str() const noexcept {
+		return data;
+	}
+
+	StringView GetView() const noexcept {
+		return {data, length};
+	}
+
+	operator StringView() const noexcept {
+		return GetView();
+	}
+
+	/**
+	 * Discard the contents, but keep the allocated buffer.
+	 */
+	void Clear() noexcept {
+		length = 0;
+		*data = '\0';
+	}
+
+	/**
+	 * Ensure that at least the given number of characters can be
+	 * appended without reallocation.
+	 *
+	 * Throws std::bad_alloc on error.
+	 */
+	void Reserve(size_t n) {
+		if (gcc_unlikely(n > capacity - length))
+			Grow(length + n);
+	}
+
+	/**
+	 * Append the given number of characters and return a pointer
+	 * to them; the caller must fill them before the next call.
+	 *
+	 * Throws std::bad_alloc on error.
+	 */
+	char *Write(size_t n) {
+		Reserve(n);
+		char *p = data + length;
+		length += n;
+		data[length] = '\0';
+		return p;
+	}
+
+	void Append(char ch) {
+		*Write(1) = ch;
+	}
+
+	void Append(const char *s, size_t n) {
+		if (n > 0)
+			memcpy(Write(n), s, n);
+	}
+
+	void Append(StringView s) {
+		Append(s.data, s.size);
+	}
+
+	void Append(const char *s) {
+		Append(s, strlen(s));
+	}
+
+	/**
+	 * Append an unsigned integer in decimal notation.
+	 */
+	void AppendUnsigned(uint64_t value);
+
+	/**
+	 * Append a signed integer in decimal notation.
+	 */
+	void AppendSigned(int64_t value);
+
+	/**
+	 * Append a string, escaping control characters, non-ASCII
+	 * characters, double quotes and backslashes as "\xHH" (the
+	 * same format as the one-line access log).
+	 */
+	void AppendEscaped(StringView s);
+
+private:
+	/**
+	 * Move the string to a larger heap buffer.
+	 */
+	void Grow(size_t min_capacity);
+};
+
+/**
+ * Builds a string incrementally in an inline buffer of #N bytes
+ * (including the null terminator).  The string is moved to the heap
+ * only if it grows beyond that, so tiny strings (log lines, header
+ * values) never allocate.  Unlike #StringBuilder, it never fails
+ * with an overflow.
+ */
+template<size_t N=256>
+class SmallStringBuilder final : public SmallStringBuilderBase {
+	static_assert(N > 0, "Inline buffer must not be empty");
+
+	char buffer[N];
+
+public:
+	SmallStringBuilder() noexcept
+		:SmallStringBuilderBase(buffer, N) {}
+
+	SmallStringBuilder(SmallStringBuilder &&src) noexcept
+		:SmallStringBuilderBase(std::move(src), buffer, N) {}
+};
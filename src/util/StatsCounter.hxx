@@ -0,0 +1,168 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "CacheLine.hxx"
+#include "LogLinearHistogram.hxx"
+
+#include <array>
+#include <atomic>
+
+#include <stdint.h>
+
+/**
+ * Returns a small number identifying the calling thread; it is
+ * used to pick a slot in #StatsCounter and #StatsHistogram.  Slots
+ * are assigned round-robin when a thread calls this for the first
+ * time.
+ */
+inline unsigned
+GetStatsThreadSlot() noexcept
+{
+	static std::atomic<unsigned> next_slot{0};
+	static thread_local const unsigned slot =
+		next_slot.fetch_add(1, std::memory_order_relaxed);
+	return slot;
+}
+
+/**
+ * A counter which may be incremented concurrently from many threads
+ * without contention: each thread increments a (relaxed) atomic in
+ * its own cache line, and Get() sums them up.  It is meant for hot
+ * paths; reading is comparatively expensive.
+ */
+class StatsCounter {
+public:
+	static constexpr unsigned N_SLOTS = 8;
+
+private:
+	struct alignas(CACHE_LINE_SIZE) Slot {
+		std::atomic<uint64_t> value{0};
+	};
+
+	std::array<Slot, N_SLOTS> slots;
+
+public:
+	StatsCounter() = default;
+	StatsCounter(const StatsCounter &) = delete;
+	StatsCounter &operator=(const StatsCounter &) = delete;
+
+	void Add(uint64_t n=1) noexcept {
+		slots[GetStatsThreadSlot() % N_SLOTS].value.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	uint64_t Get() const noexcept {
+		uint64_t sum = 0;
+		for (const auto &i : slots)
+			sum += i.value.load(std::memory_order_relaxed);
+		return sum;
+	}
+};
+
+/**
+ * A value which can go up and down, e.g. the number of open
+ * connections.
+ */
+class StatsGauge {
+	std::atomic<int64_t> value{0};
+
+public:
+	StatsGauge() = default;
+	StatsGauge(const StatsGauge &) = delete;
+	StatsGauge &operator=(const StatsGauge &) = delete;
+
+	void Set(int64_t _value) noexcept {
+		value.store(_value, std::memory_order_relaxed);
+	}
+
+	void Add(int64_t delta=1) noexcept {
+		value.fetch_add(delta, std::memory_order_relaxed);
+	}
+
+	void Subtract(int64_t delta=1) noexcept {
+		value.fetch_sub(delta, std::memory_order_relaxed);
+	}
+
+	int64_t Get() const noexcept {
+		return value.load(std::memory_order_relaxed);
+	}
+};
+
+/**
+ * A thread-safe version of #LogLinearHistogram.  Each thread
+ * records into its own copy (selected like in #StatsCounter), and
+ * GetSnapshot() merges them.
+ *
+ * This needs N_SLOTS * N_BUCKETS * 8 bytes (8 kB with the default
+ * parameters), so it should be used for a small number of global
+ * metrics; code which runs in only one thread (e.g. an #EventLoop)
+ * should use a plain #LogLinearHistogram.
+ */
+template<unsigned SUB_BITS=2, unsigned MAX_BITS=32>
+class StatsHistogram {
+public:
+	typedef LogLinearHistogram<SUB_BITS, MAX_BITS> Histogram;
+
+	static constexpr unsigned N_SLOTS = 4;
+
+private:
+	struct alignas(CACHE_LINE_SIZE) Slot {
+		std::array<std::atomic<uint64_t>, Histogram::N_BUCKETS> buckets;
+
+		Slot() noexcept {
+			for (auto &i : buckets)
+				i.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	std::array<Slot, N_SLOTS> slots;
+
+public:
+	StatsHistogram() = default;
+	StatsHistogram(const StatsHistogram &) = delete;
+	StatsHistogram &operator=(const StatsHistogram &) = delete;
+
+	void Add(uint64_t value) noexcept {
+		auto &slot = slots[GetStatsThreadSlot() % N_SLOTS];
+		slot.buckets[Histogram::ValueToBucket(value)]
+			.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	Histogram GetSnapshot() const noexcept {
+		Histogram result;
+		for (const auto &slot : slots)
+			for (unsigned i = 0; i < Histogram::N_BUCKETS; ++i)
+				result.AddToBucket(i, slot.buckets[i].load(std::memory_order_relaxed));
+		return result;
+	}
+};
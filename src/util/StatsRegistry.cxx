@@ -0,0 +1,106 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "StatsRegistry.hxx"
+#include "PrometheusStatsWriter.hxx"
+
+#include <algorithm>
+
+void
+StatsRegistry::Add(Type type, const char *name, const char *labels,
+		   const void *source, double scale)
+{
+	Entry entry;
+	entry.type = type;
+	if (name != nullptr)
+		entry.name = name;
+	if (labels != nullptr)
+		entry.labels = labels;
+	entry.source = source;
+	entry.scale = scale;
+
+	const std::lock_guard<std::mutex> lock(mutex);
+	entries.emplace_back(std::move(entry));
+}
+
+void
+StatsRegistry::Remove(const void *source) noexcept
+{
+	const std::lock_guard<std::mutex> lock(mutex);
+	entries.erase(std::remove_if(entries.begin(), entries.end(),
+				     [source](const Entry &e){
+					     return e.source == source;
+				     }),
+		      entries.end());
+}
+
+void
+StatsRegistry::Collect(StatsWriter &writer) const
+{
+	const std::lock_guard<std::mutex> lock(mutex);
+
+	for (const auto &e : entries) {
+		const char *name = e.name.c_str();
+		const char *labels = e.labels.c_str();
+
+		switch (e.type) {
+		case Type::COUNTER:
+			writer.WriteCounter(name, labels,
+					    ((const StatsCounter *)e.source)->Get());
+			break;
+
+		case Type::GAUGE:
+			writer.WriteGauge(name, labels,
+					  ((const StatsGauge *)e.source)->Get());
+			break;
+
+		case Type::HISTOGRAM:
+			writer.WriteHistogram(name, labels,
+					      ((const StatsHistogram<> *)e.source)->GetSnapshot(),
+					      e.scale);
+			break;
+
+		case Type::COLLECTOR:
+			((StatsCollector *)const_cast<void *>(e.source))->Collect(writer);
+			break;
+		}
+	}
+}
+
+std::string
+StatsRegistry::RenderPrometheus() const
+{
+	std::string result;
+	PrometheusStatsWriter writer(result);
+	Collect(writer);
+	return result;
+}
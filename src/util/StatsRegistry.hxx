@@ -0,0 +1,123 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "StatsCounter.hxx"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+class StatsWriter;
+
+/**
+ * Something which writes metrics into a #StatsWriter when a
+ * #StatsRegistry is collected, e.g. an adapter for a subsystem's
+ * statistics structure.
+ */
+class StatsCollector {
+public:
+	virtual void Collect(StatsWriter &writer) = 0;
+};
+
+/**
+ * A list of metric sources which can be rendered at once (e.g. for
+ * a Prometheus scrape).  Registered objects must be removed before
+ * they are destroyed.  Registration and collection are protected by
+ * a mutex; the metrics themselves are updated without it.
+ */
+class StatsRegistry {
+	enum class Type {
+		COUNTER,
+		GAUGE,
+		HISTOGRAM,
+		COLLECTOR,
+	};
+
+	struct Entry {
+		Type type;
+		std::string name, labels;
+		const void *source;
+		double scale;
+	};
+
+	mutable std::mutex mutex;
+
+	std::vector<Entry> entries;
+
+public:
+	StatsRegistry() = default;
+	StatsRegistry(const StatsRegistry &) = delete;
+	StatsRegistry &operator=(const StatsRegistry &) = delete;
+
+	void Add(const char *name, const StatsCounter &counter,
+		 const char *labels=nullptr) {
+		Add(Type::COUNTER, name, labels, &counter);
+	}
+
+	void Add(const char *name, const StatsGauge &gauge,
+		 const char *labels=nullptr) {
+		Add(Type::GAUGE, name, labels, &gauge);
+	}
+
+	/**
+	 * @param scale see StatsWriter::WriteHistogram()
+	 */
+	void Add(const char *name, const StatsHistogram<> &histogram,
+		 double scale=1, const char *labels=nullptr) {
+		Add(Type::HISTOGRAM, name, labels, &histogram, scale);
+	}
+
+	void Add(StatsCollector &collector) {
+		Add(Type::COLLECTOR, nullptr, nullptr, &collector);
+	}
+
+	/**
+	 * Remove all registrations of the given object.
+	 */
+	void Remove(const void *source) noexcept;
+
+	/**
+	 * Write all metrics in the order of their registration.
+	 */
+	void Collect(StatsWriter &writer) const;
+
+	/**
+	 * Render all metrics in the Prometheus text format.
+	 */
+	std::string RenderPrometheus() const;
+
+private:
+	void Add(Type type, const char *name, const char *labels,
+		 const void *source, double scale=1);
+};
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "LogLinearHistogram.hxx"
+
+#include <string>
+
+#include <stdint.h>
+
+/**
+ * Receives metrics from a #StatsRegistry or from a subsystem's
+ * statistics adapter and renders them in some output format (see
+ * #PrometheusStatsWriter).
+ *
+ * Metric names should follow the Prometheus conventions
+ * ("subsystem_what_unit").  The labels are preformatted (e.g.
+ * `host="example.com"`) and may be nullptr.
+ */
+class StatsWriter {
+public:
+	virtual void WriteCounter(const char *name, const char *labels,
+				  double value) = 0;
+
+	virtual void WriteGauge(const char *name, const char *labels,
+				double value) = 0;
+
+	/**
+	 * @param scale a factor which converts the histogram's values
+	 * to the metric's unit (e.g. 1e-6 for microseconds to
+	 * seconds)
+	 */
+	virtual void WriteHistogram(const char *name, const char *labels,
+				    const LogLinearHistogram<> &histogram,
+				    double scale=1) = 0;
+};
+
+/**
+ * Append a label (name="value") to a preformatted label list,
+ * escaping the value.
+ */
+void
+AppendStatsLabel(std::string &labels, const char *name, const char *value);
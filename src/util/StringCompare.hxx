@@ -51,6 +51,16 @@ gcc_pure
 bool
 StringEndsWith(const char *haystack, const char *needle) noexcept;
 
+/**
+ * Compare two strings, each of which may be nullptr.
+ */
+gcc_pure
+static inline bool
+StringIsEqualOptional(const char *a, const char *b) noexcept
+{
+	return a == b || (a != nullptr && b != nullptr && StringIsEqual(a, b));
+}
+
 /**
  * Returns the portion of the string after a prefix.  If the string
  * does not begin with the specified prefix, this function returns
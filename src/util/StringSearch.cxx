@@ -0,0 +1,286 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "StringSearch.hxx"
+#include "CharUtil.hxx"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_SSE42_DISPATCH
+#endif
+
+/**
+ * A 256 bit set of bytes.
+ */
+class ByteSet {
+	uint64_t bits[4] = {0, 0, 0, 0};
+
+public:
+	ByteSet(const char *set, size_t size) noexcept {
+		for (size_t i = 0; i < size; ++i) {
+			const unsigned ch = (unsigned char)set[i];
+			bits[ch / 64] |= uint64_t(1) << (ch % 64);
+		}
+	}
+
+	bool Contains(char _ch) const noexcept {
+		const unsigned ch = (unsigned char)_ch;
+		return (bits[ch / 64] >> (ch % 64)) & 1;
+	}
+};
+
+#ifdef __SSE2__
+
+/**
+ * Sets up to 16 characters are compared in vector registers, larger
+ * ones are looked up in a #ByteSet.
+ */
+static constexpr size_t MAX_VECTOR_SET = 16;
+
+/**
+ * @return a bit mask of the bytes in the 16 byte chunk which are
+ * contained in the set
+ */
+gcc_always_inline
+static int
+MatchSet(__m128i chunk, const __m128i *set, size_t set_size) noexcept
+{
+	__m128i result = _mm_cmpeq_epi8(chunk, set[0]);
+	for (size_t i = 1; i < set_size; ++i)
+		result = _mm_or_si128(result, _mm_cmpeq_epi8(chunk, set[i]));
+	return _mm_movemask_epi8(result);
+}
+
+/**
+ * Common implementation of StringFindAnyOf() and
+ * StringFindFirstNotOf().
+ *
+ * @param invert true for StringFindFirstNotOf()
+ */
+static const char *
+VectorFindSet(const char *p, size_t size,
+	      const char *set, size_t set_size, bool invert) noexcept
+{
+	__m128i vset[MAX_VECTOR_SET];
+	for (size_t i = 0; i < set_size; ++i)
+		vset[i] = _mm_set1_epi8(set[i]);
+
+	const char *const end = p + size;
+
+	for (; end - p >= 16; p += 16) {
+		const __m128i chunk =
+			_mm_loadu_si128((const __m128i *)(const void *)p);
+		int mask = MatchSet(chunk, vset, set_size);
+		if (invert)
+			mask = ~mask & 0xffff;
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+	}
+
+	for (; p != end; ++p)
+		if ((memchr(set, *p, set_size) != nullptr) != invert)
+			return p;
+
+	return nullptr;
+}
+
+#endif
+
+static const char *
+ScalarFindSet(const char *p, size_t size,
+	      const char *set, size_t set_size, bool invert) noexcept
+{
+	const ByteSet s(set, set_size);
+
+	for (const char *end = p + size; p != end; ++p)
+		if (s.Contains(*p) != invert)
+			return p;
+
+	return nullptr;
+}
+
+const char *
+StringFindAnyOf(const char *p, size_t size,
+		const char *set, size_t set_size) noexcept
+{
+	if (set_size == 0)
+		return nullptr;
+
+	if (set_size == 1)
+		return (const char *)memchr(p, set[0], size);
+
+#ifdef __SSE2__
+	if (set_size <= MAX_VECTOR_SET)
+		return VectorFindSet(p, size, set, set_size, false);
+#endif
+
+	return ScalarFindSet(p, size, set, set_size, false);
+}
+
+const char *
+StringFindFirstNotOf(const char *p, size_t size,
+		     const char *set, size_t set_size) noexcept
+{
+	if (set_size == 0)
+		return size > 0 ? p : nullptr;
+
+#ifdef __SSE2__
+	if (set_size <= MAX_VECTOR_SET)
+		return VectorFindSet(p, size, set, set_size, true);
+#endif
+
+	return ScalarFindSet(p, size, set, set_size, true);
+}
+
+#ifdef __SSE2__
+
+gcc_always_inline
+static __m128i
+ToLowerASCII(__m128i chunk) noexcept
+{
+	const __m128i upper =
+		_mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('A' - 1)),
+			      _mm_cmplt_epi8(chunk, _mm_set1_epi8('Z' + 1)));
+	return _mm_or_si128(chunk, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+#endif
+
+bool
+StringIsEqualIgnoreCaseASCII(const char *a, const char *b,
+			     size_t size) noexcept
+{
+#ifdef __SSE2__
+	for (; size >= 16; a += 16, b += 16, size -= 16) {
+		const __m128i ca =
+			_mm_loadu_si128((const __m128i *)(const void *)a);
+		const __m128i cb =
+			_mm_loadu_si128((const __m128i *)(const void *)b);
+		const __m128i eq = _mm_cmpeq_epi8(ToLowerASCII(ca),
+						  ToLowerASCII(cb));
+		if (_mm_movemask_epi8(eq) != 0xffff)
+			return false;
+	}
+#endif
+
+	for (size_t i = 0; i < size; ++i)
+		if (::ToLowerASCII(a[i]) != ::ToLowerASCII(b[i]))
+			return false;
+
+	return true;
+}
+
+#ifdef HAVE_SSE42_DISPATCH
+
+/**
+ * Find candidates with PCMPESTRI (which compares the first 16 bytes
+ * of the needle against all positions of a 16 byte chunk, including
+ * partial matches at the end of the chunk) and verify them with
+ * memcmp().
+ */
+__attribute__((target("sse4.2")))
+static const char *
+FindSubstringSSE42(const char *haystack, size_t haystack_size,
+		   const char *needle, size_t needle_size) noexcept
+{
+	const int prefix_size = needle_size < 16 ? int(needle_size) : 16;
+
+	alignas(16) char prefix_buffer[16] = {};
+	memcpy(prefix_buffer, needle, prefix_size);
+	const __m128i prefix = _mm_load_si128((const __m128i *)(const void *)prefix_buffer);
+
+	size_t i = 0;
+	while (i + 16 <= haystack_size) {
+		const __m128i chunk =
+			_mm_loadu_si128((const __m128i *)(const void *)(haystack + i));
+		const int index =
+			_mm_cmpestri(prefix, prefix_size, chunk, 16,
+				     _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ORDERED);
+		if (index == 16) {
+			i += 16;
+			continue;
+		}
+
+		const size_t position = i + index;
+		if (position + needle_size > haystack_size)
+			return nullptr;
+
+		if (memcmp(haystack + position, needle, needle_size) == 0)
+			return haystack + position;
+
+		i = position + 1;
+	}
+
+	return (const char *)memmem(haystack + i, haystack_size - i,
+				    needle, needle_size);
+}
+
+gcc_const
+static bool
+HaveSSE42() noexcept
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+
+#endif
+
+const char *
+StringFindSubstring(const char *haystack, size_t haystack_size,
+		    const char *needle, size_t needle_size) noexcept
+{
+	if (needle_size == 0)
+		return haystack;
+
+	if (needle_size > haystack_size)
+		return nullptr;
+
+	if (needle_size == 1)
+		return (const char *)memchr(haystack, needle[0], haystack_size);
+
+#ifdef HAVE_SSE42_DISPATCH
+	static const bool have_sse42 = HaveSSE42();
+	if (have_sse42)
+		return FindSubstringSSE42(haystack, haystack_size,
+					  needle, needle_size);
+#endif
+
+	/* glibc's memmem() implements the Two-Way algorithm */
+	return (const char *)memmem(haystack, haystack_size,
+				    needle, needle_size);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/*
+ * Search primitives for #StringView.  The "char" overloads are
+ * vectorized (SSE2, and SSE4.2 selected at runtime); the templates
+ * are portable fallbacks for other character types.
+ */
+
+#include "Compiler.h"
+
+#include <stddef.h>
+
+/**
+ * Find the first character which is contained in the given set.
+ *
+ * @return a pointer to the character or nullptr if there is none
+ */
+gcc_pure
+const char *
+StringFindAnyOf(const char *p, size_t size,
+		const char *set, size_t set_size) noexcept;
+
+template<typename T>
+gcc_pure
+const T *
+StringFindAnyOf(const T *p, size_t size,
+		const T *set, size_t set_size) noexcept
+{
+	for (const T *end = p + size; p != end; ++p)
+		for (size_t i = 0; i < set_size; ++i)
+			if (*p == set[i])
+				return p;
+
+	return nullptr;
+}
+
+/**
+ * Find the first character which is not contained in the given set.
+ *
+ * @return a pointer to the character or nullptr if there is none
+ */
+gcc_pure
+const char *
+StringFindFirstNotOf(const char *p, size_t size,
+		     const char *set, size_t set_size) noexcept;
+
+template<typename T>
+gcc_pure
+const T *
+StringFindFirstNotOf(const T *p, size_t size,
+		     const T *set, size_t set_size) noexcept
+{
+	for (const T *end = p + size; p != end; ++p) {
+		bool found = false;
+		for (size_t i = 0; i < set_size && !found; ++i)
+			found = *p == set[i];
+
+		if (!found)
+			return p;
+	}
+
+	return nullptr;
+}
+
+/**
+ * Compare two strings of the same length, ignoring the case of ASCII
+ * letters.  Unlike strncasecmp(), this does not stop at null bytes
+ * and does not depend on the locale.
+ */
+gcc_pure
+bool
+StringIsEqualIgnoreCaseASCII(const char *a, const char *b,
+			     size_t size) noexcept;
+
+template<typename T>
+gcc_pure
+bool
+StringIsEqualIgnoreCaseASCII(const T *a, const T *b, size_t size) noexcept
+{
+	for (size_t i = 0; i < size; ++i) {
+		T ca = a[i], cb = b[i];
+		if (ca >= 'A' && ca <= 'Z')
+			ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z')
+			cb += 'a' - 'A';
+		if (ca != cb)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Find the first occurrence of a substring.
+ *
+ * @return a pointer to the match or nullptr if there is none
+ */
+gcc_pure
+const char *
+StringFindSubstring(const char *haystack, size_t haystack_size,
+		    const char *needle, size_t needle_size) noexcept;
+
+template<typename T>
+gcc_pure
+const T *
+StringFindSubstring(const T *haystack, size_t haystack_size,
+		    const T *needle, size_t needle_size) noexcept
+{
+	if (needle_size == 0)
+		return haystack;
+
+	for (size_t i = 0; i + needle_size <= haystack_size; ++i) {
+		size_t j = 0;
+		while (j < needle_size && haystack[i + j] == needle[j])
+			++j;
+		if (j == needle_size)
+			return haystack + i;
+	}
+
+	return nullptr;
+}
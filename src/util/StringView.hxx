@@ -32,6 +32,7 @@
 
 #include "ConstBuffer.hxx"
 #include "StringAPI.hxx"
+#include "StringSearch.hxx"
 
 template<typename T>
 struct BasicStringView : ConstBuffer<T> {
@@ -75,6 +76,34 @@ struct BasicStringView : ConstBuffer<T> {
 		return StringFind(data, ch, this->size);
 	}
 
+	/**
+	 * Find the first occurrence of the given substring.
+	 */
+	gcc_pure
+	pointer_type Find(BasicStringView<T> needle) const noexcept {
+		return StringFindSubstring(data, this->size,
+					   needle.data, needle.size);
+	}
+
+	/**
+	 * Find the first character which is contained in the given
+	 * set.
+	 */
+	gcc_pure
+	pointer_type FindAnyOf(BasicStringView<T> set) const noexcept {
+		return StringFindAnyOf(data, this->size, set.data, set.size);
+	}
+
+	/**
+	 * Find the first character which is not contained in the
+	 * given set.
+	 */
+	gcc_pure
+	pointer_type FindFirstNotOf(BasicStringView<T> set) const noexcept {
+		return StringFindFirstNotOf(data, this->size,
+					    set.data, set.size);
+	}
+
 	gcc_pure
 	bool StartsWith(BasicStringView<T> needle) const noexcept {
 		return this->size >= needle.size &&
@@ -94,10 +123,21 @@ struct BasicStringView : ConstBuffer<T> {
 			StringIsEqual(data, other.data, this->size);
 	}
 
+	/**
+	 * Compare case-insensitively (ASCII letters only).
+	 */
 	gcc_pure
 	bool EqualsIgnoreCase(BasicStringView<T> other) const noexcept {
 		return this->size == other.size &&
-			StringIsEqualIgnoreCase(data, other.data, this->size);
+			StringIsEqualIgnoreCaseASCII(data, other.data,
+						     this->size);
+	}
+
+	gcc_pure
+	bool StartsWithIgnoreCase(BasicStringView<T> needle) const noexcept {
+		return this->size >= needle.size &&
+			StringIsEqualIgnoreCaseASCII(data, needle.data,
+						     needle.size);
 	}
 
 	/**
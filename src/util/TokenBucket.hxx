@@ -0,0 +1,98 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <chrono>
+
+/**
+ * A token bucket for rate limiting.  The bucket holds up to "burst"
+ * tokens and is refilled with "rate" tokens per second; each event
+ * consumes tokens.  A new bucket is full.
+ */
+class TokenBucket {
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	TimePoint last_update;
+	double tokens;
+	bool initialized = false;
+
+public:
+	/**
+	 * Attempt to consume tokens.
+	 *
+	 * @param rate the number of tokens added per second
+	 * @param burst the capacity of the bucket
+	 * @param size the number of tokens to consume
+	 * @return true if there were enough tokens, false if the
+	 * event should be rejected (no tokens are consumed then)
+	 */
+	bool Check(TimePoint now, double rate, double burst,
+		   double size=1) noexcept {
+		Update(now, rate, burst);
+
+		if (tokens < size)
+			return false;
+
+		tokens -= size;
+		return true;
+	}
+
+	/**
+	 * The number of tokens currently in the bucket (for
+	 * debugging and statistics).
+	 */
+	double GetTokens(TimePoint now, double rate, double burst) noexcept {
+		Update(now, rate, burst);
+		return tokens;
+	}
+
+private:
+	void Update(TimePoint now, double rate, double burst) noexcept {
+		if (!initialized) {
+			initialized = true;
+			last_update = now;
+			tokens = burst;
+			return;
+		}
+
+		if (now <= last_update)
+			return;
+
+		const std::chrono::duration<double> elapsed = now - last_update;
+		last_update = now;
+
+		tokens += elapsed.count() * rate;
+		if (tokens > burst)
+			tokens = burst;
+	}
+};
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Trace.hxx"
+#include "PackedCircularBuffer.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+namespace Trace {
+
+thread_local TraceContext current;
+
+static std::atomic<unsigned> sample_rate{0};
+
+static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+/**
+ * The calling thread's ring buffer, allocated on first use.
+ */
+struct ThreadBuffer {
+	const std::unique_ptr<TraceSpanRecord[]> memory;
+	PackedCircularBuffer<TraceSpanRecord> ring;
+
+	explicit ThreadBuffer(size_t capacity)
+		:memory(new TraceSpanRecord[capacity]),
+		 ring({memory.get(), capacity * sizeof(TraceSpanRecord)}) {}
+};
+
+static thread_local std::unique_ptr<ThreadBuffer> thread_buffer;
+
+/**
+ * A per-thread xorshift generator for ids and sampling decisions.
+ */
+static uint64_t
+NextRandom() noexcept
+{
+	static thread_local uint64_t state = 0;
+	if (gcc_unlikely(state == 0)) {
+		/* seed from the clock and the thread's address space */
+		state = uint64_t(std::chrono::steady_clock::now().time_since_epoch().count())
+			^ uint64_t((uintptr_t)&state);
+		if (state == 0)
+			state = 1;
+	}
+
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static uint64_t
+NewId() noexcept
+{
+	uint64_t id;
+	do {
+		id = NextRandom();
+	} while (id == 0);
+	return id;
+}
+
+static uint64_t
+NowNs() noexcept
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void
+SetSampleRate(unsigned one_in_n) noexcept
+{
+	sample_rate.store(one_in_n, std::memory_order_relaxed);
+}
+
+TraceContext
+StartTrace() noexcept
+{
+	TraceContext ctx;
+
+	const unsigned rate = sample_rate.load(std::memory_order_relaxed);
+	if (gcc_likely(rate == 0))
+		return ctx;
+
+	if (rate > 1 && NextRandom() % rate != 0)
+		return ctx;
+
+	ctx.trace_id = NewId();
+	return ctx;
+}
+
+void
+SetBufferCapacity(size_t capacity)
+{
+	thread_buffer.reset(new ThreadBuffer(capacity));
+}
+
+size_t
+Drain(TraceSpanRecord *dest, size_t max) noexcept
+{
+	if (!thread_buffer)
+		return 0;
+
+	return thread_buffer->ring.pop_front_n(dest, max);
+}
+
+void
+BeginSpan(TraceContext &previous, uint64_t &start_ns) noexcept
+{
+	previous = current;
+	current.span_id = NewId();
+	start_ns = NowNs();
+}
+
+void
+EndSpan(const TraceContext &previous, const char *name,
+	uint64_t start_ns) noexcept
+{
+	TraceSpanRecord record;
+	record.trace_id = current.trace_id;
+	record.span_id = current.span_id;
+	record.parent_span_id = previous.span_id;
+	record.name = name;
+	record.start_ns = start_ns;
+	record.duration_ns = NowNs() - start_ns;
+
+	current = previous;
+
+	if (gcc_unlikely(!thread_buffer)) {
+		try {
+			SetBufferCapacity(DEFAULT_CAPACITY);
+		} catch (...) {
+			/* out of memory: drop the span */
+			return;
+		}
+	}
+
+	thread_buffer->ring.push_back(record);
+}
+
+} /* namespace Trace */
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Compiler.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Identifies the trace and the span which the current code runs in.
+ * A trace_id of zero means this code is not being traced (not
+ * sampled), which is the fast path.
+ */
+struct TraceContext {
+	uint64_t trace_id = 0;
+
+	/**
+	 * The innermost open span; new spans become its children.
+	 */
+	uint64_t span_id = 0;
+
+	constexpr bool IsSampled() const noexcept {
+		return trace_id != 0;
+	}
+};
+
+/**
+ * A finished span, as stored in the per-thread ring buffer.
+ */
+struct TraceSpanRecord {
+	uint64_t trace_id, span_id, parent_span_id;
+
+	/**
+	 * A string literal (the pointer is stored, not a copy).
+	 */
+	const char *name;
+
+	/**
+	 * std::chrono::steady_clock in nanoseconds.
+	 */
+	uint64_t start_ns, duration_ns;
+};
+
+/**
+ * Lightweight request tracing: code wraps interesting operations in
+ * a #TraceSpan; spans of sampled traces are recorded into a ring
+ * buffer owned by the calling thread, from where they can be
+ * exported in batches with Trace::Drain().
+ *
+ * The context is kept in a thread-local variable.  It is propagated
+ * across asynchronous hops by capturing it (Trace::GetCurrent())
+ * and restoring it in the callback with a #TraceScope;
+ * #DeferEvent does this automatically.
+ *
+ * If a trace is not sampled, each hook costs one predictable branch
+ * on a thread-local variable.
+ */
+namespace Trace {
+
+extern thread_local TraceContext current;
+
+static inline const TraceContext &
+GetCurrent() noexcept
+{
+	return current;
+}
+
+/**
+ * Sample one in #one_in_n new traces; 0 disables tracing (the
+ * default).
+ */
+void
+SetSampleRate(unsigned one_in_n) noexcept;
+
+/**
+ * Begin a new trace (e.g. for an incoming request), subject to
+ * sampling.  The result is usually installed with a #TraceScope.
+ */
+TraceContext
+StartTrace() noexcept;
+
+/**
+ * Resize the calling thread's ring buffer (discarding its
+ * contents).  The default capacity is 4096 spans; if the buffer
+ * overflows, the oldest spans are overwritten.
+ */
+void
+SetBufferCapacity(size_t capacity);
+
+/**
+ * Move up to #max of the calling thread's oldest finished spans to
+ * #dest.
+ *
+ * @return the number of spans copied
+ */
+size_t
+Drain(TraceSpanRecord *dest, size_t max) noexcept;
+
+void
+BeginSpan(TraceContext &previous, uint64_t &start_ns) noexcept;
+
+void
+EndSpan(const TraceContext &previous, const char *name,
+	uint64_t start_ns) noexcept;
+
+} /* namespace Trace */
+
+/**
+ * Installs a #TraceContext (e.g. one captured earlier) for the
+ * current scope and restores the previous one afterwards.
+ */
+class TraceScope {
+	const TraceContext previous;
+
+public:
+	explicit TraceScope(const TraceContext &ctx) noexcept
+		:previous(Trace::current) {
+		Trace::current = ctx;
+	}
+
+	~TraceScope() noexcept {
+		Trace::current = previous;
+	}
+
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+};
+
+/**
+ * Records a span from construction to destruction, if the current
+ * trace is sampled.  Spans opened inside become its children.
+ */
+class TraceSpan {
+	/**
+	 * nullptr if not sampled.
+	 */
+	const char *name = nullptr;
+
+	TraceContext previous;
+
+	uint64_t start_ns;
+
+public:
+	/**
+	 * @param _name a string literal
+	 */
+	explicit TraceSpan(const char *_name) noexcept {
+		if (gcc_unlikely(Trace::current.IsSampled())) {
+			name = _name;
+			Trace::BeginSpan(previous, start_ns);
+		}
+	}
+
+	~TraceSpan() noexcept {
+		if (gcc_unlikely(name != nullptr))
+			Trace::EndSpan(previous, name, start_ns);
+	}
+
+	TraceSpan(const TraceSpan &) = delete;
+	TraceSpan &operator=(const TraceSpan &) = delete;
+};
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "AllocationCounter.hxx"
+
+/* the prototypes of the functions which are interposed below */
+#include <malloc.h>
+#include <stdlib.h>
+
+#include <errno.h>
+
+/* the glibc allocator entry points, to which the interposed
+   functions below forward */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *p);
+}
+
+static thread_local AllocationCounter *current_allocation_counter;
+
+AllocationCounter::AllocationCounter() noexcept
+	:parent(current_allocation_counter)
+{
+	current_allocation_counter = this;
+}
+
+AllocationCounter::~AllocationCounter() noexcept
+{
+	current_allocation_counter = parent;
+}
+
+inline void
+AllocationCounter::OnAllocation(size_t size) noexcept
+{
+	for (auto *i = current_allocation_counter; i != nullptr; i = i->parent) {
+		++i->n_allocations;
+		i->n_bytes += size;
+	}
+}
+
+extern "C" {
+
+void *
+malloc(size_t size) noexcept
+{
+	AllocationCounter::OnAllocation(size);
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size) noexcept
+{
+	AllocationCounter::OnAllocation(n * size);
+	return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *p, size_t size) noexcept
+{
+	AllocationCounter::OnAllocation(size);
+	return __libc_realloc(p, size);
+}
+
+void *
+memalign(size_t alignment, size_t size) noexcept
+{
+	AllocationCounter::OnAllocation(size);
+	return __libc_memalign(alignment, size);
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size) noexcept
+{
+	return memalign(alignment, size);
+}
+
+int
+posix_memalign(void **p, size_t alignment, size_t size) noexcept
+{
+	*p = memalign(alignment, size);
+	return *p != nullptr ? 0 : ENOMEM;
+}
+
+void
+free(void *p) noexcept
+{
+	__libc_free(p);
+}
+
+}
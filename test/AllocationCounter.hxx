@@ -0,0 +1,85 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Counts heap allocations (malloc(), calloc(), realloc(),
+ * operator new, ...) performed by the current thread while this
+ * object exists.  Instances may be nested; each counts the
+ * allocations made within its own scope.
+ *
+ * This works by interposing the libc allocator functions; link
+ * AllocationCounter.cxx into the test executable to use it (see
+ * "allocation_counter" in test/meson.build).
+ */
+class AllocationCounter {
+	AllocationCounter *const parent;
+
+	size_t n_allocations = 0, n_bytes = 0;
+
+public:
+	AllocationCounter() noexcept;
+	~AllocationCounter() noexcept;
+
+	AllocationCounter(const AllocationCounter &) = delete;
+	AllocationCounter &operator=(const AllocationCounter &) = delete;
+
+	size_t GetCount() const noexcept {
+		return n_allocations;
+	}
+
+	size_t GetBytes() const noexcept {
+		return n_bytes;
+	}
+
+	/**
+	 * Internal method called by the interposed allocator.
+	 */
+	static void OnAllocation(size_t size) noexcept;
+};
+
+/**
+ * Assert that the given statement does not allocate heap memory.
+ */
+#define EXPECT_NO_ALLOCATION(statement) \
+	do { \
+		size_t n_allocations_; \
+		{ \
+			AllocationCounter allocation_counter_; \
+			statement; \
+			n_allocations_ = allocation_counter_.GetCount(); \
+		} \
+		EXPECT_EQ(n_allocations_, 0u) << "Allocation in: " #statement; \
+	} while (false)
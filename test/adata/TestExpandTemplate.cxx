@@ -0,0 +1,107 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "adata/ExpandTemplate.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include <string.h>
+
+static const char *
+Expand(Allocator &alloc, const char *src, ConstBuffer<StringView> captures)
+{
+    const auto t = ExpandTemplate::Compile(alloc, src);
+    const size_t length = t.GetExpandedLength(captures);
+    const char *result = t.Expand(alloc, captures);
+    EXPECT_EQ(strlen(result), length);
+    return result;
+}
+
+TEST(ExpandTemplate, Literal)
+{
+    Allocator alloc;
+
+    const char *src = "/var/www/index.html";
+    const auto t = ExpandTemplate::Compile(alloc, src);
+    EXPECT_FALSE(t.HasCaptures());
+
+    /* a literal is not copied */
+    EXPECT_EQ(t.Expand(alloc, nullptr), src);
+
+    EXPECT_STREQ(Expand(alloc, "", nullptr), "");
+    EXPECT_STREQ(Expand(alloc, "a\\\\b", nullptr), "a\\b");
+    EXPECT_STREQ(Expand(alloc, "\\\\", nullptr), "\\");
+}
+
+TEST(ExpandTemplate, Captures)
+{
+    Allocator alloc;
+
+    const StringView captures[] = {
+        "/foo/bar", "foo", nullptr, "bar",
+    };
+
+    const auto t = ExpandTemplate::Compile(alloc, "/home/\\1/\\3.html");
+    EXPECT_TRUE(t.HasCaptures());
+    EXPECT_EQ(t.GetCaptureCount(), 4u);
+    EXPECT_STREQ(t.Expand(alloc, {captures, 4}), "/home/foo/bar.html");
+
+    EXPECT_STREQ(Expand(alloc, "\\0", {captures, 4}), "/foo/bar");
+    EXPECT_STREQ(Expand(alloc, "\\1\\1\\\\\\3", {captures, 4}),
+                 "foofoo\\bar");
+
+    /* unmatched captures expand to an empty string */
+    EXPECT_STREQ(Expand(alloc, "x\\2y", {captures, 4}), "xy");
+
+    /* the template can be expanded many times */
+    const StringView other[] = {
+        "/a/b", "a", nullptr, "b",
+    };
+    EXPECT_STREQ(t.Expand(alloc, {other, 4}), "/home/a/b.html");
+}
+
+TEST(ExpandTemplate, Errors)
+{
+    Allocator alloc;
+
+    EXPECT_THROW(ExpandTemplate::Compile(alloc, "foo\\x"),
+                 std::runtime_error);
+    EXPECT_THROW(ExpandTemplate::Compile(alloc, "foo\\"),
+                 std::runtime_error);
+
+    const StringView captures[] = {"foo", "bar"};
+    const auto t = ExpandTemplate::Compile(alloc, "\\2");
+    EXPECT_THROW(t.Expand(alloc, {captures, 2}), std::runtime_error);
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "adata/ExpandableStringList.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+static void
+Build(AllocatorPtr alloc, ExpandableStringList &list)
+{
+    ExpandableStringList::Builder builder(list);
+    builder.Add(alloc, "a", false);
+    builder.Add(alloc, "b", false);
+    builder.Add(alloc, "c", false);
+}
+
+TEST(ExpandableStringList, DeepCopy)
+{
+    Allocator alloc;
+
+    ExpandableStringList src;
+    Build(alloc, src);
+
+    const ExpandableStringList copy(alloc, src);
+    EXPECT_FALSE(copy.IsShared());
+
+    auto a = copy.ToArray(alloc);
+    ASSERT_EQ(a.size, 3u);
+    EXPECT_STREQ(a[0], "a");
+    EXPECT_STREQ(a[1], "b");
+    EXPECT_STREQ(a[2], "c");
+
+    /* the strings have been duplicated */
+    auto b = src.ToArray(alloc);
+    EXPECT_NE(a[0], b[0]);
+
+    const ExpandableStringList empty(alloc, ExpandableStringList());
+    EXPECT_TRUE(empty.IsEmpty());
+}
+
+TEST(ExpandableStringList, Share)
+{
+    Allocator alloc;
+
+    ExpandableStringList src;
+    Build(alloc, src);
+    EXPECT_FALSE(src.IsShared());
+
+    ExpandableStringList shared(ShallowCopy(), src);
+    EXPECT_TRUE(shared.IsShared());
+    EXPECT_EQ(*shared.begin(), *src.begin());
+
+    shared.Unshare(alloc);
+    EXPECT_FALSE(shared.IsShared());
+
+    /* the items have been copied, but the strings are still
+       shared */
+    auto a = shared.ToArray(alloc), b = src.ToArray(alloc);
+    ASSERT_EQ(a.size, b.size);
+    for (size_t i = 0; i < a.size; ++i)
+        EXPECT_EQ(a[i], b[i]);
+
+    /* an empty list is never shared */
+    const ExpandableStringList empty;
+    EXPECT_FALSE(ExpandableStringList(ShallowCopy(), empty).IsShared());
+}
+
+#if TRANSLATION_ENABLE_EXPAND
+
+TEST(ExpandableStringList, ExpandShared)
+{
+    Allocator alloc;
+
+    ExpandableStringList src;
+    {
+        ExpandableStringList::Builder builder(src);
+        builder.Add(alloc, "x", false);
+        builder.Add(alloc, "y", false);
+        builder.SetExpand(alloc, "/\\1/");
+    }
+
+    const StringView captures[] = {"foo", "bar"};
+
+    ExpandableStringList shared(ShallowCopy(), src);
+    shared.Expand(alloc, {captures, 2});
+    EXPECT_FALSE(shared.IsShared());
+
+    auto a = shared.ToArray(alloc);
+    ASSERT_EQ(a.size, 2u);
+    EXPECT_STREQ(a[1], "/bar/");
+
+    /* the source has not been modified */
+    auto b = src.ToArray(alloc);
+    EXPECT_STREQ(b[1], "/\\1/");
+}
+
+#endif
@@ -0,0 +1,471 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/net/cares/Cache.hxx"
+#include "event/net/cares/Channel.hxx"
+#include "event/net/cares/Handler.hxx"
+#include "event/net/cares/Error.hxx"
+#include "event/SocketEvent.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/ToString.hxx"
+#include "util/Cancellable.hxx"
+
+#include <gtest/gtest.h>
+
+#include <ares.h>
+
+#include <map>
+#include <string>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * A minimal DNS server on a loopback UDP socket which answers "A"
+ * queries from a table and "AAAA" queries with "no data".  Unknown
+ * names get NXDOMAIN.
+ */
+class FakeDnsServer {
+	UniqueSocketDescriptor fd;
+	SocketEvent event;
+
+public:
+	struct Record {
+		uint8_t rcode = 0;
+		uint32_t address = 0;
+		uint32_t ttl = 60;
+	};
+
+	std::map<std::string, Record> records;
+
+	/**
+	 * The number of "A" queries per name.
+	 */
+	std::map<std::string, unsigned> queries;
+
+	explicit FakeDnsServer(EventLoop &event_loop)
+		:event(event_loop, BIND_THIS_METHOD(OnSocketReady))
+	{
+		EXPECT_TRUE(fd.CreateNonBlock(AF_INET, SOCK_DGRAM, 0));
+		EXPECT_TRUE(fd.Bind(IPv4Address(127, 0, 0, 1, 0)));
+		event.Set(fd.Get(), SocketEvent::READ|SocketEvent::PERSIST);
+		event.Add();
+	}
+
+	~FakeDnsServer() noexcept {
+		event.Delete();
+	}
+
+	/**
+	 * Returns the address in the format expected by
+	 * Channel::SetServers().
+	 */
+	std::string GetAddress() const {
+		char buffer[64];
+		EXPECT_TRUE(ToString(buffer, sizeof(buffer),
+				     fd.GetLocalAddress()));
+		return buffer;
+	}
+
+private:
+	void OnSocketReady(unsigned) noexcept {
+		uint8_t buffer[512];
+		StaticSocketAddress address;
+		ssize_t nbytes;
+
+		while ((nbytes = fd.Read(buffer, sizeof(buffer),
+					 address)) > 0)
+			HandleQuery(buffer, nbytes, address);
+	}
+
+	void HandleQuery(const uint8_t *query, size_t size,
+			 SocketAddress address) noexcept {
+		if (size < 12)
+			return;
+
+		/* parse the question */
+		std::string name;
+		size_t i = 12;
+		while (i < size && query[i] != 0) {
+			const size_t length = query[i++];
+			if (i + length > size)
+				return;
+
+			if (!name.empty())
+				name.push_back('.');
+			name.append((const char *)query + i, length);
+			i += length;
+		}
+
+		if (i + 5 > size)
+			return;
+
+		const unsigned qtype = (query[i + 1] << 8) | query[i + 2];
+		const size_t question_end = i + 5;
+
+		uint8_t response[512];
+		std::copy_n(query, question_end, response);
+
+		/* QR, RD, RA */
+		response[2] = 0x81;
+		response[3] = 0x80;
+		/* QDCOUNT=1, ANCOUNT, NSCOUNT, ARCOUNT=0 */
+		response[4] = 0;
+		response[5] = 1;
+		std::fill_n(response + 6, 6, 0);
+
+		size_t length = question_end;
+
+		const auto r = records.find(name);
+		if (qtype == 1)
+			++queries[name];
+
+		if (r == records.end()) {
+			/* NXDOMAIN */
+			response[3] |= 3;
+		} else if (r->second.rcode != 0) {
+			response[3] |= r->second.rcode;
+		} else if (qtype == 1) {
+			const auto &record = r->second;
+			response[7] = 1;
+
+			const uint8_t answer[] = {
+				/* pointer to the name in the question */
+				0xc0, 12,
+				0, 1, /* TYPE A */
+				0, 1, /* CLASS IN */
+				uint8_t(record.ttl >> 24),
+				uint8_t(record.ttl >> 16),
+				uint8_t(record.ttl >> 8),
+				uint8_t(record.ttl),
+				0, 4,
+				uint8_t(record.address >> 24),
+				uint8_t(record.address >> 16),
+				uint8_t(record.address >> 8),
+				uint8_t(record.address),
+			};
+
+			std::copy_n(answer, sizeof(answer), response + length);
+			length += sizeof(answer);
+		}
+
+		fd.Write(response, length, address);
+	}
+};
+
+struct Result final : Cares::Handler {
+	unsigned n_success = 0, n_error = 0;
+
+	std::string address;
+	std::exception_ptr error;
+
+	CancellablePointer cancel_ptr;
+
+	unsigned GetCount() const noexcept {
+		return n_success + n_error;
+	}
+
+	/* virtual methods from Cares::Handler */
+	void OnCaresSuccess(SocketAddress _address) noexcept override {
+		++n_success;
+
+		char buffer[64];
+		address = ToString(buffer, sizeof(buffer), _address)
+			? buffer
+			: "?";
+	}
+
+	void OnCaresError(std::exception_ptr e) noexcept override {
+		++n_error;
+		error = e;
+	}
+};
+
+struct CacheTest : ::testing::Test {
+	EventLoop event_loop;
+	FakeDnsServer server;
+	Cares::Channel channel;
+
+	CacheTest()
+		:server(event_loop), channel(event_loop)
+	{
+		channel.SetServers(server.GetAddress().c_str());
+	}
+
+	/**
+	 * Run the #EventLoop until the #Result has been completed
+	 * (at most two seconds).
+	 */
+	void Wait(const Result &result, unsigned count=1) {
+		const auto until = std::chrono::steady_clock::now() +
+			std::chrono::seconds(2);
+
+		while (result.GetCount() < count &&
+		       std::chrono::steady_clock::now() < until) {
+			event_loop.LoopOnceNonBlock();
+			usleep(1000);
+		}
+	}
+
+	/**
+	 * Run the #EventLoop for the given duration, so cache
+	 * entries expire.
+	 */
+	void Sleep(std::chrono::steady_clock::duration duration) {
+		const auto until = std::chrono::steady_clock::now() + duration;
+
+		while (std::chrono::steady_clock::now() < until) {
+			event_loop.LoopOnceNonBlock();
+			usleep(1000);
+		}
+	}
+};
+
+static uint32_t
+MakeAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+{
+	return (uint32_t(a) << 24) | (uint32_t(b) << 16) |
+		(uint32_t(c) << 8) | d;
+}
+
+static int
+GetCaresCode(std::exception_ptr e)
+{
+	try {
+		std::rethrow_exception(e);
+	} catch (const Cares::Error &error) {
+		return error.GetCode();
+	} catch (...) {
+		return -1;
+	}
+}
+
+}
+
+TEST_F(CacheTest, Hit)
+{
+	server.records["a.test"].address = MakeAddress(192, 0, 2, 1);
+
+	Cares::Cache cache(channel);
+
+	Result r1;
+	cache.Lookup("a.test", r1, r1.cancel_ptr);
+	EXPECT_EQ(r1.GetCount(), 0u);
+	Wait(r1);
+	ASSERT_EQ(r1.n_success, 1u);
+	EXPECT_EQ(r1.address, "192.0.2.1:0");
+	EXPECT_EQ(server.queries["a.test"], 1u);
+
+	/* a hit is delivered synchronously */
+	Result r2;
+	cache.Lookup("a.test", r2, r2.cancel_ptr);
+	ASSERT_EQ(r2.n_success, 1u);
+	EXPECT_EQ(r2.address, "192.0.2.1:0");
+	EXPECT_EQ(server.queries["a.test"], 1u);
+
+	EXPECT_EQ(cache.GetStats().misses, 1u);
+	EXPECT_EQ(cache.GetStats().hits, 1u);
+	EXPECT_EQ(cache.GetStats().queries, 1u);
+}
+
+TEST_F(CacheTest, Coalesce)
+{
+	server.records["a.test"].address = MakeAddress(192, 0, 2, 1);
+
+	Cares::Cache cache(channel);
+
+	Result r1, r2;
+	cache.Lookup("a.test", r1, r1.cancel_ptr);
+	cache.Lookup("a.test", r2, r2.cancel_ptr);
+	Wait(r1);
+	Wait(r2);
+
+	EXPECT_EQ(r1.n_success, 1u);
+	EXPECT_EQ(r2.n_success, 1u);
+	EXPECT_EQ(server.queries["a.test"], 1u);
+	EXPECT_EQ(cache.GetStats().coalesced, 1u);
+}
+
+/**
+ * The TTL of the response is clamped to Config::min_ttl and
+ * Config::max_ttl; after that, the entry expires.
+ */
+TEST_F(CacheTest, TtlExpiry)
+{
+	server.records["short.test"].address = MakeAddress(192, 0, 2, 1);
+	server.records["short.test"].ttl = 0;
+	server.records["long.test"].address = MakeAddress(192, 0, 2, 2);
+	server.records["long.test"].ttl = 3600;
+
+	Cares::Cache::Config config;
+	config.min_ttl = std::chrono::seconds(1);
+	config.max_ttl = std::chrono::seconds(1);
+	config.stale_ttl = std::chrono::seconds::zero();
+	Cares::Cache cache(channel, config);
+
+	for (const char *name : {"short.test", "long.test"}) {
+		Result r;
+		cache.Lookup(name, r, r.cancel_ptr);
+		Wait(r);
+		ASSERT_EQ(r.n_success, 1u);
+	}
+
+	/* TTL 0 is raised to min_ttl: still cached */
+	for (const char *name : {"short.test", "long.test"}) {
+		Result r;
+		cache.Lookup(name, r, r.cancel_ptr);
+		EXPECT_EQ(r.n_success, 1u);
+		EXPECT_EQ(server.queries[name], 1u);
+	}
+
+	Sleep(std::chrono::milliseconds(1100));
+
+	/* TTL 3600 is lowered to max_ttl: both have expired */
+	server.records["short.test"].address = MakeAddress(192, 0, 2, 3);
+	for (const char *name : {"short.test", "long.test"}) {
+		Result r;
+		cache.Lookup(name, r, r.cancel_ptr);
+		EXPECT_EQ(r.GetCount(), 0u);
+		Wait(r);
+		EXPECT_EQ(r.n_success, 1u);
+		EXPECT_EQ(server.queries[name], 2u);
+	}
+
+	Result r;
+	cache.Lookup("short.test", r, r.cancel_ptr);
+	EXPECT_EQ(r.address, "192.0.2.3:0");
+}
+
+/**
+ * An expired entry is served while it is being refreshed.
+ */
+TEST_F(CacheTest, StaleWhileRevalidate)
+{
+	server.records["a.test"].address = MakeAddress(192, 0, 2, 1);
+	server.records["a.test"].ttl = 1;
+
+	Cares::Cache::Config config;
+	config.stale_ttl = std::chrono::seconds(30);
+	Cares::Cache cache(channel, config);
+
+	Result r1;
+	cache.Lookup("a.test", r1, r1.cancel_ptr);
+	Wait(r1);
+	ASSERT_EQ(r1.n_success, 1u);
+
+	Sleep(std::chrono::milliseconds(1100));
+	server.records["a.test"].address = MakeAddress(192, 0, 2, 2);
+
+	/* the stale address is delivered synchronously, and a
+	   refresh is started */
+	Result r2;
+	cache.Lookup("a.test", r2, r2.cancel_ptr);
+	ASSERT_EQ(r2.n_success, 1u);
+	EXPECT_EQ(r2.address, "192.0.2.1:0");
+	EXPECT_EQ(cache.GetStats().stale_hits, 1u);
+
+	Sleep(std::chrono::milliseconds(100));
+	EXPECT_EQ(server.queries["a.test"], 2u);
+
+	Result r3;
+	cache.Lookup("a.test", r3, r3.cancel_ptr);
+	ASSERT_EQ(r3.n_success, 1u);
+	EXPECT_EQ(r3.address, "192.0.2.2:0");
+	EXPECT_EQ(cache.GetStats().hits, 1u);
+}
+
+TEST_F(CacheTest, Negative)
+{
+	Cares::Cache::Config config;
+	config.negative_ttl = std::chrono::seconds(1);
+	Cares::Cache cache(channel, config);
+
+	Result r1;
+	cache.Lookup("missing.test", r1, r1.cancel_ptr);
+	Wait(r1);
+	ASSERT_EQ(r1.n_error, 1u);
+	EXPECT_EQ(GetCaresCode(r1.error), ARES_ENOTFOUND);
+	const unsigned n_queries = server.queries["missing.test"];
+	EXPECT_GE(n_queries, 1u);
+
+	/* the error is cached */
+	Result r2;
+	cache.Lookup("missing.test", r2, r2.cancel_ptr);
+	ASSERT_EQ(r2.n_error, 1u);
+	EXPECT_EQ(GetCaresCode(r2.error), ARES_ENOTFOUND);
+	EXPECT_EQ(cache.GetStats().negative_hits, 1u);
+	EXPECT_EQ(server.queries["missing.test"], n_queries);
+
+	/* after negative_ttl, the name is looked up again */
+	Sleep(std::chrono::milliseconds(1100));
+	server.records["missing.test"].address = MakeAddress(192, 0, 2, 1);
+
+	Result r3;
+	cache.Lookup("missing.test", r3, r3.cancel_ptr);
+	EXPECT_EQ(r3.GetCount(), 0u);
+	Wait(r3);
+	ASSERT_EQ(r3.n_success, 1u);
+	EXPECT_EQ(r3.address, "192.0.2.1:0");
+}
+
+/**
+ * Transient errors (here: SERVFAIL) are not cached.
+ */
+TEST_F(CacheTest, TransientError)
+{
+	server.records["fail.test"].rcode = 2;
+
+	Cares::Cache cache(channel);
+
+	Result r1;
+	cache.Lookup("fail.test", r1, r1.cancel_ptr);
+	Wait(r1);
+	ASSERT_EQ(r1.n_error, 1u);
+	EXPECT_NE(GetCaresCode(r1.error), ARES_ENOTFOUND);
+	const unsigned n_queries = server.queries["fail.test"];
+	EXPECT_EQ(cache.GetSize(), 0u);
+
+	Result r2;
+	cache.Lookup("fail.test", r2, r2.cancel_ptr);
+	EXPECT_EQ(r2.GetCount(), 0u);
+	Wait(r2);
+	ASSERT_EQ(r2.n_error, 1u);
+	EXPECT_GT(server.queries["fail.test"], n_queries);
+	EXPECT_EQ(cache.GetStats().negative_hits, 0u);
+}
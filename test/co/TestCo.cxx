@@ -0,0 +1,244 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "../AllocationCounter.hxx"
+#include "co/Task.hxx"
+#include "co/InvokeTask.hxx"
+#include "co/All.hxx"
+#include "event/co/Sleep.hxx"
+#include "event/net/co/ConnectSocket.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/StaticSocketAddress.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+
+using std::chrono::milliseconds;
+
+namespace {
+
+struct Runner {
+    EventLoop &event_loop;
+
+    Co::InvokeTask task;
+
+    std::exception_ptr error;
+    bool done = false;
+
+    explicit Runner(EventLoop &_event_loop, Co::InvokeTask &&_task) noexcept
+        :event_loop(_event_loop), task(std::move(_task)) {}
+
+    void Run() {
+        task.Start(BIND_THIS_METHOD(OnComplete));
+        while (!done)
+            event_loop.LoopOnce();
+    }
+
+    void OnComplete(std::exception_ptr _error) noexcept {
+        error = std::move(_error);
+        done = true;
+    }
+};
+
+}
+
+static Co::Task<int>
+Add(int a, int b)
+{
+    co_return a + b;
+}
+
+static Co::Task<std::string>
+Delayed(EventLoop &event_loop, std::string value)
+{
+    co_await Co::Sleep(event_loop, milliseconds(1));
+    co_return value;
+}
+
+static Co::Task<>
+Fail(EventLoop &event_loop)
+{
+    co_await Co::Sleep(event_loop, milliseconds(1));
+    throw std::runtime_error("failure");
+}
+
+static Co::InvokeTask
+Chain(EventLoop &event_loop, std::string &result)
+{
+    result = std::to_string(co_await Add(1, 2));
+    result += co_await Delayed(event_loop, "x");
+}
+
+TEST(CoTest, Chain)
+{
+    EventLoop event_loop;
+    std::string result;
+
+    Runner runner(event_loop, Chain(event_loop, result));
+    runner.Run();
+    EXPECT_FALSE(runner.error);
+    EXPECT_EQ(result, "3x");
+}
+
+static Co::InvokeTask
+CatchError(EventLoop &event_loop, bool &caught)
+{
+    try {
+        co_await Fail(event_loop);
+    } catch (const std::runtime_error &) {
+        caught = true;
+    }
+
+    co_await Fail(event_loop);
+}
+
+TEST(CoTest, Error)
+{
+    EventLoop event_loop;
+    bool caught = false;
+
+    Runner runner(event_loop, CatchError(event_loop, caught));
+    runner.Run();
+    EXPECT_TRUE(caught);
+    EXPECT_TRUE(runner.error);
+}
+
+static Co::Task<>
+AppendDelayed(EventLoop &event_loop, std::string &dest, milliseconds d,
+              char ch)
+{
+    co_await Co::Sleep(event_loop, d);
+    dest.push_back(ch);
+}
+
+static Co::InvokeTask
+Concurrent(EventLoop &event_loop, std::string &result)
+{
+    auto a = AppendDelayed(event_loop, result, milliseconds(20), 'a');
+    auto b = AppendDelayed(event_loop, result, milliseconds(1), 'b');
+    auto c = AppendDelayed(event_loop, result, milliseconds(10), 'c');
+    co_await Co::All(a, b, c);
+    result.push_back('!');
+}
+
+TEST(CoTest, All)
+{
+    EventLoop event_loop;
+    std::string result;
+
+    Runner runner(event_loop, Concurrent(event_loop, result));
+    runner.Run();
+    EXPECT_FALSE(runner.error);
+    EXPECT_EQ(result, "bca!");
+}
+
+static Co::InvokeTask
+SleepLong(EventLoop &event_loop, bool &finished)
+{
+    co_await Co::Sleep(event_loop, std::chrono::hours(1));
+    finished = true;
+}
+
+TEST(CoTest, Cancel)
+{
+    EventLoop event_loop;
+    bool finished = false;
+
+    {
+        Runner runner(event_loop, SleepLong(event_loop, finished));
+        runner.task.Start(BIND_METHOD(runner, &Runner::OnComplete));
+        event_loop.LoopOnceNonBlock();
+
+        /* destroying the InvokeTask cancels the timer */
+    }
+
+    event_loop.LoopOnceNonBlock();
+    EXPECT_FALSE(finished);
+}
+
+static Co::InvokeTask
+Connect(EventLoop &event_loop, SocketAddress address,
+        UniqueSocketDescriptor &result)
+{
+    result = co_await Co::ConnectSocket(event_loop, address);
+}
+
+TEST(CoTest, ConnectSocket)
+{
+    UniqueSocketDescriptor listener;
+    ASSERT_TRUE(listener.Create(AF_INET, SOCK_STREAM, 0));
+    ASSERT_TRUE(listener.Bind(IPv4Address(127, 0, 0, 1, 0)));
+    ASSERT_TRUE(listener.Listen(4));
+    const auto address = listener.GetLocalAddress();
+
+    EventLoop event_loop;
+    UniqueSocketDescriptor s;
+
+    Runner runner(event_loop, Connect(event_loop, address, s));
+    runner.Run();
+    EXPECT_FALSE(runner.error);
+    EXPECT_TRUE(s.IsDefined());
+}
+
+static Co::InvokeTask
+Loop(unsigned n, unsigned &result)
+{
+    for (unsigned i = 0; i < n; ++i)
+        result += co_await Add(i, 1);
+}
+
+TEST(CoTest, FramePool)
+{
+    EventLoop event_loop;
+    unsigned result = 0;
+
+    /* warm up the frame pool */
+    {
+        Runner runner(event_loop, Loop(1, result));
+        runner.Run();
+    }
+
+    const auto recycled = Co::GetFramePool().GetStats().recycled;
+
+    EXPECT_NO_ALLOCATION({
+        Runner runner(event_loop, Loop(100, result));
+        runner.Run();
+    });
+
+    EXPECT_EQ(result, 1u + 5050u);
+    EXPECT_GE(Co::GetFramePool().GetStats().recycled, recycled + 101);
+}
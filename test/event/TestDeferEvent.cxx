@@ -0,0 +1,267 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/DeferEvent.hxx"
+#include "event/TimerEvent.hxx"
+#include "event/Loop.hxx"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+/**
+ * A #DeferEvent which appends its name to a shared log.
+ */
+struct Recorder {
+	EventLoop &loop;
+
+	DeferEvent event;
+
+	std::string &log;
+	const char name;
+
+	/**
+	 * If set, this event is scheduled by our callback.
+	 */
+	Recorder *chain = nullptr;
+
+	/**
+	 * Sleep this long in the callback (microseconds).
+	 */
+	unsigned sleep_us = 0;
+
+	bool break_loop = false;
+
+	Recorder(EventLoop &_loop, std::string &_log, char _name,
+		 DeferEvent::Priority priority=DeferEvent::Priority::NORMAL)
+		:loop(_loop),
+		 event(loop, BIND_THIS_METHOD(OnDeferred), priority),
+		 log(_log), name(_name) {}
+
+private:
+	void OnDeferred() noexcept {
+		log.push_back(name);
+
+		if (sleep_us > 0)
+			usleep(sleep_us);
+
+		if (chain != nullptr)
+			chain->event.Schedule();
+
+		if (break_loop)
+			loop.Break();
+	}
+};
+
+}
+
+TEST(DeferEvent, Fifo)
+{
+	EventLoop loop;
+	std::string log;
+	Recorder a(loop, log, 'a'), b(loop, log, 'b'), c(loop, log, 'c');
+
+	b.event.Schedule();
+	a.event.Schedule();
+	c.event.Schedule();
+
+	/* scheduling twice does not move the event */
+	b.event.Schedule();
+
+	loop.LoopOnceNonBlock();
+	EXPECT_EQ(log, "bac");
+	EXPECT_FALSE(loop.HasPendingDeferred());
+}
+
+TEST(DeferEvent, IdleAfterNormal)
+{
+	EventLoop loop;
+	std::string log;
+	Recorder i1(loop, log, 'x', DeferEvent::Priority::IDLE);
+	Recorder i2(loop, log, 'y', DeferEvent::Priority::IDLE);
+	Recorder a(loop, log, 'a'), b(loop, log, 'b'), c(loop, log, 'c');
+
+	/* a NORMAL event scheduled by a NORMAL callback still runs
+	   before the IDLE ones */
+	a.chain = &c;
+
+	i1.event.Schedule();
+	a.event.Schedule();
+	i2.event.Schedule();
+	b.event.Schedule();
+
+	loop.LoopOnceNonBlock();
+	EXPECT_EQ(log, "abcxy");
+}
+
+TEST(DeferEvent, IdleSchedulesNormal)
+{
+	EventLoop loop;
+	std::string log;
+	Recorder i1(loop, log, 'x', DeferEvent::Priority::IDLE);
+	Recorder i2(loop, log, 'y', DeferEvent::Priority::IDLE);
+	Recorder a(loop, log, 'a');
+
+	/* a NORMAL event scheduled by an IDLE callback overtakes the
+	   remaining IDLE events */
+	i1.chain = &a;
+
+	i1.event.Schedule();
+	i2.event.Schedule();
+
+	loop.LoopOnceNonBlock();
+	EXPECT_EQ(log, "xay");
+}
+
+TEST(DeferEvent, Cancel)
+{
+	EventLoop loop;
+	std::string log;
+	Recorder a(loop, log, 'a'), b(loop, log, 'b');
+	Recorder i(loop, log, 'x', DeferEvent::Priority::IDLE);
+
+	a.event.Schedule();
+	b.event.Schedule();
+	i.event.Schedule();
+	b.event.Cancel();
+	i.event.Cancel();
+	EXPECT_FALSE(b.event.IsPending());
+	EXPECT_FALSE(i.event.IsPending());
+
+	loop.LoopOnceNonBlock();
+	EXPECT_EQ(log, "a");
+}
+
+TEST(DeferEvent, BudgetCount)
+{
+	EventLoop loop;
+	loop.SetDeferBudget(2);
+
+	std::string log;
+	Recorder a(loop, log, 'a'), b(loop, log, 'b'), c(loop, log, 'c');
+	Recorder i(loop, log, 'x', DeferEvent::Priority::IDLE);
+
+	i.event.Schedule();
+	a.event.Schedule();
+	b.event.Schedule();
+	c.event.Schedule();
+
+	/* LoopOnceNonBlock() calls RunDeferred() twice: before and
+	   after polling libevent */
+	loop.LoopOnceNonBlock();
+	EXPECT_EQ(log, "abcx");
+	EXPECT_FALSE(loop.HasPendingDeferred());
+
+	log.clear();
+	loop.SetDeferBudget(1);
+	a.event.Schedule();
+	b.event.Schedule();
+	c.event.Schedule();
+	i.event.Schedule();
+
+	loop.LoopOnceNonBlock();
+	EXPECT_EQ(log, "ab");
+	EXPECT_TRUE(c.event.IsPending());
+	EXPECT_TRUE(i.event.IsPending());
+	EXPECT_TRUE(loop.HasPendingDeferred());
+
+	loop.LoopOnceNonBlock();
+	EXPECT_EQ(log, "abcx");
+	EXPECT_FALSE(loop.HasPendingDeferred());
+}
+
+TEST(DeferEvent, BudgetTime)
+{
+	EventLoop loop;
+	loop.SetDeferBudget(0, std::chrono::milliseconds(1));
+
+	std::string log;
+	std::vector<std::unique_ptr<Recorder>> v;
+	for (unsigned i = 0; i < 64; ++i) {
+		v.emplace_back(new Recorder(loop, log, 'a'));
+		/* 16 callbacks take at least 1.6ms, which exceeds
+		   the budget at the first clock check */
+		v.back()->sleep_us = 100;
+		v.back()->event.Schedule();
+	}
+
+	loop.LoopOnceNonBlock();
+	EXPECT_EQ(log.size(), 32u);
+	EXPECT_TRUE(loop.HasPendingDeferred());
+
+	loop.LoopOnceNonBlock();
+	EXPECT_EQ(log.size(), 64u);
+	EXPECT_FALSE(loop.HasPendingDeferred());
+}
+
+/**
+ * Events carried over by the budget must not let the next
+ * iteration block in libevent.
+ */
+TEST(DeferEvent, CarryOverNonBlock)
+{
+	EventLoop loop;
+	loop.SetDeferBudget(1);
+
+	std::string log;
+	Recorder a(loop, log, 'a'), b(loop, log, 'b'), c(loop, log, 'c');
+	c.break_loop = true;
+
+	/* without the EVLOOP_NONBLOCK carry-over, Dispatch() would
+	   block until this timer expires */
+	Recorder t(loop, log, 't');
+	t.break_loop = true;
+	TimerEvent timer(loop, BIND_METHOD(t.event, &DeferEvent::Schedule));
+	timer.Add({2, 0});
+
+	a.event.Schedule();
+	b.event.Schedule();
+	c.event.Schedule();
+
+	const auto start = std::chrono::steady_clock::now();
+	loop.Dispatch();
+	EXPECT_LT(std::chrono::steady_clock::now() - start,
+		  std::chrono::seconds(1));
+
+	EXPECT_EQ(log, "abc");
+	EXPECT_TRUE(timer.IsPending());
+	timer.Cancel();
+	t.event.Cancel();
+}
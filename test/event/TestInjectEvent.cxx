@@ -0,0 +1,211 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/InjectEvent.hxx"
+#include "event/Loop.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+struct Counter {
+	EventLoop &loop;
+
+	InjectEvent event;
+
+	std::thread::id thread;
+
+	unsigned n = 0;
+
+	/**
+	 * Break the #EventLoop after the callback has been invoked
+	 * this many times in total (see #total).
+	 */
+	unsigned *const total;
+	const unsigned break_after;
+
+	Counter(EventLoop &_loop,
+		unsigned *_total=nullptr, unsigned _break_after=1)
+		:loop(_loop), event(loop, BIND_THIS_METHOD(OnInject)),
+		 total(_total), break_after(_break_after) {}
+
+private:
+	void OnInject() noexcept {
+		thread = std::this_thread::get_id();
+		++n;
+
+		if (total == nullptr || ++*total == break_after)
+			loop.Break();
+	}
+};
+
+/**
+ * Let the #EventLoop handle pending events without blocking.
+ */
+static void
+Poll(EventLoop &loop)
+{
+	for (unsigned i = 0; i < 4; ++i)
+		loop.LoopOnceNonBlock();
+}
+
+TEST(InjectEvent, FromThread)
+{
+	EventLoop loop;
+	Counter c(loop);
+
+	std::thread t([&c]{ c.event.Schedule(); });
+	loop.Dispatch();
+	t.join();
+
+	/* the callback runs in the loop thread, exactly once */
+	EXPECT_EQ(c.n, 1u);
+	EXPECT_EQ(c.thread, std::this_thread::get_id());
+
+	Poll(loop);
+	EXPECT_EQ(c.n, 1u);
+	EXPECT_FALSE(c.event.IsPending());
+
+	/* it can be scheduled again */
+	std::thread t2([&c]{ c.event.Schedule(); });
+	loop.Dispatch();
+	t2.join();
+	EXPECT_EQ(c.n, 2u);
+}
+
+TEST(InjectEvent, Coalesce)
+{
+	EventLoop loop;
+	Counter c(loop);
+
+	/* many Schedule() calls from several threads before the loop
+	   runs result in one invocation */
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < 4; ++i)
+		threads.emplace_back([&c]{
+			for (unsigned j = 0; j < 1000; ++j)
+				c.event.Schedule();
+		});
+
+	for (auto &t : threads)
+		t.join();
+
+	EXPECT_TRUE(c.event.IsPending());
+
+	loop.Dispatch();
+	Poll(loop);
+	EXPECT_EQ(c.n, 1u);
+}
+
+TEST(InjectEvent, Many)
+{
+	static constexpr unsigned N = 64;
+
+	EventLoop loop;
+	unsigned total = 0;
+
+	std::vector<std::unique_ptr<Counter>> counters;
+	for (unsigned i = 0; i < N; ++i)
+		counters.emplace_back(new Counter(loop, &total, N));
+
+	/* schedule concurrently while the loop is running */
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < 4; ++i)
+		threads.emplace_back([&counters, i]{
+			for (unsigned j = i; j < N; j += 4)
+				counters[j]->event.Schedule();
+		});
+
+	loop.Dispatch();
+
+	for (auto &t : threads)
+		t.join();
+
+	Poll(loop);
+	EXPECT_EQ(total, N);
+	for (const auto &c : counters)
+		EXPECT_EQ(c->n, 1u);
+}
+
+TEST(InjectEvent, Cancel)
+{
+	EventLoop loop;
+	Counter c(loop), other(loop);
+
+	std::thread t([&c]{ c.event.Schedule(); });
+	t.join();
+
+	c.event.Cancel();
+	EXPECT_FALSE(c.event.IsPending());
+
+	/* wake up the loop with another event; the cancelled one
+	   must not run */
+	other.event.Schedule();
+	loop.Dispatch();
+	Poll(loop);
+	EXPECT_EQ(c.n, 0u);
+	EXPECT_EQ(other.n, 1u);
+
+	/* scheduling again after Cancel() works */
+	std::thread t2([&c]{ c.event.Schedule(); });
+	loop.Dispatch();
+	t2.join();
+	EXPECT_EQ(c.n, 1u);
+
+	/* cancel and revive before the loop runs */
+	c.event.Schedule();
+	c.event.Cancel();
+	c.event.Schedule();
+	loop.Dispatch();
+	Poll(loop);
+	EXPECT_EQ(c.n, 2u);
+}
+
+TEST(InjectEvent, DestroyPending)
+{
+	EventLoop loop;
+	Counter other(loop);
+
+	{
+		Counter c(loop);
+		std::thread t([&c]{ c.event.Schedule(); });
+		t.join();
+
+		/* the destructor unlinks the pending event */
+	}
+
+	other.event.Schedule();
+	loop.Dispatch();
+	EXPECT_EQ(other.n, 1u);
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/TimerWheel.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "event/TimerEvent.hxx"
+#include "event/Loop.hxx"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+/**
+ * A #CoarseTimerEvent which records the tick it was fired at.
+ */
+struct TestTimer {
+	uint64_t &now;
+
+	CoarseTimerEvent event;
+
+	uint64_t fired = TimerWheel::NONE;
+	unsigned n_fired = 0;
+
+	TestTimer(EventLoop &loop, uint64_t &_now) noexcept
+		:now(_now), event(loop, BIND_THIS_METHOD(OnTimer)) {}
+
+private:
+	void OnTimer() noexcept {
+		fired = now;
+		++n_fired;
+	}
+};
+
+/**
+ * Drive the wheel like #EventLoop does: always wake up at the tick
+ * returned by Run().
+ *
+ * @return the number of wakeups
+ */
+static unsigned
+RunUntilEmpty(TimerWheel &wheel, uint64_t &now)
+{
+	unsigned n = 0;
+
+	for (uint64_t next = wheel.GetNextWakeup(); next != TimerWheel::NONE;
+	     ++n) {
+		now = next;
+		next = wheel.Run(now);
+	}
+
+	return n;
+}
+
+TEST(TimerWheel, Relative)
+{
+	/* a tick which is typical for a machine which has been up for
+	   a few weeks */
+	const uint64_t start = 3'000'000'000;
+
+	EventLoop loop;
+	uint64_t now = start;
+	TimerWheel wheel(start);
+	TestTimer t(loop, now);
+
+	wheel.Insert(t.event, start + 100);
+
+	/* the timer is placed relative to the start tick, not to
+	   tick 0 */
+	EXPECT_EQ(wheel.GetNextWakeup(), start + 100);
+
+	now = start + 99;
+	EXPECT_EQ(wheel.Run(now), start + 100);
+	EXPECT_EQ(t.n_fired, 0u);
+
+	now = start + 100;
+	EXPECT_EQ(wheel.Run(now), TimerWheel::NONE);
+	EXPECT_EQ(t.n_fired, 1u);
+	EXPECT_EQ(t.fired, start + 100);
+	EXPECT_TRUE(wheel.IsEmpty());
+
+	/* an expired timer fires on the next tick */
+	wheel.Insert(t.event, start);
+	EXPECT_EQ(wheel.GetNextWakeup(), start + 101);
+}
+
+TEST(TimerWheel, Cascade)
+{
+	/* not aligned to any tier boundary */
+	const uint64_t start = 1'000'000'123;
+
+	static constexpr uint64_t deltas[] = {
+		0, 1, 5, 1023, 1024, 1025, 1500,
+		65535, 65536, 65537, 100'000,
+		/* tier 2 */
+		4'000'000,
+		/* overflow */
+		4'194'304, 5 * 3600 * 1000,
+	};
+
+	EventLoop loop;
+	uint64_t now = start;
+	TimerWheel wheel(start);
+
+	std::vector<std::unique_ptr<TestTimer>> timers;
+	for (const uint64_t delta : deltas) {
+		timers.emplace_back(new TestTimer(loop, now));
+		wheel.Insert(timers.back()->event, start + delta);
+	}
+
+	RunUntilEmpty(wheel, now);
+	EXPECT_TRUE(wheel.IsEmpty());
+
+	/* each timer fires exactly once, at its due tick, no matter
+	   through how many tiers it was cascaded */
+	for (size_t i = 0; i < timers.size(); ++i) {
+		EXPECT_EQ(timers[i]->n_fired, 1u) << "delta=" << deltas[i];
+		EXPECT_EQ(timers[i]->fired, start + deltas[i])
+			<< "delta=" << deltas[i];
+	}
+}
+
+TEST(TimerWheel, NextWakeup)
+{
+	const uint64_t start = 1000;
+
+	EventLoop loop;
+	uint64_t now = start;
+	TimerWheel wheel(start);
+	TestTimer a(loop, now), b(loop, now);
+
+	/* tier 1 (cascaded at tick 1024) */
+	wheel.Insert(a.event, 2030);
+
+	/* tier 0 */
+	wheel.Insert(b.event, 2000);
+
+	/* the tier 1 boundary comes before the tier 0 slot; skipping
+	   to the tier 0 slot would miss the cascade */
+	EXPECT_EQ(wheel.GetNextWakeup(), 1024u);
+
+	RunUntilEmpty(wheel, now);
+	EXPECT_EQ(b.fired, 2000u);
+	EXPECT_EQ(a.fired, 2030u);
+}
+
+TEST(TimerWheel, IdleSkip)
+{
+	const uint64_t start = 5'000'000'000;
+
+	EventLoop loop;
+	uint64_t now = start;
+	TimerWheel wheel(start);
+	TestTimer t(loop, now);
+
+	/* an empty wheel skips the idle period at once */
+	now = start + 10 * 3600 * 1000;
+	EXPECT_EQ(wheel.Run(now), TimerWheel::NONE);
+
+	/* ... and continues relative to the new time */
+	wheel.Insert(t.event, now + 5);
+	EXPECT_EQ(wheel.GetNextWakeup(), now + 5);
+	t.event.Cancel();
+
+	const uint64_t due = now + 3600 * 1000;
+	wheel.Insert(t.event, due);
+
+	/* an hour-long timer needs only a few wakeups for the
+	   cascades, not one per tick or per tier 0 revolution */
+	const unsigned n_wakeups = RunUntilEmpty(wheel, now);
+	EXPECT_LE(n_wakeups, 8u);
+	EXPECT_EQ(t.n_fired, 1u);
+	EXPECT_EQ(t.fired, due);
+}
+
+struct LoopTimer {
+	EventLoop &loop;
+
+	CoarseTimerEvent event;
+
+	bool fired = false;
+
+	explicit LoopTimer(EventLoop &_loop) noexcept
+		:loop(_loop), event(loop, BIND_THIS_METHOD(OnTimer)) {}
+
+private:
+	void OnTimer() noexcept {
+		fired = true;
+		loop.Break();
+	}
+};
+
+TEST(CoarseTimerEvent, Loop)
+{
+	EventLoop loop;
+
+	/* the timer must fire after about 10 ms, not when the wheel
+	   has caught up with the system uptime */
+	LoopTimer timer(loop);
+	timer.event.Schedule(std::chrono::milliseconds(10));
+
+	/* give up after 5 seconds */
+	TimerEvent timeout(loop, BIND_METHOD(loop, &EventLoop::Break));
+	timeout.Add({5, 0});
+
+	const auto t0 = std::chrono::steady_clock::now();
+	loop.Dispatch();
+	const auto elapsed = std::chrono::steady_clock::now() - t0;
+
+	EXPECT_TRUE(timer.fired);
+	EXPECT_LT(elapsed, std::chrono::seconds(1));
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/WorkerPool.hxx"
+#include "event/Loop.hxx"
+#include "util/Cancellable.hxx"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A flag which one thread can wait for.
+ */
+class Gate {
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool open = false;
+
+public:
+	void Open() noexcept {
+		const std::lock_guard<std::mutex> lock(mutex);
+		open = true;
+		cond.notify_all();
+	}
+
+	void Wait() noexcept {
+		std::unique_lock<std::mutex> lock(mutex);
+		cond.wait(lock, [this]{ return open; });
+	}
+};
+
+class TestJob final : public WorkerJob {
+	std::function<void()> run;
+
+	/**
+	 * Break the #EventLoop after OnDone() has been called this
+	 * many times in total (see #n_total_done).
+	 */
+	unsigned *const n_total_done;
+	const unsigned break_after;
+
+public:
+	std::atomic<unsigned> n_run{0};
+	std::thread::id run_thread;
+
+	unsigned n_done = 0;
+
+	TestJob(EventLoop &loop, std::function<void()> &&_run,
+		unsigned *_n_total_done=nullptr, unsigned _break_after=0)
+		:WorkerJob(loop), run(std::move(_run)),
+		 n_total_done(_n_total_done), break_after(_break_after) {}
+
+protected:
+	void Run() noexcept override {
+		run_thread = std::this_thread::get_id();
+		if (run)
+			run();
+		++n_run;
+	}
+
+	void OnDone() noexcept override {
+		++n_done;
+
+		if (n_total_done != nullptr && ++*n_total_done == break_after)
+			GetEventLoop().Break();
+	}
+};
+
+/**
+ * Let the #EventLoop handle pending events without blocking.
+ */
+static void
+Poll(EventLoop &loop)
+{
+	for (unsigned i = 0; i < 4; ++i)
+		loop.LoopOnceNonBlock();
+}
+
+TEST(WorkerPool, Submit)
+{
+	EventLoop loop;
+	WorkerPool pool(4);
+	ASSERT_EQ(pool.GetThreadCount(), 4u);
+
+	static constexpr unsigned N = 100;
+	unsigned n_done = 0;
+
+	std::vector<std::unique_ptr<TestJob>> jobs;
+	for (unsigned i = 0; i < N; ++i)
+		jobs.emplace_back(new TestJob(loop, nullptr, &n_done, N));
+
+	for (auto &job : jobs)
+		pool.Submit(*job);
+
+	loop.Dispatch();
+
+	ASSERT_EQ(n_done, N);
+	for (const auto &job : jobs) {
+		/* Run() was called once in a worker thread, and
+		   OnDone() once in the EventLoop thread */
+		EXPECT_EQ(job->n_run, 1u);
+		EXPECT_EQ(job->n_done, 1u);
+		EXPECT_NE(job->run_thread, std::this_thread::get_id());
+	}
+
+	/* a finished job may be submitted again */
+	n_done = N - 1;
+	pool.Submit(*jobs.front());
+	loop.Dispatch();
+	EXPECT_EQ(jobs.front()->n_run, 2u);
+	EXPECT_EQ(jobs.front()->n_done, 2u);
+}
+
+TEST(WorkerPool, CancelQueued)
+{
+	EventLoop loop;
+	WorkerPool pool(1);
+
+	/* occupy the only thread */
+	Gate started, release;
+	TestJob blocker(loop, [&]{ started.Open(); release.Wait(); });
+	pool.Submit(blocker);
+	started.Wait();
+
+	TestJob job(loop, nullptr);
+	pool.Submit(job);
+	pool.Cancel(job);
+
+	/* cancelling twice is harmless */
+	pool.Cancel(job);
+
+	/* the same through a #CancellablePointer */
+	TestJob job2(loop, nullptr);
+	CancellablePointer cancel_ptr;
+	pool.Submit(job2, cancel_ptr);
+	cancel_ptr.Cancel();
+
+	release.Open();
+	pool.Cancel(blocker);
+	Poll(loop);
+
+	EXPECT_EQ(job.n_run, 0u);
+	EXPECT_EQ(job.n_done, 0u);
+	EXPECT_EQ(job2.n_run, 0u);
+	EXPECT_EQ(job2.n_done, 0u);
+	EXPECT_EQ(blocker.n_run, 1u);
+	EXPECT_EQ(blocker.n_done, 0u);
+}
+
+TEST(WorkerPool, CancelRunning)
+{
+	EventLoop loop;
+	WorkerPool pool(1);
+
+	Gate started, release;
+	std::atomic<bool> finished{false};
+	TestJob job(loop, [&]{
+		started.Open();
+		release.Wait();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		finished = true;
+	});
+	pool.Submit(job);
+	started.Wait();
+
+	std::thread releaser([&]{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		release.Open();
+	});
+
+	/* this blocks until Run() has returned */
+	pool.Cancel(job);
+	EXPECT_TRUE(finished);
+	releaser.join();
+
+	Poll(loop);
+	EXPECT_EQ(job.n_run, 1u);
+	EXPECT_EQ(job.n_done, 0u);
+}
+
+TEST(WorkerPool, CancelDone)
+{
+	EventLoop loop;
+	WorkerPool pool(1);
+
+	/* the second job runs on the same thread after the first one
+	   has been marked DONE */
+	TestJob job(loop, nullptr);
+	Gate started;
+	TestJob barrier(loop, [&]{ started.Open(); });
+	pool.Submit(job);
+	pool.Submit(barrier);
+	started.Wait();
+
+	/* the job has finished, but its OnDone() call is still
+	   pending in the EventLoop */
+	EXPECT_EQ(job.n_run, 1u);
+	pool.Cancel(job);
+	pool.Cancel(barrier);
+
+	Poll(loop);
+	EXPECT_EQ(job.n_done, 0u);
+	EXPECT_EQ(barrier.n_done, 0u);
+
+	/* it can be submitted again */
+	unsigned n_done = 0;
+	TestJob again(loop, nullptr, &n_done, 1);
+	pool.Submit(again);
+	loop.Dispatch();
+	EXPECT_EQ(again.n_done, 1u);
+}
+
+TEST(WorkerPool, NestedSubmit)
+{
+	EventLoop loop;
+	WorkerPool pool(4);
+
+	unsigned n_done = 0;
+	TestJob child(loop, nullptr, &n_done, 2);
+	TestJob parent(loop, [&]{ pool.Submit(child); }, &n_done, 2);
+
+	pool.Submit(parent);
+	loop.Dispatch();
+
+	EXPECT_EQ(parent.n_done, 1u);
+	EXPECT_EQ(child.n_done, 1u);
+
+	/* a job submitted from a worker thread goes to that thread's
+	   queue; stealing is possible, but unlikely with idle
+	   workers */
+	EXPECT_NE(child.run_thread, std::this_thread::get_id());
+}
+
+TEST(WorkerPool, Shutdown)
+{
+	EventLoop loop;
+
+	Gate started, release;
+	TestJob blocker(loop, [&]{ started.Open(); release.Wait(); });
+
+	std::vector<std::unique_ptr<TestJob>> queued;
+	for (unsigned i = 0; i < 10; ++i)
+		queued.emplace_back(new TestJob(loop, nullptr));
+
+	{
+		WorkerPool pool(1);
+		pool.Submit(blocker);
+		started.Wait();
+
+		for (auto &job : queued)
+			pool.Submit(*job);
+
+		/* cancel everything, then destroy the pool; its
+		   destructor joins the threads */
+		for (auto &job : queued)
+			pool.Cancel(*job);
+
+		release.Open();
+		pool.Cancel(blocker);
+	}
+
+	Poll(loop);
+
+	for (const auto &job : queued) {
+		EXPECT_EQ(job->n_run, 0u);
+		EXPECT_EQ(job->n_done, 0u);
+	}
+
+	EXPECT_EQ(blocker.n_run, 1u);
+	EXPECT_EQ(blocker.n_done, 0u);
+
+	/* an idle pool shuts down, too */
+	WorkerPool idle(8);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "http/List.hxx"
+#include "http/Date.hxx"
+
+#include <benchmark/benchmark.h>
+
+static void
+HttpListContains(benchmark::State &state)
+{
+    static constexpr char list[] = "gzip, deflate, br, \"quoted\", identity";
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(http_list_contains(list, "identity"));
+        benchmark::DoNotOptimize(http_list_contains(list, "compress"));
+    }
+
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+static void
+HttpDateFormat(benchmark::State &state)
+{
+    const auto now = std::chrono::system_clock::now();
+    char buffer[64];
+
+    for (auto _ : state) {
+        http_date_format_r(buffer, now);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void
+HttpDateParse(benchmark::State &state)
+{
+    for (auto _ : state)
+        benchmark::DoNotOptimize(http_date_parse("Sun, 06 Nov 1994 08:49:37 GMT"));
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(HttpListContains);
+BENCHMARK(HttpDateFormat);
+BENCHMARK(HttpDateParse);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "http/ChunkParser.hxx"
+#include "http/ChunkEncoder.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+
+/**
+ * Feed the input to the parser in pieces of the given size and
+ * return the decoded payload; the input which is left after the end
+ * is appended to #rest.
+ */
+static std::string
+Decode(const std::string &input, size_t step, std::string &rest)
+{
+    HttpChunkParser parser;
+    std::string result;
+
+    /* emulate an input buffer which receives #step bytes at a
+       time */
+    std::string buffer;
+    size_t position = 0;
+
+    while (!parser.HasEnded()) {
+        if (position < input.size()) {
+            buffer.append(input, position, step);
+            position += step;
+        } else if (buffer.empty())
+            throw std::runtime_error("Premature end");
+
+        const ConstBuffer<void> b(buffer.data(), buffer.size());
+        const auto payload = parser.Parse(b);
+        size_t consumed = (const char *)payload.data - buffer.data();
+
+        if (!payload.empty()) {
+            /* the payload points into the input buffer */
+            EXPECT_GE(payload.data, (const void *)buffer.data());
+            EXPECT_LE((const char *)payload.data + payload.size,
+                      buffer.data() + buffer.size());
+
+            /* consume only part of it sometimes */
+            const size_t n = payload.size > 3 && step == 1
+                ? payload.size / 2
+                : payload.size;
+            result.append((const char *)payload.data, n);
+            parser.Consume(n);
+            consumed += n;
+        } else if (consumed == 0 && !parser.HasEnded() &&
+                   position >= input.size())
+            throw std::runtime_error("Premature end");
+
+        buffer.erase(0, consumed);
+    }
+
+    rest = buffer;
+    if (position < input.size())
+        rest.append(input, position, std::string::npos);
+
+    return result;
+}
+
+static std::string
+Decode(const std::string &input, size_t step=4096)
+{
+    std::string rest;
+    return Decode(input, step, rest);
+}
+
+TEST(HttpChunkedTest, Parse)
+{
+    const std::string input = "5\r\nhello\r\n"
+        "1;ext=\"x\"\r\n \r\n"
+        "00a\r\n0123456789\r\n"
+        "0\r\n\r\n"
+        "NEXT";
+
+    for (size_t step : {1, 2, 3, 7, 4096}) {
+        std::string rest;
+        EXPECT_EQ(Decode(input, step, rest), "hello 0123456789");
+        EXPECT_EQ(rest, "NEXT");
+    }
+}
+
+TEST(HttpChunkedTest, Trailer)
+{
+    EXPECT_EQ(Decode("3\nabc\n0\nFoo: bar\r\nX: y\n\r\n"), "abc");
+    EXPECT_EQ(Decode("0\r\n\r\n"), "");
+}
+
+TEST(HttpChunkedTest, Malformed)
+{
+    EXPECT_THROW(Decode("x\r\n"), std::runtime_error);
+    EXPECT_THROW(Decode("3\r\nabcX\r\n0\r\n\r\n"), std::runtime_error);
+    EXPECT_THROW(Decode("0\r\n\rX"), std::runtime_error);
+    EXPECT_THROW(Decode("fffffffffffffffff\r\n"), std::runtime_error);
+    EXPECT_THROW(Decode("3\r\nab"), std::runtime_error);
+}
+
+/**
+ * Emulate a socket which accepts at most #max bytes per writev().
+ */
+static std::string
+Write(HttpChunkEncoder &encoder, size_t max)
+{
+    std::string output;
+
+    while (true) {
+        const auto v = encoder.Get();
+
+        size_t n = 0;
+        for (const auto &i : v) {
+            const size_t chunk = std::min(i.iov_len, max - n);
+            output.append((const char *)i.iov_base, chunk);
+            n += chunk;
+            if (n == max)
+                break;
+        }
+
+        if (encoder.Consume(n))
+            return output;
+    }
+}
+
+TEST(HttpChunkedTest, Encode)
+{
+    for (size_t max : {1, 5, 4096}) {
+        HttpChunkEncoder encoder;
+        EXPECT_TRUE(encoder.IsEmpty());
+
+        const std::string a = "hello", b = " world";
+        encoder.Append({a.data(), a.size()});
+        encoder.Append(nullptr);
+        encoder.Append({b.data(), b.size()});
+        EXPECT_FALSE(encoder.IsEmpty());
+
+        /* the payload is not copied */
+        const auto v = encoder.Get();
+        ASSERT_EQ(v.size, 4u);
+        EXPECT_EQ(v[1].iov_base, a.data());
+        EXPECT_EQ(v[2].iov_base, b.data());
+
+        std::string output = Write(encoder, max);
+        EXPECT_TRUE(encoder.IsEmpty());
+        EXPECT_TRUE(encoder.CanAppend());
+
+        const std::string c(300, 'x');
+        encoder.Append({c.data(), c.size()});
+        encoder.AppendEnd();
+        EXPECT_FALSE(encoder.CanAppend());
+        output += Write(encoder, max);
+
+        /* only the end */
+        encoder.AppendEnd();
+        EXPECT_EQ(Write(encoder, max), "0\r\n\r\n");
+
+        EXPECT_EQ(output, "b\r\nhello world\r\n12c\r\n" + c + "\r\n0\r\n\r\n");
+
+        std::string rest;
+        EXPECT_EQ(Decode(output, 3, rest), "hello world" + c);
+        EXPECT_TRUE(rest.empty());
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../AllocationCounter.hxx"
+#include "http/Date.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+static std::chrono::system_clock::time_point
+FromTime(time_t t)
+{
+    return std::chrono::system_clock::from_time_t(t);
+}
+
+TEST(HttpDateTest, Format)
+{
+    char buffer[30];
+    http_date_format_r(buffer, FromTime(0));
+    ASSERT_STREQ(buffer, "Thu, 01 Jan 1970 00:00:00 GMT");
+
+    http_date_format_r(buffer, FromTime(784111777));
+    ASSERT_STREQ(buffer, "Sun, 06 Nov 1994 08:49:37 GMT");
+
+    ASSERT_STREQ(http_date_format(FromTime(951782400)),
+                 "Tue, 29 Feb 2000 00:00:00 GMT");
+}
+
+TEST(HttpDateTest, Parse)
+{
+    ASSERT_EQ(http_date_parse("Thu, 01 Jan 1970 00:00:00 GMT"), FromTime(0));
+    ASSERT_EQ(http_date_parse("Sun, 06 Nov 1994 08:49:37 GMT"),
+              FromTime(784111777));
+    ASSERT_EQ(http_date_parse("Tue, 29 Feb 2000 00:00:00 GMT"),
+              FromTime(951782400));
+    ASSERT_EQ(http_date_parse("Fri, 31 Dec 2038 23:59:59 GMT"),
+              FromTime(2177452799));
+
+    ASSERT_EQ(http_date_parse(""), FromTime(-1));
+    ASSERT_EQ(http_date_parse("Sun, 06 Foo 1994 08:49:37 GMT"), FromTime(-1));
+    ASSERT_EQ(http_date_parse("Sun, 06 Nov 1994 24:49:37 GMT"), FromTime(-1));
+    ASSERT_EQ(http_date_parse("Sun, 00 Nov 1994 08:49:37 GMT"), FromTime(-1));
+}
+
+TEST(HttpDateTest, Cache)
+{
+    HttpDateCache cache;
+
+    const auto t = FromTime(784111777);
+    const char *a = cache.Get(t);
+    ASSERT_STREQ(a, "Sun, 06 Nov 1994 08:49:37 GMT");
+
+    /* same second: same buffer, same contents */
+    ASSERT_EQ(cache.Get(t + std::chrono::milliseconds(500)), a);
+    ASSERT_STREQ(a, "Sun, 06 Nov 1994 08:49:37 GMT");
+
+    ASSERT_STREQ(cache.Get(t + std::chrono::seconds(1)),
+                 "Sun, 06 Nov 1994 08:49:38 GMT");
+}
+
+TEST(HttpDateTest, ParserCache)
+{
+    HttpDateParserCache cache;
+
+    ASSERT_EQ(cache.Parse("Sun, 06 Nov 1994 08:49:37 GMT"),
+              FromTime(784111777));
+    ASSERT_EQ(cache.Parse("Sun, 06 Nov 1994 08:49:37 GMT"),
+              FromTime(784111777));
+    ASSERT_EQ(cache.Parse("Thu, 01 Jan 1970 00:00:00 GMT"), FromTime(0));
+    ASSERT_EQ(cache.Parse(""), FromTime(-1));
+}
+
+TEST(HttpDateTest, NoAllocation)
+{
+    /* warm up the thread-local buffer */
+    http_date_format(FromTime(0));
+
+    EXPECT_NO_ALLOCATION({
+        char buffer[30];
+        http_date_format_r(buffer, FromTime(784111777));
+        http_date_format(FromTime(951782400));
+        EXPECT_EQ(http_date_parse("Sun, 06 Nov 1994 08:49:37 GMT"),
+                  FromTime(784111777));
+    });
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "http/HeadParser.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <string.h>
+
+typedef HttpHeadParser::Result Result;
+
+static constexpr char request[] =
+    "\r\n"
+    "GET /foo?bar HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Accept-Encoding:gzip, br  \r\n"
+    "x-custom: \t 42\n"
+    "Empty:\r\n"
+    "\r\n"
+    "body";
+
+static void
+CheckRequest(const HttpHeadParser &p)
+{
+    ASSERT_EQ(p.GetResult(), Result::DONE);
+    ASSERT_EQ(p.GetHeadSize(), sizeof(request) - 1 - 4);
+    ASSERT_EQ(p.GetMethod(), HTTP_METHOD_GET);
+    ASSERT_TRUE(p.GetUri().Equals("/foo?bar"));
+    ASSERT_EQ(p.GetMinorVersion(), 1u);
+
+    ASSERT_EQ(p.GetHeaderCount(), 4u);
+    ASSERT_TRUE(p.GetHeaderName(0).Equals("Host"));
+    ASSERT_EQ(p.GetHeader(0), HttpHeader::HOST);
+    ASSERT_TRUE(p.Get(HttpHeader::HOST).Equals("example.com"));
+    ASSERT_TRUE(p.Get(HttpHeader::ACCEPT_ENCODING).Equals("gzip, br"));
+    ASSERT_TRUE(p.Get("X-Custom").Equals("42"));
+    ASSERT_EQ(p.GetHeader(2), HttpHeader::UNKNOWN);
+    ASSERT_TRUE(p.Get("empty").empty());
+    ASSERT_FALSE(p.Get("empty").IsNull());
+    ASSERT_TRUE(p.Get("foo").IsNull());
+    ASSERT_TRUE(p.Get(HttpHeader::COOKIE).IsNull());
+}
+
+TEST(HttpHeadParserTest, Request)
+{
+    HttpHeadParser p(HttpHeadParser::Mode::REQUEST);
+    ASSERT_EQ(p.Feed(request, sizeof(request) - 1), Result::DONE);
+    CheckRequest(p);
+}
+
+TEST(HttpHeadParserTest, Incremental)
+{
+    /* feed one byte at a time, copying to a new buffer each time
+       to verify that only offsets are stored */
+    HttpHeadParser p(HttpHeadParser::Mode::REQUEST);
+
+    std::string buffer;
+    Result result = Result::MORE;
+    for (size_t i = 0; i < sizeof(request) - 1; ++i) {
+        buffer = std::string(request, i + 1);
+        result = p.Feed(buffer.data(), buffer.size());
+        if (result != Result::MORE)
+            break;
+    }
+
+    ASSERT_EQ(result, Result::DONE);
+    CheckRequest(p);
+}
+
+TEST(HttpHeadParserTest, Response)
+{
+    static constexpr char response[] =
+        "HTTP/1.0 404 Not Found\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n";
+
+    HttpHeadParser p(HttpHeadParser::Mode::RESPONSE);
+    ASSERT_EQ(p.Feed(response, sizeof(response) - 1), Result::DONE);
+    ASSERT_EQ(p.GetHeadSize(), sizeof(response) - 1);
+    ASSERT_EQ(p.GetStatus(), HTTP_STATUS_NOT_FOUND);
+    ASSERT_TRUE(p.GetReason().Equals("Not Found"));
+    ASSERT_EQ(p.GetMinorVersion(), 0u);
+    ASSERT_TRUE(p.Get(HttpHeader::CONTENT_LENGTH).Equals("0"));
+
+    HttpHeadParser p2(HttpHeadParser::Mode::RESPONSE);
+    ASSERT_EQ(p2.Feed("HTTP/1.1 204\r\n\r\n", 16), Result::DONE);
+    ASSERT_EQ(p2.GetStatus(), HTTP_STATUS_NO_CONTENT);
+    ASSERT_TRUE(p2.GetReason().empty());
+}
+
+TEST(HttpHeadParserTest, UnknownMethod)
+{
+    static constexpr char s[] = "BREW /pot HTTP/1.1\r\n\r\n";
+
+    HttpHeadParser p(HttpHeadParser::Mode::REQUEST);
+    ASSERT_EQ(p.Feed(s, sizeof(s) - 1), Result::DONE);
+    ASSERT_EQ(p.GetMethod(), HTTP_METHOD_INVALID);
+    ASSERT_TRUE(p.GetUri().Equals("/pot"));
+}
+
+static Result
+Parse(HttpHeadParser::Mode mode, const char *s)
+{
+    HttpHeadParser p(mode);
+    return p.Feed(s, strlen(s));
+}
+
+TEST(HttpHeadParserTest, Malformed)
+{
+    static constexpr auto REQUEST = HttpHeadParser::Mode::REQUEST;
+    static constexpr auto RESPONSE = HttpHeadParser::Mode::RESPONSE;
+
+    ASSERT_EQ(Parse(REQUEST, "GET / HTTP/1.1\r\nHost: foo"), Result::MORE);
+    ASSERT_EQ(Parse(REQUEST, "GET / HTTP/2.0\r\n\r\n"), Result::ERROR);
+    ASSERT_EQ(Parse(REQUEST, "GET /\r\n\r\n"), Result::ERROR);
+    ASSERT_EQ(Parse(REQUEST, "GET  HTTP/1.1\r\n\r\n"), Result::ERROR);
+    ASSERT_EQ(Parse(REQUEST, "GET / HTTP/1.1\r\nHost : foo\r\n\r\n"),
+              Result::ERROR);
+    ASSERT_EQ(Parse(REQUEST, "GET / HTTP/1.1\r\nHost: foo\r\n bar\r\n\r\n"),
+              Result::ERROR);
+    ASSERT_EQ(Parse(REQUEST, "GET / HTTP/1.1\r\nno colon\r\n\r\n"),
+              Result::ERROR);
+    ASSERT_EQ(Parse(RESPONSE, "\r\n"), Result::ERROR);
+    ASSERT_EQ(Parse(RESPONSE, "HTTP/1.1 20x OK\r\n\r\n"), Result::ERROR);
+    ASSERT_EQ(Parse(RESPONSE, "HTTP/1.1 200OK\r\n\r\n"), Result::ERROR);
+    ASSERT_EQ(Parse(RESPONSE, "HTTP/1.1 099 Foo\r\n\r\n"), Result::ERROR);
+
+    const std::string huge = "GET / HTTP/1.1\r\nX-Foo: " +
+        std::string(HttpHeadParser::MAX_HEAD_SIZE, 'a');
+    ASSERT_EQ(Parse(REQUEST, huge.c_str()), Result::ERROR);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "http/HeaderName.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <ctype.h>
+
+TEST(HttpHeaderNameTest, Lookup)
+{
+    ASSERT_EQ(http_header_lookup("host"), HttpHeader::HOST);
+    ASSERT_EQ(http_header_lookup("Host"), HttpHeader::HOST);
+    ASSERT_EQ(http_header_lookup("CONTENT-TYPE"), HttpHeader::CONTENT_TYPE);
+    ASSERT_EQ(http_header_lookup("Content-Security-Policy-Report-Only"),
+              HttpHeader::CONTENT_SECURITY_POLICY_REPORT_ONLY);
+    ASSERT_EQ(http_header_lookup("X-XSS-Protection"),
+              HttpHeader::X_XSS_PROTECTION);
+
+    ASSERT_EQ(http_header_lookup(""), HttpHeader::UNKNOWN);
+    ASSERT_EQ(http_header_lookup("hos"), HttpHeader::UNKNOWN);
+    ASSERT_EQ(http_header_lookup("hostx"), HttpHeader::UNKNOWN);
+    ASSERT_EQ(http_header_lookup("x-foo"), HttpHeader::UNKNOWN);
+    ASSERT_EQ(http_header_lookup("content-security-policy-report-only-x"),
+              HttpHeader::UNKNOWN);
+    ASSERT_EQ(http_header_lookup("\xc8ost"), HttpHeader::UNKNOWN);
+}
+
+TEST(HttpHeaderNameTest, All)
+{
+    ASSERT_EQ(http_header_name(HttpHeader::UNKNOWN), nullptr);
+
+    for (size_t i = 1; i < HTTP_HEADER_COUNT; ++i) {
+        const auto header = HttpHeader(i);
+        const char *name = http_header_name(header);
+        ASSERT_NE(name, nullptr);
+        ASSERT_EQ(http_header_lookup(name), header);
+
+        std::string upper(name);
+        for (auto &ch : upper)
+            ch = toupper(ch);
+        ASSERT_EQ(http_header_lookup(upper.c_str()), header);
+    }
+}
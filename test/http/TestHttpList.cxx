@@ -46,3 +46,41 @@ TEST(HttpListTest, Contains)
     ASSERT_TRUE(http_list_contains("\"bar\",\"foo\"", "\"bar\""));
     ASSERT_TRUE(http_list_contains("\"bar\",\"foo\"", "bar"));
 }
+
+TEST(HttpListTest, Quoted)
+{
+    ASSERT_TRUE(http_list_contains("\"a,b\",foo", "foo"));
+    ASSERT_TRUE(http_list_contains("\"a,b\",foo", "a,b"));
+    ASSERT_TRUE(!http_list_contains("\"a,b\",foo", "a"));
+}
+
+TEST(HttpListTest, Tokenizer)
+{
+    HttpListTokenizer t(" gzip , \"x,y\",,deflate;q=0.5, a very long element of more than sixteen characters ");
+
+    StringView element;
+    ASSERT_TRUE(t.Next(element));
+    ASSERT_TRUE(element.Equals("gzip"));
+    ASSERT_TRUE(t.Next(element));
+    ASSERT_TRUE(element.Equals("x,y"));
+    ASSERT_TRUE(t.Next(element));
+    ASSERT_TRUE(element.empty());
+    ASSERT_TRUE(t.Next(element));
+    ASSERT_TRUE(element.Equals("deflate;q=0.5"));
+    ASSERT_TRUE(t.Next(element));
+    ASSERT_TRUE(element.Equals("a very long element of more than sixteen characters"));
+    ASSERT_FALSE(t.Next(element));
+}
+
+TEST(HttpListTest, Matcher)
+{
+    const HttpListMatcher m{"close", "keep-alive", "upgrade", "gzip", "br"};
+
+    ASSERT_EQ(m.Match(""), 0u);
+    ASSERT_EQ(m.Match("foo, bar"), 0u);
+    ASSERT_EQ(m.Match("close"), 0x1u);
+    ASSERT_EQ(m.Match("Keep-Alive, Upgrade"), 0x6u);
+    ASSERT_EQ(m.Match("br,gzip,deflate,close"), 0x19u);
+    ASSERT_EQ(m.Match("gzipx, xbr"), 0u);
+    ASSERT_EQ(m.MatchElement("GZIP"), 0x8u);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "http/Negotiate.hxx"
+
+#include <gtest/gtest.h>
+
+TEST(HttpNegotiateTest, QValue)
+{
+    ASSERT_EQ(http_parse_qvalue("1"), 1000);
+    ASSERT_EQ(http_parse_qvalue("1.000"), 1000);
+    ASSERT_EQ(http_parse_qvalue("0"), 0);
+    ASSERT_EQ(http_parse_qvalue("0.5"), 500);
+    ASSERT_EQ(http_parse_qvalue(" 0.125"), 125);
+    ASSERT_EQ(http_parse_qvalue("0."), 0);
+    ASSERT_EQ(http_parse_qvalue("1.5"), -1);
+    ASSERT_EQ(http_parse_qvalue("0.1234"), -1);
+    ASSERT_EQ(http_parse_qvalue("2"), -1);
+    ASSERT_EQ(http_parse_qvalue(""), -1);
+    ASSERT_EQ(http_parse_qvalue("0,5"), -1);
+}
+
+TEST(HttpNegotiateTest, Encoding)
+{
+    enum { BR, GZIP };
+    HttpNegotiator n{"br", "gzip"};
+
+    ASSERT_EQ(n.Select(""), -1);
+    ASSERT_EQ(n.Select("deflate"), -1);
+    ASSERT_EQ(n.Select("gzip"), GZIP);
+    ASSERT_EQ(n.Select("gzip, deflate, br"), BR);
+
+    /* ties are resolved by the order of preference */
+    ASSERT_EQ(n.Select("gzip;q=0.8, br;q=0.8"), BR);
+
+    /* q-values */
+    ASSERT_EQ(n.Select("gzip;q=1.0, br;q=0.5"), GZIP);
+    ASSERT_EQ(n.Select("GZIP ; Q=0.9, br;q=0"), GZIP);
+    ASSERT_EQ(n.Select("gzip;q=0, br;q=0"), -1);
+
+    /* malformed elements are ignored */
+    ASSERT_EQ(n.Select("br;q=2, gzip;q=0.1"), GZIP);
+
+    /* wildcard */
+    ASSERT_EQ(n.Select("*"), BR);
+    ASSERT_EQ(n.Select("*;q=0.5, gzip"), GZIP);
+    ASSERT_EQ(n.Select("br;q=0, *"), GZIP);
+    ASSERT_EQ(n.Select("*;q=0"), -1);
+
+    /* only available tokens are chosen */
+    ASSERT_EQ(n.Select("gzip, br", 1u << GZIP), GZIP);
+    ASSERT_EQ(n.Select("br", 1u << GZIP), -1);
+}
+
+TEST(HttpNegotiateTest, Cache)
+{
+    HttpNegotiator n{"br", "gzip"};
+
+    const auto a = n.Get("gzip;q=0.5, br;q=0.25");
+    ASSERT_EQ(a[0], 250);
+    ASSERT_EQ(a[1], 500);
+
+    /* cache hit */
+    const auto b = n.Get("gzip;q=0.5, br;q=0.25");
+    ASSERT_EQ(a, b);
+
+    /* a long value is not cached, but still parsed */
+    std::string s(1000, ' ');
+    s += "gzip";
+    ASSERT_EQ(n.Select({s.data(), s.size()}), 1);
+
+    n.Clear();
+    ASSERT_EQ(n.Get("br")[0], 1000);
+}
+
+TEST(HttpNegotiateTest, Language)
+{
+    enum { DE, EN_US, EN_GB };
+    HttpNegotiator n{"de", "en-US", "en-GB"};
+    HttpNegotiator ranges({"de", "en-US", "en-GB"}, true);
+
+    ASSERT_EQ(n.Select("en"), -1);
+    ASSERT_EQ(ranges.Select("en"), EN_US);
+    ASSERT_EQ(ranges.Select("en-gb, en;q=0.8, de;q=0.9"), EN_GB);
+
+    /* the most specific range wins */
+    ASSERT_EQ(ranges.Select("en-us;q=0.1, en;q=0.8, de;q=0.5"), EN_GB);
+    ASSERT_EQ(ranges.Select("e"), -1);
+    ASSERT_EQ(ranges.Select("*;q=0.1, de;q=0"), EN_US);
+}
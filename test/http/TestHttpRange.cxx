@@ -0,0 +1,153 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "http/Range.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+typedef HttpRangeRequest::Type Type;
+
+static std::string
+ToString(const HttpMultiRangeRequest &r)
+{
+    std::string result;
+    for (const auto &i : r.ranges) {
+        if (!result.empty())
+            result += ',';
+        result += std::to_string(i.start) + '-' + std::to_string(i.end);
+    }
+
+    return result;
+}
+
+static std::string
+Parse(const char *header, uint64_t size, Type expected_type=Type::VALID)
+{
+    HttpMultiRangeRequest r(size);
+    r.ParseRangeHeader(header);
+    EXPECT_EQ(r.type, expected_type) << header;
+    return ToString(r);
+}
+
+TEST(HttpRangeTest, Single)
+{
+    HttpRangeRequest r(1000);
+    r.ParseRangeHeader("bytes=100-199");
+    ASSERT_EQ(r.type, Type::VALID);
+    ASSERT_EQ(r.skip, 100u);
+    ASSERT_EQ(r.size, 200u);
+}
+
+TEST(HttpRangeTest, Multi)
+{
+    ASSERT_EQ(Parse("bytes=0-99", 1000), "0-100");
+    ASSERT_EQ(Parse("bytes=0-99,500-599", 1000), "0-100,500-600");
+    ASSERT_EQ(Parse("bytes=500-599, 0-99", 1000), "0-100,500-600");
+    ASSERT_EQ(Parse("bytes=-100", 1000), "900-1000");
+    ASSERT_EQ(Parse("bytes=-2000", 1000), "0-1000");
+    ASSERT_EQ(Parse("bytes=900-", 1000), "900-1000");
+    ASSERT_EQ(Parse("bytes=900-5000", 1000), "900-1000");
+
+    /* unsatisfiable ranges are skipped */
+    ASSERT_EQ(Parse("bytes=2000-2999,0-0", 1000), "0-1");
+    ASSERT_EQ(Parse("bytes=2000-2999", 1000, Type::INVALID), "");
+    ASSERT_EQ(Parse("bytes=-0", 1000, Type::INVALID), "");
+}
+
+TEST(HttpRangeTest, Coalesce)
+{
+    ASSERT_EQ(Parse("bytes=0-99,50-149", 1000), "0-150");
+    ASSERT_EQ(Parse("bytes=0-99,100-199", 1000), "0-200");
+    ASSERT_EQ(Parse("bytes=0-999,100-199,-10", 1000), "0-1000");
+    ASSERT_EQ(Parse("bytes=300-399,0-9,5-20,200-299", 1000), "0-21,200-400");
+}
+
+TEST(HttpRangeTest, Malformed)
+{
+    Parse("", 1000, Type::INVALID);
+    Parse("bytes=", 1000, Type::INVALID);
+    Parse("items=0-99", 1000, Type::INVALID);
+    Parse("bytes=foo", 1000, Type::INVALID);
+    Parse("bytes=99-0", 1000, Type::INVALID);
+    Parse("bytes=0-99;", 1000, Type::INVALID);
+    Parse("bytes=0-99,x", 1000, Type::INVALID);
+    Parse("bytes=99999999999999999999-", 1000, Type::INVALID);
+}
+
+TEST(HttpRangeTest, TooMany)
+{
+    std::string header = "bytes=0-0";
+    for (unsigned i = 1; i <= HttpMultiRangeRequest::MAX_RANGES; ++i)
+        header += ',' + std::to_string(i * 2) + '-' + std::to_string(i * 2);
+
+    /* the header is ignored */
+    ASSERT_EQ(Parse(header.c_str(), 1000, Type::NONE), "");
+}
+
+TEST(HttpRangeTest, Plan)
+{
+    HttpMultiRangeRequest r(1000);
+    r.ParseRangeHeader("bytes=0-9,-10");
+    ASSERT_TRUE(r.IsMultipart());
+
+    const HttpByteRangesPlan plan(r, "text/plain", "XYZ");
+    const auto &segments = plan.GetSegments();
+    ASSERT_EQ(segments.size(), 5u);
+
+    ASSERT_FALSE(segments[0].file);
+    ASSERT_TRUE(plan.GetData(segments[0]).Equals("--XYZ\r\n"
+                                                 "Content-Type: text/plain\r\n"
+                                                 "Content-Range: bytes 0-9/1000\r\n"
+                                                 "\r\n"));
+    ASSERT_TRUE(segments[1].file);
+    ASSERT_EQ(segments[1].offset, 0u);
+    ASSERT_EQ(segments[1].length, 10u);
+
+    ASSERT_FALSE(segments[2].file);
+    ASSERT_TRUE(plan.GetData(segments[2]).Equals("\r\n--XYZ\r\n"
+                                                 "Content-Type: text/plain\r\n"
+                                                 "Content-Range: bytes 990-999/1000\r\n"
+                                                 "\r\n"));
+    ASSERT_TRUE(segments[3].file);
+    ASSERT_EQ(segments[3].offset, 990u);
+    ASSERT_EQ(segments[3].length, 10u);
+
+    ASSERT_FALSE(segments[4].file);
+    ASSERT_TRUE(plan.GetData(segments[4]).Equals("\r\n--XYZ--\r\n"));
+
+    uint64_t total = 0;
+    for (const auto &i : segments)
+        total += i.length;
+    ASSERT_EQ(plan.GetContentLength(), total);
+}
@@ -0,0 +1,281 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "io/AsyncLogger.hxx"
+#include "io/Logger.hxx"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/uio.h>
+
+namespace {
+
+class MemoryOutput final : public AsyncLoggerOutput {
+    std::mutex mutex;
+    std::vector<std::string> records;
+
+public:
+    std::vector<std::string> GetRecords() {
+        const std::lock_guard<std::mutex> lock(mutex);
+        return records;
+    }
+
+    void WriteRecords(const struct iovec *v, size_t n) noexcept override {
+        const std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < n; ++i)
+            records.emplace_back((const char *)v[i].iov_base,
+                                 v[i].iov_len);
+    }
+};
+
+}
+
+TEST(AsyncLogger, Basic)
+{
+    MemoryOutput output;
+    AsyncLogger logger(output);
+    logger.Start();
+    logger.Install();
+
+    LLogger ll("foo");
+    ll(1, "hello ", 42);
+    RootLogger()(1, "bar");
+    ll(5, "invisible");
+
+    logger.Uninstall();
+    logger.Stop();
+
+    const auto records = output.GetRecords();
+    ASSERT_EQ(records.size(), 2u);
+    ASSERT_EQ(records[0], "[foo] hello 42\n");
+    ASSERT_EQ(records[1], "bar\n");
+
+    ASSERT_EQ(logger.GetStats().written, 2u);
+    ASSERT_EQ(logger.GetStats().dropped, 0u);
+}
+
+TEST(AsyncLogger, Deferred)
+{
+    MemoryOutput output;
+    AsyncLogger logger(output);
+    logger.Install();
+
+    LLogger ll("foo");
+
+    {
+        /* the string is copied, the writer thread sees the old
+           value */
+        std::string s = "copied";
+        char buffer[] = "buffer";
+        ll.FormatDeferred(1, "%s %d %s %u %s %s %.1f %c", s, -3, "literal",
+                          42u, buffer, (const char *)nullptr, 1.5, 'x');
+        s = "overwritten";
+        buffer[0] = 'X';
+    }
+
+    RootLogger().FormatDeferred(1, "no arguments");
+    ll.FormatDeferred(5, "invisible %d", 1);
+
+    /* the string arguments are truncated */
+    const std::string big(5000, 'x');
+    ll.FormatDeferred(1, "%s|%s|", big, "y");
+
+    logger.Uninstall();
+    logger.Start();
+    logger.Stop();
+
+    const auto records = output.GetRecords();
+    ASSERT_EQ(records.size(), 3u);
+    ASSERT_EQ(records[0],
+              "[foo] copied -3 literal 42 buffer (null) 1.5 x\n");
+    ASSERT_EQ(records[1], "no arguments\n");
+    ASSERT_EQ(records[2],
+              "[foo] " + std::string(LoggerDetail::MAX_DEFERRED_STRINGS - 2, 'x') + "||\n");
+}
+
+TEST(AsyncLogger, CompileTimeLevel)
+{
+    MemoryOutput output;
+    AsyncLogger logger(output);
+    logger.Install();
+
+    SetLogLevel(10);
+
+    struct Domain {
+        StringView GetDomain() const {
+            return "d";
+        }
+    };
+
+    const BasicLogger<Domain, 2> l;
+    ASSERT_TRUE(l.CheckLevel(2));
+    ASSERT_FALSE(l.CheckLevel(3));
+
+    l(2, "a");
+    l(3, "b");
+    l.Log<1>("c");
+    l.Log<9>("d");
+    l.Format(3, "%s", "e");
+    l.FormatDeferred(3, "%s", "f");
+    l.FormatDeferred(2, "%s", "g");
+
+    SetLogLevel(1);
+
+    logger.Uninstall();
+    logger.Start();
+    logger.Stop();
+
+    const auto records = output.GetRecords();
+    ASSERT_EQ(records.size(), 3u);
+    ASSERT_EQ(records[0], "[d] a\n");
+    ASSERT_EQ(records[1], "[d] c\n");
+    ASSERT_EQ(records[2], "[d] g\n");
+}
+
+TEST(AsyncLogger, Truncate)
+{
+    MemoryOutput output;
+    AsyncLogger logger(output);
+
+    const std::string big(10000, 'x');
+    const StringView v(big.data(), big.size());
+    ASSERT_TRUE(logger.Push(nullptr, {&v, 1}));
+
+    logger.Start();
+    logger.Stop();
+
+    const auto records = output.GetRecords();
+    ASSERT_EQ(records.size(), 1u);
+    ASSERT_EQ(records[0].size(), 4096u);
+    ASSERT_EQ(records[0].back(), '\n');
+}
+
+TEST(AsyncLogger, Dropped)
+{
+    MemoryOutput output;
+    AsyncLogger logger(output);
+
+    /* the writer thread is not running yet, so the ring buffer
+       fills up */
+    const StringView v("some log message with a few bytes");
+    unsigned pushed = 0, n_dropped = 0;
+    for (unsigned i = 0; i < 10000; ++i) {
+        if (logger.Push("domain", {&v, 1}))
+            ++pushed;
+        else
+            ++n_dropped;
+    }
+
+    ASSERT_GT(pushed, 0u);
+    ASSERT_GT(n_dropped, 0u);
+    ASSERT_EQ(logger.GetStats().dropped, n_dropped);
+
+    logger.Start();
+    logger.Stop();
+
+    ASSERT_EQ(logger.GetStats().written, pushed);
+
+    /* the last record reports the dropped ones */
+    const auto records = output.GetRecords();
+    ASSERT_EQ(records.size(), pushed + 1);
+    ASSERT_EQ(records[0], "[domain] some log message with a few bytes\n");
+    ASSERT_EQ(records.back(),
+              "[AsyncLogger] " + std::to_string(n_dropped) +
+              " log records dropped\n");
+
+    /* after the ring buffer has been drained, there is room
+       again */
+    ASSERT_TRUE(logger.Push("domain", {&v, 1}));
+}
+
+TEST(AsyncLogger, Threads)
+{
+    MemoryOutput output;
+    AsyncLogger logger(output);
+    logger.Start();
+
+    constexpr unsigned N_THREADS = 4, N_RECORDS = 20000;
+
+    std::vector<std::thread> threads;
+    std::vector<unsigned> n_pushed(N_THREADS);
+    for (unsigned i = 0; i < N_THREADS; ++i)
+        threads.emplace_back([&logger, &n_pushed, i]{
+            const std::string domain = std::to_string(i);
+            for (unsigned j = 0; j < N_RECORDS; ++j) {
+                const std::string s = std::to_string(j);
+                const StringView v(s.data(), s.size());
+                if (logger.Push({domain.data(), domain.size()},
+                                {&v, 1}))
+                    ++n_pushed[i];
+                else
+                    /* give the writer thread a chance */
+                    std::this_thread::yield();
+            }
+        });
+
+    for (auto &t : threads)
+        t.join();
+
+    logger.Stop();
+
+    /* the records of each thread are in order */
+    std::map<std::string, int> last;
+    std::map<std::string, unsigned> count;
+    for (const auto &r : output.GetRecords()) {
+        if (r.compare(0, 14, "[AsyncLogger] ") == 0)
+            continue;
+
+        const auto space = r.find(' ');
+        ASSERT_NE(space, r.npos);
+        const std::string domain = r.substr(1, space - 2);
+        const int value = std::stoi(r.substr(space + 1));
+
+        auto i = last.emplace(domain, -1).first;
+        ASSERT_GT(value, i->second);
+        i->second = value;
+        ++count[domain];
+    }
+
+    unsigned total = 0;
+    for (unsigned i = 0; i < N_THREADS; ++i) {
+        ASSERT_EQ(count[std::to_string(i)], n_pushed[i]);
+        total += n_pushed[i];
+    }
+
+    ASSERT_EQ(logger.GetStats().written, total);
+}
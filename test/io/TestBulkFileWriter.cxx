@@ -0,0 +1,165 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "io/BulkFileWriter.hxx"
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace {
+
+class TempDirectory {
+    char path[64] = "/tmp/TestBulkFileWriter.XXXXXX";
+
+public:
+    TempDirectory() {
+        if (mkdtemp(path) == nullptr)
+            throw std::runtime_error("mkdtemp() failed");
+    }
+
+    ~TempDirectory() {
+        boost::filesystem::remove_all(path);
+    }
+
+    std::string operator/(const char *name) const {
+        return (boost::filesystem::path(path) / name).string();
+    }
+};
+
+static std::vector<unsigned char>
+ReadFile(const std::string &path)
+{
+    std::vector<unsigned char> result;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return result;
+
+    unsigned char buffer[65536];
+    size_t nbytes;
+    while ((nbytes = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        result.insert(result.end(), buffer, buffer + nbytes);
+
+    fclose(file);
+    return result;
+}
+
+static void
+WritePattern(BulkFileWriter &w, size_t total)
+{
+    unsigned char buffer[12345];
+    for (size_t position = 0; position < total;) {
+        const size_t n = std::min(sizeof(buffer), total - position);
+        for (size_t i = 0; i < n; ++i)
+            buffer[i] = (unsigned char)((position + i) * 7);
+        w.Write(buffer, n);
+        position += n;
+    }
+}
+
+static void
+CheckPattern(const std::vector<unsigned char> &data, size_t total)
+{
+    ASSERT_EQ(data.size(), total);
+    for (size_t i = 0; i < total; ++i)
+        ASSERT_EQ(data[i], (unsigned char)(i * 7)) << "offset " << i;
+}
+
+}
+
+TEST(BulkFileWriterTest, Plain)
+{
+    TempDirectory dir;
+    const auto path = dir / "plain";
+
+    constexpr size_t total = 3 * 1024 * 1024 + 17;
+
+    {
+        BulkFileWriter w(path.c_str(), 64 * 1024);
+        w.Allocate(total);
+        WritePattern(w, total);
+        w.Commit();
+    }
+
+    CheckPattern(ReadFile(path), total);
+}
+
+TEST(BulkFileWriterTest, DirectPace)
+{
+    TempDirectory dir;
+    const auto path = dir / "direct";
+
+    constexpr size_t total = 5 * 1024 * 1024 + 4321;
+
+    {
+        BulkFileWriter w(path.c_str(), 100 * 1000,
+                         BulkFileWriter::DIRECT|BulkFileWriter::PACE);
+        WritePattern(w, total);
+        w.Commit();
+    }
+
+    CheckPattern(ReadFile(path), total);
+}
+
+TEST(BulkFileWriterTest, Empty)
+{
+    TempDirectory dir;
+    const auto path = dir / "empty";
+
+    {
+        BulkFileWriter w(path.c_str());
+        w.Commit();
+    }
+
+    ASSERT_TRUE(boost::filesystem::exists(path));
+    ASSERT_EQ(boost::filesystem::file_size(path), 0u);
+}
+
+TEST(BulkFileWriterTest, Cancel)
+{
+    TempDirectory dir;
+    const auto path = dir / "cancel";
+
+    {
+        BulkFileWriter w(path.c_str(), 4096);
+        WritePattern(w, 100000);
+    }
+
+    ASSERT_FALSE(boost::filesystem::exists(path));
+    ASSERT_TRUE(boost::filesystem::is_empty(dir / ""));
+}
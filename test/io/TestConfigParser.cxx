@@ -105,3 +105,103 @@ TEST(ConfigParserTest, VariableConfigParser)
         ASSERT_STREQ(v_output[i], p[i].c_str());
     }
 }
+
+namespace {
+
+class TempDirectory {
+    char path[64] = "/tmp/TestConfigParser.XXXXXX";
+
+public:
+    TempDirectory() {
+        if (mkdtemp(path) == nullptr)
+            throw std::runtime_error("mkdtemp() failed");
+    }
+
+    ~TempDirectory() {
+        boost::filesystem::remove_all(path);
+    }
+
+    boost::filesystem::path operator/(const char *name) const {
+        return boost::filesystem::path(path) / name;
+    }
+
+    void Write(const char *name, const char *contents) const {
+        FILE *file = fopen((*this / name).c_str(), "w");
+        ASSERT_NE(file, nullptr);
+        fputs(contents, file);
+        fclose(file);
+    }
+};
+
+}
+
+TEST(ConfigParserTest, IncludeFile)
+{
+    TempDirectory dir;
+
+    std::string long_line = "\"";
+    long_line.append(8000, 'x');
+    long_line += "\"";
+
+    dir.Write("main.conf",
+              "# comment\n"
+              "\"a\"\n"
+              "\n"
+              "@include \"inc.conf\"\n"
+              "@include_optional \"missing.conf\"\n"
+              "@include \"glob*.conf\"\n"
+              "\"z\"");
+    dir.Write("inc.conf", ("\"b\"\n" + long_line + "\n").c_str());
+    dir.Write("glob1.conf", "\"c\"\n");
+    dir.Write("glob2.conf", "\"d\"\n");
+
+    ConfigFileCache cache;
+
+    for (unsigned i = 0; i < 2; ++i) {
+        MyConfigParser p;
+        CommentConfigParser c(p);
+        IncludeConfigParser include(dir / "main.conf", c, true,
+                                    &cache);
+        ParseConfigFile(dir / "main.conf", include, cache);
+
+        ASSERT_EQ(p.size(), 6u);
+        ASSERT_EQ(p[0], "a");
+        ASSERT_EQ(p[1], "b");
+        ASSERT_EQ(p[2], std::string(8000, 'x'));
+        ASSERT_EQ(p[3], "c");
+        ASSERT_EQ(p[4], "d");
+        ASSERT_EQ(p[5], "z");
+    }
+
+    ASSERT_EQ(cache.size(), 4u);
+
+    /* a modified file is reloaded */
+    dir.Write("glob2.conf", "\"D\"\n\"E\"\n");
+
+    MyConfigParser p;
+    CommentConfigParser c(p);
+    IncludeConfigParser include(dir / "main.conf", c, true, &cache);
+    ParseConfigFile(dir / "main.conf", include, cache);
+    ASSERT_EQ(p.size(), 7u);
+    ASSERT_EQ(p[4], "D");
+    ASSERT_EQ(p[5], "E");
+}
+
+TEST(ConfigParserTest, Error)
+{
+    TempDirectory dir;
+    dir.Write("main.conf", "\"a\"\n\"b\"\nsyntax error\n");
+
+    MyConfigParser p;
+
+    try {
+        ParseConfigFile(dir / "main.conf", p);
+        FAIL();
+    } catch (const std::runtime_error &e) {
+        ASSERT_EQ(std::string(e.what()),
+                  (dir / "main.conf").native() + ":3");
+    }
+
+    ASSERT_THROW(ParseConfigFile(dir / "missing.conf", p),
+                 std::system_error);
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "io/IncrementalConfigLoader.hxx"
+#include "io/ConfigParser.hxx"
+#include "io/FileLineParser.hxx"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace {
+
+class TempDirectory {
+    char path[64] = "/tmp/TestIncrementalConfigLoader.XXXXXX";
+
+public:
+    TempDirectory() {
+        if (mkdtemp(path) == nullptr)
+            throw std::runtime_error("mkdtemp() failed");
+    }
+
+    ~TempDirectory() {
+        boost::filesystem::remove_all(path);
+    }
+
+    boost::filesystem::path operator/(const char *name) const {
+        return boost::filesystem::path(path) / name;
+    }
+
+    void Write(const char *name, const char *contents) const {
+        FILE *file = fopen((*this / name).c_str(), "w");
+        ASSERT_NE(file, nullptr);
+        fputs(contents, file);
+        fclose(file);
+    }
+
+    void Remove(const char *name) const {
+        boost::filesystem::remove(*this / name);
+    }
+};
+
+class ValueParser final
+    : public ConfigParser, public std::vector<std::string> {
+public:
+    void ParseLine(FileLineParser &line) override {
+        const char *value = line.NextUnescape();
+        if (value == nullptr)
+            throw LineParser::Error("Quoted value expected");
+        line.ExpectEnd();
+        emplace_back(value);
+    }
+};
+
+class MyHandler final : public IncrementalConfigHandler {
+public:
+    std::atomic_uint n_parsed{0};
+
+    std::map<std::string, std::vector<std::string>> values;
+
+    std::unique_ptr<ConfigParser> CreateConfigParser(const boost::filesystem::path &) override {
+        ++n_parsed;
+        return std::unique_ptr<ConfigParser>(new ValueParser());
+    }
+
+    void OnConfigFileChanged(const boost::filesystem::path &path,
+                             std::unique_ptr<ConfigParser> &&parser) override {
+        values[path.filename().native()] = (ValueParser &)*parser;
+    }
+
+    void OnConfigFileRemoved(const boost::filesystem::path &path) override {
+        values.erase(path.filename().native());
+    }
+};
+
+}
+
+TEST(IncrementalConfigLoader, Basic)
+{
+    TempDirectory dir;
+    dir.Write("a.conf", "\"a1\"\n\"a2\"\n");
+    dir.Write("b.conf", "\"b1\"\n@include \"inc.inc\"\n");
+    dir.Write("c.conf", "\"c1\"\n");
+    dir.Write("inc.inc", "\"inc1\"\n");
+
+    MyHandler handler;
+    IncrementalConfigLoader loader({dir / "*.conf"}, handler, 4);
+
+    ASSERT_EQ(loader.Reload(), 3u);
+    ASSERT_EQ(loader.size(), 3u);
+    ASSERT_EQ(handler.n_parsed, 3u);
+    ASSERT_EQ(handler.values["a.conf"],
+              (std::vector<std::string>{"a1", "a2"}));
+    ASSERT_EQ(handler.values["b.conf"],
+              (std::vector<std::string>{"b1", "inc1"}));
+    ASSERT_EQ(handler.values["c.conf"],
+              (std::vector<std::string>{"c1"}));
+
+    /* nothing has changed */
+    ASSERT_EQ(loader.Reload(), 0u);
+    ASSERT_EQ(handler.n_parsed, 3u);
+
+    /* modify an included file, remove one, add one */
+    dir.Write("inc.inc", "\"inc2\"\n");
+    dir.Remove("c.conf");
+    dir.Write("d.conf", "\"d1\"\n");
+
+    ASSERT_EQ(loader.Reload(), 3u);
+    ASSERT_EQ(handler.n_parsed, 5u);
+    ASSERT_EQ(handler.values.size(), 3u);
+    ASSERT_EQ(handler.values["b.conf"],
+              (std::vector<std::string>{"b1", "inc2"}));
+    ASSERT_EQ(handler.values.count("c.conf"), 0u);
+    ASSERT_EQ(handler.values["d.conf"],
+              (std::vector<std::string>{"d1"}));
+}
+
+TEST(IncrementalConfigLoader, Error)
+{
+    TempDirectory dir;
+    dir.Write("a.conf", "\"a1\"\n");
+    dir.Write("b.conf", "\"b1\"\n");
+
+    MyHandler handler;
+    IncrementalConfigLoader loader({dir / "a.conf", dir / "b.conf"},
+                                   handler, 1);
+    ASSERT_EQ(loader.Reload(), 2u);
+
+    /* a syntax error: nothing gets applied */
+    dir.Write("a.conf", "\"a2\"\n");
+    dir.Write("b.conf", "syntax error\n");
+    ASSERT_THROW(loader.Reload(), std::runtime_error);
+    ASSERT_EQ(handler.values["a.conf"],
+              (std::vector<std::string>{"a1"}));
+
+    /* after fixing it, both changes are applied */
+    dir.Write("b.conf", "\"b2\"\n");
+    ASSERT_EQ(loader.Reload(), 2u);
+    ASSERT_EQ(handler.values["a.conf"],
+              (std::vector<std::string>{"a2"}));
+    ASSERT_EQ(handler.values["b.conf"],
+              (std::vector<std::string>{"b2"}));
+}
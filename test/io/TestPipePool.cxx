@@ -0,0 +1,113 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "io/PipePool.hxx"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static ino_t
+GetInode(const UniqueFileDescriptor &fd)
+{
+    struct stat st;
+    EXPECT_EQ(fstat(fd.Get(), &st), 0);
+    EXPECT_TRUE(S_ISFIFO(st.st_mode));
+    return st.st_ino;
+}
+
+TEST(PipePoolTest, Reuse)
+{
+    PipePool pool;
+
+    auto a = pool.Get();
+    ASSERT_TRUE(a.IsDefined());
+    ASSERT_TRUE(a.w.IsDefined());
+
+    /* the two ends belong to the same pipe */
+    EXPECT_EQ(GetInode(a.r), GetInode(a.w));
+    EXPECT_EQ(write(a.w.Get(), "x", 1), 1);
+    char ch;
+    EXPECT_EQ(read(a.r.Get(), &ch, 1), 1);
+
+    const ino_t inode = GetInode(a.r);
+    pool.Put(std::move(a));
+
+    /* the idle pipe is handed out again */
+    auto b = pool.Get();
+    ASSERT_TRUE(b.IsDefined());
+    EXPECT_EQ(GetInode(b.r), inode);
+
+    /* the pool is empty now; this creates a new pipe */
+    auto c = pool.Get();
+    ASSERT_TRUE(c.IsDefined());
+    EXPECT_NE(GetInode(c.r), inode);
+
+    /* the pipes are non-blocking */
+    EXPECT_EQ(read(c.r.Get(), &ch, 1), -1);
+    EXPECT_EQ(errno, EAGAIN);
+}
+
+TEST(PipePoolTest, MaxIdle)
+{
+    PipePool pool(1);
+
+    auto a = pool.Get(), b = pool.Get();
+    const ino_t inode_a = GetInode(a.r), inode_b = GetInode(b.r);
+
+    pool.Put(std::move(a));
+    /* exceeds the limit and gets closed */
+    pool.Put(std::move(b));
+
+    auto c = pool.Get();
+    EXPECT_EQ(GetInode(c.r), inode_a);
+
+    auto d = pool.Get();
+    EXPECT_NE(GetInode(d.r), inode_a);
+    EXPECT_NE(GetInode(d.r), inode_b);
+}
+
+TEST(PipePoolTest, Clear)
+{
+    PipePool pool;
+
+    auto a = pool.Get();
+    const ino_t inode = GetInode(a.r);
+    pool.Put(std::move(a));
+    pool.Clear();
+
+    auto b = pool.Get();
+    EXPECT_NE(GetInode(b.r), inode);
+}
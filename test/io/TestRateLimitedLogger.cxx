@@ -0,0 +1,138 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "io/RateLimitedLogger.hxx"
+#include "io/AsyncLogger.hxx"
+
+#include <gtest/gtest.h>
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/uio.h>
+
+using std::chrono::seconds;
+using std::chrono::milliseconds;
+
+TEST(LogRateLimiter, Check)
+{
+    LogRateLimiter l(2, seconds(1));
+    const auto t0 = LogRateLimiter::Clock::now();
+
+    const uint64_t a = LogRateLimiter::Hash(1, {}), b = a + 1;
+
+    ASSERT_EQ(l.Check(a, t0), 0);
+    ASSERT_EQ(l.Check(a, t0), 0);
+    ASSERT_EQ(l.Check(a, t0), LogRateLimiter::SUPPRESS);
+    ASSERT_EQ(l.Check(a, t0 + milliseconds(500)), LogRateLimiter::SUPPRESS);
+
+    /* other messages are not affected */
+    ASSERT_EQ(l.Check(b, t0), 0);
+
+    /* the next interval reports the suppressed messages */
+    ASSERT_EQ(l.Check(a, t0 + seconds(1)), 2);
+    ASSERT_EQ(l.Check(a, t0 + seconds(1)), 0);
+    ASSERT_EQ(l.Check(a, t0 + seconds(1)), LogRateLimiter::SUPPRESS);
+    ASSERT_EQ(l.Check(a, t0 + seconds(3)), 1);
+    ASSERT_EQ(l.Check(a, t0 + seconds(5)), 0);
+}
+
+TEST(LogRateLimiter, Hash)
+{
+    const StringView x[] = {"foo", "bar"};
+    const StringView y[] = {"fo", "obar"};
+
+    ASSERT_EQ(LogRateLimiter::Hash(1, {x, 2}), LogRateLimiter::Hash(1, {x, 2}));
+    ASSERT_NE(LogRateLimiter::Hash(1, {x, 2}), LogRateLimiter::Hash(2, {x, 2}));
+    ASSERT_NE(LogRateLimiter::Hash(1, {x, 2}), LogRateLimiter::Hash(1, {y, 2}));
+}
+
+namespace {
+
+class MemoryOutput final : public AsyncLoggerOutput {
+    std::mutex mutex;
+    std::vector<std::string> records;
+
+public:
+    std::vector<std::string> GetRecords() {
+        const std::lock_guard<std::mutex> lock(mutex);
+        return records;
+    }
+
+    void WriteRecords(const struct iovec *v, size_t n) noexcept override {
+        const std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < n; ++i)
+            records.emplace_back((const char *)v[i].iov_base,
+                                 v[i].iov_len);
+    }
+};
+
+}
+
+TEST(RateLimitedLogger, Basic)
+{
+    MemoryOutput output;
+    AsyncLogger logger(output);
+    logger.Install();
+
+    BasicRateLimitedLogger<LiteralLoggerDomain> l("rl", 2, milliseconds(50));
+
+    for (unsigned i = 0; i < 100; ++i) {
+        l(1, "connect failed: ", "ECONNREFUSED");
+        l.Keyed(1, "timeout", "timeout after ", i, "ms");
+        l.Format(1, "%s", "formatted");
+    }
+
+    l(1, "other");
+
+    std::this_thread::sleep_for(milliseconds(60));
+    l(1, "connect failed: ", "ECONNREFUSED");
+
+    logger.Uninstall();
+    logger.Start();
+    logger.Stop();
+
+    const std::vector<std::string> expected{
+        "[rl] connect failed: ECONNREFUSED\n",
+        "[rl] timeout after 0ms\n",
+        "[rl] formatted\n",
+        "[rl] connect failed: ECONNREFUSED\n",
+        "[rl] timeout after 1ms\n",
+        "[rl] formatted\n",
+        "[rl] other\n",
+        "[rl] connect failed: ECONNREFUSED (98 similar messages suppressed)\n",
+    };
+
+    ASSERT_EQ(output.GetRecords(), expected);
+}
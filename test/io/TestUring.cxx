@@ -0,0 +1,109 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "io/uring/Queue.hxx"
+#include "io/uring/Operation.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <system_error>
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+
+namespace {
+
+struct Recorder final : Uring::Operation {
+    int result = 0;
+    unsigned n = 0;
+
+    void OnUringCompletion(int res) noexcept override {
+        result = res;
+        ++n;
+    }
+};
+
+}
+
+TEST(UringTest, Read)
+{
+    std::unique_ptr<Uring::Queue> queue;
+    try {
+        queue.reset(new Uring::Queue(16));
+    } catch (const std::system_error &) {
+        GTEST_SKIP();
+    }
+
+    UniqueFileDescriptor r, w;
+    ASSERT_TRUE(UniqueFileDescriptor::CreatePipe(r, w));
+
+    char buffer[16];
+    Recorder read, nop;
+
+    auto *sqe = &queue->Require();
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = r.Get();
+    struct iovec iov{buffer, sizeof(buffer)};
+    sqe->addr = (uint64_t)(uintptr_t)&iov;
+    sqe->len = 1;
+    queue->Push(*sqe, read);
+
+    sqe = &queue->Require();
+    sqe->opcode = IORING_OP_NOP;
+    queue->Push(*sqe, nop);
+
+    /* nothing happens until the batch is submitted */
+    EXPECT_TRUE(queue->HasPending());
+    queue->DispatchCompletions();
+    EXPECT_EQ(nop.n, 0u);
+
+    queue->Submit();
+    EXPECT_FALSE(queue->HasPending());
+    EXPECT_TRUE(queue->HasOperations());
+
+    ASSERT_EQ(w.Write("foo", 3), 3);
+
+    for (unsigned i = 0; i < 100 && queue->HasOperations(); ++i) {
+        usleep(1000);
+        queue->DispatchCompletions();
+    }
+
+    EXPECT_FALSE(queue->HasOperations());
+    EXPECT_EQ(nop.n, 1u);
+    EXPECT_EQ(nop.result, 0);
+    EXPECT_EQ(read.n, 1u);
+    EXPECT_EQ(read.result, 3);
+    EXPECT_EQ(memcmp(buffer, "foo", 3), 0);
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "io/WriteQueue.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <sys/uio.h>
+
+static std::string
+Collect(const WriteQueue &q)
+{
+    struct iovec v[16];
+    size_t n = q.Prepare(v, 16);
+
+    std::string result;
+    for (size_t i = 0; i < n; ++i)
+        result.append((const char *)v[i].iov_base, v[i].iov_len);
+    return result;
+}
+
+TEST(WriteQueueTest, Coalesce)
+{
+    WriteQueue q;
+    EXPECT_TRUE(q.empty());
+
+    q.Push("foo", 3);
+    q.Push("bar", 3);
+    q.Push("", 0);
+
+    struct iovec v[16];
+    EXPECT_EQ(q.Prepare(v, 16), 1u);
+    EXPECT_EQ(q.GetSize(), 6u);
+    EXPECT_EQ(Collect(q), "foobar");
+
+    static const char big[] = "reference";
+    q.PushReference(big, 9);
+    q.Push("!", 1);
+    EXPECT_EQ(q.Prepare(v, 16), 3u);
+    EXPECT_EQ(v[1].iov_base, (const void *)big);
+    EXPECT_EQ(Collect(q), "foobarreference!");
+
+    q.Consume(4);
+    EXPECT_EQ(Collect(q), "arreference!");
+
+    q.Consume(3);
+    EXPECT_EQ(Collect(q), "eference!");
+    EXPECT_EQ(q.Prepare(v, 16), 2u);
+
+    q.Consume(9);
+    EXPECT_TRUE(q.empty());
+    EXPECT_EQ(q.Prepare(v, 16), 0u);
+}
+
+TEST(WriteQueueTest, Large)
+{
+    WriteQueue q;
+
+    const std::string a(WriteQueue::MIN_CAPACITY - 1, 'a');
+    q.Push(a.data(), a.size());
+    q.Push("bc", 2);
+
+    struct iovec v[16];
+    EXPECT_EQ(q.Prepare(v, 16), 2u);
+    EXPECT_EQ(q.Prepare(v, 1), 1u);
+    EXPECT_EQ(Collect(q), a + "bc");
+
+    q.Clear();
+    EXPECT_TRUE(q.empty());
+}
+
+TEST(WriteQueueTest, PushV)
+{
+    WriteQueue q;
+    q.Push("foo", 3);
+
+    struct iovec v[3];
+    v[0].iov_base = const_cast<char *>("bar");
+    v[0].iov_len = 3;
+    v[1].iov_base = nullptr;
+    v[1].iov_len = 0;
+    v[2].iov_base = const_cast<char *>("baz");
+    v[2].iov_len = 3;
+
+    /* coalesced into the existing buffer */
+    q.PushV(v, 3);
+    EXPECT_EQ(q.GetSize(), 9u);
+    EXPECT_EQ(q.Prepare(v, 3), 1u);
+    EXPECT_EQ(Collect(q), "foobarbaz");
+
+    /* a vector larger than the free space becomes one new
+       segment */
+    const std::string a(WriteQueue::MIN_CAPACITY, 'a');
+    const std::string b(WriteQueue::MIN_CAPACITY, 'b');
+    v[0].iov_base = const_cast<char *>(a.data());
+    v[0].iov_len = a.size();
+    v[1].iov_base = const_cast<char *>(b.data());
+    v[1].iov_len = b.size();
+    q.PushV(v, 2);
+    EXPECT_EQ(q.Prepare(v, 3), 2u);
+    EXPECT_EQ(v[1].iov_len, a.size() + b.size());
+    EXPECT_EQ(Collect(q), "foobarbaz" + a + b);
+
+    q.PushV(v, 0);
+    EXPECT_EQ(q.GetSize(), 9 + a.size() + b.size());
+}
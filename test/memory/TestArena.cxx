@@ -0,0 +1,202 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "memory/Arena.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+TEST(ArenaTest, Basic)
+{
+    Arena arena(4096);
+
+    char *a = (char *)arena.Allocate(100, 1);
+    char *b = (char *)arena.Allocate(100, 1);
+    memset(a, 'a', 100);
+    memset(b, 'b', 100);
+
+    /* consecutive allocations are adjacent */
+    EXPECT_EQ(b, a + 100);
+
+    /* alignment */
+    void *c = arena.Allocate(8, 64);
+    EXPECT_EQ((uintptr_t)c % 64, 0u);
+
+    /* large allocations get a dedicated chunk */
+    char *large = (char *)arena.Allocate(100000);
+    memset(large, 'l', 100000);
+    char *d = (char *)arena.Allocate(1, 1);
+    EXPECT_TRUE(d > (char *)c && d < (char *)c + 4096);
+
+    /* many small allocations span several chunks */
+    for (unsigned i = 0; i < 1000; ++i)
+        memset(arena.Allocate(100), i, 100);
+
+    EXPECT_EQ(a[99], 'a');
+    EXPECT_EQ(b[0], 'b');
+    EXPECT_EQ(large[99999], 'l');
+}
+
+TEST(ArenaTest, AlignPastEnd)
+{
+    /* a chunk size which is not a multiple of 16, so aligning the
+       position may move it past the end of the chunk */
+    Arena arena(1000);
+
+    /* find out how many bytes fit into one chunk */
+    char *first = (char *)arena.Allocate(1, 1);
+    char *last = first;
+    unsigned n = 1;
+    while (true) {
+        char *p = (char *)arena.Allocate(1, 1);
+        if (p != last + 1) {
+            /* a new chunk has been started */
+            first = last = p;
+            break;
+        }
+
+        last = p;
+        ++n;
+    }
+
+    /* fill the new chunk up to its (unaligned) end */
+    for (unsigned i = 1; i < n; ++i) {
+        char *p = (char *)arena.Allocate(1, 1);
+        ASSERT_EQ(p, last + 1);
+        last = p;
+    }
+
+    /* this must not return memory behind the end of the chunk */
+    char *p = (char *)arena.Allocate(8, 64);
+    EXPECT_EQ((uintptr_t)p % 64, 0u);
+    EXPECT_FALSE(p > last && p <= last + 64);
+    memset(p, 'x', 8);
+}
+
+namespace {
+
+struct Counted {
+    unsigned &counter;
+
+    explicit Counted(unsigned &_counter):counter(_counter) {}
+
+    ~Counted() {
+        ++counter;
+    }
+};
+
+}
+
+TEST(ArenaTest, Destructors)
+{
+    unsigned counter = 0;
+
+    {
+        Arena arena;
+        arena.New<Counted>(counter);
+        arena.New<Counted>(counter);
+        EXPECT_EQ(counter, 0u);
+
+        arena.Clear();
+        EXPECT_EQ(counter, 2u);
+
+        arena.New<Counted>(counter);
+        Arena moved(std::move(arena));
+        EXPECT_EQ(counter, 2u);
+    }
+
+    EXPECT_EQ(counter, 3u);
+}
+
+namespace {
+
+struct Throwing {
+    unsigned &counter;
+
+    explicit Throwing(unsigned &_counter, bool fail):counter(_counter) {
+        if (fail)
+            throw 42;
+    }
+
+    ~Throwing() {
+        ++counter;
+    }
+};
+
+}
+
+TEST(ArenaTest, ConstructorThrows)
+{
+    unsigned counter = 0;
+
+    {
+        Arena arena;
+        arena.New<Throwing>(counter, false);
+        EXPECT_THROW(arena.New<Throwing>(counter, true), int);
+        arena.New<Throwing>(counter, false);
+
+        arena.Clear();
+
+        /* only the objects which were constructed successfully
+           are destructed */
+        EXPECT_EQ(counter, 2u);
+    }
+
+    EXPECT_EQ(counter, 2u);
+}
+
+TEST(ArenaTest, Clear)
+{
+    Arena arena(4096);
+
+    void *first = arena.Allocate(16);
+    for (unsigned i = 0; i < 100; ++i)
+        arena.Allocate(100);
+
+    arena.Clear();
+
+    /* the current chunk is reused */
+    void *again = arena.Allocate(16);
+    EXPECT_NE(again, nullptr);
+    EXPECT_NE(again, first);
+    EXPECT_EQ(arena.Allocate(16), (char *)again + 16);
+}
+
+TEST(ArenaTest, Huge)
+{
+    Arena arena(2 * 1024 * 1024, true);
+
+    char *p = (char *)arena.Allocate(1000);
+    memset(p, 'x', 1000);
+    EXPECT_EQ(p[999], 'x');
+}
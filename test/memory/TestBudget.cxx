@@ -0,0 +1,178 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "memory/Budget.hxx"
+#include "memory/SlicePool.hxx"
+#include "system/LargeAllocation.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace {
+
+struct FakeReclaimer final : MemoryReclaimer {
+    std::string &log;
+    const char name;
+    size_t usage;
+
+    FakeReclaimer(std::string &_log, char _name, size_t _usage) noexcept
+        :log(_log), name(_name), usage(_usage) {}
+
+    size_t GetMemoryUsage() const noexcept override {
+        return usage;
+    }
+
+    size_t ReclaimMemory(size_t bytes) noexcept override {
+        log.push_back(name);
+        const size_t n = std::min(bytes, usage);
+        usage -= n;
+        return n;
+    }
+};
+
+struct SlicePoolReclaimer final : MemoryReclaimer {
+    SlicePool &pool;
+
+    explicit SlicePoolReclaimer(SlicePool &_pool) noexcept
+        :pool(_pool) {}
+
+    size_t GetMemoryUsage() const noexcept override {
+        return 0;
+    }
+
+    size_t ReclaimMemory(size_t) noexcept override {
+        return pool.ReleaseSpare();
+    }
+};
+
+}
+
+TEST(MemoryBudgetTest, LargeAllocation)
+{
+    const size_t before = LargeAllocation::GetTotalSize();
+
+    {
+        LargeAllocation a(100000);
+        EXPECT_EQ(LargeAllocation::GetTotalSize(), before + a.size());
+
+        LargeAllocation b(std::move(a));
+        EXPECT_EQ(LargeAllocation::GetTotalSize(), before + b.size());
+
+        b.reset();
+        EXPECT_EQ(LargeAllocation::GetTotalSize(), before);
+
+        LargeAllocation c(4096, LargeAllocation::TRANSPARENT_HUGE);
+        EXPECT_EQ(LargeAllocation::GetTotalSize(), before + c.size());
+
+        /* reserved address space is not accounted */
+        LargeAllocation d(1 << 20, LargeAllocation::RESERVE);
+        EXPECT_EQ(LargeAllocation::GetTotalSize(), before + c.size());
+    }
+
+    EXPECT_EQ(LargeAllocation::GetTotalSize(), before);
+}
+
+TEST(MemoryBudgetTest, Priority)
+{
+    /* the fake usage is large compared to the LargeAllocation
+       instances which may exist in this process */
+    constexpr size_t GB = size_t(1) << 30;
+
+    std::string log;
+    FakeReclaimer a(log, 'a', GB), b(log, 'b', GB), c(log, 'c', GB);
+
+    const size_t base = LargeAllocation::GetTotalSize();
+    const size_t limit = base + 2 * GB;
+    MemoryBudget budget(limit);
+    budget.Add(c, 2);
+    budget.Add(a, 1);
+    budget.Add(b, 1);
+    EXPECT_EQ(budget.GetUsage(), base + 3 * GB);
+
+    /* reclaims down to 7/8 of the limit, lowest priority value
+       first, in registration order */
+    const size_t target = limit - limit / 8;
+    EXPECT_EQ(budget.Check(), base + 3 * GB - target);
+    EXPECT_EQ(budget.GetUsage(), target);
+    EXPECT_EQ(log, "ab");
+    EXPECT_EQ(a.usage, 0u);
+    EXPECT_EQ(c.usage, GB);
+    EXPECT_EQ(budget.GetStats().exceeded, 1u);
+
+    /* below the limit: nothing to do */
+    log.clear();
+    EXPECT_EQ(budget.Check(), 0u);
+    EXPECT_TRUE(log.empty());
+
+    /* pressure reclaims regardless of the limit */
+    budget.SetLimit(0);
+    const size_t usage = budget.GetUsage();
+    EXPECT_EQ(budget.OnPressure(), usage / 8);
+    EXPECT_EQ(budget.GetStats().pressure, 1u);
+    EXPECT_EQ(budget.GetStats().reclaimed,
+              base + 3 * GB - target + usage / 8);
+
+    /* a destroyed reclaimer unregisters itself */
+    {
+        FakeReclaimer d(log, 'd', GB);
+        budget.Add(d, 0);
+        EXPECT_EQ(budget.GetUsage(), usage - usage / 8 + GB);
+    }
+
+    EXPECT_EQ(budget.GetUsage(), usage - usage / 8);
+
+    budget.Remove(a);
+    budget.Remove(b);
+    budget.Remove(c);
+    EXPECT_EQ(budget.Reclaim(1000), 0u);
+}
+
+TEST(MemoryBudgetTest, SlicePool)
+{
+    SlicePool pool(4096, 4);
+    SlicePoolReclaimer reclaimer(pool);
+
+    MemoryBudget budget;
+    budget.Add(reclaimer, 0);
+
+    void *p = pool.Alloc();
+    pool.Free(p);
+    EXPECT_EQ(pool.GetAreaCount(), 1u);
+
+    const size_t usage = budget.GetUsage();
+    EXPECT_EQ(budget.Reclaim(1), 4u * 4096);
+    EXPECT_EQ(pool.GetAreaCount(), 0u);
+    EXPECT_EQ(budget.GetUsage(), usage - 4u * 4096);
+
+    EXPECT_EQ(budget.Reclaim(1), 0u);
+}
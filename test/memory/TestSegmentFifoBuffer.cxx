@@ -0,0 +1,156 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "memory/SegmentFifoBuffer.hxx"
+#include "memory/SlicePool.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <string.h>
+#include <sys/uio.h>
+
+static std::string
+Drain(SegmentFifoBuffer &b)
+{
+    std::string result;
+    while (!b.IsEmpty()) {
+        auto r = b.Read();
+        EXPECT_FALSE(r.empty());
+        result.append((const char *)r.data, r.size);
+        b.Consume(r.size);
+    }
+
+    return result;
+}
+
+TEST(SegmentFifoBufferTest, Basic)
+{
+    SlicePool pool(64, 16);
+
+    {
+        SegmentFifoBuffer b(pool);
+        EXPECT_TRUE(b.IsEmpty());
+        EXPECT_TRUE(b.Read().empty());
+
+        auto w = b.Write();
+        ASSERT_GE(w.size, 5u);
+        memcpy(w.data, "hello", 5);
+        b.Append(5);
+        EXPECT_EQ(b.GetAvailable(), 5u);
+        EXPECT_EQ(pool.GetAllocatedCount(), 1u);
+
+        auto r = b.Read();
+        ASSERT_EQ(r.size, 5u);
+        EXPECT_EQ(memcmp(r.data, "hello", 5), 0);
+
+        b.Consume(2);
+        r = b.Read();
+        ASSERT_EQ(r.size, 3u);
+        EXPECT_EQ(memcmp(r.data, "llo", 3), 0);
+
+        /* draining the buffer frees the segment */
+        b.Consume(3);
+        EXPECT_TRUE(b.IsEmpty());
+        EXPECT_EQ(pool.GetAllocatedCount(), 0u);
+    }
+
+    EXPECT_EQ(pool.GetAllocatedCount(), 0u);
+}
+
+TEST(SegmentFifoBufferTest, Spanning)
+{
+    SlicePool pool(64, 16);
+
+    std::string data;
+    for (unsigned i = 0; i < 1000; ++i)
+        data.push_back('a' + i % 26);
+
+    {
+        SegmentFifoBuffer b(pool);
+        b.Append(data.data(), data.size());
+        EXPECT_EQ(b.GetAvailable(), data.size());
+        EXPECT_GT(pool.GetAllocatedCount(), 1u);
+
+        /* a partial consume spanning several segments */
+        b.Consume(300);
+        EXPECT_EQ(b.GetAvailable(), data.size() - 300);
+        EXPECT_EQ(Drain(b), data.substr(300));
+        EXPECT_EQ(pool.GetAllocatedCount(), 0u);
+
+        /* interleaved writes and reads */
+        std::string expected;
+        for (unsigned i = 0; i < 50; ++i) {
+            b.Append(data.data(), 37);
+            expected.append(data.data(), 37);
+            b.Consume(11);
+            expected.erase(0, 11);
+        }
+
+        EXPECT_EQ(Drain(b), expected);
+    }
+
+    EXPECT_EQ(pool.GetAllocatedCount(), 0u);
+}
+
+TEST(SegmentFifoBufferTest, Iovec)
+{
+    SlicePool pool(64, 16);
+    SegmentFifoBuffer b(pool);
+
+    std::string data(500, 'x');
+    for (unsigned i = 0; i < data.size(); ++i)
+        data[i] = 'A' + i % 26;
+
+    b.Append(data.data(), data.size());
+    b.Consume(3);
+
+    struct iovec v[64];
+    size_t n = b.PrepareIovec(v, 64);
+    ASSERT_GT(n, 1u);
+
+    std::string result;
+    for (size_t i = 0; i < n; ++i)
+        result.append((const char *)v[i].iov_base, v[i].iov_len);
+    EXPECT_EQ(result, data.substr(3));
+
+    /* limited number of items */
+    n = b.PrepareIovec(v, 2);
+    EXPECT_EQ(n, 2u);
+    EXPECT_EQ(v[0].iov_len, b.Read().size);
+
+    b.Clear();
+    EXPECT_TRUE(b.IsEmpty());
+    EXPECT_EQ(b.PrepareIovec(v, 64), 0u);
+    EXPECT_EQ(pool.GetAllocatedCount(), 0u);
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "memory/SlabAllocator.hxx"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+TEST(SlabPoolTest, Basic)
+{
+    SlabPool pool(40, 16, 1024 * 1024);
+    EXPECT_EQ(pool.GetObjectSize(), 48u);
+
+    void *a = pool.Allocate();
+    void *b = pool.Allocate();
+    EXPECT_NE(a, b);
+    EXPECT_EQ((uintptr_t)a % 16, 0u);
+    EXPECT_EQ((uintptr_t)b % 16, 0u);
+    memset(a, 'a', 40);
+    memset(b, 'b', 40);
+
+    /* freed objects are reused (LIFO) */
+    pool.Free(a);
+    EXPECT_EQ(pool.Allocate(), a);
+
+    pool.Link(a, b);
+    pool.FreeList(a, b);
+    EXPECT_EQ(pool.Allocate(), a);
+    EXPECT_EQ(pool.Allocate(), b);
+}
+
+TEST(SlabPoolTest, Exhausted)
+{
+    SlabPool pool(4096, 4096, 8 * 4096);
+
+    std::set<void *> objects;
+    for (unsigned i = 0; i < 8; ++i)
+        EXPECT_TRUE(objects.insert(pool.Allocate()).second);
+
+    EXPECT_THROW(pool.Allocate(), std::bad_alloc);
+
+    pool.Free(*objects.begin());
+    EXPECT_EQ(pool.Allocate(), *objects.begin());
+}
+
+namespace {
+
+struct Item : SlabAllocated<Item> {
+    uint64_t value;
+    char padding[56];
+
+    explicit Item(uint64_t _value):value(_value) {}
+};
+
+}
+
+TEST(SlabAllocatorTest, NewDelete)
+{
+    std::vector<Item *> items;
+    for (unsigned i = 0; i < 1000; ++i)
+        items.push_back(new Item(i));
+
+    for (unsigned i = 0; i < 1000; ++i) {
+        EXPECT_EQ(items[i]->value, i);
+        delete items[i];
+    }
+
+    /* recently freed objects come from the thread cache */
+    Item *a = new Item(1);
+    EXPECT_EQ(a, items.back());
+    delete a;
+}
+
+TEST(SlabAllocatorTest, Threads)
+{
+    constexpr unsigned N_THREADS = 4, N_ROUNDS = 20000;
+
+    /* objects are allocated by one thread and freed by the next
+       one */
+    std::atomic<Item *> handoff[N_THREADS];
+    for (auto &i : handoff)
+        i.store(nullptr);
+
+    std::atomic_bool failed{false};
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < N_THREADS; ++t) {
+        threads.emplace_back([&, t](){
+            std::vector<Item *> local;
+            for (unsigned i = 0; i < N_ROUNDS; ++i) {
+                const uint64_t value = uint64_t(t) << 32 | i;
+                auto *item = SlabAllocator<Item>::New(value);
+                local.push_back(item);
+
+                if (local.size() > 100) {
+                    for (auto *j : local) {
+                        if ((j->value >> 32) != t)
+                            failed = true;
+                        SlabAllocator<Item>::Delete(j);
+                    }
+                    local.clear();
+                }
+
+                Item *other = handoff[(t + 1) % N_THREADS].exchange(nullptr);
+                if (other != nullptr)
+                    delete other;
+
+                Item *mine = new Item(value);
+                mine = handoff[t].exchange(mine);
+                if (mine != nullptr)
+                    delete mine;
+            }
+
+            for (auto *j : local)
+                SlabAllocator<Item>::Delete(j);
+        });
+    }
+
+    for (auto &t : threads)
+        t.join();
+
+    for (auto &i : handoff)
+        delete i.load();
+
+    EXPECT_FALSE(failed);
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "memory/SlicePool.hxx"
+
+#include <gtest/gtest.h>
+
+#include <set>
+#include <vector>
+
+#include <string.h>
+
+TEST(SlicePoolTest, Basic)
+{
+    SlicePool pool(4096, 4);
+    EXPECT_EQ(pool.GetAllocatedCount(), 0u);
+    EXPECT_EQ(pool.GetAreaCount(), 0u);
+
+    std::vector<void *> v;
+    for (unsigned i = 0; i < 10; ++i) {
+        void *p = pool.Alloc();
+        ASSERT_NE(p, nullptr);
+        memset(p, i, 4096);
+        v.push_back(p);
+    }
+
+    EXPECT_EQ(pool.GetAllocatedCount(), 10u);
+    EXPECT_EQ(pool.GetAreaCount(), 3u);
+    EXPECT_EQ(std::set<void *>(v.begin(), v.end()).size(), v.size());
+
+    /* a freed slice gets reused first */
+    void *last = v.back();
+    v.pop_back();
+    pool.Free(last);
+    EXPECT_EQ(pool.Alloc(), last);
+    v.push_back(last);
+
+    for (auto *p : v)
+        pool.Free(p);
+
+    EXPECT_EQ(pool.GetAllocatedCount(), 0u);
+
+    /* only one spare area is kept */
+    EXPECT_EQ(pool.GetAreaCount(), 1u);
+}
+
+TEST(SlicePoolTest, Interleaved)
+{
+    SlicePool pool(64, 16);
+
+    std::vector<void *> v;
+    for (unsigned i = 0; i < 1000; ++i)
+        v.push_back(pool.Alloc());
+
+    /* free every other slice, then allocate again */
+    for (unsigned i = 0; i < v.size(); i += 2)
+        pool.Free(v[i]);
+
+    EXPECT_EQ(pool.GetAllocatedCount(), 500u);
+
+    for (unsigned i = 0; i < v.size(); i += 2)
+        v[i] = pool.Alloc();
+
+    EXPECT_EQ(pool.GetAllocatedCount(), 1000u);
+    EXPECT_EQ(std::set<void *>(v.begin(), v.end()).size(), v.size());
+
+    for (auto *p : v)
+        pool.Free(p);
+
+    EXPECT_EQ(pool.GetAllocatedCount(), 0u);
+    EXPECT_EQ(pool.GetAreaCount(), 1u);
+}
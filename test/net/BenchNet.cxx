@@ -0,0 +1,126 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/MaskedSocketAddress.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "net/Parser.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Parser.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/log/Crc.hxx"
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+static void
+MaskedSocketAddress_Matches(benchmark::State &state)
+{
+    const MaskedSocketAddress mask("192.168.1.0/24");
+    const auto address = ParseSocketAddress("192.168.1.2", 42, false);
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(mask.Matches(address));
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+static Net::Log::Datagram
+MakeDatagram()
+{
+    Net::Log::Datagram d(std::chrono::system_clock::now(),
+                         HTTP_METHOD_GET, "/index.html",
+                         "192.168.1.1", "example.com", "site",
+                         "http://referer/", "agent",
+                         HTTP_STATUS_OK, 1234,
+                         100, 200,
+                         std::chrono::milliseconds(42));
+    d.forwarded_to = "10.0.0.1:80";
+    d.type = Net::Log::Type::HTTP_ACCESS;
+    return d;
+}
+
+static void
+LogSerialize(benchmark::State &state)
+{
+    const auto d = MakeDatagram();
+    char buffer[4096];
+
+    size_t size = 0;
+    for (auto _ : state) {
+        size = Net::Log::Serialize(buffer, sizeof(buffer), d);
+        benchmark::DoNotOptimize(size);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+static void
+LogParseDatagram(benchmark::State &state)
+{
+    const auto d = MakeDatagram();
+    char buffer[4096];
+    const size_t size = Net::Log::Serialize(buffer, sizeof(buffer), d);
+    if (size == 0) {
+        state.SkipWithError("Serialize() failed");
+        return;
+    }
+
+    for (auto _ : state) {
+        auto result = Net::Log::ParseDatagram(buffer, buffer + size);
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+static void
+LogCrc32(benchmark::State &state)
+{
+    std::vector<char> buffer(state.range(0), 'x');
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Net::Log::UpdateCrc32(0, buffer.data(),
+                                                       buffer.size()));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+
+BENCHMARK(MaskedSocketAddress_Matches);
+BENCHMARK(LogSerialize);
+BENCHMARK(LogParseDatagram);
+BENCHMARK(LogCrc32)->Range(64, 64 << 10);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,884 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Loopback load generator for #ServerSocket and #BufferedSocket: a
+ * number of client connections send fixed-size requests which the
+ * server echoes back, and the throughput, system call and latency
+ * statistics are printed.
+ *
+ * The system call and CPU figures are measured for the whole process,
+ * i.e. they include the client side.
+ */
+
+#include "event/net/ServerSocket.hxx"
+#include "event/net/BufferedSocket.hxx"
+#include "event/Pool.hxx"
+#include "event/Loop.hxx"
+#include "event/SocketEvent.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "io/PipePool.hxx"
+#include "io/Splice.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/PrintException.hxx"
+#include "util/StringCompare.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <forward_list>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct Usage {};
+
+/**
+ * The maximum number of bytes moved into the pipe by one splice()
+ * call.
+ */
+static constexpr size_t MAX_SPLICE = 64 * 1024;
+
+struct ServerOptions {
+	/**
+	 * Echo through a pipe with splice() instead of copying the
+	 * data through the #BufferedSocket input buffer.
+	 */
+	bool splice = false;
+
+	/**
+	 * Send responses with BufferedSocket::Enqueue() (which
+	 * coalesces all writes of one loop iteration) instead of
+	 * BufferedSocket::Write().
+	 */
+	bool coalesce = false;
+
+	/**
+	 * Register the sockets edge-triggered (see
+	 * SocketWrapper::SetEdgeTriggered()).
+	 */
+	bool edge_triggered = false;
+};
+
+class BenchServer;
+
+class EchoConnection final
+	: public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+	  BufferedSocketHandler {
+
+	BenchServer &server;
+
+	BufferedSocket socket;
+
+	PipePair pipe;
+
+	/**
+	 * The number of bytes in the pipe which have not yet been
+	 * echoed.
+	 */
+	size_t piped = 0;
+
+public:
+	EchoConnection(EventLoop &event_loop, BenchServer &_server,
+		       UniqueSocketDescriptor &&fd);
+	~EchoConnection() noexcept;
+
+	void Destroy() noexcept;
+
+private:
+	/**
+	 * Move data from the pipe back to the socket.
+	 *
+	 * Throws on error.
+	 *
+	 * @return true if the pipe is empty, false if the socket
+	 * blocks (its "write" event has been scheduled)
+	 */
+	bool Drain();
+
+	/* virtual methods from class BufferedSocketHandler */
+	BufferedResult OnBufferedData() override;
+	DirectResult OnBufferedDirect(SocketDescriptor fd,
+				      FdType fd_type) override;
+	bool OnBufferedClosed() noexcept override;
+	bool OnBufferedWrite() override;
+	void OnBufferedError(std::exception_ptr e) noexcept override;
+};
+
+class BenchServer final : public ServerSocket {
+	friend class EchoConnection;
+
+	EventLoop &event_loop;
+
+	const ServerOptions &options;
+
+	const FdType fd_type;
+
+	PipePool pipe_pool;
+
+	boost::intrusive::list<EchoConnection,
+			       boost::intrusive::constant_time_size<false>> connections;
+
+public:
+	BenchServer(EventLoop &_event_loop, const ServerOptions &_options,
+		    FdType _fd_type) noexcept
+		:ServerSocket(_event_loop), event_loop(_event_loop),
+		 options(_options),
+		 fd_type(_fd_type) {}
+
+	~BenchServer() noexcept;
+
+protected:
+	/* virtual methods from class ServerSocket */
+	void OnAccept(UniqueSocketDescriptor &&fd,
+		      SocketAddress address) override;
+	void OnAcceptError(std::exception_ptr ep) override;
+};
+
+EchoConnection::EchoConnection(EventLoop &event_loop, BenchServer &_server,
+			       UniqueSocketDescriptor &&fd)
+	:server(_server), socket(event_loop)
+{
+	if (server.options.splice)
+		pipe = server.pipe_pool.Get();
+
+	socket.Init(fd.Release(), server.fd_type,
+		    nullptr, nullptr, *this);
+	socket.SetEdgeTriggered(server.options.edge_triggered);
+	socket.SetDirect(server.options.splice);
+	socket.ScheduleReadNoTimeout(false);
+}
+
+EchoConnection::~EchoConnection() noexcept
+{
+	if (socket.IsConnected())
+		socket.Close();
+	socket.Destroy();
+
+	if (pipe.IsDefined() && piped == 0)
+		server.pipe_pool.Put(std::move(pipe));
+}
+
+void
+EchoConnection::Destroy() noexcept
+{
+	server.connections.erase(server.connections.iterator_to(*this));
+	delete this;
+}
+
+BenchServer::~BenchServer() noexcept
+{
+	connections.clear_and_dispose([](EchoConnection *c){ delete c; });
+}
+
+void
+BenchServer::OnAccept(UniqueSocketDescriptor &&new_fd, SocketAddress)
+{
+	if (fd_type == FdType::FD_TCP)
+		new_fd.SetNoDelay();
+
+	auto *c = new EchoConnection(event_loop, *this, std::move(new_fd));
+	connections.push_front(*c);
+}
+
+void
+BenchServer::OnAcceptError(std::exception_ptr ep)
+{
+	PrintException(ep);
+}
+
+bool
+EchoConnection::Drain()
+{
+	while (piped > 0) {
+		ssize_t nbytes = socket.WriteFrom(pipe.r.Get(), FdType::FD_PIPE,
+						  piped);
+		if (nbytes > 0) {
+			piped -= nbytes;
+			continue;
+		}
+
+		if (nbytes == WRITE_BLOCKING)
+			return false;
+
+		throw MakeErrno("Failed to splice to socket");
+	}
+
+	return true;
+}
+
+BufferedResult
+EchoConnection::OnBufferedData()
+{
+	auto r = socket.ReadBuffer();
+
+	if (server.options.coalesce) {
+		socket.Enqueue(r.data, r.size);
+		socket.Consumed(r.size);
+		return BufferedResult::OK;
+	}
+
+	ssize_t nbytes = socket.Write(r.data, r.size);
+	if (nbytes > 0) {
+		socket.Consumed(nbytes);
+
+		if (size_t(nbytes) == r.size)
+			return BufferedResult::OK;
+
+		socket.ScheduleWrite();
+		return BufferedResult::BLOCKING;
+	}
+
+	switch (nbytes) {
+	case WRITE_BLOCKING:
+		return BufferedResult::BLOCKING;
+
+	case WRITE_DESTROYED:
+		return BufferedResult::CLOSED;
+
+	default:
+		throw MakeErrno("Send failed");
+	}
+}
+
+DirectResult
+EchoConnection::OnBufferedDirect(SocketDescriptor fd, FdType)
+{
+	if (!Drain())
+		return DirectResult::BLOCKING;
+
+	ssize_t nbytes = SpliceToPipe(fd.Get(), pipe.w.Get(), MAX_SPLICE);
+	if (nbytes < 0)
+		return errno == EAGAIN
+			? DirectResult::EMPTY
+			: DirectResult::ERRNO;
+
+	if (nbytes == 0) {
+		socket.ClosedByPeer();
+		return DirectResult::CLOSED;
+	}
+
+	piped += nbytes;
+
+	return Drain()
+		? DirectResult::OK
+		: DirectResult::BLOCKING;
+}
+
+bool
+EchoConnection::OnBufferedClosed() noexcept
+{
+	Destroy();
+	return false;
+}
+
+bool
+EchoConnection::OnBufferedWrite()
+{
+	if (!Drain())
+		return true;
+
+	socket.UnscheduleWrite();
+
+	/* resume reading; deferred, because reading here could
+	   destroy this object */
+	socket.DeferRead(false);
+	return true;
+}
+
+void
+EchoConnection::OnBufferedError(std::exception_ptr) noexcept
+{
+	/* the client has disconnected; nothing to report */
+	Destroy();
+}
+
+struct ClientOptions {
+	unsigned requests = 10000;
+	size_t size = 64;
+	unsigned pipeline = 1;
+};
+
+/**
+ * A number of client connections served by one #EventLoop in its own
+ * thread.
+ */
+class ClientGroup {
+	class Client;
+
+	EventLoop event_loop;
+
+	std::forward_list<Client> clients;
+
+	const ClientOptions &options;
+
+	const std::unique_ptr<char[]> request, receive_buffer;
+
+	static constexpr size_t RECEIVE_BUFFER_SIZE = 64 * 1024;
+
+	unsigned running = 0;
+
+	std::thread thread;
+
+	std::exception_ptr error;
+
+public:
+	/**
+	 * The round trip durations of all finished requests.
+	 */
+	std::vector<Clock::duration> round_trips;
+
+	explicit ClientGroup(const ClientOptions &_options);
+	~ClientGroup() noexcept;
+
+	void Add(UniqueSocketDescriptor &&fd);
+
+	void Start() {
+		thread = std::thread(&ClientGroup::Run, this);
+	}
+
+	/**
+	 * Wait for all clients to finish.
+	 *
+	 * Throws the first client error.
+	 */
+	void Join();
+
+private:
+	void Run() noexcept;
+
+	void OnClientFinished() noexcept {
+		if (--running == 0)
+			event_loop.Break();
+	}
+
+	void OnClientError(std::exception_ptr e) noexcept {
+		if (!error)
+			error = e;
+		event_loop.Break();
+	}
+};
+
+class ClientGroup::Client {
+	ClientGroup &group;
+
+	UniqueSocketDescriptor fd;
+
+	SocketEvent event;
+
+	/**
+	 * The start times of the requests which have been sent (or are
+	 * being sent), but whose response has not yet been received
+	 * completely.
+	 */
+	std::deque<Clock::time_point> in_flight;
+
+	unsigned started = 0, sent = 0, completed = 0;
+
+	/**
+	 * The number of bytes of the current request which have
+	 * already been sent.
+	 */
+	size_t send_position = 0;
+
+	/**
+	 * The number of bytes of the current response which have
+	 * already been received.
+	 */
+	size_t received = 0;
+
+	bool want_write = false;
+
+public:
+	Client(ClientGroup &_group, UniqueSocketDescriptor &&_fd) noexcept
+		:group(_group), fd(std::move(_fd)),
+		 event(group.event_loop, BIND_THIS_METHOD(OnSocketReady)) {}
+
+	/**
+	 * Throws on error.
+	 */
+	void Start();
+
+private:
+	/**
+	 * Send as many requests as the pipeline depth permits.
+	 *
+	 * Throws on error.
+	 *
+	 * @return true if the socket blocks
+	 */
+	bool Send();
+
+	/**
+	 * Throws on error.
+	 *
+	 * @return false if the client has finished
+	 */
+	bool Receive();
+
+	void SetEvent() noexcept;
+
+	void OnSocketReady(unsigned events) noexcept;
+};
+
+void
+ClientGroup::Client::Start()
+{
+	want_write = Send();
+	SetEvent();
+}
+
+bool
+ClientGroup::Client::Send()
+{
+	const auto &options = group.options;
+
+	while (true) {
+		if (started == sent) {
+			/* no partial request: begin a new one? */
+			if (started == options.requests ||
+			    started - completed >= options.pipeline)
+				return false;
+
+			in_flight.push_back(Clock::now());
+			++started;
+		}
+
+		ssize_t nbytes = fd.Write(group.request.get() + send_position,
+					  options.size - send_position);
+		if (nbytes < 0) {
+			if (errno == EAGAIN)
+				return true;
+
+			throw MakeErrno("send() failed");
+		}
+
+		send_position += nbytes;
+		if (send_position == options.size) {
+			send_position = 0;
+			++sent;
+		}
+	}
+}
+
+bool
+ClientGroup::Client::Receive()
+{
+	const auto &options = group.options;
+
+	ssize_t nbytes = fd.Read(group.receive_buffer.get(),
+				 RECEIVE_BUFFER_SIZE);
+	if (nbytes < 0) {
+		if (errno == EAGAIN)
+			return true;
+
+		throw MakeErrno("recv() failed");
+	}
+
+	if (nbytes == 0)
+		throw std::runtime_error("Server closed the connection");
+
+	received += nbytes;
+
+	const auto now = Clock::now();
+	while (received >= options.size) {
+		if (in_flight.empty())
+			throw std::runtime_error("Excess data from server");
+
+		received -= options.size;
+		group.round_trips.push_back(now - in_flight.front());
+		in_flight.pop_front();
+		++completed;
+	}
+
+	return completed < options.requests;
+}
+
+void
+ClientGroup::Client::SetEvent() noexcept
+{
+	event.Set(fd.Get(), SocketEvent::READ|SocketEvent::PERSIST|
+		  (want_write ? SocketEvent::WRITE : 0));
+	event.Add();
+}
+
+void
+ClientGroup::Client::OnSocketReady(unsigned events) noexcept
+try {
+	if (events & SocketEvent::READ) {
+		if (!Receive()) {
+			event.Delete();
+			fd.Close();
+			group.OnClientFinished();
+			return;
+		}
+	}
+
+	/* receiving may have opened the pipeline window */
+	const bool old_want_write = want_write;
+	want_write = Send();
+	if (want_write != old_want_write) {
+		event.Delete();
+		SetEvent();
+	}
+} catch (...) {
+	event.Delete();
+	group.OnClientError(std::current_exception());
+}
+
+ClientGroup::ClientGroup(const ClientOptions &_options)
+	:event_loop(EventLoop::Independent()),
+	 options(_options),
+	 request(new char[options.size]),
+	 receive_buffer(new char[RECEIVE_BUFFER_SIZE])
+{
+	std::fill_n(request.get(), options.size, 'x');
+}
+
+ClientGroup::~ClientGroup() noexcept
+{
+	if (thread.joinable())
+		thread.join();
+}
+
+void
+ClientGroup::Add(UniqueSocketDescriptor &&fd)
+{
+	clients.emplace_front(*this, std::move(fd));
+	++running;
+}
+
+void
+ClientGroup::Run() noexcept
+{
+	try {
+		for (auto &i : clients)
+			i.Start();
+	} catch (...) {
+		error = std::current_exception();
+		return;
+	}
+
+	event_loop.Dispatch();
+}
+
+void
+ClientGroup::Join()
+{
+	thread.join();
+
+	/* close all sockets (and free their events) in the main
+	   thread, now that the loop is idle */
+	clients.clear();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+/**
+ * Open a counter for all system calls made by this process (and all
+ * threads created later).  Returns an undefined object if the kernel
+ * does not allow this.
+ */
+static UniqueFileDescriptor
+OpenSyscallCounter() noexcept
+{
+	static constexpr const char *id_paths[] = {
+		"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+		"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+	};
+
+	unsigned long long id = 0;
+	for (const char *path : id_paths) {
+		FILE *file = fopen(path, "r");
+		if (file == nullptr)
+			continue;
+
+		const bool success = fscanf(file, "%llu", &id) == 1;
+		fclose(file);
+		if (success)
+			break;
+	}
+
+	if (id == 0)
+		return UniqueFileDescriptor();
+
+	struct perf_event_attr attr{};
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.size = sizeof(attr);
+	attr.config = id;
+	attr.disabled = 1;
+	attr.inherit = 1;
+
+	return UniqueFileDescriptor(FileDescriptor(syscall(__NR_perf_event_open, &attr,
+							   0, -1, -1,
+							   PERF_FLAG_FD_CLOEXEC)));
+}
+
+static uint64_t
+ReadCounter(FileDescriptor fd) noexcept
+{
+	uint64_t value;
+	if (fd.Read(&value, sizeof(value)) != sizeof(value))
+		return 0;
+
+	return value;
+}
+
+static double
+ToSeconds(const struct timeval &tv) noexcept
+{
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double
+GetCpuSeconds(const struct rusage &ru) noexcept
+{
+	return ToSeconds(ru.ru_utime) + ToSeconds(ru.ru_stime);
+}
+
+static double
+ToMicroseconds(Clock::duration d) noexcept
+{
+	return std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(d).count();
+}
+
+static UniqueSocketDescriptor
+MakeListener(SocketAddress address)
+{
+	UniqueSocketDescriptor fd;
+	if (!fd.CreateNonBlock(address.GetFamily(), SOCK_STREAM, 0))
+		throw MakeErrno("Failed to create socket");
+
+	fd.SetReuseAddress(true);
+
+	if (!fd.Bind(address))
+		throw MakeErrno("Failed to bind");
+
+	if (!fd.Listen(1024))
+		throw MakeErrno("Failed to listen");
+
+	return fd;
+}
+
+static UniqueSocketDescriptor
+Connect(SocketAddress address, bool tcp)
+{
+	UniqueSocketDescriptor fd;
+	if (!fd.Create(address.GetFamily(), SOCK_STREAM, 0))
+		throw MakeErrno("Failed to create socket");
+
+	if (!fd.Connect(address))
+		throw MakeErrno("Failed to connect");
+
+	if (tcp)
+		fd.SetNoDelay();
+
+	fd.SetNonBlocking();
+	return fd;
+}
+
+int
+main(int argc, char **argv)
+try {
+	ConstBuffer<const char *> args(argv + 1, argc - 1);
+
+	ServerOptions server_options;
+	ClientOptions client_options;
+	unsigned connections = 16, server_threads = 1, client_threads = 1;
+	unsigned busy_poll_us = 0;
+	bool tcp = true, pin = false;
+
+	while (!args.empty() && *args.front() == '-') {
+		const char *arg = args.shift();
+		if (const char *c = StringAfterPrefix(arg, "--connections=")) {
+			connections = strtoul(c, nullptr, 10);
+		} else if (const char *n = StringAfterPrefix(arg, "--requests=")) {
+			client_options.requests = strtoul(n, nullptr, 10);
+		} else if (const char *s = StringAfterPrefix(arg, "--size=")) {
+			client_options.size = strtoul(s, nullptr, 10);
+		} else if (const char *p = StringAfterPrefix(arg, "--pipeline=")) {
+			client_options.pipeline = strtoul(p, nullptr, 10);
+		} else if (const char *t = StringAfterPrefix(arg, "--threads=")) {
+			server_threads = strtoul(t, nullptr, 10);
+		} else if (const char *t2 = StringAfterPrefix(arg, "--client-threads=")) {
+			client_threads = strtoul(t2, nullptr, 10);
+		} else if (const char *b = StringAfterPrefix(arg, "--busy-poll=")) {
+			busy_poll_us = strtoul(b, nullptr, 10);
+		} else if (StringIsEqual(arg, "--unix")) {
+			tcp = false;
+		} else if (StringIsEqual(arg, "--splice")) {
+			server_options.splice = true;
+		} else if (StringIsEqual(arg, "--coalesce")) {
+			server_options.coalesce = true;
+		} else if (StringIsEqual(arg, "--edge")) {
+			server_options.edge_triggered = true;
+		} else if (StringIsEqual(arg, "--pin")) {
+			pin = true;
+		} else
+			throw Usage();
+	}
+
+	if (!args.empty() || connections == 0 ||
+	    client_options.requests == 0 || client_options.size == 0 ||
+	    client_options.pipeline == 0 ||
+	    server_threads == 0 || client_threads == 0)
+		throw Usage();
+
+	/* must be opened before any thread is created, or else
+	   "inherit" won't cover it */
+	const auto syscall_counter = OpenSyscallCounter();
+
+	AllocatedSocketAddress bind_address;
+	if (tcp)
+		bind_address = IPv4Address(127, 0, 0, 1, 0);
+	else {
+		char path[64];
+		snprintf(path, sizeof(path), "@BenchSocket-%d", int(getpid()));
+		bind_address.SetLocal(path);
+	}
+
+	auto listener = MakeListener(bind_address);
+	const auto address = listener.GetLocalAddress();
+
+	EventLoopPool pool(server_threads);
+
+	/* all loops share one listener; EPOLLEXCLUSIVE wakes only one
+	   of them per connection */
+	std::forward_list<BenchServer> servers;
+	for (size_t i = 0; i < pool.size(); ++i) {
+		servers.emplace_front(pool[i], server_options,
+				      tcp ? FdType::FD_TCP : FdType::FD_SOCKET);
+		auto &server = servers.front();
+		server.SetExclusive(pool.size() > 1);
+		pool[i].SetBusyPoll(std::chrono::microseconds(busy_poll_us));
+		server.Listen(UniqueSocketDescriptor(dup(listener.Get())));
+	}
+
+	pool.Start(pin);
+
+	std::vector<std::unique_ptr<ClientGroup>> groups;
+	for (unsigned i = 0; i < client_threads; ++i)
+		groups.emplace_back(new ClientGroup(client_options));
+
+	for (unsigned i = 0; i < connections; ++i)
+		groups[i % groups.size()]->Add(Connect(address, tcp));
+
+	struct rusage ru_start, ru_end;
+	getrusage(RUSAGE_SELF, &ru_start);
+
+	if (syscall_counter.IsDefined()) {
+		ioctl(syscall_counter.Get(), PERF_EVENT_IOC_RESET, 0);
+		ioctl(syscall_counter.Get(), PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	const auto start_time = Clock::now();
+
+	for (auto &i : groups)
+		i->Start();
+
+	std::vector<Clock::duration> round_trips;
+	for (auto &i : groups) {
+		i->Join();
+		round_trips.insert(round_trips.end(),
+				   i->round_trips.begin(), i->round_trips.end());
+	}
+
+	const auto duration = Clock::now() - start_time;
+
+	if (syscall_counter.IsDefined())
+		ioctl(syscall_counter.Get(), PERF_EVENT_IOC_DISABLE, 0);
+
+	getrusage(RUSAGE_SELF, &ru_end);
+
+	pool.Stop();
+	servers.clear();
+
+	const double seconds =
+		std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+	const uint64_t n_requests = uint64_t(connections) * client_options.requests;
+
+	printf("%u connections, %llu requests in %.3f s: %.0f req/s, %.2f MB/s\n",
+	       connections, (unsigned long long)n_requests, seconds,
+	       n_requests / seconds,
+	       n_requests * client_options.size / seconds / (1024 * 1024));
+
+	std::sort(round_trips.begin(), round_trips.end());
+	const size_t n = round_trips.size();
+	printf("latency: p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+	       ToMicroseconds(round_trips[n / 2]),
+	       ToMicroseconds(round_trips[n * 9 / 10]),
+	       ToMicroseconds(round_trips[n * 99 / 100]),
+	       ToMicroseconds(round_trips[n * 999 / 1000]),
+	       ToMicroseconds(round_trips.back()));
+
+	if (syscall_counter.IsDefined())
+		printf("syscalls/request: %.2f\n",
+		       double(ReadCounter(syscall_counter.ToFileDescriptor())) / n_requests);
+	else
+		printf("syscalls/request: n/a (perf_event_open() not permitted)\n");
+
+	printf("cpu/request: %.2fus, context switches/request: %.3f\n",
+	       (GetCpuSeconds(ru_end) - GetCpuSeconds(ru_start)) * 1e6 / n_requests,
+	       double(ru_end.ru_nvcsw + ru_end.ru_nivcsw -
+		      ru_start.ru_nvcsw - ru_start.ru_nivcsw) / n_requests);
+
+	return EXIT_SUCCESS;
+} catch (Usage) {
+	fprintf(stderr, "Usage: BenchSocket [--unix] [--connections=#] [--requests=#]"
+		" [--size=#] [--pipeline=#] [--threads=#] [--client-threads=#]"
+		" [--busy-poll=MICROSECONDS]"
+		" [--splice] [--coalesce] [--edge] [--pin]\n");
+	return EXIT_FAILURE;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
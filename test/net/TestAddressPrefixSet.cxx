@@ -0,0 +1,130 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/AddressPrefixSet.hxx"
+#include "net/MaskedSocketAddress.hxx"
+#include "net/Parser.hxx"
+
+#include <gtest/gtest.h>
+
+static size_t
+Find(const AddressPrefixSet &set, const char *address)
+{
+	return set.Find(ParseSocketAddress(address, 42, false));
+}
+
+TEST(AddressPrefixSetTest, Empty)
+{
+	const AddressPrefixSet set;
+	EXPECT_TRUE(set.empty());
+	EXPECT_EQ(set.size(), 0u);
+	EXPECT_EQ(Find(set, "192.168.1.2"), AddressPrefixSet::npos);
+	EXPECT_EQ(Find(set, "::1"), AddressPrefixSet::npos);
+}
+
+TEST(AddressPrefixSetTest, IPv4)
+{
+	AddressPrefixSet set;
+	set.Add("10.0.0.0/8", 1);
+	set.Add("10.1.0.0/16", 2);
+	set.Add("10.1.2.0/24", 3);
+	set.Add("192.168.1.1/32", 4);
+	set.Add("172.16.0.0/12", 5);
+	EXPECT_EQ(set.size(), 5u);
+
+	EXPECT_EQ(Find(set, "10.2.3.4"), 1u);
+	EXPECT_EQ(Find(set, "10.1.3.4"), 2u);
+	EXPECT_EQ(Find(set, "10.1.2.4"), 3u);
+	EXPECT_EQ(Find(set, "192.168.1.1"), 4u);
+	EXPECT_EQ(Find(set, "172.31.255.255"), 5u);
+	EXPECT_EQ(Find(set, "172.32.0.1"), AddressPrefixSet::npos);
+	EXPECT_EQ(Find(set, "192.168.1.2"), AddressPrefixSet::npos);
+	EXPECT_EQ(Find(set, "11.0.0.1"), AddressPrefixSet::npos);
+
+	/* IPv4 prefixes don't match IPv6 addresses */
+	EXPECT_EQ(Find(set, "::1"), AddressPrefixSet::npos);
+}
+
+TEST(AddressPrefixSetTest, IPv6)
+{
+	AddressPrefixSet set;
+	set.Add("2001:db8::/32", 1);
+	set.Add("2001:db8:1::/48", 2);
+	set.Add("::1/128", 3);
+	EXPECT_EQ(set.size(), 3u);
+
+	EXPECT_EQ(Find(set, "2001:db8::1"), 1u);
+	EXPECT_EQ(Find(set, "2001:db8:1::1"), 2u);
+	EXPECT_EQ(Find(set, "2001:db8:2::1"), 1u);
+	EXPECT_EQ(Find(set, "::1"), 3u);
+	EXPECT_EQ(Find(set, "::2"), AddressPrefixSet::npos);
+	EXPECT_EQ(Find(set, "2001:db9::1"), AddressPrefixSet::npos);
+	EXPECT_EQ(Find(set, "10.0.0.1"), AddressPrefixSet::npos);
+}
+
+TEST(AddressPrefixSetTest, InsertionOrder)
+{
+	/* insert the more specific prefixes first to exercise edge
+	   splitting */
+	AddressPrefixSet set;
+	set.Add("10.1.2.0/24", 3);
+	set.Add("10.1.0.0/16", 2);
+	set.Add("10.0.0.0/8", 1);
+	set.Add("10.128.0.0/9", 4);
+
+	EXPECT_EQ(Find(set, "10.1.2.4"), 3u);
+	EXPECT_EQ(Find(set, "10.1.3.4"), 2u);
+	EXPECT_EQ(Find(set, "10.2.3.4"), 1u);
+	EXPECT_EQ(Find(set, "10.200.0.1"), 4u);
+}
+
+TEST(AddressPrefixSetTest, Duplicate)
+{
+	AddressPrefixSet set;
+	set.Add("10.0.0.0/8", 1);
+	set.Add("10.0.0.0/8", 2);
+	EXPECT_EQ(set.size(), 1u);
+	EXPECT_EQ(Find(set, "10.1.2.3"), 1u);
+}
+
+TEST(AddressPrefixSetTest, Default)
+{
+	AddressPrefixSet set;
+	set.Add("0.0.0.0/0", 1);
+	set.Add("192.168.0.0/16", 2);
+	set.Add("::/0", 3);
+
+	EXPECT_EQ(Find(set, "1.2.3.4"), 1u);
+	EXPECT_EQ(Find(set, "192.168.3.4"), 2u);
+	EXPECT_EQ(Find(set, "2001:db8::1"), 3u);
+	EXPECT_TRUE(set.Contains(ParseSocketAddress("8.8.8.8", 42, false)));
+}
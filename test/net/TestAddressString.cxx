@@ -33,6 +33,7 @@
 #include "net/Parser.hxx"
 #include "net/ToString.hxx"
 #include "net/AllocatedSocketAddress.hxx"
+#include "net/StaticSocketAddress.hxx"
 
 #include <gtest/gtest.h>
 
@@ -63,3 +64,89 @@ TEST(SocketAddressStringTest, Basic)
         ASSERT_STREQ(buffer, host);
     }
 }
+
+TEST(SocketAddressStringTest, Compression)
+{
+    static constexpr struct {
+        const char *in, *out;
+    } tests[] = {
+        { "2001:0db8:0000:0000:0000:0000:0000:0001", "2001:db8::1" },
+        { "2001:db8:0:0:1:0:0:1", "2001:db8::1:0:0:1" },
+        { "2001:db8:0:1:1:1:1:1", "2001:db8:0:1:1:1:1:1" },
+        { "2001:DB8::ABCD", "2001:db8::abcd" },
+        { "0:0:0:0:0:0:0:0", "::" },
+        { "1::", "1::" },
+        { "::ffff:192.168.1.2", "192.168.1.2" },
+        { "::1.2.3.4", "::1.2.3.4" },
+        { "10.0.0.255", "10.0.0.255" },
+    };
+
+    for (const auto &i : tests) {
+        const auto address = ParseSocketAddress(i.in, 80, false);
+
+        char buffer[256];
+        ASSERT_TRUE(HostToString(buffer, sizeof(buffer), address));
+        ASSERT_STREQ(buffer, i.out);
+    }
+}
+
+TEST(SocketAddressStringTest, Small)
+{
+    const auto address = ParseSocketAddress("[2001:db8::1]:8080", 80, false);
+
+    char buffer[20];
+    ASSERT_TRUE(ToString(buffer, sizeof(buffer), address));
+    ASSERT_STREQ(buffer, "[2001:db8::1]:8080");
+
+    ASSERT_FALSE(ToString(buffer, 18, address));
+}
+
+TEST(SocketAddressStringTest, ParseNumeric)
+{
+    static constexpr struct {
+        const char *in, *out;
+    } tests[] = {
+        { "127.0.0.1", "127.0.0.1:80" },
+        { "127.0.0.1:1234", "127.0.0.1:1234" },
+        { "::", "[::]:80" },
+        { "::1", "[::1]:80" },
+        { "[::1]", "[::1]:80" },
+        { "[::1]:1234", "[::1]:1234" },
+        { "1:2:3:4:5:6:7:8", "[1:2:3:4:5:6:7:8]:80" },
+        { "1:2:3:4:5:6:7::", "[1:2:3:4:5:6:7:0]:80" },
+        { "::ffff:1.2.3.4", "1.2.3.4:80" },
+    };
+
+    for (const auto &i : tests) {
+        StaticSocketAddress address;
+        ASSERT_TRUE(ParseNumericAddress(address, i.in, 80)) << i.in;
+
+        char buffer[256];
+        ASSERT_TRUE(ToString(buffer, sizeof(buffer), address));
+        ASSERT_STREQ(buffer, i.out);
+    }
+
+    static constexpr const char *invalid[] = {
+        "",
+        "localhost",
+        "1.2.3",
+        "1.2.3.256",
+        "010.0.0.1",
+        "1.2.3.4:",
+        "1.2.3.4:65536",
+        "1.2.3.4:http",
+        "1:2:3:4:5:6:7",
+        "1:2:3:4:5:6:7:8:9",
+        "1::2::3",
+        "12345::",
+        ":1::",
+        "[::1",
+        "[::1]x",
+        "fe80::1%eth0",
+    };
+
+    for (const char *i : invalid) {
+        StaticSocketAddress address;
+        ASSERT_FALSE(ParseNumericAddress(address, i, 80)) << i;
+    }
+}
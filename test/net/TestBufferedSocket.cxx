@@ -0,0 +1,285 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/net/BufferedSocket.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <sys/socket.h>
+
+/**
+ * Sends data with BufferedSocket::Enqueue() and Write(); the test
+ * reads the other end of the socket pair directly.
+ */
+class Sender final : BufferedSocketHandler {
+	BufferedSocket socket;
+
+	/**
+	 * Sent with Write() from OnBufferedWrite().
+	 */
+	std::string pending;
+
+public:
+	unsigned n_drained = 0, n_write = 0;
+
+	std::exception_ptr error;
+
+	Sender(EventLoop &event_loop, UniqueSocketDescriptor &&fd)
+		:socket(event_loop)
+	{
+		socket.Init(fd.Release(), FdType::FD_SOCKET,
+			    nullptr, nullptr, *this);
+	}
+
+	~Sender() noexcept {
+		if (socket.IsConnected())
+			socket.Close();
+		socket.Destroy();
+	}
+
+	BufferedSocket &GetSocket() noexcept {
+		return socket;
+	}
+
+	void Enqueue(const std::string &data) {
+		socket.Enqueue(data.data(), data.size());
+	}
+
+	/**
+	 * Send the data with Write() as soon as the socket is ready.
+	 */
+	void Write(std::string &&data) noexcept {
+		pending = std::move(data);
+		socket.ScheduleWrite();
+	}
+
+private:
+	/* virtual methods from class BufferedSocketHandler */
+	BufferedResult OnBufferedData() override {
+		socket.Consumed(socket.GetAvailable());
+		return BufferedResult::OK;
+	}
+
+	bool OnBufferedClosed() noexcept override {
+		socket.Close();
+		return false;
+	}
+
+	bool OnBufferedWrite() override {
+		++n_write;
+
+		ssize_t nbytes = socket.Write(pending.data(), pending.size());
+		if (nbytes == WRITE_BLOCKING)
+			return true;
+
+		if (nbytes < 0)
+			throw MakeErrno("Write failed");
+
+		pending.erase(0, nbytes);
+		if (pending.empty())
+			socket.UnscheduleWrite();
+		return true;
+	}
+
+	bool OnBufferedDrained() noexcept override {
+		++n_drained;
+		return true;
+	}
+
+	void OnBufferedError(std::exception_ptr e) noexcept override {
+		error = e;
+		socket.Close();
+	}
+};
+
+static void
+RunLoop(EventLoop &event_loop, unsigned n=8)
+{
+	for (unsigned i = 0; i < n; ++i)
+		event_loop.LoopOnceNonBlock();
+}
+
+/**
+ * Receive everything which is available right now.
+ */
+static std::string
+ReceiveAll(SocketDescriptor fd)
+{
+	std::string result;
+	char buffer[65536];
+	ssize_t nbytes;
+	while ((nbytes = recv(fd.Get(), buffer, sizeof(buffer),
+			      MSG_DONTWAIT)) > 0)
+		result.append(buffer, nbytes);
+	return result;
+}
+
+static void
+CreateSocketPair(UniqueSocketDescriptor &a, UniqueSocketDescriptor &b)
+{
+	if (!UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+							       SOCK_STREAM, 0,
+							       a, b))
+		throw MakeErrno("socketpair() failed");
+}
+
+TEST(BufferedSocket, Enqueue)
+{
+	EventLoop event_loop;
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	Sender sender(event_loop, std::move(a));
+	sender.Enqueue("foo");
+	sender.Enqueue("bar");
+	ASSERT_EQ(sender.GetSocket().GetQueuedOutput(), 6u);
+
+	/* nothing is sent before the end of the loop iteration */
+	ASSERT_EQ(ReceiveAll(b), "");
+
+	sender.Enqueue("baz");
+	RunLoop(event_loop);
+
+	ASSERT_FALSE(sender.error);
+	ASSERT_EQ(ReceiveAll(b), "foobarbaz");
+	ASSERT_EQ(sender.GetSocket().GetQueuedOutput(), 0u);
+	ASSERT_EQ(sender.n_drained, 1u);
+
+	/* Write() does not overtake the queue */
+	sender.Enqueue("1");
+	sender.Write("2");
+	RunLoop(event_loop);
+
+	ASSERT_FALSE(sender.error);
+	ASSERT_EQ(ReceiveAll(b), "12");
+	ASSERT_EQ(sender.n_drained, 2u);
+}
+
+TEST(BufferedSocket, EnqueueBlocking)
+{
+	EventLoop event_loop;
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	Sender sender(event_loop, std::move(a));
+
+	/* more than the socket buffer can take */
+	std::string data;
+	for (unsigned i = 0; data.size() < 4 * 1024 * 1024; ++i)
+		data.append(std::to_string(i));
+	sender.Enqueue(data);
+
+	std::string received;
+	while (received.size() < data.size()) {
+		RunLoop(event_loop, 1);
+		ASSERT_FALSE(sender.error);
+		received += ReceiveAll(b);
+	}
+
+	ASSERT_EQ(received, data);
+	RunLoop(event_loop);
+	ASSERT_EQ(sender.n_drained, 1u);
+}
+
+TEST(BufferedSocket, Cork)
+{
+	EventLoop event_loop;
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	Sender sender(event_loop, std::move(a));
+	sender.GetSocket().Cork();
+	sender.Enqueue("foo");
+	RunLoop(event_loop);
+	sender.Enqueue("bar");
+	RunLoop(event_loop);
+
+	ASSERT_EQ(ReceiveAll(b), "");
+	ASSERT_EQ(sender.n_drained, 0u);
+
+	/* the handler cannot write while the queue is corked */
+	sender.Write("baz");
+	RunLoop(event_loop);
+	ASSERT_EQ(ReceiveAll(b), "");
+	ASSERT_EQ(sender.n_write, 0u);
+
+	sender.GetSocket().Uncork();
+	RunLoop(event_loop);
+
+	ASSERT_FALSE(sender.error);
+	ASSERT_EQ(ReceiveAll(b), "foobarbaz");
+	ASSERT_EQ(sender.n_drained, 1u);
+	ASSERT_EQ(sender.n_write, 1u);
+}
+
+TEST(BufferedSocket, CorkBlocking)
+{
+	EventLoop event_loop;
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	Sender sender(event_loop, std::move(a));
+
+	const std::string data(4 * 1024 * 1024, 'x');
+	sender.Enqueue(data);
+
+	/* the first flush fills the socket buffer; now the "write"
+	   event is registered */
+	RunLoop(event_loop, 1);
+	ASSERT_GT(sender.GetSocket().GetQueuedOutput(), 0u);
+
+	/* Cork() holds back the rest, even though the socket
+	   becomes writable again */
+	sender.GetSocket().Cork();
+	size_t received = ReceiveAll(b).size();
+	const size_t queued = sender.GetSocket().GetQueuedOutput();
+	RunLoop(event_loop);
+	ASSERT_EQ(ReceiveAll(b), "");
+	ASSERT_EQ(sender.GetSocket().GetQueuedOutput(), queued);
+
+	sender.GetSocket().Uncork();
+	while (received < data.size()) {
+		RunLoop(event_loop, 1);
+		ASSERT_FALSE(sender.error);
+		received += ReceiveAll(b).size();
+	}
+
+	ASSERT_EQ(received, data.size());
+	RunLoop(event_loop);
+	ASSERT_EQ(sender.n_drained, 1u);
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/ConnectionPool.hxx"
+#include "event/Loop.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "util/Cancellable.hxx"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <sys/socket.h>
+
+struct MyConnectionPoolHandler final : ConnectionPoolHandler {
+	UniqueSocketDescriptor fd;
+	bool done = false, reused = false, failed = false;
+
+	void OnConnectionPoolReady(UniqueSocketDescriptor &&_fd,
+				   bool _reused) override {
+		fd = std::move(_fd);
+		reused = _reused;
+		done = true;
+	}
+
+	void OnConnectionPoolError(std::exception_ptr) override {
+		done = failed = true;
+	}
+};
+
+struct Server {
+	UniqueSocketDescriptor listener;
+	StaticSocketAddress address;
+	std::vector<UniqueSocketDescriptor> accepted;
+
+	Server() {
+		EXPECT_TRUE(listener.CreateNonBlock(AF_LOCAL, SOCK_STREAM, 0));
+		EXPECT_TRUE(listener.AutoBind());
+		EXPECT_TRUE(listener.Listen(16));
+		address = listener.GetLocalAddress();
+	}
+
+	void Accept() {
+		StaticSocketAddress peer;
+		while (true) {
+			auto fd = listener.AcceptNonBlock(peer);
+			if (!fd.IsDefined())
+				break;
+
+			accepted.emplace_back(std::move(fd));
+		}
+	}
+};
+
+static void
+Wait(EventLoop &event_loop, Server &server,
+     const MyConnectionPoolHandler &handler)
+{
+	while (!handler.done) {
+		server.Accept();
+		event_loop.LoopOnceNonBlock();
+	}
+
+	server.Accept();
+}
+
+TEST(ConnectionPool, Reuse)
+{
+	EventLoop event_loop;
+	Server server;
+	ConnectionPool pool(event_loop);
+	CancellablePointer cancel_ptr;
+
+	MyConnectionPoolHandler h1;
+	pool.Get(server.address, h1, cancel_ptr);
+	Wait(event_loop, server, h1);
+	ASSERT_FALSE(h1.failed);
+	EXPECT_FALSE(h1.reused);
+	EXPECT_EQ(server.accepted.size(), 1u);
+
+	pool.Put(server.address, std::move(h1.fd), true);
+	EXPECT_EQ(pool.GetIdleCount(), 1u);
+
+	MyConnectionPoolHandler h2;
+	pool.Get(server.address, h2, cancel_ptr);
+	ASSERT_TRUE(h2.done);
+	EXPECT_TRUE(h2.reused);
+	EXPECT_EQ(pool.GetIdleCount(), 0u);
+
+	/* the peer closes the idle connection: it must not be
+	   reused */
+	pool.Put(server.address, std::move(h2.fd), true);
+	server.accepted.clear();
+	event_loop.LoopOnceNonBlock();
+
+	MyConnectionPoolHandler h3;
+	pool.Get(server.address, h3, cancel_ptr);
+	Wait(event_loop, server, h3);
+	ASSERT_FALSE(h3.failed);
+	EXPECT_FALSE(h3.reused);
+	EXPECT_EQ(server.accepted.size(), 1u);
+
+	pool.Put(server.address, std::move(h3.fd), false);
+	EXPECT_EQ(pool.GetIdleCount(), 0u);
+}
+
+TEST(ConnectionPool, Limit)
+{
+	EventLoop event_loop;
+	Server server;
+	ConnectionPool pool(event_loop, 1);
+
+	MyConnectionPoolHandler h1, h2, h3;
+	CancellablePointer cancel1, cancel2, cancel3;
+	pool.Get(server.address, h1, cancel1);
+	pool.Get(server.address, h2, cancel2);
+	pool.Get(server.address, h3, cancel3);
+	Wait(event_loop, server, h1);
+	ASSERT_FALSE(h1.failed);
+	EXPECT_FALSE(h2.done);
+	EXPECT_FALSE(h3.done);
+
+	/* h3 gives up */
+	cancel3.Cancel();
+
+	/* returning the connection hands it to h2 */
+	pool.Put(server.address, std::move(h1.fd), true);
+	ASSERT_TRUE(h2.done);
+	EXPECT_TRUE(h2.reused);
+	EXPECT_FALSE(h3.done);
+	EXPECT_EQ(server.accepted.size(), 1u);
+
+	pool.Put(server.address, std::move(h2.fd), true);
+	EXPECT_EQ(pool.GetIdleCount(), 1u);
+
+	pool.FlushIdle();
+	EXPECT_EQ(pool.GetIdleCount(), 0u);
+	event_loop.LoopOnceNonBlock();
+}
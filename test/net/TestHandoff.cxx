@@ -0,0 +1,191 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/HandoffServer.hxx"
+#include "event/Loop.hxx"
+#include "net/Handoff.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+TEST(Handoff, Protocol)
+{
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL,
+							      SOCK_SEQPACKET, 0,
+							      a, b));
+
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipe(r, w));
+
+	SendHandoffItem(a, "pipe", "config", r.ToFileDescriptor());
+	SendHandoffItem(a, "other", "", w.ToFileDescriptor());
+	SendHandoffCommand(a, HandoffCommand::END);
+
+	HandoffClient client(std::move(b));
+
+	/* mismatching configuration */
+	EXPECT_FALSE(client.Take("other", "x").IsDefined());
+	EXPECT_FALSE(client.Take("other", "").IsDefined());
+	EXPECT_FALSE(client.Take("nonexistent", "").IsDefined());
+
+	auto fd = client.Take("pipe", "config");
+	ASSERT_TRUE(fd.IsDefined());
+	EXPECT_NE(fd.Get(), r.Get());
+
+	/* the received descriptor refers to the same pipe */
+	ASSERT_EQ(write(w.Get(), "x", 1), 1);
+	char ch;
+	ASSERT_EQ(read(fd.Get(), &ch, 1), 1);
+	EXPECT_EQ(ch, 'x');
+
+	client.Commit();
+	EXPECT_TRUE(ReceiveHandoffCommit(a));
+}
+
+TEST(Handoff, Closed)
+{
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL,
+							      SOCK_SEQPACKET, 0,
+							      a, b));
+
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipe(r, w));
+
+	SendHandoffItem(a, "pipe", "", r.ToFileDescriptor());
+	a.Close();
+
+	EXPECT_THROW(HandoffClient(std::move(b)), std::runtime_error);
+}
+
+class MyHandoffHandler final : public HandoffHandler {
+public:
+	FileDescriptor fd;
+
+	bool complete = false, error = false;
+
+	void OnHandoffRequest(HandoffSender &sender) override {
+		sender.Add("listener", "tcp", fd);
+	}
+
+	void OnHandoffComplete() noexcept override {
+		complete = true;
+	}
+
+	void OnHandoffError(std::exception_ptr) noexcept override {
+		error = true;
+	}
+};
+
+TEST(Handoff, Server)
+{
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipe(r, w));
+
+	EventLoop event_loop;
+	MyHandoffHandler handler;
+	handler.fd = r.ToFileDescriptor();
+
+	HandoffServer server(event_loop, handler);
+	server.Listen("@test_handoff_server");
+
+	/* the new process exits before committing */
+	{
+		UniqueSocketDescriptor s;
+		ASSERT_TRUE(s.Create(AF_LOCAL, SOCK_SEQPACKET, 0));
+		ASSERT_TRUE(s.Connect(server.GetLocalAddress()));
+
+		while (!server.IsBusy() && !handler.error)
+			event_loop.LoopOnce();
+		ASSERT_TRUE(server.IsBusy());
+
+		HandoffClient client(std::move(s));
+		EXPECT_TRUE(client.Take("listener", "tcp").IsDefined());
+	}
+
+	while (server.IsBusy())
+		event_loop.LoopOnce();
+	EXPECT_TRUE(handler.error);
+	EXPECT_FALSE(handler.complete);
+
+	/* successful handoff */
+	handler.error = false;
+
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.Create(AF_LOCAL, SOCK_SEQPACKET, 0));
+	ASSERT_TRUE(s.Connect(server.GetLocalAddress()));
+
+	while (!server.IsBusy() && !handler.error)
+		event_loop.LoopOnce();
+	ASSERT_TRUE(server.IsBusy());
+
+	HandoffClient client(std::move(s));
+	EXPECT_FALSE(client.Take("listener", "udp").IsDefined());
+	client.Commit();
+
+	while (!handler.complete && !handler.error)
+		event_loop.LoopOnce();
+	EXPECT_TRUE(handler.complete);
+	EXPECT_FALSE(handler.error);
+	EXPECT_FALSE(server.IsBusy());
+}
+
+TEST(Handoff, ServerRejectsForeignUid)
+{
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipe(r, w));
+
+	EventLoop event_loop;
+	MyHandoffHandler handler;
+	handler.fd = r.ToFileDescriptor();
+
+	HandoffServer server(event_loop, handler);
+	server.SetAllowedUid(geteuid() + 1);
+	server.Listen("@test_handoff_server_uid");
+
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.Create(AF_LOCAL, SOCK_SEQPACKET, 0));
+	ASSERT_TRUE(s.Connect(server.GetLocalAddress()));
+
+	while (!server.IsBusy() && !handler.error)
+		event_loop.LoopOnce();
+	EXPECT_TRUE(handler.error);
+	EXPECT_FALSE(server.IsBusy());
+
+	/* no file descriptor has been passed */
+	EXPECT_THROW(HandoffClient(std::move(s)), std::runtime_error);
+}
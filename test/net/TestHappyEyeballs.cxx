@@ -0,0 +1,332 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/net/HappyEyeballs.hxx"
+#include "event/TimerEvent.hxx"
+#include "event/Loop.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/IPv6Address.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace {
+
+/**
+ * A TCP socket on a loopback address.
+ */
+struct Peer {
+	UniqueSocketDescriptor fd;
+
+	/**
+	 * A connection which fills the accept queue; see MakeHanging().
+	 */
+	UniqueSocketDescriptor filler;
+
+	explicit Peer(SocketAddress address) {
+		EXPECT_TRUE(fd.Create(address.GetFamily(), SOCK_STREAM, 0));
+		EXPECT_TRUE(fd.Bind(address));
+	}
+
+	/**
+	 * Create a peer which accepts connections.
+	 */
+	static Peer MakeListening(SocketAddress address) {
+		Peer peer(address);
+		EXPECT_TRUE(peer.fd.Listen(16));
+		return peer;
+	}
+
+	/**
+	 * Create a peer which refuses connections: the port is bound,
+	 * but nobody listens on it.
+	 */
+	static Peer MakeRefusing(SocketAddress address) {
+		return Peer(address);
+	}
+
+	/**
+	 * Create a peer where connect() neither succeeds nor fails:
+	 * its accept queue is full, and the kernel drops all SYNs.
+	 */
+	static Peer MakeHanging(SocketAddress address) {
+		Peer peer(address);
+		EXPECT_TRUE(peer.fd.Listen(0));
+
+		EXPECT_TRUE(peer.filler.Create(address.GetFamily(),
+					       SOCK_STREAM, 0));
+		EXPECT_TRUE(peer.filler.Connect(peer.GetAddress()));
+		return peer;
+	}
+
+	AllocatedSocketAddress GetAddress() const {
+		return AllocatedSocketAddress(fd.GetLocalAddress());
+	}
+};
+
+static bool
+HaveIPv6Loopback() noexcept
+{
+	UniqueSocketDescriptor fd;
+	return fd.Create(AF_INET6, SOCK_STREAM, 0) &&
+		fd.Bind(IPv6Address(0, 0, 0, 0, 0, 0, 0, 1, 0));
+}
+
+struct Result final : ConnectSocketHandler {
+	EventLoop &event_loop;
+
+	UniqueSocketDescriptor fd;
+	std::exception_ptr error;
+	bool done = false, timed_out = false;
+
+	std::chrono::steady_clock::time_point finished;
+
+	explicit Result(EventLoop &_event_loop) noexcept
+		:event_loop(_event_loop) {}
+
+	/**
+	 * Returns the port of the connection's peer.
+	 */
+	unsigned GetPeerPort() const {
+		return fd.GetPeerAddress().GetPort();
+	}
+
+	void Finish() noexcept {
+		done = true;
+		finished = std::chrono::steady_clock::now();
+		event_loop.Break();
+	}
+
+	/* virtual methods from ConnectSocketHandler */
+	void OnSocketConnectSuccess(UniqueSocketDescriptor &&_fd) override {
+		fd = std::move(_fd);
+		Finish();
+	}
+
+	void OnSocketConnectTimeout() override {
+		timed_out = true;
+		Finish();
+	}
+
+	void OnSocketConnectError(std::exception_ptr ep) override {
+		error = ep;
+		Finish();
+	}
+};
+
+/**
+ * Run the #EventLoop until the #Result is done, but not longer than
+ * five seconds.
+ */
+static std::chrono::steady_clock::duration
+ConnectAndWait(EventLoop &event_loop, HappyEyeballsConnect &connect,
+	       const std::vector<AllocatedSocketAddress> &addresses,
+	       Result &result)
+{
+	TimerEvent timeout(event_loop, BIND_METHOD(event_loop, &EventLoop::Break));
+	timeout.Add({5, 0});
+
+	const auto start = std::chrono::steady_clock::now();
+	connect.Connect(addresses, {10, 0});
+	if (!result.done)
+		event_loop.Dispatch();
+
+	timeout.Cancel();
+	return result.finished - start;
+}
+
+}
+
+static constexpr IPv4Address LOCALHOST4(127, 0, 0, 1, 0);
+static constexpr struct timeval ATTEMPT_DELAY{0, 100000};
+
+TEST(HappyEyeballs, First)
+{
+	EventLoop event_loop;
+	const auto a = Peer::MakeListening(LOCALHOST4);
+	const auto b = Peer::MakeListening(LOCALHOST4);
+
+	Result result(event_loop);
+	HappyEyeballsConnect connect(event_loop, result, ATTEMPT_DELAY);
+	const auto duration =
+		ConnectAndWait(event_loop, connect,
+			       {a.GetAddress(), b.GetAddress()}, result);
+
+	ASSERT_TRUE(result.fd.IsDefined());
+	EXPECT_EQ(result.GetPeerPort(), a.GetAddress().GetPort());
+	EXPECT_LT(duration, std::chrono::milliseconds(100));
+	EXPECT_FALSE(connect.IsPending());
+}
+
+/**
+ * The next attempt starts only after the "Connection Attempt Delay"
+ * has elapsed, and the first one to succeed wins.
+ */
+TEST(HappyEyeballs, Stagger)
+{
+	EventLoop event_loop;
+	const auto a = Peer::MakeHanging(LOCALHOST4);
+	const auto b = Peer::MakeListening(LOCALHOST4);
+
+	Result result(event_loop);
+	HappyEyeballsConnect connect(event_loop, result, ATTEMPT_DELAY);
+	const auto duration =
+		ConnectAndWait(event_loop, connect,
+			       {a.GetAddress(), b.GetAddress()}, result);
+
+	ASSERT_TRUE(result.fd.IsDefined());
+	EXPECT_EQ(result.GetPeerPort(), b.GetAddress().GetPort());
+	EXPECT_GE(duration, std::chrono::milliseconds(90));
+	EXPECT_LT(duration, std::chrono::milliseconds(900));
+	EXPECT_FALSE(connect.IsPending());
+}
+
+/**
+ * A failed attempt starts the next one without waiting for the
+ * "Connection Attempt Delay".
+ */
+TEST(HappyEyeballs, FailFast)
+{
+	EventLoop event_loop;
+	const auto a = Peer::MakeRefusing(LOCALHOST4);
+	const auto b = Peer::MakeListening(LOCALHOST4);
+
+	Result result(event_loop);
+	HappyEyeballsConnect connect(event_loop, result, {10, 0});
+	const auto duration =
+		ConnectAndWait(event_loop, connect,
+			       {a.GetAddress(), b.GetAddress()}, result);
+
+	ASSERT_TRUE(result.fd.IsDefined());
+	EXPECT_EQ(result.GetPeerPort(), b.GetAddress().GetPort());
+	EXPECT_LT(duration, std::chrono::seconds(1));
+}
+
+TEST(HappyEyeballs, AllFail)
+{
+	EventLoop event_loop;
+	const auto a = Peer::MakeRefusing(LOCALHOST4);
+	const auto b = Peer::MakeRefusing(LOCALHOST4);
+
+	Result result(event_loop);
+	HappyEyeballsConnect connect(event_loop, result, ATTEMPT_DELAY);
+	ConnectAndWait(event_loop, connect,
+		       {a.GetAddress(), b.GetAddress()}, result);
+
+	ASSERT_TRUE(result.done);
+	EXPECT_FALSE(result.fd.IsDefined());
+	EXPECT_TRUE(result.error);
+	EXPECT_FALSE(connect.IsPending());
+}
+
+TEST(HappyEyeballs, Empty)
+{
+	EventLoop event_loop;
+
+	Result result(event_loop);
+	HappyEyeballsConnect connect(event_loop, result);
+	connect.Connect(std::vector<AllocatedSocketAddress>(), {1, 0});
+
+	EXPECT_TRUE(result.done);
+	EXPECT_TRUE(result.error);
+}
+
+/**
+ * The address families are interleaved: after the first (hanging)
+ * IPv4 address, the IPv6 address is tried before the second IPv4
+ * address.
+ */
+TEST(HappyEyeballs, Interleave)
+{
+	if (!HaveIPv6Loopback())
+		GTEST_SKIP();
+
+	static constexpr IPv6Address localhost6(0, 0, 0, 0, 0, 0, 0, 1, 0);
+
+	EventLoop event_loop;
+	const auto a = Peer::MakeHanging(LOCALHOST4);
+	const auto b = Peer::MakeHanging(LOCALHOST4);
+	const auto c = Peer::MakeListening(LOCALHOST4);
+	const auto d = Peer::MakeListening(localhost6);
+
+	Result result(event_loop);
+	HappyEyeballsConnect connect(event_loop, result, ATTEMPT_DELAY);
+	const auto duration =
+		ConnectAndWait(event_loop, connect,
+			       {a.GetAddress(), b.GetAddress(),
+				c.GetAddress(), d.GetAddress()},
+			       result);
+
+	/* without interleaving, the order would be a, b, c, d and c
+	   would win after two delays */
+	ASSERT_TRUE(result.fd.IsDefined());
+	EXPECT_EQ(result.fd.GetPeerAddress().GetFamily(), AF_INET6);
+	EXPECT_EQ(result.GetPeerPort(), d.GetAddress().GetPort());
+	EXPECT_LT(duration, std::chrono::milliseconds(190));
+}
+
+/**
+ * Cancel() closes all pending attempts; the handler is never
+ * invoked.
+ */
+TEST(HappyEyeballs, Cancel)
+{
+	EventLoop event_loop;
+	const auto a = Peer::MakeHanging(LOCALHOST4);
+	const auto b = Peer::MakeHanging(LOCALHOST4);
+
+	Result result(event_loop);
+	HappyEyeballsConnect connect(event_loop, result, {0, 10000});
+	connect.Connect(std::vector<AllocatedSocketAddress>{a.GetAddress(),
+							    b.GetAddress()},
+			{10, 0});
+
+	TimerEvent timer(event_loop, BIND_METHOD(event_loop, &EventLoop::Break));
+	timer.Add({0, 50000});
+	event_loop.Dispatch();
+
+	ASSERT_TRUE(connect.IsPending());
+	connect.Cancel();
+	EXPECT_FALSE(connect.IsPending());
+
+	timer.Add({0, 50000});
+	event_loop.Dispatch();
+	EXPECT_FALSE(result.done);
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/InterfaceTable.hxx"
+#include "net/Interface.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/IPv6Address.hxx"
+#include "event/net/InterfaceCache.hxx"
+#include "event/Loop.hxx"
+
+#include <gtest/gtest.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <string.h>
+
+/**
+ * Build rtnetlink messages for feeding them into
+ * #NetworkInterfaceTable.
+ */
+class NetlinkMessageBuilder {
+	alignas(struct nlmsghdr) char buffer[1024];
+
+public:
+	template<typename T>
+	T &Begin(uint16_t type) noexcept {
+		memset(buffer, 0, sizeof(buffer));
+		auto &nlh = GetHeader();
+		nlh.nlmsg_len = NLMSG_LENGTH(sizeof(T));
+		nlh.nlmsg_type = type;
+		return *(T *)(void *)(buffer + NLMSG_HDRLEN);
+	}
+
+	void AddAttribute(uint16_t type, const void *data, size_t size) noexcept {
+		auto &nlh = GetHeader();
+		auto *rta = (struct rtattr *)(void *)(buffer + NLMSG_ALIGN(nlh.nlmsg_len));
+		rta->rta_type = type;
+		rta->rta_len = RTA_LENGTH(size);
+		memcpy(RTA_DATA(rta), data, size);
+		nlh.nlmsg_len = NLMSG_ALIGN(nlh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	}
+
+	struct nlmsghdr &GetHeader() noexcept {
+		return *(struct nlmsghdr *)(void *)buffer;
+	}
+};
+
+static bool
+Link(NetworkInterfaceTable &table, uint16_t type, int index,
+     const char *name, unsigned flags=IFF_UP|IFF_RUNNING)
+{
+	NetlinkMessageBuilder b;
+	auto &ifi = b.Begin<struct ifinfomsg>(type);
+	ifi.ifi_index = index;
+	ifi.ifi_flags = flags;
+	if (name != nullptr)
+		b.AddAttribute(IFLA_IFNAME, name, strlen(name) + 1);
+	return table.Handle(b.GetHeader());
+}
+
+static bool
+Address(NetworkInterfaceTable &table, uint16_t type, unsigned index,
+	const struct in_addr &address)
+{
+	NetlinkMessageBuilder b;
+	auto &ifa = b.Begin<struct ifaddrmsg>(type);
+	ifa.ifa_family = AF_INET;
+	ifa.ifa_index = index;
+	b.AddAttribute(IFA_ADDRESS, &address, sizeof(address));
+	b.AddAttribute(IFA_LOCAL, &address, sizeof(address));
+	return table.Handle(b.GetHeader());
+}
+
+static bool
+Address(NetworkInterfaceTable &table, uint16_t type, unsigned index,
+	const struct in6_addr &address)
+{
+	NetlinkMessageBuilder b;
+	auto &ifa = b.Begin<struct ifaddrmsg>(type);
+	ifa.ifa_family = AF_INET6;
+	ifa.ifa_index = index;
+	b.AddAttribute(IFA_ADDRESS, &address, sizeof(address));
+	return table.Handle(b.GetHeader());
+}
+
+TEST(InterfaceTable, Link)
+{
+	NetworkInterfaceTable table;
+	EXPECT_TRUE(table.empty());
+	EXPECT_EQ(table.FindIndex("eth0"), 0u);
+	EXPECT_EQ(table.FindName(2), nullptr);
+
+	EXPECT_TRUE(Link(table, RTM_NEWLINK, 2, "eth0"));
+	EXPECT_FALSE(Link(table, RTM_NEWLINK, 2, "eth0"));
+	EXPECT_EQ(table.size(), 1u);
+	EXPECT_EQ(table.FindIndex("eth0"), 2u);
+	EXPECT_STREQ(table.FindName(2), "eth0");
+	EXPECT_TRUE(table.IsRunning(2));
+
+	/* carrier lost */
+	EXPECT_TRUE(Link(table, RTM_NEWLINK, 2, "eth0", IFF_UP));
+	EXPECT_FALSE(table.IsRunning(2));
+	EXPECT_EQ(table.GetFlags(2), unsigned(IFF_UP));
+
+	/* rename */
+	EXPECT_TRUE(Link(table, RTM_NEWLINK, 2, "lan0"));
+	EXPECT_EQ(table.FindIndex("eth0"), 0u);
+	EXPECT_EQ(table.FindIndex("lan0"), 2u);
+	EXPECT_STREQ(table.FindName(2), "lan0");
+
+	EXPECT_TRUE(Link(table, RTM_DELLINK, 2, "lan0"));
+	EXPECT_FALSE(Link(table, RTM_DELLINK, 2, "lan0"));
+	EXPECT_TRUE(table.empty());
+	EXPECT_EQ(table.FindIndex("lan0"), 0u);
+	EXPECT_EQ(table.FindName(2), nullptr);
+}
+
+TEST(InterfaceTable, Address)
+{
+	const IPv4Address a4(192, 168, 1, 2, 0);
+	const IPv4Address other4(192, 168, 1, 3, 0);
+	const IPv6Address a6(0xfe80, 0, 0, 0, 0, 0, 0, 1, 0);
+
+	NetworkInterfaceTable table;
+	EXPECT_TRUE(Link(table, RTM_NEWLINK, 2, "eth0"));
+	EXPECT_TRUE(Link(table, RTM_NEWLINK, 3, "eth1"));
+	EXPECT_EQ(table.FindAddress(a4), 0u);
+
+	EXPECT_TRUE(Address(table, RTM_NEWADDR, 2, a4.GetAddress()));
+	EXPECT_FALSE(Address(table, RTM_NEWADDR, 2, a4.GetAddress()));
+	EXPECT_TRUE(Address(table, RTM_NEWADDR, 3, a6.GetAddress()));
+	EXPECT_EQ(table.FindAddress(a4), 2u);
+	EXPECT_EQ(table.FindAddress(other4), 0u);
+	EXPECT_EQ(table.FindAddress(a6), 3u);
+
+	EXPECT_TRUE(Address(table, RTM_DELADDR, 2, a4.GetAddress()));
+	EXPECT_FALSE(Address(table, RTM_DELADDR, 2, a4.GetAddress()));
+	EXPECT_EQ(table.FindAddress(a4), 0u);
+
+	/* removing the interface removes its addresses */
+	EXPECT_TRUE(Link(table, RTM_DELLINK, 3, nullptr));
+	EXPECT_EQ(table.FindAddress(a6), 0u);
+}
+
+namespace {
+
+struct NullInterfaceCacheHandler final : InterfaceCacheHandler {
+	void OnInterfaceCacheChanged() noexcept override {}
+	void OnInterfaceCacheError(std::exception_ptr) noexcept override {}
+};
+
+}
+
+TEST(InterfaceCache, Loopback)
+{
+	const unsigned lo = if_nametoindex("lo");
+	if (lo == 0)
+		/* no loopback interface in this network namespace */
+		return;
+
+	EventLoop event_loop;
+	NullInterfaceCacheHandler handler;
+	InterfaceCache cache(event_loop, handler);
+
+	EXPECT_EQ(cache.FindIndex("lo"), lo);
+	EXPECT_STREQ(cache.FindName(lo), "lo");
+
+	const IPv4Address localhost(127, 0, 0, 1, 0);
+	EXPECT_EQ(cache.FindAddress(localhost), FindNetworkInterface(localhost));
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/log/ArchiveWriter.hxx"
+#include "net/log/ArchiveReader.hxx"
+#include "net/log/ArchiveCompression.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Parser.hxx"
+#include "net/log/Datagram.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <fcntl.h>
+
+using namespace Net::Log;
+
+static UniqueFileDescriptor
+CreateTemporaryFile()
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open("/tmp", O_TMPFILE|O_RDWR|O_APPEND, 0600))
+		throw std::runtime_error("Failed to create temporary file");
+	return fd;
+}
+
+static const char *const sites[] = { "alpha", "beta", "gamma", "delta" };
+
+static void
+WriteArchive(FileDescriptor fd, ArchiveCompression compression)
+{
+	ArchiveWriter writer(fd, compression);
+
+	for (unsigned i = 0; i < 1000; ++i) {
+		Datagram d;
+		d.valid_timestamp = true;
+		d.timestamp = 1000 + i;
+		/* each block of 250 records has only one site */
+		d.site = sites[i / 250];
+		d.http_uri = "/some/uri/which/compresses/well";
+		d.valid_traffic = true;
+		d.traffic_received = i;
+		d.traffic_sent = 2 * i;
+
+		uint8_t buffer[1024];
+		const size_t size = Serialize(buffer, sizeof(buffer), d);
+		ASSERT_GT(size, 0u);
+
+		writer.Append({buffer, size});
+
+		if (i % 250 == 249)
+			writer.Flush();
+	}
+
+	writer.Flush();
+}
+
+static void
+TestArchive(ArchiveCompression compression)
+{
+	auto fd = CreateTemporaryFile();
+	WriteArchive(fd.ToFileDescriptor(), compression);
+
+	ArchiveReader reader(fd.ToFileDescriptor());
+
+	/* all records */
+	unsigned n = 0;
+	reader.Query({}, [&n](ConstBuffer<void> record){
+		const auto d = ParseDatagram(record);
+		EXPECT_TRUE(d.valid_timestamp);
+		EXPECT_EQ(d.timestamp, 1000 + n);
+		EXPECT_EQ(d.traffic_received, n);
+		++n;
+	});
+	EXPECT_EQ(n, 1000u);
+
+	/* by site: must not visit blocks of other sites */
+	ArchiveReader::Filter filter;
+	filter.site = "gamma";
+
+	n = 0;
+	reader.Query(filter, [&n](ConstBuffer<void> record){
+		const auto d = ParseDatagram(record);
+		EXPECT_STREQ(d.site, "gamma");
+		++n;
+	});
+	EXPECT_EQ(n, 250u);
+
+	/* by time stamp range */
+	filter = {};
+	filter.since = 1100;
+	filter.until = 1300;
+
+	unsigned n_blocks = 0;
+	size_t offset = 0;
+	ArchiveReader::Block block;
+	while (reader.NextBlock(offset, block))
+		if (block.Overlaps(filter.since, filter.until))
+			++n_blocks;
+	EXPECT_EQ(n_blocks, 2u);
+
+	n = 0;
+	reader.Query(filter, [&n](ConstBuffer<void>){ ++n; });
+	EXPECT_EQ(n, 500u);
+}
+
+TEST(LogArchive, Uncompressed)
+{
+	TestArchive(ArchiveCompression::NONE);
+}
+
+TEST(LogArchive, Lz4)
+{
+	if (!IsArchiveCompressionSupported(ArchiveCompression::LZ4))
+		return;
+
+	TestArchive(ArchiveCompression::LZ4);
+}
+
+TEST(LogArchive, Zstd)
+{
+	if (!IsArchiveCompressionSupported(ArchiveCompression::ZSTD))
+		return;
+
+	TestArchive(ArchiveCompression::ZSTD);
+}
+
+TEST(LogArchive, Truncated)
+{
+	auto fd = CreateTemporaryFile();
+	WriteArchive(fd.ToFileDescriptor(), ArchiveCompression::NONE);
+
+	/* chop off half of the last block */
+	ASSERT_EQ(ftruncate(fd.Get(), fd.GetSize() - 100), 0);
+
+	ArchiveReader reader(fd.ToFileDescriptor());
+
+	unsigned n = 0;
+	reader.Query({}, [&n](ConstBuffer<void>){ ++n; });
+	EXPECT_EQ(n, 750u);
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/net/log/BatchSender.hxx"
+#include "event/Loop.hxx"
+#include "net/log/Parser.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace {
+
+struct SocketPair {
+	UniqueSocketDescriptor a, b;
+
+	SocketPair() {
+		if (!UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+								      SOCK_DGRAM,
+								      0, a, b))
+			throw std::runtime_error("socketpair() failed");
+	}
+
+	/**
+	 * Receive all pending datagrams and return their messages.
+	 */
+	std::vector<std::string> ReceiveAll() {
+		std::vector<std::string> result;
+
+		uint8_t buffer[4096];
+		ssize_t nbytes;
+		while ((nbytes = recv(b.Get(), buffer, sizeof(buffer), 0)) > 0) {
+			const auto d = Net::Log::ParseDatagram(buffer,
+							       buffer + nbytes);
+			result.emplace_back(d.message.data, d.message.size);
+		}
+
+		return result;
+	}
+};
+
+}
+
+static size_t
+GetSerializedSize(const Net::Log::Datagram &d)
+{
+	uint8_t buffer[4096];
+	return Net::Log::Serialize(buffer, sizeof(buffer), d);
+}
+
+using Messages = std::vector<std::string>;
+
+TEST(LogBatchSender, Deferred)
+{
+	EventLoop event_loop;
+	SocketPair sp;
+
+	Net::Log::BatchSender sender(event_loop, sp.a);
+	sender.Send(Net::Log::Datagram("foo"));
+	sender.Send(Net::Log::Datagram("bar"));
+	sender.Send(Net::Log::Datagram("baz"));
+
+	/* nothing is sent before the end of the loop iteration */
+	EXPECT_TRUE(sp.ReceiveAll().empty());
+	EXPECT_EQ(sender.GetStats().queued, 3u);
+	EXPECT_EQ(sender.GetStats().sent, 0u);
+
+	event_loop.LoopOnceNonBlock();
+
+	EXPECT_EQ(sp.ReceiveAll(), (Messages{"foo", "bar", "baz"}));
+	EXPECT_EQ(sender.GetStats().sent, 3u);
+	EXPECT_EQ(sender.GetStats().dropped, 0u);
+}
+
+TEST(LogBatchSender, DestructorFlush)
+{
+	EventLoop event_loop;
+	SocketPair sp;
+
+	{
+		Net::Log::BatchSender sender(event_loop, sp.a);
+		sender.Send(Net::Log::Datagram("foo"));
+		EXPECT_TRUE(sp.ReceiveAll().empty());
+	}
+
+	EXPECT_EQ(sp.ReceiveAll(), (Messages{"foo"}));
+	EXPECT_FALSE(event_loop.HasPendingDeferred());
+}
+
+/**
+ * Reaching the maximum number of datagrams flushes immediately.
+ */
+TEST(LogBatchSender, CountLimit)
+{
+	EventLoop event_loop;
+	SocketPair sp;
+
+	Net::Log::BatchSender sender(event_loop, sp.a, 2);
+	sender.Send(Net::Log::Datagram("1"));
+	sender.Send(Net::Log::Datagram("2"));
+	EXPECT_TRUE(sp.ReceiveAll().empty());
+
+	sender.Send(Net::Log::Datagram("3"));
+	EXPECT_EQ(sp.ReceiveAll(), (Messages{"1", "2"}));
+
+	sender.Send(Net::Log::Datagram("4"));
+	sender.Send(Net::Log::Datagram("5"));
+	EXPECT_EQ(sp.ReceiveAll(), (Messages{"3", "4"}));
+
+	event_loop.LoopOnceNonBlock();
+	EXPECT_EQ(sp.ReceiveAll(), (Messages{"5"}));
+
+	EXPECT_EQ(sender.GetStats().queued, 5u);
+	EXPECT_EQ(sender.GetStats().sent, 5u);
+	EXPECT_EQ(sender.GetStats().dropped, 0u);
+}
+
+/**
+ * A full serialization buffer flushes immediately; a datagram
+ * larger than the buffer is dropped.
+ */
+TEST(LogBatchSender, SizeLimit)
+{
+	EventLoop event_loop;
+	SocketPair sp;
+
+	const size_t size = GetSerializedSize(Net::Log::Datagram("aaa"));
+	ASSERT_GT(size, 0u);
+
+	/* room for two datagrams */
+	Net::Log::BatchSender sender(event_loop, sp.a, 64, size * 2 + 1);
+	sender.Send(Net::Log::Datagram("aaa"));
+	sender.Send(Net::Log::Datagram("bbb"));
+	EXPECT_TRUE(sp.ReceiveAll().empty());
+
+	sender.Send(Net::Log::Datagram("ccc"));
+	EXPECT_EQ(sp.ReceiveAll(), (Messages{"aaa", "bbb"}));
+
+	const std::string large(size * 3, 'x');
+	sender.Send(Net::Log::Datagram(large.c_str()));
+	EXPECT_EQ(sender.GetStats().dropped, 1u);
+
+	/* the failed attempt has flushed the pending datagram */
+	EXPECT_EQ(sp.ReceiveAll(), (Messages{"ccc"}));
+
+	event_loop.LoopOnceNonBlock();
+	EXPECT_TRUE(sp.ReceiveAll().empty());
+
+	EXPECT_EQ(sender.GetStats().queued, 3u);
+	EXPECT_EQ(sender.GetStats().sent, 3u);
+}
+
+/**
+ * Datagrams which cannot be sent are dropped and counted; the
+ * sender keeps working afterwards.
+ */
+TEST(LogBatchSender, Error)
+{
+	EventLoop event_loop;
+	SocketPair sp;
+
+	Net::Log::BatchSender sender(event_loop, sp.a);
+
+	/* fill the peer's receive queue until the socket blocks */
+	const std::string filler(1024, 'x');
+	while (send(sp.a.Get(), filler.data(), filler.size(),
+		    MSG_DONTWAIT) > 0) {}
+
+	sender.Send(Net::Log::Datagram("foo"));
+	sender.Send(Net::Log::Datagram("bar"));
+	event_loop.LoopOnceNonBlock();
+
+	EXPECT_EQ(sender.GetStats().queued, 2u);
+	EXPECT_EQ(sender.GetStats().sent, 0u);
+	EXPECT_EQ(sender.GetStats().dropped, 2u);
+
+	/* drain the queue; now sending works again */
+	char buffer[2048];
+	while (recv(sp.b.Get(), buffer, sizeof(buffer), 0) > 0) {}
+
+	sender.Send(Net::Log::Datagram("baz"));
+	event_loop.LoopOnceNonBlock();
+	EXPECT_EQ(sp.ReceiveAll(), (Messages{"baz"}));
+	EXPECT_EQ(sender.GetStats().sent, 1u);
+	EXPECT_EQ(sender.GetStats().dropped, 2u);
+
+	/* the peer is gone */
+	sp.b.Close();
+	sender.Send(Net::Log::Datagram("qux"));
+	event_loop.LoopOnceNonBlock();
+	EXPECT_EQ(sender.GetStats().sent, 1u);
+	EXPECT_EQ(sender.GetStats().dropped, 3u);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/log/Crc.hxx"
+
+#include <gtest/gtest.h>
+
+#include <boost/crc.hpp>
+
+#include <stdlib.h>
+
+static uint32_t
+BoostCrc(const void *p, size_t size)
+{
+	boost::crc_32_type crc;
+	crc.process_bytes(p, size);
+	return crc.checksum();
+}
+
+static uint32_t
+LogCrc(const void *p, size_t size)
+{
+	Net::Log::Crc crc;
+	crc.reset();
+	crc.process_bytes(p, size);
+	return crc.checksum();
+}
+
+TEST(LogCrc, Check)
+{
+	/* the standard CRC-32 check value */
+	EXPECT_EQ(LogCrc("123456789", 9), 0xcbf43926u);
+	EXPECT_EQ(LogCrc("", 0), 0u);
+}
+
+TEST(LogCrc, Boost)
+{
+	uint8_t buffer[1024 + 16];
+	for (auto &i : buffer)
+		i = random();
+
+	/* all lengths up to several PCLMUL blocks at all
+	   alignments */
+	for (size_t offset = 0; offset < 16; ++offset)
+		for (size_t size = 0; size <= 1024; ++size)
+			ASSERT_EQ(LogCrc(buffer + offset, size),
+				  BoostCrc(buffer + offset, size))
+				<< "offset=" << offset << " size=" << size;
+}
+
+TEST(LogCrc, Incremental)
+{
+	uint8_t buffer[4096];
+	for (auto &i : buffer)
+		i = random();
+
+	Net::Log::Crc crc;
+	crc.reset();
+
+	size_t position = 0;
+	for (size_t n = 1; position + n <= sizeof(buffer); n = n * 3 + 1) {
+		crc.process_bytes(buffer + position, n);
+		position += n;
+	}
+
+	crc.process_bytes(buffer + position, sizeof(buffer) - position);
+	EXPECT_EQ(crc.checksum(), BoostCrc(buffer, sizeof(buffer)));
+}
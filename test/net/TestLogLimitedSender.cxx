@@ -0,0 +1,162 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/log/LimitedSender.hxx"
+#include "net/log/Parser.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace {
+
+struct SocketPair {
+	UniqueSocketDescriptor a, b;
+
+	SocketPair() {
+		if (!UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+								      SOCK_DGRAM,
+								      0, a, b))
+			throw std::runtime_error("socketpair() failed");
+	}
+
+	/**
+	 * Receive all pending datagrams and return their messages
+	 * (or an empty string for datagrams without a message).
+	 */
+	std::vector<std::string> ReceiveAll() {
+		std::vector<std::string> result;
+
+		uint8_t buffer[4096];
+		ssize_t nbytes;
+		while ((nbytes = recv(b.Get(), buffer, sizeof(buffer), 0)) > 0) {
+			const auto d = Net::Log::ParseDatagram(buffer,
+							       buffer + nbytes);
+			result.emplace_back(d.message.IsNull()
+					    ? std::string()
+					    : std::string(d.message.data,
+							  d.message.size));
+		}
+
+		return result;
+	}
+};
+
+static Net::Log::Datagram
+MakeDatagram(const char *site, http_status_t status)
+{
+	Net::Log::Datagram d(std::chrono::system_clock::now(),
+			     HTTP_METHOD_GET, "/",
+			     "192.168.1.1", "example.com", site,
+			     nullptr, nullptr,
+			     status, 0, 0, 0,
+			     std::chrono::milliseconds(1));
+	d.type = Net::Log::Type::HTTP_ACCESS;
+	return d;
+}
+
+}
+
+TEST(LogLimitedSender, RateLimit)
+{
+	SocketPair sp;
+
+	Net::Log::LimitedSender::Config config;
+	config.rate = 10;
+	config.burst = 5;
+	config.summary_interval = std::chrono::seconds(1);
+
+	Net::Log::LimitedSender sender(sp.a, config);
+
+	const auto t0 = std::chrono::steady_clock::now();
+	const auto d = MakeDatagram("site", HTTP_STATUS_OK);
+
+	unsigned n_sent = 0;
+	for (unsigned i = 0; i < 20; ++i)
+		if (sender.Send(d, t0))
+			++n_sent;
+
+	EXPECT_EQ(n_sent, 5u);
+	EXPECT_EQ(sender.GetSuppressed(), 15u);
+	EXPECT_EQ(sp.ReceiveAll().size(), 5u);
+
+	/* summary not yet due */
+	sender.Flush(t0 + std::chrono::milliseconds(500));
+	EXPECT_TRUE(sp.ReceiveAll().empty());
+
+	sender.Flush(t0 + std::chrono::seconds(1));
+	auto r = sp.ReceiveAll();
+	ASSERT_EQ(r.size(), 1u);
+	EXPECT_EQ(r.front(), "15 log records suppressed");
+
+	/* no second summary without new suppressions */
+	sender.Flush(t0 + std::chrono::seconds(5));
+	EXPECT_TRUE(sp.ReceiveAll().empty());
+}
+
+TEST(LogLimitedSender, Sample)
+{
+	SocketPair sp;
+
+	Net::Log::LimitedSender::Config config;
+	config.sample_n = 4;
+	config.summary_interval = std::chrono::seconds(1);
+
+	Net::Log::LimitedSender sender(sp.a, config);
+
+	const auto t0 = std::chrono::steady_clock::now();
+	const auto a = MakeDatagram("a", HTTP_STATUS_OK);
+	const auto b = MakeDatagram("a", HTTP_STATUS_NOT_FOUND);
+
+	unsigned n_a = 0, n_b = 0;
+	for (unsigned i = 0; i < 8; ++i) {
+		n_a += sender.Send(a, t0);
+		n_b += sender.Send(b, t0);
+	}
+
+	/* every 4th datagram per key, starting with the first one */
+	EXPECT_EQ(n_a, 2u);
+	EXPECT_EQ(n_b, 2u);
+	EXPECT_EQ(sender.GetSuppressed(), 12u);
+
+	/* the summary is sent before the next datagram */
+	sender.Send(a, t0 + std::chrono::seconds(2));
+	auto r = sp.ReceiveAll();
+	ASSERT_EQ(r.size(), 6u);
+	EXPECT_EQ(r[4], "12 log records suppressed");
+	EXPECT_EQ(r[5], "");
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/log/OneLine.hxx"
+#include "net/log/Datagram.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+
+class LogOneLineTest : public ::testing::Test {
+protected:
+	UniqueFileDescriptor w;
+
+	void SetUp() override {
+		setenv("TZ", "UTC", 1);
+		tzset();
+
+		ASSERT_TRUE(w.Open("/tmp", O_TMPFILE|O_RDWR, 0600));
+	}
+
+	std::string Read() {
+		w.Rewind();
+
+		std::string result;
+		char buffer[65536];
+		ssize_t nbytes;
+		while ((nbytes = w.Read(buffer, sizeof(buffer))) > 0)
+			result.append(buffer, nbytes);
+		return result;
+	}
+};
+
+static Net::Log::Datagram
+MakeHttpDatagram()
+{
+	Net::Log::Datagram d;
+	d.valid_timestamp = true;
+	d.timestamp = 1500000000ull * 1000000ull;
+	d.remote_host = "192.168.1.1";
+	d.site = "mysite";
+	d.valid_http_method = true;
+	d.http_method = HTTP_METHOD_GET;
+	d.http_uri = "/foo \"bar\" \\ and a long tail \x01 without escapes";
+	d.valid_http_status = true;
+	d.http_status = HTTP_STATUS_NOT_FOUND;
+	d.user_agent = "agent\xff";
+	d.valid_duration = true;
+	d.duration = 42;
+	return d;
+}
+
+TEST_F(LogOneLineTest, Http)
+{
+	LogOneLine(w.ToFileDescriptor(), MakeHttpDatagram());
+	LogOneLine(w.ToFileDescriptor(), MakeHttpDatagram(), false);
+
+	EXPECT_EQ(Read(),
+		  "mysite 192.168.1.1 - - [14/Jul/2017:02:40:00 +0000] "
+		  "\"GET /foo \\x22bar\\x22 \\x5C and a long tail \\x01 without escapes HTTP/1.1\" "
+		  "404 - \"-\" \"agent\\xFF\" 42\n"
+		  "192.168.1.1 - - [14/Jul/2017:02:40:00 +0000] "
+		  "\"GET /foo \\x22bar\\x22 \\x5C and a long tail \\x01 without escapes HTTP/1.1\" "
+		  "404 - \"-\" \"agent\\xFF\" 42\n");
+}
+
+TEST_F(LogOneLineTest, Message)
+{
+	Net::Log::Datagram d;
+	d.message = "hello\nworld";
+
+	LogOneLine(w.ToFileDescriptor(), d);
+	EXPECT_EQ(Read(), "- [-] hello\\x0Aworld\n");
+}
+
+TEST_F(LogOneLineTest, Truncate)
+{
+	std::string uri(10000, 'x');
+	uri[4090] = '"';
+
+	auto d = MakeHttpDatagram();
+	d.http_uri = uri.c_str();
+
+	LogOneLine(w.ToFileDescriptor(), d);
+
+	/* the escaped URI is limited to 4092 characters (plus the
+	   overshoot of the last escape sequence) */
+	const auto line = Read();
+	const auto begin = line.find("GET ") + 4;
+	const auto end = line.find(" HTTP/1.1");
+	ASSERT_NE(end, line.npos);
+	EXPECT_EQ(end - begin, 4090u + 4);
+}
+
+TEST_F(LogOneLineTest, Writer)
+{
+	std::string expected;
+
+	{
+		OneLineWriter writer(w.ToFileDescriptor(), true, 16384);
+
+		for (unsigned i = 0; i < 1000; ++i) {
+			auto d = MakeHttpDatagram();
+			d.timestamp += i * 100000ull;
+			writer.Append(d);
+		}
+	}
+
+	for (unsigned i = 0; i < 1000; ++i) {
+		auto d = MakeHttpDatagram();
+		d.timestamp += i * 100000ull;
+		LogOneLine(w.ToFileDescriptor(), d);
+	}
+
+	const auto result = Read();
+	ASSERT_EQ(result.size() % 2, 0u);
+	EXPECT_EQ(result.substr(0, result.size() / 2),
+		  result.substr(result.size() / 2));
+	EXPECT_NE(result.find("[14/Jul/2017:02:41:39 +0000]"), result.npos);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/log/PipeAdapter.hxx"
+#include "event/Loop.hxx"
+#include "net/log/Parser.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+static std::vector<std::string>
+ReceiveMessages(SocketDescriptor s)
+{
+	std::vector<std::string> result;
+
+	uint8_t buffer[4096];
+	ssize_t nbytes;
+	while ((nbytes = recv(s.Get(), buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+		const auto d = Net::Log::ParseDatagram(buffer, buffer + nbytes);
+		EXPECT_STREQ(d.site, "site");
+		EXPECT_EQ(d.type, Net::Log::Type::HTTP_ERROR);
+		EXPECT_TRUE(d.valid_timestamp);
+		result.emplace_back(d.message.data, d.message.size);
+	}
+
+	return result;
+}
+
+static void
+TestPipeAdapter(bool batch)
+{
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipeNonBlock(r, w));
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL,
+							       SOCK_DGRAM, 0,
+							       a, b));
+
+	EventLoop event_loop;
+	Net::Log::PipeAdapter adapter(event_loop, std::move(r), a);
+	adapter.GetDatagram().site = "site";
+	adapter.GetDatagram().type = Net::Log::Type::HTTP_ERROR;
+	if (batch)
+		adapter.EnableBatch();
+
+	std::string input;
+	for (unsigned i = 0; i < 100; ++i)
+		input += "line " + std::to_string(i) + "\r\n";
+	input += "partial";
+
+	ASSERT_EQ(w.Write(input.data(), input.size()), ssize_t(input.size()));
+
+	adapter.Flush();
+
+	const auto messages = ReceiveMessages(b);
+	ASSERT_EQ(messages.size(), 101u);
+	for (unsigned i = 0; i < 100; ++i)
+		EXPECT_EQ(messages[i], "line " + std::to_string(i));
+	EXPECT_EQ(messages.back(), "partial");
+}
+
+TEST(LogPipeAdapter, Single)
+{
+	TestPipeAdapter(false);
+}
+
+TEST(LogPipeAdapter, Batch)
+{
+	TestPipeAdapter(true);
+}
+
+static void
+TestDropped(bool batch)
+{
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipeNonBlock(r, w));
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL,
+							       SOCK_DGRAM, 0,
+							       a, b));
+
+	/* the minimum send buffer size makes the big line fail
+	   with EMSGSIZE */
+	const int sndbuf = 1;
+	ASSERT_TRUE(a.SetOption(SOL_SOCKET, SO_SNDBUF,
+				&sndbuf, sizeof(sndbuf)));
+
+	EventLoop event_loop;
+	Net::Log::PipeAdapter adapter(event_loop, std::move(r), a);
+	adapter.GetDatagram().site = "site";
+	adapter.GetDatagram().type = Net::Log::Type::HTTP_ERROR;
+	if (batch)
+		adapter.EnableBatch();
+
+	const std::string input = "first\n" + std::string(6000, 'x') +
+		"\nlast\n";
+	ASSERT_EQ(w.Write(input.data(), input.size()), ssize_t(input.size()));
+
+	adapter.Flush();
+
+	const auto messages = ReceiveMessages(b);
+	ASSERT_EQ(messages.size(), 2u);
+	EXPECT_EQ(messages[0], "first");
+	EXPECT_EQ(messages[1], "last");
+	EXPECT_EQ(adapter.GetDroppedLines(), 1u);
+}
+
+TEST(LogPipeAdapter, DroppedSingle)
+{
+	TestDropped(false);
+}
+
+TEST(LogPipeAdapter, DroppedBatch)
+{
+	TestDropped(true);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/log/ReceiverPipeline.hxx"
+#include "net/log/Send.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/IPv4Address.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+
+using namespace Net::Log;
+
+namespace {
+
+class CountingConsumer final : public PipelineConsumer {
+public:
+	std::atomic_uint n_records{0}, n_bytes{0};
+	std::atomic_uint n_bad_site{0};
+
+	void OnLogRecord(const Datagram &d,
+			 ConstBuffer<void> raw) noexcept override {
+		if (d.site == nullptr || strcmp(d.site, "site") != 0)
+			++n_bad_site;
+
+		n_bytes += raw.size;
+		++n_records;
+	}
+};
+
+}
+
+static bool
+WaitFor(const std::atomic_uint &value, unsigned expected)
+{
+	for (unsigned i = 0; i < 500 && value.load() < expected; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	return value.load() == expected;
+}
+
+TEST(LogReceiverPipeline, Basic)
+{
+	CountingConsumer a, b;
+
+	ReceiverPipeline pipeline;
+	pipeline.AddConsumer(a);
+	pipeline.AddConsumer(b);
+
+	const auto address =
+		pipeline.Listen(IPv4Address(127, 0, 0, 1, 0), 2);
+	pipeline.Start();
+
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.Create(AF_INET, SOCK_DGRAM, 0));
+	ASSERT_TRUE(s.Connect(address));
+
+	Datagram d;
+	d.site = "site";
+	d.message = "hello";
+
+	constexpr unsigned N = 100;
+	for (unsigned i = 0; i < N; ++i)
+		Send(s, d);
+
+	/* a malformed datagram */
+	ASSERT_EQ(s.Write("garbage", 7), 7);
+
+	EXPECT_TRUE(WaitFor(a.n_records, N));
+	EXPECT_TRUE(WaitFor(b.n_records, N));
+
+	pipeline.Stop();
+
+	EXPECT_EQ(a.n_bad_site, 0u);
+	EXPECT_EQ(a.n_bytes, b.n_bytes);
+
+	const auto stats = pipeline.GetStats();
+	EXPECT_EQ(stats.received, N + 1);
+	EXPECT_EQ(stats.malformed, 1u);
+	EXPECT_EQ(stats.dropped, 0u);
+	EXPECT_EQ(stats.errors, 0u);
+}
@@ -0,0 +1,332 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../AllocationCounter.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Send.hxx"
+#include "net/log/Parser.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <string.h>
+#include <sys/socket.h>
+
+static Net::Log::Datagram
+MakeDatagram()
+{
+	Net::Log::Datagram d(std::chrono::system_clock::now(),
+			     HTTP_METHOD_GET, "/index.html",
+			     "192.168.1.1", "example.com", "site",
+			     "http://referer/", "agent",
+			     HTTP_STATUS_OK, 1234,
+			     100, 200,
+			     std::chrono::milliseconds(42));
+	d.forwarded_to = "10.0.0.1:80";
+	d.message = "hello";
+	d.type = Net::Log::Type::HTTP_ACCESS;
+	return d;
+}
+
+TEST(LogSerializer, Parse)
+{
+	const auto d = MakeDatagram();
+
+	uint8_t buffer[1024];
+	const size_t size = Net::Log::Serialize(buffer, sizeof(buffer), d);
+	ASSERT_GT(size, 0u);
+
+	const auto p = Net::Log::ParseDatagram(buffer, buffer + size);
+	EXPECT_EQ(p.timestamp, d.timestamp);
+	EXPECT_STREQ(p.remote_host, d.remote_host);
+	EXPECT_STREQ(p.host, d.host);
+	EXPECT_STREQ(p.site, d.site);
+	EXPECT_STREQ(p.forwarded_to, d.forwarded_to);
+	EXPECT_EQ(p.http_method, d.http_method);
+	EXPECT_STREQ(p.http_uri, d.http_uri);
+	EXPECT_STREQ(p.http_referer, d.http_referer);
+	EXPECT_STREQ(p.user_agent, d.user_agent);
+	EXPECT_TRUE(p.message.Equals("hello"));
+	EXPECT_EQ(p.http_status, d.http_status);
+	EXPECT_EQ(p.length, d.length);
+	EXPECT_EQ(p.traffic_received, d.traffic_received);
+	EXPECT_EQ(p.traffic_sent, d.traffic_sent);
+	EXPECT_EQ(p.duration, d.duration);
+	EXPECT_EQ(p.type, d.type);
+
+	/* too small */
+	for (size_t i = 0; i < size; ++i)
+		EXPECT_EQ(Net::Log::Serialize(buffer, i, d), 0u);
+}
+
+static void
+CheckSend(const Net::Log::Datagram &d)
+{
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL,
+							       SOCK_DGRAM, 0,
+							       a, b));
+
+	Net::Log::Send(a, d);
+
+	static uint8_t received[32768], buffer[32768];
+	const auto nbytes = b.Read(received, sizeof(received));
+	ASSERT_GT(nbytes, 0);
+
+	const size_t size = Net::Log::Serialize(buffer, sizeof(buffer), d);
+	ASSERT_EQ(size, size_t(nbytes));
+	EXPECT_EQ(memcmp(buffer, received, size), 0);
+}
+
+/**
+ * Serialize() must produce the same payload as Send().
+ */
+TEST(LogSerializer, Send)
+{
+	auto d = MakeDatagram();
+	CheckSend(d);
+
+	/* without a message */
+	d.message = nullptr;
+	CheckSend(d);
+
+	/* attributes which do not fit into Send()'s stack buffer */
+	const std::string long_uri(10000, 'x');
+	d.http_uri = long_uri.c_str();
+	CheckSend(d);
+
+	d.message = "hello";
+	CheckSend(d);
+}
+
+/**
+ * Prefix, message, suffix and CRC must add up to the output of
+ * Serialize().
+ */
+TEST(LogSerializer, MessagePrefixSuffix)
+{
+	const auto d = MakeDatagram();
+
+	uint8_t buffer[1024];
+	const size_t size = Net::Log::Serialize(buffer, sizeof(buffer), d);
+	ASSERT_GT(size, 0u);
+
+	uint8_t prefix[1024], suffix[256];
+	const size_t prefix_size =
+		Net::Log::SerializeMessagePrefix(prefix, sizeof(prefix), d);
+	const size_t suffix_size =
+		Net::Log::SerializeMessageSuffix(suffix, sizeof(suffix), d);
+	ASSERT_GT(prefix_size, 0u);
+	ASSERT_GT(suffix_size, 0u);
+	ASSERT_EQ(prefix_size + d.message.size + suffix_size + 4, size);
+
+	EXPECT_EQ(memcmp(buffer, prefix, prefix_size), 0);
+	EXPECT_EQ(memcmp(buffer + prefix_size, d.message.data,
+			 d.message.size), 0);
+	EXPECT_EQ(memcmp(buffer + prefix_size + d.message.size,
+			 suffix, suffix_size), 0);
+}
+
+static void
+ExpectSameDatagram(const Net::Log::Datagram &p, const Net::Log::Datagram &d)
+{
+	EXPECT_TRUE(p.valid_timestamp);
+	EXPECT_EQ(p.timestamp, d.timestamp);
+	EXPECT_STREQ(p.remote_host, d.remote_host);
+	EXPECT_STREQ(p.host, d.host);
+	EXPECT_STREQ(p.site, d.site);
+	EXPECT_STREQ(p.forwarded_to, d.forwarded_to);
+	EXPECT_EQ(p.http_method, d.http_method);
+	EXPECT_STREQ(p.http_uri, d.http_uri);
+	EXPECT_STREQ(p.http_referer, d.http_referer);
+	EXPECT_STREQ(p.user_agent, d.user_agent);
+	EXPECT_TRUE(p.message.Equals("hello"));
+	EXPECT_EQ(p.http_status, d.http_status);
+	EXPECT_EQ(p.length, d.length);
+	EXPECT_EQ(p.traffic_received, d.traffic_received);
+	EXPECT_EQ(p.traffic_sent, d.traffic_sent);
+	EXPECT_EQ(p.duration, d.duration);
+	EXPECT_EQ(p.type, d.type);
+}
+
+TEST(LogSerializer, Compact)
+{
+	auto d = MakeDatagram();
+
+	uint8_t v2[1024];
+	const size_t v2_size = Net::Log::Serialize(v2, sizeof(v2), d);
+	ASSERT_GT(v2_size, 0u);
+
+	Net::Log::CompactSerializer serializer(42);
+	Net::Log::CompactDecoder decoder;
+
+	uint8_t buffer[1024];
+	size_t size = serializer.Serialize(buffer, sizeof(buffer), d);
+	ASSERT_GT(size, 0u);
+	EXPECT_TRUE(Net::Log::VerifyDatagramCrc({buffer, size}));
+	ExpectSameDatagram(decoder.Parse({buffer, size}), d);
+
+	/* the second datagram refers to the dictionary */
+	d.timestamp += 1000;
+	const size_t first_size = size;
+	size = serializer.Serialize(buffer, sizeof(buffer), d);
+	ASSERT_GT(size, 0u);
+	EXPECT_LT(size, first_size);
+	EXPECT_LT(size, v2_size);
+	ExpectSameDatagram(decoder.Parse({buffer, size}), d);
+
+	/* without state, references and the relative time stamp
+	   cannot be resolved */
+	const auto p = Net::Log::ParseDatagram(buffer, buffer + size);
+	EXPECT_FALSE(p.valid_timestamp);
+	EXPECT_EQ(p.site, nullptr);
+	EXPECT_EQ(p.host, nullptr);
+	EXPECT_EQ(p.user_agent, nullptr);
+	EXPECT_STREQ(p.remote_host, d.remote_host);
+	EXPECT_STREQ(p.http_uri, d.http_uri);
+	EXPECT_EQ(p.length, d.length);
+
+	/* too small */
+	for (size_t i = 0; i < size; ++i)
+		EXPECT_EQ(serializer.Serialize(buffer, i, d), 0u);
+
+	/* after an overflow, the serializer starts over */
+	size = serializer.Serialize(buffer, sizeof(buffer), d);
+	ASSERT_GT(size, 0u);
+	ExpectSameDatagram(decoder.Parse({buffer, size}), d);
+}
+
+/**
+ * A receiver which has missed the definitions recovers after the
+ * refresh interval.
+ */
+TEST(LogSerializer, CompactRefresh)
+{
+	auto d = MakeDatagram();
+
+	Net::Log::CompactSerializer serializer(1);
+	Net::Log::CompactDecoder decoder;
+
+	uint8_t buffer[1024];
+	for (unsigned i = 0; i < 10; ++i) {
+		d.timestamp += 100;
+		ASSERT_GT(serializer.Serialize(buffer, sizeof(buffer), d),
+			  0u);
+	}
+
+	unsigned resolved_after = 0;
+	for (unsigned i = 0; i < 100; ++i) {
+		d.timestamp += 100;
+		const size_t size = serializer.Serialize(buffer, sizeof(buffer), d);
+		ASSERT_GT(size, 0u);
+
+		const auto p = decoder.Parse({buffer, size});
+		if (p.site != nullptr && p.valid_timestamp) {
+			resolved_after = i;
+			ExpectSameDatagram(p, d);
+			break;
+		}
+
+		EXPECT_STREQ(p.http_uri, d.http_uri);
+	}
+
+	EXPECT_GT(resolved_after, 0u);
+	EXPECT_LE(resolved_after, 64u);
+}
+
+TEST(LogSerializer, CompactEpoch)
+{
+	auto d = MakeDatagram();
+
+	Net::Log::CompactDecoder decoder;
+
+	uint8_t old_buffer[1024], buffer[1024];
+
+	Net::Log::CompactSerializer a(1);
+	size_t size = a.Serialize(buffer, sizeof(buffer), d);
+	ASSERT_GT(size, 0u);
+	ExpectSameDatagram(decoder.Parse({buffer, size}), d);
+
+	/* this one would refer to the dictionary of epoch 1 */
+	const size_t old_size = a.Serialize(old_buffer, sizeof(old_buffer), d);
+	ASSERT_GT(old_size, 0u);
+
+	/* a restarted sender begins a new epoch */
+	d.site = "other";
+	Net::Log::CompactSerializer b(1000);
+	size = b.Serialize(buffer, sizeof(buffer), d);
+	ASSERT_GT(size, 0u);
+	ExpectSameDatagram(decoder.Parse({buffer, size}), d);
+
+	size = b.Serialize(buffer, sizeof(buffer), d);
+	ASSERT_GT(size, 0u);
+	ExpectSameDatagram(decoder.Parse({buffer, size}), d);
+
+	/* a late datagram of the previous epoch doesn't see the new
+	   dictionary */
+	const auto p = decoder.Parse({old_buffer, old_size});
+	EXPECT_EQ(p.site, nullptr);
+	EXPECT_STREQ(p.http_uri, d.http_uri);
+
+	/* ... and doesn't disturb the current epoch */
+	size = b.Serialize(buffer, sizeof(buffer), d);
+	ASSERT_GT(size, 0u);
+	ExpectSameDatagram(decoder.Parse({buffer, size}), d);
+}
+
+/**
+ * Sending and parsing datagrams are hot paths; neither may allocate
+ * heap memory.
+ */
+TEST(LogSerializer, NoAllocation)
+{
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL,
+							       SOCK_DGRAM, 0,
+							       a, b));
+
+	const auto d = MakeDatagram();
+	EXPECT_NO_ALLOCATION(Net::Log::Send(a, d));
+
+	uint8_t received[1024];
+	const auto nbytes = b.Read(received, sizeof(received));
+	ASSERT_GT(nbytes, 0);
+
+	EXPECT_NO_ALLOCATION({
+		const auto p = Net::Log::ParseDatagram(received,
+						       received + nbytes);
+		EXPECT_STREQ(p.site, d.site);
+	});
+}
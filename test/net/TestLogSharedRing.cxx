@@ -0,0 +1,221 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/log/SharedRing.hxx"
+#include "event/net/log/Relay.hxx"
+#include "event/Loop.hxx"
+#include "net/log/Send.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "net/IPv4Address.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+using namespace Net::Log;
+
+static std::string
+ReadRecord(SharedRingReader &reader)
+{
+	const auto r = reader.Next();
+	if (r.IsNull())
+		return "<none>";
+
+	std::string result((const char *)r.data, r.size);
+	if (!reader.Consume())
+		return "<overwritten>";
+
+	return result;
+}
+
+TEST(LogSharedRing, Basic)
+{
+	SharedRingWriter writer(4096);
+
+	SharedRingReader a(writer.GetFileDescriptor());
+	EXPECT_TRUE(a.Next().IsNull());
+
+	EXPECT_TRUE(writer.Append(ConstBuffer<void>("foo", 3)));
+	EXPECT_TRUE(writer.Append(ConstBuffer<void>("hello world", 11)));
+
+	/* a new reader sees only new records */
+	SharedRingReader b(writer.GetFileDescriptor());
+	EXPECT_TRUE(writer.Append(ConstBuffer<void>("bar", 3)));
+
+	EXPECT_EQ(ReadRecord(a), "foo");
+	EXPECT_EQ(ReadRecord(a), "hello world");
+	EXPECT_EQ(ReadRecord(a), "bar");
+	EXPECT_EQ(ReadRecord(a), "<none>");
+
+	EXPECT_EQ(ReadRecord(b), "bar");
+	EXPECT_EQ(ReadRecord(b), "<none>");
+
+	EXPECT_TRUE(a.Wait(0) == false);
+	writer.Wake();
+
+	/* too large */
+	std::string large(writer.GetMaxRecordSize() + 1, 'x');
+	EXPECT_FALSE(writer.Append(ConstBuffer<void>(large.data(), large.size())));
+
+	EXPECT_EQ(a.GetOverruns(), 0u);
+}
+
+TEST(LogSharedRing, WrapAround)
+{
+	SharedRingWriter writer(4096);
+	SharedRingReader reader(writer.GetFileDescriptor());
+
+	for (unsigned i = 0; i < 1000; ++i) {
+		const std::string s = "record " + std::to_string(i) +
+			std::string(i % 100, '.');
+		ASSERT_TRUE(writer.Append(ConstBuffer<void>(s.data(), s.size())));
+		ASSERT_EQ(ReadRecord(reader), s);
+	}
+
+	EXPECT_EQ(ReadRecord(reader), "<none>");
+	EXPECT_EQ(reader.GetOverruns(), 0u);
+}
+
+TEST(LogSharedRing, Overrun)
+{
+	SharedRingWriter writer(4096);
+	SharedRingReader reader(writer.GetFileDescriptor());
+
+	ASSERT_TRUE(writer.Append(ConstBuffer<void>("first", 5)));
+
+	/* the record is being processed while the writer overwrites
+	   it */
+	const auto r = reader.Next();
+	ASSERT_FALSE(r.IsNull());
+
+	const std::string filler(500, 'x');
+	for (unsigned i = 0; i < 20; ++i)
+		ASSERT_TRUE(writer.Append(ConstBuffer<void>(filler.data(),
+							    filler.size())));
+
+	EXPECT_FALSE(reader.Consume());
+	EXPECT_EQ(reader.GetOverruns(), 1u);
+
+	/* the reader has skipped to the end */
+	EXPECT_EQ(ReadRecord(reader), "<none>");
+	ASSERT_TRUE(writer.Append(ConstBuffer<void>("last", 4)));
+	EXPECT_EQ(ReadRecord(reader), "last");
+}
+
+/**
+ * Consumers map the ring read-only.
+ */
+TEST(LogSharedRing, ReadOnly)
+{
+	SharedRingWriter writer(4096);
+
+	void *p = mmap(nullptr, 8192, PROT_READ|PROT_WRITE, MAP_SHARED,
+		       writer.GetFileDescriptor().Get(), 0);
+	if (p != MAP_FAILED) {
+		/* old kernel without F_SEAL_FUTURE_WRITE */
+		munmap(p, 8192);
+		return;
+	}
+
+	EXPECT_EQ(errno, EPERM);
+}
+
+TEST(LogRelay, Basic)
+{
+	SharedRingWriter ring(65536);
+	SharedRingReader reader(ring.GetFileDescriptor());
+
+	EventLoop event_loop;
+
+	UniqueSocketDescriptor r;
+	ASSERT_TRUE(r.CreateNonBlock(AF_INET, SOCK_DGRAM, 0));
+	ASSERT_TRUE(r.Bind(IPv4Address(127, 0, 0, 1, 0)));
+	const auto address = r.GetLocalAddress();
+
+	Relay relay(event_loop, std::move(r), ring);
+
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.Create(AF_INET, SOCK_DGRAM, 0));
+	ASSERT_TRUE(s.Connect(address));
+
+	Datagram d;
+	d.site = "site";
+	d.message = "hello";
+	d.SetTimestamp(std::chrono::system_clock::now());
+
+	/* V2 */
+	Send(s, d);
+
+	/* V3, with dictionary references in the second one */
+	CompactSerializer serializer(1);
+	uint8_t buffer[1024];
+	for (unsigned i = 0; i < 2; ++i) {
+		const size_t size = serializer.Serialize(buffer, sizeof(buffer), d);
+		ASSERT_GT(size, 0u);
+		ASSERT_EQ(s.Write(buffer, size), ssize_t(size));
+	}
+
+	/* a malformed datagram */
+	ASSERT_EQ(s.Write("garbage", 7), 7);
+
+	for (unsigned i = 0; i < 100 && relay.GetStats().received < 4; ++i)
+		event_loop.LoopOnce();
+
+	const auto stats = relay.GetStats();
+	EXPECT_EQ(stats.received, 4u);
+	EXPECT_EQ(stats.malformed, 1u);
+	EXPECT_EQ(stats.dropped, 0u);
+
+	for (unsigned i = 0; i < 3; ++i) {
+		const auto record = reader.Next();
+		ASSERT_FALSE(record.IsNull());
+
+		/* all records are self-contained */
+		const auto p = ParseDatagram(record);
+		EXPECT_STREQ(p.site, "site");
+		EXPECT_TRUE(p.message.Equals("hello"));
+		EXPECT_TRUE(p.valid_timestamp);
+		EXPECT_EQ(p.timestamp, d.timestamp);
+
+		EXPECT_TRUE(reader.Consume());
+	}
+
+	EXPECT_TRUE(reader.Next().IsNull());
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/log/StreamSender.hxx"
+#include "event/Loop.hxx"
+#include "net/log/StreamFrame.hxx"
+#include "net/log/Parser.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace Net::Log;
+
+namespace {
+
+struct Handler final : StreamSenderHandler {
+	EventLoop &event_loop;
+
+	unsigned n_ready = 0;
+	bool error = false;
+
+	explicit Handler(EventLoop &_event_loop) noexcept
+		:event_loop(_event_loop) {}
+
+	void OnLogStreamReady() noexcept override {
+		++n_ready;
+		event_loop.Break();
+	}
+
+	void OnLogStreamError(std::exception_ptr) noexcept override {
+		error = true;
+		event_loop.Break();
+	}
+};
+
+/**
+ * Read frames from the socket until the given number of records has
+ * been received, then close it.
+ */
+static std::vector<std::string>
+ReceiveFrames(UniqueSocketDescriptor s, unsigned n)
+{
+	std::vector<std::string> messages;
+	std::string input;
+
+	while (messages.size() < n) {
+		char buffer[65536];
+		ssize_t nbytes = recv(s.Get(), buffer, sizeof(buffer), 0);
+		if (nbytes <= 0)
+			break;
+
+		input.append(buffer, nbytes);
+
+		while (true) {
+			const auto frame = ParseStreamFrame({input.data(), input.size()});
+			if (frame.IsNull())
+				break;
+
+			const auto d = ParseDatagram(frame);
+			messages.emplace_back(d.message.data, d.message.size);
+			input.erase(0, STREAM_FRAME_HEADER_SIZE + frame.size);
+		}
+	}
+
+	return messages;
+}
+
+}
+
+TEST(LogStreamSender, Backpressure)
+{
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+								     SOCK_STREAM,
+								     0, a, b));
+	b.SetBlocking();
+
+	constexpr unsigned N = 16;
+
+	std::vector<std::string> received;
+	std::thread thread([&received, &b](){
+		received = ReceiveFrames(std::move(b), N);
+	});
+
+	EventLoop event_loop;
+	Handler handler(event_loop);
+
+	{
+		StreamSender sender(event_loop, std::move(a), handler, 65536);
+
+		/* messages which would not fit into a UDP datagram */
+		for (unsigned i = 0; i < N; ++i) {
+			std::string message(100000 + i, 'a' + i);
+			Datagram d(StringView(message.data(), message.size()));
+
+			while (!sender.Send(d)) {
+				ASSERT_FALSE(handler.error);
+				event_loop.Dispatch();
+			}
+		}
+
+		EXPECT_EQ(sender.GetStats().queued, N);
+		EXPECT_GT(sender.GetStats().refused, 0u);
+		EXPECT_GT(handler.n_ready, 0u);
+
+		/* the receiver closes the connection after it got
+		   all records */
+		event_loop.Dispatch();
+		EXPECT_TRUE(handler.error);
+		EXPECT_FALSE(sender.IsReady());
+	}
+
+	thread.join();
+
+	ASSERT_EQ(received.size(), N);
+	for (unsigned i = 0; i < N; ++i)
+		EXPECT_EQ(received[i], std::string(100000 + i, 'a' + i));
+}
+
+TEST(LogStreamFrame, Parse)
+{
+	const uint8_t data[] = { 0, 0, 0, 3, 'a', 'b', 'c', 'd' };
+
+	EXPECT_TRUE(ParseStreamFrame({data, 3}).IsNull());
+	EXPECT_TRUE(ParseStreamFrame({data, 6}).IsNull());
+
+	const auto frame = ParseStreamFrame({data, sizeof(data)});
+	ASSERT_FALSE(frame.IsNull());
+	EXPECT_EQ(frame.size, 3u);
+	EXPECT_EQ(frame.data, data + 4);
+
+	const uint8_t huge[] = { 0xff, 0, 0, 0 };
+	EXPECT_THROW(ParseStreamFrame({huge, sizeof(huge)}), ProtocolError);
+}
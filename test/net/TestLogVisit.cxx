@@ -0,0 +1,134 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/log/Visit.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Datagram.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace Net::Log;
+
+namespace {
+
+struct SiteTrafficVisitor : NullDatagramVisitor {
+	std::string site;
+	uint64_t received = 0, sent = 0;
+	unsigned n_strings = 0;
+
+	void OnString(Attribute a, StringView value) noexcept {
+		++n_strings;
+		if (a == Attribute::SITE)
+			site.assign(value.data, value.size);
+	}
+
+	void OnTraffic(uint64_t _received, uint64_t _sent) noexcept {
+		received = _received;
+		sent = _sent;
+	}
+};
+
+}
+
+static size_t
+MakeDatagram(uint8_t *buffer, size_t size)
+{
+	Datagram d;
+	d.remote_host = "192.168.1.1";
+	d.host = "example.com";
+	d.site = "mysite";
+	d.http_uri = "/foo";
+	d.user_agent = "agent";
+	d.valid_traffic = true;
+	d.traffic_received = 123;
+	d.traffic_sent = 456;
+	d.valid_duration = true;
+	d.duration = 789;
+	return Serialize(buffer, size, d);
+}
+
+TEST(LogVisit, Projection)
+{
+	uint8_t buffer[1024];
+	const size_t size = MakeDatagram(buffer, sizeof(buffer));
+	ASSERT_GT(size, 0u);
+
+	SiteTrafficVisitor v;
+	VisitDatagram({buffer, size},
+		      ToMask(Attribute::SITE, Attribute::TRAFFIC), v);
+	EXPECT_EQ(v.site, "mysite");
+	EXPECT_EQ(v.n_strings, 1u);
+	EXPECT_EQ(v.received, 123u);
+	EXPECT_EQ(v.sent, 456u);
+}
+
+TEST(LogVisit, DeferredCrc)
+{
+	uint8_t buffer[1024];
+	const size_t size = MakeDatagram(buffer, sizeof(buffer));
+	ASSERT_GT(size, 0u);
+
+	/* corrupt the CRC */
+	buffer[size - 1] ^= 0xff;
+
+	SiteTrafficVisitor v;
+	EXPECT_THROW(VisitDatagram({buffer, size},
+				   ToMask(Attribute::SITE), v),
+		     ProtocolError);
+
+	VisitDatagram({buffer, size}, ToMask(Attribute::SITE), v, false);
+	EXPECT_EQ(v.site, "mysite");
+	EXPECT_FALSE(VerifyDatagramCrc({buffer, size}));
+
+	buffer[size - 1] ^= 0xff;
+	EXPECT_TRUE(VerifyDatagramCrc({buffer, size}));
+}
+
+TEST(LogVisit, Malformed)
+{
+	uint8_t buffer[1024];
+	const size_t size = MakeDatagram(buffer, sizeof(buffer));
+	ASSERT_GT(size, 0u);
+
+	/* overwrite all null terminators; the strings now run into
+	   the CRC */
+	for (size_t i = 4; i < size - 4; ++i)
+		if (buffer[i] == 0)
+			buffer[i] = 'x';
+
+	SiteTrafficVisitor v;
+	EXPECT_THROW(VisitDatagram({buffer, size},
+				   ToMask(Attribute::SITE), v, false),
+		     ProtocolError);
+}
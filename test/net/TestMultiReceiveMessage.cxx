@@ -0,0 +1,245 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/MultiReceiveMessage.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/StaticSocketAddress.hxx"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+static UniqueSocketDescriptor
+CreateReceiver(StaticSocketAddress &address)
+{
+	UniqueSocketDescriptor fd;
+	EXPECT_TRUE(fd.CreateNonBlock(AF_INET, SOCK_DGRAM, 0));
+	EXPECT_TRUE(fd.Bind(IPv4Address(127, 0, 0, 1, 0)));
+	address = fd.GetLocalAddress();
+	return fd;
+}
+
+TEST(MultiReceiveMessageTest, Basic)
+{
+	StaticSocketAddress address;
+	auto r = CreateReceiver(address);
+	const SocketAddress a = address;
+
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.CreateNonBlock(AF_INET, SOCK_DGRAM, 0));
+
+	for (unsigned i = 0; i < 3; ++i)
+		ASSERT_EQ(sendto(s.Get(), "foo", 3 + i, 0,
+				 a.GetAddress(), a.GetSize()), 3 + i);
+
+	MultiReceiveMessage m(8, 256);
+	ASSERT_TRUE(m.Receive(r));
+
+	size_t n = 0;
+	for (const auto &d : m) {
+		EXPECT_EQ(d.payload.size, 3 + n);
+		++n;
+	}
+
+	EXPECT_EQ(n, 3u);
+
+	m.Clear();
+	EXPECT_TRUE(m.empty());
+}
+
+TEST(MultiReceiveMessageTest, Gro)
+{
+	StaticSocketAddress address;
+	auto r = CreateReceiver(address);
+	const SocketAddress a = address;
+
+	MultiReceiveMessage m(4, 65536, 256);
+	m.EnableGro(r);
+
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.CreateNonBlock(AF_INET, SOCK_DGRAM, 0));
+
+	/* send 1000 bytes as 10 segments with UDP_SEGMENT; on the
+	   loopback device, they arrive coalesced */
+	char buffer[1000];
+	for (size_t i = 0; i < sizeof(buffer); ++i)
+		buffer[i] = i / 100;
+
+	char cmsg_buffer[CMSG_SPACE(sizeof(uint16_t))] = {};
+	struct iovec v = {buffer, sizeof(buffer)};
+	struct msghdr mh{};
+	mh.msg_name = const_cast<struct sockaddr *>(a.GetAddress());
+	mh.msg_namelen = a.GetSize();
+	mh.msg_iov = &v;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cmsg_buffer;
+	mh.msg_controllen = sizeof(cmsg_buffer);
+
+	auto *cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	const uint16_t segment_size = 100;
+	memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+
+	if (sendmsg(s.Get(), &mh, 0) < 0)
+		/* UDP_SEGMENT not supported by this kernel */
+		return;
+
+	ASSERT_TRUE(m.Receive(r));
+
+	size_t n = 0;
+	for (const auto &d : m) {
+		ASSERT_EQ(d.payload.size, 100u);
+		EXPECT_EQ(((const char *)d.payload.data)[0], (char)n);
+		EXPECT_EQ(((const char *)d.payload.data)[99], (char)n);
+		++n;
+	}
+
+	EXPECT_EQ(n, 10u);
+}
+
+TEST(MultiReceiveMessageTest, Retain)
+{
+	StaticSocketAddress address;
+	auto r = CreateReceiver(address);
+	const SocketAddress a = address;
+
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.CreateNonBlock(AF_INET, SOCK_DGRAM, 0));
+
+	MultiReceiveMessage m(2, 256, 0, 0, 2);
+
+	ASSERT_EQ(sendto(s.Get(), "foo", 3, 0,
+			 a.GetAddress(), a.GetSize()), 3);
+	ASSERT_EQ(sendto(s.Get(), "bar", 3, 0,
+			 a.GetAddress(), a.GetSize()), 3);
+	ASSERT_TRUE(m.Receive(r));
+
+	std::vector<MultiReceiveMessage::RetainedDatagram> retained;
+	for (const auto &d : m) {
+		retained.emplace_back(m.Retain(d));
+		ASSERT_TRUE(retained.back());
+	}
+
+	ASSERT_EQ(retained.size(), 2u);
+
+	/* the new datagrams must not overwrite the retained ones */
+	ASSERT_EQ(sendto(s.Get(), "abc", 3, 0,
+			 a.GetAddress(), a.GetSize()), 3);
+	ASSERT_EQ(sendto(s.Get(), "def", 3, 0,
+			 a.GetAddress(), a.GetSize()), 3);
+	ASSERT_TRUE(m.Receive(r));
+
+	EXPECT_EQ(memcmp(retained[0].payload.data, "foo", 3), 0);
+	EXPECT_EQ(memcmp(retained[1].payload.data, "bar", 3), 0);
+
+	auto i = m.begin();
+	ASSERT_NE(i, m.end());
+	EXPECT_EQ(memcmp(i->payload.data, "abc", 3), 0);
+
+	/* all spare slots are occupied */
+	EXPECT_FALSE(m.Retain(*i));
+
+	/* release one */
+	retained[0].reset();
+	EXPECT_FALSE(retained[0]);
+
+	auto r2 = m.Retain(*i);
+	EXPECT_TRUE(r2);
+	EXPECT_EQ(memcmp(r2.payload.data, "abc", 3), 0);
+
+	m.Clear();
+	EXPECT_EQ(memcmp(retained[1].payload.data, "bar", 3), 0);
+}
+
+/**
+ * Since Linux 6.9, GRO coalesces up to 128 segments.
+ */
+TEST(MultiReceiveMessageTest, GroMaxSegments)
+{
+	StaticSocketAddress address;
+	auto r = CreateReceiver(address);
+	const SocketAddress a = address;
+
+	MultiReceiveMessage m(1, 65536, 256);
+	m.EnableGro(r);
+
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.CreateNonBlock(AF_INET, SOCK_DGRAM, 0));
+
+	char buffer[128 * 10];
+	for (size_t i = 0; i < sizeof(buffer); ++i)
+		buffer[i] = i / 10;
+
+	char cmsg_buffer[CMSG_SPACE(sizeof(uint16_t))] = {};
+	struct iovec v = {buffer, sizeof(buffer)};
+	struct msghdr mh{};
+	mh.msg_name = const_cast<struct sockaddr *>(a.GetAddress());
+	mh.msg_namelen = a.GetSize();
+	mh.msg_iov = &v;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cmsg_buffer;
+	mh.msg_controllen = sizeof(cmsg_buffer);
+
+	auto *cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	const uint16_t segment_size = 10;
+	memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+
+	if (sendmsg(s.Get(), &mh, 0) < 0)
+		GTEST_SKIP() << "128 UDP_SEGMENT segments not supported by this kernel";
+
+	ASSERT_TRUE(m.Receive(r));
+
+	size_t n = 0;
+	for (const auto &d : m) {
+		ASSERT_EQ(d.payload.size, 10u);
+		EXPECT_EQ(((const char *)d.payload.data)[0], (char)n);
+		EXPECT_EQ(((const char *)d.payload.data)[9], (char)n);
+		++n;
+	}
+
+	EXPECT_EQ(n, 128u);
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/MultiSendMessage.hxx"
+#include "net/MultiReceiveMessage.hxx"
+#include "net/SendMessage.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/IPv6Address.hxx"
+#include "net/StaticSocketAddress.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <system_error>
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static UniqueSocketDescriptor
+CreateReceiver(StaticSocketAddress &address)
+{
+	UniqueSocketDescriptor fd;
+	EXPECT_TRUE(fd.CreateNonBlock(AF_INET, SOCK_DGRAM, 0));
+	EXPECT_TRUE(fd.Bind(IPv4Address(127, 0, 0, 1, 0)));
+	address = fd.GetLocalAddress();
+	return fd;
+}
+
+static void
+TestSend(bool gso)
+{
+	StaticSocketAddress address1, address2;
+	auto r1 = CreateReceiver(address1);
+	auto r2 = CreateReceiver(address2);
+
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.CreateNonBlock(AF_INET, SOCK_DGRAM, 0));
+
+	char buffer[100];
+	memset(buffer, 'x', sizeof(buffer));
+
+	MultiSendMessage m(16, sizeof(buffer));
+	if (gso)
+		m.EnableGso();
+
+	EXPECT_TRUE(m.empty());
+
+	for (unsigned i = 0; i < 5; ++i)
+		ASSERT_TRUE(m.Push(address1, {buffer, sizeof(buffer)}));
+	ASSERT_TRUE(m.Push(address1, {buffer, 50}));
+	ASSERT_TRUE(m.Push(address2, {buffer, 10}));
+	ASSERT_TRUE(m.Push(address1, {buffer, 20}));
+	EXPECT_EQ(m.size(), 8u);
+
+	/* too large */
+	EXPECT_FALSE(m.Push(address1, {buffer, sizeof(buffer) + 1}));
+
+	EXPECT_EQ(m.Flush(s), 0u);
+	EXPECT_TRUE(m.empty());
+
+	MultiReceiveMessage rm(16, 256);
+	ASSERT_TRUE(rm.Receive(r1));
+
+	const size_t expected1[] = {100, 100, 100, 100, 100, 50, 20};
+	size_t n = 0;
+	for (const auto &d : rm) {
+		ASSERT_LT(n, sizeof(expected1) / sizeof(expected1[0]));
+		EXPECT_EQ(d.payload.size, expected1[n]);
+		++n;
+	}
+	EXPECT_EQ(n, 7u);
+
+	ASSERT_TRUE(rm.Receive(r2));
+	n = 0;
+	for (const auto &d : rm) {
+		EXPECT_EQ(d.payload.size, 10u);
+		++n;
+	}
+	EXPECT_EQ(n, 1u);
+}
+
+TEST(MultiSendMessageTest, Basic)
+{
+	TestSend(false);
+}
+
+TEST(MultiSendMessageTest, Gso)
+{
+	TestSend(true);
+}
+
+TEST(MultiSendMessageTest, Full)
+{
+	StaticSocketAddress address;
+	auto r = CreateReceiver(address);
+
+	MultiSendMessage m(2, 16);
+	EXPECT_TRUE(m.Push(address, {"a", 1}));
+	EXPECT_TRUE(m.Push(address, {"b", 1}));
+	EXPECT_TRUE(m.full());
+	EXPECT_FALSE(m.Push(address, {"c", 1}));
+
+	m.Clear();
+	EXPECT_TRUE(m.empty());
+}
+
+/**
+ * One failing message must not discard the others.
+ */
+TEST(MultiSendMessageTest, SkipFailed)
+{
+	StaticSocketAddress address;
+	auto r = CreateReceiver(address);
+
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.CreateNonBlock(AF_INET, SOCK_DGRAM, 0));
+
+	/* an IPv6 destination cannot be reached with an IPv4
+	   socket */
+	const IPv6Address bad(0, 0, 0, 0, 0, 0, 0, 1, 9);
+
+	MultiSendMessage m(4, 16);
+	ASSERT_TRUE(m.Push(address, {"a", 1}));
+	ASSERT_TRUE(m.Push(bad, {"b", 1}));
+	ASSERT_TRUE(m.Push(address, {"c", 1}));
+	ASSERT_TRUE(m.Push(bad, {"d", 1}));
+
+	EXPECT_EQ(m.Flush(s), 2u);
+	EXPECT_TRUE(m.empty());
+
+	MultiReceiveMessage rm(16, 256);
+	ASSERT_TRUE(rm.Receive(r));
+
+	std::string received;
+	for (const auto &d : rm)
+		received.append((const char *)d.payload.data, d.payload.size);
+	EXPECT_EQ(received, "ac");
+}
+
+TEST(SendMultiMessageTest, Basic)
+{
+	int sv[2];
+	ASSERT_EQ(socketpair(AF_LOCAL, SOCK_DGRAM|SOCK_CLOEXEC, 0, sv), 0);
+	UniqueSocketDescriptor s(sv[0]), r(sv[1]);
+
+	static const char *const payloads[] = {"foo", "hello", "x"};
+	struct iovec iov[3];
+	struct mmsghdr v[3];
+	memset(v, 0, sizeof(v));
+	for (unsigned i = 0; i < 3; ++i) {
+		iov[i].iov_base = const_cast<char *>(payloads[i]);
+		iov[i].iov_len = strlen(payloads[i]);
+		v[i].msg_hdr.msg_iov = &iov[i];
+		v[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	EXPECT_EQ(SendMultiMessage(s, v, 3, MSG_DONTWAIT), 3u);
+
+	for (unsigned i = 0; i < 3; ++i) {
+		EXPECT_EQ(v[i].msg_len, strlen(payloads[i]));
+
+		char buffer[16];
+		auto nbytes = r.Read(buffer, sizeof(buffer));
+		ASSERT_GE(nbytes, 0);
+		EXPECT_EQ(std::string(buffer, nbytes), payloads[i]);
+	}
+}
+
+TEST(SendMultiMessageTest, Error)
+{
+	int sv[2];
+	ASSERT_EQ(socketpair(AF_LOCAL, SOCK_DGRAM|SOCK_CLOEXEC, 0, sv), 0);
+	UniqueSocketDescriptor s(sv[0]);
+	close(sv[1]);
+
+	struct iovec iov;
+	iov.iov_base = const_cast<char *>("foo");
+	iov.iov_len = 3;
+	struct mmsghdr v;
+	memset(&v, 0, sizeof(v));
+	v.msg_hdr.msg_iov = &iov;
+	v.msg_hdr.msg_iovlen = 1;
+
+	EXPECT_THROW(SendMultiMessage(s, &v, 1, MSG_DONTWAIT),
+		     std::system_error);
+}
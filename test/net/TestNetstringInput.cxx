@@ -0,0 +1,202 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/djb/NetstringInput.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace {
+
+class Pipe {
+	int fds[2];
+
+public:
+	Pipe() {
+		if (pipe2(fds, O_NONBLOCK) < 0)
+			throw std::runtime_error("pipe() failed");
+	}
+
+	~Pipe() {
+		close(fds[0]);
+		if (fds[1] >= 0)
+			close(fds[1]);
+	}
+
+	int GetReadFD() const {
+		return fds[0];
+	}
+
+	void Write(const char *s) {
+		Write(s, strlen(s));
+	}
+
+	void Write(const void *data, size_t size) {
+		if (write(fds[1], data, size) != ssize_t(size))
+			throw std::runtime_error("write() failed");
+	}
+
+	void CloseWrite() {
+		close(fds[1]);
+		fds[1] = -1;
+	}
+};
+
+}
+
+static std::string
+ToString(ConstBuffer<uint8_t> b)
+{
+	return std::string((const char *)b.data, b.size);
+}
+
+static std::string
+ToString(const AllocatedArray<uint8_t> &a)
+{
+	return std::string((const char *)a.begin(), a.size());
+}
+
+TEST(NetstringInput, Unbuffered)
+{
+	Pipe p;
+	p.Write("5:hello,");
+
+	NetstringInput input(1024);
+	NetstringInput::Result result;
+	do {
+		result = input.Receive(p.GetReadFD());
+	} while (result == NetstringInput::Result::MORE);
+
+	ASSERT_EQ(result, NetstringInput::Result::FINISHED);
+	EXPECT_EQ(ToString(input.GetValue()), "hello");
+}
+
+TEST(NetstringInput, BufferedInPlace)
+{
+	Pipe p;
+	p.Write("5:hello,");
+
+	NetstringInput input(1024, 256);
+	ASSERT_EQ(input.Receive(p.GetReadFD()),
+		  NetstringInput::Result::FINISHED);
+	EXPECT_EQ(ToString(input.GetValueView()), "hello");
+	EXPECT_EQ(ToString(input.GetValue()), "hello");
+	EXPECT_EQ(ToString(input.GetValueView()), "hello");
+	EXPECT_FALSE(input.HasBufferedData());
+}
+
+TEST(NetstringInput, BufferedPipelined)
+{
+	Pipe p;
+	p.Write("3:foo,0:,3:ba");
+
+	NetstringInput input(1024, 256);
+	ASSERT_EQ(input.Receive(p.GetReadFD()),
+		  NetstringInput::Result::FINISHED);
+	EXPECT_EQ(ToString(input.GetValueView()), "foo");
+
+	input.Reset();
+	EXPECT_TRUE(input.HasBufferedData());
+	ASSERT_EQ(input.Receive(p.GetReadFD()),
+		  NetstringInput::Result::FINISHED);
+	EXPECT_EQ(ToString(input.GetValueView()), "");
+
+	input.Reset();
+	EXPECT_TRUE(input.HasBufferedData());
+	ASSERT_EQ(input.Receive(p.GetReadFD()),
+		  NetstringInput::Result::MORE);
+
+	p.Write("r,");
+	ASSERT_EQ(input.Receive(p.GetReadFD()),
+		  NetstringInput::Result::FINISHED);
+	EXPECT_EQ(ToString(input.GetValueView()), "bar");
+
+	input.Reset();
+	EXPECT_FALSE(input.HasBufferedData());
+
+	p.CloseWrite();
+	EXPECT_EQ(input.Receive(p.GetReadFD()),
+		  NetstringInput::Result::CLOSED);
+}
+
+TEST(NetstringInput, BufferedLarge)
+{
+	const std::string large(1000, 'x');
+
+	Pipe p;
+	p.Write("1000:");
+	p.Write(large.data(), 100);
+
+	NetstringInput input(4096, 64);
+	ASSERT_EQ(input.Receive(p.GetReadFD()), NetstringInput::Result::MORE);
+
+	p.Write(large.data() + 100, large.size() - 100);
+	p.Write(",");
+
+	NetstringInput::Result result;
+	do {
+		result = input.Receive(p.GetReadFD());
+	} while (result == NetstringInput::Result::MORE);
+
+	ASSERT_EQ(result, NetstringInput::Result::FINISHED);
+	EXPECT_EQ(ToString(input.GetValueView()), large);
+	EXPECT_EQ(ToString(input.GetValue()), large);
+}
+
+TEST(NetstringInput, BufferedMalformed)
+{
+	{
+		Pipe p;
+		p.Write("3:foo;");
+		NetstringInput input(1024, 256);
+		EXPECT_THROW(input.Receive(p.GetReadFD()), std::runtime_error);
+	}
+
+	{
+		Pipe p;
+		p.Write("x:foo,");
+		NetstringInput input(1024, 256);
+		EXPECT_THROW(input.Receive(p.GetReadFD()), std::runtime_error);
+	}
+
+	{
+		Pipe p;
+		p.Write("2000:");
+		NetstringInput input(1024, 256);
+		EXPECT_THROW(input.Receive(p.GetReadFD()), std::runtime_error);
+	}
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/djb/NetstringServer.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+class MyNetstringServer final : public NetstringServer {
+	EventLoop &event_loop;
+
+public:
+	std::vector<std::pair<RequestId, std::string>> requests;
+	bool disconnected = false;
+
+	MyNetstringServer(EventLoop &_event_loop, UniqueSocketDescriptor _fd,
+			  bool _persistent)
+		:NetstringServer(_event_loop, std::move(_fd), _persistent),
+		 event_loop(_event_loop) {}
+
+	using NetstringServer::SendResponse;
+
+	void Run(size_t n) {
+		while (requests.size() < n && !disconnected)
+			event_loop.LoopOnce();
+	}
+
+protected:
+	void OnPipelinedRequest(RequestId id,
+				AllocatedArray<uint8_t> &&payload) override {
+		requests.emplace_back(id,
+				      std::string((const char *)payload.begin(),
+						  payload.size()));
+	}
+
+	void OnRequest(AllocatedArray<uint8_t> &&payload) override {
+		OnPipelinedRequest(0, std::move(payload));
+	}
+
+	void OnError(std::exception_ptr) override {
+		disconnected = true;
+	}
+
+	void OnDisconnect() override {
+		disconnected = true;
+	}
+};
+
+static std::string
+ReceiveAll(SocketDescriptor s)
+{
+	std::string result;
+
+	char buffer[4096];
+	ssize_t nbytes;
+	while ((nbytes = recv(s.Get(), buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+		result.append(buffer, nbytes);
+
+	return result;
+}
+
+TEST(NetstringServer, Single)
+{
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+								      SOCK_STREAM, 0,
+								      a, b));
+
+	EventLoop event_loop;
+	MyNetstringServer server(event_loop, std::move(a), false);
+
+	ASSERT_EQ(send(b.Get(), "5:hello,", 8, 0), 8);
+	server.Run(1);
+	ASSERT_EQ(server.requests.size(), 1u);
+	EXPECT_EQ(server.requests.front().second, "hello");
+
+	ASSERT_TRUE(server.SendResponse("world"));
+	EXPECT_EQ(ReceiveAll(b), "5:world,");
+}
+
+TEST(NetstringServer, Pipelined)
+{
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+								      SOCK_STREAM, 0,
+								      a, b));
+
+	EventLoop event_loop;
+	MyNetstringServer server(event_loop, std::move(a), true);
+
+	const char request[] = "3:foo,3:bar,1:x,";
+	ASSERT_EQ(send(b.Get(), request, sizeof(request) - 1, 0),
+		  ssize_t(sizeof(request) - 1));
+	server.Run(3);
+	ASSERT_FALSE(server.disconnected);
+	ASSERT_EQ(server.requests.size(), 3u);
+	EXPECT_EQ(server.requests[0].second, "foo");
+	EXPECT_EQ(server.requests[1].second, "bar");
+	EXPECT_EQ(server.requests[2].second, "x");
+
+	const auto id0 = server.requests[0].first;
+	const auto id1 = server.requests[1].first;
+	const auto id2 = server.requests[2].first;
+
+	/* out of order: nothing may be sent until the first response
+	   is there */
+	ASSERT_TRUE(server.SendResponse(id2, "3", 1));
+	ASSERT_TRUE(server.SendResponse(id1, "22", 2));
+	EXPECT_EQ(ReceiveAll(b), "");
+
+	ASSERT_TRUE(server.SendResponse(id0, "111", 3));
+	EXPECT_EQ(ReceiveAll(b), "3:111,2:22,1:3,");
+
+	/* the connection stays open for more requests */
+	ASSERT_EQ(send(b.Get(), "2:ok,", 5, 0), 5);
+	server.Run(4);
+	ASSERT_EQ(server.requests.size(), 4u);
+	EXPECT_EQ(server.requests[3].second, "ok");
+	ASSERT_TRUE(server.SendResponse("fine"));
+	EXPECT_EQ(ReceiveAll(b), "4:fine,");
+}
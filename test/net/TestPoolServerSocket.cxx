@@ -0,0 +1,293 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/PoolServerSocket.hxx"
+#include "event/net/ServerSocket.hxx"
+#include "event/Pool.hxx"
+#include "event/InjectEvent.hxx"
+#include "event/Loop.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+#include <sys/socket.h>
+
+static std::vector<int>
+GetAllowedCpus()
+{
+	std::vector<int> result;
+
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		for (int i = 0; i < CPU_SETSIZE; ++i)
+			if (CPU_ISSET(i, &set))
+				result.push_back(i);
+
+	return result;
+}
+
+static void
+SetAffinity(const std::vector<int> &cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (const int cpu : cpus)
+		CPU_SET(cpu, &set);
+
+	if (sched_setaffinity(0, sizeof(set), &set) < 0)
+		throw MakeErrno("sched_setaffinity() failed");
+}
+
+/**
+ * Restores the calling thread's CPU affinity mask on destruction.
+ */
+class ScopeRestoreAffinity {
+	cpu_set_t set;
+
+public:
+	ScopeRestoreAffinity() {
+		if (sched_getaffinity(0, sizeof(set), &set) < 0)
+			throw MakeErrno("sched_getaffinity() failed");
+	}
+
+	~ScopeRestoreAffinity() noexcept {
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+
+	ScopeRestoreAffinity(const ScopeRestoreAffinity &) = delete;
+	ScopeRestoreAffinity &operator=(const ScopeRestoreAffinity &) = delete;
+};
+
+/**
+ * Records the CPU affinity of the #EventLoop thread it is injected
+ * into.
+ */
+struct AffinityProbe {
+	InjectEvent event;
+
+	/**
+	 * The only CPU the thread may run on, -1 if it is not
+	 * pinned, or -2 if not yet known.
+	 */
+	std::atomic<int> cpu{-2};
+
+	explicit AffinityProbe(EventLoop &loop)
+		:event(loop, BIND_THIS_METHOD(OnInject)) {}
+
+private:
+	void OnInject() noexcept {
+		cpu_set_t set;
+		if (sched_getaffinity(0, sizeof(set), &set) < 0 ||
+		    CPU_COUNT(&set) != 1) {
+			cpu = -1;
+			return;
+		}
+
+		for (int i = 0; i < CPU_SETSIZE; ++i) {
+			if (CPU_ISSET(i, &set)) {
+				cpu = i;
+				break;
+			}
+		}
+	}
+};
+
+template<typename F>
+static bool
+WaitFor(F &&f)
+{
+	for (unsigned i = 0; i < 500; ++i) {
+		if (f())
+			return true;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	return false;
+}
+
+static void
+CheckPinning(size_t n)
+{
+	const auto allowed = GetAllowedCpus();
+	ASSERT_FALSE(allowed.empty());
+
+	EventLoopPool pool(n);
+	const int *cpus = pool.GetCpus();
+
+	/* the table is known before Start(), in the order of the
+	   affinity mask, wrapping around */
+	for (size_t i = 0; i < n; ++i)
+		EXPECT_EQ(cpus[i], allowed[i % allowed.size()]);
+
+	std::vector<std::unique_ptr<AffinityProbe>> probes;
+	for (size_t i = 0; i < n; ++i)
+		probes.emplace_back(new AffinityProbe(pool[i]));
+
+	pool.Start(true);
+
+	for (auto &p : probes)
+		p->event.Schedule();
+
+	ASSERT_TRUE(WaitFor([&probes]{
+		for (const auto &p : probes)
+			if (p->cpu == -2)
+				return false;
+		return true;
+	}));
+
+	pool.Stop();
+
+	/* each thread has really been pinned to the CPU in the
+	   table */
+	for (size_t i = 0; i < n; ++i)
+		EXPECT_EQ(probes[i]->cpu, cpus[i]);
+}
+
+TEST(EventLoopPool, Pinning)
+{
+	CheckPinning(GetAllowedCpus().size());
+
+	/* more threads than CPUs */
+	CheckPinning(GetAllowedCpus().size() * 2 + 1);
+}
+
+TEST(EventLoopPool, PinningSparseMask)
+{
+	const auto allowed = GetAllowedCpus();
+	if (allowed.size() < 2)
+		GTEST_SKIP();
+
+	/* leave out the first CPU, so thread i is not pinned to CPU
+	   i */
+	const ScopeRestoreAffinity restore;
+	SetAffinity({allowed.begin() + 1, allowed.end()});
+
+	CheckPinning(allowed.size() - 1);
+}
+
+class CountingServer final : public ServerSocket {
+	std::atomic<unsigned> n_accepted{0};
+
+public:
+	explicit CountingServer(EventLoop &event_loop)
+		:ServerSocket(event_loop) {}
+
+	unsigned GetAccepted() const noexcept {
+		return n_accepted;
+	}
+
+protected:
+	void OnAccept(UniqueSocketDescriptor &&,
+		      SocketAddress) override {
+		++n_accepted;
+	}
+
+	void OnAcceptError(std::exception_ptr ep) override {
+		std::rethrow_exception(ep);
+	}
+};
+
+/**
+ * Find a free TCP port on the loopback interface.
+ */
+static IPv4Address
+GetFreeLoopbackAddress()
+{
+	UniqueSocketDescriptor s;
+	if (!s.Create(AF_INET, SOCK_STREAM, 0) ||
+	    !s.Bind(IPv4Address(127, 0, 0, 1, 0)))
+		throw MakeErrno("Failed to bind");
+
+	return IPv4Address(127, 0, 0, 1, s.GetLocalAddress().GetPort());
+}
+
+TEST(PoolServerSocket, SteerByCpu)
+{
+	auto allowed = GetAllowedCpus();
+	ASSERT_FALSE(allowed.empty());
+
+	const ScopeRestoreAffinity restore;
+
+	if (allowed.size() >= 2) {
+		/* leave out the first CPU, so the socket index
+		   differs from the CPU number */
+		allowed.erase(allowed.begin());
+		SetAffinity(allowed);
+	}
+
+	EventLoopPool pool(allowed.size());
+	PoolServerSocket<CountingServer> server(pool);
+
+	const auto address = GetFreeLoopbackAddress();
+	server.Listen(address, false, nullptr, true);
+
+	std::vector<CountingServer *> sockets;
+	server.ForEach([&sockets](CountingServer &s){
+		sockets.push_back(&s);
+	});
+	ASSERT_EQ(sockets.size(), allowed.size());
+
+	pool.Start(true);
+
+	const int *cpus = pool.GetCpus();
+	std::vector<UniqueSocketDescriptor> clients;
+
+	for (size_t i = 0; i < allowed.size(); ++i) {
+		/* connections over the loopback interface are
+		   handled by the CPU of the connecting thread */
+		SetAffinity({cpus[i]});
+
+		UniqueSocketDescriptor c;
+		ASSERT_TRUE(c.Create(AF_INET, SOCK_STREAM, 0));
+		ASSERT_TRUE(c.Connect(address));
+		clients.emplace_back(std::move(c));
+
+		ASSERT_TRUE(WaitFor([&sockets, i]{
+			return sockets[i]->GetAccepted() == 1;
+		}));
+	}
+
+	pool.Stop();
+
+	for (const auto *s : sockets)
+		EXPECT_EQ(s->GetAccepted(), 1u);
+}
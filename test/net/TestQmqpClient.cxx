@@ -0,0 +1,140 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/djb/QmqpClient.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <stdio.h>
+#include <sys/socket.h>
+
+struct MyQmqpClientHandler final : QmqpClientHandler {
+	std::string description;
+	bool done = false, failed = false;
+
+	void OnQmqpClientSuccess(StringView _description) override {
+		description.assign(_description.data, _description.size);
+		done = true;
+	}
+
+	void OnQmqpClientError(std::exception_ptr) override {
+		done = failed = true;
+	}
+};
+
+static std::string
+Exchange(EventLoop &event_loop, MyQmqpClientHandler &handler,
+	 SocketDescriptor s, size_t expected_size)
+{
+	std::string request;
+
+	while (request.size() < expected_size && !handler.done) {
+		event_loop.LoopOnceNonBlock();
+
+		char buffer[4096];
+		ssize_t nbytes = recv(s.Get(), buffer, sizeof(buffer),
+				      MSG_DONTWAIT);
+		if (nbytes > 0)
+			request.append(buffer, nbytes);
+	}
+
+	send(s.Get(), "3:Kok,", 6, 0);
+
+	while (!handler.done)
+		event_loop.LoopOnce();
+
+	return request;
+}
+
+TEST(QmqpClient, Memory)
+{
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+								      SOCK_STREAM, 0,
+								      a, b));
+
+	EventLoop event_loop;
+	MyQmqpClientHandler handler;
+	QmqpClient client(event_loop, handler);
+	client.Begin("hello", "from@example.com");
+	client.AddRecipient("to@example.com");
+	const int fd = a.Steal();
+	client.Commit(fd, fd);
+
+	const std::string expected = "46:5:hello,16:from@example.com,14:to@example.com,,";
+	EXPECT_EQ(Exchange(event_loop, handler, b, expected.size()), expected);
+	EXPECT_FALSE(handler.failed);
+	EXPECT_EQ(handler.description, "ok");
+}
+
+TEST(QmqpClient, File)
+{
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+								      SOCK_STREAM, 0,
+								      a, b));
+
+	/* a body which is larger than the socket buffer */
+	std::string body;
+	while (body.size() < 1024 * 1024)
+		body += "The quick brown fox jumps over the lazy dog.\r\n";
+
+	FILE *file = tmpfile();
+	ASSERT_NE(file, nullptr);
+	ASSERT_EQ(fputs("XXX", file), 1);
+	ASSERT_EQ(fwrite(body.data(), 1, body.size(), file), body.size());
+	ASSERT_EQ(fflush(file), 0);
+
+	EventLoop event_loop;
+	MyQmqpClientHandler handler;
+	QmqpClient client(event_loop, handler);
+	client.Begin(fileno(file), 3, body.size(), "from@example.com");
+	client.AddRecipient("to@example.com");
+	const int fd = a.Steal();
+	client.Commit(fd, fd);
+
+	const std::string message = std::to_string(body.size()) + ":" +
+		body + ",";
+	const std::string payload = message +
+		"16:from@example.com,14:to@example.com,";
+	const std::string expected = std::to_string(payload.size()) + ":" +
+		payload + ",";
+	EXPECT_EQ(Exchange(event_loop, handler, b, expected.size()), expected);
+	EXPECT_FALSE(handler.failed);
+	EXPECT_EQ(handler.description, "ok");
+
+	fclose(file);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/Resolver.hxx"
+#include "net/AddressInfo.hxx"
+#include "net/ToString.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <netdb.h>
+#include <string.h>
+
+static std::string
+FirstToString(const AddressInfoList &list)
+{
+    char buffer[256];
+    if (list.empty() || !ToString(buffer, sizeof(buffer), list.front()))
+        return {};
+    return buffer;
+}
+
+static struct addrinfo
+NumericHints()
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST;
+    hints.ai_socktype = SOCK_STREAM;
+    return hints;
+}
+
+TEST(ResolverTest, Batch)
+{
+    const char *const hosts[] = {
+        "127.0.0.1",
+        "[::1]:8080",
+        "192.168.1.2:443",
+        "10.0.0.1",
+        "[2001:db8::1]",
+    };
+
+    const auto hints = NumericHints();
+    const auto results = ResolveBatch({hosts, 5}, 80, &hints, 3);
+    ASSERT_EQ(results.size(), 5u);
+    ASSERT_EQ(FirstToString(results[0]), "127.0.0.1:80");
+    ASSERT_EQ(FirstToString(results[1]), "[::1]:8080");
+    ASSERT_EQ(FirstToString(results[2]), "192.168.1.2:443");
+    ASSERT_EQ(FirstToString(results[3]), "10.0.0.1:80");
+    ASSERT_EQ(FirstToString(results[4]), "[2001:db8::1]:80");
+}
+
+TEST(ResolverTest, BatchSingleThread)
+{
+    const char *const hosts[] = {
+        "127.0.0.1:1",
+        "127.0.0.2:2",
+    };
+
+    const auto hints = NumericHints();
+    const auto results = ResolveBatch({hosts, 2}, 80, &hints, 1);
+    ASSERT_EQ(results.size(), 2u);
+    ASSERT_EQ(FirstToString(results[0]), "127.0.0.1:1");
+    ASSERT_EQ(FirstToString(results[1]), "127.0.0.2:2");
+}
+
+TEST(ResolverTest, BatchEmpty)
+{
+    const auto results = ResolveBatch(nullptr, 80, nullptr);
+    ASSERT_TRUE(results.empty());
+}
+
+TEST(ResolverTest, BatchError)
+{
+    const char *const hosts[] = {
+        "127.0.0.1",
+        "not a numeric host",
+        "127.0.0.2",
+    };
+
+    const auto hints = NumericHints();
+    ASSERT_THROW(ResolveBatch({hosts, 3}, 80, &hints), std::runtime_error);
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "net/ReusePortCpu.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/IPv4Address.hxx"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <errno.h>
+#include <linux/filter.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * A minimal interpreter for the instructions generated by
+ * MakeReusePortCpuProgram().
+ *
+ * @return the selected socket index
+ */
+static uint32_t
+Interpret(const struct sock_filter *code, size_t length, uint32_t cpu)
+{
+	uint32_t a = 0;
+
+	for (size_t pc = 0; pc < length; ++pc) {
+		const auto &i = code[pc];
+
+		switch (i.code) {
+		case BPF_LD|BPF_W|BPF_ABS:
+			EXPECT_EQ(i.k, uint32_t(SKF_AD_OFF + SKF_AD_CPU));
+			a = cpu;
+			break;
+
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			pc += a == i.k ? i.jt : i.jf;
+			break;
+
+		case BPF_ALU|BPF_MOD|BPF_K:
+			a %= i.k;
+			break;
+
+		case BPF_RET|BPF_K:
+			return i.k;
+
+		case BPF_RET|BPF_A:
+			return a;
+
+		default:
+			ADD_FAILURE() << "Unexpected opcode " << i.code;
+			return UINT32_MAX;
+		}
+	}
+
+	ADD_FAILURE() << "No return";
+	return UINT32_MAX;
+}
+
+static std::vector<struct sock_filter>
+Make(const int *cpus, unsigned n)
+{
+	std::vector<struct sock_filter> code(ReusePortCpuProgramMaxLength(n));
+	code.resize(MakeReusePortCpuProgram(code.data(), cpus, n));
+	return code;
+}
+
+TEST(ReusePortCpu, Modulo)
+{
+	for (unsigned n = 1; n <= 8; ++n) {
+		const auto code = Make(nullptr, n);
+		EXPECT_EQ(code.size(), 3u);
+
+		for (uint32_t cpu = 0; cpu < 32; ++cpu)
+			EXPECT_EQ(Interpret(code.data(), code.size(), cpu), cpu % n);
+	}
+}
+
+TEST(ReusePortCpu, Table)
+{
+	/* socket 1 is not pinned; sockets 0 and 3 share CPU 3 */
+	static constexpr int cpus[] = {3, -1, 5, 3};
+	const auto code = Make(cpus, 4);
+	EXPECT_EQ(code.size(), 1u + 2 * 3 + 2);
+
+	const auto run = [&code](uint32_t cpu){
+		return Interpret(code.data(), code.size(), cpu);
+	};
+
+	EXPECT_EQ(run(3), 0u);
+	EXPECT_EQ(run(5), 2u);
+
+	/* other CPUs fall back to "cpu % n" */
+	EXPECT_EQ(run(0), 0u);
+	EXPECT_EQ(run(1), 1u);
+	EXPECT_EQ(run(2), 2u);
+	EXPECT_EQ(run(6), 2u);
+	EXPECT_EQ(run(7), 3u);
+}
+
+TEST(ReusePortCpu, Reversed)
+{
+	std::vector<int> cpus;
+	for (int i = 15; i >= 0; --i)
+		cpus.push_back(i);
+
+	const auto code = Make(cpus.data(), cpus.size());
+	EXPECT_EQ(code.size(), ReusePortCpuProgramMaxLength(cpus.size()));
+
+	for (uint32_t cpu = 0; cpu < 16; ++cpu)
+		EXPECT_EQ(Interpret(code.data(), code.size(), cpu), 15 - cpu);
+
+	EXPECT_EQ(Interpret(code.data(), code.size(), 17), 1u);
+}
+
+/**
+ * The kernel accepts the generated programs.
+ */
+TEST(ReusePortCpu, Attach)
+{
+	UniqueSocketDescriptor s;
+	ASSERT_TRUE(s.Create(AF_INET, SOCK_DGRAM, 0));
+	ASSERT_TRUE(s.SetReusePort());
+	ASSERT_TRUE(s.Bind(IPv4Address(127, 0, 0, 1, 0)));
+
+	EXPECT_TRUE(s.SetReusePortCpu(4));
+
+	static constexpr int cpus[] = {3, -1, 5, 3};
+	EXPECT_TRUE(s.SetReusePortCpu(cpus, 4));
+
+	/* too large for BPF_MAXINSNS */
+	std::vector<int> many(BPF_MAXINSNS, 0);
+	EXPECT_FALSE(s.SetReusePortCpu(many.data(), many.size()));
+	EXPECT_EQ(errno, EINVAL);
+
+	/* without a table, the size does not matter */
+	EXPECT_TRUE(s.SetReusePortCpu(BPF_MAXINSNS));
+}
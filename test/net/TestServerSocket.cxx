@@ -0,0 +1,275 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/ServerSocket.hxx"
+#include "event/Loop.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class TestServerSocket final : public ServerSocket {
+public:
+	/**
+	 * The size of each OnAcceptBatch() call.
+	 */
+	std::vector<size_t> batches;
+
+	std::vector<UniqueSocketDescriptor> accepted;
+
+	/**
+	 * Claim all sockets in OnAcceptBatch()?  If false, only every
+	 * other one is claimed.
+	 */
+	bool claim_all = true;
+
+	explicit TestServerSocket(EventLoop &event_loop,
+				  bool _exclusive=false)
+		:ServerSocket(event_loop) {
+		SetExclusive(_exclusive);
+		Listen(IPv4Address(127, 0, 0, 1, 0));
+	}
+
+	/**
+	 * Share an existing listener (e.g. a dup() of another
+	 * #TestServerSocket's descriptor).
+	 */
+	TestServerSocket(EventLoop &event_loop, UniqueSocketDescriptor &&_fd,
+			 bool _exclusive)
+		:ServerSocket(event_loop) {
+		SetExclusive(_exclusive);
+		Listen(std::move(_fd));
+	}
+
+	UniqueSocketDescriptor Connect() {
+		UniqueSocketDescriptor s;
+		if (!s.Create(AF_INET, SOCK_STREAM, 0))
+			throw MakeErrno("Failed to create socket");
+
+		/* this completes as soon as the connection is in the
+		   listener's backlog */
+		if (!s.Connect(GetLocalAddress()))
+			throw MakeErrno("Failed to connect");
+
+		return s;
+	}
+
+protected:
+	void OnAccept(UniqueSocketDescriptor &&new_fd,
+		      SocketAddress) override {
+		batches.push_back(0);
+		accepted.emplace_back(std::move(new_fd));
+	}
+
+	void OnAcceptError(std::exception_ptr ep) override {
+		std::rethrow_exception(ep);
+	}
+
+	void OnAcceptBatch(AcceptedSocket *sockets, size_t n) override {
+		batches.push_back(n);
+
+		for (size_t i = 0; i < n; ++i) {
+			EXPECT_EQ(sockets[i].address.GetFamily(), AF_INET);
+			if (claim_all || i % 2 == 0)
+				accepted.emplace_back(std::move(sockets[i].fd));
+		}
+	}
+};
+
+static bool
+IsNoDelay(SocketDescriptor s)
+{
+	int value = 0;
+	return s.GetOption(IPPROTO_TCP, TCP_NODELAY,
+			   &value, sizeof(value)) == sizeof(value) &&
+		value != 0;
+}
+
+/**
+ * Has the peer closed the connection?
+ */
+static bool
+IsClosedByPeer(SocketDescriptor s)
+{
+	char ch;
+	return recv(s.Get(), &ch, sizeof(ch), MSG_DONTWAIT) == 0;
+}
+
+TEST(ServerSocket, AcceptBatch)
+{
+	EventLoop event_loop;
+	TestServerSocket server(event_loop);
+	server.SetAcceptBatch(4);
+
+	std::vector<UniqueSocketDescriptor> clients;
+	for (unsigned i = 0; i < 10; ++i)
+		clients.emplace_back(server.Connect());
+
+	/* each wakeup drains up to 4 connections from the backlog */
+	for (unsigned i = 0; i < 10 && server.accepted.size() < 10; ++i)
+		event_loop.LoopOnceNonBlock();
+
+	ASSERT_EQ(server.accepted.size(), 10u);
+	ASSERT_EQ(server.batches.size(), 3u);
+	EXPECT_EQ(server.batches[0], 4u);
+	EXPECT_EQ(server.batches[1], 4u);
+	EXPECT_EQ(server.batches[2], 2u);
+
+	for (const auto &s : server.accepted)
+		EXPECT_TRUE(IsNoDelay(s));
+}
+
+TEST(ServerSocket, AcceptBatchUnclaimed)
+{
+	EventLoop event_loop;
+	TestServerSocket server(event_loop);
+	server.SetAcceptBatch(8);
+	server.claim_all = false;
+
+	std::vector<UniqueSocketDescriptor> clients;
+	for (unsigned i = 0; i < 6; ++i)
+		clients.emplace_back(server.Connect());
+
+	for (unsigned i = 0; i < 10 && server.batches.empty(); ++i)
+		event_loop.LoopOnceNonBlock();
+
+	ASSERT_EQ(server.batches.size(), 1u);
+	EXPECT_EQ(server.batches[0], 6u);
+	ASSERT_EQ(server.accepted.size(), 3u);
+
+	/* the sockets which were not claimed have been closed */
+	unsigned n_closed = 0;
+	for (const auto &c : clients)
+		if (IsClosedByPeer(c))
+			++n_closed;
+
+	EXPECT_EQ(n_closed, 3u);
+}
+
+TEST(ServerSocket, AcceptOne)
+{
+	EventLoop event_loop;
+	TestServerSocket server(event_loop);
+
+	std::vector<UniqueSocketDescriptor> clients;
+	for (unsigned i = 0; i < 3; ++i)
+		clients.emplace_back(server.Connect());
+
+	/* without SetAcceptBatch(), OnAccept() is called for one
+	   connection per wakeup */
+	event_loop.LoopOnceNonBlock();
+	EXPECT_EQ(server.accepted.size(), 1u);
+
+	for (unsigned i = 0; i < 10 && server.accepted.size() < 3; ++i)
+		event_loop.LoopOnceNonBlock();
+
+	ASSERT_EQ(server.accepted.size(), 3u);
+	for (const size_t n : server.batches)
+		EXPECT_EQ(n, 0u);
+
+	for (const auto &s : server.accepted)
+		EXPECT_TRUE(IsNoDelay(s));
+}
+
+TEST(ServerSocket, Exclusive)
+{
+	EventLoop event_loop;
+	TestServerSocket server(event_loop, true);
+	server.SetAcceptBatch(4);
+
+	std::vector<UniqueSocketDescriptor> clients;
+	for (unsigned i = 0; i < 10; ++i)
+		clients.emplace_back(server.Connect());
+
+	/* the private epoll instance stays readable while the
+	   backlog is not empty, so the batch limit still applies */
+	for (unsigned i = 0; i < 10 && server.accepted.size() < 10; ++i)
+		event_loop.LoopOnceNonBlock();
+
+	ASSERT_EQ(server.accepted.size(), 10u);
+	ASSERT_EQ(server.batches.size(), 3u);
+	EXPECT_EQ(server.batches[0], 4u);
+	EXPECT_EQ(server.batches[1], 4u);
+	EXPECT_EQ(server.batches[2], 2u);
+
+	/* no more wakeups after the backlog has been drained */
+	event_loop.LoopOnceNonBlock();
+	EXPECT_EQ(server.batches.size(), 3u);
+}
+
+/**
+ * Two #EventLoops share one listener with EPOLLEXCLUSIVE; each
+ * connection is accepted exactly once, and a wakeup which finds
+ * the backlog empty is harmless.
+ */
+TEST(ServerSocket, ExclusiveShared)
+{
+	EventLoop event_loop1, event_loop2;
+	TestServerSocket server1(event_loop1, true);
+	server1.SetAcceptBatch(2);
+
+	UniqueSocketDescriptor fd2(dup(server1.GetSocket().Get()));
+	ASSERT_TRUE(fd2.IsDefined());
+	TestServerSocket server2(event_loop2, std::move(fd2), true);
+	server2.SetAcceptBatch(2);
+
+	std::vector<UniqueSocketDescriptor> clients;
+	for (unsigned i = 0; i < 6; ++i)
+		clients.emplace_back(server1.Connect());
+
+	for (unsigned i = 0; i < 10 &&
+		     server1.accepted.size() + server2.accepted.size() < 6;
+	     ++i) {
+		event_loop1.LoopOnceNonBlock();
+		event_loop2.LoopOnceNonBlock();
+	}
+
+	EXPECT_EQ(server1.accepted.size() + server2.accepted.size(), 6u);
+	EXPECT_FALSE(server1.accepted.empty());
+	EXPECT_FALSE(server2.accepted.empty());
+
+	for (unsigned i = 0; i < 4; ++i) {
+		event_loop1.LoopOnceNonBlock();
+		event_loop2.LoopOnceNonBlock();
+	}
+
+	EXPECT_EQ(server1.accepted.size() + server2.accepted.size(), 6u);
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/net/SocketForwarder.hxx"
+#include "event/net/BufferedSocket.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+namespace {
+
+/**
+ * The regular owner of a #BufferedSocket, whose handler is replaced
+ * by the #SocketForwarder.  Received data stays in the input buffer.
+ */
+class Endpoint final : public BufferedSocketHandler {
+	BufferedSocket socket;
+
+public:
+	std::exception_ptr error;
+
+	Endpoint(EventLoop &event_loop, UniqueSocketDescriptor &&fd)
+		:socket(event_loop)
+	{
+		socket.Init(fd.Release(), FdType::FD_SOCKET,
+			    nullptr, nullptr, *this);
+	}
+
+	~Endpoint() noexcept {
+		if (socket.IsConnected())
+			socket.Close();
+		socket.Destroy();
+	}
+
+	BufferedSocket &GetSocket() noexcept {
+		return socket;
+	}
+
+private:
+	/* virtual methods from class BufferedSocketHandler */
+	BufferedResult OnBufferedData() override {
+		return BufferedResult::BLOCKING;
+	}
+
+	bool OnBufferedClosed() noexcept override {
+		socket.Close();
+		return false;
+	}
+
+	bool OnBufferedWrite() override {
+		socket.UnscheduleWrite();
+		return true;
+	}
+
+	void OnBufferedError(std::exception_ptr e) noexcept override {
+		error = e;
+		socket.Close();
+	}
+};
+
+struct ForwardHandler final : SocketForwarderHandler {
+	bool ended = false;
+	std::exception_ptr error;
+
+	/* virtual methods from class SocketForwarderHandler */
+	void OnForwardEnd() noexcept override {
+		ended = true;
+	}
+
+	void OnForwardError(std::exception_ptr e) noexcept override {
+		error = e;
+	}
+};
+
+}
+
+static void
+RunLoop(EventLoop &event_loop, unsigned n=8)
+{
+	for (unsigned i = 0; i < n; ++i)
+		event_loop.LoopOnceNonBlock();
+}
+
+static std::string
+ReceiveAll(SocketDescriptor fd)
+{
+	std::string result;
+	char buffer[65536];
+	ssize_t nbytes;
+	while ((nbytes = recv(fd.Get(), buffer, sizeof(buffer),
+			      MSG_DONTWAIT)) > 0)
+		result.append(buffer, nbytes);
+	return result;
+}
+
+static void
+CreateSocketPair(UniqueSocketDescriptor &a, UniqueSocketDescriptor &b)
+{
+	if (!UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+							       SOCK_STREAM, 0,
+							       a, b))
+		throw MakeErrno("socketpair() failed");
+}
+
+static ino_t
+GetInode(const UniqueFileDescriptor &fd)
+{
+	struct stat st;
+	EXPECT_EQ(fstat(fd.Get(), &st), 0);
+	return st.st_ino;
+}
+
+/**
+ * Forward more data than fits into the pipe and the socket buffers,
+ * with data already waiting in the source's input buffer.
+ */
+TEST(SocketForwarder, RoundTrip)
+{
+	EventLoop event_loop;
+	UniqueSocketDescriptor client, src_fd, dest_fd, sink;
+	CreateSocketPair(client, src_fd);
+	CreateSocketPair(dest_fd, sink);
+
+	Endpoint src(event_loop, std::move(src_fd));
+	Endpoint dest(event_loop, std::move(dest_fd));
+
+	/* fill the source's input buffer before forwarding starts */
+	ASSERT_EQ(send(client.Get(), "hello", 5, MSG_DONTWAIT), 5);
+	src.GetSocket().Read(false);
+	ASSERT_EQ(src.GetSocket().GetAvailable(), 5u);
+
+	PipePool pipe_pool;
+	ForwardHandler handler;
+	SocketForwarder forwarder(src.GetSocket(), dest.GetSocket(),
+				  pipe_pool, handler);
+	forwarder.Start();
+
+	std::string data;
+	for (size_t i = 0; i < 1024 * 1024; ++i)
+		data.push_back('a' + i % 26);
+
+	std::string received;
+	size_t sent = 0;
+	for (unsigned i = 0; i < 10000 && received.size() < data.size() + 5; ++i) {
+		if (sent < data.size()) {
+			auto nbytes = send(client.Get(), data.data() + sent,
+					   data.size() - sent, MSG_DONTWAIT);
+			if (nbytes > 0)
+				sent += nbytes;
+		}
+
+		RunLoop(event_loop, 1);
+		received += ReceiveAll(sink);
+	}
+
+	ASSERT_FALSE(handler.error);
+	ASSERT_FALSE(handler.ended);
+	ASSERT_EQ(received.size(), data.size() + 5);
+	EXPECT_EQ(received, "hello" + data);
+	EXPECT_EQ(forwarder.GetForwarded(), data.size() + 5);
+
+	/* end of the source finishes forwarding; the destination stays
+	   connected */
+	client.ShutdownWrite();
+	RunLoop(event_loop);
+
+	ASSERT_FALSE(handler.error);
+	EXPECT_TRUE(handler.ended);
+	EXPECT_FALSE(src.GetSocket().IsConnected());
+	EXPECT_TRUE(dest.GetSocket().IsConnected());
+	EXPECT_FALSE(src.error);
+	EXPECT_FALSE(dest.error);
+}
+
+/**
+ * The pipe is returned to the #PipePool after a successful
+ * transfer, and the next transfer reuses it.
+ */
+TEST(SocketForwarder, PoolReuse)
+{
+	EventLoop event_loop;
+	PipePool pipe_pool;
+
+	ino_t inode;
+
+	{
+		auto pipe = pipe_pool.Get();
+		inode = GetInode(pipe.r);
+		pipe_pool.Put(std::move(pipe));
+	}
+
+	for (unsigned i = 0; i < 2; ++i) {
+		UniqueSocketDescriptor client, src_fd, dest_fd, sink;
+		CreateSocketPair(client, src_fd);
+		CreateSocketPair(dest_fd, sink);
+
+		Endpoint src(event_loop, std::move(src_fd));
+		Endpoint dest(event_loop, std::move(dest_fd));
+
+		ForwardHandler handler;
+		SocketForwarder forwarder(src.GetSocket(), dest.GetSocket(),
+					  pipe_pool, handler);
+		forwarder.Start();
+
+		ASSERT_EQ(send(client.Get(), "foo", 3, MSG_DONTWAIT), 3);
+		client.ShutdownWrite();
+		RunLoop(event_loop);
+
+		ASSERT_FALSE(handler.error);
+		ASSERT_TRUE(handler.ended);
+		EXPECT_EQ(ReceiveAll(sink), "foo");
+	}
+
+	auto pipe = pipe_pool.Get();
+	EXPECT_EQ(GetInode(pipe.r), inode);
+}
+
+/**
+ * A failing destination is reported to the handler, and the pipe
+ * (which may still contain data) is not returned to the pool.
+ */
+TEST(SocketForwarder, DestinationError)
+{
+	/* splice() cannot suppress SIGPIPE like MSG_NOSIGNAL does;
+	   the daemons ignore it, and so must we */
+	signal(SIGPIPE, SIG_IGN);
+
+	EventLoop event_loop;
+	UniqueSocketDescriptor client, src_fd, dest_fd, sink;
+	CreateSocketPair(client, src_fd);
+	CreateSocketPair(dest_fd, sink);
+
+	Endpoint src(event_loop, std::move(src_fd));
+	Endpoint dest(event_loop, std::move(dest_fd));
+
+	PipePool pipe_pool;
+	ino_t inode;
+
+	{
+		auto pipe = pipe_pool.Get();
+		inode = GetInode(pipe.r);
+		pipe_pool.Put(std::move(pipe));
+	}
+
+	ForwardHandler handler;
+
+	{
+		SocketForwarder forwarder(src.GetSocket(), dest.GetSocket(),
+					  pipe_pool, handler);
+		forwarder.Start();
+
+		sink.Close();
+		ASSERT_EQ(send(client.Get(), "foo", 3, MSG_DONTWAIT), 3);
+		RunLoop(event_loop);
+
+		EXPECT_TRUE(handler.error);
+		EXPECT_FALSE(handler.ended);
+	}
+
+	auto pipe = pipe_pool.Get();
+	EXPECT_NE(GetInode(pipe.r), inode);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/SocketTuning.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static int
+GetIntOption(SocketDescriptor fd, int level, int name)
+{
+	int value = -1;
+	socklen_t size = sizeof(value);
+	EXPECT_EQ(getsockopt(fd.Get(), level, name, &value, &size), 0);
+	return value;
+}
+
+TEST(SocketTuning, FindProfile)
+{
+	EXPECT_FALSE(SocketTuning::FindProfile("default").tcp_no_delay);
+	EXPECT_TRUE(SocketTuning::FindProfile("latency").tcp_no_delay);
+	EXPECT_TRUE(SocketTuning::FindProfile("throughput").zerocopy);
+	EXPECT_THROW(SocketTuning::FindProfile("foo"), std::runtime_error);
+}
+
+TEST(SocketTuning, Apply)
+{
+	UniqueSocketDescriptor fd;
+	ASSERT_TRUE(fd.CreateNonBlock(AF_INET, SOCK_STREAM, 0));
+
+	SocketTuning tuning;
+	tuning.tcp_no_delay = true;
+	tuning.tcp_notsent_lowat = 8192;
+	tuning.receive_buffer = 65536;
+	tuning.ApplyConnect(fd, true);
+
+	EXPECT_NE(GetIntOption(fd, IPPROTO_TCP, TCP_NODELAY), 0);
+	EXPECT_EQ(GetIntOption(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT), 8192);
+
+	/* the kernel doubles the value for bookkeeping overhead */
+	EXPECT_GE(GetIntOption(fd, SOL_SOCKET, SO_RCVBUF), 65536);
+}
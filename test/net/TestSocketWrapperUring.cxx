@@ -0,0 +1,411 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/net/SocketWrapper.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/ForeignFifoBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <forward_list>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * A #SocketHandler which reads everything into a string and which
+ * optionally transfers data from a pipe with WriteFrom().
+ */
+class UringHandler final : public SocketHandler {
+public:
+	SocketWrapper socket;
+
+	std::string received;
+
+	/**
+	 * If defined, OnSocketWrite() transfers data from this pipe
+	 * with WriteFrom().
+	 */
+	FileDescriptor pipe = FileDescriptor::Undefined();
+
+	size_t spliced = 0;
+
+	unsigned n_read = 0, n_write = 0;
+
+	explicit UringHandler(EventLoop &event_loop) noexcept
+		:socket(event_loop, *this) {}
+
+	~UringHandler() noexcept {
+		if (socket.IsValid())
+			socket.Close();
+	}
+
+	void Write(const std::string &data) noexcept {
+		ASSERT_EQ(socket.Write(data.data(), data.size()),
+			  ssize_t(data.size()));
+	}
+
+private:
+	/* virtual methods from class SocketHandler */
+	bool OnSocketRead() noexcept override {
+		++n_read;
+
+		char buffer[4096];
+		ForeignFifoBuffer<uint8_t> fifo((uint8_t *)buffer,
+						sizeof(buffer));
+		ssize_t nbytes;
+		while ((nbytes = socket.ReadToBuffer(fifo)) > 0) {
+			auto r = fifo.Read();
+			received.append((const char *)r.data, r.size);
+			fifo.Consume(r.size);
+		}
+
+		if (nbytes == 0)
+			socket.UnscheduleRead();
+		return true;
+	}
+
+	bool OnSocketWrite() noexcept override {
+		++n_write;
+
+		ssize_t nbytes = socket.WriteFrom(pipe.Get(), FdType::FD_PIPE,
+						  65536);
+		if (nbytes > 0) {
+			spliced += nbytes;
+			socket.UnscheduleWrite();
+		}
+
+		return true;
+	}
+
+	bool OnSocketTimeout() noexcept override {
+		return true;
+	}
+};
+
+/**
+ * Run the #EventLoop until the given predicate becomes true (or
+ * until a generous timeout expires).  Completions arrive
+ * asynchronously, so the loop needs to be polled a few times.
+ */
+template<typename P>
+static bool
+RunUntil(EventLoop &event_loop, P &&p)
+{
+	for (unsigned i = 0; i < 2000; ++i) {
+		event_loop.LoopOnceNonBlock();
+		if (p())
+			return true;
+
+		usleep(1000);
+	}
+
+	return false;
+}
+
+static void
+RunLoop(EventLoop &event_loop, unsigned n=20)
+{
+	for (unsigned i = 0; i < n; ++i) {
+		event_loop.LoopOnceNonBlock();
+		usleep(1000);
+	}
+}
+
+/**
+ * Receive everything which is available right now.
+ *
+ * @param eof_r is set to true if the peer has closed the socket
+ */
+static std::string
+ReceiveAll(SocketDescriptor fd, bool &eof_r)
+{
+	std::string result;
+	char buffer[65536];
+	ssize_t nbytes;
+	while ((nbytes = recv(fd.Get(), buffer, sizeof(buffer),
+			      MSG_DONTWAIT)) > 0)
+		result.append(buffer, nbytes);
+	eof_r = nbytes == 0;
+	return result;
+}
+
+/**
+ * Receive until the given number of bytes or end of file.
+ */
+static std::string
+ReceiveAll(EventLoop &event_loop, SocketDescriptor fd, size_t size,
+	   bool &eof_r)
+{
+	std::string result;
+	eof_r = false;
+	RunUntil(event_loop, [&](){
+		bool eof;
+		result += ReceiveAll(fd, eof);
+		eof_r = eof_r || eof;
+		return eof_r || result.size() >= size;
+	});
+	return result;
+}
+
+static void
+CreateSocketPair(UniqueSocketDescriptor &a, UniqueSocketDescriptor &b)
+{
+	if (!UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+							       SOCK_STREAM, 0,
+							       a, b))
+		throw MakeErrno("socketpair() failed");
+}
+
+class SocketWrapperUring : public ::testing::Test {
+protected:
+	EventLoop event_loop;
+
+	void SetUp() override {
+		if (!event_loop.EnableUring())
+			GTEST_SKIP() << "io_uring not available";
+	}
+};
+
+TEST_F(SocketWrapperUring, RoundTrip)
+{
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	UringHandler handler(event_loop);
+	handler.socket.Init(a.Release(), FdType::FD_SOCKET);
+	ASSERT_TRUE(handler.socket.EnableUring());
+	ASSERT_TRUE(handler.socket.IsUring());
+
+	handler.socket.ScheduleRead(nullptr);
+	ASSERT_EQ(send(b.Get(), "hello", 5, 0), 5);
+	ASSERT_TRUE(RunUntil(event_loop, [&](){
+		return handler.received == "hello";
+	}));
+
+	handler.Write("world");
+
+	bool eof;
+	ASSERT_EQ(ReceiveAll(event_loop, b, 5, eof), "world");
+	ASSERT_FALSE(eof);
+
+	/* end of file is reported to the handler */
+	b.Close();
+	ASSERT_TRUE(RunUntil(event_loop, [&](){
+		return !handler.socket.IsReadPending();
+	}));
+	ASSERT_EQ(handler.received, "hello");
+}
+
+/**
+ * Close() while the send entry has not even been submitted: the
+ * #UringIO takes over the socket and closes it after the data has
+ * been sent.
+ */
+TEST_F(SocketWrapperUring, CloseStaged)
+{
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	UringHandler handler(event_loop);
+	handler.socket.Init(a.Release(), FdType::FD_SOCKET);
+	ASSERT_TRUE(handler.socket.EnableUring());
+
+	const std::string data(60000, 'x');
+	handler.Write(data);
+	handler.socket.Close();
+
+	bool eof;
+	ASSERT_EQ(ReceiveAll(event_loop, b, data.size(), eof), data);
+
+	/* the socket gets closed after the last completion */
+	if (!eof) {
+		ASSERT_EQ(ReceiveAll(event_loop, b, 1, eof), "");
+	}
+	ASSERT_TRUE(eof);
+}
+
+/**
+ * Close() with a recv entry which is in flight: it gets canceled
+ * and the socket is closed.
+ */
+TEST_F(SocketWrapperUring, CloseRecvInFlight)
+{
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	UringHandler handler(event_loop);
+	handler.socket.Init(a.Release(), FdType::FD_SOCKET);
+	ASSERT_TRUE(handler.socket.EnableUring());
+
+	handler.socket.ScheduleRead(nullptr);
+	RunLoop(event_loop);
+	handler.socket.Close();
+
+	bool eof;
+	ASSERT_EQ(ReceiveAll(event_loop, b, 1, eof), "");
+	ASSERT_TRUE(eof);
+	ASSERT_EQ(handler.n_read, 0u);
+}
+
+/**
+ * Abandon() with staged data: the caller keeps the socket and may
+ * close it (and reuse the descriptor number) right away; the
+ * pending entries use a duplicate.
+ */
+TEST_F(SocketWrapperUring, AbandonStaged)
+{
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	UringHandler handler(event_loop);
+	handler.socket.Init(a, FdType::FD_SOCKET);
+	ASSERT_TRUE(handler.socket.EnableUring());
+	handler.socket.ScheduleRead(nullptr);
+
+	const std::string data(60000, 'x');
+	handler.Write(data);
+	handler.socket.Abandon();
+	ASSERT_FALSE(handler.socket.IsValid());
+
+	/* reuse the descriptor number for something else before
+	   the entries get submitted */
+	const int number = a.Get();
+	a.Close();
+	UniqueSocketDescriptor c, d;
+	CreateSocketPair(c, d);
+	ASSERT_TRUE(c.Get() == number || d.Get() == number);
+
+	bool eof;
+	ASSERT_EQ(ReceiveAll(event_loop, b, data.size(), eof), data);
+
+	/* the duplicate is closed after the last completion */
+	if (!eof) {
+		ASSERT_EQ(ReceiveAll(event_loop, b, 1, eof), "");
+	}
+	ASSERT_TRUE(eof);
+
+	ASSERT_EQ(ReceiveAll(c, eof), "");
+	ASSERT_EQ(ReceiveAll(d, eof), "");
+	ASSERT_EQ(handler.n_read, 0u);
+}
+
+/**
+ * Abandon() when the socket cannot be duplicated: the pending
+ * entries must not touch the caller's socket anymore.
+ */
+TEST_F(SocketWrapperUring, AbandonDupFailure)
+{
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	UringHandler handler(event_loop);
+	handler.socket.Init(a, FdType::FD_SOCKET);
+	ASSERT_TRUE(handler.socket.EnableUring());
+
+	handler.Write("staged");
+
+	/* exhaust all file descriptors */
+	struct rlimit old_limit;
+	ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &old_limit), 0);
+
+	struct rlimit limit = old_limit;
+	limit.rlim_cur = std::max(a.Get(), b.Get()) + 16;
+	ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &limit), 0);
+
+	std::forward_list<UniqueFileDescriptor> fill;
+	while (true) {
+		int fd = fcntl(a.Get(), F_DUPFD_CLOEXEC, 0);
+		if (fd < 0)
+			break;
+		fill.emplace_front(FileDescriptor(fd));
+	}
+
+	handler.socket.Abandon();
+
+	fill.clear();
+	ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &old_limit), 0);
+
+	/* the caller still owns the socket exclusively */
+	ASSERT_EQ(send(a.Get(), "mine", 4, 0), 4);
+	RunLoop(event_loop);
+
+	bool eof;
+	ASSERT_EQ(ReceiveAll(b, eof), "mine");
+	ASSERT_FALSE(eof);
+
+	a.Close();
+	ASSERT_EQ(ReceiveAll(event_loop, b, 1, eof), "");
+	ASSERT_TRUE(eof);
+}
+
+/**
+ * WriteFrom() must wait until the staged data has been sent,
+ * without invoking the handler again and again meanwhile.
+ */
+TEST_F(SocketWrapperUring, WriteFromBlocked)
+{
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipeNonBlock(r, w));
+	ASSERT_EQ(w.Write("spliced", 7), 7);
+
+	UringHandler handler(event_loop);
+	handler.socket.Init(a.Release(), FdType::FD_SOCKET);
+	ASSERT_TRUE(handler.socket.EnableUring());
+	handler.pipe = r.ToFileDescriptor();
+
+	const std::string data(60000, 'x');
+	handler.Write(data);
+	handler.socket.ScheduleWrite(nullptr);
+
+	bool eof;
+	std::string received = ReceiveAll(event_loop, b,
+					  data.size() + 7, eof);
+	ASSERT_FALSE(eof);
+	ASSERT_EQ(received, data + "spliced");
+	ASSERT_EQ(handler.spliced, 7u);
+
+	/* once before the staged data has been sent, once after
+	   that */
+	ASSERT_LE(handler.n_write, 3u);
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/log/TrafficAggregator.hxx"
+#include "net/log/Datagram.hxx"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace Net::Log;
+
+namespace {
+
+struct Snapshot {
+	uint64_t window_start;
+	std::map<std::string, TrafficAggregator::Traffic> sites;
+};
+
+class Collector {
+public:
+	std::vector<Snapshot> snapshots;
+
+	TrafficAggregator aggregator;
+
+	Collector(uint64_t window_size, unsigned max_idle=60)
+		:aggregator(window_size, BIND_THIS_METHOD(OnSnapshot),
+			    max_idle) {}
+
+private:
+	void OnSnapshot(uint64_t window_start,
+			ConstBuffer<TrafficAggregator::Site> sites) noexcept {
+		Snapshot s;
+		s.window_start = window_start;
+		for (const auto &i : sites)
+			s.sites.emplace(std::string(i.name.data, i.name.size),
+					i.traffic);
+		snapshots.emplace_back(std::move(s));
+	}
+};
+
+}
+
+static Datagram
+MakeDatagram(const char *site, uint64_t timestamp,
+	     uint64_t received, uint64_t sent)
+{
+	Datagram d;
+	d.site = site;
+	d.valid_timestamp = true;
+	d.timestamp = timestamp;
+	d.valid_traffic = true;
+	d.traffic_received = received;
+	d.traffic_sent = sent;
+	return d;
+}
+
+TEST(TrafficAggregator, Windows)
+{
+	Collector c(1000);
+
+	c.aggregator.Add(MakeDatagram("a", 1500, 1, 2));
+	c.aggregator.Add(MakeDatagram("b", 1600, 10, 20));
+	c.aggregator.Add(MakeDatagram("a", 1999, 3, 4));
+	EXPECT_TRUE(c.snapshots.empty());
+
+	/* a late record is accounted to the current window */
+	c.aggregator.Add(MakeDatagram("a", 500, 100, 100));
+
+	/* next window */
+	c.aggregator.Add(MakeDatagram("b", 2000, 5, 5));
+	ASSERT_EQ(c.snapshots.size(), 1u);
+	EXPECT_EQ(c.snapshots[0].window_start, 1000u);
+	ASSERT_EQ(c.snapshots[0].sites.size(), 2u);
+
+	const auto &a = c.snapshots[0].sites["a"];
+	EXPECT_EQ(a.n_records, 3u);
+	EXPECT_EQ(a.received, 104u);
+	EXPECT_EQ(a.sent, 106u);
+
+	const auto &b = c.snapshots[0].sites["b"];
+	EXPECT_EQ(b.n_records, 1u);
+	EXPECT_EQ(b.received, 10u);
+
+	/* skip some empty windows */
+	c.aggregator.Advance(5500);
+	ASSERT_EQ(c.snapshots.size(), 2u);
+	EXPECT_EQ(c.snapshots[1].window_start, 2000u);
+	EXPECT_EQ(c.snapshots[1].sites.size(), 1u);
+	EXPECT_EQ(c.snapshots[1].sites["b"].received, 5u);
+
+	/* no traffic: no callback */
+	c.aggregator.Advance(6500);
+	EXPECT_EQ(c.snapshots.size(), 2u);
+
+	c.aggregator.Add(MakeDatagram("c", 6600, 7, 7));
+	c.aggregator.Flush();
+	ASSERT_EQ(c.snapshots.size(), 3u);
+	EXPECT_EQ(c.snapshots[2].window_start, 6000u);
+	EXPECT_EQ(c.snapshots[2].sites.size(), 1u);
+}
+
+TEST(TrafficAggregator, Expire)
+{
+	Collector c(1000, 2);
+
+	c.aggregator.Add(MakeDatagram("a", 1000, 1, 1));
+	c.aggregator.Add(MakeDatagram("b", 1000, 1, 1));
+	EXPECT_EQ(c.aggregator.GetSiteCount(), 2u);
+
+	for (uint64_t t = 2000; t < 10000; t += 1000)
+		c.aggregator.Add(MakeDatagram("a", t, 1, 1));
+
+	EXPECT_EQ(c.aggregator.GetSiteCount(), 1u);
+	EXPECT_EQ(c.snapshots.size(), 8u);
+	for (const auto &s : c.snapshots)
+		EXPECT_EQ(s.sites.at("a").n_records, 1u);
+
+	/* "b" comes back */
+	c.aggregator.Add(MakeDatagram("b", 10000, 1, 1));
+	EXPECT_EQ(c.aggregator.GetSiteCount(), 2u);
+}
+
+TEST(TrafficAggregator, Many)
+{
+	Collector c(1000000);
+
+	std::vector<std::string> names;
+	for (unsigned i = 0; i < 1000; ++i)
+		names.emplace_back("site" + std::to_string(i));
+
+	for (unsigned round = 0; round < 10; ++round)
+		for (const auto &name : names)
+			c.aggregator.Add(MakeDatagram(name.c_str(), 1, 1, 2));
+
+	c.aggregator.Flush();
+	ASSERT_EQ(c.snapshots.size(), 1u);
+	ASSERT_EQ(c.snapshots[0].sites.size(), 1000u);
+	for (const auto &i : c.snapshots[0].sites) {
+		EXPECT_EQ(i.second.n_records, 10u);
+		EXPECT_EQ(i.second.sent, 20u);
+	}
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/ZeroCopy.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "io/MultiWriteBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static void
+Connect(UniqueSocketDescriptor &client, UniqueSocketDescriptor &server)
+{
+	UniqueSocketDescriptor listener;
+	ASSERT_TRUE(listener.Create(AF_INET, SOCK_STREAM, 0));
+	ASSERT_TRUE(listener.Bind(IPv4Address(127, 0, 0, 1, 0)));
+	ASSERT_TRUE(listener.Listen(1));
+
+	ASSERT_TRUE(client.Create(AF_INET, SOCK_STREAM, 0));
+	ASSERT_TRUE(client.Connect(listener.GetLocalAddress()));
+
+	server = UniqueSocketDescriptor(listener.Accept());
+	ASSERT_TRUE(server.IsDefined());
+}
+
+static size_t
+ReceiveAll(SocketDescriptor s, size_t size)
+{
+	size_t total = 0;
+	char buffer[65536];
+	while (total < size) {
+		ssize_t nbytes = recv(s.Get(), buffer, sizeof(buffer), 0);
+		if (nbytes <= 0)
+			break;
+		total += nbytes;
+	}
+
+	return total;
+}
+
+TEST(MultiWriteBufferTest, Send)
+{
+	UniqueSocketDescriptor client, server;
+	Connect(client, server);
+
+	MultiWriteBuffer b;
+	b.Push("foo", 3);
+	b.Push("bar", 3);
+	EXPECT_EQ(b.GetSize(), 6u);
+	EXPECT_EQ(b.Send(client.Get()), MultiWriteBuffer::Result::FINISHED);
+	EXPECT_TRUE(b.IsEmpty());
+
+	char buffer[16];
+	ASSERT_EQ(recv(server.Get(), buffer, sizeof(buffer), 0), 6);
+	EXPECT_EQ(memcmp(buffer, "foobar", 6), 0);
+}
+
+TEST(ZeroCopyTest, Send)
+{
+	UniqueSocketDescriptor client, server;
+	Connect(client, server);
+
+	if (!ZeroCopyTracker::Enable(client))
+		GTEST_SKIP();
+
+	static char data[256 * 1024];
+	memset(data, 'z', sizeof(data));
+
+	ZeroCopyTracker tracker;
+	EXPECT_FALSE(tracker.HasPending());
+
+	MultiWriteBuffer b;
+	b.Push(data, sizeof(data) / 2);
+	b.Push(data + sizeof(data) / 2, sizeof(data) / 2);
+
+	while (b.Send(client.Get(), &tracker) != MultiWriteBuffer::Result::FINISHED) {
+		struct pollfd pfd{client.Get(), POLLOUT, 0};
+		poll(&pfd, 1, 1000);
+		tracker.ReadCompletions(client);
+	}
+
+	const uint32_t sequence = tracker.GetSequence();
+	EXPECT_GT(sequence, 0u);
+
+	EXPECT_EQ(ReceiveAll(server, sizeof(data)), sizeof(data));
+
+	/* wait for the completion notifications */
+	for (unsigned i = 0; i < 100 && !tracker.IsComplete(sequence); ++i) {
+		struct pollfd pfd{client.Get(), 0, 0};
+		poll(&pfd, 1, 100);
+		tracker.ReadCompletions(client);
+	}
+
+	EXPECT_TRUE(tracker.IsComplete(sequence));
+	EXPECT_FALSE(tracker.HasPending());
+
+	/* the loopback device has to copy the data */
+	EXPECT_TRUE(tracker.WasCopied());
+}
@@ -0,0 +1,558 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput and latency of the PostgreSQL client modes against a
+ * live server: synchronous #Pg::Connection, #Pg::AsyncConnection
+ * with and without pipeline mode, #Pg::AsyncConnectionPool and
+ * "COPY FROM STDIN".  Each mode can use prepared statements and
+ * text or binary results; decoding of all result rows is part of
+ * the measured time.
+ *
+ * Example:
+ *
+ *   BenchPgClient --rows=100 --binary pipeline "dbname=test"
+ */
+
+#include "pg/AsyncConnectionPool.hxx"
+#include "pg/AsyncConnection.hxx"
+#include "pg/CheckError.hxx"
+#include "pg/CopyEncoder.hxx"
+#include "pg/Statement.hxx"
+#include "event/Loop.hxx"
+#include "event/TimerEvent.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/PrintException.hxx"
+#include "util/StringCompare.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct Usage {};
+
+enum class Mode {
+	SYNC,
+	ASYNC,
+	PIPELINE,
+	POOL,
+	COPY,
+};
+
+struct Options {
+	Mode mode;
+
+	const char *conninfo;
+
+	unsigned queries = 10000;
+
+	/**
+	 * The number of rows returned by each query (or submitted
+	 * by each COPY).
+	 */
+	unsigned rows = 1;
+
+	/**
+	 * The number of queries in flight (pipeline and pool mode).
+	 */
+	unsigned depth = 16;
+
+	/**
+	 * The number of pool connections.
+	 */
+	unsigned connections = 4;
+
+	bool binary = false, prepared = false;
+
+	/**
+	 * The "rows" parameter for #query_sql.
+	 */
+	std::string rows_param;
+};
+
+static constexpr char query_sql[] =
+	"SELECT i, i::int8 * 1000, md5(i::text) "
+	"FROM generate_series(1, $1::int4) i";
+
+static const Pg::Statement query_statement("bench_select", query_sql);
+
+struct Stats {
+	/**
+	 * The durations of all finished queries.
+	 */
+	std::vector<Clock::duration> latencies;
+
+	uint64_t rows = 0;
+
+	/**
+	 * A sum of all decoded values, to keep the compiler from
+	 * optimizing the decoder away.
+	 */
+	uint64_t checksum = 0;
+
+	explicit Stats(unsigned queries) {
+		latencies.reserve(queries);
+	}
+
+	void Decode(const Pg::Result &result);
+};
+
+void
+Stats::Decode(const Pg::Result &result)
+{
+	if (result.IsColumnBinary(0)) {
+		for (const auto &row : result.DecodeRows<int32_t, int64_t, Pg::BinaryValue>()) {
+			checksum += std::get<0>(row) + std::get<1>(row) +
+				std::get<2>(row).size;
+			++rows;
+		}
+	} else {
+		for (const auto &row : result) {
+			checksum += strtoul(row.GetValue(0), nullptr, 10) +
+				strtoull(row.GetValue(1), nullptr, 10) +
+				row.GetValueLength(2);
+			++rows;
+		}
+	}
+}
+
+static void
+RunSync(const Options &options, Stats &stats)
+{
+	Pg::Connection c(options.conninfo);
+
+	for (unsigned i = 0; i < options.queries; ++i) {
+		const auto start = Clock::now();
+
+		const auto result = Pg::CheckError(options.prepared
+						   ? c.ExecutePrepared(options.binary,
+								       query_statement,
+								       options.rows_param.c_str())
+						   : c.ExecuteParams(options.binary,
+								     query_sql,
+								     options.rows_param.c_str()));
+		stats.Decode(result);
+
+		stats.latencies.push_back(Clock::now() - start);
+	}
+}
+
+static void
+RunCopy(const Options &options, Stats &stats)
+{
+	Pg::Connection c(options.conninfo);
+	c.ExecuteOrThrow("CREATE TEMPORARY TABLE bench_copy "
+			 "(a int4, b int8, c text)");
+
+	const char *const sql = options.binary
+		? "COPY bench_copy FROM STDIN WITH (FORMAT binary)"
+		: "COPY bench_copy FROM STDIN";
+
+	for (unsigned i = 0; i < options.queries; ++i) {
+		const auto start = Clock::now();
+
+		Pg::CopyEncoder encoder(options.binary);
+		for (unsigned j = 0; j < options.rows; ++j) {
+			encoder.BeginRow(3);
+			encoder.AppendInt32(j);
+			encoder.AppendInt64(int64_t(j) * 1000);
+			encoder.Append("d41d8cd98f00b204e9800998ecf8427e");
+			encoder.EndRow();
+		}
+
+		encoder.Finish();
+
+		c.BeginCopyIn(sql);
+		c.PutCopyData(encoder);
+		stats.rows += c.EndCopyIn();
+
+		stats.latencies.push_back(Clock::now() - start);
+	}
+}
+
+/**
+ * One #Pg::AsyncConnection which keeps up to #Options::depth
+ * queries in flight (only one without pipeline mode).
+ */
+class AsyncBench final : Pg::AsyncConnectionHandler, Pg::AsyncResultHandler {
+	EventLoop &event_loop;
+
+	const Options &options;
+
+	Stats &stats;
+
+	Pg::AsyncConnection connection;
+
+	/**
+	 * The start times of all queries in flight, oldest first.
+	 */
+	std::deque<Clock::time_point> in_flight;
+
+	unsigned sent = 0;
+
+	std::exception_ptr error;
+
+public:
+	AsyncBench(EventLoop &_event_loop, const Options &_options,
+		   Stats &_stats, bool pipeline) noexcept
+		:event_loop(_event_loop), options(_options), stats(_stats),
+		 connection(event_loop, options.conninfo, "", *this)
+	{
+#ifdef LIBPQ_HAS_PIPELINING
+		if (pipeline)
+			connection.EnablePipelineMode();
+#else
+		if (pipeline)
+			error = std::make_exception_ptr(std::runtime_error("libpq does not support pipeline mode"));
+#endif
+	}
+
+	/**
+	 * Throws on error.
+	 */
+	void Run() {
+		if (error)
+			std::rethrow_exception(error);
+
+		connection.Connect();
+		event_loop.Dispatch();
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+private:
+	void Fail(std::exception_ptr e) noexcept {
+		if (!error)
+			error = e;
+		event_loop.Break();
+	}
+
+	/**
+	 * Send queries until the window is full.
+	 */
+	void Fill() {
+		while (sent < options.queries &&
+		       in_flight.size() < options.depth &&
+		       connection.CanSendQuery()) {
+			in_flight.push_back(Clock::now());
+			++sent;
+
+			if (options.prepared)
+				connection.SendPrepared(*this, query_statement,
+							options.rows_param.c_str());
+			else
+				connection.SendQuery(*this, options.binary,
+						     query_sql,
+						     options.rows_param.c_str());
+		}
+	}
+
+	/* virtual methods from class Pg::AsyncConnectionHandler */
+	void OnConnect() override {
+		Fill();
+	}
+
+	void OnDisconnect() noexcept override {}
+	void OnNotify(const char *) override {}
+
+	void OnError(std::exception_ptr e) noexcept override {
+		Fail(e);
+	}
+
+	/* virtual methods from class Pg::AsyncResultHandler */
+	void OnResult(Pg::Result &&result) override {
+		stats.Decode(Pg::CheckError(std::move(result)));
+	}
+
+	void OnResultEnd() override {
+		stats.latencies.push_back(Clock::now() - in_flight.front());
+		in_flight.pop_front();
+
+		if (stats.latencies.size() == options.queries)
+			event_loop.Break();
+		else
+			Fill();
+	}
+};
+
+class PoolBench final : Pg::AsyncConnectionPoolHandler {
+	class Query final : public Pg::AsyncPoolQuery {
+		PoolBench &bench;
+
+		Clock::time_point start;
+
+	public:
+		explicit Query(PoolBench &_bench) noexcept:bench(_bench) {}
+
+		void Submit() noexcept {
+			start = Clock::now();
+			bench.pool.Submit(*this);
+		}
+
+		/* virtual methods from class Pg::AsyncPoolQuery */
+		void SendQuery(Pg::AsyncConnection &connection) override {
+			const auto &options = bench.options;
+			if (options.prepared)
+				connection.SendPrepared(*this, query_statement,
+							options.rows_param.c_str());
+			else
+				connection.SendQuery(*this, options.binary,
+						     query_sql,
+						     options.rows_param.c_str());
+		}
+
+		/* virtual methods from class Pg::AsyncResultHandler */
+		void OnResult(Pg::Result &&result) override {
+			bench.stats.Decode(Pg::CheckError(std::move(result)));
+		}
+
+		void OnResultEnd() override {
+			bench.OnQueryFinished(*this, Clock::now() - start);
+		}
+	};
+
+	EventLoop &event_loop;
+
+	const Options &options;
+
+	Stats &stats;
+
+	Pg::AsyncConnectionPool pool;
+
+	/**
+	 * Polls the pool until all connections are ready, so
+	 * connection setup is not measured.
+	 */
+	TimerEvent ready_timer;
+
+	std::vector<std::unique_ptr<Query>> queries;
+
+	unsigned submitted = 0;
+
+	std::exception_ptr error;
+
+public:
+	PoolBench(EventLoop &_event_loop, const Options &_options,
+		  Stats &_stats) noexcept
+		:event_loop(_event_loop), options(_options), stats(_stats),
+		 pool(event_loop, options.conninfo, "",
+		      options.connections, options.connections, *this),
+		 ready_timer(event_loop, BIND_THIS_METHOD(OnReadyTimer)) {}
+
+	/**
+	 * Throws on error.
+	 */
+	void Run() {
+		pool.Start();
+		ScheduleReadyTimer();
+		event_loop.Dispatch();
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+private:
+	void ScheduleReadyTimer() noexcept {
+		static constexpr struct timeval interval{0, 10000};
+		ready_timer.Add(interval);
+	}
+
+	void OnReadyTimer() noexcept {
+		if (pool.GetReadyCount() < options.connections) {
+			ScheduleReadyTimer();
+			return;
+		}
+
+		for (unsigned i = 0; i < options.depth && i < options.queries; ++i) {
+			queries.emplace_back(new Query(*this));
+			queries.back()->Submit();
+			++submitted;
+		}
+	}
+
+	void OnQueryFinished(Query &query, Clock::duration duration) noexcept {
+		stats.latencies.push_back(duration);
+
+		if (stats.latencies.size() == options.queries)
+			event_loop.Break();
+		else if (submitted < options.queries) {
+			++submitted;
+			query.Submit();
+		}
+	}
+
+	/* virtual methods from class Pg::AsyncConnectionPoolHandler */
+	void OnError(std::exception_ptr e) noexcept override {
+		if (!error)
+			error = e;
+		event_loop.Break();
+	}
+};
+
+static double
+ToMicroseconds(Clock::duration d) noexcept
+{
+	return std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(d).count();
+}
+
+static Mode
+ParseMode(const char *s)
+{
+	if (StringIsEqual(s, "sync"))
+		return Mode::SYNC;
+	else if (StringIsEqual(s, "async"))
+		return Mode::ASYNC;
+	else if (StringIsEqual(s, "pipeline"))
+		return Mode::PIPELINE;
+	else if (StringIsEqual(s, "pool"))
+		return Mode::POOL;
+	else if (StringIsEqual(s, "copy"))
+		return Mode::COPY;
+	else
+		throw Usage();
+}
+
+int
+main(int argc, char **argv)
+try {
+	ConstBuffer<const char *> args(argv + 1, argc - 1);
+
+	Options options;
+
+	while (!args.empty() && *args.front() == '-') {
+		const char *arg = args.shift();
+		if (const char *q = StringAfterPrefix(arg, "--queries=")) {
+			options.queries = strtoul(q, nullptr, 10);
+		} else if (const char *r = StringAfterPrefix(arg, "--rows=")) {
+			options.rows = strtoul(r, nullptr, 10);
+		} else if (const char *d = StringAfterPrefix(arg, "--depth=")) {
+			options.depth = strtoul(d, nullptr, 10);
+		} else if (const char *c = StringAfterPrefix(arg, "--connections=")) {
+			options.connections = strtoul(c, nullptr, 10);
+		} else if (StringIsEqual(arg, "--binary")) {
+			options.binary = true;
+		} else if (StringIsEqual(arg, "--prepared")) {
+			options.prepared = true;
+		} else
+			throw Usage();
+	}
+
+	if (args.size != 2 || options.queries == 0 ||
+	    options.depth == 0 || options.connections == 0)
+		throw Usage();
+
+	options.mode = ParseMode(args[0]);
+	options.conninfo = args[1];
+	options.rows_param = std::to_string(options.rows);
+
+	if (options.mode == Mode::ASYNC)
+		/* without pipeline mode, only one query can be in
+		   flight */
+		options.depth = 1;
+
+	if (options.prepared && options.binary &&
+	    options.mode != Mode::SYNC)
+		/* AsyncConnection::SendPrepared() supports only text
+		   results */
+		throw std::runtime_error("--prepared --binary is only supported in sync mode");
+
+	Stats stats(options.queries);
+
+	const auto start_time = Clock::now();
+
+	switch (options.mode) {
+	case Mode::SYNC:
+		RunSync(options, stats);
+		break;
+
+	case Mode::ASYNC:
+	case Mode::PIPELINE:
+		{
+			EventLoop event_loop;
+			AsyncBench bench(event_loop, options, stats,
+					 options.mode == Mode::PIPELINE);
+			bench.Run();
+		}
+		break;
+
+	case Mode::POOL:
+		{
+			EventLoop event_loop;
+			PoolBench bench(event_loop, options, stats);
+			bench.Run();
+		}
+		break;
+
+	case Mode::COPY:
+		RunCopy(options, stats);
+		break;
+	}
+
+	const auto duration = Clock::now() - start_time;
+	const double seconds =
+		std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+
+	printf("%s: %u queries, %llu rows in %.3f s: %.0f queries/s, %.0f rows/s\n",
+	       args[0], options.queries, (unsigned long long)stats.rows,
+	       seconds, options.queries / seconds, stats.rows / seconds);
+
+	auto &latencies = stats.latencies;
+	std::sort(latencies.begin(), latencies.end());
+	const size_t n = latencies.size();
+	printf("latency: p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+	       ToMicroseconds(latencies[n / 2]),
+	       ToMicroseconds(latencies[n * 9 / 10]),
+	       ToMicroseconds(latencies[n * 99 / 100]),
+	       ToMicroseconds(latencies[n * 999 / 1000]),
+	       ToMicroseconds(latencies.back()));
+
+	if (options.mode != Mode::COPY)
+		printf("checksum: %llu\n", (unsigned long long)stats.checksum);
+
+	return EXIT_SUCCESS;
+} catch (Usage) {
+	fprintf(stderr, "Usage: BenchPgClient [--queries=#] [--rows=#]"
+		" [--depth=#] [--connections=#] [--binary] [--prepared]"
+		" sync|async|pipeline|pool|copy CONNINFO\n");
+	return EXIT_FAILURE;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../src/pg/BinaryDecoder.hxx"
+
+#include <gtest/gtest.h>
+
+template<size_t size>
+static Pg::BinaryValue
+MakeValue(const char (&data)[size])
+{
+	/* strip the null terminator of the string literal */
+	return {data, size - 1};
+}
+
+TEST(PgTest, DecodeBinaryInteger)
+{
+	ASSERT_EQ(Pg::DecodeInt16(MakeValue("\xff\xfe")), -2);
+	ASSERT_EQ(Pg::DecodeInt32(MakeValue("\x00\x01\x00\x02")), 0x10002);
+	ASSERT_EQ(Pg::DecodeInt64(MakeValue("\x80\x00\x00\x00\x00\x00\x00\x00")),
+		  INT64_MIN);
+	ASSERT_TRUE(Pg::DecodeBool(MakeValue("\x01")));
+	ASSERT_FALSE(Pg::DecodeBool(MakeValue("\x00")));
+	ASSERT_THROW(Pg::DecodeInt32(MakeValue("\x00\x01")),
+		     std::invalid_argument);
+}
+
+TEST(PgTest, DecodeBinaryFloat8)
+{
+	/* 1.5 */
+	ASSERT_EQ(Pg::DecodeFloat8(MakeValue("\x3f\xf8\x00\x00\x00\x00\x00\x00")),
+		  1.5);
+}
+
+TEST(PgTest, DecodeBinaryTimestamp)
+{
+	ASSERT_EQ(Pg::DecodeTimestamp(MakeValue("\x00\x00\x00\x00\x00\x00\x00\x00")),
+		  std::chrono::system_clock::from_time_t(946684800));
+	ASSERT_EQ(Pg::DecodeTimestamp(MakeValue("\x00\x00\x00\x00\x00\x0f\x42\x40")),
+		  std::chrono::system_clock::from_time_t(946684801));
+	ASSERT_EQ(Pg::DecodeTimestamp(MakeValue("\x7f\xff\xff\xff\xff\xff\xff\xff")),
+		  std::chrono::system_clock::time_point::max());
+}
+
+TEST(PgTest, DecodeBinaryInterval)
+{
+	/* 1 year 2 mons 3 days 00:00:04 */
+	ASSERT_EQ(Pg::DecodeInterval(MakeValue("\x00\x00\x00\x00\x00\x3d\x09\x00"
+					       "\x00\x00\x00\x03"
+					       "\x00\x00\x00\x0e")),
+		  std::chrono::hours(24 * (365 + 60 + 3) + 6) + std::chrono::seconds(4));
+}
+
+TEST(PgTest, DecodeBinaryArray)
+{
+	/* '{1,2,3}'::int4[] */
+	const auto a = Pg::BinaryTraits<std::vector<int32_t>>::Decode(MakeValue("\x00\x00\x00\x01"
+										"\x00\x00\x00\x00"
+										"\x00\x00\x00\x17"
+										"\x00\x00\x00\x03"
+										"\x00\x00\x00\x01"
+										"\x00\x00\x00\x04" "\x00\x00\x00\x01"
+										"\x00\x00\x00\x04" "\x00\x00\x00\x02"
+										"\x00\x00\x00\x04" "\x00\x00\x00\x03"));
+	ASSERT_EQ(a, (std::vector<int32_t>{1, 2, 3}));
+
+	/* '{}'::text[] */
+	const auto e = Pg::BinaryTraits<std::vector<std::string>>::Decode(MakeValue("\x00\x00\x00\x00"
+										    "\x00\x00\x00\x00"
+										    "\x00\x00\x00\x19"));
+	ASSERT_TRUE(e.empty());
+
+	/* wrong element type */
+	ASSERT_THROW(Pg::BinaryTraits<std::vector<int64_t>>::Decode(MakeValue("\x00\x00\x00\x01"
+									      "\x00\x00\x00\x00"
+									      "\x00\x00\x00\x17"
+									      "\x00\x00\x00\x00"
+									      "\x00\x00\x00\x01")),
+		     std::invalid_argument);
+}
@@ -83,3 +83,27 @@ TEST(PgTest, DecodeArray)
     check_decode("{foo,,bar}", three);
     check_decode("{foo,\"\\\"\\\\\"}", special);
 }
+
+TEST(PgTest, VisitArray)
+{
+    const char *input = "{foo,\"bar\",\"a\\\"b\"}";
+
+    std::string buffer;
+    std::list<std::string> values;
+    std::list<bool> in_input;
+    Pg::VisitArray(input, buffer, [&](StringView value){
+            values.emplace_back(value.data, value.size);
+            in_input.push_back(value.data >= input &&
+                               value.data < input + strlen(input));
+        });
+
+    ASSERT_EQ(values, (std::list<std::string>{"foo", "bar", "a\"b"}));
+
+    /* only the escaped element is copied to the buffer */
+    ASSERT_EQ(in_input, (std::list<bool>{true, true, false}));
+
+    ASSERT_THROW(Pg::VisitArray("{\"foo}", buffer, [](StringView){}),
+                 std::invalid_argument);
+    ASSERT_THROW(Pg::VisitArray("{foo}x", buffer, [](StringView){}),
+                 std::invalid_argument);
+}
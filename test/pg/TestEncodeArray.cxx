@@ -55,3 +55,13 @@ TEST(PgTest, EncodeArray)
     a.push_back("\"");
     ASSERT_STREQ(Pg::EncodeArray(a).c_str(), "{\"foo\",\"\",\"\\\\\",\"\\\"\"}");
 }
+
+TEST(PgTest, EncodeArrayBuffer)
+{
+    const std::list<std::string> a{"foo", "", "\\\"x"};
+
+    char buffer[64];
+    const size_t length = Pg::GetEncodedArrayLength(a);
+    ASSERT_EQ(Pg::EncodeArray(buffer, a), buffer + length);
+    ASSERT_EQ(std::string(buffer, length), "{\"foo\",\"\",\"\\\\\\\"x\"}");
+}
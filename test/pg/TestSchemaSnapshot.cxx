@@ -0,0 +1,107 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../src/pg/Reflection.hxx"
+#include "../../src/pg/Result.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+static void
+AddRow(PGresult *result, const char *kind, const char *table,
+       const char *name=nullptr, const char *type=nullptr)
+{
+	const int row = PQntuples(result);
+	const char *const values[] = {kind, table, name, type};
+	for (int i = 0; i < 4; ++i)
+		if (values[i] != nullptr)
+			PQsetvalue(result, row, i,
+				   const_cast<char *>(values[i]), strlen(values[i]));
+		else
+			PQsetvalue(result, row, i, nullptr, -1);
+}
+
+static Pg::Result
+MakeSnapshotResult()
+{
+	PGresult *result = PQmakeEmptyPGresult(nullptr, PGRES_TUPLES_OK);
+
+	PGresAttDesc attributes[4];
+	memset(attributes, 0, sizeof(attributes));
+	static const char *const names[] = {"kind", "table", "name", "type"};
+	for (unsigned i = 0; i < 4; ++i) {
+		attributes[i].name = const_cast<char *>(names[i]);
+		attributes[i].typlen = -1;
+		attributes[i].atttypmod = -1;
+	}
+
+	PQsetResultAttrs(result, 4, attributes);
+
+	AddRow(result, "t", "foo");
+	AddRow(result, "c", "foo", "id", "integer");
+	AddRow(result, "c", "foo", "name", "text");
+	AddRow(result, "i", "foo", "foo_pkey");
+	AddRow(result, "r", "foo", "foo_rule");
+	AddRow(result, "c", "foo_view", "id", "integer");
+
+	return Pg::Result(result);
+}
+
+TEST(PgTest, SchemaSnapshot)
+{
+	const Pg::SchemaSnapshot snapshot(MakeSnapshotResult());
+
+	ASSERT_TRUE(snapshot.TableExists("foo"));
+	ASSERT_FALSE(snapshot.TableExists("bar"));
+
+	/* views are not tables, but their columns are listed */
+	ASSERT_FALSE(snapshot.TableExists("foo_view"));
+	ASSERT_TRUE(snapshot.ColumnExists("foo_view", "id"));
+
+	ASSERT_TRUE(snapshot.ColumnExists("foo", "id"));
+	ASSERT_TRUE(snapshot.ColumnExists("foo", "name"));
+	ASSERT_FALSE(snapshot.ColumnExists("foo", "foo_pkey"));
+	ASSERT_FALSE(snapshot.ColumnExists("bar", "id"));
+
+	ASSERT_EQ(snapshot.GetColumnType("foo", "id"), "integer");
+	ASSERT_EQ(snapshot.GetColumnType("foo", "name"), "text");
+	ASSERT_THROW(snapshot.GetColumnType("foo", "bar"), std::runtime_error);
+	ASSERT_THROW(snapshot.GetColumnType("bar", "id"), std::runtime_error);
+
+	ASSERT_TRUE(snapshot.IndexExists("foo", "foo_pkey"));
+	ASSERT_FALSE(snapshot.IndexExists("foo", "foo_rule"));
+	ASSERT_FALSE(snapshot.IndexExists("bar", "foo_pkey"));
+
+	ASSERT_TRUE(snapshot.RuleExists("foo", "foo_rule"));
+	ASSERT_FALSE(snapshot.RuleExists("foo", "foo_pkey"));
+}
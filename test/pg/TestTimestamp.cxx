@@ -31,6 +31,7 @@
  */
 
 #include "../../src/pg/Timestamp.hxx"
+#include "../../src/util/StringBuffer.hxx"
 
 #include <gtest/gtest.h>
 
@@ -54,3 +55,13 @@ TEST(PgTest, ParseTimestamp)
 		  + std::chrono::hours(1)
 		  + std::chrono::minutes(30));
 }
+
+TEST(PgTest, FormatTimestamp)
+{
+	ASSERT_STREQ(Pg::FormatTimestamp(std::chrono::system_clock::from_time_t(0)).c_str(),
+		     "1970-01-01 00:00:00");
+	ASSERT_STREQ(Pg::FormatTimestamp(std::chrono::system_clock::from_time_t(1234567890)).c_str(),
+		     "2009-02-13 23:31:30");
+	ASSERT_EQ(Pg::ParseTimestamp(Pg::FormatTimestamp(std::chrono::system_clock::from_time_t(1234567890)).c_str()),
+		  std::chrono::system_clock::from_time_t(1234567890));
+}
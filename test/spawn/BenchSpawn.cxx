@@ -0,0 +1,330 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Spawn child processes as fast as possible with a given concurrency
+ * and print the throughput and latency statistics.
+ */
+
+#include "spawn/Glue.hxx"
+#include "spawn/Client.hxx"
+#include "spawn/Config.hxx"
+#include "spawn/Prepared.hxx"
+#include "spawn/Registry.hxx"
+#include "spawn/ExitListener.hxx"
+#include "event/Loop.hxx"
+#include "system/Error.hxx"
+#include "util/PrintException.hxx"
+#include "util/StringCompare.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct Usage {};
+
+enum class BenchProfile {
+	PLAIN,
+	USER_NS,
+	MOUNT_NS,
+	CGROUP,
+};
+
+static BenchProfile
+ParseProfile(const char *s)
+{
+	if (StringIsEqual(s, "plain"))
+		return BenchProfile::PLAIN;
+	else if (StringIsEqual(s, "userns"))
+		return BenchProfile::USER_NS;
+	else if (StringIsEqual(s, "mountns"))
+		return BenchProfile::MOUNT_NS;
+	else if (StringIsEqual(s, "cgroup"))
+		return BenchProfile::CGROUP;
+	else
+		throw Usage();
+}
+
+static void
+ApplyProfile(PreparedChildProcess &p, BenchProfile profile)
+{
+	switch (profile) {
+	case BenchProfile::PLAIN:
+		break;
+
+	case BenchProfile::USER_NS:
+		p.ns.enable_user = true;
+		break;
+
+	case BenchProfile::MOUNT_NS:
+		p.ns.enable_user = true;
+		p.ns.enable_pid = true;
+		p.ns.enable_network = true;
+		p.ns.enable_ipc = true;
+		p.ns.mount.enable_mount = true;
+		p.ns.mount.mount_proc = true;
+		p.ns.mount.mount_tmp_tmpfs = "";
+		p.ns.hostname = "bench";
+		break;
+
+	case BenchProfile::CGROUP:
+		p.cgroup.name = "bench";
+		break;
+	}
+}
+
+static std::chrono::microseconds
+ToMicroseconds(Clock::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(d);
+}
+
+/**
+ * Print the given quantiles of a server-side histogram (upper bounds
+ * of the bucket containing the quantile).
+ */
+static void
+PrintHistogram(const char *name, const SpawnLatencyHistogram &h)
+{
+	uint64_t total = 0;
+	for (auto n : h.buckets)
+		total += n;
+
+	if (total == 0)
+		return;
+
+	printf("  %-8s", name);
+
+	for (double q : {0.5, 0.99}) {
+		const uint64_t needle = std::max<uint64_t>(total * q, 1);
+
+		uint64_t sum = 0;
+		size_t i = 0;
+		for (; i < h.N_BUCKETS - 1; ++i) {
+			sum += h.buckets[i];
+			if (sum >= needle)
+				break;
+		}
+
+		printf(" p%u<%lluus", unsigned(q * 100),
+		       (unsigned long long)h.GetUpperBound(i).count());
+	}
+
+	printf("\n");
+}
+
+class SpawnBench final : SpawnStatsHandler {
+	EventLoop &event_loop;
+	SpawnServerClient &client;
+
+	const BenchProfile profile;
+
+	const unsigned count;
+
+	unsigned started = 0, finished = 0, failed = 0;
+
+	Clock::time_point start_time;
+
+	/**
+	 * The round trip durations (from the EXEC request until the
+	 * EXIT notification) of all finished child processes.
+	 */
+	std::vector<Clock::duration> round_trips;
+
+	class Child final : public ExitListener {
+		SpawnBench &bench;
+		const Clock::time_point start_time = Clock::now();
+
+	public:
+		explicit Child(SpawnBench &_bench):bench(_bench) {}
+
+		void OnChildProcessExit(int status) override {
+			bench.OnChildExit(Clock::now() - start_time, status);
+			delete this;
+		}
+	};
+
+public:
+	SpawnBench(EventLoop &_event_loop, SpawnServerClient &_client,
+		   BenchProfile _profile, unsigned _count)
+		:event_loop(_event_loop), client(_client),
+		 profile(_profile), count(_count) {
+		round_trips.reserve(count);
+	}
+
+	void Start(unsigned concurrency) {
+		start_time = Clock::now();
+
+		for (unsigned i = 0; i < concurrency && started < count; ++i)
+			SpawnOne();
+	}
+
+private:
+	void SpawnOne() {
+		++started;
+
+		PreparedChildProcess p;
+		p.exec_path = "/bin/true";
+		p.args.emplace_back("true");
+		p.stdout_fd = open("/dev/null", O_WRONLY|O_CLOEXEC|O_NOCTTY);
+		p.stderr_fd = dup(p.stdout_fd);
+		ApplyProfile(p, profile);
+
+		client.EnqueueChildProcess("bench", std::move(p),
+					   new Child(*this));
+	}
+
+	void OnChildExit(Clock::duration duration, int status) {
+		++finished;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			++failed;
+		else
+			round_trips.push_back(duration);
+
+		if (started < count)
+			SpawnOne();
+		else if (finished == count)
+			Finish();
+	}
+
+	void Finish() {
+		const auto duration = Clock::now() - start_time;
+		const double seconds =
+			std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+
+		printf("%u processes (%u failed) in %.3f s: %.1f spawns/s\n",
+		       count, failed, seconds, count / seconds);
+
+		if (!round_trips.empty()) {
+			std::sort(round_trips.begin(), round_trips.end());
+			const size_t n = round_trips.size();
+			printf("round trip: p50=%lldus p99=%lldus\n",
+			       (long long)ToMicroseconds(round_trips[n / 2]).count(),
+			       (long long)ToMicroseconds(round_trips[n * 99 / 100]).count());
+		}
+
+		client.QueryStats(*this);
+	}
+
+	/* virtual methods from class SpawnStatsHandler */
+	void OnSpawnStats(SpawnStats &&stats) noexcept override {
+		printf("spawner: %llu requests, %llu spawned, %llu rejected, %llu failed\n",
+		       (unsigned long long)stats.requests,
+		       (unsigned long long)stats.spawned,
+		       (unsigned long long)stats.rejected,
+		       (unsigned long long)stats.failed);
+
+		static constexpr const char *phase_names[N_SPAWN_PHASES] = {
+			"total", "clone", "user_ns", "uid_map",
+		};
+
+		for (size_t i = 0; i < N_SPAWN_PHASES; ++i)
+			PrintHistogram(phase_names[i], stats.latency[i]);
+
+		event_loop.Break();
+	}
+};
+
+int
+main(int argc, char **argv)
+try {
+	ConstBuffer<const char *> args(argv + 1, argc - 1);
+
+	SpawnConfig config;
+	config.default_uid_gid.uid = getuid();
+	config.default_uid_gid.gid = getgid();
+
+	unsigned count = 1000, concurrency = 16;
+	BenchProfile profile = BenchProfile::PLAIN;
+	bool batch = false;
+
+	while (!args.empty() && *args.front() == '-') {
+		const char *arg = args.shift();
+		if (const char *uid = StringAfterPrefix(arg, "--uid=")) {
+			config.default_uid_gid.uid = atoi(uid);
+		} else if (const char *gid = StringAfterPrefix(arg, "--gid=")) {
+			config.default_uid_gid.gid = atoi(gid);
+		} else if (const char *n = StringAfterPrefix(arg, "--count=")) {
+			count = strtoul(n, nullptr, 10);
+		} else if (const char *c = StringAfterPrefix(arg, "--concurrency=")) {
+			concurrency = strtoul(c, nullptr, 10);
+		} else if (const char *prof = StringAfterPrefix(arg, "--profile=")) {
+			profile = ParseProfile(prof);
+		} else if (const char *z = StringAfterPrefix(arg, "--zygotes=")) {
+			config.max_zygotes = strtoul(z, nullptr, 10);
+		} else if (const char *w = StringAfterPrefix(arg, "--workers=")) {
+			config.spawn_workers = strtoul(w, nullptr, 10);
+		} else if (StringIsEqual(arg, "--batch")) {
+			batch = true;
+		} else
+			throw Usage();
+	}
+
+	if (!args.empty() || count == 0 || concurrency == 0)
+		throw Usage();
+
+	if (profile == BenchProfile::CGROUP)
+		config.systemd_scope = "bench-spawn.scope";
+
+	EventLoop event_loop;
+	ChildProcessRegistry child_process_registry(event_loop);
+
+	std::unique_ptr<SpawnServerClient> client(StartSpawnServer(config,
+								   child_process_registry,
+								   nullptr,
+								   [](){}));
+	if (batch)
+		client->EnableBatching();
+
+	SpawnBench bench(event_loop, *client, profile, count);
+	bench.Start(concurrency);
+
+	event_loop.Dispatch();
+	return EXIT_SUCCESS;
+} catch (Usage) {
+	fprintf(stderr, "Usage: BenchSpawn [--uid=#] [--gid=#] [--count=#] [--concurrency=#]"
+		" [--profile=plain|userns|mountns|cgroup] [--zygotes=#] [--workers=#] [--batch]\n");
+	return EXIT_FAILURE;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "spawn/ChildOptions.hxx"
+#include "spawn/ResourceLimits.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+/**
+ * Apply the given modification to a fresh #ChildOptions instance
+ * and compare it with a default one.
+ */
+template<typename F>
+static void
+ExpectDifferent(F &&f)
+{
+	const ChildOptions a;
+	ChildOptions b;
+	f(b);
+
+	EXPECT_NE(a.GetHash(), b.GetHash());
+	EXPECT_FALSE(a == b);
+	EXPECT_FALSE(b == a);
+
+	/* the same modification yields the same hash */
+	ChildOptions c;
+	f(c);
+	EXPECT_EQ(b.GetHash(), c.GetHash());
+	EXPECT_TRUE(b == c);
+}
+
+/**
+ * Like ExpectDifferent(), but expect both objects to be
+ * interchangeable.
+ */
+template<typename F>
+static void
+ExpectSame(F &&f)
+{
+	const ChildOptions a;
+	ChildOptions b;
+	f(b);
+
+	EXPECT_EQ(a.GetHash(), b.GetHash());
+	EXPECT_TRUE(a == b);
+	EXPECT_TRUE(b == a);
+}
+
+TEST(ChildOptions, Default)
+{
+	const ChildOptions a, b;
+	ASSERT_EQ(a.GetHash(), b.GetHash());
+	ASSERT_TRUE(a == b);
+
+	/* the cached hash does not change */
+	ASSERT_EQ(a.GetHash(), a.GetHash());
+
+	const ChildOptions c(ShallowCopy(), a);
+	ASSERT_EQ(a.GetHash(), c.GetHash());
+	ASSERT_TRUE(a == c);
+}
+
+TEST(ChildOptions, Different)
+{
+	ExpectDifferent([](ChildOptions &o){ o.umask = 022; });
+	ExpectDifferent([](ChildOptions &o){ o.stderr_path = "/tmp/log"; });
+	ExpectDifferent([](ChildOptions &o){ o.stderr_path = ""; });
+	ExpectDifferent([](ChildOptions &o){ o.stderr_null = true; });
+	ExpectDifferent([](ChildOptions &o){ o.stderr_jailed = true; });
+	ExpectDifferent([](ChildOptions &o){ o.forbid_user_ns = true; });
+	ExpectDifferent([](ChildOptions &o){ o.forbid_multicast = true; });
+	ExpectDifferent([](ChildOptions &o){ o.forbid_bind = true; });
+	ExpectDifferent([](ChildOptions &o){ o.no_new_privs = true; });
+	ExpectDifferent([](ChildOptions &o){ o.sched_batch = true; });
+	ExpectDifferent([](ChildOptions &o){ o.cgroup.name = "foo"; });
+	ExpectDifferent([](ChildOptions &o){ o.refence.Set("foo"); });
+	ExpectDifferent([](ChildOptions &o){ o.ns.enable_user = true; });
+	ExpectDifferent([](ChildOptions &o){ o.ns.enable_pid = true; });
+	ExpectDifferent([](ChildOptions &o){ o.ns.hostname = "foo"; });
+	ExpectDifferent([](ChildOptions &o){ o.uid_gid.uid = 1000; });
+	ExpectDifferent([](ChildOptions &o){ o.uid_gid.gid = 1000; });
+	ExpectDifferent([](ChildOptions &o){ o.placement.auto_node = true; });
+	ExpectDifferent([](ChildOptions &o){ CPU_SET(1, &o.placement.cpus); });
+	ExpectDifferent([](ChildOptions &o){ o.placement.util_max = 512; });
+
+	static ResourceLimits rlimits;
+	rlimits.values[RLIMIT_NOFILE].rlim_cur = 64;
+	ExpectDifferent([](ChildOptions &o){ o.rlimits = &rlimits; });
+}
+
+TEST(ChildOptions, Same)
+{
+	/* not part of the identity */
+	ExpectSame([](ChildOptions &o){ o.tag = "foo"; });
+
+	/* all negative umask values mean "don't change" */
+	ExpectSame([](ChildOptions &o){ o.umask = -2; });
+
+	/* strings are compared by value, not by pointer */
+	static const std::string path("/tmp/log");
+	ChildOptions a, b;
+	a.stderr_path = "/tmp/log";
+	b.stderr_path = path.c_str();
+	ASSERT_EQ(a.GetHash(), b.GetHash());
+	ASSERT_TRUE(a == b);
+
+	/* empty resource limits are the same as none */
+	static const ResourceLimits empty_rlimits{};
+	ExpectSame([](ChildOptions &o){
+		o.rlimits = const_cast<ResourceLimits *>(&empty_rlimits);
+	});
+
+	/* the network namespace name matters only if enabled */
+	ExpectSame([](ChildOptions &o){ o.ns.network_namespace = "foo"; });
+	ExpectDifferent([](ChildOptions &o){
+		o.ns.enable_network = true;
+		o.ns.network_namespace = "foo";
+	});
+
+	/* supplementary groups are not part of the identity */
+	ExpectSame([](ChildOptions &o){ o.uid_gid.groups[0] = 42; });
+}
@@ -0,0 +1,421 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "spawn/ChildStock.hxx"
+#include "spawn/ChildOptions.hxx"
+#include "spawn/Prepared.hxx"
+#include "spawn/Interface.hxx"
+#include "spawn/ExitListener.hxx"
+#include "event/Loop.hxx"
+#include "util/Cancellable.hxx"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <utility>
+
+#include <unistd.h>
+
+namespace {
+
+/**
+ * A #SpawnService which does not really spawn processes; it keeps
+ * the child's end of the control socket, so tests can simulate a
+ * child closing it.
+ */
+class FakeSpawnService final : public SpawnService {
+	struct Child {
+		UniqueSocketDescriptor control;
+		ExitListener *listener;
+	};
+
+	int next_pid = 1;
+
+public:
+	std::map<int, Child> children;
+
+	std::set<int> killed;
+
+	unsigned n_spawned = 0;
+
+	bool fail = false;
+
+	/**
+	 * Simulate the child process closing its control socket.
+	 */
+	void CloseControl(int pid) noexcept {
+		children.at(pid).control.Close();
+	}
+
+	/**
+	 * Simulate the child process exiting.
+	 */
+	void Exit(int pid) noexcept {
+		auto i = children.find(pid);
+		auto *listener = i->second.listener;
+		children.erase(i);
+		listener->OnChildProcessExit(0);
+	}
+
+	/* virtual methods from SpawnService */
+	int SpawnChildProcess(const char *,
+			      PreparedChildProcess &&params,
+			      ExitListener *listener) override {
+		if (fail)
+			throw std::runtime_error("Spawn failed");
+
+		EXPECT_GE(params.control_fd, 0);
+
+		const int pid = next_pid++;
+		auto &child = children[pid];
+		child.control = UniqueSocketDescriptor(std::exchange(params.control_fd, -1));
+		child.listener = listener;
+		++n_spawned;
+		return pid;
+	}
+
+	void SetExitListener(int pid, ExitListener *listener) override {
+		children.at(pid).listener = listener;
+	}
+
+	void KillChildProcess(int pid, int) override {
+		EXPECT_EQ(killed.count(pid), 0u);
+		killed.insert(pid);
+		children.erase(pid);
+	}
+};
+
+class FakeChildStockClass final : public ChildStockClass {
+public:
+	/* virtual methods from ChildStockClass */
+	void PrepareChild(const ChildOptions &, void *,
+			  PreparedChildProcess &p) override {
+		p.Append("/bin/true");
+	}
+};
+
+struct Result final : ChildStockHandler {
+	ChildStockItem *item = nullptr;
+	std::exception_ptr error;
+
+	CancellablePointer cancel_ptr;
+
+	int GetPid() const noexcept {
+		return item != nullptr ? item->GetPid() : -1;
+	}
+
+	void Put(bool reuse=true) noexcept {
+		item->Put(reuse);
+		item = nullptr;
+	}
+
+	/* virtual methods from ChildStockHandler */
+	void OnChildStockReady(ChildStockItem &_item) noexcept override {
+		EXPECT_EQ(item, nullptr);
+		item = &_item;
+	}
+
+	void OnChildStockError(std::exception_ptr ep) noexcept override {
+		error = ep;
+	}
+};
+
+struct ChildStockTest : ::testing::Test {
+	EventLoop event_loop;
+	FakeSpawnService spawn_service;
+	FakeChildStockClass cls;
+
+	const ChildOptions options;
+
+	/**
+	 * Obtain a child process from the stock; the #ChildStockHandler
+	 * is expected to be invoked synchronously.
+	 */
+	void Get(ChildStock &stock, Result &result, const char *name="foo",
+		 const ChildOptions *_options=nullptr) {
+		stock.Get(name, _options != nullptr ? *_options : options,
+			  nullptr, result, result.cancel_ptr);
+		EXPECT_NE(result.item, nullptr);
+	}
+};
+
+}
+
+TEST_F(ChildStockTest, Reuse)
+{
+	ChildStock stock(event_loop, spawn_service, cls);
+
+	Result r1;
+	Get(stock, r1);
+	const int pid = r1.GetPid();
+	EXPECT_EQ(spawn_service.n_spawned, 1u);
+	EXPECT_EQ(stock.GetBusyCount(), 1u);
+	EXPECT_TRUE(r1.item->GetControl().IsDefined());
+
+	r1.Put();
+	EXPECT_EQ(stock.GetBusyCount(), 0u);
+	EXPECT_EQ(stock.GetIdleCount(), 1u);
+
+	/* the idle child is handed out again */
+	Result r2;
+	Get(stock, r2);
+	EXPECT_EQ(r2.GetPid(), pid);
+	EXPECT_EQ(spawn_service.n_spawned, 1u);
+	EXPECT_EQ(stock.GetIdleCount(), 0u);
+
+	/* "reuse=false" kills it */
+	r2.Put(false);
+	EXPECT_EQ(spawn_service.killed.count(pid), 1u);
+	EXPECT_EQ(stock.GetIdleCount(), 0u);
+
+	Result r3;
+	Get(stock, r3);
+	EXPECT_NE(r3.GetPid(), pid);
+	EXPECT_EQ(spawn_service.n_spawned, 2u);
+	r3.Put();
+}
+
+/**
+ * Children are only shared by requests with the same name and
+ * equal #ChildOptions.
+ */
+TEST_F(ChildStockTest, Key)
+{
+	ChildStock stock(event_loop, spawn_service, cls);
+
+	Result r1;
+	Get(stock, r1);
+	const int pid = r1.GetPid();
+	r1.Put();
+
+	/* another name */
+	Result r2;
+	Get(stock, r2, "bar");
+	const int pid2 = r2.GetPid();
+	EXPECT_NE(pid2, pid);
+	r2.Put();
+
+	/* different options */
+	ChildOptions other;
+	other.no_new_privs = true;
+	Result r3;
+	Get(stock, r3, "foo", &other);
+	const int pid3 = r3.GetPid();
+	EXPECT_NE(pid3, pid);
+	EXPECT_NE(pid3, pid2);
+	r3.Put();
+
+	EXPECT_EQ(spawn_service.n_spawned, 3u);
+	EXPECT_EQ(stock.GetIdleCount(), 3u);
+
+	/* a different but equal ChildOptions instance */
+	ChildOptions same;
+	Result r4;
+	Get(stock, r4, "foo", &same);
+	EXPECT_EQ(r4.GetPid(), pid);
+
+	Result r5;
+	Get(stock, r5, "foo", &other);
+	EXPECT_EQ(r5.GetPid(), pid3);
+
+	EXPECT_EQ(spawn_service.n_spawned, 3u);
+	r4.Put();
+	r5.Put();
+}
+
+TEST_F(ChildStockTest, MaxIdlePerKey)
+{
+	ChildStock stock(event_loop, spawn_service, cls, 16, 1, 64);
+
+	Result r1, r2;
+	Get(stock, r1);
+	Get(stock, r2);
+	const int pid1 = r1.GetPid(), pid2 = r2.GetPid();
+
+	r1.Put();
+	r2.Put();
+
+	/* the least recently used one was evicted */
+	EXPECT_EQ(stock.GetIdleCount(), 1u);
+	EXPECT_EQ(spawn_service.killed.count(pid1), 1u);
+
+	Result r3;
+	Get(stock, r3);
+	EXPECT_EQ(r3.GetPid(), pid2);
+	r3.Put();
+}
+
+TEST_F(ChildStockTest, MaxIdle)
+{
+	ChildStock stock(event_loop, spawn_service, cls, 16, 4, 2);
+
+	Result r1, r2, r3;
+	Get(stock, r1, "a");
+	Get(stock, r2, "b");
+	Get(stock, r3, "c");
+	const int pid1 = r1.GetPid();
+
+	r1.Put();
+	r2.Put();
+	r3.Put();
+
+	/* the least recently used one of the whole stock was
+	   evicted */
+	EXPECT_EQ(stock.GetIdleCount(), 2u);
+	EXPECT_EQ(spawn_service.killed.count(pid1), 1u);
+	EXPECT_EQ(spawn_service.killed.size(), 1u);
+}
+
+/**
+ * Get() requests exceeding the per-key limit wait for a child to
+ * be returned.
+ */
+TEST_F(ChildStockTest, MaxPerKey)
+{
+	ChildStock stock(event_loop, spawn_service, cls, 1);
+
+	Result r1;
+	Get(stock, r1);
+	const int pid = r1.GetPid();
+
+	Result r2, r3;
+	stock.Get("foo", options, nullptr, r2, r2.cancel_ptr);
+	stock.Get("foo", options, nullptr, r3, r3.cancel_ptr);
+	EXPECT_EQ(r2.item, nullptr);
+	EXPECT_EQ(r3.item, nullptr);
+
+	/* other keys are not affected */
+	Result r4;
+	Get(stock, r4, "bar");
+	r4.Put();
+
+	r3.cancel_ptr.Cancel();
+
+	/* the returned child is handed to the waiting request */
+	r1.Put();
+	EXPECT_EQ(r2.GetPid(), pid);
+	EXPECT_EQ(r3.item, nullptr);
+	EXPECT_EQ(spawn_service.n_spawned, 2u);
+
+	r2.Put();
+	EXPECT_EQ(r3.item, nullptr);
+}
+
+/**
+ * Idle children which close the control socket or exit are
+ * discarded.
+ */
+TEST_F(ChildStockTest, IdleGone)
+{
+	ChildStock stock(event_loop, spawn_service, cls);
+
+	Result r1, r2;
+	Get(stock, r1);
+	Get(stock, r2);
+	const int pid1 = r1.GetPid(), pid2 = r2.GetPid();
+	r1.Put();
+	r2.Put();
+	ASSERT_EQ(stock.GetIdleCount(), 2u);
+
+	spawn_service.Exit(pid1);
+	EXPECT_EQ(stock.GetIdleCount(), 1u);
+	EXPECT_EQ(spawn_service.killed.count(pid1), 0u);
+
+	spawn_service.CloseControl(pid2);
+	event_loop.LoopOnceNonBlock();
+	EXPECT_EQ(stock.GetIdleCount(), 0u);
+
+	Result r3;
+	Get(stock, r3);
+	EXPECT_NE(r3.GetPid(), pid1);
+	EXPECT_NE(r3.GetPid(), pid2);
+	r3.Put();
+}
+
+/**
+ * A child which has closed its control socket is not handed out,
+ * even if the #EventLoop has not noticed it yet.
+ */
+TEST_F(ChildStockTest, IdleGoneSync)
+{
+	ChildStock stock(event_loop, spawn_service, cls);
+
+	Result r1;
+	Get(stock, r1);
+	const int pid = r1.GetPid();
+	r1.Put();
+
+	spawn_service.CloseControl(pid);
+
+	Result r2;
+	Get(stock, r2);
+	EXPECT_NE(r2.GetPid(), pid);
+	EXPECT_EQ(spawn_service.killed.count(pid), 1u);
+	r2.Put();
+}
+
+TEST_F(ChildStockTest, IdleTimeout)
+{
+	ChildStock stock(event_loop, spawn_service, cls, 16, 4, 64,
+			 std::chrono::seconds(1));
+
+	Result r1;
+	Get(stock, r1);
+	const int pid = r1.GetPid();
+	r1.Put();
+
+	const auto until = std::chrono::steady_clock::now() +
+		std::chrono::milliseconds(2500);
+	while (stock.GetIdleCount() > 0 &&
+	       std::chrono::steady_clock::now() < until) {
+		event_loop.LoopOnceNonBlock();
+		usleep(10000);
+	}
+
+	EXPECT_EQ(stock.GetIdleCount(), 0u);
+	EXPECT_EQ(spawn_service.killed.count(pid), 1u);
+}
+
+TEST_F(ChildStockTest, SpawnError)
+{
+	ChildStock stock(event_loop, spawn_service, cls);
+
+	spawn_service.fail = true;
+
+	Result r;
+	stock.Get("foo", options, nullptr, r, r.cancel_ptr);
+	EXPECT_EQ(r.item, nullptr);
+	EXPECT_TRUE(r.error);
+}
@@ -0,0 +1,408 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "spawn/Client.hxx"
+#include "spawn/Config.hxx"
+#include "spawn/IProtocol.hxx"
+#include "spawn/Prepared.hxx"
+#include "spawn/ExitListener.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+namespace {
+
+/**
+ * A datagram received by the fake spawn server.
+ */
+struct Datagram {
+	std::vector<uint8_t> payload;
+	std::vector<UniqueFileDescriptor> fds;
+
+	SpawnRequestCommand GetCommand() const noexcept {
+		return SpawnRequestCommand(payload.front());
+	}
+};
+
+struct Listener final : ExitListener {
+	int status = -1;
+
+	void OnChildProcessExit(int _status) override {
+		status = _status;
+	}
+};
+
+}
+
+/**
+ * Receive one datagram (non-blocking).
+ *
+ * @return false if there is none
+ */
+static bool
+ReceiveDatagram(SocketDescriptor s, Datagram &d)
+{
+	uint8_t buffer[SPAWN_MAX_REQUEST_SIZE];
+	struct iovec iov{buffer, sizeof(buffer)};
+
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * SPAWN_MAX_REQUEST_FDS)];
+
+	struct msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t nbytes = recvmsg(s.Get(), &msg, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
+	if (nbytes <= 0)
+		return false;
+
+	d.payload.assign(buffer, buffer + nbytes);
+	d.fds.clear();
+
+	for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		const size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		const int *fds = (const int *)CMSG_DATA(cmsg);
+		for (size_t i = 0; i < n; ++i)
+			d.fds.emplace_back(FileDescriptor(fds[i]));
+	}
+
+	return true;
+}
+
+/**
+ * Receive all pending datagrams except for PROFILE requests, which
+ * are not interesting here.
+ */
+static std::vector<Datagram>
+ReceiveAll(SocketDescriptor s)
+{
+	std::vector<Datagram> result;
+
+	Datagram d;
+	while (ReceiveDatagram(s, d))
+		if (d.GetCommand() != SpawnRequestCommand::PROFILE)
+			result.emplace_back(std::move(d));
+
+	return result;
+}
+
+/**
+ * Split an EXEC_BATCH payload the way the spawn server does and
+ * return the pids of all EXEC records.
+ */
+static std::vector<int>
+ParseExecBatch(const Datagram &d)
+{
+	EXPECT_EQ(d.GetCommand(), SpawnRequestCommand::EXEC_BATCH);
+
+	std::vector<int> pids;
+
+	size_t position = 1;
+	while (position < d.payload.size()) {
+		uint32_t length;
+		EXPECT_GE(d.payload.size() - position, sizeof(length));
+		memcpy(&length, &d.payload[position], sizeof(length));
+		position += sizeof(length);
+
+		EXPECT_GT(length, 1 + sizeof(int));
+		EXPECT_LE(length, d.payload.size() - position);
+
+		EXPECT_EQ(SpawnRequestCommand(d.payload[position]),
+			  SpawnRequestCommand::EXEC);
+
+		int pid;
+		memcpy(&pid, &d.payload[position + 1], sizeof(pid));
+		pids.push_back(pid);
+
+		position += length;
+	}
+
+	EXPECT_EQ(position, d.payload.size());
+	return pids;
+}
+
+static int
+ParseKill(const Datagram &d)
+{
+	EXPECT_EQ(d.GetCommand(), SpawnRequestCommand::KILL);
+	EXPECT_EQ(d.payload.size(), 1 + 2 * sizeof(int));
+
+	int pid;
+	memcpy(&pid, &d.payload[1], sizeof(pid));
+	return pid;
+}
+
+static UniqueFileDescriptor
+OpenDevNull()
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open("/dev/null", O_RDWR))
+		throw MakeErrno("Failed to open /dev/null");
+	return fd;
+}
+
+static void
+RunLoop(EventLoop &event_loop, unsigned n=4)
+{
+	for (unsigned i = 0; i < n; ++i)
+		event_loop.LoopOnceNonBlock();
+}
+
+class SpawnClientBatch : public ::testing::Test {
+protected:
+	EventLoop event_loop;
+
+	/**
+	 * The spawn server's end of the socket.
+	 */
+	UniqueSocketDescriptor server;
+
+	SpawnServerClient *client = nullptr;
+
+	void SetUp() override {
+		UniqueSocketDescriptor a;
+		if (!UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+								       SOCK_SEQPACKET,
+								       0,
+								       a, server))
+			throw MakeErrno("socketpair() failed");
+
+		client = new SpawnServerClient(event_loop, SpawnConfig(),
+					       std::move(a), false);
+		client->EnableBatching();
+
+		auto connect = ReceiveAll(server);
+		ASSERT_EQ(connect.size(), 1u);
+		ASSERT_EQ(connect.front().GetCommand(),
+			  SpawnRequestCommand::CONNECT);
+	}
+
+	void TearDown() override {
+		delete client;
+	}
+
+	int Spawn(const char *arg=nullptr, ExitListener *listener=nullptr) {
+		PreparedChildProcess p;
+		p.Append("true");
+		if (arg != nullptr)
+			p.Append(arg);
+		return client->SpawnChildProcess("test", std::move(p),
+						 listener);
+	}
+
+	void SendExitBatch(const std::vector<std::pair<int, int>> &exits) {
+		std::vector<uint8_t> payload;
+		payload.push_back(uint8_t(SpawnResponseCommand::EXIT_BATCH));
+		for (const auto &i : exits) {
+			const int values[] = {i.first, i.second};
+			const auto *p = (const uint8_t *)values;
+			payload.insert(payload.end(), p, p + sizeof(values));
+		}
+
+		ASSERT_EQ(send(server.Get(), payload.data(), payload.size(), 0),
+			  ssize_t(payload.size()));
+	}
+};
+
+TEST_F(SpawnClientBatch, Deferred)
+{
+	const int pid1 = Spawn();
+	const int pid2 = Spawn();
+	const int pid3 = Spawn();
+
+	/* nothing is sent before the end of the loop iteration */
+	ASSERT_TRUE(ReceiveAll(server).empty());
+
+	RunLoop(event_loop);
+
+	const auto datagrams = ReceiveAll(server);
+	ASSERT_EQ(datagrams.size(), 1u);
+	ASSERT_EQ(ParseExecBatch(datagrams.front()),
+		  (std::vector<int>{pid1, pid2, pid3}));
+}
+
+/**
+ * A batch is flushed before it would exceed the datagram size, and
+ * a request which is too large for a batch is sent by itself after
+ * the batch.
+ */
+TEST_F(SpawnClientBatch, SizeLimit)
+{
+	const std::string arg(SPAWN_MAX_REQUEST_SIZE / 4, 'x');
+
+	std::vector<int> pids;
+	for (unsigned i = 0; i < 6; ++i)
+		pids.push_back(Spawn(arg.c_str()));
+
+	/* the first batch has been sent before the fourth request
+	   was added */
+	auto datagrams = ReceiveAll(server);
+	ASSERT_EQ(datagrams.size(), 1u);
+
+	const std::string huge(SPAWN_MAX_REQUEST_SIZE, 'y');
+	const int huge_pid = Spawn(huge.c_str());
+
+	RunLoop(event_loop);
+	for (auto &d : ReceiveAll(server))
+		datagrams.emplace_back(std::move(d));
+
+	ASSERT_GE(datagrams.size(), 3u);
+
+	std::vector<int> received;
+	for (size_t i = 0; i + 1 < datagrams.size(); ++i) {
+		ASSERT_LE(datagrams[i].payload.size(), SPAWN_MAX_REQUEST_SIZE);
+		for (int pid : ParseExecBatch(datagrams[i]))
+			received.push_back(pid);
+	}
+
+	ASSERT_EQ(received, pids);
+
+	/* the huge one is sent in a memfd after the batch */
+	ASSERT_EQ(datagrams.back().GetCommand(), SpawnRequestCommand::MEMFD);
+	ASSERT_EQ(datagrams.back().fds.size(), 1u);
+	(void)huge_pid;
+}
+
+/**
+ * A batch is flushed before it would exceed the number of file
+ * descriptors which fit into one datagram.
+ */
+TEST_F(SpawnClientBatch, FdLimit)
+{
+	constexpr unsigned FDS_PER_CHILD = 3;
+	constexpr unsigned PER_BATCH = SPAWN_MAX_REQUEST_FDS / FDS_PER_CHILD;
+
+	std::vector<int> pids;
+	for (unsigned i = 0; i < PER_BATCH + 2; ++i) {
+		PreparedChildProcess p;
+		p.Append("true");
+		p.SetStdin(OpenDevNull());
+		p.SetStdout(OpenDevNull());
+		p.SetStderr(OpenDevNull());
+		pids.push_back(client->SpawnChildProcess("test", std::move(p),
+							 nullptr));
+	}
+
+	RunLoop(event_loop);
+
+	const auto datagrams = ReceiveAll(server);
+	ASSERT_EQ(datagrams.size(), 2u);
+
+	ASSERT_EQ(datagrams[0].fds.size(), PER_BATCH * FDS_PER_CHILD);
+	ASSERT_EQ(datagrams[1].fds.size(), 2 * FDS_PER_CHILD);
+
+	auto received = ParseExecBatch(datagrams[0]);
+	ASSERT_EQ(received.size(), PER_BATCH);
+	for (int pid : ParseExecBatch(datagrams[1]))
+		received.push_back(pid);
+	ASSERT_EQ(received, pids);
+}
+
+/**
+ * A KILL request must not overtake the EXEC request of the same
+ * child.
+ */
+TEST_F(SpawnClientBatch, KillOrder)
+{
+	Listener listener;
+	const int pid1 = Spawn(nullptr, &listener);
+	const int pid2 = Spawn(nullptr, &listener);
+
+	client->KillChildProcess(pid2, SIGTERM);
+
+	const auto datagrams = ReceiveAll(server);
+	ASSERT_EQ(datagrams.size(), 2u);
+	ASSERT_EQ(ParseExecBatch(datagrams[0]),
+		  (std::vector<int>{pid1, pid2}));
+	ASSERT_EQ(ParseKill(datagrams[1]), pid2);
+}
+
+TEST_F(SpawnClientBatch, ExitBatch)
+{
+	Listener l1, l2, l3;
+	const int pid1 = Spawn(nullptr, &l1);
+	Spawn(nullptr, &l2);
+	const int pid3 = Spawn(nullptr, &l3);
+
+	RunLoop(event_loop);
+	ASSERT_EQ(ReceiveAll(server).size(), 1u);
+
+	/* unknown pids are ignored */
+	SendExitBatch({{pid3, W_EXITCODE(3, 0)}, {12345, 0}, {pid1, W_EXITCODE(1, 0)}});
+	RunLoop(event_loop);
+
+	ASSERT_EQ(l1.status, W_EXITCODE(1, 0));
+	ASSERT_EQ(l2.status, -1);
+	ASSERT_EQ(l3.status, W_EXITCODE(3, 0));
+
+	/* each child is reported only once */
+	l1.status = -1;
+	SendExitBatch({{pid1, 0}});
+	RunLoop(event_loop);
+	ASSERT_EQ(l1.status, -1);
+}
+
+/**
+ * If a batch cannot be sent, its children are reported as failed.
+ */
+TEST_F(SpawnClientBatch, FlushError)
+{
+	Listener l1, l2;
+	Spawn(nullptr, &l1);
+	Spawn(nullptr, &l2);
+
+	/* the server stops receiving; sending fails with EPIPE */
+	ASSERT_EQ(shutdown(server.Get(), SHUT_RD), 0);
+
+	RunLoop(event_loop);
+
+	ASSERT_EQ(l1.status, W_EXITCODE(0xff, 0));
+	ASSERT_EQ(l2.status, W_EXITCODE(0xff, 0));
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "spawn/MemfdPayload.hxx"
+#include "spawn/Builder.hxx"
+#include "spawn/Parser.hxx"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+
+TEST(SpawnMemfd, Threshold)
+{
+	static_assert(!NeedsSpawnPayloadMemfd(1), "");
+	static_assert(!NeedsSpawnPayloadMemfd(SPAWN_MAX_REQUEST_SIZE), "");
+	static_assert(NeedsSpawnPayloadMemfd(SPAWN_MAX_REQUEST_SIZE + 1), "");
+	static_assert(NeedsSpawnPayloadMemfd(SPAWN_MAX_MEMFD_REQUEST_SIZE), "");
+}
+
+TEST(SpawnMemfd, SerializerLimit)
+{
+	const std::vector<uint8_t> chunk(4096, 'x');
+
+	/* by default, a request must fit into a datagram */
+	SpawnSerializer s(SpawnRequestCommand::EXEC);
+	ASSERT_THROW({
+			for (size_t i = 0; i <= SPAWN_MAX_REQUEST_SIZE / chunk.size(); ++i)
+				s.Write(ConstBuffer<void>(chunk.data(), chunk.size()));
+		}, SpawnPayloadTooLargeError);
+	ASSERT_FALSE(NeedsSpawnPayloadMemfd(s.GetPayload().size));
+
+	/* with the raised limit, it may be larger, but not larger
+	   than the memfd limit */
+	std::vector<uint8_t> buffer;
+	SpawnSerializer s2(buffer, SpawnRequestCommand::EXEC);
+	s2.SetMaxSize(SPAWN_MAX_MEMFD_REQUEST_SIZE);
+	for (size_t i = 0; i <= SPAWN_MAX_REQUEST_SIZE / chunk.size(); ++i)
+		s2.Write(ConstBuffer<void>(chunk.data(), chunk.size()));
+	ASSERT_TRUE(NeedsSpawnPayloadMemfd(s2.GetPayload().size));
+
+	ASSERT_THROW({
+			for (;;)
+				s2.Write(ConstBuffer<void>(chunk.data(), chunk.size()));
+		}, SpawnPayloadTooLargeError);
+	ASSERT_LE(s2.GetPayload().size, SPAWN_MAX_MEMFD_REQUEST_SIZE);
+}
+
+TEST(SpawnMemfd, RoundTrip)
+{
+	std::vector<uint8_t> payload(SPAWN_MAX_REQUEST_SIZE * 3 + 17);
+	for (size_t i = 0; i < payload.size(); ++i)
+		payload[i] = uint8_t(i * 7);
+
+	auto fd = CreateSpawnPayloadMemfd({payload.data(), payload.size()});
+	ASSERT_TRUE(fd.IsDefined());
+
+	/* the contents are immutable */
+	ASSERT_LT(fd.Write("x", 1), 0);
+	ASSERT_LT(ftruncate(fd.Get(), 1), 0);
+
+	const SpawnPayloadMapping mapping(fd.ToFileDescriptor());
+	const auto data = mapping.Get();
+	ASSERT_EQ(data.size, payload.size());
+	ASSERT_EQ(memcmp(data.data, payload.data(), payload.size()), 0);
+}
+
+TEST(SpawnMemfd, Malformed)
+{
+	/* not sealed */
+	int fd = memfd_create("test", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(write(fd, "x", 1), 1);
+	ASSERT_THROW(SpawnPayloadMapping{FileDescriptor(fd)},
+		     MalformedSpawnPayloadError);
+
+	/* sealed, but empty */
+	ASSERT_EQ(ftruncate(fd, 0), 0);
+	ASSERT_EQ(fcntl(fd, F_ADD_SEALS,
+			F_SEAL_SEAL|F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE), 0);
+	ASSERT_THROW(SpawnPayloadMapping{FileDescriptor(fd)},
+		     MalformedSpawnPayloadError);
+	close(fd);
+
+	/* not a memfd */
+	fd = open("/dev/null", O_RDONLY|O_CLOEXEC);
+	ASSERT_GE(fd, 0);
+	ASSERT_THROW(SpawnPayloadMapping{FileDescriptor(fd)},
+		     MalformedSpawnPayloadError);
+	close(fd);
+}
@@ -0,0 +1,392 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "spawn/PlacementOptions.hxx"
+#include "spawn/NumaBalancer.hxx"
+#include "util/Hash128.hxx"
+
+#include <gtest/gtest.h>
+
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static cpu_set_t
+MakeCpuSet(std::initializer_list<unsigned> list)
+{
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (unsigned i : list)
+		CPU_SET(i, &cpus);
+	return cpus;
+}
+
+static bool
+CpuSetEquals(const cpu_set_t &cpus, std::initializer_list<unsigned> list)
+{
+	const auto expected = MakeCpuSet(list);
+	return CPU_EQUAL(&cpus, &expected);
+}
+
+static std::string
+MakeId(const PlacementOptions &placement)
+{
+	char buffer[1024];
+	*placement.MakeId(buffer) = 0;
+	return buffer;
+}
+
+static Hash128
+MakeHash(const PlacementOptions &placement)
+{
+	Hash128Builder h;
+	placement.MakeHash(h);
+	return h.Finish();
+}
+
+TEST(PlacementOptions, ParseCpuList)
+{
+	cpu_set_t cpus;
+
+	ASSERT_TRUE(ParseCpuList("0", cpus));
+	EXPECT_TRUE(CpuSetEquals(cpus, {0}));
+
+	ASSERT_TRUE(ParseCpuList("0-3,8,10-11", cpus));
+	EXPECT_TRUE(CpuSetEquals(cpus, {0, 1, 2, 3, 8, 10, 11}));
+
+	/* sysfs files end with a newline */
+	ASSERT_TRUE(ParseCpuList("2-3\n", cpus));
+	EXPECT_TRUE(CpuSetEquals(cpus, {2, 3}));
+
+	char last[16];
+	snprintf(last, sizeof(last), "%u", CPU_SETSIZE - 1);
+	ASSERT_TRUE(ParseCpuList(last, cpus));
+	EXPECT_EQ(CPU_COUNT(&cpus), 1);
+	EXPECT_TRUE(CPU_ISSET(CPU_SETSIZE - 1, &cpus));
+
+	char too_large[16];
+	snprintf(too_large, sizeof(too_large), "%u", CPU_SETSIZE);
+
+	for (const char *s : {"", "x", "-1", "1,", "1-", "3-1", "1;2",
+			      "1 2", (const char *)too_large})
+		EXPECT_FALSE(ParseCpuList(s, cpus)) << s;
+}
+
+TEST(PlacementOptions, ParseNodeList)
+{
+	uint64_t nodes;
+
+	ASSERT_TRUE(ParseNodeList("0,2-3", nodes));
+	EXPECT_EQ(nodes, 0xdu);
+
+	ASSERT_TRUE(ParseNodeList("63", nodes));
+	EXPECT_EQ(nodes, uint64_t(1) << 63);
+
+	EXPECT_FALSE(ParseNodeList("64", nodes));
+	EXPECT_FALSE(ParseNodeList("0-64", nodes));
+}
+
+TEST(PlacementOptions, MakeId)
+{
+	PlacementOptions placement;
+	EXPECT_TRUE(placement.IsEmpty());
+	EXPECT_EQ(MakeId(placement), "");
+
+	/* hex digits, lowest CPU first, without trailing zeroes */
+	placement.cpus = MakeCpuSet({0, 1, 2, 3, 8});
+	EXPECT_FALSE(placement.IsEmpty());
+	EXPECT_EQ(MakeId(placement), ";cf01");
+
+	placement.cpus = MakeCpuSet({5});
+	EXPECT_EQ(MakeId(placement), ";c02");
+
+	placement.cpus = MakeCpuSet({CPU_SETSIZE - 1});
+	EXPECT_EQ(MakeId(placement),
+		  ";c" + std::string(CPU_SETSIZE / 4 - 1, '0') + "8");
+
+	placement.cpus = MakeCpuSet({});
+	placement.memory_policy = PlacementOptions::MemoryPolicy::BIND;
+	placement.memory_nodes = 0x5;
+	EXPECT_EQ(MakeId(placement), ";m2:5");
+
+	placement.util_max = 512;
+	EXPECT_EQ(MakeId(placement), ";m2:5;uc65535-512");
+
+	placement.util_min = 0;
+	placement.auto_node = true;
+	EXPECT_EQ(MakeId(placement), ";m2:5;uc0-512;na");
+}
+
+TEST(PlacementOptions, Compare)
+{
+	const PlacementOptions a;
+
+	const auto expect_different = [&a](const PlacementOptions &b){
+		EXPECT_FALSE(a.IsSameId(b));
+		EXPECT_FALSE(b.IsSameId(a));
+		EXPECT_NE(MakeHash(a), MakeHash(b));
+		EXPECT_NE(MakeId(a), MakeId(b));
+	};
+
+	PlacementOptions b;
+	EXPECT_TRUE(a.IsSameId(b));
+	EXPECT_EQ(MakeHash(a), MakeHash(b));
+
+	b.cpus = MakeCpuSet({1});
+	expect_different(b);
+
+	PlacementOptions c;
+	c.cpus = MakeCpuSet({1});
+	EXPECT_TRUE(b.IsSameId(c));
+	EXPECT_EQ(MakeHash(b), MakeHash(c));
+
+	c.cpus = MakeCpuSet({2});
+	EXPECT_FALSE(b.IsSameId(c));
+	EXPECT_NE(MakeHash(b), MakeHash(c));
+
+	b = {};
+	b.memory_policy = PlacementOptions::MemoryPolicy::PREFERRED;
+	expect_different(b);
+
+	b = {};
+	b.util_min = 100;
+	expect_different(b);
+
+	b = {};
+	b.auto_node = true;
+	expect_different(b);
+}
+
+namespace {
+
+/**
+ * A fake sysfs NUMA topology and /proc/stat for #NumaBalancer.
+ */
+class FakeTopology {
+	char path[64] = "/tmp/TestPlacement.XXXXXX";
+
+	std::string stat_path;
+
+	unsigned n_nodes = 0;
+
+	/**
+	 * The /proc/stat counters per CPU.
+	 */
+	struct {
+		unsigned long long busy = 0, idle = 0;
+	} cpus[16];
+
+public:
+	FakeTopology() {
+		if (mkdtemp(path) == nullptr)
+			throw std::runtime_error("mkdtemp() failed");
+
+		stat_path = std::string(path) + "/stat";
+	}
+
+	~FakeTopology() {
+		for (unsigned i = 0; i < n_nodes; ++i) {
+			const auto dir = NodePath(i);
+			unlink((dir + "/cpulist").c_str());
+			rmdir(dir.c_str());
+		}
+
+		rmdir(Path("node").c_str());
+		unlink(stat_path.c_str());
+		rmdir(path);
+	}
+
+	std::string Path(const char *name) const {
+		return std::string(path) + "/" + name;
+	}
+
+	std::string NodePath(unsigned i) const {
+		return Path("node") + "/node" + std::to_string(i);
+	}
+
+	/**
+	 * Add a node with the given "cpulist" (which may be empty).
+	 */
+	void AddNode(const char *cpulist) {
+		mkdir(Path("node").c_str(), 0700);
+
+		const auto dir = NodePath(n_nodes++);
+		mkdir(dir.c_str(), 0700);
+		Write((dir + "/cpulist").c_str(), cpulist);
+	}
+
+	/**
+	 * Account CPU time (in ticks) to a CPU and rewrite /proc/stat.
+	 */
+	void AddTime(unsigned cpu, unsigned long long busy,
+		     unsigned long long idle) {
+		cpus[cpu].busy += busy;
+		cpus[cpu].idle += idle;
+		WriteStat();
+	}
+
+	NumaBalancer MakeBalancer() const {
+		const auto node_path = Path("node");
+		return NumaBalancer(node_path.c_str(), stat_path.c_str());
+	}
+
+private:
+	static void Write(const char *p, const std::string &contents) {
+		FILE *file = fopen(p, "w");
+		if (file == nullptr)
+			throw std::runtime_error("fopen() failed");
+		fwrite(contents.data(), 1, contents.size(), file);
+		fclose(file);
+	}
+
+	void WriteStat() const {
+		std::string s = "cpu  0 0 0 0 0 0 0 0 0 0\n";
+		for (unsigned i = 0; i < 16; ++i) {
+			char line[256];
+			/* user nice system idle iowait irq softirq
+			   steal guest guest_nice */
+			snprintf(line, sizeof(line),
+				 "cpu%u %llu 0 0 %llu 0 0 0 0 0 0\n",
+				 i, cpus[i].busy, cpus[i].idle);
+			s += line;
+		}
+
+		s += "intr 0\n";
+		Write(stat_path.c_str(), s);
+	}
+};
+
+}
+
+TEST(NumaBalancer, Disabled)
+{
+	FakeTopology t;
+	t.AddNode("0-3");
+	t.AddNode("");
+	t.AddTime(0, 0, 0);
+
+	/* only one node has CPUs */
+	EXPECT_FALSE(t.MakeBalancer().IsEnabled());
+
+	/* no topology at all */
+	EXPECT_FALSE(NumaBalancer("/nonexistent", "/nonexistent").IsEnabled());
+}
+
+/**
+ * Without load, new child processes are spread evenly across the
+ * nodes.
+ */
+TEST(NumaBalancer, Spread)
+{
+	FakeTopology t;
+	t.AddNode("0-1");
+	t.AddNode("2-3");
+	t.AddTime(0, 0, 0);
+
+	auto balancer = t.MakeBalancer();
+	ASSERT_TRUE(balancer.IsEnabled());
+
+	const auto now = std::chrono::steady_clock::now();
+
+	PlacementOptions p;
+	EXPECT_EQ(balancer.Place(p, now), 0u);
+	EXPECT_TRUE(CpuSetEquals(p.cpus, {0, 1}));
+	EXPECT_EQ(p.memory_nodes, 0x1u);
+	EXPECT_EQ(p.memory_policy, PlacementOptions::MemoryPolicy::PREFERRED);
+
+	p = {};
+	EXPECT_EQ(balancer.Place(p, now), 1u);
+	EXPECT_TRUE(CpuSetEquals(p.cpus, {2, 3}));
+	EXPECT_EQ(p.memory_nodes, 0x2u);
+
+	EXPECT_EQ(balancer.Place(p, now), 0u);
+	EXPECT_EQ(balancer.Place(p, now), 1u);
+
+	/* an explicit memory policy is preserved */
+	p = {};
+	p.memory_policy = PlacementOptions::MemoryPolicy::BIND;
+	EXPECT_EQ(balancer.Place(p, now), 0u);
+	EXPECT_EQ(p.memory_policy, PlacementOptions::MemoryPolicy::BIND);
+	EXPECT_EQ(p.memory_nodes, 0x1u);
+
+	/* node 0 got one more child, but after the next sample, the
+	   count starts over */
+	EXPECT_EQ(balancer.Place(p, now + std::chrono::seconds(2)), 0u);
+}
+
+/**
+ * The busy node is avoided until the children placed on the other
+ * node outweigh its load.
+ */
+TEST(NumaBalancer, Load)
+{
+	FakeTopology t;
+	t.AddNode("0-1");
+	t.AddNode("2-3");
+	t.AddTime(0, 0, 0);
+
+	auto balancer = t.MakeBalancer();
+	ASSERT_TRUE(balancer.IsEnabled());
+
+	/* node 0: 75% busy; node 1: idle */
+	t.AddTime(0, 75, 25);
+	t.AddTime(1, 75, 25);
+	t.AddTime(2, 0, 100);
+	t.AddTime(3, 0, 100);
+
+	auto now = std::chrono::steady_clock::now();
+
+	PlacementOptions p;
+	EXPECT_EQ(balancer.Place(p, now), 1u);
+	EXPECT_EQ(balancer.Place(p, now), 1u);
+
+	/* node 1: 0 + 2/2 > node 0: 0.75 */
+	EXPECT_EQ(balancer.Place(p, now), 0u);
+
+	/* the load flips; it is noticed after the next sample */
+	t.AddTime(0, 0, 100);
+	t.AddTime(1, 0, 100);
+	t.AddTime(2, 100, 0);
+	t.AddTime(3, 100, 0);
+
+	EXPECT_EQ(balancer.Place(p, now), 1u);
+
+	now += std::chrono::seconds(2);
+	EXPECT_EQ(balancer.Place(p, now), 0u);
+	EXPECT_EQ(balancer.Place(p, now), 0u);
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "spawn/Prepared.hxx"
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+
+static int
+OpenDevNull()
+{
+	int fd = open("/dev/null", O_WRONLY|O_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error("Failed to open /dev/null");
+	return fd;
+}
+
+static int
+ExecDummy(PreparedChildProcess &&)
+{
+	return 0;
+}
+
+/**
+ * Build a #PreparedChildProcess which qualifies for the
+ * CLONE_VM|CLONE_VFORK fast path, apply the given modification and
+ * check it again.
+ */
+template<typename F>
+static bool
+IsVforkCompatibleWith(F &&f)
+{
+	PreparedChildProcess p;
+	p.Append("/bin/true");
+	p.SetStdout(OpenDevNull());
+	p.stderr_path = "/dev/null";
+
+	f(p);
+	return p.IsVforkCompatible();
+}
+
+TEST(PreparedChildProcess, VforkCompatible)
+{
+	/* the trivial process */
+	ASSERT_TRUE(IsVforkCompatibleWith([](PreparedChildProcess &){}));
+
+	/* settings which the vfork child applies with plain system
+	   calls */
+	ASSERT_TRUE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.SetStderr(OpenDevNull());
+		p.stderr_path = nullptr;
+	}));
+	ASSERT_TRUE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.SetStdin(OpenDevNull());
+		p.PutEnv("FOO=bar");
+		p.chdir = "/tmp";
+		p.umask = 022;
+		p.sched_idle = true;
+		p.ioprio_idle = true;
+		p.no_new_privs = true;
+	}));
+}
+
+TEST(PreparedChildProcess, VforkIncompatible)
+{
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.exec_function = ExecDummy;
+	}));
+
+	/* namespaces */
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.ns.enable_user = true;
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.ns.enable_pid = true;
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.ns.enable_network = true;
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.ns.pid_namespace = "foo";
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.ns.network_namespace = "foo";
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.mount_namespace_fd = 42;
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.chroot = "/tmp";
+	}));
+
+	/* settings which may allocate memory or throw */
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.cgroup.name = "foo";
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.refence.Set("foo");
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.uid_gid.uid = 1000;
+		p.uid_gid.gid = 1000;
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.rlimits.values[RLIMIT_NOFILE].rlim_cur = 64;
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.placement.auto_node = true;
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		CPU_SET(0, &p.placement.cpus);
+	}));
+
+	/* stdout/stderr would go to the systemd journal */
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.SetStdout(-1);
+	}));
+	ASSERT_FALSE(IsVforkCompatibleWith([](PreparedChildProcess &p){
+		p.stderr_path = nullptr;
+	}));
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "spawn/UserDatabase.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace {
+
+class TempDirectory {
+	char path[64] = "/tmp/TestUserDatabase.XXXXXX";
+
+public:
+	TempDirectory() {
+		if (mkdtemp(path) == nullptr)
+			throw std::runtime_error("mkdtemp() failed");
+	}
+
+	~TempDirectory() {
+		unlink(Path("passwd").c_str());
+		unlink(Path("group").c_str());
+		rmdir(path);
+	}
+
+	std::string Path(const char *name) const {
+		return std::string(path) + "/" + name;
+	}
+
+	void Write(const char *name, const std::string &contents) const {
+		FILE *file = fopen(Path(name).c_str(), "w");
+		if (file == nullptr)
+			throw std::runtime_error("fopen() failed");
+		fwrite(contents.data(), 1, contents.size(), file);
+		fclose(file);
+	}
+};
+
+}
+
+TEST(UserDatabase, Basic)
+{
+	const TempDirectory dir;
+	dir.Write("passwd",
+		  "udb_alice:x:1001:1001:Alice:/home/alice:/bin/sh\n"
+		  "udb_bob:x:1002:100::/home/bob:/bin/false\n");
+	dir.Write("group",
+		  "udb_alice:x:1001:\n"
+		  "udb_users:x:100:udb_alice,udb_bob\n"
+		  "udb_wheel:x:10:udb_alice\n");
+
+	UserDatabase db(std::chrono::minutes(1),
+			dir.Path("passwd").c_str(), dir.Path("group").c_str());
+	db.Preload();
+	ASSERT_EQ(db.GetUserCount(), 2u);
+	ASSERT_EQ(db.GetGroupCount(), 3u);
+
+	auto alice = db.Lookup("udb_alice");
+	ASSERT_EQ(alice.uid, 1001u);
+	ASSERT_EQ(alice.gid, 1001u);
+	ASSERT_EQ(alice.CountGroups(), 3u);
+	ASSERT_EQ(alice.groups[0], 1001u);
+	ASSERT_EQ(alice.groups[1], 100u);
+	ASSERT_EQ(alice.groups[2], 10u);
+
+	/* the primary group is not listed twice */
+	auto bob = db.Lookup("udb_bob");
+	ASSERT_EQ(bob.uid, 1002u);
+	ASSERT_EQ(bob.gid, 100u);
+	ASSERT_EQ(bob.CountGroups(), 1u);
+	ASSERT_EQ(bob.groups[0], 100u);
+
+	ASSERT_EQ(db.LookupGroup("udb_users"), 100u);
+	ASSERT_EQ(db.LookupGroup("udb_wheel"), 10u);
+
+	ASSERT_THROW(db.Lookup("udb_nobody"), std::runtime_error);
+	ASSERT_THROW(db.LookupGroup("udb_nobody"), std::runtime_error);
+}
+
+TEST(UserDatabase, Malformed)
+{
+	const TempDirectory dir;
+	dir.Write("passwd",
+		  "# comment\n"
+		  "\n"
+		  "udb_nouid:x::1001::/:/bin/sh\n"
+		  "udb_badgid:x:1002:abc::/:/bin/sh\n"
+		  "udb_negative:x:-1:1001::/:/bin/sh\n"
+		  "udb_overflow:x:4294967296:1001::/:/bin/sh\n"
+		  "udb_short:x:1003\n"
+		  ":x:1004:1004::/:/bin/sh\n"
+		  "garbage\n"
+		  "udb_alice:x:1001:1001::/:/bin/sh\n"
+		  "udb_alice:x:2001:2001::/:/bin/sh\n"
+		  "udb_max:x:4294967295:0\n"
+		  /* no trailing newline */
+		  "udb_last:x:1005:1005::/:/bin/sh");
+	dir.Write("group",
+		  "udb_short:x\n"
+		  "udb_badgid:x:1x:\n"
+		  "udb_nomembers:x:1001\n"
+		  "udb_nomembers:x:2001:udb_alice\n"
+		  "udb_users:x:100:,udb_alice,,\n");
+
+	UserDatabase db(std::chrono::minutes(1),
+			dir.Path("passwd").c_str(), dir.Path("group").c_str());
+	db.Preload();
+	ASSERT_EQ(db.GetUserCount(), 3u);
+	ASSERT_EQ(db.GetGroupCount(), 2u);
+
+	for (const char *name : {"udb_nouid", "udb_badgid", "udb_negative",
+				 "udb_overflow", "udb_short", "garbage"})
+		ASSERT_THROW(db.Lookup(name), std::runtime_error) << name;
+
+	/* like NSS, the first entry wins, also for groups (whose
+	   member list is ignored then) */
+	auto alice = db.Lookup("udb_alice");
+	ASSERT_EQ(alice.uid, 1001u);
+	ASSERT_EQ(alice.gid, 1001u);
+	ASSERT_EQ(alice.CountGroups(), 2u);
+	ASSERT_EQ(alice.groups[1], 100u);
+	ASSERT_EQ(db.LookupGroup("udb_nomembers"), 1001u);
+
+	ASSERT_EQ(db.Lookup("udb_max").uid, 4294967295u);
+	ASSERT_EQ(db.Lookup("udb_last").uid, 1005u);
+
+	ASSERT_THROW(db.LookupGroup("udb_short"), std::runtime_error);
+	ASSERT_THROW(db.LookupGroup("udb_badgid"), std::runtime_error);
+}
+
+TEST(UserDatabase, LongLines)
+{
+	const TempDirectory dir;
+	dir.Write("passwd",
+		  "udb_long:x:1001:1001:" + std::string(1024 * 1024, 'x') +
+		  ":/home/long:/bin/sh\n"
+		  "udb_alice:x:1002:1002::/:/bin/sh\n");
+
+	/* a member list much longer than any line buffer, and more
+	   supplementary groups than UidGid can hold */
+	std::string members;
+	for (unsigned i = 0; i < 10000; ++i)
+		members += "udb_member" + std::to_string(i) + ",";
+	members += "udb_alice";
+
+	std::string group = "udb_big:x:100:" + members + "\n";
+	for (unsigned i = 0; i < 50; ++i)
+		group += "udb_g" + std::to_string(i) + ":x:" +
+			std::to_string(2000 + i) + ":udb_alice\n";
+	dir.Write("group", group);
+
+	UserDatabase db(std::chrono::minutes(1),
+			dir.Path("passwd").c_str(), dir.Path("group").c_str());
+
+	ASSERT_EQ(db.Lookup("udb_long").uid, 1001u);
+
+	auto alice = db.Lookup("udb_alice");
+	ASSERT_EQ(alice.uid, 1002u);
+	ASSERT_EQ(alice.groups[0], 1002u);
+	ASSERT_EQ(alice.CountGroups(), alice.groups.size());
+
+	ASSERT_EQ(db.LookupGroup("udb_big"), 100u);
+	ASSERT_EQ(db.LookupGroup("udb_g49"), 2049u);
+	ASSERT_EQ(db.GetGroupCount(), 51u);
+}
+
+TEST(UserDatabase, MissingFiles)
+{
+	const TempDirectory dir;
+
+	UserDatabase db(std::chrono::minutes(1),
+			dir.Path("passwd").c_str(), dir.Path("group").c_str());
+
+	/* missing files are treated like empty ones */
+	db.Preload();
+	ASSERT_EQ(db.GetUserCount(), 0u);
+	ASSERT_EQ(db.GetGroupCount(), 0u);
+
+	/* ... and lookups fall back to NSS */
+	ASSERT_EQ(db.Lookup("root").uid, 0u);
+	ASSERT_THROW(db.Lookup("udb_nobody"), std::runtime_error);
+	ASSERT_THROW(db.LookupGroup("udb_nobody"), std::runtime_error);
+
+	/* a file which appears later is loaded */
+	dir.Write("passwd", "udb_alice:x:1001:1001::/:/bin/sh\n");
+	db.Preload();
+	ASSERT_EQ(db.GetUserCount(), 1u);
+	ASSERT_EQ(db.Lookup("udb_alice").uid, 1001u);
+
+	/* a file which disappears is unloaded */
+	unlink(dir.Path("passwd").c_str());
+	db.Preload();
+	ASSERT_EQ(db.GetUserCount(), 0u);
+	ASSERT_THROW(db.Lookup("udb_alice"), std::runtime_error);
+
+	/* a path which is not a regular file is an error */
+	UserDatabase db2(std::chrono::minutes(1), "/", "/");
+	ASSERT_ANY_THROW(db2.Preload());
+}
+
+TEST(UserDatabase, Reload)
+{
+	const TempDirectory dir;
+	dir.Write("passwd", "udb_alice:x:1001:1001::/:/bin/sh\n");
+	dir.Write("group", "udb_users:x:100:udb_alice\n");
+
+	UserDatabase db(std::chrono::seconds(0),
+			dir.Path("passwd").c_str(), dir.Path("group").c_str());
+
+	ASSERT_EQ(db.Lookup("udb_alice").uid, 1001u);
+	ASSERT_EQ(db.Lookup("udb_alice").CountGroups(), 2u);
+	ASSERT_THROW(db.Lookup("udb_bob"), std::runtime_error);
+
+	dir.Write("passwd",
+		  "udb_alice:x:1001:1001::/:/bin/sh\n"
+		  "udb_bob:x:1002:1002::/:/bin/sh\n");
+	dir.Write("group", "udb_users:x:100:udb_bob\n");
+
+	ASSERT_EQ(db.Lookup("udb_bob").uid, 1002u);
+	ASSERT_EQ(db.Lookup("udb_bob").CountGroups(), 2u);
+	ASSERT_EQ(db.Lookup("udb_alice").CountGroups(), 1u);
+
+	db.Clear();
+	ASSERT_EQ(db.GetUserCount(), 0u);
+	ASSERT_EQ(db.Lookup("udb_bob").uid, 1002u);
+	ASSERT_EQ(db.GetUserCount(), 2u);
+}
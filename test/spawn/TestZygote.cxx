@@ -0,0 +1,314 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "spawn/Zygote.hxx"
+#include "spawn/Prepared.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+static void
+CreateSocketPair(UniqueSocketDescriptor &a, UniqueSocketDescriptor &b)
+{
+	if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_SEQPACKET,
+						      0, a, b))
+		throw MakeErrno("socketpair() failed");
+}
+
+static int
+OpenDevNull()
+{
+	int fd = open("/dev/null", O_RDWR|O_CLOEXEC);
+	if (fd < 0)
+		throw MakeErrno("Failed to open /dev/null");
+	return fd;
+}
+
+static bool
+IsSameFile(int a, int b)
+{
+	struct stat sa, sb;
+	return fstat(a, &sa) == 0 && fstat(b, &sb) == 0 &&
+		sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+TEST(Zygote, Compatible)
+{
+	PreparedChildProcess p;
+	ASSERT_FALSE(IsZygoteCompatible(p));
+
+	p.Append("true");
+	ASSERT_TRUE(IsZygoteCompatible(p));
+
+	/* these settings are inherited by the children of a zygote */
+	p.umask = 022;
+	p.chroot = "/tmp";
+	p.ns.enable_network = true;
+	p.no_new_privs = true;
+	ASSERT_TRUE(IsZygoteCompatible(p));
+
+	{
+		PreparedChildProcess q;
+		q.Append("true");
+		q.ns.enable_pid = true;
+		ASSERT_FALSE(IsZygoteCompatible(q));
+	}
+
+	{
+		PreparedChildProcess q;
+		q.Append("true");
+		q.ns.pid_namespace = "foo";
+		ASSERT_FALSE(IsZygoteCompatible(q));
+	}
+
+	{
+		PreparedChildProcess q;
+		q.Append("true");
+		q.refence.Set("foo");
+		ASSERT_FALSE(IsZygoteCompatible(q));
+	}
+
+	{
+		PreparedChildProcess q;
+		q.Append("true");
+		q.exec_function = [](PreparedChildProcess &&) -> int { return 0; };
+		ASSERT_FALSE(IsZygoteCompatible(q));
+	}
+}
+
+/**
+ * Send a request, receive it on the other end and parse it.
+ */
+static void
+RoundTrip(const PreparedChildProcess &src, PreparedChildProcess &dest,
+	  std::unique_ptr<SpawnZygoteRequest::Buffer> &buffer)
+{
+	UniqueSocketDescriptor a, b;
+	CreateSocketPair(a, b);
+
+	SpawnZygoteRequest::Send(a, src);
+
+	buffer.reset(new SpawnZygoteRequest::Buffer());
+	auto result = ReceiveMessage(b, *buffer, 0);
+	SpawnZygoteRequest::Parse(result, dest);
+}
+
+TEST(Zygote, Request)
+{
+	PreparedChildProcess src;
+	src.Append("/bin/foo");
+	src.Append("bar");
+	src.Append("");
+	src.SetEnv("A", "1");
+	src.SetEnv("B", "2");
+
+	/* stdin and stdout share one file descriptor, which is sent
+	   only once */
+	const int in_out = OpenDevNull();
+	src.SetStdin(in_out);
+	src.SetStdout(in_out);
+	src.SetStderr(OpenDevNull());
+
+	PreparedChildProcess dest;
+	std::unique_ptr<SpawnZygoteRequest::Buffer> buffer;
+	RoundTrip(src, dest, buffer);
+
+	ASSERT_EQ(dest.args.size(), 3u);
+	ASSERT_STREQ(dest.args[0], "/bin/foo");
+	ASSERT_STREQ(dest.args[1], "bar");
+	ASSERT_STREQ(dest.args[2], "");
+
+	ASSERT_EQ(dest.env.size(), 2u);
+	ASSERT_STREQ(dest.env[0], "A=1");
+	ASSERT_STREQ(dest.env[1], "B=2");
+
+	ASSERT_GE(dest.stdin_fd, 0);
+	ASSERT_EQ(dest.stdout_fd, dest.stdin_fd);
+	ASSERT_GE(dest.stderr_fd, 0);
+	ASSERT_NE(dest.stderr_fd, dest.stdin_fd);
+	ASSERT_EQ(dest.control_fd, -1);
+
+	ASSERT_TRUE(IsSameFile(dest.stdin_fd, src.stdin_fd));
+	ASSERT_TRUE(IsSameFile(dest.stderr_fd, src.stderr_fd));
+}
+
+TEST(Zygote, RequestNoFds)
+{
+	PreparedChildProcess src;
+	src.Append("true");
+
+	PreparedChildProcess dest;
+	std::unique_ptr<SpawnZygoteRequest::Buffer> buffer;
+	RoundTrip(src, dest, buffer);
+
+	ASSERT_EQ(dest.args.size(), 1u);
+	ASSERT_STREQ(dest.args[0], "true");
+	ASSERT_TRUE(dest.env.empty());
+	ASSERT_EQ(dest.stdin_fd, -1);
+	ASSERT_EQ(dest.stdout_fd, -1);
+	ASSERT_EQ(dest.stderr_fd, -1);
+	ASSERT_EQ(dest.control_fd, -1);
+}
+
+/**
+ * Parse a hand-crafted request payload without file descriptors.
+ */
+static void
+ParseRaw(const void *data, size_t size)
+{
+	ReceiveMessageResult result;
+	result.payload = {data, size};
+
+	PreparedChildProcess p;
+	SpawnZygoteRequest::Parse(result, p);
+}
+
+TEST(Zygote, Malformed)
+{
+	/* see SpawnZygoteRequestHeader */
+	struct {
+		uint8_t fds[4];
+		uint16_t n_args, n_env;
+		char strings[8];
+	} request;
+
+	memset(request.fds, 0xff, sizeof(request.fds));
+	request.n_args = 1;
+	request.n_env = 0;
+	memcpy(request.strings, "true\0", 5);
+
+	const size_t header_size = offsetof(decltype(request), strings);
+
+	ASSERT_NO_THROW(ParseRaw(&request, header_size + 5));
+
+	/* too short for the header */
+	ASSERT_THROW(ParseRaw(&request, header_size - 1), std::runtime_error);
+
+	/* missing null terminator */
+	ASSERT_THROW(ParseRaw(&request, header_size + 4), std::runtime_error);
+
+	/* trailing garbage */
+	ASSERT_THROW(ParseRaw(&request, header_size + 6), std::runtime_error);
+
+	/* refers to a file descriptor which was not sent */
+	request.fds[1] = 0;
+	ASSERT_THROW(ParseRaw(&request, header_size + 5), std::runtime_error);
+	request.fds[1] = 0xff;
+
+	/* no arguments */
+	request.n_args = 0;
+	ASSERT_THROW(ParseRaw(&request, header_size), std::runtime_error);
+	request.n_env = 1;
+	ASSERT_THROW(ParseRaw(&request, header_size + 5), std::runtime_error);
+}
+
+static std::string
+MakeKey(const PreparedChildProcess &p)
+{
+	std::unique_ptr<char[]> buffer(new char[ZYGOTE_KEY_BUFFER_SIZE]);
+	return MakeZygoteKey(p, buffer.get(), ZYGOTE_KEY_BUFFER_SIZE);
+}
+
+template<typename F>
+static std::string
+MakeKeyWith(F &&f)
+{
+	PreparedChildProcess p;
+	p.Append("true");
+	f(p);
+	return MakeKey(p);
+}
+
+TEST(Zygote, Key)
+{
+	const auto base = MakeKeyWith([](PreparedChildProcess &){});
+
+	/* arguments, environment and file descriptors are sent with
+	   each request */
+	ASSERT_EQ(MakeKeyWith([](PreparedChildProcess &p){
+				p.Append("foo");
+				p.SetEnv("A", "1");
+				p.SetStdin(OpenDevNull());
+			}), base);
+
+	const auto umask = MakeKeyWith([](PreparedChildProcess &p){ p.umask = 022; });
+	const auto chroot = MakeKeyWith([](PreparedChildProcess &p){ p.chroot = "/tmp"; });
+	const auto chdir = MakeKeyWith([](PreparedChildProcess &p){ p.chdir = "/tmp"; });
+	const auto nnp = MakeKeyWith([](PreparedChildProcess &p){ p.no_new_privs = true; });
+	const auto cgroup = MakeKeyWith([](PreparedChildProcess &p){ p.cgroup.name = "foo"; });
+	const auto uns = MakeKeyWith([](PreparedChildProcess &p){ p.ns.enable_user = true; });
+	const auto uid = MakeKeyWith([](PreparedChildProcess &p){ p.uid_gid.uid = 1000; });
+
+	const std::string keys[] = {
+		base, umask, chroot, chdir, nnp, cgroup, uns, uid,
+	};
+
+	for (const auto &i : keys) {
+		for (const auto &j : keys) {
+			if (&i != &j) {
+				ASSERT_NE(i, j);
+			}
+		}
+	}
+
+	/* the same settings yield the same key */
+	ASSERT_EQ(MakeKeyWith([](PreparedChildProcess &p){ p.chroot = "/tmp"; }),
+		  chroot);
+}
+
+TEST(Zygote, KeyOverflow)
+{
+	PreparedChildProcess p;
+	p.Append("true");
+
+	const std::string huge(ZYGOTE_KEY_BUFFER_SIZE, 'x');
+	p.chdir = huge.c_str();
+	ASSERT_THROW(MakeKey(p), std::runtime_error);
+
+	/* a small buffer is not overrun either */
+	p.chdir = "/tmp";
+	char small[8];
+	ASSERT_THROW(MakeZygoteKey(p, small, sizeof(small)),
+		     std::runtime_error);
+}
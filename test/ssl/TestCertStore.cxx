@@ -0,0 +1,238 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ssl/CertStore.hxx"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <stdexcept>
+
+#include <openssl/ssl.h>
+
+/**
+ * Creates an empty SSL_CTX for each id and remembers which one
+ * belongs to which id.
+ */
+class FakeCertLoader final : public SslCertLoader {
+	std::map<std::string, SSL_CTX *> loaded;
+
+public:
+	unsigned n_loads = 0;
+
+	/**
+	 * Return the SSL_CTX which was loaded for the given id, or
+	 * nullptr if it was never loaded.
+	 */
+	SSL_CTX *Get(const std::string &id) const noexcept {
+		auto i = loaded.find(id);
+		return i != loaded.end() ? i->second : nullptr;
+	}
+
+	/* virtual methods from SslCertLoader */
+	SSL_CTX *LoadCertificate(const std::string &id) override {
+		if (id == "broken")
+			throw std::runtime_error("Broken certificate");
+
+		SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+		if (ctx == nullptr)
+			throw std::runtime_error("SSL_CTX_new() failed");
+
+		++n_loads;
+		loaded[id] = ctx;
+		return ctx;
+	}
+};
+
+/**
+ * Look up the host name and return the id of the certificate which
+ * was found, or an empty string if there was none.
+ */
+static std::string
+FindId(SslCertStore &store, const FakeCertLoader &loader,
+       const char *host_name)
+{
+	SSL_CTX *ctx = store.Find(host_name);
+	if (ctx == nullptr)
+		return {};
+
+	for (const char *id : {"exact", "wildcard", "sub", "deep", "other"})
+		if (loader.Get(id) == ctx)
+			return id;
+
+	return "?";
+}
+
+TEST(SslCertStore, Empty)
+{
+	FakeCertLoader loader;
+	SslCertStore store(loader);
+
+	ASSERT_EQ(store.Find("example.com"), nullptr);
+
+	store.Commit(SslCertStore::Builder());
+	ASSERT_EQ(store.Find("example.com"), nullptr);
+	ASSERT_EQ(store.Find(""), nullptr);
+	ASSERT_EQ(loader.n_loads, 0u);
+}
+
+TEST(SslCertStore, Exact)
+{
+	FakeCertLoader loader;
+	SslCertStore store(loader);
+
+	SslCertStore::Builder builder;
+	builder.Add("exact", 1, {"www.example.com", "example.com"});
+	builder.Add("other", 1, {"example.org"});
+	store.Commit(std::move(builder));
+
+	/* certificates are loaded on demand */
+	ASSERT_EQ(loader.n_loads, 0u);
+
+	ASSERT_EQ(FindId(store, loader, "www.example.com"), "exact");
+	ASSERT_EQ(FindId(store, loader, "example.com"), "exact");
+	ASSERT_EQ(FindId(store, loader, "example.org"), "other");
+	ASSERT_EQ(loader.n_loads, 2u);
+
+	/* host names are case-insensitive */
+	ASSERT_EQ(FindId(store, loader, "WWW.Example.COM"), "exact");
+
+	/* no partial matches */
+	ASSERT_EQ(FindId(store, loader, "com"), "");
+	ASSERT_EQ(FindId(store, loader, "foo.example.com"), "");
+	ASSERT_EQ(FindId(store, loader, "www.example.com.evil"), "");
+	ASSERT_EQ(FindId(store, loader, "wwwexample.com"), "");
+	ASSERT_EQ(FindId(store, loader, "example.net"), "");
+
+	/* each certificate is loaded only once */
+	ASSERT_EQ(loader.n_loads, 2u);
+}
+
+TEST(SslCertStore, Wildcard)
+{
+	FakeCertLoader loader;
+	SslCertStore store(loader);
+
+	SslCertStore::Builder builder;
+	builder.Add("wildcard", 1, {"*.example.com"});
+	store.Commit(std::move(builder));
+
+	ASSERT_EQ(FindId(store, loader, "foo.example.com"), "wildcard");
+	ASSERT_EQ(FindId(store, loader, "BAR.example.com"), "wildcard");
+
+	/* a wildcard matches exactly one label */
+	ASSERT_EQ(FindId(store, loader, "example.com"), "");
+	ASSERT_EQ(FindId(store, loader, "a.b.example.com"), "");
+	ASSERT_EQ(FindId(store, loader, "foo.example.org"), "");
+}
+
+TEST(SslCertStore, LongestMatch)
+{
+	FakeCertLoader loader;
+	SslCertStore store(loader);
+
+	SslCertStore::Builder builder;
+	builder.Add("wildcard", 1, {"*.example.com"});
+	builder.Add("exact", 1, {"www.example.com", "example.com"});
+	builder.Add("sub", 1, {"*.sub.example.com"});
+	builder.Add("deep", 1, {"a.b.c.example.com"});
+	store.Commit(std::move(builder));
+
+	/* an exact name wins over a wildcard */
+	ASSERT_EQ(FindId(store, loader, "www.example.com"), "exact");
+	ASSERT_EQ(FindId(store, loader, "example.com"), "exact");
+	ASSERT_EQ(FindId(store, loader, "mail.example.com"), "wildcard");
+
+	/* the more specific wildcard wins */
+	ASSERT_EQ(FindId(store, loader, "foo.sub.example.com"), "sub");
+	ASSERT_EQ(FindId(store, loader, "sub.example.com"), "wildcard");
+	ASSERT_EQ(FindId(store, loader, "a.foo.sub.example.com"), "");
+
+	/* intermediate trie nodes without a certificate of their own
+	   fall back to the wildcard */
+	ASSERT_EQ(FindId(store, loader, "a.b.c.example.com"), "deep");
+	ASSERT_EQ(FindId(store, loader, "c.example.com"), "wildcard");
+	ASSERT_EQ(FindId(store, loader, "b.c.example.com"), "");
+	ASSERT_EQ(FindId(store, loader, "x.b.c.example.com"), "");
+}
+
+TEST(SslCertStore, Commit)
+{
+	FakeCertLoader loader;
+	SslCertStore store(loader);
+
+	SslCertStore::Builder builder;
+	builder.Add("exact", 1, {"example.com"});
+	builder.Add("other", 1, {"example.org"});
+	store.Commit(std::move(builder));
+
+	ASSERT_EQ(FindId(store, loader, "example.com"), "exact");
+	ASSERT_EQ(FindId(store, loader, "example.org"), "other");
+	ASSERT_EQ(loader.n_loads, 2u);
+
+	/* same stamp: the loaded SSL_CTX is reused; new stamp: it
+	   is loaded again */
+	SslCertStore::Builder builder2;
+	builder2.Add("exact", 1, {"example.com", "example.net"});
+	builder2.Add("other", 2, {"example.org"});
+	store.Commit(std::move(builder2));
+
+	ASSERT_EQ(FindId(store, loader, "example.com"), "exact");
+	ASSERT_EQ(FindId(store, loader, "example.net"), "exact");
+	ASSERT_EQ(loader.n_loads, 2u);
+	ASSERT_EQ(FindId(store, loader, "example.org"), "other");
+	ASSERT_EQ(loader.n_loads, 3u);
+
+	/* removed names disappear */
+	SslCertStore::Builder builder3;
+	builder3.Add("exact", 1, {"example.com"});
+	store.Commit(std::move(builder3));
+
+	ASSERT_EQ(FindId(store, loader, "example.com"), "exact");
+	ASSERT_EQ(FindId(store, loader, "example.net"), "");
+	ASSERT_EQ(FindId(store, loader, "example.org"), "");
+	ASSERT_EQ(loader.n_loads, 3u);
+}
+
+TEST(SslCertStore, LoadError)
+{
+	FakeCertLoader loader;
+	SslCertStore store(loader);
+
+	SslCertStore::Builder builder;
+	builder.Add("broken", 1, {"example.com"});
+	store.Commit(std::move(builder));
+
+	ASSERT_THROW(store.Find("example.com"), std::runtime_error);
+	ASSERT_EQ(store.Find("example.org"), nullptr);
+}
@@ -0,0 +1,378 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ssl/OcspStapler.hxx"
+#include "ssl/Dummy.hxx"
+#include "ssl/Edit.hxx"
+#include "ssl/Error.hxx"
+#include "ssl/Key.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <openssl/ocsp.h>
+
+#include <string>
+
+#include <limits.h>
+
+using std::chrono::seconds;
+
+namespace {
+
+static constexpr long NO_NEXT_UPDATE = LONG_MIN;
+
+/**
+ * A CA and a leaf certificate issued by it, with an OCSP responder
+ * URL.
+ */
+struct Pki {
+	UniqueEVP_PKEY ca_key = GenerateEcKey(NID_X9_62_prime256v1);
+	UniqueX509 ca = MakeSelfSignedDummyCert(*ca_key, "Test CA");
+
+	UniqueEVP_PKEY leaf_key = GenerateEcKey(NID_X9_62_prime256v1);
+	UniqueX509 leaf = MakeLeaf(2, "OCSP;URI:http://ocsp.example.com/");
+
+	UniqueX509 MakeLeaf(long serial, const char *aia) {
+		UniqueX509 cert(X509_new());
+		if (cert == nullptr)
+			throw SslError("X509_new() failed");
+
+		X509_NAME_add_entry_by_NID(X509_get_subject_name(cert.get()),
+					   NID_commonName, MBSTRING_ASC,
+					   (unsigned char *)const_cast<char *>("leaf"),
+					   -1, -1, 0);
+		X509_set_issuer_name(cert.get(),
+				     X509_get_subject_name(ca.get()));
+		X509_set_version(cert.get(), 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), serial);
+		X509_gmtime_adj(X509_get_notBefore(cert.get()), 0);
+		X509_gmtime_adj(X509_get_notAfter(cert.get()), 60 * 60);
+		X509_set_pubkey(cert.get(), leaf_key.get());
+
+		if (aia != nullptr)
+			AddExt(*cert, NID_info_access, aia);
+
+		if (!X509_sign(cert.get(), ca_key.get(), EVP_sha256()))
+			throw SslError("X509_sign() failed");
+
+		return cert;
+	}
+};
+
+/**
+ * Build a DER-encoded OCSP response with status "good" for the given
+ * certificate.
+ *
+ * @param next_update the nextUpdate field relative to now (in
+ * seconds), or #NO_NEXT_UPDATE to omit it
+ */
+static std::string
+MakeResponse(X509 &cert, X509 &issuer, X509 &signer, EVP_PKEY &signer_key,
+	     long next_update, long this_update=0)
+{
+	OCSP_BASICRESP *basic = OCSP_BASICRESP_new();
+	OCSP_CERTID *id = OCSP_cert_to_id(nullptr, &cert, &issuer);
+	ASN1_TIME *this_time = X509_gmtime_adj(nullptr, this_update);
+	ASN1_TIME *next_time = next_update != NO_NEXT_UPDATE
+		? X509_gmtime_adj(nullptr, next_update)
+		: nullptr;
+
+	if (OCSP_basic_add1_status(basic, id, V_OCSP_CERTSTATUS_GOOD, 0,
+				   nullptr, this_time, next_time) == nullptr ||
+	    !OCSP_basic_sign(basic, &signer, &signer_key, EVP_sha256(),
+			     nullptr, 0))
+		throw SslError("Failed to build OCSP response");
+
+	ASN1_TIME_free(next_time);
+	ASN1_TIME_free(this_time);
+	OCSP_CERTID_free(id);
+
+	OCSP_RESPONSE *response =
+		OCSP_response_create(OCSP_RESPONSE_STATUS_SUCCESSFUL, basic);
+	OCSP_BASICRESP_free(basic);
+
+	std::string result(i2d_OCSP_RESPONSE(response, nullptr), '\0');
+	unsigned char *p = (unsigned char *)&result.front();
+	i2d_OCSP_RESPONSE(response, &p);
+	OCSP_RESPONSE_free(response);
+	return result;
+}
+
+static std::string
+MakeResponse(Pki &pki, long next_update, long this_update=0)
+{
+	return MakeResponse(*pki.leaf, *pki.ca, *pki.ca, *pki.ca_key,
+			    next_update, this_update);
+}
+
+static ConstBuffer<void>
+ToBuffer(const std::string &s) noexcept
+{
+	return {s.data(), s.size()};
+}
+
+/**
+ * Collect the one due request.
+ */
+static SslOcspStapler::Request
+CollectOne(SslOcspStapler &stapler)
+{
+	auto requests = stapler.CollectDue(SslOcspStapler::Clock::now(), 16);
+	EXPECT_EQ(requests.size(), 1u);
+	if (requests.empty())
+		throw std::runtime_error("No request");
+
+	return std::move(requests.front());
+}
+
+/**
+ * Feed the response into the #SslOcspStapler and return how far
+ * in the future the next refresh was scheduled.
+ */
+static seconds
+Respond(SslOcspStapler &stapler, const SslOcspStapler::Key &key,
+	const std::string &response)
+{
+	const auto now = SslOcspStapler::Clock::now();
+	stapler.OnResponse(key, ToBuffer(response));
+	return std::chrono::duration_cast<seconds>(stapler.GetNextRefresh() - now);
+}
+
+}
+
+TEST(SslOcspStapler, Add)
+{
+	Pki pki;
+	SslOcspStapler stapler;
+
+	EXPECT_EQ(stapler.GetNextRefresh(),
+		  SslOcspStapler::Clock::time_point::max());
+
+	/* no OCSP responder URL */
+	auto plain = pki.MakeLeaf(3, nullptr);
+	EXPECT_FALSE(stapler.Add(*plain, *pki.ca));
+
+	EXPECT_TRUE(stapler.Add(*pki.leaf, *pki.ca));
+	EXPECT_LE(stapler.GetNextRefresh(), SslOcspStapler::Clock::now());
+	EXPECT_TRUE(stapler.Get(*pki.leaf).empty());
+}
+
+TEST(SslOcspStapler, Request)
+{
+	Pki pki;
+	SslOcspStapler stapler;
+	ASSERT_TRUE(stapler.Add(*pki.leaf, *pki.ca));
+
+	const auto request = CollectOne(stapler);
+	EXPECT_EQ(request.url, "http://ocsp.example.com/");
+
+	/* the body is an OCSP request for exactly this certificate */
+	const unsigned char *p = (const unsigned char *)request.body.data();
+	OCSP_REQUEST *req = d2i_OCSP_REQUEST(nullptr, &p, request.body.size());
+	ASSERT_NE(req, nullptr);
+	ASSERT_EQ(OCSP_request_onereq_count(req), 1);
+
+	OCSP_CERTID *id = OCSP_cert_to_id(nullptr, pki.leaf.get(), pki.ca.get());
+	EXPECT_EQ(OCSP_id_cmp(OCSP_onereq_get0_id(OCSP_request_onereq_get0(req, 0)),
+			      id), 0);
+	OCSP_CERTID_free(id);
+	OCSP_REQUEST_free(req);
+
+	/* while the request is in flight, it is not collected again */
+	EXPECT_TRUE(stapler.CollectDue(SslOcspStapler::Clock::now(),
+				       16).empty());
+	EXPECT_EQ(stapler.GetNextRefresh(),
+		  SslOcspStapler::Clock::time_point::max());
+}
+
+/**
+ * The same certificate in two X509 objects shares one cache item.
+ */
+TEST(SslOcspStapler, Shared)
+{
+	Pki pki;
+	UniqueX509 copy(X509_dup(pki.leaf.get()));
+
+	SslOcspStapler stapler;
+	ASSERT_TRUE(stapler.Add(*pki.leaf, *pki.ca));
+	ASSERT_TRUE(stapler.Add(*copy, *pki.ca));
+
+	const auto request = CollectOne(stapler);
+	const auto response = MakeResponse(pki, 1000);
+	Respond(stapler, request.key, response);
+
+	EXPECT_EQ(stapler.Get(*pki.leaf), response);
+	EXPECT_EQ(stapler.Get(*copy), response);
+}
+
+/**
+ * A valid response is stapled, and a refresh is scheduled after
+ * REFRESH_PERCENT of its lifetime.
+ */
+TEST(SslOcspStapler, Response)
+{
+	Pki pki;
+	SslOcspStapler stapler;
+	ASSERT_TRUE(stapler.Add(*pki.leaf, *pki.ca));
+
+	const auto request = CollectOne(stapler);
+	const auto response = MakeResponse(pki, 1000);
+	const auto refresh = Respond(stapler, request.key, response);
+
+	EXPECT_EQ(stapler.Get(*pki.leaf), response);
+
+	EXPECT_GE(refresh, seconds(498));
+	EXPECT_LE(refresh, seconds(500));
+
+	const auto now = SslOcspStapler::Clock::now();
+	EXPECT_TRUE(stapler.CollectDue(now + seconds(490), 16).empty());
+	EXPECT_EQ(stapler.CollectDue(now + seconds(510), 16).size(), 1u);
+}
+
+/**
+ * Without nextUpdate, the response is refreshed after
+ * REFRESH_PERCENT of one hour.
+ */
+TEST(SslOcspStapler, NoNextUpdate)
+{
+	Pki pki;
+	SslOcspStapler stapler;
+	ASSERT_TRUE(stapler.Add(*pki.leaf, *pki.ca));
+
+	const auto request = CollectOne(stapler);
+	const auto refresh = Respond(stapler, request.key,
+				     MakeResponse(pki, NO_NEXT_UPDATE));
+
+	EXPECT_GE(refresh, seconds(1798));
+	EXPECT_LE(refresh, seconds(1800));
+	EXPECT_FALSE(stapler.Get(*pki.leaf).empty());
+}
+
+/**
+ * Short-lived responses are not refreshed more often than once per
+ * minute.
+ */
+TEST(SslOcspStapler, MinRefresh)
+{
+	Pki pki;
+	SslOcspStapler stapler;
+	ASSERT_TRUE(stapler.Add(*pki.leaf, *pki.ca));
+
+	const auto request = CollectOne(stapler);
+	const auto refresh = Respond(stapler, request.key,
+				     MakeResponse(pki, 20));
+
+	EXPECT_GE(refresh, seconds(59));
+	EXPECT_LE(refresh, seconds(60));
+}
+
+/**
+ * A failed fetch is retried after RETRY_INTERVAL, and the previous
+ * response keeps being stapled.
+ */
+TEST(SslOcspStapler, Error)
+{
+	Pki pki;
+	SslOcspStapler stapler;
+	ASSERT_TRUE(stapler.Add(*pki.leaf, *pki.ca));
+
+	auto request = CollectOne(stapler);
+	const auto response = MakeResponse(pki, 1000);
+	Respond(stapler, request.key, response);
+
+	request = stapler.CollectDue(SslOcspStapler::Clock::now() + seconds(600),
+				     16).front();
+
+	const auto now = SslOcspStapler::Clock::now();
+	stapler.OnError(request.key);
+
+	const auto retry = stapler.GetNextRefresh() - now;
+	EXPECT_GE(retry, SslOcspStapler::RETRY_INTERVAL - seconds(1));
+	EXPECT_LE(retry, SslOcspStapler::RETRY_INTERVAL + seconds(1));
+
+	EXPECT_EQ(stapler.Get(*pki.leaf), response);
+}
+
+/**
+ * Invalid responses are rejected (and a retry is scheduled); they
+ * are never stapled.
+ */
+TEST(SslOcspStapler, Invalid)
+{
+	Pki pki;
+
+	auto evil_key = GenerateEcKey(NID_X9_62_prime256v1);
+	auto evil_ca = MakeSelfSignedDummyCert(*evil_key, "Evil CA");
+	auto other = pki.MakeLeaf(4, "OCSP;URI:http://ocsp.example.com/");
+
+	OCSP_RESPONSE *try_later =
+		OCSP_response_create(OCSP_RESPONSE_STATUS_TRYLATER, nullptr);
+	std::string try_later_der(i2d_OCSP_RESPONSE(try_later, nullptr), '\0');
+	unsigned char *p = (unsigned char *)&try_later_der.front();
+	i2d_OCSP_RESPONSE(try_later, &p);
+	OCSP_RESPONSE_free(try_later);
+
+	const std::string invalid[] = {
+		/* malformed */
+		"garbage",
+
+		/* responder error */
+		try_later_der,
+
+		/* not signed by the issuer */
+		MakeResponse(*pki.leaf, *pki.ca, *evil_ca, *evil_key, 1000),
+
+		/* for another certificate */
+		MakeResponse(*other, *pki.ca, *pki.ca, *pki.ca_key, 1000),
+
+		/* expired */
+		MakeResponse(pki, -600, -1800),
+	};
+
+	for (const auto &response : invalid) {
+		SslOcspStapler stapler;
+		ASSERT_TRUE(stapler.Add(*pki.leaf, *pki.ca));
+
+		const auto request = CollectOne(stapler);
+		const auto now = SslOcspStapler::Clock::now();
+		EXPECT_ANY_THROW(stapler.OnResponse(request.key,
+						    ToBuffer(response)));
+
+		EXPECT_TRUE(stapler.Get(*pki.leaf).empty());
+
+		const auto retry = stapler.GetNextRefresh() - now;
+		EXPECT_GE(retry, SslOcspStapler::RETRY_INTERVAL - seconds(1));
+		EXPECT_LE(retry, SslOcspStapler::RETRY_INTERVAL + seconds(1));
+	}
+}
@@ -0,0 +1,262 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ssl/SessionCache.hxx"
+#include "ssl/TicketKeys.hxx"
+#include "ssl/Ctx.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+struct SessionDelete {
+	void operator()(SSL_SESSION *session) noexcept {
+		SSL_SESSION_free(session);
+	}
+};
+
+using UniqueSession = std::unique_ptr<SSL_SESSION, SessionDelete>;
+
+/**
+ * i2d_SSL_SESSION() refuses sessions without a cipher; pick any
+ * one (from OpenSSL's static cipher table).
+ */
+static const SSL_CIPHER *
+GetCipher()
+{
+	const SslCtx ctx(TLS_method());
+	const auto *ciphers = SSL_CTX_get_ciphers(ctx.get());
+	if (ciphers == nullptr || sk_SSL_CIPHER_num(ciphers) == 0)
+		throw std::runtime_error("No ciphers");
+
+	return sk_SSL_CIPHER_value(ciphers, 0);
+}
+
+static UniqueSession
+MakeSession(const char *id)
+{
+	static const SSL_CIPHER *const cipher = GetCipher();
+	static constexpr unsigned char master_key[48] = {};
+
+	UniqueSession session(SSL_SESSION_new());
+	if (!session ||
+	    !SSL_SESSION_set1_id(session.get(), (const unsigned char *)id,
+				 strlen(id)) ||
+	    !SSL_SESSION_set_protocol_version(session.get(), TLS1_2_VERSION) ||
+	    !SSL_SESSION_set_cipher(session.get(), cipher) ||
+	    !SSL_SESSION_set1_master_key(session.get(), master_key,
+					 sizeof(master_key)))
+		throw std::runtime_error("Failed to create SSL_SESSION");
+	return session;
+}
+
+static std::string
+GetId(SSL_SESSION &session)
+{
+	unsigned length;
+	const unsigned char *id = SSL_SESSION_get_id(&session, &length);
+	return std::string((const char *)id, length);
+}
+
+TEST(SslSessionCache, AddGet)
+{
+	SslSessionCache cache;
+
+	ASSERT_EQ(cache.Get("foo", 3), nullptr);
+
+	ASSERT_TRUE(cache.Add(*MakeSession("foo")));
+	ASSERT_TRUE(cache.Add(*MakeSession("bar")));
+	ASSERT_EQ(cache.size(), 2u);
+
+	UniqueSession session(cache.Get("foo", 3));
+	ASSERT_NE(session, nullptr);
+	ASSERT_EQ(GetId(*session), "foo");
+
+	/* the cache returns a new copy each time */
+	UniqueSession session2(cache.Get("foo", 3));
+	ASSERT_NE(session2, nullptr);
+	ASSERT_NE(session2.get(), session.get());
+
+	ASSERT_EQ(cache.Get("baz", 3), nullptr);
+
+	/* adding the same id again replaces the old item */
+	ASSERT_TRUE(cache.Add(*MakeSession("foo")));
+	ASSERT_EQ(cache.size(), 2u);
+
+	cache.Remove("foo", 3);
+	ASSERT_EQ(cache.Get("foo", 3), nullptr);
+	ASSERT_EQ(cache.size(), 1u);
+
+	cache.Clear();
+	ASSERT_EQ(cache.Get("bar", 3), nullptr);
+	ASSERT_EQ(cache.size(), 0u);
+}
+
+TEST(SslSessionCache, Expire)
+{
+	/* with a zero lifetime, every item is expired right away */
+	SslSessionCache cache(std::chrono::seconds(0));
+
+	ASSERT_TRUE(cache.Add(*MakeSession("foo")));
+	ASSERT_TRUE(cache.Add(*MakeSession("bar")));
+	ASSERT_EQ(cache.size(), 2u);
+
+	/* Get() discards the expired item */
+	ASSERT_EQ(cache.Get("foo", 3), nullptr);
+	ASSERT_EQ(cache.size(), 1u);
+
+	cache.Expire();
+	ASSERT_EQ(cache.size(), 0u);
+}
+
+TEST(SslSessionCache, Evict)
+{
+	/* one item per shard */
+	SslSessionCache cache(std::chrono::minutes(5), 16);
+
+	for (unsigned i = 0; i < 100; ++i)
+		ASSERT_TRUE(cache.Add(*MakeSession(std::to_string(i).c_str())));
+
+	ASSERT_LE(cache.size(), 16u);
+
+	/* the newest item is always kept */
+	UniqueSession session(cache.Get("99", 2));
+	ASSERT_NE(session, nullptr);
+}
+
+static UniqueFileDescriptor
+CreateTemporaryFile()
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open("/tmp", O_TMPFILE|O_RDWR, 0600))
+		throw std::runtime_error("Failed to create temporary file");
+	return fd;
+}
+
+static size_t
+ReadKeys(FileDescriptor fd, SslTicketKey *keys)
+{
+	ssize_t nbytes = pread(fd.Get(), keys,
+			       SslTicketKeys::MAX_KEYS * sizeof(*keys), 0);
+	if (nbytes < 0 || nbytes % sizeof(*keys) != 0)
+		throw std::runtime_error("Failed to read ticket keys");
+	return nbytes / sizeof(*keys);
+}
+
+static bool
+operator==(const SslTicketKey &a, const SslTicketKey &b) noexcept
+{
+	return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+TEST(SslTicketKeys, Rotate)
+{
+	SslTicketKeys keys;
+	ASSERT_TRUE(keys.IsEmpty());
+
+	auto fd = CreateTemporaryFile();
+	SslTicketKey saved[SslTicketKeys::MAX_KEYS];
+
+	keys.Rotate();
+	ASSERT_FALSE(keys.IsEmpty());
+	keys.Save(fd.ToFileDescriptor());
+	ASSERT_EQ(ReadKeys(fd.ToFileDescriptor(), saved), 1u);
+	const SslTicketKey first = saved[0];
+
+	keys.Rotate();
+	keys.Save(fd.ToFileDescriptor());
+	ASSERT_EQ(ReadKeys(fd.ToFileDescriptor(), saved), 2u);
+
+	/* the new key comes first, the old one is still accepted */
+	ASSERT_FALSE(saved[0] == first);
+	ASSERT_TRUE(saved[1] == first);
+
+	/* rotate until the first key falls out of the ring */
+	for (size_t i = 2; i < SslTicketKeys::MAX_KEYS; ++i)
+		keys.Rotate();
+	keys.Save(fd.ToFileDescriptor());
+	ASSERT_EQ(ReadKeys(fd.ToFileDescriptor(), saved), SslTicketKeys::MAX_KEYS);
+	ASSERT_TRUE(saved[SslTicketKeys::MAX_KEYS - 1] == first);
+
+	const SslTicketKey newest = saved[0];
+
+	keys.Rotate();
+	keys.Save(fd.ToFileDescriptor());
+	ASSERT_EQ(ReadKeys(fd.ToFileDescriptor(), saved), SslTicketKeys::MAX_KEYS);
+	ASSERT_TRUE(saved[1] == newest);
+	for (const auto &i : saved)
+		ASSERT_FALSE(i == first);
+}
+
+TEST(SslTicketKeys, RotateIfDue)
+{
+	SslTicketKeys keys;
+
+	/* an empty ring is always due */
+	ASSERT_TRUE(keys.RotateIfDue(std::chrono::hours(1)));
+	ASSERT_FALSE(keys.RotateIfDue(std::chrono::hours(1)));
+	ASSERT_TRUE(keys.RotateIfDue(std::chrono::seconds(0)));
+}
+
+TEST(SslTicketKeys, SaveLoad)
+{
+	SslTicketKeys a;
+	a.Rotate();
+	a.Rotate();
+
+	auto fd = CreateTemporaryFile();
+	a.Save(fd.ToFileDescriptor());
+
+	SslTicketKeys b;
+	b.Load(fd.ToFileDescriptor());
+	ASSERT_FALSE(b.IsEmpty());
+
+	auto fd2 = CreateTemporaryFile();
+	b.Save(fd2.ToFileDescriptor());
+
+	SslTicketKey saved_a[SslTicketKeys::MAX_KEYS];
+	SslTicketKey saved_b[SslTicketKeys::MAX_KEYS];
+	ASSERT_EQ(ReadKeys(fd.ToFileDescriptor(), saved_a), 2u);
+	ASSERT_EQ(ReadKeys(fd2.ToFileDescriptor(), saved_b), 2u);
+	ASSERT_TRUE(saved_a[0] == saved_b[0]);
+	ASSERT_TRUE(saved_a[1] == saved_b[1]);
+
+	/* an empty file is rejected */
+	auto empty = CreateTemporaryFile();
+	ASSERT_THROW(b.Load(empty.ToFileDescriptor()), std::runtime_error);
+}
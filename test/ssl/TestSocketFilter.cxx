@@ -0,0 +1,344 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/ssl/SocketFilter.hxx"
+#include "event/net/BufferedSocket.hxx"
+#include "event/WorkerPool.hxx"
+#include "event/Loop.hxx"
+#include "ssl/Ctx.hxx"
+#include "ssl/Dummy.hxx"
+#include "ssl/Key.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <gtest/gtest.h>
+
+#include <openssl/obj_mac.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include <sys/socket.h>
+
+static SslCtx
+MakeServerCtx()
+{
+	auto key = GenerateEcKey(NID_X9_62_prime256v1);
+	auto cert = MakeSelfSignedDummyCert(*key, "localhost");
+
+	SslCtx ctx(TLS_server_method());
+	if (SSL_CTX_use_certificate(ctx.get(), cert.get()) != 1 ||
+	    SSL_CTX_use_PrivateKey(ctx.get(), key.get()) != 1)
+		throw SslError("Failed to set up the server certificate");
+
+	return ctx;
+}
+
+static UniqueSSL
+MakeSSL(const SslCtx &ctx, bool server)
+{
+	UniqueSSL ssl(SSL_new(ctx.get()));
+	if (!ssl)
+		throw SslError("SSL_new() failed");
+
+	if (server)
+		SSL_set_accept_state(ssl.get());
+	else
+		SSL_set_connect_state(ssl.get());
+
+	return ssl;
+}
+
+static std::string
+MakeData(size_t size, char seed)
+{
+	std::string data;
+	data.reserve(size);
+	for (size_t i = 0; i < size; ++i)
+		data.push_back(char(seed + i % 61));
+	return data;
+}
+
+/**
+ * One end of a TLS connection: it sends #output in chunks of at most
+ * #chunk_size bytes with BufferedSocket::Write() and collects
+ * everything it receives in #input.
+ */
+class Peer final : BufferedSocketHandler {
+	EventLoop &event_loop;
+
+	BufferedSocket socket;
+
+	std::string output;
+	size_t output_position = 0;
+	size_t chunk_size = 0;
+
+	/**
+	 * Break the #EventLoop as soon as this number of bytes has
+	 * been received.
+	 */
+	size_t expected = 0;
+
+public:
+	std::string input;
+
+	std::exception_ptr error;
+
+	bool end = false;
+
+	Peer(EventLoop &_event_loop, UniqueSocketDescriptor &&fd,
+	     UniqueSSL &&ssl, WorkerPool *worker_pool)
+		:event_loop(_event_loop), socket(event_loop)
+	{
+		socket.Init(fd.Release(), FdType::FD_SOCKET,
+			    nullptr, nullptr, *this);
+		socket.SetFilter(std::make_unique<SslSocketFilter>(event_loop,
+								   std::move(ssl),
+								   worker_pool));
+		socket.ScheduleReadNoTimeout(false);
+	}
+
+	~Peer() noexcept {
+		if (socket.IsConnected())
+			socket.Close();
+		socket.Destroy();
+	}
+
+	bool IsHandshakeDone() const noexcept {
+		return static_cast<const SslSocketFilter *>(socket.GetFilter())
+			->IsHandshakeDone();
+	}
+
+	bool IsDone() const noexcept {
+		return error || input.size() >= expected;
+	}
+
+	void Send(std::string &&_output, size_t _chunk_size) noexcept {
+		output = std::move(_output);
+		output_position = 0;
+		chunk_size = _chunk_size;
+		socket.ScheduleWrite();
+	}
+
+	void Expect(size_t _expected) noexcept {
+		input.clear();
+		expected = _expected;
+	}
+
+	/**
+	 * Send "close_notify" and close the socket.
+	 */
+	void Close() noexcept {
+		socket.Shutdown();
+		socket.Close();
+	}
+
+private:
+	/* virtual methods from class BufferedSocketHandler */
+	BufferedResult OnBufferedData() override {
+		const auto r = socket.ReadBuffer();
+		input.append((const char *)r.data, r.size);
+		socket.Consumed(r.size);
+
+		if (input.size() == expected)
+			event_loop.Break();
+
+		return BufferedResult::OK;
+	}
+
+	bool OnBufferedClosed() noexcept override {
+		socket.Close();
+		return true;
+	}
+
+	bool OnBufferedEnd() noexcept override {
+		end = true;
+		event_loop.Break();
+		return true;
+	}
+
+	bool OnBufferedWrite() override {
+		const size_t length = std::min(output.size() - output_position,
+					       chunk_size);
+		ssize_t nbytes = socket.Write(output.data() + output_position,
+					      length);
+		if (nbytes > 0) {
+			output_position += nbytes;
+			if (output_position == output.size())
+				socket.UnscheduleWrite();
+			else
+				socket.ScheduleWrite();
+			return true;
+		}
+
+		switch (nbytes) {
+		case WRITE_BLOCKING:
+			return true;
+
+		case WRITE_DESTROYED:
+			return false;
+
+		default:
+			throw MakeErrno("Write failed");
+		}
+	}
+
+	void OnBufferedError(std::exception_ptr e) noexcept override {
+		error = e;
+		if (socket.IsConnected())
+			socket.Close();
+		event_loop.Break();
+	}
+};
+
+struct Connection {
+	Peer server, client;
+
+	Connection(EventLoop &event_loop, WorkerPool *worker_pool)
+		:Connection(event_loop, worker_pool, MakeSocketPair()) {}
+
+private:
+	struct SocketPair {
+		UniqueSocketDescriptor server, client;
+	};
+
+	static SocketPair MakeSocketPair() {
+		SocketPair p;
+		if (!UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL,
+								       SOCK_STREAM,
+								       0,
+								       p.server,
+								       p.client))
+			throw MakeErrno("socketpair() failed");
+		return p;
+	}
+
+	Connection(EventLoop &event_loop, WorkerPool *worker_pool,
+		   SocketPair &&p)
+		:server(event_loop, std::move(p.server),
+			MakeSSL(GetServerCtx(), true), worker_pool),
+		 client(event_loop, std::move(p.client),
+			MakeSSL(GetClientCtx(), false), nullptr) {}
+
+	static const SslCtx &GetServerCtx() {
+		static const SslCtx ctx = MakeServerCtx();
+		return ctx;
+	}
+
+	static const SslCtx &GetClientCtx() {
+		static const SslCtx ctx(TLS_client_method());
+		return ctx;
+	}
+};
+
+static void
+RoundTrip(EventLoop &event_loop, Connection &c,
+	  size_t size, size_t chunk_size)
+{
+	const auto request = MakeData(size, 'A');
+	const auto response = MakeData(size, 'a');
+
+	c.client.Send(std::string(request), chunk_size);
+	c.client.Expect(response.size());
+	c.server.Send(std::string(response), chunk_size);
+	c.server.Expect(request.size());
+
+	while (!c.client.IsDone() || !c.server.IsDone())
+		event_loop.Dispatch();
+
+	ASSERT_FALSE(c.client.error);
+	ASSERT_FALSE(c.server.error);
+	EXPECT_TRUE(c.client.IsHandshakeDone());
+	EXPECT_TRUE(c.server.IsHandshakeDone());
+	EXPECT_EQ(c.server.input, request);
+	EXPECT_EQ(c.client.input, response);
+}
+
+static void
+PeerClose(EventLoop &event_loop, Connection &c)
+{
+	c.client.Close();
+
+	while (!c.server.end && !c.server.error)
+		event_loop.Dispatch();
+
+	EXPECT_FALSE(c.server.error);
+	EXPECT_TRUE(c.server.end);
+}
+
+static void
+TestSocketFilter(WorkerPool *worker_pool)
+{
+	EventLoop event_loop;
+	Connection c(event_loop, worker_pool);
+
+	/* small writes: many tiny records */
+	RoundTrip(event_loop, c, 1000, 7);
+
+	/* large writes: more than fits into the BIO pair and the
+	   socket buffer at once */
+	RoundTrip(event_loop, c, 4 * 1024 * 1024, 1024 * 1024);
+
+	PeerClose(event_loop, c);
+}
+
+TEST(SslSocketFilter, Inline)
+{
+	TestSocketFilter(nullptr);
+}
+
+TEST(SslSocketFilter, Offloaded)
+{
+	WorkerPool worker_pool(2);
+	TestSocketFilter(&worker_pool);
+}
+
+TEST(SslSocketFilter, PeerCloseDuringHandshake)
+{
+	WorkerPool worker_pool(1);
+	EventLoop event_loop;
+	Connection c(event_loop, &worker_pool);
+
+	/* kick off the handshake, then give up */
+	c.client.Send("x", 1);
+	c.client.Expect(1);
+	event_loop.LoopOnceNonBlock();
+	c.client.Close();
+
+	while (!c.server.end && !c.server.error)
+		event_loop.Dispatch();
+
+	/* the server sees the connection end (or fail), and it
+	   never completes the handshake */
+	EXPECT_FALSE(c.server.IsHandshakeDone());
+}
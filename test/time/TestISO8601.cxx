@@ -0,0 +1,109 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "time/ISO8601.hxx"
+#include "time/UtcFormatter.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include <time.h>
+
+static std::string
+StrftimeISO8601(time_t t)
+{
+	struct tm tm;
+	gmtime_r(&t, &tm);
+
+	char buffer[64];
+	strftime(buffer, sizeof(buffer), "%FT%TZ", &tm);
+	return buffer;
+}
+
+TEST(ISO8601, CivilDays)
+{
+	EXPECT_EQ(DaysFromCivil(1970, 1, 1), 0);
+	EXPECT_EQ(DaysFromCivil(2000, 3, 1), 11017);
+	EXPECT_EQ(DaysFromCivil(1969, 12, 31), -1);
+
+	for (int64_t day = -800000; day < 800000; day += 37) {
+		const auto c = CivilFromDays(day);
+		EXPECT_EQ(DaysFromCivil(c.year, c.month, c.day), day);
+	}
+}
+
+TEST(ISO8601, Format)
+{
+	EXPECT_EQ(FormatISO8601(std::chrono::system_clock::from_time_t(0)),
+		  "1970-01-01T00:00:00Z");
+	EXPECT_EQ(FormatISO8601(std::chrono::system_clock::from_time_t(1234567890)),
+		  "2009-02-13T23:31:30Z");
+
+	/* fractional seconds are truncated, also before 1970 */
+	EXPECT_EQ(FormatISO8601(std::chrono::system_clock::from_time_t(1234567890)
+				+ std::chrono::milliseconds(999)),
+		  "2009-02-13T23:31:30Z");
+	EXPECT_EQ(FormatISO8601(std::chrono::system_clock::from_time_t(0)
+				- std::chrono::milliseconds(1)),
+		  "1969-12-31T23:59:59Z");
+
+	/* compare with strftime(), crossing many day boundaries */
+	for (time_t t = -2208988800; t < 4102444800; t += 86399 * 13 + 7)
+		EXPECT_EQ(FormatISO8601(std::chrono::system_clock::from_time_t(t)),
+			  StrftimeISO8601(t));
+}
+
+TEST(ISO8601, Parse)
+{
+	EXPECT_EQ(ParseISO8601("1970-01-01T00:00:00Z"),
+		  std::chrono::system_clock::from_time_t(0));
+	EXPECT_EQ(ParseISO8601("2009-02-13T23:31:30Z"),
+		  std::chrono::system_clock::from_time_t(1234567890));
+	EXPECT_EQ(ParseISO8601("1969-12-31T23:59:59Z"),
+		  std::chrono::system_clock::from_time_t(-1));
+	EXPECT_EQ(ParseISO8601("2016-02-29T12:00:00Z"),
+		  std::chrono::system_clock::from_time_t(1456747200));
+
+	/* round trip */
+	for (time_t t = -2208988800; t < 4102444800; t += 86399 * 13 + 7) {
+		const auto tp = std::chrono::system_clock::from_time_t(t);
+		EXPECT_EQ(ParseISO8601(FormatISO8601(tp).c_str()), tp);
+	}
+
+	EXPECT_THROW(ParseISO8601(""), std::runtime_error);
+	EXPECT_THROW(ParseISO8601("2009-02-13"), std::runtime_error);
+	EXPECT_THROW(ParseISO8601("2009-02-13T23:31:30Zfoo"),
+		     std::runtime_error);
+	EXPECT_THROW(ParseISO8601("2009-13-13T23:31:30Z"),
+		     std::runtime_error);
+}
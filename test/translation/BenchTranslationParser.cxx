@@ -0,0 +1,307 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Replay recorded BEGIN..END response streams through
+ * #TranslatePacketReader and #TranslateParser.
+ *
+ * Besides the time per packet, each benchmark reports the number of
+ * allocations and the number of bytes allocated per response.
+ * Streams which use packets not enabled in this build are skipped.
+ */
+
+#include "translation/Parser.hxx"
+#include "translation/Protocol.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include <stdint.h>
+#include <string.h>
+
+struct RecordedStream {
+    std::string data;
+    unsigned n_packets = 0;
+
+    RecordedStream &Append(TranslationCommand command,
+                           const void *payload, size_t length) {
+        TranslationHeader header;
+        header.length = length;
+        header.command = command;
+        data.append((const char *)&header, sizeof(header));
+        data.append((const char *)payload, length);
+        ++n_packets;
+        return *this;
+    }
+
+    RecordedStream &Append(TranslationCommand command,
+                           const char *payload="") {
+        return Append(command, payload, strlen(payload));
+    }
+
+    /**
+     * Append a packet with two null-separated strings, e.g. for
+     * #TranslationCommand::BIND_MOUNT.
+     */
+    RecordedStream &AppendPair(TranslationCommand command,
+                               const std::string &a, const std::string &b) {
+        std::string payload(a);
+        payload.push_back('\0');
+        payload.append(b);
+        return Append(command, payload.data(), payload.size());
+    }
+
+    RecordedStream &AppendUint32(TranslationCommand command,
+                                 uint32_t value) {
+        return Append(command, &value, sizeof(value));
+    }
+};
+
+/**
+ * A typical static file response.
+ */
+static RecordedStream
+MakeFileStream()
+{
+    RecordedStream s;
+    s.Append(TranslationCommand::BEGIN, "\x03", 1);
+    s.AppendUint32(TranslationCommand::MAX_AGE, 300);
+    s.Append(TranslationCommand::SITE, "www.example.com");
+    s.Append(TranslationCommand::CANONICAL_HOST, "www.example.com");
+    s.Append(TranslationCommand::POOL, "static");
+    s.Append(TranslationCommand::TOKEN, "6f1b2c3d4e5f");
+    s.Append(TranslationCommand::TEST_PATH, "/var/www/example.com/htdocs/index.html");
+    s.Append(TranslationCommand::EXPIRES_RELATIVE, "\x10\x0e\x00\x00", 4);
+    s.Append(TranslationCommand::AUTO_GZIPPED);
+    s.Append(TranslationCommand::AUTO_DEFLATE);
+    s.Append(TranslationCommand::END);
+    return s;
+}
+
+/**
+ * A JailCGI response with a large mount namespace.
+ */
+static RecordedStream
+MakeJailStream()
+{
+    RecordedStream s;
+    s.Append(TranslationCommand::BEGIN, "\x03", 1);
+    s.Append(TranslationCommand::SITE, "www.example.com");
+    s.Append(TranslationCommand::DOCUMENT_ROOT, "/var/www/example.com/htdocs");
+    s.Append(TranslationCommand::CGI, "/var/www/example.com/htdocs/index.cgi");
+    s.Append(TranslationCommand::JAILCGI);
+    s.Append(TranslationCommand::USER_NAMESPACE);
+    s.Append(TranslationCommand::PID_NAMESPACE);
+    s.Append(TranslationCommand::NETWORK_NAMESPACE);
+    s.Append(TranslationCommand::PIVOT_ROOT, "/srv/jail");
+    s.Append(TranslationCommand::MOUNT_PROC);
+    s.Append(TranslationCommand::MOUNT_TMP_TMPFS);
+    s.Append(TranslationCommand::HOME, "/var/www/example.com");
+    s.Append(TranslationCommand::MOUNT_HOME, "/home");
+
+    static constexpr const char *mounts[] = {
+        "/usr/bin", "/usr/lib", "/usr/share", "/usr/local/bin",
+        "/usr/local/lib", "/usr/local/share", "/etc/ssl", "/etc/alternatives",
+    };
+
+    for (unsigned i = 0; i < 4; ++i)
+        for (const char *m : mounts)
+            s.AppendPair(TranslationCommand::BIND_MOUNT,
+                         std::string(m) + "/" + std::to_string(i),
+                         std::string(m) + "/" + std::to_string(i));
+
+    for (unsigned i = 0; i < 16; ++i)
+        s.Append(TranslationCommand::SETENV,
+                 ("VAR" + std::to_string(i) + "=value").c_str());
+
+    s.Append(TranslationCommand::RLIMITS, "t60");
+    s.Append(TranslationCommand::STDERR_PATH, "/var/log/example.com/cgi.log");
+    s.Append(TranslationCommand::END);
+    return s;
+}
+
+/**
+ * A widget response with several views.
+ */
+static RecordedStream
+MakeWidgetStream()
+{
+    RecordedStream s;
+    s.Append(TranslationCommand::BEGIN, "\x03", 1);
+    s.AppendUint32(TranslationCommand::MAX_AGE, 60);
+    s.Append(TranslationCommand::WIDGET_INFO);
+    s.Append(TranslationCommand::WIDGET_GROUP, "portal");
+    s.Append(TranslationCommand::HTTP, "http://backend.example.com/widget/");
+    s.Append(TranslationCommand::PROCESS);
+    s.Append(TranslationCommand::CONTAINER);
+
+    static constexpr const char *views[] = {
+        "edit", "preview", "raw", "compact",
+    };
+
+    for (const char *v : views) {
+        s.Append(TranslationCommand::VIEW, v);
+        s.Append(TranslationCommand::HTTP,
+                 (std::string("http://backend.example.com/widget/") + v).c_str());
+        s.Append(TranslationCommand::PROCESS);
+    }
+
+    s.Append(TranslationCommand::END);
+    return s;
+}
+
+static const RecordedStream file_stream = MakeFileStream();
+static const RecordedStream jail_stream = MakeJailStream();
+static const RecordedStream widget_stream = MakeWidgetStream();
+
+#if TRANSLATION_ENABLE_RADDRESS || TRANSLATION_ENABLE_HTTP || TRANSLATION_ENABLE_WANT
+static const TranslateRequest dummy_request;
+#endif
+
+/**
+ * Feed one complete response into a new #TranslateParser.
+ *
+ * Throws on error.
+ */
+template<bool pinned>
+static void
+ParseResponse(Allocator &alloc, uint8_t *data, size_t length)
+{
+    TranslateParser parser(alloc
+#if TRANSLATION_ENABLE_RADDRESS || TRANSLATION_ENABLE_HTTP || TRANSLATION_ENABLE_WANT
+                           , dummy_request
+#endif
+                           );
+
+    while (true) {
+        size_t nbytes = pinned
+            ? parser.FeedPinned(data, length)
+            : parser.Feed(data, length);
+        data += nbytes;
+        length -= nbytes;
+
+        if (parser.Process() == TranslateParser::Result::DONE)
+            break;
+
+        if (nbytes == 0)
+            throw std::runtime_error("premature end of stream");
+    }
+
+    benchmark::DoNotOptimize(parser.GetResponse());
+}
+
+template<bool pinned>
+static void
+BenchReplay(benchmark::State &state, const RecordedStream &stream)
+{
+    /* FeedPinned() needs a writable buffer; Feed() does not care */
+    std::string buffer(stream.data);
+    uint8_t *data = (uint8_t *)&buffer.front();
+
+    Allocator alloc;
+
+    try {
+        ParseResponse<pinned>(alloc, data, buffer.size());
+    } catch (const std::exception &e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    alloc.Clear();
+    const auto before = alloc.GetStats();
+
+    for (auto _ : state) {
+        if (pinned)
+            memcpy(data, stream.data.data(), buffer.size());
+
+        ParseResponse<pinned>(alloc, data, buffer.size());
+        alloc.Clear();
+    }
+
+    const auto &after = alloc.GetStats();
+
+    state.SetItemsProcessed(state.iterations() * stream.n_packets);
+    state.SetBytesProcessed(state.iterations() * stream.data.size());
+    state.counters["allocs/response"] =
+        benchmark::Counter(after.n_allocations - before.n_allocations,
+                           benchmark::Counter::kAvgIterations);
+    state.counters["bytes/response"] =
+        benchmark::Counter(after.n_bytes - before.n_bytes,
+                           benchmark::Counter::kAvgIterations);
+}
+
+static void
+BenchFile(benchmark::State &state)
+{
+    BenchReplay<false>(state, file_stream);
+}
+
+static void
+BenchFilePinned(benchmark::State &state)
+{
+    BenchReplay<true>(state, file_stream);
+}
+
+static void
+BenchJail(benchmark::State &state)
+{
+    BenchReplay<false>(state, jail_stream);
+}
+
+static void
+BenchJailPinned(benchmark::State &state)
+{
+    BenchReplay<true>(state, jail_stream);
+}
+
+static void
+BenchWidget(benchmark::State &state)
+{
+    BenchReplay<false>(state, widget_stream);
+}
+
+static void
+BenchWidgetPinned(benchmark::State &state)
+{
+    BenchReplay<true>(state, widget_stream);
+}
+
+BENCHMARK(BenchFile);
+BENCHMARK(BenchFilePinned);
+BENCHMARK(BenchJail);
+BENCHMARK(BenchJailPinned);
+BENCHMARK(BenchWidget);
+BENCHMARK(BenchWidgetPinned);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,199 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "translation/Marshal.hxx"
+#include "translation/PReader.hxx"
+#include "net/SocketDescriptor.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <string.h>
+#include <sys/socket.h>
+
+static void
+ExpectPacket(AllocatorPtr alloc, const uint8_t *&data, size_t &length,
+             TranslationCommand command, const char *payload)
+{
+    TranslatePacketReader reader;
+    size_t nbytes = reader.Feed(alloc, data, length);
+    ASSERT_TRUE(reader.IsComplete());
+    EXPECT_EQ(reader.GetCommand(), command);
+    EXPECT_EQ(reader.GetLength(), strlen(payload));
+    EXPECT_STREQ((const char *)reader.GetPayload(), payload);
+
+    data += nbytes;
+    length -= nbytes;
+}
+
+static void
+WriteRequest(TranslationMarshaller &m)
+{
+    static constexpr uint8_t protocol_version = 2;
+
+    m.WriteT(TranslationCommand::BEGIN, protocol_version);
+    m.Write(TranslationCommand::URI, "/foo/bar");
+    m.WriteOptional(TranslationCommand::HOST, (const char *)nullptr);
+    m.Write(TranslationCommand::HOST, "example.com");
+    m.Write(TranslationCommand::END);
+}
+
+static constexpr size_t request_size = 4 + 1 + 4 + 8 + 4 + 11 + 4;
+
+TEST(TranslationMarshaller, Dup)
+{
+    TranslationMarshaller m;
+    EXPECT_TRUE(m.IsEmpty());
+
+    WriteRequest(m);
+    EXPECT_EQ(m.GetSize(), request_size);
+    EXPECT_EQ(m.GetVector().size, 7u);
+
+    Allocator a;
+    const auto b = m.Dup(a);
+    ASSERT_EQ(b.size, request_size);
+
+    const uint8_t *data = (const uint8_t *)b.data;
+    size_t length = b.size;
+
+    TranslatePacketReader reader;
+    size_t nbytes = reader.Feed(a, data, length);
+    data += nbytes;
+    length -= nbytes;
+    ASSERT_TRUE(reader.IsComplete());
+    EXPECT_EQ(reader.GetCommand(), TranslationCommand::BEGIN);
+    EXPECT_EQ(reader.GetLength(), 1u);
+    EXPECT_EQ(*(const uint8_t *)reader.GetPayload(), 2);
+
+    ExpectPacket(a, data, length, TranslationCommand::URI, "/foo/bar");
+    ExpectPacket(a, data, length, TranslationCommand::HOST, "example.com");
+    ExpectPacket(a, data, length, TranslationCommand::END, "");
+    EXPECT_EQ(length, 0u);
+}
+
+TEST(TranslationMarshaller, Consume)
+{
+    TranslationMarshaller m;
+    WriteRequest(m);
+
+    uint8_t full[request_size];
+    m.CopyTo(full);
+
+    /* consume in the middle of the URI payload */
+    m.Consume(12);
+    EXPECT_EQ(m.GetSize(), request_size - 12);
+
+    uint8_t rest[request_size];
+    EXPECT_EQ(m.CopyTo(rest), request_size - 12);
+    EXPECT_EQ(memcmp(rest, full + 12, request_size - 12), 0);
+
+    /* consume exactly up to a packet boundary */
+    m.Consume(5);
+    EXPECT_EQ(m.GetVector().size, 3u);
+
+    m.Consume(m.GetSize());
+    EXPECT_TRUE(m.IsEmpty());
+    EXPECT_EQ(m.GetVector().size, 0u);
+}
+
+TEST(TranslationMarshaller, TooLarge)
+{
+    static char big[0x10000];
+
+    TranslationMarshaller m;
+    EXPECT_THROW(m.Write(TranslationCommand::URI, ConstBuffer<void>(big, sizeof(big))),
+                 std::runtime_error);
+    EXPECT_TRUE(m.IsEmpty());
+
+    m.Write(TranslationCommand::URI, ConstBuffer<void>(big, sizeof(big) - 1));
+    EXPECT_EQ(m.GetSize(), sizeof(big) + 3);
+}
+
+TEST(TranslationMarshaller, Extended)
+{
+    static std::string big(0x12345, 'x');
+
+    TranslationMarshaller m;
+    m.EnableExtended();
+    m.Write(TranslationCommand::BEGIN);
+    m.Write(TranslationCommand::SETENV, StringView(big.data(), big.size()));
+    m.Write(TranslationCommand::END);
+    EXPECT_EQ(m.GetSize(), 4 + 8 + big.size() + 4);
+
+    Allocator a;
+    const auto b = m.Dup(a);
+    const uint8_t *data = (const uint8_t *)b.data;
+    size_t length = b.size;
+
+    ExpectPacket(a, data, length, TranslationCommand::BEGIN, "");
+
+    TranslatePacketReader reader;
+    reader.AllowExtended(big.size());
+    size_t nbytes = reader.Feed(a, data, length);
+    EXPECT_EQ(nbytes, 8 + big.size());
+    ASSERT_TRUE(reader.IsComplete());
+    EXPECT_TRUE(reader.IsExtended());
+    EXPECT_EQ(reader.GetCommand(), TranslationCommand::SETENV);
+    EXPECT_EQ(reader.GetLength(), big.size());
+    EXPECT_EQ(memcmp(reader.GetPayload(), big.data(), big.size()), 0);
+    data += nbytes;
+    length -= nbytes;
+
+    ExpectPacket(a, data, length, TranslationCommand::END, "");
+    EXPECT_EQ(length, 0u);
+}
+
+TEST(TranslationMarshaller, Send)
+{
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_LOCAL, SOCK_STREAM, 0, sv), 0);
+    SocketDescriptor s(sv[0]), r(sv[1]);
+
+    TranslationMarshaller m;
+    WriteRequest(m);
+
+    uint8_t expected[request_size];
+    m.CopyTo(expected);
+
+    EXPECT_EQ(m.Send(s), request_size);
+    EXPECT_TRUE(m.IsEmpty());
+
+    uint8_t buffer[request_size + 1];
+    EXPECT_EQ(recv(r.Get(), buffer, sizeof(buffer), 0),
+              ssize_t(request_size));
+    EXPECT_EQ(memcmp(buffer, expected, request_size), 0);
+
+    s.Close();
+    r.Close();
+}
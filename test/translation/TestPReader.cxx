@@ -0,0 +1,191 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "translation/PReader.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <string.h>
+
+static void
+AppendPacket(std::string &dest, TranslationCommand command,
+             const char *payload)
+{
+    TranslationHeader header;
+    header.length = strlen(payload);
+    header.command = command;
+    dest.append((const char *)&header, sizeof(header));
+    dest.append(payload);
+}
+
+static void
+AppendExtendedPacket(std::string &dest, TranslationCommand command,
+                     const std::string &payload)
+{
+    TranslationExtendedHeader header;
+    header.header.length = 0;
+    header.header.command = TranslationCommand(uint16_t(command) |
+                                               TRANSLATION_COMMAND_EXTENDED);
+    header.length = payload.length();
+    dest.append((const char *)&header, sizeof(header));
+    dest.append(payload);
+}
+
+TEST(TranslatePacketReader, Extended)
+{
+    const std::string big(100000, 'a');
+
+    std::string input;
+    AppendExtendedPacket(input, TranslationCommand::SETENV, big);
+    AppendPacket(input, TranslationCommand::URI, "/foo");
+
+    Allocator allocator;
+    TranslatePacketReader reader;
+    reader.AllowExtended(big.size());
+
+    /* feed byte by byte until the extended header is complete */
+    const uint8_t *data = (const uint8_t *)input.data();
+    size_t position = 0;
+    for (size_t i = 1; i < sizeof(TranslationExtendedHeader); ++i)
+        EXPECT_EQ(reader.Feed(allocator, data, i), 0u);
+
+    while (!reader.IsComplete()) {
+        size_t n = std::min<size_t>(input.size() - position, 4096);
+        size_t nbytes = reader.Feed(allocator, data + position, n);
+        ASSERT_GT(nbytes, 0u);
+        position += nbytes;
+    }
+
+    EXPECT_EQ(position, sizeof(TranslationExtendedHeader) + big.size());
+    EXPECT_TRUE(reader.IsExtended());
+    EXPECT_EQ(reader.GetCommand(), TranslationCommand::SETENV);
+    EXPECT_EQ(reader.GetLength(), big.size());
+    EXPECT_EQ((const char *)reader.GetPayload(), big);
+
+    position += reader.Feed(allocator, data + position,
+                            input.size() - position);
+    ASSERT_TRUE(reader.IsComplete());
+    EXPECT_FALSE(reader.IsExtended());
+    EXPECT_EQ(reader.GetCommand(), TranslationCommand::URI);
+    EXPECT_EQ(position, input.size());
+
+    /* zero-copy */
+    uint8_t *p = (uint8_t *)&input[0];
+    size_t nbytes = reader.FeedPinned(allocator, p, input.size());
+    EXPECT_EQ(nbytes, sizeof(TranslationExtendedHeader) + big.size());
+    ASSERT_TRUE(reader.IsComplete());
+    EXPECT_TRUE(reader.IsExtended());
+    EXPECT_EQ(reader.GetCommand(), TranslationCommand::SETENV);
+    EXPECT_EQ((const char *)reader.GetPayload(), big);
+    EXPECT_GE((const uint8_t *)reader.GetPayload(), p);
+    EXPECT_LT((const uint8_t *)reader.GetPayload(), p + nbytes);
+}
+
+TEST(TranslatePacketReader, ExtendedRejected)
+{
+    std::string input;
+    AppendExtendedPacket(input, TranslationCommand::SETENV,
+                         std::string(1000, 'a'));
+
+    Allocator allocator;
+    const uint8_t *data = (const uint8_t *)input.data();
+
+    /* not negotiated */
+    TranslatePacketReader reader;
+    EXPECT_THROW(reader.Feed(allocator, data, input.size()),
+                 std::runtime_error);
+
+    /* too large */
+    TranslatePacketReader reader2;
+    reader2.AllowExtended(999);
+    EXPECT_THROW(reader2.Feed(allocator, data, input.size()),
+                 std::runtime_error);
+
+    TranslatePacketReader reader3;
+    reader3.AllowExtended(1000);
+    EXPECT_EQ(reader3.Feed(allocator, data, input.size()), input.size());
+    EXPECT_TRUE(reader3.IsComplete());
+}
+
+TEST(TranslatePacketReader, Pinned)
+{
+    std::string input;
+    AppendPacket(input, TranslationCommand::BEGIN, "");
+    AppendPacket(input, TranslationCommand::PATH, "/var/www/index.html");
+    AppendPacket(input, TranslationCommand::URI, "/foo");
+
+    /* the last packet is incomplete */
+    input.pop_back();
+
+    Allocator allocator;
+    TranslatePacketReader reader;
+
+    uint8_t *data = (uint8_t *)&input[0];
+    const uint8_t *const end = data + input.size();
+
+    size_t nbytes = reader.FeedPinned(allocator, data, end - data);
+    EXPECT_EQ(nbytes, sizeof(TranslationHeader));
+    ASSERT_TRUE(reader.IsComplete());
+    EXPECT_EQ(reader.GetCommand(), TranslationCommand::BEGIN);
+    EXPECT_EQ(reader.GetLength(), 0u);
+    data += nbytes;
+
+    nbytes = reader.FeedPinned(allocator, data, end - data);
+    ASSERT_TRUE(reader.IsComplete());
+    EXPECT_EQ(reader.GetCommand(), TranslationCommand::PATH);
+    EXPECT_EQ(reader.GetLength(), 19u);
+    EXPECT_STREQ((const char *)reader.GetPayload(), "/var/www/index.html");
+
+    /* the payload refers to the buffer */
+    EXPECT_GE((const uint8_t *)reader.GetPayload(), data);
+    EXPECT_LT((const uint8_t *)reader.GetPayload(), data + nbytes);
+    data += nbytes;
+
+    /* an incomplete packet is copied */
+    nbytes = reader.FeedPinned(allocator, data, end - data);
+    EXPECT_EQ(data + nbytes, end);
+    EXPECT_FALSE(reader.IsComplete());
+
+    uint8_t o = 'o';
+    nbytes = reader.FeedPinned(allocator, &o, 1);
+    EXPECT_EQ(nbytes, 1u);
+    ASSERT_TRUE(reader.IsComplete());
+    EXPECT_EQ(reader.GetCommand(), TranslationCommand::URI);
+    EXPECT_STREQ((const char *)reader.GetPayload(), "/foo");
+    EXPECT_TRUE((const uint8_t *)reader.GetPayload() < (const uint8_t *)input.data() ||
+                (const uint8_t *)reader.GetPayload() >= end);
+}
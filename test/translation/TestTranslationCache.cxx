@@ -0,0 +1,185 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "translation/Cache.hxx"
+#include "translation/Response.hxx"
+#include "translation/Protocol.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+using std::chrono::seconds;
+
+static ConstBuffer<void>
+ToBuffer(const char *s)
+{
+    return {s, strlen(s)};
+}
+
+static TranslateResponse
+MakeResponse(const char *site)
+{
+    TranslateResponse response;
+    response.Clear();
+    response.site = site;
+    return response;
+}
+
+TEST(TranslationCache, Vary)
+{
+    std::unique_ptr<TranslationCache> cache(new TranslationCache());
+
+    const auto t0 = std::chrono::steady_clock::time_point(seconds(1000));
+    const Expiry now = Expiry::Touched(t0, seconds(0));
+
+    const TranslationCacheField fields_a[] = {
+        { TranslationCommand::HOST, ToBuffer("a.example.com") },
+        { TranslationCommand::SESSION, ToBuffer("s1") },
+    };
+    const TranslationCacheField fields_b[] = {
+        { TranslationCommand::HOST, ToBuffer("b.example.com") },
+        { TranslationCommand::SESSION, ToBuffer("s1") },
+    };
+    const TranslationCacheRequest a{"/index.html", {fields_a, 2}};
+    const TranslationCacheRequest b{"/index.html", {fields_b, 2}};
+
+    EXPECT_EQ(cache->Get(a, now), nullptr);
+
+    const TranslationCommand vary[] = { TranslationCommand::HOST };
+
+    {
+        /* the cache copies all data */
+        std::string site("site_a");
+        cache->Put(a, MakeResponse(site.c_str()), {vary, 1}, seconds(60), now);
+        site = "overwritten";
+    }
+
+    /* VARY=HOST: different host, different cache item */
+    EXPECT_EQ(cache->Get(b, now), nullptr);
+    cache->Put(b, MakeResponse("site_b"), {vary, 1}, seconds(-1), now);
+
+    const auto *r = cache->Get(a, now);
+    ASSERT_NE(r, nullptr);
+    EXPECT_STREQ(r->site, "site_a");
+
+    r = cache->Get(b, now);
+    ASSERT_NE(r, nullptr);
+    EXPECT_STREQ(r->site, "site_b");
+
+    /* MAX_AGE */
+    EXPECT_EQ(cache->Get(a, Expiry::Touched(t0, seconds(61))), nullptr);
+
+    /* MAX_AGE=0 disables caching */
+    const TranslationCacheRequest c{"/other.html", {fields_a, 2}};
+    cache->Put(c, MakeResponse("site_c"), nullptr, seconds(0), now);
+    EXPECT_EQ(cache->Get(c, now), nullptr);
+
+    EXPECT_EQ(cache->GetStats().stores, 2u);
+
+    /* only "b" is left (MAX_AGE has removed "a"); reclaiming
+       removes it */
+    const size_t usage = cache->GetMemoryUsage();
+    EXPECT_GT(usage, 0u);
+    EXPECT_EQ(cache->ReclaimMemory(1), usage);
+    EXPECT_EQ(cache->GetMemoryUsage(), 0u);
+    EXPECT_EQ(cache->Get(b, now), nullptr);
+}
+
+TEST(TranslationCache, Invalidate)
+{
+    std::unique_ptr<TranslationCache> cache(new TranslationCache());
+    const Expiry now = Expiry::Touched(std::chrono::steady_clock::time_point(), seconds(0));
+
+    const TranslationCacheField fields_a[] = {
+        { TranslationCommand::HOST, ToBuffer("a.example.com") },
+    };
+    const TranslationCacheField fields_b[] = {
+        { TranslationCommand::HOST, ToBuffer("b.example.com") },
+    };
+    const TranslationCacheRequest a1{"/1", {fields_a, 1}};
+    const TranslationCacheRequest a2{"/2", {fields_a, 1}};
+    const TranslationCacheRequest b1{"/1", {fields_b, 1}};
+
+    const TranslationCommand host[] = { TranslationCommand::HOST };
+
+    cache->Put(a1, MakeResponse("a1"), {host, 1}, seconds(60), now);
+    cache->Put(a2, MakeResponse("a2"), nullptr, seconds(60), now);
+    cache->Put(b1, MakeResponse("b1"), {host, 1}, seconds(60), now);
+
+    /* INVALIDATE=HOST removes all responses for this host */
+    EXPECT_EQ(cache->Invalidate(a1, {host, 1}), 2u);
+    EXPECT_EQ(cache->Get(a1, now), nullptr);
+    EXPECT_EQ(cache->Get(a2, now), nullptr);
+    EXPECT_NE(cache->Get(b1, now), nullptr);
+    EXPECT_EQ(cache->GetStats().invalidated, 2u);
+}
+
+TEST(TranslationCache, LookupKey)
+{
+    std::unique_ptr<TranslationCache> cache(new TranslationCache());
+
+    const auto t0 = std::chrono::steady_clock::time_point(seconds(1000));
+    const Expiry now = Expiry::Touched(t0, seconds(0));
+
+    const TranslationCacheField fields_a[] = {
+        { TranslationCommand::HOST, ToBuffer("a.example.com") },
+        { TranslationCommand::SESSION, ToBuffer("s1") },
+    };
+    const TranslationCacheField fields_b[] = {
+        { TranslationCommand::HOST, ToBuffer("a.example.com") },
+        { TranslationCommand::SESSION, ToBuffer("s2") },
+    };
+    const TranslationCacheRequest a{"/index.html", {fields_a, 2}};
+    const TranslationCacheRequest b{"/index.html", {fields_b, 2}};
+    const TranslationCacheRequest c{"/other.html", {fields_a, 2}};
+
+    const TranslationCommand vary[] = { TranslationCommand::HOST };
+    EXPECT_TRUE(a.VaryEquals(b, {vary, 1}));
+    EXPECT_TRUE(a.VaryEquals(b, nullptr));
+    EXPECT_FALSE(a.VaryEquals(c, nullptr));
+    EXPECT_FALSE(a.VaryEquals(c, {vary, 1}));
+
+    const TranslationCommand vary_session[] = { TranslationCommand::SESSION };
+    EXPECT_FALSE(a.VaryEquals(b, {vary_session, 1}));
+
+    /* no VARY list known: all attributes are part of the key */
+    EXPECT_NE(cache->MakeLookupKey(a, now), cache->MakeLookupKey(b, now));
+    EXPECT_EQ(cache->MakeLookupKey(a, now), cache->MakeLookupKey(a, now));
+    EXPECT_NE(cache->MakeLookupKey(a, now), cache->MakeLookupKey(c, now));
+
+    /* VARY=HOST: the session does not matter */
+    cache->Put(a, MakeResponse("site_a"), {vary, 1}, seconds(60), now);
+    EXPECT_EQ(cache->MakeLookupKey(a, now), cache->MakeLookupKey(b, now));
+    EXPECT_NE(cache->MakeLookupKey(a, now), cache->MakeLookupKey(c, now));
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "translation/Coalescer.hxx"
+#include "translation/Cache.hxx"
+#include "translation/Stock.hxx"
+#include "translation/Handler.hxx"
+#include "translation/Marshal.hxx"
+#include "translation/Parser.hxx"
+#include "translation/Response.hxx"
+#include "event/Loop.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <string.h>
+#include <sys/socket.h>
+
+static void
+SendPacket(SocketDescriptor s, TranslationCommand command,
+           const std::string &payload)
+{
+    TranslationHeader header;
+    header.length = payload.length();
+    header.command = command;
+
+    std::string buffer((const char *)&header, sizeof(header));
+    buffer += payload;
+    send(s.Get(), buffer.data(), buffer.size(), MSG_NOSIGNAL);
+}
+
+/* in an anonymous namespace, because TestTranslationStock.cxx has
+   classes with the same names */
+namespace {
+
+/**
+ * Accepts one connection (the stock must be configured with
+ * max_connections=1) and replies to each request with a TOKEN
+ * packet which echoes the URI, but only after #n requests have been
+ * received (so they are all in flight at the same time).  The URIs
+ * of all requests are recorded in #uris.
+ */
+struct Server {
+    UniqueSocketDescriptor listener;
+    std::thread thread;
+
+    std::vector<std::string> &uris;
+
+    Server(unsigned n, std::vector<std::string> &_uris)
+        :uris(_uris) {
+        if (!listener.Create(AF_LOCAL, SOCK_STREAM, 0) ||
+            !listener.AutoBind() || !listener.Listen(4))
+            throw std::runtime_error("Failed to listen");
+
+        thread = std::thread([this, n](){
+            UniqueSocketDescriptor c(listener.Accept());
+            if (!c.IsDefined())
+                return;
+
+            Run(c, n);
+        });
+    }
+
+    ~Server() {
+        thread.join();
+    }
+
+    StaticSocketAddress GetAddress() const {
+        return listener.GetLocalAddress();
+    }
+
+private:
+    void Run(SocketDescriptor s, unsigned n) {
+        std::string input;
+        size_t replied = 0;
+
+        while (true) {
+            char buffer[1024];
+            ssize_t nbytes = recv(s.Get(), buffer, sizeof(buffer), 0);
+            if (nbytes <= 0)
+                return;
+
+            input.append(buffer, nbytes);
+
+            while (input.size() >= sizeof(TranslationHeader)) {
+                TranslationHeader header;
+                memcpy(&header, input.data(), sizeof(header));
+                if (input.size() < sizeof(header) + header.length)
+                    break;
+
+                if (header.command == TranslationCommand::URI)
+                    uris.emplace_back(input, sizeof(header), header.length);
+
+                input.erase(0, sizeof(header) + header.length);
+            }
+
+            if (uris.size() < n)
+                continue;
+
+            for (; replied < uris.size(); ++replied) {
+                SendPacket(s, TranslationCommand::BEGIN, {});
+                SendPacket(s, TranslationCommand::TOKEN, uris[replied]);
+                SendPacket(s, TranslationCommand::END, {});
+            }
+        }
+    }
+};
+
+struct Context;
+
+struct Operation {
+    Context &context;
+    const std::string uri;
+
+    TranslationCacheRequest cache_request;
+
+    ConstBuffer<void> request;
+    TranslateParser parser;
+    CancellablePointer cancel_ptr;
+
+    std::string token;
+    bool done = false, failed = false;
+
+    Operation(Context &_context, AllocatorPtr alloc, const char *_uri)
+        :context(_context), uri(_uri), parser(alloc) {
+        cache_request.key = {uri.data(), uri.size()};
+        cache_request.fields = nullptr;
+
+        TranslationMarshaller m;
+        m.Write(TranslationCommand::BEGIN);
+        m.Write(TranslationCommand::URI, _uri);
+        m.Write(TranslationCommand::END);
+        request = m.Dup(alloc);
+    }
+};
+
+struct Context {
+    EventLoop event_loop;
+    Allocator allocator;
+
+    std::vector<std::unique_ptr<Operation>> operations;
+    unsigned pending = 0;
+
+    Operation &Send(TranslationCoalescer &coalescer, const char *uri);
+
+    void Cancel(Operation &o) {
+        o.cancel_ptr.Cancel();
+        --pending;
+    }
+
+    void Finish(Operation &o) {
+        o.done = true;
+        if (--pending == 0)
+            event_loop.Break();
+    }
+};
+
+static void
+OnResponse(TranslateResponse &response, void *ctx)
+{
+    auto &o = *(Operation *)ctx;
+    if (response.token != nullptr)
+        o.token = response.token;
+    o.context.Finish(o);
+}
+
+static void
+OnError(std::exception_ptr, void *ctx)
+{
+    auto &o = *(Operation *)ctx;
+    o.failed = true;
+    o.context.Finish(o);
+}
+
+static constexpr TranslateHandler handler = {
+    .response = OnResponse,
+    .error = OnError,
+};
+
+Operation &
+Context::Send(TranslationCoalescer &coalescer, const char *uri)
+{
+    operations.emplace_back(new Operation(*this, allocator, uri));
+    auto &o = *operations.back();
+    ++pending;
+    coalescer.SendRequest(o.cache_request, o.parser, o.request,
+                          handler, &o, o.cancel_ptr);
+    return o;
+}
+
+} // anonymous namespace
+
+TEST(TranslationCoalescer, Basic)
+{
+    std::vector<std::string> uris;
+
+    {
+        /* the server replies only after it has received two
+           requests: one for "/a" and one for "/b" */
+        Server server(2, uris);
+
+        Context context;
+        TranslationStockConfig config;
+        config.max_connections = 1;
+        TranslationStock stock(context.event_loop, server.GetAddress(),
+                               config);
+        std::unique_ptr<TranslationCache> cache(new TranslationCache());
+        TranslationCoalescer coalescer(stock, *cache);
+
+        std::vector<Operation *> a;
+        for (unsigned i = 0; i < 5; ++i)
+            a.push_back(&context.Send(coalescer, "/a"));
+        auto &b = context.Send(coalescer, "/b");
+
+        EXPECT_EQ(coalescer.GetFlightCount(), 2u);
+        EXPECT_EQ(coalescer.GetStats().sent, 2u);
+        EXPECT_EQ(coalescer.GetStats().coalesced, 4u);
+
+        context.event_loop.Dispatch();
+
+        for (const auto *o : a) {
+            EXPECT_TRUE(o->done);
+            EXPECT_FALSE(o->failed);
+            EXPECT_EQ(o->token, "/a");
+        }
+
+        EXPECT_TRUE(b.done);
+        EXPECT_EQ(b.token, "/b");
+        EXPECT_EQ(coalescer.GetFlightCount(), 0u);
+    }
+
+    EXPECT_EQ(uris.size(), 2u);
+}
+
+TEST(TranslationCoalescer, CancelLeader)
+{
+    std::vector<std::string> uris;
+    Server server(1, uris);
+
+    Context context;
+    TranslationStockConfig config;
+    config.max_connections = 1;
+    TranslationStock stock(context.event_loop, server.GetAddress(), config);
+    std::unique_ptr<TranslationCache> cache(new TranslationCache());
+    TranslationCoalescer coalescer(stock, *cache);
+
+    auto &a = context.Send(coalescer, "/c");
+    auto &b = context.Send(coalescer, "/c");
+    auto &c = context.Send(coalescer, "/c");
+    EXPECT_EQ(coalescer.GetStats().sent, 1u);
+
+    /* canceling the request which was sent promotes the next
+       one */
+    context.Cancel(a);
+    EXPECT_EQ(coalescer.GetFlightCount(), 1u);
+    EXPECT_EQ(coalescer.GetStats().sent, 2u);
+
+    context.event_loop.Dispatch();
+
+    EXPECT_FALSE(a.done);
+    EXPECT_TRUE(b.done);
+    EXPECT_EQ(b.token, "/c");
+    EXPECT_TRUE(c.done);
+    EXPECT_EQ(c.token, "/c");
+    EXPECT_EQ(coalescer.GetFlightCount(), 0u);
+
+    /* a new request after the response starts a new flight */
+    auto &d = context.Send(coalescer, "/c");
+    EXPECT_EQ(coalescer.GetStats().sent, 3u);
+    context.event_loop.Dispatch();
+    EXPECT_TRUE(d.done);
+    EXPECT_EQ(d.token, "/c");
+}
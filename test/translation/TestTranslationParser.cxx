@@ -0,0 +1,120 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "translation/Parser.hxx"
+#include "translation/Protocol.hxx"
+#include "AllocatorPtr.hxx"
+#include "../AllocationCounter.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <string.h>
+
+static void
+AppendPacket(std::string &dest, TranslationCommand command,
+             const void *payload, size_t length)
+{
+    TranslationHeader header;
+    header.length = length;
+    header.command = command;
+    dest.append((const char *)&header, sizeof(header));
+    dest.append((const char *)payload, length);
+}
+
+static void
+AppendPacket(std::string &dest, TranslationCommand command,
+             const char *payload="")
+{
+    AppendPacket(dest, command, payload, strlen(payload));
+}
+
+static std::string
+MakeResponse()
+{
+    std::string s;
+    AppendPacket(s, TranslationCommand::BEGIN, "\x03", 1);
+
+    const uint32_t max_age = 300;
+    AppendPacket(s, TranslationCommand::MAX_AGE, &max_age, sizeof(max_age));
+
+    AppendPacket(s, TranslationCommand::SITE, "www.example.com");
+    AppendPacket(s, TranslationCommand::CANONICAL_HOST, "www.example.com");
+    AppendPacket(s, TranslationCommand::TOKEN, "6f1b2c3d4e5f");
+    AppendPacket(s, TranslationCommand::END);
+    return s;
+}
+
+static void
+Parse(Allocator &alloc, const std::string &input)
+{
+    TranslateParser parser(alloc);
+
+    const uint8_t *data = (const uint8_t *)input.data();
+    size_t length = input.size();
+
+    while (true) {
+        size_t nbytes = parser.Feed(data, length);
+        ASSERT_GT(nbytes, 0u);
+        data += nbytes;
+        length -= nbytes;
+
+        if (parser.Process() == TranslateParser::Result::DONE)
+            break;
+    }
+
+    EXPECT_EQ(length, 0u);
+
+    const auto &response = parser.GetResponse();
+    EXPECT_EQ(response.protocol_version, 3u);
+    EXPECT_EQ(response.max_age, std::chrono::seconds(300));
+    EXPECT_STREQ(response.site, "www.example.com");
+    EXPECT_STREQ(response.token, "6f1b2c3d4e5f");
+}
+
+/**
+ * Once the #Arena has grown large enough, parsing a response does
+ * not touch the heap at all.
+ */
+TEST(TranslateParser, NoAllocation)
+{
+    const std::string input = MakeResponse();
+
+    Allocator alloc;
+
+    /* warm up: let the arena allocate its chunk */
+    Parse(alloc, input);
+    alloc.Clear();
+
+    EXPECT_NO_ALLOCATION(Parse(alloc, input));
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "translation/Snapshot.hxx"
+#include "translation/Response.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include <string.h>
+
+static bool
+Contains(ConstBuffer<void> buffer, const void *p)
+{
+    return p >= buffer.data &&
+        p < (const uint8_t *)buffer.data + buffer.size;
+}
+
+static void
+MakeResponse(TranslateResponse &response)
+{
+    response.Clear();
+    response.protocol_version = 2;
+    response.max_age = std::chrono::seconds(60);
+    response.token = "foo";
+    response.site = "";
+    response.pool = "bar";
+    response.transparent = true;
+    response.auto_gzip = true;
+    response.error_document = {"xyz", 3};
+    response.probe_suffixes.push_back(".html");
+    response.probe_suffixes.push_back(".php");
+    response.validate_mtime.mtime = 1234;
+    response.validate_mtime.path = "/etc/passwd";
+}
+
+TEST(TranslationSnapshot, Basic)
+{
+    TranslateResponse response;
+    MakeResponse(response);
+    ASSERT_TRUE(IsTranslationSnapshotSupported(response));
+
+    Allocator alloc;
+    const auto snapshot = DupTranslationSnapshot(alloc, response);
+    EXPECT_EQ(snapshot.size, GetTranslationSnapshotSize(response));
+    EXPECT_EQ(snapshot.size % TRANSLATION_SNAPSHOT_ALIGNMENT, 0u);
+
+    /* relocate the snapshot */
+    std::unique_ptr<uint64_t[]> copy(new uint64_t[snapshot.size / 8]);
+    memcpy(copy.get(), snapshot.data, snapshot.size);
+    const ConstBuffer<void> relocated(copy.get(), snapshot.size);
+
+    TranslateResponse loaded;
+    LoadTranslationSnapshot(loaded, relocated);
+
+    EXPECT_EQ(loaded.protocol_version, 2u);
+    EXPECT_EQ(loaded.max_age, std::chrono::seconds(60));
+    EXPECT_EQ(loaded.expires_relative, std::chrono::seconds::zero());
+    EXPECT_STREQ(loaded.token, "foo");
+    EXPECT_TRUE(Contains(relocated, loaded.token));
+    EXPECT_STREQ(loaded.site, "");
+    EXPECT_EQ(loaded.expand_site, nullptr);
+    EXPECT_STREQ(loaded.pool, "bar");
+    EXPECT_EQ(loaded.canonical_host, nullptr);
+    EXPECT_TRUE(loaded.transparent);
+    EXPECT_TRUE(loaded.auto_gzip);
+    EXPECT_FALSE(loaded.auto_deflate);
+    EXPECT_FALSE(loaded.uncached);
+    ASSERT_EQ(loaded.error_document.size, 3u);
+    EXPECT_EQ(memcmp(loaded.error_document.data, "xyz", 3), 0);
+    EXPECT_TRUE(loaded.probe_path_suffixes.IsNull());
+    ASSERT_EQ(loaded.probe_suffixes.size(), 2u);
+    EXPECT_STREQ(loaded.probe_suffixes[0], ".html");
+    EXPECT_STREQ(loaded.probe_suffixes[1], ".php");
+    EXPECT_EQ(loaded.validate_mtime.mtime, 1234u);
+    EXPECT_STREQ(loaded.validate_mtime.path, "/etc/passwd");
+}
+
+TEST(TranslationSnapshot, Malformed)
+{
+    TranslateResponse response;
+    MakeResponse(response);
+
+    Allocator alloc;
+    const auto snapshot = DupTranslationSnapshot(alloc, response);
+
+    TranslateResponse loaded;
+
+    /* truncated */
+    EXPECT_THROW(LoadTranslationSnapshot(loaded, {snapshot.data, 16}),
+                 std::runtime_error);
+    EXPECT_THROW(LoadTranslationSnapshot(loaded, {snapshot.data,
+                                                  snapshot.size - 8}),
+                 std::runtime_error);
+
+    std::unique_ptr<uint64_t[]> copy(new uint64_t[snapshot.size / 8]);
+    uint8_t *p = (uint8_t *)copy.get();
+    const ConstBuffer<void> modified(p, snapshot.size);
+
+    /* wrong magic */
+    memcpy(p, snapshot.data, snapshot.size);
+    p[0] ^= 0xff;
+    EXPECT_THROW(LoadTranslationSnapshot(loaded, modified),
+                 std::runtime_error);
+
+    /* remove the null terminator of the last string */
+    memcpy(p, snapshot.data, snapshot.size);
+    LoadTranslationSnapshot(loaded, modified);
+    const char *end = loaded.validate_mtime.path + strlen(loaded.validate_mtime.path);
+    p[end - (const char *)p] = 'x';
+    EXPECT_THROW(LoadTranslationSnapshot(loaded, modified),
+                 std::runtime_error);
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "translation/Stock.hxx"
+#include "translation/Handler.hxx"
+#include "translation/Marshal.hxx"
+#include "translation/Parser.hxx"
+#include "translation/Response.hxx"
+#include "event/Loop.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <string.h>
+#include <sys/socket.h>
+
+static void
+SendPacket(SocketDescriptor s, TranslationCommand command,
+           const std::string &payload)
+{
+    TranslationHeader header;
+    header.length = payload.length();
+    header.command = command;
+
+    std::string buffer((const char *)&header, sizeof(header));
+    buffer += payload;
+    send(s.Get(), buffer.data(), buffer.size(), MSG_NOSIGNAL);
+}
+
+/**
+ * Receive #n requests, and then reply to all of them (in order)
+ * with a TOKEN packet which echoes the URI.
+ */
+static void
+HandleConnection(SocketDescriptor s, unsigned n)
+{
+    std::vector<std::string> uris;
+    std::string input;
+
+    while (uris.size() < n) {
+        char buffer[1024];
+        ssize_t nbytes = recv(s.Get(), buffer, sizeof(buffer), 0);
+        if (nbytes <= 0)
+            return;
+
+        input.append(buffer, nbytes);
+
+        while (input.size() >= sizeof(TranslationHeader)) {
+            TranslationHeader header;
+            memcpy(&header, input.data(), sizeof(header));
+            if (input.size() < sizeof(header) + header.length)
+                break;
+
+            if (header.command == TranslationCommand::URI)
+                uris.emplace_back(input, sizeof(header), header.length);
+
+            input.erase(0, sizeof(header) + header.length);
+        }
+    }
+
+    for (const auto &uri : uris) {
+        SendPacket(s, TranslationCommand::BEGIN, {});
+        SendPacket(s, TranslationCommand::TOKEN, uri);
+        SendPacket(s, TranslationCommand::END, {});
+    }
+}
+
+struct Server {
+    UniqueSocketDescriptor listener;
+    std::thread thread;
+
+    /**
+     * @param requests the number of requests to be expected on each
+     * connection
+     */
+    explicit Server(std::vector<unsigned> requests) {
+        if (!listener.Create(AF_LOCAL, SOCK_STREAM, 0) ||
+            !listener.AutoBind() || !listener.Listen(4))
+            throw std::runtime_error("Failed to listen");
+
+        thread = std::thread([this, requests](){
+            for (unsigned n : requests) {
+                UniqueSocketDescriptor c(listener.Accept());
+                if (!c.IsDefined())
+                    return;
+
+                HandleConnection(c, n);
+            }
+        });
+    }
+
+    ~Server() {
+        thread.join();
+    }
+
+    StaticSocketAddress GetAddress() const {
+        return listener.GetLocalAddress();
+    }
+};
+
+struct Context;
+
+struct Operation {
+    Context &context;
+    const std::string uri;
+
+    ConstBuffer<void> request;
+    TranslateParser parser;
+    CancellablePointer cancel_ptr;
+
+    std::string token;
+    bool done = false, failed = false;
+
+    Operation(Context &_context, AllocatorPtr alloc, const char *_uri)
+        :context(_context), uri(_uri), parser(alloc) {
+        TranslationMarshaller m;
+        m.Write(TranslationCommand::BEGIN);
+        m.Write(TranslationCommand::URI, _uri);
+        m.Write(TranslationCommand::END);
+        request = m.Dup(alloc);
+    }
+};
+
+struct Context {
+    EventLoop event_loop;
+    Allocator allocator;
+
+    std::vector<std::unique_ptr<Operation>> operations;
+    unsigned pending = 0;
+
+    /**
+     * Cancel this operation when the first response arrives.
+     */
+    Operation *cancel_on_response = nullptr;
+
+    Operation &Send(TranslationStock &stock, const char *uri);
+
+    void Finish(Operation &o) {
+        o.done = true;
+        if (cancel_on_response != nullptr) {
+            cancel_on_response->cancel_ptr.Cancel();
+            cancel_on_response = nullptr;
+            --pending;
+        }
+
+        if (--pending == 0)
+            event_loop.Break();
+    }
+};
+
+static void
+OnResponse(TranslateResponse &response, void *ctx)
+{
+    auto &o = *(Operation *)ctx;
+    if (response.token != nullptr)
+        o.token = response.token;
+    o.context.Finish(o);
+}
+
+static void
+OnError(std::exception_ptr, void *ctx)
+{
+    auto &o = *(Operation *)ctx;
+    o.failed = true;
+    o.context.Finish(o);
+}
+
+static constexpr TranslateHandler handler = {
+    .response = OnResponse,
+    .error = OnError,
+};
+
+Operation &
+Context::Send(TranslationStock &stock, const char *uri)
+{
+    operations.emplace_back(new Operation(*this, allocator, uri));
+    auto &o = *operations.back();
+    ++pending;
+    stock.SendRequest(o.parser, o.request, handler, &o, o.cancel_ptr);
+    return o;
+}
+
+TEST(TranslationStock, Pipeline)
+{
+    Server server({3, 1});
+
+    Context context;
+    TranslationStockConfig config;
+    config.max_connections = 1;
+    TranslationStock stock(context.event_loop, server.GetAddress(), config);
+
+    /* the server replies only after it has received all three
+       requests, i.e. they must be pipelined on one connection */
+    auto &a = context.Send(stock, "/a");
+    auto &b = context.Send(stock, "/b");
+    auto &c = context.Send(stock, "/c");
+    EXPECT_EQ(stock.GetConnectionCount(), 1u);
+    EXPECT_EQ(stock.GetWaitingCount(), 3u);
+
+    /* the response to "/b" is in flight already and must be
+       discarded */
+    context.cancel_on_response = &b;
+
+    context.event_loop.Dispatch();
+
+    EXPECT_TRUE(a.done);
+    EXPECT_EQ(a.token, "/a");
+    EXPECT_FALSE(b.done);
+    EXPECT_TRUE(c.done);
+    EXPECT_EQ(c.token, "/c");
+    EXPECT_EQ(stock.GetWaitingCount(), 0u);
+
+    /* the server closes the first connection; the next request
+       gets a new one (possibly after a retry) */
+    auto &d = context.Send(stock, "/d");
+    context.event_loop.Dispatch();
+
+    EXPECT_TRUE(d.done);
+    EXPECT_FALSE(d.failed);
+    EXPECT_EQ(d.token, "/d");
+}
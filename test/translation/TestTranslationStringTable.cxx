@@ -0,0 +1,128 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "translation/StringTable.hxx"
+#include "translation/Parser.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <string.h>
+
+TEST(TranslationStringTable, Basic)
+{
+    Allocator alloc;
+    TranslationStringTable table(alloc);
+
+    const char *a = table.Intern("foo");
+    EXPECT_STREQ(a, "foo");
+    EXPECT_EQ(table.Intern(std::string("foo").c_str()), a);
+    EXPECT_NE(table.Intern("bar"), a);
+    EXPECT_NE(table.Intern("fo"), a);
+
+    /* null bytes are part of the string */
+    const char *b = table.Intern({"/a\0/b", 5});
+    EXPECT_EQ(memcmp(b, "/a\0/b", 6), 0);
+    EXPECT_EQ(table.Intern({"/a\0/b", 5}), b);
+    EXPECT_NE(table.Intern({"/a\0/c", 5}), b);
+
+    EXPECT_EQ(table.GetSize(), 5u);
+    EXPECT_EQ(table.GetHits(), 2u);
+}
+
+static void
+AppendPacket(std::string &dest, TranslationCommand command,
+             const char *payload)
+{
+    TranslationHeader header;
+    header.length = strlen(payload);
+    header.command = command;
+    dest.append((const char *)&header, sizeof(header));
+    dest.append(payload);
+}
+
+static TranslateResponse
+Parse(Allocator &alloc, TranslationStringTable *table,
+      const std::string &input)
+{
+    TranslateParser parser(alloc);
+    parser.SetStringTable(table);
+
+    const uint8_t *data = (const uint8_t *)input.data();
+    size_t length = input.size();
+
+    while (true) {
+        size_t nbytes = parser.Feed(data, length);
+        EXPECT_GT(nbytes, 0u);
+        data += nbytes;
+        length -= nbytes;
+
+        if (parser.Process() == TranslateParser::Result::DONE)
+            break;
+    }
+
+    EXPECT_EQ(length, 0u);
+    return std::move(parser.GetResponse());
+}
+
+TEST(TranslationStringTable, Parser)
+{
+    std::string input;
+    AppendPacket(input, TranslationCommand::BEGIN, "");
+    AppendPacket(input, TranslationCommand::SITE, "example");
+    AppendPacket(input, TranslationCommand::TOKEN, "xyz");
+    AppendPacket(input, TranslationCommand::END, "");
+
+    Allocator alloc, table_alloc;
+    TranslationStringTable table(table_alloc);
+
+    const auto a = Parse(alloc, &table, input);
+    const auto b = Parse(alloc, &table, input);
+
+    EXPECT_STREQ(a.site, "example");
+    EXPECT_EQ(a.site, b.site);
+
+    /* TOKEN is not interned */
+    EXPECT_STREQ(a.token, "xyz");
+    EXPECT_STREQ(b.token, "xyz");
+    EXPECT_NE(a.token, b.token);
+
+    EXPECT_EQ(table.GetSize(), 1u);
+    EXPECT_EQ(table.GetHits(), 1u);
+
+    /* without a table, nothing is shared */
+    const auto c = Parse(alloc, nullptr, input);
+    EXPECT_STREQ(c.site, "example");
+    EXPECT_NE(c.site, a.site);
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/VCircularBuffer.hxx"
+#include "util/PackedCircularBuffer.hxx"
+
+#include <benchmark/benchmark.h>
+
+#include <stddef.h>
+
+struct Event {
+    unsigned id;
+    unsigned value;
+
+    Event() = default;
+    constexpr Event(unsigned _id, unsigned _value) noexcept
+        :id(_id), value(_value) {}
+};
+
+static constexpr size_t BUFFER_SIZE = 64 * 1024;
+static constexpr size_t BATCH = 32;
+
+static void
+VCircularBuffer_PushPop(benchmark::State &state)
+{
+    alignas(8) static uint8_t buffer[BUFFER_SIZE];
+    VCircularBuffer<Event> cb(WritableBuffer<void>(buffer, sizeof(buffer)));
+    unsigned i = 0;
+
+    for (auto _ : state) {
+        for (size_t j = 0; j < BATCH; ++j)
+            cb.emplace_back(sizeof(Event), i++, j);
+
+        for (size_t j = 0; j < BATCH; ++j) {
+            benchmark::DoNotOptimize(cb.front().value);
+            cb.pop_front();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+
+static void
+PackedCircularBuffer_PushPop(benchmark::State &state)
+{
+    alignas(8) static uint8_t buffer[BUFFER_SIZE];
+    PackedCircularBuffer<Event> cb(WritableBuffer<void>(buffer, sizeof(buffer)));
+    unsigned i = 0;
+
+    for (auto _ : state) {
+        for (size_t j = 0; j < BATCH; ++j)
+            cb.push_back(Event(i++, j));
+
+        for (size_t j = 0; j < BATCH; ++j) {
+            benchmark::DoNotOptimize(cb.front().value);
+            cb.pop_front();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+
+static void
+PackedCircularBuffer_Bulk(benchmark::State &state)
+{
+    alignas(8) static uint8_t buffer[BUFFER_SIZE];
+    PackedCircularBuffer<Event> cb(WritableBuffer<void>(buffer, sizeof(buffer)));
+    Event src[BATCH], dest[BATCH];
+    unsigned i = 0;
+
+    for (auto _ : state) {
+        for (size_t j = 0; j < BATCH; ++j)
+            src[j] = Event(i++, j);
+
+        cb.push_back_n(src, BATCH);
+        cb.pop_front_n(dest, BATCH);
+        benchmark::DoNotOptimize(dest);
+    }
+
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+
+BENCHMARK(VCircularBuffer_PushPop);
+BENCHMARK(PackedCircularBuffer_PushPop);
+BENCHMARK(PackedCircularBuffer_Bulk);
+
+BENCHMARK_MAIN();
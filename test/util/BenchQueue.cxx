@@ -0,0 +1,105 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/SPSCQueue.hxx"
+#include "util/MPSCQueue.hxx"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <thread>
+
+template<typename Q>
+static void
+PushPop(benchmark::State &state)
+{
+    static Q q;
+    unsigned value = 0;
+
+    for (auto _ : state) {
+        q.Push(value);
+        q.Pop(value);
+        benchmark::DoNotOptimize(value);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * One producer thread pushes #N items in batches of state.range(0)
+ * while the benchmark thread pops them.
+ */
+template<typename Q>
+static void
+Transfer(benchmark::State &state)
+{
+    static Q q;
+    constexpr unsigned N = 1 << 20;
+    const size_t batch = state.range(0);
+
+    for (auto _ : state) {
+        std::thread producer([batch]{
+            unsigned buffer[64];
+            for (unsigned i = 0; i < N;) {
+                size_t n = std::min<size_t>(batch, N - i);
+                for (size_t j = 0; j < n; ++j)
+                    buffer[j] = i + j;
+                const size_t pushed = q.PushBatch(buffer, n);
+                if (pushed == 0)
+                    /* full: let the consumer run */
+                    std::this_thread::yield();
+                i += pushed;
+            }
+        });
+
+        unsigned buffer[64];
+        for (unsigned received = 0; received < N;) {
+            const size_t n = q.PopBatch(buffer, batch);
+            if (n == 0)
+                std::this_thread::yield();
+            received += n;
+        }
+
+        producer.join();
+    }
+
+    state.SetItemsProcessed(state.iterations() * N);
+}
+
+BENCHMARK_TEMPLATE(PushPop, SPSCQueue<unsigned, 1024>);
+BENCHMARK_TEMPLATE(PushPop, MPSCQueue<unsigned, 1024>);
+BENCHMARK_TEMPLATE(Transfer, SPSCQueue<unsigned, 1024>)
+    ->Arg(1)->Arg(16)->Arg(64)->UseRealTime();
+BENCHMARK_TEMPLATE(Transfer, MPSCQueue<unsigned, 1024>)
+    ->Arg(1)->Arg(16)->Arg(64)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Cache.hxx"
+#include "util/HashRing.hxx"
+#include "util/FNVHash.hxx"
+#include "util/StringView.hxx"
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <functional>
+
+#include <stdio.h>
+
+static void
+Cache_Get(benchmark::State &state)
+{
+    Cache<unsigned, unsigned, 1024, 1021,
+          std::hash<unsigned>, std::equal_to<unsigned>> cache;
+    for (unsigned i = 0; i < 1024; ++i)
+        cache.Put(i, i);
+
+    unsigned i = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cache.Get(i++ % 2048));
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void
+Cache_Put(benchmark::State &state)
+{
+    Cache<unsigned, unsigned, 1024, 1021,
+          std::hash<unsigned>, std::equal_to<unsigned>> cache;
+
+    unsigned i = 0;
+    for (auto _ : state) {
+        /* half of the keys are new and evict the oldest item */
+        cache.Put(i, i);
+        i += 3;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+struct RingNode {
+    unsigned hash;
+};
+
+struct RingNodeHasher {
+    unsigned operator()(const RingNode &node, size_t replica) const noexcept {
+        /* a cheap integer mix; the benchmark measures the ring
+           lookup, not the hash function */
+        unsigned h = (node.hash + unsigned(replica)) * 0x9e3779b1u;
+        return h ^ (h >> 16);
+    }
+};
+
+typedef HashRing<const RingNode, unsigned, 65536, 64> BenchHashRing;
+
+static const BenchHashRing &
+GetHashRing() noexcept
+{
+    static std::array<RingNode, 16> nodes;
+    static BenchHashRing ring;
+    static bool initialized = false;
+    if (!initialized) {
+        for (unsigned i = 0; i < nodes.size(); ++i)
+            nodes[i].hash = i * 7919;
+        ring.Build(nodes, RingNodeHasher());
+        initialized = true;
+    }
+
+    return ring;
+}
+
+static void
+HashRing_Pick(benchmark::State &state)
+{
+    const auto &ring = GetHashRing();
+
+    unsigned h = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(&ring.Pick(h));
+        h += 0x9e3779b9u;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void
+HashRing_FindNext(benchmark::State &state)
+{
+    const auto &ring = GetHashRing();
+
+    unsigned h = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ring.FindNext(h).first);
+        h += 0x9e3779b9u;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+static constexpr char sample_string[] =
+    "/var/www/example.com/htdocs/images/2018/some-long-file-name.jpeg";
+
+static void
+FNV1aHash32_String(benchmark::State &state)
+{
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(FNV1aHash32(sample_string));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * (sizeof(sample_string) - 1));
+}
+
+static void
+FNV1aHash64_String(benchmark::State &state)
+{
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(FNV1aHash64(sample_string));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * (sizeof(sample_string) - 1));
+}
+
+static void
+StringView_FindChar(benchmark::State &state)
+{
+    const StringView s(sample_string);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(s.Find('.'));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * s.size);
+}
+
+static void
+StringView_FindSubstring(benchmark::State &state)
+{
+    const StringView s(sample_string);
+    const StringView needle("name.jp");
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(s.Find(needle));
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * s.size);
+}
+
+BENCHMARK(Cache_Get);
+BENCHMARK(Cache_Put);
+BENCHMARK(HashRing_Pick);
+BENCHMARK(HashRing_FindNext);
+BENCHMARK(FNV1aHash32_String);
+BENCHMARK(FNV1aHash64_String);
+BENCHMARK(StringView_FindChar);
+BENCHMARK(StringView_FindSubstring);
+
+BENCHMARK_MAIN();
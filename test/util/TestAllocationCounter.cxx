@@ -0,0 +1,78 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "../AllocationCounter.hxx"
+#include "util/StringView.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include <stdlib.h>
+
+TEST(AllocationCounterTest, Basic)
+{
+    AllocationCounter outer;
+
+    {
+        AllocationCounter inner;
+        auto p = std::make_unique<int>(42);
+        EXPECT_EQ(inner.GetCount(), 1u);
+        EXPECT_GE(inner.GetBytes(), sizeof(int));
+    }
+
+    /* volatile prevents the compiler from eliding the allocation */
+    void *volatile p = malloc(100);
+    free(p);
+
+    EXPECT_EQ(outer.GetCount(), 2u);
+    EXPECT_GE(outer.GetBytes(), 100u + sizeof(int));
+}
+
+TEST(AllocationCounterTest, StringView)
+{
+    const char *const input = "  foo=bar; baz  ";
+
+    EXPECT_NO_ALLOCATION({
+        StringView s(input);
+        s.Strip();
+        EXPECT_TRUE(s.StartsWith("foo"));
+        EXPECT_TRUE(s.EndsWith("baz"));
+        EXPECT_NE(s.Find('='), nullptr);
+        EXPECT_NE(s.Find("bar"), nullptr);
+        EXPECT_NE(s.FindAnyOf(";,"), nullptr);
+        EXPECT_TRUE(s.StartsWithIgnoreCase("FOO"));
+        EXPECT_FALSE(s.Equals("foo"));
+    });
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../AllocationCounter.hxx"
+#include "util/Cache.hxx"
+
+#include <gtest/gtest.h>
+
+#include <functional>
+
+template<typename Policy>
+using TestCache = Cache<unsigned, unsigned, 10, 7,
+                        std::hash<unsigned>, std::equal_to<unsigned>,
+                        Policy>;
+
+TEST(CacheTest, Lru)
+{
+    TestCache<CacheLruPolicy> c;
+
+    for (unsigned i = 0; i < 10; ++i)
+        c.Put(i, i * 2);
+    EXPECT_TRUE(c.IsFull());
+
+    /* touch 0, so 1 becomes the oldest */
+    ASSERT_NE(c.Get(0u), nullptr);
+    EXPECT_EQ(*c.Get(0u), 0u);
+
+    c.Put(10u, 20u);
+    EXPECT_NE(c.Get(0u), nullptr);
+    EXPECT_EQ(c.Get(1u), nullptr);
+    EXPECT_NE(c.Get(10u), nullptr);
+
+    c.Remove(0u);
+    EXPECT_EQ(c.Get(0u), nullptr);
+    EXPECT_FALSE(c.IsFull());
+}
+
+/**
+ * Insert a hot set, then scan many keys which are used only once.
+ *
+ * @return the number of hot keys which survived the scan
+ */
+template<typename C>
+static unsigned
+Scan(C &c, bool try_put)
+{
+    /* the hot set: 5 keys, each used several times */
+    for (unsigned round = 0; round < 4; ++round)
+        for (unsigned i = 0; i < 5; ++i)
+            if (c.Get(i) == nullptr)
+                c.Put(i, i);
+
+    /* the scan */
+    for (unsigned i = 1000; i < 1100; ++i)
+        if (c.Get(i) == nullptr) {
+            if (try_put)
+                c.TryPut(i, i);
+            else
+                c.Put(i, i);
+        }
+
+    unsigned n = 0;
+    for (unsigned i = 0; i < 5; ++i)
+        if (c.Get(i) != nullptr)
+            ++n;
+    return n;
+}
+
+TEST(CacheTest, LruScan)
+{
+    TestCache<CacheLruPolicy> c;
+    EXPECT_EQ(Scan(c, false), 0u);
+}
+
+TEST(CacheTest, SegmentedLru)
+{
+    TestCache<CacheSegmentedLruPolicy<60>> c;
+    EXPECT_EQ(Scan(c, false), 5u);
+
+    /* the protected segment is bounded: new hot items demote
+       older ones */
+    for (unsigned round = 0; round < 2; ++round)
+        for (unsigned i = 100; i < 110; ++i)
+            if (c.Get(i) == nullptr)
+                c.Put(i, i);
+
+    unsigned n = 0;
+    c.ForEach([&n](unsigned, unsigned){ ++n; });
+    EXPECT_EQ(n, 10u);
+}
+
+TEST(CacheTest, TinyLfu)
+{
+    TestCache<CacheTinyLfuPolicy<60>> c;
+    EXPECT_EQ(Scan(c, true), 5u);
+
+    /* scanned keys were not admitted */
+    unsigned n_scanned = 0;
+    c.ForEach([&n_scanned](unsigned key, unsigned){
+        if (key >= 1000)
+            ++n_scanned;
+    });
+    EXPECT_LE(n_scanned, 5u);
+
+    c.RemoveIf([](unsigned key, unsigned){ return key < 5; });
+    for (unsigned i = 0; i < 5; ++i)
+        EXPECT_EQ(c.Get(i), nullptr);
+
+    c.Clear();
+    EXPECT_TRUE(c.IsEmpty());
+}
+
+TEST(CacheTest, FlatIndex)
+{
+    TestCache<CacheFlatIndexPolicy<>> c;
+
+    for (unsigned i = 0; i < 10; ++i)
+        c.Put(i, i * 2);
+    EXPECT_TRUE(c.IsFull());
+
+    c.Put(10u, 20u);
+    EXPECT_EQ(c.Get(0u), nullptr);
+    ASSERT_NE(c.Get(10u), nullptr);
+    EXPECT_EQ(*c.Get(10u), 20u);
+
+    c.PutOrReplace(10u, 30u);
+    EXPECT_EQ(*c.Get(10u), 30u);
+
+    c.Remove(10u);
+    EXPECT_EQ(c.Get(10u), nullptr);
+
+    TestCache<CacheFlatIndexPolicy<CacheTinyLfuPolicy<60>>> t;
+    EXPECT_EQ(Scan(t, true), 5u);
+}
+
+TEST(CacheTest, TryPutExisting)
+{
+    TestCache<CacheTinyLfuPolicy<60>> c;
+
+    for (unsigned i = 0; i < 10; ++i)
+        c.Put(i, i);
+    EXPECT_TRUE(c.IsFull());
+
+    /* an existing key is updated, regardless of the admission
+       filter */
+    auto *p = c.TryPut(3u, 42u);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(*p, 42u);
+    EXPECT_EQ(*c.Get(3u), 42u);
+
+    unsigned n = 0;
+    c.ForEach([&n](unsigned, unsigned){ ++n; });
+    EXPECT_EQ(n, 10u);
+}
+
+namespace {
+
+struct CountingHash {
+    static unsigned n;
+
+    size_t operator()(unsigned key) const noexcept {
+        ++n;
+        return std::hash<unsigned>()(key);
+    }
+};
+
+unsigned CountingHash::n;
+
+}
+
+/**
+ * Without an admission filter, a lookup hashes the key only for the
+ * index.
+ */
+TEST(CacheTest, NoAdmissionHash)
+{
+    Cache<unsigned, unsigned, 10, 7, CountingHash> c;
+    c.Put(1u, 1u);
+
+    CountingHash::n = 0;
+    EXPECT_NE(c.Get(1u), nullptr);
+    EXPECT_EQ(c.Get(2u), nullptr);
+    EXPECT_EQ(CountingHash::n, 2u);
+}
+
+TEST(CacheTest, NoAllocation)
+{
+    TestCache<CacheLruPolicy> c;
+
+    /* all items are pre-allocated; neither lookups nor insertions
+       nor evictions may allocate heap memory */
+    EXPECT_NO_ALLOCATION({
+        for (unsigned i = 0; i < 20; ++i)
+            c.Put(i, i * 2);
+
+        for (unsigned i = 0; i < 20; ++i)
+            c.Get(i);
+
+        c.Remove(15u);
+    });
+}
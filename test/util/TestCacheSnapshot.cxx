@@ -0,0 +1,178 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "util/CacheSnapshot.hxx"
+#include "util/Cache.hxx"
+#include "util/ExpiringCache.hxx"
+#include "util/ShardedCache.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::chrono::seconds;
+
+static ConstBuffer<void>
+ToBuffer(const std::string &s)
+{
+    return {s.data(), s.size()};
+}
+
+static std::string
+ToString(ConstBuffer<void> b)
+{
+    return {(const char *)b.data, b.size};
+}
+
+TEST(CacheSnapshotTest, LruOrder)
+{
+    Cache<std::string, std::string, 4, 3> c;
+    c.Put("a", "1");
+    c.Put("b", "2");
+    c.Put("c", "3");
+    c.Get("a");
+
+    CacheSnapshotWriter w;
+    c.ForEachOldestFirst([&w](const std::string &key, const std::string &value){
+        w.Add(ToBuffer(key), ToBuffer(value));
+    });
+    EXPECT_EQ(w.GetCount(), 3u);
+    const auto dump = w.Finish();
+
+    Cache<std::string, std::string, 4, 3> c2;
+    CacheSnapshotReader r(ToBuffer(dump));
+    CacheSnapshotReader::Item item;
+    while (r.Next(item)) {
+        EXPECT_EQ(item.expires, Expiry::Never());
+        c2.Put(ToString(item.key), ToString(item.value));
+    }
+
+    std::vector<std::string> keys;
+    c2.ForEachOldestFirst([&keys](const std::string &key, const std::string &){
+        keys.push_back(key);
+    });
+
+    const std::vector<std::string> expected{"b", "c", "a"};
+    EXPECT_EQ(keys, expected);
+
+    /* the oldest item is evicted first */
+    c2.Put("d", "4");
+    c2.Put("e", "5");
+    EXPECT_EQ(c2.Get("b"), nullptr);
+    ASSERT_NE(c2.Get("a"), nullptr);
+    EXPECT_EQ(*c2.Get("a"), "1");
+}
+
+TEST(CacheSnapshotTest, Expiry)
+{
+    ExpiringCache<std::string, std::string, 8, 7> c;
+
+    const auto now = Expiry::Now();
+    c.Put("a", "1", Expiry::Touched(now, seconds(10)), 7);
+    c.Put("b", "2", Expiry::Never());
+    c.Put("c", "3", Expiry::Touched(now, seconds(5)));
+
+    CacheSnapshotWriter w(Expiry::Touched(now, seconds(6)));
+    c.ForEachOldestFirst([&w](const std::string &key, const std::string &value,
+                              Expiry expires, size_t cost){
+        w.Add(ToBuffer(key), ToBuffer(value), expires, cost);
+    });
+
+    /* "c" has already expired */
+    EXPECT_EQ(w.GetCount(), 2u);
+    const auto dump = w.Finish();
+
+    const auto now2 = Expiry::Now();
+    CacheSnapshotReader r(ToBuffer(dump), now2);
+    CacheSnapshotReader::Item item;
+
+    ASSERT_TRUE(r.Next(item));
+    EXPECT_EQ(ToString(item.key), "a");
+    EXPECT_EQ(ToString(item.value), "1");
+    EXPECT_EQ(item.cost, 7u);
+    EXPECT_FALSE(item.expires.IsExpired(Expiry::Touched(now2, seconds(3))));
+    EXPECT_TRUE(item.expires.IsExpired(Expiry::Touched(now2, seconds(5))));
+
+    ASSERT_TRUE(r.Next(item));
+    EXPECT_EQ(ToString(item.key), "b");
+    EXPECT_EQ(item.expires, Expiry::Never());
+
+    EXPECT_FALSE(r.Next(item));
+}
+
+TEST(CacheSnapshotTest, Sharded)
+{
+    ShardedCache<unsigned, unsigned, 4, 16, 15> c;
+    for (unsigned i = 0; i < 16; ++i)
+        c.Put(i, i * 2);
+
+    CacheSnapshotWriter w;
+    c.ForEachOldestFirst([&w](const unsigned &key, const unsigned &value){
+        w.Add({&key, sizeof(key)}, {&value, sizeof(value)});
+    });
+    EXPECT_EQ(w.GetCount(), 16u);
+    const auto dump = w.Finish();
+
+    ShardedCache<unsigned, unsigned, 4, 16, 15> c2;
+    CacheSnapshotReader r(ToBuffer(dump));
+    CacheSnapshotReader::Item item;
+    while (r.Next(item)) {
+        ASSERT_EQ(item.key.size, sizeof(unsigned));
+        ASSERT_EQ(item.value.size, sizeof(unsigned));
+        c2.Put(*(const unsigned *)item.key.data,
+               *(const unsigned *)item.value.data);
+    }
+
+    for (unsigned i = 0; i < 16; ++i) {
+        unsigned value = 0;
+        ASSERT_TRUE(c2.Get(i, value));
+        EXPECT_EQ(value, i * 2);
+    }
+}
+
+TEST(CacheSnapshotTest, Corrupt)
+{
+    CacheSnapshotWriter w;
+    w.Add(ToBuffer("key"), ToBuffer("value"));
+    auto dump = w.Finish();
+
+    EXPECT_THROW(CacheSnapshotReader(ToBuffer(dump.substr(0, dump.size() - 1))),
+                 std::runtime_error);
+
+    dump[30] ^= 1;
+    EXPECT_THROW(CacheSnapshotReader{ToBuffer(dump)}, std::runtime_error);
+
+    EXPECT_THROW(CacheSnapshotReader{ToBuffer("garbage")}, std::runtime_error);
+}
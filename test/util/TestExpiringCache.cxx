@@ -0,0 +1,164 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/ExpiringCache.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using std::chrono::seconds;
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+TEST(ExpiringCacheTest, Expiry)
+{
+    ExpiringCache<unsigned, std::string, 8, 7> c;
+
+    const TimePoint t0{};
+
+    c.Put(1u, std::string("one"), Expiry::Touched(t0, seconds(10)));
+    c.Put(2u, std::string("two"), Expiry::Touched(t0, seconds(20)));
+    c.Put(3u, std::string("three"), Expiry::Touched(t0, seconds(30)));
+
+    auto *v = c.Get(1u, Expiry::Touched(t0, seconds(5)));
+    ASSERT_NE(v, nullptr);
+    EXPECT_EQ(*v, "one");
+
+    /* lazy expiry */
+    EXPECT_EQ(c.Get(1u, Expiry::Touched(t0, seconds(10))), nullptr);
+    EXPECT_EQ(c.Get(1u, Expiry::Touched(t0, seconds(5))), nullptr);
+
+    /* bounded sweep */
+    const Expiry later = Expiry::Touched(t0, seconds(40));
+    EXPECT_EQ(c.Sweep(later, 1), 1u);
+    EXPECT_EQ(c.Get(2u, Expiry::Touched(t0, seconds(5))), nullptr);
+    EXPECT_NE(c.Get(3u, Expiry::Touched(t0, seconds(5))), nullptr);
+    EXPECT_EQ(c.Sweep(later), 1u);
+    EXPECT_TRUE(c.IsEmpty());
+    EXPECT_EQ(c.Sweep(later), 0u);
+}
+
+TEST(ExpiringCacheTest, Cost)
+{
+    ExpiringCache<unsigned, unsigned, 8, 7> c(100);
+
+    const Expiry never = Expiry::Never();
+    const Expiry now = Expiry::AlreadyExpired();
+
+    EXPECT_NE(c.Put(1u, 1u, never, 40), nullptr);
+    EXPECT_NE(c.Put(2u, 2u, never, 40), nullptr);
+    EXPECT_EQ(c.GetTotalCost(), 80u);
+
+    /* too expensive for the whole cache */
+    EXPECT_EQ(c.Put(3u, 3u, never, 101), nullptr);
+
+    /* touch 1, so 2 becomes the LRU item */
+    EXPECT_NE(c.Get(1u, now), nullptr);
+
+    EXPECT_NE(c.Put(3u, 3u, never, 40), nullptr);
+    EXPECT_EQ(c.GetTotalCost(), 80u);
+    EXPECT_NE(c.Get(1u, now), nullptr);
+    EXPECT_EQ(c.Get(2u, now), nullptr);
+    EXPECT_NE(c.Get(3u, now), nullptr);
+
+    /* replace */
+    EXPECT_NE(c.Put(3u, 33u, never, 10), nullptr);
+    EXPECT_EQ(c.GetTotalCost(), 50u);
+    EXPECT_EQ(*c.Get(3u, now), 33u);
+
+    /* a replacement which is too expensive removes the stale
+       item */
+    EXPECT_EQ(c.Put(3u, 333u, never, 101), nullptr);
+    EXPECT_EQ(c.Get(3u, now), nullptr);
+    EXPECT_EQ(c.GetTotalCost(), 40u);
+
+    c.Remove(1u);
+    EXPECT_EQ(c.GetTotalCost(), 0u);
+}
+
+TEST(ExpiringCacheTest, Reclaim)
+{
+    ExpiringCache<unsigned, unsigned, 8, 7> c;
+
+    const Expiry never = Expiry::Never();
+    const Expiry now = Expiry::AlreadyExpired();
+
+    c.Put(1u, 1u, never, 10);
+    c.Put(2u, 2u, never, 20);
+    c.Put(3u, 3u, never, 30);
+
+    /* touch 1, so 2 becomes the LRU item */
+    EXPECT_NE(c.Get(1u, now), nullptr);
+
+    EXPECT_EQ(c.Reclaim(25), 50u);
+    EXPECT_EQ(c.GetTotalCost(), 10u);
+    EXPECT_NE(c.Get(1u, now), nullptr);
+
+    EXPECT_EQ(c.Reclaim(0), 0u);
+    EXPECT_EQ(c.Reclaim(100), 10u);
+    EXPECT_TRUE(c.IsEmpty());
+}
+
+TEST(ExpiringCacheTest, Count)
+{
+    ExpiringCache<unsigned, unsigned, 2, 3> c;
+
+    const Expiry never = Expiry::Never();
+    const Expiry now = Expiry::AlreadyExpired();
+
+    c.Put(1u, 1u, never);
+    c.Put(2u, 2u, never);
+    EXPECT_TRUE(c.IsFull());
+    c.Put(3u, 3u, never);
+    EXPECT_EQ(c.Get(1u, now), nullptr);
+    EXPECT_NE(c.Get(2u, now), nullptr);
+    EXPECT_NE(c.Get(3u, now), nullptr);
+}
+
+TEST(ExpiringCacheTest, RemoveIf)
+{
+    ExpiringCache<unsigned, unsigned, 8, 7> c;
+
+    const Expiry never = Expiry::Never();
+    const Expiry now = Expiry::AlreadyExpired();
+
+    for (unsigned i = 0; i < 6; ++i)
+        c.Put(i, i * 10, never);
+
+    EXPECT_EQ(c.RemoveIf([](unsigned key, unsigned){ return key % 2 == 0; }), 3u);
+    EXPECT_EQ(c.Get(0u, now), nullptr);
+    EXPECT_NE(c.Get(1u, now), nullptr);
+    EXPECT_EQ(c.Get(2u, now), nullptr);
+    EXPECT_NE(c.Get(5u, now), nullptr);
+    EXPECT_EQ(c.RemoveIf([](unsigned, unsigned){ return false; }), 0u);
+}
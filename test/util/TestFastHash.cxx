@@ -0,0 +1,116 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/FastHash.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <unordered_set>
+
+#include <string.h>
+
+TEST(FastHash, Stable)
+{
+	/* the values must never change, because they may be used
+	   for consistent hashing across hosts */
+	EXPECT_EQ(FastHash64(""), 0x409638ee2bde459ull);
+	EXPECT_EQ(FastHash64("a"), 0x28d2053309d28531ull);
+	EXPECT_EQ(FastHash64("abc"), 0x2a4f1d7cb516c72ull);
+	EXPECT_EQ(FastHash64("hello world"), 0x668d5e431c3b2573ull);
+	EXPECT_EQ(FastHash64("0123456789abcdef"), 0xc304e72c387cd229ull);
+	EXPECT_EQ(FastHash64("0123456789abcdefg"), 0xb496f8f306600195ull);
+
+	const std::string large(1000, 'x');
+	EXPECT_EQ(FastHash64(large.data(), large.size()), 0x21f496a4092af66aull);
+}
+
+TEST(FastHash, Seed)
+{
+	EXPECT_NE(FastHash64("foo", 0), FastHash64("foo", 1));
+	EXPECT_EQ(FastHash64("foo", 42), FastHash64("foo", 42));
+}
+
+TEST(FastHash, Alignment)
+{
+	const std::string src(2000, 'y');
+	char buffer[2100];
+
+	for (size_t offset = 0; offset < 16; ++offset) {
+		for (size_t length : {0, 3, 8, 17, 49, 511, 512, 1100, 2000}) {
+			memcpy(buffer + offset, src.data(), length);
+			EXPECT_EQ(FastHash64(buffer + offset, length),
+				  FastHash64(src.data(), length));
+		}
+	}
+}
+
+TEST(FastHash, Unique)
+{
+	/* every length and every single-bit change must yield a
+	   different hash */
+	std::unordered_set<uint64_t> seen;
+	std::string s;
+
+	for (unsigned length = 0; length < 600; ++length) {
+		ASSERT_TRUE(seen.insert(FastHash64(s.data(), s.size())).second);
+
+		if (length % 37 == 0) {
+			for (unsigned bit = 0; bit < s.size() * 8; bit += 5) {
+				std::string t = s;
+				t[bit / 8] ^= char(1 << (bit % 8));
+				ASSERT_TRUE(seen.insert(FastHash64(t.data(), t.size())).second);
+			}
+		}
+
+		s.push_back(char('a' + length % 26));
+	}
+}
+
+TEST(FastHash, Distribution)
+{
+	static constexpr unsigned N_BUCKETS = 64;
+	static constexpr unsigned N_KEYS = 64000;
+
+	unsigned buckets[N_BUCKETS] = {};
+
+	const FastStringHash hash;
+	for (unsigned i = 0; i < N_KEYS; ++i) {
+		const std::string key = "/some/long/uri/prefix/" + std::to_string(i);
+		++buckets[hash(key) % N_BUCKETS];
+	}
+
+	for (unsigned n : buckets) {
+		EXPECT_GT(n, N_KEYS / N_BUCKETS * 8 / 10);
+		EXPECT_LT(n, N_KEYS / N_BUCKETS * 12 / 10);
+	}
+}
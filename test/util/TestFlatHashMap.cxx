@@ -0,0 +1,199 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/FlatHashMap.hxx"
+#include "../AllocationCounter.hxx"
+
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <string>
+
+TEST(FlatHashMapTest, Basic)
+{
+    FlatHashMap<unsigned, unsigned> m;
+    EXPECT_TRUE(m.IsEmpty());
+    EXPECT_EQ(m.Find(1), nullptr);
+    EXPECT_FALSE(m.Erase(1));
+
+    auto i = m.Insert(1u, 10u);
+    EXPECT_TRUE(i.second);
+    EXPECT_EQ(*i.first, 10u);
+
+    i = m.Insert(1u, 20u);
+    EXPECT_FALSE(i.second);
+    EXPECT_EQ(*i.first, 10u);
+
+    EXPECT_EQ(m.GetSize(), 1u);
+    ASSERT_NE(m.Find(1), nullptr);
+    EXPECT_EQ(*m.Find(1), 10u);
+
+    EXPECT_TRUE(m.Erase(1));
+    EXPECT_EQ(m.Find(1), nullptr);
+    EXPECT_TRUE(m.IsEmpty());
+}
+
+TEST(FlatHashMapTest, Grow)
+{
+    FlatHashMap<unsigned, unsigned> m;
+
+    for (unsigned i = 0; i < 10000; ++i)
+        ASSERT_TRUE(m.Insert(i, i * 3).second);
+    EXPECT_EQ(m.GetSize(), 10000u);
+
+    for (unsigned i = 0; i < 10000; ++i) {
+        const auto *v = m.Find(i);
+        ASSERT_NE(v, nullptr);
+        EXPECT_EQ(*v, i * 3);
+    }
+
+    EXPECT_EQ(m.Find(10000), nullptr);
+
+    size_t n = 0;
+    m.ForEach([&n](unsigned key, unsigned value){
+        EXPECT_EQ(value, key * 3);
+        ++n;
+    });
+    EXPECT_EQ(n, 10000u);
+}
+
+/**
+ * Insert and erase many keys in a small table, which leaves
+ * tombstones behind; lookups must still find all live keys.
+ */
+TEST(FlatHashMapTest, Churn)
+{
+    FlatHashMap<unsigned, std::string> m;
+    m.Reserve(64);
+
+    for (unsigned i = 0; i < 100000; ++i) {
+        ASSERT_TRUE(m.Insert(i, std::to_string(i)).second);
+        if (i >= 50) {
+            ASSERT_TRUE(m.Erase(i - 50));
+        }
+    }
+
+    EXPECT_EQ(m.GetSize(), 50u);
+
+    for (unsigned i = 100000 - 50; i < 100000; ++i) {
+        const auto *v = m.Find(i);
+        ASSERT_NE(v, nullptr);
+        EXPECT_EQ(*v, std::to_string(i));
+    }
+
+    for (unsigned i = 0; i < 100000 - 50; ++i)
+        EXPECT_EQ(m.Find(i), nullptr);
+
+    m.Clear();
+    EXPECT_TRUE(m.IsEmpty());
+    EXPECT_EQ(m.Find(100000 - 1), nullptr);
+}
+
+/**
+ * After Reserve(), inserting and erasing must not allocate, even
+ * when tombstones fill up the table.
+ */
+TEST(FlatHashMapTest, ChurnWithoutAllocation)
+{
+    FlatHashMap<unsigned, unsigned> m;
+    m.Reserve(100);
+
+    for (unsigned i = 0; i < 100; ++i)
+        m.Insert(i, i);
+
+    EXPECT_NO_ALLOCATION({
+        for (unsigned i = 100; i < 100000; ++i) {
+            m.Erase(i - 100);
+            m.Insert(i, i);
+        }
+    });
+
+    EXPECT_EQ(m.GetSize(), 100u);
+    for (unsigned i = 100000 - 100; i < 100000; ++i) {
+        const auto *v = m.Find(i);
+        ASSERT_NE(v, nullptr);
+        EXPECT_EQ(*v, i);
+    }
+
+    EXPECT_EQ(m.Find(100000 - 101), nullptr);
+}
+
+namespace {
+
+struct ThrowingValue {
+    unsigned value;
+
+    explicit ThrowingValue(unsigned _value):value(_value) {
+        if (value == 0)
+            throw 42;
+    }
+};
+
+}
+
+TEST(FlatHashMapTest, InsertThrows)
+{
+    FlatHashMap<unsigned, ThrowingValue> m;
+    ASSERT_TRUE(m.Insert(1u, 1u).second);
+    EXPECT_THROW(m.Insert(2u, 0u), int);
+
+    EXPECT_EQ(m.GetSize(), 1u);
+    EXPECT_EQ(m.Find(2), nullptr);
+
+    size_t n = 0;
+    m.ForEach([&n](unsigned, ThrowingValue &v){
+        EXPECT_EQ(v.value, 1u);
+        ++n;
+    });
+    EXPECT_EQ(n, 1u);
+
+    /* the slot can be used again */
+    ASSERT_TRUE(m.Insert(2u, 2u).second);
+    EXPECT_EQ(m.Find(2)->value, 2u);
+}
+
+TEST(FlatHashMapTest, Move)
+{
+    FlatHashMap<std::string, unsigned> a;
+    a.Insert(std::string("foo"), 1u);
+    a.Insert(std::string("bar"), 2u);
+
+    FlatHashMap<std::string, unsigned> b(std::move(a));
+    EXPECT_TRUE(a.IsEmpty());
+    EXPECT_EQ(a.Find("foo"), nullptr);
+    ASSERT_NE(b.Find("foo"), nullptr);
+    EXPECT_EQ(*b.Find("bar"), 2u);
+
+    a = std::move(b);
+    EXPECT_EQ(a.GetSize(), 2u);
+    EXPECT_EQ(*a.Find("foo"), 1u);
+}
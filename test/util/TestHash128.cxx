@@ -0,0 +1,82 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Hash128.hxx"
+
+#include <gtest/gtest.h>
+
+#include <set>
+
+static Hash128
+HashFields(const char *a, const char *b)
+{
+	Hash128Builder h;
+	h.UpdateString(a);
+	h.UpdateString(b);
+	return h.Finish();
+}
+
+TEST(Hash128, Basic)
+{
+	EXPECT_EQ(HashFields("foo", "bar"), HashFields("foo", "bar"));
+	EXPECT_NE(HashFields("foo", "bar"), HashFields("bar", "foo"));
+
+	/* field boundaries are part of the hash */
+	EXPECT_NE(HashFields("ab", "c"), HashFields("a", "bc"));
+
+	/* nullptr is different from the empty string */
+	EXPECT_NE(HashFields(nullptr, "x"), HashFields("", "x"));
+	EXPECT_NE(HashFields(nullptr, nullptr), HashFields(nullptr, ""));
+
+	EXPECT_NE(Hash128Builder().Finish(), HashFields(nullptr, nullptr));
+}
+
+TEST(Hash128, Values)
+{
+	std::set<uint64_t> a, b;
+	std::set<Hash128> all;
+
+	for (unsigned i = 0; i < 10000; ++i) {
+		Hash128Builder h;
+		h.UpdateT(i);
+		h.UpdateT(true);
+		const auto hash = h.Finish();
+		a.insert(hash.a);
+		b.insert(hash.b);
+		all.insert(hash);
+	}
+
+	/* both halves are distinct */
+	EXPECT_EQ(a.size(), 10000u);
+	EXPECT_EQ(b.size(), 10000u);
+	EXPECT_EQ(all.size(), 10000u);
+}
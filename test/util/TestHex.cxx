@@ -0,0 +1,128 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/HexFormat.h"
+#include "util/HexParse.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+static std::string
+Format(const std::string &src, bool ct=false)
+{
+	std::string result(src.size() * 2, '?');
+	char *end = ct
+		? format_hex_buffer_ct(&result[0], src.data(), src.size())
+		: format_hex_buffer(&result[0], src.data(), src.size());
+	EXPECT_EQ(end, result.data() + result.size());
+	return result;
+}
+
+static std::string
+ReferenceFormat(const std::string &src)
+{
+	std::string result;
+	for (unsigned char ch : src) {
+		result.push_back(hex_digits[ch >> 4]);
+		result.push_back(hex_digits[ch & 0xf]);
+	}
+	return result;
+}
+
+TEST(Hex, Format)
+{
+	EXPECT_EQ(Format(""), "");
+	EXPECT_EQ(Format("\x01\xab\xff"), "01abff");
+	EXPECT_EQ(Format("\x01\xab\xff", true), "01abff");
+
+	/* all lengths around the vector size, with all byte values */
+	std::string all;
+	for (unsigned i = 0; i < 256; ++i)
+		all.push_back(char(i));
+
+	for (size_t length = 0; length <= 256; length += 7) {
+		const std::string src = all.substr(256 - length);
+		EXPECT_EQ(Format(src), ReferenceFormat(src));
+		EXPECT_EQ(Format(src, true), ReferenceFormat(src));
+	}
+}
+
+static bool
+Parse(const std::string &src, std::string &dest, bool ct=false)
+{
+	dest.assign(src.size() / 2, 0);
+	return ct
+		? ParseHexBufferConstantTime(&dest[0], src.data(), dest.size())
+		: ParseHexBuffer(&dest[0], src.data(), dest.size());
+}
+
+TEST(Hex, Parse)
+{
+	std::string all;
+	for (unsigned i = 0; i < 256; ++i)
+		all.push_back(char(i));
+
+	for (size_t length = 0; length <= 256; length += 5) {
+		const std::string src = all.substr(0, length);
+		const std::string hex = ReferenceFormat(src);
+
+		std::string upper = hex;
+		for (auto &ch : upper)
+			ch = char(toupper(ch));
+
+		for (bool ct : {false, true}) {
+			std::string dest;
+			ASSERT_TRUE(Parse(hex, dest, ct));
+			EXPECT_EQ(dest, src);
+
+			ASSERT_TRUE(Parse(upper, dest, ct));
+			EXPECT_EQ(dest, src);
+		}
+	}
+}
+
+TEST(Hex, ParseInvalid)
+{
+	const std::string valid = ReferenceFormat(std::string(40, '\x5a'));
+
+	for (size_t i = 0; i < valid.size(); i += 3) {
+		for (char invalid : {'g', 'G', '/', ':', '@', '`', ' ', '\0', '\x80', '\xb0', '\xe1'}) {
+			std::string s = valid;
+			s[i] = invalid;
+
+			std::string dest;
+			EXPECT_FALSE(Parse(s, dest, false));
+			EXPECT_FALSE(Parse(s, dest, true));
+		}
+	}
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/LogLinearHistogram.hxx"
+
+#include <gtest/gtest.h>
+
+TEST(LogLinearHistogramTest, Buckets)
+{
+    typedef LogLinearHistogram<2, 32> H;
+
+    /* small values get one bucket each */
+    EXPECT_EQ(H::ValueToBucket(0), 0u);
+    EXPECT_EQ(H::ValueToBucket(3), 3u);
+
+    /* 4..7 are still exact */
+    EXPECT_EQ(H::ValueToBucket(4), 4u);
+    EXPECT_EQ(H::ValueToBucket(7), 7u);
+
+    /* 8..15 share 4 buckets */
+    EXPECT_EQ(H::ValueToBucket(8), 8u);
+    EXPECT_EQ(H::ValueToBucket(9), 8u);
+    EXPECT_EQ(H::ValueToBucket(10), 9u);
+    EXPECT_EQ(H::ValueToBucket(15), 11u);
+    EXPECT_EQ(H::ValueToBucket(16), 12u);
+
+    /* overflow */
+    EXPECT_EQ(H::ValueToBucket(~uint64_t(0)), H::N_BUCKETS - 1);
+
+    for (unsigned i = 0; i < H::N_BUCKETS; ++i) {
+        EXPECT_EQ(H::ValueToBucket(H::GetLowerBound(i)), i);
+        if (i > 0) {
+            EXPECT_EQ(H::ValueToBucket(H::GetLowerBound(i) - 1), i - 1);
+        }
+    }
+}
+
+TEST(LogLinearHistogramTest, Quantile)
+{
+    LogLinearHistogram<> h;
+    EXPECT_EQ(h.GetTotal(), 0u);
+    EXPECT_EQ(h.GetQuantile(0.5), 0u);
+
+    for (unsigned i = 0; i < 99; ++i)
+        h.Add(1);
+    h.Add(1000);
+
+    EXPECT_EQ(h.GetTotal(), 100u);
+    EXPECT_EQ(h.GetQuantile(0.5), 1u);
+    EXPECT_EQ(h.GetQuantile(0.98), 1u);
+    EXPECT_EQ(h.GetQuantile(1), 896u);
+
+    h.Clear();
+    EXPECT_EQ(h.GetTotal(), 0u);
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/MPSCQueue.hxx"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+TEST(MPSCQueue, Basic)
+{
+    MPSCQueue<int, 4> q;
+
+    int value;
+    EXPECT_FALSE(q.Pop(value));
+
+    EXPECT_TRUE(q.Push(1));
+    EXPECT_TRUE(q.Push(2));
+
+    int src[] = {3, 4, 5};
+    EXPECT_EQ(q.PushBatch(src, 3), 2u);
+    EXPECT_FALSE(q.Push(6));
+
+    int dest[8];
+    EXPECT_EQ(q.PopBatch(dest, 8), 4u);
+    EXPECT_EQ(dest[0], 1);
+    EXPECT_EQ(dest[1], 2);
+    EXPECT_EQ(dest[2], 3);
+    EXPECT_EQ(dest[3], 4);
+
+    EXPECT_TRUE(q.Push(7));
+    EXPECT_TRUE(q.Pop(value));
+    EXPECT_EQ(value, 7);
+    EXPECT_FALSE(q.Pop(value));
+}
+
+TEST(MPSCQueue, Thread)
+{
+    static MPSCQueue<unsigned, 64> q;
+    constexpr unsigned N_THREADS = 4, N = 20000;
+
+    std::vector<std::thread> producers;
+    for (unsigned t = 0; t < N_THREADS; ++t)
+        producers.emplace_back([t]{
+            for (unsigned i = 0; i < N;) {
+                /* push some with PushBatch() */
+                unsigned batch[2] = {
+                    t << 24 | i,
+                    t << 24 | (i + 1),
+                };
+
+                if (i + 1 < N && (i % 4) == 0) {
+                    size_t n = q.PushBatch(batch, 2);
+                    i += n;
+                } else if (q.Push(batch[0]))
+                    ++i;
+            }
+        });
+
+    /* the values of each producer must arrive in order */
+    unsigned next[N_THREADS] = {};
+    unsigned total = 0;
+    while (total < N_THREADS * N) {
+        unsigned value;
+        if (!q.Pop(value))
+            continue;
+
+        const unsigned t = value >> 24;
+        ASSERT_LT(t, N_THREADS);
+        ASSERT_EQ(value & 0xffffff, next[t]);
+        ++next[t];
+        ++total;
+    }
+
+    for (auto &i : producers)
+        i.join();
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/MaglevHashRing.hxx"
+#include "util/FastHash.hxx"
+
+#include <gtest/gtest.h>
+
+#include <map>
+
+namespace {
+
+struct Node {
+    const char *name;
+    unsigned weight;
+};
+
+struct NodeHasher {
+    uint64_t operator()(const Node &node, size_t replica) const {
+        return FastHash64(node.name, replica);
+    }
+};
+
+struct NodeWeight {
+    unsigned operator()(const Node &node) const {
+        return node.weight;
+    }
+};
+
+static constexpr size_t N_BUCKETS = 4099;
+using Ring = MaglevHashRing<const Node, uint64_t, N_BUCKETS>;
+
+template<typename R>
+static std::map<const Node *, size_t>
+Count(const R &r)
+{
+    std::map<const Node *, size_t> result;
+    for (uint64_t h = 0; h < N_BUCKETS; ++h)
+        ++result[&r.Pick(h)];
+    return result;
+}
+
+}
+
+TEST(MaglevHashRingTest, Empty)
+{
+    Ring r;
+    ASSERT_TRUE(r.IsEmpty());
+
+    static const std::array<Node, 1> nodes{{{"a", 0}}};
+    r.Build(nodes, NodeHasher(), NodeWeight());
+    ASSERT_TRUE(r.IsEmpty());
+}
+
+TEST(MaglevHashRingTest, Balance)
+{
+    static const std::array<Node, 4> nodes{{
+        {"a", 1}, {"b", 1}, {"c", 1}, {"d", 1},
+    }};
+
+    Ring r;
+    r.Build(nodes, NodeHasher());
+    ASSERT_FALSE(r.IsEmpty());
+
+    const auto count = Count(r);
+    ASSERT_EQ(count.size(), nodes.size());
+    for (const auto &i : count) {
+        EXPECT_GE(i.second, N_BUCKETS / 4 - 1);
+        EXPECT_LE(i.second, N_BUCKETS / 4 + 1);
+    }
+}
+
+TEST(MaglevHashRingTest, Weight)
+{
+    static const std::array<Node, 3> nodes{{
+        {"a", 1}, {"b", 2}, {"c", 5},
+    }};
+
+    Ring r;
+    r.Build(nodes, NodeHasher(), NodeWeight());
+
+    auto count = Count(r);
+    ASSERT_EQ(count.size(), nodes.size());
+    EXPECT_NEAR(count[&nodes[0]], N_BUCKETS / 8, 2);
+    EXPECT_NEAR(count[&nodes[1]], N_BUCKETS * 2 / 8, 2);
+    EXPECT_NEAR(count[&nodes[2]], N_BUCKETS * 5 / 8, 2);
+
+    ASSERT_TRUE(r.SetWeight(nodes[2], 1));
+    count = Count(r);
+    EXPECT_NEAR(count[&nodes[0]], N_BUCKETS / 4, 2);
+    EXPECT_NEAR(count[&nodes[1]], N_BUCKETS / 2, 2);
+    EXPECT_NEAR(count[&nodes[2]], N_BUCKETS / 4, 2);
+
+    ASSERT_TRUE(r.SetWeight(nodes[2], 0));
+    count = Count(r);
+    ASSERT_EQ(count.size(), 2u);
+    ASSERT_EQ(count.count(&nodes[2]), 0u);
+}
+
+TEST(MaglevHashRingTest, AddRemove)
+{
+    static const std::array<Node, 6> nodes{{
+        {"a", 1}, {"b", 1}, {"c", 1}, {"d", 1}, {"e", 1}, {"f", 1},
+    }};
+
+    Ring r;
+    r.Build(nodes, NodeHasher());
+
+    std::array<const Node *, N_BUCKETS> before;
+    for (uint64_t h = 0; h < N_BUCKETS; ++h)
+        before[h] = &r.Pick(h);
+
+    ASSERT_TRUE(r.Remove(nodes[3]));
+    ASSERT_FALSE(r.Remove(nodes[3]));
+
+    /* only a small fraction of buckets not owned by the removed
+       node may move */
+    size_t moved = 0;
+    for (uint64_t h = 0; h < N_BUCKETS; ++h) {
+        const Node *n = &r.Pick(h);
+        ASSERT_NE(n, &nodes[3]);
+        if (before[h] != &nodes[3] && before[h] != n)
+            ++moved;
+    }
+
+    EXPECT_LT(moved, N_BUCKETS / 20);
+
+    /* adding it back makes it reachable again */
+    r.Add(nodes[3], NodeHasher());
+    ASSERT_EQ(Count(r).size(), nodes.size());
+}
+
+TEST(MaglevHashRingTest, FindNext)
+{
+    static const std::array<Node, 3> nodes{{
+        {"a", 1}, {"b", 1}, {"c", 1},
+    }};
+
+    Ring r;
+    r.Build(nodes, NodeHasher());
+
+    for (uint64_t h = 0; h < N_BUCKETS; ++h) {
+        const auto &n = r.Pick(h);
+        auto next = r.FindNext(h);
+        ASSERT_NE(&next.second, &n);
+        ASSERT_EQ(&r.Pick(next.first), &next.second);
+    }
+
+    static const std::array<Node, 1> single{{{"a", 1}}};
+    r.Build(single, NodeHasher());
+    ASSERT_EQ(&r.FindNext(42).second, &single[0]);
+}
+
+TEST(MaglevHashRingTest, FindIf)
+{
+    static const std::array<Node, 3> nodes{{
+        {"a", 1}, {"b", 1}, {"c", 1},
+    }};
+
+    Ring r;
+    r.Build(nodes, NodeHasher());
+
+    for (uint64_t h = 0; h < 64; ++h) {
+        const auto &n = r.Pick(h);
+        ASSERT_EQ(r.FindIf(h, [](const Node &){ return true; }), &n);
+
+        const Node *found = r.FindIf(h, [&n](const Node &i){
+            return &i != &n;
+        });
+        ASSERT_NE(found, nullptr);
+        ASSERT_NE(found, &n);
+
+        ASSERT_EQ(r.FindIf(h, [](const Node &){ return false; }),
+                  nullptr);
+    }
+
+    /* bounded loads: no node gets more than its share */
+    std::map<const Node *, size_t> load;
+    const size_t n_keys = 300, capacity = n_keys / nodes.size();
+    for (uint64_t h = 0; h < n_keys; ++h) {
+        const Node *found = r.FindIf(h * 7919, [&](const Node &i){
+            return load[&i] < capacity;
+        });
+        ASSERT_NE(found, nullptr);
+        ++load[found];
+    }
+
+    for (const auto &i : load)
+        ASSERT_EQ(i.second, capacity);
+}
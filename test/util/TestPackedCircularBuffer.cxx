@@ -0,0 +1,110 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/PackedCircularBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+TEST(PackedCircularBuffer, Basic)
+{
+	alignas(int) uint8_t buffer[sizeof(int) * 4];
+	PackedCircularBuffer<int> cb(WritableBuffer<void>(buffer, sizeof(buffer)));
+	ASSERT_TRUE(cb.empty());
+	ASSERT_EQ(cb.capacity(), 4u);
+
+	for (int i = 0; i < 4; ++i)
+		cb.push_back(i);
+
+	ASSERT_TRUE(cb.full());
+	ASSERT_EQ(cb.front(), 0);
+	ASSERT_EQ(cb.back(), 3);
+
+	/* overwrite the oldest item */
+	cb.push_back(4);
+	ASSERT_EQ(cb.size(), 4u);
+	ASSERT_EQ(cb.front(), 1);
+	ASSERT_EQ(cb.back(), 4);
+	ASSERT_EQ(cb[0], 1);
+	ASSERT_EQ(cb[3], 4);
+
+	/* wrapped around: the span covers only the first part */
+	auto span = cb.front_span();
+	ASSERT_EQ(span.size, 3u);
+	ASSERT_EQ(span.data[0], 1);
+	cb.pop_front_n(span.size);
+
+	span = cb.front_span();
+	ASSERT_EQ(span.size, 1u);
+	ASSERT_EQ(span.data[0], 4);
+
+	cb.pop_front();
+	ASSERT_TRUE(cb.empty());
+	ASSERT_EQ(cb.front_span().size, 0u);
+}
+
+TEST(PackedCircularBuffer, Bulk)
+{
+	int buffer[8];
+	PackedCircularBuffer<int> cb(WritableBuffer<void>(buffer, sizeof(buffer)));
+	ASSERT_EQ(cb.capacity(), 8u);
+
+	const int src[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+	int dest[16];
+
+	cb.push_back_n(src, 5);
+	ASSERT_EQ(cb.pop_front_n(dest, 3), 3u);
+	ASSERT_EQ(dest[0], 0);
+	ASSERT_EQ(dest[2], 2);
+
+	/* wraps around the end of the array */
+	cb.push_back_n(src + 5, 5);
+	ASSERT_EQ(cb.size(), 7u);
+	ASSERT_EQ(cb.front(), 3);
+	ASSERT_EQ(cb.back(), 9);
+
+	/* discards the oldest item */
+	cb.push_back_n(src + 10, 2);
+	ASSERT_EQ(cb.size(), 8u);
+	ASSERT_EQ(cb.front(), 4);
+
+	ASSERT_EQ(cb.pop_front_n(dest, 16), 8u);
+	for (unsigned i = 0; i < 8; ++i)
+		ASSERT_EQ(dest[i], int(4 + i));
+	ASSERT_TRUE(cb.empty());
+
+	/* more than the capacity: only the newest items are kept */
+	cb.push_back_n(src, 12);
+	ASSERT_EQ(cb.size(), 8u);
+	ASSERT_EQ(cb.front_span().size, 8u);
+	ASSERT_EQ(cb.front(), 4);
+	ASSERT_EQ(cb.back(), 11);
+}
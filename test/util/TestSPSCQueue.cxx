@@ -0,0 +1,110 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/SPSCQueue.hxx"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+TEST(SPSCQueue, Basic)
+{
+    SPSCQueue<int, 4> q;
+    EXPECT_TRUE(q.empty());
+
+    int value;
+    EXPECT_FALSE(q.Pop(value));
+
+    EXPECT_TRUE(q.Push(1));
+    EXPECT_TRUE(q.Push(2));
+    EXPECT_TRUE(q.Push(3));
+    EXPECT_TRUE(q.Push(4));
+    EXPECT_FALSE(q.Push(5));
+    EXPECT_FALSE(q.empty());
+
+    EXPECT_TRUE(q.Pop(value));
+    EXPECT_EQ(value, 1);
+    EXPECT_TRUE(q.Push(5));
+
+    int buffer[8];
+    EXPECT_EQ(q.PopBatch(buffer, 8), 4u);
+    EXPECT_EQ(buffer[0], 2);
+    EXPECT_EQ(buffer[3], 5);
+    EXPECT_TRUE(q.empty());
+}
+
+TEST(SPSCQueue, Batch)
+{
+    SPSCQueue<int, 8> q;
+
+    int src[] = {1, 2, 3, 4, 5, 6};
+    EXPECT_EQ(q.PushBatch(src, 6), 6u);
+    EXPECT_EQ(q.PushBatch(src, 6), 2u);
+
+    int dest[4];
+    EXPECT_EQ(q.PopBatch(dest, 4), 4u);
+    EXPECT_EQ(dest[0], 1);
+    EXPECT_EQ(dest[3], 4);
+
+    EXPECT_EQ(q.PushBatch(src, 6), 4u);
+
+    int value, expected[] = {5, 6, 1, 2, 1, 2, 3, 4};
+    for (int i : expected) {
+        ASSERT_TRUE(q.Pop(value));
+        EXPECT_EQ(value, i);
+    }
+
+    EXPECT_FALSE(q.Pop(value));
+}
+
+TEST(SPSCQueue, Thread)
+{
+    static SPSCQueue<unsigned, 64> q;
+    constexpr unsigned N = 100000;
+
+    std::thread producer([]{
+        for (unsigned i = 0; i < N;)
+            if (q.Push(i))
+                ++i;
+    });
+
+    unsigned expected = 0;
+    while (expected < N) {
+        unsigned buffer[16];
+        const size_t n = q.PopBatch(buffer, 16);
+        for (size_t i = 0; i < n; ++i)
+            ASSERT_EQ(buffer[i], expected++);
+    }
+
+    producer.join();
+    EXPECT_TRUE(q.empty());
+}
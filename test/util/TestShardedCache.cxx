@@ -0,0 +1,113 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/ShardedCache.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+typedef ShardedCache<unsigned, unsigned, 4, 64, 61> TestCache;
+
+TEST(ShardedCacheTest, Basic)
+{
+    std::unique_ptr<TestCache> c(new TestCache());
+
+    unsigned value;
+    EXPECT_FALSE(c->Get(1u, value));
+
+    c->Put(1u, 10u);
+    c->Put(2u, 20u);
+    ASSERT_TRUE(c->Get(1u, value));
+    EXPECT_EQ(value, 10u);
+
+    /* replace */
+    c->Put(1u, 11u);
+    ASSERT_TRUE(c->Get(1u, value));
+    EXPECT_EQ(value, 11u);
+
+    EXPECT_TRUE(c->Lookup(2u, [](unsigned &v){ v = 21; }));
+    ASSERT_TRUE(c->Get(2u, value));
+    EXPECT_EQ(value, 21u);
+
+    EXPECT_TRUE(c->Remove(2u));
+    EXPECT_FALSE(c->Remove(2u));
+    EXPECT_FALSE(c->Get(2u, value));
+
+    const auto stats = c->GetStats();
+    EXPECT_EQ(stats.hits, 4u);
+    EXPECT_EQ(stats.misses, 2u);
+    EXPECT_EQ(stats.insertions, 3u);
+
+    c->Clear();
+    EXPECT_FALSE(c->Get(1u, value));
+}
+
+TEST(ShardedCacheTest, Distribution)
+{
+    size_t count[TestCache::GetShardCount()] = {};
+    for (unsigned i = 0; i < 4096; ++i)
+        ++count[TestCache::GetShardIndex(i)];
+
+    for (auto i : count) {
+        EXPECT_GT(i, 512u);
+        EXPECT_LT(i, 1536u);
+    }
+}
+
+TEST(ShardedCacheTest, Threads)
+{
+    std::unique_ptr<TestCache> c(new TestCache());
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < 4; ++t)
+        threads.emplace_back([&c, t]{
+            for (unsigned i = 0; i < 10000; ++i) {
+                const unsigned key = (i * 7 + t) % 200;
+                unsigned value;
+                if (c->Get(key, value))
+                    ASSERT_EQ(value, key * 3);
+                else
+                    c->Put(key, key * 3);
+            }
+        });
+
+    for (auto &i : threads)
+        i.join();
+
+    c->RemoveIf([](unsigned key, unsigned){ return key % 2 == 0; });
+
+    unsigned value;
+    EXPECT_FALSE(c->Get(100u, value));
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/SmallStringBuilder.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <stdint.h>
+
+TEST(SmallStringBuilder, Inline)
+{
+	SmallStringBuilder<16> b;
+	ASSERT_TRUE(b.empty());
+	ASSERT_TRUE(b.IsInline());
+	ASSERT_STREQ(b.c_str(), "");
+
+	b.Append("foo");
+	b.Append('=');
+	b.Append(StringView("bar"));
+	ASSERT_EQ(b.size(), 7u);
+	ASSERT_STREQ(b.c_str(), "foo=bar");
+	ASSERT_TRUE(b.IsInline());
+
+	/* exactly fills the inline buffer */
+	b.Append("12345678");
+	ASSERT_EQ(b.size(), 15u);
+	ASSERT_TRUE(b.IsInline());
+
+	b.Clear();
+	ASSERT_TRUE(b.empty());
+	ASSERT_STREQ(b.c_str(), "");
+}
+
+TEST(SmallStringBuilder, Spill)
+{
+	SmallStringBuilder<8> b;
+	std::string expected;
+
+	for (unsigned i = 0; i < 1000; ++i) {
+		b.Append("abc");
+		expected += "abc";
+	}
+
+	ASSERT_FALSE(b.IsInline());
+	ASSERT_EQ(b.size(), expected.size());
+	ASSERT_EQ(std::string(b.c_str()), expected);
+	ASSERT_TRUE(b.GetView().Equals(expected.c_str()));
+
+	/* the heap buffer is kept */
+	b.Clear();
+	ASSERT_FALSE(b.IsInline());
+	b.Append("x");
+	ASSERT_STREQ(b.c_str(), "x");
+}
+
+TEST(SmallStringBuilder, Move)
+{
+	SmallStringBuilder<8> a;
+	a.Append("abc");
+
+	SmallStringBuilder<8> b(std::move(a));
+	ASSERT_TRUE(b.IsInline());
+	ASSERT_STREQ(b.c_str(), "abc");
+	ASSERT_TRUE(a.empty());
+
+	b.Append("defghijkl");
+	ASSERT_FALSE(b.IsInline());
+
+	SmallStringBuilder<8> c(std::move(b));
+	ASSERT_FALSE(c.IsInline());
+	ASSERT_STREQ(c.c_str(), "abcdefghijkl");
+	ASSERT_TRUE(b.IsInline());
+	ASSERT_TRUE(b.empty());
+
+	b.Append("x");
+	ASSERT_STREQ(b.c_str(), "x");
+}
+
+TEST(SmallStringBuilder, Integer)
+{
+	SmallStringBuilder<> b;
+	b.AppendUnsigned(0);
+	b.Append(' ');
+	b.AppendUnsigned(7);
+	b.Append(' ');
+	b.AppendUnsigned(42);
+	b.Append(' ');
+	b.AppendUnsigned(100);
+	b.Append(' ');
+	b.AppendUnsigned(1234567);
+	b.Append(' ');
+	b.AppendUnsigned(UINT64_MAX);
+	b.Append(' ');
+	b.AppendSigned(-1);
+	b.Append(' ');
+	b.AppendSigned(INT64_MIN);
+	b.Append(' ');
+	b.AppendSigned(INT64_MAX);
+
+	ASSERT_STREQ(b.c_str(),
+		     "0 7 42 100 1234567 18446744073709551615 -1 "
+		     "-9223372036854775808 9223372036854775807");
+
+	for (uint64_t i = 0; i < 100000; i = i * 3 + 1) {
+		b.Clear();
+		b.AppendUnsigned(i);
+		ASSERT_EQ(std::string(b.c_str()), std::to_string(i));
+	}
+}
+
+TEST(SmallStringBuilder, Escaped)
+{
+	SmallStringBuilder<4> b;
+	b.AppendEscaped("");
+	ASSERT_STREQ(b.c_str(), "");
+
+	b.AppendEscaped("harmless string");
+	ASSERT_STREQ(b.c_str(), "harmless string");
+
+	b.Clear();
+	b.AppendEscaped("a\"b\\c\nd\x7f\xc3\xa4");
+	ASSERT_STREQ(b.c_str(), "a\\x22b\\x5Cc\\x0Ad\x7f\\xC3\\xA4");
+}
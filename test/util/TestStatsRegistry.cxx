@@ -0,0 +1,140 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/StatsRegistry.hxx"
+#include "util/PrometheusStatsWriter.hxx"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+TEST(StatsRegistryTest, Counter)
+{
+	StatsCounter counter;
+	EXPECT_EQ(counter.Get(), 0u);
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < 4; ++i)
+		threads.emplace_back([&counter](){
+				for (unsigned j = 0; j < 10000; ++j)
+					counter.Add();
+			});
+
+	for (auto &t : threads)
+		t.join();
+
+	counter.Add(5);
+	EXPECT_EQ(counter.Get(), 40005u);
+}
+
+TEST(StatsRegistryTest, Histogram)
+{
+	StatsHistogram<> h;
+
+	std::thread t([&h](){
+			for (unsigned i = 0; i < 100; ++i)
+				h.Add(1);
+		});
+
+	h.Add(1000);
+	t.join();
+
+	const auto snapshot = h.GetSnapshot();
+	EXPECT_EQ(snapshot.GetTotal(), 101u);
+	EXPECT_EQ(snapshot.GetQuantile(0.5), 1u);
+	EXPECT_EQ(snapshot.GetQuantile(1), 896u);
+}
+
+TEST(StatsRegistryTest, Prometheus)
+{
+	StatsCounter requests;
+	requests.Add(3);
+
+	StatsGauge connections;
+	connections.Add(2);
+	connections.Subtract();
+
+	StatsHistogram<> latency;
+	latency.Add(1);
+	latency.Add(1);
+	latency.Add(5);
+
+	StatsRegistry registry;
+	registry.Add("requests_total", requests, "method=\"GET\"");
+	registry.Add("connections", connections);
+	registry.Add("latency", latency);
+
+	EXPECT_EQ(registry.RenderPrometheus(),
+		  "# TYPE requests_total counter\n"
+		  "requests_total{method=\"GET\"} 3\n"
+		  "# TYPE connections gauge\n"
+		  "connections 1\n"
+		  "# TYPE latency histogram\n"
+		  "latency_bucket{le=\"1\"} 2\n"
+		  "latency_bucket{le=\"5\"} 3\n"
+		  "latency_bucket{le=\"+Inf\"} 3\n"
+		  "latency_sum 7\n"
+		  "latency_count 3\n");
+
+	registry.Remove(&latency);
+	registry.Remove(&connections);
+	EXPECT_EQ(registry.RenderPrometheus(),
+		  "# TYPE requests_total counter\n"
+		  "requests_total{method=\"GET\"} 3\n");
+}
+
+TEST(StatsRegistryTest, Collector)
+{
+	struct MyCollector final : StatsCollector {
+		void Collect(StatsWriter &writer) override {
+			writer.WriteCounter("a_total", "x=\"1\"", 1);
+			writer.WriteCounter("a_total", "x=\"2\"", 2.5);
+		}
+	} collector;
+
+	StatsRegistry registry;
+	registry.Add(collector);
+
+	EXPECT_EQ(registry.RenderPrometheus(),
+		  "# TYPE a_total counter\n"
+		  "a_total{x=\"1\"} 1\n"
+		  "a_total{x=\"2\"} 2.5\n");
+}
+
+TEST(StatsRegistryTest, Label)
+{
+	std::string labels;
+	AppendStatsLabel(labels, "host", "a\"b\\c\nd");
+	AppendStatsLabel(labels, "x", "y");
+	EXPECT_EQ(labels, "host=\"a\\\"b\\\\c\\nd\",x=\"y\"");
+}
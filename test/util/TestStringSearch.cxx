@@ -0,0 +1,113 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/StringView.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+static size_t
+Position(StringView s, const char *p)
+{
+	return p != nullptr ? size_t(p - s.data) : std::string::npos;
+}
+
+TEST(StringSearch, FindAnyOf)
+{
+	const StringView s("The quick brown fox jumps over the lazy dog; 0123456789");
+
+	EXPECT_EQ(Position(s, s.FindAnyOf("q")), 4u);
+	EXPECT_EQ(Position(s, s.FindAnyOf("xz")), 18u);
+	EXPECT_EQ(Position(s, s.FindAnyOf(";9")), 43u);
+	EXPECT_EQ(Position(s, s.FindAnyOf("9")), s.size - 1);
+	EXPECT_EQ(s.FindAnyOf("!?"), nullptr);
+	EXPECT_EQ(s.FindAnyOf(""), nullptr);
+
+	/* a set which is too large for vector registers */
+	EXPECT_EQ(Position(s, s.FindAnyOf("!\"#$%&'()*+,-./:;<=>?@[]^_{|}~")),
+		  43u);
+	EXPECT_EQ(s.FindAnyOf("!\"#$%&'()*+,-./:<=>?@[]^_{|}~"), nullptr);
+}
+
+TEST(StringSearch, FindFirstNotOf)
+{
+	const StringView s("    \t  \t      \t        \tfoo  ");
+
+	EXPECT_EQ(Position(s, s.FindFirstNotOf(" \t")), 24u);
+	EXPECT_EQ(Position(s, s.FindFirstNotOf(" ")), 4u);
+	EXPECT_EQ(Position(s, s.FindFirstNotOf("")), 0u);
+	EXPECT_EQ(StringView("  \t ").FindFirstNotOf(" \t"), nullptr);
+	EXPECT_EQ(Position(s, s.FindFirstNotOf(" \tabcdefghijklmnopqrstuvwxyz")),
+		  std::string::npos);
+}
+
+TEST(StringSearch, IgnoreCase)
+{
+	EXPECT_TRUE(StringView("Content-Security-Policy").EqualsIgnoreCase("content-security-POLICY"));
+	EXPECT_FALSE(StringView("Content-Security-Policy").EqualsIgnoreCase("content-security-POLICX"));
+	EXPECT_FALSE(StringView("abc").EqualsIgnoreCase("abcd"));
+	EXPECT_FALSE(StringView("[").EqualsIgnoreCase("{"));
+	EXPECT_FALSE(StringView("@").EqualsIgnoreCase("`"));
+
+	/* null bytes are compared, too */
+	EXPECT_FALSE(StringView("a\0b", 3).EqualsIgnoreCase(StringView("a\0c", 3)));
+
+	EXPECT_TRUE(StringView("Transfer-Encoding: chunked").StartsWithIgnoreCase("transfer-encoding"));
+	EXPECT_FALSE(StringView("Transfer").StartsWithIgnoreCase("transfer-encoding"));
+}
+
+TEST(StringSearch, Substring)
+{
+	const std::string haystack = std::string(100, 'a') + "needle" +
+		std::string(40, 'a') + "a long needle of more than sixteen bytes!";
+	const StringView s(haystack.data(), haystack.size());
+
+	EXPECT_EQ(Position(s, s.Find(StringView("needle"))), 100u);
+	EXPECT_EQ(Position(s, s.Find(StringView("aneedle"))), 99u);
+	EXPECT_EQ(Position(s, s.Find(StringView("a long needle of more than sixteen bytes!"))),
+		  146u);
+	EXPECT_EQ(Position(s, s.Find(StringView("bytes!"))), s.size - 6);
+	EXPECT_EQ(s.Find(StringView("bytes!!")), nullptr);
+	EXPECT_EQ(s.Find(StringView("needlf")), nullptr);
+	EXPECT_EQ(Position(s, s.Find(StringView(""))), 0u);
+	EXPECT_EQ(StringView("abc").Find(StringView("abcd")), nullptr);
+
+	/* a needle crossing a 16 byte boundary */
+	for (size_t i = 0; i < 40; ++i) {
+		std::string h(64, 'x');
+		h.replace(i, 20, "0123456789abcdefghij");
+		const StringView hs(h.data(), h.size());
+		EXPECT_EQ(Position(hs, hs.Find(StringView("0123456789abcdefghij"))), i);
+		EXPECT_EQ(Position(hs, hs.Find(StringView("9ab"))), i + 9);
+	}
+}
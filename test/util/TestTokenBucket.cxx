@@ -0,0 +1,61 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/TokenBucket.hxx"
+
+#include <gtest/gtest.h>
+
+TEST(TokenBucketTest, Basic)
+{
+    using std::chrono::milliseconds;
+
+    const auto t0 = std::chrono::steady_clock::time_point(std::chrono::seconds(1000));
+
+    TokenBucket b;
+
+    /* a new bucket is full */
+    for (unsigned i = 0; i < 10; ++i)
+        EXPECT_TRUE(b.Check(t0, 100, 10));
+    EXPECT_FALSE(b.Check(t0, 100, 10));
+
+    /* 100 per second = one token per 10 ms */
+    EXPECT_FALSE(b.Check(t0 + milliseconds(5), 100, 10));
+    EXPECT_TRUE(b.Check(t0 + milliseconds(11), 100, 10));
+    EXPECT_FALSE(b.Check(t0 + milliseconds(11), 100, 10));
+
+    /* never more than the burst size */
+    const auto t1 = t0 + std::chrono::seconds(10);
+    EXPECT_DOUBLE_EQ(b.GetTokens(t1, 100, 10), 10);
+    EXPECT_FALSE(b.Check(t1, 100, 10, 11));
+    EXPECT_TRUE(b.Check(t1, 100, 10, 10));
+    EXPECT_FALSE(b.Check(t1, 100, 10));
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2007-2018 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Trace.hxx"
+
+#include <gtest/gtest.h>
+
+TEST(TraceTest, Disabled)
+{
+	Trace::SetSampleRate(0);
+	const auto ctx = Trace::StartTrace();
+	EXPECT_FALSE(ctx.IsSampled());
+
+	{
+		const TraceScope scope(ctx);
+		const TraceSpan span("foo");
+	}
+
+	TraceSpanRecord records[4];
+	EXPECT_EQ(Trace::Drain(records, 4), 0u);
+}
+
+TEST(TraceTest, Spans)
+{
+	Trace::SetSampleRate(1);
+	const auto ctx = Trace::StartTrace();
+	Trace::SetSampleRate(0);
+	ASSERT_TRUE(ctx.IsSampled());
+
+	TraceContext captured;
+
+	{
+		const TraceScope scope(ctx);
+		const TraceSpan outer("outer");
+
+		{
+			const TraceSpan inner("inner");
+			captured = Trace::GetCurrent();
+		}
+	}
+
+	EXPECT_FALSE(Trace::GetCurrent().IsSampled());
+
+	/* continue the trace in a "callback" */
+	{
+		const TraceScope scope(captured);
+		const TraceSpan callback("callback");
+	}
+
+	TraceSpanRecord records[8];
+	ASSERT_EQ(Trace::Drain(records, 8), 3u);
+
+	EXPECT_STREQ(records[0].name, "inner");
+	EXPECT_STREQ(records[1].name, "outer");
+	EXPECT_STREQ(records[2].name, "callback");
+
+	for (unsigned i = 0; i < 3; ++i)
+		EXPECT_EQ(records[i].trace_id, ctx.trace_id);
+
+	EXPECT_EQ(records[1].parent_span_id, 0u);
+	EXPECT_EQ(records[0].parent_span_id, records[1].span_id);
+	EXPECT_EQ(records[2].parent_span_id, records[0].span_id);
+	EXPECT_LE(records[0].duration_ns, records[1].duration_ns);
+
+	EXPECT_EQ(Trace::Drain(records, 8), 0u);
+}
+
+TEST(TraceTest, Overflow)
+{
+	Trace::SetBufferCapacity(2);
+
+	const TraceContext ctx{42, 0};
+	const TraceScope scope(ctx);
+
+	{ const TraceSpan span("a"); }
+	{ const TraceSpan span("b"); }
+	{ const TraceSpan span("c"); }
+
+	TraceSpanRecord records[4];
+	ASSERT_EQ(Trace::Drain(records, 4), 2u);
+	EXPECT_STREQ(records[0].name, "b");
+	EXPECT_STREQ(records[1].name, "c");
+}